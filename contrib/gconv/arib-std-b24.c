@@ -542,6 +542,119 @@ b24_char_conv (int set, unsigned char c1, unsigned char c2, uint32_t *out)
   return 0;
 }
 
+/*
+ * Direct-indexed tables for the graphic sets, filled in from b24_char_conv()
+ * when the module is loaded, so they hold exactly what it converts to.
+ * The 94 (94 * 94 for the 2-byte sets) entries are indexed by the code(s)
+ * minus 0x21. 0 marks the codes left to b24_char_conv() in BODY: the invalid
+ * ones, __UNKNOWN_10646_CHAR and those converting to several characters.
+ */
+static uint32_t b24_tab_ascii[94];
+static uint32_t b24_tab_hira[94];
+static uint32_t b24_tab_kata[94];
+static uint32_t b24_tab_jis0201_kata[94];
+static uint32_t b24_tab_mb[4][94 * 94];
+
+/* Table of each set, indexed by the set code, NULL for the sets without */
+static const uint32_t *b24_tab[256];
+
+static void
+b24_fill_tab (uint32_t *tab, int set, int mb)
+{
+  unsigned char c1, c2;
+  uint32_t out[MAX_NEEDED_OUTPUT];
+
+  for (c1 = 0x21; c1 <= 0x7e; c1++)
+    for (c2 = (mb ? 0x21 : 0); c2 <= (mb ? 0x7e : 0); c2++)
+      {
+	if (b24_char_conv (set, c1, c2, out) != 1
+	    || out[0] == __UNKNOWN_10646_CHAR)
+	  out[0] = 0;
+	*tab++ = out[0];
+      }
+  b24_tab[set] = tab - (mb ? 94 * 94 : 94);
+}
+
+static void __attribute__ ((constructor))
+b24_init_tabs (void)
+{
+  b24_fill_tab (b24_tab_ascii, ASCII_set, 0);
+  b24_tab[ASCII_x_set] = b24_tab[PROP_ASCII_set] = b24_tab_ascii;
+  b24_fill_tab (b24_tab_hira, HIRAGANA_set, 0);
+  b24_tab[PROP_HIRA_set] = b24_tab_hira;
+  b24_fill_tab (b24_tab_kata, KATAKANA_set, 0);
+  b24_tab[PROP_KATA_set] = b24_tab_kata;
+  b24_fill_tab (b24_tab_jis0201_kata, JIS0201_KATA_set, 0);
+
+  b24_fill_tab (b24_tab_mb[0], KANJI_set, 1);
+  b24_fill_tab (b24_tab_mb[1], JISX0213_1_set, 1);
+  b24_fill_tab (b24_tab_mb[2], JISX0213_2_set, 1);
+  b24_fill_tab (b24_tab_mb[3], EXTRA_SYMBOLS_set, 1);
+}
+
+static inline int
+b24_is_mb_set (int set)
+{
+  return set == DRCS0_set || set == KANJI_set || set == JISX0213_1_set
+	 || set == JISX0213_2_set || set == EXTRA_SYMBOLS_set;
+}
+
+/*
+ * Converts the run of spaces and graphic characters starting at *inptrp
+ * through the tables, as long as no single shift is pending. These don't
+ * change the state, so this stops at the first byte BODY has to look at:
+ * control codes, codes without a table entry and 2-byte characters split
+ * over the end of the input.
+ */
+static inline void
+b24_conv_run (const struct state_from *st, const unsigned char **inptrp,
+	      const unsigned char *inend, unsigned char **outptrp,
+	      const unsigned char *outend)
+{
+  const unsigned char *in = *inptrp;
+  unsigned char *out = *outptrp;
+  const uint32_t *tab[2] = { b24_tab[st->g[st->gl]], b24_tab[st->g[st->gr]] };
+  int mb[2] = { b24_is_mb_set (st->g[st->gl]), b24_is_mb_set (st->g[st->gr]) };
+
+  while (in < inend && out + 4 <= outend)
+    {
+      unsigned char c = *in & 0x7f;
+      int half = *in >> 7;
+      uint32_t val;
+
+      if (c == 0x20)
+	val = *in;
+      else if (c < 0x21 || c > 0x7e || !tab[half])
+	break;
+      else if (mb[half])
+	{
+	  unsigned char c2;
+
+	  if (in + 1 >= inend || (in[1] >> 7) != half)
+	    break;
+	  c2 = in[1] & 0x7f;
+	  if (c2 < 0x21 || c2 > 0x7e)
+	    break;
+	  val = tab[half][(c - 0x21) * 94 + c2 - 0x21];
+	  if (val == 0)
+	    break;
+	  in++;
+	}
+      else
+	{
+	  val = tab[half][c - 0x21];
+	  if (val == 0)
+	    break;
+	}
+      in++;
+      memcpy (out, &val, 4);
+      out += 4;
+    }
+
+  *inptrp = in;
+  *outptrp = out;
+}
+
 #define BODY \
   {									      \
     uint32_t ch = *inptr;						      \
@@ -760,6 +873,15 @@ b24_char_conv (int set, unsigned char c1, unsigned char c2, uint32_t *out)
       {									      \
 	int gidx, set;							      \
 									      \
+	if (st.ss == 0 && (ch & 0x60))					      \
+	  {								      \
+	    const unsigned char *run = inptr;				      \
+									      \
+	    b24_conv_run (&st, &inptr, inend, &outptr, outend);	      \
+	    if (inptr != run)						      \
+	      continue;							      \
+	  }								      \
+									      \
 	if (__glibc_unlikely (!(ch & 0x60))) /* C0/C1 */		      \
 	  {								      \
 	    if (ch == ESC)						      \
@@ -839,8 +961,7 @@ b24_char_conv (int set, unsigned char c1, unsigned char c2, uint32_t *out)
 									      \
 	gidx = (st.ss) ? st.ss : (ch & 0x80) ? st.gr : st.gl;		      \
 	set = st.g[gidx];						      \
-	if (set == DRCS0_set || set == KANJI_set || set == JISX0213_1_set     \
-	    || set == JISX0213_2_set || set == EXTRA_SYMBOLS_set)	      \
+	if (b24_is_mb_set (set))					      \
 	  {								      \
 	    st.mode = MB_2ND;						      \
 	    st.prev = ch;						      \
@@ -0,0 +1,612 @@
+/*
+ * dvb-parse-bench: benchmark the libdvbv5 table and descriptor parsers
+ * without a device
+ *
+ * Copyright 2026 The v4l-utils authors
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2.1 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * The PAT, PMT, NIT, SDT and EIT sections are extracted from a recorded
+ * MPEG-TS, like the ones of dvbv5-zap -P -o, and then parsed in a loop:
+ *
+ *	- each table type with its dvb_table_initializers[] parser;
+ *	- all of them with the raw section views, without decoding the
+ *	  descriptors;
+ *	- each descriptor type found on them with dvb_desc_parse().
+ *
+ * The parsers allocate on the heap, or on a parse arena with -a.
+ *
+ * The malloc(), calloc() and realloc() calls are counted as well, to see
+ * how many allocations each section or descriptor costs.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include <libdvbv5/dvb-fe.h>
+#include <libdvbv5/descriptors.h>
+#include <libdvbv5/crc32.h>
+#include <libdvbv5/mpeg_ts.h>
+#include <libdvbv5/pat.h>
+#include <libdvbv5/pmt.h>
+#include <libdvbv5/nit.h>
+#include <libdvbv5/sdt.h>
+#include <libdvbv5/eit.h>
+
+#define TS_PACKET_SIZE	188
+#define TS_NUM_PIDS	8192
+
+static unsigned long num_allocs;
+
+#ifdef __GLIBC__
+/* Counts the allocations done by libdvbv5, by overriding glibc's ones */
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t nmemb, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+
+void *malloc(size_t size)
+{
+	num_allocs++;
+	return __libc_malloc(size);
+}
+
+void *calloc(size_t nmemb, size_t size)
+{
+	num_allocs++;
+	return __libc_calloc(nmemb, size);
+}
+
+void *realloc(void *ptr, size_t size)
+{
+	num_allocs++;
+	return __libc_realloc(ptr, size);
+}
+#define HAVE_ALLOC_COUNT 1
+#else
+#define HAVE_ALLOC_COUNT 0
+#endif
+
+struct section {
+	uint16_t len;
+	uint8_t *data;
+};
+
+struct section_list {
+	const char *name;
+	unsigned num, max;
+	struct section *sections;
+};
+
+enum { PAT, PMT, NIT, SDT, EIT, NUM_TABLES };
+
+static struct section_list tables[NUM_TABLES] = {
+	[PAT] = { "PAT" },
+	[PMT] = { "PMT" },
+	[NIT] = { "NIT" },
+	[SDT] = { "SDT" },
+	[EIT] = { "EIT" },
+};
+
+/* The descriptors found on the sections, by their tag */
+struct desc_list {
+	unsigned num, max;
+	const uint8_t **desc;
+};
+
+static struct desc_list descs[256];
+
+/* PSI section reassembly, for the PIDs with the wanted tables */
+struct pid_state {
+	uint8_t buf[4096];
+	unsigned len, size;
+	int active, cc;
+};
+
+static struct pid_state *pids[TS_NUM_PIDS];
+static uint8_t is_pmt_pid[TS_NUM_PIDS];
+static unsigned crc_errors;
+
+static unsigned min_ms = 200;
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void quiet_log(int level, const char *fmt, ...)
+{
+}
+
+static int table_type(int pid, uint8_t tid)
+{
+	switch (pid) {
+	case 0x0000:
+		return tid == DVB_TABLE_PAT ? PAT : -1;
+	case 0x0010:
+		return tid == DVB_TABLE_NIT || tid == DVB_TABLE_NIT2 ? NIT : -1;
+	case 0x0011:
+		return tid == DVB_TABLE_SDT || tid == DVB_TABLE_SDT2 ? SDT : -1;
+	case 0x0012:
+		return tid >= DVB_TABLE_EIT &&
+		       tid <= DVB_TABLE_EIT_SCHEDULE_OTHER + 0xf ? EIT : -1;
+	}
+	return is_pmt_pid[pid] && tid == DVB_TABLE_PMT ? PMT : -1;
+}
+
+static void add_section(int pid, const uint8_t *buf, unsigned len)
+{
+	struct section_list *l;
+	unsigned i;
+	int type;
+
+	type = table_type(pid, buf[0]);
+	if (type < 0)
+		return;
+	if (dvb_crc32((uint8_t *)buf, len, 0xFFFFFFFF)) {
+		crc_errors++;
+		return;
+	}
+
+	/* The PMT PIDs come from the PAT */
+	if (type == PAT)
+		for (i = 8; i + 4 <= len - DVB_CRC_SIZE; i += 4)
+			if (buf[i] || buf[i + 1])
+				is_pmt_pid[((buf[i + 2] & 0x1f) << 8) | buf[i + 3]] = 1;
+
+	l = &tables[type];
+	if (l->num == l->max) {
+		l->max = l->max ? l->max * 2 : 256;
+		l->sections = realloc(l->sections, l->max * sizeof(*l->sections));
+		if (!l->sections) {
+			fprintf(stderr, "out of memory\n");
+			exit(1);
+		}
+	}
+	l->sections[l->num].len = len;
+	l->sections[l->num].data = malloc(len);
+	if (!l->sections[l->num].data) {
+		fprintf(stderr, "out of memory\n");
+		exit(1);
+	}
+	memcpy(l->sections[l->num].data, buf, len);
+	l->num++;
+}
+
+static void pid_copy(int pid, struct pid_state *s, const uint8_t *p,
+		     const uint8_t *end)
+{
+	unsigned n;
+
+	while (s->active && p < end) {
+		n = s->size ? s->size - s->len : 3 - s->len;
+		if (n > end - p)
+			n = end - p;
+		memcpy(s->buf + s->len, p, n);
+		s->len += n;
+		p += n;
+
+		if (!s->size && s->len == 3) {
+			s->size = 3 + (((s->buf[1] & 0x0f) << 8) | s->buf[2]);
+			if (s->size > sizeof(s->buf) || s->size < 8 + DVB_CRC_SIZE) {
+				s->active = 0;
+				break;
+			}
+		}
+		if (s->size && s->len == s->size) {
+			add_section(pid, s->buf, s->len);
+			s->active = p < end && *p != 0xff;
+			s->len = 0;
+			s->size = 0;
+		}
+	}
+}
+
+static void ts_packet(const uint8_t *pkt)
+{
+	int pid = ((pkt[1] & 0x1f) << 8) | pkt[2];
+	const uint8_t *p = pkt + 4, *end = pkt + TS_PACKET_SIZE;
+	struct pid_state *s;
+	unsigned ptr;
+	int cc = pkt[3] & 0x0f;
+
+	if (pid > 0x12 && !is_pmt_pid[pid])
+		return;
+	if ((pkt[1] & 0x80) || !(pkt[3] & 0x10))
+		return;
+	if (pkt[3] & 0x20)
+		p += 1 + pkt[4];
+	if (p >= end)
+		return;
+
+	s = pids[pid];
+	if (!s) {
+		s = calloc(1, sizeof(*s));
+		if (!s) {
+			fprintf(stderr, "out of memory\n");
+			exit(1);
+		}
+		pids[pid] = s;
+	}
+	if (s->active && cc != ((s->cc + 1) & 0x0f))
+		s->active = 0;
+	s->cc = cc;
+
+	if (pkt[1] & 0x40) {
+		ptr = *p++;
+		if (ptr >= end - p) {
+			s->active = 0;
+			return;
+		}
+		pid_copy(pid, s, p, p + ptr);
+		p += ptr;
+		s->active = *p != 0xff;
+		s->len = 0;
+		s->size = 0;
+	}
+	pid_copy(pid, s, p, end);
+}
+
+static int load_ts(const char *fname)
+{
+	uint8_t *buf, *p;
+	struct stat st;
+	size_t left;
+	unsigned i;
+	int fd;
+
+	fd = open(fname, O_RDONLY);
+	if (fd < 0 || fstat(fd, &st)) {
+		fprintf(stderr, "cannot open %s: %s\n", fname, strerror(errno));
+		return -1;
+	}
+	buf = malloc(st.st_size);
+	if (!buf || read(fd, buf, st.st_size) != st.st_size) {
+		fprintf(stderr, "cannot read %s\n", fname);
+		close(fd);
+		return -1;
+	}
+	close(fd);
+
+	for (p = buf, left = st.st_size; left >= TS_PACKET_SIZE; ) {
+		if (p[0] != DVB_MPEG_TS) {
+			p++;
+			left--;
+			continue;
+		}
+		ts_packet(p);
+		p += TS_PACKET_SIZE;
+		left -= TS_PACKET_SIZE;
+	}
+	free(buf);
+	for (i = 0; i < TS_NUM_PIDS; i++)
+		free(pids[i]);
+	return 0;
+}
+
+static void add_descs(const uint8_t *buf, uint16_t len)
+{
+	struct dvb_desc_iter iter;
+	struct dvb_desc_view view;
+	struct desc_list *l;
+
+	dvb_desc_iter_init(&iter, buf, len);
+	while (dvb_desc_iter_next(&iter, &view) > 0) {
+		l = &descs[view.type];
+		if (l->num == l->max) {
+			l->max = l->max ? l->max * 2 : 64;
+			l->desc = realloc(l->desc, l->max * sizeof(*l->desc));
+			if (!l->desc) {
+				fprintf(stderr, "out of memory\n");
+				exit(1);
+			}
+		}
+		l->desc[l->num++] = view.data - 2;
+	}
+}
+
+/* The NIT has no view: walk its loops by hand */
+static void nit_descs(const uint8_t *buf, unsigned len)
+{
+	const uint8_t *p = buf + 10, *end = buf + len - DVB_CRC_SIZE;
+	unsigned n;
+
+	n = ((buf[8] & 0x0f) << 8) | buf[9];
+	if (p + n + 2 > end)
+		return;
+	add_descs(p, n);
+	p += n + 2;
+	while (p + 6 <= end) {
+		n = ((p[4] & 0x0f) << 8) | p[5];
+		p += 6;
+		if (p + n > end)
+			return;
+		add_descs(p, n);
+		p += n;
+	}
+}
+
+/*
+ * Walks all the sections with the views, without allocating nor decoding
+ * anything, and, when collect is set, gathers their descriptors. Returns
+ * the number of descriptors seen.
+ */
+static unsigned walk_views(struct dvb_v5_fe_parms *parms, int collect)
+{
+	struct dvb_table_pmt_stream_view stream;
+	struct dvb_table_sdt_service_view service;
+	struct dvb_table_eit_event_view event;
+	struct dvb_table_view view;
+	struct dvb_desc_iter iter;
+	struct dvb_desc_view desc;
+	unsigned i, count = 0;
+
+#define COUNT_DESCS(_buf, _len)					\
+	do {								\
+		if (collect)						\
+			add_descs(_buf, _len);				\
+		dvb_desc_iter_init(&iter, _buf, _len);			\
+		while (dvb_desc_iter_next(&iter, &desc) > 0)		\
+			count++;					\
+	} while (0)
+
+	for (i = 0; i < tables[PMT].num; i++) {
+		struct section *s = &tables[PMT].sections[i];
+
+		if (dvb_table_pmt_view_init(parms, s->data, s->len, &view, NULL))
+			continue;
+		COUNT_DESCS(view.desc, view.desc_length);
+		while (dvb_table_pmt_view_next(&view, &stream) > 0)
+			COUNT_DESCS(stream.desc, stream.desc_length);
+	}
+	for (i = 0; i < tables[SDT].num; i++) {
+		struct section *s = &tables[SDT].sections[i];
+
+		if (dvb_table_sdt_view_init(parms, s->data, s->len, &view))
+			continue;
+		while (dvb_table_sdt_view_next(&view, &service) > 0)
+			COUNT_DESCS(service.desc, service.desc_length);
+	}
+	for (i = 0; i < tables[EIT].num; i++) {
+		struct section *s = &tables[EIT].sections[i];
+
+		if (dvb_table_eit_view_init(parms, s->data, s->len, &view, NULL))
+			continue;
+		while (dvb_table_eit_view_next(&view, &event) > 0)
+			COUNT_DESCS(event.desc, event.desc_length);
+	}
+	if (collect)
+		for (i = 0; i < tables[NIT].num; i++)
+			nit_descs(tables[NIT].sections[i].data,
+				  tables[NIT].sections[i].len);
+	return count;
+}
+
+static void table_free(int type, void *table)
+{
+	switch (type) {
+	case PAT:
+		dvb_table_pat_free(table);
+		break;
+	case PMT:
+		dvb_table_pmt_free(table);
+		break;
+	case NIT:
+		dvb_table_nit_free(table);
+		break;
+	case SDT:
+		dvb_table_sdt_free(table);
+		break;
+	case EIT:
+		dvb_table_eit_free(table);
+		break;
+	}
+}
+
+static void print_result(unsigned long items, uint64_t ns,
+			 unsigned long allocs)
+{
+	printf("%12.0f  %12.1f", items * 1e9 / ns, (double)ns / items);
+	if (HAVE_ALLOC_COUNT)
+		printf("  %12.2f\n", (double)allocs / items);
+	else
+		printf("  %12s\n", "-");
+}
+
+static void bench_tables(struct dvb_v5_fe_parms *parms,
+			 struct dvb_parse_arena *arena)
+{
+	unsigned long items, allocs;
+	uint64_t start, end;
+	unsigned t, i, runs;
+
+	printf("%-6s  %8s  %12s  %12s  %12s\n", "table", "sections",
+	       "sections/s", "ns/section", "allocs/sect");
+	for (t = 0; t < NUM_TABLES; t++) {
+		struct section_list *l = &tables[t];
+
+		if (!l->num)
+			continue;
+		runs = 0;
+		allocs = num_allocs;
+		start = now_ns();
+		do {
+			for (i = 0; i < l->num; i++) {
+				struct section *s = &l->sections[i];
+				void *table = NULL;
+
+				dvb_table_initializers[s->data[0]](parms, s->data,
+								   s->len - DVB_CRC_SIZE,
+								   &table);
+				/* The arena is released at once, below */
+				if (table && !arena)
+					table_free(t, table);
+			}
+			if (arena)
+				dvb_parse_arena_reset(arena);
+			runs++;
+			end = now_ns();
+		} while (runs < 3 || end - start < min_ms * 1000000ULL);
+		allocs = num_allocs - allocs;
+
+		items = (unsigned long)l->num * runs;
+		printf("%-6s  %8u  ", l->name, l->num);
+		print_result(items, end - start, allocs);
+	}
+
+	/* The same sections, but just walking them, as the EPG code does */
+	items = tables[PMT].num + tables[SDT].num + tables[EIT].num;
+	if (items) {
+		runs = 0;
+		allocs = num_allocs;
+		start = now_ns();
+		do {
+			walk_views(parms, 0);
+			runs++;
+			end = now_ns();
+		} while (runs < 3 || end - start < min_ms * 1000000ULL);
+		allocs = num_allocs - allocs;
+		printf("%-6s  %8lu  ", "views", items);
+		print_result(items * runs, end - start, allocs);
+	}
+}
+
+static void bench_descs(struct dvb_v5_fe_parms *parms,
+			struct dvb_parse_arena *arena)
+{
+	unsigned long items, allocs;
+	uint64_t start, end;
+	unsigned t, i, runs;
+
+	printf("\n%-4s  %-32s  %8s  %12s  %12s  %12s\n", "tag", "descriptor",
+	       "count", "descs/s", "ns/desc", "allocs/desc");
+	for (t = 0; t < 256; t++) {
+		struct desc_list *l = &descs[t];
+
+		if (!l->num)
+			continue;
+		runs = 0;
+		allocs = num_allocs;
+		start = now_ns();
+		do {
+			for (i = 0; i < l->num; i++) {
+				struct dvb_desc *list = NULL;
+
+				dvb_desc_parse(parms, l->desc[i], 2 + l->desc[i][1],
+					       &list);
+				dvb_desc_free(&list);
+			}
+			if (arena)
+				dvb_parse_arena_reset(arena);
+			runs++;
+			end = now_ns();
+		} while (runs < 3 || end - start < min_ms * 1000000ULL);
+		allocs = num_allocs - allocs;
+
+		items = (unsigned long)l->num * runs;
+		printf("0x%02x  %-32.32s  %8u  ", t,
+		       dvb_descriptors[t].name ? dvb_descriptors[t].name : "-",
+		       l->num);
+		print_result(items, end - start, allocs);
+	}
+}
+
+static void usage(void)
+{
+	fprintf(stderr,
+		"usage: dvb-parse-bench [options] <file.ts>\n"
+		"  -a, --arena      parse on a parse arena, instead of on the heap\n"
+		"  -t, --time <ms>  the minimum time to run each benchmark (default 200)\n");
+}
+
+int main(int argc, char **argv)
+{
+	static const struct option long_options[] = {
+		{ "arena", no_argument, 0, 'a' },
+		{ "time", required_argument, 0, 't' },
+		{ "help", no_argument, 0, 'h' },
+		{ 0, 0, 0, 0 }
+	};
+	struct dvb_parse_arena *arena = NULL;
+	struct dvb_v5_fe_parms *parms;
+	unsigned t, total = 0;
+	int use_arena = 0;
+	int ch;
+
+	while ((ch = getopt_long(argc, argv, "at:h",
+				 long_options, NULL)) != -1) {
+		switch (ch) {
+		case 'a':
+			use_arena = 1;
+			break;
+		case 't':
+			min_ms = strtoul(optarg, NULL, 0);
+			break;
+		default:
+			usage();
+			return ch == 'h' ? 0 : 1;
+		}
+	}
+	if (optind != argc - 1) {
+		usage();
+		return 1;
+	}
+
+	parms = dvb_fe_dummy();
+	if (!parms) {
+		fprintf(stderr, "out of memory\n");
+		return 1;
+	}
+	parms->logfunc = quiet_log;
+
+	if (load_ts(argv[optind]))
+		return 1;
+	for (t = 0; t < NUM_TABLES; t++)
+		total += tables[t].num;
+	if (!total) {
+		fprintf(stderr, "no PAT, PMT, NIT, SDT or EIT sections found\n");
+		return 1;
+	}
+	printf("%u sections", total);
+	for (t = 0; t < NUM_TABLES; t++)
+		printf(", %u %s", tables[t].num, tables[t].name);
+	printf(" (%u with CRC errors skipped)\n\n", crc_errors);
+
+	if (use_arena) {
+		arena = dvb_parse_arena_alloc(0);
+		if (!arena) {
+			fprintf(stderr, "out of memory\n");
+			return 1;
+		}
+		dvb_parse_set_arena(parms, arena);
+	}
+	bench_tables(parms, arena);
+	walk_views(parms, 1);
+	bench_descs(parms, arena);
+	if (arena) {
+		dvb_parse_set_arena(parms, NULL);
+		dvb_parse_arena_free(arena);
+	}
+
+	dvb_fe_close(parms);
+	return 0;
+}
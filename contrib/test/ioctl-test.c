@@ -14,6 +14,15 @@
 
    	gcc -o ioctl-test32 ioctl-test.c -I../../include -m32
 
+   (or 'make ioctl-test-32').
+
+   With --time it instead measures the latency of a set of ioctls over
+   many iterations and reports percentiles. Adding --compat with the path
+   of the 32-bit executable runs the same measurements through it as well
+   and compares them, to see what the compat layer costs:
+
+	ioctl-test --time 1000000 --compat ./ioctl-test-32 /dev/video0
+
    Copyright (C) 2005-2013 Mauro Carvalho Chehab
 
    This program is free software; you can redistribute it and/or modify
@@ -32,9 +41,12 @@
  */
 
 #include <stdio.h>
+#include <stdlib.h>
 #include <unistd.h>
 #include <string.h>
 #include <errno.h>
+#include <getopt.h>
+#include <time.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <sys/ioctl.h>
@@ -42,8 +54,453 @@
 
 #include "ioctl-test.h"
 
+/* Percentiles reported by the timing mode, in tenths of a percent */
+static const unsigned pcts[] = { 0, 500, 900, 990, 999, 1000 };
+#define N_PCTS (sizeof(pcts) / sizeof(pcts[0]))
+
+struct lat {
+	char name[32];
+	u_int32_t *ns;
+	unsigned calls;
+	unsigned errors;
+	int first_errno;
+	double pct[N_PCTS];
+};
+
+#define MAX_LATS 16
+
+static struct lat lats[MAX_LATS];
+static unsigned n_lats;
+static unsigned iterations;
+
+static inline unsigned long long now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static struct lat *lat_new(const char *name)
+{
+	struct lat *l = &lats[n_lats];
+
+	if (n_lats == MAX_LATS)
+		return NULL;
+	memset(l, 0, sizeof(*l));
+	snprintf(l->name, sizeof(l->name), "%s", name);
+	l->ns = malloc(iterations * sizeof(*l->ns));
+	if (!l->ns) {
+		fprintf(stderr, "out of memory\n");
+		return NULL;
+	}
+	n_lats++;
+	return l;
+}
+
+static int timed_ioctl(struct lat *l, int fd, unsigned long cmd, void *arg)
+{
+	unsigned long long start = now_ns();
+	unsigned long long ns;
+	int ret = ioctl(fd, cmd, arg);
+
+	ns = now_ns() - start;
+	l->ns[l->calls++] = ns > 0xffffffff ? 0xffffffff : ns;
+	if (ret < 0 && !l->errors++)
+		l->first_errno = errno;
+	return ret;
+}
+
+static int cmp_u32(const void *a, const void *b)
+{
+	u_int32_t x = *(const u_int32_t *)a;
+	u_int32_t y = *(const u_int32_t *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+/* Turn the samples into percentiles and drop them */
+static void lat_done(struct lat *l)
+{
+	unsigned i;
+
+	if (l->calls) {
+		qsort(l->ns, l->calls, sizeof(*l->ns), cmp_u32);
+		for (i = 0; i < N_PCTS; i++)
+			l->pct[i] = l->ns[(unsigned long long)(l->calls - 1) * pcts[i] / 1000];
+	}
+	free(l->ns);
+	l->ns = NULL;
+}
+
+static int find_type(int fd, u_int32_t *type)
+{
+	struct v4l2_capability cap;
+	u_int32_t caps;
+
+	memset(&cap, 0, sizeof(cap));
+	if (ioctl(fd, VIDIOC_QUERYCAP, &cap))
+		return -1;
+	caps = (cap.capabilities & V4L2_CAP_DEVICE_CAPS) ?
+		cap.device_caps : cap.capabilities;
+	if (caps & V4L2_CAP_VIDEO_CAPTURE)
+		*type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+	else if (caps & V4L2_CAP_VIDEO_CAPTURE_MPLANE)
+		*type = V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE;
+	else if (caps & V4L2_CAP_VIDEO_OUTPUT)
+		*type = V4L2_BUF_TYPE_VIDEO_OUTPUT;
+	else if (caps & V4L2_CAP_VIDEO_OUTPUT_MPLANE)
+		*type = V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE;
+	else
+		return -1;
+	return (caps & V4L2_CAP_STREAMING) ? 1 : 0;
+}
+
+/* The cost of taking the timestamps themselves */
+static void time_clock(int fd)
+{
+	struct lat *l = lat_new("clock_gettime");
+	unsigned i;
+
+	for (i = 0; l && i < iterations; i++) {
+		unsigned long long start = now_ns();
+
+		l->ns[l->calls++] = now_ns() - start;
+	}
+	if (l)
+		lat_done(l);
+}
+
+static void time_querycap(int fd)
+{
+	struct lat *l = lat_new("VIDIOC_QUERYCAP");
+	struct v4l2_capability cap;
+	unsigned i;
+
+	for (i = 0; l && i < iterations; i++)
+		timed_ioctl(l, fd, VIDIOC_QUERYCAP, &cap);
+	if (l)
+		lat_done(l);
+}
+
+static void time_g_fmt(int fd)
+{
+	struct lat *l;
+	struct v4l2_format fmt;
+	u_int32_t type;
+	unsigned i;
+
+	if (find_type(fd, &type) < 0)
+		return;
+	l = lat_new("VIDIOC_G_FMT");
+	for (i = 0; l && i < iterations; i++) {
+		fmt.type = type;
+		timed_ioctl(l, fd, VIDIOC_G_FMT, &fmt);
+	}
+	if (l)
+		lat_done(l);
+}
+
+static void time_enum_fmt(int fd)
+{
+	struct lat *l;
+	struct v4l2_fmtdesc fmtdesc;
+	u_int32_t type;
+	unsigned i;
+
+	if (find_type(fd, &type) < 0)
+		return;
+	l = lat_new("VIDIOC_ENUM_FMT");
+	for (i = 0; l && i < iterations; i++) {
+		memset(&fmtdesc, 0, sizeof(fmtdesc));
+		fmtdesc.type = type;
+		timed_ioctl(l, fd, VIDIOC_ENUM_FMT, &fmtdesc);
+	}
+	if (l)
+		lat_done(l);
+}
+
+static void time_ctrls(int fd)
+{
+	struct v4l2_ext_control ctrl;
+	struct v4l2_ext_controls ctrls;
+	struct v4l2_queryctrl qctrl;
+	struct lat *lq, *lg;
+	unsigned i;
+
+	/* Time the first control that has a value */
+	memset(&qctrl, 0, sizeof(qctrl));
+	qctrl.id = V4L2_CTRL_FLAG_NEXT_CTRL;
+	while (!ioctl(fd, VIDIOC_QUERYCTRL, &qctrl)) {
+		if (qctrl.type == V4L2_CTRL_TYPE_INTEGER ||
+		    qctrl.type == V4L2_CTRL_TYPE_BOOLEAN ||
+		    qctrl.type == V4L2_CTRL_TYPE_MENU)
+			break;
+		qctrl.id |= V4L2_CTRL_FLAG_NEXT_CTRL;
+	}
+	if (qctrl.type != V4L2_CTRL_TYPE_INTEGER &&
+	    qctrl.type != V4L2_CTRL_TYPE_BOOLEAN &&
+	    qctrl.type != V4L2_CTRL_TYPE_MENU)
+		return;
+
+	lq = lat_new("VIDIOC_QUERYCTRL");
+	lg = lat_new("VIDIOC_G_EXT_CTRLS");
+	for (i = 0; lq && lg && i < iterations; i++) {
+		u_int32_t id = qctrl.id & ~V4L2_CTRL_FLAG_NEXT_CTRL;
+
+		memset(&qctrl, 0, sizeof(qctrl));
+		qctrl.id = id;
+		timed_ioctl(lq, fd, VIDIOC_QUERYCTRL, &qctrl);
+
+		memset(&ctrl, 0, sizeof(ctrl));
+		memset(&ctrls, 0, sizeof(ctrls));
+		ctrl.id = id;
+		ctrls.which = V4L2_CTRL_WHICH_CUR_VAL;
+		ctrls.count = 1;
+		ctrls.controls = &ctrl;
+		timed_ioctl(lg, fd, VIDIOC_G_EXT_CTRLS, &ctrls);
+	}
+	if (lq)
+		lat_done(lq);
+	if (lg)
+		lat_done(lg);
+}
+
+/*
+ * Without streaming, QBUF queues the buffer, DQBUF finds nothing done and
+ * fails with EAGAIN and STREAMOFF gives the buffer back, so this times the
+ * buffer ioctls, including the translation of struct v4l2_buffer by the
+ * compat layer, without depending on the frame rate.
+ */
+static void time_buffers(int fd)
+{
+	struct v4l2_plane planes[VIDEO_MAX_PLANES];
+	struct v4l2_requestbuffers req;
+	struct v4l2_buffer buf;
+	struct lat *lqu, *lq, *ldq, *loff;
+	u_int32_t type;
+	int mplane;
+	unsigned i;
+
+	if (find_type(fd, &type) <= 0)
+		return;
+	mplane = type == V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE ||
+		 type == V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE;
+
+	memset(&req, 0, sizeof(req));
+	req.count = 1;
+	req.type = type;
+	req.memory = V4L2_MEMORY_MMAP;
+	if (ioctl(fd, VIDIOC_REQBUFS, &req) || !req.count) {
+		perror("VIDIOC_REQBUFS");
+		return;
+	}
+
+	lqu = lat_new("VIDIOC_QUERYBUF");
+	lq = lat_new("VIDIOC_QBUF");
+	ldq = lat_new("VIDIOC_DQBUF (EAGAIN)");
+	loff = lat_new("VIDIOC_STREAMOFF");
+	for (i = 0; lqu && lq && ldq && loff && i < iterations; i++) {
+		memset(&buf, 0, sizeof(buf));
+		buf.type = type;
+		buf.memory = V4L2_MEMORY_MMAP;
+		if (mplane) {
+			buf.m.planes = planes;
+			buf.length = VIDEO_MAX_PLANES;
+		}
+		timed_ioctl(lqu, fd, VIDIOC_QUERYBUF, &buf);
+		if (type == V4L2_BUF_TYPE_VIDEO_OUTPUT ||
+		    type == V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE)
+			buf.field = V4L2_FIELD_NONE;
+		timed_ioctl(lq, fd, VIDIOC_QBUF, &buf);
+		timed_ioctl(ldq, fd, VIDIOC_DQBUF, &buf);
+		timed_ioctl(loff, fd, VIDIOC_STREAMOFF, &type);
+	}
+	if (lqu)
+		lat_done(lqu);
+	if (lq)
+		lat_done(lq);
+	if (ldq)
+		lat_done(ldq);
+	if (loff)
+		lat_done(loff);
+
+	req.count = 0;
+	ioctl(fd, VIDIOC_REQBUFS, &req);
+}
+
+static const struct {
+	const char *name;
+	void (*func)(int fd);
+} timings[] = {
+	{ "clock", time_clock },
+	{ "querycap", time_querycap },
+	{ "g_fmt", time_g_fmt },
+	{ "enum_fmt", time_enum_fmt },
+	{ "ctrls", time_ctrls },
+	{ "buffers", time_buffers },
+};
+#define N_TIMINGS (sizeof(timings) / sizeof(timings[0]))
+
+static int in_list(const char *list, const char *name)
+{
+	size_t len = strlen(name);
+	const char *s = list;
+
+	while (s && *s) {
+		if (!strncmp(s, name, len) && (s[len] == ',' || !s[len]))
+			return 1;
+		s = strchr(s, ',');
+		if (s)
+			s++;
+	}
+	return 0;
+}
+
+/* Read the results of the --compat executable, printed with --machine */
+static int read_compat(FILE *f, struct lat *compat, unsigned *n_compat)
+{
+	char line[256];
+
+	*n_compat = 0;
+	while (fgets(line, sizeof(line), f) && *n_compat < MAX_LATS) {
+		struct lat *l = &compat[*n_compat];
+		char *tab = strchr(line, '\t');
+		unsigned i;
+		char *p;
+
+		if (!tab)
+			continue;
+		memset(l, 0, sizeof(*l));
+		*tab = 0;
+		snprintf(l->name, sizeof(l->name), "%.*s",
+			 (int)sizeof(l->name) - 1, line);
+		p = tab + 1;
+		l->calls = strtoul(p, &p, 10);
+		l->errors = strtoul(p, &p, 10);
+		for (i = 0; i < N_PCTS; i++)
+			l->pct[i] = strtod(p, &p);
+		(*n_compat)++;
+	}
+	return 0;
+}
+
+static int time_ioctls(const char *device, const char *list, const char *compat_exe,
+		       int machine)
+{
+	struct lat compat[MAX_LATS];
+	unsigned n_compat = 0;
+	unsigned i, j;
+	int fd;
+
+	if ((fd = open(device, O_RDWR | O_NONBLOCK)) < 0 &&
+	    (fd = open(device, O_RDONLY | O_NONBLOCK)) < 0) {
+		fprintf(stderr, "Couldn't open %s\n", device);
+		return -1;
+	}
+	for (i = 0; i < N_TIMINGS; i++)
+		if (!list || in_list(list, timings[i].name))
+			timings[i].func(fd);
+	close(fd);
+
+	if (machine) {
+		for (i = 0; i < n_lats; i++) {
+			printf("%s\t%u %u", lats[i].name, lats[i].calls, lats[i].errors);
+			for (j = 0; j < N_PCTS; j++)
+				printf(" %.0f", lats[i].pct[j]);
+			printf("\n");
+		}
+		return 0;
+	}
+
+	if (compat_exe) {
+		char cmd[1024];
+		FILE *f;
+
+		snprintf(cmd, sizeof(cmd), "'%s' --machine --time %u%s%s '%s'",
+			 compat_exe, iterations, list ? " --ioctls " : "",
+			 list ? list : "", device);
+		f = popen(cmd, "r");
+		if (!f) {
+			perror(compat_exe);
+			return -1;
+		}
+		read_compat(f, compat, &n_compat);
+		if (pclose(f))
+			fprintf(stderr, "%s failed\n", compat_exe);
+	}
+
+	printf("%u iterations, %u-bit\n\n", iterations, (unsigned)sizeof(long) * 8);
+	printf("%-24s %7s", "ioctl (ns)", "errors");
+	for (j = 0; j < N_PCTS; j++) {
+		if (!pcts[j])
+			printf(" %8s", "min");
+		else if (pcts[j] == 1000)
+			printf(" %8s", "max");
+		else if (pcts[j] % 10)
+			printf("    p%u.%u", pcts[j] / 10, pcts[j] % 10);
+		else
+			printf("      p%u", pcts[j] / 10);
+	}
+	printf("\n");
+
+	for (i = 0; i < n_lats; i++) {
+		struct lat *l = &lats[i];
+
+		printf("%-24s %7u", l->name, l->errors);
+		for (j = 0; j < N_PCTS; j++)
+			printf(" %8.0f", l->pct[j]);
+		if (l->errors)
+			printf("  (%s)", strerror(l->first_errno));
+		printf("\n");
+
+		for (j = 0; j < n_compat; j++) {
+			struct lat *c = &compat[j];
+			unsigned k;
+
+			if (strcmp(c->name, l->name))
+				continue;
+			printf("%-24s %7u", "  compat", c->errors);
+			for (k = 0; k < N_PCTS; k++)
+				printf(" %8.0f", c->pct[k]);
+			if (l->pct[1])
+				printf("  p50 x%.2f", c->pct[1] / l->pct[1]);
+			printf("\n");
+		}
+	}
+	return 0;
+}
+
+static void usage(const char *prog)
+{
+	unsigned i;
+
+	printf("Usage: %s [options] [device]\n"
+	       "  -t, --time <iterations>  measure the ioctl latencies instead\n"
+	       "  -i, --ioctls <list>      comma separated measurements to run\n"
+	       "                           (default all):", prog);
+	for (i = 0; i < N_TIMINGS; i++)
+		printf("%s%s", i ? ", " : " ", timings[i].name);
+	printf("\n"
+	       "  -c, --compat <exe>       also measure with this (32-bit) ioctl-test\n"
+	       "  -m, --machine            print the measurements for --compat\n"
+	       "  -h, --help               show this help\n");
+}
+
 int main(int argc, char **argv)
 {
+	static const struct option long_options[] = {
+		{ "time", required_argument, NULL, 't' },
+		{ "ioctls", required_argument, NULL, 'i' },
+		{ "compat", required_argument, NULL, 'c' },
+		{ "machine", no_argument, NULL, 'm' },
+		{ "help", no_argument, NULL, 'h' },
+		{ NULL, 0, NULL, 0 }
+	};
+	const char *list = NULL;
+	const char *compat_exe = NULL;
+	int machine = 0;
+	int opt;
 	int fd = 0;
 	unsigned i;
 	unsigned maxlen = 0;
@@ -58,9 +515,31 @@ int main(int argc, char **argv)
 		"IOWR"
 	};
 
-	if (argv[1])
-		device = argv[1];
-	
+	while ((opt = getopt_long(argc, argv, "t:i:c:mh", long_options, NULL)) != -1) {
+		switch (opt) {
+		case 't':
+			iterations = strtoul(optarg, NULL, 0);
+			break;
+		case 'i':
+			list = optarg;
+			break;
+		case 'c':
+			compat_exe = optarg;
+			break;
+		case 'm':
+			machine = 1;
+			break;
+		case 'h':
+			usage(argv[0]);
+			return 0;
+		default:
+			usage(argv[0]);
+			return -1;
+		}
+	}
+	if (optind < argc)
+		device = argv[optind];
+
 	for (i = 0; i < S_IOCTLS; i++) {
 		unsigned cmp_cmd;
 
@@ -79,6 +558,9 @@ int main(int argc, char **argv)
 	if (cmd_errors)
 		return -1;
 
+	if (iterations)
+		return time_ioctls(device, list, compat_exe, machine);
+
 	if ((fd = open(device, O_RDONLY|O_NONBLOCK)) < 0) {
 		fprintf(stderr, "Couldn't open %s\n", device);
 		return -1;
@@ -0,0 +1,534 @@
+/*
+ * media-pipeline-profile: per stage timing of a media controller pipeline
+ *
+ * Copyright 2026 The v4l-utils authors
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2.1 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * Walks the enabled links of a pipeline set up with media-ctl upstream from
+ * the video node it ends in, such as sensor -> CSI receiver -> ISP -> video
+ * node. Every subdev on the way that supports V4L2_EVENT_FRAME_SYNC (or
+ * else V4L2_EVENT_VSYNC) is subscribed to while capturing from the video
+ * node, and the event timestamps are matched to the buffers:
+ *
+ *   media-ctl -d /dev/media0 -l '"imx219 4-0010":0 -> "csi":0 [1]'
+ *   media-pipeline-profile -m /dev/media0 -n 600
+ *
+ * The frame sequence numbers of the events and of the buffers count from
+ * different starting points, so the first buffer is paired with the last
+ * event of each stage that happened before the buffer timestamp, and the
+ * sequence numbers are matched from then on.
+ *
+ * The report has the frame intervals and the number of dropped frames of
+ * each stage, and the latency from the event of each stage (for the most
+ * upstream one: from the sensor) to the dequeue of the buffer holding that
+ * frame.
+ */
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+#include <getopt.h>
+#include <time.h>
+
+#include "cv4l-helpers.h"
+#include "cv4l-stream-engine.h"
+
+extern "C" {
+#include "mediactl.h"
+}
+
+#define MAX_STAGES	16
+#define EVENT_HISTORY	64
+
+static inline __u64 now_ns()
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+struct stage_event {
+	__u32 sequence;
+	__u64 ts;
+};
+
+struct pipeline_stage {
+	struct media_entity *entity;
+	const char *name;
+	cv4l_fd fd;
+	/* The subscribed event, 0 if the subdev has neither */
+	__u32 event_type;
+	/* The last events, indexed by sequence % EVENT_HISTORY */
+	stage_event history[EVENT_HISTORY];
+	unsigned num_events;
+	__u32 vsync_count;
+	__u32 last_seq;
+	__u64 last_ts;
+	unsigned dropped;
+	/* Buffer sequence - event sequence, once a buffer was paired */
+	bool paired;
+	__u32 seq_offset;
+	std::vector<double> intervals;
+	std::vector<double> latencies;
+};
+
+static pipeline_stage stages[MAX_STAGES];
+static unsigned num_stages;
+
+/* The video node at the end of the pipeline */
+static struct {
+	bool monotonic;
+	bool have_seq;
+	__u32 last_seq;
+	__u64 last_ts;
+	unsigned dropped;
+	std::vector<double> intervals;
+	std::vector<double> ts_to_dq;
+} video;
+
+/* Walk the enabled links upstream from entity, the stages end up source first */
+static bool find_pipeline(struct media_entity *entity)
+{
+	struct media_entity *chain[MAX_STAGES];
+	unsigned n = 0;
+
+	while (entity) {
+		const struct media_entity_desc *info = media_entity_get_info(entity);
+		struct media_entity *next = NULL;
+
+		if (n == MAX_STAGES) {
+			fprintf(stderr, "pipeline has more than %u entities\n", MAX_STAGES);
+			return false;
+		}
+		chain[n++] = entity;
+		for (unsigned i = 0; i < info->pads && !next; i++) {
+			struct media_pad *pad =
+				const_cast<struct media_pad *>(media_entity_get_pad(entity, i));
+			struct media_pad *source;
+
+			if (!(pad->flags & MEDIA_PAD_FL_SINK))
+				continue;
+			source = media_entity_remote_source(pad);
+			if (source)
+				next = source->entity;
+		}
+		for (unsigned i = 0; i < n && next; i++)
+			if (chain[i] == next)
+				next = NULL;
+		entity = next;
+	}
+
+	num_stages = n;
+	for (unsigned i = 0; i < n; i++) {
+		stages[i].entity = chain[n - 1 - i];
+		stages[i].name = media_entity_get_info(stages[i].entity)->name;
+	}
+	return true;
+}
+
+/* Find the video node at the end of the first enabled pipeline */
+static struct media_entity *default_video_node(struct media_device *media)
+{
+	for (unsigned i = 0; i < media_get_entities_count(media); i++) {
+		struct media_entity *entity = media_get_entity(media, i);
+		const struct media_entity_desc *info = media_entity_get_info(entity);
+
+		if (media_entity_type(entity) != MEDIA_ENT_T_DEVNODE ||
+		    info->type != MEDIA_ENT_T_DEVNODE_V4L)
+			continue;
+		for (unsigned p = 0; p < info->pads; p++) {
+			struct media_pad *pad =
+				const_cast<struct media_pad *>(media_entity_get_pad(entity, p));
+
+			if ((pad->flags & MEDIA_PAD_FL_SINK) &&
+			    media_entity_remote_source(pad))
+				return entity;
+		}
+	}
+	return NULL;
+}
+
+static void subscribe_stage(pipeline_stage &s, cv4l_event_loop &loop, __u32 id)
+{
+	static const __u32 types[] = { V4L2_EVENT_FRAME_SYNC, V4L2_EVENT_VSYNC };
+	const char *devname = media_entity_get_devname(s.entity);
+
+	if (media_entity_type(s.entity) != MEDIA_ENT_T_V4L2_SUBDEV || !devname)
+		return;
+	s.fd.s_direct(true);
+	if (s.fd.subdev_open(devname, true) < 0) {
+		fprintf(stderr, "%s: can't open %s: %s\n", s.name, devname, strerror(errno));
+		return;
+	}
+	for (auto type : types) {
+		struct v4l2_event_subscription sub = {};
+
+		sub.type = type;
+		if (!s.fd.subscribe_event(sub)) {
+			s.event_type = type;
+			break;
+		}
+	}
+	if (!s.event_type) {
+		s.fd.close();
+		return;
+	}
+	if (loop.add(s.fd.g_fd(), EPOLLPRI, id)) {
+		fprintf(stderr, "%s: epoll error\n", s.name);
+		s.event_type = 0;
+		s.fd.close();
+	}
+}
+
+static void stage_event_add(pipeline_stage &s, const struct v4l2_event &ev)
+{
+	__u64 ts = ev.timestamp.tv_sec * 1000000000ULL + ev.timestamp.tv_nsec;
+	__u32 seq;
+
+	if (ev.type == V4L2_EVENT_FRAME_SYNC) {
+		seq = ev.u.frame_sync.frame_sequence;
+		if (s.num_events && seq > s.last_seq + 1)
+			s.dropped += seq - s.last_seq - 1;
+	} else if (ev.type == V4L2_EVENT_VSYNC) {
+		seq = s.vsync_count++;
+	} else {
+		return;
+	}
+	if (s.num_events)
+		s.intervals.push_back((double)(__s64)(ts - s.last_ts) / 1e6);
+	s.history[seq % EVENT_HISTORY].sequence = seq;
+	s.history[seq % EVENT_HISTORY].ts = ts;
+	s.last_seq = seq;
+	s.last_ts = ts;
+	s.num_events++;
+}
+
+static void drain_events(pipeline_stage &s)
+{
+	struct v4l2_event ev;
+
+	/* Only dequeue what is pending, DQEVENT blocks on an empty queue */
+	do {
+		if (s.fd.dqevent(ev))
+			break;
+		stage_event_add(s, ev);
+	} while (ev.pending);
+}
+
+/* Match the buffer to the events of the stage, see the top of this file */
+static void stage_buffer_add(pipeline_stage &s, __u32 seq, __u64 ts, __u64 dq)
+{
+	const stage_event *e;
+
+	if (!s.num_events)
+		return;
+	if (!s.paired) {
+		const stage_event *best = NULL;
+
+		for (unsigned i = 0; i < EVENT_HISTORY; i++) {
+			e = &s.history[i];
+			/* A zero timestamp is a slot that wasn't used yet */
+			if (e->ts && e->ts <= ts && (!best || e->ts > best->ts))
+				best = e;
+		}
+		if (!best)
+			return;
+		s.seq_offset = seq - best->sequence;
+		s.paired = true;
+	}
+	e = &s.history[(seq - s.seq_offset) % EVENT_HISTORY];
+	if (e->sequence == seq - s.seq_offset && e->ts <= dq)
+		s.latencies.push_back((dq - e->ts) / 1e6);
+}
+
+class profile_stage : public cv4l_stream_stage {
+public:
+	profile_stage(unsigned frames) : frames(frames) {}
+
+	int process(cv4l_stream_engine &engine, cv4l_stream_buffer &buf)
+	{
+		__u64 dq = now_ns();
+		__u32 seq = buf->g_sequence();
+		__u64 ts = buf->g_timestamp_ns();
+
+		if (buf->g_flags() & V4L2_BUF_FLAG_ERROR)
+			return 1;
+		if (video.have_seq && seq > video.last_seq + 1)
+			video.dropped += seq - video.last_seq - 1;
+		if (video.monotonic) {
+			if (video.have_seq)
+				video.intervals.push_back((double)(__s64)(ts - video.last_ts) / 1e6);
+			if (ts <= dq)
+				video.ts_to_dq.push_back((dq - ts) / 1e6);
+		} else {
+			/* Without a usable timestamp the dequeue time has to do */
+			if (video.have_seq)
+				video.intervals.push_back((double)(dq - video.last_ts) / 1e6);
+			ts = dq;
+		}
+		video.have_seq = true;
+		video.last_seq = seq;
+		video.last_ts = ts;
+
+		for (unsigned i = 0; i < num_stages; i++)
+			stage_buffer_add(stages[i], seq, ts, dq);
+
+		return engine.g_frames() >= frames ? -1 : 0;
+	}
+
+private:
+	unsigned frames;
+};
+
+static void print_row(const char *name, std::vector<double> v)
+{
+	double sum = 0;
+
+	if (v.empty()) {
+		printf("%-32.32s %8s\n", name, "-");
+		return;
+	}
+	std::sort(v.begin(), v.end());
+	for (auto d : v)
+		sum += d;
+	printf("%-32.32s %8.3f %8.3f %8.3f %8.3f %8.3f %8.3f %7zu\n", name,
+	       v.front(), sum / v.size(), v[v.size() / 2],
+	       v[v.size() * 95 / 100], v[v.size() * 99 / 100], v.back(),
+	       v.size());
+}
+
+static void print_results(const char *video_name)
+{
+	bool sensor = true;
+	char label[80];
+
+	printf("\npipeline:");
+	for (unsigned i = 0; i < num_stages; i++)
+		printf("%s \"%s\"", i ? " ->" : "", stages[i].name);
+	printf("\n");
+
+	printf("\n%-32s %8s %8s %8s %8s %8s %8s %7s\n", "frame interval (ms)",
+	       "min", "avg", "p50", "p95", "p99", "max", "frames");
+	for (unsigned i = 0; i + 1 < num_stages; i++) {
+		if (stages[i].event_type)
+			print_row(stages[i].name, stages[i].intervals);
+		else
+			printf("%-32.32s %8s\n", stages[i].name, "no events");
+	}
+	print_row(video_name, video.intervals);
+
+	printf("\n%-32s %8s %8s %8s %8s %8s %8s %7s\n", "latency to dqbuf (ms)",
+	       "min", "avg", "p50", "p95", "p99", "max", "frames");
+	for (unsigned i = 0; i + 1 < num_stages; i++) {
+		if (!stages[i].event_type)
+			continue;
+		snprintf(label, sizeof(label), "%s%s",
+			 sensor ? "sensor: " : "", stages[i].name);
+		sensor = false;
+		print_row(label, stages[i].latencies);
+	}
+	if (video.monotonic)
+		print_row("buffer timestamp", video.ts_to_dq);
+
+	printf("\ndropped frames:");
+	for (unsigned i = 0; i + 1 < num_stages; i++)
+		if (stages[i].event_type == V4L2_EVENT_FRAME_SYNC)
+			printf(" \"%s\" %u,", stages[i].name, stages[i].dropped);
+	printf(" \"%s\" %u\n", video_name, video.dropped);
+}
+
+static void usage(const char *prog)
+{
+	printf("Usage: %s [options]\n"
+	       "  -m, --media <dev>     media device (default /dev/media0)\n"
+	       "  -e, --entity <name>   video node entity the pipeline ends in\n"
+	       "  -d, --device <dev>    the same, by device node (default: the first\n"
+	       "                        video node with an enabled incoming link)\n"
+	       "  -n, --frames <count>  frames to capture (default 300)\n"
+	       "  -b, --buffers <count> buffers to capture into (default 4)\n"
+	       "  -t, --timeout <ms>    stop if no frame arrives for this long (default 2000)\n"
+	       "  -h, --help            show this help\n", prog);
+}
+
+int main(int argc, char **argv)
+{
+	static const struct option long_options[] = {
+		{ "media", required_argument, NULL, 'm' },
+		{ "entity", required_argument, NULL, 'e' },
+		{ "device", required_argument, NULL, 'd' },
+		{ "frames", required_argument, NULL, 'n' },
+		{ "buffers", required_argument, NULL, 'b' },
+		{ "timeout", required_argument, NULL, 't' },
+		{ "help", no_argument, NULL, 'h' },
+		{ NULL, 0, NULL, 0 }
+	};
+	const char *media_dev = "/dev/media0";
+	const char *entity_name = NULL;
+	const char *dev = NULL;
+	unsigned frames = 300;
+	unsigned buffers = 4;
+	int timeout = 2000;
+	struct media_device *media;
+	struct media_entity *entity = NULL;
+	cv4l_fd fd;
+	cv4l_queue q;
+	cv4l_stream_buffer h;
+	int opt;
+	int ret;
+
+	while ((opt = getopt_long(argc, argv, "m:e:d:n:b:t:h", long_options, NULL)) != -1) {
+		switch (opt) {
+		case 'm':
+			media_dev = optarg;
+			break;
+		case 'e':
+			entity_name = optarg;
+			break;
+		case 'd':
+			dev = optarg;
+			break;
+		case 'n':
+			frames = strtoul(optarg, NULL, 0);
+			break;
+		case 'b':
+			buffers = strtoul(optarg, NULL, 0);
+			break;
+		case 't':
+			timeout = strtol(optarg, NULL, 0);
+			break;
+		case 'h':
+			usage(argv[0]);
+			return 0;
+		default:
+			usage(argv[0]);
+			return 1;
+		}
+	}
+
+	media = media_device_new(media_dev);
+	if (!media || media_device_enumerate(media)) {
+		fprintf(stderr, "Failed to enumerate %s\n", media_dev);
+		return 1;
+	}
+	if (entity_name) {
+		entity = media_get_entity_by_name(media, entity_name);
+	} else if (dev) {
+		for (unsigned i = 0; i < media_get_entities_count(media) && !entity; i++) {
+			struct media_entity *e = media_get_entity(media, i);
+			const char *devname = media_entity_get_devname(e);
+
+			if (devname && !strcmp(devname, dev))
+				entity = e;
+		}
+	} else {
+		entity = default_video_node(media);
+	}
+	if (!entity || media_entity_get_info(entity)->type != MEDIA_ENT_T_DEVNODE_V4L) {
+		fprintf(stderr, "no such video node in %s\n", media_dev);
+		return 1;
+	}
+	if (!find_pipeline(entity))
+		return 1;
+	frames = std::max(frames, 1U);
+	for (unsigned i = 0; i < num_stages; i++) {
+		stages[i].intervals.reserve(frames);
+		stages[i].latencies.reserve(frames);
+	}
+	video.intervals.reserve(frames);
+	video.ts_to_dq.reserve(frames);
+
+	dev = media_entity_get_devname(entity);
+	fd.s_direct(true);
+	if (!dev || fd.open(dev, true) < 0) {
+		fprintf(stderr, "Failed to open the video node of \"%s\"\n",
+			media_entity_get_info(entity)->name);
+		return 1;
+	}
+	if (!fd.has_vid_cap() || !fd.has_streaming()) {
+		fprintf(stderr, "%s is not a streaming capture device\n", dev);
+		return 1;
+	}
+
+	q.init(fd.g_type(), V4L2_MEMORY_MMAP);
+	if (q.reqbufs(&fd, buffers) || q.obtain_bufs(&fd)) {
+		perror("capture buffers");
+		return 1;
+	}
+
+	cv4l_stream_engine engine(fd, q);
+	profile_stage profile(frames);
+	cv4l_event_loop &loop = engine.g_event_loop();
+
+	engine.add_stage(&profile);
+	/* The engine uses id 0, so the stages are found with their index + 1 */
+	for (unsigned i = 0; i + 1 < num_stages; i++)
+		subscribe_stage(stages[i], loop, i + 1);
+
+	ret = engine.start();
+	if (ret) {
+		fprintf(stderr, "VIDIOC_STREAMON: %s\n", strerror(ret));
+		return 1;
+	}
+	video.monotonic = false;
+
+	for (;;) {
+		int r = loop.wait(timeout);
+
+		if (r < 0) {
+			perror("epoll");
+			break;
+		}
+		if (r == 0) {
+			fprintf(stderr, "timeout waiting for a frame\n");
+			break;
+		}
+		/* The events go first, so the buffers find the events of their frame */
+		for (unsigned i = 0; i + 1 < num_stages; i++)
+			if (stages[i].event_type && (loop.g_events(i + 1) & EPOLLPRI))
+				drain_events(stages[i]);
+		if (!(loop.g_events(CV4L_STREAM_ENGINE_ID) & EPOLLIN))
+			continue;
+
+		r = 0;
+		while (!(ret = engine.dequeue(h))) {
+			if (engine.g_frames() == 1)
+				video.monotonic = (h->g_flags() & V4L2_BUF_FLAG_TIMESTAMP_MASK) ==
+						  V4L2_BUF_FLAG_TIMESTAMP_MONOTONIC;
+			r = engine.run_stages(h);
+			h.release();
+			if (r < 0)
+				break;
+		}
+		if (r < 0)
+			break;
+		if (ret != EAGAIN) {
+			fprintf(stderr, "VIDIOC_DQBUF: %s\n", strerror(ret));
+			break;
+		}
+	}
+
+	engine.stop();
+	q.free(&fd);
+	fd.close();
+	for (unsigned i = 0; i < num_stages; i++)
+		if (stages[i].event_type)
+			stages[i].fd.close();
+
+	print_results(media_entity_get_info(entity)->name);
+	media_device_unref(media);
+	return 0;
+}
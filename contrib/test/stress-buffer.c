@@ -10,131 +10,977 @@
  *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
  *  GNU General Public License for more details.
  *
- *  stress-buffer tool makes infinite calls using read() for
- *  any device specified by the command argument.
+ *  stress-buffer hammers the buffer handling of a streaming device and
+ *  reports the latency of each ioctl involved, to reproduce contention
+ *  and memory handling issues in the drivers and in videobuf2.
  *
- *  The size of buffer shall be a random number from 0 up to 1000.
+ *  The tests, selected with --tests, are:
  *
- *  Also is automatically created a file called: stats-M-D-Y-h-m-s.txt
- *  in current directory with data executed.
+ *  - read:   open the device, read() a random amount from 0 up to 1000
+ *            bytes and close it again, the original stress-buffer test
+ *  - count:  stream with as many buffers as the driver allows
+ *  - cycle:  repeatedly queue all buffers, STREAMON, wait for a single
+ *            frame and STREAMOFF
+ *  - churn:  allocate a random number of buffers with REQBUFS, add more
+ *            with CREATE_BUFS, mmap and unmap them all and free them again
+ *  - dmabuf: stream into buffers exported by a second device (--export)
  *
- *  The stress test is performed by several read() calls,
- *  and it helped to identify real issues like:
+ *  While the tests run, --ctrl-threads threads each change random
+ *  controls of the device through their own file handle. The values
+ *  the controls had are restored on exit.
+ *
+ *  The stress tests helped to identify real issues like:
  *
  *  - memory leaks
  *  - specific crashs that are rare and hard to reproduce
- *
- *  To compile:
- *             gcc -o stress-buffer stress-buffer.c -Wall
+ *  - ioctls stalled behind the queue or device lock
  *
  *  To execute:
- *             ./stress-buffer /dev/device_for_test
+ *             ./stress-buffer [options] /dev/device_for_test
  *
  *  Example:
- *             ./stress-buffer /dev/video0
+ *             ./stress-buffer --tests cycle,churn --ctrl-threads 2 /dev/video0
+ *             ./stress-buffer --tests dmabuf --export /dev/video1 /dev/video0
  */
 
 #include <unistd.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/mman.h>
 #include <fcntl.h>
+#include <getopt.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdbool.h>
 #include <stdio.h>
 #include <sys/ioctl.h>
 #include <stdlib.h>
 #include <time.h>
 #include <string.h>
 #include <errno.h>
+#include <linux/videodev2.h>
 
-int main(int argc, char **argv)
+#define TEST_READ	(1 << 0)
+#define TEST_COUNT	(1 << 1)
+#define TEST_CYCLE	(1 << 2)
+#define TEST_CHURN	(1 << 3)
+#define TEST_DMABUF	(1 << 4)
+
+#define MAX_CTRL_THREADS	16
+#define STREAM_BUFS		4
+#define POLL_TIMEOUT_MS		2000
+
+enum {
+	IOC_REQBUFS,
+	IOC_CREATE_BUFS,
+	IOC_QUERYBUF,
+	IOC_QBUF,
+	IOC_DQBUF,
+	IOC_STREAMON,
+	IOC_STREAMOFF,
+	IOC_EXPBUF,
+	IOC_S_EXT_CTRLS,
+	IOC_G_EXT_CTRLS,
+	IOC_READ,
+	IOC_NUM
+};
+
+static const struct {
+	unsigned long req;
+	const char *name;
+} ioctls[IOC_NUM] = {
+	[IOC_REQBUFS]		= { VIDIOC_REQBUFS, "VIDIOC_REQBUFS" },
+	[IOC_CREATE_BUFS]	= { VIDIOC_CREATE_BUFS, "VIDIOC_CREATE_BUFS" },
+	[IOC_QUERYBUF]		= { VIDIOC_QUERYBUF, "VIDIOC_QUERYBUF" },
+	[IOC_QBUF]		= { VIDIOC_QBUF, "VIDIOC_QBUF" },
+	[IOC_DQBUF]		= { VIDIOC_DQBUF, "VIDIOC_DQBUF" },
+	[IOC_STREAMON]		= { VIDIOC_STREAMON, "VIDIOC_STREAMON" },
+	[IOC_STREAMOFF]		= { VIDIOC_STREAMOFF, "VIDIOC_STREAMOFF" },
+	[IOC_EXPBUF]		= { VIDIOC_EXPBUF, "VIDIOC_EXPBUF" },
+	[IOC_S_EXT_CTRLS]	= { VIDIOC_S_EXT_CTRLS, "VIDIOC_S_EXT_CTRLS" },
+	[IOC_G_EXT_CTRLS]	= { VIDIOC_G_EXT_CTRLS, "VIDIOC_G_EXT_CTRLS" },
+	[IOC_READ]		= { 0, "read()" },
+};
+
+/* The latencies of all calls of one ioctl, in nanoseconds */
+struct lat {
+	unsigned long long *ns;
+	unsigned n, size;
+	unsigned errors;
+};
+
+struct stats {
+	struct lat lat[IOC_NUM];
+};
+
+struct plane_map {
+	void *start;
+	__u32 length;
+};
+
+struct dev {
+	const char *name;
+	int fd;
+	__u32 type;
+	bool mplane;
+	struct v4l2_format fmt;
+	unsigned num_planes;
+	unsigned nbufs;
+	struct plane_map (*maps)[VIDEO_MAX_PLANES];
+};
+
+struct ctrl {
+	__u32 id;
+	__u32 type;
+	__s32 min, max, step;
+	__u64 menu_mask;	/* valid menu items below 64 */
+	__s32 orig;
+};
+
+static unsigned opt_iterations = 100;
+static unsigned opt_buffers = 32;
+static unsigned opt_ctrl_threads = 1;
+static bool opt_verbose;
+
+static struct ctrl *ctrls;
+static unsigned num_ctrls;
+static volatile bool stop_ctrls;
+
+static unsigned long long now_ns(void)
 {
-	char buffer[1000];
-	char fname[100];
-	int fd, ret, magic_buffer_size, cnt = 0;
-	time_t t1, t2;
-	double dif;
-	time_t current;
-	struct tm *timep;
+	struct timespec ts;
 
-	FILE *fd_file;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
 
-	if (argc != 2) {
-		printf("Usage: %s /dev/device_to_test\n", argv[0]);
-		return -1;
+static void lat_add(struct lat *l, unsigned long long ns)
+{
+	if (l->n == l->size) {
+		unsigned size = l->size ? l->size * 2 : 1024;
+		unsigned long long *p = realloc(l->ns, size * sizeof(*p));
+
+		if (!p)
+			return;
+		l->ns = p;
+		l->size = size;
+	}
+	l->ns[l->n++] = ns;
+}
+
+static int timed_ioctl(struct stats *st, int fd, int ioc, void *arg)
+{
+	unsigned long long start = now_ns();
+	int ret;
+
+	do {
+		ret = ioctl(fd, ioctls[ioc].req, arg);
+	} while (ret < 0 && errno == EINTR);
+
+	lat_add(&st->lat[ioc], now_ns() - start);
+	if (ret < 0) {
+		st->lat[ioc].errors++;
+		if (opt_verbose)
+			fprintf(stderr, "%s: %s\n", ioctls[ioc].name,
+				strerror(errno));
+	}
+	return ret;
+}
+
+static int cmp_ull(const void *a, const void *b)
+{
+	unsigned long long x = *(const unsigned long long *)a;
+	unsigned long long y = *(const unsigned long long *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+static void stats_merge(struct stats *dst, struct stats *src)
+{
+	for (unsigned i = 0; i < IOC_NUM; i++) {
+		for (unsigned j = 0; j < src->lat[i].n; j++)
+			lat_add(&dst->lat[i], src->lat[i].ns[j]);
+		dst->lat[i].errors += src->lat[i].errors;
 	}
+}
 
-	current = time(NULL);
-	timep = localtime(&current);
+static void stats_free(struct stats *st)
+{
+	for (unsigned i = 0; i < IOC_NUM; i++)
+		free(st->lat[i].ns);
+	memset(st, 0, sizeof(*st));
+}
 
-	memset(fname, 0, sizeof(fname));
+/* Print the latency percentiles in microseconds, and reset the stats */
+static void stats_print(const char *title, struct stats *st)
+{
+	printf("\n%s\n", title);
+	printf("%-20s %8s %6s %9s %9s %9s %9s %9s\n", "ioctl (us)",
+	       "calls", "errors", "min", "p50", "p95", "p99", "max");
 
-	snprintf(fname, sizeof(fname), "stats-%.2d-%.2d-%.2d-%.2d-%.2d-%.2d.txt",
-		timep->tm_mon+1, timep->tm_mday, timep->tm_year + 1900,
-		timep->tm_hour,	timep->tm_min, timep->tm_sec);
+	for (unsigned i = 0; i < IOC_NUM; i++) {
+		struct lat *l = &st->lat[i];
 
-	fd_file = fopen(fname, "a+");
-	if (!fd_file) {
-		perror("error opening file");
+		if (!l->n)
+			continue;
+		qsort(l->ns, l->n, sizeof(*l->ns), cmp_ull);
+		printf("%-20s %8u %6u %9.1f %9.1f %9.1f %9.1f %9.1f\n",
+		       ioctls[i].name, l->n, l->errors,
+		       l->ns[0] / 1000.0, l->ns[l->n / 2] / 1000.0,
+		       l->ns[(unsigned long long)l->n * 95 / 100] / 1000.0,
+		       l->ns[(unsigned long long)l->n * 99 / 100] / 1000.0,
+		       l->ns[l->n - 1] / 1000.0);
+	}
+	stats_free(st);
+}
+
+static int dev_open(struct dev *d, const char *name)
+{
+	static const __u32 types[] = {
+		V4L2_BUF_TYPE_VIDEO_CAPTURE,
+		V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE,
+		V4L2_BUF_TYPE_VIDEO_OUTPUT,
+		V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE,
+	};
+	static const __u32 type_caps[] = {
+		V4L2_CAP_VIDEO_CAPTURE,
+		V4L2_CAP_VIDEO_CAPTURE_MPLANE,
+		V4L2_CAP_VIDEO_OUTPUT,
+		V4L2_CAP_VIDEO_OUTPUT_MPLANE,
+	};
+	struct v4l2_capability cap;
+	__u32 caps;
+	unsigned i;
+
+	memset(d, 0, sizeof(*d));
+	d->name = name;
+	d->fd = open(name, O_RDWR | O_NONBLOCK);
+	if (d->fd < 0) {
+		fprintf(stderr, "error opening %s: %s\n", name, strerror(errno));
 		return -1;
 	}
+	if (ioctl(d->fd, VIDIOC_QUERYCAP, &cap)) {
+		fprintf(stderr, "%s: VIDIOC_QUERYCAP: %s\n", name, strerror(errno));
+		goto err;
+	}
+	caps = cap.capabilities & V4L2_CAP_DEVICE_CAPS ?
+		cap.device_caps : cap.capabilities;
+	if (!(caps & V4L2_CAP_STREAMING)) {
+		fprintf(stderr, "%s doesn't support streaming\n", name);
+		goto err;
+	}
+	for (i = 0; i < sizeof(types) / sizeof(types[0]); i++)
+		if (caps & type_caps[i])
+			break;
+	if (i == sizeof(types) / sizeof(types[0])) {
+		fprintf(stderr, "%s is not a video capture or output device\n", name);
+		goto err;
+	}
+	d->type = types[i];
+	d->mplane = V4L2_TYPE_IS_MULTIPLANAR(d->type);
 
-	srand(time(NULL));
+	d->fmt.type = d->type;
+	if (ioctl(d->fd, VIDIOC_G_FMT, &d->fmt)) {
+		fprintf(stderr, "%s: VIDIOC_G_FMT: %s\n", name, strerror(errno));
+		goto err;
+	}
+	d->num_planes = d->mplane ? d->fmt.fmt.pix_mp.num_planes : 1;
+	return 0;
+
+err:
+	close(d->fd);
+	d->fd = -1;
+	return -1;
+}
+
+static void dev_close(struct dev *d)
+{
+	free(d->maps);
+	if (d->fd >= 0)
+		close(d->fd);
+	d->fd = -1;
+}
 
-	while (1) {
+static __u32 dev_sizeimage(const struct dev *d)
+{
+	return d->mplane ? d->fmt.fmt.pix_mp.plane_fmt[0].sizeimage :
+			   d->fmt.fmt.pix.sizeimage;
+}
 
-		if (time(&t1) < 0) {
-			perror("time_t t1");
-			fclose(fd_file);
+static void init_buf(const struct dev *d, struct v4l2_buffer *buf,
+		     struct v4l2_plane *planes, unsigned index, __u32 memory)
+{
+	memset(buf, 0, sizeof(*buf));
+	buf->type = d->type;
+	buf->memory = memory;
+	buf->index = index;
+	if (d->mplane) {
+		memset(planes, 0, VIDEO_MAX_PLANES * sizeof(*planes));
+		buf->m.planes = planes;
+		buf->length = VIDEO_MAX_PLANES;
+	}
+}
+
+/* Returns the number of buffers allocated, or -1 */
+static int reqbufs(struct stats *st, struct dev *d, unsigned count, __u32 memory)
+{
+	struct v4l2_requestbuffers req;
+
+	memset(&req, 0, sizeof(req));
+	req.count = count;
+	req.type = d->type;
+	req.memory = memory;
+	if (timed_ioctl(st, d->fd, IOC_REQBUFS, &req))
+		return -1;
+	d->nbufs = req.count;
+	return req.count;
+}
+
+/* Query and mmap the planes of buffers first up to d->nbufs */
+static int mmap_bufs(struct stats *st, struct dev *d, unsigned first)
+{
+	void *p = realloc(d->maps, d->nbufs * sizeof(*d->maps));
+
+	if (!p)
+		return -1;
+	d->maps = p;
+	memset(d->maps + first, 0, (d->nbufs - first) * sizeof(*d->maps));
+
+	for (unsigned i = first; i < d->nbufs; i++) {
+		struct v4l2_plane planes[VIDEO_MAX_PLANES];
+		struct v4l2_buffer buf;
+		unsigned nplanes;
+
+		init_buf(d, &buf, planes, i, V4L2_MEMORY_MMAP);
+		if (timed_ioctl(st, d->fd, IOC_QUERYBUF, &buf))
 			return -1;
+		nplanes = d->mplane ? buf.length : 1;
+
+		for (unsigned p = 0; p < nplanes; p++) {
+			__u32 len = d->mplane ? planes[p].length : buf.length;
+			__u32 offset = d->mplane ? planes[p].m.mem_offset :
+						   buf.m.offset;
+			void *start = mmap(NULL, len, PROT_READ | PROT_WRITE,
+					   MAP_SHARED, d->fd, offset);
+
+			if (start == MAP_FAILED) {
+				perror("mmap");
+				return -1;
+			}
+			d->maps[i][p].start = start;
+			d->maps[i][p].length = len;
 		}
+	}
+	return 0;
+}
 
-		fd = open(argv[1], O_RDONLY);
-		if (fd < 0) {
-			perror("error opening device");
-			fclose(fd_file);
-			return -1;
+static void munmap_bufs(struct dev *d)
+{
+	if (!d->maps)
+		return;
+	for (unsigned i = 0; i < d->nbufs; i++)
+		for (unsigned p = 0; p < VIDEO_MAX_PLANES; p++)
+			if (d->maps[i][p].start)
+				munmap(d->maps[i][p].start, d->maps[i][p].length);
+	free(d->maps);
+	d->maps = NULL;
+}
+
+static int queue_buf(struct stats *st, struct dev *d, unsigned index,
+		     __u32 memory, int dmabuf_fd)
+{
+	struct v4l2_plane planes[VIDEO_MAX_PLANES];
+	struct v4l2_buffer buf;
+
+	init_buf(d, &buf, planes, index, memory);
+	if (d->mplane) {
+		buf.length = d->num_planes;
+		for (unsigned p = 0; p < d->num_planes; p++) {
+			planes[p].length = d->fmt.fmt.pix_mp.plane_fmt[p].sizeimage;
+			if (V4L2_TYPE_IS_OUTPUT(d->type))
+				planes[p].bytesused = planes[p].length;
 		}
+		if (memory == V4L2_MEMORY_DMABUF)
+			planes[0].m.fd = dmabuf_fd;
+	} else {
+		buf.length = d->fmt.fmt.pix.sizeimage;
+		if (V4L2_TYPE_IS_OUTPUT(d->type))
+			buf.bytesused = buf.length;
+		if (memory == V4L2_MEMORY_DMABUF)
+			buf.m.fd = dmabuf_fd;
+	}
+	if (V4L2_TYPE_IS_OUTPUT(d->type))
+		buf.field = V4L2_FIELD_NONE;
+	return timed_ioctl(st, d->fd, IOC_QBUF, &buf);
+}
 
-		/* Random number 0 - 1000 */
-		magic_buffer_size = rand() % sizeof(buffer);
+static int queue_all(struct stats *st, struct dev *d, __u32 memory,
+		     const int *dmabuf_fds)
+{
+	for (unsigned i = 0; i < d->nbufs; i++)
+		if (queue_buf(st, d, i, memory, dmabuf_fds ? dmabuf_fds[i] : -1))
+			return -1;
+	return 0;
+}
 
-		memset(buffer, 0, sizeof(buffer));
+/* Wait for and dequeue a buffer, returns its index or -1 */
+static int dequeue_buf(struct stats *st, struct dev *d, __u32 memory)
+{
+	struct pollfd pfd = {
+		d->fd, V4L2_TYPE_IS_OUTPUT(d->type) ? POLLOUT : POLLIN, 0
+	};
+	struct v4l2_plane planes[VIDEO_MAX_PLANES];
+	struct v4l2_buffer buf;
+	int ret;
 
-		ret = access(fname, W_OK);
-		if (ret < 0) {
-			close(fd);
-			perror("Error");
+	do {
+		ret = poll(&pfd, 1, POLL_TIMEOUT_MS);
+	} while (ret < 0 && errno == EINTR);
+	if (ret <= 0) {
+		fprintf(stderr, "%s: timeout waiting for a buffer\n", d->name);
+		return -1;
+	}
+
+	init_buf(d, &buf, planes, 0, memory);
+	if (timed_ioctl(st, d->fd, IOC_DQBUF, &buf))
+		return -1;
+	return buf.index;
+}
+
+static int streamon(struct stats *st, struct dev *d)
+{
+	return timed_ioctl(st, d->fd, IOC_STREAMON, &d->type);
+}
+
+static int streamoff(struct stats *st, struct dev *d)
+{
+	return timed_ioctl(st, d->fd, IOC_STREAMOFF, &d->type);
+}
+
+/* The original stress-buffer: random sized reads, forever if iterations is 0 */
+static int test_read(struct stats *st, const char *name)
+{
+	char buffer[1000];
+
+	for (unsigned i = 0; !opt_iterations || i < opt_iterations; i++) {
+		unsigned long long start;
+		int fd, ret;
+
+		fd = open(name, O_RDONLY);
+		if (fd < 0) {
+			perror("error opening device");
 			return -1;
 		}
 
-		ret = read(fd, buffer, magic_buffer_size);
+		start = now_ns();
+		ret = read(fd, buffer, rand() % sizeof(buffer));
+		lat_add(&st->lat[IOC_READ], now_ns() - start);
+		close(fd);
+
 		if (ret < 0) {
-			fprintf(fd_file, "[%s] error reading buffer - [%s]\n",
-				argv[1], strerror(errno));
-			fflush(fd_file);
 			perror("error reading buffer from device");
+			st->lat[IOC_READ].errors++;
 			return -1;
 		}
+		if (opt_verbose)
+			printf("Test number: [%u] - Read [%d] bytes\n", i, ret);
+	}
+	return 0;
+}
+
+static int test_count(struct stats *st, struct dev *d)
+{
+	int ret = -1;
+	int n;
 
-		if (time(&t2) < 0) {
-			perror("time_t t2");
-			fclose(fd_file);
+	n = reqbufs(st, d, opt_buffers, V4L2_MEMORY_MMAP);
+	if (n <= 0)
+		return -1;
+	printf("%s: asked for %u buffers, got %d\n", d->name, opt_buffers, n);
+
+	if (mmap_bufs(st, d, 0) || queue_all(st, d, V4L2_MEMORY_MMAP, NULL) ||
+	    streamon(st, d))
+		goto free;
+
+	for (unsigned i = 0; i < opt_iterations; i++) {
+		int index = dequeue_buf(st, d, V4L2_MEMORY_MMAP);
+
+		if (index < 0 || queue_buf(st, d, index, V4L2_MEMORY_MMAP, -1))
+			goto off;
+	}
+	ret = 0;
+
+off:
+	streamoff(st, d);
+free:
+	munmap_bufs(d);
+	reqbufs(st, d, 0, V4L2_MEMORY_MMAP);
+	return ret;
+}
+
+static int test_cycle(struct stats *st, struct dev *d)
+{
+	int ret = -1;
+
+	if (reqbufs(st, d, STREAM_BUFS, V4L2_MEMORY_MMAP) <= 0)
+		return -1;
+
+	for (unsigned i = 0; i < opt_iterations; i++) {
+		if (queue_all(st, d, V4L2_MEMORY_MMAP, NULL) || streamon(st, d))
+			goto free;
+		if (dequeue_buf(st, d, V4L2_MEMORY_MMAP) < 0) {
+			streamoff(st, d);
+			goto free;
+		}
+		/* Returns all the buffers still queued to userspace */
+		if (streamoff(st, d))
+			goto free;
+	}
+	ret = 0;
+
+free:
+	reqbufs(st, d, 0, V4L2_MEMORY_MMAP);
+	return ret;
+}
+
+static int test_churn(struct stats *st, struct dev *d)
+{
+	bool have_create_bufs = true;
+
+	for (unsigned i = 0; i < opt_iterations; i++) {
+		unsigned count = 1 + rand() % opt_buffers;
+		unsigned first;
+
+		if (reqbufs(st, d, count, V4L2_MEMORY_MMAP) <= 0)
 			return -1;
+		if (mmap_bufs(st, d, 0))
+			goto err;
+
+		if (have_create_bufs) {
+			struct v4l2_create_buffers create;
+
+			memset(&create, 0, sizeof(create));
+			create.count = 1 + rand() % STREAM_BUFS;
+			create.memory = V4L2_MEMORY_MMAP;
+			create.format = d->fmt;
+			if (timed_ioctl(st, d->fd, IOC_CREATE_BUFS, &create)) {
+				if (errno != ENOTTY)
+					goto err;
+				printf("%s: no VIDIOC_CREATE_BUFS support\n", d->name);
+				have_create_bufs = false;
+			} else {
+				first = create.index;
+				d->nbufs = create.index + create.count;
+				if (mmap_bufs(st, d, first))
+					goto err;
+			}
 		}
 
-		dif = difftime(t2, t1);
+		munmap_bufs(d);
+		if (reqbufs(st, d, 0, V4L2_MEMORY_MMAP) < 0)
+			return -1;
+	}
+	return 0;
 
-		printf("Seconds: [%d] - Test Number: [%d] - Read [%d] bytes\n",
-			(int)dif, cnt, ret);
+err:
+	munmap_bufs(d);
+	reqbufs(st, d, 0, V4L2_MEMORY_MMAP);
+	return -1;
+}
 
-		fprintf(fd_file, "Seconds: [%.2f] - Test number: [%d] - Read [%d] bytes\n",
-			dif,  cnt, ret);
+static int test_dmabuf(struct stats *st, struct dev *d, struct dev *e)
+{
+	int fds[STREAM_BUFS];
+	int n, ret = -1;
+	unsigned i;
 
-		fflush(fd_file);
+	if (d->num_planes != 1) {
+		fprintf(stderr, "%s: dmabuf test needs a single plane format\n",
+			d->name);
+		return -1;
+	}
+	for (i = 0; i < STREAM_BUFS; i++)
+		fds[i] = -1;
 
-		cnt++;
+	n = reqbufs(st, e, STREAM_BUFS, V4L2_MEMORY_MMAP);
+	if (n <= 0)
+		return -1;
+	if (n > STREAM_BUFS)
+		n = STREAM_BUFS;
 
-		close(fd);
+	for (i = 0; i < (unsigned)n; i++) {
+		struct v4l2_plane planes[VIDEO_MAX_PLANES];
+		struct v4l2_exportbuffer expbuf;
+		struct v4l2_buffer buf;
+		__u32 len;
+
+		init_buf(e, &buf, planes, i, V4L2_MEMORY_MMAP);
+		if (timed_ioctl(st, e->fd, IOC_QUERYBUF, &buf))
+			goto free;
+		len = e->mplane ? planes[0].length : buf.length;
+		if (len < dev_sizeimage(d)) {
+			fprintf(stderr, "%s: buffers of %u bytes are too small for %s\n",
+				e->name, len, d->name);
+			goto free;
+		}
+
+		memset(&expbuf, 0, sizeof(expbuf));
+		expbuf.type = e->type;
+		expbuf.index = i;
+		expbuf.flags = O_RDWR | O_CLOEXEC;
+		if (timed_ioctl(st, e->fd, IOC_EXPBUF, &expbuf))
+			goto free;
+		fds[i] = expbuf.fd;
+	}
+
+	if (reqbufs(st, d, n, V4L2_MEMORY_DMABUF) < n)
+		goto free_import;
+	d->nbufs = n;
 
+	for (i = 0; i < opt_iterations; i++) {
+		if (queue_all(st, d, V4L2_MEMORY_DMABUF, fds) || streamon(st, d))
+			goto free_import;
+		for (unsigned f = 0; f < 2 * STREAM_BUFS; f++) {
+			int index = dequeue_buf(st, d, V4L2_MEMORY_DMABUF);
+
+			if (index < 0 ||
+			    queue_buf(st, d, index, V4L2_MEMORY_DMABUF, fds[index])) {
+				streamoff(st, d);
+				goto free_import;
+			}
+		}
+		if (streamoff(st, d))
+			goto free_import;
 	}
+	ret = 0;
+
+free_import:
+	reqbufs(st, d, 0, V4L2_MEMORY_DMABUF);
+free:
+	for (i = 0; i < STREAM_BUFS; i++)
+		if (fds[i] >= 0)
+			close(fds[i]);
+	reqbufs(st, e, 0, V4L2_MEMORY_MMAP);
+	return ret;
+}
+
+static int ctrl_get(int fd, __u32 id, __s32 *value)
+{
+	struct v4l2_ext_control ctrl = { .id = id };
+	struct v4l2_ext_controls ctrls = {
+		.which = V4L2_CTRL_WHICH_CUR_VAL,
+		.count = 1,
+		.controls = &ctrl,
+	};
+
+	if (ioctl(fd, VIDIOC_G_EXT_CTRLS, &ctrls))
+		return -1;
+	*value = ctrl.value;
 	return 0;
 }
+
+static void ctrl_set(int fd, __u32 id, __s32 value)
+{
+	struct v4l2_ext_control ctrl = { .id = id, .value = value };
+	struct v4l2_ext_controls ctrls = {
+		.which = V4L2_CTRL_WHICH_CUR_VAL,
+		.count = 1,
+		.controls = &ctrl,
+	};
+
+	ioctl(fd, VIDIOC_S_EXT_CTRLS, &ctrls);
+}
+
+/* Collect the writable integer, boolean and menu controls */
+static void enum_ctrls(int fd)
+{
+	struct v4l2_queryctrl qc;
+
+	memset(&qc, 0, sizeof(qc));
+	qc.id = V4L2_CTRL_FLAG_NEXT_CTRL;
+	while (!ioctl(fd, VIDIOC_QUERYCTRL, &qc)) {
+		struct ctrl *c;
+		void *p;
+
+		qc.id |= V4L2_CTRL_FLAG_NEXT_CTRL;
+		if (qc.flags & (V4L2_CTRL_FLAG_DISABLED | V4L2_CTRL_FLAG_READ_ONLY |
+				V4L2_CTRL_FLAG_WRITE_ONLY | V4L2_CTRL_FLAG_VOLATILE))
+			continue;
+		if (qc.type != V4L2_CTRL_TYPE_INTEGER &&
+		    qc.type != V4L2_CTRL_TYPE_BOOLEAN &&
+		    qc.type != V4L2_CTRL_TYPE_MENU &&
+		    qc.type != V4L2_CTRL_TYPE_INTEGER_MENU)
+			continue;
+
+		p = realloc(ctrls, (num_ctrls + 1) * sizeof(*ctrls));
+		if (!p)
+			break;
+		ctrls = p;
+		c = &ctrls[num_ctrls];
+		memset(c, 0, sizeof(*c));
+		c->id = qc.id & ~V4L2_CTRL_FLAG_NEXT_CTRL;
+		c->type = qc.type;
+		c->min = qc.minimum;
+		c->max = qc.maximum;
+		c->step = qc.step ? qc.step : 1;
+		if (ctrl_get(fd, c->id, &c->orig))
+			continue;
+
+		if (qc.type == V4L2_CTRL_TYPE_MENU ||
+		    qc.type == V4L2_CTRL_TYPE_INTEGER_MENU) {
+			struct v4l2_querymenu qm;
+
+			for (__s32 i = c->min; i <= c->max && i < 64; i++) {
+				memset(&qm, 0, sizeof(qm));
+				qm.id = c->id;
+				qm.index = i;
+				if (!ioctl(fd, VIDIOC_QUERYMENU, &qm))
+					c->menu_mask |= 1ULL << i;
+			}
+			if (!c->menu_mask)
+				continue;
+		}
+		num_ctrls++;
+	}
+}
+
+static __s32 ctrl_random(const struct ctrl *c, unsigned *seed)
+{
+	if (c->menu_mask) {
+		unsigned n = __builtin_popcountll(c->menu_mask);
+		unsigned pick = rand_r(seed) % n;
+		__u64 mask = c->menu_mask;
+
+		while (pick--)
+			mask &= mask - 1;
+		return __builtin_ctzll(mask);
+	}
+	return c->min +
+	       (__s32)((rand_r(seed) % ((__u64)(c->max - c->min) / c->step + 1)) *
+		       c->step);
+}
+
+struct ctrl_thread {
+	pthread_t thread;
+	int fd;
+	unsigned seed;
+	struct stats st;
+};
+
+static void *ctrl_thread(void *arg)
+{
+	struct ctrl_thread *t = arg;
+
+	while (!stop_ctrls) {
+		const struct ctrl *c = &ctrls[rand_r(&t->seed) % num_ctrls];
+		struct v4l2_ext_control ctrl = {
+			.id = c->id,
+			.value = ctrl_random(c, &t->seed),
+		};
+		struct v4l2_ext_controls ext = {
+			.which = V4L2_CTRL_WHICH_CUR_VAL,
+			.count = 1,
+			.controls = &ctrl,
+		};
+
+		timed_ioctl(&t->st, t->fd, IOC_S_EXT_CTRLS, &ext);
+		timed_ioctl(&t->st, t->fd, IOC_G_EXT_CTRLS, &ext);
+	}
+	return NULL;
+}
+
+static unsigned parse_tests(const char *s)
+{
+	static const struct {
+		const char *name;
+		unsigned test;
+	} names[] = {
+		{ "read", TEST_READ },
+		{ "count", TEST_COUNT },
+		{ "cycle", TEST_CYCLE },
+		{ "churn", TEST_CHURN },
+		{ "dmabuf", TEST_DMABUF },
+	};
+	unsigned tests = 0;
+
+	while (*s) {
+		size_t len = strcspn(s, ",");
+		unsigned i;
+
+		for (i = 0; i < sizeof(names) / sizeof(names[0]); i++)
+			if (strlen(names[i].name) == len &&
+			    !strncmp(s, names[i].name, len))
+				break;
+		if (i == sizeof(names) / sizeof(names[0])) {
+			fprintf(stderr, "unknown test %.*s\n", (int)len, s);
+			return 0;
+		}
+		tests |= names[i].test;
+		s += len;
+		if (*s)
+			s++;
+	}
+	return tests;
+}
+
+static void usage(const char *prog)
+{
+	printf("Usage: %s [options] /dev/device_to_test\n\n"
+	       "  -t, --tests <list>        comma separated tests to run: read, count,\n"
+	       "                            cycle, churn, dmabuf (default count,cycle,churn\n"
+	       "                            and dmabuf if --export is given)\n"
+	       "  -n, --iterations <count>  iterations of each test (default %u), 0 runs\n"
+	       "                            the read test forever\n"
+	       "  -b, --buffers <count>     buffers to ask for in the count and churn\n"
+	       "                            tests (default %u)\n"
+	       "  -e, --export <dev>        device exporting the buffers for the dmabuf test\n"
+	       "  -c, --ctrl-threads <num>  threads changing controls while the tests\n"
+	       "                            run (default %u, at most %u)\n"
+	       "  -v, --verbose             report every failing call\n"
+	       "  -h, --help                show this help\n",
+	       prog, opt_iterations, opt_buffers, opt_ctrl_threads,
+	       MAX_CTRL_THREADS);
+}
+
+int main(int argc, char **argv)
+{
+	static const struct option long_options[] = {
+		{ "tests", required_argument, NULL, 't' },
+		{ "iterations", required_argument, NULL, 'n' },
+		{ "buffers", required_argument, NULL, 'b' },
+		{ "export", required_argument, NULL, 'e' },
+		{ "ctrl-threads", required_argument, NULL, 'c' },
+		{ "verbose", no_argument, NULL, 'v' },
+		{ "help", no_argument, NULL, 'h' },
+		{ NULL, 0, NULL, 0 }
+	};
+	struct ctrl_thread threads[MAX_CTRL_THREADS];
+	const char *export_name = NULL;
+	unsigned tests = 0;
+	struct stats st;
+	struct dev d, e;
+	int ret = 0;
+	int opt;
+
+	while ((opt = getopt_long(argc, argv, "t:n:b:e:c:vh", long_options, NULL)) != -1) {
+		switch (opt) {
+		case 't':
+			tests = parse_tests(optarg);
+			if (!tests)
+				return -1;
+			break;
+		case 'n':
+			opt_iterations = strtoul(optarg, NULL, 0);
+			break;
+		case 'b':
+			opt_buffers = strtoul(optarg, NULL, 0);
+			if (!opt_buffers)
+				opt_buffers = 1;
+			break;
+		case 'e':
+			export_name = optarg;
+			break;
+		case 'c':
+			opt_ctrl_threads = strtoul(optarg, NULL, 0);
+			if (opt_ctrl_threads > MAX_CTRL_THREADS)
+				opt_ctrl_threads = MAX_CTRL_THREADS;
+			break;
+		case 'v':
+			opt_verbose = true;
+			break;
+		case 'h':
+			usage(argv[0]);
+			return 0;
+		default:
+			usage(argv[0]);
+			return -1;
+		}
+	}
+	if (optind != argc - 1) {
+		usage(argv[0]);
+		return -1;
+	}
+	if (!tests)
+		tests = TEST_COUNT | TEST_CYCLE | TEST_CHURN |
+			(export_name ? TEST_DMABUF : 0);
+	if ((tests & TEST_DMABUF) && !export_name) {
+		fprintf(stderr, "the dmabuf test needs --export\n");
+		return -1;
+	}
+
+	srand(time(NULL));
+	memset(&st, 0, sizeof(st));
+	d.fd = e.fd = -1;
+	d.maps = e.maps = NULL;
+
+	if ((tests & ~TEST_READ) && dev_open(&d, argv[optind]))
+		return -1;
+	if ((tests & TEST_DMABUF) && dev_open(&e, export_name)) {
+		dev_close(&d);
+		return -1;
+	}
+
+	if (opt_ctrl_threads && d.fd >= 0) {
+		enum_ctrls(d.fd);
+		if (!num_ctrls)
+			opt_ctrl_threads = 0;
+	} else {
+		opt_ctrl_threads = 0;
+	}
+	if (opt_ctrl_threads)
+		printf("%u threads changing %u controls\n", opt_ctrl_threads, num_ctrls);
+
+	for (unsigned i = 0; i < opt_ctrl_threads; i++) {
+		struct ctrl_thread *t = &threads[i];
+
+		memset(&t->st, 0, sizeof(t->st));
+		t->seed = rand();
+		t->fd = open(argv[optind], O_RDWR);
+		if (t->fd < 0 || pthread_create(&t->thread, NULL, ctrl_thread, t)) {
+			perror("control thread");
+			if (t->fd >= 0)
+				close(t->fd);
+			opt_ctrl_threads = i;
+			break;
+		}
+	}
+
+	if (tests & TEST_READ) {
+		ret |= test_read(&st, argv[optind]);
+		stats_print("read", &st);
+	}
+	if (tests & TEST_COUNT) {
+		ret |= test_count(&st, &d);
+		stats_print("count: streaming with many buffers", &st);
+	}
+	if (tests & TEST_CYCLE) {
+		ret |= test_cycle(&st, &d);
+		stats_print("cycle: STREAMON/STREAMOFF cycling", &st);
+	}
+	if (tests & TEST_CHURN) {
+		ret |= test_churn(&st, &d);
+		stats_print("churn: REQBUFS/CREATE_BUFS churn", &st);
+	}
+	if (tests & TEST_DMABUF) {
+		ret |= test_dmabuf(&st, &d, &e);
+		stats_print("dmabuf: importing buffers of the export device", &st);
+	}
+
+	stop_ctrls = true;
+	for (unsigned i = 0; i < opt_ctrl_threads; i++) {
+		pthread_join(threads[i].thread, NULL);
+		close(threads[i].fd);
+		stats_merge(&st, &threads[i].st);
+		stats_free(&threads[i].st);
+	}
+	if (opt_ctrl_threads)
+		stats_print("controls, changed concurrently", &st);
+
+	for (unsigned i = 0; i < num_ctrls; i++)
+		ctrl_set(d.fd, ctrls[i].id, ctrls[i].orig);
+	free(ctrls);
+
+	dev_close(&e);
+	dev_close(&d);
+	return ret ? -1 : 0;
+}
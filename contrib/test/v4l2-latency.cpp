@@ -0,0 +1,582 @@
+/*
+ * v4l2-latency: threaded capture to display pipeline measuring its latency
+ *
+ * Copyright 2026 The v4l-utils authors
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2.1 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * A reference design for a low latency capture client: dequeuing,
+ * conversion (libv4lconvert) and display each run in their own thread,
+ * handing the frames to the next stage through single producer / single
+ * consumer rings, so no stage ever waits for a lock held by another one.
+ * The display stage copies the frames into a staging surface, standing in
+ * for the texture upload of a real client.
+ *
+ * For every frame the time from the buffer timestamp to the dequeue, the
+ * wait for and the time spent in the conversion and the wait for the
+ * display are measured, and summarized when done.
+ *
+ * With --output the frames generated by the test pattern generator are fed
+ * to a video output device looping back into the capture device, such as
+ * vivid with the loop_video control set on an HDMI or S-Video input and
+ * output. Each output frame carries a pattern of black and white blocks
+ * encoding the time it was queued, which the display stage decodes again
+ * from the converted frame to measure the glass to glass latency:
+ *
+ *   v4l2-ctl -d0 -i3 -c loop_video=1
+ *   v4l2-latency -d /dev/video0 --output /dev/video1
+ */
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <thread>
+#include <vector>
+
+#include <getopt.h>
+#include <poll.h>
+#include <time.h>
+
+#include <libv4lconvert.h>
+
+#include "cv4l-helpers.h"
+
+extern "C" {
+#include "v4l2-tpg.h"
+}
+
+#define NUM_BUFS	4
+#define NUM_SLOTS	4
+
+/* 16 bits of magic and 48 bits of CLOCK_MONOTONIC microseconds */
+#define STAMP_BITS	64
+#define STAMP_MAGIC	0xb24cULL
+#define STAMP_MAX_BLOCK	8
+
+static inline __u64 now_ns()
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/*
+ * Ring for handing items from one thread to one other thread: only the
+ * producer writes head and only the consumer writes tail, so the two never
+ * need a lock. A consumer finding the ring empty spins for a while before
+ * it starts sleeping, to keep the wake up latency out of the measurement.
+ */
+template <typename T, unsigned N>
+class spsc_ring {
+public:
+	bool push(const T &item)
+	{
+		unsigned h = head.load(std::memory_order_relaxed);
+
+		if (h - tail.load(std::memory_order_acquire) == N)
+			return false;
+		items[h % N] = item;
+		head.store(h + 1, std::memory_order_release);
+		return true;
+	}
+
+	bool pop(T &item)
+	{
+		unsigned t = tail.load(std::memory_order_relaxed);
+
+		if (t == head.load(std::memory_order_acquire))
+			return false;
+		item = items[t % N];
+		tail.store(t + 1, std::memory_order_release);
+		return true;
+	}
+
+	/* Returns false once stop is set and the ring ran empty */
+	bool wait_pop(T &item, const std::atomic<bool> &stop)
+	{
+		unsigned spins = 0;
+
+		while (!pop(item)) {
+			if (stop.load(std::memory_order_relaxed))
+				return false;
+			if (++spins < 10000) {
+				std::this_thread::yield();
+			} else {
+				struct timespec ts = { 0, 100000 };
+
+				nanosleep(&ts, NULL);
+			}
+		}
+		return true;
+	}
+
+private:
+	T items[N];
+	std::atomic<unsigned> head{0};
+	std::atomic<unsigned> tail{0};
+};
+
+struct frame_times {
+	__u64 ts;		/* buffer timestamp, 0 if not monotonic */
+	__u64 dq;		/* dequeued */
+	__u64 conv_start;
+	__u64 conv_end;
+	__u64 shown;		/* copied to the staging surface */
+	__u64 stamp;		/* loopback stamp decoded, 0 if none */
+};
+
+struct cap_item {
+	unsigned index;
+	unsigned bytesused;
+	frame_times t;
+};
+
+struct disp_item {
+	unsigned slot;
+	frame_times t;
+};
+
+static std::atomic<bool> stop_capture{false};
+static std::atomic<bool> stop_pipeline{false};
+static std::atomic<unsigned> dropped{0};
+
+static cv4l_fd cap_fd;
+static cv4l_queue cap_q;
+static struct v4lconvert_data *convert;
+static struct v4l2_format src_fmt, dst_fmt;
+static std::vector<std::vector<unsigned char>> slots;
+static spsc_ring<cap_item, NUM_BUFS> cap_to_conv;
+static spsc_ring<disp_item, NUM_SLOTS> conv_to_disp;
+static spsc_ring<unsigned, NUM_SLOTS> free_slots;
+static std::vector<frame_times> results;
+
+static unsigned stamp_block(unsigned width)
+{
+	return std::min<unsigned>(STAMP_MAX_BLOCK, width / STAMP_BITS);
+}
+
+/*
+ * Write the stamp into the first plane, all bytes of a block being 0x00 or
+ * 0xff. Whatever the format, 0xff bytes come out bright and 0x00 bytes
+ * dark after the conversion to RGB.
+ */
+static void stamp_write(unsigned char *p, unsigned width, unsigned bpl, __u64 t)
+{
+	unsigned blk = stamp_block(width);
+	__u64 code = (STAMP_MAGIC << 48) | ((t / 1000) & 0xffffffffffffULL);
+
+	for (unsigned b = 0; b < STAMP_BITS; b++) {
+		unsigned x0 = b * blk * bpl / width;
+		unsigned x1 = (b + 1) * blk * bpl / width;
+		int val = (code >> (STAMP_BITS - 1 - b)) & 1 ? 0xff : 0x00;
+
+		for (unsigned y = 0; y < blk; y++)
+			memset(p + y * bpl + x0, val, x1 - x0);
+	}
+}
+
+/* Decode the stamp from an RGB24 / BGR24 frame, returns 0 if none */
+static __u64 stamp_read(const unsigned char *p, unsigned width, unsigned bpl)
+{
+	unsigned blk = stamp_block(width);
+	const unsigned char *line = p + blk / 2 * bpl;
+	__u64 code = 0;
+	__u64 now_us = now_ns() / 1000;
+	__u64 us;
+
+	if (!blk)
+		return 0;
+	for (unsigned b = 0; b < STAMP_BITS; b++) {
+		const unsigned char *px = line + (b * blk + blk / 2) * 3;
+
+		code = (code << 1) | (px[0] + px[1] + px[2] > 3 * 128);
+	}
+	if (code >> 48 != STAMP_MAGIC)
+		return 0;
+
+	/* Put back the top bits of the clock */
+	us = (now_us & ~0xffffffffffffULL) | (code & 0xffffffffffffULL);
+	if (us > now_us)
+		us -= 1ULL << 48;
+	return us * 1000;
+}
+
+static void capture_thread()
+{
+	while (!stop_capture.load(std::memory_order_relaxed)) {
+		struct pollfd pfd = { cap_fd.g_fd(), POLLIN, 0 };
+		cv4l_buffer buf(cap_q);
+		cap_item item;
+
+		if (poll(&pfd, 1, 100) <= 0)
+			continue;
+		if (cap_fd.dqbuf(buf)) {
+			if (errno == EAGAIN)
+				continue;
+			perror("VIDIOC_DQBUF");
+			break;
+		}
+
+		item.index = buf.g_index();
+		item.bytesused = buf.g_bytesused();
+		memset(&item.t, 0, sizeof(item.t));
+		item.t.dq = now_ns();
+		if (buf.g_timestamp_type() == V4L2_BUF_FLAG_TIMESTAMP_MONOTONIC)
+			item.t.ts = buf.g_timestamp_ns();
+
+		/* The converter is behind, give the buffer back to the driver */
+		if (!cap_to_conv.push(item)) {
+			dropped++;
+			cap_fd.qbuf(buf);
+		}
+	}
+	stop_pipeline = true;
+}
+
+static void convert_thread()
+{
+	cap_item item;
+
+	while (cap_to_conv.wait_pop(item, stop_pipeline)) {
+		cv4l_buffer buf(cap_q, item.index);
+		disp_item out;
+
+		out.t = item.t;
+		if (free_slots.pop(out.slot)) {
+			out.t.conv_start = now_ns();
+			if (v4lconvert_convert(convert, &src_fmt, &dst_fmt,
+					       (unsigned char *)cap_q.g_dataptr(item.index, 0),
+					       item.bytesused, slots[out.slot].data(),
+					       slots[out.slot].size()) < 0) {
+				fprintf(stderr, "conversion failed: %s\n",
+					v4lconvert_get_error_message(convert));
+				free_slots.push(out.slot);
+			} else {
+				out.t.conv_end = now_ns();
+				conv_to_disp.push(out);
+			}
+		} else {
+			dropped++;
+		}
+		cap_fd.qbuf(buf);
+	}
+}
+
+static void display_thread(unsigned frames, bool loopback)
+{
+	std::vector<unsigned char> surface(dst_fmt.fmt.pix.sizeimage);
+	disp_item item;
+
+	while (conv_to_disp.wait_pop(item, stop_pipeline)) {
+		const unsigned char *frame = slots[item.slot].data();
+
+		memcpy(surface.data(), frame, surface.size());
+		item.t.shown = now_ns();
+		if (loopback)
+			item.t.stamp = stamp_read(frame, dst_fmt.fmt.pix.width,
+						  dst_fmt.fmt.pix.bytesperline);
+		free_slots.push(item.slot);
+
+		results.push_back(item.t);
+		if (results.size() == frames)
+			stop_capture = true;
+	}
+}
+
+static void output_thread(cv4l_fd *out_fd, cv4l_queue *out_q)
+{
+	while (!stop_pipeline.load(std::memory_order_relaxed)) {
+		struct pollfd pfd = { out_fd->g_fd(), POLLOUT, 0 };
+		cv4l_buffer buf(*out_q);
+
+		if (poll(&pfd, 1, 100) <= 0)
+			continue;
+		if (out_fd->dqbuf(buf)) {
+			if (errno == EAGAIN)
+				continue;
+			perror("VIDIOC_DQBUF (output)");
+			break;
+		}
+		stamp_write((unsigned char *)out_q->g_dataptr(buf.g_index(), 0),
+			    src_fmt.fmt.pix.width, src_fmt.fmt.pix.bytesperline,
+			    now_ns());
+		out_fd->qbuf(buf);
+	}
+}
+
+static int setup_output(cv4l_fd &out_fd, cv4l_queue &out_q, const char *dev)
+{
+	cv4l_fmt fmt(V4L2_BUF_TYPE_VIDEO_OUTPUT);
+	struct tpg_data tpg;
+
+	out_fd.s_direct(true);
+	if (out_fd.open(dev, true) < 0) {
+		fprintf(stderr, "Failed to open %s: %s\n", dev, strerror(errno));
+		return -1;
+	}
+	out_fd.g_fmt(fmt, V4L2_BUF_TYPE_VIDEO_OUTPUT);
+	fmt.s_width(src_fmt.fmt.pix.width);
+	fmt.s_height(src_fmt.fmt.pix.height);
+	fmt.s_pixelformat(src_fmt.fmt.pix.pixelformat);
+	fmt.s_field(V4L2_FIELD_NONE);
+	if (out_fd.s_fmt(fmt) ||
+	    fmt.g_width() != src_fmt.fmt.pix.width ||
+	    fmt.g_height() != src_fmt.fmt.pix.height ||
+	    fmt.g_pixelformat() != src_fmt.fmt.pix.pixelformat) {
+		fprintf(stderr, "%s can't output the capture format\n", dev);
+		return -1;
+	}
+
+	out_q.init(V4L2_BUF_TYPE_VIDEO_OUTPUT, V4L2_MEMORY_MMAP);
+	if (out_q.reqbufs(&out_fd, NUM_BUFS) || out_q.mmap_bufs(&out_fd)) {
+		perror("output buffers");
+		return -1;
+	}
+
+	tpg_init(&tpg, fmt.g_width(), fmt.g_height());
+	if (tpg_alloc(&tpg, fmt.g_width())) {
+		fprintf(stderr, "out of memory\n");
+		return -1;
+	}
+	bool have_tpg = tpg_s_fourcc(&tpg, fmt.g_pixelformat()) &&
+			tpg_g_buffers(&tpg) == 1;
+	if (have_tpg) {
+		tpg_reset_source(&tpg, fmt.g_width(), fmt.g_height(), V4L2_FIELD_NONE);
+		tpg_s_bytesperline(&tpg, 0, fmt.g_bytesperline());
+		tpg_s_pattern(&tpg, TPG_PAT_75_COLORBAR);
+	}
+
+	for (unsigned i = 0; i < out_q.g_buffers(); i++) {
+		unsigned char *p = (unsigned char *)out_q.g_dataptr(i, 0);
+		cv4l_buffer buf(out_q, i);
+
+		if (have_tpg)
+			tpg_fillbuffer(&tpg, 0, 0, p);
+		else
+			memset(p, 0x80, out_q.g_length(0));
+		stamp_write(p, fmt.g_width(), fmt.g_bytesperline(), now_ns());
+		buf.s_bytesused(fmt.g_sizeimage());
+		if (out_fd.qbuf(buf)) {
+			perror("VIDIOC_QBUF (output)");
+			tpg_free(&tpg);
+			return -1;
+		}
+	}
+	tpg_free(&tpg);
+
+	if (out_fd.streamon()) {
+		perror("VIDIOC_STREAMON (output)");
+		return -1;
+	}
+	return 0;
+}
+
+static void print_stage(const char *name, std::vector<double> v)
+{
+	double sum = 0;
+
+	if (v.empty()) {
+		printf("%-22s %8s\n", name, "-");
+		return;
+	}
+	std::sort(v.begin(), v.end());
+	for (auto d : v)
+		sum += d;
+	printf("%-22s %8.3f %8.3f %8.3f %8.3f %8.3f %8.3f %7zu\n", name,
+	       v.front(), sum / v.size(), v[v.size() / 2],
+	       v[v.size() * 95 / 100], v[v.size() * 99 / 100], v.back(),
+	       v.size());
+}
+
+static void print_results()
+{
+	std::vector<double> drv, handoff, conv, disp, total, g2g;
+
+	for (const auto &t : results) {
+		if (t.ts) {
+			drv.push_back((double)(__s64)(t.dq - t.ts) / 1e6);
+			total.push_back((double)(__s64)(t.shown - t.ts) / 1e6);
+		}
+		handoff.push_back((t.conv_start - t.dq) / 1e6);
+		conv.push_back((t.conv_end - t.conv_start) / 1e6);
+		disp.push_back((t.shown - t.conv_end) / 1e6);
+		if (t.stamp)
+			g2g.push_back((double)(__s64)(t.shown - t.stamp) / 1e6);
+	}
+
+	printf("\n%-22s %8s %8s %8s %8s %8s %8s %7s\n", "latency (ms)",
+	       "min", "avg", "p50", "p95", "p99", "max", "frames");
+	print_stage("timestamp -> dqbuf", drv);
+	print_stage("dqbuf -> convert", handoff);
+	print_stage("convert", conv);
+	print_stage("convert -> display", disp);
+	print_stage("timestamp -> display", total);
+	if (!g2g.empty())
+		print_stage("glass -> glass", g2g);
+	printf("\n%zu frames shown, %u dropped\n", results.size(), dropped.load());
+}
+
+static void usage(const char *prog)
+{
+	printf("Usage: %s [options]\n"
+	       "  -d, --device <dev>    capture device (default /dev/video0)\n"
+	       "  -o, --output <dev>    output device looping back into the capture\n"
+	       "                        device, to measure the glass to glass latency\n"
+	       "  -f, --format <fourcc> format to convert to (default RGB3)\n"
+	       "  -s, --size <w>x<h>    frame size to ask the device for\n"
+	       "  -n, --frames <count>  frames to measure (default 300)\n"
+	       "  -h, --help            show this help\n", prog);
+}
+
+int main(int argc, char **argv)
+{
+	static const struct option long_options[] = {
+		{ "device", required_argument, NULL, 'd' },
+		{ "output", required_argument, NULL, 'o' },
+		{ "format", required_argument, NULL, 'f' },
+		{ "size", required_argument, NULL, 's' },
+		{ "frames", required_argument, NULL, 'n' },
+		{ "help", no_argument, NULL, 'h' },
+		{ NULL, 0, NULL, 0 }
+	};
+	const char *dev = "/dev/video0";
+	const char *out_dev = NULL;
+	__u32 fourcc = V4L2_PIX_FMT_RGB24;
+	unsigned width = 0, height = 0;
+	unsigned frames = 300;
+	cv4l_fd out_fd;
+	cv4l_queue out_q;
+	int opt;
+
+	while ((opt = getopt_long(argc, argv, "d:o:f:s:n:h", long_options, NULL)) != -1) {
+		switch (opt) {
+		case 'd':
+			dev = optarg;
+			break;
+		case 'o':
+			out_dev = optarg;
+			break;
+		case 'f':
+			if (strlen(optarg) != 4) {
+				fprintf(stderr, "invalid fourcc %s\n", optarg);
+				return 1;
+			}
+			fourcc = v4l2_fourcc(optarg[0], optarg[1], optarg[2], optarg[3]);
+			break;
+		case 's':
+			if (sscanf(optarg, "%ux%u", &width, &height) != 2) {
+				fprintf(stderr, "invalid size %s\n", optarg);
+				return 1;
+			}
+			break;
+		case 'n':
+			frames = strtoul(optarg, NULL, 0);
+			break;
+		case 'h':
+			usage(argv[0]);
+			return 0;
+		default:
+			usage(argv[0]);
+			return 1;
+		}
+	}
+	if (out_dev && fourcc != V4L2_PIX_FMT_RGB24 && fourcc != V4L2_PIX_FMT_BGR24) {
+		fprintf(stderr, "--output needs RGB3 or BGR3 to decode the stamps\n");
+		return 1;
+	}
+
+	cap_fd.s_direct(true);
+	if (cap_fd.open(dev, true) < 0) {
+		fprintf(stderr, "Failed to open %s: %s\n", dev, strerror(errno));
+		return 1;
+	}
+	if (!cap_fd.has_vid_cap() || cap_fd.has_vid_mplane() ||
+	    !cap_fd.has_streaming()) {
+		fprintf(stderr, "%s is not a single planar streaming capture device\n", dev);
+		return 1;
+	}
+	convert = v4lconvert_create(cap_fd.g_fd());
+	if (!convert) {
+		fprintf(stderr, "v4lconvert_create failed\n");
+		return 1;
+	}
+
+	/* Pick the device format to convert from, just like libv4l2 */
+	cap_fd.g_fmt(dst_fmt, V4L2_BUF_TYPE_VIDEO_CAPTURE);
+	if (width && height) {
+		dst_fmt.fmt.pix.width = width;
+		dst_fmt.fmt.pix.height = height;
+	}
+	dst_fmt.fmt.pix.pixelformat = fourcc;
+	dst_fmt.fmt.pix.field = V4L2_FIELD_NONE;
+	if (v4lconvert_try_format(convert, &dst_fmt, &src_fmt) ||
+	    dst_fmt.fmt.pix.pixelformat != fourcc) {
+		fprintf(stderr, "can't convert to the requested format\n");
+		return 1;
+	}
+	if (cap_fd.s_fmt(src_fmt, false)) {
+		perror("VIDIOC_S_FMT");
+		return 1;
+	}
+	printf("Capturing %ux%u %.4s, converting to %.4s\n",
+	       src_fmt.fmt.pix.width, src_fmt.fmt.pix.height,
+	       (char *)&src_fmt.fmt.pix.pixelformat,
+	       (char *)&dst_fmt.fmt.pix.pixelformat);
+
+	cap_q.init(V4L2_BUF_TYPE_VIDEO_CAPTURE, V4L2_MEMORY_MMAP);
+	if (cap_q.reqbufs(&cap_fd, NUM_BUFS) || cap_q.mmap_bufs(&cap_fd) ||
+	    cap_q.queue_all(&cap_fd)) {
+		perror("capture buffers");
+		return 1;
+	}
+	for (unsigned i = 0; i < NUM_SLOTS; i++) {
+		slots.emplace_back(dst_fmt.fmt.pix.sizeimage);
+		free_slots.push(i);
+	}
+	results.reserve(frames);
+
+	if (out_dev && setup_output(out_fd, out_q, out_dev))
+		return 1;
+	if (cap_fd.streamon()) {
+		perror("VIDIOC_STREAMON");
+		return 1;
+	}
+
+	std::thread capture(capture_thread);
+	std::thread converter(convert_thread);
+	std::thread display(display_thread, frames, out_dev != NULL);
+	std::thread output;
+
+	if (out_dev)
+		output = std::thread(output_thread, &out_fd, &out_q);
+
+	capture.join();
+	converter.join();
+	display.join();
+	if (out_dev) {
+		output.join();
+		out_fd.streamoff();
+		out_q.free(&out_fd);
+		out_fd.close();
+	}
+
+	cap_fd.streamoff();
+	cap_q.free(&cap_fd);
+	v4lconvert_destroy(convert);
+	cap_fd.close();
+
+	print_results();
+	return 0;
+}
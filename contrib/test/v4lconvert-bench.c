@@ -0,0 +1,587 @@
+/*
+ * v4lconvert-bench: benchmark the libv4lconvert conversions without a device
+ *
+ * Copyright 2026 The v4l-utils authors
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2.1 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * Every source format is fed to v4lconvert_convert() for every destination
+ * format and frame size, through a fake device that only enumerates that
+ * source format. The frames are generated by the test pattern generator,
+ * or read from a file for the (compressed) formats it can't generate.
+ *
+ * The results can be written to a baseline file, and compared against
+ * such a file on the next run: a conversion that became more than the
+ * threshold slower is reported and makes the exit code non-zero.
+ *
+ * Set LIBV4LCONVERT_THREADS to benchmark the threaded conversions.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+
+#include <libv4lconvert.h>
+#include <libv4l-plugin.h>
+
+#include "v4l2-tpg.h"
+
+/* The formats of supported_src_pixfmts in libv4lconvert.c */
+static const uint32_t src_fmts[] = {
+	V4L2_PIX_FMT_RGB24, V4L2_PIX_FMT_BGR24,
+	V4L2_PIX_FMT_YUV420, V4L2_PIX_FMT_YVU420,
+	V4L2_PIX_FMT_NV12, V4L2_PIX_FMT_XRGB32, V4L2_PIX_FMT_XBGR32,
+	V4L2_PIX_FMT_RGB565, V4L2_PIX_FMT_BGR32, V4L2_PIX_FMT_RGB32,
+	V4L2_PIX_FMT_ABGR32, V4L2_PIX_FMT_ARGB32,
+	V4L2_PIX_FMT_YUYV, V4L2_PIX_FMT_YVYU, V4L2_PIX_FMT_UYVY,
+	V4L2_PIX_FMT_NV16, V4L2_PIX_FMT_NV61,
+	V4L2_PIX_FMT_SPCA501, V4L2_PIX_FMT_SPCA505, V4L2_PIX_FMT_SPCA508,
+	V4L2_PIX_FMT_CIT_YYVYUY, V4L2_PIX_FMT_KONICA420,
+	V4L2_PIX_FMT_SN9C20X_I420, V4L2_PIX_FMT_M420, V4L2_PIX_FMT_HM12,
+	V4L2_PIX_FMT_CPIA1,
+	V4L2_PIX_FMT_MJPEG, V4L2_PIX_FMT_JPEG, V4L2_PIX_FMT_PJPG,
+	V4L2_PIX_FMT_JPGL, V4L2_PIX_FMT_OV511, V4L2_PIX_FMT_OV518,
+	V4L2_PIX_FMT_SBGGR8, V4L2_PIX_FMT_SGBRG8,
+	V4L2_PIX_FMT_SGRBG8, V4L2_PIX_FMT_SRGGB8, V4L2_PIX_FMT_STV0680,
+	V4L2_PIX_FMT_SBGGR10P, V4L2_PIX_FMT_SGBRG10P,
+	V4L2_PIX_FMT_SGRBG10P, V4L2_PIX_FMT_SRGGB10P,
+	V4L2_PIX_FMT_SBGGR10, V4L2_PIX_FMT_SGBRG10,
+	V4L2_PIX_FMT_SGRBG10, V4L2_PIX_FMT_SRGGB10,
+	V4L2_PIX_FMT_SBGGR16, V4L2_PIX_FMT_SGBRG16,
+	V4L2_PIX_FMT_SGRBG16, V4L2_PIX_FMT_SRGGB16,
+	V4L2_PIX_FMT_SPCA561, V4L2_PIX_FMT_SN9C10X, V4L2_PIX_FMT_SN9C2028,
+	V4L2_PIX_FMT_PAC207, V4L2_PIX_FMT_MR97310A, V4L2_PIX_FMT_JL2005BCD,
+	V4L2_PIX_FMT_SQ905C, V4L2_PIX_FMT_SE401,
+	V4L2_PIX_FMT_GREY, V4L2_PIX_FMT_Y4, V4L2_PIX_FMT_Y6,
+	V4L2_PIX_FMT_Y10BPACK, V4L2_PIX_FMT_Y16, V4L2_PIX_FMT_Y16_BE,
+	V4L2_PIX_FMT_HSV32, V4L2_PIX_FMT_HSV24,
+};
+
+static const uint32_t dst_fmts[] = {
+	V4L2_PIX_FMT_RGB24, V4L2_PIX_FMT_BGR24,
+	V4L2_PIX_FMT_YUV420, V4L2_PIX_FMT_YVU420,
+	V4L2_PIX_FMT_NV12, V4L2_PIX_FMT_XRGB32, V4L2_PIX_FMT_XBGR32,
+};
+
+struct frame_size {
+	unsigned width;
+	unsigned height;
+};
+
+/* A frame read with -i, used instead of a generated one */
+struct input_file {
+	uint32_t fourcc;
+	unsigned width;
+	unsigned height;
+	unsigned char *data;
+	unsigned size;
+};
+
+struct baseline {
+	uint32_t src;
+	uint32_t dst;
+	unsigned width;
+	unsigned height;
+	double mpix;
+};
+
+#define MAX_SIZES	16
+#define MAX_INPUTS	16
+
+static struct frame_size sizes[MAX_SIZES] = {
+	{ 640, 480 }, { 1280, 720 }, { 1920, 1080 },
+};
+static unsigned num_sizes = 3;
+static struct input_file inputs[MAX_INPUTS];
+static unsigned num_inputs;
+static struct baseline *baselines;
+static unsigned num_baselines;
+static uint32_t only_src;
+static unsigned min_ms = 200;
+static double threshold = 10;
+
+/* The fake device, which only knows the pixelformat being benchmarked */
+struct bench_dev {
+	uint32_t fourcc;
+	unsigned width;
+	unsigned height;
+};
+
+static void *bench_init(int fd)
+{
+	return NULL;
+}
+
+static void bench_close(void *priv)
+{
+}
+
+static int bench_ioctl(void *priv, int fd, unsigned long cmd, void *arg)
+{
+	struct bench_dev *dev = priv;
+
+	switch (cmd) {
+	case VIDIOC_QUERYCAP: {
+		struct v4l2_capability *cap = arg;
+
+		memset(cap, 0, sizeof(*cap));
+		strcpy((char *)cap->driver, "v4lconvert-bench");
+		strcpy((char *)cap->card, "v4lconvert-bench");
+		cap->capabilities = V4L2_CAP_VIDEO_CAPTURE | V4L2_CAP_STREAMING;
+		return 0;
+	}
+	case VIDIOC_ENUM_FMT: {
+		struct v4l2_fmtdesc *fmt = arg;
+
+		/*
+		 * Also enumerate RGB24, so libv4lconvert doesn't consider
+		 * this a device that always needs conversion and won't
+		 * enable the software processing.
+		 */
+		if (fmt->index > 1 || fmt->type != V4L2_BUF_TYPE_VIDEO_CAPTURE)
+			break;
+		fmt->pixelformat = fmt->index ? V4L2_PIX_FMT_RGB24 : dev->fourcc;
+		return 0;
+	}
+	case VIDIOC_ENUM_FRAMESIZES: {
+		struct v4l2_frmsizeenum *fsize = arg;
+
+		if (fsize->index)
+			break;
+		fsize->type = V4L2_FRMSIZE_TYPE_DISCRETE;
+		fsize->discrete.width = dev->width;
+		fsize->discrete.height = dev->height;
+		return 0;
+	}
+	default:
+		break;
+	}
+	errno = EINVAL;
+	return -1;
+}
+
+static ssize_t bench_read(void *priv, int fd, void *buf, size_t len)
+{
+	errno = EINVAL;
+	return -1;
+}
+
+static ssize_t bench_write(void *priv, int fd, const void *buf, size_t len)
+{
+	errno = EINVAL;
+	return -1;
+}
+
+static const struct libv4l_dev_ops bench_dev_ops = {
+	.init = bench_init,
+	.close = bench_close,
+	.ioctl = bench_ioctl,
+	.read = bench_read,
+	.write = bench_write,
+};
+
+static const char *fcc2s(uint32_t fourcc)
+{
+	static char s[5];
+	unsigned i;
+
+	for (i = 0; i < 4; i++) {
+		s[i] = (fourcc >> (8 * i)) & 0xff;
+		if (s[i] < ' ' || s[i] > '~')
+			s[i] = '.';
+	}
+	s[4] = 0;
+	return s;
+}
+
+static uint32_t s2fcc(const char *s)
+{
+	char f[4] = { ' ', ' ', ' ', ' ' };
+	unsigned i;
+
+	for (i = 0; i < 4 && s[i]; i++)
+		f[i] = s[i];
+	return v4l2_fourcc(f[0], f[1], f[2], f[3]);
+}
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/* A CPU cycle counter for this thread, or -1 if there is none */
+static int open_cycle_counter(void)
+{
+	struct perf_event_attr attr;
+
+	memset(&attr, 0, sizeof(attr));
+	attr.size = sizeof(attr);
+	attr.type = PERF_TYPE_HARDWARE;
+	attr.config = PERF_COUNT_HW_CPU_CYCLES;
+	attr.exclude_kernel = 1;
+	attr.exclude_hv = 1;
+	return syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+static uint64_t read_cycles(int fd)
+{
+	uint64_t v = 0;
+
+	if (fd < 0 || read(fd, &v, sizeof(v)) != sizeof(v))
+		return 0;
+	return v;
+}
+
+/*
+ * Fill the frame with a test pattern. Returns the frame size, or 0 if
+ * the test pattern generator doesn't support the format.
+ */
+static unsigned gen_frame(struct tpg_data *tpg, uint32_t fourcc,
+			  unsigned width, unsigned height,
+			  unsigned char **data, struct v4l2_format *fmt)
+{
+	unsigned size = 0;
+	unsigned p;
+
+	if (!tpg_s_fourcc(tpg, fourcc) || tpg_g_buffers(tpg) > 1)
+		return 0;
+	tpg_reset_source(tpg, width, height, V4L2_FIELD_NONE);
+	tpg_s_bytesperline(tpg, 0, width * tpg_g_twopixelsize(tpg, 0) / 2);
+	tpg_s_pattern(tpg, TPG_PAT_75_COLORBAR);
+	for (p = 0; p < tpg_g_planes(tpg); p++)
+		size += tpg_calc_plane_size(tpg, p);
+	*data = malloc(size);
+	if (!*data)
+		return 0;
+	tpg_fillbuffer(tpg, 0, 0, *data);
+	fmt->fmt.pix.bytesperline = tpg_g_bytesperline(tpg, 0);
+	fmt->fmt.pix.sizeimage = size;
+	return size;
+}
+
+static const struct input_file *find_input(uint32_t fourcc,
+					   unsigned width, unsigned height)
+{
+	unsigned i;
+
+	for (i = 0; i < num_inputs; i++)
+		if (inputs[i].fourcc == fourcc && inputs[i].width == width &&
+		    inputs[i].height == height)
+			return &inputs[i];
+	return NULL;
+}
+
+static const struct baseline *find_baseline(uint32_t src, uint32_t dst,
+					    unsigned width, unsigned height)
+{
+	unsigned i;
+
+	for (i = 0; i < num_baselines; i++)
+		if (baselines[i].src == src && baselines[i].dst == dst &&
+		    baselines[i].width == width && baselines[i].height == height)
+			return &baselines[i];
+	return NULL;
+}
+
+static int load_baseline(const char *fname)
+{
+	FILE *f = fopen(fname, "r");
+	struct baseline b;
+
+	if (!f) {
+		fprintf(stderr, "cannot open %s: %s\n", fname, strerror(errno));
+		return -1;
+	}
+	while (fscanf(f, "%x %x %ux%u %lf", &b.src, &b.dst,
+		      &b.width, &b.height, &b.mpix) == 5) {
+		baselines = realloc(baselines, (num_baselines + 1) * sizeof(b));
+		baselines[num_baselines++] = b;
+	}
+	fclose(f);
+	return 0;
+}
+
+static int load_input(char *arg)
+{
+	struct input_file *in = &inputs[num_inputs];
+	char *fcc = strtok(arg, ",");
+	char *size = strtok(NULL, ",");
+	char *fname = strtok(NULL, "");
+	struct stat st;
+	int fd;
+
+	if (num_inputs == MAX_INPUTS || !fcc || !size || !fname ||
+	    sscanf(size, "%ux%u", &in->width, &in->height) != 2) {
+		fprintf(stderr, "invalid -i argument, expected <fourcc>,<w>x<h>,<file>\n");
+		return -1;
+	}
+	in->fourcc = s2fcc(fcc);
+	fd = open(fname, O_RDONLY);
+	if (fd < 0 || fstat(fd, &st)) {
+		fprintf(stderr, "cannot open %s: %s\n", fname, strerror(errno));
+		return -1;
+	}
+	in->size = st.st_size;
+	in->data = malloc(in->size);
+	if (!in->data || read(fd, in->data, in->size) != (ssize_t)in->size) {
+		fprintf(stderr, "cannot read %s\n", fname);
+		close(fd);
+		return -1;
+	}
+	close(fd);
+	num_inputs++;
+	return 0;
+}
+
+static int parse_sizes(const char *s)
+{
+	num_sizes = 0;
+	while (*s) {
+		int n = 0;
+
+		if (num_sizes == MAX_SIZES ||
+		    sscanf(s, "%ux%u%n", &sizes[num_sizes].width,
+			   &sizes[num_sizes].height, &n) != 2)
+			return -1;
+		num_sizes++;
+		s += n;
+		if (*s == ',')
+			s++;
+		else if (*s)
+			return -1;
+	}
+	return num_sizes ? 0 : -1;
+}
+
+static void usage(void)
+{
+	fprintf(stderr,
+		"usage: v4lconvert-bench [options]\n"
+		"  -s, --sizes <w>x<h>[,<w>x<h>...]\n"
+		"                   the frame sizes (default 640x480,1280x720,1920x1080)\n"
+		"  -f, --format <fourcc>\n"
+		"                   only benchmark this source format\n"
+		"  -i, --input <fourcc>,<w>x<h>,<file>\n"
+		"                   use the frame in <file> for this format and size\n"
+		"  -t, --time <ms>  the minimum time to run each conversion (default 200)\n"
+		"  -b, --baseline <file>\n"
+		"                   compare the results against <file>\n"
+		"  -w, --write-baseline <file>\n"
+		"                   write the results to <file>\n"
+		"  -r, --regression <percent>\n"
+		"                   report conversions that became more than <percent>\n"
+		"                   slower than the baseline (default 10)\n");
+}
+
+int main(int argc, char **argv)
+{
+	static const struct option long_options[] = {
+		{ "sizes", required_argument, 0, 's' },
+		{ "format", required_argument, 0, 'f' },
+		{ "input", required_argument, 0, 'i' },
+		{ "time", required_argument, 0, 't' },
+		{ "baseline", required_argument, 0, 'b' },
+		{ "write-baseline", required_argument, 0, 'w' },
+		{ "regression", required_argument, 0, 'r' },
+		{ "help", no_argument, 0, 'h' },
+		{ 0, 0, 0, 0 }
+	};
+	const char *write_file = NULL;
+	FILE *fout = NULL;
+	struct tpg_data tpg;
+	unsigned regressions = 0;
+	unsigned max_w = 0;
+	unsigned i, s, d;
+	int null_fd, cycles_fd;
+	int ch;
+
+	while ((ch = getopt_long(argc, argv, "s:f:i:t:b:w:r:h",
+				 long_options, NULL)) != -1) {
+		switch (ch) {
+		case 's':
+			if (parse_sizes(optarg)) {
+				fprintf(stderr, "invalid sizes '%s'\n", optarg);
+				return 1;
+			}
+			break;
+		case 'f':
+			only_src = s2fcc(optarg);
+			break;
+		case 'i':
+			if (load_input(optarg))
+				return 1;
+			break;
+		case 't':
+			min_ms = strtoul(optarg, NULL, 0);
+			break;
+		case 'b':
+			if (load_baseline(optarg))
+				return 1;
+			break;
+		case 'w':
+			write_file = optarg;
+			break;
+		case 'r':
+			threshold = strtod(optarg, NULL);
+			break;
+		default:
+			usage();
+			return ch == 'h' ? 0 : 1;
+		}
+	}
+
+	if (write_file) {
+		fout = fopen(write_file, "w");
+		if (!fout) {
+			fprintf(stderr, "cannot create %s: %s\n", write_file,
+				strerror(errno));
+			return 1;
+		}
+	}
+
+	/* The formats of the fake devices must not come from a cache */
+	unsetenv("LIBV4LCONVERT_CACHE_DIR");
+	null_fd = open("/dev/null", O_RDWR);
+	cycles_fd = open_cycle_counter();
+
+	for (s = 0; s < num_sizes; s++)
+		if (sizes[s].width > max_w)
+			max_w = sizes[s].width;
+	tpg_init(&tpg, max_w, sizes[0].height);
+	if (tpg_alloc(&tpg, max_w)) {
+		fprintf(stderr, "out of memory\n");
+		return 1;
+	}
+
+	printf("%-4s  %-4s  %-9s  %9s  %12s  %s\n", "src", "dst", "size",
+	       "Mpix/s", "cycles/pixel", num_baselines ? "baseline" : "");
+	for (i = 0; i < sizeof(src_fmts) / sizeof(src_fmts[0]); i++) {
+		uint32_t src = src_fmts[i];
+
+		if (only_src && src != only_src)
+			continue;
+		for (s = 0; s < num_sizes; s++) {
+			unsigned w = sizes[s].width, h = sizes[s].height;
+			const struct input_file *in = find_input(src, w, h);
+			struct bench_dev dev = { src, w, h };
+			struct v4lconvert_data *data;
+			struct v4l2_format src_fmt;
+			unsigned char *frame = NULL;
+			unsigned char *dest;
+			unsigned dest_size = w * h * 4;
+			unsigned size;
+
+			memset(&src_fmt, 0, sizeof(src_fmt));
+			src_fmt.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+			src_fmt.fmt.pix.width = w;
+			src_fmt.fmt.pix.height = h;
+			src_fmt.fmt.pix.pixelformat = src;
+			src_fmt.fmt.pix.field = V4L2_FIELD_NONE;
+			if (in) {
+				size = in->size;
+				src_fmt.fmt.pix.sizeimage = size;
+			} else {
+				size = gen_frame(&tpg, src, w, h, &frame, &src_fmt);
+				if (!size) {
+					printf("%-4s  %-4s  %4ux%-4u  no input, use -i\n",
+					       fcc2s(src), "", w, h);
+					break;
+				}
+			}
+
+			data = v4lconvert_create_with_dev_ops(null_fd, &dev, &bench_dev_ops);
+			dest = malloc(dest_size);
+			if (!data || !dest) {
+				fprintf(stderr, "out of memory\n");
+				return 1;
+			}
+			for (d = 0; d < sizeof(dst_fmts) / sizeof(dst_fmts[0]); d++) {
+				unsigned char *src_data = in ? in->data : frame;
+				const struct baseline *base;
+				struct v4l2_format dst_fmt = src_fmt;
+				uint64_t start, end, c0, c1;
+				unsigned runs = 0;
+				double mpix;
+
+				if (dst_fmts[d] == src)
+					continue;
+				dst_fmt.fmt.pix.pixelformat = dst_fmts[d];
+				/* Warm up, and check that this conversion works */
+				if (v4lconvert_convert(data, &src_fmt, &dst_fmt,
+						       src_data, size, dest, dest_size) < 0) {
+					printf("%-4s  ", fcc2s(src));
+					printf("%-4s  %4ux%-4u  failed: %s\n",
+					       fcc2s(dst_fmts[d]), w, h,
+					       v4lconvert_get_error_message(data));
+					continue;
+				}
+				c0 = read_cycles(cycles_fd);
+				start = now_ns();
+				do {
+					v4lconvert_convert(data, &src_fmt, &dst_fmt,
+							   src_data, size, dest, dest_size);
+					runs++;
+					end = now_ns();
+				} while (runs < 3 || end - start < min_ms * 1000000ULL);
+				c1 = read_cycles(cycles_fd);
+
+				mpix = (double)w * h * runs * 1000.0 / (end - start);
+				printf("%-4s  ", fcc2s(src));
+				printf("%-4s  %4ux%-4u  %9.1f", fcc2s(dst_fmts[d]), w, h, mpix);
+				if (cycles_fd >= 0)
+					printf("  %12.2f", (double)(c1 - c0) / ((double)w * h * runs));
+				else
+					printf("  %12s", "-");
+				base = find_baseline(src, dst_fmts[d], w, h);
+				if (base) {
+					double delta = (mpix - base->mpix) * 100.0 / base->mpix;
+
+					printf("  %9.1f %+6.1f%%", base->mpix, delta);
+					if (delta < -threshold) {
+						printf(" REGRESSION");
+						regressions++;
+					}
+				}
+				printf("\n");
+				fflush(stdout);
+				if (fout)
+					fprintf(fout, "%08x %08x %ux%u %.1f\n",
+						src, dst_fmts[d], w, h, mpix);
+			}
+			v4lconvert_destroy(data);
+			free(dest);
+			free(frame);
+		}
+	}
+	tpg_free(&tpg);
+	if (fout)
+		fclose(fout);
+	if (cycles_fd >= 0)
+		close(cycles_fd);
+	close(null_fd);
+	if (regressions)
+		printf("%u conversions are more than %.0f%% slower than the baseline\n",
+		       regressions, threshold);
+	return regressions ? 1 : 0;
+}
@@ -0,0 +1,173 @@
+/*
+# CPU feature detection and SIMD kernel dispatch shared by the libraries
+# and the utils
+
+# This program is free software; you can redistribute it and/or modify
+# it under the terms of the GNU Lesser General Public License as published by
+# the Free Software Foundation; either version 2.1 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU Lesser General Public License for more details.
+#
+# You should have received a copy of the GNU Lesser General Public License
+# along with this program; if not, write to the Free Software
+# Foundation, Inc., 51 Franklin Street, Suite 500, Boston, MA  02110-1335  USA
+ */
+
+/*
+ * Each vectorized kernel provides a table of function pointers per
+ * instruction set plus one with the plain C functions, and lists them
+ * best first in an array of struct cpu_kernel_variant ending with the C
+ * one. cpu_select_kernels() then returns the first variant whose
+ * features the cpu has, so the selection only needs to be done once.
+ *
+ * Which variants are built is decided by the --disable-sse,
+ * --disable-avx2 and --disable-neon configure options, config.h must be
+ * included before this header. The V4L_SIMD environment variable forces
+ * a variant ("c", "sse", "avx2" or "neon") for benchmarking and for
+ * comparing against the C code, features the cpu lacks are never used.
+ */
+
+#ifndef __CPU_FEATURES_H
+#define __CPU_FEATURES_H
+
+#include <stdlib.h>
+#include <string.h>
+#if defined(__arm__) && defined(__linux__)
+#include <sys/auxv.h>
+#endif
+
+#define CPU_FEATURE_SSE2	0x01
+#define CPU_FEATURE_AVX2	0x02
+#define CPU_FEATURE_NEON	0x04
+#define CPU_FEATURE_SSSE3	0x08
+#define CPU_FEATURE_PCLMUL	0x10
+
+#define CPU_FEATURES_SSE	(CPU_FEATURE_SSE2 | CPU_FEATURE_SSSE3 | CPU_FEATURE_PCLMUL)
+
+/* Never a valid set of features, for caching the detection */
+#define CPU_FEATURES_UNKNOWN	0x80000000
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#ifndef DISABLE_SIMD_SSE
+#define CPU_BUILD_SSE
+#endif
+#ifndef DISABLE_SIMD_AVX2
+#define CPU_BUILD_AVX2
+#endif
+#endif
+
+#if (defined(__ARM_NEON) || defined(__aarch64__)) && !defined(DISABLE_SIMD_NEON)
+#define CPU_BUILD_NEON
+#endif
+
+#if defined(__arm__) && !defined(HWCAP_NEON)
+#define HWCAP_NEON (1 << 12)
+#endif
+
+struct cpu_kernel_variant {
+	const char *name;
+	unsigned int features;	/* All of these are needed */
+	const void *kernels;
+};
+
+/* The features of the cpu we run on that have variants built in */
+static inline unsigned int cpu_features_detect(void)
+{
+	unsigned int flags = 0;
+
+#if defined(CPU_BUILD_SSE) || defined(CPU_BUILD_AVX2)
+	__builtin_cpu_init();
+#ifdef CPU_BUILD_SSE
+	if (__builtin_cpu_supports("sse2"))
+		flags |= CPU_FEATURE_SSE2;
+	if (__builtin_cpu_supports("ssse3"))
+		flags |= CPU_FEATURE_SSSE3;
+	if (__builtin_cpu_supports("pclmul"))
+		flags |= CPU_FEATURE_PCLMUL;
+#endif
+#ifdef CPU_BUILD_AVX2
+	if (__builtin_cpu_supports("avx2"))
+		flags |= CPU_FEATURE_AVX2;
+#endif
+#elif defined(CPU_BUILD_NEON) && defined(__aarch64__)
+	/* Advanced SIMD is mandatory on aarch64 */
+	flags |= CPU_FEATURE_NEON;
+#elif defined(CPU_BUILD_NEON) && defined(__linux__)
+	if (getauxval(AT_HWCAP) & HWCAP_NEON)
+		flags |= CPU_FEATURE_NEON;
+#endif
+
+	return flags;
+}
+
+/* Apply the V4L_SIMD override to the detected flags */
+static inline unsigned int cpu_features_override(unsigned int flags)
+{
+	const char *simd = getenv("V4L_SIMD");
+
+	if (!simd)
+		return flags;
+	if (!strcmp(simd, "c"))
+		return 0;
+	if (!strcmp(simd, "sse"))
+		return flags & CPU_FEATURES_SSE;
+	if (!strcmp(simd, "avx2"))
+		return flags & (CPU_FEATURES_SSE | CPU_FEATURE_AVX2);
+	if (!strcmp(simd, "neon"))
+		return flags & CPU_FEATURE_NEON;
+	return flags;
+}
+
+/*
+ * The usable features. The result is cached per user of this header, the
+ * libraries that dispatch often wrap this to share one cache.
+ */
+static inline unsigned int cpu_features_get(void)
+{
+	static unsigned int cpu_flags = CPU_FEATURES_UNKNOWN;
+	unsigned int flags = __atomic_load_n(&cpu_flags, __ATOMIC_ACQUIRE);
+
+	/* Racing initializations all store the same value, atomically */
+	if (flags == CPU_FEATURES_UNKNOWN) {
+		flags = cpu_features_override(cpu_features_detect());
+		__atomic_store_n(&cpu_flags, flags, __ATOMIC_RELEASE);
+	}
+	return flags;
+}
+
+/* The best of the variants for flags, the last one must need no features */
+static inline const struct cpu_kernel_variant *
+cpu_select_variant(const struct cpu_kernel_variant *variants, unsigned int flags)
+{
+	while ((variants->features & flags) != variants->features)
+		variants++;
+	return variants;
+}
+
+static inline const void *
+cpu_select_kernels(const struct cpu_kernel_variant *variants, unsigned int flags)
+{
+	return cpu_select_variant(variants, flags)->kernels;
+}
+
+/*
+ * cpu_select_kernels() for cpu_features_get(), cached in *cache which
+ * must start out NULL. For kernels called too often to select each time.
+ */
+static inline const void *
+cpu_select_kernels_cached(const void **cache, const struct cpu_kernel_variant *variants)
+{
+	const void *kernels = __atomic_load_n(cache, __ATOMIC_ACQUIRE);
+
+	if (!kernels) {
+		kernels = cpu_select_kernels(variants, cpu_features_get());
+		__atomic_store_n(cache, kernels, __ATOMIC_RELEASE);
+	}
+	return kernels;
+}
+
+#endif
@@ -111,6 +111,27 @@ void dvb_desc_event_short_print(struct dvb_v5_fe_parms *parms,
  */
 void dvb_desc_event_short_free(struct dvb_desc *desc);
 
+/**
+ * @brief Decodes only the needed fields of a short event descriptor view
+ * @ingroup descriptors
+ *
+ * @param parms		struct dvb_v5_fe_parms pointer to the opened device
+ * @param view		the short event descriptor, from dvb_desc_iter_next()
+ * @param language	place to store the ISO 639 language code, as a
+ *			4 bytes string, or NULL
+ * @param name		place to store the event name, or NULL
+ * @param text		place to store the event text, or NULL
+ *
+ * Only the strings that are asked for are converted. They are allocated
+ * like dvb_desc_view_string() does, and set to NULL if empty.
+ *
+ * @return Returns 0 on success, a negative value if the view is not a
+ *	   valid short event descriptor.
+ */
+int dvb_desc_event_short_view(struct dvb_v5_fe_parms *parms,
+			      const struct dvb_desc_view *view,
+			      char *language, char **name, char **text);
+
 #ifdef __cplusplus
 }
 #endif
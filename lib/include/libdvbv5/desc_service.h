@@ -111,6 +111,26 @@ void dvb_desc_service_print(struct dvb_v5_fe_parms *parms,
  */
 void dvb_desc_service_free(struct dvb_desc *desc);
 
+/**
+ * @brief Decodes only the needed fields of a service descriptor view
+ * @ingroup descriptors
+ *
+ * @param parms		struct dvb_v5_fe_parms pointer to the opened device
+ * @param view		the service descriptor, from dvb_desc_iter_next()
+ * @param service_type	place to store the service type, or NULL
+ * @param provider	place to store the provider name, or NULL
+ * @param name		place to store the service name, or NULL
+ *
+ * Only the strings that are asked for are converted. They are allocated
+ * like dvb_desc_view_string() does, and set to NULL if empty.
+ *
+ * @return Returns 0 on success, a negative value if the view is not a
+ *	   valid service descriptor.
+ */
+int dvb_desc_service_view(struct dvb_v5_fe_parms *parms,
+			  const struct dvb_desc_view *view,
+			  uint8_t *service_type, char **provider, char **name);
+
 #ifdef __cplusplus
 }
 #endif
@@ -122,6 +122,39 @@ struct dvb_desc {
 	uint8_t data[];
 } __attribute__((packed));
 
+/**
+ * @struct dvb_desc_view
+ * @brief A descriptor as found on the raw MPEG-TS table, not decoded
+ * @ingroup dvb_table
+ *
+ * @param type		Descriptor type
+ * @param length	Length of the descriptor data
+ * @param data		pointer to the descriptor data, inside the buffer
+ *			the descriptors were read from
+ *
+ * The view is only valid while that buffer is.
+ */
+struct dvb_desc_view {
+	uint8_t type;
+	uint8_t length;
+	const uint8_t *data;
+};
+
+/**
+ * @struct dvb_desc_iter
+ * @brief Iterates over the descriptors of a raw MPEG-TS table
+ * @ingroup dvb_table
+ *
+ * @param ptr		next descriptor
+ * @param end		end of the descriptors
+ *
+ * Initialized by dvb_desc_iter_init().
+ */
+struct dvb_desc_iter {
+	const uint8_t *ptr;
+	const uint8_t *end;
+};
+
 #ifndef _DOXYGEN
 
 #define dvb_desc_foreach( _desc, _tbl ) \
@@ -200,6 +233,149 @@ void dvb_desc_free (struct dvb_desc **list);
  */
 void dvb_desc_print(struct dvb_v5_fe_parms *parms, struct dvb_desc *desc);
 
+/**
+ * @struct dvb_parse_arena
+ * @brief Arena where parsed tables and descriptors are allocated
+ * @ingroup dvb_table
+ *
+ * A parsed table is made of many small objects: the table itself, its
+ * entries (programs, streams, services, events, ...), the descriptors and
+ * their strings. When an arena is set with dvb_parse_set_arena(), those
+ * are allocated inside a few big memory blocks, and all of them are freed
+ * at once by dvb_parse_arena_reset() or dvb_parse_arena_free().
+ *
+ * The table free functions, like dvb_table_eit_free(), can still be
+ * called for tables in an arena: they just don't release the arena
+ * memory. This is an opaque struct.
+ */
+struct dvb_parse_arena;
+
+/**
+ * @brief allocates a parse arena
+ * @ingroup dvb_table
+ *
+ * @param block_size	size of each memory block. If zero, a default
+ *			of 64 KiB is used
+ *
+ * At success, returns a pointer. NULL otherwise.
+ */
+struct dvb_parse_arena *dvb_parse_arena_alloc(size_t block_size);
+
+/**
+ * @brief frees all tables and descriptors parsed into an arena
+ * @ingroup dvb_table
+ *
+ * @param arena		struct dvb_parse_arena pointer
+ *
+ * The arena can be used again afterwards.
+ */
+void dvb_parse_arena_reset(struct dvb_parse_arena *arena);
+
+/**
+ * @brief frees an arena, and all tables and descriptors parsed into it
+ * @ingroup dvb_table
+ *
+ * @param arena		struct dvb_parse_arena pointer
+ *
+ * The arena should not be set on any struct dvb_v5_fe_parms anymore.
+ */
+void dvb_parse_arena_free(struct dvb_parse_arena *arena);
+
+/**
+ * @brief sets the arena used for the tables parsed with a frontend
+ * @ingroup dvb_table
+ *
+ * @param parms		Struct dvb_v5_fe_parms pointer
+ * @param arena		struct dvb_parse_arena pointer, or NULL to allocate
+ *			the tables on the heap again
+ *
+ * Affects all tables and descriptors parsed afterwards with parms,
+ * including the ones read by dvb_read_section() and dvb_get_ts_tables().
+ */
+void dvb_parse_set_arena(struct dvb_v5_fe_parms *parms,
+			 struct dvb_parse_arena *arena);
+
+/**
+ * @brief starts iterating over the descriptors of a buffer
+ * @ingroup dvb_table
+ *
+ * @param iter		struct dvb_desc_iter to initialize
+ * @param buf		Buffer with the descriptors
+ * @param buflen	Size of the buffer
+ *
+ * Unlike dvb_desc_parse(), iterating doesn't allocate nor decode anything:
+ * each descriptor is returned as a struct dvb_desc_view pointing into buf,
+ * and can be decoded on demand, with dvb_desc_view_parse() or with the
+ * view functions of the descriptor, like dvb_desc_service_view().
+ */
+void dvb_desc_iter_init(struct dvb_desc_iter *iter, const uint8_t *buf,
+			uint16_t buflen);
+
+/**
+ * @brief gets the next descriptor of a buffer
+ * @ingroup dvb_table
+ *
+ * @param iter		struct dvb_desc_iter pointer
+ * @param view		place to store the descriptor
+ *
+ * Like dvb_desc_parse(), it stops at a 0xff descriptor type.
+ *
+ * @return Returns 1 if a descriptor was stored at view, 0 at the end of
+ * the descriptors and -1 if the descriptor doesn't fit in the buffer.
+ */
+int dvb_desc_iter_next(struct dvb_desc_iter *iter, struct dvb_desc_view *view);
+
+/**
+ * @brief finds a descriptor type in a buffer
+ * @ingroup dvb_table
+ *
+ * @param buf		Buffer with the descriptors
+ * @param buflen	Size of the buffer
+ * @param type		Descriptor type to find
+ * @param view		place to store the descriptor
+ *
+ * @return Returns 1 if the descriptor was found, 0 if not and -1 if the
+ * descriptors are malformed.
+ */
+int dvb_desc_view_find(const uint8_t *buf, uint16_t buflen, uint8_t type,
+		       struct dvb_desc_view *view);
+
+/**
+ * @brief fully decodes a single descriptor
+ * @ingroup dvb_table
+ *
+ * @param parms		Struct dvb_v5_fe_parms pointer
+ * @param view		descriptor to decode
+ *
+ * The descriptor is decoded just like dvb_desc_parse() does, as a list
+ * with a single entry.
+ *
+ * @return Returns the descriptor, to be freed with dvb_desc_free(), or
+ * NULL on error.
+ */
+struct dvb_desc *dvb_desc_view_parse(struct dvb_v5_fe_parms *parms,
+				     const struct dvb_desc_view *view);
+
+/**
+ * @brief decodes a string of a descriptor
+ * @ingroup dvb_table
+ *
+ * @param parms		Struct dvb_v5_fe_parms pointer
+ * @param src		string, as found on the descriptor data
+ * @param len		length of the string
+ *
+ * Converts the string to the output charset, like the descriptor parsers
+ * do, discarding the emphasis part.
+ *
+ * The string is allocated like the decoded descriptors are: if a parse
+ * arena is set, it is released together with the arena, otherwise it
+ * should be freed with free().
+ *
+ * @return Returns the string, or NULL if it is empty or on error.
+ */
+char *dvb_desc_view_string(struct dvb_v5_fe_parms *parms, const uint8_t *src,
+			   size_t len);
+
 #ifdef __cplusplus
 }
 #endif
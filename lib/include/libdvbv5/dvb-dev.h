@@ -236,6 +236,38 @@ struct dvb_dev_list *dvb_get_dev_info(struct dvb_device *dvb,
  */
 void dvb_dev_stop_monitor(struct dvb_device *dvb);
 
+/**
+ * @brief Hands the monitor mode of dvb_dev_find() over to the caller
+ * @ingroup dvb_device
+ *
+ * @param dvb pointer to struct dvb_device to be used
+ *
+ * After calling dvb_dev_find() in monitor mode, this function stops the
+ * thread that waits for the device changes, and returns a file descriptor
+ * that becomes readable when there are changes, to be added to the
+ * caller's poll() or epoll loop. When it is readable, the caller should
+ * call dvb_dev_monitor_handle(), which updates the list of devices and
+ * calls the handler given to dvb_dev_find(), from the caller's thread.
+ * So, no mutexes are needed to access the list of devices.
+ *
+ * @return returns the file descriptor, or a negative error code, like
+ * -EINVAL if dvb_dev_find() wasn't called in monitor mode.
+ */
+int dvb_dev_monitor_get_fd(struct dvb_device *dvb);
+
+/**
+ * @brief Handles the device changes pending on dvb_dev_monitor_get_fd()
+ * @ingroup dvb_device
+ *
+ * @param dvb pointer to struct dvb_device to be used
+ *
+ * It doesn't block.
+ *
+ * @return returns the number of device changes handled, or a negative
+ * error code.
+ */
+int dvb_dev_monitor_handle(struct dvb_device *dvb);
+
 /**
  * @brief Sets the DVB verbosity and log function with context private data
  * @ingroup dvb_device
@@ -339,6 +371,72 @@ int dvb_dev_get_fd(struct dvb_open_descriptor *open_dev);
 ssize_t dvb_dev_read(struct dvb_open_descriptor *open_dev,
 		     void *buf, size_t count);
 
+/**
+ * @brief Setup memory mapped streaming on a dvb demux or dvr file
+ * @ingroup dvb_device
+ *
+ * @param open_dev	Points to the struct dvb_open_descriptor
+ * @param count		number of buffers to allocate
+ * @param size		size of each buffer, in bytes
+ *
+ * This is a wrapper for the DMX_REQBUFS, DMX_QUERYBUF and DMX_QBUF
+ * ioctls. All the buffers are mapped and queued, after that, data
+ * can be consumed in place with dvb_dev_mmap_dequeue(), instead of being
+ * copied by dvb_dev_read(). The two shouldn't be mixed.
+ *
+ * For remote devices, the buffers are emulated: they're allocated
+ * locally, and filled by dvb_dev_mmap_dequeue().
+ *
+ * @return On success, returns the number of buffers, which can be smaller
+ * than count. Returns a negative error code otherwise.
+ */
+int dvb_dev_mmap_setup(struct dvb_open_descriptor *open_dev,
+		       unsigned int count, unsigned int size);
+
+/**
+ * @brief Dequeue a buffer filled with data
+ * @ingroup dvb_device
+ *
+ * @param open_dev	Points to the struct dvb_open_descriptor
+ * @param data		pointer to be filled with the buffer's data address
+ * @param index		pointer to be filled with the buffer's index, to
+ *			be used with dvb_dev_mmap_queue()
+ * @param flags		buffer flags, as defined at enum dmx_buffer_flags.
+ *			May be NULL.
+ *
+ * This is a wrapper for the DMX_DQBUF ioctl. The buffer should be given
+ * back with dvb_dev_mmap_queue() once its data was consumed.
+ *
+ * @return On success, returns the number of bytes at the buffer. Returns
+ * a negative error code otherwise, with -EOVERFLOW meaning that data
+ * was lost.
+ */
+ssize_t dvb_dev_mmap_dequeue(struct dvb_open_descriptor *open_dev,
+			     void **data, int *index, uint32_t *flags);
+
+/**
+ * @brief Give a buffer back, after consuming its data
+ * @ingroup dvb_device
+ *
+ * @param open_dev	Points to the struct dvb_open_descriptor
+ * @param index		buffer index, as returned by dvb_dev_mmap_dequeue()
+ *
+ * This is a wrapper for the DMX_QBUF ioctl.
+ *
+ * @return Retuns zero on success, a negative error code otherwise.
+ */
+int dvb_dev_mmap_queue(struct dvb_open_descriptor *open_dev, int index);
+
+/**
+ * @brief Unmap and free the buffers allocated by dvb_dev_mmap_setup()
+ * @ingroup dvb_device
+ *
+ * @param open_dev	Points to the struct dvb_open_descriptor
+ *
+ * @note dvb_dev_close() already does that.
+ */
+void dvb_dev_mmap_free(struct dvb_open_descriptor *open_dev);
+
 /**
  * @brief Stops the demux filter for a given file descriptor
  * @ingroup dvb_device
@@ -366,6 +464,9 @@ void dvb_dev_dmx_stop(struct dvb_open_descriptor *open_dev);
  * See http://linuxtv.org/downloads/v4l-dvb-apis/dvb_demux.html
  * for more details.
  *
+ * For remote devices, this also negotiates a larger transfer unit and
+ * client-side ring buffer for the descriptor, if the daemon supports it.
+ *
  * @return Retuns zero on success, -1 otherwise.
  *
  * @note valid only for DVB_DEVICE_DEMUX or DVB_DEVICE_DVR.
@@ -474,20 +575,55 @@ struct dvb_v5_descriptors *dvb_dev_scan(struct dvb_open_descriptor *open_dev,
 					unsigned other_nit,
 					unsigned timeout_multiply);
 
+/* From dvb-dev-file.c */
+
+/**
+ * @brief initialize the dvb-dev to use a virtual device, backed by MPEG-TS
+ *	recordings
+ *
+ * @param dvb		pointer to struct dvb_device to be used
+ * @param dir		directory with the recordings, one per transponder,
+ *			named after its frequency, as stored at DTV_FREQUENCY,
+ *			like 474000000.ts
+ *
+ * The device has a single frontend, demux and dvr. Tuning into a frequency
+ * with a recording locks at once, and the demux then reads the recording,
+ * in a loop for the section filters, as fast as it is asked for. Useful to
+ * test a scan, or anything that reads the tables, without any hardware.
+ *
+ * @return zero on success, or a negative error code. On error, the
+ * dvb-dev is left as it was.
+ */
+int dvb_dev_file_init(struct dvb_device *d, const char *dir);
+
 /* From dvb-dev-remote.c */
 
 #ifdef HAVE_DVBV5_REMOTE
 
 #define REMOTE_BUF_SIZE (87 * 188)	/* 16356 bytes */
 
+/*
+ * Protocol version. Since version 2, the transfer unit used to send data
+ * for a demux or dvr descriptor can be raised, up to REMOTE_MAX_BUF_SIZE,
+ * by calling dvb_dev_set_bufsize() on it. Since version 3, the data is
+ * sent via a second connection, tuned for throughput, keeping the first
+ * one just for the low latency command messages. Since version 4, a
+ * daemon reached via its Unix socket writes the DVR data to a memory ring
+ * shared with the client. Since version 5, the frequently called methods,
+ * like fe_get_stats, use binary messages with a fixed layout.
+ */
+#define REMOTE_PROTO_VERSION 5
+#define REMOTE_MAX_BUF_SIZE (5577 * 188)	/* 1048476 bytes */
+
 
 /**
  * @brief initialize the dvb-dev to use a remote device running the
  *	dvbv5-daemon.
  *
  * @param dvb		pointer to struct dvb_device to be used
- * @param server	server hostname or address
- * @param port		server port
+ * @param server	server address, or the path of the Unix socket of a
+ *			local daemon
+ * @param port		server port. Ignored for Unix sockets
  *
  * @note The protocol between the dvbv5-daemon and the dvb_dev library is
  * highly experimental and is subject to changes in a near future. So,
@@ -496,6 +632,24 @@ struct dvb_v5_descriptors *dvb_dev_scan(struct dvb_open_descriptor *open_dev,
  */
 int dvb_dev_remote_init(struct dvb_device *d, char *server, int port);
 
+/**
+ * @brief subscribe to the frontend statistics of a remote device
+ *
+ * @param dvb		pointer to struct dvb_device, initialized with
+ *			dvb_dev_remote_init()
+ * @param interval_ms	how often the dvbv5-daemon samples the stats, in
+ *			milliseconds. Zero cancels the subscription
+ *
+ * While subscribed, the dvbv5-daemon pushes the statistics that changed
+ * at every sample, and dvb_fe_get_stats() just returns the last ones,
+ * without a round trip to the daemon.
+ *
+ * @return zero on success, or a negative error code. -ENOTSUP means that
+ * the dvbv5-daemon protocol is too old.
+ */
+int dvb_dev_remote_stats_subscribe(struct dvb_device *d,
+				   unsigned int interval_ms);
+
 #else
 
 static inline int dvb_dev_remote_init(struct dvb_device *d, char *server,
@@ -504,6 +658,12 @@ static inline int dvb_dev_remote_init(struct dvb_device *d, char *server,
 	return -1;
 };
 
+static inline int dvb_dev_remote_stats_subscribe(struct dvb_device *d,
+						 unsigned int interval_ms)
+{
+	return -1;
+};
+
 #endif
 
 
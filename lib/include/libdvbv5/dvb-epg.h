@@ -0,0 +1,211 @@
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation version 2.1 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ * Or, point your browser to http://www.gnu.org/licenses/old-licenses/gpl-2.0.html
+ *
+ */
+
+/**
+ * @file dvb-epg.h
+ * @ingroup frontend_scan
+ * @brief Collects the events of the EIT tables, with bounded memory
+ * @copyright GNU Lesser General Public License version 2.1 (LGPLv2.1)
+ *
+ * @par Bug Report
+ * Please submit bug reports and patches to linux-media@vger.kernel.org
+ */
+
+#ifndef _DVB_EPG_H
+#define _DVB_EPG_H
+
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h> /* ssize_t */
+
+/**
+ * @struct dvb_epg_event
+ * @brief An event collected from the EIT tables
+ * @ingroup frontend_scan
+ *
+ * @param network_id		original network ID. Zero for ATSC
+ * @param transport_id		transport stream ID. Zero for ATSC
+ * @param service_id		service ID, or the source ID for ATSC
+ * @param event_id		event ID
+ * @param atsc			1 if the event came from an ATSC EIT table
+ * @param version		version of the EIT section with the event
+ * @param running_status	running status. Zero for ATSC
+ * @param free_CA_mode		free CA mode. Zero for ATSC
+ * @param start			start time
+ * @param duration		duration in seconds
+ * @param language		ISO 639 language code of the name and text
+ * @param name			event name, or an empty string
+ * @param text			event description, or an empty string. Always
+ *				empty for ATSC, as it comes from the ETT
+ */
+struct dvb_epg_event {
+	uint16_t network_id;
+	uint16_t transport_id;
+	uint16_t service_id;
+	uint16_t event_id;
+	uint8_t atsc;
+	uint8_t version;
+	uint8_t running_status;
+	uint8_t free_CA_mode;
+	time_t start;
+	uint32_t duration;
+	char language[4];
+	const char *name;
+	const char *text;
+};
+
+/**
+ * @struct dvb_epg
+ * @brief Opaque struct with the collected events
+ * @ingroup frontend_scan
+ *
+ * The events are indexed by service and start time. Each one only takes
+ * one allocation, with its strings. The number of events is limited:
+ * when full, the events that start first are dropped.
+ */
+struct dvb_epg;
+
+/**
+ * @brief callback for the events returned by dvb_epg_query()
+ * @ingroup frontend_scan
+ *
+ * @param event		the event. Only valid during the call
+ * @param priv		pointer given to dvb_epg_query()
+ *
+ * Should return 0 to get more events, or any other value to stop.
+ */
+typedef int (*dvb_epg_event_func)(const struct dvb_epg_event *event,
+				  void *priv);
+
+struct dvb_v5_fe_parms;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief allocates an EPG collector
+ * @ingroup frontend_scan
+ *
+ * @param parms		pointer to struct dvb_v5_fe_parms created when the
+ *			frontend is opened, used for the logs and to
+ *			convert the strings
+ * @param max_events	maximum number of events to keep
+ *
+ * Returns the collector, or NULL if out of memory.
+ */
+struct dvb_epg *dvb_epg_alloc(struct dvb_v5_fe_parms *parms,
+			      unsigned max_events);
+
+/**
+ * @brief frees an EPG collector, with all its events
+ * @ingroup frontend_scan
+ *
+ * @param epg		struct dvb_epg pointer
+ */
+void dvb_epg_free(struct dvb_epg *epg);
+
+/**
+ * @brief adds the events of a raw EIT section
+ * @ingroup frontend_scan
+ *
+ * @param epg		struct dvb_epg pointer
+ * @param buf		the EIT section, as read from the demux, with its
+ *			CRC already checked
+ * @param buflen	size of the section
+ *
+ * Both DVB EIT (table IDs 0x4e to 0x6f) and ATSC EIT (table ID 0xcb)
+ * sections are handled. Other sections are ignored.
+ *
+ * Events already known with the same version are skipped before any
+ * string gets converted. Events that ended before the last call to
+ * dvb_epg_expire() are also skipped.
+ *
+ * Returns the number of new or updated events, or a negative error code.
+ */
+int dvb_epg_add_section(struct dvb_epg *epg, const uint8_t *buf,
+			ssize_t buflen);
+
+/**
+ * @brief reads EIT sections from a demux, adding their events
+ * @ingroup frontend_scan
+ *
+ * @param epg		struct dvb_epg pointer
+ * @param dmx_fd	an opened demux file descriptor
+ * @param pid		PID with the EIT sections, like DVB_TABLE_EIT_PID.
+ *			For ATSC, the EIT PIDs are listed on the MGT
+ * @param timeout	time to read, in seconds
+ *
+ * Reads all sections during timeout seconds, or until parms->abort
+ * is set.
+ *
+ * Returns the number of new or updated events, or a negative error code.
+ */
+int dvb_epg_read(struct dvb_epg *epg, int dmx_fd, uint16_t pid,
+		 unsigned timeout);
+
+/**
+ * @brief removes the events that already ended
+ * @ingroup frontend_scan
+ *
+ * @param epg		struct dvb_epg pointer
+ * @param now		current time
+ *
+ * Should be called from time to time, to keep the memory for the
+ * current and the next events.
+ *
+ * Returns the number of events removed.
+ */
+unsigned dvb_epg_expire(struct dvb_epg *epg, time_t now);
+
+/**
+ * @brief returns the number of events of an EPG collector
+ * @ingroup frontend_scan
+ *
+ * @param epg		struct dvb_epg pointer
+ */
+unsigned dvb_epg_num_events(struct dvb_epg *epg);
+
+/**
+ * @brief gets the events of a time range
+ * @ingroup frontend_scan
+ *
+ * @param epg		struct dvb_epg pointer
+ * @param network_id	original network ID, or -1 for any
+ * @param transport_id	transport stream ID, or -1 for any
+ * @param service_id	service ID, or -1 for any
+ * @param from		start of the time range
+ * @param to		end of the time range
+ * @param func		function called for each event
+ * @param priv		pointer passed to func
+ *
+ * func is called for the events that overlap [from, to), sorted by their
+ * start time for each service. The services are sorted by network ID,
+ * transport ID and service ID, the ATSC ones at the end.
+ *
+ * Returns the number of events found, or the value returned by func if it
+ * stopped the query.
+ */
+int dvb_epg_query(struct dvb_epg *epg, int network_id, int transport_id,
+		  int service_id, time_t from, time_t to,
+		  dvb_epg_event_func func, void *priv);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -410,6 +410,102 @@ int dvb_fe_set_parms(struct dvb_v5_fe_parms *parms);
  */
 int dvb_fe_get_parms(struct dvb_v5_fe_parms *parms);
 
+/**
+ * @struct dvb_fe_tune
+ * @brief Opaque struct with a tune prepared by dvb_fe_prepare_tune()
+ * @ingroup frontend
+ */
+struct dvb_fe_tune;
+
+/**
+ * @brief Validates and precomputes a tune to the parameters at the cache
+ * @ingroup frontend
+ *
+ * @param parms	struct dvb_v5_fe_parms pointer to the opened device
+ *
+ * Takes a snapshot of the properties at the cache, as stored with
+ * dvb_fe_store_parm(), and builds the property list that
+ * dvb_fe_set_parms() would send. The cache can then be changed for other
+ * channels, and each prepared tune kept for later use by dvb_fe_tune().
+ * This is meant for applications that switch among a set of channels.
+ *
+ * @return Returns a pointer to be freed with dvb_fe_tune_free(), or NULL
+ * if the parameters are invalid or on lack of memory.
+ */
+struct dvb_fe_tune *dvb_fe_prepare_tune(struct dvb_v5_fe_parms *parms);
+
+/**
+ * @brief Tunes to a prepared channel, waiting for a lock
+ * @ingroup frontend
+ *
+ * @param parms		struct dvb_v5_fe_parms pointer to the opened device
+ * @param tune		tune prepared by dvb_fe_prepare_tune()
+ * @param timeout_ms	how long to wait for a lock, in milliseconds
+ * @param lock_ms	if not NULL, stores the time it took to lock
+ *
+ * Restores the prepared properties at the cache, and sends them to the
+ * frontend. On a local DVBv5 frontend for a non-satellite delivery system,
+ * the precomputed list is submitted as is, with a single FE_SET_PROPERTY,
+ * and the lock is waited for with FE_GET_EVENT, instead of by polling the
+ * status. Otherwise, it falls back to dvb_fe_set_parms() and
+ * dvb_fe_get_stats().
+ *
+ * @return Returns 0 if the frontend locked, -ETIMEDOUT if it didn't lock
+ * in time, or another negative error code.
+ */
+int dvb_fe_tune(struct dvb_v5_fe_parms *parms, struct dvb_fe_tune *tune,
+		unsigned int timeout_ms, unsigned int *lock_ms);
+
+/**
+ * @brief Frees a tune prepared by dvb_fe_prepare_tune()
+ * @ingroup frontend
+ *
+ * @param tune	tune prepared by dvb_fe_prepare_tune()
+ */
+void dvb_fe_tune_free(struct dvb_fe_tune *tune);
+
+/**
+ * @typedef int (*dvb_fe_lock_cb)(struct dvb_v5_fe_parms *parms, void *priv)
+ * @brief Called by dvb_fe_wait_lock() when the stats are refreshed
+ * @ingroup frontend
+ *
+ * @param parms		struct dvb_v5_fe_parms pointer to the opened device
+ * @param priv		private data passed to dvb_fe_wait_lock()
+ *
+ * The stats cache is up to date when called, so dvb_fe_retrieve_stats()
+ * and friends can be used to show them. Returning a non-zero value stops
+ * the wait.
+ */
+typedef int (*dvb_fe_lock_cb)(struct dvb_v5_fe_parms *parms, void *priv);
+
+/**
+ * @brief Waits for the frontend to lock
+ * @ingroup frontend
+ *
+ * @param parms		struct dvb_v5_fe_parms pointer to the opened device
+ * @param timeout_ms	how long to wait, in milliseconds, or 0 to wait
+ *			forever
+ * @param stats_ms	how often to refresh the stats and call cb, in
+ *			milliseconds
+ * @param cb		if not NULL, called with the stats at startup, at
+ *			every stats_ms period and when the frontend locks
+ * @param priv		private data passed to cb
+ *
+ * Blocks on the frontend events (FE_GET_EVENT) until one of them reports
+ * FE_HAS_LOCK, so the lock is detected as soon as the hardware reports it,
+ * instead of at the next period of a status polling loop. Remote frontends
+ * don't have the events, and are polled every 20 ms instead.
+ *
+ * The wait also stops if parms->abort is set or if a signal interrupts it.
+ *
+ * @return Returns 0 if the frontend locked, -ETIMEDOUT if it didn't lock
+ * in time or the frontend gave up (FE_TIMEDOUT), -ECANCELED if the
+ * callback stopped the wait, -EINTR if interrupted, or another negative
+ * error code.
+ */
+int dvb_fe_wait_lock(struct dvb_v5_fe_parms *parms, unsigned int timeout_ms,
+		     unsigned int stats_ms, dvb_fe_lock_cb cb, void *priv);
+
 /*
  * statistics functions
  */
@@ -469,6 +565,56 @@ int dvb_fe_retrieve_stats(struct dvb_v5_fe_parms *parms,
  */
 int dvb_fe_get_stats(struct dvb_v5_fe_parms *parms);
 
+/**
+ * @enum dvb_fe_stats_mask
+ * @brief Stats groups to be retrieved by dvb_fe_get_stats_mask()
+ * @ingroup frontend
+ *
+ * @var DVB_FE_STATS_STATUS
+ *	@brief DTV_STATUS, with FE_READ_STATUS
+ * @var DVB_FE_STATS_SIGNAL
+ *	@brief DTV_STAT_SIGNAL_STRENGTH
+ * @var DVB_FE_STATS_CNR
+ *	@brief DTV_STAT_CNR
+ * @var DVB_FE_STATS_PRE_BER
+ *	@brief DTV_STAT_PRE_ERROR_BIT_COUNT and DTV_STAT_PRE_TOTAL_BIT_COUNT
+ * @var DVB_FE_STATS_POST_BER
+ *	@brief DTV_STAT_POST_ERROR_BIT_COUNT and DTV_STAT_POST_TOTAL_BIT_COUNT
+ * @var DVB_FE_STATS_PER
+ *	@brief DTV_STAT_ERROR_BLOCK_COUNT and DTV_STAT_TOTAL_BLOCK_COUNT
+ * @var DVB_FE_STATS_ALL
+ *	@brief All of the above, as dvb_fe_get_stats() does
+ */
+enum dvb_fe_stats_mask {
+	DVB_FE_STATS_STATUS	= 1 << 0,
+	DVB_FE_STATS_SIGNAL	= 1 << 1,
+	DVB_FE_STATS_CNR	= 1 << 2,
+	DVB_FE_STATS_PRE_BER	= 1 << 3,
+	DVB_FE_STATS_POST_BER	= 1 << 4,
+	DVB_FE_STATS_PER	= 1 << 5,
+	DVB_FE_STATS_ALL	= (1 << 6) - 1,
+};
+
+/**
+ * @brief Retrieve a subset of the stats from the Kernel
+ * @ingroup frontend
+ *
+ * @param parms	struct dvb_v5_fe_parms pointer to the opened device
+ * @param mask	bitmask of enum dvb_fe_stats_mask values
+ *
+ * Like dvb_fe_get_stats(), but only the selected stats are asked for, with
+ * a single FE_GET_PROPERTY call, and the BER/PER counters are only updated
+ * if some of them were selected. This is cheaper for applications that
+ * poll just the signal strength of several frontends at a high rate.
+ *
+ * The other stats at the cache are kept as they were. Remote frontends
+ * and the ones without DVBv5 stats get all the stats, as with
+ * dvb_fe_get_stats().
+ *
+ * @return The returned value is 0 if success, EINVAL otherwise.
+ */
+int dvb_fe_get_stats_mask(struct dvb_v5_fe_parms *parms, unsigned int mask);
+
 /**
  * @brief Retrieve the BER stats from cache
  * @ingroup frontend
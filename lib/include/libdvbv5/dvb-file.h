@@ -228,6 +228,9 @@ struct dvb_parse_file {
  * @var FILE_VDR
  *	@brief File is at DVR format (as supported on version 2.1.6).
  *	       Note: this is only supported as an output format.
+ * @var FILE_DVBV5_DB
+ *	@brief File is a compiled libdvbv5 channel database, indexed by
+ *	       channel name, virtual channel and service ID.
  */
 enum dvb_file_formats {
 	FILE_UNKNOWN,
@@ -235,6 +238,7 @@ enum dvb_file_formats {
 	FILE_CHANNEL,
 	FILE_DVBV5,
 	FILE_VDR,
+	FILE_DVBV5_DB,
 };
 
 struct dvb_v5_descriptors;
@@ -243,6 +247,33 @@ struct dvb_v5_descriptors;
 extern "C" {
 #endif
 
+/**
+ * @brief Deallocates memory associated with a single struct dvb_entry
+ * @ingroup file
+ *
+ * @param entry		dvb_entry struct to be deallocated
+ *
+ * Only the entry itself is freed, not the ones linked to it by entry->next.
+ */
+static inline void dvb_file_free_entry(struct dvb_entry *entry)
+{
+	if (entry->channel)
+		free(entry->channel);
+	if (entry->vchannel)
+		free(entry->vchannel);
+	if (entry->location)
+		free(entry->location);
+	if (entry->video_pid)
+		free(entry->video_pid);
+	if (entry->audio_pid)
+		free(entry->audio_pid);
+	if (entry->other_el_pid)
+		free(entry->other_el_pid);
+	if (entry->lnb)
+		free(entry->lnb);
+	free(entry);
+}
+
 /**
  * @brief Deallocates memory associated with a struct dvb_file
  * @ingroup file
@@ -257,21 +288,7 @@ static inline void dvb_file_free(struct dvb_file *dvb_file)
 	struct dvb_entry *entry = dvb_file->first_entry, *next;
 	while (entry) {
 		next = entry->next;
-		if (entry->channel)
-			free(entry->channel);
-		if (entry->vchannel)
-			free(entry->vchannel);
-		if (entry->location)
-			free(entry->location);
-		if (entry->video_pid)
-			free(entry->video_pid);
-		if (entry->audio_pid)
-			free(entry->audio_pid);
-		if (entry->other_el_pid)
-			free(entry->other_el_pid);
-		if (entry->lnb)
-			free(entry->lnb);
-		free(entry);
+		dvb_file_free_entry(entry);
 		entry = next;
 	}
 	free(dvb_file);
@@ -353,6 +370,71 @@ int dvb_write_file_format(const char *fname,
 			  uint32_t delsys,
 			  enum dvb_file_formats format);
 
+/**
+ * @struct dvb_file_stream
+ * @brief Opaque handler for a channel file read or written entry by entry
+ * @ingroup file
+ */
+struct dvb_file_stream;
+
+/**
+ * @brief Opens a channel file to be read or written one entry at a time
+ * @ingroup file
+ *
+ * @param fname		file name, or "-" for stdin/stdout
+ * @param delsys	Delivery system, as specified by enum fe_delivery_system
+ * @param format	Format of the file
+ * @param mode		"r" to read the file or "w" to write it
+ *
+ * Unlike dvb_read_file_format() and dvb_write_file_format(), only the entry
+ * being handled is kept in memory, so the memory needed doesn't grow with
+ * the size of the file. The DVBV5_DB format can't be handled this way, as
+ * its index is written together with the entries.
+ *
+ * @return It returns a pointer to struct dvb_file_stream on success, or NULL
+ * otherwise, with errno set.
+ */
+struct dvb_file_stream *dvb_file_stream_open(const char *fname,
+					     uint32_t delsys,
+					     enum dvb_file_formats format,
+					     const char *mode);
+
+/**
+ * @brief Reads the next entry from a channel file
+ * @ingroup file
+ *
+ * @param stream	stream opened with dvb_file_stream_open() for reading
+ * @param entry		filled with the entry read, to be freed with
+ *			dvb_file_free_entry()
+ *
+ * @return It returns 1 if an entry was read, zero at the end of the file or
+ * a negative error number if it fails.
+ */
+int dvb_file_stream_read(struct dvb_file_stream *stream,
+			 struct dvb_entry **entry);
+
+/**
+ * @brief Writes an entry to a channel file
+ * @ingroup file
+ *
+ * @param stream	stream opened with dvb_file_stream_open() for writing
+ * @param entry		entry to be written. entry->next is ignored.
+ *
+ * @return It returns zero if success, or a negative error number if it fails.
+ */
+int dvb_file_stream_write(struct dvb_file_stream *stream,
+			  struct dvb_entry *entry);
+
+/**
+ * @brief Closes a channel file opened with dvb_file_stream_open()
+ * @ingroup file
+ *
+ * @param stream	stream to be closed
+ *
+ * @return It returns zero if success, or a negative error number if the
+ * data written couldn't be flushed to the file.
+ */
+int dvb_file_stream_close(struct dvb_file_stream *stream);
 
 /**
  * @brief Stores a key/value pair on a DVB file entry
@@ -513,6 +595,126 @@ int dvb_write_format_oneline(const char *fname,
 int dvb_write_format_vdr(const char *fname,
 			 struct dvb_file *dvb_file);
 
+/**
+ * @struct dvb_file_db
+ * @brief Opaque handle of a compiled channel database
+ * @ingroup file
+ *
+ * A channel database contains the same entries as a DVBv5 channel file,
+ * stored in a binary form that is mapped into memory instead of being
+ * parsed, with hash indexes by channel name, virtual channel and service ID.
+ * It uses the byte order of the machine that wrote it.
+ */
+struct dvb_file_db;
+
+/**
+ * @brief Writes a compiled channel database
+ * @ingroup file
+ *
+ * @param fname		file name
+ * @param dvb_file	contents of the file to be written
+ *
+ * @return It returns zero if success, or a negative error number if it fails.
+ *
+ * This function is called internally by dvb_write_file_format.
+ */
+int dvb_write_file_db(const char *fname, struct dvb_file *dvb_file);
+
+/**
+ * @brief Reads a whole compiled channel database
+ * @ingroup file
+ *
+ * @param fname		file name
+ *
+ * @return It returns a pointer to struct dvb_file on success, NULL otherwise.
+ *
+ * This function is called internally by dvb_read_file_format. Applications
+ * that just need a few entries should use dvb_file_db_open() instead.
+ */
+struct dvb_file *dvb_read_file_db(const char *fname);
+
+/**
+ * @brief Maps a compiled channel database into memory
+ * @ingroup file
+ *
+ * @param fname		file name
+ *
+ * @return It returns a database handle on success, NULL otherwise.
+ *
+ * The file is validated once, so that the lookups don't need to check it.
+ */
+struct dvb_file_db *dvb_file_db_open(const char *fname);
+
+/**
+ * @brief Unmaps a channel database opened with dvb_file_db_open()
+ * @ingroup file
+ *
+ * @param db		database handle
+ */
+void dvb_file_db_close(struct dvb_file_db *db);
+
+/**
+ * @brief Returns the number of entries of a channel database
+ * @ingroup file
+ *
+ * @param db		database handle
+ */
+int dvb_file_db_num_entries(struct dvb_file_db *db);
+
+/**
+ * @brief Looks up an entry by its channel name
+ * @ingroup file
+ *
+ * @param db		database handle
+ * @param channel	channel name, compared with strcmp()
+ * @param prev		index of the previous match, or -1 for the first one
+ *
+ * @return It returns the index of the next entry with this channel name
+ * after @p prev, in file order, or -1 if there is none.
+ */
+int dvb_file_db_find_channel(struct dvb_file_db *db, const char *channel,
+			     int prev);
+
+/**
+ * @brief Looks up an entry by its virtual channel
+ * @ingroup file
+ *
+ * @param db		database handle
+ * @param vchannel	virtual channel, compared with strcmp()
+ * @param prev		index of the previous match, or -1 for the first one
+ *
+ * @return It returns the index of the next entry with this virtual channel
+ * after @p prev, in file order, or -1 if there is none.
+ */
+int dvb_file_db_find_vchannel(struct dvb_file_db *db, const char *vchannel,
+			      int prev);
+
+/**
+ * @brief Looks up an entry by its service ID
+ * @ingroup file
+ *
+ * @param db		database handle
+ * @param service_id	service ID
+ * @param prev		index of the previous match, or -1 for the first one
+ *
+ * @return It returns the index of the next entry with this service ID
+ * after @p prev, in file order, or -1 if there is none.
+ */
+int dvb_file_db_find_service(struct dvb_file_db *db, uint16_t service_id,
+			     int prev);
+
+/**
+ * @brief Copies an entry of a channel database
+ * @ingroup file
+ *
+ * @param db		database handle
+ * @param index		index of the entry, as returned by the lookups
+ *
+ * @return It returns a struct dvb_file with just this entry, that should be
+ * freed with dvb_file_free(), or NULL on error.
+ */
+struct dvb_file *dvb_file_db_get(struct dvb_file_db *db, int index);
+
 #ifdef __cplusplus
 }
 #endif
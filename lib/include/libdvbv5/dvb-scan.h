@@ -22,6 +22,7 @@
 #include <linux/dvb/dmx.h>
 #include <libdvbv5/descriptors.h>
 #include <libdvbv5/dvb-sat.h>
+#include <libdvbv5/header.h>
 
 /**
  * @file dvb-scan.h
@@ -226,6 +227,191 @@ int dvb_read_sections(struct dvb_v5_fe_parms *parms, int dmx_fd,
 			     struct dvb_table_filter *sect,
 			     unsigned timeout);
 
+/**
+ * @struct dvb_ts_demux
+ * @brief Userspace MPEG-TS section demultiplexer
+ * @ingroup frontend_scan
+ *
+ * Reassembles the sections of several tables, on any number of PIDs, from
+ * a single MPEG-TS stream. This is an opaque struct, allocated with
+ * dvb_ts_demux_alloc().
+ */
+struct dvb_ts_demux;
+
+/**
+ * @brief allocates a userspace MPEG-TS section demultiplexer
+ * @ingroup frontend_scan
+ *
+ * @param parms		pointer to struct dvb_v5_fe_parms, used for logging
+ *			and by the table parsers
+ *
+ * At success, returns a pointer. NULL otherwise.
+ */
+struct dvb_ts_demux *dvb_ts_demux_alloc(struct dvb_v5_fe_parms *parms);
+
+/**
+ * @brief adds a table to a userspace MPEG-TS section demultiplexer
+ * @ingroup frontend_scan
+ *
+ * @param dmx		struct dvb_ts_demux pointer
+ * @param sect		section filter pointer, as used by dvb_read_sections().
+ *			It should be kept valid until dvb_ts_demux_free().
+ *
+ * Several tables can use the same PID, as long as their table IDs differ.
+ *
+ * Returns 0 on success or a negative error code.
+ */
+int dvb_ts_demux_add_filter(struct dvb_ts_demux *dmx,
+			    struct dvb_table_filter *sect);
+
+/**
+ * @brief feeds MPEG-TS data to a userspace section demultiplexer
+ * @ingroup frontend_scan
+ *
+ * @param dmx		struct dvb_ts_demux pointer
+ * @param buf		MPEG-TS data
+ * @param len		length of buf. It doesn't need to be a multiple of
+ *			the TS packet size: a trailing partial packet is
+ *			completed by the next call.
+ *
+ * Every complete section of a table added with dvb_ts_demux_add_filter()
+ * is passed to the table parser. Sections with a wrong CRC, or interrupted
+ * by a continuity error, are dropped.
+ *
+ * Returns the number of tables that weren't completely read yet.
+ */
+int dvb_ts_demux_parse(struct dvb_ts_demux *dmx, const uint8_t *buf,
+		       size_t len);
+
+/**
+ * @brief returns the status of a table of a userspace section demultiplexer
+ * @ingroup frontend_scan
+ *
+ * @param dmx		struct dvb_ts_demux pointer
+ * @param sect		section filter pointer, as added with
+ *			dvb_ts_demux_add_filter()
+ *
+ * Returns 1 if the table was completely read, 0 if it wasn't yet, or a
+ * negative error code.
+ */
+int dvb_ts_demux_filter_status(struct dvb_ts_demux *dmx,
+			       struct dvb_table_filter *sect);
+
+/**
+ * @brief frees a userspace MPEG-TS section demultiplexer
+ * @ingroup frontend_scan
+ *
+ * @param dmx		struct dvb_ts_demux pointer
+ *
+ * The tables read are not freed: they belong to the caller, as with
+ * dvb_read_sections().
+ */
+void dvb_ts_demux_free(struct dvb_ts_demux *dmx);
+
+/**
+ * @brief read several MPEG-TS tables at once from a single TS stream
+ * @ingroup frontend_scan
+ *
+ * @param parms		pointer to struct dvb_v5_fe_parms created when the
+ *			frontend is opened
+ * @param dmx_fd	an opened demux file descriptor
+ * @param sect		array of section filters
+ * @param num_sect	number of section filters in the array
+ * @param timeout	limit, in seconds, to read all tables
+ *
+ * Instead of one kernel section filter per table, this function sets a
+ * single TS filter, for the PIDs of the tables, or for the whole stream
+ * if the demux can't filter a PID set. The sections are then demultiplexed
+ * with a struct dvb_ts_demux. Useful for hardware with few section
+ * filters.
+ *
+ * Returns the number of tables that couldn't be read, or a negative
+ * error code.
+ */
+int dvb_read_sections_ts(struct dvb_v5_fe_parms *parms, int dmx_fd,
+			 struct dvb_table_filter *sect, unsigned num_sect,
+			 unsigned timeout);
+
+/**
+ * @struct dvb_section_cache
+ * @brief Remembers the version and CRC of the sections already parsed
+ * @ingroup frontend_scan
+ *
+ * When a cache is set with dvb_set_section_cache(), dvb_read_sections()
+ * and the other section readers only call the table parsers for sections
+ * that weren't seen before, or whose version or CRC changed. The other
+ * sections are still accounted to know when a table is completely read,
+ * but they aren't parsed again: a table with only unchanged sections is
+ * returned as NULL.
+ *
+ * Sections are identified by their table ID, extension ID and section
+ * number, and also by the original network ID for the SDT and EIT tables.
+ */
+struct dvb_section_cache;
+
+/**
+ * @brief callback for the sections that changed
+ * @ingroup frontend_scan
+ *
+ * @param parms		struct dvb_v5_fe_parms pointer
+ * @param header	header of the section, in CPU endianness
+ * @param buf		the section, including its CRC
+ * @param buflen	size of the section
+ * @param priv		pointer given to dvb_section_cache_alloc()
+ *
+ * Called before the section is parsed.
+ */
+typedef void (*dvb_section_changed_func)(struct dvb_v5_fe_parms *parms,
+					 const struct dvb_table_header *header,
+					 const uint8_t *buf, ssize_t buflen,
+					 void *priv);
+
+/**
+ * @brief allocates a section cache
+ * @ingroup frontend_scan
+ *
+ * @param changed	function called for the new or changed sections,
+ *			or NULL
+ * @param priv		pointer passed to changed
+ *
+ * Returns the cache, or NULL if out of memory.
+ */
+struct dvb_section_cache *dvb_section_cache_alloc(dvb_section_changed_func changed,
+						  void *priv);
+
+/**
+ * @brief forgets all sections of a section cache
+ * @ingroup frontend_scan
+ *
+ * @param cache		struct dvb_section_cache pointer
+ *
+ * Should be called when tuning to another transponder.
+ */
+void dvb_section_cache_reset(struct dvb_section_cache *cache);
+
+/**
+ * @brief frees a section cache
+ * @ingroup frontend_scan
+ *
+ * @param cache		struct dvb_section_cache pointer
+ */
+void dvb_section_cache_free(struct dvb_section_cache *cache);
+
+/**
+ * @brief sets the section cache used by a frontend
+ * @ingroup frontend_scan
+ *
+ * @param parms		pointer to struct dvb_v5_fe_parms created when the
+ *			frontend is opened
+ * @param cache		struct dvb_section_cache pointer, or NULL to parse
+ *			all sections
+ *
+ * The cache is not thread safe: it should only be used by one frontend
+ * at a time.
+ */
+void dvb_set_section_cache(struct dvb_v5_fe_parms *parms,
+			   struct dvb_section_cache *cache);
+
 /**
  * @brief allocates a struct dvb_v5_descriptors
  * @ingroup frontend_scan
@@ -262,6 +448,9 @@ void dvb_scan_free_handler_table(struct dvb_v5_descriptors *dvb_scan_handler);
  * available at the transport stream, and parses the following tables:
  * PAT, PMT, NIT, SDT (and VCT, if the delivery system is ATSC).
  *
+ * After the PAT, the other tables are read concurrently: the demux is
+ * opened again to have one section filter per table.
+ *
  * On sucess, it returns a pointer to a struct dvb_v5_descriptors, that can
  * either be used to tune into a service or to be stored inside a file.
  */
@@ -393,6 +582,79 @@ void dvb_add_scaned_transponders(struct dvb_v5_fe_parms *parms,
 				 struct dvb_entry *first_entry,
 				 struct dvb_entry *entry);
 
+/**
+ * @struct dvb_freq_index
+ * @brief Index of the frequencies of a list of entries
+ * @ingroup frontend_scan
+ *
+ * Checking if a transponder is already at the list of entries to scan
+ * normally compares it against every entry. With thousands of entries,
+ * like on satellite scans, adding the transponders found at the NIT gets
+ * quadratic. An index keeps the entries sorted by frequency, so only the
+ * ones close to the frequency are compared.
+ *
+ * An index is bound to the list given to its first lookup, and indexes
+ * the entries appended to it as they appear. It should be freed together
+ * with the list. This is an opaque struct.
+ */
+struct dvb_freq_index;
+
+/**
+ * @brief allocates a frequency index
+ * @ingroup frontend_scan
+ *
+ * At success, returns a pointer. NULL otherwise.
+ */
+struct dvb_freq_index *dvb_freq_index_alloc(void);
+
+/**
+ * @brief frees a frequency index
+ * @ingroup frontend_scan
+ *
+ * @param idx	index allocated by dvb_freq_index_alloc(), or NULL
+ */
+void dvb_freq_index_free(struct dvb_freq_index *idx);
+
+/**
+ * @brief uses a frequency index to check for duplicated transponders
+ * @ingroup frontend_scan
+ *
+ * @param parms	pointer to struct dvb_v5_fe_parms
+ * @param idx	index allocated by dvb_freq_index_alloc(), or NULL to
+ *		stop using it
+ *
+ * Affects dvb_add_scaned_transponders(), which then looks for the new
+ * transponders with the index. The same index can be set at several
+ * frontends adding entries to the same list, as long as they don't do it
+ * at the same time.
+ */
+void dvb_scan_set_freq_index(struct dvb_v5_fe_parms *parms,
+			     struct dvb_freq_index *idx);
+
+/**
+ * @brief checks if a transponder is not at a list yet, using an index
+ * @ingroup frontend_scan
+ *
+ * @param idx		index allocated by dvb_freq_index_alloc(), or NULL
+ * @param first_entry	first entry of the list
+ * @param last_entry	if not NULL, only the entries before it are checked
+ * @param freq		frequency of the transponder
+ * @param shift		max frequency shift, from dvb_estimate_freq_shift()
+ * @param pol		polarization, or POLARIZATION_OFF to ignore it
+ * @param stream_id	stream ID, or NO_STREAM_ID_FILTER to ignore it
+ *
+ * Does the same as dvb_new_entry_is_needed(), in logarithmic time. Falls
+ * back to it if idx is NULL or there are entries without a frequency.
+ *
+ * Returns 1 if no entry matches, 0 otherwise.
+ */
+int dvb_freq_index_entry_is_needed(struct dvb_freq_index *idx,
+				   struct dvb_entry *first_entry,
+				   struct dvb_entry *last_entry,
+				   uint32_t freq, int shift,
+				   enum dvb_sat_polarization pol,
+				   uint32_t stream_id);
+
 #ifndef _DOXYGEN
 /*
  * Some ancillary functions used internally inside the library, used to
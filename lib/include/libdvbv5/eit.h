@@ -124,6 +124,30 @@ struct dvb_table_eit_event {
 	uint16_t service_id;
 } __attribute__((packed));
 
+/**
+ * @struct dvb_table_eit_event_view
+ * @brief An event of a raw EIT section, not decoded
+ * @ingroup dvb_table
+ *
+ * @param event_id		event ID
+ * @param dvbstart		start time, as found on the section: a 16 bits big
+ *				endian MJD, followed by the BCD encoded UTC time
+ * @param duration		duration in seconds
+ * @param free_CA_mode		free CA mode
+ * @param running_status	running status
+ * @param desc_length		length of the descriptors
+ * @param desc			descriptors, inside the section buffer
+ */
+struct dvb_table_eit_event_view {
+	uint16_t event_id;
+	const uint8_t *dvbstart;
+	uint32_t duration;
+	uint8_t free_CA_mode;
+	uint8_t running_status;
+	uint16_t desc_length;
+	const uint8_t *desc;
+};
+
 /**
  * @struct dvb_table_eit
  * @brief DVB EIT table
@@ -219,6 +243,40 @@ void dvb_table_eit_print(struct dvb_v5_fe_parms *parms,
  */
 void dvb_time(const uint8_t data[5], struct tm *tm);
 
+/**
+ * @brief Initializes a view over a raw EIT section
+ * @ingroup dvb_table
+ *
+ * @param parms		struct dvb_v5_fe_parms pointer to the opened device
+ * @param buf		buffer containing the EIT raw data
+ * @param buflen	length of the buffer
+ * @param view		struct dvb_table_view to initialize
+ * @param service_id	place to store the service ID, or NULL
+ *
+ * Unlike dvb_table_eit_init(), nothing is allocated nor decoded: the
+ * events are read with dvb_table_eit_view_next(), and their descriptors
+ * with dvb_desc_iter_init(). That allows to filter the events of an EPG
+ * before decoding their strings.
+ *
+ * @return Returns 0 on success, a negative value otherwise.
+ */
+int dvb_table_eit_view_init(struct dvb_v5_fe_parms *parms, const uint8_t *buf,
+			    ssize_t buflen, struct dvb_table_view *view,
+			    uint16_t *service_id);
+
+/**
+ * @brief Gets the next event of a raw EIT section
+ * @ingroup dvb_table
+ *
+ * @param view		struct dvb_table_view pointer
+ * @param event		place to store the event
+ *
+ * @return Returns 1 if an event was stored, 0 at the end of the section
+ *	   and -1 if the section is malformed.
+ */
+int dvb_table_eit_view_next(struct dvb_table_view *view,
+			    struct dvb_table_eit_event_view *event);
+
 #ifdef __cplusplus
 }
 #endif
@@ -120,6 +120,28 @@ struct dvb_table_header {
 	uint8_t  last_section;		/* last_section_number */
 } __attribute__((packed));
 
+/**
+ * @struct dvb_table_view
+ * @brief Iterates over the entries of a raw MPEG-TS table section
+ * @ingroup dvb_table
+ *
+ * @param ptr		next entry
+ * @param end		end of the entries, before the CRC
+ * @param desc		table-wide descriptors, or NULL if the table has none
+ * @param desc_length	length of the table-wide descriptors
+ *
+ * Initialized by the view init function of a table, like
+ * dvb_table_sdt_view_init(), and used with its view next function to get
+ * the entries without allocating nor decoding anything. The descriptors
+ * can then be read with dvb_desc_iter_init().
+ */
+struct dvb_table_view {
+	const uint8_t *ptr;
+	const uint8_t *end;
+	const uint8_t *desc;
+	uint16_t desc_length;
+};
+
 struct dvb_v5_fe_parms;
 
 #ifdef __cplusplus
@@ -143,6 +165,26 @@ void dvb_table_header_init (struct dvb_table_header *header);
 void dvb_table_header_print(struct dvb_v5_fe_parms *parms,
 			    const struct dvb_table_header *header);
 
+/**
+ * @brief Initializes a view over a raw MPEG-TS table section
+ * @ingroup dvb_table
+ *
+ * @param parms		struct dvb_v5_fe_parms pointer to the opened device
+ * @param buf		buffer with the section, as read from the demux
+ * @param buflen	size of the buffer
+ * @param hdr_size	size of the table header, including the fields
+ *			after struct dvb_table_header
+ * @param view		struct dvb_table_view to initialize
+ *
+ * Only checks that the section fits in the buffer: the table specific
+ * view init functions also check the table ID.
+ *
+ * @return Returns 0 on success, a negative value otherwise.
+ */
+int dvb_table_view_init(struct dvb_v5_fe_parms *parms, const uint8_t *buf,
+			ssize_t buflen, size_t hdr_size,
+			struct dvb_table_view *view);
+
 #ifdef __cplusplus
 }
 #endif
@@ -118,6 +118,154 @@ struct dvb_mpeg_ts {
 	struct dvb_mpeg_ts_adaption adaption[];
 } __attribute__((packed));
 
+/**
+ * @def DVB_MPEG_TS_NUM_PIDS
+ *	@brief Number of possible PIDs at an MPEG Transport Stream
+ *	@ingroup dvb_table
+ * @def DVB_MPEG_TS_NULL_PID
+ *	@brief PID used for NULL (stuffing) packets
+ *	@ingroup dvb_table
+ */
+#define DVB_MPEG_TS_NUM_PIDS  0x2000
+#define DVB_MPEG_TS_NULL_PID  0x1fff
+
+/**
+ * @def DVB_MPEG_TS_PCR_HZ
+ *	@brief PCR clock frequency
+ *	@ingroup dvb_table
+ * @def DVB_MPEG_TS_PCR_REPETITION
+ *	@brief Maximum interval between two PCRs of a PID, in PCR units
+ *	@ingroup dvb_table
+ * @def DVB_MPEG_TS_PCR_DISCONTINUITY
+ *	@brief Interval between two PCRs of a PID taken as a discontinuity,
+ *	when not signalled by the discontinuity indicator, in PCR units
+ *	@ingroup dvb_table
+ * @def DVB_MPEG_TS_PCR_ACCURACY
+ *	@brief Maximum PCR inaccuracy, in nanoseconds
+ *	@ingroup dvb_table
+ *
+ * The limits are the ones checked by ETSI TR 101 290 for the
+ * PCR_repetition_error, PCR_discontinuity_indicator_error and
+ * PCR_accuracy_error indicators.
+ */
+#define DVB_MPEG_TS_PCR_HZ		27000000ULL
+#define DVB_MPEG_TS_PCR_REPETITION	(DVB_MPEG_TS_PCR_HZ * 40 / 1000)
+#define DVB_MPEG_TS_PCR_DISCONTINUITY	(DVB_MPEG_TS_PCR_HZ * 100 / 1000)
+#define DVB_MPEG_TS_PCR_ACCURACY	500
+
+/**
+ * @struct dvb_mpeg_ts_pcr
+ * @brief PCR statistics of a PID
+ * @ingroup dvb_table
+ *
+ * @param count			Number of PCRs seen
+ * @param last			Value of the last PCR, in 27 MHz units
+ * @param last_pos		Packet number of the last PCR, counting all
+ *				packets passed to dvb_mpeg_ts_stats_update()
+ * @param ref_pos		Packet number of the PCR where the rate
+ *				estimate started, ie. the first one after a
+ *				discontinuity
+ * @param span			PCR time from ref_pos to last_pos
+ * @param elapsed		PCR time since the first PCR, going on across
+ *				PCR wraps. Discontinuities are bridged with
+ *				the caller's clock.
+ * @param first_clock		Caller's clock when the first PCR was seen
+ * @param last_clock		Caller's clock when the last PCR was seen
+ * @param repetition_errors	PCRs more than DVB_MPEG_TS_PCR_REPETITION
+ *				after the previous one
+ * @param discontinuities	PCRs that went back, or more than
+ *				DVB_MPEG_TS_PCR_DISCONTINUITY ahead, without
+ *				the discontinuity indicator
+ * @param accuracy_errors	PCRs off by more than DVB_MPEG_TS_PCR_ACCURACY
+ * @param win_max_interval	Biggest interval between PCRs since the last
+ *				dvb_mpeg_ts_pcr_stats_reset_window()
+ * @param win_jitter_min	Smallest PCR jitter, in 27 MHz units, in the
+ *				current window
+ * @param win_jitter_max	Biggest PCR jitter in the current window
+ * @param win_jitters		Number of jitter measures in the current
+ *				window. win_jitter_min and win_jitter_max are
+ *				only meaningful if not zero.
+ *
+ * The jitter of a PCR is how far it is from the value expected from the
+ * number of packets since the previous PCR, at the rate of the stream
+ * measured from ref_pos up to the previous PCR. For a constant bit rate
+ * TS, that is the PCR accuracy as defined by ETSI TR 101 290.
+ */
+struct dvb_mpeg_ts_pcr {
+	uint64_t count;
+	uint64_t last;
+	uint64_t last_pos;
+	uint64_t ref_pos;
+	uint64_t span;
+	uint64_t elapsed;
+	uint64_t first_clock;
+	uint64_t last_clock;
+	uint64_t repetition_errors;
+	uint64_t discontinuities;
+	uint64_t accuracy_errors;
+
+	uint64_t win_max_interval;
+	int64_t win_jitter_min;
+	int64_t win_jitter_max;
+	uint64_t win_jitters;
+};
+
+/**
+ * @struct dvb_mpeg_ts_pcr_stats
+ * @brief Per-PID PCR statistics for MPEG TS buffers
+ * @ingroup dvb_table
+ *
+ * @param clock		Set by the caller, before each call to
+ *			dvb_mpeg_ts_stats_update(), to the time the buffer
+ *			was received, in nanoseconds on any monotonic clock.
+ *			Used to measure the drift of the PCRs against it.
+ * @param pid		PCR statistics of each PID
+ *
+ * Should be initialized with dvb_mpeg_ts_pcr_stats_init().
+ */
+struct dvb_mpeg_ts_pcr_stats {
+	uint64_t clock;
+	struct dvb_mpeg_ts_pcr pid[DVB_MPEG_TS_NUM_PIDS];
+};
+
+/**
+ * @struct dvb_mpeg_ts_stats
+ * @brief Per-PID traffic and continuity counters for MPEG TS buffers
+ * @ingroup dvb_table
+ *
+ * @param packets		Number of packets seen for each PID
+ * @param cc_errors		Number of continuity errors for each PID
+ * @param cc			Last continuity counter seen for each PID,
+ *				or -1 if unknown
+ * @param total			Total number of packets with a valid sync byte
+ * @param total_cc_errors	Total number of continuity errors
+ * @param sync_errors		Number of packets discarded due to an invalid
+ *				sync byte
+ * @param cc_error		Optional callback, called for every
+ *				continuity error
+ * @param priv			Private data passed to cc_error
+ * @param pcr			Optional PCR statistics, also updated by
+ *				dvb_mpeg_ts_stats_update() if not NULL
+ *
+ * Should be initialized with dvb_mpeg_ts_stats_init() and updated with
+ * dvb_mpeg_ts_stats_update(). The counters are cumulative.
+ */
+struct dvb_mpeg_ts_stats {
+	uint64_t packets[DVB_MPEG_TS_NUM_PIDS];
+	uint64_t cc_errors[DVB_MPEG_TS_NUM_PIDS];
+	int8_t cc[DVB_MPEG_TS_NUM_PIDS];
+
+	uint64_t total;
+	uint64_t total_cc_errors;
+	uint64_t sync_errors;
+
+	void (*cc_error)(void *priv, uint16_t pid,
+			 unsigned expected, unsigned received);
+	void *priv;
+
+	struct dvb_mpeg_ts_pcr_stats *pcr;
+};
+
 struct dvb_v5_fe_parms;
 
 #ifdef __cplusplus
@@ -165,6 +313,59 @@ void dvb_mpeg_ts_free(struct dvb_mpeg_ts *ts);
  */
 void dvb_mpeg_ts_print(struct dvb_v5_fe_parms *parms, struct dvb_mpeg_ts *ts);
 
+/**
+ * @brief Reset a struct dvb_mpeg_ts_stats
+ * @ingroup dvb_table
+ *
+ * @param stats		struct dvb_mpeg_ts_stats to initialize
+ *
+ * Zeroes all counters and marks all continuity counters as unknown.
+ * The cc_error callback, its private data and the pcr pointer are preserved.
+ */
+void dvb_mpeg_ts_stats_init(struct dvb_mpeg_ts_stats *stats);
+
+/**
+ * @brief Reset a struct dvb_mpeg_ts_pcr_stats
+ * @ingroup dvb_table
+ *
+ * @param pcr		struct dvb_mpeg_ts_pcr_stats to initialize
+ */
+void dvb_mpeg_ts_pcr_stats_init(struct dvb_mpeg_ts_pcr_stats *pcr);
+
+/**
+ * @brief Start a new window for the win_* fields of all PIDs
+ * @ingroup dvb_table
+ *
+ * @param pcr		struct dvb_mpeg_ts_pcr_stats to update
+ *
+ * Meant to be called after reporting the statistics of an interval.
+ */
+void dvb_mpeg_ts_pcr_stats_reset_window(struct dvb_mpeg_ts_pcr_stats *pcr);
+
+/**
+ * @brief Account a buffer of MPEG TS packets on a struct dvb_mpeg_ts_stats
+ * @ingroup dvb_table
+ *
+ * @param stats		struct dvb_mpeg_ts_stats to update
+ * @param buf		Buffer with 188-bytes TS packets
+ * @param buflen	Length of buffer. Any trailing partial packet is
+ *			ignored
+ * @param check_cc	If zero, continuity counters are just tracked, and
+ *			no continuity errors are reported. Useful while a
+ *			frontend is still starting to stream.
+ *
+ * Counts the packets per PID and checks the continuity counters of
+ * non-NULL packets with payload, in a single pass over the buffer. If
+ * stats->pcr is set, the PCRs are accounted too. This is
+ * faster than parsing each packet with dvb_mpeg_ts_init(), and the buffer
+ * is not modified.
+ *
+ * @return		Number of packets processed.
+ */
+ssize_t dvb_mpeg_ts_stats_update(struct dvb_mpeg_ts_stats *stats,
+				 const uint8_t *buf, size_t buflen,
+				 int check_cc);
+
 #ifdef __cplusplus
 }
 #endif
@@ -190,6 +190,23 @@ struct dvb_table_pmt_stream {
 	struct dvb_table_pmt_stream *next;
 } __attribute__((packed));
 
+/**
+ * @struct dvb_table_pmt_stream_view
+ * @brief A stream of a raw PMT section, not decoded
+ * @ingroup dvb_table
+ *
+ * @param type		stream type
+ * @param elementary_pid	elementary pid
+ * @param desc_length	length of the descriptors
+ * @param desc		descriptors, inside the section buffer
+ */
+struct dvb_table_pmt_stream_view {
+	uint8_t type;
+	uint16_t elementary_pid;
+	uint16_t desc_length;
+	const uint8_t *desc;
+};
+
 /**
  * @struct dvb_table_pmt
  * @brief MPEG-TS PMT table
@@ -293,6 +310,39 @@ void dvb_table_pmt_free(struct dvb_table_pmt *table);
 void dvb_table_pmt_print(struct dvb_v5_fe_parms *parms,
 			 const struct dvb_table_pmt *table);
 
+/**
+ * @brief Initializes a view over a raw PMT section
+ * @ingroup dvb_table
+ *
+ * @param parms		struct dvb_v5_fe_parms pointer to the opened device
+ * @param buf		buffer containing the PMT raw data
+ * @param buflen	length of the buffer
+ * @param view		struct dvb_table_view to initialize
+ * @param pcr_pid	place to store the PCR pid, or NULL
+ *
+ * Unlike dvb_table_pmt_init(), nothing is allocated nor decoded: the
+ * program descriptors are at view->desc, and the streams are read with
+ * dvb_table_pmt_view_next().
+ *
+ * @return Returns 0 on success, a negative value otherwise.
+ */
+int dvb_table_pmt_view_init(struct dvb_v5_fe_parms *parms, const uint8_t *buf,
+			    ssize_t buflen, struct dvb_table_view *view,
+			    uint16_t *pcr_pid);
+
+/**
+ * @brief Gets the next stream of a raw PMT section
+ * @ingroup dvb_table
+ *
+ * @param view		struct dvb_table_view pointer
+ * @param stream	place to store the stream
+ *
+ * @return Returns 1 if a stream was stored, 0 at the end of the section
+ *	   and -1 if the section is malformed.
+ */
+int dvb_table_pmt_view_next(struct dvb_table_view *view,
+			    struct dvb_table_pmt_stream_view *stream);
+
 #ifdef __cplusplus
 }
 #endif
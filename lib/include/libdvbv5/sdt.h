@@ -101,6 +101,29 @@ struct dvb_table_sdt_service {
 	struct dvb_table_sdt_service *next;
 } __attribute__((packed));
 
+/**
+ * @struct dvb_table_sdt_service_view
+ * @brief A service of a raw SDT section, not decoded
+ * @ingroup dvb_table
+ *
+ * @param service_id		service ID
+ * @param EIT_schedule		EIT schedule
+ * @param EIT_present_following	EIT present following
+ * @param free_CA_mode		free CA mode
+ * @param running_status	running status
+ * @param desc_length		length of the descriptors
+ * @param desc			descriptors, inside the section buffer
+ */
+struct dvb_table_sdt_service_view {
+	uint16_t service_id;
+	uint8_t EIT_schedule;
+	uint8_t EIT_present_following;
+	uint8_t free_CA_mode;
+	uint8_t running_status;
+	uint16_t desc_length;
+	const uint8_t *desc;
+};
+
 /**
  * @struct dvb_table_sdt
  * @brief MPEG-TS SDT table
@@ -180,6 +203,38 @@ void dvb_table_sdt_free(struct dvb_table_sdt *table);
  */
 void dvb_table_sdt_print(struct dvb_v5_fe_parms *parms, struct dvb_table_sdt *table);
 
+/**
+ * @brief Initializes a view over a raw SDT section
+ * @ingroup dvb_table
+ *
+ * @param parms		struct dvb_v5_fe_parms pointer to the opened device
+ * @param buf		buffer containing the SDT raw data
+ * @param buflen	length of the buffer
+ * @param view		struct dvb_table_view to initialize
+ *
+ * Unlike dvb_table_sdt_init(), nothing is allocated nor decoded: the
+ * services are read with dvb_table_sdt_view_next(), and their descriptors
+ * with dvb_desc_iter_init(). That is much cheaper when only a few services
+ * or descriptors are needed.
+ *
+ * @return Returns 0 on success, a negative value otherwise.
+ */
+int dvb_table_sdt_view_init(struct dvb_v5_fe_parms *parms, const uint8_t *buf,
+			    ssize_t buflen, struct dvb_table_view *view);
+
+/**
+ * @brief Gets the next service of a raw SDT section
+ * @ingroup dvb_table
+ *
+ * @param view		struct dvb_table_view pointer
+ * @param service	place to store the service
+ *
+ * @return Returns 1 if a service was stored, 0 at the end of the section
+ *	   and -1 if the section is malformed.
+ */
+int dvb_table_sdt_view_next(struct dvb_table_view *view,
+			    struct dvb_table_sdt_service_view *service);
+
 #ifdef __cplusplus
 }
 #endif
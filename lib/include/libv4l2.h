@@ -70,6 +70,70 @@ LIBV4L_PUBLIC void *v4l2_mmap(void *start, size_t length, int prot, int flags,
 		int fd, int64_t offset);
 LIBV4L_PUBLIC int v4l2_munmap(void *_start, size_t length);
 
+/* Zero-copy alternative to v4l2_read(): instead of copying the next frame
+   into a buffer supplied by the application, *frame is pointed to the frame
+   data inside libv4l2's own (mmap-ed) buffers. This is the driver's buffer
+   itself when no conversion is needed, and the buffer the frame got
+   converted into otherwise. *id is set to an identifier for the frame which
+   must be passed to v4l2_release_frame() once the application is done with
+   it, until then libv4l2 will not reuse the buffer. Note that format changes
+   and switching to application controlled streaming fail with EBUSY while
+   frames are borrowed, and that v4l2_close() invalidates all borrowed
+   frames.
+
+   Returns the size of the frame, or -1 with errno set on failure. errno is
+   EINVAL if the device can only be read with read(). */
+LIBV4L_PUBLIC ssize_t v4l2_borrow_frame(int fd, void **frame, int *id);
+LIBV4L_PUBLIC int v4l2_release_frame(int fd, int id);
+
+/* Move a frame borrowed with v4l2_borrow_frame() to dest without copying it,
+   by swapping the memory pages holding the frame with the ones at dest. dest
+   must be page aligned and lie inside a private anonymous mapping of the
+   caller (mmap() with MAP_PRIVATE | MAP_ANONYMOUS) at least n bytes long;
+   the pages previously at dest end up in libv4l2's buffer, which gets reused
+   for a later frame. The frame still has to be released afterwards.
+
+   This only works for frames libv4l2 converted, as the driver's own buffers
+   can't be moved around, and not for dma-bufs (V4L2_ENABLE_DMABUF_EXPORT). Returns 0, or -1 with errno set to EINVAL when the
+   frame can't be moved, in which case dest is left untouched and the frame
+   can be copied from where its reference points instead. */
+LIBV4L_PUBLIC int v4l2_move_frame(int fd, int id, void *dest, size_t n);
+
+/* Counters libv4l2 keeps for each device, see v4l2_get_stats() */
+struct v4l2_lib_stats {
+	uint64_t frames_converted;	/* frames converted successfully */
+	uint64_t convert_errors;	/* failed conversions, retried ones too */
+	uint64_t short_frames;		/* short frames returned to the app */
+	uint64_t convert_ns;		/* time spent converting, summed over
+					   the conversion threads */
+	uint32_t buffers_queued;	/* buffers currently queued at the
+					   driver */
+	uint32_t buffers_borrowed;	/* frames lent out by v4l2_borrow_frame */
+	uint32_t read_buffers;		/* driver buffers used by the read()
+					   emulation, 0 when not streaming */
+	uint32_t read_buffer_resizes;	/* times the read() emulation changed
+					   its number of buffers */
+	uint64_t frames_dropped;	/* sequence gaps seen by the read()
+					   emulation and v4l2_borrow_frame() */
+	uint32_t reserved[4];
+};
+
+/* Fill stats with the counters of the device since it was opened. The
+   buffers are only tracked while libv4l2 handles them, that is when
+   converting or emulating read(). When the LIBV4L2_STATS_INTERVAL environment
+   variable is set to a number of seconds, the counters of each device also
+   get written to the log file (or stderr) that often while converting.
+
+   The read() emulation uses 4 driver buffers. Setting the LIBV4L2_READ_BUFFERS
+   environment variable to a number changes that, setting it to a min:max
+   range (e.g. 2:16) makes it restart the stream with more buffers (up to max)
+   when the driver dropped frames while the application or the conversion
+   stalled, and with fewer ones (down to min) after a while without drops. A
+   restart loses the frames queued at the driver at that moment.
+
+   Returns 0, or -1 with errno set to EBADF if fd is not a libv4l2 fd. */
+LIBV4L_PUBLIC int v4l2_get_stats(int fd, struct v4l2_lib_stats *stats);
+
 
 /* Misc utility functions */
 
@@ -100,6 +164,24 @@ LIBV4L_PUBLIC int v4l2_get_control(int fd, int cid);
 /* This flag is *OBSOLETE*, since version 0.5.98 libv4l *always* reports
    emulated formats to ENUM_FMT, except when conversion is disabled. */
 #define V4L2_ENABLE_ENUM_FMT_EMULATION 0x02
+/* Convert frames on a pool of worker threads. Frames dequeued from the driver
+   get converted in the background while the next DQBUF is in flight, they are
+   still handed to the application in capture order by v4l2_read() and by
+   (emulated mmap) VIDIOC_DQBUF calls. This raises the number of frames per
+   second which can be converted (e.g. MJPEG decoding) at the cost of added
+   latency. The number of workers defaults to the number of online cpus and
+   can be overridden through the LIBV4L2_CONVERT_THREADS environment variable.
+   This works best with blocking I/O, with non-blocking I/O a frame may only
+   become available one poll() wakeup later. */
+#define V4L2_ENABLE_PIPELINED_CONVERSION 0x04
+/* Convert frames into dma-bufs, allocated from the system dma-heap or else
+   from memfd backed udmabufs, so VIDIOC_EXPBUF works for the (emulated mmap)
+   buffers holding the converted frames and they can be imported by a GPU or
+   an encoder without a copy. The exported fd gets the O_CLOEXEC of the
+   flags, but is always read / write. When neither allocator is available
+   the frames are converted into normal memory and VIDIOC_EXPBUF fails with
+   EINVAL. */
+#define V4L2_ENABLE_DMABUF_EXPORT 0x08
 
 /* v4l2_fd_open: open an already opened fd for further use through
    v4l2lib and possibly modify libv4l2's default behavior through the
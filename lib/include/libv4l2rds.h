@@ -321,6 +321,16 @@ LIBV4L_PUBLIC void v4l2_rds_reset(struct v4l2_rds *handle, bool reset_statistics
  * 				on RDS capable V4L2 devices */
 LIBV4L_PUBLIC uint32_t v4l2_rds_add(struct v4l2_rds *handle, struct v4l2_rds_data *rds_data);
 
+/* adds an array of raw RDS blocks, e.g. from a single read() of many blocks
+ * @return:	bitmask with with updated fields set to 1
+ * @rds_data:	the raw RDS blocks
+ * @count:	the number of blocks, set to the number of blocks decoded
+ * 				decoding stops after the first block that completes a
+ * 				group with updated fields, call it again to decode the
+ * 				remaining blocks */
+LIBV4L_PUBLIC uint32_t v4l2_rds_add_blocks(struct v4l2_rds *handle,
+		const struct v4l2_rds_data *rds_data, unsigned int *count);
+
 /*
  * group of functions to translate numerical RDS data into strings
  *
@@ -36,6 +36,8 @@
 
 /* end broken header workaround includes */
 
+#include <stddef.h>
+
 #if defined(__OpenBSD__)
 #include <sys/videoio.h>
 #else
@@ -57,6 +59,20 @@ struct v4lconvert_data;
 
 LIBV4L_PUBLIC const struct libv4l_dev_ops *v4lconvert_get_default_dev_ops();
 
+/* Setting the LIBV4LCONVERT_THREADS environment variable to a number > 1
+   (or 0 for one per cpu) makes the created instance convert (bayer and
+   packed yuv) frames in horizontal bands on a pool of that many threads.
+   Setting LIBV4LCONVERT_CACHE_DIR to a directory makes it store the formats
+   and framesizes it enumerates there, per driver and bus_info, and use them
+   instead of enumerating them again at the next opens of the device. The
+   cache files should be removed when a device firmware is updated.
+   Setting LIBV4LCONVERT_CALIBRATE makes it measure how long the conversions
+   take on this machine, and pick the src format with the cheapest conversion
+   which fits the bandwidth instead of using fixed preferences. The measured
+   costs are kept in LIBV4LCONVERT_CACHE_DIR, when set.
+   Setting LIBV4LCONVERT_GPU makes it do the yuyv, nv12 and 8 bit bayer to
+   rgb24 / bgr24 conversions with OpenGL ES 3.0, in a surfaceless EGL context
+   of its own, when libEGL and libGLESv2 are installed. */
 LIBV4L_PUBLIC struct v4lconvert_data *v4lconvert_create(int fd);
 LIBV4L_PUBLIC struct v4lconvert_data *v4lconvert_create_with_dev_ops(int fd,
 		void *dev_ops_priv, const struct libv4l_dev_ops *dev_ops);
@@ -116,6 +132,19 @@ LIBV4L_PUBLIC int v4lconvert_convert(struct v4lconvert_data *data,
 		const struct v4l2_format *dest_fmt, /* in */
 		unsigned char *src, int src_size, unsigned char *dest, int dest_size);
 
+/* Like v4lconvert_convert(), but for a multi-planar src_fmt
+   (V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE), with each plane read in place from
+   src[i], which holds src_size[i] bytes. The plane strides are taken from
+   src_fmt->fmt.pix_mp.plane_fmt[i].bytesperline. dest_fmt is a normal single
+   plane format. Currently only NV12M is supported as source format.
+
+   Returns the amount of bytes written to dest and -1 on error */
+LIBV4L_PUBLIC int v4lconvert_convert_mplane(struct v4lconvert_data *data,
+		const struct v4l2_format *src_fmt,  /* in */
+		const struct v4l2_format *dest_fmt, /* in */
+		unsigned char *const *src, const int *src_size,
+		unsigned char *dest, int dest_size);
+
 /* get a string describing the last error */
 LIBV4L_PUBLIC const char *v4lconvert_get_error_message(struct v4lconvert_data *data);
 
@@ -143,7 +172,8 @@ LIBV4L_PUBLIC int v4lconvert_vidioc_try_ext_ctrls(struct v4lconvert_data *data,
 LIBV4L_PUBLIC int v4lconvert_vidioc_s_ext_ctrls(struct v4lconvert_data *data,
 		void *arg);
 
-/* Is the passed in pixelformat supported as destination format? */
+/* Is the passed in pixelformat supported as destination format? These are
+   RGB24, BGR24, YUV420, YVU420, NV12, XRGB32 and XBGR32 */
 LIBV4L_PUBLIC int v4lconvert_supported_dst_format(unsigned int pixelformat);
 
 /* Get/set the no fps libv4lconvert uses to decide if a compressed format
@@ -154,6 +184,13 @@ LIBV4L_PUBLIC void v4lconvert_set_fps(struct v4lconvert_data *data, int fps);
 /* Fixup bytesperline and sizeimage for supported destination formats */
 LIBV4L_PUBLIC void v4lconvert_fixup_fmt(struct v4l2_format *fmt);
 
+/* Return the amount of memory currently used for intermediate buffers by
+   v4lconvert_convert(). These are sized for the last converted formats, and
+   released when converting between different formats. Setting the
+   LIBV4LCONVERT_HUGEPAGES environment variable makes large buffers use
+   transparent hugepages. */
+LIBV4L_PUBLIC size_t v4lconvert_get_scratch_size(struct v4lconvert_data *data);
+
 #ifdef __cplusplus
 }
 #endif /* __cplusplus */
@@ -18,7 +18,30 @@
  *
  */
 
+/*
+ * The CRC is computed 8 bytes at a time, from 8 lookup tables (the
+ * "slicing-by-8" algorithm). On x86 CPUs with carry-less multiplication,
+ * big buffers are first folded 64 bytes at a time with PCLMULQDQ, and the
+ * tables are used for the remainder. All ways give the same result as the
+ * byte at a time loop with crctab[].
+ */
+
+#include <config.h>
+
 #include <libdvbv5/crc32.h>
+#include <cpu-features.h>
+
+#ifdef HAVE_PTHREAD
+#include <pthread.h>
+#endif
+
+#ifdef CPU_BUILD_SSE
+#include <immintrin.h>
+#define HAVE_X86_CLMUL
+#endif
+
+/* x^32 + x^26 + x^23 + x^22 + x^16 + x^12 + x^11 + x^10 + x^8 + x^7 + x^5 + x^4 + x^2 + x + 1 */
+#define CRC32_POLY 0x104c11db7ULL
 
 static uint32_t crctab[256] = {
   0x00000000, 0x04c11db7, 0x09823b6e, 0x0d4326d9, 0x130476dc, 0x17c56b6b,
@@ -66,10 +89,184 @@ static uint32_t crctab[256] = {
   0xbcb4666d, 0xb8757bda, 0xb5365d03, 0xb1f740b4
 };
 
-inline uint32_t dvb_crc32(uint8_t *data, size_t len, uint32_t crc)
+/* crc_slice[k][i] is the crc of the byte i followed by k zero bytes */
+static uint32_t crc_slice[8][256];
+
+static uint32_t crc32_slice8(const uint8_t *data, size_t len, uint32_t crc)
+{
+	uint32_t hi;
+
+	while (len >= 8) {
+		hi = crc ^ ((uint32_t)data[0] << 24 | (uint32_t)data[1] << 16 |
+			    (uint32_t)data[2] << 8 | data[3]);
+		crc = crc_slice[7][hi >> 24] ^
+		      crc_slice[6][(hi >> 16) & 0xff] ^
+		      crc_slice[5][(hi >> 8) & 0xff] ^
+		      crc_slice[4][hi & 0xff] ^
+		      crc_slice[3][data[4]] ^
+		      crc_slice[2][data[5]] ^
+		      crc_slice[1][data[6]] ^
+		      crc_slice[0][data[7]];
+		data += 8;
+		len -= 8;
+	}
+	while (len--)
+		crc = (crc << 8) ^ crctab[((crc >> 24) ^ *data++) & 0xff];
+	return crc;
+}
+
+#ifdef HAVE_X86_CLMUL
+
+/* x^n mod P, for the folding constants */
+static uint64_t crc32_xpow_mod(unsigned n)
+{
+	uint64_t r = 1;
+
+	while (n--) {
+		r <<= 1;
+		if (r & (1ULL << 32))
+			r ^= CRC32_POLY;
+	}
+	return r;
+}
+
+/*
+ * Folding constants: an 128 bits block at distance d bits of the end of
+ * the data is reduced to (hi * (x^(d + 64) mod P)) ^ (lo * (x^d mod P)),
+ * which is congruent, and fits in 96 bits.
+ */
+static __m128i crc_fold_512, crc_fold_384, crc_fold_256, crc_fold_128;
+
+static void crc32_clmul_init(void)
+{
+	crc_fold_512 = _mm_set_epi64x(crc32_xpow_mod(512 + 64), crc32_xpow_mod(512));
+	crc_fold_384 = _mm_set_epi64x(crc32_xpow_mod(384 + 64), crc32_xpow_mod(384));
+	crc_fold_256 = _mm_set_epi64x(crc32_xpow_mod(256 + 64), crc32_xpow_mod(256));
+	crc_fold_128 = _mm_set_epi64x(crc32_xpow_mod(128 + 64), crc32_xpow_mod(128));
+}
+
+__attribute__((target("pclmul,ssse3")))
+static inline __m128i crc32_fold(__m128i x, __m128i k)
+{
+	return _mm_xor_si128(_mm_clmulepi64_si128(x, k, 0x11),
+			     _mm_clmulepi64_si128(x, k, 0x00));
+}
+
+__attribute__((target("pclmul,ssse3")))
+static uint32_t crc32_clmul(const uint8_t *data, size_t len, uint32_t crc)
+{
+	/* Loads the bytes as a big endian 128 bits polynomial */
+	const __m128i bswap = _mm_set_epi8(0, 1, 2, 3, 4, 5, 6, 7,
+					   8, 9, 10, 11, 12, 13, 14, 15);
+	uint8_t buf[16];
+	__m128i x0, x1, x2, x3;
+
+	if (len < 64)
+		return crc32_slice8(data, len, crc);
+
+	/* The initial value is the same as xoring the first 32 bits */
+	x0 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)data), bswap);
+	x0 = _mm_xor_si128(x0, _mm_set_epi64x((uint64_t)crc << 32, 0));
+	x1 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(data + 16)), bswap);
+	x2 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(data + 32)), bswap);
+	x3 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(data + 48)), bswap);
+	data += 64;
+	len -= 64;
+
+	while (len >= 64) {
+		x0 = _mm_xor_si128(crc32_fold(x0, crc_fold_512),
+				   _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)data), bswap));
+		x1 = _mm_xor_si128(crc32_fold(x1, crc_fold_512),
+				   _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(data + 16)), bswap));
+		x2 = _mm_xor_si128(crc32_fold(x2, crc_fold_512),
+				   _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(data + 32)), bswap));
+		x3 = _mm_xor_si128(crc32_fold(x3, crc_fold_512),
+				   _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(data + 48)), bswap));
+		data += 64;
+		len -= 64;
+	}
+
+	x0 = _mm_xor_si128(crc32_fold(x0, crc_fold_384), crc32_fold(x1, crc_fold_256));
+	x0 = _mm_xor_si128(x0, _mm_xor_si128(crc32_fold(x2, crc_fold_128), x3));
+
+	while (len >= 16) {
+		x0 = _mm_xor_si128(crc32_fold(x0, crc_fold_128),
+				   _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)data), bswap));
+		data += 16;
+		len -= 16;
+	}
+
+	/*
+	 * x0 is congruent to the data processed so far, so its crc, starting
+	 * from zero, is the crc of that data.
+	 */
+	_mm_storeu_si128((__m128i *)buf, _mm_shuffle_epi8(x0, bswap));
+	crc = crc32_slice8(buf, sizeof(buf), 0);
+
+	return crc32_slice8(data, len, crc);
+}
+
+#endif /* HAVE_X86_CLMUL */
+
+struct crc32_kernels {
+	void (*init)(void);
+	uint32_t (*crc32)(const uint8_t *data, size_t len, uint32_t crc);
+};
+
+#ifdef HAVE_X86_CLMUL
+static const struct crc32_kernels clmul_crc32_kernels = {
+	.init = crc32_clmul_init,
+	.crc32 = crc32_clmul,
+};
+#endif
+
+static const struct crc32_kernels c_crc32_kernels = {
+	.crc32 = crc32_slice8,
+};
+
+static const struct cpu_kernel_variant crc32_variants[] = {
+#ifdef HAVE_X86_CLMUL
+	{ "sse", CPU_FEATURE_PCLMUL | CPU_FEATURE_SSSE3, &clmul_crc32_kernels },
+#endif
+	{ "c", 0, &c_crc32_kernels },
+};
+
+static uint32_t (*crc32_func)(const uint8_t *data, size_t len, uint32_t crc);
+
+static void crc32_init(void)
+{
+	const struct crc32_kernels *kernels;
+	unsigned i, k;
+
+	for (i = 0; i < 256; i++) {
+		crc_slice[0][i] = crctab[i];
+		for (k = 1; k < 8; k++)
+			crc_slice[k][i] = (crc_slice[k - 1][i] << 8) ^
+					  crctab[crc_slice[k - 1][i] >> 24];
+	}
+
+	kernels = cpu_select_kernels(crc32_variants, cpu_features_get());
+	if (kernels->init)
+		kernels->init();
+	crc32_func = kernels->crc32;
+}
+
+#ifdef HAVE_PTHREAD
+static pthread_once_t crc32_once = PTHREAD_ONCE_INIT;
+#else
+static int crc32_initialized;
+#endif
+
+uint32_t dvb_crc32(uint8_t *data, size_t len, uint32_t crc)
 {
-  while(len--)
-    crc = (crc << 8) ^ crctab[((crc >> 24) ^ *data++) & 0xff];
-  return crc;
+#ifdef HAVE_PTHREAD
+	pthread_once(&crc32_once, crc32_init);
+#else
+	if (!crc32_initialized) {
+		crc32_init();
+		crc32_initialized = 1;
+	}
+#endif
+	return crc32_func(data, len, crc);
 }
 
@@ -57,6 +57,9 @@
 #include <libdvbv5/desc_ca_identifier.h>
 #include <libdvbv5/desc_extension.h>
 
+#include <parse_arena.h>
+#include <parse_string.h>
+
 static void dvb_desc_init(uint8_t type, uint8_t length, struct dvb_desc *desc)
 {
 	desc->type   = type;
@@ -132,70 +135,90 @@ const dvb_table_init_func dvb_table_initializers[256] = {
 	[DVB_TABLE_EIT_SCHEDULE_OTHER + 0x0f]	= TABLE_INIT(dvb_table_eit),
 };
 
+static struct dvb_desc *dvb_desc_parse_one(struct dvb_v5_fe_parms *parms,
+					   const struct dvb_desc_view *view,
+					   int *err)
+{
+	struct dvb_desc *current;
+	uint8_t desc_type = view->type;
+	uint8_t desc_len = view->length;
+	size_t size;
+
+	switch (parms->verbose) {
+	case 0:
+	case 1:
+		break;
+	case 2:
+		if (dvb_descriptors[desc_type].init)
+			break;
+		/* fall through */
+	case 3:
+		dvb_log("%sdescriptor %s type 0x%02x, size %d",
+			dvb_descriptors[desc_type].init ? "" : "Not handled ",
+			dvb_descriptors[desc_type].name, desc_type, desc_len);
+		dvb_hexdump(parms, "content: ", view->data, desc_len);
+	}
+
+	dvb_desc_init_func init = dvb_descriptors[desc_type].init;
+	if (!init) {
+		init = dvb_desc_default_init;
+		size = sizeof(struct dvb_desc) + desc_len;
+	} else {
+		size = dvb_descriptors[desc_type].size;
+	}
+	if (!size) {
+		dvb_logerr("descriptor type 0x%02x has no size defined", desc_type);
+		*err = -2;
+		return NULL;
+	}
+
+	current = dvb_parse_calloc(parms, 1, size);
+	if (!current) {
+		dvb_logerr("%s: out of memory", __func__);
+		*err = -3;
+		return NULL;
+	}
+	dvb_desc_init(desc_type, desc_len, current); /* initialize the standard header */
+	if (init(parms, view->data, current) != 0) {
+		dvb_parse_free(current);
+		*err = -4;
+		return NULL;
+	}
+	return current;
+}
+
 int dvb_desc_parse(struct dvb_v5_fe_parms *parms, const uint8_t *buf,
 			   uint16_t buflen, struct dvb_desc **head_desc)
 {
 	const uint8_t *ptr = buf, *endbuf = buf + buflen;
 	struct dvb_desc *current = NULL;
 	struct dvb_desc *last = NULL;
+	struct dvb_desc_view view;
+	int err;
 
 	*head_desc = NULL;
 
 	while (ptr + 2 <= endbuf ) {
-		uint8_t desc_type = ptr[0];
-		uint8_t desc_len  = ptr[1];
-		size_t size;
+		view.type = ptr[0];
+		view.length = ptr[1];
 
-		if (desc_type == 0xff ) {
+		if (view.type == 0xff ) {
 			dvb_logwarn("%s: stopping at invalid descriptor 0xff", __func__);
 			return 0;
 		}
 
 		ptr += 2; /* skip type and length */
 
-		if (ptr + desc_len > endbuf) {
+		if (ptr + view.length > endbuf) {
 			dvb_logerr("%s: short read of %zd/%d bytes parsing descriptor %#02x",
-				   __func__, endbuf - ptr, desc_len, desc_type);
+				   __func__, endbuf - ptr, view.length, view.type);
 			return -1;
 		}
+		view.data = ptr;
 
-		switch (parms->verbose) {
-		case 0:
-		case 1:
-			break;
-		case 2:
-			if (dvb_descriptors[desc_type].init)
-				break;
-			/* fall through */
-		case 3:
-			dvb_log("%sdescriptor %s type 0x%02x, size %d",
-				dvb_descriptors[desc_type].init ? "" : "Not handled ",
-				dvb_descriptors[desc_type].name, desc_type, desc_len);
-			dvb_hexdump(parms, "content: ", ptr, desc_len);
-		}
-
-		dvb_desc_init_func init = dvb_descriptors[desc_type].init;
-		if (!init) {
-			init = dvb_desc_default_init;
-			size = sizeof(struct dvb_desc) + desc_len;
-		} else {
-			size = dvb_descriptors[desc_type].size;
-		}
-		if (!size) {
-			dvb_logerr("descriptor type 0x%02x has no size defined", desc_type);
-			return -2;
-		}
-
-		current = calloc(1, size);
-		if (!current) {
-			dvb_logerr("%s: out of memory", __func__);
-			return -3;
-		}
-		dvb_desc_init(desc_type, desc_len, current); /* initialize the standard header */
-		if (init(parms, ptr, current) != 0) {
-			free(current);
-			return -4;
-		}
+		current = dvb_desc_parse_one(parms, &view, &err);
+		if (!current)
+			return err;
 		if (!*head_desc)
 			*head_desc = current;
 		if (last)
@@ -206,6 +229,65 @@ int dvb_desc_parse(struct dvb_v5_fe_parms *parms, const uint8_t *buf,
 	return 0;
 }
 
+void dvb_desc_iter_init(struct dvb_desc_iter *iter, const uint8_t *buf,
+			uint16_t buflen)
+{
+	iter->ptr = buf;
+	iter->end = buf + buflen;
+}
+
+int dvb_desc_iter_next(struct dvb_desc_iter *iter, struct dvb_desc_view *view)
+{
+	const uint8_t *ptr = iter->ptr;
+
+	if (ptr + 2 > iter->end || ptr[0] == 0xff) {
+		iter->ptr = iter->end;
+		return 0;
+	}
+	if (ptr + 2 + ptr[1] > iter->end) {
+		iter->ptr = iter->end;
+		return -1;
+	}
+
+	view->type = ptr[0];
+	view->length = ptr[1];
+	view->data = ptr + 2;
+	iter->ptr = ptr + 2 + ptr[1];
+	return 1;
+}
+
+int dvb_desc_view_find(const uint8_t *buf, uint16_t buflen, uint8_t type,
+		       struct dvb_desc_view *view)
+{
+	struct dvb_desc_iter iter;
+	int ret;
+
+	dvb_desc_iter_init(&iter, buf, buflen);
+	while ((ret = dvb_desc_iter_next(&iter, view)) > 0) {
+		if (view->type == type)
+			return 1;
+	}
+	return ret;
+}
+
+struct dvb_desc *dvb_desc_view_parse(struct dvb_v5_fe_parms *parms,
+				     const struct dvb_desc_view *view)
+{
+	int err;
+
+	return dvb_desc_parse_one(parms, view, &err);
+}
+
+char *dvb_desc_view_string(struct dvb_v5_fe_parms *parms, const uint8_t *src,
+			   size_t len)
+{
+	char *dest = NULL, *emph = NULL;
+
+	dvb_parse_string(parms, &dest, &emph, src, len);
+	dvb_parse_free(emph);
+	return dvb_parse_detach(dest);
+}
+
 void dvb_desc_print(struct dvb_v5_fe_parms *parms, struct dvb_desc *desc)
 {
 	while (desc) {
@@ -226,7 +308,7 @@ void dvb_desc_free(struct dvb_desc **list)
 		desc = desc->next;
 		if (dvb_descriptors[tmp->type].free)
 			dvb_descriptors[tmp->type].free(tmp);
-		free(tmp);
+		dvb_parse_free(tmp);
 	}
 	*list = NULL;
 }
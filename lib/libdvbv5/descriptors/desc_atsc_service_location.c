@@ -19,6 +19,7 @@
 
 #include <libdvbv5/desc_atsc_service_location.h>
 #include <libdvbv5/dvb-fe.h>
+#include <parse_arena.h>
 
 #if __GNUC__ >= 9
 #pragma GCC diagnostic ignored "-Waddress-of-packed-member"
@@ -40,7 +41,7 @@ int atsc_desc_service_location_init(struct dvb_v5_fe_parms *parms,
 	bswap16(s_loc->bitfield);
 
 	if (s_loc->number_elements) {
-		s_loc->elementary = malloc(s_loc->number_elements * sizeof(*s_loc->elementary));
+		s_loc->elementary = dvb_parse_malloc(parms, s_loc->number_elements * sizeof(*s_loc->elementary));
 		if (!s_loc->elementary) {
 			dvb_perror("Can't allocate space for ATSC service location elementary data");
 			return -1;
@@ -85,5 +86,5 @@ void atsc_desc_service_location_free(struct dvb_desc *desc)
 	const struct atsc_desc_service_location *s_loc = (const struct atsc_desc_service_location *) desc;
 
 	if (s_loc->elementary)
-		free(s_loc->elementary);
+		dvb_parse_free(s_loc->elementary);
 }
@@ -20,6 +20,7 @@
 
 #include <libdvbv5/desc_ca.h>
 #include <libdvbv5/dvb-fe.h>
+#include <parse_arena.h>
 
 #if __GNUC__ >= 9
 #pragma GCC diagnostic ignored "-Waddress-of-packed-member"
@@ -36,7 +37,7 @@ int dvb_desc_ca_init(struct dvb_v5_fe_parms *parms, const uint8_t *buf, struct d
 
 	if (d->length > size) {
 		size = d->length - size;
-		d->privdata = malloc(size);
+		d->privdata = dvb_parse_malloc(parms, size);
 		if (!d->privdata)
 			return -1;
 		d->privdata_len = size;
@@ -64,6 +65,6 @@ void dvb_desc_ca_free(struct dvb_desc *desc)
 {
 	struct dvb_desc_ca *d = (struct dvb_desc_ca *) desc;
 	if (d->privdata)
-		free(d->privdata);
+		dvb_parse_free(d->privdata);
 }
 
@@ -20,6 +20,7 @@
 
 #include <libdvbv5/desc_ca_identifier.h>
 #include <libdvbv5/dvb-fe.h>
+#include <parse_arena.h>
 
 #if __GNUC__ >= 9
 #pragma GCC diagnostic ignored "-Waddress-of-packed-member"
@@ -31,7 +32,7 @@ int dvb_desc_ca_identifier_init(struct dvb_v5_fe_parms *parms, const uint8_t *bu
 	int i;
 
 	d->caid_count = d->length >> 1; /* FIXME: warn if odd */
-	d->caids = malloc(d->length);
+	d->caids = dvb_parse_malloc(parms, d->length);
 	if (!d->caids) {
 		dvb_logerr("dvb_desc_ca_identifier_init: out of memory");
 		return -1;
@@ -56,6 +57,6 @@ void dvb_desc_ca_identifier_free(struct dvb_desc *desc)
 {
 	struct dvb_desc_ca_identifier *d = (struct dvb_desc_ca_identifier *) desc;
 	if (d->caids)
-		free(d->caids);
+		dvb_parse_free(d->caids);
 }
 
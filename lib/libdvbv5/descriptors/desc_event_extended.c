@@ -21,6 +21,7 @@
 #include <libdvbv5/desc_event_extended.h>
 #include <libdvbv5/dvb-fe.h>
 #include <parse_string.h>
+#include <parse_arena.h>
 
 #ifdef ENABLE_NLS
 # include "gettext.h"
@@ -59,7 +60,7 @@ int dvb_desc_event_extended_init(struct dvb_v5_fe_parms *parms, const uint8_t *b
 		if (first) {
 			first = 0;
 			event->num_items = 1;
-			event->items = calloc(sizeof(struct dvb_desc_event_extended_item), event->num_items);
+			event->items = dvb_parse_calloc(parms, sizeof(struct dvb_desc_event_extended_item), event->num_items);
 			if (!event->items) {
 				dvb_logerr(_("%s: out of memory"), __func__);
 				return -1;
@@ -67,7 +68,7 @@ int dvb_desc_event_extended_init(struct dvb_v5_fe_parms *parms, const uint8_t *b
 			item = event->items;
 		} else {
 			event->num_items++;
-			event->items = realloc(event->items, sizeof(struct dvb_desc_event_extended_item) * (event->num_items));
+			event->items = dvb_parse_realloc(parms, event->items, sizeof(struct dvb_desc_event_extended_item) * (event->num_items));
 			item = event->items + (event->num_items - 1);
 		}
 		len = *buf;
@@ -103,15 +104,15 @@ void dvb_desc_event_extended_free(struct dvb_desc *desc)
 {
 	struct dvb_desc_event_extended *event = (struct dvb_desc_event_extended *) desc;
 	int i;
-	free(event->text);
-	free(event->text_emph);
+	dvb_parse_free(event->text);
+	dvb_parse_free(event->text_emph);
 	for (i = 0; i < event->num_items; i++) {
-		free(event->items[i].description);
-		free(event->items[i].description_emph);
-		free(event->items[i].item);
-		free(event->items[i].item_emph);
+		dvb_parse_free(event->items[i].description);
+		dvb_parse_free(event->items[i].description_emph);
+		dvb_parse_free(event->items[i].item);
+		dvb_parse_free(event->items[i].item_emph);
 	}
-	free(event->items);
+	dvb_parse_free(event->items);
 }
 
 void dvb_desc_event_extended_print(struct dvb_v5_fe_parms *parms, const struct dvb_desc *desc)
@@ -21,6 +21,7 @@
 #include <libdvbv5/desc_event_short.h>
 #include <libdvbv5/dvb-fe.h>
 #include <parse_string.h>
+#include <parse_arena.h>
 
 #if __GNUC__ >= 9
 #pragma GCC diagnostic ignored "-Waddress-of-packed-member"
@@ -58,13 +59,48 @@ int dvb_desc_event_short_init(struct dvb_v5_fe_parms *parms, const uint8_t *buf,
 	return 0;
 }
 
+int dvb_desc_event_short_view(struct dvb_v5_fe_parms *parms,
+			      const struct dvb_desc_view *view,
+			      char *language, char **name, char **text)
+{
+	const uint8_t *buf = view->data;
+	const uint8_t *endbuf = buf + view->length;
+	uint8_t len1, len2;
+
+	if (name)
+		*name = NULL;
+	if (text)
+		*text = NULL;
+
+	if (view->type != short_event_descriptor || buf + 4 > endbuf)
+		return -1;
+	len1 = buf[3];
+	if (buf + 5 + len1 > endbuf)
+		return -1;
+	len2 = buf[4 + len1];
+	if (buf + 5 + len1 + len2 > endbuf)
+		return -1;
+
+	if (language) {
+		language[0] = buf[0];
+		language[1] = buf[1];
+		language[2] = buf[2];
+		language[3] = '\0';
+	}
+	if (name)
+		*name = dvb_desc_view_string(parms, buf + 4, len1);
+	if (text)
+		*text = dvb_desc_view_string(parms, buf + 5 + len1, len2);
+	return 0;
+}
+
 void dvb_desc_event_short_free(struct dvb_desc *desc)
 {
 	struct dvb_desc_event_short *event = (struct dvb_desc_event_short *) desc;
-	free(event->name);
-	free(event->name_emph);
-	free(event->text);
-	free(event->text_emph);
+	dvb_parse_free(event->name);
+	dvb_parse_free(event->name_emph);
+	dvb_parse_free(event->text);
+	dvb_parse_free(event->text_emph);
 }
 
 void dvb_desc_event_short_print(struct dvb_v5_fe_parms *parms, const struct dvb_desc *desc)
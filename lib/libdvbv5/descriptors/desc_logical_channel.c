@@ -23,6 +23,7 @@
 
 #include <libdvbv5/desc_logical_channel.h>
 #include <libdvbv5/dvb-fe.h>
+#include <parse_arena.h>
 
 #if __GNUC__ >= 9
 #pragma GCC diagnostic ignored "-Waddress-of-packed-member"
@@ -36,7 +37,7 @@ int dvb_desc_logical_channel_init(struct dvb_v5_fe_parms *parms,
 	size_t len;
 	int i;
 
-	d->lcn = malloc(d->length);
+	d->lcn = dvb_parse_malloc(parms, d->length);
 	if (!d->lcn) {
 		dvb_logerr("%s: out of memory", __func__);
 		return -1;
@@ -72,6 +73,6 @@ void dvb_desc_logical_channel_free(struct dvb_desc *desc)
 {
 	struct dvb_desc_logical_channel *d = (void *)desc;
 
-	free(d->lcn);
+	dvb_parse_free(d->lcn);
 }
 
@@ -21,6 +21,7 @@
 #include <libdvbv5/desc_network_name.h>
 #include <libdvbv5/dvb-fe.h>
 #include <parse_string.h>
+#include <parse_arena.h>
 
 #if __GNUC__ >= 9
 #pragma GCC diagnostic ignored "-Waddress-of-packed-member"
@@ -52,6 +53,6 @@ void dvb_desc_network_name_free(struct dvb_desc *desc)
 {
 	const struct dvb_desc_network_name *net = (const struct dvb_desc_network_name *) desc;
 
-	free(net->network_name);
-	free(net->network_name_emph);
+	dvb_parse_free(net->network_name);
+	dvb_parse_free(net->network_name_emph);
 }
@@ -19,6 +19,7 @@
 
 #include <libdvbv5/desc_registration_id.h>
 #include <libdvbv5/dvb-fe.h>
+#include <parse_arena.h>
 
 #if __GNUC__ >= 9
 #pragma GCC diagnostic ignored "-Waddress-of-packed-member"
@@ -40,7 +41,7 @@ int dvb_desc_registration_init(struct dvb_v5_fe_parms *parms,
 	if (desc->length <= size)
 		return 0;
 
-	d->additional_identification_info = malloc(desc->length - size);
+	d->additional_identification_info = dvb_parse_malloc(parms, desc->length - size);
 	memcpy(desc->data, buf + size, desc->length - size);
 
 	return 0;
@@ -68,5 +69,5 @@ void dvb_desc_registration_free(struct dvb_desc *desc)
 {
 	const struct dvb_desc_registration *d = (const void *) desc;
 
-	free(d->additional_identification_info);
+	dvb_parse_free(d->additional_identification_info);
 }
@@ -21,6 +21,7 @@
 #include <libdvbv5/desc_service.h>
 #include <libdvbv5/dvb-fe.h>
 #include <parse_string.h>
+#include <parse_arena.h>
 
 #if __GNUC__ >= 9
 #pragma GCC diagnostic ignored "-Waddress-of-packed-member"
@@ -85,13 +86,44 @@ int dvb_desc_service_init(struct dvb_v5_fe_parms *parms, const uint8_t *buf, str
 	return 0;
 }
 
+int dvb_desc_service_view(struct dvb_v5_fe_parms *parms,
+			  const struct dvb_desc_view *view,
+			  uint8_t *service_type, char **provider, char **name)
+{
+	const uint8_t *buf = view->data;
+	const uint8_t *endbuf = buf + view->length;
+	uint8_t len1, len2;
+
+	if (provider)
+		*provider = NULL;
+	if (name)
+		*name = NULL;
+
+	if (view->type != service_descriptor || buf + 2 > endbuf)
+		return -1;
+	len1 = buf[1];
+	if (buf + 3 + len1 > endbuf)
+		return -1;
+	len2 = buf[2 + len1];
+	if (buf + 3 + len1 + len2 > endbuf)
+		return -1;
+
+	if (service_type)
+		*service_type = buf[0];
+	if (provider)
+		*provider = dvb_desc_view_string(parms, buf + 2, len1);
+	if (name)
+		*name = dvb_desc_view_string(parms, buf + 3 + len1, len2);
+	return 0;
+}
+
 void dvb_desc_service_free(struct dvb_desc *desc)
 {
 	struct dvb_desc_service *service = (struct dvb_desc_service *) desc;
-	free(service->provider);
-	free(service->provider_emph);
-	free(service->name);
-	free(service->name_emph);
+	dvb_parse_free(service->provider);
+	dvb_parse_free(service->provider_emph);
+	dvb_parse_free(service->name);
+	dvb_parse_free(service->name_emph);
 }
 
 void dvb_desc_service_print(struct dvb_v5_fe_parms *parms, const struct dvb_desc *desc)
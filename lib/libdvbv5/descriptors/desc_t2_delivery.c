@@ -21,6 +21,7 @@
 #include <libdvbv5/desc_extension.h>
 #include <libdvbv5/desc_t2_delivery.h>
 #include <libdvbv5/dvb-fe.h>
+#include <parse_arena.h>
 
 #if __GNUC__ >= 9
 #pragma GCC diagnostic ignored "-Waddress-of-packed-member"
@@ -65,7 +66,7 @@ int dvb_desc_t2_delivery_init(struct dvb_v5_fe_parms *parms,
 			return -2;
 		}
 
-		d->cell = realloc(d->cell, (d->num_cell + 1) * sizeof(*d->cell));
+		d->cell = dvb_parse_realloc(parms, d->cell, (d->num_cell + 1) * sizeof(*d->cell));
 		if (!d->cell) {
 			dvb_logerr("%s: out of memory", __func__);
 			return -3;
@@ -83,7 +84,7 @@ int dvb_desc_t2_delivery_init(struct dvb_v5_fe_parms *parms,
 			d->cell[d->num_cell].num_freqs = 1;
 
 		d->frequency_loop_length += d->cell[d->num_cell].num_freqs;
-		d->centre_frequency = realloc(d->centre_frequency,
+		d->centre_frequency = dvb_parse_realloc(parms, d->centre_frequency,
 					      d->frequency_loop_length * sizeof(*d->centre_frequency));
 		if (!d->centre_frequency) {
 			dvb_logerr("%s: out of memory", __func__);
@@ -107,7 +108,7 @@ int dvb_desc_t2_delivery_init(struct dvb_v5_fe_parms *parms,
 		p++;
 
 		if (d->cell[d->num_cell].subcel_length) {
-			d->cell[d->num_cell].subcel = calloc(d->cell[d->num_cell].subcel_length,
+			d->cell[d->num_cell].subcel = dvb_parse_calloc(parms, d->cell[d->num_cell].subcel_length,
 							     sizeof (*d->cell[d->num_cell].subcel));
 
 			if (!d->cell[d->num_cell].subcel) {
@@ -126,7 +127,7 @@ int dvb_desc_t2_delivery_init(struct dvb_v5_fe_parms *parms,
 
 			// Add transposer_frequency at centre_frequency table
 			d->frequency_loop_length++;
-			d->centre_frequency = realloc(d->centre_frequency,
+			d->centre_frequency = dvb_parse_realloc(parms, d->centre_frequency,
 						      d->frequency_loop_length * sizeof(*d->centre_frequency));
 			memcpy(&d->centre_frequency[pos], p, sizeof(*d->centre_frequency));
 			bswap32(d->centre_frequency[pos]);
@@ -195,13 +196,13 @@ void dvb_desc_t2_delivery_free(const void *desc)
 	int i;
 
 	if (d->centre_frequency)
-		free(d->centre_frequency);
+		dvb_parse_free(d->centre_frequency);
 
 	if (d->cell) {
 		for (i = 0; i < d->num_cell; i++)
 			if (d->cell[i].subcel)
-				free(d->cell[i].subcel);
-		free (d->cell);
+				dvb_parse_free(d->cell[i].subcel);
+		dvb_parse_free(d->cell);
 	}
 
 	// No need to free d->subcell, as it is always NULL
@@ -21,6 +21,7 @@
 #include <libdvbv5/desc_ts_info.h>
 #include <libdvbv5/dvb-fe.h>
 #include <parse_string.h>
+#include <parse_arena.h>
 
 #if __GNUC__ >= 9
 #pragma GCC diagnostic ignored "-Waddress-of-packed-member"
@@ -52,7 +53,7 @@ int dvb_desc_ts_info_init(struct dvb_v5_fe_parms *parms,
 
 	t = &d->transmission_type;
 
-	d->service_id = malloc(sizeof(*d->service_id) * t->num_of_service);
+	d->service_id = dvb_parse_malloc(parms, sizeof(*d->service_id) * t->num_of_service);
 	if (!d->service_id) {
 		dvb_logerr("%s: out of memory", __func__);
 		return -1;
@@ -89,9 +90,9 @@ void dvb_desc_ts_info_free(struct dvb_desc *desc)
 	const struct dvb_desc_ts_info *d = (const void *) desc;
 
 	if (d->ts_name)
-	      free(d->ts_name);
+	      dvb_parse_free(d->ts_name);
 	if (d->ts_name_emph)
-	      free(d->ts_name_emph);
+	      dvb_parse_free(d->ts_name_emph);
 
-	free(d->service_id);
+	dvb_parse_free(d->service_id);
 }
@@ -0,0 +1,1060 @@
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation version 2.1 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ * Or, point your browser to http://www.gnu.org/licenses/old-licenses/gpl-2.0.html
+ */
+
+/*
+ * Virtual DVB device, backed by MPEG-TS recordings.
+ *
+ * It has a single adapter, with a frontend, a demux and a dvr. Each
+ * recording at the directory given to dvb_dev_file_init() is a
+ * transponder, named after its frequency, as stored at DTV_FREQUENCY,
+ * like 474000000.ts, or 11494000.ts for a satellite one, in kHz.
+ *
+ * Tuning into a frequency that has a recording locks at once, and into
+ * any other one gives FE_TIMEDOUT, so nothing waits for a tuner. The
+ * recording is then read as fast as it is asked for:
+ *
+ *	- a section filter returns the matching sections, reading the
+ *	  recording in a loop, as the tables are repeated on air. After a
+ *	  whole loop without any matching section, read gives -ETIMEDOUT;
+ *	- a PES filter returns the TS packets of its PID, on the demux with
+ *	  DMX_OUT_TSDEMUX_TAP, or on the dvr with DMX_OUT_TS_TAP, until the
+ *	  end of the recording;
+ *	- dvb_dev_scan() reads each batch of tables in a single pass, with
+ *	  a userspace demux, from where the previous batch stopped.
+ *
+ * So, a scan takes just CPU time, while how much of the recordings it
+ * had to read, logged in verbose mode, tells how long it would take on
+ * air.
+ */
+
+#define _FILE_OFFSET_BITS 64
+#define _LARGEFILE_SOURCE 1
+#define _LARGEFILE64_SOURCE 1
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include <config.h>
+
+#include "dvb-fe-priv.h"
+#include "dvb-dev-priv.h"
+#include <libdvbv5/dvb-scan.h>
+#include <libdvbv5/crc32.h>
+#include <libdvbv5/mpeg_ts.h>
+#include <libdvbv5/pat.h>
+
+#ifdef ENABLE_NLS
+# include "gettext.h"
+# include <libintl.h>
+# define _(string) dgettext(LIBDVBV5_DOMAIN, string)
+#else
+# define _(string) string
+#endif
+
+#define FILE_READ_PACKETS	64
+#define FILE_ALL_PIDS		0x2000
+
+struct dvb_file_rec {
+	uint32_t freq;
+	char *path;
+};
+
+/* Reads the TS packets of the tuned recording */
+struct dvb_file_reader {
+	off_t pos;		/* of the next read() */
+	off_t lap;		/* bytes given since the reader started */
+	unsigned len, off;
+	uint8_t buf[FILE_READ_PACKETS * DVB_MPEG_TS_PACKET_SIZE];
+};
+
+/* Reassembles the sections of a PID */
+struct dvb_file_section {
+	int cc, started, can_start;
+	unsigned len;
+	uint8_t buf[DVB_MAX_PAYLOAD_PACKET_SIZE];
+
+	/* The payload not handled yet */
+	const uint8_t *p, *next_p;
+	unsigned size, next_size;
+};
+
+enum dvb_file_filter {
+	FILE_FILTER_NONE,
+	FILE_FILTER_SECTION,
+	FILE_FILTER_PES,
+};
+
+struct dvb_file_open {
+	/* Should be the first element */
+	struct dvb_open_descriptor open_dev;
+
+	enum dvb_file_filter type;
+	unsigned flags;
+	uint16_t pid;
+	dmx_output_t output;
+	unsigned filtsize;
+	uint8_t filter[DMX_FILTER_SIZE];
+	uint8_t mask[DMX_FILTER_SIZE];
+	uint8_t mode[DMX_FILTER_SIZE];
+
+	struct dvb_file_reader reader;
+	struct dvb_file_section sect;
+};
+
+struct dvb_dev_file_priv {
+	char *dir;
+	struct dvb_file_rec *recs;
+	unsigned num_recs;
+
+	/* The tuned recording, if any */
+	struct dvb_file_rec *rec;
+	int fd;
+	off_t size;
+
+	/* Where the next table read starts, and the total read */
+	off_t pos;
+	unsigned long long total;
+
+	struct dvb_file_reader scan_reader;
+};
+
+static void dvb_file_reader_start(struct dvb_dev_file_priv *priv,
+				  struct dvb_file_reader *r, off_t pos)
+{
+	r->pos = pos;
+	r->lap = 0;
+	r->len = 0;
+	r->off = 0;
+}
+
+/* The position of the next packet the reader will return */
+static off_t dvb_file_reader_tell(struct dvb_file_reader *r)
+{
+	return r->pos - (r->len - r->off);
+}
+
+/*
+ * Returns the next TS packet. If loop is set, the recording is read in a
+ * loop, up to its size. Returns NULL when done.
+ */
+static const uint8_t *dvb_file_reader_packet(struct dvb_dev_file_priv *priv,
+					     struct dvb_file_reader *r,
+					     int loop)
+{
+	const uint8_t *pkt;
+	ssize_t ret;
+	int wrapped = 0;
+
+	if (priv->fd < 0 || (loop && r->lap >= priv->size))
+		return NULL;
+
+	for (;;) {
+		while (r->off + DVB_MPEG_TS_PACKET_SIZE <= r->len) {
+			if (r->buf[r->off] != DVB_MPEG_TS) {
+				/* Lost sync: skip to the next sync byte */
+				r->off++;
+				r->lap++;
+				continue;
+			}
+			pkt = r->buf + r->off;
+			r->off += DVB_MPEG_TS_PACKET_SIZE;
+			r->lap += DVB_MPEG_TS_PACKET_SIZE;
+			return pkt;
+		}
+
+		memmove(r->buf, r->buf + r->off, r->len - r->off);
+		r->len -= r->off;
+		r->off = 0;
+
+		ret = pread(priv->fd, r->buf + r->len, sizeof(r->buf) - r->len,
+			    r->pos);
+		if (ret < 0) {
+			if (errno == EINTR)
+				continue;
+			return NULL;
+		}
+		if (ret) {
+			r->len += ret;
+			r->pos += ret;
+			continue;
+		}
+
+		/* At the end: a partial packet there is just dropped */
+		if (!loop || wrapped)
+			return NULL;
+		r->lap += r->len;
+		r->len = 0;
+		r->pos = 0;
+		wrapped = 1;
+	}
+}
+
+static void dvb_file_section_reset(struct dvb_file_section *s)
+{
+	s->cc = -1;
+	s->started = 0;
+	s->size = 0;
+	s->next_size = 0;
+}
+
+/*
+ * Appends payload to the section being reassembled. Returns 1 when the
+ * section is complete, 0 if it needs more data, or -1 if it is invalid.
+ */
+static int dvb_file_section_append(struct dvb_file_section *s)
+{
+	unsigned total = 3, n;
+
+	for (;;) {
+		if (s->len >= 3) {
+			total += ((s->buf[1] & 0x0f) << 8) | s->buf[2];
+			if (total > sizeof(s->buf))
+				return -1;
+		}
+		if (s->len == total)
+			return total > 3 ? 1 : 0;
+		if (!s->size)
+			return 0;
+		n = total - s->len;
+		if (n > s->size)
+			n = s->size;
+		memcpy(s->buf + s->len, s->p, n);
+		s->len += n;
+		s->p += n;
+		s->size -= n;
+		total = 3;
+	}
+}
+
+/* Sets the payload of a TS packet of the PID to be reassembled */
+static void dvb_file_section_packet(struct dvb_file_section *s,
+				    const uint8_t *pkt)
+{
+	const uint8_t *p = pkt + 4;
+	unsigned size, ptr, cc;
+
+	if (pkt[1] & 0x80 || !(pkt[3] & 0x10) || pkt[3] & 0xc0)
+		return;
+	if (pkt[3] & 0x20) {
+		if (5 + pkt[4] >= DVB_MPEG_TS_PACKET_SIZE)
+			return;
+		p += 1 + pkt[4];
+	}
+	size = pkt + DVB_MPEG_TS_PACKET_SIZE - p;
+
+	cc = pkt[3] & 0x0f;
+	if (s->cc >= 0) {
+		if (cc == (unsigned)s->cc)
+			return;		/* Duplicated packet */
+		if (cc != ((s->cc + 1) & 0x0f))
+			s->started = 0;
+	}
+	s->cc = cc;
+
+	if (!(pkt[1] & 0x40)) {
+		if (!s->started)
+			return;
+		s->p = p;
+		s->size = size;
+		s->can_start = 0;
+		return;
+	}
+
+	/* Payload unit start: the pointer field tells where a section starts */
+	ptr = *p++;
+	size--;
+	if (ptr >= size) {
+		s->started = 0;
+		return;
+	}
+	if (s->started) {
+		/* The end of the section being reassembled comes first */
+		s->p = p;
+		s->size = ptr;
+		s->next_p = p + ptr;
+		s->next_size = size - ptr;
+	} else {
+		s->p = p + ptr;
+		s->size = size - ptr;
+	}
+	s->can_start = 1;
+}
+
+/*
+ * Returns the length of the next section at s->buf, reading the
+ * recording if needed, or 0 if there's none.
+ */
+static unsigned dvb_file_section_next(struct dvb_dev_file_priv *priv,
+				      struct dvb_file_open *f, int loop)
+{
+	struct dvb_file_section *s = &f->sect;
+	const uint8_t *pkt;
+
+	for (;;) {
+		while (s->size || s->next_size) {
+			if (!s->size) {
+				/* The section ended before its length */
+				s->started = 0;
+				s->p = s->next_p;
+				s->size = s->next_size;
+				s->next_size = 0;
+				continue;
+			}
+			if (!s->started) {
+				if (!s->can_start || *s->p == 0xff) {
+					s->size = 0;
+					s->next_size = 0;
+					break;
+				}
+				s->started = 1;
+				s->len = 0;
+			}
+			switch (dvb_file_section_append(s)) {
+			case 1:
+				s->started = 0;
+				if (s->next_size) {
+					s->p = s->next_p;
+					s->size = s->next_size;
+					s->next_size = 0;
+				}
+				return s->len;
+			case -1:
+				s->started = 0;
+				s->size = 0;
+				s->next_size = 0;
+				break;
+			}
+		}
+
+		do {
+			pkt = dvb_file_reader_packet(priv, &f->reader, loop);
+			if (!pkt)
+				return 0;
+		} while ((((pkt[1] & 0x1f) << 8) | pkt[2]) != f->pid);
+		dvb_file_section_packet(s, pkt);
+	}
+}
+
+/* Same as the Kernel's section filter */
+static int dvb_file_section_match(struct dvb_file_open *f,
+				  const uint8_t *buf, unsigned len)
+{
+	uint8_t xor, neq = 0, doneq = 0;
+	unsigned i;
+
+	if (len < f->filtsize + 2)
+		return 0;
+
+	for (i = 0; i < f->filtsize; i++) {
+		xor = (buf[i ? i + 2 : 0] ^ f->filter[i]) & f->mask[i];
+		if (xor & ~f->mode[i])
+			return 0;
+		neq |= xor & f->mode[i];
+		doneq |= f->mask[i] & f->mode[i];
+	}
+	if (doneq && !neq)
+		return 0;
+
+	if ((f->flags & DMX_CHECK_CRC) && (buf[1] & 0x80) &&
+	    dvb_crc32((uint8_t *)buf, len, 0xFFFFFFFF))
+		return 0;
+
+	return 1;
+}
+
+static struct dvb_file_rec *dvb_file_find_rec(struct dvb_dev_file_priv *priv,
+					      uint32_t freq)
+{
+	unsigned i;
+
+	for (i = 0; i < priv->num_recs; i++)
+		if (priv->recs[i].freq == freq)
+			return &priv->recs[i];
+	return NULL;
+}
+
+static int dvb_file_add_dev(struct dvb_device_priv *dvb,
+			    enum dvb_dev_type type)
+{
+	struct dvb_dev_file_priv *priv = dvb->priv;
+	struct dvb_dev_list *dev;
+
+	dev = realloc(dvb->d.devices,
+		      sizeof(*dev) * (dvb->d.num_devices + 1));
+	if (!dev)
+		return -ENOMEM;
+	dvb->d.devices = dev;
+	dev += dvb->d.num_devices++;
+	memset(dev, 0, sizeof(*dev));
+	dvb_dev_index_invalidate(dvb);
+
+	dev->dvb_type = type;
+	if (asprintf(&dev->sysname, "dvb0.%s0", dev_type_names[type]) < 0) {
+		dev->sysname = NULL;
+		return -ENOMEM;
+	}
+	dev->path = strdup(priv->dir);
+	dev->syspath = strdup(priv->dir);
+	dev->bus_addr = strdup("file");
+	dev->product = strdup("Virtual DVB device, backed by MPEG-TS files");
+	if (!dev->path || !dev->syspath || !dev->bus_addr || !dev->product)
+		return -ENOMEM;
+
+	return 0;
+}
+
+static int dvb_file_find(struct dvb_device_priv *dvb,
+			 dvb_dev_change_t handler, void *user_priv)
+{
+	struct dvb_v5_fe_parms_priv *parms = (void *)dvb->d.fe_parms;
+	static const enum dvb_dev_type types[] = {
+		DVB_DEVICE_FRONTEND, DVB_DEVICE_DEMUX, DVB_DEVICE_DVR
+	};
+	unsigned i;
+
+	/* Free a previous list of devices */
+	if (dvb->d.num_devices)
+		dvb_dev_free_devices(dvb);
+
+	for (i = 0; i < sizeof(types) / sizeof(*types); i++) {
+		if (dvb_file_add_dev(dvb, types[i]) < 0) {
+			dvb_logerr(_("%s: out of memory"), __func__);
+			return -ENOMEM;
+		}
+		dvb_dev_dump_device(_("Found dvb %s device: %s"), parms,
+				    &dvb->d.devices[i]);
+		if (handler)
+			handler(strdup(dvb->d.devices[i].sysname),
+				DVB_DEV_ADD, user_priv);
+	}
+
+	return 0;
+}
+
+static void dvb_file_open_fe(struct dvb_device_priv *dvb)
+{
+	static const fe_delivery_system_t systems[] = {
+		SYS_DVBT, SYS_DVBT2, SYS_DVBC_ANNEX_A, SYS_DVBC_ANNEX_B,
+		SYS_DVBC_ANNEX_C, SYS_DVBS, SYS_DVBS2, SYS_ISDBT, SYS_ATSC,
+	};
+	struct dvb_v5_fe_parms_priv *parms = (void *)dvb->d.fe_parms;
+	struct dvb_v5_fe_parms *p = &parms->p;
+	unsigned i;
+
+	memset(&p->info, 0, sizeof(p->info));
+	strcpy(p->info.name, "Virtual frontend, backed by MPEG-TS files");
+	p->info.caps = FE_CAN_INVERSION_AUTO | FE_CAN_FEC_AUTO |
+		       FE_CAN_QAM_AUTO | FE_CAN_TRANSMISSION_MODE_AUTO |
+		       FE_CAN_GUARD_INTERVAL_AUTO | FE_CAN_HIERARCHY_AUTO |
+		       FE_CAN_2G_MODULATION;
+	p->version = 0x510;
+	p->has_v5_stats = 1;
+
+	for (i = 0; i < sizeof(systems) / sizeof(*systems); i++)
+		p->systems[i] = systems[i];
+	p->num_systems = i;
+
+	dvb_fe_init_stats(parms);
+	if (p->current_sys == SYS_UNDEFINED)
+		dvb_set_sys(p, systems[0]);
+}
+
+static struct dvb_open_descriptor *dvb_file_open(struct dvb_device_priv *dvb,
+						 const char *sysname,
+						 int flags)
+{
+	struct dvb_v5_fe_parms_priv *parms = (void *)dvb->d.fe_parms;
+	struct dvb_open_descriptor *open_dev, *cur;
+	struct dvb_dev_list *dev;
+	struct dvb_file_open *f;
+
+	dev = dvb_local_get_dev_info(dvb, sysname);
+	if (!dev)
+		return NULL;
+
+	f = calloc(1, sizeof(*f));
+	if (!f) {
+		dvb_perror("Can't create file descriptor");
+		return NULL;
+	}
+	dvb_file_section_reset(&f->sect);
+
+	if (dev->dvb_type == DVB_DEVICE_FRONTEND)
+		dvb_file_open_fe(dvb);
+
+	/* There's no Kernel file descriptor */
+	open_dev = &f->open_dev;
+	open_dev->fd = -1;
+	open_dev->dev = dev;
+	open_dev->dvb = dvb;
+
+	cur = &dvb->open_list;
+	while (cur->next)
+		cur = cur->next;
+	cur->next = open_dev;
+
+	return open_dev;
+}
+
+static int dvb_file_close(struct dvb_open_descriptor *open_dev)
+{
+	struct dvb_device_priv *dvb = open_dev->dvb;
+	struct dvb_v5_fe_parms_priv *parms = (void *)dvb->d.fe_parms;
+	struct dvb_open_descriptor *cur;
+
+	for (cur = &dvb->open_list; cur->next; cur = cur->next) {
+		if (cur->next == open_dev) {
+			cur->next = open_dev->next;
+			free(open_dev);
+			return 0;
+		}
+	}
+
+	/* Should never happen */
+	dvb_logerr(_("Couldn't free device\n"));
+
+	return -ENODEV;
+}
+
+static int dvb_file_dmx_stop(struct dvb_open_descriptor *open_dev)
+{
+	struct dvb_file_open *f = (void *)open_dev;
+
+	if (open_dev->dev->dvb_type != DVB_DEVICE_DEMUX)
+		return -EINVAL;
+
+	f->type = FILE_FILTER_NONE;
+	return 0;
+}
+
+static int dvb_file_set_bufsize(struct dvb_open_descriptor *open_dev,
+				int buffersize)
+{
+	enum dvb_dev_type type = open_dev->dev->dvb_type;
+
+	if (type != DVB_DEVICE_DEMUX && type != DVB_DEVICE_DVR)
+		return -EINVAL;
+
+	/* The data is read from the recording when asked for */
+	return 0;
+}
+
+static void dvb_file_start(struct dvb_open_descriptor *open_dev)
+{
+	struct dvb_dev_file_priv *priv = open_dev->dvb->priv;
+	struct dvb_file_open *f = (void *)open_dev;
+
+	dvb_file_reader_start(priv, &f->reader, priv->pos);
+	dvb_file_section_reset(&f->sect);
+}
+
+static ssize_t dvb_file_read_section(struct dvb_dev_file_priv *priv,
+				     struct dvb_file_open *f,
+				     uint8_t *buf, size_t count)
+{
+	unsigned len;
+
+	for (;;) {
+		len = dvb_file_section_next(priv, f, 1);
+		if (!len)
+			return -ETIMEDOUT;
+		if (!dvb_file_section_match(f, f->sect.buf, len))
+			continue;
+
+		/* A whole loop without sections times out */
+		f->reader.lap = 0;
+		if (f->flags & DMX_ONESHOT)
+			f->type = FILE_FILTER_NONE;
+
+		if (len > count)
+			len = count;
+		memcpy(buf, f->sect.buf, len);
+		return len;
+	}
+}
+
+/* Reads the TS packets of the PIDs for which pid_ok() is true */
+static ssize_t dvb_file_read_ts(struct dvb_dev_file_priv *priv,
+				struct dvb_file_reader *r,
+				uint8_t *buf, size_t count,
+				int (*pid_ok)(void *arg, uint16_t pid),
+				void *arg)
+{
+	const uint8_t *pkt;
+	size_t len = 0;
+
+	while (len + DVB_MPEG_TS_PACKET_SIZE <= count) {
+		pkt = dvb_file_reader_packet(priv, r, 0);
+		if (!pkt)
+			break;
+		if (!pid_ok(arg, ((pkt[1] & 0x1f) << 8) | pkt[2]))
+			continue;
+		memcpy(buf + len, pkt, DVB_MPEG_TS_PACKET_SIZE);
+		len += DVB_MPEG_TS_PACKET_SIZE;
+	}
+
+	return len;
+}
+
+static int dvb_file_dmx_pid_ok(void *arg, uint16_t pid)
+{
+	struct dvb_file_open *f = arg;
+
+	return f->pid == FILE_ALL_PIDS || f->pid == pid;
+}
+
+/* The dvr has the PIDs of all demux PES filters with DMX_OUT_TS_TAP */
+static int dvb_file_dvr_pid_ok(void *arg, uint16_t pid)
+{
+	struct dvb_device_priv *dvb = arg;
+	struct dvb_open_descriptor *cur;
+	struct dvb_file_open *f;
+
+	for (cur = dvb->open_list.next; cur; cur = cur->next) {
+		f = (void *)cur;
+		if (cur->dev->dvb_type != DVB_DEVICE_DEMUX ||
+		    f->type != FILE_FILTER_PES || f->output != DMX_OUT_TS_TAP)
+			continue;
+		if (dvb_file_dmx_pid_ok(f, pid))
+			return 1;
+	}
+	return 0;
+}
+
+static ssize_t dvb_file_read(struct dvb_open_descriptor *open_dev,
+			     void *buf, size_t count)
+{
+	struct dvb_device_priv *dvb = open_dev->dvb;
+	struct dvb_v5_fe_parms_priv *parms = (void *)dvb->d.fe_parms;
+	struct dvb_dev_file_priv *priv = dvb->priv;
+	struct dvb_file_open *f = (void *)open_dev;
+
+	if (open_dev->dev->dvb_type == DVB_DEVICE_DVR)
+		return dvb_file_read_ts(priv, &f->reader, buf, count,
+					dvb_file_dvr_pid_ok, dvb);
+
+	if (open_dev->dev->dvb_type != DVB_DEVICE_DEMUX) {
+		dvb_logerr("Trying to read from an invalid device type on %s",
+			   open_dev->dev->sysname);
+		return -EINVAL;
+	}
+
+	switch (f->type) {
+	case FILE_FILTER_SECTION:
+		return dvb_file_read_section(priv, f, buf, count);
+	case FILE_FILTER_PES:
+		if (f->output == DMX_OUT_TSDEMUX_TAP)
+			return dvb_file_read_ts(priv, &f->reader, buf, count,
+						dvb_file_dmx_pid_ok, f);
+		/* fall through */
+	default:
+		/* Nothing would ever be read */
+		return -ETIMEDOUT;
+	}
+}
+
+static int dvb_file_dmx_set_pesfilter(struct dvb_open_descriptor *open_dev,
+				      int pid, dmx_pes_type_t type,
+				      dmx_output_t output, int bufsize)
+{
+	struct dvb_file_open *f = (void *)open_dev;
+
+	if (open_dev->dev->dvb_type != DVB_DEVICE_DEMUX)
+		return -EINVAL;
+	if (pid < 0 || pid > FILE_ALL_PIDS)
+		return -EINVAL;
+
+	f->type = FILE_FILTER_PES;
+	f->pid = pid;
+	f->output = output;
+	dvb_file_start(open_dev);
+
+	return 0;
+}
+
+static int dvb_file_dmx_set_section_filter(struct dvb_open_descriptor *open_dev,
+					   int pid, unsigned filtsize,
+					   unsigned char *filter,
+					   unsigned char *mask,
+					   unsigned char *mode,
+					   unsigned int flags)
+{
+	struct dvb_file_open *f = (void *)open_dev;
+
+	if (open_dev->dev->dvb_type != DVB_DEVICE_DEMUX)
+		return -EINVAL;
+	if (pid < 0 || pid >= FILE_ALL_PIDS)
+		return -EINVAL;
+
+	if (filtsize > DMX_FILTER_SIZE)
+		filtsize = DMX_FILTER_SIZE;
+
+	memset(f->filter, 0, sizeof(f->filter));
+	memset(f->mask, 0, sizeof(f->mask));
+	memset(f->mode, 0, sizeof(f->mode));
+	if (filter)
+		memcpy(f->filter, filter, filtsize);
+	if (mask)
+		memcpy(f->mask, mask, filtsize);
+	if (mode)
+		memcpy(f->mode, mode, filtsize);
+
+	f->type = FILE_FILTER_SECTION;
+	f->pid = pid;
+	f->filtsize = filtsize;
+	f->flags = flags;
+	dvb_file_start(open_dev);
+
+	return 0;
+}
+
+static int dvb_file_dmx_get_pmt_pid(struct dvb_open_descriptor *open_dev,
+				    int sid)
+{
+	struct dvb_dev_file_priv *priv = open_dev->dvb->priv;
+	struct dvb_file_open *f = (void *)open_dev;
+	unsigned char tid = DVB_TABLE_PAT, mask = 0xff;
+	uint8_t buf[DVB_MAX_PAYLOAD_PACKET_SIZE];
+	ssize_t len;
+	int i, ret;
+
+	ret = dvb_file_dmx_set_section_filter(open_dev, DVB_TABLE_PAT_PID, 1,
+					      &tid, &mask, NULL,
+					      DMX_CHECK_CRC);
+	if (ret < 0)
+		return ret;
+	len = dvb_file_read_section(priv, f, buf, sizeof(buf));
+	f->type = FILE_FILTER_NONE;
+	if (len < 0)
+		return len;
+
+	/* Assumes that one section contains the whole PAT */
+	for (i = 8; i + 4 <= len - DVB_CRC_SIZE; i += 4)
+		if (((buf[i] << 8) | buf[i + 1]) == sid)
+			return ((buf[i + 2] & 0x1f) << 8) | buf[i + 3];
+
+	return 0;
+}
+
+static struct dvb_v5_descriptors *dvb_file_scan(struct dvb_open_descriptor *open_dev,
+						struct dvb_entry *entry,
+						check_frontend_t *check_frontend,
+						void *args,
+						unsigned other_nit,
+						unsigned timeout_multiply)
+{
+	struct dvb_device_priv *dvb = open_dev->dvb;
+	struct dvb_v5_fe_parms_priv *parms = (void *)dvb->d.fe_parms;
+
+	if (open_dev->dev->dvb_type != DVB_DEVICE_DEMUX) {
+		dvb_logerr(_("dvb_dev_scan: expecting a demux descriptor"));
+		return NULL;
+	}
+
+	/* The tables are read by dvb_file_read_tables() */
+	return dvb_scan_transponder(dvb->d.fe_parms, entry, open_dev->fd,
+				    check_frontend, args, other_nit,
+				    timeout_multiply);
+}
+
+static void dvb_file_read_tables(struct dvb_device_priv *dvb,
+				 struct dvb_table_filter **sect, int *rc,
+				 unsigned num_sect)
+{
+	struct dvb_v5_fe_parms_priv *parms = (void *)dvb->d.fe_parms;
+	struct dvb_dev_file_priv *priv = dvb->priv;
+	struct dvb_file_reader *r = &priv->scan_reader;
+	struct dvb_ts_demux *dmx;
+	const uint8_t *pkt;
+	unsigned i;
+	int pending = 0;
+
+	for (i = 0; i < num_sect; i++)
+		rc[i] = -1;
+	if (!priv->rec)
+		return;
+
+	dmx = dvb_ts_demux_alloc(&parms->p);
+	if (!dmx)
+		return;
+	for (i = 0; i < num_sect; i++) {
+		rc[i] = dvb_ts_demux_add_filter(dmx, sect[i]);
+		if (!rc[i])
+			pending++;
+	}
+
+	dvb_file_reader_start(priv, r, priv->pos);
+	while (pending && !parms->p.abort) {
+		pkt = dvb_file_reader_packet(priv, r, 1);
+		if (!pkt)
+			break;
+		pending = dvb_ts_demux_parse(dmx, pkt, DVB_MPEG_TS_PACKET_SIZE);
+	}
+	priv->pos = dvb_file_reader_tell(r);
+	priv->total += r->lap;
+
+	if (parms->p.verbose)
+		dvb_log(_("%s: %d of %u tables read from %s, in %lld packets"),
+			__func__, num_sect - pending, num_sect, priv->rec->path,
+			(long long)r->lap / DVB_MPEG_TS_PACKET_SIZE);
+
+	for (i = 0; i < num_sect; i++) {
+		if (rc[i] < 0)
+			continue;
+		rc[i] = dvb_ts_demux_filter_status(dmx, sect[i]);
+		/* Not found in a whole loop of the recording */
+		if (!rc[i])
+			rc[i] = -1;
+	}
+	dvb_ts_demux_free(dmx);
+}
+
+/* Frontend functions */
+
+static int dvb_file_fe_set_sys(struct dvb_v5_fe_parms *p,
+			       fe_delivery_system_t sys)
+{
+	struct dvb_v5_fe_parms_priv *parms = (void *)p;
+	int rc;
+
+	rc = dvb_add_parms_for_sys(p, sys);
+	if (rc < 0)
+		return -EINVAL;
+
+	p->current_sys = sys;
+	parms->n_props = rc;
+
+	return 0;
+}
+
+static int dvb_file_fe_get_parms(struct dvb_v5_fe_parms *p)
+{
+	/* What was tuned is what was received */
+	return 0;
+}
+
+static int dvb_file_fe_set_parms(struct dvb_v5_fe_parms *p)
+{
+	struct dvb_v5_fe_parms_priv *parms = (void *)p;
+	struct dvb_device_priv *dvb = parms->dvb;
+	struct dvb_dev_file_priv *priv = dvb->priv;
+	struct dvb_open_descriptor *cur;
+	struct stat st;
+	uint32_t freq = 0;
+
+	if (priv->fd >= 0)
+		close(priv->fd);
+	priv->fd = -1;
+	priv->size = 0;
+	priv->pos = 0;
+
+	dvb_fe_retrieve_parm(p, DTV_FREQUENCY, &freq);
+	priv->rec = dvb_file_find_rec(priv, freq);
+	if (!priv->rec) {
+		if (p->verbose)
+			dvb_log(_("No recording for frequency %u"), freq);
+		return 0;
+	}
+
+	priv->fd = open(priv->rec->path, O_RDONLY);
+	if (priv->fd < 0 || fstat(priv->fd, &st) < 0) {
+		dvb_perror(priv->rec->path);
+		if (priv->fd >= 0)
+			close(priv->fd);
+		priv->fd = -1;
+		priv->rec = NULL;
+		return 0;
+	}
+	priv->size = st.st_size;
+	if (p->verbose)
+		dvb_log(_("Tuned to %s"), priv->rec->path);
+
+	/* The filters now get the data of the new recording */
+	for (cur = dvb->open_list.next; cur; cur = cur->next)
+		dvb_file_start(cur);
+
+	return 0;
+}
+
+static int dvb_file_fe_get_stats(struct dvb_v5_fe_parms *p)
+{
+	struct dvb_v5_fe_parms_priv *parms = (void *)p;
+	struct dvb_dev_file_priv *priv = parms->dvb->priv;
+	struct dtv_fe_stats *st = NULL;
+	fe_status_t status;
+	int i;
+
+	if (priv->rec)
+		status = FE_HAS_SIGNAL | FE_HAS_CARRIER | FE_HAS_VITERBI |
+			 FE_HAS_SYNC | FE_HAS_LOCK;
+	else
+		status = FE_TIMEDOUT;
+
+	for (i = 0; i < DTV_NUM_STATS_PROPS; i++)
+		if (parms->stats.prop[i].cmd == DTV_STATUS)
+			st = &parms->stats.prop[i].u.st;
+	if (!st)
+		return -EINVAL;
+
+	st->len = 1;
+	st->stat[0].scale = FE_SCALE_RELATIVE;
+	st->stat[0].uvalue = status;
+	parms->stats.prev_status = status;
+
+	return 0;
+}
+
+static void dvb_file_free_priv(struct dvb_dev_file_priv *priv)
+{
+	unsigned i;
+
+	if (priv->fd >= 0)
+		close(priv->fd);
+	for (i = 0; i < priv->num_recs; i++)
+		free(priv->recs[i].path);
+	free(priv->recs);
+	free(priv->dir);
+	free(priv);
+}
+
+static void dvb_dev_file_free(struct dvb_device_priv *dvb)
+{
+	dvb_file_free_priv(dvb->priv);
+}
+
+static int dvb_file_rec_cmp(const void *a, const void *b)
+{
+	const struct dvb_file_rec *ra = a, *rb = b;
+
+	return ra->freq < rb->freq ? -1 : ra->freq > rb->freq;
+}
+
+static int dvb_file_scan_dir(struct dvb_v5_fe_parms_priv *parms,
+			     struct dvb_dev_file_priv *priv)
+{
+	struct dvb_file_rec *recs;
+	struct dirent *de;
+	unsigned long freq;
+	char *end;
+	DIR *dir;
+	int ret;
+
+	dir = opendir(priv->dir);
+	if (!dir) {
+		ret = -errno;
+		dvb_logerr(_("Can't open %s: %s"), priv->dir, strerror(-ret));
+		return ret;
+	}
+
+	while ((de = readdir(dir))) {
+		freq = strtoul(de->d_name, &end, 10);
+		if (end == de->d_name || strcmp(end, ".ts") || freq > UINT32_MAX)
+			continue;
+
+		recs = realloc(priv->recs, sizeof(*recs) * (priv->num_recs + 1));
+		if (!recs) {
+			closedir(dir);
+			return -ENOMEM;
+		}
+		priv->recs = recs;
+		recs += priv->num_recs;
+		recs->freq = freq;
+		if (asprintf(&recs->path, "%s/%s", priv->dir, de->d_name) < 0) {
+			closedir(dir);
+			return -ENOMEM;
+		}
+		priv->num_recs++;
+	}
+	closedir(dir);
+
+	if (!priv->num_recs) {
+		dvb_logerr(_("No recordings named after their frequencies, like 474000000.ts, at %s"),
+			   priv->dir);
+		return -ENOENT;
+	}
+	qsort(priv->recs, priv->num_recs, sizeof(*priv->recs),
+	      dvb_file_rec_cmp);
+
+	if (parms->p.verbose)
+		dvb_log(_("%u recordings at %s"), priv->num_recs, priv->dir);
+
+	return 0;
+}
+
+int dvb_dev_file_init(struct dvb_device *d, const char *dir)
+{
+	struct dvb_device_priv *dvb = (void *)d;
+	struct dvb_v5_fe_parms_priv *parms = (void *)dvb->d.fe_parms;
+	struct dvb_dev_ops *ops = &dvb->ops;
+	struct dvb_dev_file_priv *priv;
+	int ret;
+
+	priv = calloc(1, sizeof(*priv));
+	if (!priv)
+		return -ENOMEM;
+	priv->fd = -1;
+	priv->dir = strdup(dir);
+	if (!priv->dir) {
+		free(priv);
+		return -ENOMEM;
+	}
+
+	ret = dvb_file_scan_dir(parms, priv);
+	if (ret < 0) {
+		dvb_file_free_priv(priv);
+		return ret;
+	}
+
+	/* Call an implementation-specific free method, if defined */
+	if (ops->free)
+		ops->free(dvb);
+	if (dvb->d.num_devices)
+		dvb_dev_free_devices(dvb);
+
+	dvb->priv = priv;
+	memset(ops, 0, sizeof(*ops));
+
+	ops->find = dvb_file_find;
+	ops->seek_by_adapter = dvb_local_seek_by_adapter;
+	ops->get_dev_info = dvb_local_get_dev_info;
+	ops->open = dvb_file_open;
+	ops->close = dvb_file_close;
+
+	ops->dmx_stop = dvb_file_dmx_stop;
+	ops->set_bufsize = dvb_file_set_bufsize;
+	ops->read = dvb_file_read;
+	ops->dmx_set_pesfilter = dvb_file_dmx_set_pesfilter;
+	ops->dmx_set_section_filter = dvb_file_dmx_set_section_filter;
+	ops->dmx_get_pmt_pid = dvb_file_dmx_get_pmt_pid;
+
+	ops->scan = dvb_file_scan;
+	ops->read_tables = dvb_file_read_tables;
+
+	ops->fe_set_sys = dvb_file_fe_set_sys;
+	ops->fe_get_parms = dvb_file_fe_get_parms;
+	ops->fe_set_parms = dvb_file_fe_set_parms;
+	ops->fe_get_stats = dvb_file_fe_get_stats;
+
+	ops->free = dvb_dev_file_free;
+
+	return 0;
+}
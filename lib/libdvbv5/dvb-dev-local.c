@@ -26,6 +26,8 @@
 #include <locale.h>
 #include <unistd.h>
 #include <string.h>
+#include <poll.h>
+#include <sys/mman.h>
 
 #include <config.h>
 
@@ -58,6 +60,7 @@ struct dvb_dev_local_priv {
 
 #ifdef HAVE_PTHREAD
 	pthread_t dev_change_id;
+	int monitor_thread;
 #endif
 
 	/* udev control fields */
@@ -83,38 +86,34 @@ static int handle_device_change(struct dvb_device_priv *dvb,
 	char *buf;
 	int i, ret;
 
-	/* remove, change, move should all remove the device first */
-	if (!strcmp(action,"add")) {
-		type = DVB_DEV_ADD;
-	} else {
-		sysname = udev_device_get_sysname(dev);
-		if (!sysname) {
-			dvb_logerr(_("udev_device_get_sysname failed"));
-			return -ENODEV;
-		}
+	sysname = udev_device_get_sysname(dev);
+	if (!sysname) {
+		dvb_logerr(_("udev_device_get_sysname failed"));
+		return -ENODEV;
+	}
 
-		for (i = 0; i < dvb->d.num_devices; i++) {
-			if (!strcmp(sysname, dvb->d.devices[i].sysname)) {
-				memmove(&dvb->d.devices[i],
-					&dvb->d.devices[i + 1],
-					sizeof(*dvb->d.devices) * (dvb->d.num_devices - i));
-				dvb->d.num_devices--;
-
-				if (!dvb->d.num_devices) {
-					free(dvb->d.devices);
-					dvb->d.devices = NULL;
-				} else {
-					p = realloc(dvb->d.devices,
-						sizeof(*dvb->d.devices) * dvb->d.num_devices);
-					if (!p) {
-						dvb_logerr(_("Can't remove a device from the list of DVB devices"));
-						return -ENODEV;
-					}
-				}
-				break;
-			}
+	/*
+	 * remove, change, move should all remove the device first, as well
+	 * as an add of a device that is already there, as an event may
+	 * arrive while the devices are enumerated
+	 */
+	dvb_dev = dvb_dev_lookup(dvb, sysname);
+	if (dvb_dev) {
+		i = dvb_dev - dvb->d.devices;
+		free_dvb_dev(dvb_dev);
+		memmove(&dvb->d.devices[i], &dvb->d.devices[i + 1],
+			sizeof(*dvb->d.devices) * (dvb->d.num_devices - i - 1));
+		dvb->d.num_devices--;
+		if (!dvb->d.num_devices) {
+			free(dvb->d.devices);
+			dvb->d.devices = NULL;
 		}
+		dvb_dev_index_invalidate(dvb);
+	}
 
+	if (!strcmp(action,"add")) {
+		type = DVB_DEV_ADD;
+	} else {
 		/* Return, if the device was removed */
 		if (!strcmp(action,"remove")) {
 			if (priv->notify_dev_change)
@@ -202,6 +201,7 @@ static int handle_device_change(struct dvb_device_priv *dvb,
 	dvb->d.devices = dvb_dev;
 	dvb->d.devices[dvb->d.num_devices - 1] = dev_list;
 	dvb_dev = &dvb->d.devices[dvb->d.num_devices - 1];
+	dvb_dev_index_invalidate(dvb);
 
 	/* Get optional per-bus fields associated with the device parent */
 	if (!strcmp(bus_type, "pci")) {
@@ -256,38 +256,64 @@ err:
 	return -ENODEV;
 }
 
+static int dvb_local_monitor_handle(struct dvb_device_priv *dvb)
+{
+	struct dvb_dev_local_priv *priv = dvb->priv;
+	struct udev_device *dev;
+	const char *action;
+	int n = 0;
+
+	if (!priv->mon)
+		return -EINVAL;
+
+	/* The netlink socket is non-blocking: handle all pending events */
+	while ((dev = udev_monitor_receive_device(priv->mon))) {
+		action = udev_device_get_action(dev);
+		if (action)
+			handle_device_change(dvb, dev, NULL, action);
+		udev_device_unref(dev);
+		n++;
+	}
+
+	return n;
+}
+
 #ifdef HAVE_PTHREAD
 static void *monitor_device_changes(void *privdata)
 {
 	struct dvb_device_priv *dvb = privdata;
 	struct dvb_dev_local_priv *priv = dvb->priv;
-	struct udev_device *dev;
-
-	while (1) {
-		fd_set fds;
-		struct timeval tv;
-		int ret;
+	struct pollfd pfd;
+	int state;
 
-		FD_ZERO(&fds);
-		FD_SET(priv->udev_fd, &fds);
-		tv.tv_sec = 1;
-		tv.tv_usec = 0;
+	pfd.fd = priv->udev_fd;
+	pfd.events = POLLIN;
 
-		ret = select(priv->udev_fd + 1, &fds, NULL, NULL, &tv);
+	while (1) {
+		/* Sleeps until there's an event, and can be cancelled there */
+		if (poll(&pfd, 1, -1) <= 0)
+			continue;
 
-		/* Check if our file descriptor has received data. */
-		if (ret > 0 && FD_ISSET(priv->udev_fd, &fds)) {
-			dev = udev_monitor_receive_device(priv->mon);
-			if (dev) {
-				const char *action = udev_device_get_action(dev);
-				handle_device_change(dvb, dev, NULL, action);
-			}
-		}
+		/* Don't leave the list of devices half updated */
+		pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, &state);
+		dvb_local_monitor_handle(dvb);
+		pthread_setcancelstate(state, NULL);
 	}
 	return NULL;
 }
+
+static void dvb_local_stop_thread(struct dvb_dev_local_priv *priv)
+{
+	if (!priv->monitor_thread)
+		return;
+	pthread_cancel(priv->dev_change_id);
+	pthread_join(priv->dev_change_id, NULL);
+	priv->monitor_thread = 0;
+}
 #endif
 
+static int dvb_local_stop_monitor(struct dvb_device_priv *dvb);
+
 static int dvb_local_find(struct dvb_device_priv *dvb,
 			  dvb_dev_change_t handler, void *user_priv)
 {
@@ -297,7 +323,8 @@ static int dvb_local_find(struct dvb_device_priv *dvb,
 	struct udev_list_entry *devices, *dev_list_entry;
 	struct udev_device *dev;
 
-	/* Free a previous list of devices */
+	/* Free a previous list of devices, and stop its monitor */
+	dvb_local_stop_monitor(dvb);
 	if (dvb->d.num_devices)
 		dvb_dev_free_devices(dvb);
 
@@ -349,10 +376,12 @@ static int dvb_local_find(struct dvb_device_priv *dvb,
 
 		ret = pthread_create(&priv->dev_change_id, NULL,
 				     monitor_device_changes, dvb);
-		if (ret < 0) {
+		if (ret) {
+			errno = ret;
 			dvb_perror("pthread_create");
 			return -1;
 		}
+		priv->monitor_thread = 1;
 	}
 #endif
 	if (!priv->notify_dev_change) {
@@ -365,45 +394,59 @@ static int dvb_local_find(struct dvb_device_priv *dvb,
 
 static int dvb_local_stop_monitor(struct dvb_device_priv *dvb)
 {
-#ifdef HAVE_PTHREAD
 	struct dvb_dev_local_priv *priv = dvb->priv;
 
-	if (priv->notify_dev_change) {
-		pthread_cancel(priv->dev_change_id);
+#ifdef HAVE_PTHREAD
+	dvb_local_stop_thread(priv);
+#endif
+	if (priv->mon) {
+		udev_monitor_unref(priv->mon);
+		priv->mon = NULL;
+	}
+	if (priv->udev) {
 		udev_unref(priv->udev);
+		priv->udev = NULL;
 	}
-#endif
+	priv->notify_dev_change = NULL;
 
 	return 0;
 }
 
+static int dvb_local_monitor_get_fd(struct dvb_device_priv *dvb)
+{
+	struct dvb_dev_local_priv *priv = dvb->priv;
+
+	if (!priv->mon)
+		return -EINVAL;
+
+	/* From now on, the caller handles the events */
+#ifdef HAVE_PTHREAD
+	dvb_local_stop_thread(priv);
+#endif
+
+	return priv->udev_fd;
+}
+
 struct dvb_dev_list *dvb_local_seek_by_adapter(struct dvb_device_priv *dvb,
 					       unsigned int adapter,
 					       unsigned int num,
 					       enum dvb_dev_type type)
 {
 	struct dvb_v5_fe_parms_priv *parms = (void *)dvb->d.fe_parms;
-	int ret, i;
-	char *p;
+	struct dvb_dev_list *dev;
+	char p[64];
 
-	if (type > dev_type_names_size){
+	if (type >= dev_type_names_size){
 		dvb_logerr(_("Unexpected device type found!"));
 		return NULL;
 	}
 
-	ret = asprintf(&p, "dvb%d.%s%d", adapter, dev_type_names[type], num);
-	if (ret < 0) {
-		dvb_logerr(_("error %d when seeking for device's filename"),
-			   errno);
-		return NULL;
-	}
-	for (i = 0; i < dvb->d.num_devices; i++) {
-		if (!strcmp(p, dvb->d.devices[i].sysname)) {
-			free(p);
-			dvb_dev_dump_device(_("Selected dvb %s device: %s"),
-					    parms, &dvb->d.devices[i]);
-			return &dvb->d.devices[i];
-		}
+	snprintf(p, sizeof(p), "dvb%u.%s%u", adapter, dev_type_names[type], num);
+	dev = dvb_dev_lookup(dvb, p);
+	if (dev) {
+		dvb_dev_dump_device(_("Selected dvb %s device: %s"),
+				    parms, dev);
+		return dev;
 	}
 
 	dvb_logwarn(_("device %s not found"), p);
@@ -414,18 +457,16 @@ struct dvb_dev_list *dvb_local_get_dev_info(struct dvb_device_priv *dvb,
 					    const char *sysname)
 {
 	struct dvb_v5_fe_parms_priv *parms = (void *)dvb->d.fe_parms;
-	int i;
+	struct dvb_dev_list *dev;
 
 	if (!sysname) {
 		dvb_logerr(_("Device not specified"));
 		return NULL;
 	}
 
-	for (i = 0; i < dvb->d.num_devices; i++) {
-		if (!strcmp(sysname, dvb->d.devices[i].sysname)) {
-			return &dvb->d.devices[i];
-		}
-	}
+	dev = dvb_dev_lookup(dvb, sysname);
+	if (dev)
+		return dev;
 
 	dvb_logerr(_("Can't find device %s"), sysname);
 	return NULL;
@@ -497,6 +538,8 @@ static struct dvb_open_descriptor
 	return open_dev;
 }
 
+static void dvb_local_mmap_free(struct dvb_open_descriptor *open_dev);
+
 static int dvb_local_close(struct dvb_open_descriptor *open_dev)
 {
 	struct dvb_dev_list *dev = open_dev->dev;
@@ -510,6 +553,7 @@ static int dvb_local_close(struct dvb_open_descriptor *open_dev)
 		if (dev->dvb_type == DVB_DEVICE_DEMUX)
 			dvb_dev_dmx_stop(open_dev);
 
+		dvb_local_mmap_free(open_dev);
 		close(open_dev->fd);
 	}
 
@@ -633,6 +677,156 @@ static ssize_t dvb_local_read(struct dvb_open_descriptor *open_dev,
 	return ret;
 }
 
+static void dvb_local_mmap_free(struct dvb_open_descriptor *open_dev)
+{
+	struct dvb_dev_mmap *mm = open_dev->mmap;
+	struct dmx_requestbuffers req;
+	unsigned int i;
+
+	if (!mm)
+		return;
+
+	for (i = 0; i < mm->count; i++)
+		munmap(mm->buf[i].start, mm->buf[i].length);
+
+	/* Release the Kernel buffers */
+	memset(&req, 0, sizeof(req));
+	xioctl(open_dev->fd, DMX_REQBUFS, &req);
+
+	free(mm);
+	open_dev->mmap = NULL;
+}
+
+static int dvb_local_mmap_setup(struct dvb_open_descriptor *open_dev,
+				unsigned int count, unsigned int size)
+{
+	struct dvb_dev_list *dev = open_dev->dev;
+	struct dvb_device_priv *dvb = open_dev->dvb;
+	struct dvb_v5_fe_parms_priv *parms = (void *)dvb->d.fe_parms;
+	struct dmx_requestbuffers req;
+	struct dmx_buffer buf;
+	struct dvb_dev_mmap *mm;
+	int ret, fd = open_dev->fd;
+	unsigned int i;
+
+	if (dev->dvb_type != DVB_DEVICE_DEMUX && dev->dvb_type != DVB_DEVICE_DVR)
+		return -EINVAL;
+
+	if (open_dev->mmap)
+		return -EBUSY;
+
+	if (count > DVB_DEV_MAX_MMAP_BUFS)
+		count = DVB_DEV_MAX_MMAP_BUFS;
+
+	mm = calloc(1, sizeof(*mm));
+	if (!mm)
+		return -ENOMEM;
+	open_dev->mmap = mm;
+
+	memset(&req, 0, sizeof(req));
+	req.count = count;
+	req.size = size;
+	if (xioctl(fd, DMX_REQBUFS, &req) == -1) {
+		ret = -errno;
+		/* Older Kernels don't support it: not an error worth to log */
+		if (errno != ENOTTY)
+			dvb_perror("DMX_REQBUFS failed");
+		free(mm);
+		open_dev->mmap = NULL;
+		return ret;
+	}
+	if (req.count > DVB_DEV_MAX_MMAP_BUFS)
+		req.count = DVB_DEV_MAX_MMAP_BUFS;
+
+	for (i = 0; i < req.count; i++) {
+		memset(&buf, 0, sizeof(buf));
+		buf.index = i;
+		if (xioctl(fd, DMX_QUERYBUF, &buf) == -1) {
+			ret = -errno;
+			dvb_perror("DMX_QUERYBUF failed");
+			goto error;
+		}
+
+		mm->buf[i].length = buf.length;
+		mm->buf[i].start = mmap(NULL, buf.length, PROT_READ | PROT_WRITE,
+					MAP_SHARED, fd, buf.offset);
+		if (mm->buf[i].start == MAP_FAILED) {
+			ret = -errno;
+			dvb_perror("mmap failed");
+			goto error;
+		}
+		mm->count++;
+
+		if (xioctl(fd, DMX_QBUF, &buf) == -1) {
+			ret = -errno;
+			dvb_perror("DMX_QBUF failed");
+			goto error;
+		}
+		mm->queued |= 1 << i;
+	}
+
+	return mm->count;
+
+error:
+	dvb_local_mmap_free(open_dev);
+	return ret;
+}
+
+static ssize_t dvb_local_mmap_dequeue(struct dvb_open_descriptor *open_dev,
+				      void **data, int *index, uint32_t *flags)
+{
+	struct dvb_device_priv *dvb = open_dev->dvb;
+	struct dvb_v5_fe_parms_priv *parms = (void *)dvb->d.fe_parms;
+	struct dvb_dev_mmap *mm = open_dev->mmap;
+	struct dmx_buffer buf;
+
+	if (!mm)
+		return -EINVAL;
+
+	memset(&buf, 0, sizeof(buf));
+	if (xioctl(open_dev->fd, DMX_DQBUF, &buf) == -1) {
+		if (errno != EOVERFLOW && errno != EAGAIN)
+			dvb_perror("DMX_DQBUF failed");
+		return -errno;
+	}
+	if (buf.index >= mm->count) {
+		dvb_logerr("DMX_DQBUF returned an invalid buffer index %d",
+			   buf.index);
+		return -EINVAL;
+	}
+
+	mm->queued &= ~(1 << buf.index);
+	*data = mm->buf[buf.index].start;
+	*index = buf.index;
+	if (flags)
+		*flags = buf.flags;
+
+	return buf.bytesused;
+}
+
+static int dvb_local_mmap_queue(struct dvb_open_descriptor *open_dev,
+				int index)
+{
+	struct dvb_device_priv *dvb = open_dev->dvb;
+	struct dvb_v5_fe_parms_priv *parms = (void *)dvb->d.fe_parms;
+	struct dvb_dev_mmap *mm = open_dev->mmap;
+	struct dmx_buffer buf;
+
+	if (!mm || index < 0 || index >= (int)mm->count ||
+	    (mm->queued & (1 << index)))
+		return -EINVAL;
+
+	memset(&buf, 0, sizeof(buf));
+	buf.index = index;
+	if (xioctl(open_dev->fd, DMX_QBUF, &buf) == -1) {
+		dvb_perror("DMX_QBUF failed");
+		return -errno;
+	}
+	mm->queued |= 1 << index;
+
+	return 0;
+}
+
 static int dvb_local_dmx_set_pesfilter(struct dvb_open_descriptor *open_dev,
 			      int pid, dmx_pes_type_t type,
 			      dmx_output_t output, int bufsize)
@@ -840,6 +1034,8 @@ void dvb_dev_local_init(struct dvb_device_priv *dvb)
 	ops->seek_by_adapter = dvb_local_seek_by_adapter;
 	ops->get_dev_info = dvb_local_get_dev_info;
 	ops->stop_monitor = dvb_local_stop_monitor;
+	ops->monitor_get_fd = dvb_local_monitor_get_fd;
+	ops->monitor_handle = dvb_local_monitor_handle;
 	ops->open = dvb_local_open;
 	ops->close = dvb_local_close;
 	ops->get_fd = dvb_local_get_fd;
@@ -847,6 +1043,10 @@ void dvb_dev_local_init(struct dvb_device_priv *dvb)
 	ops->dmx_stop = dvb_local_dmx_stop;
 	ops->set_bufsize = dvb_local_set_bufsize;
 	ops->read = dvb_local_read;
+	ops->mmap_setup = dvb_local_mmap_setup;
+	ops->mmap_dequeue = dvb_local_mmap_dequeue;
+	ops->mmap_queue = dvb_local_mmap_queue;
+	ops->mmap_free = dvb_local_mmap_free;
 	ops->dmx_set_pesfilter = dvb_local_dmx_set_pesfilter;
 	ops->dmx_set_section_filter = dvb_local_dmx_set_section_filter;
 	ops->dmx_get_pmt_pid = dvb_local_dmx_get_pmt_pid;
@@ -23,12 +23,26 @@
 #include <libdvbv5/dvb-dev.h>
 
 struct dvb_device_priv;
+struct dvb_table_filter;
+
+#define DVB_DEV_MAX_MMAP_BUFS	32	/* bitmask at struct dvb_dev_mmap */
+
+/* Buffers set by dvb_dev_mmap_setup() */
+struct dvb_dev_mmap {
+	unsigned int count;
+	uint32_t queued;	/* 1 bit per buffer */
+	struct {
+		void *start;
+		size_t length;
+	} buf[DVB_DEV_MAX_MMAP_BUFS];
+};
 
 struct dvb_open_descriptor {
 	int fd;
 	struct dvb_dev_list *dev;
 	struct dvb_device_priv *dvb;
 	struct dvb_open_descriptor *next;
+	struct dvb_dev_mmap *mmap;
 };
 
 struct dvb_dev_ops {
@@ -41,6 +55,8 @@ struct dvb_dev_ops {
 	struct dvb_dev_list * (*get_dev_info)(struct dvb_device_priv *dvb,
 					      const char *sysname);
 	int (*stop_monitor)(struct dvb_device_priv *dvb);
+	int (*monitor_get_fd)(struct dvb_device_priv *dvb);
+	int (*monitor_handle)(struct dvb_device_priv *dvb);
 	struct dvb_open_descriptor *(*open)(struct dvb_device_priv *dvb,
 					    const char *sysname, int flags);
 	int (*close)(struct dvb_open_descriptor *open_dev);
@@ -49,6 +65,12 @@ struct dvb_dev_ops {
 			   int buffersize);
 	ssize_t (*read)(struct dvb_open_descriptor *open_dev,
 			void *buf, size_t count);
+	int (*mmap_setup)(struct dvb_open_descriptor *open_dev,
+			  unsigned int count, unsigned int size);
+	ssize_t (*mmap_dequeue)(struct dvb_open_descriptor *open_dev,
+				void **data, int *index, uint32_t *flags);
+	int (*mmap_queue)(struct dvb_open_descriptor *open_dev, int index);
+	void (*mmap_free)(struct dvb_open_descriptor *open_dev);
 	int (*dmx_set_pesfilter)(struct dvb_open_descriptor *open_dev,
 				 int pid, dmx_pes_type_t type,
 				 dmx_output_t output, int bufsize);
@@ -66,6 +88,15 @@ struct dvb_dev_ops {
 					   unsigned other_nit,
 					   unsigned timeout_multiply);
 
+	/*
+	 * Reads several tables at once, for the devices without a Kernel
+	 * demux, instead of dvb_get_ts_tables() setting a section filter
+	 * for each one. rc gets the same return codes as dvb_read_sections().
+	 */
+	void (*read_tables)(struct dvb_device_priv *dvb,
+			    struct dvb_table_filter **sect, int *rc,
+			    unsigned num_sect);
+
 	int (*fe_set_sys)(struct dvb_v5_fe_parms *p, fe_delivery_system_t sys);
 	int (*fe_get_parms)(struct dvb_v5_fe_parms *p);
 	int (*fe_set_parms)(struct dvb_v5_fe_parms *p);
@@ -75,11 +106,132 @@ struct dvb_dev_ops {
 	int (*get_fd)(struct dvb_open_descriptor *dvb);
 };
 
+/*
+ * Ring shared by dvbv5-daemon with its local clients, at the start of a
+ * memfd passed over the Unix socket together with an eventfd. The daemon
+ * reads the demux/dvr data straight into it, and the client copies it from
+ * there, instead of getting it via data_read messages.
+ *
+ * read and write are free-running byte counters, each one written only by
+ * one side. The data starts at data_offset. When the client waits for
+ * data, it sets waiting, and the daemon writes to the eventfd after adding
+ * data. rc is a pending error, like -EOVERFLOW, cleared by the client.
+ */
+#define DVB_SHM_RING_MAGIC	0x44564252	/* "DVBR" */
+#define DVB_SHM_RING_CACHELINE	64
+
+struct dvb_shm_ring {
+	uint32_t magic;
+	uint32_t data_offset;
+	uint64_t size;
+	int32_t rc;
+	int32_t waiting;
+
+	uint64_t write __attribute__((aligned(DVB_SHM_RING_CACHELINE)));
+	uint64_t read __attribute__((aligned(DVB_SHM_RING_CACHELINE)));
+};
+
+/*
+ * Binary messages of the remote protocol, since version 5.
+ *
+ * Their length word has REMOTE_BIN_MSG set. They start with a
+ * struct remote_bin_hdr, followed by a fixed layout payload, specific
+ * for the opcode. All fields are big endian. The daemon dispatches them
+ * by indexing a table with the opcode, instead of looking for the
+ * command name, and the payload is copied instead of parsed field by
+ * field. Their responses use the same header, with the request's seq and
+ * opcode. Messages pushed by the daemon, not answering any request, have
+ * seq 0.
+ */
+#define REMOTE_BIN_MSG		0x80000000
+
+enum remote_opcode {
+	REMOTE_OP_NONE = 0,
+	REMOTE_OP_FE_GET_STATS,
+	REMOTE_OP_FE_STATS_SUBSCRIBE,
+	REMOTE_OP_FE_STATS_EVENT,
+	REMOTE_OP_MAX,
+};
+
+struct remote_bin_hdr {
+	uint32_t seq;
+	uint16_t opcode;
+	uint16_t reserved;
+	int32_t retval;
+} __attribute__((packed));
+
+/* Response payload for REMOTE_OP_FE_GET_STATS */
+struct remote_bin_counters {
+	uint64_t pre_bit_count;
+	uint64_t pre_bit_error;
+	uint64_t post_bit_count;
+	uint64_t post_bit_error;
+	uint64_t block_count;
+	uint64_t block_error;
+} __attribute__((packed));
+
+struct remote_bin_stats_prop {
+	uint32_t cmd;
+	uint32_t len;
+	struct {
+		uint8_t scale;
+		uint64_t value;
+	} __attribute__((packed)) stat[MAX_DTV_STATS];
+} __attribute__((packed));
+
+struct remote_bin_stats_layer {
+	uint32_t has_post_ber;
+	uint32_t has_pre_ber;
+	uint32_t has_per;
+	struct remote_bin_counters prev;
+	struct remote_bin_counters cur;
+} __attribute__((packed));
+
+struct remote_bin_stats {
+	uint32_t prev_status;
+	struct remote_bin_stats_prop prop[DTV_NUM_STATS_PROPS];
+	struct remote_bin_stats_layer layer[MAX_DTV_STATS];
+} __attribute__((packed));
+
+/*
+ * REMOTE_OP_FE_STATS_SUBSCRIBE takes a struct remote_bin_subscribe, and
+ * its response has the current struct remote_bin_stats. Then, the daemon
+ * samples the stats every interval_ms, and pushes a REMOTE_OP_FE_STATS_EVENT
+ * when they change. Its payload is a struct remote_bin_stats_delta,
+ * followed by the changed props, and then by the changed layers, in
+ * ascending order. A zero interval_ms cancels the subscription.
+ */
+struct remote_bin_subscribe {
+	uint32_t interval_ms;
+} __attribute__((packed));
+
+struct remote_bin_stats_delta {
+	uint32_t prev_status;
+	uint32_t prop_mask;	/* bit n: prop[n] follows */
+	uint32_t layer_mask;	/* bit n: layer[n] follows */
+} __attribute__((packed));
+
+/*
+ * Index of d.devices by sysname: an open addressing hash table with the
+ * position of each device, plus one, or zero for the empty slots. It is
+ * rebuilt by the first lookup after the list changes.
+ */
+struct dvb_dev_index {
+	unsigned int *slot;
+	unsigned int size;		/* power of two */
+
+	/* The list it was built for */
+	int valid;
+	struct dvb_dev_list *devices;
+	int num_devices;
+};
+
 struct dvb_device_priv {
 	struct dvb_device d;
 	struct dvb_dev_ops ops;
 
 	struct dvb_open_descriptor open_list;
+	struct dvb_dev_index index;
 
 	/* private data to be used by implementation, if needed */
 	void *priv;
@@ -94,8 +246,23 @@ void dvb_dev_dump_device(char *msg,
 			struct dvb_dev_list *dev);
 void free_dvb_dev(struct dvb_dev_list *dvb_dev);
 void dvb_dev_free_devices(struct dvb_device_priv *dvb);
+struct dvb_dev_list *dvb_dev_lookup(struct dvb_device_priv *dvb,
+				    const char *sysname);
+
+/* Should be called after changing d.devices */
+static inline void dvb_dev_index_invalidate(struct dvb_device_priv *dvb)
+{
+	dvb->index.valid = 0;
+}
 
 /* From dvb-dev-local.c */
 void dvb_dev_local_init(struct dvb_device_priv *dvb);
+int dvb_local_fe_set_parms(struct dvb_v5_fe_parms *p);
+struct dvb_dev_list *dvb_local_seek_by_adapter(struct dvb_device_priv *dvb,
+					       unsigned int adapter,
+					       unsigned int num,
+					       enum dvb_dev_type type);
+struct dvb_dev_list *dvb_local_get_dev_info(struct dvb_device_priv *dvb,
+					    const char *sysname);
 
 #endif
@@ -34,11 +34,16 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <locale.h>
+#include <poll.h>
 #include <pthread.h>
 #include <unistd.h>
 #include <resolv.h>
 #include <string.h>
+#include <strings.h>
+#include <sys/mman.h>
 #include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
 
 #include "dvb-fe-priv.h"
 #include "dvb-dev-priv.h"
@@ -66,7 +71,35 @@ const char *daemon_version = "dvbv5-daemon version " V4L_UTILS_VERSION;
  * Internal data structures
  */
 
-#define RINGBUF_SIZE (REMOTE_BUF_SIZE * 32)
+#define RINGBUF_CHUNKS 32
+#define RINGBUF_SIZE (REMOTE_BUF_SIZE * RINGBUF_CHUNKS)
+#define RINGBUF_CACHELINE 64
+
+/* Size of the receive buffer: the largest data chunk, plus its header */
+#define RECV_BUF_SIZE (REMOTE_MAX_BUF_SIZE + 64)
+
+/* Receive buffer of the data channel socket: a few of the largest chunks */
+#define DATA_SOCKET_BUF_SIZE (4 * REMOTE_MAX_BUF_SIZE)
+
+/*
+ * Single producer (receive_data), single consumer (dvb_remote_read) ring.
+ *
+ * read and write are free-running byte counters, each one only written by
+ * its owner, and accessed with atomics by the other side. They're on
+ * separate cache lines to avoid false sharing. The lock/cond pair is only
+ * used when the consumer has to sleep, waiting for data.
+ *
+ * The data area is replaced by a larger one after a transfer unit
+ * negotiation. The new one is stored at pending, and the producer switches
+ * to it once the ring is empty.
+ *
+ * For a DVR device of a local daemon, the data comes instead from a ring
+ * shared with the daemon (shm), and the consumer sleeps at its eventfd.
+ */
+struct ringbuffer_data {
+	size_t size;
+	char buf[] __attribute__((aligned(RINGBUF_CACHELINE)));
+};
 
 struct ringbuffer {
 	/* Should be the first member of struct */
@@ -74,14 +107,24 @@ struct ringbuffer {
 
 	/* ringbuffer handling */
 	int rc;
-	ssize_t read, write;
-	char buf[RINGBUF_SIZE];
+	int waiting;		/* consumer is sleeping at cond */
 	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	struct ringbuffer_data *pending;
+
+	struct dvb_shm_ring *shm;
+	size_t shm_len;
+	int shm_efd;
+
+	size_t write __attribute__((aligned(RINGBUF_CACHELINE)));
+	struct ringbuffer_data *data;
+	size_t read __attribute__((aligned(RINGBUF_CACHELINE)));
 };
 
 struct queued_msg {
 	int seq;
 	char cmd[80];
+	int opcode;		/* for binary messages */
 	int retval;
 
 	pthread_mutex_t lock;
@@ -90,14 +133,31 @@ struct queued_msg {
 	char args[REMOTE_BUF_SIZE];
 	ssize_t args_size;
 
+	/* File descriptors passed along with the response */
+	int fds[2];
+	int nfds;
+
 	struct queued_msg *next;
 };
 
 struct dvb_dev_remote_priv {
 	int fd;
-	struct sockaddr_in addr;
+	struct sockaddr_storage addr;
+	socklen_t addrlen;
+	int is_local;		/* connected via a Unix socket */
 
 	int seq, disconnected;
+	int proto;		/* negotiated protocol version */
+	char *recv_buf;
+
+	/*
+	 * Since protocol version 3, a second connection carries the
+	 * data_read messages, keeping the control one free for the
+	 * command responses.
+	 */
+	int data_fd;
+	char *data_recv_buf;
+	pthread_t data_recv_id;
 
 	dvb_dev_change_t notify_dev_change;
 
@@ -109,6 +169,11 @@ struct dvb_dev_remote_priv {
 
 	struct queued_msg msgs;
 
+	/* Last frontend stats pushed by the daemon, if subscribed */
+	pthread_mutex_t stats_lock;
+	int stats_subscribed;
+	struct remote_bin_stats stats;
+
 	/* private user data, used by event notifier*/
 	void *user_priv;
 };
@@ -403,6 +468,81 @@ static struct queued_msg *send_buf(struct dvb_device_priv *dvb, int fd,
 	return msg;
 }
 
+/*
+ * Sends a binary message. cmd is just the method name, used for the
+ * queued message and its logs.
+ */
+static struct queued_msg *send_bin(struct dvb_device_priv *dvb, int fd,
+				   enum remote_opcode opcode, const char *cmd,
+				   const void *in_buf, const size_t in_size)
+{
+	struct dvb_v5_fe_parms_priv *parms = (void *)dvb->d.fe_parms;
+	struct dvb_dev_remote_priv *priv = dvb->priv;
+	struct queued_msg *msg, *msgs;
+	char buf[REMOTE_BUF_SIZE];
+	struct remote_bin_hdr *hdr = (void *)buf;
+	size_t size = sizeof(*hdr) + in_size;
+	int ret, err;
+	int32_t i32;
+
+	if (size > sizeof(buf)) {
+		dvb_logdbg("buffer to big!");
+		stack_dump(parms);
+		return NULL;
+	}
+
+	msg = calloc(1, sizeof(*msg));
+	if (!msg) {
+		dvb_logerr("calloc queued_msg");
+		stack_dump(parms);
+		return NULL;
+	}
+
+	pthread_mutex_init(&msg->lock, NULL);
+	pthread_cond_init(&msg->cond, NULL);
+	strcpy(msg->cmd, cmd);
+	msg->opcode = opcode;
+
+	pthread_mutex_lock(&priv->lock_io);
+	msg->seq = ++priv->seq;
+
+	hdr->seq = htobe32(msg->seq);
+	hdr->opcode = htobe16(opcode);
+	hdr->reserved = 0;
+	hdr->retval = 0;
+	if (in_size)
+		memcpy(buf + sizeof(*hdr), in_buf, in_size);
+
+	pthread_mutex_lock(&msg->lock);
+	i32 = htobe32(size | REMOTE_BIN_MSG);
+	ret = send(fd, (void *)&i32, 4, MSG_MORE);
+	if (ret != 4) {
+		err = 1;
+	} else {
+		err = 0;
+		ret = write(fd, buf, size);
+	}
+	if (ret < 0 || (ret < size) || err) {
+		pthread_mutex_unlock(&msg->lock);
+		pthread_mutex_destroy(&msg->lock);
+		pthread_cond_destroy(&msg->cond);
+		free(msg);
+		msg = NULL;
+		if (ret < 0)
+			dvb_perror("write");
+		else
+			dvb_logerr("incomplete send");
+		stack_dump(parms);
+	} else {
+		/* Add it to the message queue */
+		for (msgs = &priv->msgs; msgs->next; msgs = msgs->next);
+		msgs->next = msg;
+	}
+	pthread_mutex_unlock(&priv->lock_io);
+
+	return msg;
+}
+
 static void free_msg(struct dvb_device_priv *dvb, struct queued_msg *msg)
 {
 	struct dvb_v5_fe_parms_priv *parms = (void *)dvb->d.fe_parms;
@@ -513,77 +653,254 @@ static void dvb_dev_remote_disconnect(struct dvb_dev_remote_priv *priv)
 		msg->retval = -ENODEV;
 		pthread_cond_signal(&msg->cond);
 	}
-	/* Close the socket */
+	/* Close the sockets */
+	if (priv->data_fd > 0) {
+		close(priv->data_fd);
+		priv->data_fd = 0;
+	}
 	if (priv->fd > 0) {
 		close(priv->fd);
 		priv->fd = 0;
 	}
 }
 
+static struct ringbuffer_data *alloc_ringbuffer_data(size_t size)
+{
+	struct ringbuffer_data *data;
+
+	if (posix_memalign((void **)&data, RINGBUF_CACHELINE,
+			   sizeof(*data) + size))
+		return NULL;
+	data->size = size;
+
+	return data;
+}
+
+static void wakeup_ringbuffer(struct ringbuffer *ringbuf)
+{
+	/* Pairs with the fence after setting waiting at read_ringbuffer() */
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	if (!__atomic_load_n(&ringbuf->waiting, __ATOMIC_SEQ_CST))
+		return;
+
+	pthread_mutex_lock(&ringbuf->lock);
+	pthread_cond_signal(&ringbuf->cond);
+	pthread_mutex_unlock(&ringbuf->lock);
+}
+
 static void write_ringbuffer(struct dvb_open_descriptor *open_dev,
 			    ssize_t size, char *buf)
 {
 	struct ringbuffer *ringbuf = (struct ringbuffer *)open_dev;
-	ssize_t len = size, split;
+	struct ringbuffer_data *data = ringbuf->data, *new, *none = NULL;
+	size_t rd, wr = ringbuf->write, pos, split;
 
-	pthread_mutex_lock(&ringbuf->lock);
+	rd = __atomic_load_n(&ringbuf->read, __ATOMIC_ACQUIRE);
 
-	split = (ringbuf->write + size > RINGBUF_SIZE) ?
-		 RINGBUF_SIZE - ringbuf->write : 0;
+	/*
+	 * Switch to a resized data area when the consumer is not using the
+	 * current one anymore. If the ring is not empty, keep it pending,
+	 * unless a newer one was queued meanwhile.
+	 */
+	new = __atomic_exchange_n(&ringbuf->pending, NULL, __ATOMIC_ACQUIRE);
+	if (new) {
+		if (wr == rd) {
+			__atomic_store_n(&ringbuf->data, new, __ATOMIC_RELAXED);
+			free(data);
+			data = new;
+		} else if (!__atomic_compare_exchange_n(&ringbuf->pending,
+							&none,
+							new, 0,
+							__ATOMIC_RELEASE,
+							__ATOMIC_RELAXED)) {
+			free(new);
+		}
+	}
 
-	if (split > 0) {
-		memcpy(&ringbuf->buf[ringbuf->write], buf, split);
-		buf += split;
-		len -= split;
-		ringbuf->write = 0;
+	/*
+	 * Detect buffer overflows. As the consumer may be reading the
+	 * oldest data, drop the new chunk instead of overwriting it.
+	 */
+	if (data->size - (wr - rd) < (size_t)size) {
+		__atomic_store_n(&ringbuf->rc, -EOVERFLOW, __ATOMIC_RELEASE);
+		wakeup_ringbuffer(ringbuf);
+		return;
 	}
 
-	memcpy(&ringbuf->buf[ringbuf->write], buf, len);
-	ringbuf->write = (ringbuf->write + len) % RINGBUF_SIZE;
+	pos = wr % data->size;
+	split = (pos + size > data->size) ? data->size - pos : size;
+
+	memcpy(&data->buf[pos], buf, split);
+	memcpy(data->buf, buf + split, size - split);
+
+	__atomic_store_n(&ringbuf->write, wr + size, __ATOMIC_RELEASE);
+	wakeup_ringbuffer(ringbuf);
+}
+
+static void error_ringbuffer(struct dvb_open_descriptor *open_dev, int rc)
+{
+	struct ringbuffer *ringbuf = (struct ringbuffer *)open_dev;
+
+	if (rc)
+		__atomic_store_n(&ringbuf->rc, rc, __ATOMIC_RELEASE);
 
-	/* Detect buffer overflows */
-	if ((unsigned)((ringbuf->write - ringbuf->read) % RINGBUF_SIZE) < size)
-		ringbuf->rc = -EOVERFLOW;
+	if (ringbuf->shm) {
+		uint64_t one = 1;
 
+		if (write(ringbuf->shm_efd, &one, sizeof(one)) < 0)
+			return;
+	}
+
+	pthread_mutex_lock(&ringbuf->lock);
+	pthread_cond_signal(&ringbuf->cond);
 	pthread_mutex_unlock(&ringbuf->lock);
 }
 
-static void read_ringbuffer(struct dvb_open_descriptor *open_dev,
-			    size_t *len, char *buf)
+/* Returns true if read_ringbuffer() has something to return */
+static int ringbuffer_ready(struct ringbuffer *ringbuf,
+			    struct dvb_dev_remote_priv *priv)
+{
+	return __atomic_load_n(&ringbuf->write, __ATOMIC_ACQUIRE) != ringbuf->read ||
+	       __atomic_load_n(&ringbuf->rc, __ATOMIC_ACQUIRE) ||
+	       priv->disconnected;
+}
+
+/* Returns true if read_shm_ring() has something to return */
+static int shm_ring_ready(struct ringbuffer *ringbuf,
+			  struct dvb_dev_remote_priv *priv)
+{
+	struct dvb_shm_ring *shm = ringbuf->shm;
+
+	return __atomic_load_n(&shm->write, __ATOMIC_SEQ_CST) != shm->read ||
+	       __atomic_load_n(&shm->rc, __ATOMIC_ACQUIRE) ||
+	       __atomic_load_n(&ringbuf->rc, __ATOMIC_ACQUIRE) ||
+	       priv->disconnected;
+}
+
+/* read_ringbuffer() counterpart for the ring shared with the daemon */
+static int read_shm_ring(struct ringbuffer *ringbuf,
+			 struct dvb_dev_remote_priv *priv,
+			 size_t *len, char *buf)
+{
+	struct dvb_shm_ring *shm = ringbuf->shm;
+	char *data = (char *)shm + shm->data_offset;
+	uint64_t rd = shm->read, wr, pos, size, split, val;
+	struct pollfd pfd;
+	int rc;
+
+	/*
+	 * Tell the daemon to kick the eventfd, and check again, as the data
+	 * may have arrived before it could see the flag.
+	 */
+	while (!shm_ring_ready(ringbuf, priv)) {
+		__atomic_store_n(&shm->waiting, 1, __ATOMIC_SEQ_CST);
+		if (shm_ring_ready(ringbuf, priv))
+			break;
+
+		pfd.fd = ringbuf->shm_efd;
+		pfd.events = POLLIN;
+		if (poll(&pfd, 1, -1) < 0 && errno != EINTR)
+			return -errno;
+		if (pfd.revents & POLLIN &&
+		    read(ringbuf->shm_efd, &val, sizeof(val)) < 0)
+			return -errno;
+	}
+
+	rc = __atomic_exchange_n(&ringbuf->rc, 0, __ATOMIC_ACQ_REL);
+	if (!rc)
+		rc = __atomic_exchange_n(&shm->rc, 0, __ATOMIC_ACQ_REL);
+	wr = __atomic_load_n(&shm->write, __ATOMIC_ACQUIRE);
+	if (rc || wr == rd) {
+		*len = 0;
+		return rc ? rc : -ENODEV;
+	}
+
+	size = wr - rd;
+	if (size > *len)
+		size = *len;
+
+	pos = rd % shm->size;
+	split = (pos + size > shm->size) ? shm->size - pos : size;
+
+	memcpy(buf, &data[pos], split);
+	memcpy(buf + split, data, size - split);
+	*len = size;
+
+	__atomic_store_n(&shm->read, rd + size, __ATOMIC_RELEASE);
+
+	return 0;
+}
+
+/*
+ * Blocks until there's some data at the ringbuffer, and returns up to
+ * *len bytes of it. A pending error (like -EOVERFLOW) is returned, and
+ * cleared, instead, as well as -ENODEV if the remote end went away.
+ */
+static int read_ringbuffer(struct dvb_open_descriptor *open_dev,
+			   size_t *len, char *buf)
 {
 	struct ringbuffer *ringbuf = (struct ringbuffer *)open_dev;
-	ssize_t size, split;
+	struct dvb_dev_remote_priv *priv = open_dev->dvb->priv;
+	struct ringbuffer_data *data;
+	size_t rd = ringbuf->read, wr, pos, size, split;
+	int rc;
 
-	/* Sets the read size */
-	if (*len > REMOTE_BUF_SIZE)
-		*len = REMOTE_BUF_SIZE;
+	/*
+	 * Data sent via data_read before switching to the shared ring
+	 * should be returned first.
+	 */
+	if (ringbuf->shm && __atomic_load_n(&ringbuf->write,
+					    __ATOMIC_ACQUIRE) == rd)
+		return read_shm_ring(ringbuf, priv, len, buf);
 
 	/* Wait for data to arrive */
-	pthread_mutex_lock(&ringbuf->lock);
-	while ((unsigned)((ringbuf->write - ringbuf->read) % RINGBUF_SIZE) < *len) {
-		pthread_mutex_unlock(&ringbuf->lock);
-		usleep(1);
+	if (!ringbuffer_ready(ringbuf, priv)) {
 		pthread_mutex_lock(&ringbuf->lock);
+		__atomic_store_n(&ringbuf->waiting, 1, __ATOMIC_SEQ_CST);
+		/*
+		 * Pairs with the fence at wakeup_ringbuffer(): either the
+		 * producer sees waiting set, or the check below sees its data.
+		 */
+		__atomic_thread_fence(__ATOMIC_SEQ_CST);
+		while (!ringbuffer_ready(ringbuf, priv))
+			pthread_cond_wait(&ringbuf->cond, &ringbuf->lock);
+		__atomic_store_n(&ringbuf->waiting, 0, __ATOMIC_RELAXED);
+		pthread_mutex_unlock(&ringbuf->lock);
 	}
 
-	size = *len;
+	rc = __atomic_exchange_n(&ringbuf->rc, 0, __ATOMIC_ACQ_REL);
+	wr = __atomic_load_n(&ringbuf->write, __ATOMIC_ACQUIRE);
+	if (rc || wr == rd) {
+		*len = 0;
+		return rc ? rc : -ENODEV;
+	}
 
-	*len = 0;
-	split = (ringbuf->read + size > RINGBUF_SIZE) ? RINGBUF_SIZE - ringbuf->read : 0;
-	if (split > 0) {
+	/* Partial reads: return whatever is there, up to *len */
+	size = wr - rd;
+	if (size > *len)
+		size = *len;
 
-		memcpy(buf, &ringbuf->buf[ringbuf->read], split);
-		buf += split;
-		size -= split;
-		*len += split;
-		ringbuf->read = 0;
-	}
-	memcpy(buf, &ringbuf->buf[ringbuf->read], size);
-	*len += size;
+	/* Only switched by the producer while empty, so it's stable here */
+	data = __atomic_load_n(&ringbuf->data, __ATOMIC_RELAXED);
+	pos = rd % data->size;
+	split = (pos + size > data->size) ? data->size - pos : size;
 
-	ringbuf->read = (ringbuf->read + size) % RINGBUF_SIZE;
+	memcpy(buf, &data->buf[pos], split);
+	memcpy(buf + split, data->buf, size - split);
+	*len = size;
 
-	pthread_mutex_unlock(&ringbuf->lock);
+	__atomic_store_n(&ringbuf->read, rd + size, __ATOMIC_RELEASE);
+
+	return 0;
+}
+
+/* Wakes up the readers blocked at read_ringbuffer() */
+static void wakeup_ringbuffers(struct dvb_device_priv *dvb)
+{
+	struct dvb_open_descriptor *cur;
+
+	for (cur = dvb->open_list.next; cur; cur = cur->next)
+		error_ringbuffer(cur, 0);
 }
 
 static void log_hexdump(struct dvb_v5_fe_parms_priv *parms, int len,
@@ -614,42 +931,164 @@ static void log_hexdump(struct dvb_v5_fe_parms_priv *parms, int len,
 	}
 }
 
-static void *receive_data(void *privdata)
+/* Applies a REMOTE_OP_FE_STATS_EVENT to the pushed stats */
+static void receive_stats_delta(struct dvb_device_priv *dvb, char *args,
+				ssize_t args_size)
+{
+	struct dvb_v5_fe_parms_priv *parms = (void *)dvb->d.fe_parms;
+	struct dvb_dev_remote_priv *priv = dvb->priv;
+	struct remote_bin_stats_delta delta;
+	struct remote_bin_stats *st = &priv->stats;
+	uint32_t prop_mask, layer_mask;
+	size_t size = sizeof(delta);
+	char *p = args + sizeof(delta);
+	int i;
+
+	if (args_size < sizeof(delta))
+		goto invalid;
+	memcpy(&delta, args, sizeof(delta));
+	prop_mask = be32toh(delta.prop_mask);
+	layer_mask = be32toh(delta.layer_mask);
+
+	for (i = 0; i < DTV_NUM_STATS_PROPS; i++)
+		if (prop_mask & (1 << i))
+			size += sizeof(st->prop[i]);
+	for (i = 0; i < MAX_DTV_STATS; i++)
+		if (layer_mask & (1 << i))
+			size += sizeof(st->layer[i]);
+	if (args_size < size)
+		goto invalid;
+
+	pthread_mutex_lock(&priv->stats_lock);
+	st->prev_status = delta.prev_status;
+	for (i = 0; i < DTV_NUM_STATS_PROPS; i++) {
+		if (!(prop_mask & (1 << i)))
+			continue;
+		memcpy(&st->prop[i], p, sizeof(st->prop[i]));
+		p += sizeof(st->prop[i]);
+	}
+	for (i = 0; i < MAX_DTV_STATS; i++) {
+		if (!(layer_mask & (1 << i)))
+			continue;
+		memcpy(&st->layer[i], p, sizeof(st->layer[i]));
+		p += sizeof(st->layer[i]);
+	}
+	pthread_mutex_unlock(&priv->stats_lock);
+	return;
+
+invalid:
+	dvb_logerr("invalid stats event with size %zd", args_size);
+}
+
+static void receive_loop(struct dvb_device_priv *dvb, int fd, char *buf)
 {
-	struct dvb_device_priv *dvb = privdata;
 	struct dvb_dev_remote_priv *priv = dvb->priv;
 	struct dvb_v5_fe_parms_priv *parms = (void *)dvb->d.fe_parms;
 	struct queued_msg *msg;
 	struct dvb_open_descriptor *cur;
-	char buf[REMOTE_BUF_SIZE + 8], cmd[REMOTE_BUF_SIZE], *args;
+	char cmd[REMOTE_BUF_SIZE], *args;
+	char cbuf[CMSG_SPACE(2 * sizeof(int))];
+	struct msghdr mh;
+	struct cmsghdr *cmsg;
+	struct iovec iov;
+	struct remote_bin_hdr hdr;
 	ssize_t size, args_size;
-	int ret, retval, seq, handled, uid, found;
+	int ret, retval, seq, handled, uid, found, i, opcode;
+	int fds[2], nfds;
+	uint32_t len;
 
 	do {
-		size = recv(priv->fd, buf, 4, MSG_WAITALL);
+		/*
+		 * A local daemon may pass file descriptors along with a
+		 * message. They come with its first byte.
+		 */
+		memset(&mh, 0, sizeof(mh));
+		iov.iov_base = buf;
+		iov.iov_len = 4;
+		mh.msg_iov = &iov;
+		mh.msg_iovlen = 1;
+		if (priv->is_local) {
+			mh.msg_control = cbuf;
+			mh.msg_controllen = sizeof(cbuf);
+		}
+		size = recvmsg(fd, &mh, MSG_WAITALL | MSG_CMSG_CLOEXEC);
+
+		nfds = 0;
+		for (cmsg = CMSG_FIRSTHDR(&mh); cmsg; cmsg = CMSG_NXTHDR(&mh, cmsg)) {
+			if (cmsg->cmsg_level != SOL_SOCKET ||
+			    cmsg->cmsg_type != SCM_RIGHTS)
+				continue;
+			nfds = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+			if (nfds > 2)
+				nfds = 2;
+			memcpy(fds, CMSG_DATA(cmsg), nfds * sizeof(int));
+		}
+
 		if (size < 4) {
 			if (size < 0)
 				dvb_perror("recv");
 			else
 				dvb_logerr("remote end disconnected");
 			dvb_dev_remote_disconnect(priv);
-			return NULL;
+			wakeup_ringbuffers(dvb);
+			return;
 		}
-		size = (uint32_t)buf[0] << 24 | (uint32_t)buf[1] << 16 |
-		       (uint32_t)buf[2] << 8 | (uint32_t)buf[3];
-		ret = recv(priv->fd, buf, size, MSG_WAITALL);
+		memcpy(&len, buf, 4);
+		len = be32toh(len);
+		size = len & ~REMOTE_BIN_MSG;
+		if (size > RECV_BUF_SIZE) {
+			dvb_logerr("message too big: %zd bytes", size);
+			for (i = 0; i < nfds; i++)
+				close(fds[i]);
+			dvb_dev_remote_disconnect(priv);
+			wakeup_ringbuffers(dvb);
+			return;
+		}
+		ret = recv(fd, buf, size, MSG_WAITALL);
 		if (ret != size) {
+			for (i = 0; i < nfds; i++)
+				close(fds[i]);
 			if (size < 0)
 				dvb_perror("recv");
 			else
 				dvb_logerr("remote end disconnected");
 			dvb_dev_remote_disconnect(priv);
-			return NULL;
+			wakeup_ringbuffers(dvb);
+			return;
 		}
 
 		args = buf;
 		args_size = size;
-		while (args_size > 0) {
+		opcode = REMOTE_OP_NONE;
+
+		/* Binary messages are always command responses */
+		if (len & REMOTE_BIN_MSG) {
+			if (size < sizeof(hdr)) {
+				dvb_logerr("binary message too short: %zd bytes", size);
+				continue;
+			}
+			memcpy(&hdr, buf, sizeof(hdr));
+			seq = be32toh(hdr.seq);
+			opcode = be16toh(hdr.opcode);
+			retval = (int32_t)be32toh(hdr.retval);
+			args += sizeof(hdr);
+			args_size -= sizeof(hdr);
+			ret = 1;
+			cmd[0] = '\0';
+
+			/* Pushed by the daemon */
+			if (!seq) {
+				if (opcode == REMOTE_OP_FE_STATS_EVENT)
+					receive_stats_delta(dvb, args, args_size);
+				else
+					dvb_logerr("unexpected binary message: %d", opcode);
+				for (i = 0; i < nfds; i++)
+					close(fds[i]);
+				continue;
+			}
+		}
+
+		while (!opcode && args_size > 0) {
 			ret = scan_data(parms, args, args_size, "%i%s%i",
 					&seq, cmd, &retval);
 			if (ret < 0) {
@@ -700,11 +1139,9 @@ static void *receive_data(void *privdata)
 				found = 0;
 				for (cur = dvb->open_list.next; cur; cur = cur->next) {
 					if (cur->fd == uid) {
-						struct ringbuffer *ringbuf = (struct ringbuffer *)cur;
-
 						found = 1;
 						if (retval < 0) {
-							ringbuf->rc = retval;
+							error_ringbuffer(cur, retval);
 							continue;
 						}
 						write_ringbuffer(cur, args_size, args);
@@ -721,8 +1158,11 @@ static void *receive_data(void *privdata)
 				break;
 			}
 		}
-		if (ret <= 0 || !seq)
+		if (ret <= 0 || !seq) {
+			for (i = 0; i < nfds; i++)
+				close(fds[i]);
 			continue;
+		}
 
 		/* Handle command responses */
 		pthread_mutex_lock(&priv->lock_io);
@@ -734,15 +1174,24 @@ static void *receive_data(void *privdata)
 
 			handled = 1;
 
-			if (strcmp(msg->cmd, cmd)) {
-				dvb_logerr("msg #%d: Expecting '%s', got '%s'",
-						seq, msg->cmd, cmd);
+			if (opcode != msg->opcode ||
+			    (!opcode && strcmp(msg->cmd, cmd))) {
+				dvb_logerr("msg #%d: Expecting '%s', got '%s' (opcode %d)",
+						seq, msg->cmd, cmd, opcode);
 				free_msg(dvb, msg);
 				break;
 			}
+			if (args_size > (ssize_t)sizeof(msg->args)) {
+				dvb_logerr("%s response too big: %zd bytes",
+					   msg->cmd, args_size);
+				args_size = sizeof(msg->args);
+			}
 			memcpy(msg->args, args, args_size);
 			msg->args_size = args_size;
 			msg->retval = retval;
+			memcpy(msg->fds, fds, nfds * sizeof(int));
+			msg->nfds = nfds;
+			nfds = 0;
 			pthread_mutex_unlock(&priv->lock_io);
 			pthread_mutex_lock(&msg->lock);
 			ret = pthread_cond_signal(&msg->cond);
@@ -752,6 +1201,8 @@ static void *receive_data(void *privdata)
 				dvb_perror("pthread_cond_signal");
 			break;
 		}
+		for (i = 0; i < nfds; i++)
+			close(fds[i]);
 		if (handled)
 			continue;
 
@@ -760,6 +1211,24 @@ static void *receive_data(void *privdata)
 	} while (1);
 }
 
+static void *receive_data(void *privdata)
+{
+	struct dvb_device_priv *dvb = privdata;
+	struct dvb_dev_remote_priv *priv = dvb->priv;
+
+	receive_loop(dvb, priv->fd, priv->recv_buf);
+	return NULL;
+}
+
+static void *receive_bulk_data(void *privdata)
+{
+	struct dvb_device_priv *dvb = privdata;
+	struct dvb_dev_remote_priv *priv = dvb->priv;
+
+	receive_loop(dvb, priv->data_fd, priv->data_recv_buf);
+	return NULL;
+}
+
 /*
  * Function handlers
  */
@@ -769,12 +1238,14 @@ static int dvb_remote_get_version(struct dvb_device_priv *dvb)
 	struct dvb_dev_remote_priv *priv = dvb->priv;
 	struct queued_msg *msg;
 	char version[REMOTE_BUF_SIZE];
-	int ret;
+	int ret, proto;
 
 	if (priv->disconnected)
 		return -ENODEV;
 
-	msg = send_fmt(dvb, priv->fd, "daemon_get_version", "-");
+	/* Older daemons just ignore the client's protocol version */
+	msg = send_fmt(dvb, priv->fd, "daemon_get_version", "%i",
+		       REMOTE_PROTO_VERSION);
 	if (!msg)
 		return -1;
 
@@ -800,6 +1271,13 @@ static int dvb_remote_get_version(struct dvb_device_priv *dvb)
 		goto error;
 	}
 
+	/* Protocol version 1 daemons don't send it */
+	priv->proto = 1;
+	if (scan_data(parms, msg->args + ret, msg->args_size - ret,
+		      "%i", &proto) > 0 && proto > 1)
+		priv->proto = proto < REMOTE_PROTO_VERSION ?
+			      proto : REMOTE_PROTO_VERSION;
+
 	/* version matches */
 	ret = 1;
 
@@ -811,6 +1289,111 @@ error:
 	return ret;
 }
 
+static void dvb_remote_close_data_channel(struct dvb_dev_remote_priv *priv)
+{
+	if (priv->data_fd > 0) {
+		close(priv->data_fd);
+		priv->data_fd = 0;
+	}
+	free(priv->data_recv_buf);
+	priv->data_recv_buf = NULL;
+}
+
+/*
+ * Opens the data channel: asks the daemon for a token, connects a second
+ * socket to it and attaches the socket to this client by sending the token
+ * over it. On failures, the data is just kept being sent via the control
+ * connection.
+ */
+static int dvb_remote_open_data_channel(struct dvb_device_priv *dvb)
+{
+	struct dvb_v5_fe_parms_priv *parms = (void *)dvb->d.fe_parms;
+	struct dvb_dev_remote_priv *priv = dvb->priv;
+	struct queued_msg *msg;
+	char token[REMOTE_BUF_SIZE];
+	int fd, ret, bufsize;
+
+	msg = send_fmt(dvb, priv->fd, "data_channel_open", "-");
+	if (!msg)
+		return -1;
+
+	ret = pthread_cond_wait(&msg->cond, &msg->lock);
+	if (ret < 0) {
+		dvb_logerr("error waiting for %s response", msg->cmd);
+		goto error;
+	}
+
+	ret = msg->retval;
+	if (ret >= 0 &&
+	    scan_data(parms, msg->args, msg->args_size, "%s", token) <= 0)
+		ret = -EINVAL;
+
+error:
+	msg->seq = 0; /* Avoids any risk of a recursive call */
+	pthread_mutex_unlock(&msg->lock);
+
+	free_msg(dvb, msg);
+	if (ret < 0)
+		return ret;
+
+	fd = socket(priv->addr.ss_family, SOCK_STREAM, 0);
+	if (fd < 0) {
+		dvb_perror("socket");
+		return -errno;
+	}
+
+	/* Throughput matters here, not latency: keep Nagle on */
+	bufsize = DATA_SOCKET_BUF_SIZE;
+	setsockopt(fd, SOL_SOCKET, SO_RCVBUF,
+		   (void *)&bufsize, (int)sizeof(bufsize));
+
+	if (connect(fd, (struct sockaddr *)&priv->addr, priv->addrlen)) {
+		dvb_perror("connect");
+		close(fd);
+		return -errno;
+	}
+	priv->data_fd = fd;
+
+	priv->data_recv_buf = malloc(RECV_BUF_SIZE);
+	if (!priv->data_recv_buf) {
+		dvb_perror("Can't allocate receive buffer");
+		dvb_remote_close_data_channel(priv);
+		return -ENOMEM;
+	}
+
+	ret = pthread_create(&priv->data_recv_id, NULL, receive_bulk_data, dvb);
+	if (ret) {
+		dvb_perror("pthread_create");
+		dvb_remote_close_data_channel(priv);
+		return -ret;
+	}
+
+	msg = send_fmt(dvb, priv->data_fd, "data_channel_attach", "%s", token);
+	if (!msg) {
+		ret = -1;
+		goto err_thread;
+	}
+
+	ret = pthread_cond_wait(&msg->cond, &msg->lock);
+	if (ret < 0)
+		dvb_logerr("error waiting for %s response", msg->cmd);
+	else
+		ret = msg->retval;
+
+	msg->seq = 0; /* Avoids any risk of a recursive call */
+	pthread_mutex_unlock(&msg->lock);
+
+	free_msg(dvb, msg);
+	if (ret >= 0)
+		return 0;
+
+err_thread:
+	pthread_cancel(priv->data_recv_id);
+	pthread_join(priv->data_recv_id, NULL);
+	dvb_remote_close_data_channel(priv);
+	return ret;
+}
+
 static int dvb_remote_find(struct dvb_device_priv *dvb,
 			   dvb_dev_change_t handler, void *user_priv)
 {
@@ -1019,6 +1602,77 @@ error:
 
 int dvb_remote_fe_get_parms(struct dvb_v5_fe_parms *par);
 
+/*
+ * Asks a local daemon to put the data of a DVR device at a shared memory
+ * ring, instead of sending it via data_read messages. On failures, the
+ * messages are just kept being used.
+ */
+static int dvb_remote_shm_ring(struct dvb_open_descriptor *open_dev)
+{
+	struct ringbuffer *ringbuf = (struct ringbuffer *)open_dev;
+	struct dvb_device_priv *dvb = open_dev->dvb;
+	struct dvb_dev_remote_priv *priv = dvb->priv;
+	struct dvb_v5_fe_parms_priv *parms = (void *)dvb->d.fe_parms;
+	struct dvb_shm_ring *shm;
+	struct queued_msg *msg;
+	struct stat st;
+	int i, ret;
+
+	msg = send_fmt(dvb, priv->fd, "dev_shm_ring", "%i%i", open_dev->fd,
+		       4 * REMOTE_MAX_BUF_SIZE);
+	if (!msg)
+		return -1;
+
+	ret = pthread_cond_wait(&msg->cond, &msg->lock);
+	if (ret < 0) {
+		dvb_logerr("error waiting for %s response", msg->cmd);
+		goto error;
+	}
+
+	ret = msg->retval;
+	if (ret < 0)
+		goto error;
+	if (msg->nfds != 2) {
+		ret = -EINVAL;
+		goto error;
+	}
+
+	if (fstat(msg->fds[0], &st) < 0) {
+		ret = -errno;
+		goto error;
+	}
+	shm = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED,
+		   msg->fds[0], 0);
+	if (shm == MAP_FAILED) {
+		ret = -errno;
+		dvb_perror("mmap");
+		goto error;
+	}
+	if (shm->magic != DVB_SHM_RING_MAGIC ||
+	    shm->data_offset < sizeof(*shm) ||
+	    shm->data_offset + shm->size > (uint64_t)st.st_size) {
+		dvb_logerr("invalid shared memory ring");
+		munmap(shm, st.st_size);
+		ret = -EINVAL;
+		goto error;
+	}
+
+	ringbuf->shm_len = st.st_size;
+	ringbuf->shm_efd = msg->fds[1];
+	ringbuf->shm = shm;
+	close(msg->fds[0]);
+	msg->nfds = 0;
+
+error:
+	for (i = 0; i < msg->nfds; i++)
+		close(msg->fds[i]);
+	msg->seq = 0; /* Avoids any risk of a recursive call */
+	pthread_mutex_unlock(&msg->lock);
+
+	free_msg(dvb, msg);
+	return ret;
+}
+
 static struct dvb_open_descriptor *dvb_remote_open(struct dvb_device_priv *dvb,
 						   const char *sysname,
 						   int flags)
@@ -1033,11 +1687,18 @@ static struct dvb_open_descriptor *dvb_remote_open(struct dvb_device_priv *dvb,
 	if (priv->disconnected)
 		return NULL;
 
-	ringbuf = calloc(1, sizeof(*ringbuf));
-	if (!ringbuf) {
+	if (posix_memalign((void **)&ringbuf, RINGBUF_CACHELINE,
+			   sizeof(*ringbuf))) {
 		dvb_perror("Can't create file descriptor");
 		return NULL;
 	}
+	memset(ringbuf, 0, sizeof(*ringbuf));
+	ringbuf->data = alloc_ringbuffer_data(RINGBUF_SIZE);
+	if (!ringbuf->data) {
+		dvb_perror("Can't create file descriptor");
+		free(ringbuf);
+		return NULL;
+	}
 	open_dev = &ringbuf->open_dev;
 
 	msg = send_fmt(dvb, priv->fd, "dev_open", "%s%i", sysname, flags);
@@ -1060,16 +1721,28 @@ static struct dvb_open_descriptor *dvb_remote_open(struct dvb_device_priv *dvb,
 
 	/* Initialize ringbuffer data*/
 	pthread_mutex_init(&ringbuf->lock, NULL);
+	pthread_cond_init(&ringbuf->cond, NULL);
 
 	cur = &dvb->open_list;
 	while (cur->next)
 		cur = cur->next;
 	cur->next = open_dev;
 
+	msg->seq = 0; /* Avoids any risk of a recursive call */
+	pthread_mutex_unlock(&msg->lock);
+	free_msg(dvb, msg);
+
 	/* Retrieve frontend initial parameters */
 	if (strstr(sysname, "frontend"))
 		dvb_remote_fe_get_parms(dvb->d.fe_parms);
 
+	/* A local daemon can share the DVR data via memory */
+	if (priv->is_local && priv->proto >= 4 && strstr(sysname, "dvr")) {
+		ret = dvb_remote_shm_ring(open_dev);
+		if (ret < 0)
+			dvb_logdbg("Can't use a shared memory ring: %d", ret);
+	}
+
 	return open_dev;
 
 error:
@@ -1080,6 +1753,8 @@ error:
 	return NULL;
 }
 
+static void dvb_remote_mmap_free(struct dvb_open_descriptor *open_dev);
+
 static int dvb_remote_close(struct dvb_open_descriptor *open_dev)
 {
 	struct ringbuffer *ringbuffer = (struct ringbuffer *)open_dev;
@@ -1115,7 +1790,15 @@ error:
 	for (cur = &dvb->open_list; cur->next; cur = cur->next) {
 		if (cur->next == open_dev) {
 			cur->next = open_dev->next;
+			pthread_cond_destroy(&ringbuffer->cond);
 			pthread_mutex_destroy(&ringbuffer->lock);
+			dvb_remote_mmap_free(open_dev);
+			if (ringbuffer->shm) {
+				munmap(ringbuffer->shm, ringbuffer->shm_len);
+				close(ringbuffer->shm_efd);
+			}
+			free(ringbuffer->pending);
+			free(ringbuffer->data);
 			free(ringbuffer);
 			goto ret;
 		}
@@ -1189,6 +1872,35 @@ static int dvb_remote_set_bufsize(struct dvb_open_descriptor *open_dev,
 
 	ret = msg->retval;
 
+	/* The daemon replies with the transfer unit it will use */
+	if (ret >= 0 && priv->proto >= 2) {
+		struct ringbuffer *ringbuf = (struct ringbuffer *)open_dev;
+		struct ringbuffer_data *data;
+		int xfer_size;
+
+		if (scan_data(parms, msg->args, msg->args_size,
+			      "%i", &xfer_size) <= 0 ||
+		    xfer_size <= REMOTE_BUF_SIZE ||
+		    xfer_size > REMOTE_MAX_BUF_SIZE)
+			goto error;
+
+		data = alloc_ringbuffer_data((size_t)xfer_size * RINGBUF_CHUNKS);
+		if (!data) {
+			dvb_logerr("Can't allocate a %d bytes ring buffer",
+				   xfer_size * RINGBUF_CHUNKS);
+			goto error;
+		}
+		free(__atomic_exchange_n(&ringbuf->pending, data,
+					 __ATOMIC_ACQ_REL));
+
+		/* The data channel already has a large buffer */
+		if (priv->data_fd <= 0) {
+			bufsize = xfer_size * 2;
+			setsockopt(priv->fd, SOL_SOCKET, SO_RCVBUF,
+				   (void *)&bufsize, (int)sizeof(bufsize));
+		}
+	}
+
 error:
 	msg->seq = 0; /* Avoids any risk of a recursive call */
 	pthread_mutex_unlock(&msg->lock);
@@ -1200,7 +1912,6 @@ error:
 static ssize_t dvb_remote_read(struct dvb_open_descriptor *open_dev,
 		     void *buf, size_t count)
 {
-	struct ringbuffer *ringbuf = (struct ringbuffer *)open_dev;
 	struct dvb_device_priv *dvb = open_dev->dvb;
 	struct dvb_dev_remote_priv *priv = dvb->priv;
 	int ret;
@@ -1208,17 +1919,109 @@ static ssize_t dvb_remote_read(struct dvb_open_descriptor *open_dev,
 	if (priv->disconnected)
 		return -ENODEV;
 
-	if (ringbuf->rc) {
-		ret = ringbuf->rc;
-		ringbuf->rc = 0;
+	ret = read_ringbuffer(open_dev, &count, buf);
+	if (ret < 0)
 		return ret;
+
+	return count;
+}
+
+/*
+ * There's no way to map the remote buffers, so the mmap API is emulated
+ * with local buffers, filled from the ringbuffer at dequeue time.
+ */
+static void dvb_remote_mmap_free(struct dvb_open_descriptor *open_dev)
+{
+	struct dvb_dev_mmap *mm = open_dev->mmap;
+	unsigned int i;
+
+	if (!mm)
+		return;
+
+	for (i = 0; i < mm->count; i++)
+		free(mm->buf[i].start);
+	free(mm);
+	open_dev->mmap = NULL;
+}
+
+static int dvb_remote_mmap_setup(struct dvb_open_descriptor *open_dev,
+				 unsigned int count, unsigned int size)
+{
+	struct dvb_dev_mmap *mm;
+	unsigned int i;
+
+	if (open_dev->mmap)
+		return -EBUSY;
+	if (!size)
+		return -EINVAL;
+
+	if (count > DVB_DEV_MAX_MMAP_BUFS)
+		count = DVB_DEV_MAX_MMAP_BUFS;
+
+	mm = calloc(1, sizeof(*mm));
+	if (!mm)
+		return -ENOMEM;
+	open_dev->mmap = mm;
+
+	for (i = 0; i < count; i++) {
+		mm->buf[i].start = malloc(size);
+		if (!mm->buf[i].start) {
+			dvb_remote_mmap_free(open_dev);
+			return -ENOMEM;
+		}
+		mm->buf[i].length = size;
+		mm->count++;
+		mm->queued |= 1 << i;
 	}
 
-	read_ringbuffer(open_dev, &count, buf);
+	return mm->count;
+}
+
+static ssize_t dvb_remote_mmap_dequeue(struct dvb_open_descriptor *open_dev,
+				       void **data, int *index, uint32_t *flags)
+{
+	struct dvb_dev_remote_priv *priv = open_dev->dvb->priv;
+	struct dvb_dev_mmap *mm = open_dev->mmap;
+	size_t count;
+	int i, ret;
+
+	if (!mm)
+		return -EINVAL;
+	if (priv->disconnected)
+		return -ENODEV;
+
+	if (!mm->queued)
+		return -ENOBUFS;
+	i = ffs(mm->queued) - 1;
+
+	count = mm->buf[i].length;
+	ret = read_ringbuffer(open_dev, &count, mm->buf[i].start);
+	if (ret < 0)
+		return ret;
+
+	mm->queued &= ~(1 << i);
+	*data = mm->buf[i].start;
+	*index = i;
+	if (flags)
+		*flags = 0;
 
 	return count;
 }
 
+static int dvb_remote_mmap_queue(struct dvb_open_descriptor *open_dev,
+				 int index)
+{
+	struct dvb_dev_mmap *mm = open_dev->mmap;
+
+	if (!mm || index < 0 || index >= (int)mm->count ||
+	    (mm->queued & (1 << index)))
+		return -EINVAL;
+
+	mm->queued |= 1 << index;
+
+	return 0;
+}
+
 static int dvb_remote_dmx_set_pesfilter(struct dvb_open_descriptor *open_dev,
 			      int pid, dmx_pes_type_t type,
 			      dmx_output_t output, int bufsize)
@@ -1538,6 +2341,134 @@ error:
 	return ret;
 }
 
+static void bin_counters(struct dvb_v5_counters *c,
+			 const struct remote_bin_counters *in)
+{
+	c->pre_bit_count = be64toh(in->pre_bit_count);
+	c->pre_bit_error = be64toh(in->pre_bit_error);
+	c->post_bit_count = be64toh(in->post_bit_count);
+	c->post_bit_error = be64toh(in->post_bit_error);
+	c->block_count = be64toh(in->block_count);
+	c->block_error = be64toh(in->block_error);
+}
+
+static void bin_stats(struct dvb_v5_stats *st,
+		      const struct remote_bin_stats *in)
+{
+	int i, j;
+
+	st->prev_status = be32toh(in->prev_status);
+	for (i = 0; i < DTV_NUM_STATS_PROPS; i++) {
+		st->prop[i].cmd = be32toh(in->prop[i].cmd);
+		st->prop[i].u.st.len = be32toh(in->prop[i].len);
+		for (j = 0; j < MAX_DTV_STATS; j++) {
+			st->prop[i].u.st.stat[j].scale = in->prop[i].stat[j].scale;
+			st->prop[i].u.st.stat[j].uvalue = be64toh(in->prop[i].stat[j].value);
+		}
+	}
+	for (i = 0; i < MAX_DTV_STATS; i++) {
+		st->has_post_ber[i] = be32toh(in->layer[i].has_post_ber);
+		st->has_pre_ber[i] = be32toh(in->layer[i].has_pre_ber);
+		st->has_per[i] = be32toh(in->layer[i].has_per);
+		bin_counters(&st->prev[i], &in->layer[i].prev);
+		bin_counters(&st->cur[i], &in->layer[i].cur);
+	}
+}
+
+/* fe_get_stats via a binary message, with all the per-layer values */
+static int dvb_remote_fe_get_stats_bin(struct dvb_v5_fe_parms *par)
+{
+	struct dvb_v5_fe_parms_priv *parms = (void *)par;
+	struct dvb_device_priv *dvb = parms->dvb;
+	struct dvb_dev_remote_priv *priv = dvb->priv;
+	struct remote_bin_stats in;
+	struct queued_msg *msg;
+	int ret;
+
+	msg = send_bin(dvb, priv->fd, REMOTE_OP_FE_GET_STATS, "fe_get_stats",
+		       NULL, 0);
+	if (!msg)
+		return -1;
+
+	ret = pthread_cond_wait(&msg->cond, &msg->lock);
+	if (ret < 0) {
+		dvb_logerr("error waiting for %s response", msg->cmd);
+		goto error;
+	}
+
+	ret = msg->retval;
+	if (ret < 0)
+		goto error;
+	if (msg->args_size < sizeof(in)) {
+		dvb_logerr("%s response too short: %zd bytes", msg->cmd,
+			   msg->args_size);
+		ret = -EINVAL;
+		goto error;
+	}
+	memcpy(&in, msg->args, sizeof(in));
+	bin_stats(&parms->stats, &in);
+
+error:
+	msg->seq = 0; /* Avoids any risk of a recursive call */
+	pthread_mutex_unlock(&msg->lock);
+
+	free_msg(dvb, msg);
+	return ret;
+}
+
+int dvb_remote_fe_get_stats(struct dvb_v5_fe_parms *par);
+
+int dvb_dev_remote_stats_subscribe(struct dvb_device *d,
+				   unsigned int interval_ms)
+{
+	struct dvb_device_priv *dvb = (void *)d;
+	struct dvb_v5_fe_parms_priv *parms = (void *)d->fe_parms;
+	struct dvb_dev_remote_priv *priv = dvb->priv;
+	struct remote_bin_subscribe req;
+	struct queued_msg *msg;
+	int ret;
+
+	if (dvb->ops.fe_get_stats != dvb_remote_fe_get_stats)
+		return -EINVAL;
+	if (priv->disconnected)
+		return -ENODEV;
+	if (priv->proto < 5)
+		return -ENOTSUP;
+
+	req.interval_ms = htobe32(interval_ms);
+	msg = send_bin(dvb, priv->fd, REMOTE_OP_FE_STATS_SUBSCRIBE,
+		       "fe_stats_subscribe", &req, sizeof(req));
+	if (!msg)
+		return -1;
+
+	ret = pthread_cond_wait(&msg->cond, &msg->lock);
+	if (ret < 0) {
+		dvb_logerr("error waiting for %s response", msg->cmd);
+		goto error;
+	}
+
+	ret = msg->retval;
+	if (ret < 0)
+		goto error;
+
+	/* The response has the stats at subscription time */
+	pthread_mutex_lock(&priv->stats_lock);
+	if (interval_ms && msg->args_size >= sizeof(priv->stats)) {
+		memcpy(&priv->stats, msg->args, sizeof(priv->stats));
+		priv->stats_subscribed = 1;
+	} else {
+		priv->stats_subscribed = 0;
+	}
+	pthread_mutex_unlock(&priv->stats_lock);
+
+error:
+	msg->seq = 0; /* Avoids any risk of a recursive call */
+	pthread_mutex_unlock(&msg->lock);
+
+	free_msg(dvb, msg);
+	return ret;
+}
+
 int dvb_remote_fe_get_stats(struct dvb_v5_fe_parms *par)
 {
 	struct dvb_v5_fe_parms_priv *parms = (void *)par;
@@ -1552,6 +2483,17 @@ int dvb_remote_fe_get_stats(struct dvb_v5_fe_parms *par)
 	if (priv->disconnected)
 		return -ENODEV;
 
+	/* The daemon pushes them: no need for a round trip */
+	if (priv->stats_subscribed) {
+		pthread_mutex_lock(&priv->stats_lock);
+		bin_stats(st, &priv->stats);
+		pthread_mutex_unlock(&priv->stats_lock);
+		return 0;
+	}
+
+	if (priv->proto >= 5)
+		return dvb_remote_fe_get_stats_bin(par);
+
 	msg = send_fmt(dvb, priv->fd, "fe_get_stats", "-");
 	if (!msg)
 		return -1;
@@ -1658,6 +2600,8 @@ static void dvb_dev_remote_free(struct dvb_device_priv *dvb)
 	 */
 
 	pthread_cancel(priv->recv_id);
+	if (priv->data_fd > 0)
+		pthread_cancel(priv->data_recv_id);
 
 	/* Cancel any pending messages */
 	dvb_dev_remote_disconnect(priv);
@@ -1677,6 +2621,7 @@ static void dvb_dev_remote_free(struct dvb_device_priv *dvb)
 	}
 
 	pthread_mutex_destroy(&priv->lock_io);
+	pthread_mutex_destroy(&priv->stats_lock);
 
 	/* Close the socket */
 	if (priv->fd > 0) {
@@ -1684,6 +2629,8 @@ static void dvb_dev_remote_free(struct dvb_device_priv *dvb)
 		priv->fd = 0;
 	}
 
+	free(priv->data_recv_buf);
+	free(priv->recv_buf);
 	free(priv);
 }
 
@@ -1693,6 +2640,8 @@ int dvb_dev_remote_init(struct dvb_device *d, char *server, int port)
 	struct dvb_v5_fe_parms_priv *parms = (void *)dvb->d.fe_parms;
 	struct dvb_dev_remote_priv *priv;
 	struct dvb_dev_ops *ops = &dvb->ops;
+	struct sockaddr_in *addr_in;
+	struct sockaddr_un *addr_un;
 	int fd, ret, bufsize;
 
 	/* Call an implementation-specific free method, if defined */
@@ -1706,9 +2655,33 @@ int dvb_dev_remote_init(struct dvb_device *d, char *server, int port)
 	strcpy(priv->output_charset, "utf-8");
 	strcpy(priv->default_charset, "iso-8859-1");
 
+	/* An absolute path is the Unix socket of a local daemon */
+
+	if (server[0] == '/') {
+		addr_un = (struct sockaddr_un *)&priv->addr;
+		if (strlen(server) >= sizeof(addr_un->sun_path)) {
+			dvb_logerr("%s: path too long", server);
+			return -1;
+		}
+		addr_un->sun_family = AF_UNIX;
+		strcpy(addr_un->sun_path, server);
+		priv->addrlen = sizeof(*addr_un);
+		priv->is_local = 1;
+	} else {
+		addr_in = (struct sockaddr_in *)&priv->addr;
+		addr_in->sin_family = AF_INET;
+		addr_in->sin_port = htons(port);
+		if (!inet_aton(server, &addr_in->sin_addr))
+		{
+			dvb_perror(server);
+			return -1;
+		}
+		priv->addrlen = sizeof(*addr_in);
+	}
+
 	/* open socket */
 
-	fd = socket(AF_INET, SOCK_STREAM, 0);
+	fd = socket(priv->addr.ss_family, SOCK_STREAM, 0);
 	if (fd < 0) {
 		dvb_perror("socket");
 		return -1;
@@ -1717,14 +2690,7 @@ int dvb_dev_remote_init(struct dvb_device *d, char *server, int port)
 
 	/* connect socket to the server */
 
-	priv->addr.sin_family = AF_INET;
-	priv->addr.sin_port = htons(port);
-	if (!inet_aton(server, &priv->addr.sin_addr))
-	{
-		dvb_perror(server);
-		return -1;
-	}
-	ret = connect(fd, (struct sockaddr*)&priv->addr, sizeof(priv->addr));
+	ret = connect(fd, (struct sockaddr*)&priv->addr, priv->addrlen);
 
 	if (ret) {
 		dvb_perror("connect");
@@ -1736,8 +2702,15 @@ int dvb_dev_remote_init(struct dvb_device *d, char *server, int port)
 	setsockopt(fd, SOL_SOCKET, SO_RCVBUF,
 		   (void *)&bufsize, (int)sizeof(bufsize));
 
+	priv->recv_buf = malloc(RECV_BUF_SIZE);
+	if (!priv->recv_buf) {
+		dvb_perror("Can't allocate receive buffer");
+		return -ENOMEM;
+	}
+
 	/* Start receiving messsages from the server */
 	pthread_mutex_init(&priv->lock_io, NULL);
+	pthread_mutex_init(&priv->stats_lock, NULL);
 	ret = pthread_create(&priv->recv_id, NULL, receive_data, dvb);
 	if (ret < 0) {
 		dvb_perror("pthread_create");
@@ -1750,6 +2723,9 @@ int dvb_dev_remote_init(struct dvb_device *d, char *server, int port)
 	if (ret <= 0) {
 		pthread_mutex_destroy(&priv->lock_io);
 		pthread_cancel(priv->recv_id);
+	} else if (priv->proto >= 3 && !priv->is_local &&
+		   dvb_remote_open_data_channel(dvb) < 0) {
+		dvb_logwarn("Can't open a data channel. Using the control connection for data");
 	}
 
 	/* Everything is OK, initialize data structs */
@@ -1762,6 +2738,10 @@ int dvb_dev_remote_init(struct dvb_device *d, char *server, int port)
 
 	ops->dmx_stop = dvb_remote_dmx_stop;
 	ops->set_bufsize = dvb_remote_set_bufsize;
+	ops->mmap_setup = dvb_remote_mmap_setup;
+	ops->mmap_dequeue = dvb_remote_mmap_dequeue;
+	ops->mmap_queue = dvb_remote_mmap_queue;
+	ops->mmap_free = dvb_remote_mmap_free;
 	ops->read = dvb_remote_read;
 	ops->dmx_set_pesfilter = dvb_remote_dmx_set_pesfilter;
 	ops->dmx_set_section_filter = dvb_remote_dmx_set_section_filter;
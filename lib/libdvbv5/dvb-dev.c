@@ -16,6 +16,7 @@
  * Or, point your browser to http://www.gnu.org/licenses/old-licenses/gpl-2.0.html
  */
 
+#include <errno.h>
 #include <libudev.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -96,6 +97,82 @@ void dvb_dev_free_devices(struct dvb_device_priv *dvb)
 
 	dvb->d.devices = NULL;
 	dvb->d.num_devices = 0;
+	dvb_dev_index_invalidate(dvb);
+}
+
+/* FNV-1a */
+static unsigned int dvb_dev_hash(const char *sysname)
+{
+	unsigned int h = 2166136261u;
+
+	while (*sysname) {
+		h ^= (unsigned char)*sysname++;
+		h *= 16777619u;
+	}
+	return h;
+}
+
+static int dvb_dev_index_build(struct dvb_device_priv *dvb)
+{
+	struct dvb_dev_index *idx = &dvb->index;
+	unsigned int size = 16, *slot, h;
+	int i;
+
+	while (size < 2 * (unsigned int)dvb->d.num_devices)
+		size <<= 1;
+	if (size != idx->size) {
+		slot = realloc(idx->slot, sizeof(*slot) * size);
+		if (!slot)
+			return -ENOMEM;
+		idx->slot = slot;
+		idx->size = size;
+	}
+	memset(idx->slot, 0, sizeof(*idx->slot) * size);
+
+	for (i = 0; i < dvb->d.num_devices; i++) {
+		if (!dvb->d.devices[i].sysname)
+			continue;
+		h = dvb_dev_hash(dvb->d.devices[i].sysname) & (size - 1);
+		while (idx->slot[h])
+			h = (h + 1) & (size - 1);
+		idx->slot[h] = i + 1;
+	}
+
+	idx->devices = dvb->d.devices;
+	idx->num_devices = dvb->d.num_devices;
+	idx->valid = 1;
+
+	return 0;
+}
+
+struct dvb_dev_list *dvb_dev_lookup(struct dvb_device_priv *dvb,
+				    const char *sysname)
+{
+	struct dvb_dev_index *idx = &dvb->index;
+	struct dvb_dev_list *dev;
+	unsigned int h;
+	int i;
+
+	if (!idx->valid || idx->devices != dvb->d.devices ||
+	    idx->num_devices != dvb->d.num_devices) {
+		if (dvb_dev_index_build(dvb) < 0) {
+			/* Out of memory: just walk the list */
+			for (i = 0; i < dvb->d.num_devices; i++) {
+				dev = &dvb->d.devices[i];
+				if (dev->sysname && !strcmp(sysname, dev->sysname))
+					return dev;
+			}
+			return NULL;
+		}
+	}
+
+	for (h = dvb_dev_hash(sysname) & (idx->size - 1); idx->slot[h];
+	     h = (h + 1) & (idx->size - 1)) {
+		dev = &dvb->d.devices[idx->slot[h] - 1];
+		if (!strcmp(sysname, dev->sysname))
+			return dev;
+	}
+	return NULL;
 }
 
 void dvb_dev_free(struct dvb_device *d)
@@ -119,6 +196,7 @@ void dvb_dev_free(struct dvb_device *d)
 	dvb_fe_close(dvb->d.fe_parms);
 
 	dvb_dev_free_devices(dvb);
+	free(dvb->index.slot);
 
 	free(dvb);
 }
@@ -207,6 +285,28 @@ void dvb_dev_stop_monitor(struct dvb_device *d)
 		ops->stop_monitor(dvb);
 }
 
+int dvb_dev_monitor_get_fd(struct dvb_device *d)
+{
+	struct dvb_device_priv *dvb = (void *)d;
+	struct dvb_dev_ops *ops = &dvb->ops;
+
+	if (!ops->monitor_get_fd)
+		return -ENOTSUP;
+
+	return ops->monitor_get_fd(dvb);
+}
+
+int dvb_dev_monitor_handle(struct dvb_device *d)
+{
+	struct dvb_device_priv *dvb = (void *)d;
+	struct dvb_dev_ops *ops = &dvb->ops;
+
+	if (!ops->monitor_handle)
+		return -ENOTSUP;
+
+	return ops->monitor_handle(dvb);
+}
+
 struct dvb_dev_list *dvb_get_dev_info(struct dvb_device *d,
 				      const char *sysname)
 {
@@ -284,6 +384,50 @@ ssize_t dvb_dev_read(struct dvb_open_descriptor *open_dev,
 	return ops->read(open_dev, buf, count);
 }
 
+int dvb_dev_mmap_setup(struct dvb_open_descriptor *open_dev,
+		       unsigned int count, unsigned int size)
+{
+	struct dvb_device_priv *dvb = open_dev->dvb;
+	struct dvb_dev_ops *ops = &dvb->ops;
+
+	if (!ops->mmap_setup)
+		return -ENOTSUP;
+
+	return ops->mmap_setup(open_dev, count, size);
+}
+
+ssize_t dvb_dev_mmap_dequeue(struct dvb_open_descriptor *open_dev,
+			     void **data, int *index, uint32_t *flags)
+{
+	struct dvb_device_priv *dvb = open_dev->dvb;
+	struct dvb_dev_ops *ops = &dvb->ops;
+
+	if (!ops->mmap_dequeue)
+		return -ENOTSUP;
+
+	return ops->mmap_dequeue(open_dev, data, index, flags);
+}
+
+int dvb_dev_mmap_queue(struct dvb_open_descriptor *open_dev, int index)
+{
+	struct dvb_device_priv *dvb = open_dev->dvb;
+	struct dvb_dev_ops *ops = &dvb->ops;
+
+	if (!ops->mmap_queue)
+		return -ENOTSUP;
+
+	return ops->mmap_queue(open_dev, index);
+}
+
+void dvb_dev_mmap_free(struct dvb_open_descriptor *open_dev)
+{
+	struct dvb_device_priv *dvb = open_dev->dvb;
+	struct dvb_dev_ops *ops = &dvb->ops;
+
+	if (ops->mmap_free)
+		ops->mmap_free(open_dev);
+}
+
 int dvb_dev_dmx_set_pesfilter(struct dvb_open_descriptor *open_dev,
 			      int pid, dmx_pes_type_t type,
 			      dmx_output_t output, int bufsize)
@@ -0,0 +1,649 @@
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation version 2.1 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ * Or, point your browser to http://www.gnu.org/licenses/old-licenses/gpl-2.0.html
+ */
+
+/*
+ * EPG collector.
+ *
+ * The EIT sections are walked with the table views, without parsing them
+ * into tables: only the short event descriptor of the new events gets
+ * decoded. Each event is a single allocation, with its strings, linked on
+ * a hash by service and event ID, to drop the repeated ones, and on a list
+ * per service, sorted by start time, for the queries and the eviction.
+ */
+
+#include <config.h>
+#include <errno.h>
+#include <poll.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "dvb-fe-priv.h"
+#include <libdvbv5/dvb-epg.h>
+#include <libdvbv5/dvb-demux.h>
+#include <libdvbv5/descriptors.h>
+#include <libdvbv5/header.h>
+#include <libdvbv5/eit.h>
+#include <libdvbv5/atsc_eit.h>
+#include <libdvbv5/desc_event_short.h>
+#include <parse_string.h>
+
+#ifdef ENABLE_NLS
+# include "gettext.h"
+# include <libintl.h>
+# define _(string) dgettext(LIBDVBV5_DOMAIN, string)
+#else
+# define _(string) string
+#endif
+
+#define EPG_MIN_HASH_SIZE	1024
+
+/* Seconds from the UNIX epoch to the MJD epoch and to the GPS epoch */
+#define MJD_UNIX_EPOCH		40587
+#define GPS_UNIX_OFFSET		315964800
+
+struct dvb_epg_service;
+
+struct dvb_epg_entry {
+	struct dvb_epg_event ev;
+	struct dvb_epg_service *service;
+	struct dvb_epg_entry *hash_next;
+	struct dvb_epg_entry *prev, *next;
+	char strings[];
+};
+
+struct dvb_epg_service {
+	uint64_t key;
+	struct dvb_epg_entry *first, *last;
+};
+
+struct dvb_epg {
+	struct dvb_v5_fe_parms_priv *parms;
+	unsigned max_events, num_events;
+	time_t expired;
+
+	struct dvb_epg_entry **hash;
+	unsigned hash_size;
+
+	/* Sorted by key */
+	struct dvb_epg_service **services;
+	unsigned num_services, alloc_services;
+};
+
+struct dvb_epg *dvb_epg_alloc(struct dvb_v5_fe_parms *parms,
+			      unsigned max_events)
+{
+	struct dvb_epg *epg;
+
+	epg = calloc(1, sizeof(*epg));
+	if (!epg)
+		return NULL;
+	epg->parms = (void *)parms;
+	epg->max_events = max_events ? max_events : 1;
+	return epg;
+}
+
+void dvb_epg_free(struct dvb_epg *epg)
+{
+	struct dvb_epg_entry *e, *next;
+	unsigned i;
+
+	if (!epg)
+		return;
+
+	for (i = 0; i < epg->num_services; i++) {
+		for (e = epg->services[i]->first; e; e = next) {
+			next = e->next;
+			free(e);
+		}
+		free(epg->services[i]);
+	}
+	free(epg->services);
+	free(epg->hash);
+	free(epg);
+}
+
+unsigned dvb_epg_num_events(struct dvb_epg *epg)
+{
+	return epg->num_events;
+}
+
+static uint64_t epg_service_key(int atsc, uint16_t network_id,
+				uint16_t transport_id, uint16_t service_id)
+{
+	return (uint64_t)!!atsc << 48 | (uint64_t)network_id << 32 |
+	       (uint64_t)transport_id << 16 | service_id;
+}
+
+/* Returns the index of the first service with a key >= key */
+static unsigned epg_service_index(struct dvb_epg *epg, uint64_t key)
+{
+	unsigned lo = 0, hi = epg->num_services, mid;
+
+	while (lo < hi) {
+		mid = (lo + hi) / 2;
+		if (epg->services[mid]->key < key)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return lo;
+}
+
+static struct dvb_epg_service *epg_get_service(struct dvb_epg *epg,
+					       uint64_t key)
+{
+	struct dvb_epg_service *service, **services;
+	unsigned i = epg_service_index(epg, key);
+
+	if (i < epg->num_services && epg->services[i]->key == key)
+		return epg->services[i];
+
+	if (epg->num_services == epg->alloc_services) {
+		unsigned alloc = epg->alloc_services ? epg->alloc_services * 2 : 64;
+
+		services = realloc(epg->services, alloc * sizeof(*services));
+		if (!services)
+			return NULL;
+		epg->services = services;
+		epg->alloc_services = alloc;
+	}
+	service = calloc(1, sizeof(*service));
+	if (!service)
+		return NULL;
+	service->key = key;
+
+	memmove(&epg->services[i + 1], &epg->services[i],
+		(epg->num_services - i) * sizeof(*epg->services));
+	epg->services[i] = service;
+	epg->num_services++;
+	return service;
+}
+
+static unsigned epg_hash(struct dvb_epg_service *service, uint16_t event_id,
+			 unsigned size)
+{
+	uint64_t h = ((uintptr_t)service ^ event_id) * 0x9e3779b97f4a7c15ULL;
+
+	return (h >> 32) & (size - 1);
+}
+
+static struct dvb_epg_entry **epg_hash_find(struct dvb_epg *epg,
+					    struct dvb_epg_service *service,
+					    uint16_t event_id)
+{
+	struct dvb_epg_entry **e;
+
+	e = &epg->hash[epg_hash(service, event_id, epg->hash_size)];
+	for (; *e; e = &(*e)->hash_next)
+		if ((*e)->service == service && (*e)->ev.event_id == event_id)
+			break;
+	return e;
+}
+
+static int epg_hash_grow(struct dvb_epg *epg)
+{
+	struct dvb_epg_entry **hash, *e, *next;
+	unsigned i, h, size;
+
+	size = epg->hash_size ? epg->hash_size * 2 : EPG_MIN_HASH_SIZE;
+	hash = calloc(size, sizeof(*hash));
+	if (!hash)
+		return -ENOMEM;
+
+	for (i = 0; i < epg->hash_size; i++) {
+		for (e = epg->hash[i]; e; e = next) {
+			next = e->hash_next;
+			h = epg_hash(e->service, e->ev.event_id, size);
+			e->hash_next = hash[h];
+			hash[h] = e;
+		}
+	}
+	free(epg->hash);
+	epg->hash = hash;
+	epg->hash_size = size;
+	return 0;
+}
+
+static void epg_remove(struct dvb_epg *epg, struct dvb_epg_entry *e)
+{
+	struct dvb_epg_service *service = e->service;
+	struct dvb_epg_entry **p;
+
+	p = epg_hash_find(epg, service, e->ev.event_id);
+	*p = e->hash_next;
+
+	if (e->prev)
+		e->prev->next = e->next;
+	else
+		service->first = e->next;
+	if (e->next)
+		e->next->prev = e->prev;
+	else
+		service->last = e->prev;
+
+	epg->num_events--;
+	free(e);
+}
+
+/* Drops the event that starts first */
+static int epg_evict(struct dvb_epg *epg, time_t start)
+{
+	struct dvb_epg_entry *oldest = NULL, *e;
+	unsigned i;
+
+	for (i = 0; i < epg->num_services; i++) {
+		e = epg->services[i]->first;
+		if (e && (!oldest || e->ev.start < oldest->ev.start))
+			oldest = e;
+	}
+	if (!oldest || oldest->ev.start > start)
+		return -1;
+	epg_remove(epg, oldest);
+	return 0;
+}
+
+static void epg_insert_sorted(struct dvb_epg_service *service,
+			      struct dvb_epg_entry *e)
+{
+	struct dvb_epg_entry *pos = service->last;
+
+	/* The events usually come in order */
+	while (pos && pos->ev.start > e->ev.start)
+		pos = pos->prev;
+
+	e->prev = pos;
+	if (pos) {
+		e->next = pos->next;
+		pos->next = e;
+	} else {
+		e->next = service->first;
+		service->first = e;
+	}
+	if (e->next)
+		e->next->prev = e;
+	else
+		service->last = e;
+}
+
+/*
+ * Looks for an event. Returns 0 if it is already known with that version,
+ * and 1 if it should be added.
+ */
+static int epg_check(struct dvb_epg *epg, struct dvb_epg_event *ev,
+		     struct dvb_epg_service **service)
+{
+	struct dvb_epg_entry *e;
+
+	if (ev->start + (time_t)ev->duration <= epg->expired)
+		return 0;
+
+	*service = epg_get_service(epg,
+				   epg_service_key(ev->atsc, ev->network_id,
+						   ev->transport_id, ev->service_id));
+	if (!*service)
+		return -ENOMEM;
+
+	if (!epg->hash_size)
+		return 1;
+	e = *epg_hash_find(epg, *service, ev->event_id);
+	if (e && e->ev.version == ev->version)
+		return 0;
+	return 1;
+}
+
+static int epg_store(struct dvb_epg *epg, struct dvb_epg_service *service,
+		     const struct dvb_epg_event *ev,
+		     const char *name, const char *text)
+{
+	struct dvb_epg_entry *e, **p;
+	size_t name_len, text_len;
+
+	if (epg->hash_size) {
+		e = *epg_hash_find(epg, service, ev->event_id);
+		if (e)
+			epg_remove(epg, e);
+	}
+
+	if (epg->num_events >= epg->max_events &&
+	    epg_evict(epg, ev->start) < 0)
+		return 0;
+
+	if ((epg->num_events + 1) * 4 > epg->hash_size * 3 &&
+	    epg_hash_grow(epg) < 0)
+		return -ENOMEM;
+
+	name_len = name ? strlen(name) : 0;
+	text_len = text ? strlen(text) : 0;
+	e = malloc(sizeof(*e) + name_len + text_len + 2);
+	if (!e)
+		return -ENOMEM;
+
+	e->ev = *ev;
+	e->service = service;
+	memcpy(e->strings, name ? name : "", name_len + 1);
+	memcpy(e->strings + name_len + 1, text ? text : "", text_len + 1);
+	e->ev.name = e->strings;
+	e->ev.text = e->strings + name_len + 1;
+
+	p = &epg->hash[epg_hash(service, ev->event_id, epg->hash_size)];
+	e->hash_next = *p;
+	*p = e;
+	epg_insert_sorted(service, e);
+	epg->num_events++;
+	return 1;
+}
+
+static time_t epg_dvb_time(const uint8_t *p)
+{
+	unsigned mjd = p[0] << 8 | p[1];
+
+	return (time_t)((int)mjd - MJD_UNIX_EPOCH) * 86400 +
+	       dvb_bcd(p[2]) * 3600 + dvb_bcd(p[3]) * 60 + dvb_bcd(p[4]);
+}
+
+static int epg_add_dvb(struct dvb_epg *epg, const uint8_t *buf,
+		       ssize_t buflen)
+{
+	struct dvb_v5_fe_parms_priv *parms = epg->parms;
+	struct dvb_table_eit_event_view event;
+	struct dvb_table_view view;
+	struct dvb_desc_view desc;
+	struct dvb_epg_service *service;
+	struct dvb_epg_event ev;
+	uint16_t service_id;
+	int ret, count = 0;
+
+	ret = dvb_table_eit_view_init(&parms->p, buf, buflen, &view, &service_id);
+	if (ret < 0)
+		return ret;
+
+	memset(&ev, 0, sizeof(ev));
+	ev.service_id = service_id;
+	ev.transport_id = buf[8] << 8 | buf[9];
+	ev.network_id = buf[10] << 8 | buf[11];
+	ev.version = (buf[5] >> 1) & 0x1f;
+
+	while ((ret = dvb_table_eit_view_next(&view, &event)) > 0) {
+		char *name = NULL, *text = NULL;
+
+		/* NVOD reference events have no start time */
+		if (event.dvbstart[0] == 0xff && event.dvbstart[1] == 0xff)
+			continue;
+
+		ev.event_id = event.event_id;
+		ev.start = epg_dvb_time(event.dvbstart);
+		ev.duration = event.duration;
+		ev.running_status = event.running_status;
+		ev.free_CA_mode = event.free_CA_mode;
+		ev.language[0] = '\0';
+
+		ret = epg_check(epg, &ev, &service);
+		if (ret < 0)
+			return ret;
+		if (!ret)
+			continue;
+
+		if (dvb_desc_view_find(event.desc, event.desc_length,
+				       short_event_descriptor, &desc) > 0)
+			dvb_desc_event_short_view(&parms->p, &desc, ev.language,
+						  &name, &text);
+
+		ret = epg_store(epg, service, &ev, name, text);
+		/* Only heap strings are freed, see dvb_desc_view_string() */
+		if (!parms->arena) {
+			free(name);
+			free(text);
+		}
+		if (ret < 0)
+			return ret;
+		count += ret;
+	}
+	if (ret < 0)
+		dvb_logwarn(_("%s: EIT section for service 0x%04x is truncated"),
+			    __func__, service_id);
+	return count;
+}
+
+/*
+ * Gets the uncompressed Latin-1 segments of the first string of an ATSC
+ * multiple string structure.
+ */
+static void epg_atsc_title(struct dvb_v5_fe_parms_priv *parms,
+			   const uint8_t *p, size_t len,
+			   char *language, char *title, size_t title_size)
+{
+	const uint8_t *end = p + len;
+	unsigned char latin1[256 * 4];
+	size_t n = 0;
+	unsigned nseg;
+
+	title[0] = '\0';
+	if (len < 5 || !p[0])
+		return;
+
+	memcpy(language, p + 1, 3);
+	language[3] = '\0';
+	nseg = p[4];
+	p += 5;
+
+	while (nseg-- && p + 3 <= end && p + 3 + p[2] <= end) {
+		/* compression_type 0 and mode 0: Unicode page 0, i. e. Latin-1 */
+		if (!p[0] && !p[1] && n + p[2] <= sizeof(latin1)) {
+			memcpy(latin1 + n, p + 3, p[2]);
+			n += p[2];
+		}
+		p += 3 + p[2];
+	}
+	if (n)
+		dvb_iconv_to_charset(&parms->p, title, title_size - 1, latin1, n,
+				     "ISO-8859-1", parms->p.output_charset);
+}
+
+static int epg_add_atsc(struct dvb_epg *epg, const uint8_t *buf,
+			ssize_t buflen)
+{
+	struct dvb_v5_fe_parms_priv *parms = epg->parms;
+	struct dvb_epg_service *service;
+	struct dvb_table_view view;
+	struct dvb_epg_event ev;
+	const uint8_t *p;
+	int ret, count = 0;
+	size_t size;
+
+	ret = dvb_table_view_init(&parms->p, buf, buflen,
+				  offsetof(struct atsc_table_eit, event), &view);
+	if (ret < 0)
+		return ret;
+
+	memset(&ev, 0, sizeof(ev));
+	ev.atsc = 1;
+	ev.service_id = buf[3] << 8 | buf[4];
+	ev.version = (buf[5] >> 1) & 0x1f;
+
+	for (p = view.ptr; p + 10 <= view.end; p += size) {
+		char title[256 * 3 * 4];
+		size_t title_length = p[9];
+
+		size = 10 + title_length + 2;
+		if (p + size > view.end)
+			break;
+		size += ((p[size - 2] & 0x0f) << 8) | p[size - 1];
+		if (p + size > view.end)
+			break;
+
+		ev.event_id = ((p[0] & 0x3f) << 8) | p[1];
+		ev.start = (time_t)((uint32_t)p[2] << 24 | p[3] << 16 |
+				    p[4] << 8 | p[5]) + GPS_UNIX_OFFSET;
+		ev.duration = ((p[6] & 0x0f) << 16) | p[7] << 8 | p[8];
+		ev.language[0] = '\0';
+
+		ret = epg_check(epg, &ev, &service);
+		if (ret < 0)
+			return ret;
+		if (!ret)
+			continue;
+
+		epg_atsc_title(parms, p + 10, title_length, ev.language,
+			       title, sizeof(title));
+		ret = epg_store(epg, service, &ev, title, NULL);
+		if (ret < 0)
+			return ret;
+		count += ret;
+	}
+	if (p < view.end)
+		dvb_logwarn(_("%s: EIT section for source 0x%04x is truncated"),
+			    __func__, ev.service_id);
+	return count;
+}
+
+int dvb_epg_add_section(struct dvb_epg *epg, const uint8_t *buf,
+			ssize_t buflen)
+{
+	if (buflen < 1)
+		return 0;
+
+	if (buf[0] >= DVB_TABLE_EIT && buf[0] <= DVB_TABLE_EIT_SCHEDULE_OTHER + 0xf)
+		return epg_add_dvb(epg, buf, buflen);
+	if (buf[0] == ATSC_TABLE_EIT)
+		return epg_add_atsc(epg, buf, buflen);
+	return 0;
+}
+
+int dvb_epg_read(struct dvb_epg *epg, int dmx_fd, uint16_t pid,
+		 unsigned timeout)
+{
+	struct dvb_v5_fe_parms_priv *parms = epg->parms;
+	struct timespec start, now;
+	struct pollfd pfd;
+	uint8_t *buf;
+	ssize_t len;
+	long elapsed;
+	int ret, count = 0;
+
+	if (dvb_set_section_filter(dmx_fd, pid, 0, NULL, NULL, NULL,
+				   DMX_IMMEDIATE_START | DMX_CHECK_CRC) < 0) {
+		dvb_dmx_stop(dmx_fd);
+		return -1;
+	}
+
+	buf = dvb_section_buf_get(parms);
+	if (!buf) {
+		dvb_logerr(_("%s: out of memory"), __func__);
+		dvb_dmx_stop(dmx_fd);
+		return -ENOMEM;
+	}
+
+	pfd.fd = dmx_fd;
+	pfd.events = POLLIN;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	while (!parms->p.abort) {
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		elapsed = (now.tv_sec - start.tv_sec) * 1000 +
+			  (now.tv_nsec - start.tv_nsec) / 1000000;
+		if (elapsed >= (long)timeout * 1000)
+			break;
+
+		ret = poll(&pfd, 1, (long)timeout * 1000 - elapsed);
+		if (ret < 0 && errno != EINTR) {
+			dvb_perror("poll");
+			break;
+		}
+		if (ret <= 0)
+			continue;
+
+		len = read(dmx_fd, buf, DVB_MAX_PAYLOAD_PACKET_SIZE);
+		if (len < 0) {
+			/* Lost sections, or a bad CRC */
+			if (errno == EOVERFLOW || errno == EAGAIN ||
+			    errno == EINTR)
+				continue;
+			dvb_perror("read");
+			break;
+		}
+		if (len < 3 || (((buf[1] & 0x0f) << 8) | buf[2]) + 3 != len)
+			continue;
+
+		ret = dvb_epg_add_section(epg, buf, len);
+		if (ret == -ENOMEM) {
+			count = ret;
+			break;
+		}
+		if (ret > 0)
+			count += ret;
+	}
+
+	dvb_section_buf_put(parms, buf);
+	dvb_dmx_stop(dmx_fd);
+	return count;
+}
+
+unsigned dvb_epg_expire(struct dvb_epg *epg, time_t now)
+{
+	struct dvb_epg_entry *e, *next;
+	unsigned i, removed = 0;
+
+	epg->expired = now;
+	for (i = 0; i < epg->num_services; i++) {
+		for (e = epg->services[i]->first; e; e = next) {
+			next = e->next;
+			/*
+			 * The list is sorted by start time: stop at the first
+			 * event that didn't start, one before it can still
+			 * last longer.
+			 */
+			if (e->ev.start > now)
+				break;
+			if (e->ev.start + (time_t)e->ev.duration <= now) {
+				epg_remove(epg, e);
+				removed++;
+			}
+		}
+	}
+	return removed;
+}
+
+int dvb_epg_query(struct dvb_epg *epg, int network_id, int transport_id,
+		  int service_id, time_t from, time_t to,
+		  dvb_epg_event_func func, void *priv)
+{
+	struct dvb_epg_service *service;
+	struct dvb_epg_entry *e;
+	uint16_t nid, tsid, sid;
+	unsigned i;
+	int ret, count = 0;
+
+	for (i = 0; i < epg->num_services; i++) {
+		service = epg->services[i];
+		nid = service->key >> 32;
+		tsid = service->key >> 16;
+		sid = service->key;
+		if ((network_id >= 0 && nid != network_id) ||
+		    (transport_id >= 0 && tsid != transport_id) ||
+		    (service_id >= 0 && sid != service_id))
+			continue;
+
+		for (e = service->first; e && e->ev.start < to; e = e->next) {
+			if (e->ev.start + (time_t)e->ev.duration <= from)
+				continue;
+			count++;
+			ret = func(&e->ev, priv);
+			if (ret)
+				return ret;
+		}
+	}
+	return count;
+}
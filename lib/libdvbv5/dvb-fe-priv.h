@@ -54,7 +54,31 @@ struct dvb_v5_stats {
 
 };
 
+/*
+ * Last SEC setup sent to the frontend, used by dvb-sat.c to skip the
+ * voltage, tone and DiSEqC steps that wouldn't change anything.
+ */
+struct dvb_sec_state {
+	int				has_voltage, has_tone;
+	fe_sec_voltage_t		voltage;
+	fe_sec_tone_mode_t		tone;
+
+	/* The switch is at the input selected by cmd and burst */
+	int				has_input;
+	unsigned			cmd_len;
+	unsigned char			cmd[6];
+	int				burst;
+};
+
 struct dvb_device_priv;
+struct dvb_freq_index;
+struct dvb_iconv_cache;
+struct dvb_section_cache;
+struct dvb_table_filter_priv;
+
+/* How many section read buffers and filter states are kept for reuse */
+#define DVB_SECTION_BUF_POOL	2
+#define DVB_FILTER_POOL		32
 
 struct dvb_v5_fe_parms_priv {
 	/* dvbv_v4_fe_parms should be the first element on this struct */
@@ -75,9 +99,30 @@ struct dvb_v5_fe_parms_priv {
 	/* Satellite specific stuff */
 	int				high_band;
 	unsigned			freq_offset;
+	struct dvb_sec_state		sec;
+
+	/* Used to look for duplicated transponders, if not NULL */
+	struct dvb_freq_index		*freq_index;
 
 	dvb_logfunc_priv		logfunc_priv;
 	void				*logpriv;
+
+	/* Where the parsed tables are allocated, if not on the heap */
+	struct dvb_parse_arena		*arena;
+
+	/* iconv descriptors used to convert the strings of the tables */
+	struct dvb_iconv_cache		*iconv_cache;
+
+	/* Sections already parsed, to skip the unchanged ones */
+	struct dvb_section_cache	*section_cache;
+
+	/*
+	 * Section buffers and filter states of the finished table reads,
+	 * taken and given back with atomic exchanges, as the reads may run
+	 * on several threads at once
+	 */
+	uint8_t				*section_buf_pool[DVB_SECTION_BUF_POOL];
+	struct dvb_table_filter_priv	*filter_pool[DVB_FILTER_POOL];
 };
 
 /* Functions used internally by dvb-dev.c. Aren't part of the API */
@@ -85,6 +130,12 @@ int dvb_fe_open_fname(struct dvb_v5_fe_parms_priv *parms, char *fname,
 		      int flags);
 void dvb_v5_free(struct dvb_v5_fe_parms_priv *parms);
 void __dvb_fe_close(struct dvb_v5_fe_parms_priv *parms);
+void dvb_fe_init_stats(struct dvb_v5_fe_parms_priv *parms);
+
+/* Used internally by dvb-scan.c and dvb-epg.c */
+uint8_t *dvb_section_buf_get(struct dvb_v5_fe_parms_priv *parms);
+void dvb_section_buf_put(struct dvb_v5_fe_parms_priv *parms, uint8_t *buf);
+void dvb_section_pool_free(struct dvb_v5_fe_parms_priv *parms);
 
 /* Functions that can be overriden to be executed remotely */
 int __dvb_set_sys(struct dvb_v5_fe_parms *p, fe_delivery_system_t sys);
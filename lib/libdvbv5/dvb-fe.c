@@ -18,13 +18,16 @@
 #include <sys/types.h>
 
 #include "dvb-fe-priv.h"
+#include "dvb-dev-priv.h"
 #include "dvb-v5.h"
 #include <libdvbv5/dvb-dev.h>
 #include <libdvbv5/countries.h>
 #include <libdvbv5/dvb-v5-std.h>
+#include <parse_string.h>
 
 #include <inttypes.h>
 #include <math.h>
+#include <poll.h>
 #include <stddef.h>
 #include <time.h>
 #include <unistd.h>
@@ -85,6 +88,8 @@ void dvb_v5_free(struct dvb_v5_fe_parms_priv *parms)
 	if (parms->fname)
 		free(parms->fname);
 
+	dvb_iconv_cache_free(&parms->p);
+	dvb_section_pool_free(parms);
 	free(parms);
 }
 
@@ -385,6 +390,13 @@ int dvb_fe_open_fname(struct dvb_v5_fe_parms_priv *parms, char *fname,
 		}
 	}
 
+	dvb_fe_init_stats(parms);
+
+	return 0;
+}
+
+void dvb_fe_init_stats(struct dvb_v5_fe_parms_priv *parms)
+{
 	/*
 	 * Prepare the status struct - DVBv5.10 parameters should
 	 * come first, as they'll be read together.
@@ -404,8 +416,6 @@ int dvb_fe_open_fname(struct dvb_v5_fe_parms_priv *parms, char *fname,
 	parms->stats.prop[10].cmd = DTV_PER;
 	parms->stats.prop[11].cmd = DTV_QUALITY;
 	parms->stats.prop[12].cmd = DTV_PRE_BER;
-
-	return 0;
 }
 
 
@@ -1439,6 +1449,34 @@ static void dvb_fe_update_counters(struct dvb_v5_fe_parms_priv *parms)
 	}
 }
 
+/* Is parms->fd the frontend itself, instead of a remote one? */
+static int dvb_fe_is_local(struct dvb_v5_fe_parms_priv *parms)
+{
+	struct dvb_device_priv *dvb = parms->dvb;
+
+	return !dvb || !dvb->ops.fe_set_parms ||
+	       dvb->ops.fe_set_parms == dvb_local_fe_set_parms;
+}
+
+static int dvb_fe_read_status(struct dvb_v5_fe_parms_priv *parms,
+			      fe_status_t *status)
+{
+	if (xioctl(parms->fd, FE_READ_STATUS, status) == -1) {
+		dvb_perror("FE_READ_STATUS");
+		return -EINVAL;
+	}
+	dvb_fe_store_stats(parms, DTV_STATUS, FE_SCALE_RELATIVE, 0, *status);
+
+	/* if lock has obtained, get DVB parameters */
+	if (*status != parms->stats.prev_status) {
+		if ((*status & FE_HAS_LOCK) &&
+		    parms->stats.prev_status != *status)
+			dvb_fe_get_parms(&parms->p);
+		parms->stats.prev_status = *status;
+	}
+	return 0;
+}
+
 int __dvb_fe_get_stats(struct dvb_v5_fe_parms *p)
 {
 	struct dvb_v5_fe_parms_priv *parms = (void *)p;
@@ -1448,19 +1486,8 @@ int __dvb_fe_get_stats(struct dvb_v5_fe_parms *p)
 	int i;
 	enum fecap_scale_params scale;
 
-	if (xioctl(parms->fd, FE_READ_STATUS, &status) == -1) {
-		dvb_perror("FE_READ_STATUS");
+	if (dvb_fe_read_status(parms, &status))
 		return -EINVAL;
-	}
-	dvb_fe_store_stats(parms, DTV_STATUS, FE_SCALE_RELATIVE, 0, status);
-
-	/* if lock has obtained, get DVB parameters */
-	if (status != parms->stats.prev_status) {
-		if ((status & FE_HAS_LOCK) &&
-		    parms->stats.prev_status != status)
-			dvb_fe_get_parms(&parms->p);
-		parms->stats.prev_status = status;
-	}
 
 	if (parms->p.has_v5_stats) {
 		struct dtv_properties props;
@@ -1536,6 +1563,66 @@ dvbv3_fallback:
 	return 0;
 }
 
+/* Stats groups, in the order of the DTV_NUM_KERNEL_STATS props */
+static const unsigned int dvb_fe_stats_group[DTV_NUM_KERNEL_STATS] = {
+	DVB_FE_STATS_SIGNAL,
+	DVB_FE_STATS_CNR,
+	DVB_FE_STATS_PRE_BER,
+	DVB_FE_STATS_PRE_BER,
+	DVB_FE_STATS_POST_BER,
+	DVB_FE_STATS_POST_BER,
+	DVB_FE_STATS_PER,
+	DVB_FE_STATS_PER,
+};
+
+int dvb_fe_get_stats_mask(struct dvb_v5_fe_parms *p, unsigned int mask)
+{
+	struct dvb_v5_fe_parms_priv *parms = (void *)p;
+	struct dtv_property prop[DTV_NUM_KERNEL_STATS];
+	struct dtv_properties props;
+	fe_status_t status = 0;
+	int i, n = 0;
+
+	if ((mask & DVB_FE_STATS_ALL) == DVB_FE_STATS_ALL ||
+	    !dvb_fe_is_local(parms) || !p->has_v5_stats)
+		return dvb_fe_get_stats(p);
+
+	if (mask & DVB_FE_STATS_STATUS) {
+		if (dvb_fe_read_status(parms, &status))
+			return -EINVAL;
+	}
+
+	for (i = 0; i < DTV_NUM_KERNEL_STATS; i++) {
+		if (!(mask & dvb_fe_stats_group[i]))
+			continue;
+		memset(&prop[n], 0, sizeof(prop[n]));
+		prop[n++].cmd = parms->stats.prop[i].cmd;
+	}
+	if (!n)
+		return 0;
+
+	props.num = n;
+	props.props = prop;
+	if (ioctl(parms->fd, FE_GET_PROPERTY, &props) == -1) {
+		if (errno == EAGAIN)
+			return 0;
+		dvb_perror("FE_GET_PROPERTY");
+		return -EINVAL;
+	}
+
+	for (i = 0, n = 0; i < DTV_NUM_KERNEL_STATS; i++) {
+		if (!(mask & dvb_fe_stats_group[i]))
+			continue;
+		parms->stats.prop[i].u.st = prop[n++].u.st;
+	}
+
+	if (mask & (DVB_FE_STATS_PRE_BER | DVB_FE_STATS_POST_BER |
+		    DVB_FE_STATS_PER))
+		dvb_fe_update_counters(parms);
+
+	return 0;
+}
+
 
 int dvb_fe_get_event(struct dvb_v5_fe_parms *p)
 {
@@ -1596,6 +1683,282 @@ int dvb_fe_get_event(struct dvb_v5_fe_parms *p)
 	return dvb_fe_get_stats(&parms->p);
 }
 
+/*
+ * Prepared tunes
+ */
+
+struct dvb_fe_tune {
+	fe_delivery_system_t sys;
+
+	/* Snapshot of the cache, restored at tune time */
+	int n_props;
+	struct dtv_property dvb_prop[DTV_MAX_COMMAND];
+
+	/* What to submit at FE_SET_PROPERTY, ending with DTV_TUNE */
+	int direct;
+	struct dtv_property props[DTV_MAX_COMMAND + 2];
+	unsigned int num;
+};
+
+struct dvb_fe_tune *dvb_fe_prepare_tune(struct dvb_v5_fe_parms *p)
+{
+	struct dvb_v5_fe_parms_priv *parms = (void *)p;
+	struct dvb_v5_fe_parms_priv *tmp_parms;
+	struct dvb_fe_tune *tune;
+	uint32_t freq = 0;
+	int n;
+
+	if (!dvb_v5_delivery_system[p->current_sys]) {
+		dvb_logerr(_("delivery system %d is not supported"),
+			   p->current_sys);
+		return NULL;
+	}
+	if (dvb_fe_retrieve_parm(p, DTV_FREQUENCY, &freq) || !freq) {
+		dvb_logerr(_("can't prepare a tune without a frequency"));
+		return NULL;
+	}
+	if (!dvb_fe_is_satellite(p->current_sys) && p->info.frequency_max &&
+	    (freq < p->info.frequency_min || freq > p->info.frequency_max)) {
+		dvb_logerr(_("frequency %u is out of the frontend range"), freq);
+		return NULL;
+	}
+
+	tune = calloc(1, sizeof(*tune));
+	tmp_parms = malloc(sizeof(*tmp_parms));
+	if (!tune || !tmp_parms) {
+		dvb_perror(_("Can't prepare a tune"));
+		free(tune);
+		free(tmp_parms);
+		return NULL;
+	}
+
+	/* Fill the defaults at a copy, as __dvb_fe_set_parms() would do */
+	*tmp_parms = *parms;
+	dvb_setup_delsys_default(&tmp_parms->p);
+
+	tune->sys = p->current_sys;
+	tune->n_props = tmp_parms->n_props;
+	memcpy(tune->dvb_prop, tmp_parms->dvb_prop,
+	       tmp_parms->n_props * sizeof(*tune->dvb_prop));
+
+	/*
+	 * The properties can be submitted as is, without going through
+	 * __dvb_fe_set_parms(), except for satellite, as the LNBf and the
+	 * DiSEqC are driven at every tune.
+	 */
+	tune->direct = dvb_fe_is_local(parms) && !p->legacy_fe &&
+		       !dvb_fe_is_satellite(tune->sys);
+	if (tune->direct) {
+		n = 0;
+		if (p->lna != LNA_AUTO) {
+			tune->props[n].cmd = DTV_LNA;
+			tune->props[n++].u.data = p->lna;
+		}
+		/* Filter out any user DTV_foo property */
+		n += dvb_copy_fe_props(tmp_parms->dvb_prop, tmp_parms->n_props,
+				       &tune->props[n]);
+		tune->props[n++].cmd = DTV_TUNE;
+		tune->num = n;
+	}
+	free(tmp_parms);
+
+	return tune;
+}
+
+void dvb_fe_tune_free(struct dvb_fe_tune *tune)
+{
+	free(tune);
+}
+
+static unsigned int dvb_fe_elapsed_ms(const struct timespec *start)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (now.tv_sec - start->tv_sec) * 1000 +
+	       (now.tv_nsec - start->tv_nsec) / 1000000;
+}
+
+/* Refreshes the stats cache and passes it to the callback */
+static int dvb_fe_lock_stats(struct dvb_v5_fe_parms_priv *parms,
+			     dvb_fe_lock_cb cb, void *priv, uint32_t *status)
+{
+	int ret;
+
+	ret = dvb_fe_get_stats(&parms->p);
+	if (ret < 0)
+		return ret;
+	*status = 0;
+	dvb_fe_retrieve_stats(&parms->p, DTV_STATUS, status);
+	if (cb && cb(&parms->p, priv))
+		return -ECANCELED;
+	return 0;
+}
+
+/*
+ * Waits for a lock with FE_GET_EVENT, waking up every stats_ms to refresh
+ * the stats if there's a callback. Remote frontends don't have the events,
+ * so the status is polled every 20 ms for them, with FE_TIMEDOUT ending
+ * the wait, as the event does.
+ */
+static int __dvb_fe_wait_lock(struct dvb_v5_fe_parms_priv *parms,
+			      const struct timespec *start,
+			      unsigned int timeout_ms, unsigned int stats_ms,
+			      dvb_fe_lock_cb cb, void *priv)
+{
+	struct dvb_frontend_event event;
+	struct pollfd pfd;
+	unsigned int elapsed, next_stats = stats_ms;
+	int local = dvb_fe_is_local(parms);
+	uint32_t status;
+	int ret, wait;
+
+	pfd.fd = parms->fd;
+	pfd.events = POLLPRI;
+
+	for (;;) {
+		if (parms->p.abort)
+			return -EINTR;
+
+		elapsed = dvb_fe_elapsed_ms(start);
+		if (cb && elapsed >= next_stats) {
+			ret = dvb_fe_lock_stats(parms, cb, priv, &status);
+			if (ret < 0)
+				return ret;
+			if (status & FE_HAS_LOCK)
+				return 0;
+			next_stats = elapsed + stats_ms;
+		}
+		if (timeout_ms && elapsed >= timeout_ms)
+			return -ETIMEDOUT;
+
+		wait = local ? -1 : 20;
+		if (timeout_ms && (wait < 0 || (int)(timeout_ms - elapsed) < wait))
+			wait = timeout_ms - elapsed;
+		if (cb && (wait < 0 || (int)(next_stats - elapsed) < wait))
+			wait = next_stats - elapsed;
+
+		if (!local) {
+			usleep(wait * 1000);
+			ret = dvb_fe_lock_stats(parms, NULL, NULL, &status);
+			if (ret < 0)
+				return ret;
+			if (status & FE_HAS_LOCK)
+				break;
+			if (status & FE_TIMEDOUT)
+				return -ETIMEDOUT;
+			continue;
+		}
+
+		ret = poll(&pfd, 1, wait);
+		if (ret < 0) {
+			if (errno == EINTR)
+				return -EINTR;
+			dvb_perror("poll");
+			return -errno;
+		}
+		if (!ret)
+			continue;
+
+		if (ioctl(parms->fd, FE_GET_EVENT, &event) == -1) {
+			/* Some events were lost: just wait for the next */
+			if (errno == EOVERFLOW || errno == EWOULDBLOCK)
+				continue;
+			dvb_perror("FE_GET_EVENT");
+			return -errno;
+		}
+		dvb_fe_store_stats(parms, DTV_STATUS, FE_SCALE_RELATIVE, 0,
+				   event.status);
+		if (event.status & FE_HAS_LOCK)
+			break;
+		if (event.status & FE_TIMEDOUT)
+			return -ETIMEDOUT;
+	}
+
+	/* Let the callback see the stats at the time of the lock */
+	if (cb) {
+		ret = dvb_fe_lock_stats(parms, cb, priv, &status);
+		if (ret < 0)
+			return ret;
+	}
+	return 0;
+}
+
+int dvb_fe_wait_lock(struct dvb_v5_fe_parms *p, unsigned int timeout_ms,
+		     unsigned int stats_ms, dvb_fe_lock_cb cb, void *priv)
+{
+	struct dvb_v5_fe_parms_priv *parms = (void *)p;
+	struct timespec start;
+	uint32_t status;
+	int ret;
+
+	if (cb && !stats_ms) {
+		dvb_logerr(_("a stats period is needed for the callback"));
+		return -EINVAL;
+	}
+
+	/*
+	 * The frontend may have locked before the call, with its events
+	 * already consumed, so check the current status first.
+	 */
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	ret = dvb_fe_lock_stats(parms, cb, priv, &status);
+	if (ret < 0)
+		return ret;
+	if (status & FE_HAS_LOCK)
+		return 0;
+
+	return __dvb_fe_wait_lock(parms, &start, timeout_ms, stats_ms,
+				  cb, priv);
+}
+
+int dvb_fe_tune(struct dvb_v5_fe_parms *p, struct dvb_fe_tune *tune,
+		unsigned int timeout_ms, unsigned int *lock_ms)
+{
+	struct dvb_v5_fe_parms_priv *parms = (void *)p;
+	struct dtv_properties prop;
+	struct timespec start;
+	int ret;
+
+	if (tune->sys != p->current_sys) {
+		ret = dvb_set_sys(p, tune->sys);
+		if (ret < 0)
+			return ret;
+	}
+
+	/* Make the cache reflect the channel being tuned */
+	parms->n_props = tune->n_props;
+	memcpy(parms->dvb_prop, tune->dvb_prop,
+	       tune->n_props * sizeof(*parms->dvb_prop));
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	if (tune->direct) {
+		prop.num = tune->num;
+		prop.props = tune->props;
+		if (xioctl(parms->fd, FE_SET_PROPERTY, &prop) == -1) {
+			dvb_perror("FE_SET_PROPERTY");
+			return -errno;
+		}
+	} else {
+		ret = dvb_fe_set_parms(p);
+		if (ret < 0)
+			return ret;
+	}
+
+	ret = __dvb_fe_wait_lock(parms, &start, timeout_ms, 0, NULL, NULL);
+
+	if (!ret && lock_ms)
+		*lock_ms = dvb_fe_elapsed_ms(&start);
+	if (p->verbose) {
+		if (!ret)
+			dvb_logdbg(_("Locked after %u ms"), dvb_fe_elapsed_ms(&start));
+		else if (ret == -ETIMEDOUT)
+			dvb_logdbg(_("No lock after %u ms"), timeout_ms);
+	}
+
+	return ret;
+}
+
 struct metric_prefixes {
 	int multiply_factor;
 	char *symbol;
@@ -1866,6 +2229,8 @@ int dvb_fe_sec_voltage(struct dvb_v5_fe_parms *p, int on, int v18)
 	}
 	rc = xioctl(parms->fd, FE_SET_VOLTAGE, v);
 	if (rc == -1) {
+		parms->sec.has_voltage = 0;
+		parms->sec.has_input = 0;
 		if (errno == ENOTSUP) {
 			dvb_logerr("FE_SET_VOLTAGE: driver doesn't support it!");
 		} else {
@@ -1873,6 +2238,12 @@ int dvb_fe_sec_voltage(struct dvb_v5_fe_parms *p, int on, int v18)
 		}
 		return -errno;
 	}
+	parms->sec.has_voltage = 1;
+	parms->sec.voltage = v;
+
+	/* Without power, the switches lose their state */
+	if (v == SEC_VOLTAGE_OFF)
+		parms->sec.has_input = 0;
 	return rc;
 }
 
@@ -1884,9 +2255,12 @@ int dvb_fe_sec_tone(struct dvb_v5_fe_parms *p, fe_sec_tone_mode_t tone)
 		dvb_log( _("DiSEqC TONE: %s"), fe_tone_name[tone] );
 	rc = xioctl(parms->fd, FE_SET_TONE, tone);
 	if (rc == -1) {
+		parms->sec.has_tone = 0;
 		dvb_perror("FE_SET_TONE");
 		return -errno;
 	}
+	parms->sec.has_tone = 1;
+	parms->sec.tone = tone;
 	return rc;
 }
 
@@ -1913,6 +2287,7 @@ int dvb_fe_diseqc_burst(struct dvb_v5_fe_parms *p, int mini_b)
 	int rc;
 
 	mini = mini_b ? SEC_MINI_B : SEC_MINI_A;
+	parms->sec.has_input = 0;
 
 	if (parms->p.verbose)
 		dvb_log( _("DiSEqC BURST: %s"), mini_b ? "SEC_MINI_B" : "SEC_MINI_A" );
@@ -1936,6 +2311,7 @@ int dvb_fe_diseqc_cmd(struct dvb_v5_fe_parms *p, const unsigned len,
 
 	msg.msg_len = len;
 	memcpy(msg.msg, buf, len);
+	parms->sec.has_input = 0;
 
 	if (parms->p.verbose) {
 		int i;
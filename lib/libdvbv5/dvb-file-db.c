@@ -0,0 +1,679 @@
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation version 2.1 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ * Or, point your browser to http://www.gnu.org/licenses/old-licenses/gpl-2.0.html
+ */
+
+/*
+ * Compiled channel database
+ *
+ * The file is meant to be mapped into memory and used as is: it starts
+ * with a header, followed by an array of fixed-size entry records, three
+ * hash tables (by channel name, by virtual channel and by service ID),
+ * a string area and a data area with the properties and PIDs. All offsets
+ * are in bytes from the start of the file, except for the ones inside an
+ * entry record, that are relative to the string or to the data area.
+ *
+ * The values are stored in the byte order of the machine that compiled
+ * the file, as the database is a cache of a channel file and not an
+ * interchange format. Files with another byte order or version are
+ * refused.
+ *
+ * The hash tables use open addressing with linear probing. Each slot
+ * stores the index of the entry plus one, or zero if the slot is empty.
+ * As the entries are inserted in file order, the entries with the same
+ * key are found in file order while probing.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <libdvbv5/dvb-file.h>
+
+#include <config.h>
+
+#ifdef ENABLE_NLS
+# include "gettext.h"
+# include <libintl.h>
+# define _(string) dgettext(LIBDVBV5_DOMAIN, string)
+
+#else
+# define _(string) string
+#endif
+
+# define N_(string) string
+
+#define DVB_FILE_DB_MAGIC	"DVBV5DB"
+#define DVB_FILE_DB_BYTE_ORDER	0x01020304
+#define DVB_FILE_DB_VERSION	1
+
+struct dvb_file_db_header {
+	char magic[8];
+	uint32_t byte_order;
+	uint32_t version;
+	uint32_t n_entries;
+	uint32_t hash_size;
+	uint32_t entries;
+	uint32_t channel_hash;
+	uint32_t vchannel_hash;
+	uint32_t service_hash;
+	uint32_t strings;
+	uint32_t strings_size;
+	uint32_t data;
+	uint32_t data_size;	/* In 32 bits words */
+};
+
+/* String offsets are zero for no string, data offsets are in words */
+struct dvb_file_db_entry {
+	uint32_t channel, vchannel, location, lnb;
+	uint32_t props, n_props;
+	uint32_t video_pid, video_pid_len;
+	uint32_t audio_pid, audio_pid_len;
+	uint32_t other_el_pid, other_el_pid_len;
+	int32_t sat_number;
+	uint32_t freq_bpf;
+	uint32_t diseqc_wait;
+	uint16_t service_id;
+	uint16_t network_id;
+	uint16_t transport_id;
+	uint16_t reserved;
+};
+
+struct dvb_file_db {
+	void *map;
+	size_t size;
+	const struct dvb_file_db_header *hdr;
+	const struct dvb_file_db_entry *entries;
+	const uint32_t *channel_hash, *vchannel_hash, *service_hash;
+	const char *strings;
+	const uint32_t *data;
+};
+
+static uint32_t dvb_file_db_hash_str(const char *s)
+{
+	uint32_t h = 2166136261u;
+
+	while (*s) {
+		h ^= (uint8_t)*s++;
+		h *= 16777619u;
+	}
+	return h;
+}
+
+static uint32_t dvb_file_db_hash_sid(uint16_t service_id)
+{
+	return service_id * 2654435761u;
+}
+
+/*
+ * Write side
+ */
+
+struct dvb_file_db_buf {
+	char *buf;
+	size_t len, size;
+};
+
+static int dvb_file_db_buf_add(struct dvb_file_db_buf *b, const void *p,
+			       size_t len, uint32_t *off)
+{
+	if (b->len + len > b->size) {
+		size_t size = b->size ? b->size : 4096;
+		char *buf;
+
+		while (size < b->len + len)
+			size *= 2;
+		buf = realloc(b->buf, size);
+		if (!buf)
+			return -ENOMEM;
+		b->buf = buf;
+		b->size = size;
+	}
+	*off = b->len;
+	memcpy(b->buf + b->len, p, len);
+	b->len += len;
+	return 0;
+}
+
+static int dvb_file_db_add_str(struct dvb_file_db_buf *b, const char *s,
+			       uint32_t *off)
+{
+	if (!s) {
+		*off = 0;
+		return 0;
+	}
+	return dvb_file_db_buf_add(b, s, strlen(s) + 1, off);
+}
+
+static int dvb_file_db_add_words(struct dvb_file_db_buf *b, const uint32_t *w,
+				 unsigned n, uint32_t *off)
+{
+	int ret;
+
+	if (!n) {
+		*off = 0;
+		return 0;
+	}
+	ret = dvb_file_db_buf_add(b, w, n * sizeof(*w), off);
+	*off /= sizeof(*w);
+	return ret;
+}
+
+static int dvb_file_db_add_pids(struct dvb_file_db_buf *b, const uint16_t *pid,
+				unsigned n, uint32_t *off)
+{
+	uint32_t w, o;
+	unsigned i;
+
+	*off = 0;
+	for (i = 0; i < n; i++) {
+		w = pid[i];
+		if (dvb_file_db_buf_add(b, &w, sizeof(w), &o) < 0)
+			return -ENOMEM;
+		if (!i)
+			*off = o / sizeof(w);
+	}
+	return 0;
+}
+
+static void dvb_file_db_hash_insert(uint32_t *table, uint32_t hash_size,
+				    uint32_t hash, uint32_t idx)
+{
+	uint32_t slot = hash & (hash_size - 1);
+
+	while (table[slot])
+		slot = (slot + 1) & (hash_size - 1);
+	table[slot] = idx + 1;
+}
+
+int dvb_write_file_db(const char *fname, struct dvb_file *dvb_file)
+{
+	struct dvb_file_db_header hdr = { DVB_FILE_DB_MAGIC };
+	struct dvb_file_db_buf strings = { 0 }, data = { 0 };
+	struct dvb_file_db_entry *entries = NULL;
+	struct dvb_entry *entry;
+	uint32_t *hash = NULL, words[2 * DTV_MAX_COMMAND];
+	uint32_t n = 0, hash_size = 16, off, i, j;
+	size_t hash_bytes;
+	FILE *fp = NULL;
+	int ret = -ENOMEM;
+
+	for (entry = dvb_file->first_entry; entry; entry = entry->next)
+		n++;
+	while (hash_size < 2 * n)
+		hash_size *= 2;
+
+	entries = calloc(n ? n : 1, sizeof(*entries));
+	hash_bytes = hash_size * sizeof(*hash);
+	hash = calloc(3, hash_bytes);
+	if (!entries || !hash)
+		goto error;
+
+	/* Offset zero is reserved for "no string" */
+	if (dvb_file_db_buf_add(&strings, "", 1, &off) < 0)
+		goto error;
+
+	for (i = 0, entry = dvb_file->first_entry; entry; entry = entry->next, i++) {
+		struct dvb_file_db_entry *e = &entries[i];
+
+		if (dvb_file_db_add_str(&strings, entry->channel, &e->channel) < 0 ||
+		    dvb_file_db_add_str(&strings, entry->vchannel, &e->vchannel) < 0 ||
+		    dvb_file_db_add_str(&strings, entry->location, &e->location) < 0 ||
+		    dvb_file_db_add_str(&strings, entry->lnb, &e->lnb) < 0)
+			goto error;
+
+		e->n_props = entry->n_props;
+		for (j = 0; j < entry->n_props; j++) {
+			words[2 * j] = entry->props[j].cmd;
+			words[2 * j + 1] = entry->props[j].u.data;
+		}
+		if (dvb_file_db_add_words(&data, words, 2 * e->n_props, &e->props) < 0)
+			goto error;
+
+		e->video_pid_len = entry->video_pid_len;
+		if (dvb_file_db_add_pids(&data, entry->video_pid,
+					 entry->video_pid_len, &e->video_pid) < 0)
+			goto error;
+
+		e->audio_pid_len = entry->audio_pid_len;
+		if (dvb_file_db_add_pids(&data, entry->audio_pid,
+					 entry->audio_pid_len, &e->audio_pid) < 0)
+			goto error;
+
+		/* Each element is stored as type << 16 | pid */
+		e->other_el_pid_len = entry->other_el_pid_len;
+		e->other_el_pid = 0;
+		for (j = 0; j < entry->other_el_pid_len; j++) {
+			words[0] = entry->other_el_pid[j].type << 16 |
+				   entry->other_el_pid[j].pid;
+			if (dvb_file_db_buf_add(&data, words, sizeof(words[0]), &off) < 0)
+				goto error;
+			if (!j)
+				e->other_el_pid = off / sizeof(words[0]);
+		}
+
+		e->sat_number = entry->sat_number;
+		e->freq_bpf = entry->freq_bpf;
+		e->diseqc_wait = entry->diseqc_wait;
+		e->service_id = entry->service_id;
+		e->network_id = entry->network_id;
+		e->transport_id = entry->transport_id;
+
+		if (entry->channel)
+			dvb_file_db_hash_insert(hash, hash_size,
+						dvb_file_db_hash_str(entry->channel), i);
+		if (entry->vchannel)
+			dvb_file_db_hash_insert(hash + hash_size, hash_size,
+						dvb_file_db_hash_str(entry->vchannel), i);
+		dvb_file_db_hash_insert(hash + 2 * hash_size, hash_size,
+					dvb_file_db_hash_sid(entry->service_id), i);
+	}
+
+	/* Keeps the data area aligned for the 32 bits accesses */
+	while (strings.len & 3)
+		if (dvb_file_db_buf_add(&strings, "", 1, &off) < 0)
+			goto error;
+
+	hdr.byte_order = DVB_FILE_DB_BYTE_ORDER;
+	hdr.version = DVB_FILE_DB_VERSION;
+	hdr.n_entries = n;
+	hdr.hash_size = hash_size;
+	hdr.entries = sizeof(hdr);
+	hdr.channel_hash = hdr.entries + n * sizeof(*entries);
+	hdr.vchannel_hash = hdr.channel_hash + hash_bytes;
+	hdr.service_hash = hdr.vchannel_hash + hash_bytes;
+	hdr.strings = hdr.service_hash + hash_bytes;
+	hdr.strings_size = strings.len;
+	hdr.data = hdr.strings + strings.len;
+	hdr.data_size = data.len / sizeof(uint32_t);
+
+	fp = fopen(fname, "w");
+	if (!fp) {
+		ret = -errno;
+		perror(fname);
+		goto error;
+	}
+	if (fwrite(&hdr, sizeof(hdr), 1, fp) != 1 ||
+	    (n && fwrite(entries, n * sizeof(*entries), 1, fp) != 1) ||
+	    fwrite(hash, 3 * hash_bytes, 1, fp) != 1 ||
+	    fwrite(strings.buf, strings.len, 1, fp) != 1 ||
+	    (data.len && fwrite(data.buf, data.len, 1, fp) != 1)) {
+		ret = -EIO;
+		perror(fname);
+		goto error;
+	}
+	ret = 0;
+
+error:
+	if (fp && fclose(fp) && !ret) {
+		ret = -errno;
+		perror(fname);
+	}
+	free(data.buf);
+	free(strings.buf);
+	free(hash);
+	free(entries);
+	return ret;
+}
+
+/*
+ * Read side
+ */
+
+static int dvb_file_db_check_area(const struct dvb_file_db *db,
+				  uint32_t off, size_t size)
+{
+	return !(off & 3) && off <= db->size && size <= db->size - off;
+}
+
+struct dvb_file_db *dvb_file_db_open(const char *fname)
+{
+	const struct dvb_file_db_header *hdr;
+	struct dvb_file_db *db;
+	size_t hash_bytes;
+	struct stat st;
+	uint32_t i;
+	int fd;
+
+	db = calloc(1, sizeof(*db));
+	if (!db)
+		return NULL;
+
+	fd = open(fname, O_RDONLY | O_CLOEXEC);
+	if (fd < 0) {
+		perror(fname);
+		free(db);
+		return NULL;
+	}
+	if (fstat(fd, &st) < 0) {
+		perror(fname);
+		close(fd);
+		free(db);
+		return NULL;
+	}
+	if (st.st_size < sizeof(*hdr)) {
+		fprintf(stderr, _("%s: not a channel database\n"), fname);
+		close(fd);
+		free(db);
+		return NULL;
+	}
+	db->size = st.st_size;
+	db->map = mmap(NULL, db->size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (db->map == MAP_FAILED) {
+		perror(fname);
+		free(db);
+		return NULL;
+	}
+	hdr = db->hdr = db->map;
+
+	if (memcmp(hdr->magic, DVB_FILE_DB_MAGIC, sizeof(hdr->magic))) {
+		fprintf(stderr, _("%s: not a channel database\n"), fname);
+		goto error;
+	}
+	if (hdr->byte_order != DVB_FILE_DB_BYTE_ORDER ||
+	    hdr->version != DVB_FILE_DB_VERSION) {
+		fprintf(stderr, _("%s: channel database version or byte order not supported\n"),
+			fname);
+		goto error;
+	}
+
+	/* A non-zero hash_size of at least 2 * n_entries is > n_entries too */
+	hash_bytes = (size_t)hdr->hash_size * sizeof(uint32_t);
+	if (!hdr->hash_size ||
+	    hdr->hash_size < 2 * (uint64_t)hdr->n_entries ||
+	    hdr->hash_size & (hdr->hash_size - 1) ||
+	    !dvb_file_db_check_area(db, hdr->entries,
+				    (size_t)hdr->n_entries * sizeof(*db->entries)) ||
+	    !dvb_file_db_check_area(db, hdr->channel_hash, hash_bytes) ||
+	    !dvb_file_db_check_area(db, hdr->vchannel_hash, hash_bytes) ||
+	    !dvb_file_db_check_area(db, hdr->service_hash, hash_bytes) ||
+	    !hdr->strings_size ||
+	    !dvb_file_db_check_area(db, hdr->strings, hdr->strings_size) ||
+	    !dvb_file_db_check_area(db, hdr->data,
+				    (size_t)hdr->data_size * sizeof(uint32_t)))
+		goto corrupted;
+
+	db->entries = (const void *)((const char *)db->map + hdr->entries);
+	db->channel_hash = (const void *)((const char *)db->map + hdr->channel_hash);
+	db->vchannel_hash = (const void *)((const char *)db->map + hdr->vchannel_hash);
+	db->service_hash = (const void *)((const char *)db->map + hdr->service_hash);
+	db->strings = (const char *)db->map + hdr->strings;
+	db->data = (const void *)((const char *)db->map + hdr->data);
+
+	/*
+	 * The string area ends with a NUL, so any offset inside it is a
+	 * valid string. Check the offsets once here, so that the lookups
+	 * don't need to.
+	 */
+	if (db->strings[hdr->strings_size - 1])
+		goto corrupted;
+	for (i = 0; i < hdr->n_entries; i++) {
+		const struct dvb_file_db_entry *e = &db->entries[i];
+
+		if (e->channel >= hdr->strings_size ||
+		    e->vchannel >= hdr->strings_size ||
+		    e->location >= hdr->strings_size ||
+		    e->lnb >= hdr->strings_size ||
+		    e->n_props > DTV_MAX_COMMAND ||
+		    e->props > hdr->data_size ||
+		    2 * e->n_props > hdr->data_size - e->props ||
+		    e->video_pid > hdr->data_size ||
+		    e->video_pid_len > hdr->data_size - e->video_pid ||
+		    e->audio_pid > hdr->data_size ||
+		    e->audio_pid_len > hdr->data_size - e->audio_pid ||
+		    e->other_el_pid > hdr->data_size ||
+		    e->other_el_pid_len > hdr->data_size - e->other_el_pid)
+			goto corrupted;
+	}
+	for (i = 0; i < hdr->hash_size; i++)
+		if (db->channel_hash[i] > hdr->n_entries ||
+		    db->vchannel_hash[i] > hdr->n_entries ||
+		    db->service_hash[i] > hdr->n_entries)
+			goto corrupted;
+
+	return db;
+
+corrupted:
+	fprintf(stderr, _("%s: channel database is corrupted\n"), fname);
+error:
+	munmap(db->map, db->size);
+	free(db);
+	return NULL;
+}
+
+void dvb_file_db_close(struct dvb_file_db *db)
+{
+	if (!db)
+		return;
+	munmap(db->map, db->size);
+	free(db);
+}
+
+int dvb_file_db_num_entries(struct dvb_file_db *db)
+{
+	return db->hdr->n_entries;
+}
+
+static const char *dvb_file_db_str(struct dvb_file_db *db, uint32_t off)
+{
+	return off ? db->strings + off : NULL;
+}
+
+static int dvb_file_db_find_str(struct dvb_file_db *db, const uint32_t *table,
+				int vchannel, const char *name, int prev)
+{
+	uint32_t mask = db->hdr->hash_size - 1;
+	uint32_t slot = dvb_file_db_hash_str(name) & mask;
+	uint32_t idx, n;
+
+	/* A corrupted table may have no empty slot, so probe each one once */
+	for (n = 0; n < db->hdr->hash_size; n++) {
+		const struct dvb_file_db_entry *e;
+		const char *s;
+
+		idx = table[slot];
+		if (!idx || idx > db->hdr->n_entries)
+			break;
+		e = &db->entries[idx - 1];
+		s = dvb_file_db_str(db, vchannel ? e->vchannel : e->channel);
+		if ((int)idx - 1 > prev && s && !strcmp(s, name))
+			return idx - 1;
+		slot = (slot + 1) & mask;
+	}
+	return -1;
+}
+
+int dvb_file_db_find_channel(struct dvb_file_db *db, const char *channel,
+			     int prev)
+{
+	return dvb_file_db_find_str(db, db->channel_hash, 0, channel, prev);
+}
+
+int dvb_file_db_find_vchannel(struct dvb_file_db *db, const char *vchannel,
+			      int prev)
+{
+	return dvb_file_db_find_str(db, db->vchannel_hash, 1, vchannel, prev);
+}
+
+int dvb_file_db_find_service(struct dvb_file_db *db, uint16_t service_id,
+			     int prev)
+{
+	uint32_t mask = db->hdr->hash_size - 1;
+	uint32_t slot = dvb_file_db_hash_sid(service_id) & mask;
+	uint32_t idx, n;
+
+	for (n = 0; n < db->hdr->hash_size; n++) {
+		idx = db->service_hash[slot];
+		if (!idx || idx > db->hdr->n_entries)
+			break;
+		if ((int)idx - 1 > prev &&
+		    db->entries[idx - 1].service_id == service_id)
+			return idx - 1;
+		slot = (slot + 1) & mask;
+	}
+	return -1;
+}
+
+static char *dvb_file_db_strdup(struct dvb_file_db *db, uint32_t off,
+				int *err)
+{
+	char *s;
+
+	if (!off)
+		return NULL;
+	s = strdup(db->strings + off);
+	if (!s)
+		*err = 1;
+	return s;
+}
+
+static struct dvb_entry *dvb_file_db_entry(struct dvb_file_db *db, int index)
+{
+	const struct dvb_file_db_entry *e = &db->entries[index];
+	struct dvb_entry *entry;
+	const uint32_t *w;
+	int err = 0;
+	unsigned i;
+
+	entry = calloc(1, sizeof(*entry));
+	if (!entry)
+		return NULL;
+
+	entry->channel = dvb_file_db_strdup(db, e->channel, &err);
+	entry->vchannel = dvb_file_db_strdup(db, e->vchannel, &err);
+	entry->location = dvb_file_db_strdup(db, e->location, &err);
+	entry->lnb = dvb_file_db_strdup(db, e->lnb, &err);
+
+	entry->n_props = e->n_props;
+	w = db->data + e->props;
+	for (i = 0; i < e->n_props; i++) {
+		entry->props[i].cmd = w[2 * i];
+		entry->props[i].u.data = w[2 * i + 1];
+	}
+
+	if (e->video_pid_len) {
+		entry->video_pid = calloc(e->video_pid_len, sizeof(*entry->video_pid));
+		if (entry->video_pid) {
+			entry->video_pid_len = e->video_pid_len;
+			w = db->data + e->video_pid;
+			for (i = 0; i < e->video_pid_len; i++)
+				entry->video_pid[i] = w[i];
+		} else {
+			err = 1;
+		}
+	}
+	if (e->audio_pid_len) {
+		entry->audio_pid = calloc(e->audio_pid_len, sizeof(*entry->audio_pid));
+		if (entry->audio_pid) {
+			entry->audio_pid_len = e->audio_pid_len;
+			w = db->data + e->audio_pid;
+			for (i = 0; i < e->audio_pid_len; i++)
+				entry->audio_pid[i] = w[i];
+		} else {
+			err = 1;
+		}
+	}
+	if (e->other_el_pid_len) {
+		entry->other_el_pid = calloc(e->other_el_pid_len,
+					     sizeof(*entry->other_el_pid));
+		if (entry->other_el_pid) {
+			entry->other_el_pid_len = e->other_el_pid_len;
+			w = db->data + e->other_el_pid;
+			for (i = 0; i < e->other_el_pid_len; i++) {
+				entry->other_el_pid[i].type = w[i] >> 16;
+				entry->other_el_pid[i].pid = w[i] & 0xffff;
+			}
+		} else {
+			err = 1;
+		}
+	}
+
+	entry->sat_number = e->sat_number;
+	entry->freq_bpf = e->freq_bpf;
+	entry->diseqc_wait = e->diseqc_wait;
+	entry->service_id = e->service_id;
+	entry->network_id = e->network_id;
+	entry->transport_id = e->transport_id;
+
+	if (err) {
+		free(entry->channel);
+		free(entry->vchannel);
+		free(entry->location);
+		free(entry->lnb);
+		free(entry->video_pid);
+		free(entry->audio_pid);
+		free(entry->other_el_pid);
+		free(entry);
+		return NULL;
+	}
+	return entry;
+}
+
+struct dvb_file *dvb_file_db_get(struct dvb_file_db *db, int index)
+{
+	struct dvb_file *dvb_file;
+
+	if (index < 0 || index >= db->hdr->n_entries)
+		return NULL;
+
+	dvb_file = calloc(1, sizeof(*dvb_file));
+	if (!dvb_file)
+		return NULL;
+	dvb_file->first_entry = dvb_file_db_entry(db, index);
+	if (!dvb_file->first_entry) {
+		free(dvb_file);
+		return NULL;
+	}
+	dvb_file->n_entries = 1;
+	return dvb_file;
+}
+
+struct dvb_file *dvb_read_file_db(const char *fname)
+{
+	struct dvb_entry *entry, **tail;
+	struct dvb_file *dvb_file;
+	struct dvb_file_db *db;
+	int i;
+
+	db = dvb_file_db_open(fname);
+	if (!db)
+		return NULL;
+
+	dvb_file = calloc(1, sizeof(*dvb_file));
+	if (!dvb_file) {
+		dvb_file_db_close(db);
+		return NULL;
+	}
+	tail = &dvb_file->first_entry;
+	for (i = 0; i < db->hdr->n_entries; i++) {
+		entry = dvb_file_db_entry(db, i);
+		if (!entry) {
+			fprintf(stderr, _("Not enough memory\n"));
+			dvb_file_free(dvb_file);
+			dvb_file_db_close(db);
+			return NULL;
+		}
+		*tail = entry;
+		tail = &entry->next;
+		dvb_file->n_entries++;
+	}
+	dvb_file_db_close(db);
+	return dvb_file;
+}
@@ -0,0 +1,34 @@
+/*
+ * Copyright (c) 2011-2012 - Mauro Carvalho Chehab
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation version 2.1 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ * Or, point your browser to http://www.gnu.org/licenses/old-licenses/gpl-2.0.html
+ *
+ */
+
+#ifndef __DVB_FILE_PRIV_H
+#define __DVB_FILE_PRIV_H
+
+#include <stdio.h>
+#include <libdvbv5/dvb-file.h>
+
+/*
+ * Writes one entry at VDR format. Returns zero if the entry was written,
+ * 1 if VDR can't represent it and it was skipped, or -1 on error. Line is
+ * the number of entries written so far, used on the messages.
+ */
+int dvb_write_entry_vdr(FILE *fp, struct dvb_entry *entry,
+			const char *fname, int line);
+
+#endif
@@ -21,9 +21,11 @@
 #include <stdlib.h>
 #include <string.h>
 #include <strings.h> /* strcasecmp */
+#include <errno.h>
 #include <unistd.h>
 
 #include "dvb-fe-priv.h"
+#include "dvb-file-priv.h"
 #include <libdvbv5/dvb-file.h>
 #include <libdvbv5/dvb-v5-std.h>
 #include <libdvbv5/dvb-scan.h>
@@ -218,175 +220,124 @@ static void adjust_delsys(struct dvb_entry *entry)
  * Generic parse function for all formats each channel is contained into
  * just one line.
  */
-struct dvb_file *dvb_parse_format_oneline(const char *fname,
-					  uint32_t delsys,
-					  const struct dvb_parse_file *parse_file)
+static int parse_oneline_entry(struct dvb_entry *entry, char *p,
+			       uint32_t delsys,
+			       const struct dvb_parse_file *parse_file,
+			       char *err_msg)
 {
 	const char *delimiter = parse_file->delimiter;
 	const struct dvb_parse_struct *formats = parse_file->formats;
-	char *buf = NULL, *p;
-	size_t size = 0;
-	int len = 0;
-	int i, j, line = 0;
-	struct dvb_file *dvb_file;
-	FILE *fd;
 	const struct dvb_parse_struct *fmt;
-	struct dvb_entry *entry = NULL;
 	const struct dvb_parse_table *table;
-	char err_msg[80];
-	int has_inversion;
-
-	dvb_file = calloc(sizeof(*dvb_file), 1);
-	if (!dvb_file) {
-		perror(_("Allocating memory for dvb_file"));
-		return NULL;
-	}
+	char *line = p, *saveptr = NULL;
+	int i, j, has_inversion;
+
+	if (parse_file->has_delsys_id) {
+		p = strtok_r(p, delimiter, &saveptr);
+		if (!p) {
+			sprintf(err_msg, _("unknown delivery system type for %s"),
+				line);
+			return -1;
+		}
 
-	fd = fopen(fname, "r");
-	if (!fd) {
-		perror(fname);
-		free(dvb_file);
-		return NULL;
+		/* Parse the type of the delivery system */
+		for (i = 0; formats[i].id != NULL; i++) {
+			if (!strcmp(p, formats[i].id))
+				break;
+		}
+		if (!formats[i].id) {
+			sprintf(err_msg, _("Doesn't know how to handle delimiter '%s'"),
+				p);
+			return -1;
+		}
+	} else {
+		/* Seek for the delivery system */
+		for (i = 0; formats[i].delsys != 0; i++) {
+			if (formats[i].delsys == delsys)
+				break;
+		}
+		if (!formats[i].delsys) {
+			sprintf(err_msg, _("Doesn't know how to parse delivery system %d"),
+				delsys);
+			return -1;
+		}
 	}
 
-	do {
-		len = getline(&buf, &size, fd);
-		if (len <= 0)
-			break;
-		line++;
-
-		p = buf;
-		while (*p == ' ')
-			p++;
-		if (*p == '\n' || *p == '#' || *p == '\a' || *p == '\0')
-			continue;
-
-		if (parse_file->has_delsys_id) {
-			p = strtok(p, delimiter);
-			if (!p) {
-				sprintf(err_msg, _("unknown delivery system type for %s"),
-					p);
-				goto error;
-			}
-
-			/* Parse the type of the delivery system */
-			for (i = 0; formats[i].id != NULL; i++) {
-				if (!strcmp(p, formats[i].id))
-					break;
-			}
-			if (!formats[i].id) {
-				sprintf(err_msg, _("Doesn't know how to handle delimiter '%s'"),
-					p);
-				goto error;
-			}
-		} else {
-			/* Seek for the delivery system */
-			for (i = 0; formats[i].delsys != 0; i++) {
-				if (formats[i].delsys == delsys)
+	fmt = &formats[i];
+	entry->sat_number = -1;
+	entry->props[entry->n_props].cmd = DTV_DELIVERY_SYSTEM;
+	entry->props[entry->n_props++].u.data = fmt->delsys;
+	has_inversion = 0;
+	for (i = 0; i < fmt->size; i++) {
+		table = &fmt->table[i];
+		if (delsys && !i) {
+			p = strtok_r(p, delimiter, &saveptr);
+		} else
+			p = strtok_r(NULL, delimiter, &saveptr);
+		if (p && *p == '#')
+			p = NULL;
+		if (!p && !fmt->table[i].has_default_value) {
+			sprintf(err_msg, _("parameter %i (%s) missing"),
+				i, dvb_cmd_name(table->prop));
+			return -1;
+		}
+		if (p && table->size) {
+			for (j = 0; j < table->size; j++)
+				if (!table->table[j] || !strcasecmp(table->table[j], p))
 					break;
+			if (j == table->size) {
+				sprintf(err_msg, _("parameter %s invalid: %s"),
+					dvb_cmd_name(table->prop), p);
+				return -1;
 			}
-			if (!formats[i].delsys) {
-				sprintf(err_msg, _("Doesn't know how to parse delivery system %d"),
-					delsys);
-				goto error;
-			}
-		}
-
-
-		fmt = &formats[i];
-		if (!entry) {
-			dvb_file->first_entry = calloc(sizeof(*entry), 1);
-			entry = dvb_file->first_entry;
+			if (table->prop == DTV_BANDWIDTH_HZ)
+				j = fe_bandwidth_name[j];
+			entry->props[entry->n_props].cmd = table->prop;
+			entry->props[entry->n_props++].u.data = j;
 		} else {
-			entry->next = calloc(sizeof(*entry), 1);
-			entry = entry->next;
-		}
-		entry->sat_number = -1;
-		entry->props[entry->n_props].cmd = DTV_DELIVERY_SYSTEM;
-		entry->props[entry->n_props++].u.data = fmt->delsys;
-		has_inversion = 0;
-		for (i = 0; i < fmt->size; i++) {
-			table = &fmt->table[i];
-			if (delsys && !i) {
-				p = strtok(p, delimiter);
-			} else
-				p = strtok(NULL, delimiter);
-			if (p && *p == '#')
-				p = NULL;
-			if (!p && !fmt->table[i].has_default_value) {
-				sprintf(err_msg, _("parameter %i (%s) missing"),
-					i, dvb_cmd_name(table->prop));
-				goto error;
-			}
-			if (p && table->size) {
-				for (j = 0; j < table->size; j++)
-					if (!table->table[j] || !strcasecmp(table->table[j], p))
-						break;
-				if (j == table->size) {
-					sprintf(err_msg, _("parameter %s invalid: %s"),
-						dvb_cmd_name(table->prop), p);
-					goto error;
-				}
-				if (table->prop == DTV_BANDWIDTH_HZ)
-					j = fe_bandwidth_name[j];
-				entry->props[entry->n_props].cmd = table->prop;
-                                entry->props[entry->n_props++].u.data = j;
-			} else {
-				long v;
+			long v;
 
-				if (!p)
-					v = fmt->table[i].default_value;
-				else
-					v = atol(p);
+			if (!p)
+				v = fmt->table[i].default_value;
+			else
+				v = atol(p);
 
-				if (table->mult_factor)
-					v *= table->mult_factor;
+			if (table->mult_factor)
+				v *= table->mult_factor;
 
-				switch (table->prop) {
-				case DTV_VIDEO_PID:
-					entry->video_pid = calloc(sizeof(*entry->video_pid), 1);
-					entry->video_pid_len = 1;
-					entry->video_pid[0] = v;
-					break;
-				case DTV_AUDIO_PID:
-					entry->audio_pid = calloc(sizeof(*entry->audio_pid), 1);
-					entry->audio_pid_len = 1;
-					entry->audio_pid[0] = v;
-					break;
-				case DTV_SERVICE_ID:
-					entry->service_id = v;
-					break;
-				case DTV_CH_NAME:
-					entry->channel = calloc(strlen(p) + 1, 1);
-					strcpy(entry->channel, p);
-					break;
-				default:
-					entry->props[entry->n_props].cmd = table->prop;
-					entry->props[entry->n_props++].u.data = v;
-				}
+			switch (table->prop) {
+			case DTV_VIDEO_PID:
+				entry->video_pid = calloc(sizeof(*entry->video_pid), 1);
+				entry->video_pid_len = 1;
+				entry->video_pid[0] = v;
+				break;
+			case DTV_AUDIO_PID:
+				entry->audio_pid = calloc(sizeof(*entry->audio_pid), 1);
+				entry->audio_pid_len = 1;
+				entry->audio_pid[0] = v;
+				break;
+			case DTV_SERVICE_ID:
+				entry->service_id = v;
+				break;
+			case DTV_CH_NAME:
+				entry->channel = calloc(strlen(p) + 1, 1);
+				strcpy(entry->channel, p);
+				break;
+			default:
+				entry->props[entry->n_props].cmd = table->prop;
+				entry->props[entry->n_props++].u.data = v;
 			}
-			if (table->prop == DTV_INVERSION)
-				has_inversion = 1;
-		}
-		if (!has_inversion) {
-			entry->props[entry->n_props].cmd = DTV_INVERSION;
-			entry->props[entry->n_props++].u.data = INVERSION_AUTO;
 		}
-		adjust_delsys(entry);
-	} while (1);
-	fclose(fd);
-	if (buf)
-		free(buf);
-	return dvb_file;
+		if (table->prop == DTV_INVERSION)
+			has_inversion = 1;
+	}
+	if (!has_inversion) {
+		entry->props[entry->n_props].cmd = DTV_INVERSION;
+		entry->props[entry->n_props++].u.data = INVERSION_AUTO;
+	}
+	adjust_delsys(entry);
 
-error:
-	fprintf (stderr, _("ERROR %s while parsing line %d of %s\n"),
-		 err_msg, line, fname);
-	dvb_file_free(dvb_file);
-	fclose(fd);
-	if (buf)
-		free(buf);
-	return NULL;
+	return 0;
 }
 
 static uint32_t get_compat_format(uint32_t delivery_system)
@@ -416,156 +367,144 @@ static uint32_t get_compat_format(uint32_t delivery_system)
 	}
 }
 
-int dvb_write_format_oneline(const char *fname,
-			     struct dvb_file *dvb_file,
-			     uint32_t delsys,
-			     const struct dvb_parse_file *parse_file)
+static int write_oneline_entry(FILE *fp, struct dvb_entry *entry,
+			       uint32_t *prev_delsys,
+			       const struct dvb_parse_file *parse_file,
+			       const char *fname, int line)
 {
 	const char delimiter = parse_file->delimiter[0];
 	const struct dvb_parse_struct *formats = parse_file->formats;
-	int i, j, line = 0, first;
-	FILE *fp;
+	int i, j, first;
 	const struct dvb_parse_struct *fmt;
-	struct dvb_entry *entry;
 	const struct dvb_parse_table *table;
 	uint32_t data;
 	char err_msg[80];
-	uint32_t delsys_compat = 0;
+	uint32_t delsys = *prev_delsys, delsys_compat = 0;
 
-	fp = fopen(fname, "w");
-	if (!fp) {
-		perror(fname);
-		return -errno;
-	}
-
-	for (entry = dvb_file->first_entry; entry != NULL; entry = entry->next) {
-		for (i = 0; i < entry->n_props; i++) {
-			if (entry->props[i].cmd == DTV_DELIVERY_SYSTEM) {
-				delsys = entry->props[i].u.data;
-				break;
-			}
+	for (i = 0; i < entry->n_props; i++) {
+		if (entry->props[i].cmd == DTV_DELIVERY_SYSTEM) {
+			delsys = entry->props[i].u.data;
+			break;
 		}
+	}
 
+	for (i = 0; formats[i].delsys != 0; i++) {
+		if (formats[i].delsys == delsys)
+			break;
+	}
+	if (!formats[i].delsys) {
+		delsys_compat = get_compat_format(delsys);
 		for (i = 0; formats[i].delsys != 0; i++) {
-			if (formats[i].delsys == delsys)
+			if (formats[i].delsys == delsys_compat) {
+				delsys = delsys_compat;
 				break;
-		}
-		if (!formats[i].delsys) {
-			delsys_compat = get_compat_format(delsys);
-			for (i = 0; formats[i].delsys != 0; i++) {
-				if (formats[i].delsys == delsys_compat) {
-					delsys = delsys_compat;
-					break;
-				}
 			}
 		}
-		if (formats[i].delsys == 0) {
-			sprintf(err_msg,
-				 _("delivery system %d not supported on this format"),
-				 delsys);
-			goto error;
-		}
-		adjust_delsys(entry);
-		if (parse_file->has_delsys_id) {
-			fprintf(fp, "%s", formats[i].id);
+	}
+	*prev_delsys = delsys;
+	if (formats[i].delsys == 0) {
+		sprintf(err_msg,
+			 _("delivery system %d not supported on this format"),
+			 delsys);
+		goto error;
+	}
+	adjust_delsys(entry);
+	if (parse_file->has_delsys_id) {
+		fprintf(fp, "%s", formats[i].id);
+		first = 0;
+	} else
+		first = 1;
+
+	fmt = &formats[i];
+	for (i = 0; i < fmt->size; i++) {
+		table = &fmt->table[i];
+
+		if (first)
 			first = 0;
-		} else
-			first = 1;
-
-		fmt = &formats[i];
-		for (i = 0; i < fmt->size; i++) {
-			table = &fmt->table[i];
+		else
+			fprintf(fp, "%c", delimiter);
 
-			if (first)
-				first = 0;
-			else
-				fprintf(fp, "%c", delimiter);
-
-			for (j = 0; j < entry->n_props; j++)
-				if (entry->props[j].cmd == table->prop)
-					break;
-			if (fmt->table[i].has_default_value &&
-			   (j < entry->n_props) &&
-			   (fmt->table[i].default_value == entry->props[j].u.data))
+		for (j = 0; j < entry->n_props; j++)
+			if (entry->props[j].cmd == table->prop)
 				break;
-			if (table->size && j < entry->n_props) {
-				data = entry->props[j].u.data;
-
-				if (table->prop == DTV_BANDWIDTH_HZ) {
-					for (j = 0; j < ARRAY_SIZE(fe_bandwidth_name); j++) {
-						if (fe_bandwidth_name[j] == data) {
-							data = j;
-							break;
-						}
+		if (fmt->table[i].has_default_value &&
+		   (j < entry->n_props) &&
+		   (fmt->table[i].default_value == entry->props[j].u.data))
+			break;
+		if (table->size && j < entry->n_props) {
+			data = entry->props[j].u.data;
+
+			if (table->prop == DTV_BANDWIDTH_HZ) {
+				for (j = 0; j < ARRAY_SIZE(fe_bandwidth_name); j++) {
+					if (fe_bandwidth_name[j] == data) {
+						data = j;
+						break;
 					}
-					if (j == ARRAY_SIZE(fe_bandwidth_name))
-						data = BANDWIDTH_AUTO;
-				}
-				if (data >= table->size) {
-					sprintf(err_msg,
-						 _("value not supported"));
-					goto error;
 				}
+				if (j == ARRAY_SIZE(fe_bandwidth_name))
+					data = BANDWIDTH_AUTO;
+			}
+			if (data >= table->size) {
+				sprintf(err_msg,
+					 _("value not supported"));
+				goto error;
+			}
 
-				fprintf(fp, "%s", table->table[data]);
-			} else {
-				switch (table->prop) {
-				case DTV_VIDEO_PID:
-					if (!entry->video_pid) {
-						fprintf(stderr,
-							_("WARNING: missing video PID while parsing entry %d of %s\n"),
-							line, fname);
-						fprintf(fp, "%d",0);
-					} else
-						fprintf(fp, "%d",
-							entry->video_pid[0]);
-					break;
-				case DTV_AUDIO_PID:
-					if (!entry->audio_pid) {
+			fprintf(fp, "%s", table->table[data]);
+		} else {
+			switch (table->prop) {
+			case DTV_VIDEO_PID:
+				if (!entry->video_pid) {
+					fprintf(stderr,
+						_("WARNING: missing video PID while parsing entry %d of %s\n"),
+						line, fname);
+					fprintf(fp, "%d",0);
+				} else
+					fprintf(fp, "%d",
+						entry->video_pid[0]);
+				break;
+			case DTV_AUDIO_PID:
+				if (!entry->audio_pid) {
+					fprintf(stderr,
+						_("WARNING: missing audio PID while parsing entry %d of %s\n"),
+						line, fname);
+					fprintf(fp, "%d",0);
+				} else
+					fprintf(fp, "%d",
+						entry->audio_pid[0]);
+				break;
+			case DTV_SERVICE_ID:
+				fprintf(fp, "%d", entry->service_id);
+				break;
+			case DTV_CH_NAME:
+				fprintf(fp, "%s", entry->channel);
+				break;
+			default:
+				if (j >= entry->n_props) {
+					if (fmt->table[i].has_default_value) {
+						data = fmt->table[i].default_value;
+					} else {
 						fprintf(stderr,
-							_("WARNING: missing audio PID while parsing entry %d of %s\n"),
+							_("property %s not supported while parsing entry %d of %s\n"),
+							dvb_cmd_name(table->prop),
 							line, fname);
-						fprintf(fp, "%d",0);
-					} else
-						fprintf(fp, "%d",
-							entry->audio_pid[0]);
-					break;
-				case DTV_SERVICE_ID:
-					fprintf(fp, "%d", entry->service_id);
-					break;
-				case DTV_CH_NAME:
-					fprintf(fp, "%s", entry->channel);
-					break;
-				default:
-					if (j >= entry->n_props) {
-						if (fmt->table[i].has_default_value) {
-							data = fmt->table[i].default_value;
-						} else {
-							fprintf(stderr,
-								_("property %s not supported while parsing entry %d of %s\n"),
-								dvb_cmd_name(table->prop),
-								line, fname);
-							data = 0;
-						}
-					} else {
-						data = entry->props[j].u.data;
+						data = 0;
+					}
+				} else {
+					data = entry->props[j].u.data;
 
-					fprintf(fp, "%d", data);
-				}
-					break;
-				}
+				fprintf(fp, "%d", data);
+			}
+				break;
 			}
 		}
-		fprintf(fp, "\n");
-		line++;
-	};
-	fclose (fp);
+	}
+	fprintf(fp, "\n");
 	return 0;
 
 error:
 	fprintf(stderr, _("ERROR: %s while parsing entry %d of %s\n"),
 		 err_msg, line, fname);
-	fclose(fp);
 	return -1;
 }
 
@@ -576,7 +515,7 @@ static int fill_entry(struct dvb_entry *entry, char *key, char *value)
 	int i, j, len, type = 0;
 	int is_video = 0, is_audio = 0, n_prop;
 	uint16_t *pid = NULL;
-	char *p;
+	char *p, *saveptr;
 
 	/* Handle the DVBv5 DTV_foo properties */
 	for (i = 0; i < ARRAY_SIZE(dvb_v5_name); i++) {
@@ -672,7 +611,7 @@ static int fill_entry(struct dvb_entry *entry, char *key, char *value)
 
 		len = 0;
 
-		p = strtok(value," \t");
+		p = strtok_r(value, " \t", &saveptr);
 		if (!p)
 			return 0;
 		while (p) {
@@ -681,7 +620,7 @@ static int fill_entry(struct dvb_entry *entry, char *key, char *value)
 						      sizeof (*entry->other_el_pid));
 			entry->other_el_pid[len].type = type;
 			entry->other_el_pid[len].pid = atol(p);
-			p = strtok(NULL, " \t\n");
+			p = strtok_r(NULL, " \t\n", &saveptr);
 			len++;
 		}
 		entry->other_el_pid_len = len;
@@ -719,13 +658,13 @@ static int fill_entry(struct dvb_entry *entry, char *key, char *value)
 
 	len = 0;
 
-	p = strtok(value," \t");
+	p = strtok_r(value, " \t", &saveptr);
 	if (!p)
 		return 0;
 	while (p) {
 		pid = realloc(pid, (len + 1) * sizeof (*pid));
 		pid[len] = atol(p);
-		p = strtok(NULL, " \t\n");
+		p = strtok_r(NULL, " \t\n", &saveptr);
 		len++;
 	}
 
@@ -741,54 +680,107 @@ static int fill_entry(struct dvb_entry *entry, char *key, char *value)
 }
 
 
-struct dvb_file *dvb_read_file(const char *fname)
+/*
+ * Channel files read or written one entry at a time, so that converting or
+ * filtering a big file doesn't need to keep all of it in memory.
+ */
+struct dvb_file_stream {
+	FILE *fp;
+	char *fname;
+	enum dvb_file_formats format;
+	const struct dvb_parse_file *parse_file;
+	uint32_t delsys;
+	int writing;
+	char *buf;
+	size_t size;
+	int line;		/* lines read or entries written so far */
+	int pending;		/* buf holds the first line of the next entry */
+};
+
+static int stream_getline(struct dvb_file_stream *stream)
 {
-	char *buf = NULL, *p, *key, *value;
-	size_t size = 0;
-	int len = 0;
-	int line = 0, rc;
-	struct dvb_file *dvb_file;
-	FILE *fd;
-	struct dvb_entry *entry = NULL;
-	char err_msg[80];
+	if (getline(&stream->buf, &stream->size, stream->fp) > 0) {
+		stream->line++;
+		return 1;
+	}
+	if (ferror(stream->fp)) {
+		perror(stream->fname);
+		return -EIO;
+	}
+	return 0;
+}
 
-	dvb_file = calloc(sizeof(*dvb_file), 1);
-	if (!dvb_file) {
-		perror(_("Allocating memory for dvb_file"));
-		return NULL;
+static int read_oneline_entry(struct dvb_file_stream *stream,
+			      struct dvb_entry **entry)
+{
+	char *p, err_msg[80];
+	int rc;
+
+	do {
+		rc = stream_getline(stream);
+		if (rc <= 0)
+			return rc;
+
+		p = stream->buf;
+		while (*p == ' ')
+			p++;
+	} while (*p == '\n' || *p == '#' || *p == '\a' || *p == '\0');
+
+	*entry = calloc(sizeof(**entry), 1);
+	if (!*entry) {
+		perror(_("Allocating memory for dvb_entry"));
+		return -ENOMEM;
 	}
 
-	fd = fopen(fname, "r");
-	if (!fd) {
-		perror(fname);
-		free(dvb_file);
-		return NULL;
+	if (parse_oneline_entry(*entry, p, stream->delsys, stream->parse_file,
+				err_msg) < 0) {
+		fprintf (stderr, _("ERROR %s while parsing line %d of %s\n"),
+			 err_msg, stream->line, stream->fname);
+		dvb_file_free_entry(*entry);
+		*entry = NULL;
+		return -EINVAL;
 	}
+	return 1;
+}
+
+static int read_dvbv5_entry(struct dvb_file_stream *stream,
+			    struct dvb_entry **entry_p)
+{
+	char *p, *key, *value, *saveptr;
+	int rc;
+	struct dvb_entry *entry = NULL;
+	char err_msg[80];
 
 	do {
-		len = getline(&buf, &size, fd);
-		if (len <= 0)
-			break;
-		line++;
-		p = buf;
+		if (!stream->pending) {
+			rc = stream_getline(stream);
+			if (rc < 0)
+				goto err_io;
+			if (!rc)
+				break;
+		}
+		stream->pending = 0;
+
+		p = stream->buf;
 		while (*p == ' ' || *p == '\t')
 			p++;
 		if (*p == '\n' || *p == '#' || *p == '\a' || *p == '\0')
 			continue;
 
 		if (*p == '[') {
-			/* NEW Entry */
+			/* NEW Entry: keep its line for the next call */
+			if (entry) {
+				stream->pending = 1;
+				break;
+			}
+			entry = calloc(sizeof(*entry), 1);
 			if (!entry) {
-				dvb_file->first_entry = calloc(sizeof(*entry), 1);
-				entry = dvb_file->first_entry;
-			} else {
-				adjust_delsys(entry);
-				entry->next = calloc(sizeof(*entry), 1);
-				entry = entry->next;
+				perror(_("Allocating memory for dvb_entry"));
+				return -ENOMEM;
 			}
 			entry->sat_number = -1;
 			p++;
-			p = strtok(p, "]");
+			p = strtok_r(p, "]", &saveptr);
 			if (!p) {
 				sprintf(err_msg, _("Missing channel group"));
 				goto error;
@@ -806,7 +798,7 @@ struct dvb_file *dvb_read_file(const char *fname)
 				sprintf(err_msg, _("key/value without a channel group"));
 				goto error;
 			}
-			key = strtok(p, "=");
+			key = strtok_r(p, "=", &saveptr);
 			if (!key) {
 				sprintf(err_msg, _("missing key"));
 				goto error;
@@ -815,7 +807,7 @@ struct dvb_file *dvb_read_file(const char *fname)
 			while ((p > key) && (*(p - 1) == ' ' || *(p - 1) == '\t'))
 				p--;
 			*p = 0;
-			value = strtok(NULL, "\n");
+			value = strtok_r(NULL, "\n", &saveptr);
 			if (!value) {
 				sprintf(err_msg, _("missing value"));
 				goto error;
@@ -831,146 +823,360 @@ struct dvb_file *dvb_read_file(const char *fname)
 			}
 		}
 	} while (1);
-	if (buf)
-		free(buf);
-	if (entry)
-		adjust_delsys(entry);
-	fclose(fd);
-	return dvb_file;
+
+	if (!entry)
+		return 0;
+
+	adjust_delsys(entry);
+	*entry_p = entry;
+	return 1;
 
 error:
 	fprintf (stderr, _("ERROR %s while parsing line %d of %s\n"),
-		 err_msg, line, fname);
-	if (buf)
-		free(buf);
-	dvb_file_free(dvb_file);
-	fclose(fd);
-	return NULL;
-};
+		 err_msg, stream->line, stream->fname);
+	rc = -EINVAL;
+err_io:
+	if (entry)
+		dvb_file_free_entry(entry);
+	return rc;
+}
 
-int dvb_write_file(const char *fname, struct dvb_file *dvb_file)
+static void write_dvbv5_entry(FILE *fp, struct dvb_entry *entry)
 {
-	FILE *fp;
 	int i;
-	struct dvb_entry *entry = dvb_file->first_entry;
 	static const char *off = "OFF";
 
-	fp = fopen(fname, "w");
-	if (!fp) {
-		perror(fname);
-		return -errno;
+	adjust_delsys(entry);
+	if (entry->channel) {
+		fprintf(fp, "[%s]\n", entry->channel);
+		if (entry->vchannel)
+			fprintf(fp, "\tVCHANNEL = %s\n", entry->vchannel);
+	} else {
+		fprintf(fp, "[CHANNEL]\n");
 	}
 
-	for (entry = dvb_file->first_entry; entry != NULL; entry = entry->next) {
-		adjust_delsys(entry);
-		if (entry->channel) {
-			fprintf(fp, "[%s]\n", entry->channel);
-			if (entry->vchannel)
-				fprintf(fp, "\tVCHANNEL = %s\n", entry->vchannel);
-		} else {
-			fprintf(fp, "[CHANNEL]\n");
-		}
+	if (entry->service_id)
+		fprintf(fp, "\tSERVICE_ID = %d\n", entry->service_id);
 
-		if (entry->service_id)
-			fprintf(fp, "\tSERVICE_ID = %d\n", entry->service_id);
+	if (entry->network_id)
+		fprintf(fp, "\tNETWORK_ID = %d\n", entry->network_id);
 
-		if (entry->network_id)
-			fprintf(fp, "\tNETWORK_ID = %d\n", entry->network_id);
+	if (entry->transport_id)
+		fprintf(fp, "\tTRANSPORT_ID = %d\n", entry->transport_id);
 
-		if (entry->transport_id)
-			fprintf(fp, "\tTRANSPORT_ID = %d\n", entry->transport_id);
+	if (entry->video_pid_len){
+		fprintf(fp, "\tVIDEO_PID =");
+		for (i = 0; i < entry->video_pid_len; i++)
+			fprintf(fp, " %d", entry->video_pid[i]);
+		fprintf(fp, "\n");
+	}
 
-		if (entry->video_pid_len){
-			fprintf(fp, "\tVIDEO_PID =");
-			for (i = 0; i < entry->video_pid_len; i++)
-				fprintf(fp, " %d", entry->video_pid[i]);
-			fprintf(fp, "\n");
-		}
+	if (entry->audio_pid_len) {
+		fprintf(fp, "\tAUDIO_PID =");
+		for (i = 0; i < entry->audio_pid_len; i++)
+			fprintf(fp, " %d", entry->audio_pid[i]);
+		fprintf(fp, "\n");
+	}
 
-		if (entry->audio_pid_len) {
-			fprintf(fp, "\tAUDIO_PID =");
-			for (i = 0; i < entry->audio_pid_len; i++)
-				fprintf(fp, " %d", entry->audio_pid[i]);
-			fprintf(fp, "\n");
+	if (entry->other_el_pid_len) {
+		int type = -1;
+		for (i = 0; i < entry->other_el_pid_len; i++) {
+			if (type != entry->other_el_pid[i].type) {
+				type = entry->other_el_pid[i].type;
+				if (i)
+					fprintf(fp, "\n");
+				fprintf(fp, "\tPID_%02x =", type);
+			}
+			fprintf(fp, " %d", entry->other_el_pid[i].pid);
 		}
+		fprintf(fp, "\n");
+	}
 
-		if (entry->other_el_pid_len) {
-			int type = -1;
-			for (i = 0; i < entry->other_el_pid_len; i++) {
-				if (type != entry->other_el_pid[i].type) {
-					type = entry->other_el_pid[i].type;
-					if (i)
-						fprintf(fp, "\n");
-					fprintf(fp, "\tPID_%02x =", type);
-				}
-				fprintf(fp, " %d", entry->other_el_pid[i].pid);
+	if (entry->sat_number >= 0) {
+		fprintf(fp, "\tSAT_NUMBER = %d\n",
+			entry->sat_number);
+	}
+
+	if (entry->freq_bpf > 0) {
+		fprintf(fp, "\tFREQ_BPF = %d\n",
+			entry->freq_bpf);
+	}
+
+	if (entry->diseqc_wait > 0) {
+		fprintf(fp, "\tDISEQC_WAIT = %d\n",
+			entry->diseqc_wait);
+	}
+	if (entry->lnb)
+			fprintf(fp, "\tLNB = %s\n", entry->lnb);
+
+	for (i = 0; i < entry->n_props; i++) {
+		const char * const *attr_name = dvb_attr_names(entry->props[i].cmd);
+		const char *buf;
+
+		if (attr_name) {
+			int j;
+
+			for (j = 0; j < entry->props[i].u.data; j++) {
+				if (!*attr_name)
+					break;
+				attr_name++;
 			}
-			fprintf(fp, "\n");
 		}
 
-		if (entry->sat_number >= 0) {
-			fprintf(fp, "\tSAT_NUMBER = %d\n",
-				entry->sat_number);
+		if (entry->props[i].cmd == DTV_COUNTRY_CODE) {
+			buf = dvb_country_to_2letters(entry->props[i].u.data);
+			attr_name = &buf;
 		}
 
-		if (entry->freq_bpf > 0) {
-			fprintf(fp, "\tFREQ_BPF = %d\n",
-				entry->freq_bpf);
+		switch (entry->props[i].cmd) {
+		/* Handle parameters with optional values */
+		case DTV_PLS_CODE:
+		case DTV_PLS_MODE:
+			if (entry->props[i].u.data == (unsigned)-1)
+				continue;
+			break;
+		case DTV_PILOT:
+			if (entry->props[i].u.data == (unsigned)-1)
+				attr_name = &off;
+			break;
 		}
 
-		if (entry->diseqc_wait > 0) {
-			fprintf(fp, "\tDISEQC_WAIT = %d\n",
-				entry->diseqc_wait);
-		}
-		if (entry->lnb)
-				fprintf(fp, "\tLNB = %s\n", entry->lnb);
+		if (!attr_name || !*attr_name)
+			fprintf(fp, "\t%s = %u\n",
+				dvb_cmd_name(entry->props[i].cmd),
+				entry->props[i].u.data);
+		else
+			fprintf(fp, "\t%s = %s\n",
+				dvb_cmd_name(entry->props[i].cmd),
+				*attr_name);
+	}
+	fprintf(fp, "\n");
+}
 
-		for (i = 0; i < entry->n_props; i++) {
-			const char * const *attr_name = dvb_attr_names(entry->props[i].cmd);
-			const char *buf;
+static struct dvb_file_stream *stream_open(const char *fname, uint32_t delsys,
+					   enum dvb_file_formats format,
+					   const struct dvb_parse_file *parse_file,
+					   int writing)
+{
+	struct dvb_file_stream *stream;
+	int err;
+
+	stream = calloc(sizeof(*stream), 1);
+	if (stream)
+		stream->fname = strdup(fname);
+	if (!stream || !stream->fname) {
+		perror(_("Allocating memory for dvb_file_stream"));
+		free(stream);
+		errno = ENOMEM;
+		return NULL;
+	}
+	stream->format = format;
+	stream->parse_file = parse_file;
+	stream->delsys = delsys;
+	stream->writing = writing;
+
+	if (!strcmp(fname, "-"))
+		stream->fp = writing ? stdout : stdin;
+	else
+		stream->fp = fopen(fname, writing ? "w" : "r");
+	if (!stream->fp) {
+		err = errno;
+		perror(fname);
+		free(stream->fname);
+		free(stream);
+		errno = err;
+		return NULL;
+	}
+	return stream;
+}
 
-			if (attr_name) {
-				int j;
+struct dvb_file_stream *dvb_file_stream_open(const char *fname,
+					     uint32_t delsys,
+					     enum dvb_file_formats format,
+					     const char *mode)
+{
+	const struct dvb_parse_file *parse_file = NULL;
+	int writing;
 
-				for (j = 0; j < entry->props[i].u.data; j++) {
-					if (!*attr_name)
-						break;
-					attr_name++;
-				}
-			}
+	if (!strcmp(mode, "r")) {
+		writing = 0;
+	} else if (!strcmp(mode, "w")) {
+		writing = 1;
+	} else {
+		errno = EINVAL;
+		return NULL;
+	}
 
-			if (entry->props[i].cmd == DTV_COUNTRY_CODE) {
-				buf = dvb_country_to_2letters(entry->props[i].u.data);
-				attr_name = &buf;
-			}
+	switch (format) {
+	case FILE_CHANNEL:		/* DVB channel/transponder old format */
+		parse_file = &channel_file_format;
+		delsys = SYS_UNDEFINED;
+		break;
+	case FILE_ZAP:
+		parse_file = &channel_file_zap_format;
+		break;
+	case FILE_DVBV5:
+		break;
+	case FILE_VDR:
+		if (writing)
+			break;
+		fprintf(stderr, _("Currently, VDR format is supported only for output\n"));
+		errno = EINVAL;
+		return NULL;
+	default:
+		fprintf(stderr, _("Format can't be handled one entry at a time\n"));
+		errno = EOPNOTSUPP;
+		return NULL;
+	}
 
-			switch (entry->props[i].cmd) {
-			/* Handle parameters with optional values */
-			case DTV_PLS_CODE:
-			case DTV_PLS_MODE:
-				if (entry->props[i].u.data == (unsigned)-1)
-					continue;
-				break;
-			case DTV_PILOT:
-				if (entry->props[i].u.data == (unsigned)-1)
-					attr_name = &off;
-				break;
-			}
+	return stream_open(fname, delsys, format, parse_file, writing);
+}
 
-			if (!attr_name || !*attr_name)
-				fprintf(fp, "\t%s = %u\n",
-					dvb_cmd_name(entry->props[i].cmd),
-					entry->props[i].u.data);
-			else
-				fprintf(fp, "\t%s = %s\n",
-					dvb_cmd_name(entry->props[i].cmd),
-					*attr_name);
-		}
-		fprintf(fp, "\n");
+int dvb_file_stream_read(struct dvb_file_stream *stream,
+			 struct dvb_entry **entry)
+{
+	*entry = NULL;
+	if (stream->writing)
+		return -EBADF;
+
+	if (stream->parse_file)
+		return read_oneline_entry(stream, entry);
+	return read_dvbv5_entry(stream, entry);
+}
+
+int dvb_file_stream_write(struct dvb_file_stream *stream,
+			  struct dvb_entry *entry)
+{
+	int rc;
+
+	if (!stream->writing)
+		return -EBADF;
+
+	if (stream->format == FILE_VDR) {
+		rc = dvb_write_entry_vdr(stream->fp, entry, stream->fname,
+					 stream->line);
+		if (rc < 0)
+			return rc;
+		/* Entries VDR can't represent are skipped */
+		if (rc > 0)
+			return 0;
+	} else if (stream->parse_file) {
+		rc = write_oneline_entry(stream->fp, entry, &stream->delsys,
+					 stream->parse_file, stream->fname,
+					 stream->line);
+		if (rc < 0)
+			return rc;
+	} else {
+		write_dvbv5_entry(stream->fp, entry);
 	}
-	fclose(fp);
+	stream->line++;
+
 	return 0;
-};
+}
+
+int dvb_file_stream_close(struct dvb_file_stream *stream)
+{
+	int rc = 0;
+
+	if (stream->writing) {
+		if (fflush(stream->fp))
+			rc = -errno;
+		else if (ferror(stream->fp))
+			rc = -EIO;
+	}
+	if (stream->fp != stdin && stream->fp != stdout &&
+	    fclose(stream->fp) && stream->writing && !rc)
+		rc = -errno;
+	if (rc)
+		fprintf(stderr, "%s: %s\n", stream->fname, strerror(-rc));
+
+	free(stream->buf);
+	free(stream->fname);
+	free(stream);
+
+	return rc;
+}
+
+static struct dvb_file *stream_read_all(struct dvb_file_stream *stream)
+{
+	struct dvb_file *dvb_file;
+	struct dvb_entry *entry, **tail;
+	int rc;
+
+	if (!stream)
+		return NULL;
+
+	dvb_file = calloc(sizeof(*dvb_file), 1);
+	if (!dvb_file) {
+		perror(_("Allocating memory for dvb_file"));
+		dvb_file_stream_close(stream);
+		return NULL;
+	}
+
+	tail = &dvb_file->first_entry;
+	while ((rc = dvb_file_stream_read(stream, &entry)) > 0) {
+		*tail = entry;
+		tail = &entry->next;
+	}
+	dvb_file_stream_close(stream);
+
+	if (rc < 0) {
+		dvb_file_free(dvb_file);
+		return NULL;
+	}
+	return dvb_file;
+}
+
+static int stream_write_all(struct dvb_file_stream *stream,
+			    struct dvb_file *dvb_file)
+{
+	struct dvb_entry *entry;
+	int rc;
+
+	if (!stream)
+		return -errno;
+
+	for (entry = dvb_file->first_entry; entry != NULL; entry = entry->next) {
+		if (dvb_file_stream_write(stream, entry) < 0) {
+			dvb_file_stream_close(stream);
+			return -1;
+		}
+	}
+	rc = dvb_file_stream_close(stream);
+
+	return rc;
+}
+
+struct dvb_file *dvb_parse_format_oneline(const char *fname,
+					  uint32_t delsys,
+					  const struct dvb_parse_file *parse_file)
+{
+	return stream_read_all(stream_open(fname, delsys, FILE_UNKNOWN,
+					   parse_file, 0));
+}
+
+int dvb_write_format_oneline(const char *fname,
+			     struct dvb_file *dvb_file,
+			     uint32_t delsys,
+			     const struct dvb_parse_file *parse_file)
+{
+	return stream_write_all(stream_open(fname, delsys, FILE_UNKNOWN,
+					    parse_file, 1),
+				dvb_file);
+}
+
+struct dvb_file *dvb_read_file(const char *fname)
+{
+	return stream_read_all(stream_open(fname, SYS_UNDEFINED, FILE_DVBV5,
+					   NULL, 0));
+}
+
+int dvb_write_file(const char *fname, struct dvb_file *dvb_file)
+{
+	return stream_write_all(stream_open(fname, SYS_UNDEFINED, FILE_DVBV5,
+					    NULL, 1),
+				dvb_file);
+}
 
 static char *dvb_vchannel(struct dvb_v5_fe_parms_priv *parms,
 			  struct dvb_table_nit *nit, uint16_t service_id)
@@ -1480,6 +1686,8 @@ enum dvb_file_formats dvb_parse_format(const char *name)
 		return FILE_DVBV5;
 	if (!strcasecmp(name, "VDR"))
 		return FILE_VDR;
+	if (!strcasecmp(name, "DVBV5DB"))
+		return FILE_DVBV5_DB;
 
 	fprintf(stderr, _("File format %s is unknown\n"), name);
 	return FILE_UNKNOWN;
@@ -1572,6 +1780,9 @@ struct dvb_file *dvb_read_file_format(const char *fname,
 		/* FIXME: add support for VDR input */
 		fprintf(stderr, _("Currently, VDR format is supported only for output\n"));
 		return NULL;
+	case FILE_DVBV5_DB:
+		dvb_file = dvb_read_file_db(fname);
+		break;
 	default:
 		fprintf(stderr, _("Format is not supported\n"));
 		return NULL;
@@ -1606,6 +1817,9 @@ int dvb_write_file_format(const char *fname,
 	case FILE_VDR:
 		ret = dvb_write_format_vdr(fname, dvb_file);
 		break;
+	case FILE_DVBV5_DB:
+		ret = dvb_write_file_db(fname, dvb_file);
+		break;
 	default:
 		return -1;
 	}
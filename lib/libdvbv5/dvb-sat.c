@@ -20,6 +20,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
+#include <string.h>
 #include <strings.h> /* strcasecmp */
 
 #include "dvb-fe-priv.h"
@@ -455,11 +456,10 @@ static void dvbsat_diseqc_prep_frame_addr(struct diseqc_cmd *cmd,
 //struct dvb_v5_fe_parms *parms; // legacy code, used for parms->fd, FIXME anyway
 
 /* Inputs are numbered from 1 to 16, according with the spec */
-static int dvbsat_diseqc_write_to_port_group(struct dvb_v5_fe_parms_priv *parms,
-					     struct diseqc_cmd *cmd,
-					     int high_band,
-					     int pol_v,
-					     int sat_number)
+static void dvbsat_diseqc_write_to_port_group(struct diseqc_cmd *cmd,
+					      int high_band,
+					      int pol_v,
+					      int sat_number)
 {
 	dvbsat_diseqc_prep_frame_addr(cmd,
 				      DISEQC_BROADCAST_LNB_SWITCHER_SMATV,
@@ -474,16 +474,13 @@ static int dvbsat_diseqc_write_to_port_group(struct dvb_v5_fe_parms_priv *parms,
 	cmd->data0 |= pol_v ? 0 : 2;
 	/* Instead of using position/option, use a number from 0 to 3 */
 	cmd->data0 |= (sat_number & 0x3) << 2;
-
-	return dvb_fe_diseqc_cmd(&parms->p, cmd->len, cmd->msg);
 }
 
-static int dvbsat_scr_odu_channel_change(struct dvb_v5_fe_parms_priv *parms,
-					 struct diseqc_cmd *cmd,
-					 int high_band,
-					 int pol_v,
-					 int sat_number,
-					 uint16_t t)
+static void dvbsat_scr_odu_channel_change(struct diseqc_cmd *cmd,
+					  int high_band,
+					  int pol_v,
+					  int sat_number,
+					  uint16_t t)
 {
 	int pos_b;
 
@@ -506,8 +503,6 @@ static int dvbsat_scr_odu_channel_change(struct dvb_v5_fe_parms_priv *parms,
 	cmd->data0 |= high_band ? 0 : 4;
 	cmd->data0 |= pol_v ? 8 : 0;
 	cmd->data0 |= pos_b ? 16 : 0;
-
-	return dvb_fe_diseqc_cmd(&parms->p, cmd->len, cmd->msg);
 }
 
 static int dvbsat_diseqc_set_input(struct dvb_v5_fe_parms_priv *parms,
@@ -520,7 +515,11 @@ static int dvbsat_diseqc_set_input(struct dvb_v5_fe_parms_priv *parms,
 	int sat_number = parms->p.sat_number;
 	int vol_high = 0;
 	int tone_on = 0;
+	int burst = -1, quiet;
+	fe_sec_voltage_t voltage;
+	fe_sec_tone_mode_t tone;
 	struct diseqc_cmd cmd;
+	struct dvb_sec_state *sec = &parms->sec;
 	const struct dvb_sat_lnb_priv *lnb = (void *)parms->p.lnb;
 
 	if (sat_number < 0 && t) {
@@ -549,43 +548,87 @@ static int dvbsat_diseqc_set_input(struct dvb_v5_fe_parms_priv *parms,
 		}
 	}
 
-	rc = dvb_fe_sec_voltage(&parms->p, 1, vol_high);
-	if (rc)
-		return rc;
-
-	rc = dvb_fe_sec_tone(&parms->p, SEC_TONE_OFF);
-	if (rc)
-		return rc;
+	voltage = vol_high ? SEC_VOLTAGE_18 : SEC_VOLTAGE_13;
+	tone = tone_on ? SEC_TONE_ON : SEC_TONE_OFF;
 
+	cmd.len = 0;
 	if (sat_number >= 0) {
-		/* DiSEqC is enabled. Send DiSEqC commands */
-		usleep(15 * 1000);
-
 		if (!t)
-			rc = dvbsat_diseqc_write_to_port_group(parms, &cmd, high_band,
-								pol_v, sat_number);
+			dvbsat_diseqc_write_to_port_group(&cmd, high_band,
+							  pol_v, sat_number);
 		else
-			rc = dvbsat_scr_odu_channel_change(parms, &cmd, high_band,
-								pol_v, sat_number, t);
+			dvbsat_scr_odu_channel_change(&cmd, high_band,
+						      pol_v, sat_number, t);
 
+		/* miniDiSEqC/Toneburst commands are defined only for up to 2 sattelites */
+		if (sat_number < 2)
+			burst = sat_number;
+	}
+
+	/*
+	 * When retuning to a transponder on the same input, the voltage,
+	 * the tone and the switch are already set: nothing to be sent.
+	 */
+	if (sec->has_input && sec->has_voltage && sec->voltage == voltage &&
+	    sec->has_tone && sec->tone == tone &&
+	    sec->cmd_len == cmd.len && !memcmp(sec->cmd, cmd.msg, cmd.len) &&
+	    sec->burst == burst) {
+		if (parms->p.verbose > 1)
+			dvb_log(_("SEC: input didn't change. Skipping it"));
+		return 0;
+	}
+
+	/*
+	 * The bus should be quiet for 15 ms before a DiSEqC command. It
+	 * already is if neither the voltage nor the tone were changed.
+	 */
+	quiet = sec->has_voltage && sec->voltage == voltage &&
+		sec->has_tone && sec->tone == SEC_TONE_OFF;
+
+	if (!sec->has_voltage || sec->voltage != voltage) {
+		rc = dvb_fe_sec_voltage(&parms->p, 1, vol_high);
+		if (rc)
+			return rc;
+	}
+
+	if (!sec->has_tone || sec->tone != SEC_TONE_OFF) {
+		rc = dvb_fe_sec_tone(&parms->p, SEC_TONE_OFF);
+		if (rc)
+			return rc;
+	}
+
+	if (sat_number >= 0) {
+		/* DiSEqC is enabled. Send DiSEqC commands */
+		if (!quiet)
+			usleep(15 * 1000);
+
+		rc = dvb_fe_diseqc_cmd(&parms->p, cmd.len, cmd.msg);
 		if (rc) {
 			dvb_logerr(_("sending diseq failed"));
 			return rc;
 		}
 		usleep((15 + parms->p.diseqc_wait) * 1000);
 
-		/* miniDiSEqC/Toneburst commands are defined only for up to 2 sattelites */
-		if (parms->p.sat_number < 2) {
-			rc = dvb_fe_diseqc_burst(&parms->p, parms->p.sat_number);
+		if (burst >= 0) {
+			rc = dvb_fe_diseqc_burst(&parms->p, burst);
 			if (rc)
 				return rc;
 		}
 		usleep(15 * 1000);
 	}
 
-	rc = dvb_fe_sec_tone(&parms->p, tone_on ? SEC_TONE_ON : SEC_TONE_OFF);
+	if (tone != SEC_TONE_OFF) {
+		rc = dvb_fe_sec_tone(&parms->p, tone);
+		if (rc)
+			return rc;
+	}
 
-	return rc;
+	sec->has_input = 1;
+	sec->cmd_len = cmd.len;
+	memcpy(sec->cmd, cmd.msg, cmd.len);
+	sec->burst = burst;
+
+	return 0;
 }
 
 int dvb_sat_real_freq(struct dvb_v5_fe_parms *p, int freq)
@@ -36,8 +36,11 @@
 #include <sys/types.h>
 #include <stdlib.h>
 #include <sys/time.h>
+#include <poll.h>
+#include <time.h>
 
 #include "dvb-fe-priv.h"
+#include "dvb-dev-priv.h"
 #include <libdvbv5/dvb-scan.h>
 #include <libdvbv5/dvb-frontend.h>
 #include <libdvbv5/descriptors.h>
@@ -52,6 +55,8 @@
 #include <libdvbv5/pmt.h>
 #include <libdvbv5/nit.h>
 #include <libdvbv5/sdt.h>
+#include <libdvbv5/eit.h>
+#include <libdvbv5/mpeg_ts.h>
 #include <libdvbv5/vct.h>
 #include <libdvbv5/desc_extension.h>
 #include <libdvbv5/desc_cable_delivery.h>
@@ -146,10 +151,83 @@ struct dvb_table_filter_ext_priv {
 };
 
 struct dvb_table_filter_priv {
-	int num_extensions;
+	int num_extensions, max_extensions;
 	struct dvb_table_filter_ext_priv *extensions;
 };
 
+/*
+ * Scans and EIT monitoring read sections over and over. Instead of
+ * allocating a buffer and a filter state for each read, the ones of the
+ * finished reads are kept on small pools at parms.
+ */
+static void *dvb_pool_get(void **pool, unsigned size)
+{
+	void *p;
+	unsigned i;
+
+	for (i = 0; i < size; i++) {
+		if (!__atomic_load_n(&pool[i], __ATOMIC_RELAXED))
+			continue;
+		p = __atomic_exchange_n(&pool[i], NULL, __ATOMIC_ACQUIRE);
+		if (p)
+			return p;
+	}
+	return NULL;
+}
+
+/* Returns 0 if the pool is full, and p should be freed instead */
+static int dvb_pool_put(void **pool, unsigned size, void *p)
+{
+	void *empty;
+	unsigned i;
+
+	for (i = 0; i < size; i++) {
+		empty = NULL;
+		if (__atomic_compare_exchange_n(&pool[i], &empty, p, 0,
+						__ATOMIC_RELEASE,
+						__ATOMIC_RELAXED))
+			return 1;
+	}
+	return 0;
+}
+
+uint8_t *dvb_section_buf_get(struct dvb_v5_fe_parms_priv *parms)
+{
+	uint8_t *buf;
+
+	buf = dvb_pool_get((void **)parms->section_buf_pool,
+			   DVB_SECTION_BUF_POOL);
+	if (!buf)
+		buf = malloc(DVB_MAX_PAYLOAD_PACKET_SIZE);
+	return buf;
+}
+
+void dvb_section_buf_put(struct dvb_v5_fe_parms_priv *parms, uint8_t *buf)
+{
+	if (buf && !dvb_pool_put((void **)parms->section_buf_pool,
+				 DVB_SECTION_BUF_POOL, buf))
+		free(buf);
+}
+
+static void dvb_table_filter_priv_free(struct dvb_table_filter_priv *priv)
+{
+	free(priv->extensions);
+	free(priv);
+}
+
+void dvb_section_pool_free(struct dvb_v5_fe_parms_priv *parms)
+{
+	struct dvb_table_filter_priv *priv;
+	uint8_t *buf;
+
+	while ((buf = dvb_pool_get((void **)parms->section_buf_pool,
+				   DVB_SECTION_BUF_POOL)))
+		free(buf);
+	while ((priv = dvb_pool_get((void **)parms->filter_pool,
+				    DVB_FILTER_POOL)))
+		dvb_table_filter_priv_free(priv);
+}
+
 static int dvb_parse_section_alloc(struct dvb_v5_fe_parms_priv *parms,
 				   struct dvb_table_filter *sect)
 {
@@ -161,27 +239,210 @@ static int dvb_parse_section_alloc(struct dvb_v5_fe_parms_priv *parms,
 		return -4;
 	}
 	*sect->table = NULL;
-	priv = calloc(sizeof(struct dvb_table_filter_priv), 1);
-	if (!priv) {
-		dvb_logerr(_("%s: out of memory"), __func__);
-		return -1;
+
+	/* A reused state keeps its extensions array, but none is in use */
+	priv = dvb_pool_get((void **)parms->filter_pool, DVB_FILTER_POOL);
+	if (priv) {
+		priv->num_extensions = 0;
+	} else {
+		priv = calloc(sizeof(struct dvb_table_filter_priv), 1);
+		if (!priv) {
+			dvb_logerr(_("%s: out of memory"), __func__);
+			return -1;
+		}
 	}
 	sect->priv = priv;
 
 	return 0;
 }
 
+/* Like dvb_table_filter_free(), but keeps the filter state for reuse */
+static void dvb_table_filter_release(struct dvb_v5_fe_parms_priv *parms,
+				     struct dvb_table_filter *sect)
+{
+	struct dvb_table_filter_priv *priv = sect->priv;
+
+	if (!priv)
+		return;
+	sect->priv = NULL;
+	if (!dvb_pool_put((void **)parms->filter_pool, DVB_FILTER_POOL, priv))
+		dvb_table_filter_priv_free(priv);
+}
+
+static struct dvb_table_filter_ext_priv *
+dvb_table_filter_ext_add(struct dvb_table_filter_priv *priv)
+{
+	struct dvb_table_filter_ext_priv *ext;
+	int size;
+
+	if (priv->num_extensions == priv->max_extensions) {
+		size = priv->max_extensions ? priv->max_extensions * 2 : 4;
+		ext = realloc(priv->extensions, sizeof(*ext) * size);
+		if (!ext)
+			return NULL;
+		priv->extensions = ext;
+		priv->max_extensions = size;
+	}
+	ext = &priv->extensions[priv->num_extensions++];
+	memset(ext, 0, sizeof(*ext));
+	return ext;
+}
+
 void dvb_table_filter_free(struct dvb_table_filter *sect)
 {
 	struct dvb_table_filter_priv *priv = sect->priv;
 
 	if (priv) {
-		free (priv->extensions);
-		free(priv);
+		dvb_table_filter_priv_free(priv);
 		sect->priv = NULL;
 	}
 }
 
+#define DVB_SECTION_CACHE_MIN_SIZE 256
+
+struct dvb_section_cache_entry {
+	uint64_t key;
+	uint32_t crc;
+	uint8_t version;
+	uint8_t used;
+};
+
+struct dvb_section_cache {
+	struct dvb_section_cache_entry *entries;
+	unsigned size, used;
+
+	dvb_section_changed_func changed;
+	void *priv;
+};
+
+struct dvb_section_cache *dvb_section_cache_alloc(dvb_section_changed_func changed,
+						  void *priv)
+{
+	struct dvb_section_cache *cache;
+
+	cache = calloc(1, sizeof(*cache));
+	if (!cache)
+		return NULL;
+	cache->changed = changed;
+	cache->priv = priv;
+	return cache;
+}
+
+void dvb_section_cache_reset(struct dvb_section_cache *cache)
+{
+	if (cache->entries)
+		memset(cache->entries, 0,
+		       cache->size * sizeof(*cache->entries));
+	cache->used = 0;
+}
+
+void dvb_section_cache_free(struct dvb_section_cache *cache)
+{
+	if (!cache)
+		return;
+	free(cache->entries);
+	free(cache);
+}
+
+void dvb_set_section_cache(struct dvb_v5_fe_parms *p,
+			   struct dvb_section_cache *cache)
+{
+	struct dvb_v5_fe_parms_priv *parms = (void *)p;
+
+	parms->section_cache = cache;
+}
+
+static struct dvb_section_cache_entry *
+dvb_section_cache_lookup(struct dvb_section_cache_entry *entries,
+			 unsigned size, uint64_t key)
+{
+	unsigned i = (key * 0x9e3779b97f4a7c15ULL) >> 32;
+
+	/* The size is a power of two, and the table is never full */
+	for (i &= size - 1; entries[i].used; i = (i + 1) & (size - 1))
+		if (entries[i].key == key)
+			break;
+	return &entries[i];
+}
+
+static int dvb_section_cache_grow(struct dvb_section_cache *cache)
+{
+	struct dvb_section_cache_entry *entries, *e;
+	unsigned i, size;
+
+	size = cache->size ? cache->size * 2 : DVB_SECTION_CACHE_MIN_SIZE;
+	entries = calloc(size, sizeof(*entries));
+	if (!entries)
+		return -ENOMEM;
+
+	for (i = 0; i < cache->size; i++) {
+		if (!cache->entries[i].used)
+			continue;
+		e = dvb_section_cache_lookup(entries, size,
+					     cache->entries[i].key);
+		*e = cache->entries[i];
+	}
+	free(cache->entries);
+	cache->entries = entries;
+	cache->size = size;
+	return 0;
+}
+
+/*
+ * Returns 0 if the section is in the cache with the same version and CRC,
+ * and 1 otherwise, after storing it.
+ */
+static int dvb_section_cache_update(struct dvb_v5_fe_parms_priv *parms,
+				    struct dvb_section_cache *cache,
+				    const struct dvb_table_header *h,
+				    const uint8_t *buf, ssize_t buf_length)
+{
+	struct dvb_section_cache_entry *e;
+	const uint8_t *p = buf + buf_length - DVB_CRC_SIZE;
+	uint32_t crc = p[0] << 24 | p[1] << 16 | p[2] << 8 | p[3];
+	uint64_t key;
+	uint16_t onid = 0;
+
+	/* The same service ID can be used on several networks */
+	if ((h->table_id == DVB_TABLE_SDT || h->table_id == DVB_TABLE_SDT2) &&
+	    buf_length >= 10)
+		onid = buf[8] << 8 | buf[9];
+	else if (h->table_id >= DVB_TABLE_EIT && h->table_id <= 0x6f &&
+		 buf_length >= 12)
+		onid = buf[10] << 8 | buf[11];
+
+	key = (uint64_t)h->table_id << 40 | (uint64_t)h->id << 24 |
+	      (uint64_t)h->section_id << 16 | onid;
+
+	if (cache->size) {
+		e = dvb_section_cache_lookup(cache->entries, cache->size, key);
+		if (e->used) {
+			if (e->version == h->version && e->crc == crc)
+				return 0;
+			goto store;
+		}
+	}
+
+	/* Keeps the load below 3/4 */
+	if ((cache->used + 1) * 4 > cache->size * 3 &&
+	    dvb_section_cache_grow(cache) < 0) {
+		dvb_logerr(_("%s: out of memory"), __func__);
+		return 1;
+	}
+	e = dvb_section_cache_lookup(cache->entries, cache->size, key);
+	e->key = key;
+	e->used = 1;
+	cache->used++;
+
+store:
+	e->version = h->version;
+	e->crc = crc;
+
+	if (cache->changed)
+		cache->changed(&parms->p, h, buf, buf_length, cache->priv);
+	return 1;
+}
+
 static int dvb_parse_section(struct dvb_v5_fe_parms_priv *parms,
 			     struct dvb_table_filter *sect,
 			     const uint8_t *buf, ssize_t buf_length)
@@ -208,8 +469,8 @@ static int dvb_parse_section(struct dvb_v5_fe_parms_priv *parms,
 	ext = priv->extensions;
 	tid = h.table_id;
 
-	if (!ext) {
-		ext = calloc(sizeof(struct dvb_table_filter_ext_priv), 1);
+	if (!priv->num_extensions) {
+		ext = dvb_table_filter_ext_add(priv);
 		if (!ext) {
 			dvb_logerr(_("%s: out of memory"), __func__);
 			return -1;
@@ -217,8 +478,6 @@ static int dvb_parse_section(struct dvb_v5_fe_parms_priv *parms,
 		ext->ext_id = h.id;
 		ext->first_section = h.section_id;
 		ext->last_section = h.last_section;
-		priv->extensions = ext;
-		priv->num_extensions = 1;
 		new = 1;
 	} else {
 		/* search for an specific TS ID */
@@ -232,15 +491,11 @@ static int dvb_parse_section(struct dvb_v5_fe_parms_priv *parms,
 				break;
 		}
 		if (i == priv->num_extensions) {
-			priv->num_extensions++;
-			priv->extensions = realloc(priv->extensions, sizeof(struct dvb_table_filter_ext_priv) * (priv->num_extensions));
-			ext = priv->extensions;
+			ext = dvb_table_filter_ext_add(priv);
 			if (!ext) {
 				dvb_logerr(_("%s: out of memory"), __func__);
 				return -1;
 			}
-			ext += i;
-			memset(ext, 0, sizeof(struct dvb_table_filter_ext_priv));
 			ext->ext_id = h.id;
 			ext->first_section = h.section_id;
 			ext->last_section = h.last_section;
@@ -277,7 +532,13 @@ static int dvb_parse_section(struct dvb_v5_fe_parms_priv *parms,
 	if (!sect->allow_section_gaps && sect->ts_id == -1)
 		set_bit(h.section_id, ext->is_read_bits);
 
-	if (dvb_table_initializers[tid])
+	if (parms->section_cache &&
+	    !dvb_section_cache_update(parms, parms->section_cache, &h,
+				      buf, buf_length)) {
+		if (parms->p.verbose)
+			dvb_log(_("%s: table 0x%02x, extension ID 0x%04x, section %d unchanged"),
+				__func__, h.table_id, h.id, h.section_id);
+	} else if (dvb_table_initializers[tid])
 		dvb_table_initializers[tid](&parms->p, buf,
 					    buf_length - DVB_CRC_SIZE,
 					    sect->table);
@@ -293,122 +554,881 @@ static int dvb_parse_section(struct dvb_v5_fe_parms_priv *parms,
 		ext->done = 1;
 	}
 
-	if (!ext->done)
-		return 0;
+	if (!ext->done)
+		return 0;
+
+ret:
+	/* Check if all extensions are done */
+	for (ext = priv->extensions, i = 0; i < priv->num_extensions; i++, ext++) {
+		if (!ext->done) {
+			if (parms->p.verbose)
+				dvb_log(_("%s: extension not completed yet: 0x%04x"),
+						__func__, ext->ext_id);
+			return 0;
+		}
+	}
+
+	/* Section was fully parsed */
+	return 1;
+}
+
+int dvb_read_sections(struct dvb_v5_fe_parms *__p, int dmx_fd,
+			     struct dvb_table_filter *sect,
+			     unsigned timeout)
+{
+	struct dvb_v5_fe_parms_priv *parms = (void *)__p;
+	int ret;
+	uint8_t *buf = NULL;
+	uint8_t mask = 0xff;
+
+	ret = dvb_parse_section_alloc(parms, sect);
+	if (ret < 0)
+		return ret;
+
+	if (dvb_set_section_filter(dmx_fd, sect->pid, 1,
+				   &sect->tid, &mask, NULL,
+				   DMX_IMMEDIATE_START | DMX_CHECK_CRC)) {
+		dvb_dmx_stop(dmx_fd);
+		return -1;
+	}
+	if (parms->p.verbose)
+		dvb_log(_("%s: waiting for table ID 0x%02x, program ID 0x%02x"),
+			__func__, sect->tid, sect->pid);
+
+	buf = dvb_section_buf_get(parms);
+	if (!buf) {
+		dvb_logerr(_("%s: out of memory"), __func__);
+		dvb_dmx_stop(dmx_fd);
+		dvb_table_filter_release(parms, sect);
+		return -1;
+	}
+
+
+	do {
+		int available;
+		uint32_t crc;
+		ssize_t buf_length = 0;
+
+		do {
+			available = dvb_poll(parms, dmx_fd, timeout);
+		} while (available < 0 && errno == EOVERFLOW);
+
+		if (parms->p.abort) {
+			ret = 0;
+			break;
+		}
+		if (available <= 0) {
+			dvb_logerr(_("%s: no data read on section filter"), __func__);
+			ret = -1;
+			break;
+		}
+		buf_length = read(dmx_fd, buf, DVB_MAX_PAYLOAD_PACKET_SIZE);
+
+		if (!buf_length) {
+			dvb_logerr(_("%s: buf returned an empty buffer"), __func__);
+			ret = -1;
+			break;
+		}
+		if (buf_length < 0) {
+			dvb_perror(_("dvb_read_section: read error"));
+			ret = -2;
+			break;
+		}
+
+		crc = dvb_crc32(buf, buf_length, 0xFFFFFFFF);
+		if (crc != 0) {
+			dvb_logerr(_("%s: crc error"), __func__);
+			ret = -3;
+			break;
+		}
+
+		ret = dvb_parse_section(parms, sect, buf, buf_length);
+	} while (!ret);
+	dvb_section_buf_put(parms, buf);
+	dvb_dmx_stop(dmx_fd);
+	dvb_table_filter_release(parms, sect);
+
+	if (ret > 0)
+		ret = 0;
+
+	return ret;
+}
+
+int dvb_read_section_with_id(struct dvb_v5_fe_parms *parms, int dmx_fd,
+			     unsigned char tid, uint16_t pid,
+			     int ts_id,
+			     void **table, unsigned timeout)
+{
+	struct dvb_table_filter tab;
+
+	tab.tid = tid;
+	tab.pid = pid;
+	tab.ts_id = ts_id;
+	tab.table = table;
+	tab.allow_section_gaps = 0;
+
+	return dvb_read_sections(parms, dmx_fd, &tab, timeout);
+}
+
+/*
+ * Concurrent reading of several tables, used by dvb_get_ts_tables().
+ *
+ * Each table gets its own section filter. As a demux file descriptor has
+ * only one filter, the demux is opened again for the other tables. The
+ * tables are then read from a single poll() loop, so the time needed to
+ * get all of them is the time of the slowest table, instead of the sum of
+ * all tables. If the demux can't be opened that many times, the tables
+ * that don't fit wait for a filter to become free.
+ *
+ * A table may be optional: once all the other tables are done, it is
+ * dropped, unless its sections are already being received, instead of
+ * waiting for it until its timeout.
+ */
+
+#define DVB_MAX_PARALLEL_FILTERS	32
+
+struct dvb_table_read {
+	struct dvb_table_filter sect;
+	unsigned timeout;
+	unsigned optional;
+
+	/* Filled by dvb_read_tables() */
+	int rc;
+	int fd;
+	unsigned sections;
+	struct timespec start, deadline;
+};
+
+static void dvb_table_read_init(struct dvb_table_read *t, unsigned char tid,
+				uint16_t pid, void **table, unsigned timeout)
+{
+	memset(t, 0, sizeof(*t));
+	t->sect.tid = tid;
+	t->sect.pid = pid;
+	t->sect.ts_id = -1;
+	t->sect.table = table;
+	t->sect.allow_section_gaps = 0;
+	t->timeout = timeout;
+	t->fd = -1;
+}
+
+static void dvb_table_read_set_deadline(struct dvb_table_read *t)
+{
+	clock_gettime(CLOCK_MONOTONIC, &t->deadline);
+	t->deadline.tv_sec += t->timeout;
+}
+
+static int dvb_table_read_start(struct dvb_v5_fe_parms_priv *parms,
+				struct dvb_table_read *t, int fd)
+{
+	uint8_t mask = 0xff;
+	int ret;
+
+	ret = dvb_parse_section_alloc(parms, &t->sect);
+	if (ret < 0) {
+		t->rc = ret;
+		return 1;
+	}
+
+	if (dvb_set_section_filter(fd, t->sect.pid, 1,
+				   &t->sect.tid, &mask, NULL,
+				   DMX_IMMEDIATE_START | DMX_CHECK_CRC)) {
+		dvb_dmx_stop(fd);
+		dvb_table_filter_release(parms, &t->sect);
+		return -1;
+	}
+	if (parms->p.verbose)
+		dvb_log(_("%s: waiting for table ID 0x%02x, program ID 0x%02x"),
+			__func__, t->sect.tid, t->sect.pid);
+
+	t->fd = fd;
+	t->sections = 0;
+	clock_gettime(CLOCK_MONOTONIC, &t->start);
+	dvb_table_read_set_deadline(t);
+	return 0;
+}
+
+static void dvb_table_read_stop(struct dvb_v5_fe_parms_priv *parms,
+				struct dvb_table_read *t, int rc)
+{
+	if (parms->p.verbose) {
+		struct timespec now;
+		long ms;
+
+		/* Tells how much of the timeout each table needs */
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		ms = (now.tv_sec - t->start.tv_sec) * 1000 +
+		     (now.tv_nsec - t->start.tv_nsec) / 1000000;
+		dvb_log(_("%s: table ID 0x%02x, program ID 0x%02x: %s after %ld ms (timeout: %u s), %u sections"),
+			__func__, t->sect.tid, t->sect.pid,
+			rc > 0 ? _("read") : rc < 0 ? _("failed") : _("stopped"),
+			ms, t->timeout, t->sections);
+	}
+
+	dvb_dmx_stop(t->fd);
+	dvb_table_filter_release(parms, &t->sect);
+	t->fd = -1;
+	t->rc = rc > 0 ? 0 : rc;
+}
+
+/*
+ * Handles one section for a table. Returns 0 if more sections are needed,
+ * otherwise the table is done, with the same return codes as
+ * dvb_read_sections().
+ */
+static int dvb_table_read_section(struct dvb_v5_fe_parms_priv *parms,
+				  struct dvb_table_read *t, uint8_t *buf)
+{
+	ssize_t buf_length;
+	uint32_t crc;
+	int ret;
+
+	buf_length = read(t->fd, buf, DVB_MAX_PAYLOAD_PACKET_SIZE);
+	if (!buf_length) {
+		dvb_logerr(_("%s: buf returned an empty buffer"), __func__);
+		return -1;
+	}
+	if (buf_length < 0) {
+		if (errno == EAGAIN || errno == EINTR)
+			return 0;
+		/* The demux flushed its buffer, the next section is fine */
+		if (errno == EOVERFLOW)
+			return 0;
+		dvb_perror(_("dvb_read_section: read error"));
+		return -2;
+	}
+
+	crc = dvb_crc32(buf, buf_length, 0xFFFFFFFF);
+	if (crc != 0) {
+		dvb_logerr(_("%s: crc error"), __func__);
+		return -3;
+	}
+
+	t->sections++;
+	ret = dvb_parse_section(parms, &t->sect, buf, buf_length);
+	if (!ret)
+		dvb_table_read_set_deadline(t);
+	return ret;
+}
+
+/* Returns true if a table that isn't optional wasn't read yet */
+static int dvb_read_tables_pending(struct dvb_table_read *tabs,
+				   unsigned num_tabs, unsigned next)
+{
+	unsigned i;
+
+	for (i = 0; i < num_tabs; i++)
+		if (!tabs[i].optional && (i >= next || tabs[i].fd >= 0))
+			return 1;
+	return 0;
+}
+
+/* Gives all tables to a device that reads them by itself */
+static void dvb_read_tables_dev(struct dvb_v5_fe_parms_priv *parms,
+				struct dvb_table_read *tabs, unsigned num_tabs)
+{
+	struct dvb_device_priv *dvb = parms->dvb;
+	struct dvb_table_filter *sect[DVB_MAX_PARALLEL_FILTERS];
+	int rc[DVB_MAX_PARALLEL_FILTERS];
+	unsigned i, n;
+
+	for (; num_tabs; tabs += n, num_tabs -= n) {
+		n = num_tabs;
+		if (n > DVB_MAX_PARALLEL_FILTERS)
+			n = DVB_MAX_PARALLEL_FILTERS;
+		for (i = 0; i < n; i++)
+			sect[i] = &tabs[i].sect;
+
+		dvb->ops.read_tables(dvb, sect, rc, n);
+
+		for (i = 0; i < n; i++)
+			tabs[i].rc = rc[i] > 0 || tabs[i].optional ? 0 : rc[i];
+	}
+}
+
+static void dvb_read_tables(struct dvb_v5_fe_parms_priv *parms, int dmx_fd,
+			    struct dvb_table_read *tabs, unsigned num_tabs)
+{
+	struct dvb_table_read *owner[DVB_MAX_PARALLEL_FILTERS] = { NULL };
+	struct pollfd pfd[DVB_MAX_PARALLEL_FILTERS];
+	int fds[DVB_MAX_PARALLEL_FILTERS];
+	unsigned num_fds = 1, max_fds = DVB_MAX_PARALLEL_FILTERS;
+	unsigned next = 0, i;
+	int has_needed;
+	uint8_t *buf;
+
+	for (i = 0; i < num_tabs; i++)
+		tabs[i].rc = 0;
+	if (!num_tabs)
+		return;
+	has_needed = dvb_read_tables_pending(tabs, num_tabs, 0);
+
+	if (parms->dvb && parms->dvb->ops.read_tables) {
+		dvb_read_tables_dev(parms, tabs, num_tabs);
+		return;
+	}
+
+	buf = dvb_section_buf_get(parms);
+	if (!buf) {
+		dvb_logerr(_("%s: out of memory"), __func__);
+		for (i = 0; i < num_tabs; i++)
+			tabs[i].rc = -1;
+		return;
+	}
+	fds[0] = dmx_fd;
+
+	while (!parms->p.abort) {
+		struct timespec now;
+		unsigned num_pfd = 0;
+		long timeout_ms = -1;
+		int n;
+
+		/* Start the pending tables on the idle filters */
+		for (i = 0; i < max_fds && next < num_tabs; i++) {
+			int ret;
+
+			if (owner[i])
+				continue;
+			if (i == num_fds) {
+				char path[32];
+				int fd;
+
+				snprintf(path, sizeof(path), "/proc/self/fd/%d", dmx_fd);
+				fd = open(path, O_RDWR | O_NONBLOCK);
+				if (fd < 0) {
+					max_fds = num_fds;
+					break;
+				}
+				fds[num_fds++] = fd;
+				ret = dvb_table_read_start(parms, &tabs[next], fd);
+				if (ret < 0) {
+					/* Out of demux filters: use the ones we have */
+					close(fd);
+					max_fds = --num_fds;
+					break;
+				}
+			} else {
+				ret = dvb_table_read_start(parms, &tabs[next], fds[i]);
+				if (ret < 0)
+					tabs[next].rc = -1;
+			}
+			if (!ret)
+				owner[i] = &tabs[next];
+			else
+				i--;
+			next++;
+		}
+
+		/* All needed tables are done: drop the optional ones not seen */
+		if (has_needed && !dvb_read_tables_pending(tabs, num_tabs, next)) {
+			for (; next < num_tabs; next++)
+				if (parms->p.verbose)
+					dvb_log(_("%s: table ID 0x%02x, program ID 0x%02x: not needed"),
+						__func__, tabs[next].sect.tid,
+						tabs[next].sect.pid);
+			for (i = 0; i < num_fds; i++) {
+				if (!owner[i] || owner[i]->sections)
+					continue;
+				dvb_table_read_stop(parms, owner[i], 0);
+				owner[i] = NULL;
+			}
+		}
+
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		for (i = 0; i < num_fds; i++) {
+			struct dvb_table_read *t = owner[i];
+			long ms;
+
+			if (!t)
+				continue;
+			ms = (t->deadline.tv_sec - now.tv_sec) * 1000 +
+			     (t->deadline.tv_nsec - now.tv_nsec) / 1000000;
+			if (ms <= 0) {
+				/* An optional table may just not be there */
+				if (!t->optional)
+					dvb_logerr(_("%s: no data read on section filter for table ID 0x%02x, program ID 0x%02x"),
+						   __func__, t->sect.tid, t->sect.pid);
+				dvb_table_read_stop(parms, t, t->optional ? 0 : -1);
+				owner[i] = NULL;
+				continue;
+			}
+			if (timeout_ms < 0 || ms < timeout_ms)
+				timeout_ms = ms;
+			pfd[num_pfd].fd = fds[i];
+			pfd[num_pfd].events = POLLIN | POLLPRI;
+			pfd[num_pfd].revents = 0;
+			num_pfd++;
+		}
+		if (!num_pfd) {
+			if (next < num_tabs)
+				continue;
+			break;
+		}
+
+		n = poll(pfd, num_pfd, timeout_ms);
+		if (n < 0 && errno != EINTR) {
+			dvb_perror(_("dvb_read_section: poll error"));
+			for (i = 0; i < num_fds; i++) {
+				if (owner[i])
+					dvb_table_read_stop(parms, owner[i], -1);
+				owner[i] = NULL;
+			}
+			continue;
+		}
+		if (n <= 0 || parms->p.abort)
+			continue;
+
+		for (i = 0, num_pfd = 0; i < num_fds; i++) {
+			int ret;
+
+			if (!owner[i])
+				continue;
+			if (!pfd[num_pfd++].revents)
+				continue;
+			ret = dvb_table_read_section(parms, owner[i], buf);
+			if (ret) {
+				dvb_table_read_stop(parms, owner[i], ret);
+				owner[i] = NULL;
+			}
+		}
+	}
+
+	/* Aborted: the tables that weren't read are simply not there */
+	for (i = 0; i < num_fds; i++) {
+		if (owner[i])
+			dvb_table_read_stop(parms, owner[i], 0);
+		if (i)
+			close(fds[i]);
+	}
+	dvb_section_buf_put(parms, buf);
+}
+
+/*
+ * Userspace MPEG-TS section demultiplexer
+ */
+
+/* Size of the kernel buffer when reading a TS, and of each read */
+#define DVB_TS_DEMUX_BUFFER_SIZE	(DVB_MPEG_TS_PACKET_SIZE * 4096)
+#define DVB_TS_DEMUX_READ_SIZE		(DVB_MPEG_TS_PACKET_SIZE * 64)
+
+struct dvb_ts_demux_pid {
+	uint16_t pid;
+	int cc;
+
+	/* Section being reassembled */
+	uint8_t *buf;
+	unsigned len;
+	int started;
+};
+
+struct dvb_ts_demux {
+	struct dvb_v5_fe_parms_priv *parms;
+
+	struct dvb_table_filter **filters;
+	int *status;
+	unsigned num_filters;
+	unsigned pending;
+
+	struct dvb_ts_demux_pid *pids;
+	unsigned num_pids;
+	int16_t pid_map[DVB_MPEG_TS_NUM_PIDS];
+
+	/* A partial TS packet from the previous call */
+	uint8_t pkt[DVB_MPEG_TS_PACKET_SIZE];
+	unsigned pkt_len;
+};
+
+struct dvb_ts_demux *dvb_ts_demux_alloc(struct dvb_v5_fe_parms *__p)
+{
+	struct dvb_v5_fe_parms_priv *parms = (void *)__p;
+	struct dvb_ts_demux *dmx;
+	unsigned i;
+
+	dmx = calloc(sizeof(*dmx), 1);
+	if (!dmx) {
+		dvb_logerr(_("%s: out of memory"), __func__);
+		return NULL;
+	}
+	dmx->parms = parms;
+	for (i = 0; i < DVB_MPEG_TS_NUM_PIDS; i++)
+		dmx->pid_map[i] = -1;
+
+	return dmx;
+}
+
+int dvb_ts_demux_add_filter(struct dvb_ts_demux *dmx,
+			    struct dvb_table_filter *sect)
+{
+	struct dvb_v5_fe_parms_priv *parms = dmx->parms;
+	struct dvb_table_filter **filters;
+	struct dvb_ts_demux_pid *pids;
+	int *status;
+	int ret;
+
+	if (sect->pid >= DVB_MPEG_TS_NUM_PIDS) {
+		dvb_logerr(_("%s: invalid program ID 0x%04x"),
+			   __func__, sect->pid);
+		return -EINVAL;
+	}
+
+	filters = realloc(dmx->filters, sizeof(*filters) * (dmx->num_filters + 1));
+	if (!filters)
+		goto nomem;
+	dmx->filters = filters;
+	status = realloc(dmx->status, sizeof(*status) * (dmx->num_filters + 1));
+	if (!status)
+		goto nomem;
+	dmx->status = status;
+
+	if (dmx->pid_map[sect->pid] < 0) {
+		pids = realloc(dmx->pids, sizeof(*pids) * (dmx->num_pids + 1));
+		if (!pids)
+			goto nomem;
+		dmx->pids = pids;
+		pids += dmx->num_pids;
+		memset(pids, 0, sizeof(*pids));
+		pids->pid = sect->pid;
+		pids->cc = -1;
+		pids->buf = malloc(DVB_MAX_PAYLOAD_PACKET_SIZE);
+		if (!pids->buf)
+			goto nomem;
+		dmx->pid_map[sect->pid] = dmx->num_pids++;
+	}
+
+	ret = dvb_parse_section_alloc(parms, sect);
+	if (ret < 0)
+		return ret;
+
+	dmx->filters[dmx->num_filters] = sect;
+	dmx->status[dmx->num_filters] = 0;
+	dmx->num_filters++;
+	dmx->pending++;
+
+	return 0;
+
+nomem:
+	dvb_logerr(_("%s: out of memory"), __func__);
+	return -ENOMEM;
+}
+
+int dvb_ts_demux_filter_status(struct dvb_ts_demux *dmx,
+			       struct dvb_table_filter *sect)
+{
+	unsigned i;
+
+	for (i = 0; i < dmx->num_filters; i++)
+		if (dmx->filters[i] == sect)
+			return dmx->status[i];
+	return -EINVAL;
+}
+
+void dvb_ts_demux_free(struct dvb_ts_demux *dmx)
+{
+	unsigned i;
+
+	if (!dmx)
+		return;
+
+	for (i = 0; i < dmx->num_filters; i++)
+		dvb_table_filter_release(dmx->parms, dmx->filters[i]);
+	for (i = 0; i < dmx->num_pids; i++)
+		free(dmx->pids[i].buf);
+	free(dmx->pids);
+	free(dmx->status);
+	free(dmx->filters);
+	free(dmx);
+}
+
+static void dvb_ts_demux_section(struct dvb_ts_demux *dmx, uint16_t pid,
+				 const uint8_t *buf, unsigned len)
+{
+	struct dvb_v5_fe_parms_priv *parms = dmx->parms;
+	unsigned i;
+	int ret;
+
+	/* All tables that have a parser use the long section format */
+	if (len < sizeof(struct dvb_table_header) + DVB_CRC_SIZE ||
+	    !(buf[1] & 0x80))
+		return;
+
+	if (dvb_crc32((uint8_t *)buf, len, 0xFFFFFFFF) != 0) {
+		dvb_logdbg(_("%s: crc error on program ID 0x%04x"),
+			   __func__, pid);
+		return;
+	}
+
+	for (i = 0; i < dmx->num_filters; i++) {
+		struct dvb_table_filter *sect = dmx->filters[i];
+
+		if (dmx->status[i] || sect->pid != pid || sect->tid != buf[0])
+			continue;
+
+		ret = dvb_parse_section(parms, sect, buf, len);
+		if (ret) {
+			dmx->status[i] = ret > 0 ? 1 : ret;
+			dmx->pending--;
+		}
+	}
+}
+
+/*
+ * Appends payload data to the section being reassembled. Returns the
+ * number of bytes used, which is less than size if the section ended.
+ */
+static unsigned dvb_ts_demux_append(struct dvb_ts_demux *dmx,
+				    struct dvb_ts_demux_pid *ps,
+				    const uint8_t *p, unsigned size)
+{
+	unsigned used = 0, total, n;
+
+	for (;;) {
+		/* The first 3 bytes have the section length */
+		total = 3;
+		if (ps->len >= 3) {
+			total += ((ps->buf[1] & 0x0f) << 8) | ps->buf[2];
+			if (total > DVB_MAX_PAYLOAD_PACKET_SIZE) {
+				ps->started = 0;
+				return size;
+			}
+			if (ps->len == total) {
+				ps->started = 0;
+				dvb_ts_demux_section(dmx, ps->pid, ps->buf, ps->len);
+				break;
+			}
+		}
+		if (used == size)
+			break;
+		n = total - ps->len;
+		if (n > size - used)
+			n = size - used;
+		memcpy(ps->buf + ps->len, p + used, n);
+		ps->len += n;
+		used += n;
+	}
+	return used;
+}
+
+static void dvb_ts_demux_packet(struct dvb_ts_demux *dmx, const uint8_t *p)
+{
+	struct dvb_ts_demux_pid *ps;
+	unsigned pid, off = 4, cc, size, used;
+	int idx, pusi = p[1] & 0x40;
+
+	/* Transport error indicator */
+	if (p[1] & 0x80)
+		return;
+
+	pid = ((p[1] & 0x1f) << 8) | p[2];
+	idx = dmx->pid_map[pid];
+	if (idx < 0)
+		return;
+	ps = &dmx->pids[idx];
+
+	/* No payload */
+	if (!(p[3] & 0x10))
+		return;
+	if (p[3] & 0x20) {
+		off += 1 + p[4];
+		if (off >= DVB_MPEG_TS_PACKET_SIZE)
+			return;
+	}
+
+	cc = p[3] & 0x0f;
+	if (ps->cc >= 0) {
+		if (cc == (unsigned)ps->cc)
+			return;		/* Duplicated packet */
+		if (cc != ((ps->cc + 1) & 0x0f))
+			ps->started = 0;
+	}
+	ps->cc = cc;
+
+	/* Sections are never scrambled */
+	if (p[3] & 0xc0)
+		return;
+
+	p += off;
+	size = DVB_MPEG_TS_PACKET_SIZE - off;
+
+	if (!pusi) {
+		if (ps->started)
+			dvb_ts_demux_append(dmx, ps, p, size);
+		return;
+	}
+
+	/* Payload unit start: the pointer field tells where a section starts */
+	used = *p++ + 1;
+	size--;
+	if (used > size + 1) {
+		ps->started = 0;
+		return;
+	}
+	if (ps->started) {
+		dvb_ts_demux_append(dmx, ps, p, used - 1);
+		ps->started = 0;
+	}
+	p += used - 1;
+	size -= used - 1;
+
+	/* There may be several sections, until the 0xff stuffing */
+	while (size && *p != 0xff) {
+		ps->started = 1;
+		ps->len = 0;
+		used = dvb_ts_demux_append(dmx, ps, p, size);
+		if (ps->started)
+			break;
+		p += used;
+		size -= used;
+	}
+}
+
+int dvb_ts_demux_parse(struct dvb_ts_demux *dmx, const uint8_t *buf,
+		       size_t len)
+{
+	while (len) {
+		if (dmx->pkt_len) {
+			size_t n = DVB_MPEG_TS_PACKET_SIZE - dmx->pkt_len;
+
+			if (n > len)
+				n = len;
+			memcpy(dmx->pkt + dmx->pkt_len, buf, n);
+			dmx->pkt_len += n;
+			buf += n;
+			len -= n;
+			if (dmx->pkt_len < DVB_MPEG_TS_PACKET_SIZE)
+				break;
+			dvb_ts_demux_packet(dmx, dmx->pkt);
+			dmx->pkt_len = 0;
+			continue;
+		}
+		if (*buf != DVB_MPEG_TS) {
+			/* Lost sync: skip to the next sync byte */
+			buf++;
+			len--;
+			continue;
+		}
+		if (len < DVB_MPEG_TS_PACKET_SIZE) {
+			memcpy(dmx->pkt, buf, len);
+			dmx->pkt_len = len;
+			break;
+		}
+		dvb_ts_demux_packet(dmx, buf);
+		buf += DVB_MPEG_TS_PACKET_SIZE;
+		len -= DVB_MPEG_TS_PACKET_SIZE;
+	}
+
+	return dmx->pending;
+}
+
+/*
+ * Sets a TS filter for the PIDs of the demuxer, or for the whole TS if
+ * the demux doesn't support adding PIDs to a filter.
+ */
+static int dvb_ts_demux_set_filter(struct dvb_ts_demux *dmx, int dmx_fd)
+{
+	struct dvb_v5_fe_parms_priv *parms = dmx->parms;
+	unsigned i;
+
+	if (dvb_set_pesfilter(dmx_fd, dmx->pids[0].pid, DMX_PES_OTHER,
+			      DMX_OUT_TSDEMUX_TAP, DVB_TS_DEMUX_BUFFER_SIZE))
+		goto all_pids;
 
-ret:
-	/* Check if all extensions are done */
-	for (ext = priv->extensions, i = 0; i < priv->num_extensions; i++, ext++) {
-		if (!ext->done) {
-			if (parms->p.verbose)
-				dvb_log(_("%s: extension not completed yet: 0x%04x"),
-						__func__, ext->ext_id);
-			return 0;
+	for (i = 1; i < dmx->num_pids; i++) {
+		uint16_t pid = dmx->pids[i].pid;
+
+		if (ioctl(dmx_fd, DMX_ADD_PID, &pid) < 0) {
+			dvb_dmx_stop(dmx_fd);
+			goto all_pids;
 		}
 	}
+	return 0;
 
-	/* Section was fully parsed */
-	return 1;
+all_pids:
+	if (parms->p.verbose)
+		dvb_log(_("%s: can't filter %d PIDs, reading the whole TS"),
+			__func__, dmx->num_pids);
+	return dvb_set_pesfilter(dmx_fd, DVB_MPEG_TS_NUM_PIDS, DMX_PES_OTHER,
+				 DMX_OUT_TSDEMUX_TAP, DVB_TS_DEMUX_BUFFER_SIZE);
 }
 
-int dvb_read_sections(struct dvb_v5_fe_parms *__p, int dmx_fd,
-			     struct dvb_table_filter *sect,
-			     unsigned timeout)
+int dvb_read_sections_ts(struct dvb_v5_fe_parms *__p, int dmx_fd,
+			 struct dvb_table_filter *sect, unsigned num_sect,
+			 unsigned timeout)
 {
 	struct dvb_v5_fe_parms_priv *parms = (void *)__p;
-	int ret;
-	uint8_t *buf = NULL;
-	uint8_t mask = 0xff;
+	struct dvb_ts_demux *dmx;
+	struct timespec start, now;
+	uint8_t *buf;
+	unsigned i;
+	int ret = 0, pending = num_sect;
 
-	ret = dvb_parse_section_alloc(parms, sect);
-	if (ret < 0)
-		return ret;
+	if (!num_sect)
+		return 0;
 
-	if (dvb_set_section_filter(dmx_fd, sect->pid, 1,
-				   &sect->tid, &mask, NULL,
-				   DMX_IMMEDIATE_START | DMX_CHECK_CRC)) {
-		dvb_dmx_stop(dmx_fd);
-		return -1;
+	dmx = dvb_ts_demux_alloc(&parms->p);
+	if (!dmx)
+		return -ENOMEM;
+	for (i = 0; i < num_sect; i++) {
+		ret = dvb_ts_demux_add_filter(dmx, &sect[i]);
+		if (ret < 0) {
+			dvb_ts_demux_free(dmx);
+			return ret;
+		}
 	}
-	if (parms->p.verbose)
-		dvb_log(_("%s: waiting for table ID 0x%02x, program ID 0x%02x"),
-			__func__, sect->tid, sect->pid);
 
-	buf = calloc(DVB_MAX_PAYLOAD_PACKET_SIZE, 1);
+	buf = malloc(DVB_TS_DEMUX_READ_SIZE);
 	if (!buf) {
 		dvb_logerr(_("%s: out of memory"), __func__);
-		dvb_dmx_stop(dmx_fd);
-		dvb_table_filter_free(sect);
-		return -1;
+		dvb_ts_demux_free(dmx);
+		return -ENOMEM;
 	}
 
+	if (dvb_ts_demux_set_filter(dmx, dmx_fd)) {
+		free(buf);
+		dvb_ts_demux_free(dmx);
+		return -1;
+	}
 
-	do {
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	now = start;
+	while (pending && now.tv_sec - start.tv_sec < (time_t)timeout) {
+		ssize_t buf_length;
 		int available;
-		uint32_t crc;
-		ssize_t buf_length = 0;
-
-		do {
-			available = dvb_poll(parms, dmx_fd, timeout);
-		} while (available < 0 && errno == EOVERFLOW);
 
-		if (parms->p.abort) {
-			ret = 0;
+		available = dvb_poll(parms, dmx_fd, timeout);
+		if (parms->p.abort)
 			break;
-		}
 		if (available <= 0) {
-			dvb_logerr(_("%s: no data read on section filter"), __func__);
-			ret = -1;
-			break;
-		}
-		buf_length = read(dmx_fd, buf, DVB_MAX_PAYLOAD_PACKET_SIZE);
-
-		if (!buf_length) {
-			dvb_logerr(_("%s: buf returned an empty buffer"), __func__);
-			ret = -1;
+			dvb_logerr(_("%s: no data read on TS filter"), __func__);
 			break;
 		}
+		buf_length = read(dmx_fd, buf, DVB_TS_DEMUX_READ_SIZE);
+		clock_gettime(CLOCK_MONOTONIC, &now);
 		if (buf_length < 0) {
-			dvb_perror(_("dvb_read_section: read error"));
+			if (errno == EAGAIN || errno == EINTR ||
+			    errno == EOVERFLOW)
+				continue;
+			dvb_perror(_("dvb_read_sections_ts: read error"));
 			ret = -2;
 			break;
 		}
+		pending = dvb_ts_demux_parse(dmx, buf, buf_length);
+	}
 
-		crc = dvb_crc32(buf, buf_length, 0xFFFFFFFF);
-		if (crc != 0) {
-			dvb_logerr(_("%s: crc error"), __func__);
-			ret = -3;
-			break;
-		}
-
-		ret = dvb_parse_section(parms, sect, buf, buf_length);
-	} while (!ret);
-	free(buf);
 	dvb_dmx_stop(dmx_fd);
-	dvb_table_filter_free(sect);
+	free(buf);
 
-	if (ret > 0)
-		ret = 0;
+	if (ret >= 0) {
+		for (ret = 0, i = 0; i < num_sect; i++)
+			if (dvb_ts_demux_filter_status(dmx, &sect[i]) <= 0)
+				ret++;
+		if (ret && !parms->p.abort)
+			dvb_logerr(_("%s: %d tables not read"), __func__, ret);
+	}
+	dvb_ts_demux_free(dmx);
 
 	return ret;
 }
 
-int dvb_read_section_with_id(struct dvb_v5_fe_parms *parms, int dmx_fd,
-			     unsigned char tid, uint16_t pid,
-			     int ts_id,
-			     void **table, unsigned timeout)
-{
-	struct dvb_table_filter tab;
-
-	tab.tid = tid;
-	tab.pid = pid;
-	tab.ts_id = ts_id;
-	tab.table = table;
-	tab.allow_section_gaps = 0;
-
-	return dvb_read_sections(parms, dmx_fd, &tab, timeout);
-}
-
 struct dvb_v5_descriptors *dvb_scan_alloc_handler_table(uint32_t delivery_system)
 {
 	struct dvb_v5_descriptors *dvb_scan_handler;
@@ -457,7 +1477,8 @@ struct dvb_v5_descriptors *dvb_get_ts_tables(struct dvb_v5_fe_parms *__p,
 	int rc;
 	unsigned pat_pmt_time, sdt_time, nit_time, vct_time;
 	int atsc_filter = 0;
-	unsigned num_pmt = 0;
+	unsigned num_pmt = 0, num_tabs = 0, num_services = 0;
+	struct dvb_table_read pat, *tabs, *t;
 
 	struct dvb_v5_descriptors *dvb_scan_handler;
 
@@ -512,10 +1533,11 @@ struct dvb_v5_descriptors *dvb_get_ts_tables(struct dvb_v5_fe_parms *__p,
 	};
 
 	/* PAT table */
-	rc = dvb_read_section(&parms->p, dmx_fd,
-			      DVB_TABLE_PAT, DVB_TABLE_PAT_PID,
-			      (void **)&dvb_scan_handler->pat,
-			      pat_pmt_time * timeout_multiply);
+	dvb_table_read_init(&pat, DVB_TABLE_PAT, DVB_TABLE_PAT_PID,
+			    (void **)&dvb_scan_handler->pat,
+			    pat_pmt_time * timeout_multiply);
+	dvb_read_tables(parms, dmx_fd, &pat, 1);
+	rc = pat.rc;
 	if (parms->p.abort)
 		return dvb_scan_handler;
 	if (rc < 0) {
@@ -526,23 +1548,23 @@ struct dvb_v5_descriptors *dvb_get_ts_tables(struct dvb_v5_fe_parms *__p,
 	if (parms->p.verbose)
 		dvb_table_pat_print(&parms->p, dvb_scan_handler->pat);
 
-	/* ATSC-specific VCT table */
-	if (atsc_filter) {
-		rc = dvb_read_section(&parms->p, dmx_fd,
-				      atsc_filter, ATSC_TABLE_VCT_PID,
-				      (void **)&dvb_scan_handler->vct,
-				      vct_time * timeout_multiply);
-		if (parms->p.abort)
-			return dvb_scan_handler;
-		if (rc < 0)
-			dvb_logerr(_("error while waiting for VCT table"));
-		else if (parms->p.verbose)
-			atsc_table_vct_print(&parms->p, dvb_scan_handler->vct);
-	}
-
-	/* PMT tables */
+	/*
+	 * PMT, NIT, SDT and VCT tables are read all at once, together with
+	 * the other NIT and SDT tables, as their sections are just appended
+	 * to the NIT and SDT. The tables that aren't needed by the services
+	 * of the PAT are optional, so they don't delay the scan when they
+	 * aren't there. The SDT is only needed for ATSC if there's no VCT,
+	 * so it is read afterwards.
+	 */
+	tabs = calloc(dvb_scan_handler->pat->programs + 5, sizeof(*tabs));
 	dvb_scan_handler->program = calloc(dvb_scan_handler->pat->programs,
 					   sizeof(*dvb_scan_handler->program));
+	if (!tabs || !dvb_scan_handler->program) {
+		dvb_logerr(_("%s: out of memory"), __func__);
+		free(tabs);
+		dvb_scan_free_handler_table(dvb_scan_handler);
+		return NULL;
+	}
 
 	dvb_pat_program_foreach(program, dvb_scan_handler->pat) {
 		dvb_scan_handler->program[num_pmt].pat_pgm = program;
@@ -557,79 +1579,106 @@ struct dvb_v5_descriptors *dvb_get_ts_tables(struct dvb_v5_fe_parms *__p,
 		if (parms->p.verbose)
 			dvb_log(_("Program #%d ID 0x%04x, service ID 0x%04x"),
 				num_pmt, program->pid, program->service_id);
-		rc = dvb_read_section(&parms->p, dmx_fd,
-				      DVB_TABLE_PMT, program->pid,
-				      (void **)&dvb_scan_handler->program[num_pmt].pmt,
-				      pat_pmt_time * timeout_multiply);
-		if (parms->p.abort) {
-			dvb_scan_handler->num_program = num_pmt + 1;
-			return dvb_scan_handler;
-		}
-		if (rc < 0) {
-			dvb_logerr(_("error while reading the PMT table for service 0x%04x"),
-				   program->service_id);
-			dvb_scan_handler->program[num_pmt].pmt = NULL;
-		} else {
-			if (parms->p.verbose)
-				dvb_table_pmt_print(&parms->p,
-						    dvb_scan_handler->program[num_pmt].pmt);
-		}
+		dvb_table_read_init(&tabs[num_tabs++], DVB_TABLE_PMT, program->pid,
+				    (void **)&dvb_scan_handler->program[num_pmt].pmt,
+				    pat_pmt_time * timeout_multiply);
 		num_pmt++;
+		num_services++;
 	}
 	dvb_scan_handler->num_program = num_pmt;
 
-	/* NIT table */
-	rc = dvb_read_section(&parms->p, dmx_fd,
-			      DVB_TABLE_NIT, DVB_TABLE_NIT_PID,
-			      (void **)&dvb_scan_handler->nit,
-			      nit_time * timeout_multiply);
-	if (parms->p.abort)
-		return dvb_scan_handler;
-	if (rc < 0)
-		dvb_logerr(_("error while reading the NIT table"));
-	else if (parms->p.verbose)
-		dvb_table_nit_print(&parms->p, dvb_scan_handler->nit);
-
-	/* SDT table */
-	if (!dvb_scan_handler->vct || other_nit) {
-		rc = dvb_read_section(&parms->p, dmx_fd,
-				DVB_TABLE_SDT, DVB_TABLE_SDT_PID,
-				(void **)&dvb_scan_handler->sdt,
-				sdt_time * timeout_multiply);
-		if (parms->p.abort)
-			return dvb_scan_handler;
-		if (rc < 0)
-			dvb_logerr(_("error while reading the SDT table"));
-		else if (parms->p.verbose)
-			dvb_table_sdt_print(&parms->p, dvb_scan_handler->sdt);
+	/* ATSC-specific VCT table */
+	if (atsc_filter)
+		dvb_table_read_init(&tabs[num_tabs++], atsc_filter,
+				    ATSC_TABLE_VCT_PID,
+				    (void **)&dvb_scan_handler->vct,
+				    vct_time * timeout_multiply);
+	dvb_table_read_init(&tabs[num_tabs++], DVB_TABLE_NIT,
+			    DVB_TABLE_NIT_PID,
+			    (void **)&dvb_scan_handler->nit,
+			    nit_time * timeout_multiply);
+	if (!atsc_filter || other_nit) {
+		dvb_table_read_init(&tabs[num_tabs], DVB_TABLE_SDT,
+				    DVB_TABLE_SDT_PID,
+				    (void **)&dvb_scan_handler->sdt,
+				    sdt_time * timeout_multiply);
+		/* It just names the services */
+		tabs[num_tabs++].optional = !num_services;
 	}
-
-	/* NIT/SDT other tables */
 	if (other_nit) {
 		if (parms->p.verbose)
 			dvb_log(_("Parsing other NIT/SDT"));
-		rc = dvb_read_section(&parms->p, dmx_fd,
-				      DVB_TABLE_NIT2, DVB_TABLE_NIT_PID,
-				      (void **)&dvb_scan_handler->nit,
-				      nit_time * timeout_multiply);
-		if (parms->p.abort)
-			return dvb_scan_handler;
-		if (rc < 0)
-			dvb_logerr(_("error while reading the NIT table"));
+		dvb_table_read_init(&tabs[num_tabs], DVB_TABLE_NIT2,
+				    DVB_TABLE_NIT_PID,
+				    (void **)&dvb_scan_handler->nit,
+				    nit_time * timeout_multiply);
+		tabs[num_tabs++].optional = 1;
+		dvb_table_read_init(&tabs[num_tabs], DVB_TABLE_SDT2,
+				    DVB_TABLE_SDT_PID,
+				    (void **)&dvb_scan_handler->sdt,
+				    sdt_time * timeout_multiply);
+		tabs[num_tabs++].optional = 1;
+	}
+
+	dvb_read_tables(parms, dmx_fd, tabs, num_tabs);
+	if (parms->p.abort) {
+		free(tabs);
+		return dvb_scan_handler;
+	}
+
+	t = tabs;
+	for (num_pmt = 0; num_pmt < dvb_scan_handler->num_program; num_pmt++) {
+		struct dvb_v5_descriptors_program *pgm;
+
+		pgm = &dvb_scan_handler->program[num_pmt];
+		if (!pgm->pat_pgm->service_id)
+			continue;
+		if (t->rc < 0) {
+			dvb_logerr(_("error while reading the PMT table for service 0x%04x"),
+				   pgm->pat_pgm->service_id);
+			pgm->pmt = NULL;
+		} else if (parms->p.verbose) {
+			dvb_table_pmt_print(&parms->p, pgm->pmt);
+		}
+		t++;
+	}
+
+	if (atsc_filter) {
+		if (t->rc < 0)
+			dvb_logerr(_("error while waiting for VCT table"));
 		else if (parms->p.verbose)
-			dvb_table_nit_print(&parms->p, dvb_scan_handler->nit);
+			atsc_table_vct_print(&parms->p, dvb_scan_handler->vct);
+		t++;
+	}
 
-		rc = dvb_read_section(&parms->p, dmx_fd,
-				DVB_TABLE_SDT2, DVB_TABLE_SDT_PID,
-				(void **)&dvb_scan_handler->sdt,
-				sdt_time * timeout_multiply);
-		if (parms->p.abort)
+	for (; t < tabs + num_tabs; t++) {
+		if (t->rc < 0)
+			dvb_logerr(_("error while reading the %s table"),
+				   t->sect.tid == DVB_TABLE_NIT ||
+				   t->sect.tid == DVB_TABLE_NIT2 ?
+				   "NIT" : "SDT");
+	}
+	if (parms->p.verbose && dvb_scan_handler->nit)
+		dvb_table_nit_print(&parms->p, dvb_scan_handler->nit);
+	if (parms->p.verbose && dvb_scan_handler->sdt)
+		dvb_table_sdt_print(&parms->p, dvb_scan_handler->sdt);
+
+	/* SDT table, for ATSC without VCT */
+	if (atsc_filter && !dvb_scan_handler->vct && !other_nit) {
+		dvb_table_read_init(&tabs[0], DVB_TABLE_SDT, DVB_TABLE_SDT_PID,
+				    (void **)&dvb_scan_handler->sdt,
+				    sdt_time * timeout_multiply);
+		dvb_read_tables(parms, dmx_fd, tabs, 1);
+		if (parms->p.abort) {
+			free(tabs);
 			return dvb_scan_handler;
-		if (rc < 0)
+		}
+		if (tabs[0].rc < 0)
 			dvb_logerr(_("error while reading the SDT table"));
-		else if (parms->p.verbose)
+		else if (parms->p.verbose && dvb_scan_handler->sdt)
 			dvb_table_sdt_print(&parms->p, dvb_scan_handler->sdt);
 	}
+	free(tabs);
 
 	return dvb_scan_handler;
 }
@@ -795,42 +1844,297 @@ struct dvb_entry *dvb_scan_add_entry(struct dvb_v5_fe_parms *__p,
 					pol, NO_STREAM_ID_FILTER);
 }
 
+/* Checks if entry is the same transponder as freq/pol/stream_id */
+static int dvb_entry_matches(struct dvb_entry *entry,
+			     uint32_t freq, int shift,
+			     enum dvb_sat_polarization pol, uint32_t stream_id)
+{
+	int i;
+
+	for (i = 0; i < entry->n_props; i++) {
+			uint32_t data = entry->props[i].u.data;
+
+		if (entry->props[i].cmd == DTV_FREQUENCY) {
+			if (freq < data - shift || freq > data + shift)
+				return 0;
+		}
+		if (pol != POLARIZATION_OFF
+		    && entry->props[i].cmd == DTV_POLARIZATION) {
+			if (data != pol)
+				return 0;
+		}
+		/* NO_STREAM_ID_FILTER: stream_id is not used.
+		 * 0: unspecified/auto. libdvbv5 default value.
+		 */
+		if (stream_id != NO_STREAM_ID_FILTER && stream_id != 0
+		    && entry->props[i].cmd == DTV_STREAM_ID) {
+			if (data != stream_id)
+				return 0;
+		}
+	}
+
+	return entry->n_props > 0;
+}
+
 int dvb_new_entry_is_needed(struct dvb_entry *entry,
 			    struct dvb_entry *last_entry,
 			    uint32_t freq, int shift,
 			    enum dvb_sat_polarization pol, uint32_t stream_id)
 {
 	for (; entry != last_entry; entry = entry->next) {
-		int i;
+		if (dvb_entry_matches(entry, freq, shift, pol, stream_id))
+			return 0;
+	}
 
-		for (i = 0; i < entry->n_props; i++) {
-			uint32_t data = entry->props[i].u.data;
+	return 1;
+}
 
-			if (entry->props[i].cmd == DTV_FREQUENCY) {
-				if (freq < data - shift || freq > data + shift)
-					break;
-			}
-			if (pol != POLARIZATION_OFF
-			    && entry->props[i].cmd == DTV_POLARIZATION) {
-				if (data != pol)
-					break;
-			}
-			/* NO_STREAM_ID_FILTER: stream_id is not used.
-			 * 0: unspecified/auto. libdvbv5 default value.
-			 */
-			if (stream_id != NO_STREAM_ID_FILTER && stream_id != 0
-			    && entry->props[i].cmd == DTV_STREAM_ID) {
-				if (data != stream_id)
-					break;
-			}
+/*
+ * Frequency index
+ *
+ * The entries of a list are kept sorted by frequency, except for the last
+ * ones added, which are merged into the sorted part after a few of them.
+ * The frequency of an entry doesn't change after it is added to the list,
+ * but the other properties may, so they're checked at the entries.
+ */
+
+#define FREQ_INDEX_PENDING	32
+
+struct dvb_freq_index_item {
+	uint32_t		freq;
+	unsigned		seq;	/* position at the list */
+	struct dvb_entry	*entry;
+};
+
+struct dvb_freq_index {
+	struct dvb_entry	*first_entry;
+	struct dvb_entry	*last_entry;	/* last one indexed */
+	unsigned		seq;
+
+	/* Entries without a frequency match any, so the index can't be used */
+	int			no_freq;
+
+	struct dvb_freq_index_item *items;
+	unsigned		n_items, n_sorted, size;
+};
+
+struct dvb_freq_index *dvb_freq_index_alloc(void)
+{
+	return calloc(1, sizeof(struct dvb_freq_index));
+}
+
+void dvb_freq_index_free(struct dvb_freq_index *idx)
+{
+	if (!idx)
+		return;
+	free(idx->items);
+	free(idx);
+}
+
+void dvb_scan_set_freq_index(struct dvb_v5_fe_parms *p,
+			     struct dvb_freq_index *idx)
+{
+	struct dvb_v5_fe_parms_priv *parms = (void *)p;
+
+	parms->freq_index = idx;
+}
+
+static int freq_index_cmp(const void *a, const void *b)
+{
+	const struct dvb_freq_index_item *ia = a, *ib = b;
+
+	if (ia->freq != ib->freq)
+		return ia->freq < ib->freq ? -1 : 1;
+	return ia->seq < ib->seq ? -1 : ia->seq > ib->seq;
+}
+
+/* Merges the pending items into the sorted ones */
+static void freq_index_merge(struct dvb_freq_index *idx)
+{
+	struct dvb_freq_index_item pending[FREQ_INDEX_PENDING];
+	unsigned n = idx->n_items - idx->n_sorted;
+	int i = idx->n_sorted - 1, j = n - 1, k = idx->n_items - 1;
+
+	memcpy(pending, &idx->items[idx->n_sorted], n * sizeof(*pending));
+	qsort(pending, n, sizeof(*pending), freq_index_cmp);
+
+	while (j >= 0) {
+		if (i >= 0 && freq_index_cmp(&idx->items[i], &pending[j]) > 0)
+			idx->items[k--] = idx->items[i--];
+		else
+			idx->items[k--] = pending[j--];
+	}
+	idx->n_sorted = idx->n_items;
+}
+
+/* Indexes the entries added to the list since the last call */
+static int freq_index_update(struct dvb_freq_index *idx,
+			     struct dvb_entry *first_entry)
+{
+	struct dvb_freq_index_item *item;
+	struct dvb_entry *entry;
+	uint32_t freq;
+
+	if (idx->first_entry != first_entry) {
+		idx->first_entry = first_entry;
+		idx->last_entry = NULL;
+		idx->seq = 0;
+		idx->no_freq = 0;
+		idx->n_items = 0;
+		idx->n_sorted = 0;
+	}
+
+	entry = idx->last_entry ? idx->last_entry->next : first_entry;
+	for (; entry; entry = entry->next) {
+		idx->last_entry = entry;
+		idx->seq++;
+
+		if (dvb_retrieve_entry_prop(entry, DTV_FREQUENCY, &freq)) {
+			if (entry->n_props)
+				idx->no_freq = 1;
+			continue;
 		}
-		if (i == entry->n_props && entry->n_props > 0)
-			return 0;
+
+		if (idx->n_items == idx->size) {
+			unsigned size = idx->size ? idx->size * 2 : 256;
+
+			item = realloc(idx->items, size * sizeof(*item));
+			if (!item)
+				return -ENOMEM;
+			idx->items = item;
+			idx->size = size;
+		}
+		item = &idx->items[idx->n_items++];
+		item->freq = freq;
+		item->seq = idx->seq;
+		item->entry = entry;
+
+		if (idx->n_items - idx->n_sorted == FREQ_INDEX_PENDING)
+			freq_index_merge(idx);
+	}
+
+	return 0;
+}
+
+/* Returns the first sorted item with a frequency >= freq */
+static unsigned freq_index_lower_bound(struct dvb_freq_index *idx,
+				       uint32_t freq)
+{
+	unsigned lo = 0, hi = idx->n_sorted, mid;
+
+	while (lo < hi) {
+		mid = (lo + hi) / 2;
+		if (idx->items[mid].freq < freq)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return lo;
+}
+
+/*
+ * Calls fn() for the items with frequencies in the [min, max] range, until
+ * it returns non-zero. Returns what fn() returned, or 0.
+ */
+static int freq_index_foreach(struct dvb_freq_index *idx,
+			      uint32_t min, uint32_t max,
+			      int (*fn)(struct dvb_freq_index_item *item,
+					void *priv),
+			      void *priv)
+{
+	struct dvb_freq_index_item *item;
+	unsigned i;
+	int ret;
+
+	for (i = freq_index_lower_bound(idx, min); i < idx->n_sorted; i++) {
+		item = &idx->items[i];
+		if (item->freq > max)
+			break;
+		ret = fn(item, priv);
+		if (ret)
+			return ret;
+	}
+	for (i = idx->n_sorted; i < idx->n_items; i++) {
+		item = &idx->items[i];
+		if (item->freq < min || item->freq > max)
+			continue;
+		ret = fn(item, priv);
+		if (ret)
+			return ret;
 	}
+	return 0;
+}
+
+struct freq_index_lookup {
+	struct dvb_entry		*entry;
+	unsigned			seq;
+	uint32_t			freq;
+	int				shift;
+	enum dvb_sat_polarization	pol;
+	uint32_t			stream_id;
+};
 
+static int freq_index_find_seq(struct dvb_freq_index_item *item, void *priv)
+{
+	struct freq_index_lookup *l = priv;
+
+	if (item->entry != l->entry)
+		return 0;
+	l->seq = item->seq;
 	return 1;
 }
 
+static int freq_index_match(struct dvb_freq_index_item *item, void *priv)
+{
+	struct freq_index_lookup *l = priv;
+
+	if (l->seq && item->seq >= l->seq)
+		return 0;
+	return dvb_entry_matches(item->entry, l->freq, l->shift, l->pol,
+				 l->stream_id);
+}
+
+int dvb_freq_index_entry_is_needed(struct dvb_freq_index *idx,
+				   struct dvb_entry *first_entry,
+				   struct dvb_entry *last_entry,
+				   uint32_t freq, int shift,
+				   enum dvb_sat_polarization pol,
+				   uint32_t stream_id)
+{
+	struct freq_index_lookup l = {
+		.freq = freq,
+		.shift = shift,
+		.pol = pol,
+		.stream_id = stream_id,
+	};
+	uint32_t min, max, last_freq;
+
+	if (!idx || shift < 0 || freq_index_update(idx, first_entry) ||
+	    idx->no_freq)
+		goto linear;
+
+	/* Only the entries before last_entry should be checked */
+	if (last_entry) {
+		if (dvb_retrieve_entry_prop(last_entry, DTV_FREQUENCY,
+					    &last_freq))
+			goto linear;
+		l.entry = last_entry;
+		if (!freq_index_foreach(idx, last_freq, last_freq,
+					freq_index_find_seq, &l))
+			goto linear;
+	}
+
+	/* The entries that dvb_entry_matches() may accept */
+	min = freq > (uint32_t)shift ? freq - shift : 0;
+	max = UINT32_MAX - freq > (uint32_t)shift ? freq + shift : UINT32_MAX;
+
+	return !freq_index_foreach(idx, min, max, freq_index_match, &l);
+
+linear:
+	return dvb_new_entry_is_needed(first_entry, last_entry, freq, shift,
+				       pol, stream_id);
+}
+
 struct dvb_entry *dvb_scan_add_entry_ex(struct dvb_v5_fe_parms *__p,
 					struct dvb_entry *first_entry,
 					struct dvb_entry *entry,
@@ -842,8 +2146,8 @@ struct dvb_entry *dvb_scan_add_entry_ex(struct dvb_v5_fe_parms *__p,
 	struct dvb_entry *new_entry;
 	int i, n = 2;
 
-	if (!dvb_new_entry_is_needed(first_entry, NULL, freq, shift, pol,
-				     stream_id))
+	if (!dvb_freq_index_entry_is_needed(parms->freq_index, first_entry,
+					    NULL, freq, shift, pol, stream_id))
 		return NULL;
 
 	/* Clone the current entry into a new entry */
@@ -16,6 +16,7 @@
  * Or, point your browser to http://www.gnu.org/licenses/old-licenses/gpl-2.0.html
  */
 
+#include <errno.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -23,6 +24,8 @@
 #include <libdvbv5/dvb-file.h>
 #include <libdvbv5/dvb-v5-std.h>
 
+#include "dvb-file-priv.h"
+
 #include <config.h>
 
 #ifdef ENABLE_NLS
@@ -255,190 +258,203 @@ static const struct dvb_parse_file vdr_file_format = {
 	}
 };
 
-int dvb_write_format_vdr(const char *fname,
-			 struct dvb_file *dvb_file)
+int dvb_write_entry_vdr(FILE *fp, struct dvb_entry *entry,
+			const char *fname, int line)
 {
 	const struct dvb_parse_file *parse_file = &vdr_file_format;
 	const struct dvb_parse_struct *formats = parse_file->formats;
-	int i, j, line = 0;
-	FILE *fp;
+	int i, j;
 	const struct dvb_parse_struct *fmt;
-	struct dvb_entry *entry;
 	const struct dvb_parse_table *table;
 	const char *id;
 	uint32_t delsys, freq, data, srate;
 	char err_msg[80];
 
-	fp = fopen(fname, "w");
-	if (!fp) {
-		perror(fname);
-		return -errno;
+	if (dvb_retrieve_entry_prop(entry, DTV_DELIVERY_SYSTEM, &delsys) < 0)
+		return 1;
+
+	for (i = 0; formats[i].delsys != 0; i++) {
+		if (formats[i].delsys == delsys)
+			break;
 	}
+	if (formats[i].delsys == 0) {
+		fprintf(stderr,
+			_("WARNING: entry %d: delivery system %d not supported on this format. skipping entry\n"),
+			 line, delsys);
+		return 1;
+	}
+	id = formats[i].id;
 
-	for (entry = dvb_file->first_entry; entry != NULL; entry = entry->next) {
-		if (dvb_retrieve_entry_prop(entry, DTV_DELIVERY_SYSTEM, &delsys) < 0)
-			continue;
+	if (!entry->channel) {
+		fprintf(stderr,
+			_("WARNING: entry %d: channel name not found. skipping entry\n"),
+			 line);
+		return 1;
+	}
+
+	if (dvb_retrieve_entry_prop(entry, DTV_FREQUENCY, &freq) < 0) {
+		fprintf(stderr,
+			_("WARNING: entry %d: frequency not found. skipping entry\n"),
+			 line);
+		return 1;
+	}
 
-		for (i = 0; formats[i].delsys != 0; i++) {
-			if (formats[i].delsys == delsys)
+	/* Output channel name */
+	fprintf(fp, "%s", entry->channel);
+	if (entry->vchannel)
+		fprintf(fp, ",%s", entry->vchannel);
+	fprintf(fp, ":");
+
+	/*
+	 * Output frequency:
+	 *	in kHz for terrestrial/cable
+	 *	in MHz for satellite
+	 */
+	fprintf(fp, "%i:", freq / 1000);
+
+	/* Output modulation parameters */
+	fmt = &formats[i];
+	for (i = 0; i < fmt->size; i++) {
+		table = &fmt->table[i];
+
+		for (j = 0; j < entry->n_props; j++)
+			if (entry->props[j].cmd == table->prop)
 				break;
-		}
-		if (formats[i].delsys == 0) {
-			fprintf(stderr,
-				_("WARNING: entry %d: delivery system %d not supported on this format. skipping entry\n"),
-				 line, delsys);
-			continue;
-		}
-		id = formats[i].id;
 
-		if (!entry->channel) {
-			fprintf(stderr,
-				_("WARNING: entry %d: channel name not found. skipping entry\n"),
-				 line);
+		if (!table->size || j >= entry->n_props)
 			continue;
-		}
 
-		if (dvb_retrieve_entry_prop(entry, DTV_FREQUENCY, &freq) < 0) {
-			fprintf(stderr,
-				_("WARNING: entry %d: frequency not found. skipping entry\n"),
-				 line);
-			continue;
-		}
+		data = entry->props[j].u.data;
 
-		/* Output channel name */
-		fprintf(fp, "%s", entry->channel);
-		if (entry->vchannel)
-			fprintf(fp, ",%s", entry->vchannel);
-		fprintf(fp, ":");
-
-		/*
-		 * Output frequency:
-		 *	in kHz for terrestrial/cable
-		 *	in MHz for satellite
-		 */
-		fprintf(fp, "%i:", freq / 1000);
-
-		/* Output modulation parameters */
-		fmt = &formats[i];
-		for (i = 0; i < fmt->size; i++) {
-			table = &fmt->table[i];
-
-			for (j = 0; j < entry->n_props; j++)
-				if (entry->props[j].cmd == table->prop)
+		if (table->prop == DTV_BANDWIDTH_HZ) {
+			for (j = 0; j < ARRAY_SIZE(fe_bandwidth_name); j++) {
+				if (fe_bandwidth_name[j] == data) {
+					data = j;
 					break;
-
-			if (!table->size || j >= entry->n_props)
-				continue;
-
-			data = entry->props[j].u.data;
-
-			if (table->prop == DTV_BANDWIDTH_HZ) {
-				for (j = 0; j < ARRAY_SIZE(fe_bandwidth_name); j++) {
-					if (fe_bandwidth_name[j] == data) {
-						data = j;
-						break;
-					}
 				}
-				if (j == ARRAY_SIZE(fe_bandwidth_name))
-					data = BANDWIDTH_AUTO;
 			}
-			if (data >= table->size) {
-				sprintf(err_msg,
-						_("value not supported"));
-				goto error;
-			}
-
-			fprintf(fp, "%s", table->table[data]);
+			if (j == ARRAY_SIZE(fe_bandwidth_name))
+				data = BANDWIDTH_AUTO;
 		}
-		fprintf(fp, ":");
-
-		/*
-		 * Output sources configuration for VDR
-		 *
-		 *   S (satellite) xy.z (orbital position in degrees) E or W (east or west)
-		 *
-		 *   FIXME: in case of ATSC we use "A", this is what w_scan does
-		 */
-
-		if (entry->location) {
-			switch(delsys) {
-			case SYS_DVBS:
-			case SYS_DVBS2:
-				fprintf(fp, "%s", entry->location);
-				break;
-			default:
-				fprintf(fp, "%s", id);
-				break;
-			}
-		} else {
-			fprintf(fp, "%s", id);
+		if (data >= table->size) {
+			sprintf(err_msg,
+					_("value not supported"));
+			goto error;
 		}
-		fprintf(fp, ":");
 
-		/* Output symbol rate */
-		srate = 27500000;
+		fprintf(fp, "%s", table->table[data]);
+	}
+	fprintf(fp, ":");
+
+	/*
+	 * Output sources configuration for VDR
+	 *
+	 *   S (satellite) xy.z (orbital position in degrees) E or W (east or west)
+	 *
+	 *   FIXME: in case of ATSC we use "A", this is what w_scan does
+	 */
+
+	if (entry->location) {
 		switch(delsys) {
-		case SYS_DVBT:
-			srate = 0;
-			break;
 		case SYS_DVBS:
 		case SYS_DVBS2:
-		case SYS_DVBC_ANNEX_A:
-			if (dvb_retrieve_entry_prop(entry, DTV_SYMBOL_RATE, &srate) < 0) {
-				sprintf(err_msg,
-						_("symbol rate not found"));
-				goto error;
-			}
-		}
-		fprintf(fp, "%d:", srate / 1000);
-
-		/* Output video PID(s) */
-		for (i = 0; i < entry->video_pid_len; i++) {
-			if (i)
-				fprintf(fp,",");
-			fprintf(fp, "%d", entry->video_pid[i]);
+			fprintf(fp, "%s", entry->location);
+			break;
+		default:
+			fprintf(fp, "%s", id);
+			break;
 		}
-		if (!i)
-			fprintf(fp, "0");
-		fprintf(fp, ":");
-
-		/* Output audio PID(s) */
-		for (i = 0; i < entry->audio_pid_len; i++) {
-			if (i)
-				fprintf(fp,",");
-			fprintf(fp, "%d", entry->audio_pid[i]);
+	} else {
+		fprintf(fp, "%s", id);
+	}
+	fprintf(fp, ":");
+
+	/* Output symbol rate */
+	srate = 27500000;
+	switch(delsys) {
+	case SYS_DVBT:
+		srate = 0;
+		break;
+	case SYS_DVBS:
+	case SYS_DVBS2:
+	case SYS_DVBC_ANNEX_A:
+		if (dvb_retrieve_entry_prop(entry, DTV_SYMBOL_RATE, &srate) < 0) {
+			sprintf(err_msg,
+					_("symbol rate not found"));
+			goto error;
 		}
-		if (!i)
-			fprintf(fp, "0");
-		fprintf(fp, ":");
+	}
+	fprintf(fp, "%d:", srate / 1000);
 
-		/* FIXME: Output teletex PID(s) */
-		fprintf(fp, "0:");
+	/* Output video PID(s) */
+	for (i = 0; i < entry->video_pid_len; i++) {
+		if (i)
+			fprintf(fp,",");
+		fprintf(fp, "%d", entry->video_pid[i]);
+	}
+	if (!i)
+		fprintf(fp, "0");
+	fprintf(fp, ":");
+
+	/* Output audio PID(s) */
+	for (i = 0; i < entry->audio_pid_len; i++) {
+		if (i)
+			fprintf(fp,",");
+		fprintf(fp, "%d", entry->audio_pid[i]);
+	}
+	if (!i)
+		fprintf(fp, "0");
+	fprintf(fp, ":");
 
-		/* Output Conditional Access - let VDR discover it */
-		fprintf(fp, "0:");
+	/* FIXME: Output teletex PID(s) */
+	fprintf(fp, "0:");
 
-		/* Output Service ID */
-		fprintf(fp, "%d:", entry->service_id);
+	/* Output Conditional Access - let VDR discover it */
+	fprintf(fp, "0:");
 
-		/* Output Network ID */
-		fprintf(fp, "%d:", entry->network_id);
+	/* Output Service ID */
+	fprintf(fp, "%d:", entry->service_id);
 
-		/* Output Transport Stream ID */
-		fprintf(fp, "%d:", entry->transport_id);
+	/* Output Network ID */
+	fprintf(fp, "%d:", entry->network_id);
 
-		/* Output Radio ID
-		 * this is the last entry, tagged bei a new line (not a colon!)
-		 */
-		fprintf(fp, "0\n");
-		line++;
-	};
-	fclose (fp);
+	/* Output Transport Stream ID */
+	fprintf(fp, "%d:", entry->transport_id);
+
+	/* Output Radio ID
+	 * this is the last entry, tagged bei a new line (not a colon!)
+	 */
+	fprintf(fp, "0\n");
 	return 0;
 
 error:
 	fprintf(stderr, _("ERROR: %s while parsing entry %d of %s\n"),
 		 err_msg, line, fname);
-	fclose(fp);
 	return -1;
 }
+
+int dvb_write_format_vdr(const char *fname,
+			 struct dvb_file *dvb_file)
+{
+	int rc, line = 0;
+	FILE *fp;
+	struct dvb_entry *entry;
+
+	fp = fopen(fname, "w");
+	if (!fp) {
+		perror(fname);
+		return -errno;
+	}
+
+	for (entry = dvb_file->first_entry; entry != NULL; entry = entry->next) {
+		rc = dvb_write_entry_vdr(fp, entry, fname, line);
+		if (rc < 0) {
+			fclose(fp);
+			return rc;
+		}
+		if (!rc)
+			line++;
+	};
+	fclose (fp);
+	return 0;
+}
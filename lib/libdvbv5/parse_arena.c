@@ -0,0 +1,246 @@
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation version 2.1 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ * Or, point your browser to http://www.gnu.org/licenses/old-licenses/gpl-2.0.html
+ */
+
+/*
+ * Arena allocator for the parsed tables and descriptors.
+ *
+ * The memory is taken from big blocks, so a whole table, or a whole scan,
+ * lives in a few blocks that are freed at once.
+ *
+ * The free functions of the tables and descriptors don't know where their
+ * memory came from, so every allocation, on the heap or in an arena, is
+ * prefixed by its size, and the size of arena memory is tagged with
+ * DVB_PARSE_IN_ARENA. dvb_parse_free() just checks the tag, and ignores
+ * arena memory.
+ */
+
+#include <config.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "dvb-fe-priv.h"
+#include <libdvbv5/descriptors.h>
+#include <parse_arena.h>
+
+#define DVB_PARSE_ARENA_BLOCK_SIZE	(64 * 1024)
+#define DVB_PARSE_ARENA_ALIGN		sizeof(uint64_t)
+
+/* Set on the size of the memory allocated from an arena */
+#define DVB_PARSE_IN_ARENA		((size_t)1 << (sizeof(size_t) * 8 - 1))
+
+/* The prefix of each allocation, that keeps the data 8-byte aligned */
+union dvb_parse_hdr {
+	size_t size;
+	uint64_t align;
+};
+
+#define dvb_parse_hdr(ptr)	((union dvb_parse_hdr *)(ptr) - 1)
+
+struct dvb_parse_arena_block {
+	struct dvb_parse_arena_block *next;
+	size_t size;
+	size_t used;
+	uint64_t data[];
+};
+
+struct dvb_parse_arena {
+	struct dvb_parse_arena_block *blocks;
+	size_t block_size;
+};
+
+struct dvb_parse_arena *dvb_parse_arena_alloc(size_t block_size)
+{
+	struct dvb_parse_arena *arena;
+
+	arena = calloc(sizeof(*arena), 1);
+	if (!arena)
+		return NULL;
+	arena->block_size = block_size ? block_size : DVB_PARSE_ARENA_BLOCK_SIZE;
+
+	return arena;
+}
+
+void dvb_parse_arena_reset(struct dvb_parse_arena *arena)
+{
+	struct dvb_parse_arena_block *block, *next;
+
+	if (!arena || !arena->blocks)
+		return;
+
+	/* Keep the first block, as it will likely be needed again */
+	for (block = arena->blocks->next; block; block = next) {
+		next = block->next;
+		free(block);
+	}
+	arena->blocks->next = NULL;
+	arena->blocks->used = 0;
+}
+
+void dvb_parse_arena_free(struct dvb_parse_arena *arena)
+{
+	struct dvb_parse_arena_block *block, *next;
+
+	if (!arena)
+		return;
+
+	for (block = arena->blocks; block; block = next) {
+		next = block->next;
+		free(block);
+	}
+	free(arena);
+}
+
+void dvb_parse_set_arena(struct dvb_v5_fe_parms *p, struct dvb_parse_arena *arena)
+{
+	struct dvb_v5_fe_parms_priv *parms = (void *)p;
+
+	parms->arena = arena;
+}
+
+static void *arena_alloc(struct dvb_parse_arena *arena, size_t size)
+{
+	struct dvb_parse_arena_block *block = arena->blocks;
+	union dvb_parse_hdr *hdr;
+	size_t need;
+
+	if (size >= DVB_PARSE_IN_ARENA - sizeof(*hdr) - DVB_PARSE_ARENA_ALIGN)
+		return NULL;
+	need = (sizeof(*hdr) + size + DVB_PARSE_ARENA_ALIGN - 1) &
+	       ~(DVB_PARSE_ARENA_ALIGN - 1);
+
+	if (!block || block->used + need > block->size) {
+		size_t block_size = arena->block_size;
+
+		if (block_size < need)
+			block_size = need;
+		block = malloc(sizeof(*block) + block_size);
+		if (!block)
+			return NULL;
+		block->size = block_size;
+		block->used = 0;
+		block->next = arena->blocks;
+		arena->blocks = block;
+	}
+
+	hdr = (union dvb_parse_hdr *)((uint8_t *)block->data + block->used);
+	block->used += need;
+	hdr->size = size | DVB_PARSE_IN_ARENA;
+
+	return hdr + 1;
+}
+
+static void *heap_alloc(size_t size, int zero)
+{
+	union dvb_parse_hdr *hdr;
+
+	if (size >= DVB_PARSE_IN_ARENA - sizeof(*hdr))
+		return NULL;
+	if (zero)
+		hdr = calloc(1, sizeof(*hdr) + size);
+	else
+		hdr = malloc(sizeof(*hdr) + size);
+	if (!hdr)
+		return NULL;
+	hdr->size = size;
+
+	return hdr + 1;
+}
+
+void *dvb_parse_malloc(struct dvb_v5_fe_parms *p, size_t size)
+{
+	struct dvb_v5_fe_parms_priv *parms = (void *)p;
+
+	if (parms && parms->arena)
+		return arena_alloc(parms->arena, size);
+	return heap_alloc(size, 0);
+}
+
+void *dvb_parse_calloc(struct dvb_v5_fe_parms *p, size_t nmemb, size_t size)
+{
+	struct dvb_v5_fe_parms_priv *parms = (void *)p;
+	void *ptr;
+
+	if (size && nmemb > SIZE_MAX / size)
+		return NULL;
+	if (!parms || !parms->arena)
+		return heap_alloc(nmemb * size, 1);
+
+	ptr = arena_alloc(parms->arena, nmemb * size);
+	if (ptr)
+		memset(ptr, 0, nmemb * size);
+	return ptr;
+}
+
+void *dvb_parse_realloc(struct dvb_v5_fe_parms *p, void *ptr, size_t size)
+{
+	union dvb_parse_hdr *hdr;
+	size_t old_size;
+	void *new;
+
+	if (!ptr)
+		return dvb_parse_malloc(p, size);
+
+	hdr = dvb_parse_hdr(ptr);
+	if (!(hdr->size & DVB_PARSE_IN_ARENA)) {
+		if (size >= DVB_PARSE_IN_ARENA - sizeof(*hdr))
+			return NULL;
+		hdr = realloc(hdr, sizeof(*hdr) + size);
+		if (!hdr)
+			return NULL;
+		hdr->size = size;
+		return hdr + 1;
+	}
+
+	/* Shrinking is done in place: the space is only lost until the reset */
+	old_size = hdr->size & ~DVB_PARSE_IN_ARENA;
+	if (size <= old_size) {
+		hdr->size = size | DVB_PARSE_IN_ARENA;
+		return ptr;
+	}
+	new = dvb_parse_malloc(p, size);
+	if (new)
+		memcpy(new, ptr, old_size);
+	return new;
+}
+
+void dvb_parse_free(void *ptr)
+{
+	union dvb_parse_hdr *hdr;
+
+	if (!ptr)
+		return;
+
+	hdr = dvb_parse_hdr(ptr);
+	if (!(hdr->size & DVB_PARSE_IN_ARENA))
+		free(hdr);
+}
+
+void *dvb_parse_detach(void *ptr)
+{
+	union dvb_parse_hdr *hdr;
+	size_t size;
+
+	if (!ptr)
+		return NULL;
+
+	hdr = dvb_parse_hdr(ptr);
+	size = hdr->size;
+	if (size & DVB_PARSE_IN_ARENA)
+		return ptr;
+	memmove(hdr, ptr, size);
+	return hdr;
+}
@@ -0,0 +1,44 @@
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation version 2.1 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ * Or, point your browser to http://www.gnu.org/licenses/old-licenses/gpl-2.0.html
+ */
+
+#if HAVE_VISIBILITY
+#pragma GCC visibility push(hidden)
+#endif
+
+#include <stddef.h>
+
+struct dvb_v5_fe_parms;
+
+/*
+ * Memory allocation for the parsed tables and descriptors. If a parse
+ * arena was set with dvb_parse_set_arena(), the memory comes from it,
+ * otherwise from the heap. dvb_parse_free() does nothing for memory of
+ * an arena, as it is only released together with the arena.
+ *
+ * The memory is prefixed by a header, so it should only be released with
+ * dvb_parse_free(). dvb_parse_detach() turns heap memory into something
+ * free() can release, for the strings returned by the public API, and
+ * leaves arena memory alone.
+ */
+void *dvb_parse_malloc(struct dvb_v5_fe_parms *parms, size_t size);
+void *dvb_parse_calloc(struct dvb_v5_fe_parms *parms, size_t nmemb, size_t size);
+void *dvb_parse_realloc(struct dvb_v5_fe_parms *parms, void *ptr, size_t size);
+void dvb_parse_free(void *ptr);
+void *dvb_parse_detach(void *ptr);
+
+#if HAVE_VISIBILITY
+#pragma GCC visibility pop
+#endif
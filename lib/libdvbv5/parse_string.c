@@ -29,11 +29,29 @@
 #include <strings.h> /* strcasecmp */
 
 #include <parse_string.h>
+#include <parse_arena.h>
 #include <libdvbv5/dvb-log.h>
 #include <libdvbv5/dvb-fe.h>
+#include "dvb-fe-priv.h"
 
 #define CS_OPTIONS "//TRANSLIT"
 
+/*
+ * Opening an iconv descriptor costs much more than converting a service or
+ * event name, so they are kept open, per struct dvb_v5_fe_parms, keyed by
+ * the charsets. Like the rest of the parms, the cache isn't thread safe.
+ */
+#define DVB_ICONV_CACHE_SIZE 8
+
+struct dvb_iconv_cache {
+	struct {
+		char *from;
+		char *to;
+		iconv_t cd;
+	} entry[DVB_ICONV_CACHE_SIZE];
+	unsigned num, next;
+};
+
 struct charset_conv {
 	unsigned len;
 	unsigned char  data[3];
@@ -299,6 +317,112 @@ static struct charset_conv en300468_latin_00_to_utf8[256] = {
 	[0xff] = { 2, {0xc2, 0xad, } },
 };
 
+static iconv_t dvb_iconv_get(struct dvb_v5_fe_parms *p,
+			     const char *to, const char *from)
+{
+	struct dvb_v5_fe_parms_priv *parms = (void *)p;
+	struct dvb_iconv_cache *cache = parms->iconv_cache;
+	unsigned i;
+	iconv_t cd;
+
+	if (!cache) {
+		cache = calloc(1, sizeof(*cache));
+		if (!cache)
+			return iconv_open(to, from);
+		parms->iconv_cache = cache;
+	}
+
+	for (i = 0; i < cache->num; i++) {
+		if (!strcmp(cache->entry[i].to, to) &&
+		    !strcmp(cache->entry[i].from, from)) {
+			cd = cache->entry[i].cd;
+			/* Back to the initial shift state */
+			iconv(cd, NULL, NULL, NULL, NULL);
+			return cd;
+		}
+	}
+
+	cd = iconv_open(to, from);
+	if (cd == (iconv_t)(-1))
+		return cd;
+
+	if (cache->num < DVB_ICONV_CACHE_SIZE) {
+		i = cache->num++;
+	} else {
+		i = cache->next;
+		cache->next = (i + 1) % DVB_ICONV_CACHE_SIZE;
+		iconv_close(cache->entry[i].cd);
+		free(cache->entry[i].from);
+		free(cache->entry[i].to);
+	}
+	cache->entry[i].from = strdup(from);
+	cache->entry[i].to = strdup(to);
+	if (!cache->entry[i].from || !cache->entry[i].to) {
+		free(cache->entry[i].from);
+		free(cache->entry[i].to);
+		cache->entry[i] = cache->entry[--cache->num];
+		return cd;
+	}
+	cache->entry[i].cd = cd;
+	return cd;
+}
+
+static void dvb_iconv_put(struct dvb_v5_fe_parms *p, iconv_t cd)
+{
+	struct dvb_v5_fe_parms_priv *parms = (void *)p;
+	struct dvb_iconv_cache *cache = parms->iconv_cache;
+	unsigned i;
+
+	if (cache) {
+		for (i = 0; i < cache->num; i++)
+			if (cache->entry[i].cd == cd)
+				return;
+	}
+	iconv_close(cd);
+}
+
+void dvb_iconv_cache_free(struct dvb_v5_fe_parms *p)
+{
+	struct dvb_v5_fe_parms_priv *parms = (void *)p;
+	struct dvb_iconv_cache *cache = parms->iconv_cache;
+	unsigned i;
+
+	if (!cache)
+		return;
+
+	for (i = 0; i < cache->num; i++) {
+		iconv_close(cache->entry[i].cd);
+		free(cache->entry[i].from);
+		free(cache->entry[i].to);
+	}
+	free(cache);
+	parms->iconv_cache = NULL;
+}
+
+/*
+ * Charsets whose 7-bit characters are the ASCII ones. A string with only
+ * those doesn't need any conversion between them.
+ */
+static int dvb_charset_is_ascii_superset(const char *charset)
+{
+	return !strncasecmp(charset, "ISO-8859", 8) ||
+	       !strcasecmp(charset, "ISO-6937") ||
+	       !strcasecmp(charset, "ISO-10646/UTF-8") ||
+	       !strcasecmp(charset, "UTF-8") ||
+	       !strcasecmp(charset, "US-ASCII") ||
+	       !strcasecmp(charset, "ASCII");
+}
+
+static int dvb_string_is_ascii(const unsigned char *s, size_t len)
+{
+	size_t i;
+
+	for (i = 0; i < len; i++)
+		if (s[i] & 0x80)
+			return 0;
+	return 1;
+}
+
 void dvb_iconv_to_charset(struct dvb_v5_fe_parms *parms,
 			  char *dest,
 			  size_t destlen,
@@ -309,10 +433,18 @@ void dvb_iconv_to_charset(struct dvb_v5_fe_parms *parms,
 	char out_cs[strlen(output_charset) + 1 + sizeof(CS_OPTIONS)];
 	char *p = dest;
 
+	if (len < destlen && dvb_string_is_ascii(src, len) &&
+	    dvb_charset_is_ascii_superset(input_charset) &&
+	    dvb_charset_is_ascii_superset(output_charset)) {
+		memcpy(p, src, len);
+		p[len] = '\0';
+		return;
+	}
+
 	strcpy(out_cs, output_charset);
 	strcat(out_cs, CS_OPTIONS);
 
-	iconv_t cd = iconv_open(out_cs, input_charset);
+	iconv_t cd = dvb_iconv_get(parms, out_cs, input_charset);
 	if (cd == (iconv_t)(-1)) {
 		memcpy(p, src, len);
 		p[len] = '\0';
@@ -322,7 +454,7 @@ void dvb_iconv_to_charset(struct dvb_v5_fe_parms *parms,
 			dvb_log("Try setting GCONV_PATH to the bundled gconv dir.\n");
 	} else {
 		iconv(cd, (ICONV_CONST char **)&src, &len, &p, &destlen);
-		iconv_close(cd);
+		dvb_iconv_put(parms, cd);
 		*p = '\0';
 	}
 }
@@ -352,7 +484,7 @@ static void charset_conversion(struct dvb_v5_fe_parms *parms, char **dest, const
 			tmp = (unsigned char *)*dest;
 			len = p - *dest;
 
-			*dest = malloc(destlen + 1);
+			*dest = dvb_parse_malloc(parms, destlen + 1);
 			input_charset = "UTF-8";
 			s = tmp;
 		} else
@@ -377,11 +509,11 @@ void dvb_parse_string(struct dvb_v5_fe_parms *parms, char **dest, char **emph,
 	int emphasis = 0;
 
 	if (*dest) {
-		free(*dest);
+		dvb_parse_free(*dest);
 		*dest = NULL;
 	}
 	if (*emph) {
-		free(*emph);
+		dvb_parse_free(*emph);
 		*emph = NULL;
 	}
 	if (!len)
@@ -442,8 +574,8 @@ void dvb_parse_string(struct dvb_v5_fe_parms *parms, char **dest, char **emph,
 	 * use 3 chars for one code, use it for destlen
 	 */
 	destlen = len * 3;
-	*dest = malloc(destlen + 1);
-	*emph = malloc(destlen + 1);
+	*dest = dvb_parse_malloc(parms, destlen + 1);
+	*emph = dvb_parse_malloc(parms, destlen + 1);
 
 	/* Remove special chars */
 	if (!strncasecmp(type, "ISO-8859", 8) || !strcasecmp(type, "ISO-6937") || !strcasecmp(type, "ISO-10646/UTF-8")) {
@@ -520,18 +652,18 @@ void dvb_parse_string(struct dvb_v5_fe_parms *parms, char **dest, char **emph,
 	charset_conversion(parms, dest, s, len, type);
 	/* The code had over-sized the space. Fix it. */
 	if (*dest)
-		*dest = realloc(*dest, strlen(*dest) + 1);
+		*dest = dvb_parse_realloc(parms, *dest, strlen(*dest) + 1);
 
 	if (!len2) {
 		if (tmp2) {
 			free (tmp2);
 			tmp2 = NULL;
 		}
-		free (*emph);
+		dvb_parse_free(*emph);
 		*emph = NULL;
 	} else {
 		charset_conversion(parms, emph, tmp2, len2, type);
-		*emph = realloc(*emph, strlen(*emph) + 1);
+		*emph = dvb_parse_realloc(parms, *emph, strlen(*emph) + 1);
 	}
 
 	if (tmp1)
@@ -20,6 +20,7 @@
 #include <libdvbv5/atsc_eit.h>
 #include <libdvbv5/descriptors.h>
 #include <libdvbv5/dvb-fe.h>
+#include <parse_arena.h>
 
 #if __GNUC__ >= 9
 #pragma GCC diagnostic ignored "-Waddress-of-packed-member"
@@ -48,7 +49,7 @@ ssize_t atsc_table_eit_init(struct dvb_v5_fe_parms *parms, const uint8_t *buf,
 	}
 
 	if (!*table) {
-		*table = calloc(sizeof(struct atsc_table_eit), 1);
+		*table = dvb_parse_calloc(parms, sizeof(struct atsc_table_eit), 1);
 		if (!*table) {
 			dvb_logerr("%s: out of memory", __func__);
 			return -3;
@@ -74,7 +75,7 @@ ssize_t atsc_table_eit_init(struct dvb_v5_fe_parms *parms, const uint8_t *buf,
 				   endbuf - p, size);
 			return -4;
 		}
-		event = (struct atsc_table_eit_event *) malloc(sizeof(struct atsc_table_eit_event));
+		event = (struct atsc_table_eit_event *) dvb_parse_malloc(parms, sizeof(struct atsc_table_eit_event));
 		if (!event) {
 			dvb_logerr("%s: out of memory", __func__);
 			return -5;
@@ -139,9 +140,9 @@ void atsc_table_eit_free(struct atsc_table_eit *eit)
 
 		dvb_desc_free((struct dvb_desc **) &event->descriptor);
 		event = event->next;
-		free(tmp);
+		dvb_parse_free(tmp);
 	}
-	free(eit);
+	dvb_parse_free(eit);
 }
 
 void atsc_table_eit_print(struct dvb_v5_fe_parms *parms, struct atsc_table_eit *eit)
@@ -20,6 +20,7 @@
 #include <libdvbv5/eit.h>
 #include <libdvbv5/descriptors.h>
 #include <libdvbv5/dvb-fe.h>
+#include <parse_arena.h>
 
 #if __GNUC__ >= 9
 #pragma GCC diagnostic ignored "-Waddress-of-packed-member"
@@ -51,7 +52,7 @@ ssize_t dvb_table_eit_init(struct dvb_v5_fe_parms *parms, const uint8_t *buf,
 	}
 
 	if (!*table) {
-		*table = calloc(sizeof(struct dvb_table_eit), 1);
+		*table = dvb_parse_calloc(parms, sizeof(struct dvb_table_eit), 1);
 		if (!*table) {
 			dvb_logerr("%s: out of memory", __func__);
 			return -3;
@@ -75,7 +76,7 @@ ssize_t dvb_table_eit_init(struct dvb_v5_fe_parms *parms, const uint8_t *buf,
 	while (p + size <= endbuf) {
 		struct dvb_table_eit_event *event;
 
-		event = malloc(sizeof(struct dvb_table_eit_event));
+		event = dvb_parse_malloc(parms, sizeof(struct dvb_table_eit_event));
 		if (!event) {
 			dvb_logerr("%s: out of memory", __func__);
 			return -4;
@@ -119,6 +120,59 @@ ssize_t dvb_table_eit_init(struct dvb_v5_fe_parms *parms, const uint8_t *buf,
 	return p - buf;
 }
 
+int dvb_table_eit_view_init(struct dvb_v5_fe_parms *parms, const uint8_t *buf,
+			    ssize_t buflen, struct dvb_table_view *view,
+			    uint16_t *service_id)
+{
+	int ret;
+
+	if (buflen > 0 &&
+	    (buf[0] != DVB_TABLE_EIT && buf[0] != DVB_TABLE_EIT_OTHER) &&
+		!(buf[0] >= DVB_TABLE_EIT_SCHEDULE && buf[0] <= DVB_TABLE_EIT_SCHEDULE + 0xF) &&
+		!(buf[0] >= DVB_TABLE_EIT_SCHEDULE_OTHER && buf[0] <= DVB_TABLE_EIT_SCHEDULE_OTHER + 0xF)) {
+		dvb_logerr("%s: invalid marker 0x%02x, should be 0x%02x, 0x%02x or between 0x%02x and 0x%02x or 0x%02x and 0x%02x",
+				__func__, buf[0], DVB_TABLE_EIT, DVB_TABLE_EIT_OTHER,
+				DVB_TABLE_EIT_SCHEDULE, DVB_TABLE_EIT_SCHEDULE + 0xF,
+				DVB_TABLE_EIT_SCHEDULE_OTHER, DVB_TABLE_EIT_SCHEDULE_OTHER + 0xF);
+		return -2;
+	}
+
+	ret = dvb_table_view_init(parms, buf, buflen,
+				  offsetof(struct dvb_table_eit, event), view);
+	if (ret < 0)
+		return ret;
+	if (service_id)
+		*service_id = (buf[3] << 8) | buf[4];
+	return 0;
+}
+
+int dvb_table_eit_view_next(struct dvb_table_view *view,
+			    struct dvb_table_eit_event_view *event)
+{
+	const size_t size = offsetof(struct dvb_table_eit_event, descriptor);
+	const uint8_t *p = view->ptr;
+
+	if (p + size > view->end)
+		return 0;
+
+	event->event_id = (p[0] << 8) | p[1];
+	event->dvbstart = p + 2;
+	event->duration = dvb_bcd((uint32_t) p[7]) * 3600 +
+			  dvb_bcd((uint32_t) p[8]) * 60 +
+			  dvb_bcd((uint32_t) p[9]);
+	event->running_status = p[10] >> 5;
+	event->free_CA_mode = (p[10] >> 4) & 1;
+	event->desc_length = ((p[10] & 0x0f) << 8) | p[11];
+	event->desc = p + size;
+
+	if (event->desc + event->desc_length > view->end) {
+		view->ptr = view->end;
+		return -1;
+	}
+	view->ptr = event->desc + event->desc_length;
+	return 1;
+}
+
 void dvb_table_eit_free(struct dvb_table_eit *eit)
 {
 	struct dvb_table_eit_event *event = eit->event;
@@ -126,9 +180,9 @@ void dvb_table_eit_free(struct dvb_table_eit *eit)
 		dvb_desc_free((struct dvb_desc **) &event->descriptor);
 		struct dvb_table_eit_event *tmp = event;
 		event = event->next;
-		free(tmp);
+		dvb_parse_free(tmp);
 	}
-	free(eit);
+	dvb_parse_free(eit);
 }
 
 void dvb_table_eit_print(struct dvb_v5_fe_parms *parms, struct dvb_table_eit *eit)
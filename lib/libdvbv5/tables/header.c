@@ -32,6 +32,32 @@ void dvb_table_header_init(struct dvb_table_header *t)
 	bswap16(t->id);
 }
 
+int dvb_table_view_init(struct dvb_v5_fe_parms *parms, const uint8_t *buf,
+			ssize_t buflen, size_t hdr_size,
+			struct dvb_table_view *view)
+{
+	size_t section_length;
+
+	if (buflen < 3 || hdr_size < sizeof(struct dvb_table_header)) {
+		dvb_logerr("%s: short read %zd/%zu bytes", __func__,
+			   buflen, hdr_size);
+		return -1;
+	}
+	section_length = ((buf[1] & 0x0f) << 8) | buf[2];
+	if (section_length + 3 > (size_t)buflen ||
+	    section_length + 3 < hdr_size + DVB_CRC_SIZE) {
+		dvb_logerr("%s: invalid section length %zu, buffer has %zd bytes",
+			   __func__, section_length, buflen);
+		return -2;
+	}
+
+	view->ptr = buf + hdr_size;
+	view->end = buf + section_length + 3 - DVB_CRC_SIZE;
+	view->desc = NULL;
+	view->desc_length = 0;
+	return 0;
+}
+
 void dvb_table_header_print(struct dvb_v5_fe_parms *parms, const struct dvb_table_header *t)
 {
 	dvb_loginfo("| table_id         0x%02x", t->table_id);
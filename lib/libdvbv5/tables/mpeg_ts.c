@@ -17,6 +17,8 @@
  *
  */
 
+#include <stdlib.h>
+
 #include <libdvbv5/mpeg_ts.h>
 #include <libdvbv5/descriptors.h>
 #include <libdvbv5/dvb-fe.h>
@@ -80,3 +82,185 @@ void dvb_mpeg_ts_print(struct dvb_v5_fe_parms *parms, struct dvb_mpeg_ts *ts)
                 dvb_loginfo("   - extension      %d", ts->adaption->extension);
 	}
 }
+
+void dvb_mpeg_ts_stats_init(struct dvb_mpeg_ts_stats *stats)
+{
+	memset(stats->packets, 0, sizeof(stats->packets));
+	memset(stats->cc_errors, 0, sizeof(stats->cc_errors));
+	memset(stats->cc, -1, sizeof(stats->cc));
+	stats->total = 0;
+	stats->total_cc_errors = 0;
+	stats->sync_errors = 0;
+}
+
+void dvb_mpeg_ts_pcr_stats_init(struct dvb_mpeg_ts_pcr_stats *pcr)
+{
+	memset(pcr, 0, sizeof(*pcr));
+}
+
+void dvb_mpeg_ts_pcr_stats_reset_window(struct dvb_mpeg_ts_pcr_stats *pcr)
+{
+	int pid;
+
+	for (pid = 0; pid < DVB_MPEG_TS_NUM_PIDS; pid++) {
+		pcr->pid[pid].win_max_interval = 0;
+		pcr->pid[pid].win_jitters = 0;
+	}
+}
+
+#define PCR_WRAP	((1ULL << 33) * 300)
+
+static void ts_pcr_update(struct dvb_mpeg_ts_pcr_stats *stats, uint16_t pid,
+			  const uint8_t *p, uint64_t pos, int discontinued)
+{
+	struct dvb_mpeg_ts_pcr *pcr = &stats->pid[pid];
+	uint64_t v, delta;
+	int64_t jitter;
+
+	v = ((uint64_t)p[6] << 25 | p[7] << 17 | p[8] << 9 | p[9] << 1 |
+	     p[10] >> 7) * 300 + ((p[10] & 1) << 8 | p[11]);
+
+	if (!pcr->count++) {
+		pcr->first_clock = stats->clock;
+		goto restart;
+	}
+
+	delta = (v + PCR_WRAP - pcr->last) % PCR_WRAP;
+	if (discontinued || delta > DVB_MPEG_TS_PCR_DISCONTINUITY) {
+		if (!discontinued)
+			pcr->discontinuities++;
+		/* Bridge the gap with the caller's clock */
+		pcr->elapsed += (stats->clock - pcr->last_clock) / 1000 *
+				(DVB_MPEG_TS_PCR_HZ / 1000000);
+		goto restart;
+	}
+
+	pcr->elapsed += delta;
+	if (delta > pcr->win_max_interval)
+		pcr->win_max_interval = delta;
+	if (delta > DVB_MPEG_TS_PCR_REPETITION)
+		pcr->repetition_errors++;
+
+	/* Needs two PCRs since ref_pos to know the rate */
+	if (pcr->last_pos != pcr->ref_pos) {
+		jitter = (int64_t)delta - (int64_t)((double)(pos - pcr->last_pos) *
+					   pcr->span /
+					   (pcr->last_pos - pcr->ref_pos) + .5);
+		if (!pcr->win_jitters++) {
+			pcr->win_jitter_min = jitter;
+			pcr->win_jitter_max = jitter;
+		} else if (jitter < pcr->win_jitter_min) {
+			pcr->win_jitter_min = jitter;
+		} else if (jitter > pcr->win_jitter_max) {
+			pcr->win_jitter_max = jitter;
+		}
+		if ((uint64_t)llabs(jitter) * 1000000000ULL >
+		    DVB_MPEG_TS_PCR_ACCURACY * DVB_MPEG_TS_PCR_HZ)
+			pcr->accuracy_errors++;
+	}
+	pcr->span += delta;
+	pcr->last = v;
+	pcr->last_pos = pos;
+	pcr->last_clock = stats->clock;
+	return;
+
+restart:
+	pcr->ref_pos = pos;
+	pcr->span = 0;
+	pcr->last = v;
+	pcr->last_pos = pos;
+	pcr->last_clock = stats->clock;
+}
+
+/*
+ * Packets are handled in blocks: first, the few header fields that
+ * matter are extracted into small arrays, without branches, and then the
+ * per-PID tables are updated. This keeps the table updates, which can't
+ * be vectorized, away from the header parsing, which can.
+ */
+#define TS_STATS_BLOCK 64
+
+#define TS_FLAG_INVALID		(1 << 0)	/* bad sync byte */
+#define TS_FLAG_CHECK_CC	(1 << 1)	/* has payload, not NULL */
+#define TS_FLAG_DISCONTINUED	(1 << 2)	/* discontinuity indicator */
+#define TS_FLAG_PCR		(1 << 3)	/* has a PCR */
+
+ssize_t dvb_mpeg_ts_stats_update(struct dvb_mpeg_ts_stats *stats,
+				 const uint8_t *buf, size_t buflen,
+				 int check_cc)
+{
+	uint16_t pid[TS_STATS_BLOCK];
+	uint8_t cc[TS_STATS_BLOCK], flags[TS_STATS_BLOCK];
+	size_t npackets = buflen / DVB_MPEG_TS_PACKET_SIZE, done, n, i;
+	uint64_t pos = stats->total + stats->sync_errors;
+
+	for (done = 0; done < npackets; done += n) {
+		const uint8_t *p = buf + done * DVB_MPEG_TS_PACKET_SIZE;
+
+		n = npackets - done;
+		if (n > TS_STATS_BLOCK)
+			n = TS_STATS_BLOCK;
+
+		for (i = 0; i < n; i++, p += DVB_MPEG_TS_PACKET_SIZE) {
+			unsigned afc = (p[3] >> 4) & 3;
+
+			pid[i] = ((p[1] & 0x1f) << 8) | p[2];
+			cc[i] = p[3] & 0x0f;
+
+			/*
+			 * According to ITU-T H.222.0 | ISO/IEC 13818-1, the
+			 * continuity counter is only incremented on packets
+			 * with payload.
+			 */
+			flags[i] = (p[0] != DVB_MPEG_TS) * TS_FLAG_INVALID |
+				   ((afc & 1) && pid[i] != DVB_MPEG_TS_NULL_PID) *
+					TS_FLAG_CHECK_CC |
+				   ((afc & 2) && p[4] >= 1 && (p[5] & 0x80)) *
+					TS_FLAG_DISCONTINUED |
+				   ((afc & 2) && p[4] >= 7 && (p[5] & 0x10) &&
+				    !(p[1] & 0x80)) * TS_FLAG_PCR;
+		}
+
+		for (i = 0; i < n; i++) {
+			uint16_t cur = pid[i];
+			int8_t prev;
+
+			if (flags[i] & TS_FLAG_INVALID) {
+				stats->sync_errors++;
+				continue;
+			}
+
+			stats->packets[cur]++;
+			stats->total++;
+
+			if ((flags[i] & TS_FLAG_PCR) && stats->pcr)
+				ts_pcr_update(stats->pcr, cur,
+					      buf + (done + i) * DVB_MPEG_TS_PACKET_SIZE,
+					      pos + done + i,
+					      flags[i] & TS_FLAG_DISCONTINUED);
+
+			if (!(flags[i] & TS_FLAG_CHECK_CC))
+				continue;
+
+			prev = stats->cc[cur];
+			if (!check_cc || (flags[i] & TS_FLAG_DISCONTINUED)) {
+				stats->cc[cur] = -1;
+				continue;
+			}
+
+			if (prev >= 0 && ((prev + 1) & 0x0f) != cc[i]) {
+				stats->cc_errors[cur]++;
+				stats->total_cc_errors++;
+				if (stats->cc_error)
+					stats->cc_error(stats->priv, cur,
+							(prev + 1) & 0x0f,
+							cc[i]);
+				stats->cc[cur] = -1;
+				continue;
+			}
+			stats->cc[cur] = cc[i];
+		}
+	}
+
+	return npackets;
+}
@@ -20,6 +20,7 @@
 
 #include <libdvbv5/nit.h>
 #include <libdvbv5/dvb-fe.h>
+#include <parse_arena.h>
 
 #if __GNUC__ >= 9
 #pragma GCC diagnostic ignored "-Waddress-of-packed-member"
@@ -48,7 +49,7 @@ ssize_t dvb_table_nit_init(struct dvb_v5_fe_parms *parms, const uint8_t *buf,
 	}
 
 	if (!*table) {
-		*table = calloc(sizeof(struct dvb_table_nit), 1);
+		*table = dvb_parse_calloc(parms, sizeof(struct dvb_table_nit), 1);
 		if (!*table) {
 			dvb_logerr("%s: out of memory", __func__);
 			return -3;
@@ -92,7 +93,7 @@ ssize_t dvb_table_nit_init(struct dvb_v5_fe_parms *parms, const uint8_t *buf,
 	while (p + size <= endbuf) {
 		struct dvb_table_nit_transport *transport;
 
-		transport = malloc(sizeof(struct dvb_table_nit_transport));
+		transport = dvb_parse_malloc(parms, sizeof(struct dvb_table_nit_transport));
 		if (!transport) {
 			dvb_logerr("%s: out of memory", __func__);
 			return -7;
@@ -138,9 +139,9 @@ void dvb_table_nit_free(struct dvb_table_nit *nit)
 		dvb_desc_free(&transport->descriptor);
 		struct dvb_table_nit_transport *tmp = transport;
 		transport = transport->next;
-		free(tmp);
+		dvb_parse_free(tmp);
 	}
-	free(nit);
+	dvb_parse_free(nit);
 }
 
 void dvb_table_nit_print(struct dvb_v5_fe_parms *parms, struct dvb_table_nit *nit)
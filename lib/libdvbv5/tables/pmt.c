@@ -21,6 +21,7 @@
 #include <libdvbv5/pmt.h>
 #include <libdvbv5/descriptors.h>
 #include <libdvbv5/dvb-fe.h>
+#include <parse_arena.h>
 
 #include <string.h> /* memcpy */
 
@@ -51,7 +52,7 @@ ssize_t dvb_table_pmt_init(struct dvb_v5_fe_parms *parms, const uint8_t *buf,
 	}
 
 	if (!*table) {
-		*table = calloc(sizeof(struct dvb_table_pmt), 1);
+		*table = dvb_parse_calloc(parms, sizeof(struct dvb_table_pmt), 1);
 		if (!*table) {
 			dvb_logerr("%s: out of memory", __func__);
 			return -3;
@@ -100,7 +101,7 @@ ssize_t dvb_table_pmt_init(struct dvb_v5_fe_parms *parms, const uint8_t *buf,
 	while (p + size <= endbuf) {
 		struct dvb_table_pmt_stream *stream;
 
-		stream = malloc(sizeof(struct dvb_table_pmt_stream));
+		stream = dvb_parse_malloc(parms, sizeof(struct dvb_table_pmt_stream));
 		if (!stream) {
 			dvb_logerr("%s: out of memory", __func__);
 			return -5;
@@ -138,6 +139,61 @@ ssize_t dvb_table_pmt_init(struct dvb_v5_fe_parms *parms, const uint8_t *buf,
 	return p - buf;
 }
 
+int dvb_table_pmt_view_init(struct dvb_v5_fe_parms *parms, const uint8_t *buf,
+			    ssize_t buflen, struct dvb_table_view *view,
+			    uint16_t *pcr_pid)
+{
+	const uint8_t *p;
+	int ret;
+
+	if (buflen > 0 && buf[0] != DVB_TABLE_PMT) {
+		dvb_logerr("%s: invalid marker 0x%02x, should be 0x%02x",
+				__func__, buf[0], DVB_TABLE_PMT);
+		return -2;
+	}
+
+	ret = dvb_table_view_init(parms, buf, buflen,
+				  offsetof(struct dvb_table_pmt, dvb_pmt_field_last),
+				  view);
+	if (ret < 0)
+		return ret;
+
+	p = view->ptr - 4;
+	if (pcr_pid)
+		*pcr_pid = ((p[0] & 0x1f) << 8) | p[1];
+	view->desc = view->ptr;
+	view->desc_length = ((p[2] & 0x03) << 8) | p[3];
+	if (view->desc + view->desc_length > view->end) {
+		dvb_logerr("%s: program descriptors bigger than the section",
+			   __func__);
+		return -4;
+	}
+	view->ptr += view->desc_length;
+	return 0;
+}
+
+int dvb_table_pmt_view_next(struct dvb_table_view *view,
+			    struct dvb_table_pmt_stream_view *stream)
+{
+	const size_t size = offsetof(struct dvb_table_pmt_stream, descriptor);
+	const uint8_t *p = view->ptr;
+
+	if (p + size > view->end)
+		return 0;
+
+	stream->type = p[0];
+	stream->elementary_pid = ((p[1] & 0x1f) << 8) | p[2];
+	stream->desc_length = ((p[3] & 0x03) << 8) | p[4];
+	stream->desc = p + size;
+
+	if (stream->desc + stream->desc_length > view->end) {
+		view->ptr = view->end;
+		return -1;
+	}
+	view->ptr = stream->desc + stream->desc_length;
+	return 1;
+}
+
 void dvb_table_pmt_free(struct dvb_table_pmt *pmt)
 {
 	struct dvb_table_pmt_stream *stream = pmt->stream;
@@ -145,10 +201,10 @@ void dvb_table_pmt_free(struct dvb_table_pmt *pmt)
 		dvb_desc_free((struct dvb_desc **) &stream->descriptor);
 		struct dvb_table_pmt_stream *tmp = stream;
 		stream = stream->next;
-		free(tmp);
+		dvb_parse_free(tmp);
 	}
 	dvb_desc_free(&pmt->descriptor);
-	free(pmt);
+	dvb_parse_free(pmt);
 }
 
 void dvb_table_pmt_print(struct dvb_v5_fe_parms *parms, const struct dvb_table_pmt *pmt)
@@ -21,6 +21,7 @@
 #include <libdvbv5/sdt.h>
 #include <libdvbv5/descriptors.h>
 #include <libdvbv5/dvb-fe.h>
+#include <parse_arena.h>
 
 #if __GNUC__ >= 9
 #pragma GCC diagnostic ignored "-Waddress-of-packed-member"
@@ -48,7 +49,7 @@ ssize_t dvb_table_sdt_init(struct dvb_v5_fe_parms *parms, const uint8_t *buf,
 	}
 
 	if (!*table) {
-		*table = calloc(sizeof(struct dvb_table_sdt), 1);
+		*table = dvb_parse_calloc(parms, sizeof(struct dvb_table_sdt), 1);
 		if (!*table) {
 			dvb_logerr("%s: out of memory", __func__);
 			return -3;
@@ -78,7 +79,7 @@ ssize_t dvb_table_sdt_init(struct dvb_v5_fe_parms *parms, const uint8_t *buf,
 	while (p + size <= endbuf) {
 		struct dvb_table_sdt_service *service;
 
-		service = malloc(sizeof(struct dvb_table_sdt_service));
+		service = dvb_parse_malloc(parms, sizeof(struct dvb_table_sdt_service));
 		if (!service) {
 			dvb_logerr("%s: out of memory", __func__);
 			return -5;
@@ -117,6 +118,44 @@ ssize_t dvb_table_sdt_init(struct dvb_v5_fe_parms *parms, const uint8_t *buf,
 	return p - buf;
 }
 
+int dvb_table_sdt_view_init(struct dvb_v5_fe_parms *parms, const uint8_t *buf,
+			    ssize_t buflen, struct dvb_table_view *view)
+{
+	if (buflen > 0 &&
+	    buf[0] != DVB_TABLE_SDT && buf[0] != DVB_TABLE_SDT2) {
+		dvb_logerr("%s: invalid marker 0x%02x, should be 0x%02x or 0x%02x",
+				__func__, buf[0], DVB_TABLE_SDT, DVB_TABLE_SDT2);
+		return -2;
+	}
+	return dvb_table_view_init(parms, buf, buflen,
+				   offsetof(struct dvb_table_sdt, service), view);
+}
+
+int dvb_table_sdt_view_next(struct dvb_table_view *view,
+			    struct dvb_table_sdt_service_view *service)
+{
+	const size_t size = offsetof(struct dvb_table_sdt_service, descriptor);
+	const uint8_t *p = view->ptr;
+
+	if (p + size > view->end)
+		return 0;
+
+	service->service_id = (p[0] << 8) | p[1];
+	service->EIT_schedule = (p[2] >> 1) & 1;
+	service->EIT_present_following = p[2] & 1;
+	service->running_status = p[3] >> 5;
+	service->free_CA_mode = (p[3] >> 4) & 1;
+	service->desc_length = ((p[3] & 0x0f) << 8) | p[4];
+	service->desc = p + size;
+
+	if (service->desc + service->desc_length > view->end) {
+		view->ptr = view->end;
+		return -1;
+	}
+	view->ptr = service->desc + service->desc_length;
+	return 1;
+}
+
 void dvb_table_sdt_free(struct dvb_table_sdt *sdt)
 {
 	struct dvb_table_sdt_service *service = sdt->service;
@@ -124,9 +163,9 @@ void dvb_table_sdt_free(struct dvb_table_sdt *sdt)
 		dvb_desc_free((struct dvb_desc **) &service->descriptor);
 		struct dvb_table_sdt_service *tmp = service;
 		service = service->next;
-		free(tmp);
+		dvb_parse_free(tmp);
 	}
-	free(sdt);
+	dvb_parse_free(sdt);
 }
 
 void dvb_table_sdt_print(struct dvb_v5_fe_parms *parms, struct dvb_table_sdt *sdt)
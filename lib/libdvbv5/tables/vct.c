@@ -22,6 +22,7 @@
 #include <libdvbv5/descriptors.h>
 #include <libdvbv5/dvb-fe.h>
 #include <parse_string.h>
+#include <parse_arena.h>
 
 #if __GNUC__ >= 9
 #pragma GCC diagnostic ignored "-Waddress-of-packed-member"
@@ -50,7 +51,7 @@ ssize_t atsc_table_vct_init(struct dvb_v5_fe_parms *parms, const uint8_t *buf,
 	}
 
 	if (!*table) {
-		*table = calloc(sizeof(struct atsc_table_vct), 1);
+		*table = dvb_parse_calloc(parms, sizeof(struct atsc_table_vct), 1);
 		if (!*table) {
 			dvb_logerr("%s: out of memory", __func__);
 			return -3;
@@ -77,7 +78,7 @@ ssize_t atsc_table_vct_init(struct dvb_v5_fe_parms *parms, const uint8_t *buf,
 			break;
 		}
 
-		channel = malloc(sizeof(struct atsc_table_vct_channel));
+		channel = dvb_parse_malloc(parms, sizeof(struct atsc_table_vct_channel));
 		if (!channel) {
 			dvb_logerr("%s: out of memory", __func__);
 			return -4;
@@ -158,11 +159,11 @@ void atsc_table_vct_free(struct atsc_table_vct *vct)
 		dvb_desc_free((struct dvb_desc **) &channel->descriptor);
 		struct atsc_table_vct_channel *tmp = channel;
 		channel = channel->next;
-		free(tmp);
+		dvb_parse_free(tmp);
 	}
 	dvb_desc_free(&vct->descriptor);
 
-	free(vct);
+	dvb_parse_free(vct);
 }
 
 void atsc_table_vct_print(struct dvb_v5_fe_parms *parms, struct atsc_table_vct *vct)
@@ -479,6 +479,41 @@ int v4l1_dup(int fd)
 	return v4l2_dup(fd);
 }
 
+/* Get the next frame into one of the frames of our VIDIOCGMBUF area. Our
+   area is plain anonymous memory, so when libv4l2 converted the frame into
+   its buffer we swap that buffer's pages into the area rather than copying
+   the frame; otherwise the frame gets copied out of the driver's buffer, and
+   devices which can't stream are simply read. */
+static int v4l1_sync_frame(int index, unsigned char *dest)
+{
+	void *frame;
+	int id, saved_err;
+	ssize_t size;
+
+	size = v4l2_borrow_frame(devices[index].fd, &frame, &id);
+	if (size < 0) {
+		if (errno != EINVAL)
+			return -1;
+		size = v4l2_read(devices[index].fd, dest, V4L1_FRAME_BUF_SIZE);
+		return (size > 0) ? 0 : size;
+	}
+
+	if (size > V4L1_FRAME_BUF_SIZE)
+		size = V4L1_FRAME_BUF_SIZE;
+
+	if (v4l2_move_frame(devices[index].fd, id, dest, V4L1_FRAME_BUF_SIZE))
+		memcpy(dest, frame, size);
+
+	if (v4l2_release_frame(devices[index].fd, id)) {
+		saved_err = errno;
+		V4L1_LOG_ERR("releasing frame: %s\n", strerror(errno));
+		errno = saved_err;
+		return -1;
+	}
+
+	return 0;
+}
+
 int v4l1_ioctl(int fd, unsigned long int request, ...)
 {
 	void *arg;
@@ -788,11 +823,8 @@ int v4l1_ioctl(int fd, unsigned long int request, ...)
 			break;
 		}
 
-		result = v4l2_read(devices[index].fd,
-				devices[index].v4l1_frame_pointer +
-				*frame_index * V4L1_FRAME_BUF_SIZE,
-				V4L1_FRAME_BUF_SIZE);
-		result = (result > 0) ? 0 : result;
+		result = v4l1_sync_frame(index, devices[index].v4l1_frame_pointer +
+				*frame_index * V4L1_FRAME_BUF_SIZE);
 		break;
 	}
 
@@ -20,19 +20,24 @@
 #define __LIBV4L2_PRIV_H
 
 #include <stdio.h>
+#include <stdint.h>
 #include <pthread.h>
 #include <libv4lconvert.h> /* includes videodev2.h for us */
 
 #include "../libv4lconvert/libv4lsyscall-priv.h"
 
-#define V4L2_MAX_DEVICES 16
-/* Warning when making this larger the frame_queued and frame_mapped members of
-   the v4l2_dev_info struct can no longer be a bitfield, so the code needs to
-   be adjusted! */
-#define V4L2_MAX_NO_FRAMES 32
+#define V4L2_MAX_DEVICES 256
+/* Deep queues help riding out scheduling hiccups with high fps capture. The
+   per frame arrays only get touched for the frames actually requested. */
+#define V4L2_MAX_NO_FRAMES 128
 #define V4L2_DEFAULT_NREADBUFFERS 4
+/* read() emulation buffer count adaptation, see v4l2_adapt_read_buffers() */
+#define V4L2_READ_WINDOW_FRAMES 64
+#define V4L2_READ_CALM_WINDOWS 8
 #define V4L2_IGNORE_FIRST_FRAME_ERRORS 3
 #define V4L2_DEFAULT_FPS 30
+#define V4L2_MAX_CONVERT_THREADS 8
+#define V4L2_PIPELINE_ERROR_MSG_SIZE 256
 
 #define V4L2_LOG_ERR(...) 			\
 	do { 					\
@@ -71,35 +76,148 @@
 
 #define MIN(a, b) (((a) < (b)) ? (a) : (b))
 
+/* State of a frame in the conversion pipeline */
+enum v4l2_pipeline_frame_state {
+	V4L2_PIPELINE_FRAME_DEQUEUED,
+	V4L2_PIPELINE_FRAME_CONVERTING,
+	V4L2_PIPELINE_FRAME_DONE,
+};
+
+struct v4l2_pipeline_frame {
+	enum v4l2_pipeline_frame_state state;
+	struct v4l2_buffer buf;
+	int result;
+	int error; /* errno of a failed conversion */
+	char error_msg[V4L2_PIPELINE_ERROR_MSG_SIZE];
+};
+
+/* Worker pool used when V4L2_ENABLE_PIPELINED_CONVERSION is set. All members
+   are protected by the stream_lock of the device. Frames are kept in a ring
+   in dequeue order, head is the next frame to hand to the app, convert_pos
+   the next frame to convert and tail the next free slot. */
+struct v4l2_pipeline {
+	int nworkers;
+	struct v4lconvert_data *convert[V4L2_MAX_CONVERT_THREADS];
+	pthread_t workers[V4L2_MAX_CONVERT_THREADS];
+	pthread_t dequeue_thread;
+	pthread_cond_t cond;
+	int wake_pipe[2];
+	int running;
+	int stop;
+	int error; /* errno of a failed DQBUF, ends the stream */
+	unsigned int head, convert_pos, tail;
+	struct v4l2_pipeline_frame frames[V4L2_MAX_NO_FRAMES];
+};
+
+/* 1 status bit per frame */
+#define V4L2_FRAME_BITMAP_WORDS ((V4L2_MAX_NO_FRAMES + 31) / 32)
+struct v4l2_frame_bitmap {
+	uint32_t bits[V4L2_FRAME_BITMAP_WORDS];
+};
+
+static inline void v4l2_frame_bitmap_set(struct v4l2_frame_bitmap *map,
+					 unsigned int frame)
+{
+	map->bits[frame / 32] |= 1u << (frame % 32);
+}
+
+static inline void v4l2_frame_bitmap_clear(struct v4l2_frame_bitmap *map,
+					   unsigned int frame)
+{
+	map->bits[frame / 32] &= ~(1u << (frame % 32));
+}
+
+static inline int v4l2_frame_bitmap_test(const struct v4l2_frame_bitmap *map,
+					 unsigned int frame)
+{
+	return (map->bits[frame / 32] >> (frame % 32)) & 1;
+}
+
+static inline int v4l2_frame_bitmap_empty(const struct v4l2_frame_bitmap *map)
+{
+	unsigned int i;
+
+	for (i = 0; i < V4L2_FRAME_BITMAP_WORDS; i++)
+		if (map->bits[i])
+			return 0;
+	return 1;
+}
+
+static inline unsigned int v4l2_frame_bitmap_count(
+		const struct v4l2_frame_bitmap *map)
+{
+	unsigned int i, count = 0;
+
+	for (i = 0; i < V4L2_FRAME_BITMAP_WORDS; i++)
+		count += __builtin_popcount(map->bits[i]);
+	return count;
+}
+
+static inline void v4l2_frame_bitmap_zero(struct v4l2_frame_bitmap *map)
+{
+	unsigned int i;
+
+	for (i = 0; i < V4L2_FRAME_BITMAP_WORDS; i++)
+		map->bits[i] = 0;
+}
+
 struct v4l2_dev_info {
 	int fd;
 	int flags;
 	int open_count;
 	int gone; /* Set to 1 when a device is detached (ENODEV encountered) */
+	/* Set (under stream_lock) when buffer ioctls can bypass the stream_lock,
+	   read locklessly by v4l2_ioctl */
+	int passthrough;
 	long page_size;
 	/* actual format of the cam */
 	struct v4l2_format src_fmt;
 	/* fmt as seen by the application (iow after conversion) */
 	struct v4l2_format dest_fmt;
 	pthread_mutex_t stream_lock;
+	/* Copy of dest_fmt for VIDIOC_G_FMT, which skips the stream_lock once
+	   fmt_published is set. Written with both locks held, so G_FMT only
+	   waits for the copy and not for a conversion holding the stream_lock */
+	pthread_mutex_t fmt_lock;
+	struct v4l2_format published_fmt;
+	int fmt_published;
 	unsigned int no_frames;
 	unsigned int nreadbuffers;
+	/* Frames seen by the read() emulation in the current window */
+	unsigned int read_window_frames;
+	unsigned int read_window_drops;
+	uint64_t read_window_start_ns; /* buffer timestamps */
+	uint64_t read_window_end_ns;
+	uint64_t read_window_convert_ns;
+	uint64_t read_window_conversions;
+	unsigned int read_calm_windows;
+	uint32_t last_sequence;
+	int last_sequence_valid;
 	int fps;
 	int first_frame;
 	struct v4lconvert_data *convert;
 	unsigned char *convert_mmap_buf;
 	size_t convert_mmap_buf_size;
 	size_t convert_mmap_frame_size;
+	/* dma-buf of each frame of convert_mmap_buf, -1 when it is anonymous
+	   memory (see V4L2_ENABLE_DMABUF_EXPORT) */
+	int frame_dmabuf_fd[V4L2_MAX_NO_FRAMES];
 	/* Frame bookkeeping is only done when in read or mmap-conversion mode */
 	unsigned char *frame_pointers[V4L2_MAX_NO_FRAMES];
 	int frame_sizes[V4L2_MAX_NO_FRAMES];
-	int frame_queued; /* 1 status bit per frame */
+	struct v4l2_frame_bitmap frame_queued;
+	struct v4l2_frame_bitmap frame_borrowed; /* see v4l2_borrow_frame */
 	int frame_info_generation;
 	/* mapping tracking of our fake (converting mmap) frame buffers */
 	unsigned char frame_map_count[V4L2_MAX_NO_FRAMES];
 	/* buffer when doing conversion and using read() for read() */
 	int readbuf_size;
 	unsigned char *readbuf;
+	/* conversion worker pool (NULL when not enabled) */
+	struct v4l2_pipeline *pipeline;
+	/* see v4l2_get_stats, protected by the stream_lock */
+	struct v4l2_lib_stats stats;
+	uint64_t stats_next_dump;
 	/* plugin info */
 	void *plugin_library;
 	void *dev_ops_priv;
@@ -67,12 +67,25 @@
 #include <fcntl.h>
 #include <string.h>
 #include <unistd.h>
+#include <poll.h>
+#include <stdint.h>
 #include <sys/types.h>
 #include <sys/mman.h>
 #include <sys/stat.h>
+#include <time.h>
+#ifdef HAVE_LINUX_DMA_BUF_H
+#include <linux/dma-buf.h>
+#endif
+#ifdef HAVE_LINUX_DMA_HEAP_H
+#include <linux/dma-heap.h>
+#endif
+#ifdef HAVE_LINUX_UDMABUF_H
+#include <linux/udmabuf.h>
+#endif
 #include "libv4l2.h"
 #include "libv4l2-priv.h"
 #include "libv4l-plugin.h"
+#include "../libv4lconvert/libv4ltrace-priv.h"
 
 /* Note these flags are stored together with the flags passed to v4l2_fd_open()
    in v4l2_dev_info's flags member, so care should be taken that the do not
@@ -88,18 +101,193 @@
 #define V4L2_MMAP_OFFSET_MAGIC      0xABCDEF00u
 
 static void v4l2_adjust_src_fmt_to_fps(int index, int fps);
+static void v4l2_pipeline_stop(int index);
 static void v4l2_set_src_and_dest_format(int index,
 		struct v4l2_format *src_fmt, struct v4l2_format *dest_fmt);
 
 static pthread_mutex_t v4l2_open_mutex = PTHREAD_MUTEX_INITIALIZER;
-static struct v4l2_dev_info devices[V4L2_MAX_DEVICES] = {
-	{ .fd = -1 },
-	{ .fd = -1 }, { .fd = -1 }, { .fd = -1 }, { .fd = -1 }, { .fd = -1 },
-	{ .fd = -1 }, { .fd = -1 }, { .fd = -1 }, { .fd = -1 }, { .fd = -1 },
-	{ .fd = -1 }, { .fd = -1 }, { .fd = -1 }, { .fd = -1 }, { .fd = -1 }
-};
+/* Only the first devices_used entries are valid, the ones with fd -1 are
+   free */
+static struct v4l2_dev_info devices[V4L2_MAX_DEVICES];
 static int devices_used;
 
+/* fd -> index in devices + 1, or 0 if the fd is not ours. This is read
+   without any lock by v4l2_get_index(), so the chunks of the table are
+   allocated when needed, with v4l2_open_mutex held, and never freed. The
+   (unlikely) fds beyond the table are looked up in devices instead */
+#define V4L2_FD_CHUNK_BITS 10
+#define V4L2_FD_CHUNK_SIZE (1 << V4L2_FD_CHUNK_BITS)
+#define V4L2_FD_MAX_CHUNKS 1024
+static int *fd_index[V4L2_FD_MAX_CHUNKS];
+
+/* Seconds between the stats dumps, from LIBV4L2_STATS_INTERVAL, 0 for none */
+static int v4l2_stats_interval;
+
+/* Bounds of the read() emulation buffer count, from LIBV4L2_READ_BUFFERS */
+static unsigned int v4l2_min_readbuffers = V4L2_DEFAULT_NREADBUFFERS;
+static unsigned int v4l2_max_readbuffers = V4L2_DEFAULT_NREADBUFFERS;
+
+static int v4l2_set_fd_index(int fd, int index)
+{
+	unsigned int chunk = (unsigned int)fd >> V4L2_FD_CHUNK_BITS;
+	int *table;
+
+	if (chunk >= V4L2_FD_MAX_CHUNKS)
+		return 0;
+
+	table = __atomic_load_n(&fd_index[chunk], __ATOMIC_ACQUIRE);
+	if (!table) {
+		if (index == -1)
+			return 0;
+		table = calloc(V4L2_FD_CHUNK_SIZE, sizeof(*table));
+		if (!table)
+			return -1;
+		__atomic_store_n(&fd_index[chunk], table, __ATOMIC_RELEASE);
+	}
+	__atomic_store_n(&table[fd & (V4L2_FD_CHUNK_SIZE - 1)], index + 1,
+			 __ATOMIC_RELEASE);
+	return 0;
+}
+
+/* Allocates a dma-buf of size bytes, from the dma-heap when heap is open
+   and else from the udmabuf device, backed by memfd at offset */
+static int v4l2_alloc_dmabuf(int heap, int udmabuf, int memfd, size_t offset,
+		size_t size)
+{
+#ifdef HAVE_LINUX_DMA_HEAP_H
+	if (heap >= 0) {
+		struct dma_heap_allocation_data alloc = {
+			.len = size,
+			.fd_flags = O_RDWR | O_CLOEXEC,
+		};
+
+		if (SYS_IOCTL(heap, DMA_HEAP_IOCTL_ALLOC, &alloc))
+			return -1;
+		return alloc.fd;
+	}
+#endif
+#ifdef HAVE_LINUX_UDMABUF_H
+	if (udmabuf >= 0) {
+		struct udmabuf_create create = {
+			.memfd = memfd,
+			.flags = UDMABUF_FLAGS_CLOEXEC,
+			.offset = offset,
+			.size = size,
+		};
+
+		return SYS_IOCTL(udmabuf, UDMABUF_CREATE, &create);
+	}
+#endif
+	errno = ENODEV;
+	return -1;
+}
+
+/* Replaces the anonymous memory of each frame of the conversion buffer by a
+   mapping of a dma-buf, so the frames can be exported. Returns -1 when no
+   dma-buf could be allocated, leaving the conversion buffer as it is */
+static int v4l2_map_dmabuf_convert_buf(int index)
+{
+	size_t size = devices[index].convert_mmap_frame_size;
+	unsigned int i, no_frames = devices[index].no_frames;
+	int heap, udmabuf = -1, memfd = -1, fd, result = -1;
+
+	heap = SYS_OPEN("/dev/dma_heap/system", O_RDWR | O_CLOEXEC, 0);
+	if (heap < 0) {
+#ifdef HAVE_MEMFD_CREATE
+		/* udmabuf needs a memfd which can't shrink */
+		udmabuf = SYS_OPEN("/dev/udmabuf", O_RDWR | O_CLOEXEC, 0);
+		if (udmabuf >= 0)
+			memfd = memfd_create("libv4l2-convert",
+					MFD_CLOEXEC | MFD_ALLOW_SEALING);
+		if (memfd < 0 || ftruncate(memfd, size * no_frames) ||
+		    fcntl(memfd, F_ADD_SEALS, F_SEAL_SHRINK)) {
+			V4L2_LOG_WARN("no dma-heap nor udmabuf to convert into\n");
+			goto leave;
+		}
+#else
+		V4L2_LOG_WARN("no dma-heap to convert into\n");
+		goto leave;
+#endif
+	}
+
+	for (i = 0; i < no_frames; i++) {
+		fd = v4l2_alloc_dmabuf(heap, udmabuf, memfd, i * size, size);
+		if (fd < 0)
+			break;
+		devices[index].frame_dmabuf_fd[i] = fd;
+		if ((void *)SYS_MMAP(devices[index].convert_mmap_buf + i * size,
+				size, PROT_READ | PROT_WRITE,
+				MAP_SHARED | MAP_FIXED, fd, 0) == MAP_FAILED)
+			break;
+	}
+	if (i == no_frames) {
+		V4L2_LOG("converting into %s dma-bufs\n",
+			 heap >= 0 ? "dma-heap" : "udmabuf");
+		result = 0;
+		goto leave;
+	}
+
+	V4L2_LOG_WARN("allocating conversion dma-bufs: %s\n", strerror(errno));
+	for (i = 0; i < no_frames; i++) {
+		if (devices[index].frame_dmabuf_fd[i] != -1)
+			SYS_CLOSE(devices[index].frame_dmabuf_fd[i]);
+		devices[index].frame_dmabuf_fd[i] = -1;
+	}
+	/* Back to anonymous memory for the frames mapped already */
+	if ((void *)SYS_MMAP(devices[index].convert_mmap_buf,
+			devices[index].convert_mmap_buf_size,
+			PROT_READ | PROT_WRITE,
+			MAP_ANONYMOUS | MAP_PRIVATE | MAP_FIXED,
+			-1, 0) == MAP_FAILED)
+		result = -2;
+
+leave:
+	/* The dma-bufs keep their memory, the fds aren't needed anymore */
+	if (memfd >= 0)
+		SYS_CLOSE(memfd);
+	if (udmabuf >= 0)
+		SYS_CLOSE(udmabuf);
+	if (heap >= 0)
+		SYS_CLOSE(heap);
+	return result;
+}
+
+/* Brackets a conversion writing into a dma-buf backed frame, so it gets
+   written back to memory for the devices the frame is passed on to. errno
+   is left alone, it may hold the error of the conversion */
+static void v4l2_sync_dmabuf(int fd, int end)
+{
+#ifdef HAVE_LINUX_DMA_BUF_H
+	struct dma_buf_sync sync = {
+		.flags = (end ? DMA_BUF_SYNC_END : DMA_BUF_SYNC_START) |
+			 DMA_BUF_SYNC_WRITE,
+	};
+	int saved_err = errno;
+
+	if (fd != -1)
+		SYS_IOCTL(fd, DMA_BUF_IOCTL_SYNC, &sync);
+	errno = saved_err;
+#endif
+}
+
+/* Frees the conversion buffer and its dma-bufs, the memory is only unmapped
+   when unmap is set, the application may still have it mapped otherwise */
+static void v4l2_free_convert_mmap_buf(int index, int unmap)
+{
+	unsigned int i;
+
+	if (unmap && devices[index].convert_mmap_buf != MAP_FAILED)
+		SYS_MUNMAP(devices[index].convert_mmap_buf,
+				devices[index].convert_mmap_buf_size);
+	for (i = 0; i < V4L2_MAX_NO_FRAMES; i++) {
+		if (devices[index].frame_dmabuf_fd[i] != -1)
+			SYS_CLOSE(devices[index].frame_dmabuf_fd[i]);
+		devices[index].frame_dmabuf_fd[i] = -1;
+	}
+	devices[index].convert_mmap_buf = MAP_FAILED;
+	devices[index].convert_mmap_buf_size = 0;
+}
+
 static int v4l2_ensure_convert_mmap_buf(int index)
 {
 	if (devices[index].convert_mmap_buf != MAP_FAILED) {
@@ -124,6 +312,17 @@ static int v4l2_ensure_convert_mmap_buf(int index)
 		return -1;
 	}
 
+	/* Converting into normal memory will do when this fails */
+	if ((devices[index].flags & V4L2_ENABLE_DMABUF_EXPORT) &&
+	    v4l2_map_dmabuf_convert_buf(index) == -2) {
+		int saved_err = errno;
+
+		V4L2_LOG_ERR("remapping conversion buffer\n");
+		v4l2_free_convert_mmap_buf(index, 1);
+		errno = saved_err;
+		return -1;
+	}
+
 	return 0;
 }
 
@@ -266,6 +465,8 @@ static int v4l2_streamoff(int index)
 	enum v4l2_buf_type type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
 
 	if (devices[index].flags & V4L2_STREAMON) {
+		v4l2_pipeline_stop(index);
+
 		result = devices[index].dev_ops->ioctl(
 				devices[index].dev_ops_priv,
 				devices[index].fd, VIDIOC_STREAMOFF, &type);
@@ -279,7 +480,7 @@ static int v4l2_streamoff(int index)
 		devices[index].flags &= ~V4L2_STREAMON;
 
 		/* Stream off also dequeues all our buffers! */
-		devices[index].frame_queued = 0;
+		v4l2_frame_bitmap_zero(&devices[index].frame_queued);
 	}
 
 	return 0;
@@ -290,7 +491,7 @@ static int v4l2_queue_read_buffer(int index, int buffer_index)
 	int result;
 	struct v4l2_buffer buf;
 
-	if (devices[index].frame_queued & (1 << buffer_index))
+	if (v4l2_frame_bitmap_test(&devices[index].frame_queued, buffer_index))
 		return 0;
 
 	memset(&buf, 0, sizeof(buf));
@@ -307,20 +508,483 @@ static int v4l2_queue_read_buffer(int index, int buffer_index)
 		return result;
 	}
 
-	devices[index].frame_queued |= 1 << buffer_index;
+	v4l2_frame_bitmap_set(&devices[index].frame_queued, buffer_index);
+	if (devices[index].pipeline)
+		pthread_cond_broadcast(&devices[index].pipeline->cond);
+	return 0;
+}
+
+/*
+ * Pipelined conversion (V4L2_ENABLE_PIPELINED_CONVERSION).
+ *
+ * A dequeue thread takes filled buffers from the driver as soon as they are
+ * ready and appends them to the frame ring, a pool of workers (each with its
+ * own libv4lconvert instance) converts them into the fake mmap buffers and
+ * v4l2_pipeline_dequeue_and_convert() hands them out in ring (thus capture)
+ * order. All threads synchronize through the stream_lock of the device.
+ */
+static void v4l2_pipeline_destroy(struct v4l2_pipeline *pipeline)
+{
+	int i;
+
+	if (!pipeline)
+		return;
+
+	for (i = 0; i < pipeline->nworkers; i++)
+		v4lconvert_destroy(pipeline->convert[i]);
+	SYS_CLOSE(pipeline->wake_pipe[0]);
+	SYS_CLOSE(pipeline->wake_pipe[1]);
+	pthread_cond_destroy(&pipeline->cond);
+	free(pipeline);
+}
+
+static struct v4l2_pipeline *v4l2_pipeline_create(int fd, void *dev_ops_priv,
+		const struct libv4l_dev_ops *dev_ops)
+{
+	struct v4l2_pipeline *pipeline;
+	long nworkers;
+	char *s;
+	int i;
+
+	s = getenv("LIBV4L2_CONVERT_THREADS");
+	nworkers = s ? strtol(s, NULL, 0) : sysconf(_SC_NPROCESSORS_ONLN);
+	if (nworkers < 1)
+		nworkers = 1;
+	if (nworkers > V4L2_MAX_CONVERT_THREADS)
+		nworkers = V4L2_MAX_CONVERT_THREADS;
+
+	pipeline = calloc(1, sizeof(*pipeline));
+	if (!pipeline)
+		return NULL;
+
+	if (pipe(pipeline->wake_pipe)) {
+		free(pipeline);
+		return NULL;
+	}
+	fcntl(pipeline->wake_pipe[0], F_SETFL, O_NONBLOCK);
+	fcntl(pipeline->wake_pipe[1], F_SETFL, O_NONBLOCK);
+	pthread_cond_init(&pipeline->cond, NULL);
+
+	/* libv4lconvert instances are not thread safe, so each worker gets
+	   its own one */
+	for (i = 0; i < nworkers; i++) {
+		pipeline->convert[i] =
+			v4lconvert_create_with_dev_ops(fd, dev_ops_priv, dev_ops);
+		if (!pipeline->convert[i])
+			break;
+	}
+	pipeline->nworkers = i;
+
+	if (!pipeline->nworkers) {
+		v4l2_pipeline_destroy(pipeline);
+		return NULL;
+	}
+
+	V4L2_LOG("using %d conversion threads\n", pipeline->nworkers);
+
+	return pipeline;
+}
+
+static uint64_t v4l2_now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/* Must be called with the stream_lock held */
+static void v4l2_get_stats_locked(int index, struct v4l2_lib_stats *stats)
+{
+	*stats = devices[index].stats;
+	stats->buffers_queued =
+		v4l2_frame_bitmap_count(&devices[index].frame_queued);
+	stats->buffers_borrowed =
+		v4l2_frame_bitmap_count(&devices[index].frame_borrowed);
+	stats->read_buffers =
+		(devices[index].flags & V4L2_STREAM_CONTROLLED_BY_READ) ?
+		devices[index].no_frames : 0;
+}
+
+static void v4l2_stats_dump(int index)
+{
+	FILE *f = v4l2_log_file ? v4l2_log_file : stderr;
+	struct v4l2_lib_stats stats;
+	uint64_t frames;
+
+	v4l2_get_stats_locked(index, &stats);
+	frames = stats.frames_converted + stats.convert_errors;
+	fprintf(f, "libv4l2: stats fd %d: %llu frames converted, %llu errors, "
+		"%llu short frames, %llu dropped, %.3f ms per conversion, "
+		"%u buffers queued, %u borrowed, %u read buffers (%u resizes)\n",
+		devices[index].fd,
+		(unsigned long long)stats.frames_converted,
+		(unsigned long long)stats.convert_errors,
+		(unsigned long long)stats.short_frames,
+		(unsigned long long)stats.frames_dropped,
+		frames ? stats.convert_ns / 1e6 / frames : 0.0,
+		stats.buffers_queued, stats.buffers_borrowed,
+		stats.read_buffers, stats.read_buffer_resizes);
+	fflush(f);
+}
+
+/* Account a v4lconvert_convert() call started at start_ns, must be called
+   with the stream_lock held */
+static void v4l2_stats_convert(int index, int result, uint64_t start_ns)
+{
+	uint64_t now = v4l2_now_ns();
+
+	devices[index].stats.convert_ns += now - start_ns;
+	if (result < 0)
+		devices[index].stats.convert_errors++;
+	else
+		devices[index].stats.frames_converted++;
+
+	if (v4l2_stats_interval && now >= devices[index].stats_next_dump) {
+		/* The first conversion only starts the clock */
+		if (devices[index].stats_next_dump)
+			v4l2_stats_dump(index);
+		devices[index].stats_next_dump =
+			now + v4l2_stats_interval * 1000000000ULL;
+	}
+}
+
+static void *v4l2_pipeline_dequeue_thread(void *arg)
+{
+	int index = (intptr_t)arg;
+	struct v4l2_pipeline *pipeline = devices[index].pipeline;
+	struct v4l2_pipeline_frame *frame;
+	struct pollfd fds[2];
+	struct v4l2_buffer buf;
+	int result;
+
+	fds[0].fd = devices[index].fd;
+	fds[0].events = POLLIN;
+	fds[1].fd = pipeline->wake_pipe[0];
+	fds[1].events = POLLIN;
+
+	pthread_mutex_lock(&devices[index].stream_lock);
+	while (!pipeline->stop) {
+		/* Only wait for the driver when it has buffers to fill */
+		if (v4l2_frame_bitmap_empty(&devices[index].frame_queued)) {
+			pthread_cond_wait(&pipeline->cond,
+					  &devices[index].stream_lock);
+			continue;
+		}
+		pthread_mutex_unlock(&devices[index].stream_lock);
+
+		result = poll(fds, 2, -1);
+		if (result > 0 && !fds[1].revents) {
+			memset(&buf, 0, sizeof(buf));
+			buf.type   = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+			buf.memory = V4L2_MEMORY_MMAP;
+			result = devices[index].dev_ops->ioctl(
+					devices[index].dev_ops_priv,
+					devices[index].fd, VIDIOC_DQBUF, &buf);
+		} else {
+			/* Interrupted or woken up to stop, try again */
+			result = -1;
+			errno = EAGAIN;
+		}
+
+		pthread_mutex_lock(&devices[index].stream_lock);
+		if (result) {
+			if (errno != EAGAIN && errno != EINTR &&
+			    !pipeline->stop) {
+				int saved_err = errno;
+
+				V4L2_PERROR("dequeuing buf");
+				pipeline->error = saved_err;
+				pthread_cond_broadcast(&pipeline->cond);
+				break;
+			}
+			continue;
+		}
+
+		v4l2_frame_bitmap_clear(&devices[index].frame_queued, buf.index);
+		V4L_PROBE(libv4l2, dqbuf, devices[index].fd, buf.index,
+			  buf.sequence, buf.timestamp.tv_sec,
+			  buf.timestamp.tv_usec, buf.bytesused);
+
+		frame = &pipeline->frames[pipeline->tail % V4L2_MAX_NO_FRAMES];
+		frame->buf = buf;
+		frame->state = V4L2_PIPELINE_FRAME_DEQUEUED;
+		pipeline->tail++;
+		pthread_cond_broadcast(&pipeline->cond);
+	}
+	pthread_mutex_unlock(&devices[index].stream_lock);
+
+	return NULL;
+}
+
+static void *v4l2_pipeline_worker(void *arg)
+{
+	int index = (intptr_t)arg / V4L2_MAX_CONVERT_THREADS;
+	struct v4l2_pipeline *pipeline = devices[index].pipeline;
+	struct v4lconvert_data *convert =
+		pipeline->convert[(intptr_t)arg % V4L2_MAX_CONVERT_THREADS];
+	struct v4l2_pipeline_frame *frame;
+	struct v4l2_format src_fmt, dest_fmt;
+	unsigned char *src, *dest;
+	int result, saved_err, dest_size, dmabuf_fd;
+	uint64_t start;
+
+	pthread_mutex_lock(&devices[index].stream_lock);
+	while (!pipeline->stop) {
+		if (pipeline->convert_pos == pipeline->tail) {
+			pthread_cond_wait(&pipeline->cond,
+					  &devices[index].stream_lock);
+			continue;
+		}
+
+		frame = &pipeline->frames[pipeline->convert_pos % V4L2_MAX_NO_FRAMES];
+		pipeline->convert_pos++;
+		frame->state = V4L2_PIPELINE_FRAME_CONVERTING;
+		src_fmt = devices[index].src_fmt;
+		dest_fmt = devices[index].dest_fmt;
+		src = devices[index].frame_pointers[frame->buf.index];
+		dest_size = devices[index].convert_mmap_frame_size;
+		dest = devices[index].convert_mmap_buf +
+			frame->buf.index * dest_size;
+		dmabuf_fd = devices[index].frame_dmabuf_fd[frame->buf.index];
+		pthread_mutex_unlock(&devices[index].stream_lock);
+
+		start = v4l2_now_ns();
+		v4l2_sync_dmabuf(dmabuf_fd, 0);
+		result = v4lconvert_convert(convert, &src_fmt, &dest_fmt,
+				src, frame->buf.bytesused, dest, dest_size);
+		saved_err = errno;
+		v4l2_sync_dmabuf(dmabuf_fd, 1);
+
+		pthread_mutex_lock(&devices[index].stream_lock);
+		v4l2_stats_convert(index, result, start);
+		frame->result = result;
+		frame->error = saved_err;
+		if (result < 0)
+			snprintf(frame->error_msg, sizeof(frame->error_msg),
+				 "%s", v4lconvert_get_error_message(convert));
+		frame->state = V4L2_PIPELINE_FRAME_DONE;
+		pthread_cond_broadcast(&pipeline->cond);
+	}
+	pthread_mutex_unlock(&devices[index].stream_lock);
+
+	return NULL;
+}
+
+/* Must be called with the stream_lock held, which gets dropped while waiting
+   for the threads to exit */
+static void v4l2_pipeline_stop(int index)
+{
+	struct v4l2_pipeline *pipeline = devices[index].pipeline;
+	ssize_t written;
+	char c = 0;
+	int i;
+
+	if (!pipeline || !pipeline->running)
+		return;
+
+	/* Some other thread is already stopping the pipeline */
+	if (pipeline->stop) {
+		while (pipeline->running)
+			pthread_cond_wait(&pipeline->cond,
+					  &devices[index].stream_lock);
+		return;
+	}
+
+	pipeline->stop = 1;
+	pthread_cond_broadcast(&pipeline->cond);
+	written = SYS_WRITE(pipeline->wake_pipe[1], &c, 1);
+	if (written != 1)
+		V4L2_LOG("warning failed to wake up dequeue thread\n");
+
+	pthread_mutex_unlock(&devices[index].stream_lock);
+	pthread_join(pipeline->dequeue_thread, NULL);
+	for (i = 0; i < pipeline->running; i++)
+		pthread_join(pipeline->workers[i], NULL);
+	pthread_mutex_lock(&devices[index].stream_lock);
+
+	/* Give the frames the app did not get back to the driver */
+	if (devices[index].flags & V4L2_STREAMON)
+		for (; pipeline->head != pipeline->tail; pipeline->head++)
+			v4l2_queue_read_buffer(index, pipeline->frames[
+				pipeline->head % V4L2_MAX_NO_FRAMES].buf.index);
+
+	pipeline->head = pipeline->convert_pos = pipeline->tail = 0;
+	pipeline->running = 0;
+	pthread_cond_broadcast(&pipeline->cond);
+	V4L2_LOG("conversion threads stopped\n");
+}
+
+static int v4l2_pipeline_start(int index)
+{
+	struct v4l2_pipeline *pipeline = devices[index].pipeline;
+	ssize_t drained;
+	char c;
+	int i, result;
+
+	/* Wait for a concurrent stop to finish before restarting */
+	while (pipeline->running && pipeline->stop)
+		pthread_cond_wait(&pipeline->cond, &devices[index].stream_lock);
+
+	if (pipeline->running)
+		return 0;
+
+	/* We always convert into our fake mmap buffers, also for read() */
+	result = v4l2_ensure_convert_mmap_buf(index);
+	if (result)
+		return result;
+
+	do {
+		drained = SYS_READ(pipeline->wake_pipe[0], &c, 1);
+	} while (drained > 0);
+
+	pipeline->stop = 0;
+	pipeline->error = 0;
+	pipeline->head = pipeline->convert_pos = pipeline->tail = 0;
+
+	for (i = 0; i < pipeline->nworkers; i++) {
+		result = pthread_create(&pipeline->workers[i], NULL,
+				v4l2_pipeline_worker,
+				(void *)(intptr_t)(index * V4L2_MAX_CONVERT_THREADS + i));
+		if (result)
+			break;
+	}
+	pipeline->running = i;
+
+	if (pipeline->running)
+		result = pthread_create(&pipeline->dequeue_thread, NULL,
+				v4l2_pipeline_dequeue_thread,
+				(void *)(intptr_t)index);
+	if (result) {
+		V4L2_LOG_ERR("starting conversion threads: %s\n",
+			     strerror(result));
+		if (pipeline->running) {
+			/* Only the workers got started, stop them */
+			pipeline->stop = 1;
+			pthread_cond_broadcast(&pipeline->cond);
+			pthread_mutex_unlock(&devices[index].stream_lock);
+			for (i = 0; i < pipeline->running; i++)
+				pthread_join(pipeline->workers[i], NULL);
+			pthread_mutex_lock(&devices[index].stream_lock);
+			pipeline->running = 0;
+		}
+		errno = result;
+		return -1;
+	}
+
+	V4L2_LOG("started %d conversion threads\n", pipeline->running);
+
 	return 0;
 }
 
+static int v4l2_pipeline_dequeue_and_convert(int index, struct v4l2_buffer *buf,
+		unsigned char *dest, int dest_size)
+{
+	const int max_tries = V4L2_IGNORE_FIRST_FRAME_ERRORS + 1;
+	struct v4l2_pipeline *pipeline = devices[index].pipeline;
+	struct v4l2_pipeline_frame *frame;
+	int result, tries = max_tries;
+
+	result = v4l2_pipeline_start(index);
+	if (result)
+		return result;
+
+	do {
+		while (pipeline->head == pipeline->tail ||
+		       pipeline->frames[pipeline->head % V4L2_MAX_NO_FRAMES].state !=
+				V4L2_PIPELINE_FRAME_DONE) {
+			if (pipeline->error) {
+				errno = pipeline->error;
+				return -1;
+			}
+			if (!pipeline->running || pipeline->stop) {
+				errno = EINVAL;
+				return -1;
+			}
+			if (fcntl(devices[index].fd, F_GETFL) & O_NONBLOCK) {
+				errno = EAGAIN;
+				return -1;
+			}
+			pthread_cond_wait(&pipeline->cond,
+					  &devices[index].stream_lock);
+		}
+
+		frame = &pipeline->frames[pipeline->head % V4L2_MAX_NO_FRAMES];
+		pipeline->head++;
+		*buf = frame->buf;
+		result = frame->result;
+		if (result < 0)
+			errno = frame->error;
+
+		if (devices[index].first_frame) {
+			/* See v4l2_dequeue_and_convert() */
+			if (result < 0)
+				errno = EAGAIN;
+			devices[index].first_frame--;
+		}
+
+		if (result < 0) {
+			int saved_err = errno;
+
+			if (errno == EAGAIN || errno == EPIPE)
+				V4L2_LOG("warning error while converting frame data: %s",
+						frame->error_msg);
+			else
+				V4L2_LOG_ERR("converting / decoding frame data: %s",
+						frame->error_msg);
+
+			if (!(tries == 1 && errno == EPIPE))
+				v4l2_queue_read_buffer(index, buf->index);
+			errno = saved_err;
+		}
+		tries--;
+	} while (result < 0 && (errno == EAGAIN || errno == EPIPE) && tries);
+
+	if (result < 0 && errno == EAGAIN) {
+		V4L2_LOG_ERR("got %d consecutive frame decode errors, last error: %s",
+				max_tries, frame->error_msg);
+		errno = EIO;
+	}
+
+	if (result < 0 && errno == EPIPE) {
+		V4L2_LOG("got %d consecutive short frame errors, "
+			 "returning short frame", max_tries);
+		result = devices[index].dest_fmt.fmt.pix.sizeimage;
+		devices[index].stats.short_frames++;
+		errno = 0;
+	}
+
+	/* For read() copy the converted frame to the app */
+	if (result >= 0 && dest) {
+		result = MIN(result, dest_size);
+		memcpy(dest, devices[index].convert_mmap_buf +
+		       buf->index * devices[index].convert_mmap_frame_size,
+		       result);
+	}
+
+	return result;
+}
+
 static int v4l2_dequeue_and_convert(int index, struct v4l2_buffer *buf,
 		unsigned char *dest, int dest_size)
 {
 	const int max_tries = V4L2_IGNORE_FIRST_FRAME_ERRORS + 1;
-	int result, tries = max_tries, frame_info_gen;
+	int result, tries = max_tries, frame_info_gen, dmabuf_fd;
+	uint64_t start;
+
+	V4L_PROBE(libv4l2, dequeue_and_convert_entry, devices[index].fd,
+		  dest_size);
 
 	/* Make sure we have the real v4l2 buffers mapped */
 	result = v4l2_map_buffers(index);
 	if (result)
-		return result;
+		goto leave;
+
+	if (devices[index].pipeline && (devices[index].flags & V4L2_STREAMON)) {
+		result = v4l2_pipeline_dequeue_and_convert(index, buf, dest,
+							   dest_size);
+		goto leave;
+	}
 
 	do {
 		frame_info_gen = devices[index].frame_info_generation;
@@ -336,22 +1000,32 @@ static int v4l2_dequeue_and_convert(int index, struct v4l2_buffer *buf,
 				V4L2_PERROR("dequeuing buf");
 				errno = saved_err;
 			}
-			return result;
+			goto leave;
 		}
 
-		devices[index].frame_queued &= ~(1 << buf->index);
+		v4l2_frame_bitmap_clear(&devices[index].frame_queued, buf->index);
+		V4L_PROBE(libv4l2, dqbuf, devices[index].fd, buf->index,
+			  buf->sequence, buf->timestamp.tv_sec,
+			  buf->timestamp.tv_usec, buf->bytesused);
 
 		if (frame_info_gen != devices[index].frame_info_generation) {
 			errno = -EINVAL;
-			return -1;
+			result = -1;
+			goto leave;
 		}
 
+		dmabuf_fd = dest ? -1 :
+			devices[index].frame_dmabuf_fd[buf->index];
+		start = v4l2_now_ns();
+		v4l2_sync_dmabuf(dmabuf_fd, 0);
 		result = v4lconvert_convert(devices[index].convert,
 				&devices[index].src_fmt, &devices[index].dest_fmt,
 				devices[index].frame_pointers[buf->index],
 				buf->bytesused, dest ? dest : (devices[index].convert_mmap_buf +
 					buf->index * devices[index].convert_mmap_frame_size),
 				dest_size);
+		v4l2_sync_dmabuf(dmabuf_fd, 1);
+		v4l2_stats_convert(index, result, start);
 
 		if (devices[index].first_frame) {
 			/* Always treat convert errors as EAGAIN during the first few frames, as
@@ -394,9 +1068,20 @@ static int v4l2_dequeue_and_convert(int index, struct v4l2_buffer *buf,
 		V4L2_LOG("got %d consecutive short frame errors, "
 			 "returning short frame", max_tries);
 		result = devices[index].dest_fmt.fmt.pix.sizeimage;
+		devices[index].stats.short_frames++;
 		errno = 0;
 	}
 
+leave:
+	/* buf is only filled in on success */
+	if (result >= 0)
+		V4L_PROBE(libv4l2, dequeue_and_convert_return,
+			  devices[index].fd, result, buf->index, buf->sequence,
+			  buf->timestamp.tv_sec, buf->timestamp.tv_usec);
+	else
+		V4L_PROBE(libv4l2, dequeue_and_convert_error,
+			  devices[index].fd, result, errno);
+
 	return result;
 }
 
@@ -404,6 +1089,7 @@ static int v4l2_read_and_convert(int index, unsigned char *dest, int dest_size)
 {
 	const int max_tries = V4L2_IGNORE_FIRST_FRAME_ERRORS + 1;
 	int result, buf_size, tries = max_tries;
+	uint64_t start;
 
 	buf_size = devices[index].dest_fmt.fmt.pix.sizeimage;
 
@@ -433,9 +1119,11 @@ static int v4l2_read_and_convert(int index, unsigned char *dest, int dest_size)
 			return result;
 		}
 
+		start = v4l2_now_ns();
 		result = v4lconvert_convert(devices[index].convert,
 				&devices[index].src_fmt, &devices[index].dest_fmt,
 				devices[index].readbuf, result, dest, dest_size);
+		v4l2_stats_convert(index, result, start);
 
 		if (devices[index].first_frame) {
 			/* Always treat convert errors as EAGAIN during the first few frames, as
@@ -471,6 +1159,7 @@ static int v4l2_read_and_convert(int index, unsigned char *dest, int dest_size)
 		V4L2_LOG("got %d consecutive short frame errors, "
 			 "returning short frame", max_tries);
 		result = devices[index].dest_fmt.fmt.pix.sizeimage;
+		devices[index].stats.short_frames++;
 		errno = 0;
 	}
 
@@ -500,11 +1189,53 @@ static int v4l2_queue_read_buffers(int index)
 	return 0;
 }
 
+/* Buffer ioctls can go straight to the driver once the stream has been
+   touched (so the supported_dst_fmt_only format fixup is done) and as long as
+   read() is not controlling the stream. Whether a conversion is needed is
+   checked on each ioctl, as the controls can change behind our back.
+   Must be called with the stream_lock held. */
+static void v4l2_update_passthrough(int index)
+{
+	int passthrough = (devices[index].flags & V4L2_STREAM_TOUCHED) &&
+		!(devices[index].flags & V4L2_STREAM_CONTROLLED_BY_READ);
+
+	__atomic_store_n(&devices[index].passthrough, passthrough,
+			 __ATOMIC_RELEASE);
+}
+
+/* Must be called with the stream_lock held */
+static void v4l2_publish_fmt(int index)
+{
+	/* Until the stream is touched G_FMT may need to do the
+	   supported_dst_fmt_only fixup, which needs the stream_lock */
+	if (!(devices[index].flags & V4L2_STREAM_TOUCHED))
+		return;
+
+	pthread_mutex_lock(&devices[index].fmt_lock);
+	devices[index].published_fmt = devices[index].dest_fmt;
+	pthread_mutex_unlock(&devices[index].fmt_lock);
+	__atomic_store_n(&devices[index].fmt_published, 1, __ATOMIC_RELEASE);
+}
+
+/* VIDIOC_G_FMT without the stream_lock, returns 0 when not possible yet */
+static int v4l2_get_published_fmt(int index, struct v4l2_format *fmt)
+{
+	if (!__atomic_load_n(&devices[index].fmt_published, __ATOMIC_ACQUIRE))
+		return 0;
+
+	pthread_mutex_lock(&devices[index].fmt_lock);
+	*fmt = devices[index].published_fmt;
+	pthread_mutex_unlock(&devices[index].fmt_lock);
+
+	return 1;
+}
+
 static int v4l2_activate_read_stream(int index)
 {
 	int result;
 
-	if ((devices[index].flags & V4L2_STREAMON) || devices[index].frame_queued) {
+	if ((devices[index].flags & V4L2_STREAMON) ||
+	    !v4l2_frame_bitmap_empty(&devices[index].frame_queued)) {
 		errno = EBUSY;
 		return -1;
 	}
@@ -518,6 +1249,11 @@ static int v4l2_activate_read_stream(int index)
 		return result;
 
 	devices[index].flags |= V4L2_STREAM_CONTROLLED_BY_READ;
+	v4l2_update_passthrough(index);
+
+	/* The sequence numbers start over */
+	devices[index].last_sequence_valid = 0;
+	devices[index].read_window_frames = 0;
 
 	return v4l2_streamon(index);
 }
@@ -526,6 +1262,13 @@ static int v4l2_deactivate_read_stream(int index)
 {
 	int result;
 
+	/* The app still holds pointers into our buffers */
+	if (!v4l2_frame_bitmap_empty(&devices[index].frame_borrowed)) {
+		V4L2_LOG("v4l2_deactivate_read_stream(): frames still borrowed\n");
+		errno = EBUSY;
+		return -1;
+	}
+
 	result = v4l2_streamoff(index);
 	if (result)
 		return result;
@@ -541,6 +1284,106 @@ static int v4l2_deactivate_read_stream(int index)
 	return 0;
 }
 
+/* Counts the frames the driver dropped before buf, in the stats and in the
+   window of v4l2_adapt_read_buffers(). Must be called with the stream_lock
+   held */
+static void v4l2_account_read_frame(int index, const struct v4l2_buffer *buf)
+{
+	uint64_t ts = buf->timestamp.tv_sec * 1000000000ULL +
+		buf->timestamp.tv_usec * 1000ULL;
+
+	/* Drivers not counting frames leave sequence at 0 */
+	if (devices[index].last_sequence_valid &&
+	    buf->sequence > devices[index].last_sequence) {
+		uint32_t drops = buf->sequence - devices[index].last_sequence - 1;
+
+		devices[index].stats.frames_dropped += drops;
+		devices[index].read_window_drops += drops;
+	}
+	devices[index].last_sequence = buf->sequence;
+	devices[index].last_sequence_valid = 1;
+	devices[index].read_window_end_ns = ts;
+
+	if (!devices[index].read_window_frames) {
+		devices[index].read_window_drops = 0;
+		devices[index].read_window_start_ns = ts;
+		devices[index].read_window_convert_ns =
+			devices[index].stats.convert_ns;
+		devices[index].read_window_conversions =
+			devices[index].stats.frames_converted +
+			devices[index].stats.convert_errors;
+	}
+	devices[index].read_window_frames++;
+}
+
+/* Picks the number of read() emulation buffers at the end of each window of
+   V4L2_READ_WINDOW_FRAMES frames. Frames dropped by the driver while the
+   conversions take less than a frame interval mean the application or the
+   conversion stalled for a moment and the driver ran out of buffers, so 2
+   more are used. If the conversions can't keep up more buffers don't help.
+   After V4L2_READ_CALM_WINDOWS windows without drops and with conversions
+   taking less than half a frame interval 1 buffer is given back. Changing
+   the number of buffers restarts the stream. Must be called with the
+   stream_lock held, with no frame borrowed. */
+static void v4l2_adapt_read_buffers(int index)
+{
+	unsigned int frames = devices[index].read_window_frames;
+	unsigned int count = devices[index].nreadbuffers;
+	uint64_t interval = 0, convert_ns = 0, conversions;
+
+	if (v4l2_min_readbuffers == v4l2_max_readbuffers ||
+	    frames < V4L2_READ_WINDOW_FRAMES ||
+	    !(devices[index].flags & V4L2_STREAM_CONTROLLED_BY_READ))
+		return;
+
+	/* The drops are within the window too, timestamps may be missing */
+	if (devices[index].read_window_end_ns >
+	    devices[index].read_window_start_ns)
+		interval = (devices[index].read_window_end_ns -
+			    devices[index].read_window_start_ns) /
+			(frames + devices[index].read_window_drops - 1);
+	conversions = devices[index].stats.frames_converted +
+		devices[index].stats.convert_errors -
+		devices[index].read_window_conversions;
+	if (conversions)
+		convert_ns = (devices[index].stats.convert_ns -
+			      devices[index].read_window_convert_ns) / conversions;
+
+	if (devices[index].read_window_drops) {
+		devices[index].read_calm_windows = 0;
+		if (!interval || convert_ns < interval)
+			count = MIN(count + 2, v4l2_max_readbuffers);
+	} else if (!interval || convert_ns < interval / 2) {
+		if (++devices[index].read_calm_windows >= V4L2_READ_CALM_WINDOWS) {
+			devices[index].read_calm_windows = 0;
+			if (count > v4l2_min_readbuffers)
+				count--;
+		}
+	} else {
+		devices[index].read_calm_windows = 0;
+	}
+	devices[index].read_window_frames = 0;
+
+	if (count == devices[index].nreadbuffers ||
+	    !v4l2_frame_bitmap_empty(&devices[index].frame_borrowed))
+		return;
+
+	V4L2_LOG("%u frames dropped in %u, %.3f ms per conversion: restarting "
+		 "read stream with %u instead of %u buffers\n",
+		 devices[index].read_window_drops,
+		 frames + devices[index].read_window_drops, convert_ns / 1e6,
+		 count, devices[index].nreadbuffers);
+	if (v4l2_deactivate_read_stream(index))
+		return;
+	/* Sized for the old number of buffers */
+	v4l2_free_convert_mmap_buf(index, 1);
+	devices[index].nreadbuffers = count;
+	devices[index].stats.read_buffer_resizes++;
+	/* The next v4l2_read() tries again when this fails */
+	if (v4l2_activate_read_stream(index))
+		V4L2_LOG_WARN("restarting read stream: %s\n", strerror(errno));
+}
+
 static int v4l2_needs_conversion(int index)
 {
 	if (devices[index].convert == NULL)
@@ -550,6 +1393,20 @@ static int v4l2_needs_conversion(int index)
 			&devices[index].src_fmt, &devices[index].dest_fmt);
 }
 
+static int v4l2_can_passthrough(int index, unsigned long int request,
+				void *arg)
+{
+	if (request != VIDIOC_QBUF && request != VIDIOC_DQBUF &&
+	    request != VIDIOC_QUERYBUF)
+		return 0;
+
+	if (((struct v4l2_buffer *)arg)->type != V4L2_BUF_TYPE_VIDEO_CAPTURE)
+		return 1; /* Not ours, never needs the stream_lock */
+
+	return __atomic_load_n(&devices[index].passthrough, __ATOMIC_ACQUIRE) &&
+	       !v4l2_needs_conversion(index);
+}
+
 static void v4l2_set_conversion_buf_params(int index, struct v4l2_buffer *buf)
 {
 	if (!v4l2_needs_conversion(index))
@@ -655,7 +1512,7 @@ int v4l2_open(const char *file, int oflag, ...)
 int v4l2_fd_open(int fd, int v4l2_flags)
 {
 	int i, index;
-	char *lfname;
+	char *lfname, *interval, *readbuffers;
 	struct v4l2_capability cap;
 	struct v4l2_format fmt = { 0, };
 	struct v4l2_streamparm parm = { 0, };
@@ -663,6 +1520,7 @@ int v4l2_fd_open(int fd, int v4l2_flags)
 	void *plugin_library;
 	void *dev_ops_priv;
 	const struct libv4l_dev_ops *dev_ops;
+	struct v4l2_pipeline *pipeline = NULL;
 	long page_size;
 
 	v4l2_plugin_init(fd, &plugin_library, &dev_ops_priv, &dev_ops);
@@ -675,6 +1533,28 @@ int v4l2_fd_open(int fd, int v4l2_flags)
 			v4l2_log_file = fopen(lfname, "w");
 	}
 
+	interval = getenv("LIBV4L2_STATS_INTERVAL");
+	if (interval)
+		v4l2_stats_interval = atoi(interval);
+
+	/* A single number (the minimum) fixes the count */
+	readbuffers = getenv("LIBV4L2_READ_BUFFERS");
+	if (readbuffers) {
+		unsigned int min = 0, max = 0;
+		int n = sscanf(readbuffers, "%u:%u", &min, &max);
+
+		if (n == 1)
+			max = min;
+		if (n >= 1 && min >= 1 && min <= max &&
+		    max <= V4L2_MAX_NO_FRAMES) {
+			v4l2_min_readbuffers = min;
+			v4l2_max_readbuffers = max;
+		} else {
+			V4L2_LOG_WARN("ignoring invalid LIBV4L2_READ_BUFFERS %s\n",
+				      readbuffers);
+		}
+	}
+
 	/* Get page_size (for mmap emulation) */
 	page_size = sysconf(_SC_PAGESIZE);
 	if (page_size < 0) {
@@ -726,13 +1606,20 @@ int v4l2_fd_open(int fd, int v4l2_flags)
 			errno = saved_err;
 			return -1;
 		}
+
+		if (v4l2_flags & V4L2_ENABLE_PIPELINED_CONVERSION) {
+			pipeline = v4l2_pipeline_create(fd, dev_ops_priv,
+							dev_ops);
+			if (!pipeline)
+				V4L2_LOG_WARN("could not create conversion threads, converting in the calling thread\n");
+		}
 	}
 
 no_capture:
 	/* So we have a v4l2 capture device, register it in our devices array */
 	pthread_mutex_lock(&v4l2_open_mutex);
 	for (index = 0; index < V4L2_MAX_DEVICES; index++) {
-		if (devices[index].fd == -1) {
+		if (index >= devices_used || devices[index].fd == -1) {
 			devices[index].fd = fd;
 			devices[index].plugin_library = plugin_library;
 			devices[index].dev_ops_priv = dev_ops_priv;
@@ -740,13 +1627,27 @@ no_capture:
 			break;
 		}
 	}
+	if (index < V4L2_MAX_DEVICES) {
+		if (v4l2_set_fd_index(fd, index)) {
+			devices[index].fd = -1;
+			index = -1;
+		} else if (index >= devices_used) {
+			devices_used = index + 1;
+		}
+	}
 	pthread_mutex_unlock(&v4l2_open_mutex);
 
-	if (index == V4L2_MAX_DEVICES) {
-		V4L2_LOG_ERR("attempting to open more than %d video devices\n",
-				V4L2_MAX_DEVICES);
+	if (index == V4L2_MAX_DEVICES || index == -1) {
+		if (index == -1) {
+			V4L2_LOG_ERR("out of memory registering the device\n");
+			errno = ENOMEM;
+		} else {
+			V4L2_LOG_ERR("attempting to open more than %d video devices\n",
+					V4L2_MAX_DEVICES);
+			errno = EBUSY;
+		}
+		v4l2_pipeline_destroy(pipeline);
 		v4l2_plugin_cleanup(plugin_library, dev_ops_priv, dev_ops);
-		errno = EBUSY;
 		return -1;
 	}
 
@@ -762,6 +1663,7 @@ no_capture:
 	if ((parm.type == V4L2_BUF_TYPE_VIDEO_CAPTURE) &&
 	    (parm.parm.capture.capability & V4L2_CAP_TIMEPERFRAME))
 		devices[index].flags |= V4L2_SUPPORTS_TIMEPERFRAME;
+	devices[index].passthrough = 0;
 	devices[index].open_count = 1;
 	devices[index].page_size = page_size;
 	devices[index].src_fmt  = fmt;
@@ -770,22 +1672,31 @@ no_capture:
 				     &devices[index].dest_fmt);
 
 	pthread_mutex_init(&devices[index].stream_lock, NULL);
+	pthread_mutex_init(&devices[index].fmt_lock, NULL);
+	devices[index].fmt_published = 0;
 
 	devices[index].no_frames = 0;
 	devices[index].nreadbuffers = V4L2_DEFAULT_NREADBUFFERS;
+	if (devices[index].nreadbuffers < v4l2_min_readbuffers)
+		devices[index].nreadbuffers = v4l2_min_readbuffers;
+	if (devices[index].nreadbuffers > v4l2_max_readbuffers)
+		devices[index].nreadbuffers = v4l2_max_readbuffers;
+	devices[index].read_calm_windows = 0;
 	devices[index].convert = convert;
 	devices[index].convert_mmap_buf = MAP_FAILED;
 	devices[index].convert_mmap_buf_size = 0;
 	for (i = 0; i < V4L2_MAX_NO_FRAMES; i++) {
 		devices[index].frame_pointers[i] = MAP_FAILED;
 		devices[index].frame_map_count[i] = 0;
+		devices[index].frame_dmabuf_fd[i] = -1;
 	}
-	devices[index].frame_queued = 0;
+	v4l2_frame_bitmap_zero(&devices[index].frame_queued);
+	v4l2_frame_bitmap_zero(&devices[index].frame_borrowed);
 	devices[index].readbuf = NULL;
 	devices[index].readbuf_size = 0;
-
-	if (index >= devices_used)
-		devices_used = index + 1;
+	devices[index].pipeline = pipeline;
+	memset(&devices[index].stats, 0, sizeof(devices[index].stats));
+	devices[index].stats_next_dump = 0;
 
 	/* Note we always tell v4lconvert to optimize src fmt selection for
 	   our default fps, the only exception is the app explicitly selecting
@@ -802,12 +1713,22 @@ no_capture:
 /* Is this an fd for which we are emulating v4l1 ? */
 static int v4l2_get_index(int fd)
 {
-	int index;
+	unsigned int chunk;
+	int index, *table;
 
 	/* We never handle fd -1 */
-	if (fd == -1)
+	if (fd < 0)
 		return -1;
 
+	chunk = (unsigned int)fd >> V4L2_FD_CHUNK_BITS;
+	if (chunk < V4L2_FD_MAX_CHUNKS) {
+		table = __atomic_load_n(&fd_index[chunk], __ATOMIC_ACQUIRE);
+		if (!table)
+			return -1;
+		return __atomic_load_n(&table[fd & (V4L2_FD_CHUNK_SIZE - 1)],
+				       __ATOMIC_ACQUIRE) - 1;
+	}
+
 	for (index = 0; index < devices_used; index++)
 		if (devices[index].fd == fd)
 			break;
@@ -832,6 +1753,8 @@ int v4l2_close(int fd)
 	pthread_mutex_lock(&devices[index].stream_lock);
 	devices[index].open_count--;
 	result = devices[index].open_count != 0;
+	if (!result)
+		v4l2_pipeline_stop(index);
 	pthread_mutex_unlock(&devices[index].stream_lock);
 
 	if (result)
@@ -844,17 +1767,15 @@ int v4l2_close(int fd)
 	/* Free resources */
 	v4l2_unmap_buffers(index);
 	if (devices[index].convert_mmap_buf != MAP_FAILED) {
-		if (v4l2_buffers_mapped(index)) {
-			if (!devices[index].gone)
-				V4L2_LOG_WARN("v4l2 mmap buffers still mapped on close()\n");
-		} else {
-			SYS_MUNMAP(devices[index].convert_mmap_buf,
-					devices[index].convert_mmap_buf_size);
-		}
-		devices[index].convert_mmap_buf = MAP_FAILED;
-		devices[index].convert_mmap_buf_size = 0;
+		int mapped = v4l2_buffers_mapped(index);
+
+		if (mapped && !devices[index].gone)
+			V4L2_LOG_WARN("v4l2 mmap buffers still mapped on close()\n");
+		v4l2_free_convert_mmap_buf(index, !mapped);
 	}
 	v4lconvert_destroy(devices[index].convert);
+	v4l2_pipeline_destroy(devices[index].pipeline);
+	devices[index].pipeline = NULL;
 	free(devices[index].readbuf);
 	devices[index].readbuf = NULL;
 	devices[index].readbuf_size = 0;
@@ -862,6 +1783,7 @@ int v4l2_close(int fd)
 	/* Remove the fd from our list of managed fds before closing it, because as
 	   soon as we've done the actual close, the fd maybe returned by an open() in
 	   another thread and we don't want to intercept calls to this new fd. */
+	v4l2_set_fd_index(fd, -1);
 	devices[index].fd = -1;
 
 	/* Since we've marked the fd as no longer used, and freed the resources,
@@ -889,6 +1811,15 @@ int v4l2_dup(int fd)
 
 static int v4l2_check_buffer_change_ok(int index)
 {
+	if (!v4l2_frame_bitmap_empty(&devices[index].frame_borrowed)) {
+		V4L2_LOG("v4l2_check_buffer_change_ok(): frames still borrowed\n");
+		errno = EBUSY;
+		return -1;
+	}
+
+	/* The conversion threads use the buffers we are about to unmap */
+	v4l2_pipeline_stop(index);
+
 	devices[index].frame_info_generation++;
 	v4l2_unmap_buffers(index);
 
@@ -896,7 +1827,7 @@ static int v4l2_check_buffer_change_ok(int index)
 	if (v4l2_buffers_mapped(index) ||
 			(!(devices[index].flags & V4L2_STREAM_CONTROLLED_BY_READ) &&
 			 ((devices[index].flags & V4L2_STREAMON) ||
-			  devices[index].frame_queued))) {
+			  !v4l2_frame_bitmap_empty(&devices[index].frame_queued)))) {
 		V4L2_LOG("v4l2_check_buffer_change_ok(): stream busy\n");
 		errno = EBUSY;
 		return -1;
@@ -905,10 +1836,7 @@ static int v4l2_check_buffer_change_ok(int index)
 	/* We may change from convert to non conversion mode and
 	   v4l2_unrequest_read_buffers may change the no_frames, so free the
 	   convert mmap buffer */
-	SYS_MUNMAP(devices[index].convert_mmap_buf,
-			devices[index].convert_mmap_buf_size);
-	devices[index].convert_mmap_buf = MAP_FAILED;
-	devices[index].convert_mmap_buf_size = 0;
+	v4l2_free_convert_mmap_buf(index, 1);
 
 	if (devices[index].flags & V4L2_STREAM_CONTROLLED_BY_READ) {
 		V4L2_LOG("deactivating read-stream for settings change\n");
@@ -1076,10 +2004,13 @@ int v4l2_ioctl(int fd, unsigned long int request, ...)
 	   ioctl, causing it to get sign extended, depending upon this behavior */
 	request = (unsigned int)request;
 
-	if (devices[index].convert == NULL)
+	if (devices[index].convert == NULL ||
+	    v4l2_can_passthrough(index, request, arg))
 		goto no_capture_request;
 
-	/* Is this a capture request and do we need to take the stream lock? */
+	/* Is this a capture request and do we need to take the stream lock?
+	   Only requests touching the format or the buffers take it, so that
+	   control changes don't wait for a frame being converted. */
 	switch (request) {
 	case VIDIOC_QUERYCAP:
 	case VIDIOC_QUERYCTRL:
@@ -1102,8 +2033,18 @@ int v4l2_ioctl(int fd, unsigned long int request, ...)
 				V4L2_BUF_TYPE_VIDEO_CAPTURE)
 			is_capture_request = 1;
 		break;
-	case VIDIOC_S_FMT:
 	case VIDIOC_G_FMT:
+		if (((struct v4l2_format *)arg)->type ==
+				V4L2_BUF_TYPE_VIDEO_CAPTURE) {
+			if (v4l2_get_published_fmt(index, arg)) {
+				result = 0;
+				goto leave;
+			}
+			is_capture_request = 1;
+			stream_needs_locking = 1;
+		}
+		break;
+	case VIDIOC_S_FMT:
 		if (((struct v4l2_format *)arg)->type ==
 				V4L2_BUF_TYPE_VIDEO_CAPTURE) {
 			is_capture_request = 1;
@@ -1126,6 +2067,13 @@ int v4l2_ioctl(int fd, unsigned long int request, ...)
 			stream_needs_locking = 1;
 		}
 		break;
+	case VIDIOC_EXPBUF:
+		if (((struct v4l2_exportbuffer *)arg)->type ==
+				V4L2_BUF_TYPE_VIDEO_CAPTURE) {
+			is_capture_request = 1;
+			stream_needs_locking = 1;
+		}
+		break;
 	case VIDIOC_STREAMON:
 	case VIDIOC_STREAMOFF:
 		if (*((enum v4l2_buf_type *)arg) ==
@@ -1350,6 +2298,44 @@ no_capture_request:
 		break;
 	}
 
+	case VIDIOC_EXPBUF: {
+		struct v4l2_exportbuffer *exp = arg;
+		int dmabuf_fd;
+
+		/* The driver's buffers hold the unconverted frames, the ones
+		   the app sees are ours when converting */
+		if (!v4l2_needs_conversion(index)) {
+			result = devices[index].dev_ops->ioctl(
+					devices[index].dev_ops_priv,
+					fd, VIDIOC_EXPBUF, arg);
+			break;
+		}
+
+		if (exp->index >= devices[index].no_frames || exp->plane ||
+		    (exp->flags & ~(O_CLOEXEC | O_ACCMODE))) {
+			errno = EINVAL;
+			result = -1;
+			break;
+		}
+
+		result = v4l2_ensure_convert_mmap_buf(index);
+		if (result)
+			break;
+
+		dmabuf_fd = devices[index].frame_dmabuf_fd[exp->index];
+		if (dmabuf_fd == -1) {
+			V4L2_LOG("cannot export conversion buffer %u, it is not a dma-buf\n",
+				 exp->index);
+			errno = EINVAL;
+			result = -1;
+			break;
+		}
+		exp->fd = fcntl(dmabuf_fd, (exp->flags & O_CLOEXEC) ?
+				F_DUPFD_CLOEXEC : F_DUPFD, 0);
+		result = exp->fd < 0 ? -1 : 0;
+		break;
+	}
+
 	case VIDIOC_QBUF: {
 		struct v4l2_buffer *buf = arg;
 
@@ -1370,6 +2356,14 @@ no_capture_request:
 				devices[index].dev_ops_priv,
 				fd, VIDIOC_QBUF, arg);
 
+		/* Let the dequeue thread know the driver has a buffer to fill */
+		if (result == 0 && devices[index].pipeline &&
+		    v4l2_needs_conversion(index) &&
+		    buf->index < V4L2_MAX_NO_FRAMES) {
+			v4l2_frame_bitmap_set(&devices[index].frame_queued, buf->index);
+			pthread_cond_broadcast(&devices[index].pipeline->cond);
+		}
+
 		v4l2_set_conversion_buf_params(index, buf);
 		break;
 	}
@@ -1459,9 +2453,13 @@ no_capture_request:
 		break;
 	}
 
-	if (stream_needs_locking)
+	if (stream_needs_locking) {
+		v4l2_update_passthrough(index);
+		v4l2_publish_fmt(index);
 		pthread_mutex_unlock(&devices[index].stream_lock);
+	}
 
+leave:
 	saved_err = errno;
 	v4l2_log_ioctl(request, arg, result);
 	errno = saved_err;
@@ -1553,10 +2551,11 @@ ssize_t v4l2_read(int fd, void *dest, size_t n)
 	pthread_mutex_lock(&devices[index].stream_lock);
 
 	/* When not converting and the device supports read(), let the kernel handle
-	   it */
-	if (devices[index].convert == NULL ||
-	    ((devices[index].flags & V4L2_SUPPORTS_READ) &&
-			!v4l2_needs_conversion(index))) {
+	   it, unless v4l2_borrow_frame() already started streaming under the hood */
+	if ((devices[index].convert == NULL ||
+	     ((devices[index].flags & V4L2_SUPPORTS_READ) &&
+			!v4l2_needs_conversion(index))) &&
+	    !(devices[index].flags & V4L2_STREAM_CONTROLLED_BY_READ)) {
 		result = devices[index].dev_ops->read(
 				devices[index].dev_ops_priv,
 				fd, dest, n);
@@ -1591,10 +2590,226 @@ ssize_t v4l2_read(int fd, void *dest, size_t n)
 		buf.memory = V4L2_MEMORY_MMAP;
 		result = v4l2_dequeue_and_convert(index, &buf, dest, n);
 
-		if (result >= 0)
+		if (result >= 0) {
+			v4l2_account_read_frame(index, &buf);
 			v4l2_queue_read_buffer(index, buf.index);
+			v4l2_adapt_read_buffers(index);
+		}
+	}
+
+leave:
+	V4L_PROBE(libv4l2, read_return, fd, result);
+	saved_errno = errno;
+	pthread_mutex_unlock(&devices[index].stream_lock);
+	errno = saved_errno;
+
+	return result;
+}
+
+ssize_t v4l2_borrow_frame(int fd, void **frame, int *id)
+{
+	struct v4l2_buffer buf;
+	ssize_t result;
+	int saved_errno;
+	int index = v4l2_get_index(fd);
+
+	if (index == -1) {
+		errno = EBADF;
+		return -1;
+	}
+
+	pthread_mutex_lock(&devices[index].stream_lock);
+
+	/* We need mmap (streaming) mode under the hood to have a buffer to
+	   hand out, see v4l2_read() */
+	if (!(devices[index].flags & V4L2_STREAM_CONTROLLED_BY_READ)) {
+		if (devices[index].flags & V4L2_USE_READ_FOR_READ) {
+			errno = EINVAL;
+			result = -1;
+			goto leave;
+		}
+		result = v4l2_activate_read_stream(index);
+		if (result)
+			goto leave;
+	}
+
+	memset(&buf, 0, sizeof(buf));
+	buf.type   = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+	buf.memory = V4L2_MEMORY_MMAP;
+
+	if (v4l2_needs_conversion(index)) {
+		result = v4l2_ensure_convert_mmap_buf(index);
+		if (result)
+			goto leave;
+
+		result = v4l2_dequeue_and_convert(index, &buf, NULL,
+				devices[index].convert_mmap_frame_size);
+		if (result < 0)
+			goto leave;
+
+		*frame = devices[index].convert_mmap_buf +
+			buf.index * devices[index].convert_mmap_frame_size;
+	} else {
+		result = v4l2_map_buffers(index);
+		if (result)
+			goto leave;
+
+		pthread_mutex_unlock(&devices[index].stream_lock);
+		result = devices[index].dev_ops->ioctl(
+				devices[index].dev_ops_priv,
+				devices[index].fd, VIDIOC_DQBUF, &buf);
+		pthread_mutex_lock(&devices[index].stream_lock);
+		if (result) {
+			if (errno != EAGAIN) {
+				saved_errno = errno;
+				V4L2_PERROR("dequeuing buf");
+				errno = saved_errno;
+			}
+			goto leave;
+		}
+
+		v4l2_frame_bitmap_clear(&devices[index].frame_queued, buf.index);
+		*frame = devices[index].frame_pointers[buf.index];
+		result = buf.bytesused;
+	}
+
+	v4l2_account_read_frame(index, &buf);
+	v4l2_frame_bitmap_set(&devices[index].frame_borrowed, buf.index);
+	*id = buf.index;
+
+leave:
+	saved_errno = errno;
+	pthread_mutex_unlock(&devices[index].stream_lock);
+	errno = saved_errno;
+
+	return result;
+}
+
+int v4l2_get_stats(int fd, struct v4l2_lib_stats *stats)
+{
+	int index = v4l2_get_index(fd);
+
+	if (index == -1) {
+		errno = EBADF;
+		return -1;
+	}
+
+	pthread_mutex_lock(&devices[index].stream_lock);
+	v4l2_get_stats_locked(index, stats);
+	pthread_mutex_unlock(&devices[index].stream_lock);
+
+	return 0;
+}
+
+int v4l2_release_frame(int fd, int id)
+{
+	int result;
+	int saved_errno;
+	int index = v4l2_get_index(fd);
+
+	if (index == -1) {
+		errno = EBADF;
+		return -1;
+	}
+
+	pthread_mutex_lock(&devices[index].stream_lock);
+
+	if (id < 0 || id >= V4L2_MAX_NO_FRAMES ||
+	    !v4l2_frame_bitmap_test(&devices[index].frame_borrowed, id)) {
+		errno = EINVAL;
+		result = -1;
+		goto leave;
+	}
+
+	v4l2_frame_bitmap_clear(&devices[index].frame_borrowed, id);
+	result = v4l2_queue_read_buffer(index, id);
+	if (!result)
+		v4l2_adapt_read_buffers(index);
+
+leave:
+	saved_errno = errno;
+	pthread_mutex_unlock(&devices[index].stream_lock);
+	errno = saved_errno;
+
+	return result;
+}
+
+/* Swaps the len bytes of pages at a and b through a scratch mapping, all
+   three steps only move page table entries around */
+static int v4l2_swap_pages(void *a, void *b, size_t len)
+{
+	void *scratch;
+
+	/* Reserve an address range for the pages of a to go to while b's
+	   pages take their place */
+	scratch = (void *)SYS_MMAP(NULL, len, PROT_NONE,
+			MAP_ANONYMOUS | MAP_PRIVATE, -1, 0);
+	if (scratch == MAP_FAILED)
+		return -1;
+
+	if (mremap(a, len, len, MREMAP_MAYMOVE | MREMAP_FIXED,
+			scratch) == MAP_FAILED) {
+		SYS_MUNMAP(scratch, len);
+		return -1;
+	}
+	if (mremap(b, len, len, MREMAP_MAYMOVE | MREMAP_FIXED,
+			a) == MAP_FAILED) {
+		/* Put a's pages back, this can't fail as nothing is mapped at
+		   a anymore */
+		mremap(scratch, len, len, MREMAP_MAYMOVE | MREMAP_FIXED, a);
+		return -1;
+	}
+	if (mremap(scratch, len, len, MREMAP_MAYMOVE | MREMAP_FIXED,
+			b) == MAP_FAILED) {
+		/* The pages at b only hold a frame to be overwritten by a later
+		   conversion, so fresh ones do as well */
+		SYS_MUNMAP(scratch, len);
+		if ((void *)SYS_MMAP(b, len, PROT_READ | PROT_WRITE,
+				MAP_ANONYMOUS | MAP_PRIVATE | MAP_FIXED,
+				-1, 0) == MAP_FAILED)
+			V4L2_LOG_ERR("remapping conversion buffer: %s\n",
+					strerror(errno));
+	}
+
+	return 0;
+}
+
+int v4l2_move_frame(int fd, int id, void *dest, size_t n)
+{
+	int result;
+	int saved_errno;
+	size_t len;
+	int index = v4l2_get_index(fd);
+
+	if (index == -1) {
+		errno = EBADF;
+		return -1;
+	}
+
+	pthread_mutex_lock(&devices[index].stream_lock);
+
+	len = devices[index].convert_mmap_frame_size;
+
+	/* Only frames converted into our own anonymous buffer, which the
+	   application has not mapped through v4l2_mmap() nor exported, can be
+	   moved */
+	if (id < 0 || id >= V4L2_MAX_NO_FRAMES ||
+	    !v4l2_frame_bitmap_test(&devices[index].frame_borrowed, id) ||
+	    !v4l2_needs_conversion(index) ||
+	    devices[index].convert_mmap_buf == MAP_FAILED ||
+	    devices[index].frame_dmabuf_fd[id] != -1 ||
+	    devices[index].frame_map_count[id] ||
+	    (uintptr_t)dest % devices[index].page_size || n < len) {
+		errno = EINVAL;
+		result = -1;
+		goto leave;
 	}
 
+	result = v4l2_swap_pages(dest, devices[index].convert_mmap_buf +
+			id * len, len);
+	if (result)
+		errno = EINVAL;
+
 leave:
 	saved_errno = errno;
 	pthread_mutex_unlock(&devices[index].stream_lock);
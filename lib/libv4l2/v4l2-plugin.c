@@ -21,6 +21,9 @@
 #include <dlfcn.h>
 #include <fcntl.h>
 #include <glob.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
 #include <sys/stat.h>
 #include <sys/mman.h>
 #include "libv4l2.h"
@@ -48,19 +51,41 @@
 
 #define PLUGINS_PATTERN LIBV4L2_PLUGIN_DIR "/*.so"
 
-void v4l2_plugin_init(int fd, void **plugin_lib_ret, void **plugin_priv_ret,
-		      const struct libv4l_dev_ops **dev_ops_ret)
+/* The plugins are loaded once per process, and only loaded again if the
+   plugin directory changes */
+struct v4l2_plugin {
+	char *path;
+	void *library;
+	const struct libv4l_dev_ops *ops;
+};
+
+static pthread_mutex_t v4l2_plugins_mutex = PTHREAD_MUTEX_INITIALIZER;
+static struct v4l2_plugin *v4l2_plugins;
+static int v4l2_num_plugins;
+static int v4l2_plugins_scanned;
+static struct timespec v4l2_plugins_mtime;
+
+static void v4l2_plugins_unload(void)
+{
+	int i;
+
+	for (i = 0; i < v4l2_num_plugins; i++) {
+		dlclose(v4l2_plugins[i].library);
+		free(v4l2_plugins[i].path);
+	}
+	free(v4l2_plugins);
+	v4l2_plugins = NULL;
+	v4l2_num_plugins = 0;
+}
+
+static void v4l2_plugins_load(void)
 {
 	char *error;
 	int glob_ret, i;
-	void *plugin_library = NULL;
-	const struct libv4l_dev_ops *libv4l2_plugin = NULL;
+	void *plugin_library;
+	const struct libv4l_dev_ops *libv4l2_plugin;
 	glob_t globbuf;
 
-	*dev_ops_ret = v4lconvert_get_default_dev_ops();
-	*plugin_lib_ret = NULL;
-	*plugin_priv_ret = NULL;
-
 	glob_ret = glob(PLUGINS_PATTERN, 0, NULL, &globbuf);
 
 	if (glob_ret == GLOB_NOSPACE)
@@ -69,6 +94,10 @@ void v4l2_plugin_init(int fd, void **plugin_lib_ret, void **plugin_priv_ret,
 	if (glob_ret == GLOB_ABORTED || glob_ret == GLOB_NOMATCH)
 		goto leave;
 
+	v4l2_plugins = calloc(globbuf.gl_pathc, sizeof(*v4l2_plugins));
+	if (!v4l2_plugins)
+		goto leave;
+
 	for (i = 0; i < globbuf.gl_pathc; i++) {
 		V4L2_LOG("PLUGIN: dlopen(%s);\n", globbuf.gl_pathv[i]);
 
@@ -94,10 +123,69 @@ void v4l2_plugin_init(int fd, void **plugin_lib_ret, void **plugin_priv_ret,
 			continue;
 		}
 
+		v4l2_plugins[v4l2_num_plugins].path = strdup(globbuf.gl_pathv[i]);
+		if (!v4l2_plugins[v4l2_num_plugins].path) {
+			dlclose(plugin_library);
+			continue;
+		}
+		v4l2_plugins[v4l2_num_plugins].library = plugin_library;
+		v4l2_plugins[v4l2_num_plugins].ops = libv4l2_plugin;
+		v4l2_num_plugins++;
+	}
+
+leave:
+	globfree(&globbuf);
+}
+
+/* Must be called with v4l2_plugins_mutex held */
+static void v4l2_plugins_update(void)
+{
+	struct stat st;
+
+	if (stat(LIBV4L2_PLUGIN_DIR, &st))
+		memset(&st, 0, sizeof(st));
+
+	if (v4l2_plugins_scanned &&
+	    st.st_mtim.tv_sec == v4l2_plugins_mtime.tv_sec &&
+	    st.st_mtim.tv_nsec == v4l2_plugins_mtime.tv_nsec)
+		return;
+
+	/* The devices using a plugin hold their own reference to it */
+	v4l2_plugins_unload();
+	v4l2_plugins_load();
+	v4l2_plugins_mtime = st.st_mtim;
+	v4l2_plugins_scanned = 1;
+}
+
+void v4l2_plugin_init(int fd, void **plugin_lib_ret, void **plugin_priv_ret,
+		      const struct libv4l_dev_ops **dev_ops_ret)
+{
+	const struct libv4l_dev_ops *libv4l2_plugin;
+	void *plugin_library;
+	int i;
+
+	*dev_ops_ret = v4lconvert_get_default_dev_ops();
+	*plugin_lib_ret = NULL;
+	*plugin_priv_ret = NULL;
+
+	pthread_mutex_lock(&v4l2_plugins_mutex);
+	v4l2_plugins_update();
+
+	for (i = 0; i < v4l2_num_plugins; i++) {
+		libv4l2_plugin = v4l2_plugins[i].ops;
+
 		*plugin_priv_ret = libv4l2_plugin->init(fd);
 		if (!*plugin_priv_ret) {
 			V4L2_LOG("PLUGIN: plugin open() returned NULL\n");
-			dlclose(plugin_library);
+			continue;
+		}
+
+		/* Take a reference for the device, dropped by v4l2_plugin_cleanup() */
+		plugin_library = dlopen(v4l2_plugins[i].path,
+					RTLD_LAZY | RTLD_NOLOAD);
+		if (!plugin_library) {
+			libv4l2_plugin->close(*plugin_priv_ret);
+			*plugin_priv_ret = NULL;
 			continue;
 		}
 
@@ -105,9 +193,7 @@ void v4l2_plugin_init(int fd, void **plugin_lib_ret, void **plugin_priv_ret,
 		*dev_ops_ret = libv4l2_plugin;
 		break;
 	}
-
-leave:
-	globfree(&globbuf);
+	pthread_mutex_unlock(&v4l2_plugins_mutex);
 }
 
 void v4l2_plugin_cleanup(void *plugin_lib, void *plugin_priv,
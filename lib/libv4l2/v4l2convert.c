@@ -37,6 +37,7 @@
 #include <stdlib.h>
 #include <fcntl.h>
 #include <string.h>
+#include <pthread.h>
 #include <sys/ioctl.h>
 #include <sys/mman.h>
 #if defined(__OpenBSD__)
@@ -45,6 +46,7 @@
 #include <linux/videodev2.h>
 #endif
 #include <libv4l2.h>
+#include <libv4lconvert.h>
 #include "../libv4lconvert/libv4lsyscall-priv.h"
 
 /* Check that open/read/mmap is not a define */
@@ -58,6 +60,165 @@
 #define LIBV4L_PUBLIC
 #endif
 
+/* With LIBV4L2_LAZY set in the environment, video devices are not handed to
+   libv4l2 when opened. Instead only the format enumeration and negotiation
+   ioctls are looked at (answered by a libv4lconvert instance, so the
+   emulated formats are listed as usual), and the device is handed to libv4l2
+   when the application tries or sets a format which needs conversion. So
+   applications using a native format of the camera keep doing their buffer
+   I/O directly with the kernel. Devices for which libv4l2 always converts
+   (ie to flip the image of upside down mounted cameras) are handed to
+   libv4l2 at their first negotiation ioctl. */
+#ifndef ANDROID
+#define V4L2CONVERT_MAX_LAZY 16
+
+struct v4l2convert_lazy_dev {
+	int fd;
+	struct v4lconvert_data *convert;
+};
+
+static pthread_mutex_t v4l2convert_lazy_mutex = PTHREAD_MUTEX_INITIALIZER;
+static struct v4l2convert_lazy_dev v4l2convert_lazy[V4L2CONVERT_MAX_LAZY] = {
+	{ -1 }, { -1 }, { -1 }, { -1 }, { -1 }, { -1 }, { -1 }, { -1 },
+	{ -1 }, { -1 }, { -1 }, { -1 }, { -1 }, { -1 }, { -1 }, { -1 }
+};
+static int v4l2convert_lazy_used;
+
+static int v4l2convert_lazy_enabled(void)
+{
+	static int enabled = -1;
+
+	if (enabled == -1)
+		enabled = getenv("LIBV4L2_LAZY") != NULL;
+
+	return enabled;
+}
+
+/* Must be called with the lazy mutex held */
+static struct v4l2convert_lazy_dev *v4l2convert_lazy_find(int fd)
+{
+	int i;
+
+	for (i = 0; i < V4L2CONVERT_MAX_LAZY; i++)
+		if (v4l2convert_lazy[i].fd == fd)
+			return &v4l2convert_lazy[i];
+
+	return NULL;
+}
+
+/* Returns 0 when the fd is tracked for lazy wrapping, -1 if there's no room
+   left, in which case the caller should wrap it right away */
+static int v4l2convert_lazy_add(int fd)
+{
+	struct v4l2convert_lazy_dev *dev;
+
+	pthread_mutex_lock(&v4l2convert_lazy_mutex);
+	dev = v4l2convert_lazy_find(-1);
+	if (dev) {
+		dev->fd = fd;
+		dev->convert = NULL;
+		__atomic_add_fetch(&v4l2convert_lazy_used, 1,
+				__ATOMIC_RELAXED);
+	}
+	pthread_mutex_unlock(&v4l2convert_lazy_mutex);
+
+	return dev ? 0 : -1;
+}
+
+/* Must be called with the lazy mutex held */
+static void v4l2convert_lazy_remove(struct v4l2convert_lazy_dev *dev)
+{
+	if (dev->convert)
+		v4lconvert_destroy(dev->convert);
+	dev->convert = NULL;
+	dev->fd = -1;
+	__atomic_sub_fetch(&v4l2convert_lazy_used, 1, __ATOMIC_RELAXED);
+}
+
+static int v4l2convert_lazy_request(unsigned long int request)
+{
+	switch (request) {
+	case VIDIOC_ENUM_FMT:
+	case VIDIOC_ENUM_FRAMESIZES:
+	case VIDIOC_ENUM_FRAMEINTERVALS:
+	case VIDIOC_TRY_FMT:
+	case VIDIOC_S_FMT:
+		return 1;
+	}
+
+	return 0;
+}
+
+/* Handles a format enumeration / negotiation ioctl for an fd which has not
+   been handed to libv4l2 yet, wrapping it when needed. Returns 1 with the
+   result of the ioctl in *result when the fd is one of ours, 0 otherwise */
+static int v4l2convert_lazy_ioctl(int fd, unsigned long int request,
+		void *arg, int *result)
+{
+	struct v4l2convert_lazy_dev *dev;
+	struct v4l2_format src_fmt, dest_fmt;
+	int wrap = 0;
+
+	if (!__atomic_load_n(&v4l2convert_lazy_used, __ATOMIC_RELAXED))
+		return 0;
+
+	pthread_mutex_lock(&v4l2convert_lazy_mutex);
+
+	dev = v4l2convert_lazy_find(fd);
+	if (!dev) {
+		pthread_mutex_unlock(&v4l2convert_lazy_mutex);
+		return 0;
+	}
+
+	if (!dev->convert) {
+		dev->convert = v4lconvert_create(fd);
+		if (!dev->convert ||
+		    v4lconvert_supported_dst_fmt_only(dev->convert))
+			wrap = 1;
+	}
+
+	if (!wrap) {
+		switch (request) {
+		case VIDIOC_ENUM_FMT:
+			*result = v4lconvert_enum_fmt(dev->convert, arg);
+			break;
+		case VIDIOC_ENUM_FRAMESIZES:
+			*result = v4lconvert_enum_framesizes(dev->convert, arg);
+			break;
+		case VIDIOC_ENUM_FRAMEINTERVALS:
+			*result = v4lconvert_enum_frameintervals(dev->convert,
+					arg);
+			break;
+		case VIDIOC_TRY_FMT:
+		case VIDIOC_S_FMT:
+			dest_fmt = *(struct v4l2_format *)arg;
+			if (dest_fmt.type == V4L2_BUF_TYPE_VIDEO_CAPTURE &&
+			    !v4lconvert_try_format(dev->convert, &dest_fmt,
+						  &src_fmt) &&
+			    v4lconvert_needs_conversion(dev->convert, &src_fmt,
+							&dest_fmt)) {
+				wrap = 1;
+				break;
+			}
+			*result = SYS_IOCTL(fd, request, arg);
+			break;
+		}
+	}
+
+	if (wrap) {
+		/* From now on libv4l2 handles everything for this fd, if it
+		   can't the calls go to the kernel just as well */
+		v4l2convert_lazy_remove(dev);
+		v4l2_fd_open(fd, 0);
+		*result = v4l2_ioctl(fd, request, arg);
+	}
+
+	pthread_mutex_unlock(&v4l2convert_lazy_mutex);
+
+	return 1;
+}
+#endif
+
 LIBV4L_PUBLIC int open(const char *file, int oflag, ...)
 {
 	int fd;
@@ -90,6 +251,11 @@ LIBV4L_PUBLIC int open(const char *file, int oflag, ...)
 	if (fd == -1 || !v4l_device)
 		return fd;
 
+#ifndef ANDROID
+	if (v4l2convert_lazy_enabled() && !v4l2convert_lazy_add(fd))
+		return fd;
+#endif
+
 	/* Try to Register with libv4l2 (in case of failure pass the fd to the
 	   application as is) */
 	v4l2_fd_open(fd, 0);
@@ -125,12 +291,37 @@ LIBV4L_PUBLIC int open64(const char *file, int oflag, ...)
 #ifndef ANDROID
 LIBV4L_PUBLIC int close(int fd)
 {
+	struct v4l2convert_lazy_dev *dev;
+
+	if (__atomic_load_n(&v4l2convert_lazy_used, __ATOMIC_RELAXED)) {
+		pthread_mutex_lock(&v4l2convert_lazy_mutex);
+		dev = v4l2convert_lazy_find(fd);
+		if (dev)
+			v4l2convert_lazy_remove(dev);
+		pthread_mutex_unlock(&v4l2convert_lazy_mutex);
+	}
+
 	return v4l2_close(fd);
 }
 
 LIBV4L_PUBLIC int dup(int fd)
 {
-	return v4l2_dup(fd);
+	struct v4l2convert_lazy_dev *dev = NULL;
+	int new_fd;
+
+	if (__atomic_load_n(&v4l2convert_lazy_used, __ATOMIC_RELAXED)) {
+		pthread_mutex_lock(&v4l2convert_lazy_mutex);
+		dev = v4l2convert_lazy_find(fd);
+		pthread_mutex_unlock(&v4l2convert_lazy_mutex);
+	}
+
+	new_fd = v4l2_dup(fd);
+
+	/* The copy of a not yet wrapped fd gets tracked on its own */
+	if (dev && new_fd != -1 && v4l2convert_lazy_add(new_fd))
+		v4l2_fd_open(new_fd, 0);
+
+	return new_fd;
 }
 
 #ifdef HAVE_POSIX_IOCTL
@@ -141,11 +332,16 @@ LIBV4L_PUBLIC int ioctl(int fd, unsigned long int request, ...)
 {
 	void *arg;
 	va_list ap;
+	int result;
 
 	va_start(ap, request);
 	arg = va_arg(ap, void *);
 	va_end(ap);
 
+	if (v4l2convert_lazy_request((unsigned int)request) &&
+	    v4l2convert_lazy_ioctl(fd, (unsigned int)request, arg, &result))
+		return result;
+
 	return v4l2_ioctl(fd, request, arg);
 }
 
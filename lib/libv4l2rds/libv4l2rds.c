@@ -1366,7 +1366,7 @@ void v4l2_rds_reset(struct v4l2_rds *handle, bool reset_statistics)
  * Decoding is only done once a complete group was received. This is slower compared
  * to decoding the group type independent information up front, but adds a barrier
  * against corrupted data (happens regularly when reception is weak) */
-uint32_t v4l2_rds_add(struct v4l2_rds *handle, struct v4l2_rds_data *rds_data)
+static uint32_t rds_add_block(struct v4l2_rds *handle, const struct v4l2_rds_data *rds_data)
 {
 	struct rds_private_state *priv_state = (struct rds_private_state *) handle;
 	struct v4l2_rds_data *rds_data_raw = priv_state->rds_data_raw;
@@ -1451,6 +1451,26 @@ uint32_t v4l2_rds_add(struct v4l2_rds *handle, struct v4l2_rds_data *rds_data)
 	return 0;
 }
 
+uint32_t v4l2_rds_add(struct v4l2_rds *handle, struct v4l2_rds_data *rds_data)
+{
+	return rds_add_block(handle, rds_data);
+}
+
+/* Decodes the blocks up to the first one that completes a group which
+ * updates any field, so that the caller can handle each such group in
+ * turn while reading many blocks at once */
+uint32_t v4l2_rds_add_blocks(struct v4l2_rds *handle,
+		const struct v4l2_rds_data *rds_data, unsigned int *count)
+{
+	uint32_t updated_fields = 0;
+	unsigned int i;
+
+	for (i = 0; i < *count && !updated_fields; i++)
+		updated_fields = rds_add_block(handle, &rds_data[i]);
+	*count = i;
+	return updated_fields;
+}
+
 const char *v4l2_rds_get_pty_str(const struct v4l2_rds *handle)
 {
 	const uint8_t pty = handle->pty;
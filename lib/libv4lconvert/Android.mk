@@ -4,9 +4,15 @@ include $(CLEAR_VARS)
 
 LOCAL_SRC_FILES := \
     bayer.c \
+    bayer-simd.c \
+    conv-cost.c \
     cpia1.c \
+    cpu-features.c \
     crop.c \
     flip.c \
+    flip-simd.c \
+    fmt-cache.c \
+    gpu.c \
     helper.c \
     hm12.c \
     jidctflt.c \
@@ -18,6 +24,7 @@ LOCAL_SRC_FILES := \
     mr97310a.c \
     pac207.c \
     rgbyuv.c \
+    rgbyuv-simd.c \
     se401.c \
     sn9c10x.c \
     sn9c2028-decomp.c \
@@ -26,7 +33,9 @@ LOCAL_SRC_FILES := \
     spca561-decompress.c \
     sq905c.c \
     stv0680.c \
+    threads.c \
     tinyjpeg.c \
+    unpack-simd.c \
     control/libv4lcontrol.c \
     processing/autogain.c  \
     processing/gamma.c \
@@ -0,0 +1,439 @@
+/*
+# SIMD versions of the Bayer demosaic inner loops from bayer.c
+
+# This program is free software; you can redistribute it and/or modify
+# it under the terms of the GNU Lesser General Public License as published by
+# the Free Software Foundation; either version 2.1 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU Lesser General Public License for more details.
+#
+# You should have received a copy of the GNU Lesser General Public License
+# along with this program; if not, write to the Free Software
+# Foundation, Inc., 51 Franklin Street, Suite 500, Boston, MA  02110-1335  USA
+
+ */
+
+/*
+ * These render the pairs of pixels of the non border lines which bayer.c
+ * handles in its "bayer <= bayer_end - 2" loops, with results bit identical
+ * to that code. bayer points to the line above the one being rendered, each
+ * pair consists of a non green pixel, interpolated from its diagonal and
+ * cross neighbours, followed by a green pixel, interpolated from its
+ * vertical and horizontal neighbours. For pair k the neighbours are taken
+ * from the even / odd bytes starting at bayer + 2 * k and bayer + 2 * k + 2
+ * of the 3 lines involved, so the loads never go past what the scalar code
+ * reads. The routines return the number of pairs done, the scalar code
+ * does the rest of the line.
+ */
+
+#include "libv4lconvert-priv.h"
+#include "simd-priv.h"
+
+/* Fixed point RGB -> Y weights, as used by v4lconvert_bayer_to_yuv420() */
+#define Y_BLUE_LINE_X	8453, 4148, 806		/* center, cross, diagonal */
+#define Y_RED_LINE_X	2113, 4148, 3223	/* diagonal, cross, center */
+/* For the green pixels: the red neighbours (horizontal on blue lines), center
+   and the blue neighbours */
+#define Y_GREEN		4226, 16594, 1611
+
+#ifdef HAVE_X86_SIMD
+
+/* Split 8 pairs starting at p in the even and odd bytes at p and p + 2 */
+__attribute__((target("sse2")))
+static inline void sse2_load_bayer(const unsigned char *p, __m128i *e0,
+		__m128i *o0, __m128i *e2, __m128i *o2)
+{
+	const __m128i lo_mask = _mm_set1_epi16(0x00ff);
+	__m128i l0 = _mm_loadu_si128((const __m128i *)p);
+	__m128i l2 = _mm_loadu_si128((const __m128i *)(p + 2));
+
+	*e0 = _mm_and_si128(l0, lo_mask);
+	*o0 = _mm_srli_epi16(l0, 8);
+	*e2 = _mm_and_si128(l2, lo_mask);
+	*o2 = _mm_srli_epi16(l2, 8);
+}
+
+/* (wa * a + wb * b + wc * c + 524288) >> 15, a, b and c are < 1024 */
+__attribute__((target("sse2")))
+static inline __m128i sse2_weigh3(__m128i a, __m128i b, __m128i c,
+		int wa, int wb, int wc)
+{
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i round = _mm_set1_epi32(524288);
+	const __m128i wab = _mm_set1_epi32(wa | (wb << 16));
+	const __m128i w_c = _mm_set1_epi32(wc);
+	__m128i lo, hi;
+
+	lo = _mm_add_epi32(_mm_madd_epi16(_mm_unpacklo_epi16(a, b), wab),
+			   _mm_madd_epi16(_mm_unpacklo_epi16(c, zero), w_c));
+	hi = _mm_add_epi32(_mm_madd_epi16(_mm_unpackhi_epi16(a, b), wab),
+			   _mm_madd_epi16(_mm_unpackhi_epi16(c, zero), w_c));
+	lo = _mm_srai_epi32(_mm_add_epi32(lo, round), 15);
+	hi = _mm_srai_epi32(_mm_add_epi32(hi, round), 15);
+
+	return _mm_packs_epi32(lo, hi);
+}
+
+#define SSE2_WEIGH3(a, b, c, w) sse2_weigh3(a, b, c, w)
+
+/*
+ * Load 3 lines and compute the sums of the neighbours. x_center / g_center
+ * are the center values of the non green / green pixel of each pair.
+ */
+#define SSE2_BAYER_SUMS(bayer, stride)						\
+	__m128i ae0, ao0, ae2, ao2, be0, bo0, be2, bo2, ce0, co0, ce2, co2;	\
+	__m128i diag, cross, vert, horiz, x_center, g_center;			\
+										\
+	sse2_load_bayer(bayer, &ae0, &ao0, &ae2, &ao2);				\
+	sse2_load_bayer(bayer + stride, &be0, &bo0, &be2, &bo2);		\
+	sse2_load_bayer(bayer + 2 * stride, &ce0, &co0, &ce2, &co2);		\
+	(void)ao2; (void)co2;							\
+	diag = _mm_add_epi16(_mm_add_epi16(ae0, ae2), _mm_add_epi16(ce0, ce2)); \
+	cross = _mm_add_epi16(_mm_add_epi16(ao0, be0), _mm_add_epi16(be2, co0)); \
+	vert = _mm_add_epi16(ae2, ce2);						\
+	horiz = _mm_add_epi16(bo0, bo2);					\
+	x_center = bo0;								\
+	g_center = be2
+
+__attribute__((target("sse2")))
+static int sse2_bayer_line_to_rgbbgr24(const unsigned char *bayer,
+		unsigned char *bgr, int pairs, unsigned int stride, int blue_line)
+{
+	const __m128i one = _mm_set1_epi16(1), two = _mm_set1_epi16(2);
+	__m128i c0, c1, c2;
+	int i;
+
+	for (i = 0; i + 8 <= pairs; i += 8) {
+		SSE2_BAYER_SUMS(bayer, stride);
+
+		diag = _mm_srli_epi16(_mm_add_epi16(diag, two), 2);
+		cross = _mm_srli_epi16(_mm_add_epi16(cross, two), 2);
+		vert = _mm_srli_epi16(_mm_add_epi16(vert, one), 1);
+		horiz = _mm_srli_epi16(_mm_add_epi16(horiz, one), 1);
+
+		/* Each 16 bit lane holds a pair, non green pixel first */
+		c1 = _mm_or_si128(cross, _mm_slli_epi16(g_center, 8));
+		if (blue_line) {
+			c0 = _mm_or_si128(diag, _mm_slli_epi16(vert, 8));
+			c2 = _mm_or_si128(x_center, _mm_slli_epi16(horiz, 8));
+		} else {
+			c0 = _mm_or_si128(x_center, _mm_slli_epi16(horiz, 8));
+			c2 = _mm_or_si128(diag, _mm_slli_epi16(vert, 8));
+		}
+		sse2_store_rgb24(bgr, c0, c1, c2, 0);
+
+		bayer += 16;
+		bgr += 48;
+	}
+
+	return i;
+}
+
+__attribute__((target("sse2")))
+static int sse2_bayer_line_to_y(const unsigned char *bayer, unsigned char *y,
+		int pairs, unsigned int stride, int blue_line)
+{
+	__m128i x_out, g_out;
+	int i;
+
+	for (i = 0; i + 8 <= pairs; i += 8) {
+		SSE2_BAYER_SUMS(bayer, stride);
+
+		if (blue_line) {
+			x_out = SSE2_WEIGH3(x_center, cross, diag, Y_BLUE_LINE_X);
+			g_out = SSE2_WEIGH3(horiz, g_center, vert, Y_GREEN);
+		} else {
+			x_out = SSE2_WEIGH3(diag, cross, x_center, Y_RED_LINE_X);
+			g_out = SSE2_WEIGH3(vert, g_center, horiz, Y_GREEN);
+		}
+		_mm_storeu_si128((__m128i *)y,
+				 _mm_or_si128(x_out, _mm_slli_epi16(g_out, 8)));
+
+		bayer += 16;
+		y += 16;
+	}
+
+	return i;
+}
+
+#ifdef CPU_BUILD_AVX2
+
+/* The same, for 16 pairs at a time */
+__attribute__((target("avx2")))
+static inline void avx2_load_bayer(const unsigned char *p, __m256i *e0,
+		__m256i *o0, __m256i *e2, __m256i *o2)
+{
+	const __m256i lo_mask = _mm256_set1_epi16(0x00ff);
+	__m256i l0 = _mm256_loadu_si256((const __m256i *)p);
+	__m256i l2 = _mm256_loadu_si256((const __m256i *)(p + 2));
+
+	*e0 = _mm256_and_si256(l0, lo_mask);
+	*o0 = _mm256_srli_epi16(l0, 8);
+	*e2 = _mm256_and_si256(l2, lo_mask);
+	*o2 = _mm256_srli_epi16(l2, 8);
+}
+
+__attribute__((target("avx2")))
+static inline __m256i avx2_weigh3(__m256i a, __m256i b, __m256i c,
+		int wa, int wb, int wc)
+{
+	const __m256i zero = _mm256_setzero_si256();
+	const __m256i round = _mm256_set1_epi32(524288);
+	const __m256i wab = _mm256_set1_epi32(wa | (wb << 16));
+	const __m256i w_c = _mm256_set1_epi32(wc);
+	__m256i lo, hi;
+
+	/* unpack and packs both work per 128 bit lane, so the order is kept */
+	lo = _mm256_add_epi32(_mm256_madd_epi16(_mm256_unpacklo_epi16(a, b), wab),
+			      _mm256_madd_epi16(_mm256_unpacklo_epi16(c, zero), w_c));
+	hi = _mm256_add_epi32(_mm256_madd_epi16(_mm256_unpackhi_epi16(a, b), wab),
+			      _mm256_madd_epi16(_mm256_unpackhi_epi16(c, zero), w_c));
+	lo = _mm256_srai_epi32(_mm256_add_epi32(lo, round), 15);
+	hi = _mm256_srai_epi32(_mm256_add_epi32(hi, round), 15);
+
+	return _mm256_packs_epi32(lo, hi);
+}
+
+#define AVX2_WEIGH3(a, b, c, w) avx2_weigh3(a, b, c, w)
+
+#define AVX2_BAYER_SUMS(bayer, stride)						\
+	__m256i ae0, ao0, ae2, ao2, be0, bo0, be2, bo2, ce0, co0, ce2, co2;	\
+	__m256i diag, cross, vert, horiz, x_center, g_center;			\
+										\
+	avx2_load_bayer(bayer, &ae0, &ao0, &ae2, &ao2);				\
+	avx2_load_bayer(bayer + stride, &be0, &bo0, &be2, &bo2);		\
+	avx2_load_bayer(bayer + 2 * stride, &ce0, &co0, &ce2, &co2);		\
+	(void)ao2; (void)co2;							\
+	diag = _mm256_add_epi16(_mm256_add_epi16(ae0, ae2),			\
+				_mm256_add_epi16(ce0, ce2));			\
+	cross = _mm256_add_epi16(_mm256_add_epi16(ao0, be0),			\
+				 _mm256_add_epi16(be2, co0));			\
+	vert = _mm256_add_epi16(ae2, ce2);					\
+	horiz = _mm256_add_epi16(bo0, bo2);					\
+	x_center = bo0;								\
+	g_center = be2
+
+__attribute__((target("avx2")))
+static int avx2_bayer_line_to_rgbbgr24(const unsigned char *bayer,
+		unsigned char *bgr, int pairs, unsigned int stride, int blue_line)
+{
+	const __m256i one = _mm256_set1_epi16(1), two = _mm256_set1_epi16(2);
+	__m256i c0, c1, c2;
+	int i;
+
+	for (i = 0; i + 16 <= pairs; i += 16) {
+		AVX2_BAYER_SUMS(bayer, stride);
+
+		diag = _mm256_srli_epi16(_mm256_add_epi16(diag, two), 2);
+		cross = _mm256_srli_epi16(_mm256_add_epi16(cross, two), 2);
+		vert = _mm256_srli_epi16(_mm256_add_epi16(vert, one), 1);
+		horiz = _mm256_srli_epi16(_mm256_add_epi16(horiz, one), 1);
+
+		c1 = _mm256_or_si256(cross, _mm256_slli_epi16(g_center, 8));
+		if (blue_line) {
+			c0 = _mm256_or_si256(diag, _mm256_slli_epi16(vert, 8));
+			c2 = _mm256_or_si256(x_center, _mm256_slli_epi16(horiz, 8));
+		} else {
+			c0 = _mm256_or_si256(x_center, _mm256_slli_epi16(horiz, 8));
+			c2 = _mm256_or_si256(diag, _mm256_slli_epi16(vert, 8));
+		}
+		avx2_store16_rgb24(bgr, _mm256_castsi256_si128(c0),
+				   _mm256_castsi256_si128(c1),
+				   _mm256_castsi256_si128(c2));
+		avx2_store16_rgb24(bgr + 48, _mm256_extracti128_si256(c0, 1),
+				   _mm256_extracti128_si256(c1, 1),
+				   _mm256_extracti128_si256(c2, 1));
+
+		bayer += 32;
+		bgr += 96;
+	}
+
+	return i;
+}
+
+__attribute__((target("avx2")))
+static int avx2_bayer_line_to_y(const unsigned char *bayer, unsigned char *y,
+		int pairs, unsigned int stride, int blue_line)
+{
+	__m256i x_out, g_out;
+	int i;
+
+	for (i = 0; i + 16 <= pairs; i += 16) {
+		AVX2_BAYER_SUMS(bayer, stride);
+
+		if (blue_line) {
+			x_out = AVX2_WEIGH3(x_center, cross, diag, Y_BLUE_LINE_X);
+			g_out = AVX2_WEIGH3(horiz, g_center, vert, Y_GREEN);
+		} else {
+			x_out = AVX2_WEIGH3(diag, cross, x_center, Y_RED_LINE_X);
+			g_out = AVX2_WEIGH3(vert, g_center, horiz, Y_GREEN);
+		}
+		_mm256_storeu_si256((__m256i *)y,
+				    _mm256_or_si256(x_out, _mm256_slli_epi16(g_out, 8)));
+
+		bayer += 32;
+		y += 32;
+	}
+
+	return i;
+}
+
+#endif /* CPU_BUILD_AVX2 */
+
+static const struct v4lconvert_bayer_kernels sse2_bayer_kernels = {
+	.line_to_rgbbgr24 = sse2_bayer_line_to_rgbbgr24,
+	.line_to_y = sse2_bayer_line_to_y,
+};
+
+#ifdef CPU_BUILD_AVX2
+static const struct v4lconvert_bayer_kernels avx2_bayer_kernels = {
+	.line_to_rgbbgr24 = avx2_bayer_line_to_rgbbgr24,
+	.line_to_y = avx2_bayer_line_to_y,
+};
+#endif
+
+#endif /* HAVE_X86_SIMD */
+
+#ifdef HAVE_NEON_SIMD
+
+/* Interleave the non green and green pixels of 8 pairs */
+static inline uint8x16_t neon_zip_pairs(uint8x8_t x, uint8x8_t g)
+{
+	uint8x8x2_t t = vzip_u8(x, g);
+
+	return vcombine_u8(t.val[0], t.val[1]);
+}
+
+static inline uint8x8_t neon_weigh3(uint16x8_t a, uint16x8_t b, uint16x8_t c,
+		uint16_t wa, uint16_t wb, uint16_t wc)
+{
+	uint32x4_t lo = vmull_n_u16(vget_low_u16(a), wa);
+	uint32x4_t hi = vmull_n_u16(vget_high_u16(a), wa);
+
+	lo = vmlal_n_u16(lo, vget_low_u16(b), wb);
+	hi = vmlal_n_u16(hi, vget_high_u16(b), wb);
+	lo = vmlal_n_u16(lo, vget_low_u16(c), wc);
+	hi = vmlal_n_u16(hi, vget_high_u16(c), wc);
+	lo = vaddq_u32(lo, vdupq_n_u32(524288));
+	hi = vaddq_u32(hi, vdupq_n_u32(524288));
+
+	return vmovn_u16(vcombine_u16(vshrn_n_u32(lo, 15), vshrn_n_u32(hi, 15)));
+}
+
+#define NEON_WEIGH3(a, b, c, w) neon_weigh3(a, b, c, w)
+
+/* vld2 splits the even and odd bytes, for 8 pairs at a time */
+#define NEON_BAYER_SUMS(bayer, stride)						\
+	uint8x8x2_t a0 = vld2_u8(bayer), a2 = vld2_u8(bayer + 2);		\
+	uint8x8x2_t b0 = vld2_u8(bayer + stride), b2 = vld2_u8(bayer + stride + 2); \
+	uint8x8x2_t c0 = vld2_u8(bayer + 2 * stride);				\
+	uint8x8x2_t c2 = vld2_u8(bayer + 2 * stride + 2);			\
+	uint16x8_t diag = vaddq_u16(vaddl_u8(a0.val[0], a2.val[0]),		\
+				    vaddl_u8(c0.val[0], c2.val[0]));		\
+	uint16x8_t cross = vaddq_u16(vaddl_u8(a0.val[1], b0.val[0]),		\
+				     vaddl_u8(b2.val[0], c0.val[1]));		\
+	uint8x8_t x_center = b0.val[1], g_center = b2.val[0]
+
+static int neon_bayer_line_to_rgbbgr24(const unsigned char *bayer,
+		unsigned char *bgr, int pairs, unsigned int stride, int blue_line)
+{
+	uint8x8_t d, v, h, x;
+	uint8x16x3_t out;
+	int i;
+
+	for (i = 0; i + 8 <= pairs; i += 8) {
+		NEON_BAYER_SUMS(bayer, stride);
+
+		/* vrshrn and vrhadd round exactly like the scalar code */
+		d = vrshrn_n_u16(diag, 2);
+		x = vrshrn_n_u16(cross, 2);
+		v = vrhadd_u8(a2.val[0], c2.val[0]);
+		h = vrhadd_u8(b0.val[1], b2.val[1]);
+
+		out.val[1] = neon_zip_pairs(x, g_center);
+		if (blue_line) {
+			out.val[0] = neon_zip_pairs(d, v);
+			out.val[2] = neon_zip_pairs(x_center, h);
+		} else {
+			out.val[0] = neon_zip_pairs(x_center, h);
+			out.val[2] = neon_zip_pairs(d, v);
+		}
+		vst3q_u8(bgr, out);
+
+		bayer += 16;
+		bgr += 48;
+	}
+
+	return i;
+}
+
+static int neon_bayer_line_to_y(const unsigned char *bayer, unsigned char *y,
+		int pairs, unsigned int stride, int blue_line)
+{
+	uint16x8_t vert, horiz, xc, gc;
+	uint8x8_t x_out, g_out;
+	int i;
+
+	for (i = 0; i + 8 <= pairs; i += 8) {
+		NEON_BAYER_SUMS(bayer, stride);
+
+		vert = vaddl_u8(a2.val[0], c2.val[0]);
+		horiz = vaddl_u8(b0.val[1], b2.val[1]);
+		xc = vmovl_u8(x_center);
+		gc = vmovl_u8(g_center);
+		if (blue_line) {
+			x_out = NEON_WEIGH3(xc, cross, diag, Y_BLUE_LINE_X);
+			g_out = NEON_WEIGH3(horiz, gc, vert, Y_GREEN);
+		} else {
+			x_out = NEON_WEIGH3(diag, cross, xc, Y_RED_LINE_X);
+			g_out = NEON_WEIGH3(vert, gc, horiz, Y_GREEN);
+		}
+		vst1q_u8(y, neon_zip_pairs(x_out, g_out));
+
+		bayer += 16;
+		y += 16;
+	}
+
+	return i;
+}
+
+static const struct v4lconvert_bayer_kernels neon_bayer_kernels = {
+	.line_to_rgbbgr24 = neon_bayer_line_to_rgbbgr24,
+	.line_to_y = neon_bayer_line_to_y,
+};
+
+#endif /* HAVE_NEON_SIMD */
+
+static int c_bayer_line(const unsigned char *bayer, unsigned char *dest,
+		int pairs, unsigned int stride, int blue_line)
+{
+	/* Leave everything to the scalar code */
+	return 0;
+}
+
+static const struct v4lconvert_bayer_kernels c_bayer_kernels = {
+	.line_to_rgbbgr24 = c_bayer_line,
+	.line_to_y = c_bayer_line,
+};
+
+static const struct cpu_kernel_variant bayer_variants[] = {
+#ifdef CPU_BUILD_AVX2
+	{ "avx2", CPU_FEATURE_AVX2, &avx2_bayer_kernels },
+#endif
+#ifdef HAVE_X86_SIMD
+	{ "sse2", CPU_FEATURE_SSE2, &sse2_bayer_kernels },
+#endif
+#ifdef HAVE_NEON_SIMD
+	{ "neon", CPU_FEATURE_NEON, &neon_bayer_kernels },
+#endif
+	{ "c", 0, &c_bayer_kernels },
+};
+
+const struct v4lconvert_bayer_kernels *v4lconvert_get_bayer_kernels(void)
+{
+	return cpu_select_kernels(bayer_variants, v4lconvert_get_cpu_flags());
+}
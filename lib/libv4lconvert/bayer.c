@@ -162,19 +162,16 @@ static void v4lconvert_border_bayer_line_to_bgr24(
 	}
 }
 
-/* From libdc1394, which on turn was based on OpenCV's Bayer decoding */
-static void bayer_to_rgbbgr24(const unsigned char *bayer,
-		unsigned char *bgr, int width, int height, const unsigned int stride, unsigned int pixfmt,
+/* From libdc1394, which on turn was based on OpenCV's Bayer decoding.
+   Renders a number of non border lines, bayer points to the line above
+   the first one to render. */
+static void bayer_to_rgbbgr24_lines(const struct v4lconvert_bayer_kernels *simd,
+		const unsigned char *bayer,
+		unsigned char *bgr, int width, int lines, const unsigned int stride,
 		int start_with_green, int blue_line)
 {
-	/* render the first line */
-	v4lconvert_border_bayer_line_to_bgr24(bayer, bayer + stride, bgr, width,
-			start_with_green, blue_line);
-	bgr += width * 3;
-
-	/* reduce height by 2 because of the special case top/bottom line */
-	for (height -= 2; height; height--) {
-		int t0, t1;
+	for (; lines; lines--) {
+		int t0, t1, pairs;
 		/* (width - 2) because of the border */
 		const unsigned char *bayer_end = bayer + (width - 2);
 
@@ -219,6 +216,13 @@ static void bayer_to_rgbbgr24(const unsigned char *bayer,
 			}
 		}
 
+		if (bayer <= bayer_end - 2) {
+			pairs = simd->line_to_rgbbgr24(bayer, bgr,
+					(bayer_end - bayer) / 2, stride, blue_line);
+			bayer += 2 * pairs;
+			bgr += 6 * pairs;
+		}
+
 		if (blue_line) {
 			for (; bayer <= bayer_end - 2; bayer += 2) {
 				t0 = (bayer[0] + bayer[2] + bayer[stride * 2] +
@@ -304,30 +308,126 @@ static void bayer_to_rgbbgr24(const unsigned char *bayer,
 		blue_line = !blue_line;
 		start_with_green = !start_with_green;
 	}
+}
+
+struct bayer_to_rgbbgr24_job {
+	const struct v4lconvert_bayer_kernels *simd;
+	const unsigned char *bayer;
+	unsigned char *bgr;
+	int width;
+	unsigned int stride;
+	int start_with_green;
+	int blue_line;
+	/* 3, or 4 for 32 bpp output with the padding byte first or last */
+	int pixel_size;
+	int x_first;
+};
+
+static void bayer_to_rgbbgr24_band(void *arg, int first, int count)
+{
+	struct bayer_to_rgbbgr24_job *job = arg;
+	int odd = first & 1;
+	int i;
+
+	if (job->pixel_size == 3) {
+		bayer_to_rgbbgr24_lines(job->simd,
+				job->bayer + first * job->stride,
+				job->bgr + first * job->width * 3, job->width,
+				count, job->stride, job->start_with_green ^ odd,
+				job->blue_line ^ odd);
+		return;
+	}
+
+	/* Render each line at the start of its 32 bpp line, and expand it
+	   from there while it is still in the cache */
+	for (i = first; i < first + count; i++) {
+		unsigned char *line = job->bgr + i * job->width * 4;
+
+		odd = i & 1;
+		bayer_to_rgbbgr24_lines(job->simd, job->bayer + i * job->stride,
+				line, job->width, 1, job->stride,
+				job->start_with_green ^ odd, job->blue_line ^ odd);
+		v4lconvert_rgb24_to_rgb32(line, line, job->width, 1,
+				job->x_first);
+	}
+}
+
+static void bayer_to_rgbbgr24(struct v4lconvert_threads *threads,
+		const unsigned char *bayer, unsigned char *bgr, int width, int height,
+		const unsigned int stride, int start_with_green, int blue_line,
+		int pixel_size, int x_first)
+{
+	struct bayer_to_rgbbgr24_job job = {
+		.simd = v4lconvert_get_bayer_kernels(),
+		.bayer = bayer,
+		.bgr = bgr + width * pixel_size,
+		.width = width,
+		.stride = stride,
+		.start_with_green = start_with_green,
+		.blue_line = blue_line,
+		.pixel_size = pixel_size,
+		.x_first = x_first,
+	};
+	unsigned char *last = bgr + (height - 1) * width * pixel_size;
+	int odd = height & 1;
+
+	/* render the first line */
+	v4lconvert_border_bayer_line_to_bgr24(bayer, bayer + stride, bgr, width,
+			start_with_green, blue_line);
+	if (pixel_size == 4)
+		v4lconvert_rgb24_to_rgb32(bgr, bgr, width, 1, x_first);
+
+	/* reduce height by 2 because of the special case top/bottom line, the
+	   lines in between only depend on the source, so they can be rendered
+	   in parallel bands */
+	v4lconvert_threads_run(threads, height - 2, 2, bayer_to_rgbbgr24_band,
+			&job);
 
 	/* render the last line */
-	v4lconvert_border_bayer_line_to_bgr24(bayer + stride, bayer, bgr, width,
-			!start_with_green, !blue_line);
+	v4lconvert_border_bayer_line_to_bgr24(bayer + (height - 1) * stride,
+			bayer + (height - 2) * stride, last,
+			width, !(start_with_green ^ odd), !(blue_line ^ odd));
+	if (pixel_size == 4)
+		v4lconvert_rgb24_to_rgb32(last, last, width, 1, x_first);
 }
 
-void v4lconvert_bayer_to_rgb24(const unsigned char *bayer,
+void v4lconvert_bayer_to_rgb24(struct v4lconvert_threads *threads,
+		const unsigned char *bayer,
 		unsigned char *bgr, int width, int height, const unsigned int stride, unsigned int pixfmt)
 {
-	bayer_to_rgbbgr24(bayer, bgr, width, height, stride, pixfmt,
+	bayer_to_rgbbgr24(threads, bayer, bgr, width, height, stride,
 			pixfmt == V4L2_PIX_FMT_SGBRG8		/* start with green */
 			|| pixfmt == V4L2_PIX_FMT_SGRBG8,
 			pixfmt != V4L2_PIX_FMT_SBGGR8		/* blue line */
-			&& pixfmt != V4L2_PIX_FMT_SGBRG8);
+			&& pixfmt != V4L2_PIX_FMT_SGBRG8, 3, 0);
 }
 
-void v4lconvert_bayer_to_bgr24(const unsigned char *bayer,
+void v4lconvert_bayer_to_bgr24(struct v4lconvert_threads *threads,
+		const unsigned char *bayer,
 		unsigned char *bgr, int width, int height, const unsigned int stride, unsigned int pixfmt)
 {
-	bayer_to_rgbbgr24(bayer, bgr, width, height, stride, pixfmt,
+	bayer_to_rgbbgr24(threads, bayer, bgr, width, height, stride,
 			pixfmt == V4L2_PIX_FMT_SGBRG8		/* start with green */
 			|| pixfmt == V4L2_PIX_FMT_SGRBG8,
 			pixfmt == V4L2_PIX_FMT_SBGGR8		/* blue line */
-			|| pixfmt == V4L2_PIX_FMT_SGBRG8);
+			|| pixfmt == V4L2_PIX_FMT_SGBRG8, 3, 0);
+}
+
+/* XRGB32 has the padding byte before red, XBGR32 after red, as in
+   bgr24 + padding */
+void v4lconvert_bayer_to_rgb32(struct v4lconvert_threads *threads,
+		const unsigned char *bayer,
+		unsigned char *dest, int width, int height, const unsigned int stride,
+		unsigned int pixfmt, int xbgr)
+{
+	int start_with_green = pixfmt == V4L2_PIX_FMT_SGBRG8 ||
+			       pixfmt == V4L2_PIX_FMT_SGRBG8;
+	int bgr_blue_line = pixfmt == V4L2_PIX_FMT_SBGGR8 ||
+			    pixfmt == V4L2_PIX_FMT_SGBRG8;
+
+	bayer_to_rgbbgr24(threads, bayer, dest, width, height, stride,
+			start_with_green, xbgr ? bgr_blue_line : !bgr_blue_line,
+			4, !xbgr);
 }
 
 static void v4lconvert_border_bayer_line_to_y(
@@ -432,6 +532,7 @@ static void v4lconvert_border_bayer_line_to_y(
 void v4lconvert_bayer_to_yuv420(const unsigned char *bayer, unsigned char *yuv,
 		int width, int height, const unsigned int stride, unsigned int src_pixfmt, int yvu)
 {
+	const struct v4lconvert_bayer_kernels *simd = v4lconvert_get_bayer_kernels();
 	int blue_line = 0, start_with_green = 0, x, y;
 	unsigned char *ydst = yuv;
 	unsigned char *udst, *vdst;
@@ -525,7 +626,7 @@ void v4lconvert_bayer_to_yuv420(const unsigned char *bayer, unsigned char *yuv,
 
 	/* reduce height by 2 because of the border */
 	for (height -= 2; height; height--) {
-		int t0, t1;
+		int t0, t1, pairs;
 		/* (width - 2) because of the border */
 		const unsigned char *bayer_end = bayer + (width - 2);
 
@@ -561,6 +662,13 @@ void v4lconvert_bayer_to_yuv420(const unsigned char *bayer, unsigned char *yuv,
 			}
 		}
 
+		if (bayer <= bayer_end - 2) {
+			pairs = simd->line_to_y(bayer, ydst,
+					(bayer_end - bayer) / 2, stride, blue_line);
+			bayer += 2 * pairs;
+			ydst += 2 * pairs;
+		}
+
 		if (blue_line) {
 			for (; bayer <= bayer_end - 2; bayer += 2) {
 				t0 = bayer[0] + bayer[2] + bayer[stride * 2] + bayer[stride * 2 + 2];
@@ -638,7 +746,9 @@ void v4lconvert_bayer10_to_bayer8(void *bayer10,
 	int i;
 	uint16_t *src = bayer10;
 
-	for (i = 0; i < width * height; i++)
+	i = v4lconvert_get_unpack_kernels()->u16_to_8(bayer10, bayer8,
+			width * height, 2);
+	for (; i < width * height; i++)
 		bayer8[i] = src[i] >> 2;
 }
 
@@ -648,7 +758,10 @@ void v4lconvert_bayer10p_to_bayer8(unsigned char *bayer10p,
 	unsigned long i;
 	unsigned long len = width * height;
 
-	for (i = 0; i < len ; i += 4) {
+	i = v4lconvert_get_unpack_kernels()->raw10p_to_8(bayer10p, bayer8, len);
+	bayer10p += i / 4 * 5;
+	bayer8 += i;
+	for (; i < len ; i += 4) {
 		/*
 		 * Do not use a second loop, hoping that
 		 * a clever compiler with understand the
@@ -668,6 +781,8 @@ void v4lconvert_bayer16_to_bayer8(unsigned char *bayer16,
 {
 	int i;
 
-	for (i = 0; i < width * height; i++)
+	i = v4lconvert_get_unpack_kernels()->u16_to_8(bayer16, bayer8,
+			width * height, 8);
+	for (; i < width * height; i++)
 		bayer8[i] = bayer16[2*i+1];
 }
@@ -0,0 +1,115 @@
+/*
+# MSB first bit reader shared by the webcam decompressors
+
+# This program is free software; you can redistribute it and/or modify
+# it under the terms of the GNU Lesser General Public License as published by
+# the Free Software Foundation; either version 2.1 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU Lesser General Public License for more details.
+#
+# You should have received a copy of the GNU Lesser General Public License
+# along with this program; if not, write to the Free Software
+# Foundation, Inc., 51 Franklin Street, Suite 500, Boston, MA  02110-1335  USA
+ */
+
+#ifndef __LIBV4LCONVERT_BITREADER_PRIV_H
+#define __LIBV4LCONVERT_BITREADER_PRIV_H
+
+#include <stdint.h>
+#include <string.h>
+
+/*
+ * The bits not consumed yet are kept left aligned in a 64 bit word, which
+ * v4lconvert_bits_refill() tops up to at least 56 bits with a single
+ * unaligned load, so a decoder can refill once per code and then peek and
+ * skip (up to) 56 bits without any further checks. Peeking 8 bits and
+ * looking them up in a 256 entry table decodes a whole Huffman code at once.
+ *
+ * Past the end of the buffer the stream reads as zero bits, where the old
+ * byte at a time readers went on reading whatever followed the frame.
+ */
+struct v4lconvert_bits {
+	uint64_t bits;
+	int count;		/* valid bits in bits */
+	unsigned int pos;	/* bytes of buf loaded into bits */
+	unsigned int size;
+	const unsigned char *buf;
+};
+
+static inline uint64_t v4lconvert_bits_load64(const unsigned char *p)
+{
+	uint64_t v;
+
+	memcpy(&v, p, sizeof(v));
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+	v = __builtin_bswap64(v);
+#endif
+	return v;
+}
+
+static inline void v4lconvert_bits_refill(struct v4lconvert_bits *br)
+{
+	if (br->pos + 8 <= br->size) {
+		/* Load as many whole bytes as fit, the bits of the next byte
+		   which get or-ed in already are or-ed in again with the same
+		   value by the next refill */
+		br->bits |= v4lconvert_bits_load64(br->buf + br->pos) >>
+			br->count;
+		br->pos += (63 - br->count) >> 3;
+		br->count |= 56;
+		return;
+	}
+
+	while (br->count <= 56) {
+		if (br->pos < br->size)
+			br->bits |= (uint64_t)br->buf[br->pos] <<
+				(56 - br->count);
+		br->pos++;
+		br->count += 8;
+	}
+}
+
+static inline void v4lconvert_bits_init(struct v4lconvert_bits *br,
+		const unsigned char *buf, unsigned int size)
+{
+	br->bits = 0;
+	br->count = 0;
+	br->pos = 0;
+	br->size = size;
+	br->buf = buf;
+	v4lconvert_bits_refill(br);
+}
+
+/* Returns the next n (1 - 32) bits without consuming them */
+static inline unsigned int v4lconvert_bits_peek(const struct v4lconvert_bits *br,
+		int n)
+{
+	return br->bits >> (64 - n);
+}
+
+static inline void v4lconvert_bits_skip(struct v4lconvert_bits *br, int n)
+{
+	br->bits <<= n;
+	br->count -= n;
+}
+
+static inline unsigned int v4lconvert_bits_get(struct v4lconvert_bits *br,
+		int n)
+{
+	unsigned int v = v4lconvert_bits_peek(br, n);
+
+	v4lconvert_bits_skip(br, n);
+	return v;
+}
+
+/* The number of bits consumed since v4lconvert_bits_init() */
+static inline unsigned int v4lconvert_bits_tell(const struct v4lconvert_bits *br)
+{
+	return br->pos * 8 - br->count;
+}
+
+#endif
@@ -0,0 +1,161 @@
+/*
+# Measured cost of the conversions on the machine we run on
+
+# This program is free software; you can redistribute it and/or modify
+# it under the terms of the GNU Lesser General Public License as published by
+# the Free Software Foundation; either version 2.1 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU Lesser General Public License for more details.
+#
+# You should have received a copy of the GNU Lesser General Public License
+# along with this program; if not, write to the Free Software
+# Foundation, Inc., 51 Franklin Street, Suite 500, Boston, MA  02110-1335  USA
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+#include "libv4lconvert-priv.h"
+
+#define V4LCONVERT_COST_CACHE_MAGIC "v4lccst2"
+
+/* Like the format cache this is only read back on the same machine */
+struct v4lconvert_cost_cache {
+	char magic[8];
+	/* The costs are indexed by the supported_src_pixfmts table, which
+	   changes with the library build */
+	uint32_t struct_size;
+	uint32_t no_src_pixfmts;
+	/* Which SIMD code paths the costs were measured with */
+	uint32_t cpu_flags;
+	uint32_t reserved;
+	float cost[V4LCONVERT_MAX_SRC_PIXFMTS][V4LCONVERT_COST_CLASSES];
+};
+
+int v4lconvert_cost_enabled(void)
+{
+	const char *s = getenv("LIBV4LCONVERT_CALIBRATE");
+
+	return s && *s && strcmp(s, "0");
+}
+
+/* Returns the name of the cache file, or NULL if there is no cache dir */
+static char *v4lconvert_cost_cache_name(void)
+{
+	const char *dir = getenv("LIBV4LCONVERT_CACHE_DIR");
+	char *name;
+
+	if (!dir || !*dir)
+		return NULL;
+
+	name = malloc(strlen(dir) + sizeof("/conv-costs"));
+	if (name)
+		sprintf(name, "%s/conv-costs", dir);
+	return name;
+}
+
+static void v4lconvert_cost_cache_key(struct v4lconvert_cost_cache *cache,
+		unsigned int no_src_pixfmts)
+{
+	memcpy(cache->magic, V4LCONVERT_COST_CACHE_MAGIC, sizeof(cache->magic));
+	cache->struct_size = sizeof(*cache);
+	cache->no_src_pixfmts = no_src_pixfmts;
+	cache->cpu_flags = v4lconvert_get_cpu_flags();
+}
+
+void v4lconvert_cost_load(struct v4lconvert_data *data,
+		unsigned int no_src_pixfmts)
+{
+	struct v4lconvert_cost_cache *cache, key;
+	char *name = v4lconvert_cost_cache_name();
+	int fd;
+
+	if (!name)
+		return;
+
+	cache = malloc(sizeof(*cache));
+	fd = open(name, O_RDONLY | O_CLOEXEC);
+	free(name);
+	if (fd < 0 || !cache)
+		goto out;
+	if (read(fd, cache, sizeof(*cache)) != sizeof(*cache))
+		goto out;
+
+	memset(&key, 0, sizeof(key));
+	v4lconvert_cost_cache_key(&key, no_src_pixfmts);
+	if (memcmp(cache, &key, offsetof(struct v4lconvert_cost_cache, cost)))
+		goto out;
+
+	memcpy(data->conv_cost, cache->cost, sizeof(data->conv_cost));
+out:
+	if (fd >= 0)
+		close(fd);
+	free(cache);
+}
+
+void v4lconvert_cost_store(struct v4lconvert_data *data,
+		unsigned int no_src_pixfmts)
+{
+	struct v4lconvert_cost_cache *cache;
+	char *name = v4lconvert_cost_cache_name(), *tmp = NULL;
+	int fd = -1;
+
+	if (!name)
+		return;
+
+	cache = calloc(1, sizeof(*cache));
+	tmp = malloc(strlen(name) + 8);
+	if (!cache || !tmp)
+		goto out;
+
+	v4lconvert_cost_cache_key(cache, no_src_pixfmts);
+	memcpy(cache->cost, data->conv_cost, sizeof(cache->cost));
+
+	/* Write it to a temporary file first, so readers never see half of it */
+	sprintf(tmp, "%s.XXXXXX", name);
+	fd = mkstemp(tmp);
+	if (fd < 0)
+		goto out;
+	if (write(fd, cache, sizeof(*cache)) != sizeof(*cache) ||
+	    rename(tmp, name))
+		unlink(tmp);
+out:
+	if (fd >= 0)
+		close(fd);
+	free(tmp);
+	free(cache);
+	free(name);
+}
+
+uint64_t v4lconvert_cost_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+void v4lconvert_cost_update(struct v4lconvert_data *data, int src_index,
+		int cost_class, uint64_t ns, unsigned int pixels)
+{
+	float *cost, sample;
+
+	if (!pixels || src_index >= V4LCONVERT_MAX_SRC_PIXFMTS)
+		return;
+
+	/* A moving average, so a single preempted conversion doesn't count
+	   much, but a different kind of content eventually does */
+	cost = &data->conv_cost[src_index][cost_class];
+	sample = (float)ns / pixels;
+	*cost = *cost > 0 ? *cost * 7 / 8 + sample / 8 : sample;
+	data->conv_cost_dirty = 1;
+}
@@ -48,7 +48,7 @@ int v4lconvert_cpia1_to_yuv420(struct v4lconvert_data *data,
 	}
 
 	if (data->previous_frame == NULL) {
-		data->previous_frame = malloc(352 * 288 * 3 / 2);
+		data->previous_frame = malloc(V4LCONVERT_CPIA1_FRAME_SIZE);
 		if (data->previous_frame == NULL) {
 			fprintf(stderr, "cpia1 decode error: could not allocate buffer!\n");
 			return -1;
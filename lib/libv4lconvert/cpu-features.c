@@ -0,0 +1,41 @@
+/*
+# CPU feature detection for the SIMD conversion routines
+
+# This program is free software; you can redistribute it and/or modify
+# it under the terms of the GNU Lesser General Public License as published by
+# the Free Software Foundation; either version 2.1 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU Lesser General Public License for more details.
+#
+# You should have received a copy of the GNU Lesser General Public License
+# along with this program; if not, write to the Free Software
+# Foundation, Inc., 51 Franklin Street, Suite 500, Boston, MA  02110-1335  USA
+ */
+
+#include <stdlib.h>
+#include "libv4lconvert-priv.h"
+
+static int cpu_flags = -1;
+
+int v4lconvert_get_cpu_flags(void)
+{
+	int flags = __atomic_load_n(&cpu_flags, __ATOMIC_ACQUIRE);
+
+	/* Racing initializations all store the same value, atomically */
+	if (flags == -1) {
+		/* Allow forcing the plain C code paths, for debugging and for
+		   comparing against the reference implementation, V4L_SIMD
+		   picks a variant */
+		if (getenv("LIBV4LCONVERT_DISABLE_SIMD"))
+			flags = 0;
+		else
+			flags = cpu_features_override(cpu_features_detect());
+		__atomic_store_n(&cpu_flags, flags, __ATOMIC_RELEASE);
+	}
+
+	return flags;
+}
@@ -0,0 +1,358 @@
+/*
+# SIMD versions of the flip and rotate inner loops from flip.c
+
+# This program is free software; you can redistribute it and/or modify
+# it under the terms of the GNU Lesser General Public License as published by
+# the Free Software Foundation; either version 2.1 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU Lesser General Public License for more details.
+#
+# You should have received a copy of the GNU Lesser General Public License
+# along with this program; if not, write to the Free Software
+# Foundation, Inc., 51 Franklin Street, Suite 500, Boston, MA  02110-1335  USA
+
+ */
+
+/*
+ * The reverse routines copy the pixels before src_end to dst in reverse
+ * order, they do (up to) n pixels and return the number done, flip.c
+ * does the rest. rotate90_8x8 transposes a block of 8 x 8 bytes, flip.c
+ * passes a negative src_stride to turn that into a clockwise rotation.
+ */
+
+#include <string.h>
+#include "libv4lconvert-priv.h"
+#include "simd-priv.h"
+
+static int c_reverse(const unsigned char *src_end, unsigned char *dst, int n)
+{
+	/* Leave everything to the scalar code */
+	return 0;
+}
+
+static void c_rotate90_8x8(const unsigned char *src, int src_stride,
+		unsigned char *dst, int dst_stride)
+{
+	int x, y;
+
+	for (y = 0; y < 8; y++)
+		for (x = 0; x < 8; x++)
+			dst[y * dst_stride + x] = src[x * src_stride + y];
+}
+
+static void c_rotate90_8x8_24(const unsigned char *src, int src_stride,
+		unsigned char *dst, int dst_stride)
+{
+	int x, y;
+
+	for (y = 0; y < 8; y++)
+		for (x = 0; x < 8; x++)
+			memcpy(dst + y * dst_stride + 3 * x,
+			       src + x * src_stride + 3 * y, 3);
+}
+
+#ifdef HAVE_X86_SIMD
+
+__attribute__((target("sse2")))
+static int sse2_reverse_8(const unsigned char *src_end, unsigned char *dst,
+		int n)
+{
+	__m128i v;
+	int i;
+
+	for (i = 0; i + 16 <= n; i += 16) {
+		src_end -= 16;
+		v = _mm_loadu_si128((const __m128i *)src_end);
+		/* Reverse the dwords, then the words in them, then the bytes */
+		v = _mm_shuffle_epi32(v, 0x1b);
+		v = _mm_shufflehi_epi16(_mm_shufflelo_epi16(v, 0xb1), 0xb1);
+		v = _mm_or_si128(_mm_slli_epi16(v, 8), _mm_srli_epi16(v, 8));
+		_mm_storeu_si128((__m128i *)(dst + i), v);
+	}
+
+	return i;
+}
+
+__attribute__((target("sse2")))
+static void sse2_rotate90_8x8(const unsigned char *src, int src_stride,
+		unsigned char *dst, int dst_stride)
+{
+	__m128i a[8], b[4], c[4], d;
+	int i;
+
+	for (i = 0; i < 8; i++)
+		a[i] = _mm_loadl_epi64((const __m128i *)(src + i * src_stride));
+
+	for (i = 0; i < 4; i++)
+		b[i] = _mm_unpacklo_epi8(a[2 * i], a[2 * i + 1]);
+
+	c[0] = _mm_unpacklo_epi16(b[0], b[1]);
+	c[1] = _mm_unpackhi_epi16(b[0], b[1]);
+	c[2] = _mm_unpacklo_epi16(b[2], b[3]);
+	c[3] = _mm_unpackhi_epi16(b[2], b[3]);
+
+	/* Each of these holds 2 dst lines */
+	for (i = 0; i < 4; i++) {
+		if (i & 1)
+			d = _mm_unpackhi_epi32(c[i / 2], c[i / 2 + 2]);
+		else
+			d = _mm_unpacklo_epi32(c[i / 2], c[i / 2 + 2]);
+		_mm_storel_epi64((__m128i *)(dst + 2 * i * dst_stride), d);
+		_mm_storel_epi64((__m128i *)(dst + (2 * i + 1) * dst_stride),
+				 _mm_srli_si128(d, 8));
+	}
+}
+
+#ifdef CPU_BUILD_AVX2
+
+/* For RGB24, 5 pixels are reversed at a time, in the 15 bytes after the
+   first one loaded. The 16th byte stored gets overwritten by the next
+   block, or by flip.c, so this stops while there are more than 5 left. */
+static const unsigned char reverse_24_shuffle[16] __attribute__((aligned(16))) = {
+	13, 14, 15, 10, 11, 12, 7, 8, 9, 4, 5, 6, 1, 2, 3, 0x80
+};
+
+/* Spread 4 RGB24 pixels over 32 bit lanes and back */
+static const unsigned char rgb24_to_32_shuffle[16] __attribute__((aligned(16))) = {
+	0, 1, 2, 0x80, 3, 4, 5, 0x80, 6, 7, 8, 0x80, 9, 10, 11, 0x80
+};
+static const unsigned char rgb32_to_24_shuffle[16] __attribute__((aligned(16))) = {
+	0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, 0x80, 0x80, 0x80, 0x80
+};
+
+/* Transposes 4 x 4 RGB24 pixels, loading and storing exactly 12 bytes per
+   line, so that this never touches anything outside of the block */
+__attribute__((target("avx2")))
+static void avx2_rotate90_4x4_24(const unsigned char *src, int src_stride,
+		unsigned char *dst, int dst_stride)
+{
+	const __m128i expand = _mm_load_si128((const __m128i *)rgb24_to_32_shuffle);
+	const __m128i compact = _mm_load_si128((const __m128i *)rgb32_to_24_shuffle);
+	__m128i l[4], t[4];
+	int i;
+
+	for (i = 0; i < 4; i++) {
+		const unsigned char *s = src + i * src_stride;
+		int last;
+
+		memcpy(&last, s + 8, 4);
+		l[i] = _mm_unpacklo_epi64(_mm_loadl_epi64((const __m128i *)s),
+					  _mm_cvtsi32_si128(last));
+		l[i] = _mm_shuffle_epi8(l[i], expand);
+	}
+
+	t[0] = _mm_unpacklo_epi32(l[0], l[1]);
+	t[1] = _mm_unpacklo_epi32(l[2], l[3]);
+	t[2] = _mm_unpackhi_epi32(l[0], l[1]);
+	t[3] = _mm_unpackhi_epi32(l[2], l[3]);
+	l[0] = _mm_unpacklo_epi64(t[0], t[1]);
+	l[1] = _mm_unpackhi_epi64(t[0], t[1]);
+	l[2] = _mm_unpacklo_epi64(t[2], t[3]);
+	l[3] = _mm_unpackhi_epi64(t[2], t[3]);
+
+	for (i = 0; i < 4; i++) {
+		unsigned char *d = dst + i * dst_stride;
+		int last;
+
+		l[i] = _mm_shuffle_epi8(l[i], compact);
+		_mm_storel_epi64((__m128i *)d, l[i]);
+		last = _mm_cvtsi128_si32(_mm_srli_si128(l[i], 8));
+		memcpy(d + 8, &last, 4);
+	}
+}
+
+__attribute__((target("avx2")))
+static void avx2_rotate90_8x8_24(const unsigned char *src, int src_stride,
+		unsigned char *dst, int dst_stride)
+{
+	avx2_rotate90_4x4_24(src, src_stride, dst, dst_stride);
+	avx2_rotate90_4x4_24(src + 12, src_stride, dst + 4 * dst_stride,
+			     dst_stride);
+	avx2_rotate90_4x4_24(src + 4 * src_stride, src_stride, dst + 12,
+			     dst_stride);
+	avx2_rotate90_4x4_24(src + 4 * src_stride + 12, src_stride,
+			     dst + 4 * dst_stride + 12, dst_stride);
+}
+
+__attribute__((target("avx2")))
+static int avx2_reverse_24(const unsigned char *src_end, unsigned char *dst,
+		int n)
+{
+	const __m128i shuffle = _mm_load_si128((const __m128i *)reverse_24_shuffle);
+	__m128i v;
+	int i;
+
+	for (i = 0; i + 5 < n; i += 5) {
+		src_end -= 15;
+		v = _mm_loadu_si128((const __m128i *)(src_end - 1));
+		_mm_storeu_si128((__m128i *)dst, _mm_shuffle_epi8(v, shuffle));
+		dst += 15;
+	}
+
+	return i;
+}
+
+#endif /* CPU_BUILD_AVX2 */
+
+static const struct v4lconvert_flip_kernels sse2_flip_kernels = {
+	.reverse_8 = sse2_reverse_8,
+	.reverse_24 = c_reverse,
+	.rotate90_8x8 = sse2_rotate90_8x8,
+	.rotate90_8x8_24 = c_rotate90_8x8_24,
+};
+
+#ifdef CPU_BUILD_AVX2
+static const struct v4lconvert_flip_kernels avx2_flip_kernels = {
+	.reverse_8 = sse2_reverse_8,
+	.reverse_24 = avx2_reverse_24,
+	.rotate90_8x8 = sse2_rotate90_8x8,
+	.rotate90_8x8_24 = avx2_rotate90_8x8_24,
+};
+#endif
+
+#endif /* HAVE_X86_SIMD */
+
+#ifdef HAVE_NEON_SIMD
+
+static inline uint8x16_t neon_reverse_16(uint8x16_t v)
+{
+	v = vrev64q_u8(v);
+	return vextq_u8(v, v, 8);
+}
+
+static int neon_reverse_8(const unsigned char *src_end, unsigned char *dst,
+		int n)
+{
+	int i;
+
+	for (i = 0; i + 16 <= n; i += 16) {
+		src_end -= 16;
+		vst1q_u8(dst + i, neon_reverse_16(vld1q_u8(src_end)));
+	}
+
+	return i;
+}
+
+static int neon_reverse_24(const unsigned char *src_end, unsigned char *dst,
+		int n)
+{
+	uint8x16x3_t rgb;
+	int i, j;
+
+	for (i = 0; i + 16 <= n; i += 16) {
+		src_end -= 48;
+		rgb = vld3q_u8(src_end);
+		for (j = 0; j < 3; j++)
+			rgb.val[j] = neon_reverse_16(rgb.val[j]);
+		vst3q_u8(dst + 3 * i, rgb);
+	}
+
+	return i;
+}
+
+/* Transpose 8 lines of 8 bytes in place */
+static inline void neon_transpose_8x8(uint8x8_t l[8])
+{
+	uint8x8x2_t b[4];
+	uint16x4x2_t c[4];
+	uint32x2x2_t d[4];
+	int i;
+
+	for (i = 0; i < 4; i++)
+		b[i] = vtrn_u8(l[2 * i], l[2 * i + 1]);
+
+	for (i = 0; i < 2; i++) {
+		c[2 * i] = vtrn_u16(vreinterpret_u16_u8(b[2 * i].val[0]),
+				    vreinterpret_u16_u8(b[2 * i + 1].val[0]));
+		c[2 * i + 1] = vtrn_u16(vreinterpret_u16_u8(b[2 * i].val[1]),
+					vreinterpret_u16_u8(b[2 * i + 1].val[1]));
+	}
+
+	for (i = 0; i < 2; i++) {
+		d[2 * i] = vtrn_u32(vreinterpret_u32_u16(c[i].val[0]),
+				    vreinterpret_u32_u16(c[i + 2].val[0]));
+		d[2 * i + 1] = vtrn_u32(vreinterpret_u32_u16(c[i].val[1]),
+					vreinterpret_u32_u16(c[i + 2].val[1]));
+	}
+
+	/* d[0] has lines 0 and 4, d[1] 2 and 6, d[2] 1 and 5, d[3] 3 and 7 */
+	for (i = 0; i < 4; i++) {
+		int line = (i >> 1) | ((i & 1) << 1);
+
+		l[line] = vreinterpret_u8_u32(d[i].val[0]);
+		l[line + 4] = vreinterpret_u8_u32(d[i].val[1]);
+	}
+}
+
+static void neon_rotate90_8x8(const unsigned char *src, int src_stride,
+		unsigned char *dst, int dst_stride)
+{
+	uint8x8_t l[8];
+	int i;
+
+	for (i = 0; i < 8; i++)
+		l[i] = vld1_u8(src + i * src_stride);
+	neon_transpose_8x8(l);
+	for (i = 0; i < 8; i++)
+		vst1_u8(dst + i * dst_stride, l[i]);
+}
+
+static void neon_rotate90_8x8_24(const unsigned char *src, int src_stride,
+		unsigned char *dst, int dst_stride)
+{
+	uint8x8_t l[3][8];
+	uint8x8x3_t rgb;
+	int i, j;
+
+	/* Do each component on its own */
+	for (i = 0; i < 8; i++) {
+		rgb = vld3_u8(src + i * src_stride);
+		for (j = 0; j < 3; j++)
+			l[j][i] = rgb.val[j];
+	}
+	for (j = 0; j < 3; j++)
+		neon_transpose_8x8(l[j]);
+	for (i = 0; i < 8; i++) {
+		for (j = 0; j < 3; j++)
+			rgb.val[j] = l[j][i];
+		vst3_u8(dst + i * dst_stride, rgb);
+	}
+}
+
+static const struct v4lconvert_flip_kernels neon_flip_kernels = {
+	.reverse_8 = neon_reverse_8,
+	.reverse_24 = neon_reverse_24,
+	.rotate90_8x8 = neon_rotate90_8x8,
+	.rotate90_8x8_24 = neon_rotate90_8x8_24,
+};
+
+#endif /* HAVE_NEON_SIMD */
+
+static const struct v4lconvert_flip_kernels c_flip_kernels = {
+	.reverse_8 = c_reverse,
+	.reverse_24 = c_reverse,
+	.rotate90_8x8 = c_rotate90_8x8,
+	.rotate90_8x8_24 = c_rotate90_8x8_24,
+};
+
+static const struct cpu_kernel_variant flip_variants[] = {
+#ifdef CPU_BUILD_AVX2
+	{ "avx2", CPU_FEATURE_AVX2, &avx2_flip_kernels },
+#endif
+#ifdef HAVE_X86_SIMD
+	{ "sse2", CPU_FEATURE_SSE2, &sse2_flip_kernels },
+#endif
+#ifdef HAVE_NEON_SIMD
+	{ "neon", CPU_FEATURE_NEON, &neon_flip_kernels },
+#endif
+	{ "c", 0, &c_flip_kernels },
+};
+
+const struct v4lconvert_flip_kernels *v4lconvert_get_flip_kernels(void)
+{
+	return cpu_select_kernels(flip_variants, v4lconvert_get_cpu_flags());
+}
@@ -66,136 +66,182 @@ static void v4lconvert_vflip_yuv420(unsigned char *src, unsigned char *dest,
 	}
 }
 
+/* Copy the n pixels before src_end to dst in reverse order */
+static void v4lconvert_reverse_8(const struct v4lconvert_flip_kernels *simd,
+		const unsigned char *src_end, unsigned char *dst, int n)
+{
+	int i = simd->reverse_8(src_end, dst, n);
+
+	src_end -= i;
+	for (; i < n; i++)
+		dst[i] = *--src_end;
+}
+
+static void v4lconvert_reverse_24(const struct v4lconvert_flip_kernels *simd,
+		const unsigned char *src_end, unsigned char *dst, int n)
+{
+	int i = simd->reverse_24(src_end, dst, n);
+
+	src_end -= 3 * i;
+	dst += 3 * i;
+	for (; i < n; i++) {
+		src_end -= 3;
+		dst[0] = src_end[0];
+		dst[1] = src_end[1];
+		dst[2] = src_end[2];
+		dst += 3;
+	}
+}
+
 static void v4lconvert_hflip_rgbbgr24(unsigned char *src, unsigned char *dest,
 		struct v4l2_format *fmt)
 {
-	int x, y;
+	const struct v4lconvert_flip_kernels *simd = v4lconvert_get_flip_kernels();
+	int y;
 
 	for (y = 0; y < fmt->fmt.pix.height; y++) {
-		src += fmt->fmt.pix.width * 3;
-		for (x = 0; x < fmt->fmt.pix.width; x++) {
-			src -= 3;
-			dest[0] = src[0];
-			dest[1] = src[1];
-			dest[2] = src[2];
-			dest += 3;
-		}
+		v4lconvert_reverse_24(simd, src + fmt->fmt.pix.width * 3, dest,
+				      fmt->fmt.pix.width);
 		src += fmt->fmt.pix.bytesperline;
+		dest += fmt->fmt.pix.width * 3;
+	}
+}
+
+static void v4lconvert_hflip_plane(const struct v4lconvert_flip_kernels *simd,
+		unsigned char *src, unsigned char *dest, int width, int height,
+		int bytesperline)
+{
+	int y;
+
+	for (y = 0; y < height; y++) {
+		v4lconvert_reverse_8(simd, src + width, dest, width);
+		src += bytesperline;
+		dest += width;
 	}
 }
 
 static void v4lconvert_hflip_yuv420(unsigned char *src, unsigned char *dest,
 		struct v4l2_format *fmt)
 {
-	int x, y;
+	const struct v4lconvert_flip_kernels *simd = v4lconvert_get_flip_kernels();
+	int width = fmt->fmt.pix.width, height = fmt->fmt.pix.height;
+	int bytesperline = fmt->fmt.pix.bytesperline;
 
 	/* First flip the Y plane */
-	for (y = 0; y < fmt->fmt.pix.height; y++) {
-		src += fmt->fmt.pix.width;
-		for (x = 0; x < fmt->fmt.pix.width; x++)
-			*dest++ = *--src;
-		src += fmt->fmt.pix.bytesperline;
-	}
+	v4lconvert_hflip_plane(simd, src, dest, width, height, bytesperline);
+	src += height * bytesperline;
+	dest += width * height;
 
 	/* Now flip the U plane */
-	for (y = 0; y < fmt->fmt.pix.height / 2; y++) {
-		src += fmt->fmt.pix.width / 2;
-		for (x = 0; x < fmt->fmt.pix.width / 2; x++)
-			*dest++ = *--src;
-		src += fmt->fmt.pix.bytesperline / 2;
-	}
+	v4lconvert_hflip_plane(simd, src, dest, width / 2, height / 2,
+			       bytesperline / 2);
+	src += (height / 2) * (bytesperline / 2);
+	dest += (width / 2) * (height / 2);
 
 	/* Last flip the V plane */
-	for (y = 0; y < fmt->fmt.pix.height / 2; y++) {
-		src += fmt->fmt.pix.width / 2;
-		for (x = 0; x < fmt->fmt.pix.width / 2; x++)
-			*dest++ = *--src;
-		src += fmt->fmt.pix.bytesperline / 2;
-	}
+	v4lconvert_hflip_plane(simd, src, dest, width / 2, height / 2,
+			       bytesperline / 2);
 }
 
 static void v4lconvert_rotate180_rgbbgr24(const unsigned char *src,
 		unsigned char *dst, int width, int height)
 {
-	int i;
-
-	src += 3 * width * height - 3;
-
-	for (i = 0; i < width * height; i++) {
-		dst[0] = src[0];
-		dst[1] = src[1];
-		dst[2] = src[2];
-		dst += 3;
-		src -= 3;
-	}
+	v4lconvert_reverse_24(v4lconvert_get_flip_kernels(),
+			      src + 3 * width * height, dst, width * height);
 }
 
 static void v4lconvert_rotate180_yuv420(const unsigned char *src,
 		unsigned char *dst, int width, int height)
 {
-	int i;
+	const struct v4lconvert_flip_kernels *simd = v4lconvert_get_flip_kernels();
 
 	/* First flip x and y of the Y plane */
-	src += width * height - 1;
-	for (i = 0; i < width * height; i++)
-		*dst++ = *src--;
+	v4lconvert_reverse_8(simd, src + width * height, dst, width * height);
+	src += width * height;
+	dst += width * height;
 
 	/* Now flip the U plane */
-	src += width * height * 5 / 4;
-	for (i = 0; i < width * height / 4; i++)
-		*dst++ = *src--;
+	v4lconvert_reverse_8(simd, src + width * height / 4, dst,
+			     width * height / 4);
+	src += width * height / 4;
+	dst += width * height / 4;
 
 	/* Last flip the V plane */
-	src += width * height / 2;
-	for (i = 0; i < width * height / 4; i++)
-		*dst++ = *src--;
+	v4lconvert_reverse_8(simd, src + width * height / 4, dst,
+			     width * height / 4);
 }
 
-static void v4lconvert_rotate90_rgbbgr24(const unsigned char *src,
-		unsigned char *dst, int destwidth, int destheight)
+/*
+ * Dest line y is src column y read from the bottom up. Going through dest
+ * a line at a time reads a whole src column per line, which touches a new
+ * cache line for every pixel. Instead this does strips of 8 dest lines in
+ * blocks of 8 x 8 pixels, so that each src cache line read is used for the
+ * whole strip, and for the next strips as long as it stays in the cache.
+ */
+
+/* Rotates a plane of 1 (bpp 8) or 3 (bpp 24) byte pixels */
+static void v4lconvert_rotate90_plane(const struct v4lconvert_flip_kernels *simd,
+		const unsigned char *src, unsigned char *dst, int destwidth,
+		int destheight, int bpp)
 {
-	int x, y;
+	void (*rotate90_8x8)(const unsigned char *src, int src_stride,
+			unsigned char *dst, int dst_stride) =
+		bpp == 24 ? simd->rotate90_8x8_24 : simd->rotate90_8x8;
+	int pixel_size = bpp / 8;
+	int src_stride = -destheight * pixel_size; /* Going up through src */
+	int dst_stride = destwidth * pixel_size;
+	int x0, y0, x, y, x_end, y_end;
 #define srcwidth destheight
 #define srcheight destwidth
 
-	for (y = 0; y < destheight; y++)
-		for (x = 0; x < destwidth; x++) {
-			int offset = ((srcheight - x - 1) * srcwidth + y) * 3;
-			*dst++ = src[offset++];
-			*dst++ = src[offset++];
-			*dst++ = src[offset];
+	for (y0 = 0; y0 < destheight; y0 += 8) {
+		const unsigned char *s = src +
+			((srcheight - 1) * srcwidth + y0) * pixel_size;
+		unsigned char *d = dst + y0 * dst_stride;
+
+		y_end = destheight - y0 < 8 ? destheight - y0 : 8;
+		for (x0 = 0; y_end == 8 && x0 + 8 <= destwidth; x0 += 8) {
+			rotate90_8x8(s, src_stride, d, dst_stride);
+			s += 8 * src_stride;
+			d += 8 * pixel_size;
 		}
+
+		/* The partial blocks at the right and bottom edges */
+		x_end = destwidth - x0;
+		for (y = 0; y < y_end; y++)
+			for (x = 0; x < x_end; x++)
+				memcpy(d + y * dst_stride + x * pixel_size,
+				       s + x * src_stride + y * pixel_size,
+				       pixel_size);
+	}
+}
+
+static void v4lconvert_rotate90_rgbbgr24(const unsigned char *src,
+		unsigned char *dst, int destwidth, int destheight)
+{
+	v4lconvert_rotate90_plane(v4lconvert_get_flip_kernels(), src, dst,
+				  destwidth, destheight, 24);
 }
 
 static void v4lconvert_rotate90_yuv420(const unsigned char *src,
 		unsigned char *dst, int destwidth, int destheight)
 {
-	int x, y;
+	const struct v4lconvert_flip_kernels *simd = v4lconvert_get_flip_kernels();
 
 	/* Y-plane */
-	for (y = 0; y < destheight; y++)
-		for (x = 0; x < destwidth; x++) {
-			int offset = (srcheight - x - 1) * srcwidth + y;
-			*dst++ = src[offset];
-		}
+	v4lconvert_rotate90_plane(simd, src, dst, destwidth, destheight, 8);
+	src += srcwidth * srcheight;
+	dst += destwidth * destheight;
 
 	/* U-plane */
-	src += srcwidth * srcheight;
 	destwidth /= 2;
 	destheight /= 2;
-	for (y = 0; y < destheight; y++)
-		for (x = 0; x < destwidth; x++) {
-			int offset = (srcheight - x - 1) * srcwidth + y;
-			*dst++ = src[offset];
-		}
+	v4lconvert_rotate90_plane(simd, src, dst, destwidth, destheight, 8);
+	src += srcwidth * srcheight;
+	dst += destwidth * destheight;
 
 	/* V-plane */
-	src += srcwidth * srcheight;
-	for (y = 0; y < destheight; y++)
-		for (x = 0; x < destwidth; x++) {
-			int offset = (srcheight - x - 1) * srcwidth + y;
-			*dst++ = src[offset];
-		}
+	v4lconvert_rotate90_plane(simd, src, dst, destwidth, destheight, 8);
 }
 
 void v4lconvert_rotate90(unsigned char *src, unsigned char *dest,
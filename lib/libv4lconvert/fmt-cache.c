@@ -0,0 +1,184 @@
+/*
+# On-disk cache of the formats and framesizes enumerated from a device
+
+# This program is free software; you can redistribute it and/or modify
+# it under the terms of the GNU Lesser General Public License as published by
+# the Free Software Foundation; either version 2.1 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU Lesser General Public License for more details.
+#
+# You should have received a copy of the GNU Lesser General Public License
+# along with this program; if not, write to the Free Software
+# Foundation, Inc., 51 Franklin Street, Suite 500, Boston, MA  02110-1335  USA
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/stat.h>
+#include "libv4lconvert-priv.h"
+
+#define V4LCONVERT_FMT_CACHE_MAGIC "v4lcfmt2"
+
+/* The cache file is only meant to be read back on the same machine, so
+   this is just dumped as is */
+struct v4lconvert_fmt_cache {
+	char magic[8];
+	/* The format bits are indexes in the supported_src_pixfmts table,
+	   which changes with the library build */
+	uint32_t struct_size;
+	uint32_t no_src_pixfmts;
+
+	/* The device: V4L2 doesn't report firmware versions, the driver
+	   version is the closest to it */
+	uint8_t driver[16];
+	uint8_t card[32];
+	uint8_t bus_info[32];
+	uint32_t version;
+	uint32_t capabilities;
+	uint32_t device_caps;
+
+	/* What v4lconvert_create_with_dev_ops() enumerated */
+	uint32_t no_formats;
+	int32_t needs_conversion;
+	unsigned long supported_src_formats[128 / BITS_PER_LONG];
+	uint32_t no_framesizes;
+	struct v4l2_frmsizeenum framesizes[V4LCONVERT_MAX_FRAMESIZES];
+	int64_t framesize_supported_src_formats[V4LCONVERT_MAX_FRAMESIZES];
+};
+
+/* Returns the name of the cache file of the device, or NULL if disabled */
+static char *v4lconvert_fmt_cache_name(const struct v4l2_capability *cap)
+{
+	const char *dir = getenv("LIBV4LCONVERT_CACHE_DIR");
+	char key[sizeof(cap->driver) + sizeof(cap->bus_info) + 1], *name, *c;
+
+	if (!dir || !*dir)
+		return NULL;
+
+	/* The bus_info of USB devices has the port path, so it is unique */
+	snprintf(key, sizeof(key), "%.*s-%.*s",
+		 (int)sizeof(cap->driver), (const char *)cap->driver,
+		 (int)sizeof(cap->bus_info), (const char *)cap->bus_info);
+	for (c = key; *c; c++)
+		if (*c == '/' || *c == ' ')
+			*c = '_';
+
+	name = malloc(strlen(dir) + strlen(key) + 6);
+	if (name)
+		sprintf(name, "%s/%s.fmts", dir, key);
+	return name;
+}
+
+static void v4lconvert_fmt_cache_key(struct v4lconvert_fmt_cache *cache,
+		const struct v4l2_capability *cap, unsigned int no_src_pixfmts)
+{
+	memcpy(cache->magic, V4LCONVERT_FMT_CACHE_MAGIC, sizeof(cache->magic));
+	cache->struct_size = sizeof(*cache);
+	cache->no_src_pixfmts = no_src_pixfmts;
+	memcpy(cache->driver, cap->driver, sizeof(cache->driver));
+	memcpy(cache->card, cap->card, sizeof(cache->card));
+	memcpy(cache->bus_info, cap->bus_info, sizeof(cache->bus_info));
+	cache->version = cap->version;
+	cache->capabilities = cap->capabilities;
+	cache->device_caps = cap->device_caps;
+}
+
+int v4lconvert_fmt_cache_load(struct v4lconvert_data *data,
+		const struct v4l2_capability *cap, unsigned int no_src_pixfmts,
+		int *needs_conversion)
+{
+	struct v4lconvert_fmt_cache *cache, key;
+	char *name = v4lconvert_fmt_cache_name(cap);
+	int fd, ret = -1;
+
+	if (!name)
+		return -1;
+
+	cache = malloc(sizeof(*cache));
+	fd = open(name, O_RDONLY | O_CLOEXEC);
+	free(name);
+	if (fd < 0 || !cache)
+		goto out;
+	if (read(fd, cache, sizeof(*cache)) != sizeof(*cache))
+		goto out;
+
+	/* Compare everything before the enumerated data */
+	memset(&key, 0, sizeof(key));
+	v4lconvert_fmt_cache_key(&key, cap, no_src_pixfmts);
+	if (memcmp(cache, &key, offsetof(struct v4lconvert_fmt_cache,
+					 no_formats)) ||
+	    cache->no_framesizes > V4LCONVERT_MAX_FRAMESIZES)
+		goto out;
+
+	data->no_formats = cache->no_formats;
+	memcpy(data->supported_src_formats, cache->supported_src_formats,
+	       sizeof(data->supported_src_formats));
+	data->no_framesizes = cache->no_framesizes;
+	memcpy(data->framesizes, cache->framesizes,
+	       cache->no_framesizes * sizeof(*data->framesizes));
+	memcpy(data->framesize_supported_src_formats,
+	       cache->framesize_supported_src_formats,
+	       cache->no_framesizes *
+	       sizeof(*data->framesize_supported_src_formats));
+	*needs_conversion = cache->needs_conversion;
+	ret = 0;
+out:
+	if (fd >= 0)
+		close(fd);
+	free(cache);
+	return ret;
+}
+
+void v4lconvert_fmt_cache_store(struct v4lconvert_data *data,
+		const struct v4l2_capability *cap, unsigned int no_src_pixfmts,
+		int needs_conversion)
+{
+	struct v4lconvert_fmt_cache *cache;
+	char *name = v4lconvert_fmt_cache_name(cap), *tmp = NULL;
+	int fd = -1;
+
+	if (!name)
+		return;
+
+	cache = calloc(1, sizeof(*cache));
+	tmp = malloc(strlen(name) + 8);
+	if (!cache || !tmp)
+		goto out;
+
+	v4lconvert_fmt_cache_key(cache, cap, no_src_pixfmts);
+	cache->no_formats = data->no_formats;
+	cache->needs_conversion = needs_conversion;
+	memcpy(cache->supported_src_formats, data->supported_src_formats,
+	       sizeof(cache->supported_src_formats));
+	cache->no_framesizes = data->no_framesizes;
+	memcpy(cache->framesizes, data->framesizes,
+	       data->no_framesizes * sizeof(*cache->framesizes));
+	memcpy(cache->framesize_supported_src_formats,
+	       data->framesize_supported_src_formats,
+	       data->no_framesizes *
+	       sizeof(*cache->framesize_supported_src_formats));
+
+	/* Write it to a temporary file first, so readers never see half of it */
+	sprintf(tmp, "%s.XXXXXX", name);
+	fd = mkstemp(tmp);
+	if (fd < 0)
+		goto out;
+	if (write(fd, cache, sizeof(*cache)) != sizeof(*cache) ||
+	    rename(tmp, name))
+		unlink(tmp);
+out:
+	if (fd >= 0)
+		close(fd);
+	free(tmp);
+	free(cache);
+	free(name);
+}
@@ -0,0 +1,697 @@
+/*
+# OpenGL ES 3.0 backend for the bayer and yuv to rgb conversions
+
+# This program is free software; you can redistribute it and/or modify
+# it under the terms of the GNU Lesser General Public License as published by
+# the Free Software Foundation; either version 2.1 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU Lesser General Public License for more details.
+#
+# You should have received a copy of the GNU Lesser General Public License
+# along with this program; if not, write to the Free Software
+# Foundation, Inc., 51 Franklin Street, Suite 500, Boston, MA  02110-1335  USA
+ */
+
+#include <dlfcn.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include "libv4lconvert-priv.h"
+
+/*
+ * libEGL and libGLESv2 are loaded at runtime, so libv4lconvert neither
+ * builds nor links against them; the few definitions needed are here.
+ */
+#define GPU_EGL_DEFAULT_DISPLAY		((void *)0)
+#define GPU_EGL_NO_CONTEXT		((void *)0)
+#define GPU_EGL_NO_SURFACE		((void *)0)
+#define GPU_EGL_NO_CONFIG		((void *)0)
+#define GPU_EGL_NONE			0x3038
+#define GPU_EGL_OPENGL_ES_API		0x30A0
+#define GPU_EGL_CONTEXT_CLIENT_VERSION	0x3098
+#define GPU_EGL_PLATFORM_SURFACELESS	0x31DD
+
+#define GPU_GL_TRIANGLES		0x0004
+#define GPU_GL_TEXTURE_2D		0x0DE1
+#define GPU_GL_UNPACK_ROW_LENGTH	0x0CF2
+#define GPU_GL_UNPACK_ALIGNMENT		0x0CF5
+#define GPU_GL_PACK_ALIGNMENT		0x0D05
+#define GPU_GL_UNSIGNED_BYTE		0x1401
+#define GPU_GL_RGBA			0x1908
+#define GPU_GL_NEAREST			0x2600
+#define GPU_GL_TEXTURE_MAG_FILTER	0x2800
+#define GPU_GL_TEXTURE_MIN_FILTER	0x2801
+#define GPU_GL_RGBA8			0x8058
+#define GPU_GL_R8UI			0x8232
+#define GPU_GL_TEXTURE0			0x84C0
+#define GPU_GL_FRAGMENT_SHADER		0x8B30
+#define GPU_GL_VERTEX_SHADER		0x8B31
+#define GPU_GL_COMPILE_STATUS		0x8B81
+#define GPU_GL_LINK_STATUS		0x8B82
+#define GPU_GL_COLOR_ATTACHMENT0	0x8CE0
+#define GPU_GL_FRAMEBUFFER_COMPLETE	0x8CD5
+#define GPU_GL_FRAMEBUFFER		0x8D40
+#define GPU_GL_RED_INTEGER		0x8D94
+
+#define GPU_EGL_FUNCS(F) \
+	F(void *, eglGetDisplay, (void *native)) \
+	F(void *, eglGetProcAddress, (const char *name)) \
+	F(unsigned, eglInitialize, (void *dpy, int *major, int *minor)) \
+	F(unsigned, eglBindAPI, (unsigned api)) \
+	F(void *, eglCreateContext, (void *dpy, void *config, void *share, \
+				     const int *attribs)) \
+	F(unsigned, eglDestroyContext, (void *dpy, void *ctx)) \
+	F(unsigned, eglMakeCurrent, (void *dpy, void *draw, void *read, \
+				     void *ctx))
+
+#define GPU_GL_FUNCS(F) \
+	F(unsigned, glGetError, (void)) \
+	F(unsigned, glCreateShader, (unsigned type)) \
+	F(void, glShaderSource, (unsigned shader, int count, \
+				 const char * const *string, const int *length)) \
+	F(void, glCompileShader, (unsigned shader)) \
+	F(void, glGetShaderiv, (unsigned shader, unsigned pname, int *params)) \
+	F(void, glDeleteShader, (unsigned shader)) \
+	F(unsigned, glCreateProgram, (void)) \
+	F(void, glAttachShader, (unsigned program, unsigned shader)) \
+	F(void, glLinkProgram, (unsigned program)) \
+	F(void, glGetProgramiv, (unsigned program, unsigned pname, int *params)) \
+	F(void, glUseProgram, (unsigned program)) \
+	F(void, glDeleteProgram, (unsigned program)) \
+	F(int, glGetUniformLocation, (unsigned program, const char *name)) \
+	F(void, glUniform1i, (int location, int v0)) \
+	F(void, glUniform2i, (int location, int v0, int v1)) \
+	F(void, glGenTextures, (int n, unsigned *textures)) \
+	F(void, glDeleteTextures, (int n, const unsigned *textures)) \
+	F(void, glActiveTexture, (unsigned texture)) \
+	F(void, glBindTexture, (unsigned target, unsigned texture)) \
+	F(void, glTexParameteri, (unsigned target, unsigned pname, int param)) \
+	F(void, glTexImage2D, (unsigned target, int level, int internalformat, \
+			       int width, int height, int border, \
+			       unsigned format, unsigned type, const void *pixels)) \
+	F(void, glTexSubImage2D, (unsigned target, int level, int xoffset, \
+				  int yoffset, int width, int height, \
+				  unsigned format, unsigned type, const void *pixels)) \
+	F(void, glPixelStorei, (unsigned pname, int param)) \
+	F(void, glGenFramebuffers, (int n, unsigned *framebuffers)) \
+	F(void, glDeleteFramebuffers, (int n, const unsigned *framebuffers)) \
+	F(void, glBindFramebuffer, (unsigned target, unsigned framebuffer)) \
+	F(void, glFramebufferTexture2D, (unsigned target, unsigned attachment, \
+					 unsigned textarget, unsigned texture, \
+					 int level)) \
+	F(unsigned, glCheckFramebufferStatus, (unsigned target)) \
+	F(void, glGenVertexArrays, (int n, unsigned *arrays)) \
+	F(void, glDeleteVertexArrays, (int n, const unsigned *arrays)) \
+	F(void, glBindVertexArray, (unsigned array)) \
+	F(void, glViewport, (int x, int y, int width, int height)) \
+	F(void, glDrawArrays, (unsigned mode, int first, int count)) \
+	F(void, glReadPixels, (int x, int y, int width, int height, \
+			       unsigned format, unsigned type, void *pixels))
+
+#define GPU_DECLARE_FUNC(ret, name, args) ret (*name) args;
+
+/* The conversions, each has its own program */
+enum v4lconvert_gpu_conv {
+	GPU_CONV_YUYV,
+	GPU_CONV_NV12,
+	GPU_CONV_BAYER,
+	GPU_CONV_COUNT
+};
+
+static const char *const v4lconvert_gpu_conv_names[GPU_CONV_COUNT] = {
+	"YUYV", "NV12", "BAYER"
+};
+
+struct v4lconvert_gpu {
+	GPU_EGL_FUNCS(GPU_DECLARE_FUNC)
+	GPU_GL_FUNCS(GPU_DECLARE_FUNC)
+	void *dpy;
+	void *ctx;
+
+	/* All GL calls are made by this thread, which has the context current,
+	   so the contexts of the calling threads aren't touched */
+	pthread_t thread;
+	pthread_mutex_t lock;
+	pthread_cond_t work_cond;
+	pthread_cond_t done_cond;
+	int stop;
+	int pending;
+	int result;
+
+	/* Current job */
+	enum v4lconvert_gpu_conv conv;
+	const unsigned char *src;
+	unsigned char *dest;
+	int width;
+	int height;
+	int src_row_length;
+	int src_height;
+	int bgr;
+	int red_x;
+	int red_y;
+
+	unsigned programs[GPU_CONV_COUNT];
+	unsigned vao;
+	unsigned fbo;
+	unsigned src_tex;
+	unsigned dest_tex;
+	/* The sizes the textures were allocated for */
+	int src_tex_width;
+	int src_tex_height;
+	int dest_tex_width;
+	int dest_tex_height;
+	/* For dest lines that aren't a multiple of 4 bytes */
+	unsigned char *readback_buf;
+	int readback_buf_size;
+};
+
+static const char v4lconvert_gpu_vertex_shader[] =
+	"#version 300 es\n"
+	"void main() {\n"
+	"	// A triangle covering the viewport\n"
+	"	gl_Position = vec4(vec2(gl_VertexID & 1, gl_VertexID >> 1) * 4.0 - 1.0, 0.0, 1.0);\n"
+	"}\n";
+
+/* The integer math is the same as in rgbyuv.c and bayer.c, so the result
+   equals that of the cpu path. Each fragment writes 4 bytes of a packed
+   rgb24 line, so a frame can be read back as RGBA. */
+static const char v4lconvert_gpu_fragment_shader[] =
+	"precision highp float;\n"
+	"precision highp int;\n"
+	"uniform highp usampler2D src;\n"
+	"uniform ivec2 size;\n"
+	"uniform int bgr;\n"
+	"// The position of the red pixel in the 2x2 bayer pattern\n"
+	"uniform ivec2 red;\n"
+	"out vec4 fs_Bytes;\n"
+	"\n"
+	"int fetch(int x, int y)\n"
+	"{\n"
+	"	return int(texelFetch(src, ivec2(x, y), 0).r);\n"
+	"}\n"
+	"\n"
+	"#if defined(YUYV)\n"
+	"ivec3 pixel(int x, int y)\n"
+	"{\n"
+	"	int pair = (x & ~1) * 2;\n"
+	"	int u = fetch(pair + 1, y) - 128;\n"
+	"	int v = fetch(pair + 3, y) - 128;\n"
+	"	int u1 = ((u << 7) + u) >> 6;\n"
+	"	int rg = ((u << 1) + u + (v << 2) + (v << 1)) >> 3;\n"
+	"	int v1 = ((v << 1) + v) >> 1;\n"
+	"	int l = fetch(x * 2, y);\n"
+	"\n"
+	"	return ivec3(l + v1, l - rg, l + u1);\n"
+	"}\n"
+	"#elif defined(NV12)\n"
+	"ivec3 pixel(int x, int y)\n"
+	"{\n"
+	"	int uvy = size.y + y / 2;\n"
+	"	int u = fetch(x & ~1, uvy) - 128;\n"
+	"	int v = fetch(x | 1, uvy) - 128;\n"
+	"	int l = fetch(x, y);\n"
+	"\n"
+	"	return ivec3(l + ((v * 1436) >> 10),\n"
+	"		     l - ((u * 352 + v * 731) >> 10),\n"
+	"		     l + ((u * 1814) >> 10));\n"
+	"}\n"
+	"#elif defined(BAYER)\n"
+	"// The average of the neighbours which are inside the frame, rounded\n"
+	"// like bayer.c does\n"
+	"int average(int sum, int n)\n"
+	"{\n"
+	"	if (n == 4)\n"
+	"		return (sum + 2) >> 2;\n"
+	"	if (n == 3)\n"
+	"		return (sum + 1) / 3;\n"
+	"	if (n == 2)\n"
+	"		return (sum + 1) >> 1;\n"
+	"	return sum;\n"
+	"}\n"
+	"\n"
+	"int horizontal(int x, int y)\n"
+	"{\n"
+	"	int sum = 0, n = 0;\n"
+	"\n"
+	"	if (x > 0) { sum += fetch(x - 1, y); n++; }\n"
+	"	if (x < size.x - 1) { sum += fetch(x + 1, y); n++; }\n"
+	"	return average(sum, n);\n"
+	"}\n"
+	"\n"
+	"int vertical(int x, int y)\n"
+	"{\n"
+	"	int sum = 0, n = 0;\n"
+	"\n"
+	"	if (y > 0) { sum += fetch(x, y - 1); n++; }\n"
+	"	if (y < size.y - 1) { sum += fetch(x, y + 1); n++; }\n"
+	"	return average(sum, n);\n"
+	"}\n"
+	"\n"
+	"int adjacent(int x, int y)\n"
+	"{\n"
+	"	int sum = 0, n = 0;\n"
+	"\n"
+	"	if (x > 0) { sum += fetch(x - 1, y); n++; }\n"
+	"	if (x < size.x - 1) { sum += fetch(x + 1, y); n++; }\n"
+	"	if (y > 0) { sum += fetch(x, y - 1); n++; }\n"
+	"	if (y < size.y - 1) { sum += fetch(x, y + 1); n++; }\n"
+	"	return average(sum, n);\n"
+	"}\n"
+	"\n"
+	"int diagonal(int x, int y)\n"
+	"{\n"
+	"	int sum = 0, n = 0;\n"
+	"\n"
+	"	for (int dy = -1; dy <= 1; dy += 2)\n"
+	"		for (int dx = -1; dx <= 1; dx += 2)\n"
+	"			if (x + dx >= 0 && x + dx < size.x &&\n"
+	"			    y + dy >= 0 && y + dy < size.y) {\n"
+	"				sum += fetch(x + dx, y + dy);\n"
+	"				n++;\n"
+	"			}\n"
+	"	return average(sum, n);\n"
+	"}\n"
+	"\n"
+	"ivec3 pixel(int x, int y)\n"
+	"{\n"
+	"	ivec2 site = ivec2(x & 1, y & 1);\n"
+	"\n"
+	"	if (site == red)\n"
+	"		return ivec3(fetch(x, y), adjacent(x, y), diagonal(x, y));\n"
+	"	if (site == (red ^ 1))\n"
+	"		return ivec3(diagonal(x, y), adjacent(x, y), fetch(x, y));\n"
+	"	// Green, red is either left and right or above and below\n"
+	"	if (site.y == red.y)\n"
+	"		return ivec3(horizontal(x, y), fetch(x, y), vertical(x, y));\n"
+	"	return ivec3(vertical(x, y), fetch(x, y), horizontal(x, y));\n"
+	"}\n"
+	"#endif\n"
+	"\n"
+	"void main()\n"
+	"{\n"
+	"	ivec2 pos = ivec2(gl_FragCoord.xy);\n"
+	"	int first = pos.x * 4;\n"
+	"	int x = first / 3;\n"
+	"	ivec3 p[2];\n"
+	"	vec4 bytes;\n"
+	"\n"
+	"	// The 4 bytes span 2 pixels, the last one may be past the line\n"
+	"	p[0] = clamp(pixel(x, pos.y), 0, 255);\n"
+	"	p[1] = clamp(pixel(min(x + 1, size.x - 1), pos.y), 0, 255);\n"
+	"	if (bgr != 0) {\n"
+	"		p[0] = p[0].bgr;\n"
+	"		p[1] = p[1].bgr;\n"
+	"	}\n"
+	"	for (int i = 0; i < 4; i++) {\n"
+	"		int b = first + i;\n"
+	"\n"
+	"		bytes[i] = float(p[b / 3 - x][b % 3]);\n"
+	"	}\n"
+	"	fs_Bytes = bytes / 255.0;\n"
+	"}\n";
+
+static unsigned v4lconvert_gpu_shader(struct v4lconvert_gpu *gpu,
+		unsigned type, const char *const *src, int count)
+{
+	unsigned shader = gpu->glCreateShader(type);
+	int ok = 0;
+
+	gpu->glShaderSource(shader, count, src, NULL);
+	gpu->glCompileShader(shader);
+	gpu->glGetShaderiv(shader, GPU_GL_COMPILE_STATUS, &ok);
+	if (!ok) {
+		gpu->glDeleteShader(shader);
+		return 0;
+	}
+	return shader;
+}
+
+static unsigned v4lconvert_gpu_program(struct v4lconvert_gpu *gpu,
+		enum v4lconvert_gpu_conv conv)
+{
+	const char *vs_src[1] = { v4lconvert_gpu_vertex_shader };
+	const char *fs_src[3];
+	char defines[64];
+	unsigned program, vs, fs;
+	int ok = 0;
+
+	if (gpu->programs[conv])
+		return gpu->programs[conv];
+
+	snprintf(defines, sizeof(defines), "#version 300 es\n#define %s\n",
+		 v4lconvert_gpu_conv_names[conv]);
+	fs_src[0] = defines;
+	fs_src[1] = v4lconvert_gpu_fragment_shader;
+	vs = v4lconvert_gpu_shader(gpu, GPU_GL_VERTEX_SHADER, vs_src, 1);
+	fs = v4lconvert_gpu_shader(gpu, GPU_GL_FRAGMENT_SHADER, fs_src, 2);
+	if (!vs || !fs) {
+		if (vs)
+			gpu->glDeleteShader(vs);
+		if (fs)
+			gpu->glDeleteShader(fs);
+		return 0;
+	}
+
+	program = gpu->glCreateProgram();
+	gpu->glAttachShader(program, vs);
+	gpu->glAttachShader(program, fs);
+	gpu->glLinkProgram(program);
+	/* Only freed once the program is */
+	gpu->glDeleteShader(vs);
+	gpu->glDeleteShader(fs);
+	gpu->glGetProgramiv(program, GPU_GL_LINK_STATUS, &ok);
+	if (!ok) {
+		gpu->glDeleteProgram(program);
+		return 0;
+	}
+	gpu->glUseProgram(program);
+	gpu->glUniform1i(gpu->glGetUniformLocation(program, "src"), 0);
+	gpu->programs[conv] = program;
+	return program;
+}
+
+static void v4lconvert_gpu_texture(struct v4lconvert_gpu *gpu, unsigned tex,
+		int internalformat, unsigned format, int width, int height)
+{
+	gpu->glBindTexture(GPU_GL_TEXTURE_2D, tex);
+	gpu->glTexParameteri(GPU_GL_TEXTURE_2D, GPU_GL_TEXTURE_MIN_FILTER,
+			     GPU_GL_NEAREST);
+	gpu->glTexParameteri(GPU_GL_TEXTURE_2D, GPU_GL_TEXTURE_MAG_FILTER,
+			     GPU_GL_NEAREST);
+	gpu->glTexImage2D(GPU_GL_TEXTURE_2D, 0, internalformat, width, height,
+			  0, format, GPU_GL_UNSIGNED_BYTE, NULL);
+}
+
+/* Run the current job, in the gpu thread */
+static int v4lconvert_gpu_run(struct v4lconvert_gpu *gpu)
+{
+	unsigned program = v4lconvert_gpu_program(gpu, gpu->conv);
+	int line_size = gpu->width * 3;
+	/* The dest texture has 4 bytes per texel */
+	int dest_width = (line_size + 3) / 4;
+	unsigned char *readback = gpu->dest;
+	int i;
+
+	if (!program)
+		return -1;
+
+	/* Drop any error of an earlier job */
+	while (gpu->glGetError())
+		;
+
+	gpu->glActiveTexture(GPU_GL_TEXTURE0);
+	if (gpu->src_tex_width != gpu->src_row_length ||
+	    gpu->src_tex_height != gpu->src_height) {
+		v4lconvert_gpu_texture(gpu, gpu->src_tex, GPU_GL_R8UI,
+				       GPU_GL_RED_INTEGER, gpu->src_row_length,
+				       gpu->src_height);
+		gpu->src_tex_width = gpu->src_row_length;
+		gpu->src_tex_height = gpu->src_height;
+	}
+	if (gpu->dest_tex_width != dest_width ||
+	    gpu->dest_tex_height != gpu->height) {
+		v4lconvert_gpu_texture(gpu, gpu->dest_tex, GPU_GL_RGBA8,
+				       GPU_GL_RGBA, dest_width, gpu->height);
+		gpu->glBindFramebuffer(GPU_GL_FRAMEBUFFER, gpu->fbo);
+		gpu->glFramebufferTexture2D(GPU_GL_FRAMEBUFFER,
+					    GPU_GL_COLOR_ATTACHMENT0,
+					    GPU_GL_TEXTURE_2D, gpu->dest_tex, 0);
+		if (gpu->glCheckFramebufferStatus(GPU_GL_FRAMEBUFFER) !=
+		    GPU_GL_FRAMEBUFFER_COMPLETE)
+			return -1;
+		gpu->dest_tex_width = dest_width;
+		gpu->dest_tex_height = gpu->height;
+	}
+
+	/* The whole src lines are uploaded, the shader only reads the part
+	   holding the frame */
+	gpu->glBindTexture(GPU_GL_TEXTURE_2D, gpu->src_tex);
+	gpu->glPixelStorei(GPU_GL_UNPACK_ALIGNMENT, 1);
+	gpu->glTexSubImage2D(GPU_GL_TEXTURE_2D, 0, 0, 0, gpu->src_row_length,
+			     gpu->src_height, GPU_GL_RED_INTEGER,
+			     GPU_GL_UNSIGNED_BYTE, gpu->src);
+
+	gpu->glUseProgram(program);
+	gpu->glUniform2i(gpu->glGetUniformLocation(program, "size"),
+			 gpu->width, gpu->height);
+	gpu->glUniform1i(gpu->glGetUniformLocation(program, "bgr"), gpu->bgr);
+	gpu->glUniform2i(gpu->glGetUniformLocation(program, "red"),
+			 gpu->red_x, gpu->red_y);
+	gpu->glBindFramebuffer(GPU_GL_FRAMEBUFFER, gpu->fbo);
+	gpu->glBindVertexArray(gpu->vao);
+	gpu->glViewport(0, 0, dest_width, gpu->height);
+	gpu->glDrawArrays(GPU_GL_TRIANGLES, 0, 3);
+
+	if (line_size & 3) {
+		readback = v4lconvert_alloc_buffer(dest_width * 4 * gpu->height,
+				&gpu->readback_buf, &gpu->readback_buf_size);
+		if (!readback)
+			return -1;
+	}
+	gpu->glPixelStorei(GPU_GL_PACK_ALIGNMENT, 4);
+	gpu->glReadPixels(0, 0, dest_width, gpu->height, GPU_GL_RGBA,
+			  GPU_GL_UNSIGNED_BYTE, readback);
+	if (gpu->glGetError())
+		return -1;
+	if (readback != gpu->dest)
+		for (i = 0; i < gpu->height; i++)
+			memcpy(gpu->dest + i * line_size,
+			       readback + i * dest_width * 4, line_size);
+	return 0;
+}
+
+static int v4lconvert_gpu_init_context(struct v4lconvert_gpu *gpu)
+{
+	static const int attribs[] = {
+		GPU_EGL_CONTEXT_CLIENT_VERSION, 3,
+		GPU_EGL_NONE
+	};
+	void *(*get_platform_display)(unsigned platform, void *native,
+				      const int *attribs);
+	int major, minor;
+
+	/* Surfaceless, so no window system is needed */
+	get_platform_display = gpu->eglGetProcAddress("eglGetPlatformDisplayEXT");
+	if (get_platform_display)
+		gpu->dpy = get_platform_display(GPU_EGL_PLATFORM_SURFACELESS,
+						GPU_EGL_DEFAULT_DISPLAY, NULL);
+	if (!gpu->dpy || !gpu->eglInitialize(gpu->dpy, &major, &minor)) {
+		gpu->dpy = gpu->eglGetDisplay(GPU_EGL_DEFAULT_DISPLAY);
+		if (!gpu->dpy || !gpu->eglInitialize(gpu->dpy, &major, &minor))
+			return -1;
+	}
+	if (!gpu->eglBindAPI(GPU_EGL_OPENGL_ES_API))
+		return -1;
+	/* Needs EGL_KHR_no_config_context and EGL_KHR_surfaceless_context */
+	gpu->ctx = gpu->eglCreateContext(gpu->dpy, GPU_EGL_NO_CONFIG,
+					 GPU_EGL_NO_CONTEXT, attribs);
+	if (gpu->ctx == GPU_EGL_NO_CONTEXT)
+		return -1;
+	if (!gpu->eglMakeCurrent(gpu->dpy, GPU_EGL_NO_SURFACE,
+				 GPU_EGL_NO_SURFACE, gpu->ctx)) {
+		gpu->eglDestroyContext(gpu->dpy, gpu->ctx);
+		return -1;
+	}
+
+	gpu->glGenTextures(1, &gpu->src_tex);
+	gpu->glGenTextures(1, &gpu->dest_tex);
+	gpu->glGenFramebuffers(1, &gpu->fbo);
+	gpu->glGenVertexArrays(1, &gpu->vao);
+	return 0;
+}
+
+static void v4lconvert_gpu_free_context(struct v4lconvert_gpu *gpu)
+{
+	int i;
+
+	for (i = 0; i < GPU_CONV_COUNT; i++)
+		if (gpu->programs[i])
+			gpu->glDeleteProgram(gpu->programs[i]);
+	gpu->glDeleteTextures(1, &gpu->src_tex);
+	gpu->glDeleteTextures(1, &gpu->dest_tex);
+	gpu->glDeleteFramebuffers(1, &gpu->fbo);
+	gpu->glDeleteVertexArrays(1, &gpu->vao);
+	gpu->eglMakeCurrent(gpu->dpy, GPU_EGL_NO_SURFACE, GPU_EGL_NO_SURFACE,
+			    GPU_EGL_NO_CONTEXT);
+	/* The display may be shared with the application, so it is not
+	   terminated */
+	gpu->eglDestroyContext(gpu->dpy, gpu->ctx);
+}
+
+static void *v4lconvert_gpu_thread_main(void *arg)
+{
+	struct v4lconvert_gpu *gpu = arg;
+	int ok = !v4lconvert_gpu_init_context(gpu);
+
+	pthread_mutex_lock(&gpu->lock);
+	/* Report the result of the initialization */
+	gpu->result = ok ? 0 : -1;
+	gpu->pending = 0;
+	pthread_cond_signal(&gpu->done_cond);
+	while (ok) {
+		while (!gpu->pending && !gpu->stop)
+			pthread_cond_wait(&gpu->work_cond, &gpu->lock);
+		if (gpu->stop)
+			break;
+		pthread_mutex_unlock(&gpu->lock);
+		gpu->result = v4lconvert_gpu_run(gpu);
+		pthread_mutex_lock(&gpu->lock);
+		gpu->pending = 0;
+		pthread_cond_signal(&gpu->done_cond);
+	}
+	pthread_mutex_unlock(&gpu->lock);
+	if (ok)
+		v4lconvert_gpu_free_context(gpu);
+	return NULL;
+}
+
+static int v4lconvert_gpu_load(struct v4lconvert_gpu *gpu)
+{
+	/* The libraries stay loaded, unloading GL drivers is not reliable */
+	void *egl = dlopen("libEGL.so.1", RTLD_NOW | RTLD_LOCAL);
+	void *gles = dlopen("libGLESv2.so.2", RTLD_NOW | RTLD_LOCAL);
+
+	if (!egl || !gles)
+		return -1;
+
+#define GPU_LOAD_FUNC(lib, ret, name, args)			\
+	gpu->name = (ret (*) args)dlsym(lib, #name);		\
+	if (!gpu->name)						\
+		return -1;
+#define GPU_LOAD_EGL_FUNC(ret, name, args) GPU_LOAD_FUNC(egl, ret, name, args)
+#define GPU_LOAD_GL_FUNC(ret, name, args) GPU_LOAD_FUNC(gles, ret, name, args)
+	GPU_EGL_FUNCS(GPU_LOAD_EGL_FUNC)
+	GPU_GL_FUNCS(GPU_LOAD_GL_FUNC)
+	return 0;
+}
+
+struct v4lconvert_gpu *v4lconvert_gpu_create(void)
+{
+	struct v4lconvert_gpu *gpu;
+
+	/* Opt-in, any value but 0 enables it */
+	if (!getenv("LIBV4LCONVERT_GPU") ||
+	    !strcmp(getenv("LIBV4LCONVERT_GPU"), "0"))
+		return NULL;
+
+	gpu = calloc(1, sizeof(*gpu));
+	if (!gpu)
+		return NULL;
+	if (v4lconvert_gpu_load(gpu)) {
+		free(gpu);
+		return NULL;
+	}
+
+	pthread_mutex_init(&gpu->lock, NULL);
+	pthread_cond_init(&gpu->work_cond, NULL);
+	pthread_cond_init(&gpu->done_cond, NULL);
+	gpu->pending = 1;
+	if (pthread_create(&gpu->thread, NULL, v4lconvert_gpu_thread_main, gpu))
+		goto err;
+
+	pthread_mutex_lock(&gpu->lock);
+	while (gpu->pending)
+		pthread_cond_wait(&gpu->done_cond, &gpu->lock);
+	pthread_mutex_unlock(&gpu->lock);
+	if (!gpu->result)
+		return gpu;
+
+	/* The thread exits right away if there is no context */
+	pthread_join(gpu->thread, NULL);
+err:
+	pthread_cond_destroy(&gpu->done_cond);
+	pthread_cond_destroy(&gpu->work_cond);
+	pthread_mutex_destroy(&gpu->lock);
+	free(gpu);
+	return NULL;
+}
+
+void v4lconvert_gpu_destroy(struct v4lconvert_gpu *gpu)
+{
+	if (!gpu)
+		return;
+
+	pthread_mutex_lock(&gpu->lock);
+	gpu->stop = 1;
+	pthread_cond_signal(&gpu->work_cond);
+	pthread_mutex_unlock(&gpu->lock);
+	pthread_join(gpu->thread, NULL);
+
+	pthread_cond_destroy(&gpu->done_cond);
+	pthread_cond_destroy(&gpu->work_cond);
+	pthread_mutex_destroy(&gpu->lock);
+	free(gpu->readback_buf);
+	free(gpu);
+}
+
+int v4lconvert_gpu_convert(struct v4lconvert_gpu *gpu,
+		const unsigned char *src, int src_size, unsigned char *dest,
+		int width, int height, int bytesperline,
+		unsigned int src_pix_fmt, unsigned int dest_pix_fmt)
+{
+	int line_size;
+
+	if (dest_pix_fmt != V4L2_PIX_FMT_RGB24 &&
+	    dest_pix_fmt != V4L2_PIX_FMT_BGR24)
+		return -1;
+	/* Tiny frames are left to the cpu, bayer.c needs 3 lines and columns
+	   to give the same borders */
+	if (width < 3 || height < 3)
+		return -1;
+
+	switch (src_pix_fmt) {
+	case V4L2_PIX_FMT_YUYV:
+		if (width & 1)
+			return -1;
+		gpu->conv = GPU_CONV_YUYV;
+		gpu->src_height = height;
+		line_size = width * 2;
+		break;
+	case V4L2_PIX_FMT_NV12:
+		/* Packed, as nv12_to_rgb24 expects it */
+		if ((width & 1) || (height & 1))
+			return -1;
+		gpu->conv = GPU_CONV_NV12;
+		gpu->src_height = height * 3 / 2;
+		bytesperline = width;
+		line_size = width;
+		break;
+	case V4L2_PIX_FMT_SBGGR8:
+	case V4L2_PIX_FMT_SGBRG8:
+	case V4L2_PIX_FMT_SGRBG8:
+	case V4L2_PIX_FMT_SRGGB8:
+		gpu->conv = GPU_CONV_BAYER;
+		gpu->src_height = height;
+		line_size = width;
+		gpu->red_x = src_pix_fmt == V4L2_PIX_FMT_SBGGR8 ||
+			     src_pix_fmt == V4L2_PIX_FMT_SGRBG8;
+		gpu->red_y = src_pix_fmt == V4L2_PIX_FMT_SBGGR8 ||
+			     src_pix_fmt == V4L2_PIX_FMT_SGBRG8;
+		break;
+	default:
+		return -1;
+	}
+	if (bytesperline < line_size ||
+	    src_size < bytesperline * (gpu->src_height - 1) + line_size)
+		return -1;
+
+	gpu->src = src;
+	gpu->dest = dest;
+	gpu->width = width;
+	gpu->height = height;
+	gpu->src_row_length = bytesperline;
+	gpu->bgr = dest_pix_fmt == V4L2_PIX_FMT_BGR24;
+
+	pthread_mutex_lock(&gpu->lock);
+	gpu->pending = 1;
+	pthread_cond_signal(&gpu->work_cond);
+	while (gpu->pending)
+		pthread_cond_wait(&gpu->done_cond, &gpu->lock);
+	pthread_mutex_unlock(&gpu->lock);
+
+	return gpu->result;
+}
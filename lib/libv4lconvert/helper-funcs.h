@@ -29,6 +29,18 @@
 #include <unistd.h>
 #include <errno.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+/* Offset of the decompressed data in the shared memory, see helper.c */
+#define V4LCONVERT_HELPER_SHM_DEST(src_size) \
+  (((size_t)(src_size) + 4095) & ~(size_t)4095)
+
+struct v4lconvert_helper_shm {
+  int fd;
+  unsigned char *mem;
+  size_t size;
+};
 
 static int v4lconvert_helper_write(int fd, const void *b, size_t count,
   char *progname)
@@ -77,3 +89,52 @@ static int v4lconvert_helper_read(int fd, void *b, size_t count,
 
   return 0;
 }
+
+/* When libv4lconvert passes us a shared memory fd as first argument, the
+   frame data gets exchanged through it instead of through the pipes */
+static void v4lconvert_helper_shm_init(struct v4lconvert_helper_shm *shm,
+  int argc, char *argv[])
+{
+  shm->fd = (argc > 1) ? atoi(argv[1]) : -1;
+  shm->mem = NULL;
+  shm->size = 0;
+}
+
+/* libv4lconvert grows the shared memory before sending us a frame which does
+   not fit, so (re)map it when our mapping is too small */
+static unsigned char *v4lconvert_helper_shm_map(
+  struct v4lconvert_helper_shm *shm, size_t needed, char *progname)
+{
+  struct stat st;
+
+  if (needed <= shm->size)
+    return shm->mem;
+
+  if (shm->mem)
+    munmap(shm->mem, shm->size);
+  shm->mem = NULL;
+  shm->size = 0;
+
+  if (fstat(shm->fd, &st)) {
+    fprintf(stderr, "%s: error with shared memory: %s\n", progname,
+	    strerror(errno));
+    return NULL;
+  }
+  if ((size_t)st.st_size < needed) {
+    fprintf(stderr, "%s: error: shared memory too small, need: %zu\n",
+	    progname, needed);
+    return NULL;
+  }
+
+  shm->mem = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED,
+		  shm->fd, 0);
+  if (shm->mem == MAP_FAILED) {
+    fprintf(stderr, "%s: error mapping shared memory: %s\n", progname,
+	    strerror(errno));
+    shm->mem = NULL;
+    return NULL;
+  }
+  shm->size = st.st_size;
+
+  return shm->mem;
+}
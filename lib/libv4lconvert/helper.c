@@ -22,6 +22,8 @@
 #include <errno.h>
 #include <string.h>
 #include <signal.h>
+#include <fcntl.h>
+#include <sys/mman.h>
 #include <sys/wait.h>
 #include "libv4lconvert-priv.h"
 
@@ -46,11 +48,68 @@
    From the helper to libv4l the following is send:
    int			data length (-1 in case of a decompression error)
    unsigned char[]	data (not present when a decompression error happened)
+
+   When memfd_create() is available, the helper gets the fd of a shared memory
+   area as its first argument, and the data is not send over the pipes.
+   Instead the compressed data is at the start of the shared memory, and the
+   helper stores the decompressed data at the next page boundary after it
+   (see HELPER_SHM_DEST). We grow the area before sending the frame header, so
+   that it is large enough for both, the helper remaps it when needed.
  */
 
+#define HELPER_SHM_DEST(src_size) (((size_t)(src_size) + 4095) & ~(size_t)4095)
+
+static void v4lconvert_helper_shm_free(struct v4lconvert_data *data)
+{
+	if (data->decompress_shm)
+		munmap(data->decompress_shm, data->decompress_shm_size);
+	if (data->decompress_shm_fd != -1)
+		close(data->decompress_shm_fd);
+	data->decompress_shm = NULL;
+	data->decompress_shm_size = 0;
+	data->decompress_shm_fd = -1;
+}
+
+static int v4lconvert_helper_shm_grow(struct v4lconvert_data *data,
+		size_t needed)
+{
+	/* Round up, to avoid growing it a little bit at a time */
+	needed = (needed + 65535) & ~(size_t)65535;
+
+	if (ftruncate(data->decompress_shm_fd, needed)) {
+		V4LCONVERT_ERR("growing helper shared memory: %s\n",
+				strerror(errno));
+		return -1;
+	}
+
+	if (data->decompress_shm)
+		munmap(data->decompress_shm, data->decompress_shm_size);
+	data->decompress_shm_size = 0;
+
+	data->decompress_shm = mmap(NULL, needed, PROT_READ | PROT_WRITE,
+			MAP_SHARED, data->decompress_shm_fd, 0);
+	if (data->decompress_shm == MAP_FAILED) {
+		V4LCONVERT_ERR("mapping helper shared memory: %s\n",
+				strerror(errno));
+		data->decompress_shm = NULL;
+		return -1;
+	}
+	data->decompress_shm_size = needed;
+
+	return 0;
+}
+
 static int v4lconvert_helper_start(struct v4lconvert_data *data,
 		const char *helper)
 {
+	char shm_fd[16];
+
+#ifdef HAVE_MEMFD_CREATE
+	/* On failure we simply fall back to sending the data over the pipes */
+	data->decompress_shm_fd = memfd_create("libv4lconvert-helper",
+			MFD_CLOEXEC);
+#endif
+
 	if (pipe(data->decompress_in_pipe)) {
 		V4LCONVERT_ERR("with helper pipe: %s\n", strerror(errno));
 		goto error;
@@ -85,7 +144,14 @@ static int v4lconvert_helper_start(struct v4lconvert_data *data,
 		}
 
 		/* And execute the helper */
-		execl(helper, helper, NULL);
+		if (data->decompress_shm_fd != -1 &&
+				fcntl(data->decompress_shm_fd, F_SETFD, 0) == 0) {
+			snprintf(shm_fd, sizeof(shm_fd), "%d",
+					data->decompress_shm_fd);
+			execl(helper, helper, shm_fd, NULL);
+		} else {
+			execl(helper, helper, NULL);
+		}
 
 		/* We should never get here */
 		perror("libv4lconvert: error starting helper");
@@ -105,6 +171,7 @@ error_close_in_pipe:
 	close(data->decompress_in_pipe[READ_END]);
 	close(data->decompress_in_pipe[WRITE_END]);
 error:
+	v4lconvert_helper_shm_free(data);
 	return -1;
 }
 
@@ -176,6 +243,15 @@ int v4lconvert_helper_decompress(struct v4lconvert_data *data,
 			return -1;
 	}
 
+	if (data->decompress_shm_fd != -1) {
+		if (HELPER_SHM_DEST(src_size) + dest_size >
+				data->decompress_shm_size &&
+				v4lconvert_helper_shm_grow(data,
+					HELPER_SHM_DEST(src_size) + dest_size))
+			return -1;
+		memcpy(data->decompress_shm, src, src_size);
+	}
+
 	if (v4lconvert_helper_write(data, &width, sizeof(int)))
 		return -1;
 
@@ -188,7 +264,8 @@ int v4lconvert_helper_decompress(struct v4lconvert_data *data,
 	if (v4lconvert_helper_write(data, &src_size, sizeof(int)))
 		return -1;
 
-	if (v4lconvert_helper_write(data, src, src_size))
+	if (data->decompress_shm_fd == -1 &&
+			v4lconvert_helper_write(data, src, src_size))
 		return -1;
 
 	if (v4lconvert_helper_read(data, &r, sizeof(int)))
@@ -204,6 +281,11 @@ int v4lconvert_helper_decompress(struct v4lconvert_data *data,
 		return -1;
 	}
 
+	if (data->decompress_shm_fd != -1) {
+		memcpy(dest, data->decompress_shm + HELPER_SHM_DEST(src_size), r);
+		return 0;
+	}
+
 	return v4lconvert_helper_read(data, dest, r);
 }
 
@@ -217,4 +299,5 @@ void v4lconvert_helper_cleanup(struct v4lconvert_data *data)
 		waitpid(data->decompress_pid, &status, 0);
 		data->decompress_pid = -1;
 	}
+	v4lconvert_helper_shm_free(data);
 }
@@ -91,69 +91,166 @@ static void v4lconvert_hm12_to_rgb(const unsigned char *src, unsigned char *dest
 	}
 }
 
-void v4lconvert_hm12_to_rgb24(const unsigned char *src, unsigned char *dest,
-		int width, int height)
-{
-	v4lconvert_hm12_to_rgb(src, dest, width, height, 1);
-}
+/*
+ * The fast paths below work in bands of 32 lines, one row of 16x16 chroma
+ * macroblocks and the 2 rows of luma macroblocks going with it, and are
+ * run in parallel on the conversion threads. The line being rendered
+ * moves through the macroblocks 16 bytes at a time.
+ */
+#define HM12_BAND_LINES 32
 
-void v4lconvert_hm12_to_bgr24(const unsigned char *src, unsigned char *dest,
-		int width, int height)
+struct hm12_job {
+	const struct v4lconvert_unpack_kernels *simd;
+	const struct v4lconvert_yuv_kernels *yuv;
+	const unsigned char *src;
+	unsigned char *dest;
+	int width;
+	int height;
+	unsigned int dest_pix_fmt;
+};
+
+/* Copies luma lines first to first + count - 1 to dst */
+static void de_macro_y_lines(unsigned char *dst, const unsigned char *src,
+		int w, int first, int count)
 {
-	v4lconvert_hm12_to_rgb(src, dest, width, height, 0);
+	int y, x;
+
+	for (y = first; y < first + count; y++) {
+		const unsigned char *src_y = src + (y / 16) * 16 * stride +
+			(y % 16) * 16;
+
+		for (x = 0; x + 16 <= w; x += 16) {
+			memcpy(dst + x, src_y, 16);
+			src_y += 256;
+		}
+		memcpy(dst + x, src_y, w - x);
+		dst += w;
+	}
 }
 
-static void de_macro_uv(unsigned char *dstu, unsigned char *dstv,
-		const unsigned char *src, int w, int h)
+/* Splits chroma lines first to first + count - 1 of w pairs to dstu and
+   dstv */
+static void de_macro_uv_lines(const struct v4lconvert_unpack_kernels *simd,
+		unsigned char *dstu, unsigned char *dstv,
+		const unsigned char *src, int w, int first, int count)
 {
-	unsigned int y, x, i, j;
+	int y, x, j;
+
+	for (y = first; y < first + count; y++) {
+		const unsigned char *src_uv = src + (y / 16) * 16 * stride +
+			(y % 16) * 16;
 
-	for (y = 0; y < h; y += 16) {
 		for (x = 0; x < w; x += 8) {
-			const unsigned char *src_uv = src + y * stride + x * 32;
-			int maxy = (h - y < 16 ? h - y : 16);
 			int maxx = (w - x < 8 ? w - x : 8);
 
-			for (i = 0; i < maxy; i++) {
-				int idx = x + (y + i) * w;
-
-				for (j = 0; j < maxx; j++) {
-					dstu[idx+j] = src_uv[2 * j];
-					dstv[idx+j] = src_uv[2 * j + 1];
-				}
-				src_uv += 16;
+			j = simd->split_uv(src_uv, dstu + x, dstv + x, maxx);
+			for (; j < maxx; j++) {
+				dstu[x + j] = src_uv[2 * j];
+				dstv[x + j] = src_uv[2 * j + 1];
 			}
+			src_uv += 256;
 		}
+		dstu += w;
+		dstv += w;
 	}
 }
 
-static void de_macro_y(unsigned char *dst, const unsigned char *src,
-		int w, int h)
+static void hm12_band(void *arg, int first, int count)
 {
-	unsigned int y, x, i;
+	struct hm12_job *job = arg;
+	int w = job->width, h = job->height;
+	const unsigned char *uv_base = job->src + stride * h;
+	unsigned char tmp[720 * HM12_BAND_LINES * 3 / 2];
+	unsigned char *y_dst, *u_dst, *v_dst;
+	int y, lines;
 
-	for (y = 0; y < h; y += 16) {
-		for (x = 0; x < w; x += 16) {
-			const unsigned char *src_y = src + y * stride + x * 16;
-			int maxy = (h - y < 16 ? h - y : 16);
-			int maxx = (w - x < 16 ? w - x : 16);
+	for (y = first; y < first + count; y += HM12_BAND_LINES) {
+		lines = first + count - y;
+		if (lines > HM12_BAND_LINES)
+			lines = HM12_BAND_LINES;
 
-			for (i = 0; i < maxy; i++) {
-				memcpy(dst + x + (y + i) * w, src_y, maxx);
-				src_y += 16;
+		switch (job->dest_pix_fmt) {
+		case V4L2_PIX_FMT_YUV420:
+		case V4L2_PIX_FMT_YVU420:
+			y_dst = job->dest + y * w;
+			u_dst = job->dest + w * h + y / 2 * (w / 2);
+			v_dst = u_dst + w * h / 4;
+			if (job->dest_pix_fmt == V4L2_PIX_FMT_YVU420) {
+				u_dst = v_dst;
+				v_dst = u_dst - w * h / 4;
 			}
+			break;
+		default:
+			/* Gather a planar YUV420 band in tmp, and convert it
+			   while it is still in the cache */
+			y_dst = tmp;
+			u_dst = tmp + w * lines;
+			v_dst = u_dst + w * lines / 4;
+			break;
+		}
+
+		de_macro_y_lines(y_dst, job->src, w, y, lines);
+		de_macro_uv_lines(job->simd, u_dst, v_dst, uv_base, w / 2,
+				  y / 2, lines / 2);
+
+		switch (job->dest_pix_fmt) {
+		case V4L2_PIX_FMT_RGB24:
+			job->yuv->yuv420_to_rgb24(tmp, job->dest + y * w * 3,
+						  w, lines, 0);
+			break;
+		case V4L2_PIX_FMT_BGR24:
+			job->yuv->yuv420_to_bgr24(tmp, job->dest + y * w * 3,
+						  w, lines, 0);
+			break;
 		}
 	}
 }
 
-void v4lconvert_hm12_to_yuv420(const unsigned char *src, unsigned char *dest,
-		int width, int height, int yvu)
+static void v4lconvert_hm12_run(struct v4lconvert_threads *threads,
+		const unsigned char *src, unsigned char *dest, int width,
+		int height, unsigned int dest_pix_fmt)
+{
+	struct hm12_job job = {
+		.simd = v4lconvert_get_unpack_kernels(),
+		.yuv = v4lconvert_get_yuv_kernels(),
+		.src = src,
+		.dest = dest,
+		.width = width,
+		.height = height,
+		.dest_pix_fmt = dest_pix_fmt,
+	};
+
+	v4lconvert_threads_run(threads, height, HM12_BAND_LINES, hm12_band,
+			       &job);
+}
+
+void v4lconvert_hm12_to_rgb24(struct v4lconvert_threads *threads,
+		const unsigned char *src, unsigned char *dest,
+		int width, int height)
 {
-	de_macro_y(dest, src, width, height);
-	dest += width * height;
-	src += stride * height;
-	if (yvu)
-		de_macro_uv(dest + width * height / 4, dest, src, width / 2, height / 2);
+	/* The YUV420 routines do pixels and lines in pairs */
+	if ((width | height) & 1 || width > stride)
+		v4lconvert_hm12_to_rgb(src, dest, width, height, 1);
 	else
-		de_macro_uv(dest, dest + width * height / 4, src, width / 2, height / 2);
+		v4lconvert_hm12_run(threads, src, dest, width, height,
+				    V4L2_PIX_FMT_RGB24);
+}
+
+void v4lconvert_hm12_to_bgr24(struct v4lconvert_threads *threads,
+		const unsigned char *src, unsigned char *dest,
+		int width, int height)
+{
+	if ((width | height) & 1 || width > stride)
+		v4lconvert_hm12_to_rgb(src, dest, width, height, 0);
+	else
+		v4lconvert_hm12_run(threads, src, dest, width, height,
+				    V4L2_PIX_FMT_BGR24);
+}
+
+void v4lconvert_hm12_to_yuv420(struct v4lconvert_threads *threads,
+		const unsigned char *src, unsigned char *dest,
+		int width, int height, int yvu)
+{
+	v4lconvert_hm12_run(threads, src, dest, width, height,
+			    yvu ? V4L2_PIX_FMT_YVU420 : V4L2_PIX_FMT_YUV420);
 }
@@ -42,6 +42,7 @@ int v4lconvert_decode_jpeg_tinyjpeg(struct v4lconvert_data *data,
 		data->tinyjpeg = tinyjpeg_init();
 		if (!data->tinyjpeg)
 			return v4lconvert_oom_error(data);
+		tinyjpeg_set_threads(data->tinyjpeg, data->threads);
 	}
 	flags |= TINYJPEG_FLAGS_MJPEG_TABLE;
 	tinyjpeg_set_flags(data->tinyjpeg, flags);
@@ -319,20 +320,50 @@ int v4lconvert_decode_jpeg_libjpeg(struct v4lconvert_data *data,
 	}
 
 	if (dest_pix_fmt == V4L2_PIX_FMT_RGB24 ||
-	    dest_pix_fmt == V4L2_PIX_FMT_BGR24) {
+	    dest_pix_fmt == V4L2_PIX_FMT_BGR24 ||
+	    dest_pix_fmt == V4L2_PIX_FMT_XRGB32 ||
+	    dest_pix_fmt == V4L2_PIX_FMT_XBGR32) {
+		int rgb32 = dest_pix_fmt == V4L2_PIX_FMT_XRGB32 ||
+			    dest_pix_fmt == V4L2_PIX_FMT_XBGR32;
 		JSAMPROW row_pointer[1];
 
 #ifdef JCS_EXTENSIONS
 		if (dest_pix_fmt == V4L2_PIX_FMT_BGR24)
 			data->cinfo.out_color_space = JCS_EXT_BGR;
+		else if (dest_pix_fmt == V4L2_PIX_FMT_XRGB32)
+			data->cinfo.out_color_space = JCS_EXT_XRGB;
+		else if (dest_pix_fmt == V4L2_PIX_FMT_XBGR32)
+			data->cinfo.out_color_space = JCS_EXT_BGRX;
 #endif
+		/* Decode at a reduced size, when the caller is going to
+		   downscale anyways, updating fmt to the decoded size */
+		if (data->jpeg_scale_denom > 1) {
+			data->cinfo.scale_num = 1;
+			data->cinfo.scale_denom = data->jpeg_scale_denom;
+		}
 		row_pointer[0] = dest;
 		jpeg_start_decompress(&data->cinfo);
+		width = data->cinfo.output_width;
+		height = data->cinfo.output_height;
+		fmt->fmt.pix.width = width;
+		fmt->fmt.pix.height = height;
 		/* Make libjpeg errors report that we've got some data */
 		data->jerr_errno = EPIPE;
 		while (data->cinfo.output_scanline < height) {
 			jpeg_read_scanlines(&data->cinfo, row_pointer, 1);
-			row_pointer[0] += 3 * width;
+#ifndef JCS_EXTENSIONS
+			/* The line got decoded as rgb24 at the start of its
+			   32 bpp line, expand it from there */
+			if (rgb32) {
+				if (dest_pix_fmt == V4L2_PIX_FMT_XBGR32)
+					v4lconvert_swap_rgb(row_pointer[0],
+						row_pointer[0], width, 1);
+				v4lconvert_rgb24_to_rgb32(row_pointer[0],
+					row_pointer[0], width, 1,
+					dest_pix_fmt == V4L2_PIX_FMT_XRGB32);
+			}
+#endif
+			row_pointer[0] += (rgb32 ? 4 : 3) * width;
 		}
 		jpeg_finish_decompress(&data->cinfo);
 #ifndef JCS_EXTENSIONS
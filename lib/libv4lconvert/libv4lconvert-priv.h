@@ -36,8 +36,18 @@
 #include "control/libv4lcontrol.h"
 #include "processing/libv4lprocessing.h"
 #include "tinyjpeg.h"
+#include <cpu-features.h>
 
 #define ARRAY_SIZE(x) ((int)sizeof(x)/(int)sizeof((x)[0]))
+
+/* Alignment of the buffers from v4lconvert_alloc_buffer(), for the SIMD
+   code. If the LIBV4LCONVERT_HUGEPAGES environment variable is set, buffers
+   of at least V4LCONVERT_HUGEPAGE_SIZE get aligned and advised for
+   transparent hugepages instead */
+#define V4LCONVERT_BUF_ALIGN 64
+#define V4LCONVERT_HUGEPAGE_SIZE (2 * 1024 * 1024)
+
+#define V4LCONVERT_CPIA1_FRAME_SIZE (352 * 288 * 3 / 2)
 #define BITS_PER_LONG (8 * sizeof(long))
 
 #define V4LCONVERT_ERROR_MSG_SIZE 256
@@ -51,6 +61,16 @@
 #define V4LCONVERT_IS_UVC                0x01
 #define V4LCONVERT_USE_TINYJPEG          0x02
 
+struct v4lconvert_threads;
+struct v4lconvert_gpu;
+
+/* The supported_src_formats bitmask limits the src formats to 128 */
+#define V4LCONVERT_MAX_SRC_PIXFMTS	128
+/* Conversion costs are kept for converting to rgb and to yuv */
+#define V4LCONVERT_COST_RGB		0
+#define V4LCONVERT_COST_YUV		1
+#define V4LCONVERT_COST_CLASSES		2
+
 struct v4lconvert_data {
 	int fd;
 	int flags; /* bitfield */
@@ -65,6 +85,9 @@ struct v4lconvert_data {
 	jmp_buf jerr_jmp_state;
 	struct jpeg_decompress_struct cinfo;
 	int cinfo_initialized;
+	/* Set by v4lconvert_convert() when libjpeg may decode to RGB at a
+	   1 / jpeg_scale_denom scaled size */
+	int jpeg_scale_denom;
 #endif // HAVE_JPEG
 	struct v4l2_frmsizeenum framesizes[V4LCONVERT_MAX_FRAMESIZES];
 	/* Bitmask of all supported src_formats which can do for a size */
@@ -77,11 +100,20 @@ struct v4lconvert_data {
 	int rotate90_buf_size;
 	int flip_buf_size;
 	int convert_pixfmt_buf_size;
+	int mplane_buf_size;
+	int extra_dst_buf_size;
 	unsigned char *convert1_buf;
 	unsigned char *convert2_buf;
 	unsigned char *rotate90_buf;
 	unsigned char *flip_buf;
 	unsigned char *convert_pixfmt_buf;
+	/* Single plane copy of a multi-planar frame needing further steps */
+	unsigned char *mplane_buf;
+	/* Base format frame of a nv12 / 32 bpp rgb frame needing further steps */
+	unsigned char *extra_dst_buf;
+	/* Formats the above buffers are currently sized for */
+	struct v4l2_pix_format scratch_src_fmt;
+	struct v4l2_pix_format scratch_dest_fmt;
 	struct v4lcontrol_data *control;
 	struct v4lprocessing_data *processing;
 	void *dev_ops_priv;
@@ -91,12 +123,27 @@ struct v4lconvert_data {
 	pid_t decompress_pid;
 	int decompress_in_pipe[2];  /* Data from helper to us */
 	int decompress_out_pipe[2]; /* Data from us to helper */
+	int decompress_shm_fd;      /* Frame data shared with the helper */
+	unsigned char *decompress_shm;
+	size_t decompress_shm_size;
 
 	/* For mr97310a decoder */
 	int frames_dropped;
 
 	/* For cpia1 decoder */
 	unsigned char *previous_frame;
+
+	/* Optional thread pool for converting in bands, may be NULL */
+	struct v4lconvert_threads *threads;
+
+	/* Optional OpenGL ES backend for some conversions, may be NULL */
+	struct v4lconvert_gpu *gpu;
+
+	/* Measured ns per pixel per src format and cost class, 0 if unknown,
+	   only used when calibrate is set */
+	int calibrate;
+	int conv_cost_dirty;
+	float conv_cost[V4LCONVERT_MAX_SRC_PIXFMTS][V4LCONVERT_COST_CLASSES];
 };
 
 struct v4lconvert_pixfmt {
@@ -171,6 +218,20 @@ void v4lconvert_y16_to_yuv420(const unsigned char *src, unsigned char *dest,
 void v4lconvert_rgb32_to_rgb24(const unsigned char *src, unsigned char *dest,
 		int width, int height, int bgr);
 
+/* The padding byte goes before the 3 color bytes with x_first, after them
+   otherwise. src and dest may be the same buffer. */
+void v4lconvert_rgb24_to_rgb32(const unsigned char *src, unsigned char *dest,
+		int width, int height, int x_first);
+
+/* When converting in place (src == dest) tmp must hold width * height / 4
+   bytes, it is not used otherwise */
+void v4lconvert_yuv420_to_nv12(const unsigned char *src, unsigned char *dest,
+		unsigned char *tmp, int width, int height);
+
+void v4lconvert_packed_yuv_to_nv12(const unsigned char *src,
+		unsigned char *dest, int width, int height, int stride,
+		unsigned int src_pix_fmt);
+
 int v4lconvert_y10b_to_rgb24(struct v4lconvert_data *data,
 	const unsigned char *src, unsigned char *dest, int width, int height);
 
@@ -232,8 +293,8 @@ int v4lconvert_decode_jpgl(const unsigned char *src, int src_size,
 void v4lconvert_decode_spca561(const unsigned char *src, unsigned char *dst,
 		int width, int height);
 
-void v4lconvert_decode_sn9c10x(const unsigned char *src, unsigned char *dst,
-		int width, int height);
+void v4lconvert_decode_sn9c10x(const unsigned char *src, int src_size,
+		unsigned char *dst, int width, int height);
 
 int v4lconvert_decode_pac207(struct v4lconvert_data *data,
 		const unsigned char *inp, int src_size, unsigned char *outp,
@@ -256,12 +317,19 @@ void v4lconvert_decode_sq905c(const unsigned char *src, unsigned char *dst,
 void v4lconvert_decode_stv0680(const unsigned char *src, unsigned char *dst,
 		int width, int height);
 
-void v4lconvert_bayer_to_rgb24(const unsigned char *bayer,
+void v4lconvert_bayer_to_rgb24(struct v4lconvert_threads *threads,
+		const unsigned char *bayer,
 		unsigned char *rgb, int width, int height, const unsigned int stride, unsigned int pixfmt);
 
-void v4lconvert_bayer_to_bgr24(const unsigned char *bayer,
+void v4lconvert_bayer_to_bgr24(struct v4lconvert_threads *threads,
+		const unsigned char *bayer,
 		unsigned char *rgb, int width, int height, const unsigned int stride, unsigned int pixfmt);
 
+void v4lconvert_bayer_to_rgb32(struct v4lconvert_threads *threads,
+		const unsigned char *bayer, unsigned char *dest, int width,
+		int height, const unsigned int stride, unsigned int pixfmt,
+		int xbgr);
+
 void v4lconvert_bayer_to_yuv420(const unsigned char *bayer, unsigned char *yuv,
 		int width, int height, const unsigned int stride, unsigned int src_pixfmt, int yvu);
 
@@ -274,14 +342,17 @@ void v4lconvert_bayer10p_to_bayer8(unsigned char *bayer10p,
 void v4lconvert_bayer16_to_bayer8(unsigned char *bayer16,
 		unsigned char *bayer8, int width, int height);
 
-void v4lconvert_hm12_to_rgb24(const unsigned char *src,
-		unsigned char *dst, int width, int height);
+void v4lconvert_hm12_to_rgb24(struct v4lconvert_threads *threads,
+		const unsigned char *src, unsigned char *dst,
+		int width, int height);
 
-void v4lconvert_hm12_to_bgr24(const unsigned char *src,
-		unsigned char *dst, int width, int height);
+void v4lconvert_hm12_to_bgr24(struct v4lconvert_threads *threads,
+		const unsigned char *src, unsigned char *dst,
+		int width, int height);
 
-void v4lconvert_hm12_to_yuv420(const unsigned char *src,
-		unsigned char *dst, int width, int height, int yvu);
+void v4lconvert_hm12_to_yuv420(struct v4lconvert_threads *threads,
+		const unsigned char *src, unsigned char *dst,
+		int width, int height, int yvu);
 
 void v4lconvert_hsv_to_rgb24(const unsigned char *src, unsigned char *dest,
 		int width, int height, int bgr, int Xin, unsigned char hsv_enc);
@@ -292,6 +363,159 @@ void v4lconvert_nv12_to_rgb24(const unsigned char *src, unsigned char *dest,
 void v4lconvert_nv12_to_yuv420(const unsigned char *src, unsigned char *dest,
 		int width, int height, int yvu);
 
+void v4lconvert_nv12m_to_rgb24(const unsigned char *ysrc, int ystride,
+		const unsigned char *uvsrc, int uvstride, unsigned char *dest,
+		int width, int height, int bgr);
+
+void v4lconvert_nv12m_to_yuv420(const unsigned char *ysrc, int ystride,
+		const unsigned char *uvsrc, int uvstride, unsigned char *dest,
+		int width, int height, int yvu);
+
+/* From threads.c, an optional pool of threads used to convert a frame in
+   horizontal bands. It is only created when the LIBV4LCONVERT_THREADS
+   environment variable asks for more than 1 thread (0 means one per cpu),
+   v4lconvert_threads_run() with a NULL pool runs func on the whole frame
+   in the calling thread. */
+#define V4LCONVERT_MAX_THREADS 16
+
+struct v4lconvert_threads *v4lconvert_threads_create(void);
+void v4lconvert_threads_destroy(struct v4lconvert_threads *threads);
+
+/* Splits lines in bands, calls func for them in parallel and waits for all of
+   them to finish, all bands but the last one are a multiple of align
+   lines long */
+void v4lconvert_threads_run(struct v4lconvert_threads *threads,
+		int lines, int align,
+		void (*func)(void *arg, int first, int count), void *arg);
+
+/* From gpu.c, an optional OpenGL ES 3.0 backend for the yuyv, nv12 and
+   8 bit bayer to rgb24 / bgr24 conversions, giving the same result as the
+   cpu code. It is only created when the LIBV4LCONVERT_GPU environment
+   variable is set and libEGL / libGLESv2 can create a surfaceless context.
+   Converting returns -1 if the conversion should be done by the cpu. */
+struct v4lconvert_gpu *v4lconvert_gpu_create(void);
+void v4lconvert_gpu_destroy(struct v4lconvert_gpu *gpu);
+int v4lconvert_gpu_convert(struct v4lconvert_gpu *gpu,
+		const unsigned char *src, int src_size, unsigned char *dest,
+		int width, int height, int bytesperline,
+		unsigned int src_pix_fmt, unsigned int dest_pix_fmt);
+
+/* From fmt-cache.c, an on-disk cache of the formats and framesizes
+   enumerated by v4lconvert_create_with_dev_ops(), so the next opens of the
+   device don't need to enumerate them again. It is only used when the
+   LIBV4LCONVERT_CACHE_DIR environment variable points to a directory.
+   Loading returns 0 if the cache had the device. */
+int v4lconvert_fmt_cache_load(struct v4lconvert_data *data,
+		const struct v4l2_capability *cap, unsigned int no_src_pixfmts,
+		int *needs_conversion);
+void v4lconvert_fmt_cache_store(struct v4lconvert_data *data,
+		const struct v4l2_capability *cap, unsigned int no_src_pixfmts,
+		int needs_conversion);
+
+/* From conv-cost.c, the cost of the conversions measured on this machine,
+   used to rank the src formats instead of their fixed ranks. It is only
+   measured when the LIBV4LCONVERT_CALIBRATE environment variable is set,
+   and kept in LIBV4LCONVERT_CACHE_DIR when that is set too. Updates add
+   the time a conversion of pixels took to a moving average. */
+int v4lconvert_cost_enabled(void);
+void v4lconvert_cost_load(struct v4lconvert_data *data,
+		unsigned int no_src_pixfmts);
+void v4lconvert_cost_store(struct v4lconvert_data *data,
+		unsigned int no_src_pixfmts);
+uint64_t v4lconvert_cost_now(void);
+void v4lconvert_cost_update(struct v4lconvert_data *data, int src_index,
+		int cost_class, uint64_t ns, unsigned int pixels);
+
+/* From cpu-features.c, the CPU_FEATURE_* flags of lib/include/cpu-features.h
+   that the conversion kernels are dispatched on */
+#define V4LCONVERT_CPU_SSE2	CPU_FEATURE_SSE2
+#define V4LCONVERT_CPU_AVX2	CPU_FEATURE_AVX2
+#define V4LCONVERT_CPU_NEON	CPU_FEATURE_NEON
+
+int v4lconvert_get_cpu_flags(void);
+
+/* From rgbyuv-simd.c, the best YUV -> RGB routines for the cpu we run on,
+   v4lconvert_yuv_kernels_c holds the plain C versions from rgbyuv.c */
+struct v4lconvert_yuv_kernels {
+	void (*yuyv_to_rgb24)(const unsigned char *src, unsigned char *dst,
+			int width, int height, int stride);
+	void (*yuyv_to_bgr24)(const unsigned char *src, unsigned char *dst,
+			int width, int height, int stride);
+	void (*yvyu_to_rgb24)(const unsigned char *src, unsigned char *dst,
+			int width, int height, int stride);
+	void (*yvyu_to_bgr24)(const unsigned char *src, unsigned char *dst,
+			int width, int height, int stride);
+	void (*uyvy_to_rgb24)(const unsigned char *src, unsigned char *dst,
+			int width, int height, int stride);
+	void (*uyvy_to_bgr24)(const unsigned char *src, unsigned char *dst,
+			int width, int height, int stride);
+	void (*yuv420_to_rgb24)(const unsigned char *src, unsigned char *dst,
+			int width, int height, int yvu);
+	void (*yuv420_to_bgr24)(const unsigned char *src, unsigned char *dst,
+			int width, int height, int yvu);
+	void (*nv12_to_rgb24)(const unsigned char *src, unsigned char *dst,
+			int width, int height, int bgr);
+	void (*nv12m_to_rgb24)(const unsigned char *ysrc, int ystride,
+			const unsigned char *uvsrc, int uvstride, unsigned char *dst,
+			int width, int height, int bgr);
+};
+
+extern const struct v4lconvert_yuv_kernels v4lconvert_yuv_kernels_c;
+
+const struct v4lconvert_yuv_kernels *v4lconvert_get_yuv_kernels(void);
+
+/* From bayer-simd.c, vectorized versions of the inner loops used by bayer.c
+   for the non border lines. They render (up to) pairs pairs of pixels and
+   return the number of pairs done. */
+struct v4lconvert_bayer_kernels {
+	int (*line_to_rgbbgr24)(const unsigned char *bayer, unsigned char *bgr,
+			int pairs, unsigned int stride, int blue_line);
+	int (*line_to_y)(const unsigned char *bayer, unsigned char *y,
+			int pairs, unsigned int stride, int blue_line);
+};
+
+const struct v4lconvert_bayer_kernels *v4lconvert_get_bayer_kernels(void);
+
+/* From unpack-simd.c, vectorized versions of the loops reducing 10 and 16 bit
+   samples to 8 bits, and of splitting interleaved chroma. They do (up to) pixels pixels and return the number of
+   pixels done. */
+struct v4lconvert_unpack_kernels {
+	/* Little endian 16 bit samples, dst = (sample >> shift) & 0xff */
+	int (*u16_to_8)(const unsigned char *src, unsigned char *dst,
+			int pixels, int shift);
+	/* The 8 msb of Y10B */
+	int (*y10b_to_8)(const unsigned char *src, unsigned char *dst,
+			int pixels);
+	/* The 8 msb of the MIPI 10 bit packed Bayer formats */
+	int (*raw10p_to_8)(const unsigned char *src, unsigned char *dst,
+			int pixels);
+	int (*grey_to_rgb24)(const unsigned char *src, unsigned char *dst,
+			int pixels);
+	/* u[i] = src[2 * i], v[i] = src[2 * i + 1] */
+	int (*split_uv)(const unsigned char *src, unsigned char *u,
+			unsigned char *v, int pairs);
+};
+
+const struct v4lconvert_unpack_kernels *v4lconvert_get_unpack_kernels(void);
+
+/* From flip-simd.c, vectorized versions of the inner loops of flip.c */
+struct v4lconvert_flip_kernels {
+	/* Copy (up to) n 8 / 24 bpp pixels before src_end to dst in reverse
+	   order, returns the number of pixels done */
+	int (*reverse_8)(const unsigned char *src_end, unsigned char *dst,
+			int n);
+	int (*reverse_24)(const unsigned char *src_end, unsigned char *dst,
+			int n);
+	/* dst[y * dst_stride + x] = src[x * src_stride + y] for a 8x8 block */
+	void (*rotate90_8x8)(const unsigned char *src, int src_stride,
+			unsigned char *dst, int dst_stride);
+	/* The same for 8x8 RGB24 pixels, the strides are in bytes */
+	void (*rotate90_8x8_24)(const unsigned char *src, int src_stride,
+			unsigned char *dst, int dst_stride);
+};
+
+const struct v4lconvert_flip_kernels *v4lconvert_get_flip_kernels(void);
+
 void v4lconvert_rotate90(unsigned char *src, unsigned char *dest,
 		struct v4l2_format *fmt);
 
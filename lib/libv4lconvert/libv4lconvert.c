@@ -25,11 +25,13 @@
 #include <string.h>
 #include <stdlib.h>
 #include <unistd.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 #include "libv4lconvert.h"
 #include "libv4lconvert-priv.h"
 #include "libv4lsyscall-priv.h"
+#include "libv4ltrace-priv.h"
 
 #define MIN(a, b) (((a) < (b)) ? (a) : (b))
 #define BIT_MASK(nr) (1UL << ((nr) % BITS_PER_LONG))
@@ -96,6 +98,7 @@ const struct libv4l_dev_ops *v4lconvert_get_default_dev_ops()
 
 static void v4lconvert_get_framesizes(struct v4lconvert_data *data,
 		unsigned int pixelformat, int index);
+static void v4lconvert_calibrate(struct v4lconvert_data *data);
 
 /*
  * Notes:
@@ -112,7 +115,10 @@ static void v4lconvert_get_framesizes(struct v4lconvert_data *data,
 	{ V4L2_PIX_FMT_RGB24,		24,	 1,	 5,	0 }, \
 	{ V4L2_PIX_FMT_BGR24,		24,	 1,	 5,	0 }, \
 	{ V4L2_PIX_FMT_YUV420,		12,	 6,	 1,	0 }, \
-	{ V4L2_PIX_FMT_YVU420,		12,	 6,	 1,	0 }
+	{ V4L2_PIX_FMT_YVU420,		12,	 6,	 1,	0 }, \
+	{ V4L2_PIX_FMT_NV12,		12,	 6,	 3,	1 }, \
+	{ V4L2_PIX_FMT_XRGB32,		32,	 4,	 6,	0 }, \
+	{ V4L2_PIX_FMT_XBGR32,		32,	 4,	 6,	0 }
 
 static const struct v4lconvert_pixfmt supported_src_pixfmts[] = {
 	SUPPORTED_DST_PIXFMTS,
@@ -120,8 +126,6 @@ static const struct v4lconvert_pixfmt supported_src_pixfmts[] = {
 	{ V4L2_PIX_FMT_RGB565,		16,	 4,	 6,	0 },
 	{ V4L2_PIX_FMT_BGR32,		32,	 4,	 6,	0 },
 	{ V4L2_PIX_FMT_RGB32,		32,	 4,	 6,	0 },
-	{ V4L2_PIX_FMT_XBGR32,		32,	 4,	 6,	0 },
-	{ V4L2_PIX_FMT_XRGB32,		32,	 4,	 6,	0 },
 	{ V4L2_PIX_FMT_ABGR32,		32,	 4,	 6,	0 },
 	{ V4L2_PIX_FMT_ARGB32,		32,	 4,	 6,	0 },
 	/* yuv 4:2:2 formats */
@@ -139,7 +143,6 @@ static const struct v4lconvert_pixfmt supported_src_pixfmts[] = {
 	{ V4L2_PIX_FMT_SN9C20X_I420,	12,	 6,	 3,	1 },
 	{ V4L2_PIX_FMT_M420,		12,	 6,	 3,	1 },
 	{ V4L2_PIX_FMT_HM12,		12,	 6,	 3,	1 },
-	{ V4L2_PIX_FMT_NV12,		12,	 6,	 3,	1 },
 	{ V4L2_PIX_FMT_CPIA1,		 0,	 6,	 3,	1 },
 	/* JPEG and variants */
 	{ V4L2_PIX_FMT_MJPEG,		 0,	 7,	 7,	0 },
@@ -228,6 +231,7 @@ struct v4lconvert_data *v4lconvert_create_with_dev_ops(int fd, void *dev_ops_pri
 	 * performance impact.
 	 */
 	int always_needs_conversion = 1;
+	int got_cap, needs_conversion;
 
 	if (!data) {
 		fprintf(stderr, "libv4lconvert: error: out of memory!\n");
@@ -238,8 +242,19 @@ struct v4lconvert_data *v4lconvert_create_with_dev_ops(int fd, void *dev_ops_pri
 	data->dev_ops = dev_ops;
 	data->dev_ops_priv = dev_ops_priv;
 	data->decompress_pid = -1;
+	data->decompress_shm_fd = -1;
 	data->fps = 30;
 
+	got_cap = data->dev_ops->ioctl(data->dev_ops_priv, data->fd,
+			VIDIOC_QUERYCAP, &cap) == 0;
+
+	/* Use the formats enumerated by a previous open, if cached */
+	if (got_cap && !v4lconvert_fmt_cache_load(data, &cap,
+			ARRAY_SIZE(supported_src_pixfmts), &needs_conversion)) {
+		always_needs_conversion = needs_conversion;
+		goto got_formats;
+	}
+
 	/* Check supported formats */
 	for (i = 0; ; i++) {
 		struct v4l2_fmtdesc fmt = { .type = V4L2_BUF_TYPE_VIDEO_CAPTURE };
@@ -264,10 +279,14 @@ struct v4lconvert_data *v4lconvert_create_with_dev_ops(int fd, void *dev_ops_pri
 	}
 
 	data->no_formats = i;
+	if (got_cap)
+		v4lconvert_fmt_cache_store(data, &cap,
+				ARRAY_SIZE(supported_src_pixfmts),
+				always_needs_conversion);
 
+got_formats:
 	/* Check if this cam has any special flags */
-	if (data->dev_ops->ioctl(data->dev_ops_priv, data->fd,
-			VIDIOC_QUERYCAP, &cap) == 0) {
+	if (got_cap) {
 		if (!strcmp((char *)cap.driver, "uvcvideo"))
 			data->flags |= V4LCONVERT_IS_UVC;
 
@@ -295,6 +314,15 @@ struct v4lconvert_data *v4lconvert_create_with_dev_ops(int fd, void *dev_ops_pri
 		return NULL;
 	}
 
+	/* Opt-in, NULL (convert in the calling thread) unless enabled */
+	data->threads = v4lconvert_threads_create();
+	data->gpu = v4lconvert_gpu_create();
+
+	/* Opt-in too, as measuring the conversions takes some time */
+	data->calibrate = v4lconvert_cost_enabled();
+	if (data->calibrate)
+		v4lconvert_calibrate(data);
+
 	return data;
 }
 
@@ -303,6 +331,10 @@ void v4lconvert_destroy(struct v4lconvert_data *data)
 	if (!data)
 		return;
 
+	if (data->conv_cost_dirty)
+		v4lconvert_cost_store(data, ARRAY_SIZE(supported_src_pixfmts));
+	v4lconvert_gpu_destroy(data->gpu);
+	v4lconvert_threads_destroy(data->threads);
 	v4lprocessing_destroy(data->processing);
 	v4lcontrol_destroy(data->control);
 	if (data->tinyjpeg) {
@@ -323,6 +355,8 @@ void v4lconvert_destroy(struct v4lconvert_data *data)
 	free(data->rotate90_buf);
 	free(data->flip_buf);
 	free(data->convert_pixfmt_buf);
+	free(data->mplane_buf);
+	free(data->extra_dst_buf);
 	free(data->previous_frame);
 	free(data);
 }
@@ -405,28 +439,49 @@ int v4lconvert_enum_fmt(struct v4lconvert_data *data, struct v4l2_fmtdesc *fmt)
    except when all of them cause this.
    
    Note grey scale formats start at 20 rather than 1-10, because we want to
-   never autoselect them, unless they are the only choice */
+   never autoselect them, unless they are the only choice.
+
+   When calibrating, a src format for which the conversion cost has been
+   measured gets the share of a cpu its conversion takes at the requested
+   size and fps as initial rank instead, in steps of 10%, so that cheap
+   conversions from bigger formats win as long as the bandwidth allows. */
 static int v4lconvert_get_rank(struct v4lconvert_data *data,
 	int src_index, int src_width, int src_height,
 	unsigned int dest_pixelformat)
 {
-	int needed, rank = 0;
+	int needed, rank = 0, cost_class = -1;
 
 	switch (dest_pixelformat) {
 	case V4L2_PIX_FMT_RGB24:
 	case V4L2_PIX_FMT_BGR24:
+	case V4L2_PIX_FMT_XRGB32:
+	case V4L2_PIX_FMT_XBGR32:
 		rank = supported_src_pixfmts[src_index].rgb_rank;
+		cost_class = V4LCONVERT_COST_RGB;
 		break;
 	case V4L2_PIX_FMT_YUV420:
 	case V4L2_PIX_FMT_YVU420:
+	case V4L2_PIX_FMT_NV12:
 		rank = supported_src_pixfmts[src_index].yuv_rank;
+		cost_class = V4LCONVERT_COST_YUV;
 		break;
 	}
 
+	if (data->calibrate && cost_class >= 0 &&
+	    data->conv_cost[src_index][cost_class] > 0) {
+		double load = data->conv_cost[src_index][cost_class] *
+			      src_width * src_height * data->fps / 1e9;
+		int steps = load * 10;
+
+		rank = (rank >= 20 ? 20 : 0) + 1 + (steps > 9 ? 9 : steps);
+	}
+
 	/* So that if both rgb32 and bgr32 are supported, or both yuv420 and
-	   yvu420 the right one wins */
+	   yvu420 the right one wins. Not converting at all beats any
+	   conversion, also for the nv12 and 32 bpp rgb dest formats whose
+	   src ranks are higher. */
 	if (supported_src_pixfmts[src_index].fmt == dest_pixelformat)
-		rank--;
+		rank = 0;
 
 	/* check bandwidth needed */
 	needed = src_width * src_height * data->fps *
@@ -575,9 +630,15 @@ void v4lconvert_fixup_fmt(struct v4l2_format *fmt)
 		break;
 	case V4L2_PIX_FMT_YUV420:
 	case V4L2_PIX_FMT_YVU420:
+	case V4L2_PIX_FMT_NV12:
 		fmt->fmt.pix.bytesperline = fmt->fmt.pix.width;
 		fmt->fmt.pix.sizeimage = fmt->fmt.pix.width * fmt->fmt.pix.height * 3 / 2;
 		break;
+	case V4L2_PIX_FMT_XRGB32:
+	case V4L2_PIX_FMT_XBGR32:
+		fmt->fmt.pix.bytesperline = fmt->fmt.pix.width * 4;
+		fmt->fmt.pix.sizeimage = fmt->fmt.pix.width * fmt->fmt.pix.height * 4;
+		break;
 	}
 }
 
@@ -756,18 +817,81 @@ static int v4lconvert_processing_needs_double_conversion(
 unsigned char *v4lconvert_alloc_buffer(int needed,
 		unsigned char **buf, int *buf_size)
 {
+	size_t align = V4LCONVERT_BUF_ALIGN;
+	void *p;
+
 	if (*buf_size < needed) {
 		free(*buf);
-		*buf = malloc(needed);
-		if (*buf == NULL) {
-			*buf_size = 0;
-			return NULL;
+		*buf = NULL;
+		*buf_size = 0;
+#ifdef MADV_HUGEPAGE
+		if (needed >= V4LCONVERT_HUGEPAGE_SIZE &&
+		    getenv("LIBV4LCONVERT_HUGEPAGES")) {
+			align = V4LCONVERT_HUGEPAGE_SIZE;
+			needed = (needed + align - 1) & ~(align - 1);
 		}
+#endif
+		if (posix_memalign(&p, align, needed))
+			return NULL;
+#ifdef MADV_HUGEPAGE
+		if (align == V4LCONVERT_HUGEPAGE_SIZE)
+			madvise(p, needed, MADV_HUGEPAGE);
+#endif
+		*buf = p;
 		*buf_size = needed;
 	}
 	return *buf;
 }
 
+/* The intermediate buffers only ever grow, so release them when the formats
+   change, to have them sized for the new formats by the next conversion */
+static void v4lconvert_check_scratch_fmt(struct v4lconvert_data *data,
+		const struct v4l2_format *src_fmt,
+		const struct v4l2_format *dest_fmt)
+{
+	if (data->scratch_src_fmt.width == src_fmt->fmt.pix.width &&
+	    data->scratch_src_fmt.height == src_fmt->fmt.pix.height &&
+	    data->scratch_src_fmt.pixelformat == src_fmt->fmt.pix.pixelformat &&
+	    data->scratch_dest_fmt.width == dest_fmt->fmt.pix.width &&
+	    data->scratch_dest_fmt.height == dest_fmt->fmt.pix.height &&
+	    data->scratch_dest_fmt.pixelformat == dest_fmt->fmt.pix.pixelformat)
+		return;
+
+	free(data->convert1_buf);
+	free(data->convert2_buf);
+	free(data->rotate90_buf);
+	free(data->flip_buf);
+	free(data->convert_pixfmt_buf);
+	data->convert1_buf = NULL;
+	data->convert2_buf = NULL;
+	data->rotate90_buf = NULL;
+	data->flip_buf = NULL;
+	data->convert_pixfmt_buf = NULL;
+	data->convert1_buf_size = 0;
+	data->convert2_buf_size = 0;
+	data->rotate90_buf_size = 0;
+	data->flip_buf_size = 0;
+	data->convert_pixfmt_buf_size = 0;
+
+	data->scratch_src_fmt = src_fmt->fmt.pix;
+	data->scratch_dest_fmt = dest_fmt->fmt.pix;
+}
+
+size_t v4lconvert_get_scratch_size(struct v4lconvert_data *data)
+{
+	size_t size;
+
+	size = data->convert1_buf_size + data->convert2_buf_size +
+		data->rotate90_buf_size + data->flip_buf_size +
+		data->convert_pixfmt_buf_size + data->mplane_buf_size +
+		data->extra_dst_buf_size;
+	size += data->decompress_shm_size;
+	if (data->previous_frame)
+		size += V4LCONVERT_CPIA1_FRAME_SIZE;
+
+	return size;
+}
+
 int v4lconvert_oom_error(struct v4lconvert_data *data)
 {
 	V4LCONVERT_ERR("could not allocate memory\n");
@@ -775,6 +899,142 @@ int v4lconvert_oom_error(struct v4lconvert_data *data)
 	return -1;
 }
 
+struct v4lconvert_packed_yuv_job {
+	void (*func)(const unsigned char *src, unsigned char *dst,
+			int width, int height, int stride);
+	const unsigned char *src;
+	unsigned char *dest;
+	int width;
+	int stride;
+	/* 3, or 4 for 32 bpp output with the padding byte first or last */
+	int pixel_size;
+	int x_first;
+};
+
+static void v4lconvert_packed_yuv_band(void *arg, int first, int count)
+{
+	struct v4lconvert_packed_yuv_job *job = arg;
+	int i;
+
+	if (job->pixel_size == 3) {
+		job->func(job->src + first * job->stride,
+				job->dest + first * job->width * 3,
+				job->width, count, job->stride);
+		return;
+	}
+
+	/* Convert each line at the start of its 32 bpp line, and expand it
+	   from there while it is still in the cache */
+	for (i = first; i < first + count; i++) {
+		unsigned char *line = job->dest + i * job->width * 4;
+
+		job->func(job->src + i * job->stride, line, job->width, 1,
+				job->stride);
+		v4lconvert_rgb24_to_rgb32(line, line, job->width, 1,
+				job->x_first);
+	}
+}
+
+/* Packed yuv lines convert independently, so split the frame over the
+   thread pool (if any) */
+static void v4lconvert_packed_yuv_to_rgb(struct v4lconvert_data *data,
+		void (*func)(const unsigned char *src, unsigned char *dst,
+			int width, int height, int stride),
+		const unsigned char *src, unsigned char *dest,
+		int width, int height, int stride)
+{
+	struct v4lconvert_packed_yuv_job job = {
+		.func = func,
+		.src = src,
+		.dest = dest,
+		.width = width,
+		.stride = stride,
+		.pixel_size = 3,
+	};
+
+	v4lconvert_threads_run(data->threads, height, 1,
+			v4lconvert_packed_yuv_band, &job);
+}
+
+/* Padding byte first for XRGB32, last for XBGR32 */
+static void v4lconvert_packed_yuv_to_rgb32(struct v4lconvert_data *data,
+		unsigned int src_pix_fmt, const unsigned char *src,
+		unsigned char *dest, int width, int height, int stride, int xbgr)
+{
+	const struct v4lconvert_yuv_kernels *yuv = v4lconvert_get_yuv_kernels();
+	struct v4lconvert_packed_yuv_job job = {
+		.src = src,
+		.dest = dest,
+		.width = width,
+		.stride = stride,
+		.pixel_size = 4,
+		.x_first = !xbgr,
+	};
+
+	switch (src_pix_fmt) {
+	case V4L2_PIX_FMT_YUYV:
+		job.func = xbgr ? yuv->yuyv_to_bgr24 : yuv->yuyv_to_rgb24;
+		break;
+	case V4L2_PIX_FMT_YVYU:
+		job.func = xbgr ? yuv->yvyu_to_bgr24 : yuv->yvyu_to_rgb24;
+		break;
+	case V4L2_PIX_FMT_UYVY:
+		job.func = xbgr ? yuv->uyvy_to_bgr24 : yuv->uyvy_to_rgb24;
+		break;
+	}
+
+	v4lconvert_threads_run(data->threads, height, 1,
+			v4lconvert_packed_yuv_band, &job);
+}
+
+/* The nv12 and 32 bpp rgb dest formats are written directly from the
+   common src formats, from all others they are repacked from the yuv420
+   resp. rgb24 / bgr24 base format in place. All other steps (processing,
+   flipping, etc.) happen on the base format. */
+static unsigned int v4lconvert_extra_dst_base(unsigned int pixelformat)
+{
+	switch (pixelformat) {
+	case V4L2_PIX_FMT_NV12:
+		return V4L2_PIX_FMT_YUV420;
+	case V4L2_PIX_FMT_XRGB32:
+		return V4L2_PIX_FMT_RGB24;
+	case V4L2_PIX_FMT_XBGR32:
+		return V4L2_PIX_FMT_BGR24;
+	}
+	return 0;
+}
+
+/* Repack a frame of the base format, src may be dest */
+static int v4lconvert_repack_extra_dst(struct v4lconvert_data *data,
+		const unsigned char *src, unsigned char *dest, int width,
+		int height, unsigned int dest_pix_fmt)
+{
+	unsigned char *tmp = NULL;
+
+	switch (dest_pix_fmt) {
+	case V4L2_PIX_FMT_NV12:
+		if (src == dest) {
+			tmp = v4lconvert_alloc_buffer(width * height / 4,
+					&data->convert_pixfmt_buf,
+					&data->convert_pixfmt_buf_size);
+			if (!tmp)
+				return v4lconvert_oom_error(data);
+		}
+		v4lconvert_yuv420_to_nv12(src, dest, tmp, width, height);
+		break;
+	case V4L2_PIX_FMT_XRGB32:
+	case V4L2_PIX_FMT_XBGR32:
+		v4lconvert_rgb24_to_rgb32(src, dest, width, height,
+				dest_pix_fmt == V4L2_PIX_FMT_XRGB32);
+		break;
+	}
+	return 0;
+}
+
+static int v4lconvert_convert_extra_dst(struct v4lconvert_data *data,
+	unsigned char *src, int src_size, unsigned char *dest, int dest_size,
+	struct v4l2_format *fmt, unsigned int dest_pix_fmt);
+
 static int v4lconvert_convert_pixfmt(struct v4lconvert_data *data,
 	unsigned char *src, int src_size, unsigned char *dest, int dest_size,
 	struct v4l2_format *fmt, unsigned int dest_pix_fmt)
@@ -784,6 +1044,16 @@ static int v4lconvert_convert_pixfmt(struct v4lconvert_data *data,
 	unsigned int width  = fmt->fmt.pix.width;
 	unsigned int height = fmt->fmt.pix.height;
 	unsigned int bytesperline = fmt->fmt.pix.bytesperline;
+	const struct v4lconvert_yuv_kernels *yuv = v4lconvert_get_yuv_kernels();
+
+	if (v4lconvert_extra_dst_base(dest_pix_fmt))
+		return v4lconvert_convert_extra_dst(data, src, src_size,
+				dest, dest_size, fmt, dest_pix_fmt);
+
+	if (data->gpu && !v4lconvert_gpu_convert(data->gpu, src, src_size,
+				dest, width, height, bytesperline,
+				src_pix_fmt, dest_pix_fmt))
+		return 0;
 
 	switch (src_pix_fmt) {
 	/* JPG and variants */
@@ -904,11 +1174,11 @@ static int v4lconvert_convert_pixfmt(struct v4lconvert_data *data,
 
 		switch (dest_pix_fmt) {
 		case V4L2_PIX_FMT_RGB24:
-			v4lconvert_yuv420_to_rgb24(data->convert_pixfmt_buf, dest, width,
+			yuv->yuv420_to_rgb24(data->convert_pixfmt_buf, dest, width,
 					height, yvu);
 			break;
 		case V4L2_PIX_FMT_BGR24:
-			v4lconvert_yuv420_to_bgr24(data->convert_pixfmt_buf, dest, width,
+			yuv->yuv420_to_bgr24(data->convert_pixfmt_buf, dest, width,
 					height, yvu);
 			break;
 		}
@@ -919,16 +1189,20 @@ static int v4lconvert_convert_pixfmt(struct v4lconvert_data *data,
 	case V4L2_PIX_FMT_HM12:
 		switch (dest_pix_fmt) {
 		case V4L2_PIX_FMT_RGB24:
-			v4lconvert_hm12_to_rgb24(src, dest, width, height);
+			v4lconvert_hm12_to_rgb24(data->threads, src, dest,
+						 width, height);
 			break;
 		case V4L2_PIX_FMT_BGR24:
-			v4lconvert_hm12_to_bgr24(src, dest, width, height);
+			v4lconvert_hm12_to_bgr24(data->threads, src, dest,
+						 width, height);
 			break;
 		case V4L2_PIX_FMT_YUV420:
-			v4lconvert_hm12_to_yuv420(src, dest, width, height, 0);
+			v4lconvert_hm12_to_yuv420(data->threads, src, dest,
+						  width, height, 0);
 			break;
 		case V4L2_PIX_FMT_YVU420:
-			v4lconvert_hm12_to_yuv420(src, dest, width, height, 1);
+			v4lconvert_hm12_to_yuv420(data->threads, src, dest,
+						  width, height, 1);
 			break;
 		}
 		break;
@@ -937,10 +1211,10 @@ static int v4lconvert_convert_pixfmt(struct v4lconvert_data *data,
 	case V4L2_PIX_FMT_NV12:
 		switch (dest_pix_fmt) {
 		case V4L2_PIX_FMT_RGB24:
-			v4lconvert_nv12_to_rgb24(src, dest, width, height, 0);
+			yuv->nv12_to_rgb24(src, dest, width, height, 0);
 			break;
 		case V4L2_PIX_FMT_BGR24:
-			v4lconvert_nv12_to_rgb24(src, dest, width, height, 1);
+			yuv->nv12_to_rgb24(src, dest, width, height, 1);
 			break;
 		case V4L2_PIX_FMT_YUV420:
 			v4lconvert_nv12_to_yuv420(src, dest, width, height, 0);
@@ -976,7 +1250,8 @@ static int v4lconvert_convert_pixfmt(struct v4lconvert_data *data,
 			tmpfmt.fmt.pix.pixelformat = V4L2_PIX_FMT_SGBRG8;
 			break;
 		case V4L2_PIX_FMT_SN9C10X:
-			v4lconvert_decode_sn9c10x(src, tmpbuf, width, height);
+			v4lconvert_decode_sn9c10x(src, src_size, tmpbuf, width,
+						  height);
 			tmpfmt.fmt.pix.pixelformat = V4L2_PIX_FMT_SBGGR8;
 			break;
 		case V4L2_PIX_FMT_PAC207:
@@ -1158,10 +1433,12 @@ static int v4lconvert_convert_pixfmt(struct v4lconvert_data *data,
 		}
 		switch (dest_pix_fmt) {
 		case V4L2_PIX_FMT_RGB24:
-			v4lconvert_bayer_to_rgb24(src, dest, width, height, bytesperline, src_pix_fmt);
+			v4lconvert_bayer_to_rgb24(data->threads, src, dest, width, height,
+					bytesperline, src_pix_fmt);
 			break;
 		case V4L2_PIX_FMT_BGR24:
-			v4lconvert_bayer_to_bgr24(src, dest, width, height, bytesperline, src_pix_fmt);
+			v4lconvert_bayer_to_bgr24(data->threads, src, dest, width, height,
+					bytesperline, src_pix_fmt);
 			break;
 		case V4L2_PIX_FMT_YUV420:
 			v4lconvert_bayer_to_yuv420(src, dest, width, height, bytesperline, src_pix_fmt, 0);
@@ -1397,11 +1674,11 @@ static int v4lconvert_convert_pixfmt(struct v4lconvert_data *data,
 		}
 		switch (dest_pix_fmt) {
 		case V4L2_PIX_FMT_RGB24:
-			v4lconvert_yuv420_to_rgb24(src, dest, width,
+			yuv->yuv420_to_rgb24(src, dest, width,
 					height, 0);
 			break;
 		case V4L2_PIX_FMT_BGR24:
-			v4lconvert_yuv420_to_bgr24(src, dest, width,
+			yuv->yuv420_to_bgr24(src, dest, width,
 					height, 0);
 			break;
 		case V4L2_PIX_FMT_YUV420:
@@ -1421,11 +1698,11 @@ static int v4lconvert_convert_pixfmt(struct v4lconvert_data *data,
 		}
 		switch (dest_pix_fmt) {
 		case V4L2_PIX_FMT_RGB24:
-			v4lconvert_yuv420_to_rgb24(src, dest, width,
+			yuv->yuv420_to_rgb24(src, dest, width,
 					height, 1);
 			break;
 		case V4L2_PIX_FMT_BGR24:
-			v4lconvert_yuv420_to_bgr24(src, dest, width,
+			yuv->yuv420_to_bgr24(src, dest, width,
 					height, 1);
 			break;
 		case V4L2_PIX_FMT_YUV420:
@@ -1459,10 +1736,12 @@ static int v4lconvert_convert_pixfmt(struct v4lconvert_data *data,
 		}
 		switch (dest_pix_fmt) {
 		case V4L2_PIX_FMT_RGB24:
-			v4lconvert_yuyv_to_rgb24(src, dest, width, height, bytesperline);
+			v4lconvert_packed_yuv_to_rgb(data, yuv->yuyv_to_rgb24, src, dest,
+					width, height, bytesperline);
 			break;
 		case V4L2_PIX_FMT_BGR24:
-			v4lconvert_yuyv_to_bgr24(src, dest, width, height, bytesperline);
+			v4lconvert_packed_yuv_to_rgb(data, yuv->yuyv_to_bgr24, src, dest,
+					width, height, bytesperline);
 			break;
 		case V4L2_PIX_FMT_YUV420:
 			v4lconvert_yuyv_to_yuv420(src, dest, width, height, bytesperline, 0);
@@ -1496,10 +1775,12 @@ static int v4lconvert_convert_pixfmt(struct v4lconvert_data *data,
 		}
 		switch (dest_pix_fmt) {
 		case V4L2_PIX_FMT_RGB24:
-			v4lconvert_yvyu_to_rgb24(src, dest, width, height, bytesperline);
+			v4lconvert_packed_yuv_to_rgb(data, yuv->yvyu_to_rgb24, src, dest,
+					width, height, bytesperline);
 			break;
 		case V4L2_PIX_FMT_BGR24:
-			v4lconvert_yvyu_to_bgr24(src, dest, width, height, bytesperline);
+			v4lconvert_packed_yuv_to_rgb(data, yuv->yvyu_to_bgr24, src, dest,
+					width, height, bytesperline);
 			break;
 		case V4L2_PIX_FMT_YUV420:
 			/* Note we use yuyv_to_yuv420 not v4lconvert_yvyu_to_yuv420,
@@ -1520,10 +1801,12 @@ static int v4lconvert_convert_pixfmt(struct v4lconvert_data *data,
 		}
 		switch (dest_pix_fmt) {
 		case V4L2_PIX_FMT_RGB24:
-			v4lconvert_uyvy_to_rgb24(src, dest, width, height, bytesperline);
+			v4lconvert_packed_yuv_to_rgb(data, yuv->uyvy_to_rgb24, src, dest,
+					width, height, bytesperline);
 			break;
 		case V4L2_PIX_FMT_BGR24:
-			v4lconvert_uyvy_to_bgr24(src, dest, width, height, bytesperline);
+			v4lconvert_packed_yuv_to_rgb(data, yuv->uyvy_to_bgr24, src, dest,
+					width, height, bytesperline);
 			break;
 		case V4L2_PIX_FMT_YUV420:
 			v4lconvert_uyvy_to_yuv420(src, dest, width, height, bytesperline, 0);
@@ -1605,7 +1888,282 @@ static int v4lconvert_convert_pixfmt(struct v4lconvert_data *data,
 	return result;
 }
 
-int v4lconvert_convert(struct v4lconvert_data *data,
+static int v4lconvert_convert_extra_dst(struct v4lconvert_data *data,
+	unsigned char *src, int src_size, unsigned char *dest, int dest_size,
+	struct v4l2_format *fmt, unsigned int dest_pix_fmt)
+{
+	int result = 0;
+	unsigned int src_pix_fmt = fmt->fmt.pix.pixelformat;
+	unsigned int width  = fmt->fmt.pix.width;
+	unsigned int height = fmt->fmt.pix.height;
+	unsigned int bytesperline = fmt->fmt.pix.bytesperline;
+	int xbgr = dest_pix_fmt == V4L2_PIX_FMT_XBGR32;
+
+	switch (src_pix_fmt) {
+	case V4L2_PIX_FMT_YUYV:
+	case V4L2_PIX_FMT_YVYU:
+	case V4L2_PIX_FMT_UYVY:
+		if (src_size < (width * height * 2)) {
+			V4LCONVERT_ERR("short packed yuv data frame\n");
+			errno = EPIPE;
+			result = -1;
+		}
+		if (dest_pix_fmt == V4L2_PIX_FMT_NV12)
+			v4lconvert_packed_yuv_to_nv12(src, dest, width, height,
+					bytesperline, src_pix_fmt);
+		else
+			v4lconvert_packed_yuv_to_rgb32(data, src_pix_fmt, src,
+					dest, width, height, bytesperline, xbgr);
+		break;
+
+	case V4L2_PIX_FMT_SBGGR8:
+	case V4L2_PIX_FMT_SGBRG8:
+	case V4L2_PIX_FMT_SGRBG8:
+	case V4L2_PIX_FMT_SRGGB8:
+		if (dest_pix_fmt == V4L2_PIX_FMT_NV12)
+			goto repack;
+		if (src_size < (width * height)) {
+			V4LCONVERT_ERR("short raw bayer data frame\n");
+			errno = EPIPE;
+			result = -1;
+		}
+		v4lconvert_bayer_to_rgb32(data->threads, src, dest, width,
+				height, bytesperline, src_pix_fmt, xbgr);
+		break;
+
+#ifdef HAVE_JPEG
+	case V4L2_PIX_FMT_MJPEG:
+	case V4L2_PIX_FMT_JPEG:
+		/* libjpeg decodes to 32 bpp rgb directly, any other decoding
+		   is done by decoding to the base format */
+		if (dest_pix_fmt == V4L2_PIX_FMT_NV12 ||
+		    (data->flags & V4LCONVERT_USE_TINYJPEG))
+			goto repack;
+		result = v4lconvert_decode_jpeg_libjpeg(data, src, src_size,
+				dest, fmt, dest_pix_fmt);
+		if (result == -1 && errno == EOPNOTSUPP) {
+			jpeg_destroy_decompress(&data->cinfo);
+			data->cinfo_initialized = 0;
+			data->flags |= V4LCONVERT_USE_TINYJPEG;
+			goto repack;
+		}
+		break;
+#endif
+
+	default:
+repack:
+		result = v4lconvert_convert_pixfmt(data, src, src_size, dest,
+				dest_size, fmt, v4lconvert_extra_dst_base(dest_pix_fmt));
+		if (result)
+			return result;
+		if (v4lconvert_repack_extra_dst(data, dest, dest,
+				fmt->fmt.pix.width, fmt->fmt.pix.height,
+				dest_pix_fmt))
+			return -1;
+		break;
+	}
+
+	fmt->fmt.pix.pixelformat = dest_pix_fmt;
+	v4lconvert_fixup_fmt(fmt);
+
+	return result;
+}
+
+static int v4lconvert_get_src_index(unsigned int pixelformat)
+{
+	int i;
+
+	for (i = 0; i < ARRAY_SIZE(supported_src_pixfmts); i++)
+		if (supported_src_pixfmts[i].fmt == pixelformat)
+			return i;
+	return -1;
+}
+
+/* v4lconvert_convert_pixfmt(), measuring how long it takes when calibrating */
+static int v4lconvert_convert_pixfmt_measured(struct v4lconvert_data *data,
+	unsigned char *src, int src_size, unsigned char *dest, int dest_size,
+	struct v4l2_format *fmt, unsigned int dest_pix_fmt)
+{
+	int src_index, pixels = fmt->fmt.pix.width * fmt->fmt.pix.height;
+	uint64_t start;
+	int res;
+
+	if (!data->calibrate)
+		return v4lconvert_convert_pixfmt(data, src, src_size, dest,
+				dest_size, fmt, dest_pix_fmt);
+
+	src_index = v4lconvert_get_src_index(fmt->fmt.pix.pixelformat);
+	start = v4lconvert_cost_now();
+	res = v4lconvert_convert_pixfmt(data, src, src_size, dest, dest_size,
+			fmt, dest_pix_fmt);
+	if (!res && src_index >= 0)
+		v4lconvert_cost_update(data, src_index,
+				(dest_pix_fmt == V4L2_PIX_FMT_YUV420 ||
+				 dest_pix_fmt == V4L2_PIX_FMT_YVU420 ||
+				 dest_pix_fmt == V4L2_PIX_FMT_NV12) ?
+				V4LCONVERT_COST_YUV : V4LCONVERT_COST_RGB,
+				v4lconvert_cost_now() - start, pixels);
+	return res;
+}
+
+/* Measure the conversions from the uncompressed src formats the device
+   has, from a blank frame. Compressed formats can only be measured when
+   converting real frames. */
+static void v4lconvert_calibrate(struct v4lconvert_data *data)
+{
+	static const unsigned int dest_fmts[V4LCONVERT_COST_CLASSES][2] = {
+		[V4LCONVERT_COST_RGB] = { V4L2_PIX_FMT_RGB24, V4L2_PIX_FMT_BGR24 },
+		[V4LCONVERT_COST_YUV] = { V4L2_PIX_FMT_YUV420, V4L2_PIX_FMT_YVU420 },
+	};
+	const int width = 320, height = 240;
+	int src_size = width * height * 4, dest_size = width * height * 3;
+	unsigned char *src, *dest;
+	int i, c, run;
+
+	v4lconvert_cost_load(data, ARRAY_SIZE(supported_src_pixfmts));
+
+	src = calloc(1, src_size);
+	dest = malloc(dest_size);
+	if (!src || !dest)
+		goto out;
+
+	for (i = 0; i < ARRAY_SIZE(supported_src_pixfmts); i++) {
+		unsigned int src_pix_fmt = supported_src_pixfmts[i].fmt;
+		int bpp = supported_src_pixfmts[i].bpp;
+
+		if (!bpp || !test_bit(i, data->supported_src_formats))
+			continue;
+
+		for (c = 0; c < V4LCONVERT_COST_CLASSES; c++) {
+			unsigned int dest_pix_fmt =
+				dest_fmts[c][src_pix_fmt == dest_fmts[c][0]];
+			struct v4l2_format fmt = {
+				.type = V4L2_BUF_TYPE_VIDEO_CAPTURE,
+			};
+
+			if (data->conv_cost[i][c] > 0)
+				continue;
+
+			fmt.fmt.pix.width = width;
+			fmt.fmt.pix.height = height;
+			fmt.fmt.pix.pixelformat = src_pix_fmt;
+			fmt.fmt.pix.field = V4L2_FIELD_NONE;
+			/* The 12 bpp formats and NV16/61 are planar */
+			fmt.fmt.pix.bytesperline = (bpp == 12 ||
+				src_pix_fmt == V4L2_PIX_FMT_NV16 ||
+				src_pix_fmt == V4L2_PIX_FMT_NV61) ?
+				width : width * bpp / 8;
+			fmt.fmt.pix.sizeimage = src_size;
+
+			/* The first run only warms up the caches */
+			for (run = 0; run < 3; run++) {
+				struct v4l2_format my_fmt = fmt;
+				uint64_t start = v4lconvert_cost_now();
+
+				if (v4lconvert_convert_pixfmt(data, src, src_size,
+						dest, dest_size, &my_fmt,
+						dest_pix_fmt))
+					break;
+				if (run)
+					v4lconvert_cost_update(data, i, c,
+						v4lconvert_cost_now() - start,
+						width * height);
+			}
+		}
+	}
+out:
+	free(dest);
+	free(src);
+}
+
+/* Returns the line converter to use for a fused packed yuv -> rgb / bgr
+   convert + flip + crop, or NULL if the combination must go through the
+   generic multi pass path */
+static void (*v4lconvert_fused_line_func(const struct v4l2_format *src_fmt,
+		const struct v4l2_format *dest_fmt))(const unsigned char *,
+		unsigned char *, int, int, int)
+{
+	const struct v4lconvert_yuv_kernels *yuv = v4lconvert_get_yuv_kernels();
+	int bgr = dest_fmt->fmt.pix.pixelformat == V4L2_PIX_FMT_BGR24;
+	int sw = src_fmt->fmt.pix.width, sh = src_fmt->fmt.pix.height;
+	int dw = dest_fmt->fmt.pix.width, dh = dest_fmt->fmt.pix.height;
+
+	if (dest_fmt->fmt.pix.pixelformat != V4L2_PIX_FMT_RGB24 && !bgr)
+		return NULL;
+
+	/* Only plain centered cropping, not adding borders or reducing */
+	if (sw < dw || sh < dh || (sw >= 2 * dw && sh >= 2 * dh))
+		return NULL;
+
+	switch (src_fmt->fmt.pix.pixelformat) {
+	case V4L2_PIX_FMT_YUYV:
+		return bgr ? yuv->yuyv_to_bgr24 : yuv->yuyv_to_rgb24;
+	case V4L2_PIX_FMT_YVYU:
+		return bgr ? yuv->yvyu_to_bgr24 : yuv->yvyu_to_rgb24;
+	case V4L2_PIX_FMT_UYVY:
+		return bgr ? yuv->uyvy_to_bgr24 : yuv->uyvy_to_rgb24;
+	}
+
+	return NULL;
+}
+
+/* Do convert + flip + crop in a single pass over the frame, one line at a
+   time, so that the intermediate data stays in the cache instead of going
+   through 2 - 3 full frame sized temporary buffers. */
+static int v4lconvert_convert_fused(struct v4lconvert_data *data,
+		void (*convert_line)(const unsigned char *, unsigned char *,
+			int, int, int),
+		const struct v4l2_format *src_fmt, const struct v4l2_format *dest_fmt,
+		unsigned char *src, int src_size, unsigned char *dest,
+		int hflip, int vflip, int crop)
+{
+	int sw = src_fmt->fmt.pix.width, sh = src_fmt->fmt.pix.height;
+	int dw = dest_fmt->fmt.pix.width, dh = dest_fmt->fmt.pix.height;
+	int src_stride = src_fmt->fmt.pix.bytesperline;
+	int dest_stride = crop ? dest_fmt->fmt.pix.bytesperline : dw * 3;
+	int startx = (sw - dw) / 2, starty = (sh - dh) / 2;
+	unsigned char *line, *s, *d;
+	int x, y, src_y;
+
+	if (src_size < sw * sh * 2) {
+		V4LCONVERT_ERR("short packed yuv data frame\n");
+		errno = EPIPE;
+		return -1;
+	}
+
+	line = v4lconvert_alloc_buffer(sw * 3, &data->convert2_buf,
+			&data->convert2_buf_size);
+	if (!line)
+		return v4lconvert_oom_error(data);
+
+	for (y = 0; y < dh; y++) {
+		src_y = vflip ? sh - 1 - (starty + y) : starty + y;
+		d = dest + y * dest_stride;
+
+		if (!hflip && !crop) {
+			convert_line(src + src_y * src_stride, d, sw, 1, src_stride);
+			continue;
+		}
+
+		convert_line(src + src_y * src_stride, line, sw, 1, src_stride);
+		if (!hflip) {
+			memcpy(d, line + 3 * startx, dw * 3);
+			continue;
+		}
+
+		s = line + 3 * (sw - 1 - startx);
+		for (x = 0; x < dw; x++) {
+			*d++ = s[0];
+			*d++ = s[1];
+			*d++ = s[2];
+			s -= 3;
+		}
+	}
+
+	return 0;
+}
+
+static int v4lconvert_do_convert(struct v4lconvert_data *data,
 		const struct v4l2_format *src_fmt,  /* in */
 		const struct v4l2_format *dest_fmt, /* in */
 		unsigned char *src, int src_size, unsigned char *dest, int dest_size)
@@ -1621,6 +2179,7 @@ int v4lconvert_convert(struct v4lconvert_data *data,
 	unsigned char *crop_src = src;
 	struct v4l2_format my_src_fmt = *src_fmt;
 	struct v4l2_format my_dest_fmt = *dest_fmt;
+	unsigned int base_pix_fmt;
 
 	processing = v4lprocessing_pre_processing(data->processing);
 	rotate90 = data->control_flags & V4LCONTROL_ROTATED_90_JPEG;
@@ -1640,6 +2199,40 @@ int v4lconvert_convert(struct v4lconvert_data *data,
 		return to_copy;
 	}
 
+	/* Steps other than converting only work on the base format of the
+	   extra dest formats, so do all of them to that and repack it */
+	base_pix_fmt = v4lconvert_extra_dst_base(my_dest_fmt.fmt.pix.pixelformat);
+	if (base_pix_fmt && (processing || rotate90 || hflip || vflip || crop)) {
+		struct v4l2_format base_fmt = my_dest_fmt;
+		unsigned char *base;
+
+		base_fmt.fmt.pix.pixelformat = base_pix_fmt;
+		v4lconvert_fixup_fmt(&base_fmt);
+		v4lconvert_fixup_fmt(&my_dest_fmt);
+		if (dest_size < my_dest_fmt.fmt.pix.sizeimage) {
+			V4LCONVERT_ERR("destination buffer too small (%d < %d)\n",
+					dest_size, my_dest_fmt.fmt.pix.sizeimage);
+			errno = EFAULT;
+			return -1;
+		}
+		base = v4lconvert_alloc_buffer(base_fmt.fmt.pix.sizeimage,
+				&data->extra_dst_buf, &data->extra_dst_buf_size);
+		if (!base)
+			return v4lconvert_oom_error(data);
+
+		res = v4lconvert_do_convert(data, src_fmt, &base_fmt, src,
+				src_size, base, base_fmt.fmt.pix.sizeimage);
+		if (res < 0)
+			return res;
+		if (v4lconvert_repack_extra_dst(data, base, dest,
+				base_fmt.fmt.pix.width, base_fmt.fmt.pix.height,
+				my_dest_fmt.fmt.pix.pixelformat))
+			return -1;
+		return my_dest_fmt.fmt.pix.sizeimage;
+	}
+
+	v4lconvert_check_scratch_fmt(data, &my_src_fmt, &my_dest_fmt);
+
 	/* sanity check, is the dest buffer large enough? */
 	switch (my_dest_fmt.fmt.pix.pixelformat) {
 	case V4L2_PIX_FMT_RGB24:
@@ -1649,11 +2242,17 @@ int v4lconvert_convert(struct v4lconvert_data *data,
 		break;
 	case V4L2_PIX_FMT_YUV420:
 	case V4L2_PIX_FMT_YVU420:
+	case V4L2_PIX_FMT_NV12:
 		dest_needed =
 			my_dest_fmt.fmt.pix.width * my_dest_fmt.fmt.pix.height * 3 / 2;
 		temp_needed =
 			my_src_fmt.fmt.pix.width * my_src_fmt.fmt.pix.height * 3 / 2;
 		break;
+	case V4L2_PIX_FMT_XRGB32:
+	case V4L2_PIX_FMT_XBGR32:
+		dest_needed = my_dest_fmt.fmt.pix.width * my_dest_fmt.fmt.pix.height * 4;
+		temp_needed = my_src_fmt.fmt.pix.width * my_src_fmt.fmt.pix.height * 4;
+		break;
 	default:
 		V4LCONVERT_ERR("Unknown dest format in conversion\n");
 		errno = EINVAL;
@@ -1667,6 +2266,19 @@ int v4lconvert_convert(struct v4lconvert_data *data,
 		return -1;
 	}
 
+	/* Fast path: packed yuv -> rgb / bgr with flipping and / or cropping */
+	if (!processing && !rotate90 && (hflip || vflip || crop)) {
+		void (*convert_line)(const unsigned char *, unsigned char *,
+				int, int, int);
+
+		convert_line = v4lconvert_fused_line_func(&my_src_fmt, &my_dest_fmt);
+		if (convert_line) {
+			res = v4lconvert_convert_fused(data, convert_line,
+					&my_src_fmt, &my_dest_fmt, src, src_size,
+					dest, hflip, vflip, crop);
+			return res ? res : dest_needed;
+		}
+	}
 
 	/* Sometimes we need foo -> rgb -> bar as video processing (whitebalance,
 	   etc.) can only be done on rgb data */
@@ -1683,6 +2295,25 @@ int v4lconvert_convert(struct v4lconvert_data *data,
 		 (!rotate90 && !hflip && !vflip && !crop))
 		convert = 1;
 
+#ifdef HAVE_JPEG
+	/* If cropping is going to throw away every other pixel and line of the
+	   decoded frame, have libjpeg decode at half the size using DCT
+	   scaling and crop from that instead. This saves most of the idct and
+	   color conversion work. Avoid it when the halved frame would get
+	   reduced again, so that the crop covers the same area. */
+	data->jpeg_scale_denom = 1;
+	if (convert == 1 && !rotate90 && crop &&
+	    (my_src_fmt.fmt.pix.pixelformat == V4L2_PIX_FMT_MJPEG ||
+	     my_src_fmt.fmt.pix.pixelformat == V4L2_PIX_FMT_JPEG) &&
+	    (my_dest_fmt.fmt.pix.pixelformat == V4L2_PIX_FMT_RGB24 ||
+	     my_dest_fmt.fmt.pix.pixelformat == V4L2_PIX_FMT_BGR24) &&
+	    my_src_fmt.fmt.pix.width >= 2 * my_dest_fmt.fmt.pix.width &&
+	    my_src_fmt.fmt.pix.height >= 2 * my_dest_fmt.fmt.pix.height &&
+	    !((my_src_fmt.fmt.pix.width + 1) / 2 >= 2 * my_dest_fmt.fmt.pix.width &&
+	      (my_src_fmt.fmt.pix.height + 1) / 2 >= 2 * my_dest_fmt.fmt.pix.height))
+		data->jpeg_scale_denom = 2;
+#endif
+
 	/* convert_pixfmt (only if convert == 2) -> processing -> convert_pixfmt ->
 	   rotate -> flip -> crop, all steps are optional */
 	if (convert == 2) {
@@ -1728,7 +2359,7 @@ int v4lconvert_convert(struct v4lconvert_data *data,
 	/* Done setting sources / dest and allocating intermediate buffers,
 	   real conversion / processing / ... starts here. */
 	if (convert == 2) {
-		res = v4lconvert_convert_pixfmt(data, src, src_size,
+		res = v4lconvert_convert_pixfmt_measured(data, src, src_size,
 				convert1_dest, convert1_dest_size,
 				&my_src_fmt,
 				V4L2_PIX_FMT_RGB24);
@@ -1736,40 +2367,207 @@ int v4lconvert_convert(struct v4lconvert_data *data,
 			return res;
 
 		src_size = my_src_fmt.fmt.pix.sizeimage;
+		V4L_PROBE(libv4lconvert, convert1_done, data, src_size);
 	}
 
-	if (processing)
+	if (processing) {
 		v4lprocessing_processing(data->processing, convert2_src, &my_src_fmt);
+		V4L_PROBE(libv4lconvert, processing_done, data);
+	}
 
 	if (convert) {
-		res = v4lconvert_convert_pixfmt(data, convert2_src, src_size,
-				convert2_dest, convert2_dest_size,
+		res = v4lconvert_convert_pixfmt_measured(data, convert2_src,
+				src_size, convert2_dest, convert2_dest_size,
 				&my_src_fmt,
 				my_dest_fmt.fmt.pix.pixelformat);
 		if (res)
 			return res;
 
 		src_size = my_src_fmt.fmt.pix.sizeimage;
+		V4L_PROBE(libv4lconvert, convert2_done, data, src_size);
 
 		/* We call processing here again in case the source format was not
 		   rgb, but the dest is. v4lprocessing checks it self it only actually
 		   does the processing once per frame. */
-		if (processing)
+		if (processing) {
 			v4lprocessing_processing(data->processing, convert2_dest, &my_src_fmt);
+			V4L_PROBE(libv4lconvert, processing_done, data);
+		}
 	}
 
-	if (rotate90)
+	if (rotate90) {
 		v4lconvert_rotate90(rotate90_src, rotate90_dest, &my_src_fmt);
+		V4L_PROBE(libv4lconvert, rotate90_done, data);
+	}
 
-	if (hflip || vflip)
+	if (hflip || vflip) {
 		v4lconvert_flip(flip_src, flip_dest, &my_src_fmt, hflip, vflip);
+		V4L_PROBE(libv4lconvert, flip_done, data);
+	}
 
-	if (crop)
+	if (crop) {
 		v4lconvert_crop(crop_src, dest, &my_src_fmt, &my_dest_fmt);
+		V4L_PROBE(libv4lconvert, crop_done, data);
+	}
 
 	return dest_needed;
 }
 
+int v4lconvert_convert(struct v4lconvert_data *data,
+		const struct v4l2_format *src_fmt,  /* in */
+		const struct v4l2_format *dest_fmt, /* in */
+		unsigned char *src, int src_size, unsigned char *dest, int dest_size)
+{
+	int res;
+
+	/* In between, each of the convert1, processing, convert2, rotate90,
+	   flip and crop steps fires a probe when done */
+	V4L_PROBE(libv4lconvert, convert_entry, data,
+		  src_fmt->fmt.pix.pixelformat, dest_fmt->fmt.pix.pixelformat,
+		  src_size);
+	res = v4lconvert_do_convert(data, src_fmt, dest_fmt, src, src_size,
+				    dest, dest_size);
+	V4L_PROBE(libv4lconvert, convert_return, data, res);
+
+	return res;
+}
+
+static int v4lconvert_convert_nv12m(struct v4lconvert_data *data,
+		unsigned char *const *src, const int *stride, int width,
+		int height, unsigned char *dest, unsigned int dest_pix_fmt)
+{
+	switch (dest_pix_fmt) {
+	case V4L2_PIX_FMT_RGB24:
+	case V4L2_PIX_FMT_BGR24:
+		v4lconvert_get_yuv_kernels()->nv12m_to_rgb24(src[0], stride[0],
+				src[1], stride[1], dest, width, height,
+				dest_pix_fmt == V4L2_PIX_FMT_BGR24);
+		return width * height * 3;
+	case V4L2_PIX_FMT_YUV420:
+	case V4L2_PIX_FMT_YVU420:
+		v4lconvert_nv12m_to_yuv420(src[0], stride[0], src[1], stride[1],
+				dest, width, height,
+				dest_pix_fmt == V4L2_PIX_FMT_YVU420);
+		return width * height * 3 / 2;
+	case V4L2_PIX_FMT_NV12: {
+		int i;
+
+		for (i = 0; i < height; i++)
+			memcpy(dest + i * width, src[0] + i * stride[0], width);
+		dest += width * height;
+		for (i = 0; i < height / 2; i++)
+			memcpy(dest + i * width, src[1] + i * stride[1], width);
+		return width * height * 3 / 2;
+	}
+	case V4L2_PIX_FMT_XRGB32:
+	case V4L2_PIX_FMT_XBGR32:
+		v4lconvert_get_yuv_kernels()->nv12m_to_rgb24(src[0], stride[0],
+				src[1], stride[1], dest, width, height,
+				dest_pix_fmt == V4L2_PIX_FMT_XBGR32);
+		v4lconvert_rgb24_to_rgb32(dest, dest, width, height,
+				dest_pix_fmt == V4L2_PIX_FMT_XRGB32);
+		return width * height * 4;
+	}
+
+	V4LCONVERT_ERR("Unknown dest format in conversion\n");
+	errno = EINVAL;
+	return -1;
+}
+
+int v4lconvert_convert_mplane(struct v4lconvert_data *data,
+		const struct v4l2_format *src_fmt,  /* in */
+		const struct v4l2_format *dest_fmt, /* in */
+		unsigned char *const *src, const int *src_size,
+		unsigned char *dest, int dest_size)
+{
+	const struct v4l2_pix_format_mplane *pix_mp = &src_fmt->fmt.pix_mp;
+	unsigned int dest_pix_fmt = dest_fmt->fmt.pix.pixelformat;
+	int width = pix_mp->width, height = pix_mp->height;
+	int stride[2], needed, processing, rotate90, hflip, vflip, crop;
+	struct v4l2_format tmp_fmt;
+	unsigned char *tmp;
+	unsigned int i;
+
+	if (src_fmt->type != V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE ||
+	    pix_mp->pixelformat != V4L2_PIX_FMT_NV12M ||
+	    pix_mp->num_planes != 2 ||
+	    !v4lconvert_supported_dst_format(dest_pix_fmt)) {
+		V4LCONVERT_ERR("unsupported multi-planar conversion\n");
+		errno = EINVAL;
+		return -1;
+	}
+
+	for (i = 0; i < 2; i++) {
+		int lines = i ? (height + 1) / 2 : height;
+
+		stride[i] = pix_mp->plane_fmt[i].bytesperline;
+		if (stride[i] < width)
+			stride[i] = width;
+		if (src_size[i] < stride[i] * (lines - 1) + width) {
+			V4LCONVERT_ERR("short nv12m data frame\n");
+			errno = EPIPE;
+			return -1;
+		}
+	}
+
+	switch (dest_pix_fmt) {
+	case V4L2_PIX_FMT_YUV420:
+	case V4L2_PIX_FMT_YVU420:
+	case V4L2_PIX_FMT_NV12:
+		needed = width * height * 3 / 2;
+		break;
+	case V4L2_PIX_FMT_XRGB32:
+	case V4L2_PIX_FMT_XBGR32:
+		needed = width * height * 4;
+		break;
+	default:
+		needed = width * height * 3;
+		break;
+	}
+
+	processing = v4lprocessing_pre_processing(data->processing);
+	rotate90 = data->control_flags & V4LCONTROL_ROTATED_90_JPEG;
+	hflip = v4lcontrol_get_ctrl(data->control, V4LCONTROL_HFLIP);
+	vflip = v4lcontrol_get_ctrl(data->control, V4LCONTROL_VFLIP);
+	crop = dest_fmt->fmt.pix.width != pix_mp->width ||
+		dest_fmt->fmt.pix.height != pix_mp->height;
+
+	/* Without any further steps both planes get converted in place */
+	if (!processing && !rotate90 && !hflip && !vflip && !crop) {
+		if (dest_size < needed) {
+			V4LCONVERT_ERR("destination buffer too small (%d < %d)\n",
+					dest_size, needed);
+			errno = EFAULT;
+			return -1;
+		}
+		return v4lconvert_convert_nv12m(data, src, stride, width,
+						height, dest, dest_pix_fmt);
+	}
+
+	/* Otherwise convert to a single plane frame of the destination
+	   pixelformat and let v4lconvert_convert() do the rest from there */
+	tmp = v4lconvert_alloc_buffer(needed, &data->mplane_buf,
+				      &data->mplane_buf_size);
+	if (!tmp)
+		return v4lconvert_oom_error(data);
+
+	if (v4lconvert_convert_nv12m(data, src, stride, width, height, tmp,
+				     dest_pix_fmt) < 0)
+		return -1;
+
+	memset(&tmp_fmt, 0, sizeof(tmp_fmt));
+	tmp_fmt.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+	tmp_fmt.fmt.pix.width = width;
+	tmp_fmt.fmt.pix.height = height;
+	tmp_fmt.fmt.pix.pixelformat = dest_pix_fmt;
+	tmp_fmt.fmt.pix.field = pix_mp->field;
+	tmp_fmt.fmt.pix.colorspace = pix_mp->colorspace;
+	v4lconvert_fixup_fmt(&tmp_fmt);
+
+	return v4lconvert_convert(data, &tmp_fmt, dest_fmt, tmp, needed,
+				  dest, dest_size);
+}
+
 const char *v4lconvert_get_error_message(struct v4lconvert_data *data)
 {
 	return data->error_msg;
@@ -0,0 +1,42 @@
+/*
+# Static tracing probes for libv4l2 and libv4lconvert
+
+# This program is free software; you can redistribute it and/or modify
+# it under the terms of the GNU Lesser General Public License as published by
+# the Free Software Foundation; either version 2.1 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU Lesser General Public License for more details.
+#
+# You should have received a copy of the GNU Lesser General Public License
+# along with this program; if not, write to the Free Software
+# Foundation, Inc., 51 Franklin Street, Suite 500, Boston, MA  02110-1335  USA
+ */
+
+#ifndef __LIBV4LTRACE_PRIV_H
+#define __LIBV4LTRACE_PRIV_H
+
+/*
+ * When built against systemtap's sys/sdt.h each V4L_PROBE() is a USDT probe,
+ * a single nop in the code plus a note in the ELF file telling tracers like
+ * perf, bpftrace and systemtap where the probe is and where its arguments
+ * live, ie:
+ *
+ *   bpftrace -e 'usdt:/usr/lib/libv4l2.so.0:libv4l2:dqbuf { ... }'
+ *
+ * The arguments should be plain values already at hand, as they get loaded
+ * into registers even when nobody is tracing. Without sys/sdt.h the probes
+ * compile to nothing.
+ */
+#ifdef HAVE_SYS_SDT_H
+#include <sys/sdt.h>
+#define V4L_PROBE(provider, name, ...) \
+	STAP_PROBEV(provider, name, __VA_ARGS__)
+#else
+#define V4L_PROBE(provider, name, ...) do { } while (0)
+#endif
+
+#endif
@@ -22,6 +22,7 @@
 #include <unistd.h>
 #include "libv4lconvert-priv.h"
 #include "libv4lsyscall-priv.h"
+#include "bitreader-priv.h"
 
 #define CLIP(x) ((x) < 0 ? 0 : ((x) > 0xff) ? 0xff : (x))
 
@@ -86,19 +87,11 @@ static void init_mr97310a_decoder(void)
 	decoder_initialized = 1;
 }
 
-static inline unsigned char get_byte(const unsigned char *inp,
-		unsigned int bitpos)
-{
-	const unsigned char *addr;
-
-	addr = inp + (bitpos >> 3);
-	return (addr[0] << (bitpos & 7)) | (addr[1] >> (8 - (bitpos & 7)));
-}
-
 int v4lconvert_decode_mr97310a(struct v4lconvert_data *data,
 		const unsigned char *inp, int src_size,
 		unsigned char *outp, int width, int height)
 {
+	struct v4lconvert_bits br;
 	int row, col;
 	int val;
 	int bitpos;
@@ -112,7 +105,7 @@ int v4lconvert_decode_mr97310a(struct v4lconvert_data *data,
 	/* remove the header */
 	inp += 12;
 
-	bitpos = 0;
+	v4lconvert_bits_init(&br, inp, src_size > 12 ? src_size - 12 : 0);
 
 	/* main decoding loop */
 	for (row = 0; row < height; ++row) {
@@ -120,29 +113,23 @@ int v4lconvert_decode_mr97310a(struct v4lconvert_data *data,
 
 		/* first two pixels in first two rows are stored as raw 8-bit */
 		if (row < 2) {
-			code = get_byte(inp, bitpos);
-			bitpos += 8;
-			*outp++ = code;
-
-			code = get_byte(inp, bitpos);
-			bitpos += 8;
-			*outp++ = code;
-
+			v4lconvert_bits_refill(&br);
+			*outp++ = v4lconvert_bits_get(&br, 8);
+			*outp++ = v4lconvert_bits_get(&br, 8);
 			col += 2;
 		}
 
 		while (col < width) {
 			/* get bitcode */
-			code = get_byte(inp, bitpos);
+			v4lconvert_bits_refill(&br);
+			code = v4lconvert_bits_peek(&br, 8);
 			/* update bit position */
-			bitpos += table[code].len;
+			v4lconvert_bits_skip(&br, table[code].len);
 
 			/* calculate pixel value */
 			if (table[code].is_abs) {
 				/* get 5 more bits and use them as absolute value */
-				code = get_byte(inp, bitpos);
-				val = (code & 0xf8);
-				bitpos += 5;
+				val = v4lconvert_bits_get(&br, 5) << 3;
 
 			} else {
 				/* value is relative to top or left pixel */
@@ -178,6 +165,7 @@ int v4lconvert_decode_mr97310a(struct v4lconvert_data *data,
 		}
 
 		/* src_size - 12 because of 12 byte footer */
+		bitpos = v4lconvert_bits_tell(&br);
 		if (((bitpos - 1) / 8) >= (src_size - 12)) {
 			data->frames_dropped++;
 			if (data->frames_dropped == 3) {
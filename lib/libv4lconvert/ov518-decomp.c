@@ -1432,6 +1432,10 @@ int main(int argc, char *argv[])
 	int width, height, yvu, src_size, dest_size;
 	unsigned char src_buf[200000];
 	unsigned char dest_buf[500000];
+	unsigned char *src;
+	struct v4lconvert_helper_shm shm;
+
+	v4lconvert_helper_shm_init(&shm, argc, argv);
 
 	while (1) {
 		if (v4lconvert_helper_read(STDIN_FILENO, &width, sizeof(int), argv[0]))
@@ -1446,14 +1450,16 @@ int main(int argc, char *argv[])
 		if (v4lconvert_helper_read(STDIN_FILENO, &src_size, sizeof(int), argv[0]))
 			return 1; /* Erm, no way to recover without loosing sync with libv4l */
 
-		if (src_size > sizeof(src_buf)) {
-			fprintf(stderr, "%s: error: src_buf too small, need: %d\n",
-					argv[0], src_size);
-			return 2;
-		}
+		if (shm.fd == -1) {
+			if (src_size > sizeof(src_buf)) {
+				fprintf(stderr, "%s: error: src_buf too small, need: %d\n",
+						argv[0], src_size);
+				return 2;
+			}
 
-		if (v4lconvert_helper_read(STDIN_FILENO, src_buf, src_size, argv[0]))
-			return 1; /* Erm, no way to recover without loosing sync with libv4l */
+			if (v4lconvert_helper_read(STDIN_FILENO, src_buf, src_size, argv[0]))
+				return 1; /* Erm, no way to recover without loosing sync with libv4l */
+		}
 
 
 		dest_size = width * height * 3 / 2;
@@ -1461,6 +1467,17 @@ int main(int argc, char *argv[])
 			fprintf(stderr, "%s: error: width or height out of bounds\n",
 					argv[0]);
 			dest_size = -1;
+		} else if (shm.fd != -1) {
+			/* The data and result are in the shared memory */
+			src = NULL;
+			if (src_size >= 0)
+				src = v4lconvert_helper_shm_map(&shm,
+						V4LCONVERT_HELPER_SHM_DEST(src_size) +
+						dest_size, argv[0]);
+			if (!src || v4lconvert_ov518_to_yuv420(src,
+					src + V4LCONVERT_HELPER_SHM_DEST(src_size),
+					width, height, yvu, src_size))
+				dest_size = -1;
 		} else if (dest_size > sizeof(dest_buf)) {
 			fprintf(stderr, "%s: error: dest_buf too small, need: %d\n",
 					argv[0], dest_size);
@@ -1473,7 +1490,7 @@ int main(int argc, char *argv[])
 					argv[0]))
 			return 1; /* Erm, no way to recover without loosing sync with libv4l */
 
-		if (dest_size == -1)
+		if (dest_size == -1 || shm.fd != -1)
 			continue;
 
 		if (v4lconvert_helper_write(STDOUT_FILENO, dest_buf, dest_size, argv[0]))
@@ -74,7 +74,8 @@ static int autogain_calculate_lookup_tables(
 		struct v4lprocessing_data *data,
 		unsigned char *buf, const struct v4l2_format *fmt)
 {
-	int x, y, target, steps, avg_lum = 0;
+	int x, y, target, steps, avg_lum = 0, samples = 0;
+	int width, height, stride, step;
 	int gain, exposure, orig_gain, orig_exposure, exposure_low;
 	struct v4l2_control ctrl;
 	struct v4l2_queryctrl gainctrl, expoctrl;
@@ -105,39 +106,55 @@ static int autogain_calculate_lookup_tables(
 		return 0;
 	gain = orig_gain = ctrl.value;
 
+	/* Average the luminance of the center of the frame, half its width and
+	   height, on a grid which might skip lines and columns for big frames */
+	width = fmt->fmt.pix.width / 2;
+	height = fmt->fmt.pix.height / 2;
+	stride = fmt->fmt.pix.bytesperline;
+
 	switch (fmt->fmt.pix.pixelformat) {
 	case V4L2_PIX_FMT_SGBRG8:
 	case V4L2_PIX_FMT_SGRBG8:
 	case V4L2_PIX_FMT_SBGGR8:
 	case V4L2_PIX_FMT_SRGGB8:
-		buf += fmt->fmt.pix.height * fmt->fmt.pix.bytesperline / 4 +
-			fmt->fmt.pix.width / 4;
-
-		for (y = 0; y < fmt->fmt.pix.height / 2; y++) {
-			for (x = 0; x < fmt->fmt.pix.width / 2; x++)
-				avg_lum += *buf++;
-			buf += fmt->fmt.pix.bytesperline - fmt->fmt.pix.width / 2;
+		/* Sample whole 2x2 cells, so that all colors are included */
+		buf += (fmt->fmt.pix.height / 4 & ~1) * stride +
+			(fmt->fmt.pix.width / 4 & ~1);
+		step = 2 * v4lprocessing_stats_step(data, width / 2, height / 2);
+
+		for (y = 0; y + 1 < height; y += step) {
+			unsigned char *line = buf + y * stride;
+
+			for (x = 0; x + 1 < width; x += step) {
+				avg_lum += line[x] + line[x + 1] +
+					   line[stride + x] + line[stride + x + 1];
+				samples += 4;
+			}
 		}
-		avg_lum /= fmt->fmt.pix.height * fmt->fmt.pix.width / 4;
 		break;
 
 	case V4L2_PIX_FMT_RGB24:
 	case V4L2_PIX_FMT_BGR24:
-		buf += fmt->fmt.pix.height * fmt->fmt.pix.bytesperline / 4 +
-			fmt->fmt.pix.width * 3 / 4;
-
-		for (y = 0; y < fmt->fmt.pix.height / 2; y++) {
-			for (x = 0; x < fmt->fmt.pix.width / 2; x++) {
-				avg_lum += *buf++;
-				avg_lum += *buf++;
-				avg_lum += *buf++;
+		buf += fmt->fmt.pix.height / 4 * stride +
+			fmt->fmt.pix.width / 4 * 3;
+		step = v4lprocessing_stats_step(data, width, height);
+
+		for (y = 0; y < height; y += step) {
+			unsigned char *line = buf + y * stride;
+
+			for (x = 0; x < width; x += step) {
+				avg_lum += line[3 * x] + line[3 * x + 1] +
+					   line[3 * x + 2];
+				samples += 3;
 			}
-			buf += fmt->fmt.pix.bytesperline - fmt->fmt.pix.width * 3 / 2;
 		}
-		avg_lum /= fmt->fmt.pix.height * fmt->fmt.pix.width * 3 / 4;
 		break;
 	}
 
+	if (!samples)
+		return 0;
+	avg_lum /= samples;
+
 	/* If we are off a multiple of deadzone, do multiple steps to reach the
 	   desired lumination fast (with the risc of a slight overshoot) */
 	target = v4lcontrol_get_ctrl(data->control, V4LCONTROL_AUTOGAIN_TARGET);
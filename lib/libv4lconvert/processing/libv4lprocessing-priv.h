@@ -26,6 +26,12 @@
 
 #define V4L2PROCESSING_UPDATE_RATE 10
 
+/* Default number of samples the filters gather their frame statistics from,
+   frames with more pixels are subsampled on a regular grid. Can be changed
+   with the LIBV4LCONVERT_STATS_SAMPLES environment variable, 0 means use
+   every pixel. */
+#define V4L2PROCESSING_STATS_SAMPLES 65536
+
 struct v4lprocessing_data {
 	struct v4lcontrol_data *control;
 	int fd;
@@ -37,7 +43,10 @@ struct v4lprocessing_data {
 	/* Counts the number of processed frames until a
 	   V4L2PROCESSING_UPDATE_RATE overflow happens */
 	int lookup_table_update_counter;
-	/* RGB/BGR lookup tables */
+	/* Max number of samples for the frame statistics, 0 for no limit */
+	int stats_samples;
+	/* RGB/BGR lookup tables, these must stay together and be followed by
+	   at least 3 more bytes, the AVX2 code does dword gathers from them */
 	unsigned char comp1[256];
 	unsigned char green[256];
 	unsigned char comp2[256];
@@ -61,6 +70,12 @@ struct v4lprocessing_filter {
 			unsigned char *buf, const struct v4l2_format *fmt);
 };
 
+/* Returns the distance between the sampled columns and lines (or 2x2 cells
+   for bayer) of a width x height grid, to keep the statistics gathering
+   at roughly the same cost for any resolution */
+int v4lprocessing_stats_step(struct v4lprocessing_data *data,
+		int width, int height);
+
 extern struct v4lprocessing_filter whitebalance_filter;
 extern struct v4lprocessing_filter autogain_filter;
 extern struct v4lprocessing_filter gamma_filter;
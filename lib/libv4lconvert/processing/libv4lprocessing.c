@@ -26,6 +26,7 @@
 #include "libv4lprocessing.h"
 #include "libv4lprocessing-priv.h"
 #include "../libv4lconvert-priv.h" /* for PIX_FMT defines */
+#include "../simd-priv.h"
 
 static struct v4lprocessing_filter *filters[] = {
 	&whitebalance_filter,
@@ -37,6 +38,7 @@ struct v4lprocessing_data *v4lprocessing_create(int fd, struct v4lcontrol_data *
 {
 	struct v4lprocessing_data *data =
 		calloc(1, sizeof(struct v4lprocessing_data));
+	char *s;
 
 	if (!data) {
 		fprintf(stderr, "libv4lprocessing: error: out of memory!\n");
@@ -46,6 +48,11 @@ struct v4lprocessing_data *v4lprocessing_create(int fd, struct v4lcontrol_data *
 	data->fd = fd;
 	data->control = control;
 
+	s = getenv("LIBV4LCONVERT_STATS_SAMPLES");
+	data->stats_samples = s ? strtol(s, NULL, 0) : V4L2PROCESSING_STATS_SAMPLES;
+	if (data->stats_samples < 0)
+		data->stats_samples = 0;
+
 	return data;
 }
 
@@ -69,6 +76,18 @@ int v4lprocessing_pre_processing(struct v4lprocessing_data *data)
 	return data->do_process;
 }
 
+int v4lprocessing_stats_step(struct v4lprocessing_data *data,
+		int width, int height)
+{
+	int step = 1;
+
+	if (data->stats_samples)
+		while ((width / step) * (height / step) > data->stats_samples)
+			step++;
+
+	return step;
+}
+
 static void v4lprocessing_update_lookup_tables(struct v4lprocessing_data *data,
 		unsigned char *buf, const struct v4l2_format *fmt)
 {
@@ -89,66 +108,122 @@ static void v4lprocessing_update_lookup_tables(struct v4lprocessing_data *data,
 	}
 }
 
+#ifdef CPU_BUILD_AVX2
+/* Look up 24 bytes at a time with dword gathers from the tables, which start
+   at base. offsets holds the offset of the table for each of the 3 bytes of
+   a period (bytes 0 and 1 repeat for a period of 2, which divides 24 too).
+   Returns the number of bytes done. */
+__attribute__((target("avx2")))
+static int v4lprocessing_avx2_lut_line(const unsigned char *base,
+		unsigned char *buf, int n, const int *offsets, int period)
+{
+	const __m256i byte_mask = _mm256_set1_epi32(0xff);
+	int o[24] __attribute__((aligned(32)));
+	__m256i off[3], v;
+	__m128i out;
+	int x, g;
+
+	for (x = 0; x < 24; x++)
+		o[x] = offsets[x % period];
+	for (g = 0; g < 3; g++)
+		off[g] = _mm256_load_si256((const __m256i *)(o + g * 8));
+
+	for (x = 0; x + 24 <= n; x += 24) {
+		for (g = 0; g < 3; g++) {
+			v = _mm256_cvtepu8_epi32(_mm_loadl_epi64(
+					(const __m128i *)(buf + x + g * 8)));
+			v = _mm256_i32gather_epi32((const int *)base,
+					_mm256_add_epi32(v, off[g]), 1);
+			v = _mm256_and_si256(v, byte_mask);
+			/* 8 dwords -> 8 bytes */
+			v = _mm256_packus_epi32(v, v);
+			v = _mm256_permute4x64_epi64(v, _MM_SHUFFLE(3, 1, 2, 0));
+			out = _mm_packus_epi16(_mm256_castsi256_si128(v),
+					       _mm256_castsi256_si128(v));
+			_mm_storel_epi64((__m128i *)(buf + x + g * 8), out);
+		}
+	}
+
+	return x;
+}
+#endif
+
+/* Apply the lookup tables to the n bytes of a line, byte x goes through
+   tables[x % period], period is 2 (bayer) or 3 (rgb / bgr) */
+static void v4lprocessing_lut_line(struct v4lprocessing_data *data,
+		unsigned char *buf, int n, const unsigned char * const *tables,
+		int period)
+{
+	int x = 0;
+
+#ifdef CPU_BUILD_AVX2
+	if (v4lconvert_get_cpu_flags() & V4LCONVERT_CPU_AVX2) {
+		int offsets[3];
+
+		for (x = 0; x < period; x++)
+			offsets[x] = tables[x] - data->comp1;
+		x = v4lprocessing_avx2_lut_line(data->comp1, buf, n, offsets,
+				period);
+	}
+#endif
+
+	if (period == 2) {
+		for (; x + 1 < n; x += 2) {
+			buf[x] = tables[0][buf[x]];
+			buf[x + 1] = tables[1][buf[x + 1]];
+		}
+	} else {
+		for (; x + 2 < n; x += 3) {
+			buf[x] = tables[0][buf[x]];
+			buf[x + 1] = tables[1][buf[x + 1]];
+			buf[x + 2] = tables[2][buf[x + 2]];
+		}
+	}
+}
+
 static void v4lprocessing_do_processing(struct v4lprocessing_data *data,
 		unsigned char *buf, const struct v4l2_format *fmt)
 {
-	int x, y;
+	const unsigned char *green_first[2][2] = {
+		{ data->green, data->comp1 }, { data->comp2, data->green }
+	};
+	const unsigned char *green_second[2][2] = {
+		{ data->comp1, data->green }, { data->green, data->comp2 }
+	};
+	const unsigned char *rgb[3] = { data->comp1, data->green, data->comp2 };
+	const unsigned char *(*bayer)[2] = NULL;
+	int y;
 
 	switch (fmt->fmt.pix.pixelformat) {
 	case V4L2_PIX_FMT_SGBRG8:
 	case V4L2_PIX_FMT_SGRBG8: /* Bayer patterns starting with green */
-		for (y = 0; y < fmt->fmt.pix.height / 2; y++) {
-			for (x = 0; x < fmt->fmt.pix.width / 2; x++) {
-				*buf = data->green[*buf];
-				buf++;
-				*buf = data->comp1[*buf];
-				buf++;
-			}
-			buf += fmt->fmt.pix.bytesperline - fmt->fmt.pix.width;
-			for (x = 0; x < fmt->fmt.pix.width / 2; x++) {
-				*buf = data->comp2[*buf];
-				buf++;
-				*buf = data->green[*buf];
-				buf++;
-			}
-			buf += fmt->fmt.pix.bytesperline - fmt->fmt.pix.width;
-		}
+		bayer = green_first;
 		break;
 
 	case V4L2_PIX_FMT_SBGGR8:
 	case V4L2_PIX_FMT_SRGGB8: /* Bayer patterns *NOT* starting with green */
-		for (y = 0; y < fmt->fmt.pix.height / 2; y++) {
-			for (x = 0; x < fmt->fmt.pix.width / 2; x++) {
-				*buf = data->comp1[*buf];
-				buf++;
-				*buf = data->green[*buf];
-				buf++;
-			}
-			buf += fmt->fmt.pix.bytesperline - fmt->fmt.pix.width;
-			for (x = 0; x < fmt->fmt.pix.width / 2; x++) {
-				*buf = data->green[*buf];
-				buf++;
-				*buf = data->comp2[*buf];
-				buf++;
-			}
-			buf += fmt->fmt.pix.bytesperline - fmt->fmt.pix.width;
-		}
+		bayer = green_second;
 		break;
 
 	case V4L2_PIX_FMT_RGB24:
 	case V4L2_PIX_FMT_BGR24:
 		for (y = 0; y < fmt->fmt.pix.height; y++) {
-			for (x = 0; x < fmt->fmt.pix.width; x++) {
-				*buf = data->comp1[*buf];
-				buf++;
-				*buf = data->green[*buf];
-				buf++;
-				*buf = data->comp2[*buf];
-				buf++;
-			}
-			buf += fmt->fmt.pix.bytesperline - 3 * fmt->fmt.pix.width;
+			v4lprocessing_lut_line(data, buf, 3 * fmt->fmt.pix.width,
+					rgb, 3);
+			buf += fmt->fmt.pix.bytesperline;
 		}
-		break;
+		return;
+
+	default:
+		return;
+	}
+
+	/* Bayer lines alternate between 2 pairs of tables, as before an odd
+	   last line or column is left alone */
+	for (y = 0; y < (fmt->fmt.pix.height & ~1); y++) {
+		v4lprocessing_lut_line(data, buf, fmt->fmt.pix.width & ~1,
+				bayer[y & 1], 2);
+		buf += fmt->fmt.pix.bytesperline;
 	}
 }
 
@@ -124,22 +124,27 @@ static int whitebalance_calculate_lookup_tables_bayer(
 		struct v4lprocessing_data *data, unsigned char *buf,
 		const struct v4l2_format *fmt, int starts_with_green)
 {
-	int x, y, a1 = 0, a2 = 0, b1 = 0, b2 = 0;
+	int x, y, a1 = 0, a2 = 0, b1 = 0, b2 = 0, cells = 0;
 	int green_avg, comp1_avg, comp2_avg;
-
-	for (y = 0; y < fmt->fmt.pix.height; y += 2) {
-		for (x = 0; x < fmt->fmt.pix.width; x += 2) {
-			a1 += *buf++;
-			a2 += *buf++;
-		}
-		buf += fmt->fmt.pix.bytesperline - fmt->fmt.pix.width;
-		for (x = 0; x < fmt->fmt.pix.width; x += 2) {
-			b1 += *buf++;
-			b2 += *buf++;
+	int step = 2 * v4lprocessing_stats_step(data, fmt->fmt.pix.width / 2,
+						fmt->fmt.pix.height / 2);
+	int stride = fmt->fmt.pix.bytesperline;
+
+	for (y = 0; y + 1 < fmt->fmt.pix.height; y += step) {
+		unsigned char *line = buf + y * stride;
+
+		for (x = 0; x + 1 < fmt->fmt.pix.width; x += step) {
+			a1 += line[x];
+			a2 += line[x + 1];
+			b1 += line[stride + x];
+			b2 += line[stride + x + 1];
+			cells++;
 		}
-		buf += fmt->fmt.pix.bytesperline - fmt->fmt.pix.width;
 	}
 
+	if (!cells)
+		return 0;
+
 	if (starts_with_green) {
 		green_avg = a1 / 2 + b2 / 2;
 		comp1_avg = a2;
@@ -151,9 +156,9 @@ static int whitebalance_calculate_lookup_tables_bayer(
 	}
 
 	/* Norm avg to ~ 0 - 4095 */
-	green_avg /= fmt->fmt.pix.width * fmt->fmt.pix.height / 64;
-	comp1_avg /= fmt->fmt.pix.width * fmt->fmt.pix.height / 64;
-	comp2_avg /= fmt->fmt.pix.width * fmt->fmt.pix.height / 64;
+	green_avg = (long long)green_avg * 16 / cells;
+	comp1_avg = (long long)comp1_avg * 16 / cells;
+	comp2_avg = (long long)comp2_avg * 16 / cells;
 
 	return whitebalance_calculate_lookup_tables_generic(data, green_avg,
 			comp1_avg, comp2_avg);
@@ -163,21 +168,28 @@ static int whitebalance_calculate_lookup_tables_rgb(
 		struct v4lprocessing_data *data, unsigned char *buf,
 		const struct v4l2_format *fmt)
 {
-	int x, y, green_avg = 0, comp1_avg = 0, comp2_avg = 0;
-
-	for (y = 0; y < fmt->fmt.pix.height; y++) {
-		for (x = 0; x < fmt->fmt.pix.width; x++) {
-			comp1_avg += *buf++;
-			green_avg += *buf++;
-			comp2_avg += *buf++;
+	int x, y, green_avg = 0, comp1_avg = 0, comp2_avg = 0, pixels = 0;
+	int step = v4lprocessing_stats_step(data, fmt->fmt.pix.width,
+					     fmt->fmt.pix.height);
+
+	for (y = 0; y < fmt->fmt.pix.height; y += step) {
+		unsigned char *line = buf + y * fmt->fmt.pix.bytesperline;
+
+		for (x = 0; x < fmt->fmt.pix.width; x += step) {
+			comp1_avg += line[3 * x];
+			green_avg += line[3 * x + 1];
+			comp2_avg += line[3 * x + 2];
+			pixels++;
 		}
-		buf += fmt->fmt.pix.bytesperline - fmt->fmt.pix.width * 3;
 	}
 
+	if (!pixels)
+		return 0;
+
 	/* Norm avg to ~ 0 - 4095 */
-	green_avg /= fmt->fmt.pix.width * fmt->fmt.pix.height / 16;
-	comp1_avg /= fmt->fmt.pix.width * fmt->fmt.pix.height / 16;
-	comp2_avg /= fmt->fmt.pix.width * fmt->fmt.pix.height / 16;
+	green_avg = (long long)green_avg * 16 / pixels;
+	comp1_avg = (long long)comp1_avg * 16 / pixels;
+	comp2_avg = (long long)comp2_avg * 16 / pixels;
 
 	return whitebalance_calculate_lookup_tables_generic(data, green_avg,
 			comp1_avg, comp2_avg);
@@ -0,0 +1,794 @@
+/*
+# SIMD versions of the YUV -> RGB conversion routines from rgbyuv.c
+
+# This program is free software; you can redistribute it and/or modify
+# it under the terms of the GNU Lesser General Public License as published by
+# the Free Software Foundation; either version 2.1 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU Lesser General Public License for more details.
+#
+# You should have received a copy of the GNU Lesser General Public License
+# along with this program; if not, write to the Free Software
+# Foundation, Inc., 51 Franklin Street, Suite 500, Boston, MA  02110-1335  USA
+
+ */
+
+/*
+ * All routines here produce bit identical results to the plain C versions in
+ * rgbyuv.c, which remain the reference implementation. The packed 4:2:2 and
+ * planar 4:2:0 routines use the "fast" shift based formula, the NV12 routine
+ * uses the multiplication based YUV2R / YUV2G / YUV2B formula.
+ *
+ * Each routine does as many pixels as possible with vector instructions and
+ * the rest of a line with the scalar helpers below.
+ */
+
+#include "libv4lconvert-priv.h"
+#include "simd-priv.h"
+
+#define CLIP(color) (unsigned char)(((color) > 0xFF) ? 0xff : (((color) < 0) ? 0 : (color)))
+
+/* Pixel layout of the packed 4:2:2 formats */
+#define PACKED_YUYV	0, 1
+#define PACKED_YVYU	0, 0
+#define PACKED_UYVY	1, 1
+
+static inline void fast_pair_to_rgb24(int y0, int y1, int u, int v,
+		unsigned char *dest, int bgr)
+{
+	int u1 = (((u - 128) << 7) +  (u - 128)) >> 6;
+	int rg = (((u - 128) << 1) +  (u - 128) +
+			((v - 128) << 2) + ((v - 128) << 1)) >> 3;
+	int v1 = (((v - 128) << 1) +  (v - 128)) >> 1;
+
+	dest[bgr ? 2 : 0] = CLIP(y0 + v1);
+	dest[1] = CLIP(y0 - rg);
+	dest[bgr ? 0 : 2] = CLIP(y0 + u1);
+	dest[bgr ? 5 : 3] = CLIP(y1 + v1);
+	dest[4] = CLIP(y1 - rg);
+	dest[bgr ? 3 : 5] = CLIP(y1 + u1);
+}
+
+static inline void accurate_pixel_to_rgb24(int y, int u, int v,
+		unsigned char *dest, int bgr)
+{
+	int r = y + (((v - 128) * 1436) >> 10);
+	int g = y - (((u - 128) * 352 + (v - 128) * 731) >> 10);
+	int b = y + (((u - 128) * 1814) >> 10);
+
+	dest[bgr ? 2 : 0] = CLIP(r);
+	dest[1] = CLIP(g);
+	dest[bgr ? 0 : 2] = CLIP(b);
+}
+
+/* Convert the pixels starting at x of a packed 4:2:2 line */
+static inline void packed_tail_to_rgb24(const unsigned char *src,
+		unsigned char *dest, int x, int width, int y_odd, int u_first,
+		int bgr)
+{
+	int y0 = y_odd ? 1 : 0;
+	int c0 = y_odd ? 0 : 1;
+	int u = u_first ? c0 : c0 + 2;
+	int v = u_first ? c0 + 2 : c0;
+
+	for (src += x * 2, dest += x * 3; x + 1 < width; x += 2) {
+		fast_pair_to_rgb24(src[y0], src[y0 + 2], src[u], src[v],
+				   dest, bgr);
+		src += 4;
+		dest += 6;
+	}
+}
+
+static inline void planar_tail_to_rgb24(const unsigned char *ysrc,
+		const unsigned char *usrc, const unsigned char *vsrc,
+		unsigned char *dest, int x, int width, int bgr)
+{
+	for (; x < width; x += 2)
+		fast_pair_to_rgb24(ysrc[x], ysrc[x + 1], usrc[x / 2], vsrc[x / 2],
+				   dest + x * 3, bgr);
+}
+
+static inline void nv12_tail_to_rgb24(const unsigned char *ysrc,
+		const unsigned char *uvsrc, unsigned char *dest, int x, int width,
+		int bgr)
+{
+	for (; x < width; x++)
+		accurate_pixel_to_rgb24(ysrc[x], uvsrc[x & ~1], uvsrc[x | 1],
+					dest + x * 3, bgr);
+}
+
+#ifdef HAVE_X86_SIMD
+
+/* Chroma offsets for the fast formula, u and v are already minus 128 */
+#define SSE2_FAST_CHROMA(u, v, rd, gd, bd)					\
+	do {									\
+		bd = _mm_srai_epi16(_mm_add_epi16(_mm_slli_epi16(u, 7), u), 6); \
+		gd = _mm_srai_epi16(_mm_add_epi16(				\
+			_mm_add_epi16(_mm_slli_epi16(u, 1), u),			\
+			_mm_add_epi16(_mm_slli_epi16(v, 2),			\
+				      _mm_slli_epi16(v, 1))), 3);		\
+		rd = _mm_srai_epi16(_mm_add_epi16(_mm_slli_epi16(v, 1), v), 1); \
+	} while (0)
+
+/*
+ * Chroma offsets for the accurate formula. (x * c) >> 10 is computed as the
+ * high half of (x << 4) * (c << 2), which is exact as x << 4 still fits.
+ */
+#define SSE2_ACCURATE_CHROMA(u, v, rd, gd, bd)					\
+	do {									\
+		const __m128i gmul = _mm_set_epi16(731, 352, 731, 352,		\
+						   731, 352, 731, 352);	\
+		rd = _mm_mulhi_epi16(_mm_slli_epi16(v, 4), _mm_set1_epi16(1436 * 4)); \
+		gd = _mm_packs_epi32(						\
+			_mm_srai_epi32(_mm_madd_epi16(_mm_unpacklo_epi16(u, v), gmul), 10), \
+			_mm_srai_epi32(_mm_madd_epi16(_mm_unpackhi_epi16(u, v), gmul), 10)); \
+		bd = _mm_mulhi_epi16(_mm_slli_epi16(u, 4), _mm_set1_epi16(1814 * 4)); \
+	} while (0)
+
+/* y, rd, gd and bd hold 2 x 8 pixels, lo and hi */
+#define SSE2_OUTPUT(dest, y_lo, y_hi, rd_lo, gd_lo, bd_lo, rd_hi, gd_hi, bd_hi, bgr) \
+	sse2_store_rgb24(dest,							\
+		_mm_packus_epi16(_mm_add_epi16(y_lo, rd_lo), _mm_add_epi16(y_hi, rd_hi)), \
+		_mm_packus_epi16(_mm_sub_epi16(y_lo, gd_lo), _mm_sub_epi16(y_hi, gd_hi)), \
+		_mm_packus_epi16(_mm_add_epi16(y_lo, bd_lo), _mm_add_epi16(y_hi, bd_hi)), \
+		bgr)
+
+/* Split 8 packed pixels into Y and per pixel (duplicated) U and V */
+__attribute__((target("sse2")))
+static inline void sse2_unpack_packed(__m128i in, int y_odd, int u_first,
+		__m128i *y, __m128i *u, __m128i *v)
+{
+	const __m128i lo_mask = _mm_set1_epi16(0x00ff);
+	const __m128i bias = _mm_set1_epi16(128);
+	__m128i c, c0, c1;
+
+	if (y_odd) {
+		*y = _mm_srli_epi16(in, 8);
+		c = _mm_and_si128(in, lo_mask);
+	} else {
+		*y = _mm_and_si128(in, lo_mask);
+		c = _mm_srli_epi16(in, 8);
+	}
+	c = _mm_sub_epi16(c, bias);
+	c0 = _mm_shufflehi_epi16(_mm_shufflelo_epi16(c, _MM_SHUFFLE(2, 2, 0, 0)),
+				 _MM_SHUFFLE(2, 2, 0, 0));
+	c1 = _mm_shufflehi_epi16(_mm_shufflelo_epi16(c, _MM_SHUFFLE(3, 3, 1, 1)),
+				 _MM_SHUFFLE(3, 3, 1, 1));
+	*u = u_first ? c0 : c1;
+	*v = u_first ? c1 : c0;
+}
+
+__attribute__((target("sse2")))
+static inline void sse2_packed_to_rgb24(const unsigned char *src,
+		unsigned char *dest, int width, int height, int stride,
+		int y_odd, int u_first, int bgr)
+{
+	__m128i y_lo, y_hi, u, v, rd_lo, gd_lo, bd_lo, rd_hi, gd_hi, bd_hi;
+	int x;
+
+	while (--height >= 0) {
+		for (x = 0; x + 16 <= width; x += 16) {
+			sse2_unpack_packed(_mm_loadu_si128((const __m128i *)(src + x * 2)),
+					   y_odd, u_first, &y_lo, &u, &v);
+			SSE2_FAST_CHROMA(u, v, rd_lo, gd_lo, bd_lo);
+			sse2_unpack_packed(_mm_loadu_si128((const __m128i *)(src + x * 2 + 16)),
+					   y_odd, u_first, &y_hi, &u, &v);
+			SSE2_FAST_CHROMA(u, v, rd_hi, gd_hi, bd_hi);
+			SSE2_OUTPUT(dest + x * 3, y_lo, y_hi, rd_lo, gd_lo, bd_lo,
+				    rd_hi, gd_hi, bd_hi, bgr);
+		}
+		packed_tail_to_rgb24(src, dest, x, width, y_odd, u_first, bgr);
+		src += stride;
+		dest += (width & ~1) * 3;
+	}
+}
+
+/* Load 8 chroma samples duplicated for 16 pixels, minus 128 */
+#define SSE2_DUP_CHROMA(c16, lo, hi)						\
+	do {									\
+		__m128i t = _mm_sub_epi16(c16, _mm_set1_epi16(128));		\
+		lo = _mm_unpacklo_epi16(t, t);					\
+		hi = _mm_unpackhi_epi16(t, t);					\
+	} while (0)
+
+__attribute__((target("sse2")))
+static inline void sse2_yuv420_to_rgb24(const unsigned char *src,
+		unsigned char *dest, int width, int height, int yvu, int bgr)
+{
+	const __m128i zero = _mm_setzero_si128();
+	const unsigned char *ysrc = src, *usrc, *vsrc;
+	__m128i y8, y_lo, y_hi, u_lo, u_hi, v_lo, v_hi;
+	__m128i rd_lo, gd_lo, bd_lo, rd_hi, gd_hi, bd_hi;
+	int x, i;
+
+	if (yvu) {
+		vsrc = src + width * height;
+		usrc = vsrc + (width * height) / 4;
+	} else {
+		usrc = src + width * height;
+		vsrc = usrc + (width * height) / 4;
+	}
+
+	for (i = 0; i < height; i++) {
+		const unsigned char *u = usrc + (i / 2) * (width / 2);
+		const unsigned char *v = vsrc + (i / 2) * (width / 2);
+
+		for (x = 0; x + 16 <= width; x += 16) {
+			y8 = _mm_loadu_si128((const __m128i *)(ysrc + x));
+			y_lo = _mm_unpacklo_epi8(y8, zero);
+			y_hi = _mm_unpackhi_epi8(y8, zero);
+			SSE2_DUP_CHROMA(_mm_unpacklo_epi8(
+				_mm_loadl_epi64((const __m128i *)(u + x / 2)), zero),
+				u_lo, u_hi);
+			SSE2_DUP_CHROMA(_mm_unpacklo_epi8(
+				_mm_loadl_epi64((const __m128i *)(v + x / 2)), zero),
+				v_lo, v_hi);
+			SSE2_FAST_CHROMA(u_lo, v_lo, rd_lo, gd_lo, bd_lo);
+			SSE2_FAST_CHROMA(u_hi, v_hi, rd_hi, gd_hi, bd_hi);
+			SSE2_OUTPUT(dest + x * 3, y_lo, y_hi, rd_lo, gd_lo, bd_lo,
+				    rd_hi, gd_hi, bd_hi, bgr);
+		}
+		planar_tail_to_rgb24(ysrc, u, v, dest, x, width, bgr);
+		ysrc += width;
+		dest += width * 3;
+	}
+}
+
+__attribute__((target("sse2")))
+static inline void sse2_nv12m_to_rgb24(const unsigned char *ysrc,
+		int ystride, const unsigned char *uvplane, int uvstride,
+		unsigned char *dest, int width, int height, int bgr)
+{
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i lo_mask = _mm_set1_epi16(0x00ff);
+	__m128i y8, uv, y_lo, y_hi, u_lo, u_hi, v_lo, v_hi;
+	__m128i rd_lo, gd_lo, bd_lo, rd_hi, gd_hi, bd_hi;
+	int x, i;
+
+	for (i = 0; i < height; i++) {
+		const unsigned char *uvsrc = uvplane + (i / 2) * uvstride;
+
+		for (x = 0; x + 16 <= width; x += 16) {
+			y8 = _mm_loadu_si128((const __m128i *)(ysrc + x));
+			y_lo = _mm_unpacklo_epi8(y8, zero);
+			y_hi = _mm_unpackhi_epi8(y8, zero);
+			uv = _mm_loadu_si128((const __m128i *)(uvsrc + x));
+			SSE2_DUP_CHROMA(_mm_and_si128(uv, lo_mask), u_lo, u_hi);
+			SSE2_DUP_CHROMA(_mm_srli_epi16(uv, 8), v_lo, v_hi);
+			SSE2_ACCURATE_CHROMA(u_lo, v_lo, rd_lo, gd_lo, bd_lo);
+			SSE2_ACCURATE_CHROMA(u_hi, v_hi, rd_hi, gd_hi, bd_hi);
+			SSE2_OUTPUT(dest + x * 3, y_lo, y_hi, rd_lo, gd_lo, bd_lo,
+				    rd_hi, gd_hi, bd_hi, bgr);
+		}
+		nv12_tail_to_rgb24(ysrc, uvsrc, dest, x, width, bgr);
+		ysrc += ystride;
+		dest += width * 3;
+	}
+}
+
+#ifdef CPU_BUILD_AVX2
+
+#define AVX2_FAST_CHROMA(u, v, rd, gd, bd)					\
+	do {									\
+		bd = _mm256_srai_epi16(_mm256_add_epi16(_mm256_slli_epi16(u, 7), u), 6); \
+		gd = _mm256_srai_epi16(_mm256_add_epi16(			\
+			_mm256_add_epi16(_mm256_slli_epi16(u, 1), u),		\
+			_mm256_add_epi16(_mm256_slli_epi16(v, 2),		\
+					 _mm256_slli_epi16(v, 1))), 3);		\
+		rd = _mm256_srai_epi16(_mm256_add_epi16(_mm256_slli_epi16(v, 1), v), 1); \
+	} while (0)
+
+#define AVX2_ACCURATE_CHROMA(u, v, rd, gd, bd)					\
+	do {									\
+		const __m256i gmul = _mm256_set1_epi32((731 << 16) | 352);	\
+		rd = _mm256_mulhi_epi16(_mm256_slli_epi16(v, 4),		\
+					_mm256_set1_epi16(1436 * 4));		\
+		gd = _mm256_packs_epi32(					\
+			_mm256_srai_epi32(_mm256_madd_epi16(_mm256_unpacklo_epi16(u, v), gmul), 10), \
+			_mm256_srai_epi32(_mm256_madd_epi16(_mm256_unpackhi_epi16(u, v), gmul), 10)); \
+		bd = _mm256_mulhi_epi16(_mm256_slli_epi16(u, 4),		\
+					_mm256_set1_epi16(1814 * 4));		\
+	} while (0)
+
+/* Store 32 pixels given as in order R, G and B vectors */
+__attribute__((target("avx2")))
+static inline void avx2_store_rgb24(unsigned char *dest, __m256i r, __m256i g,
+		__m256i b, int bgr)
+{
+	if (bgr) {
+		__m256i t = r;
+
+		r = b;
+		b = t;
+	}
+	avx2_store16_rgb24(dest, _mm256_castsi256_si128(r),
+			   _mm256_castsi256_si128(g), _mm256_castsi256_si128(b));
+	avx2_store16_rgb24(dest + 48, _mm256_extracti128_si256(r, 1),
+			   _mm256_extracti128_si256(g, 1),
+			   _mm256_extracti128_si256(b, 1));
+}
+
+/*
+ * a and b hold 2 x 16 pixels. When in_order is not set the pixels are spread
+ * over a and b per 128 bit lane (as with unpacklo / unpackhi), which
+ * packus undoes; otherwise a and b hold consecutive pixels and the 64 bit
+ * quarters need to be put back in order after packus.
+ */
+#define AVX2_PACK(a, b, in_order)						\
+	((in_order) ? _mm256_permute4x64_epi64(_mm256_packus_epi16(a, b),	\
+					       _MM_SHUFFLE(3, 1, 2, 0)) :	\
+		      _mm256_packus_epi16(a, b))
+
+#define AVX2_OUTPUT(dest, y_a, y_b, rd_a, gd_a, bd_a, rd_b, gd_b, bd_b, in_order, bgr) \
+	avx2_store_rgb24(dest,							\
+		AVX2_PACK(_mm256_add_epi16(y_a, rd_a), _mm256_add_epi16(y_b, rd_b), in_order), \
+		AVX2_PACK(_mm256_sub_epi16(y_a, gd_a), _mm256_sub_epi16(y_b, gd_b), in_order), \
+		AVX2_PACK(_mm256_add_epi16(y_a, bd_a), _mm256_add_epi16(y_b, bd_b), in_order), \
+		bgr)
+
+__attribute__((target("avx2")))
+static inline void avx2_unpack_packed(__m256i in, int y_odd, int u_first,
+		__m256i *y, __m256i *u, __m256i *v)
+{
+	const __m256i lo_mask = _mm256_set1_epi16(0x00ff);
+	const __m256i bias = _mm256_set1_epi16(128);
+	__m256i c, c0, c1;
+
+	if (y_odd) {
+		*y = _mm256_srli_epi16(in, 8);
+		c = _mm256_and_si256(in, lo_mask);
+	} else {
+		*y = _mm256_and_si256(in, lo_mask);
+		c = _mm256_srli_epi16(in, 8);
+	}
+	c = _mm256_sub_epi16(c, bias);
+	c0 = _mm256_shufflehi_epi16(_mm256_shufflelo_epi16(c, _MM_SHUFFLE(2, 2, 0, 0)),
+				    _MM_SHUFFLE(2, 2, 0, 0));
+	c1 = _mm256_shufflehi_epi16(_mm256_shufflelo_epi16(c, _MM_SHUFFLE(3, 3, 1, 1)),
+				    _MM_SHUFFLE(3, 3, 1, 1));
+	*u = u_first ? c0 : c1;
+	*v = u_first ? c1 : c0;
+}
+
+__attribute__((target("avx2")))
+static inline void avx2_packed_to_rgb24(const unsigned char *src,
+		unsigned char *dest, int width, int height, int stride,
+		int y_odd, int u_first, int bgr)
+{
+	__m256i y_a, y_b, u, v, rd_a, gd_a, bd_a, rd_b, gd_b, bd_b;
+	int x;
+
+	while (--height >= 0) {
+		for (x = 0; x + 32 <= width; x += 32) {
+			avx2_unpack_packed(_mm256_loadu_si256((const __m256i *)(src + x * 2)),
+					   y_odd, u_first, &y_a, &u, &v);
+			AVX2_FAST_CHROMA(u, v, rd_a, gd_a, bd_a);
+			avx2_unpack_packed(_mm256_loadu_si256((const __m256i *)(src + x * 2 + 32)),
+					   y_odd, u_first, &y_b, &u, &v);
+			AVX2_FAST_CHROMA(u, v, rd_b, gd_b, bd_b);
+			AVX2_OUTPUT(dest + x * 3, y_a, y_b, rd_a, gd_a, bd_a,
+				    rd_b, gd_b, bd_b, 1, bgr);
+		}
+		packed_tail_to_rgb24(src, dest, x, width, y_odd, u_first, bgr);
+		src += stride;
+		dest += (width & ~1) * 3;
+	}
+}
+
+/* 16 chroma samples duplicated for 32 pixels, minus 128, lane spread */
+#define AVX2_DUP_CHROMA(c16, a, b)						\
+	do {									\
+		__m256i t = _mm256_sub_epi16(c16, _mm256_set1_epi16(128));	\
+		a = _mm256_unpacklo_epi16(t, t);				\
+		b = _mm256_unpackhi_epi16(t, t);				\
+	} while (0)
+
+__attribute__((target("avx2")))
+static inline void avx2_yuv420_to_rgb24(const unsigned char *src,
+		unsigned char *dest, int width, int height, int yvu, int bgr)
+{
+	const __m256i zero = _mm256_setzero_si256();
+	const unsigned char *ysrc = src, *usrc, *vsrc;
+	__m256i y8, y_a, y_b, u_a, u_b, v_a, v_b;
+	__m256i rd_a, gd_a, bd_a, rd_b, gd_b, bd_b;
+	int x, i;
+
+	if (yvu) {
+		vsrc = src + width * height;
+		usrc = vsrc + (width * height) / 4;
+	} else {
+		usrc = src + width * height;
+		vsrc = usrc + (width * height) / 4;
+	}
+
+	for (i = 0; i < height; i++) {
+		const unsigned char *u = usrc + (i / 2) * (width / 2);
+		const unsigned char *v = vsrc + (i / 2) * (width / 2);
+
+		for (x = 0; x + 32 <= width; x += 32) {
+			y8 = _mm256_loadu_si256((const __m256i *)(ysrc + x));
+			y_a = _mm256_unpacklo_epi8(y8, zero);
+			y_b = _mm256_unpackhi_epi8(y8, zero);
+			AVX2_DUP_CHROMA(_mm256_cvtepu8_epi16(
+				_mm_loadu_si128((const __m128i *)(u + x / 2))),
+				u_a, u_b);
+			AVX2_DUP_CHROMA(_mm256_cvtepu8_epi16(
+				_mm_loadu_si128((const __m128i *)(v + x / 2))),
+				v_a, v_b);
+			AVX2_FAST_CHROMA(u_a, v_a, rd_a, gd_a, bd_a);
+			AVX2_FAST_CHROMA(u_b, v_b, rd_b, gd_b, bd_b);
+			AVX2_OUTPUT(dest + x * 3, y_a, y_b, rd_a, gd_a, bd_a,
+				    rd_b, gd_b, bd_b, 0, bgr);
+		}
+		planar_tail_to_rgb24(ysrc, u, v, dest, x, width, bgr);
+		ysrc += width;
+		dest += width * 3;
+	}
+}
+
+__attribute__((target("avx2")))
+static inline void avx2_nv12m_to_rgb24(const unsigned char *ysrc,
+		int ystride, const unsigned char *uvplane, int uvstride,
+		unsigned char *dest, int width, int height, int bgr)
+{
+	const __m256i zero = _mm256_setzero_si256();
+	const __m256i lo_mask = _mm256_set1_epi16(0x00ff);
+	__m256i y8, uv, y_a, y_b, u_a, u_b, v_a, v_b;
+	__m256i rd_a, gd_a, bd_a, rd_b, gd_b, bd_b;
+	int x, i;
+
+	for (i = 0; i < height; i++) {
+		const unsigned char *uvsrc = uvplane + (i / 2) * uvstride;
+
+		for (x = 0; x + 32 <= width; x += 32) {
+			y8 = _mm256_loadu_si256((const __m256i *)(ysrc + x));
+			y_a = _mm256_unpacklo_epi8(y8, zero);
+			y_b = _mm256_unpackhi_epi8(y8, zero);
+			uv = _mm256_loadu_si256((const __m256i *)(uvsrc + x));
+			AVX2_DUP_CHROMA(_mm256_and_si256(uv, lo_mask), u_a, u_b);
+			AVX2_DUP_CHROMA(_mm256_srli_epi16(uv, 8), v_a, v_b);
+			AVX2_ACCURATE_CHROMA(u_a, v_a, rd_a, gd_a, bd_a);
+			AVX2_ACCURATE_CHROMA(u_b, v_b, rd_b, gd_b, bd_b);
+			AVX2_OUTPUT(dest + x * 3, y_a, y_b, rd_a, gd_a, bd_a,
+				    rd_b, gd_b, bd_b, 0, bgr);
+		}
+		nv12_tail_to_rgb24(ysrc, uvsrc, dest, x, width, bgr);
+		ysrc += ystride;
+		dest += width * 3;
+	}
+}
+
+#endif /* CPU_BUILD_AVX2 */
+
+#define DEFINE_X86_KERNELS(isa)							\
+__attribute__((target(#isa)))							\
+static void isa##_yuyv_to_rgb24(const unsigned char *src, unsigned char *dest, \
+		int width, int height, int stride)				\
+{										\
+	isa##_packed_to_rgb24(src, dest, width, height, stride, PACKED_YUYV, 0); \
+}										\
+__attribute__((target(#isa)))							\
+static void isa##_yuyv_to_bgr24(const unsigned char *src, unsigned char *dest, \
+		int width, int height, int stride)				\
+{										\
+	isa##_packed_to_rgb24(src, dest, width, height, stride, PACKED_YUYV, 1); \
+}										\
+__attribute__((target(#isa)))							\
+static void isa##_yvyu_to_rgb24(const unsigned char *src, unsigned char *dest, \
+		int width, int height, int stride)				\
+{										\
+	isa##_packed_to_rgb24(src, dest, width, height, stride, PACKED_YVYU, 0); \
+}										\
+__attribute__((target(#isa)))							\
+static void isa##_yvyu_to_bgr24(const unsigned char *src, unsigned char *dest, \
+		int width, int height, int stride)				\
+{										\
+	isa##_packed_to_rgb24(src, dest, width, height, stride, PACKED_YVYU, 1); \
+}										\
+__attribute__((target(#isa)))							\
+static void isa##_uyvy_to_rgb24(const unsigned char *src, unsigned char *dest, \
+		int width, int height, int stride)				\
+{										\
+	isa##_packed_to_rgb24(src, dest, width, height, stride, PACKED_UYVY, 0); \
+}										\
+__attribute__((target(#isa)))							\
+static void isa##_uyvy_to_bgr24(const unsigned char *src, unsigned char *dest, \
+		int width, int height, int stride)				\
+{										\
+	isa##_packed_to_rgb24(src, dest, width, height, stride, PACKED_UYVY, 1); \
+}										\
+__attribute__((target(#isa)))							\
+static void isa##_yuv420p_to_rgb24(const unsigned char *src, unsigned char *dest, \
+		int width, int height, int yvu)					\
+{										\
+	isa##_yuv420_to_rgb24(src, dest, width, height, yvu, 0);		\
+}										\
+__attribute__((target(#isa)))							\
+static void isa##_yuv420p_to_bgr24(const unsigned char *src, unsigned char *dest, \
+		int width, int height, int yvu)					\
+{										\
+	isa##_yuv420_to_rgb24(src, dest, width, height, yvu, 1);		\
+}										\
+__attribute__((target(#isa)))							\
+static void isa##_nv12_to_rgb24(const unsigned char *src,			\
+		unsigned char *dest, int width, int height, int bgr)		\
+{										\
+	isa##_nv12m_to_rgb24(src, width, src + width * height, width,	\
+			     dest, width, height, bgr);			\
+}										\
+__attribute__((target(#isa)))							\
+static void isa##_nv12m_to_rgb24_bgr24(const unsigned char *ysrc,		\
+		int ystride, const unsigned char *uvsrc, int uvstride,		\
+		unsigned char *dest, int width, int height, int bgr)		\
+{										\
+	isa##_nv12m_to_rgb24(ysrc, ystride, uvsrc, uvstride, dest,		\
+			     width, height, bgr);				\
+}										\
+static const struct v4lconvert_yuv_kernels isa##_yuv_kernels = {		\
+	.yuyv_to_rgb24 = isa##_yuyv_to_rgb24,					\
+	.yuyv_to_bgr24 = isa##_yuyv_to_bgr24,					\
+	.yvyu_to_rgb24 = isa##_yvyu_to_rgb24,					\
+	.yvyu_to_bgr24 = isa##_yvyu_to_bgr24,					\
+	.uyvy_to_rgb24 = isa##_uyvy_to_rgb24,					\
+	.uyvy_to_bgr24 = isa##_uyvy_to_bgr24,					\
+	.yuv420_to_rgb24 = isa##_yuv420p_to_rgb24,				\
+	.yuv420_to_bgr24 = isa##_yuv420p_to_bgr24,				\
+	.nv12_to_rgb24 = isa##_nv12_to_rgb24,					\
+	.nv12m_to_rgb24 = isa##_nv12m_to_rgb24_bgr24,				\
+};
+
+DEFINE_X86_KERNELS(sse2)
+#ifdef CPU_BUILD_AVX2
+DEFINE_X86_KERNELS(avx2)
+#endif
+
+#endif /* HAVE_X86_SIMD */
+
+#ifdef HAVE_NEON_SIMD
+
+struct neon_deltas {
+	int16x8_t r, g, b;
+};
+
+/* u and v are 8 chroma samples shared by 16 pixels */
+static inline struct neon_deltas neon_fast_chroma(uint8x8_t u8, uint8x8_t v8)
+{
+	const int16x8_t bias = vdupq_n_s16(128);
+	int16x8_t u = vsubq_s16(vreinterpretq_s16_u16(vmovl_u8(u8)), bias);
+	int16x8_t v = vsubq_s16(vreinterpretq_s16_u16(vmovl_u8(v8)), bias);
+	struct neon_deltas d;
+
+	d.b = vshrq_n_s16(vaddq_s16(vshlq_n_s16(u, 7), u), 6);
+	d.g = vshrq_n_s16(vaddq_s16(vaddq_s16(vshlq_n_s16(u, 1), u),
+				    vaddq_s16(vshlq_n_s16(v, 2),
+					      vshlq_n_s16(v, 1))), 3);
+	d.r = vshrq_n_s16(vaddq_s16(vshlq_n_s16(v, 1), v), 1);
+
+	return d;
+}
+
+static inline struct neon_deltas neon_accurate_chroma(uint8x8_t u8,
+		uint8x8_t v8)
+{
+	const int16x8_t bias = vdupq_n_s16(128);
+	int16x8_t u = vsubq_s16(vreinterpretq_s16_u16(vmovl_u8(u8)), bias);
+	int16x8_t v = vsubq_s16(vreinterpretq_s16_u16(vmovl_u8(v8)), bias);
+	struct neon_deltas d;
+
+	d.r = vcombine_s16(
+		vshrn_n_s32(vmull_n_s16(vget_low_s16(v), 1436), 10),
+		vshrn_n_s32(vmull_n_s16(vget_high_s16(v), 1436), 10));
+	d.g = vcombine_s16(
+		vshrn_n_s32(vmlal_n_s16(vmull_n_s16(vget_low_s16(u), 352),
+					vget_low_s16(v), 731), 10),
+		vshrn_n_s32(vmlal_n_s16(vmull_n_s16(vget_high_s16(u), 352),
+					vget_high_s16(v), 731), 10));
+	d.b = vcombine_s16(
+		vshrn_n_s32(vmull_n_s16(vget_low_s16(u), 1814), 10),
+		vshrn_n_s32(vmull_n_s16(vget_high_s16(u), 1814), 10));
+
+	return d;
+}
+
+/* Store 16 pixels, given as 8 even and 8 odd luma samples */
+static inline void neon_store_rgb24(unsigned char *dest, uint8x8_t y_even,
+		uint8x8_t y_odd, struct neon_deltas d, int bgr)
+{
+	int16x8_t ye = vreinterpretq_s16_u16(vmovl_u8(y_even));
+	int16x8_t yo = vreinterpretq_s16_u16(vmovl_u8(y_odd));
+	uint8x8x2_t r = vzip_u8(vqmovun_s16(vaddq_s16(ye, d.r)),
+				vqmovun_s16(vaddq_s16(yo, d.r)));
+	uint8x8x2_t g = vzip_u8(vqmovun_s16(vsubq_s16(ye, d.g)),
+				vqmovun_s16(vsubq_s16(yo, d.g)));
+	uint8x8x2_t b = vzip_u8(vqmovun_s16(vaddq_s16(ye, d.b)),
+				vqmovun_s16(vaddq_s16(yo, d.b)));
+	uint8x16x3_t out;
+
+	out.val[bgr ? 2 : 0] = vcombine_u8(r.val[0], r.val[1]);
+	out.val[1] = vcombine_u8(g.val[0], g.val[1]);
+	out.val[bgr ? 0 : 2] = vcombine_u8(b.val[0], b.val[1]);
+	vst3q_u8(dest, out);
+}
+
+static inline void neon_packed_to_rgb24(const unsigned char *src,
+		unsigned char *dest, int width, int height, int stride,
+		int y_odd, int u_first, int bgr)
+{
+	int c0 = y_odd ? 0 : 1;
+	int y0 = y_odd ? 1 : 0;
+	int x;
+
+	while (--height >= 0) {
+		for (x = 0; x + 16 <= width; x += 16) {
+			uint8x8x4_t in = vld4_u8(src + x * 2);
+			uint8x8_t u = in.val[u_first ? c0 : c0 + 2];
+			uint8x8_t v = in.val[u_first ? c0 + 2 : c0];
+
+			neon_store_rgb24(dest + x * 3, in.val[y0], in.val[y0 + 2],
+					 neon_fast_chroma(u, v), bgr);
+		}
+		packed_tail_to_rgb24(src, dest, x, width, y_odd, u_first, bgr);
+		src += stride;
+		dest += (width & ~1) * 3;
+	}
+}
+
+static inline void neon_yuv420_to_rgb24(const unsigned char *src,
+		unsigned char *dest, int width, int height, int yvu, int bgr)
+{
+	const unsigned char *ysrc = src, *usrc, *vsrc;
+	int x, i;
+
+	if (yvu) {
+		vsrc = src + width * height;
+		usrc = vsrc + (width * height) / 4;
+	} else {
+		usrc = src + width * height;
+		vsrc = usrc + (width * height) / 4;
+	}
+
+	for (i = 0; i < height; i++) {
+		const unsigned char *u = usrc + (i / 2) * (width / 2);
+		const unsigned char *v = vsrc + (i / 2) * (width / 2);
+
+		for (x = 0; x + 16 <= width; x += 16) {
+			uint8x8x2_t y = vld2_u8(ysrc + x);
+
+			neon_store_rgb24(dest + x * 3, y.val[0], y.val[1],
+					 neon_fast_chroma(vld1_u8(u + x / 2),
+							  vld1_u8(v + x / 2)),
+					 bgr);
+		}
+		planar_tail_to_rgb24(ysrc, u, v, dest, x, width, bgr);
+		ysrc += width;
+		dest += width * 3;
+	}
+}
+
+static void neon_nv12m_to_rgb24(const unsigned char *ysrc, int ystride,
+		const unsigned char *uvplane, int uvstride, unsigned char *dest,
+		int width, int height, int bgr)
+{
+	int x, i;
+
+	for (i = 0; i < height; i++) {
+		const unsigned char *uvsrc = uvplane + (i / 2) * uvstride;
+
+		for (x = 0; x + 16 <= width; x += 16) {
+			uint8x8x2_t y = vld2_u8(ysrc + x);
+			uint8x8x2_t uv = vld2_u8(uvsrc + x);
+
+			neon_store_rgb24(dest + x * 3, y.val[0], y.val[1],
+					 neon_accurate_chroma(uv.val[0], uv.val[1]),
+					 bgr);
+		}
+		nv12_tail_to_rgb24(ysrc, uvsrc, dest, x, width, bgr);
+		ysrc += ystride;
+		dest += width * 3;
+	}
+}
+
+static void neon_nv12_to_rgb24(const unsigned char *src, unsigned char *dest,
+		int width, int height, int bgr)
+{
+	neon_nv12m_to_rgb24(src, width, src + width * height, width, dest,
+			    width, height, bgr);
+}
+
+static void neon_yuyv_to_rgb24(const unsigned char *src, unsigned char *dest,
+		int width, int height, int stride)
+{
+	neon_packed_to_rgb24(src, dest, width, height, stride, PACKED_YUYV, 0);
+}
+
+static void neon_yuyv_to_bgr24(const unsigned char *src, unsigned char *dest,
+		int width, int height, int stride)
+{
+	neon_packed_to_rgb24(src, dest, width, height, stride, PACKED_YUYV, 1);
+}
+
+static void neon_yvyu_to_rgb24(const unsigned char *src, unsigned char *dest,
+		int width, int height, int stride)
+{
+	neon_packed_to_rgb24(src, dest, width, height, stride, PACKED_YVYU, 0);
+}
+
+static void neon_yvyu_to_bgr24(const unsigned char *src, unsigned char *dest,
+		int width, int height, int stride)
+{
+	neon_packed_to_rgb24(src, dest, width, height, stride, PACKED_YVYU, 1);
+}
+
+static void neon_uyvy_to_rgb24(const unsigned char *src, unsigned char *dest,
+		int width, int height, int stride)
+{
+	neon_packed_to_rgb24(src, dest, width, height, stride, PACKED_UYVY, 0);
+}
+
+static void neon_uyvy_to_bgr24(const unsigned char *src, unsigned char *dest,
+		int width, int height, int stride)
+{
+	neon_packed_to_rgb24(src, dest, width, height, stride, PACKED_UYVY, 1);
+}
+
+static void neon_yuv420p_to_rgb24(const unsigned char *src, unsigned char *dest,
+		int width, int height, int yvu)
+{
+	neon_yuv420_to_rgb24(src, dest, width, height, yvu, 0);
+}
+
+static void neon_yuv420p_to_bgr24(const unsigned char *src, unsigned char *dest,
+		int width, int height, int yvu)
+{
+	neon_yuv420_to_rgb24(src, dest, width, height, yvu, 1);
+}
+
+static const struct v4lconvert_yuv_kernels neon_yuv_kernels = {
+	.yuyv_to_rgb24 = neon_yuyv_to_rgb24,
+	.yuyv_to_bgr24 = neon_yuyv_to_bgr24,
+	.yvyu_to_rgb24 = neon_yvyu_to_rgb24,
+	.yvyu_to_bgr24 = neon_yvyu_to_bgr24,
+	.uyvy_to_rgb24 = neon_uyvy_to_rgb24,
+	.uyvy_to_bgr24 = neon_uyvy_to_bgr24,
+	.yuv420_to_rgb24 = neon_yuv420p_to_rgb24,
+	.yuv420_to_bgr24 = neon_yuv420p_to_bgr24,
+	.nv12_to_rgb24 = neon_nv12_to_rgb24,
+	.nv12m_to_rgb24 = neon_nv12m_to_rgb24,
+};
+
+#endif /* HAVE_NEON_SIMD */
+
+const struct v4lconvert_yuv_kernels v4lconvert_yuv_kernels_c = {
+	.yuyv_to_rgb24 = v4lconvert_yuyv_to_rgb24,
+	.yuyv_to_bgr24 = v4lconvert_yuyv_to_bgr24,
+	.yvyu_to_rgb24 = v4lconvert_yvyu_to_rgb24,
+	.yvyu_to_bgr24 = v4lconvert_yvyu_to_bgr24,
+	.uyvy_to_rgb24 = v4lconvert_uyvy_to_rgb24,
+	.uyvy_to_bgr24 = v4lconvert_uyvy_to_bgr24,
+	.yuv420_to_rgb24 = v4lconvert_yuv420_to_rgb24,
+	.yuv420_to_bgr24 = v4lconvert_yuv420_to_bgr24,
+	.nv12_to_rgb24 = v4lconvert_nv12_to_rgb24,
+	.nv12m_to_rgb24 = v4lconvert_nv12m_to_rgb24,
+};
+
+static const struct cpu_kernel_variant yuv_variants[] = {
+#ifdef CPU_BUILD_AVX2
+	{ "avx2", CPU_FEATURE_AVX2, &avx2_yuv_kernels },
+#endif
+#ifdef HAVE_X86_SIMD
+	{ "sse2", CPU_FEATURE_SSE2, &sse2_yuv_kernels },
+#endif
+#ifdef HAVE_NEON_SIMD
+	{ "neon", CPU_FEATURE_NEON, &neon_yuv_kernels },
+#endif
+	{ "c", 0, &v4lconvert_yuv_kernels_c },
+};
+
+const struct v4lconvert_yuv_kernels *v4lconvert_get_yuv_kernels(void)
+{
+	return cpu_select_kernels(yuv_variants, v4lconvert_get_cpu_flags());
+}
@@ -602,55 +602,92 @@ void v4lconvert_rgb565_to_yuv420(const unsigned char *src, unsigned char *dest,
 	}
 }
 
-void v4lconvert_y16_to_rgb24(const unsigned char *src, unsigned char *dest,
-		int width, int height, int little_endian)
+static void grey_to_rgb24(const struct v4lconvert_unpack_kernels *simd,
+		const unsigned char *src, unsigned char *dest, int pixels)
 {
-	int j;
-
-	if (little_endian)
+	int i = simd->grey_to_rgb24(src, dest, pixels);
+
+	src += i;
+	dest += 3 * i;
+	for (; i < pixels; i++) {
+		*dest++ = *src;
+		*dest++ = *src;
+		*dest++ = *src;
 		src++;
-
-	while (--height >= 0) {
-		for (j = 0; j < width; j++) {
-			*dest++ = *src;
-			*dest++ = *src;
-			*dest++ = *src;
-			src+=2;
-		}
 	}
 }
 
+/* Little endian 16 bit samples to 8 bit, shift is 8 to take the msb */
+static void u16_to_grey(const struct v4lconvert_unpack_kernels *simd,
+		const unsigned char *src, unsigned char *dest, int pixels,
+		int shift)
+{
+	int i = simd->u16_to_8(src, dest, pixels, shift);
+
+	for (; i < pixels; i++)
+		dest[i] = (src[2 * i] | (src[2 * i + 1] << 8)) >> shift;
+}
+
+/* The 8 msb of each Y10B pixel, 4 pixels are packed big endian in 5 bytes */
+static void y10b_to_grey(const struct v4lconvert_unpack_kernels *simd,
+		const unsigned char *src, unsigned char *dest, int pixels)
+{
+	int i = simd->y10b_to_8(src, dest, pixels);
+
+	src += i / 4 * 5;
+	for (; i + 4 <= pixels; i += 4) {
+		dest[i] = src[0];
+		dest[i + 1] = (src[1] << 2) | (src[2] >> 6);
+		dest[i + 2] = (src[2] << 4) | (src[3] >> 4);
+		dest[i + 3] = (src[3] << 6) | (src[4] >> 2);
+		src += 5;
+	}
+	/* The frame size need not be a multiple of 4 pixels */
+	if (i < pixels)
+		dest[i++] = src[0];
+	if (i < pixels)
+		dest[i++] = (src[1] << 2) | (src[2] >> 6);
+	if (i < pixels)
+		dest[i] = (src[2] << 4) | (src[3] >> 4);
+}
+
+/*
+ * The Y16 and Y10B to RGB24 conversions below first reduce the frame to
+ * 8 bits in the last third of dest, and then expand that to the whole of
+ * dest, this is fine as pixel i is only written after it has been read.
+ */
+
+void v4lconvert_y16_to_rgb24(const unsigned char *src, unsigned char *dest,
+		int width, int height, int little_endian)
+{
+	const struct v4lconvert_unpack_kernels *simd =
+		v4lconvert_get_unpack_kernels();
+	int pixels = width * height;
+	unsigned char *grey = dest + 2 * pixels;
+
+	/* For big endian the msb is the low byte of a little endian read */
+	u16_to_grey(simd, src, grey, pixels, little_endian ? 8 : 0);
+	grey_to_rgb24(simd, grey, dest, pixels);
+}
+
 void v4lconvert_y16_to_yuv420(const unsigned char *src, unsigned char *dest,
 		const struct v4l2_format *src_fmt, int little_endian)
 {
-	int x, y;
-
-	if (little_endian)
-		src++;
+	int pixels = src_fmt->fmt.pix.width * src_fmt->fmt.pix.height;
 
 	/* Y */
-	for (y = 0; y < src_fmt->fmt.pix.height; y++)
-		for (x = 0; x < src_fmt->fmt.pix.width; x++){
-			*dest++ = *src;
-			src+=2;
-		}
+	u16_to_grey(v4lconvert_get_unpack_kernels(), src, dest, pixels,
+		    little_endian ? 8 : 0);
 
 	/* Clear U/V */
-	memset(dest, 0x80, src_fmt->fmt.pix.width * src_fmt->fmt.pix.height / 2);
+	memset(dest + pixels, 0x80, pixels / 2);
 }
 
 void v4lconvert_grey_to_rgb24(const unsigned char *src, unsigned char *dest,
 		int width, int height)
 {
-	int j;
-	while (--height >= 0) {
-		for (j = 0; j < width; j++) {
-			*dest++ = *src;
-			*dest++ = *src;
-			*dest++ = *src;
-			src++;
-		}
-	}
+	grey_to_rgb24(v4lconvert_get_unpack_kernels(), src, dest,
+		      width * height);
 }
 
 void v4lconvert_grey_to_yuv420(const unsigned char *src, unsigned char *dest,
@@ -667,84 +704,29 @@ void v4lconvert_grey_to_yuv420(const unsigned char *src, unsigned char *dest,
 	memset(dest, 0x80, src_fmt->fmt.pix.width * src_fmt->fmt.pix.height / 2);
 }
 
-/* Unpack buffer of (vw bit) data into padded 16bit buffer. */
-static inline void convert_packed_to_16bit(const uint8_t *raw, uint16_t *unpacked,
-					   int vw, int unpacked_len)
-{
-	int mask = (1 << vw) - 1;
-	uint32_t buffer = 0;
-	int bitsIn = 0;
-	while (unpacked_len--) {
-		while (bitsIn < vw) {
-			buffer = (buffer << 8) | *(raw++);
-			bitsIn += 8;
-		}
-		bitsIn -= vw;
-		*(unpacked++) = (buffer >> bitsIn) & mask;
-	}
-}
-
 int v4lconvert_y10b_to_rgb24(struct v4lconvert_data *data,
 	const unsigned char *src, unsigned char *dest, int width, int height)
 {
-	unsigned char *unpacked_buffer;
-
-	unpacked_buffer = v4lconvert_alloc_buffer(width * height * 2,
-					&data->convert_pixfmt_buf,
-					&data->convert_pixfmt_buf_size);
-	if (!unpacked_buffer)
-		return v4lconvert_oom_error(data);
-
-	convert_packed_to_16bit((uint8_t *)src, (uint16_t *)unpacked_buffer,
-				10, width * height);
-
-	int j;
-	unsigned short *tmp = (unsigned short *)unpacked_buffer;
-	while (--height >= 0) {
-		for (j = 0; j < width; j++) {
-
-			/* Only 10 useful bits, so we discard the LSBs */
-			*dest++ = (*tmp & 0x3ff) >> 2;
-			*dest++ = (*tmp & 0x3ff) >> 2;
-			*dest++ = (*tmp & 0x3ff) >> 2;
-
-			/* +1 means two bytes as we are dealing with (unsigned short) */
-			tmp += 1;
-		}
-	}
+	const struct v4lconvert_unpack_kernels *simd =
+		v4lconvert_get_unpack_kernels();
+	int pixels = width * height;
+	unsigned char *grey = dest + 2 * pixels;
+
+	/* Only 10 useful bits, so we discard the LSBs */
+	y10b_to_grey(simd, src, grey, pixels);
+	grey_to_rgb24(simd, grey, dest, pixels);
 	return 0;
 }
 
 int v4lconvert_y10b_to_yuv420(struct v4lconvert_data *data,
 	const unsigned char *src, unsigned char *dest, int width, int height)
 {
-	unsigned char *unpacked_buffer;
-
-	unpacked_buffer = v4lconvert_alloc_buffer(width * height * 2,
-					&data->convert_pixfmt_buf,
-					&data->convert_pixfmt_buf_size);
-	if (!unpacked_buffer)
-		return v4lconvert_oom_error(data);
-
-	convert_packed_to_16bit((uint8_t *)src, (uint16_t *)unpacked_buffer,
-				10, width * height);
-
-	int x, y;
-	unsigned short *tmp = (unsigned short *)unpacked_buffer;
-
-	/* Y */
-	for (y = 0; y < height; y++)
-		for (x = 0; x < width; x++) {
-
-			/* Only 10 useful bits, so we discard the LSBs */
-			*dest++ = (*tmp & 0x3ff) >> 2;
-
-			/* +1 means two bytes as we are dealing with (unsigned short) */
-			tmp += 1;
-		}
+	/* Y, only 10 useful bits, so we discard the LSBs */
+	y10b_to_grey(v4lconvert_get_unpack_kernels(), src, dest,
+		     width * height);
 
 	/* Clear U/V */
-	memset(dest, 0x80, width * height / 2);
+	memset(dest + width * height, 0x80, width * height / 2);
 
 	return 0;
 }
@@ -771,6 +753,128 @@ void v4lconvert_rgb32_to_rgb24(const unsigned char *src, unsigned char *dest,
 	}
 }
 
+/* Goes backwards through the frame, so that src and dest may be the same */
+void v4lconvert_rgb24_to_rgb32(const unsigned char *src, unsigned char *dest,
+		int width, int height, int x_first)
+{
+	int i = width * height;
+
+	src += i * 3;
+	dest += i * 4;
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+	/* 4 pixels at a time as 3 words in and 4 words out, still backwards so
+	   that this keeps working in place */
+	while (i >= 4) {
+		uint32_t w[3], o[4];
+
+		src -= 12;
+		dest -= 16;
+		i -= 4;
+		memcpy(w, src, sizeof(w));
+		if (x_first) {
+			o[0] = 0xff | (w[0] << 8);
+			o[1] = 0xff | ((w[0] >> 24) << 8) | (w[1] << 16);
+			o[2] = 0xff | ((w[1] >> 16) << 8) | (w[2] << 24);
+			o[3] = 0xff | (w[2] & 0xffffff00);
+		} else {
+			o[0] = (w[0] & 0xffffff) | 0xff000000;
+			o[1] = (w[0] >> 24) | ((w[1] & 0xffff) << 8) | 0xff000000;
+			o[2] = (w[1] >> 16) | ((w[2] & 0xff) << 16) | 0xff000000;
+			o[3] = (w[2] >> 8) | 0xff000000;
+		}
+		memcpy(dest, o, sizeof(o));
+	}
+#endif
+	while (--i >= 0) {
+		unsigned char c0, c1, c2;
+
+		src -= 3;
+		dest -= 4;
+		c0 = src[0];
+		c1 = src[1];
+		c2 = src[2];
+		if (x_first) {
+			dest[3] = c2;
+			dest[2] = c1;
+			dest[1] = c0;
+			dest[0] = 0xff;
+		} else {
+			dest[3] = 0xff;
+			dest[2] = c2;
+			dest[1] = c1;
+			dest[0] = c0;
+		}
+	}
+}
+
+void v4lconvert_yuv420_to_nv12(const unsigned char *src, unsigned char *dest,
+		unsigned char *tmp, int width, int height)
+{
+	unsigned int i, chroma = width * height / 4;
+	const unsigned char *u = src + width * height;
+	const unsigned char *v = u + chroma;
+	unsigned char *uv = dest + width * height;
+
+	/* In place the U plane gets overwritten first, V values are always
+	   read before being overwritten */
+	if (src == dest) {
+		memcpy(tmp, u, chroma);
+		u = tmp;
+	} else {
+		memcpy(dest, src, width * height);
+	}
+
+	for (i = 0; i < chroma; i++) {
+		unsigned char cb = u[i], cr = v[i];
+
+		*uv++ = cb;
+		*uv++ = cr;
+	}
+}
+
+void v4lconvert_packed_yuv_to_nv12(const unsigned char *src,
+		unsigned char *dest, int width, int height, int stride,
+		unsigned int src_pix_fmt)
+{
+	const unsigned char *src1;
+	unsigned char *uv = dest + width * height;
+	int y_off = 0, u_off = 1, v_off = 3;
+	int i, j;
+
+	switch (src_pix_fmt) {
+	case V4L2_PIX_FMT_YVYU:
+		u_off = 3;
+		v_off = 1;
+		break;
+	case V4L2_PIX_FMT_UYVY:
+		y_off = 1;
+		u_off = 0;
+		v_off = 2;
+		break;
+	}
+
+	/* copy the Y values */
+	src1 = src + y_off;
+	for (i = 0; i < height; i++) {
+		for (j = 0; j + 1 < width; j += 2) {
+			*dest++ = src1[0];
+			*dest++ = src1[2];
+			src1 += 4;
+		}
+		src1 += stride - width * 2;
+	}
+
+	/* average the U and V values of each 2 lines */
+	for (i = 0; i + 1 < height; i += 2) {
+		src1 = src + i * stride;
+		for (j = 0; j + 1 < width; j += 2) {
+			*uv++ = ((int)src1[u_off] + src1[stride + u_off]) / 2;
+			*uv++ = ((int)src1[v_off] + src1[stride + v_off]) / 2;
+			src1 += 4;
+		}
+	}
+}
+
 static void hsvtorgb(const unsigned char *hsv, unsigned char *rgb,
 		     unsigned char hsv_enc)
 {
@@ -846,41 +950,46 @@ void v4lconvert_hsv_to_rgb24(const unsigned char *src, unsigned char *dest,
 		}
 }
 
-void v4lconvert_nv12_to_rgb24(const unsigned char *src, unsigned char *dest,
+/* NV12 with the Y and the interleaved UV plane each at their own address
+   and with their own stride, as found in NV12M buffers */
+void v4lconvert_nv12m_to_rgb24(const unsigned char *ysrc, int ystride,
+		const unsigned char *uvsrc, int uvstride, unsigned char *dest,
 		int width, int height, int bgr)
 {
 	int i, j;
-	const unsigned char *ysrc = src;
-	const unsigned char *uvsrc = src + width * height;
 
 	for (i = 0; i < height; i++) {
-		for (j = 0; j < width; j ++) {
+		const unsigned char *y = ysrc + i * ystride;
+		const unsigned char *uv = uvsrc + (i / 2) * uvstride;
+
+		for (j = 0; j < width; j++) {
+			int u = uv[j & ~1], v = uv[j | 1];
+
 			if (bgr) {
-				*dest++ = YUV2B(*ysrc, *uvsrc, *(uvsrc + 1));
-				*dest++ = YUV2G(*ysrc, *uvsrc, *(uvsrc + 1));
-				*dest++ = YUV2R(*ysrc, *uvsrc, *(uvsrc + 1));
+				*dest++ = YUV2B(y[j], u, v);
+				*dest++ = YUV2G(y[j], u, v);
+				*dest++ = YUV2R(y[j], u, v);
 			} else {
-				*dest++ = YUV2R(*ysrc, *uvsrc, *(uvsrc + 1));
-				*dest++ = YUV2G(*ysrc, *uvsrc, *(uvsrc + 1));
-				*dest++ = YUV2B(*ysrc, *uvsrc, *(uvsrc + 1));
+				*dest++ = YUV2R(y[j], u, v);
+				*dest++ = YUV2G(y[j], u, v);
+				*dest++ = YUV2B(y[j], u, v);
 			}
-			ysrc++;
-			if (j&1)
-				uvsrc += 2;
 		}
-
-		/* Rewind u and v for next line */
-		if (!(i&1))
-			uvsrc -= width;
 	}
 }
 
-void v4lconvert_nv12_to_yuv420(const unsigned char *src, unsigned char *dest,
+void v4lconvert_nv12_to_rgb24(const unsigned char *src, unsigned char *dest,
+		int width, int height, int bgr)
+{
+	v4lconvert_nv12m_to_rgb24(src, width, src + width * height, width,
+				  dest, width, height, bgr);
+}
+
+void v4lconvert_nv12m_to_yuv420(const unsigned char *ysrc, int ystride,
+		const unsigned char *uvsrc, int uvstride, unsigned char *dest,
 		int width, int height, int yvu)
 {
 	int i, j;
-	const unsigned char *ysrc = src;
-	const unsigned char *uvsrc = src + width * height;
 	unsigned char *ydst = dest;
 	unsigned char *udst, *vdst;
 
@@ -892,12 +1001,23 @@ void v4lconvert_nv12_to_yuv420(const unsigned char *src, unsigned char *dest,
 		vdst = udst + ((width / 2) * (height / 2));
 	}
 
-	for (i = 0; i < height; i++)
-		for (j = 0; j < width; j++) {
-			*ydst++ = *ysrc++;
-			if (((i % 2) == 0) && ((j % 2) == 0)) {
-				*udst++ = *uvsrc++;
-				*vdst++ = *uvsrc++;
-			}
+	for (i = 0; i < height; i++) {
+		const unsigned char *uv = uvsrc + (i / 2) * uvstride;
+
+		memcpy(ydst, ysrc + i * ystride, width);
+		ydst += width;
+		if (i % 2)
+			continue;
+		for (j = 0; j < width; j += 2) {
+			*udst++ = uv[j];
+			*vdst++ = uv[j + 1];
 		}
+	}
+}
+
+void v4lconvert_nv12_to_yuv420(const unsigned char *src, unsigned char *dest,
+		int width, int height, int yvu)
+{
+	v4lconvert_nv12m_to_yuv420(src, width, src + width * height, width,
+				   dest, width, height, yvu);
 }
@@ -0,0 +1,96 @@
+/*
+# Helpers shared by the SIMD conversion routines
+
+# This program is free software; you can redistribute it and/or modify
+# it under the terms of the GNU Lesser General Public License as published by
+# the Free Software Foundation; either version 2.1 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU Lesser General Public License for more details.
+#
+# You should have received a copy of the GNU Lesser General Public License
+# along with this program; if not, write to the Free Software
+# Foundation, Inc., 51 Franklin Street, Suite 500, Boston, MA  02110-1335  USA
+ */
+
+#ifndef __LIBV4LCONVERT_SIMD_PRIV_H
+#define __LIBV4LCONVERT_SIMD_PRIV_H
+
+#include <cpu-features.h>
+
+/* The AVX2 kernels reuse SSE2 code, so that is built for either */
+#if defined(CPU_BUILD_SSE) || defined(CPU_BUILD_AVX2)
+#include <immintrin.h>
+#define HAVE_X86_SIMD
+#endif
+
+#ifdef CPU_BUILD_NEON
+#include <arm_neon.h>
+#define HAVE_NEON_SIMD
+#endif
+
+#ifdef HAVE_X86_SIMD
+
+/* pshufb masks interleaving 16 R, G and B bytes into 48 bytes of RGB24 */
+static const unsigned char rgb24_shuffle[3][3][16] __attribute__((aligned(16))) = {
+	{
+		{  0, 0x80, 0x80,  1, 0x80, 0x80,  2, 0x80, 0x80,  3, 0x80, 0x80,  4, 0x80, 0x80,  5 },
+		{ 0x80,  0, 0x80, 0x80,  1, 0x80, 0x80,  2, 0x80, 0x80,  3, 0x80, 0x80,  4, 0x80, 0x80 },
+		{ 0x80, 0x80,  0, 0x80, 0x80,  1, 0x80, 0x80,  2, 0x80, 0x80,  3, 0x80, 0x80,  4, 0x80 },
+	}, {
+		{ 0x80, 0x80,  6, 0x80, 0x80,  7, 0x80, 0x80,  8, 0x80, 0x80,  9, 0x80, 0x80, 10, 0x80 },
+		{  5, 0x80, 0x80,  6, 0x80, 0x80,  7, 0x80, 0x80,  8, 0x80, 0x80,  9, 0x80, 0x80, 10 },
+		{ 0x80,  5, 0x80, 0x80,  6, 0x80, 0x80,  7, 0x80, 0x80,  8, 0x80, 0x80,  9, 0x80, 0x80 },
+	}, {
+		{ 0x80, 11, 0x80, 0x80, 12, 0x80, 0x80, 13, 0x80, 0x80, 14, 0x80, 0x80, 15, 0x80, 0x80 },
+		{ 0x80, 0x80, 11, 0x80, 0x80, 12, 0x80, 0x80, 13, 0x80, 0x80, 14, 0x80, 0x80, 15, 0x80 },
+		{ 10, 0x80, 0x80, 11, 0x80, 0x80, 12, 0x80, 0x80, 13, 0x80, 0x80, 14, 0x80, 0x80, 15 },
+	},
+};
+
+/* Store 16 pixels given as R, G and B vectors */
+__attribute__((target("sse2")))
+static inline void sse2_store_rgb24(unsigned char *dest, __m128i r, __m128i g,
+		__m128i b, int bgr)
+{
+	unsigned char c[3][16] __attribute__((aligned(16)));
+	int i;
+
+	_mm_store_si128((__m128i *)c[bgr ? 2 : 0], r);
+	_mm_store_si128((__m128i *)c[1], g);
+	_mm_store_si128((__m128i *)c[bgr ? 0 : 2], b);
+	for (i = 0; i < 16; i++) {
+		*dest++ = c[0][i];
+		*dest++ = c[1][i];
+		*dest++ = c[2][i];
+	}
+}
+
+#ifdef CPU_BUILD_AVX2
+
+/* Store 16 pixels given as R, G and B vectors */
+__attribute__((target("avx2")))
+static inline void avx2_store16_rgb24(unsigned char *dest, __m128i r,
+		__m128i g, __m128i b)
+{
+	int i;
+
+	for (i = 0; i < 3; i++) {
+		__m128i out = _mm_or_si128(
+			_mm_or_si128(
+				_mm_shuffle_epi8(r, _mm_load_si128((const __m128i *)rgb24_shuffle[i][0])),
+				_mm_shuffle_epi8(g, _mm_load_si128((const __m128i *)rgb24_shuffle[i][1]))),
+			_mm_shuffle_epi8(b, _mm_load_si128((const __m128i *)rgb24_shuffle[i][2])));
+
+		_mm_storeu_si128((__m128i *)(dest + i * 16), out);
+	}
+}
+
+#endif /* CPU_BUILD_AVX2 */
+
+#endif /* HAVE_X86_SIMD */
+
+#endif
@@ -0,0 +1,203 @@
+/*
+# Thread pool for converting frames in horizontal bands
+
+# This program is free software; you can redistribute it and/or modify
+# it under the terms of the GNU Lesser General Public License as published by
+# the Free Software Foundation; either version 2.1 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU Lesser General Public License for more details.
+#
+# You should have received a copy of the GNU Lesser General Public License
+# along with this program; if not, write to the Free Software
+# Foundation, Inc., 51 Franklin Street, Suite 500, Boston, MA  02110-1335  USA
+ */
+
+#include <stdlib.h>
+#include <unistd.h>
+#include <pthread.h>
+#include "libv4lconvert-priv.h"
+
+/* Don't bother splitting a frame in bands smaller than this */
+#define V4LCONVERT_MIN_BAND_LINES 16
+
+struct v4lconvert_threads {
+	int nthreads;
+	pthread_t threads[V4LCONVERT_MAX_THREADS];
+	pthread_mutex_t lock;
+	pthread_cond_t work_cond;
+	pthread_cond_t done_cond;
+	unsigned int generation;
+	int stop;
+	int pending;
+	/* Current job */
+	void (*func)(void *arg, int first, int count);
+	void *arg;
+	int lines;
+	int align;
+	int bands;
+};
+
+struct v4lconvert_thread_arg {
+	struct v4lconvert_threads *threads;
+	int index;
+};
+
+static void v4lconvert_threads_run_band(struct v4lconvert_threads *threads,
+		int band)
+{
+	int per_band, first, last;
+
+	/* Round up to the alignment, so only the last band can be shorter */
+	per_band = (threads->lines + threads->bands - 1) / threads->bands;
+	per_band = (per_band + threads->align - 1) / threads->align *
+		threads->align;
+
+	first = band * per_band;
+	last = first + per_band;
+	if (last > threads->lines)
+		last = threads->lines;
+
+	if (first < last)
+		threads->func(threads->arg, first, last - first);
+}
+
+static void *v4lconvert_thread_main(void *data)
+{
+	struct v4lconvert_thread_arg *thread_arg = data;
+	struct v4lconvert_threads *threads = thread_arg->threads;
+	/* Band 0 is always done by the calling thread */
+	int band = thread_arg->index + 1;
+	unsigned int generation = 0;
+
+	free(thread_arg);
+
+	pthread_mutex_lock(&threads->lock);
+	while (1) {
+		while (generation == threads->generation && !threads->stop)
+			pthread_cond_wait(&threads->work_cond, &threads->lock);
+		if (threads->stop)
+			break;
+		generation = threads->generation;
+		if (band >= threads->bands)
+			continue;
+		pthread_mutex_unlock(&threads->lock);
+
+		v4lconvert_threads_run_band(threads, band);
+
+		pthread_mutex_lock(&threads->lock);
+		if (--threads->pending == 0)
+			pthread_cond_signal(&threads->done_cond);
+	}
+	pthread_mutex_unlock(&threads->lock);
+
+	return NULL;
+}
+
+struct v4lconvert_threads *v4lconvert_threads_create(void)
+{
+	struct v4lconvert_threads *threads;
+	struct v4lconvert_thread_arg *thread_arg;
+	long nthreads;
+	char *s;
+	int i;
+
+	/* Opt-in: 0 means one thread per online cpu */
+	s = getenv("LIBV4LCONVERT_THREADS");
+	if (!s)
+		return NULL;
+	nthreads = strtol(s, NULL, 0);
+	if (nthreads == 0)
+		nthreads = sysconf(_SC_NPROCESSORS_ONLN);
+	if (nthreads > V4LCONVERT_MAX_THREADS)
+		nthreads = V4LCONVERT_MAX_THREADS;
+	if (nthreads < 2)
+		return NULL;
+
+	threads = calloc(1, sizeof(*threads));
+	if (!threads)
+		return NULL;
+
+	pthread_mutex_init(&threads->lock, NULL);
+	pthread_cond_init(&threads->work_cond, NULL);
+	pthread_cond_init(&threads->done_cond, NULL);
+
+	/* The calling thread does one band itself */
+	for (i = 0; i < nthreads - 1; i++) {
+		thread_arg = malloc(sizeof(*thread_arg));
+		if (!thread_arg)
+			break;
+		thread_arg->threads = threads;
+		thread_arg->index = i;
+		if (pthread_create(&threads->threads[i], NULL,
+				v4lconvert_thread_main, thread_arg)) {
+			free(thread_arg);
+			break;
+		}
+	}
+	threads->nthreads = i + 1;
+
+	if (threads->nthreads < 2) {
+		v4lconvert_threads_destroy(threads);
+		return NULL;
+	}
+
+	return threads;
+}
+
+void v4lconvert_threads_destroy(struct v4lconvert_threads *threads)
+{
+	int i;
+
+	if (!threads)
+		return;
+
+	pthread_mutex_lock(&threads->lock);
+	threads->stop = 1;
+	pthread_cond_broadcast(&threads->work_cond);
+	pthread_mutex_unlock(&threads->lock);
+
+	for (i = 0; i < threads->nthreads - 1; i++)
+		pthread_join(threads->threads[i], NULL);
+
+	pthread_cond_destroy(&threads->done_cond);
+	pthread_cond_destroy(&threads->work_cond);
+	pthread_mutex_destroy(&threads->lock);
+	free(threads);
+}
+
+void v4lconvert_threads_run(struct v4lconvert_threads *threads,
+		int lines, int align,
+		void (*func)(void *arg, int first, int count), void *arg)
+{
+	int bands;
+
+	bands = threads ? lines / V4LCONVERT_MIN_BAND_LINES : 1;
+	if (threads && bands > threads->nthreads)
+		bands = threads->nthreads;
+	if (bands < 2) {
+		func(arg, 0, lines);
+		return;
+	}
+
+	pthread_mutex_lock(&threads->lock);
+	threads->func = func;
+	threads->arg = arg;
+	threads->lines = lines;
+	threads->align = align;
+	threads->bands = bands;
+	threads->pending = bands - 1;
+	threads->generation++;
+	pthread_cond_broadcast(&threads->work_cond);
+	pthread_mutex_unlock(&threads->lock);
+
+	v4lconvert_threads_run_band(threads, 0);
+
+	pthread_mutex_lock(&threads->lock);
+	while (threads->pending)
+		pthread_cond_wait(&threads->done_cond, &threads->lock);
+	pthread_mutex_unlock(&threads->lock);
+}
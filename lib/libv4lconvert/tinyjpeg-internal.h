@@ -47,8 +47,8 @@ struct jdec_private;
 
 #define HUFFMAN_TABLES	   4
 #define COMPONENTS	   3
-#define JPEG_MAX_WIDTH	   2048
-#define JPEG_MAX_HEIGHT	   2048
+#define JPEG_MAX_WIDTH	   4096
+#define JPEG_MAX_HEIGHT	   4096
 
 struct huffman_table {
 	/* Fast look up table, using HUFFMAN_HASH_NBITS bits we can have directly the symbol,
@@ -60,6 +60,9 @@ struct huffman_table {
 	 * IMPROVEME: Calculate if 256 value is enough to store all values
 	 */
 	uint16_t slowtable[16 - HUFFMAN_HASH_NBITS][256];
+	/* Code lengths and values the table was built from, 0 if unknown */
+	unsigned int src_size;
+	unsigned char src[16 + 256];
 };
 
 struct component {
@@ -94,9 +97,10 @@ struct jdec_private {
 
 	struct component component_infos[COMPONENTS];
 	float Q_tables[COMPONENTS][64];		/* quantization tables */
+	unsigned char Q_src[COMPONENTS][64];	/* DQT the tables were built from */
+	unsigned int Q_src_valid;			/* Bitmask of valid Q_src entries */
 	struct huffman_table HTDC[HUFFMAN_TABLES];	/* DC huffman tables   */
 	struct huffman_table HTAC[HUFFMAN_TABLES];	/* AC huffman tables   */
-	int default_huffman_table_initialized;
 	int restart_interval;
 	int restarts_to_go;				/* MCUs left in this restart interval */
 	int last_rst_marker_seen;			/* Rst marker is incremented each time */
@@ -118,6 +122,11 @@ struct jdec_private {
 	/* Temp buffers for multipass planar JPG -> RGB decoding */
 	int tmp_buf_y_size;
 	uint8_t *tmp_buf[COMPONENTS];
+
+	/* For decoding the restart intervals in parallel */
+	struct v4lconvert_threads *threads;
+	const unsigned char **rst_starts;	/* Start of each interval */
+	int rst_starts_bufsize;
 };
 
 #define IDCT tinyjpeg_idct_float
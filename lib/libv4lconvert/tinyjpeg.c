@@ -502,23 +502,46 @@ static int build_huffman_table(struct jdec_private *priv, const unsigned char *b
 	return 0;
 }
 
-static int build_default_huffman_tables(struct jdec_private *priv)
+/*
+ * Cameras send the same tables with every frame (or none at all, using the
+ * default ones), so only rebuild a lookup table when its contents changed.
+ */
+static int build_huffman_table_cached(struct jdec_private *priv, const unsigned char *bits, const unsigned char *vals, struct huffman_table *table)
 {
-	if ((priv->flags & TINYJPEG_FLAGS_MJPEG_TABLE)
-			&& priv->default_huffman_table_initialized)
+	unsigned int i, count = 0;
+
+	for (i = 1; i < 17; i++)
+		count += bits[i];
+
+	if (table->src_size == 16 + count &&
+			memcmp(table->src, bits + 1, 16) == 0 &&
+			memcmp(table->src + 16, vals, count) == 0)
 		return 0;
 
-	if (build_huffman_table(priv, bits_dc_luminance, val_dc_luminance, &priv->HTDC[0]))
+	table->src_size = 0;
+	if (build_huffman_table(priv, bits, vals, table))
+		return -1;
+
+	if (count <= sizeof(table->src) - 16) {
+		memcpy(table->src, bits + 1, 16);
+		memcpy(table->src + 16, vals, count);
+		table->src_size = 16 + count;
+	}
+	return 0;
+}
+
+static int build_default_huffman_tables(struct jdec_private *priv)
+{
+	if (build_huffman_table_cached(priv, bits_dc_luminance, val_dc_luminance, &priv->HTDC[0]))
 		return -1;
-	if (build_huffman_table(priv, bits_ac_luminance, val_ac_luminance, &priv->HTAC[0]))
+	if (build_huffman_table_cached(priv, bits_ac_luminance, val_ac_luminance, &priv->HTAC[0]))
 		return -1;
 
-	if (build_huffman_table(priv, bits_dc_chrominance, val_dc_chrominance, &priv->HTDC[1]))
+	if (build_huffman_table_cached(priv, bits_dc_chrominance, val_dc_chrominance, &priv->HTDC[1]))
 		return -1;
-	if (build_huffman_table(priv, bits_ac_chrominance, val_ac_chrominance, &priv->HTAC[1]))
+	if (build_huffman_table_cached(priv, bits_ac_chrominance, val_ac_chrominance, &priv->HTAC[1]))
 		return -1;
 
-	priv->default_huffman_table_initialized = 1;
 	return 0;
 }
 
@@ -1477,6 +1500,7 @@ static void pixart_decode_MCU_2x1_3planes(struct jdec_private *priv)
 			}
 		}
 		build_quantization_table(priv->Q_tables[1], qt);
+		priv->Q_src_valid &= ~3;
 
 		priv->marker = marker;
 	}
@@ -1700,8 +1724,14 @@ static int parse_DQT(struct jdec_private *priv, const unsigned char *stream)
 			error("No more than %d quantization tables supported (got %d)\n",
 					COMPONENTS, qi + 1);
 #endif
-		table = priv->Q_tables[qi];
-		build_quantization_table(table, stream);
+		/* Skip rebuilding the table when it is unchanged */
+		if (!(priv->Q_src_valid & (1 << qi)) ||
+				memcmp(priv->Q_src[qi], stream, 64)) {
+			table = priv->Q_tables[qi];
+			build_quantization_table(table, stream);
+			memcpy(priv->Q_src[qi], stream, 64);
+			priv->Q_src_valid |= 1 << qi;
+		}
 		stream += 64;
 	}
 	trace("< DQT marker\n");
@@ -1851,10 +1881,10 @@ static int parse_DHT(struct jdec_private *priv, const unsigned char *stream)
 #endif
 
 		if (index & 0xf0) {
-			if (build_huffman_table(priv, huff_bits, stream, &priv->HTAC[index & 0xf]))
+			if (build_huffman_table_cached(priv, huff_bits, stream, &priv->HTAC[index & 0xf]))
 				return -1;
 		} else {
-			if (build_huffman_table(priv, huff_bits, stream, &priv->HTDC[index & 0xf]))
+			if (build_huffman_table_cached(priv, huff_bits, stream, &priv->HTDC[index & 0xf]))
 				return -1;
 		}
 
@@ -2101,6 +2131,7 @@ void tinyjpeg_free(struct jdec_private *priv)
 	}
 	priv->tmp_buf_y_size = 0;
 	free(priv->stream_filtered);
+	free(priv->rst_starts);
 	free(priv);
 }
 
@@ -2236,6 +2267,129 @@ kernel: 0xff 0xff 0x00 0xff 0x96, and we skip one unknown byte */
  *
  * Note: components will be automaticaly allocated if no memory is attached.
  */
+/*
+ * State shared by the bands decoding the restart intervals of a frame
+ */
+struct rst_decode_job {
+	struct jdec_private *priv;
+	decode_MCU_fct decode_MCU;
+	convert_colorspace_fct convert_to_pixfmt;
+	unsigned int mcus_per_row, mcus;
+	unsigned int bytes_per_blocklines[3], bytes_per_mcu[3];
+	int failed;
+};
+
+/*
+ * Find the start of all restart intervals of the entropy coded segment, so
+ * that they can be decoded independently. Returns -1 when the stream does
+ * not contain all of them in order, in which case the caller falls back to
+ * the sequential decoder, which reports the error.
+ */
+static int find_rst_intervals(struct jdec_private *priv, unsigned int intervals)
+{
+	const unsigned char *stream = priv->stream;
+	unsigned int found = 1;
+	int marker;
+
+	priv->rst_starts = (const unsigned char **)v4lconvert_alloc_buffer(
+			intervals * sizeof(*priv->rst_starts),
+			(unsigned char **)&priv->rst_starts,
+			&priv->rst_starts_bufsize);
+	if (!priv->rst_starts)
+		return -1;
+
+	priv->rst_starts[0] = stream;
+	while (found < intervals && stream < priv->stream_end - 1) {
+		if (*stream++ != 0xff)
+			continue;
+		/* Skip any padding ff byte (this is normal) */
+		while (*stream == 0xff && stream < priv->stream_end - 1)
+			stream++;
+
+		marker = *stream++;
+		if (marker == 0x00)	/* Stuffed 0xff data byte */
+			continue;
+		if (marker == RST + ((found - 1) & 7))
+			priv->rst_starts[found++] = stream;
+		else if ((marker >= RST && marker <= RST7) || marker == EOI)
+			break;
+	}
+
+	return found == intervals ? 0 : -1;
+}
+
+static void decode_rst_band(void *arg, int first, int count)
+{
+	struct rst_decode_job *job = arg;
+	struct jdec_private *priv;
+	unsigned int mcu, last, x, y;
+	int i;
+
+	/* Each band needs its own bit reservoir, DC predictors and temp space */
+	priv = malloc(sizeof(*priv));
+	if (priv == NULL) {
+		job->failed = 1;
+		return;
+	}
+	memcpy(priv, job->priv, sizeof(*priv));
+
+	if (setjmp(priv->jump_state)) {
+		job->failed = 1;
+		free(priv);
+		return;
+	}
+
+	for (i = first; i < first + count; i++) {
+		priv->stream = job->priv->rst_starts[i];
+		resync(priv);
+
+		mcu = i * priv->restart_interval;
+		last = mcu + priv->restart_interval;
+		if (last > job->mcus)
+			last = job->mcus;
+		for (; mcu < last; mcu++) {
+			x = mcu % job->mcus_per_row;
+			y = mcu / job->mcus_per_row;
+			priv->plane[0] = priv->components[0] +
+				y * job->bytes_per_blocklines[0] +
+				x * job->bytes_per_mcu[0];
+			priv->plane[1] = priv->components[1] +
+				y * job->bytes_per_blocklines[1] +
+				x * job->bytes_per_mcu[1];
+			priv->plane[2] = priv->components[2] +
+				y * job->bytes_per_blocklines[2] +
+				x * job->bytes_per_mcu[2];
+			job->decode_MCU(priv);
+			job->convert_to_pixfmt(priv);
+		}
+	}
+
+	free(priv);
+}
+
+/*
+ * Decode the restart intervals on the conversion threads, every band writes
+ * its own MCUs directly into the output planes. Returns -1 if this is not
+ * possible and the frame must be decoded sequentially.
+ */
+static int decode_rst_intervals(struct jdec_private *priv,
+		struct rst_decode_job *job)
+{
+	unsigned int intervals;
+
+	intervals = (job->mcus + priv->restart_interval - 1) /
+		priv->restart_interval;
+	if (intervals < 2 || find_rst_intervals(priv, intervals))
+		return -1;
+
+	job->priv = priv;
+	job->failed = 0;
+	v4lconvert_threads_run(priv->threads, intervals, 1,
+			decode_rst_band, job);
+
+	return job->failed ? -1 : 0;
+}
+
 int tinyjpeg_decode(struct jdec_private *priv, int pixfmt)
 {
 	unsigned int x, y, xstride_by_mcu, ystride_by_mcu;
@@ -2364,6 +2518,22 @@ int tinyjpeg_decode(struct jdec_private *priv, int pixfmt)
 	bytes_per_mcu[1] *= xstride_by_mcu / 8;
 	bytes_per_mcu[2] *= xstride_by_mcu / 8;
 
+	if (priv->threads && priv->restart_interval > 0 &&
+	    !(priv->flags & TINYJPEG_FLAGS_PIXART_JPEG)) {
+		struct rst_decode_job job;
+
+		job.decode_MCU = decode_MCU;
+		job.convert_to_pixfmt = convert_to_pixfmt;
+		job.mcus_per_row = (priv->width + xstride_by_mcu - 1) / xstride_by_mcu;
+		job.mcus = job.mcus_per_row * (priv->height / ystride_by_mcu);
+		memcpy(job.bytes_per_blocklines, bytes_per_blocklines,
+		       sizeof(bytes_per_blocklines));
+		memcpy(job.bytes_per_mcu, bytes_per_mcu, sizeof(bytes_per_mcu));
+		/* On failure decode again sequentially, to get the error */
+		if (decode_rst_intervals(priv, &job) == 0)
+			return 0;
+	}
+
 	/* Just the decode the image by macroblock (size is 8x8, 8x16, or 16x16) */
 	for (y = 0; y < priv->height / ystride_by_mcu; y++) {
 		//trace("Decoding row %d\n", y);
@@ -2668,3 +2838,13 @@ int tinyjpeg_set_flags(struct jdec_private *priv, int flags)
 	return oldflags;
 }
 
+/**
+ * Use the given conversion threads for decoding JPEG's with restart
+ * intervals, NULL (the default) decodes them sequentially.
+ */
+void tinyjpeg_set_threads(struct jdec_private *priv,
+			  struct v4lconvert_threads *threads)
+{
+	priv->threads = threads;
+}
+
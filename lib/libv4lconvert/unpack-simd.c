@@ -0,0 +1,382 @@
+/*
+# SIMD versions of the loops reducing 10 and 16 bit samples to 8 bits from
+# rgbyuv.c and bayer.c
+
+# This program is free software; you can redistribute it and/or modify
+# it under the terms of the GNU Lesser General Public License as published by
+# the Free Software Foundation; either version 2.1 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU Lesser General Public License for more details.
+#
+# You should have received a copy of the GNU Lesser General Public License
+# along with this program; if not, write to the Free Software
+# Foundation, Inc., 51 Franklin Street, Suite 500, Boston, MA  02110-1335  USA
+
+ */
+
+/*
+ * All of these work on a whole frame of samples, do 16 or 32 pixels at a
+ * time and return how many pixels they did, the C code in rgbyuv.c and
+ * bayer.c does the rest. The 10 bit packed ones take 4 pixels from each
+ * 5 bytes and read 10 bytes past the 20 they consume, so they stop 24
+ * pixels before the end. They read all of a block before writing its
+ * result, so the reducing ones may be used in place, and grey_to_rgb24
+ * may read from the last third of its dest. split_uv de-interleaves
+ * chroma pairs, 8 at a time, as that is the width of a HM12 chroma
+ * macroblock.
+ */
+
+#include "libv4lconvert-priv.h"
+#include "simd-priv.h"
+
+#if defined(CPU_BUILD_AVX2) || (defined(HAVE_NEON_SIMD) && defined(__aarch64__))
+
+/* Y10B is a big endian bit stream, pixel k of each group of 4 is the low
+   byte of ((b[k] << 8 | b[k + 1]) >> (8 - 2 * k)). These gather those byte
+   pairs into 16 bit lanes for the first 2 groups of the 10 bytes given. */
+static const unsigned char y10b_shuffle[16] __attribute__((aligned(16))) = {
+	1, 0, 2, 1, 3, 2, 4, 3, 6, 5, 7, 6, 8, 7, 9, 8
+};
+
+/* The MIPI 10 bit packed formats have the 8 msb of 4 pixels followed by a
+   byte with their lsb, this drops the lsb bytes of 2 groups */
+static const unsigned char raw10p_shuffle[16] __attribute__((aligned(16))) = {
+	0, 1, 2, 3, 5, 6, 7, 8, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80
+};
+
+#endif
+
+#ifdef HAVE_X86_SIMD
+
+#ifdef CPU_BUILD_AVX2
+/* Repeat each of 16 grey bytes 3 times to make 48 bytes of RGB24 */
+static const unsigned char grey_shuffle[3][16] __attribute__((aligned(16))) = {
+	{  0,  0,  0,  1,  1,  1,  2,  2,  2,  3,  3,  3,  4,  4,  4,  5 },
+	{  5,  5,  6,  6,  6,  7,  7,  7,  8,  8,  8,  9,  9,  9, 10, 10 },
+	{ 10, 11, 11, 11, 12, 12, 12, 13, 13, 13, 14, 14, 14, 15, 15, 15 },
+};
+#endif
+
+__attribute__((target("sse2")))
+static int sse2_u16_to_8(const unsigned char *src, unsigned char *dst,
+		int pixels, int shift)
+{
+	const __m128i mask = _mm_set1_epi16(0x00ff);
+	const __m128i count = _mm_cvtsi32_si128(shift);
+	__m128i a, b;
+	int i;
+
+	for (i = 0; i + 16 <= pixels; i += 16) {
+		a = _mm_loadu_si128((const __m128i *)(src + 2 * i));
+		b = _mm_loadu_si128((const __m128i *)(src + 2 * i + 16));
+		a = _mm_and_si128(_mm_srl_epi16(a, count), mask);
+		b = _mm_and_si128(_mm_srl_epi16(b, count), mask);
+		_mm_storeu_si128((__m128i *)(dst + i), _mm_packus_epi16(a, b));
+	}
+
+	return i;
+}
+
+/* pshufb is not in SSE2, so the ones below are only used with AVX2 */
+#ifdef CPU_BUILD_AVX2
+
+__attribute__((target("avx2")))
+static int avx2_u16_to_8(const unsigned char *src, unsigned char *dst,
+		int pixels, int shift)
+{
+	const __m256i mask = _mm256_set1_epi16(0x00ff);
+	const __m128i count = _mm_cvtsi32_si128(shift);
+	__m256i a, b;
+	int i;
+
+	for (i = 0; i + 32 <= pixels; i += 32) {
+		a = _mm256_loadu_si256((const __m256i *)(src + 2 * i));
+		b = _mm256_loadu_si256((const __m256i *)(src + 2 * i + 32));
+		a = _mm256_and_si256(_mm256_srl_epi16(a, count), mask);
+		b = _mm256_and_si256(_mm256_srl_epi16(b, count), mask);
+		/* packus works per 128 bit lane, put the quarters back in order */
+		a = _mm256_permute4x64_epi64(_mm256_packus_epi16(a, b), 0xd8);
+		_mm256_storeu_si256((__m256i *)(dst + i), a);
+	}
+
+	return i + sse2_u16_to_8(src + 2 * i, dst + i, pixels - i, shift);
+}
+
+__attribute__((target("avx2")))
+static inline __m128i avx2_y10b_8(const unsigned char *src)
+{
+	const __m128i mul = _mm_setr_epi16(1, 4, 16, 64, 1, 4, 16, 64);
+	__m128i v = _mm_loadu_si128((const __m128i *)src);
+
+	v = _mm_shuffle_epi8(v, _mm_load_si128((const __m128i *)y10b_shuffle));
+	return _mm_srli_epi16(_mm_mullo_epi16(v, mul), 8);
+}
+
+__attribute__((target("avx2")))
+static int avx2_y10b_to_8(const unsigned char *src, unsigned char *dst,
+		int pixels)
+{
+	int i;
+
+	for (i = 0; i + 24 <= pixels; i += 16) {
+		__m128i a = avx2_y10b_8(src);
+		__m128i b = avx2_y10b_8(src + 10);
+
+		_mm_storeu_si128((__m128i *)(dst + i), _mm_packus_epi16(a, b));
+		src += 20;
+	}
+
+	return i;
+}
+
+__attribute__((target("avx2")))
+static int avx2_raw10p_to_8(const unsigned char *src, unsigned char *dst,
+		int pixels)
+{
+	const __m128i shuffle = _mm_load_si128((const __m128i *)raw10p_shuffle);
+	int i;
+
+	for (i = 0; i + 24 <= pixels; i += 16) {
+		__m128i a = _mm_loadu_si128((const __m128i *)src);
+		__m128i b = _mm_loadu_si128((const __m128i *)(src + 10));
+
+		a = _mm_unpacklo_epi64(_mm_shuffle_epi8(a, shuffle),
+				       _mm_shuffle_epi8(b, shuffle));
+		_mm_storeu_si128((__m128i *)(dst + i), a);
+		src += 20;
+	}
+
+	return i;
+}
+
+#endif /* CPU_BUILD_AVX2 */
+
+__attribute__((target("sse2")))
+static int sse2_split_uv(const unsigned char *src, unsigned char *u,
+		unsigned char *v, int pairs)
+{
+	const __m128i mask = _mm_set1_epi16(0xff);
+	int i;
+
+	for (i = 0; i + 8 <= pairs; i += 8) {
+		__m128i a = _mm_loadu_si128((const __m128i *)(src + 2 * i));
+
+		/* u in the low 8 bytes, v in the high 8 bytes */
+		a = _mm_packus_epi16(_mm_and_si128(a, mask),
+				     _mm_srli_epi16(a, 8));
+		_mm_storel_epi64((__m128i *)(u + i), a);
+		_mm_storel_epi64((__m128i *)(v + i), _mm_unpackhi_epi64(a, a));
+	}
+
+	return i;
+}
+
+#ifdef CPU_BUILD_AVX2
+
+__attribute__((target("avx2")))
+static int avx2_grey_to_rgb24(const unsigned char *src, unsigned char *dst,
+		int pixels)
+{
+	int i, j;
+
+	for (i = 0; i + 16 <= pixels; i += 16) {
+		__m128i g = _mm_loadu_si128((const __m128i *)(src + i));
+
+		for (j = 0; j < 3; j++)
+			_mm_storeu_si128((__m128i *)(dst + 3 * i + 16 * j),
+				_mm_shuffle_epi8(g,
+					_mm_load_si128((const __m128i *)grey_shuffle[j])));
+	}
+
+	return i;
+}
+
+#endif /* CPU_BUILD_AVX2 */
+
+#endif /* HAVE_X86_SIMD */
+
+#ifdef HAVE_NEON_SIMD
+
+static int neon_u16_to_8(const unsigned char *src, unsigned char *dst,
+		int pixels, int shift)
+{
+	const int16x8_t count = vdupq_n_s16(-shift);
+	uint16x8_t a, b;
+	int i;
+
+	for (i = 0; i + 16 <= pixels; i += 16) {
+		a = vld1q_u16((const uint16_t *)(src + 2 * i));
+		b = vld1q_u16((const uint16_t *)(src + 2 * i + 16));
+		/* vmovn keeps the low byte, like the & 0xff of the C code */
+		vst1q_u8(dst + i, vcombine_u8(vmovn_u16(vshlq_u16(a, count)),
+					      vmovn_u16(vshlq_u16(b, count))));
+	}
+
+	return i;
+}
+
+static int neon_grey_to_rgb24(const unsigned char *src, unsigned char *dst,
+		int pixels)
+{
+	uint8x16x3_t rgb;
+	int i;
+
+	for (i = 0; i + 16 <= pixels; i += 16) {
+		rgb.val[0] = rgb.val[1] = rgb.val[2] = vld1q_u8(src + i);
+		vst3q_u8(dst + 3 * i, rgb);
+	}
+
+	return i;
+}
+
+static int neon_split_uv(const unsigned char *src, unsigned char *u,
+		unsigned char *v, int pairs)
+{
+	uint8x8x2_t uv;
+	int i;
+
+	for (i = 0; i + 8 <= pairs; i += 8) {
+		uv = vld2_u8(src + 2 * i);
+		vst1_u8(u + i, uv.val[0]);
+		vst1_u8(v + i, uv.val[1]);
+	}
+
+	return i;
+}
+
+#if defined(__aarch64__)
+
+static inline uint8x8_t neon_y10b_8(const unsigned char *src)
+{
+	static const uint16_t mul[8] = { 1, 4, 16, 64, 1, 4, 16, 64 };
+	uint8x16_t v = vqtbl1q_u8(vld1q_u8(src), vld1q_u8(y10b_shuffle));
+
+	return vshrn_n_u16(vmulq_u16(vreinterpretq_u16_u8(v), vld1q_u16(mul)),
+			   8);
+}
+
+static int neon_y10b_to_8(const unsigned char *src, unsigned char *dst,
+		int pixels)
+{
+	int i;
+
+	for (i = 0; i + 24 <= pixels; i += 16) {
+		uint8x8_t a = neon_y10b_8(src);
+		uint8x8_t b = neon_y10b_8(src + 10);
+
+		vst1q_u8(dst + i, vcombine_u8(a, b));
+		src += 20;
+	}
+
+	return i;
+}
+
+static int neon_raw10p_to_8(const unsigned char *src, unsigned char *dst,
+		int pixels)
+{
+	const uint8x16_t shuffle = vld1q_u8(raw10p_shuffle);
+	int i;
+
+	for (i = 0; i + 24 <= pixels; i += 16) {
+		uint8x16_t a = vqtbl1q_u8(vld1q_u8(src), shuffle);
+		uint8x16_t b = vqtbl1q_u8(vld1q_u8(src + 10), shuffle);
+
+		vst1q_u8(dst + i, vcombine_u8(vget_low_u8(a), vget_low_u8(b)));
+		src += 20;
+	}
+
+	return i;
+}
+
+#endif /* __aarch64__ */
+
+#endif /* HAVE_NEON_SIMD */
+
+static int c_unpack(const unsigned char *src, unsigned char *dst, int pixels)
+{
+	/* Leave everything to the scalar code */
+	return 0;
+}
+
+static int c_u16_to_8(const unsigned char *src, unsigned char *dst,
+		int pixels, int shift)
+{
+	return 0;
+}
+
+static int c_split_uv(const unsigned char *src, unsigned char *u,
+		unsigned char *v, int pairs)
+{
+	return 0;
+}
+
+#ifdef HAVE_X86_SIMD
+
+static const struct v4lconvert_unpack_kernels sse2_unpack_kernels = {
+	.u16_to_8 = sse2_u16_to_8,
+	.y10b_to_8 = c_unpack,
+	.raw10p_to_8 = c_unpack,
+	.grey_to_rgb24 = c_unpack,
+	.split_uv = sse2_split_uv,
+};
+
+#ifdef CPU_BUILD_AVX2
+static const struct v4lconvert_unpack_kernels avx2_unpack_kernels = {
+	.u16_to_8 = avx2_u16_to_8,
+	.y10b_to_8 = avx2_y10b_to_8,
+	.raw10p_to_8 = avx2_raw10p_to_8,
+	.grey_to_rgb24 = avx2_grey_to_rgb24,
+	/* 8 pairs is too little for a 256 bit register */
+	.split_uv = sse2_split_uv,
+};
+#endif
+
+#endif /* HAVE_X86_SIMD */
+
+#ifdef HAVE_NEON_SIMD
+
+static const struct v4lconvert_unpack_kernels neon_unpack_kernels = {
+	.u16_to_8 = neon_u16_to_8,
+#if defined(__aarch64__)
+	.y10b_to_8 = neon_y10b_to_8,
+	.raw10p_to_8 = neon_raw10p_to_8,
+#else
+	/* vtbl only does 8 bytes on 32 bit arm, not worth it */
+	.y10b_to_8 = c_unpack,
+	.raw10p_to_8 = c_unpack,
+#endif
+	.grey_to_rgb24 = neon_grey_to_rgb24,
+	.split_uv = neon_split_uv,
+};
+
+#endif /* HAVE_NEON_SIMD */
+
+static const struct v4lconvert_unpack_kernels c_unpack_kernels = {
+	.u16_to_8 = c_u16_to_8,
+	.y10b_to_8 = c_unpack,
+	.raw10p_to_8 = c_unpack,
+	.grey_to_rgb24 = c_unpack,
+	.split_uv = c_split_uv,
+};
+
+static const struct cpu_kernel_variant unpack_variants[] = {
+#ifdef CPU_BUILD_AVX2
+	{ "avx2", CPU_FEATURE_AVX2, &avx2_unpack_kernels },
+#endif
+#ifdef HAVE_X86_SIMD
+	{ "sse2", CPU_FEATURE_SSE2, &sse2_unpack_kernels },
+#endif
+#ifdef HAVE_NEON_SIMD
+	{ "neon", CPU_FEATURE_NEON, &neon_unpack_kernels },
+#endif
+	{ "c", 0, &c_unpack_kernels },
+};
+
+const struct v4lconvert_unpack_kernels *v4lconvert_get_unpack_kernels(void)
+{
+	return cpu_select_kernels(unpack_variants, v4lconvert_get_cpu_flags());
+}
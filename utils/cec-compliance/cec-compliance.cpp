@@ -7,8 +7,11 @@
 
 #include <fcntl.h>
 #include <getopt.h>
+#include <pthread.h>
 #include <sys/ioctl.h>
+#include <sys/mman.h>
 #include <sys/time.h>
+#include <sys/wait.h>
 #include <unistd.h>
 
 #include "cec-compliance.h"
@@ -32,6 +35,7 @@ enum Option {
 	OptTestFuzzing = 'F',
 	OptHelp = 'h',
 	OptInteractive = 'i',
+	OptParallel = 'j',
 	OptListTests = 'l',
 	OptExpectWithNoWarnings = 'n',
 	OptNoWarnings = 'N',
@@ -123,6 +127,7 @@ static struct option long_options[] = {
 	{"skip-info", no_argument, 0, OptSkipInfo},
 	{"wall-clock", no_argument, 0, OptWallClock},
 	{"interactive", no_argument, 0, OptInteractive},
+	{"parallel", no_argument, 0, OptParallel},
 	{"reply-threshold", required_argument, 0, OptReplyThreshold},
 
 	{"test-adapter", no_argument, 0, OptTestAdapter},
@@ -185,6 +190,8 @@ static void usage()
 	       "  -R, --reply-threshold <timeout>\n"
 	       "                       Warn if replies take longer than this threshold (default 1000ms)\n"
 	       "  -i, --interactive    Interactive mode when doing remote tests\n"
+	       "  -j, --parallel       Test the remote devices concurrently. Features that also\n"
+	       "                       affect other devices are still tested one device at a time.\n"
 	       "  -t, --timeout <secs> Set the standby/resume timeout to <secs>. Default is 60s.\n"
 	       "\n"
 	       "  -A, --test-adapter                  Test the CEC adapter API\n"
@@ -964,6 +971,143 @@ int util_receive(struct node *node, unsigned la, unsigned timeout,
 	return -1;
 }
 
+/*
+ * With --parallel each remote device is tested by its own child process
+ * with its own filehandle, so the replies and received messages of the
+ * devices are kept apart. The output of each child goes to a temporary
+ * file and is shown in order of LA once all children are done.
+ */
+struct parallel_result {
+	bool done;
+	int tests_total;
+	int tests_ok;
+	int app_result;
+	unsigned warnings;
+};
+
+struct parallel_state {
+	pthread_rwlock_t lock;
+	struct parallel_result results[15];
+};
+
+static struct parallel_state *parallel;
+
+void parallel_lock(bool exclusive)
+{
+	if (!parallel)
+		return;
+	if (exclusive)
+		pthread_rwlock_wrlock(&parallel->lock);
+	else
+		pthread_rwlock_rdlock(&parallel->lock);
+}
+
+void parallel_unlock()
+{
+	if (parallel)
+		pthread_rwlock_unlock(&parallel->lock);
+}
+
+static void test_remote_parallel(struct node *node, unsigned me,
+				 unsigned la_mask, unsigned test_tags)
+{
+	pthread_rwlockattr_t attr;
+	FILE *out[15] = { };
+	pid_t pids[15] = { };
+	bool aborted = false;
+	void *p;
+
+	p = mmap(NULL, sizeof(*parallel), PROT_READ | PROT_WRITE,
+		 MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	if (p == MAP_FAILED) {
+		perror("mmap");
+		std::exit(EXIT_FAILURE);
+	}
+	parallel = static_cast<struct parallel_state *>(p);
+	memset(parallel, 0, sizeof(*parallel));
+	pthread_rwlockattr_init(&attr);
+	pthread_rwlockattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+#ifdef PTHREAD_RWLOCK_PREFER_WRITER_NONRECURSIVE_NP
+	/* Don't let the concurrent tests starve the exclusive ones */
+	pthread_rwlockattr_setkind_np(&attr, PTHREAD_RWLOCK_PREFER_WRITER_NONRECURSIVE_NP);
+#endif
+	pthread_rwlock_init(&parallel->lock, &attr);
+	pthread_rwlockattr_destroy(&attr);
+
+	fflush(stdout);
+	for (unsigned la = 0; la < 15; la++) {
+		if (!(la_mask & (1 << la)))
+			continue;
+		out[la] = tmpfile();
+		if (!out[la]) {
+			perror("tmpfile");
+			std::exit(EXIT_FAILURE);
+		}
+		pids[la] = fork();
+		if (pids[la] < 0) {
+			perror("fork");
+			std::exit(EXIT_FAILURE);
+		}
+		if (pids[la])
+			continue;
+
+		close(node->fd);
+		node->fd = open(node->device, O_RDWR);
+		if (node->fd < 0) {
+			fprintf(stderr, "Failed to open %s: %s\n", node->device,
+				strerror(errno));
+			std::exit(EXIT_FAILURE);
+		}
+		dup2(fileno(out[la]), STDOUT_FILENO);
+		tests_total = tests_ok = app_result = 0;
+		warnings = 0;
+
+		testRemote(node, me, la, test_tags, false);
+
+		struct parallel_result &res = parallel->results[la];
+
+		res.tests_total = tests_total;
+		res.tests_ok = tests_ok;
+		res.app_result = app_result;
+		res.warnings = warnings;
+		res.done = true;
+		fflush(stdout);
+		_exit(0);
+	}
+
+	for (unsigned la = 0; la < 15; la++) {
+		if (pids[la] > 0)
+			waitpid(pids[la], NULL, 0);
+	}
+	for (unsigned la = 0; la < 15; la++) {
+		const struct parallel_result &res = parallel->results[la];
+		char buf[4096];
+		size_t len;
+
+		if (!out[la])
+			continue;
+		rewind(out[la]);
+		while ((len = fread(buf, 1, sizeof(buf), out[la])) > 0)
+			fwrite(buf, 1, len, stdout);
+		fclose(out[la]);
+		/* A child only stops early for --exit-on-fail/warn or on errors */
+		if (!res.done) {
+			aborted = true;
+			continue;
+		}
+		tests_total += res.tests_total;
+		tests_ok += res.tests_ok;
+		warnings += res.warnings;
+		if (res.app_result)
+			app_result = res.app_result;
+	}
+	pthread_rwlock_destroy(&parallel->lock);
+	munmap(parallel, sizeof(*parallel));
+	parallel = NULL;
+	if (aborted)
+		std::exit(EXIT_FAILURE);
+}
+
 static int poll_remote_devs(struct node *node)
 {
 	unsigned retries = 0;
@@ -1394,6 +1538,12 @@ int main(int argc, char **argv)
 	if (options[OptInteractive])
 		test_tags |= TAG_INTERACTIVE;
 
+	if (options[OptParallel] && options[OptInteractive]) {
+		fprintf(stderr, "--parallel and --interactive cannot be combined.\n");
+		usage();
+		std::exit(EXIT_FAILURE);
+	}
+
 	printf("cec-compliance SHA                 : %s\n", STRING(GIT_SHA));
 
 	node.phys_addr = CEC_PHYS_ADDR_INVALID;
@@ -1513,6 +1663,12 @@ int main(int argc, char **argv)
 		for (unsigned from = 0; from <= 15; from++) {
 			if (!(node.adap_la_mask & (1 << from)))
 				continue;
+			if (options[OptParallel]) {
+				test_remote_parallel(&node, from,
+						     remote_la_mask & ~node.adap_la_mask,
+						     test_tags);
+				continue;
+			}
 			for (unsigned to = 0; to <= 15; to++)
 				if (!(node.adap_la_mask & (1 << to)) &&
 				    (remote_la_mask & (1 << to)))
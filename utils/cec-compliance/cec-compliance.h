@@ -314,6 +314,13 @@ static inline bool question(const char* prompt)
 int cec_named_ioctl(struct node *node, const char *name,
 		    unsigned long int request, void *parm);
 
+/*
+ * With --parallel the remote devices are tested concurrently. Tests that
+ * affect the other devices as well must take the lock exclusively.
+ */
+void parallel_lock(bool exclusive);
+void parallel_unlock();
+
 #define doioctl(n, r, p) cec_named_ioctl(n, #r, r, p)
 
 const char *opcode2s(__u8 opcode);
@@ -1534,13 +1534,25 @@ int setExpectedResult(char *optarg, bool no_warnings)
 	return 0;
 }
 
+/*
+ * These features broadcast messages that change the state of the other
+ * devices as well (e.g. Active Source, System Audio Mode, Standby),
+ * so they cannot be tested concurrently with other remote devices.
+ */
+#define TAGS_EXCLUSIVE (TAG_ARC_CONTROL | TAG_SYSTEM_AUDIO_CONTROL | \
+			TAG_ONE_TOUCH_PLAY | TAG_ROUTING_CONTROL | TAG_STANDBY_RESUME)
+
 void testRemote(struct node *node, unsigned me, unsigned la, unsigned test_tags,
 		bool interactive)
 {
 	printf("testing CEC local LA %d (%s) to remote LA %d (%s):\n",
 	       me, cec_la2s(me), la, cec_la2s(la));
 
-	if (!util_interactive_ensure_power_state(node, me, la, interactive, CEC_OP_POWER_STATUS_ON))
+	parallel_lock(true);
+	bool powered_on = util_interactive_ensure_power_state(node, me, la, interactive,
+							      CEC_OP_POWER_STATUS_ON);
+	parallel_unlock();
+	if (!powered_on)
 		return;
 	if (node->remote[la].in_standby && !interactive) {
 		announce("The remote device is in standby. It should be powered on when testing. Aborting.");
@@ -1558,6 +1570,7 @@ void testRemote(struct node *node, unsigned me, unsigned la, unsigned test_tags,
 			continue;
 
 		printf("\t%s:\n", test.name);
+		parallel_lock(test.tags & TAGS_EXCLUSIVE);
 		for (unsigned j = 0; j < test.num_subtests; j++) {
 			const char *name = test.subtests[j].name;
 
@@ -1596,9 +1609,12 @@ void testRemote(struct node *node, unsigned me, unsigned la, unsigned test_tags,
 					printf("\t    %s: %s\n", name, ok(ret));
 			} else if (ret != NOTAPPLICABLE)
 				printf("\t    %s: %s\n", name, ok(ret));
-			if (ret == FAIL_CRITICAL)
+			if (ret == FAIL_CRITICAL) {
+				parallel_unlock();
 				return;
+			}
 		}
+		parallel_unlock();
 		printf("\n");
 	}
 }
@@ -15,12 +15,19 @@
 #include <dirent.h>
 #include <fcntl.h>
 #include <getopt.h>
+#include <poll.h>
 #include <pthread.h>
+#include <signal.h>
+#include <sys/inotify.h>
 #include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
 #include <sys/time.h>
 #include <unistd.h>
 
 #include <linux/cec-funcs.h>
+#include <linux/netlink.h>
 #include "cec-htng-funcs.h"
 #include "cec-log.h"
 #include "cec-parse.h"
@@ -106,9 +113,12 @@ enum Option {
 	OptTimeout,
 	OptMonitorTime,
 	OptMonitorPin,
+	OptMonitorDevice,
 	OptIgnore,
 	OptStorePin,
+	OptStorePinBinary,
 	OptAnalyzePin,
+	OptAnalyzePinSummary,
 	OptRcTVProfile1,
 	OptRcTVProfile2,
 	OptRcTVProfile3,
@@ -126,6 +136,9 @@ enum Option {
 	OptFeatSourceHasARCRx,
 	OptStressTestPowerCycle,
 	OptTestPowerCycle,
+	OptBench,
+	OptTopologyCache,
+	OptCacheTopology,
 	OptVendorCommand = 508,
 	OptVendorCommandWithID,
 	OptVendorRemoteButtonDown,
@@ -149,6 +162,7 @@ struct node {
 bool verbose;
 
 typedef std::vector<cec_msg> msg_vec;
+using dev_vec = std::vector<std::string>;
 
 static struct option long_options[] = {
 	{ "device", required_argument, 0, OptSetDevice },
@@ -174,10 +188,13 @@ static struct option long_options[] = {
 	{ "monitor", no_argument, 0, OptMonitor },
 	{ "monitor-all", no_argument, 0, OptMonitorAll },
 	{ "monitor-pin", no_argument, 0, OptMonitorPin },
+	{ "monitor-device", required_argument, 0, OptMonitorDevice },
 	{ "monitor-time", required_argument, 0, OptMonitorTime },
 	{ "ignore", required_argument, 0, OptIgnore },
 	{ "store-pin", required_argument, 0, OptStorePin },
+	{ "store-pin-binary", required_argument, 0, OptStorePinBinary },
 	{ "analyze-pin", required_argument, 0, OptAnalyzePin },
+	{ "analyze-pin-summary", required_argument, 0, OptAnalyzePinSummary },
 	{ "no-reply", no_argument, 0, OptToggleNoReply },
 	{ "non-blocking", no_argument, 0, OptNonBlocking },
 	{ "logical-address", no_argument, 0, OptLogicalAddress },
@@ -187,6 +204,8 @@ static struct option long_options[] = {
 	{ "skip-info", no_argument, 0, OptSkipInfo },
 	{ "show-raw", no_argument, 0, OptShowRaw },
 	{ "show-topology", no_argument, 0, OptShowTopology },
+	{ "topology-cache", required_argument, 0, OptTopologyCache },
+	{ "cache-topology", no_argument, 0, OptCacheTopology },
 	{ "list-devices", no_argument, 0, OptListDevices },
 	{ "poll", no_argument, 0, OptPoll },
 	{ "rc-tv-profile-1", no_argument, 0, OptRcTVProfile1 },
@@ -227,6 +246,7 @@ static struct option long_options[] = {
 
 	{ "test-power-cycle", optional_argument, 0, OptTestPowerCycle }, \
 	{ "stress-test-power-cycle", required_argument, 0, OptStressTestPowerCycle }, \
+	{ "bench", required_argument, 0, OptBench }, \
 
 	{ 0, 0, 0, 0 }
 };
@@ -249,8 +269,8 @@ static void usage()
 	       "  -e, --phys-addr-from-edid <path>\n"
 	       "                           Set physical address from this EDID file\n"
 	       "  -E, --phys-addr-from-edid-poll <path>\n"
-	       "                           Continuously poll the EDID file for changes, and update the\n"
-	       "                           physical address whenever there is a change\n"
+	       "                           Watch the EDID file and DRM hotplug events for changes, and update\n"
+	       "                           the physical address whenever there is a change\n"
 	       "  -o, --osd-name <name>    Use this OSD name\n"
 	       "  -V, --vendor-id <id>     Use this vendor ID\n"
 	       "  -l, --logical-address    Show first configured logical address\n"
@@ -264,6 +284,11 @@ static void usage()
 	       "  -r, --show-raw           Show the raw CEC message (hex values)\n"
 	       "  -s, --skip-info          Skip Driver Info output\n"
 	       "  -S, --show-topology      Show the CEC topology\n"
+	       "  --topology-cache <file>  Show the topology stored in <file> by --cache-topology\n"
+	       "                           instead of discovering it, if it is still valid\n"
+	       "  --cache-topology         Discover the topology and store it in the --topology-cache\n"
+	       "                           file, and discover it again after each state change or HPD\n"
+	       "                           event, for up to --monitor-time secs\n"
 	       "  -P, --poll               Send poll message\n"
 	       "  -h, --help               Display this help message\n"
 	       "  --help-all               Show all help messages\n"
@@ -312,14 +337,24 @@ static void usage()
 	       "  -M, --monitor-all        Monitor all CEC traffic\n"
 	       "  --monitor-pin            Monitor low-level CEC pin\n"
 	       "  --monitor-time <secs>    Monitor for <secs> seconds (default is forever)\n"
+	       "  --monitor-device <dev>   Also monitor CEC device <dev>. If <dev> starts with a digit,\n"
+	       "                           then /dev/cec<dev> is used. Can be given multiple times.\n"
+	       "                           The messages and events of all devices are merged in\n"
+	       "                           timestamp order, and each is prefixed with its timestamp\n"
+	       "                           and device.\n"
 	       "  --ignore <la>,<opcode>   Ignore messages from logical address <la> and opcode\n"
 	       "                           <opcode> when monitoring. 'all' can be used for <la>\n"
 	       "                           or <opcode> to match all logical addresses or opcodes.\n"
 	       "                           To ignore poll messages use 'poll' as <opcode>.\n"
 	       "  --store-pin <to>         Store the low-level CEC pin changes to the file <to>.\n"
 	       "                           Use - for stdout.\n"
-	       "  --analyze-pin <from>     Analyze the low-level CEC pin changes from the file <from>.\n"
-	       "                           Use - for stdin.\n"
+	       "  --store-pin-binary <to>  Like --store-pin, but use a more compact binary format.\n"
+	       "  --analyze-pin <from>     Analyze the low-level CEC pin changes from the file <from>,\n"
+	       "                           in either format. Use - for stdin.\n"
+	       "  --analyze-pin-summary <from>\n"
+	       "                           Like --analyze-pin, but only show a summary: messages per\n"
+	       "                           opcode, messages, NACKs and errors per initiator, and bit\n"
+	       "                           timing histograms. Large files are analyzed in parallel.\n"
 	       "  --test-power-cycle [polls=<n>][,sleep=<secs>]\n"
 	       "                           Test power cycle behavior of the display. It polls up to\n"
 	       "                           <n> times (default 15), waiting for a state change. If\n"
@@ -340,6 +375,12 @@ static void usage()
 	       "                           before transmitting <Image View On>.\n"
 	       "                           If <secs2> is specified, then sleep for <secs2> seconds\n"
 	       "                           before transmitting <Standby>.\n"
+	       "  --bench to=<la>[,cnt=<count>][,burst=<n>][,msg=<msg>]\n"
+	       "                           Transmit <count> messages (default 100) to <la>, queuing\n"
+	       "                           up to <n> (default 1) at a time, and show the transmit\n"
+	       "                           and reply latency percentiles, the retry counts and the\n"
+	       "                           bus utilization. <msg> is power-status (the default),\n"
+	       "                           cec-version or poll.\n"
 	       "\n"
 	       CEC_PARSE_USAGE
 	       "\n"
@@ -465,7 +506,7 @@ static const char *event2s(__u32 event)
 	}
 }
 
-static void log_event(struct cec_event &ev, bool show)
+static void log_event(struct cec_event &ev, bool show, const char *prefix = "")
 {
 	bool is_high = ev.event == CEC_EVENT_PIN_CEC_HIGH;
 	__u16 pa;
@@ -473,7 +514,7 @@ static void log_event(struct cec_event &ev, bool show)
 	if (ev.event != CEC_EVENT_PIN_CEC_LOW && ev.event != CEC_EVENT_PIN_CEC_HIGH &&
 	    ev.event != CEC_EVENT_PIN_HPD_LOW && ev.event != CEC_EVENT_PIN_HPD_HIGH &&
 	    ev.event != CEC_EVENT_PIN_5V_LOW && ev.event != CEC_EVENT_PIN_5V_HIGH)
-		printf("\n");
+		printf("\n%s", prefix);
 	if ((ev.flags & CEC_EVENT_FL_DROPPED_EVENTS) && show)
 		printf("(warn: %s events were lost)\n", event2s(ev.event));
 	if ((ev.flags & CEC_EVENT_FL_INITIAL_STATE) && show)
@@ -526,7 +567,139 @@ static void log_event(struct cec_event &ev, bool show)
  */
 static __u32 phys_addrs[16];
 
-static int showTopologyDevice(struct node *node, unsigned i, unsigned la)
+/*
+ * Transmit the messages without blocking, so the kernel can send the next
+ * ones while earlier ones are waiting for their reply. The results are
+ * matched to the messages by sequence number and stored in place. Messages
+ * that could not be transmitted keep a zero tx_status. If queued_ts is
+ * given, then it is filled with the time at which each message was queued.
+ */
+static void transmit_msgs(struct node *node, std::vector<cec_msg> &msgs,
+			  std::vector<__u64> *queued_ts = NULL)
+{
+	std::map<__u32, cec_msg *> pending;
+	int flags = fcntl(node->fd, F_GETFL);
+	time_t deadline = time(NULL) + 10;
+	size_t next = 0;
+
+	fcntl(node->fd, F_SETFL, flags | O_NONBLOCK);
+	if (queued_ts)
+		queued_ts->assign(msgs.size(), 0);
+
+	/*
+	 * The kernel always completes transmits, the deadline is only a
+	 * safety net in case no progress is made.
+	 */
+	while ((next < msgs.size() || !pending.empty()) && time(NULL) < deadline) {
+		struct timeval tv = { 1, 0 };
+		fd_set rd_fds;
+		int res;
+
+		/* Fill the transmit queue, until the kernel reports it full */
+		while (next < msgs.size()) {
+			cec_msg &msg = msgs[next];
+
+			if (queued_ts)
+				(*queued_ts)[next] = current_ts();
+			res = doioctl(node, CEC_TRANSMIT, &msg);
+			if (res == EBUSY)
+				break;
+			next++;
+			deadline = time(NULL) + 10;
+			if (res) {
+				msg.tx_status = msg.rx_status = 0;
+				continue;
+			}
+			pending[msg.sequence] = &msg;
+		}
+
+		if (pending.empty()) {
+			/* The queue is full of other users' messages */
+			if (next < msgs.size())
+				usleep(10000);
+			continue;
+		}
+
+		FD_ZERO(&rd_fds);
+		FD_SET(node->fd, &rd_fds);
+		res = select(node->fd + 1, &rd_fds, NULL, NULL, &tv);
+		if (res < 0)
+			break;
+		if (res == 0)
+			continue;
+
+		struct cec_msg msg = { };
+
+		res = doioctl(node, CEC_RECEIVE, &msg);
+		if (res == ENODEV)
+			break;
+		if (res || !msg.sequence)
+			continue;
+
+		auto it = pending.find(msg.sequence);
+
+		if (it == pending.end())
+			continue;
+		*it->second = msg;
+		pending.erase(it);
+		deadline = time(NULL) + 10;
+	}
+
+	/* Whatever is left has no result */
+	for (; next < msgs.size(); next++)
+		msgs[next].tx_status = msgs[next].rx_status = 0;
+	for (auto &it : pending)
+		it.second->tx_status = it.second->rx_status = 0;
+
+	fcntl(node->fd, F_SETFL, flags);
+}
+
+/* The requests sent to each device, replies are printed in this order */
+enum {
+	TOPO_CEC_VERSION,
+	TOPO_PHYS_ADDR,
+	TOPO_VENDOR_ID,
+	TOPO_OSD_NAME,
+	TOPO_MENU_LANGUAGE,
+	TOPO_POWER_STATUS,
+	TOPO_FEATURES,
+	TOPO_NUM_REQS
+};
+
+static void queueTopologyDevice(std::vector<cec_msg> &msgs, unsigned i, unsigned la)
+{
+	struct cec_msg msg;
+
+	cec_msg_init(&msg, la, i);
+	cec_msg_get_cec_version(&msg, true);
+	msgs.push_back(msg);
+
+	cec_msg_init(&msg, la, i);
+	cec_msg_give_physical_addr(&msg, true);
+	msgs.push_back(msg);
+
+	cec_msg_init(&msg, la, i);
+	cec_msg_give_device_vendor_id(&msg, true);
+	msgs.push_back(msg);
+
+	cec_msg_init(&msg, la, i);
+	cec_msg_give_osd_name(&msg, true);
+	msgs.push_back(msg);
+
+	cec_msg_init(&msg, la, i);
+	cec_msg_get_menu_language(&msg, true);
+	msgs.push_back(msg);
+
+	cec_msg_init(&msg, la, i);
+	cec_msg_give_device_power_status(&msg, true);
+	msgs.push_back(msg);
+
+	cec_msg_init(&msg, la, i);
+	cec_msg_give_features(&msg, true);
+	msgs.push_back(msg);
+}
+
+static int showTopologyDevice(const cec_msg *replies, unsigned i, unsigned la)
 {
 	struct cec_msg msg;
 	char osd_name[15];
@@ -534,15 +707,11 @@ static int showTopologyDevice(struct node *node, unsigned i, unsigned la)
 	printf("\tSystem Information for device %d (%s) from device %d (%s):\n",
 	       i, cec_la2s(i), la & 0xf, cec_la2s(la));
 
-	cec_msg_init(&msg, la, i);
-	cec_msg_get_cec_version(&msg, true);
-	doioctl(node, CEC_TRANSMIT, &msg);
+	msg = replies[TOPO_CEC_VERSION];
 	printf("\t\tCEC Version                : %s\n",
 	       (!cec_msg_status_is_ok(&msg)) ? cec_status2s(msg).c_str() : cec_version2s(msg.msg[2]));
 
-	cec_msg_init(&msg, la, i);
-	cec_msg_give_physical_addr(&msg, true);
-	doioctl(node, CEC_TRANSMIT, &msg);
+	msg = replies[TOPO_PHYS_ADDR];
 	printf("\t\tPhysical Address           : ");
 	if (!cec_msg_status_is_ok(&msg)) {
 		printf("%s\n", cec_status2s(msg).c_str());
@@ -555,9 +724,7 @@ static int showTopologyDevice(struct node *node, unsigned i, unsigned la)
 		phys_addrs[i] = (phys_addr << 8) | i;
 	}
 
-	cec_msg_init(&msg, la, i);
-	cec_msg_give_device_vendor_id(&msg, true);
-	doioctl(node, CEC_TRANSMIT, &msg);
+	msg = replies[TOPO_VENDOR_ID];
 	printf("\t\tVendor ID                  : ");
 	if (!cec_msg_status_is_ok(&msg))
 		printf("%s\n", cec_status2s(msg).c_str());
@@ -566,9 +733,7 @@ static int showTopologyDevice(struct node *node, unsigned i, unsigned la)
 		       msg.msg[2], msg.msg[3], msg.msg[4],
 		       cec_vendor2s(msg.msg[2] << 16 | msg.msg[3] << 8 | msg.msg[4]));
 
-	cec_msg_init(&msg, la, i);
-	cec_msg_give_osd_name(&msg, true);
-	doioctl(node, CEC_TRANSMIT, &msg);
+	msg = replies[TOPO_OSD_NAME];
 	cec_ops_set_osd_name(&msg, osd_name);
 	printf("\t\tOSD Name                   : ");
 	if (cec_msg_status_is_ok(&msg))
@@ -576,9 +741,7 @@ static int showTopologyDevice(struct node *node, unsigned i, unsigned la)
 	else
 		printf("%s\n", cec_status2s(msg).c_str());
 
-	cec_msg_init(&msg, la, i);
-	cec_msg_get_menu_language(&msg, true);
-	doioctl(node, CEC_TRANSMIT, &msg);
+	msg = replies[TOPO_MENU_LANGUAGE];
 	if (cec_msg_status_is_ok(&msg)) {
 		char language[4];
 
@@ -587,9 +750,7 @@ static int showTopologyDevice(struct node *node, unsigned i, unsigned la)
 		printf("\t\tMenu Language              : %s\n", language);
 	}
 
-	cec_msg_init(&msg, la, i);
-	cec_msg_give_device_power_status(&msg, true);
-	doioctl(node, CEC_TRANSMIT, &msg);
+	msg = replies[TOPO_POWER_STATUS];
 	if (cec_msg_status_is_ok(&msg)) {
 		__u8 pwr;
 
@@ -598,9 +759,7 @@ static int showTopologyDevice(struct node *node, unsigned i, unsigned la)
 		       power_status2s(pwr));
 	}
 
-	cec_msg_init(&msg, la, i);
-	cec_msg_give_features(&msg, true);
-	doioctl(node, CEC_TRANSMIT, &msg);
+	msg = replies[TOPO_FEATURES];
 	if (cec_msg_status_is_ok(&msg)) {
 		__u8 vers, all_dev_types;
 		const __u8 *rc, *feat;
@@ -664,10 +823,134 @@ static __u16 calc_mask(__u16 pa)
 	return 0;
 }
 
-static int showTopology(struct node *node)
+/*
+ * Poll all addresses, then send all requests to the devices found in one go
+ * instead of waiting for each reply in turn. The requests for the devices
+ * that replied to the poll are stored in msgs, in logical address order.
+ */
+static void discoverTopology(struct node *node, __u8 la,
+			     std::vector<cec_msg> &polls,
+			     std::vector<cec_msg> &msgs)
+{
+	polls.clear();
+	msgs.clear();
+
+	for (unsigned i = 0; i < 15; i++) {
+		struct cec_msg msg;
+
+		cec_msg_init(&msg, la, i);
+		polls.push_back(msg);
+	}
+	transmit_msgs(node, polls);
+
+	for (unsigned i = 0; i < 15; i++) {
+		if (polls[i].tx_status & CEC_TX_STATUS_OK)
+			queueTopologyDevice(msgs, i, la);
+	}
+	transmit_msgs(node, msgs);
+}
+
+/*
+ * The topology cache file starts with this header, followed by the poll
+ * results and the replies as stored by discoverTopology(). It is only
+ * valid while the cec-ctl --cache-topology process that wrote it is
+ * running, as that process removes it when the topology may have changed.
+ */
+#define TOPOLOGY_CACHE_MAGIC "CECTOPO1"
+
+struct topology_cache_hdr {
+	char magic[8];
+	__u32 pid;
+	__u16 phys_addr;
+	__u16 log_addr_mask;
+	__u8 log_addr;
+	__u8 num_polls;
+	__u16 num_msgs;
+};
+
+static void writeTopologyCache(const char *file, const struct node *node, __u8 la,
+			       const std::vector<cec_msg> &polls,
+			       const std::vector<cec_msg> &msgs)
+{
+	struct topology_cache_hdr hdr = { };
+	std::string tmp = std::string(file) + ".XXXXXX";
+	FILE *f;
+	int fd;
+
+	memcpy(hdr.magic, TOPOLOGY_CACHE_MAGIC, sizeof(hdr.magic));
+	hdr.pid = getpid();
+	hdr.phys_addr = node->phys_addr;
+	hdr.log_addr_mask = node->log_addr_mask;
+	hdr.log_addr = la;
+	hdr.num_polls = polls.size();
+	hdr.num_msgs = msgs.size();
+
+	/* Write a new file and rename it, so readers never see a partial one */
+	fd = mkstemp(&tmp[0]);
+	if (fd < 0 || fchmod(fd, 0644) || !(f = fdopen(fd, "w"))) {
+		fprintf(stderr, "Failed to create %s: %s\n", tmp.c_str(),
+			strerror(errno));
+		if (fd >= 0) {
+			close(fd);
+			unlink(tmp.c_str());
+		}
+		return;
+	}
+	if (fwrite(&hdr, sizeof(hdr), 1, f) != 1 ||
+	    fwrite(polls.data(), sizeof(cec_msg), polls.size(), f) != polls.size() ||
+	    fwrite(msgs.data(), sizeof(cec_msg), msgs.size(), f) != msgs.size() ||
+	    fclose(f) || rename(tmp.c_str(), file)) {
+		fprintf(stderr, "Failed to write %s: %s\n", file, strerror(errno));
+		unlink(tmp.c_str());
+	}
+}
+
+static bool readTopologyCache(const char *file, const struct node *node, __u8 la,
+			      std::vector<cec_msg> &polls,
+			      std::vector<cec_msg> &msgs)
+{
+	struct topology_cache_hdr hdr;
+	unsigned found = 0;
+	bool ok = false;
+	FILE *f;
+
+	f = fopen(file, "r");
+	if (!f)
+		return false;
+
+	if (fread(&hdr, sizeof(hdr), 1, f) != 1 ||
+	    memcmp(hdr.magic, TOPOLOGY_CACHE_MAGIC, sizeof(hdr.magic)) ||
+	    hdr.phys_addr != node->phys_addr ||
+	    hdr.log_addr_mask != node->log_addr_mask ||
+	    hdr.log_addr != la || hdr.num_polls != 15)
+		goto done;
+
+	/* A stale file left behind by a process that was killed */
+	if (kill(hdr.pid, 0) && errno != EPERM)
+		goto done;
+
+	polls.resize(hdr.num_polls);
+	msgs.resize(hdr.num_msgs);
+	if (fread(polls.data(), sizeof(cec_msg), polls.size(), f) != polls.size() ||
+	    fread(msgs.data(), sizeof(cec_msg), msgs.size(), f) != msgs.size())
+		goto done;
+
+	for (const auto &msg : polls)
+		if (msg.tx_status & CEC_TX_STATUS_OK)
+			found++;
+	ok = msgs.size() == found * TOPO_NUM_REQS;
+
+done:
+	fclose(f);
+	return ok;
+}
+
+static int showTopology(struct node *node, const char *cache)
 {
-	struct cec_msg msg = { };
 	struct cec_log_addrs laddrs = { };
+	std::vector<cec_msg> polls;
+	std::vector<cec_msg> msgs;
+	std::vector<unsigned> found;
 
 	if (!(node->caps & CEC_CAP_TRANSMIT))
 		return -ENOTTY;
@@ -677,21 +960,29 @@ static int showTopology(struct node *node)
 	if (!laddrs.num_log_addrs)
 		return 0;
 
-	for (unsigned i = 0; i < 15; i++) {
-		int ret;
+	if (cache && readTopologyCache(cache, node, laddrs.log_addr[0], polls, msgs)) {
+		if (verbose)
+			printf("\tUsing the topology cached in %s\n", cache);
+	} else {
+		discoverTopology(node, laddrs.log_addr[0], polls, msgs);
+	}
 
-		cec_msg_init(&msg, laddrs.log_addr[0], i);
-		ret = doioctl(node, CEC_TRANSMIT, &msg);
+	for (unsigned i = 0; i < 15; i++) {
+		const cec_msg &msg = polls[i];
 
-		if (ret)
+		if (!msg.tx_status)
 			continue;
 
 		if (msg.tx_status & CEC_TX_STATUS_OK)
-			showTopologyDevice(node, i, laddrs.log_addr[0]);
+			found.push_back(i);
 		else if (verbose && !(msg.tx_status & CEC_TX_STATUS_MAX_RETRIES))
 			printf("\t\t%s for addr %d\n", cec_status2s(msg).c_str(), i);
 	}
 
+	for (unsigned j = 0; j < found.size(); j++)
+		showTopologyDevice(&msgs[j * TOPO_NUM_REQS], found[j],
+				   laddrs.log_addr[0]);
+
 	__u32 pas[16];
 
 	memcpy(pas, phys_addrs, sizeof(pas));
@@ -740,6 +1031,111 @@ static inline unsigned response_time_ms(const struct cec_msg &msg)
 	return 0;
 }
 
+#define MONITOR_FL_DROPPED_EVENTS     (1 << 16)
+
+/*
+ * The binary pin store format starts with a header of PIN_BIN_HDR_SIZE
+ * bytes, all fields in little endian:
+ *
+ *  0: PIN_BIN_MAGIC
+ *  8: u32 version (1)
+ * 12: u32 header size, records start at this offset
+ * 16: u64 start_monotonic seconds
+ * 24: u32 start_monotonic nanoseconds
+ * 28: u32 start_timeofday microseconds
+ * 32: u64 start_timeofday seconds
+ * 40: u16 log_addr_mask
+ * 42: u16 phys_addr
+ * 44: u32 reserved
+ *
+ * Each record is an unsigned LEB128 varint. Bits 3-0 hold the event as
+ * stored in the text format (bit 3 being the dropped events flag), the
+ * remaining bits the zigzag encoded difference in nanoseconds with the
+ * timestamp of the previous record, or with 0 for the first record.
+ */
+#define PIN_BIN_MAGIC		"CEC-PIN"	/* Including the trailing 0 */
+#define PIN_BIN_VERSION		1
+#define PIN_BIN_HDR_SIZE	48
+#define PIN_BIN_DROPPED		(1 << 3)
+
+static bool store_pin_binary;
+static __u64 store_pin_last_ts;
+
+static void put_le(__u8 *p, __u64 v, unsigned bytes)
+{
+	for (unsigned i = 0; i < bytes; i++, v >>= 8)
+		p[i] = v & 0xff;
+}
+
+static __u64 get_le(const __u8 *p, unsigned bytes)
+{
+	__u64 v = 0;
+
+	while (bytes--)
+		v = (v << 8) | p[bytes];
+	return v;
+}
+
+static void store_pin_header(FILE *fstore, const struct node &node)
+{
+	if (!store_pin_binary) {
+		fprintf(fstore, "# cec-ctl --store-pin\n");
+		fprintf(fstore, "# version 1\n");
+		fprintf(fstore, "# start_monotonic %lu.%09lu\n",
+			start_monotonic.tv_sec, start_monotonic.tv_nsec);
+		fprintf(fstore, "# start_timeofday %lu.%06lu\n",
+			start_timeofday.tv_sec, start_timeofday.tv_usec);
+		fprintf(fstore, "# log_addr_mask 0x%04x\n", node.log_addr_mask);
+		fprintf(fstore, "# phys_addr %x.%x.%x.%x\n",
+			cec_phys_addr_exp(node.phys_addr));
+		return;
+	}
+
+	__u8 hdr[PIN_BIN_HDR_SIZE] = { };
+
+	memcpy(hdr, PIN_BIN_MAGIC, 8);
+	put_le(hdr + 8, PIN_BIN_VERSION, 4);
+	put_le(hdr + 12, PIN_BIN_HDR_SIZE, 4);
+	put_le(hdr + 16, start_monotonic.tv_sec, 8);
+	put_le(hdr + 24, start_monotonic.tv_nsec, 4);
+	put_le(hdr + 28, start_timeofday.tv_usec, 4);
+	put_le(hdr + 32, start_timeofday.tv_sec, 8);
+	put_le(hdr + 40, node.log_addr_mask, 2);
+	put_le(hdr + 42, node.phys_addr, 2);
+	fwrite(hdr, sizeof(hdr), 1, fstore);
+	store_pin_last_ts = 0;
+}
+
+/* v is the event as stored in the text format */
+static void store_pin_event(FILE *fstore, __u64 ts, unsigned v)
+{
+	if (!store_pin_binary) {
+		fprintf(fstore, "%llu.%09llu %d\n",
+			ts / 1000000000, ts % 1000000000, v);
+		fflush(fstore);
+		return;
+	}
+
+	__s64 delta = ts - store_pin_last_ts;
+	__u64 rec = ((__u64)delta << 1) ^ (__u64)(delta >> 63);
+	__u8 buf[10];
+	unsigned len = 0;
+
+	rec = (rec << 4) | (v & 7);
+	if (v & MONITOR_FL_DROPPED_EVENTS)
+		rec |= PIN_BIN_DROPPED;
+	do {
+		buf[len] = rec & 0x7f;
+		rec >>= 7;
+		if (rec)
+			buf[len] |= 0x80;
+		len++;
+	} while (rec);
+	fwrite(buf, len, 1, fstore);
+	fflush(fstore);
+	store_pin_last_ts = ts;
+}
+
 static void generate_eob_event(__u64 ts, FILE *fstore)
 {
 	if (!eob_ts || eob_ts_max >= ts)
@@ -750,24 +1146,27 @@ static void generate_eob_event(__u64 ts, FILE *fstore)
 		CEC_EVENT_PIN_CEC_HIGH
 	};
 
-	if (fstore) {
-		fprintf(fstore, "%llu.%09llu %d\n",
-			ev_eob.ts / 1000000000, ev_eob.ts % 1000000000,
-			ev_eob.event - CEC_EVENT_PIN_CEC_LOW);
-		fflush(fstore);
-	}
+	if (fstore)
+		store_pin_event(fstore, ev_eob.ts,
+				ev_eob.event - CEC_EVENT_PIN_CEC_LOW);
 	log_event(ev_eob, fstore != stdout);
 }
 
+static bool ignore_msg(const cec_msg &msg)
+{
+	__u8 from = cec_msg_initiator(&msg);
+
+	return ignore_la[from] ||
+	       (msg.len == 1 && (ignore_opcode[POLL_FAKE_OPCODE] & (1 << from))) ||
+	       (msg.len > 1 && (ignore_opcode[msg.msg[1]] & (1 << from)));
+}
+
 static void show_msg(const cec_msg &msg)
 {
 	__u8 from = cec_msg_initiator(&msg);
 	__u8 to = cec_msg_destination(&msg);
 
-	if (ignore_la[from])
-		return;
-	if ((msg.len == 1 && (ignore_opcode[POLL_FAKE_OPCODE] & (1 << from))) ||
-	    (msg.len > 1 && (ignore_opcode[msg.msg[1]] & (1 << from))))
+	if (ignore_msg(msg))
 		return;
 
 	bool transmitted = msg.tx_status != 0;
@@ -777,18 +1176,18 @@ static void show_msg(const cec_msg &msg)
 	cec_log_msg(&msg);
 	if (options[OptShowRaw])
 		log_raw_msg(&msg);
-	std::string status;
+	char status[CEC_STATUS_STR_SIZE + 1] = "";
 	if ((msg.tx_status & ~CEC_TX_STATUS_OK) ||
-	    (msg.rx_status & ~CEC_RX_STATUS_OK))
-		status = std::string(" ") + cec_status2s(msg);
+	    (msg.rx_status & ~CEC_RX_STATUS_OK)) {
+		status[0] = ' ';
+		cec_status2s(msg, status + 1, sizeof(status) - 1);
+	}
 	if (verbose && transmitted)
 		printf("\tSequence: %u Tx Timestamp: %s%s\n",
-		       msg.sequence, ts2s(msg.tx_ts).c_str(),
-		       status.c_str());
+		       msg.sequence, ts2s(msg.tx_ts).c_str(), status);
 	else if (verbose && !transmitted)
 		printf("\tSequence: %u Rx Timestamp: %s%s\n",
-		       msg.sequence, ts2s(msg.rx_ts).c_str(),
-		       status.c_str());
+		       msg.sequence, ts2s(msg.rx_ts).c_str(), status);
 }
 
 static void wait_for_msgs(const struct node &node, __u32 monitor_time)
@@ -834,7 +1233,78 @@ static void wait_for_msgs(const struct node &node, __u32 monitor_time)
 	}
 }
 
-#define MONITOR_FL_DROPPED_EVENTS     (1 << 16)
+/*
+ * Keep the topology cache file up to date. It is removed as soon as a state
+ * change or HPD event arrives, and the topology is discovered again once no
+ * event was received for a second, to let the adapter settle.
+ */
+static void cache_topology(struct node &node, __u32 monitor_time, const char *file)
+{
+	std::vector<cec_msg> polls;
+	std::vector<cec_msg> msgs;
+	bool dirty = true;
+	fd_set ex_fds;
+	int fd = node.fd;
+	time_t t;
+
+	if (!(node.caps & CEC_CAP_TRANSMIT)) {
+		fprintf(stderr, "This adapter cannot transmit messages\n");
+		return;
+	}
+
+	t = time(NULL) + monitor_time;
+
+	while (!monitor_time || time(NULL) < t) {
+		struct timeval tv = { 1, 0 };
+		int res;
+
+		fflush(stdout);
+		FD_ZERO(&ex_fds);
+		FD_SET(fd, &ex_fds);
+		res = select(fd + 1, NULL, NULL, &ex_fds, &tv);
+		if (res < 0)
+			break;
+		if (res > 0) {
+			struct cec_event ev;
+
+			if (doioctl(&node, CEC_DQEVENT, &ev))
+				continue;
+			if (ev.flags & CEC_EVENT_FL_INITIAL_STATE)
+				continue;
+			if (ev.event != CEC_EVENT_STATE_CHANGE &&
+			    ev.event != CEC_EVENT_PIN_HPD_LOW &&
+			    ev.event != CEC_EVENT_PIN_HPD_HIGH)
+				continue;
+			if (verbose)
+				log_event(ev, true);
+			unlink(file);
+			dirty = true;
+			continue;
+		}
+		if (!dirty)
+			continue;
+		dirty = false;
+
+		struct cec_log_addrs laddrs = { };
+
+		doioctl(&node, CEC_ADAP_G_PHYS_ADDR, &node.phys_addr);
+		doioctl(&node, CEC_ADAP_G_LOG_ADDRS, &laddrs);
+		node.num_log_addrs = laddrs.num_log_addrs;
+		node.log_addr_mask = laddrs.log_addr_mask;
+
+		/* Wait for the adapter to be configured again */
+		if (!laddrs.num_log_addrs)
+			continue;
+
+		discoverTopology(&node, laddrs.log_addr[0], polls, msgs);
+		writeTopologyCache(file, &node, laddrs.log_addr[0], polls, msgs);
+		if (verbose)
+			printf("Topology cached in %s: %u devices\n", file,
+			       (unsigned)(msgs.size() / TOPO_NUM_REQS));
+	}
+	unlink(file);
+}
+
 
 static void monitor(const struct node &node, __u32 monitor_time, const char *store_pin)
 {
@@ -885,15 +1355,7 @@ static void monitor(const struct node &node, __u32 monitor_time, const char *sto
 				strerror(errno));
 			std::exit(EXIT_FAILURE);
 		}
-		fprintf(fstore, "# cec-ctl --store-pin\n");
-		fprintf(fstore, "# version 1\n");
-		fprintf(fstore, "# start_monotonic %lu.%09lu\n",
-			start_monotonic.tv_sec, start_monotonic.tv_nsec);
-		fprintf(fstore, "# start_timeofday %lu.%06lu\n",
-			start_timeofday.tv_sec, start_timeofday.tv_usec);
-		fprintf(fstore, "# log_addr_mask 0x%04x\n", node.log_addr_mask);
-		fprintf(fstore, "# phys_addr %x.%x.%x.%x\n",
-			cec_phys_addr_exp(node.phys_addr));
+		store_pin_header(fstore, node);
 	}
 
 	if (fstore != stdout)
@@ -944,29 +1406,168 @@ static void monitor(const struct node &node, __u32 monitor_time, const char *sto
 
 				if (ev.flags & CEC_EVENT_FL_DROPPED_EVENTS)
 					v |= MONITOR_FL_DROPPED_EVENTS;
-				fprintf(fstore, "%llu.%09llu %d\n",
-					ev.ts / 1000000000, ev.ts % 1000000000, v);
-				fflush(fstore);
+				store_pin_event(fstore, ev.ts, v);
+			}
+			if (!pin_event || options[OptMonitorPin])
+				log_event(ev, fstore != stdout);
+		}
+		if (!res && eob_ts) {
+			struct timespec ts;
+			__u64 ts64;
+
+			clock_gettime(CLOCK_MONOTONIC, &ts);
+			ts64 = ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+			generate_eob_event(ts64, fstore);
+		}
+	}
+	if (fstore && fstore != stdout)
+		fclose(fstore);
+}
+
+/*
+ * Messages and events from different adapters are dequeued in whatever
+ * order select() reports them. Hold them back this long so they can be
+ * shown in timestamp order.
+ */
+#define MONITOR_REORDER_NSECS	(100 * 1000000ULL)
+
+struct monitor_item {
+	unsigned dev;
+	bool is_msg;
+	struct cec_msg msg;
+	struct cec_event ev;
+};
+
+static void show_monitor_item(const std::vector<node> &nodes, __u64 ts,
+			      struct monitor_item &item)
+{
+	const char *name = strrchr(nodes[item.dev].device, '/');
+	std::string prefix = ts2s(ts) + " " + (name ? name + 1 : nodes[item.dev].device) + ": ";
+
+	if (item.is_msg) {
+		if (ignore_msg(item.msg))
+			return;
+		printf("%s", prefix.c_str());
+		show_msg(item.msg);
+	} else {
+		log_event(item.ev, true, prefix.c_str());
+	}
+}
+
+static void monitor_multi(const struct node &node, const dev_vec &devices,
+			  __u32 monitor_time)
+{
+	__u32 monitor = options[OptMonitorAll] ? CEC_MODE_MONITOR_ALL : CEC_MODE_MONITOR;
+	std::multimap<__u64, monitor_item> pending;
+	std::vector<struct node> nodes(1, node);
+	unsigned active;
+	time_t t;
+
+	for (const auto &dev : devices) {
+		struct node n = { };
+		struct cec_caps caps = { };
+
+		n.device = dev.c_str();
+		n.fd = open(n.device, O_RDWR);
+		if (n.fd < 0) {
+			fprintf(stderr, "Failed to open %s: %s\n", n.device,
+				strerror(errno));
+			std::exit(EXIT_FAILURE);
+		}
+		doioctl(&n, CEC_ADAP_G_CAPS, &caps);
+		n.caps = caps.capabilities;
+		nodes.push_back(n);
+	}
+
+	for (auto &n : nodes) {
+		__u32 mode = monitor;
+
+		if (!(n.caps & CEC_CAP_MONITOR_ALL) && mode == CEC_MODE_MONITOR_ALL) {
+			fprintf(stderr, "%s: Monitor All mode is not supported, falling back to regular monitoring\n",
+				n.device);
+			mode = CEC_MODE_MONITOR;
+		}
+		if (doioctl(&n, CEC_S_MODE, &mode)) {
+			fprintf(stderr, "%s: Selecting monitor mode failed, you may have to run this as root.\n",
+				n.device);
+			return;
+		}
+		fcntl(n.fd, F_SETFL, fcntl(n.fd, F_GETFL) | O_NONBLOCK);
+	}
+	active = nodes.size();
+
+	printf("\n");
+	t = time(NULL) + monitor_time;
+
+	while (active && (!monitor_time || time(NULL) < t)) {
+		struct timeval tv = { 1, 0 };
+		fd_set rd_fds;
+		fd_set ex_fds;
+		int max_fd = -1;
+		__u64 ts_now;
+		int res;
+
+		if (!pending.empty()) {
+			tv.tv_sec = 0;
+			tv.tv_usec = MONITOR_REORDER_NSECS / 4000;
+		}
+		fflush(stdout);
+		FD_ZERO(&rd_fds);
+		FD_ZERO(&ex_fds);
+		for (const auto &n : nodes) {
+			if (n.fd < 0)
+				continue;
+			FD_SET(n.fd, &rd_fds);
+			FD_SET(n.fd, &ex_fds);
+			max_fd = std::max(max_fd, n.fd);
+		}
+		res = select(max_fd + 1, &rd_fds, NULL, &ex_fds, &tv);
+		if (res < 0)
+			break;
+		for (unsigned i = 0; res && i < nodes.size(); i++) {
+			struct node &n = nodes[i];
+			struct monitor_item item = { };
+
+			item.dev = i;
+			if (n.fd >= 0 && FD_ISSET(n.fd, &rd_fds)) {
+				/* Drain the queue so that the items can be sorted */
+				while (!(res = doioctl(&n, CEC_RECEIVE, &item.msg))) {
+					item.is_msg = true;
+					pending.insert({ item.msg.tx_status ? item.msg.tx_ts :
+							 item.msg.rx_ts, item });
+				}
+				if (res == ENODEV) {
+					fprintf(stderr, "%s: Device was disconnected.\n", n.device);
+					close(n.fd);
+					n.fd = -1;
+					active--;
+				}
+			}
+			if (n.fd >= 0 && FD_ISSET(n.fd, &ex_fds)) {
+				while (!doioctl(&n, CEC_DQEVENT, &item.ev)) {
+					item.is_msg = false;
+					pending.insert({ item.ev.ts, item });
+				}
 			}
-			if (!pin_event || options[OptMonitorPin])
-				log_event(ev, fstore != stdout);
 		}
-		if (!res && eob_ts) {
-			struct timespec ts;
-			__u64 ts64;
 
-			clock_gettime(CLOCK_MONOTONIC, &ts);
-			ts64 = ts.tv_sec * 1000000000ULL + ts.tv_nsec;
-			generate_eob_event(ts64, fstore);
+		ts_now = current_ts();
+		while (!pending.empty() &&
+		       pending.begin()->first + MONITOR_REORDER_NSECS <= ts_now) {
+			show_monitor_item(nodes, pending.begin()->first,
+					  pending.begin()->second);
+			pending.erase(pending.begin());
 		}
 	}
-	if (fstore && fstore != stdout)
-		fclose(fstore);
+	for (auto &p : pending)
+		show_monitor_item(nodes, p.first, p.second);
+	for (unsigned i = 1; i < nodes.size(); i++)
+		if (nodes[i].fd >= 0)
+			close(nodes[i].fd);
 }
 
-static void analyze(const char *analyze_pin)
+static void analyze_text(FILE *fanalyze)
 {
-	FILE *fanalyze;
 	struct cec_event ev = { };
 	unsigned long tv_sec, tv_nsec, tv_usec;
 	unsigned version;
@@ -975,15 +1576,6 @@ static void analyze(const char *analyze_pin)
 	unsigned line = 1;
 	char s[100];
 
-	if (!strcmp(analyze_pin, "-"))
-		fanalyze = stdin;
-	else
-		fanalyze = fopen(analyze_pin, "r");
-	if (fanalyze == NULL) {
-		fprintf(stderr, "Failed to open %s: %s\n", analyze_pin,
-			strerror(errno));
-		std::exit(EXIT_FAILURE);
-	}
 	if (!fgets(s, sizeof(s), fanalyze) ||
 	    strcmp(s, "# cec-ctl --store-pin\n"))
 		goto err;
@@ -1041,20 +1633,402 @@ static void analyze(const char *analyze_pin)
 		log_event(ev, true);
 		line++;
 	}
+	return;
+
+err:
+	fprintf(stderr, "Not a pin store file: malformed data at line %d\n", line);
+	std::exit(EXIT_FAILURE);
+}
+
+static void analyze_binary(const __u8 *data, size_t size)
+{
+	const __u8 *p = data, *end = data + size;
+	struct cec_event ev = { };
+	unsigned hdr_size;
+	__u64 ts = 0;
+	__u16 pa;
+
+	if (size < PIN_BIN_HDR_SIZE ||
+	    get_le(p + 8, 4) != PIN_BIN_VERSION ||
+	    (hdr_size = get_le(p + 12, 4)) < PIN_BIN_HDR_SIZE ||
+	    hdr_size > size ||
+	    get_le(p + 24, 4) >= 1000000000 || get_le(p + 28, 4) >= 1000000) {
+		fprintf(stderr, "Not a pin store file: unsupported binary header\n");
+		std::exit(EXIT_FAILURE);
+	}
+	start_monotonic.tv_sec = get_le(p + 16, 8);
+	start_monotonic.tv_nsec = get_le(p + 24, 4);
+	start_timeofday.tv_usec = get_le(p + 28, 4);
+	start_timeofday.tv_sec = get_le(p + 32, 8);
+
+	pa = get_le(p + 42, 2);
+	printf("Physical Address:     %x.%x.%x.%x\n", cec_phys_addr_exp(pa));
+	printf("Logical Address Mask: 0x%04x\n\n", (unsigned)get_le(p + 40, 2));
+
+	for (p += hdr_size; p < end; ) {
+		const __u8 *rec_start = p;
+		unsigned shift = 0;
+		__u64 rec = 0;
+		__s64 delta;
+		unsigned event;
+
+		for (;;) {
+			if (p == end || shift > 63) {
+				fprintf(stderr, "truncated data at offset %zu\n",
+					(size_t)(rec_start - data));
+				return;
+			}
+			rec |= (__u64)(*p & 0x7f) << shift;
+			shift += 7;
+			if (!(*p++ & 0x80))
+				break;
+		}
+
+		event = rec & 7;
+		if (event > 5) {
+			fprintf(stderr, "malformed data at offset %zu\n",
+				(size_t)(rec_start - data));
+			break;
+		}
+		ev.flags = (rec & PIN_BIN_DROPPED) ? CEC_EVENT_FL_DROPPED_EVENTS : 0;
+		rec >>= 4;
+		delta = (__s64)(rec >> 1) ^ -(__s64)(rec & 1);
+		ts += delta;
+		ev.ts = ts;
+		ev.event = event + CEC_EVENT_PIN_CEC_LOW;
+		log_event(ev, true);
+	}
+}
+
+static void analyze(const char *analyze_pin)
+{
+	struct cec_event ev = { };
+
+	if (!strcmp(analyze_pin, "-")) {
+		int c = getc(stdin);
+
+		ungetc(c, stdin);
+		if (c == '#' || c == EOF) {
+			analyze_text(stdin);
+		} else {
+			std::vector<__u8> buf;
+			__u8 s[65536];
+			size_t len;
+
+			while ((len = fread(s, 1, sizeof(s), stdin)) > 0)
+				buf.insert(buf.end(), s, s + len);
+			analyze_binary(buf.data(), buf.size());
+		}
+	} else {
+		FILE *fanalyze = fopen(analyze_pin, "r");
+		void *map = MAP_FAILED;
+		struct stat st;
+
+		if (fanalyze == NULL) {
+			fprintf(stderr, "Failed to open %s: %s\n", analyze_pin,
+				strerror(errno));
+			std::exit(EXIT_FAILURE);
+		}
+		if (!fstat(fileno(fanalyze), &st) && S_ISREG(st.st_mode) &&
+		    st.st_size >= PIN_BIN_HDR_SIZE)
+			map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE,
+				   fileno(fanalyze), 0);
+		if (map != MAP_FAILED && !memcmp(map, PIN_BIN_MAGIC, 8)) {
+			madvise(map, st.st_size, MADV_SEQUENTIAL);
+			analyze_binary((const __u8 *)map, st.st_size);
+		} else {
+			analyze_text(fanalyze);
+		}
+		if (map != MAP_FAILED)
+			munmap(map, st.st_size);
+		fclose(fanalyze);
+	}
 
 	if (eob_ts) {
 		ev.event = CEC_EVENT_PIN_CEC_HIGH;
 		ev.ts = eob_ts;
 		log_event(ev, true);
 	}
+}
 
-	if (fanalyze != stdin)
-		fclose(fanalyze);
-	return;
+/*
+ * The summary analyzer splits the capture into chunks at points where
+ * the bus has been idle for at least PIN_SUMMARY_IDLE_NSECS. The pin
+ * state machine is back in the idle state at such a point, so each
+ * chunk can be decoded by a separate thread and the results merged.
+ */
+#define PIN_SUMMARY_IDLE_NSECS		(10 * 2400 * 1000ULL)	/* 10 bit periods */
+#define PIN_SUMMARY_MIN_CHUNK_SIZE	(1 << 20)
+
+struct pin_chunk {
+	const __u8 *start;
+	const __u8 *end;
+	bool binary;
+	__u64 ts;		/* timestamp preceding the first binary record */
+	bool last;
+	const __u8 *malformed;
+	struct cec_pin_stats stats;
+};
 
-err:
-	fprintf(stderr, "Not a pin store file: malformed data at line %d\n", line);
-	std::exit(EXIT_FAILURE);
+/*
+ * Read the next pin event from p. Returns 1 if an event was read,
+ * 0 at the end of the data and -1 if the data is malformed.
+ */
+static int read_pin_event(const __u8 *&p, const __u8 *end, bool binary,
+			  __u64 &ts, unsigned &event)
+{
+	if (binary) {
+		unsigned shift = 0;
+		__u64 rec = 0;
+
+		if (p == end)
+			return 0;
+		for (;;) {
+			if (p == end || shift > 63)
+				return -1;
+			rec |= (__u64)(*p & 0x7f) << shift;
+			shift += 7;
+			if (!(*p++ & 0x80))
+				break;
+		}
+		event = rec & 7;
+		rec >>= 4;
+		ts += (__s64)(rec >> 1) ^ -(__s64)(rec & 1);
+		return event > 5 ? -1 : 1;
+	}
+
+	for (;;) {
+		__u64 sec = 0, nsec = 0;
+		unsigned digits = 0;
+
+		if (p == end)
+			return 0;
+		if (*p == '#' || *p == '\n') {
+			p = (const __u8 *)memchr(p, '\n', end - p);
+			p = p ? p + 1 : end;
+			continue;
+		}
+		while (p < end && isdigit(*p) && digits++ < 20)
+			sec = sec * 10 + *p++ - '0';
+		if (!digits || p == end || *p++ != '.')
+			return -1;
+		for (digits = 0; digits < 9; digits++) {
+			if (p == end || !isdigit(*p))
+				return -1;
+			nsec = nsec * 10 + *p++ - '0';
+		}
+		if (p == end || *p++ != ' ')
+			return -1;
+		event = 0;
+		for (digits = 0; p < end && isdigit(*p) && digits < 6; digits++)
+			event = event * 10 + *p++ - '0';
+		if (!digits || (p < end && *p++ != '\n'))
+			return -1;
+		event &= ~MONITOR_FL_DROPPED_EVENTS;
+		ts = sec * 1000000000ULL + nsec;
+		return event > 5 ? -1 : 1;
+	}
+}
+
+static void *analyze_pin_chunk(void *arg)
+{
+	struct pin_chunk *chunk = static_cast<struct pin_chunk *>(arg);
+	const __u8 *p = chunk->start;
+	__u64 ts = chunk->ts;
+	unsigned event;
+	int ret;
+
+	cec_pin_stats_set(&chunk->stats);
+	while (true) {
+		const __u8 *rec = p;
+
+		ret = read_pin_event(p, chunk->end, chunk->binary, ts, event);
+		if (ret <= 0) {
+			if (ret < 0)
+				chunk->malformed = rec;
+			break;
+		}
+		if (event <= CEC_EVENT_PIN_CEC_HIGH - CEC_EVENT_PIN_CEC_LOW)
+			log_event_pin(event, ts, false);
+	}
+	if (chunk->last && !ret && eob_ts)
+		log_event_pin(true, eob_ts, false);
+	cec_pin_stats_set(NULL);
+	return NULL;
+}
+
+static void split_pin_chunks(const __u8 *data, const __u8 *end, bool binary,
+			     unsigned n, std::vector<pin_chunk> &chunks)
+{
+	const __u8 *p = data;
+	__u64 ts = 0;
+
+	chunks.resize(1);
+	chunks[0].start = data;
+	chunks[0].ts = 0;
+	for (unsigned i = 1; i < n && p < end; i++) {
+		const __u8 *nominal = data + (end - data) * i / n;
+		bool have_high = false;
+		__u64 high_ts = 0;
+
+		/* Text lines are self-contained, so skip ahead to the next line */
+		if (!binary && p < nominal) {
+			p = (const __u8 *)memchr(nominal, '\n', end - nominal);
+			p = p ? p + 1 : end;
+		}
+		while (p < end) {
+			const __u8 *rec = p;
+			__u64 rec_ts = ts;
+			unsigned event;
+
+			if (read_pin_event(p, end, binary, ts, event) <= 0) {
+				/* Leave it to the thread to report malformed data */
+				p = end;
+				break;
+			}
+			if (rec < nominal)
+				continue;
+			if (event == CEC_EVENT_PIN_CEC_HIGH - CEC_EVENT_PIN_CEC_LOW) {
+				have_high = true;
+				high_ts = ts;
+			} else if (event == CEC_EVENT_PIN_CEC_LOW - CEC_EVENT_PIN_CEC_LOW) {
+				if (have_high && ts - high_ts >= PIN_SUMMARY_IDLE_NSECS) {
+					struct pin_chunk chunk = { };
+
+					chunk.start = p = rec;
+					chunk.ts = rec_ts;
+					chunks.back().end = rec;
+					chunks.push_back(chunk);
+					break;
+				}
+				have_high = false;
+			}
+		}
+	}
+	for (auto &chunk : chunks) {
+		chunk.binary = binary;
+		chunk.malformed = NULL;
+		memset(&chunk.stats, 0, sizeof(chunk.stats));
+	}
+	chunks.back().end = end;
+	chunks.back().last = true;
+}
+
+static void analyze_summary_data(const __u8 *data, size_t size)
+{
+	const __u8 *p = data, *end = data + size;
+	bool binary = size >= PIN_BIN_HDR_SIZE && !memcmp(data, PIN_BIN_MAGIC, 8);
+	std::vector<pin_chunk> chunks;
+	std::vector<pthread_t> threads;
+	struct cec_pin_stats stats = { };
+	long nproc = sysconf(_SC_NPROCESSORS_ONLN);
+	unsigned log_addr_mask = 0;
+	__u16 pa = CEC_PHYS_ADDR_INVALID;
+	unsigned n;
+
+	if (binary) {
+		unsigned hdr_size;
+
+		if (get_le(p + 8, 4) != PIN_BIN_VERSION ||
+		    (hdr_size = get_le(p + 12, 4)) < PIN_BIN_HDR_SIZE ||
+		    hdr_size > size) {
+			fprintf(stderr, "Not a pin store file: unsupported binary header\n");
+			std::exit(EXIT_FAILURE);
+		}
+		log_addr_mask = get_le(p + 40, 2);
+		pa = get_le(p + 42, 2);
+		p += hdr_size;
+	} else {
+		static const char magic[] = "# cec-ctl --store-pin\n# version 1\n";
+		char s[100];
+
+		if (size < sizeof(magic) - 1 || memcmp(p, magic, sizeof(magic) - 1)) {
+			fprintf(stderr, "Not a pin store file: malformed data at line 1\n");
+			std::exit(EXIT_FAILURE);
+		}
+		/* The remaining header lines are comments as far as the events are concerned */
+		while (p < end && *p == '#') {
+			const __u8 *eol = (const __u8 *)memchr(p, '\n', end - p);
+			size_t len = (eol ? eol : end) - p;
+			unsigned pa1, pa2, pa3, pa4;
+
+			len = std::min(len, sizeof(s) - 1);
+			memcpy(s, p, len);
+			s[len] = 0;
+			sscanf(s, "# log_addr_mask 0x%04x", &log_addr_mask);
+			if (sscanf(s, "# phys_addr %x.%x.%x.%x", &pa1, &pa2, &pa3, &pa4) == 4)
+				pa = (pa1 << 12) | (pa2 << 8) | (pa3 << 4) | pa4;
+			p = eol ? eol + 1 : end;
+		}
+	}
+
+	printf("Physical Address:     %x.%x.%x.%x\n", cec_phys_addr_exp(pa));
+	printf("Logical Address Mask: 0x%04x\n\n", log_addr_mask);
+
+	n = nproc > 1 ? nproc : 1;
+	n = std::min<size_t>(n, (end - p) / PIN_SUMMARY_MIN_CHUNK_SIZE + 1);
+	split_pin_chunks(p, end, binary, n, chunks);
+
+	/* The first chunk is analyzed by this thread */
+	threads.resize(chunks.size());
+	for (unsigned i = 1; i < chunks.size(); i++) {
+		if (pthread_create(&threads[i], NULL, analyze_pin_chunk, &chunks[i])) {
+			fprintf(stderr, "Failed to create a thread: %s\n", strerror(errno));
+			std::exit(EXIT_FAILURE);
+		}
+	}
+	analyze_pin_chunk(&chunks[0]);
+	for (unsigned i = 1; i < chunks.size(); i++)
+		pthread_join(threads[i], NULL);
+
+	for (const auto &chunk : chunks) {
+		cec_pin_stats_add(stats, chunk.stats);
+		if (chunk.malformed) {
+			fprintf(stderr, "malformed data at offset %zu\n",
+				(size_t)(chunk.malformed - data));
+			break;
+		}
+	}
+	cec_pin_stats_show(stats);
+}
+
+static void analyze_summary(const char *analyze_pin)
+{
+	if (!strcmp(analyze_pin, "-")) {
+		std::vector<__u8> buf;
+		__u8 s[65536];
+		size_t len;
+
+		while ((len = fread(s, 1, sizeof(s), stdin)) > 0)
+			buf.insert(buf.end(), s, s + len);
+		analyze_summary_data(buf.data(), buf.size());
+		return;
+	}
+
+	int fd = open(analyze_pin, O_RDONLY);
+	void *map = MAP_FAILED;
+	struct stat st;
+
+	if (fd < 0) {
+		fprintf(stderr, "Failed to open %s: %s\n", analyze_pin,
+			strerror(errno));
+		std::exit(EXIT_FAILURE);
+	}
+	if (fstat(fd, &st) || !S_ISREG(st.st_mode)) {
+		fprintf(stderr, "%s is not a regular file\n", analyze_pin);
+		std::exit(EXIT_FAILURE);
+	}
+	if (st.st_size)
+		map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (st.st_size && map == MAP_FAILED) {
+		fprintf(stderr, "Failed to map %s: %s\n", analyze_pin,
+			strerror(errno));
+		std::exit(EXIT_FAILURE);
+	}
+	analyze_summary_data(st.st_size ? (const __u8 *)map : NULL, st.st_size);
+	if (map != MAP_FAILED)
+		munmap(map, st.st_size);
+	close(fd);
 }
 
 static bool wait_for_pwr_state(const struct node &node, unsigned from,
@@ -1476,6 +2450,113 @@ static void test_power_cycle(const struct node &node, unsigned int max_tries,
 		printf("Test had %u failure%s\n", failures, failures == 1 ? "" : "s");
 }
 
+/* The duration of a frame on the bus: a start bit and 10 bits per byte */
+#define BENCH_FRAME_NSECS(len)	((4500 + (len) * 10 * 2400) * 1000ULL)
+
+enum {
+	BENCH_MSG_POWER_STATUS,
+	BENCH_MSG_CEC_VERSION,
+	BENCH_MSG_POLL,
+};
+
+static double percentile(const std::vector<__u64> &v, unsigned p)
+{
+	return v[(v.size() - 1) * p / 100] / 1000000.0;
+}
+
+static void show_latency(const char *name, std::vector<__u64> &v)
+{
+	if (v.empty()) {
+		printf("\t%-17s: no samples\n", name);
+		return;
+	}
+	std::sort(v.begin(), v.end());
+	printf("\t%-17s: min %.2f, p50 %.2f, p90 %.2f, p99 %.2f, max %.2f ms (%zu samples)\n",
+	       name, percentile(v, 0), percentile(v, 50), percentile(v, 90),
+	       percentile(v, 99), percentile(v, 100), v.size());
+}
+
+static void bench(struct node *node, unsigned from, unsigned to, unsigned cnt,
+		  unsigned burst, unsigned type)
+{
+	std::vector<__u64> tx_latency, reply_latency;
+	unsigned tx_ok = 0, tx_failed = 0, replies = 0, timeouts = 0, aborts = 0;
+	unsigned arb_lost = 0, nacks = 0, low_drives = 0, errors = 0;
+	__u64 bus_nsecs = 0;
+	__u64 start, duration;
+
+	printf("\nBenchmark: %u messages in bursts of %u from %s to %s\n",
+	       cnt, burst, cec_la2s(from), cec_la2s(to));
+
+	start = current_ts();
+	for (unsigned done = 0; done < cnt; ) {
+		std::vector<cec_msg> msgs(std::min(burst, cnt - done));
+		std::vector<__u64> queued;
+		unsigned len;
+
+		for (auto &msg : msgs) {
+			cec_msg_init(&msg, from, to);
+			if (type == BENCH_MSG_POWER_STATUS)
+				cec_msg_give_device_power_status(&msg, true);
+			else if (type == BENCH_MSG_CEC_VERSION)
+				cec_msg_get_cec_version(&msg, true);
+		}
+		/* The results overwrite the messages with the replies */
+		len = msgs[0].len;
+		transmit_msgs(node, msgs, &queued);
+		done += msgs.size();
+
+		for (unsigned i = 0; i < msgs.size(); i++) {
+			const cec_msg &msg = msgs[i];
+			unsigned attempts = msg.tx_nack_cnt + msg.tx_low_drive_cnt +
+					    msg.tx_error_cnt;
+
+			arb_lost += msg.tx_arb_lost_cnt;
+			nacks += msg.tx_nack_cnt;
+			low_drives += msg.tx_low_drive_cnt;
+			errors += msg.tx_error_cnt;
+			if (!(msg.tx_status & CEC_TX_STATUS_OK)) {
+				tx_failed++;
+				bus_nsecs += attempts * BENCH_FRAME_NSECS(len);
+				continue;
+			}
+			tx_ok++;
+			bus_nsecs += (attempts + 1) * BENCH_FRAME_NSECS(len);
+			if (queued[i] && msg.tx_ts > queued[i])
+				tx_latency.push_back(msg.tx_ts - queued[i]);
+			if (!msg.reply)
+				continue;
+			if (msg.rx_status & CEC_RX_STATUS_TIMEOUT) {
+				timeouts++;
+				continue;
+			}
+			if (!(msg.rx_status & CEC_RX_STATUS_OK))
+				continue;
+			replies++;
+			if (msg.rx_status & CEC_RX_STATUS_FEATURE_ABORT)
+				aborts++;
+			reply_latency.push_back(msg.rx_ts - msg.tx_ts);
+			bus_nsecs += BENCH_FRAME_NSECS(msg.len);
+		}
+	}
+	duration = current_ts() - start;
+
+	printf("\tDuration         : %.3f s, %.1f msgs/s\n", duration / 1000000000.0,
+	       tx_ok * 1000000000.0 / (duration ? duration : 1));
+	printf("\tTransmitted      : %u OK, %u failed\n", tx_ok, tx_failed);
+	if (type != BENCH_MSG_POLL)
+		printf("\tReplies          : %u (%u Feature Abort), %u timed out\n",
+		       replies, aborts, timeouts);
+	printf("\tRetries          : %u Arbitration Lost, %u NACK, %u Low Drive, %u Error\n",
+	       arb_lost, nacks, low_drives, errors);
+	show_latency("Transmit latency", tx_latency);
+	if (type != BENCH_MSG_POLL)
+		show_latency("Reply latency", reply_latency);
+	/* Only counts our frames and their replies, not the signal free time */
+	printf("\tBus utilization  : %.1f%%\n",
+	       bus_nsecs * 100.0 / (duration ? duration : 1));
+}
+
 static void stress_test_power_cycle(const struct node &node, unsigned cnt,
 				    unsigned min_sleep, unsigned max_sleep, unsigned max_tries,
 				    bool has_seed, unsigned seed, unsigned repeats,
@@ -1746,44 +2827,148 @@ static __u16 parse_phys_addr_from_edid(const char *edid_path)
 	return pa;
 }
 
+/*
+ * Read the physical address from an already opened EDID file. Only block 0
+ * and, if present, the first extension block (which is where the CTA-861
+ * block holding the SPA normally is) are read.
+ */
+static __u16 read_phys_addr_from_edid_fd(int fd)
+{
+	__u8 edid[256];
+	unsigned int loc;
+
+	if (pread(fd, edid, 128, 0) != 128 || !edid[0x7e])
+		return CEC_PHYS_ADDR_INVALID;
+	if (pread(fd, edid + 128, 128, 128) != 128)
+		return CEC_PHYS_ADDR_INVALID;
+	loc = cec_get_edid_spa_location(edid, sizeof(edid));
+	return loc ? (edid[loc] << 8) | edid[loc + 1] : CEC_PHYS_ADDR_INVALID;
+}
+
+/*
+ * Open a socket receiving kernel uevents. DRM sends a uevent on every
+ * hotplug, which is the only change notification available for the EDID
+ * attributes in sysfs since those do not support inotify.
+ */
+static int open_uevent_socket()
+{
+	struct sockaddr_nl addr = {};
+	int fd;
+
+	fd = socket(AF_NETLINK, SOCK_DGRAM | SOCK_CLOEXEC, NETLINK_KOBJECT_UEVENT);
+	if (fd < 0)
+		return -1;
+	addr.nl_family = AF_NETLINK;
+	addr.nl_groups = 1;
+	if (bind(fd, reinterpret_cast<struct sockaddr *>(&addr), sizeof(addr))) {
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+/* Returns true if a pending uevent was read, *drm is set if it is for DRM */
+static bool read_uevent(int fd, bool *drm)
+{
+	char buf[4096];
+	ssize_t len = recv(fd, buf, sizeof(buf) - 1, MSG_DONTWAIT);
+
+	if (len <= 0)
+		return false;
+	buf[len] = 0;
+	for (ssize_t i = 0; i < len; i += strlen(buf + i) + 1)
+		if (!strcmp(buf + i, "SUBSYSTEM=drm"))
+			*drm = true;
+	return true;
+}
+
+#define EDID_INOTIFY_MASK (IN_MODIFY | IN_CLOSE_WRITE | IN_ATTRIB | \
+			   IN_DELETE_SELF | IN_MOVE_SELF)
+
 static void *thread_edid_poll(void *arg)
 {
 	struct node *node = static_cast<struct node *>(arg);
+	struct pollfd pfds[2];
 	__u16 phys_addr;
-	bool has_edid;
-	char dummy;
+	int in_fd, wd, ev_fd;
 	int fd;
 
 	fd = open(edid_path, O_RDONLY);
 	if (fd < 0)
 		std::exit(EXIT_FAILURE);
 
+	in_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+	wd = in_fd >= 0 ? inotify_add_watch(in_fd, edid_path, EDID_INOTIFY_MASK) : -1;
+	ev_fd = open_uevent_socket();
+	pfds[0].fd = in_fd;
+	pfds[0].events = POLLIN;
+	pfds[1].fd = ev_fd;
+	pfds[1].events = POLLIN;
+
 	doioctl(node, CEC_ADAP_G_PHYS_ADDR, &phys_addr);
-	has_edid = phys_addr != CEC_PHYS_ADDR_INVALID;
 
 	for (;;) {
-		bool edid;
-
-		/* Poll every 100 ms */
-		usleep(100000);
-		lseek(fd, 0, SEEK_SET);
-		edid = read(fd, &dummy, 1) > 0;
-		if (has_edid != edid) {
-			has_edid = edid;
-			if (!edid)
-				phys_addr = CEC_PHYS_ADDR_INVALID;
-			else
-				phys_addr = parse_phys_addr_from_edid(edid_path);
-			doioctl(node, CEC_ADAP_S_PHYS_ADDR, &phys_addr);
-			if (is_paused)
-				printf("Physical Address: %x.%x.%x.%x\n",
-				       cec_phys_addr_exp(phys_addr));
+		/*
+		 * Without a uevent socket (e.g. in a container without
+		 * netlink access) fall back to polling every 100 ms, since
+		 * inotify alone does not report changes to sysfs files.
+		 */
+		int timeout = ev_fd >= 0 ? -1 : 100;
+		bool changed = false;
+		__u16 pa;
+		int ret;
+
+		ret = poll(pfds, 2, timeout);
+		if (ret < 0) {
+			if (errno == EINTR)
+				continue;
+			break;
+		}
+		if (ret == 0)
+			changed = true;
+		if (pfds[0].revents & POLLIN) {
+			char buf[4096]
+				__attribute__((aligned(__alignof__(struct inotify_event))));
+			ssize_t len;
+
+			while ((len = read(in_fd, buf, sizeof(buf))) > 0) {
+				for (char *p = buf; p < buf + len; ) {
+					const auto *ev = reinterpret_cast<struct inotify_event *>(p);
+
+					if (ev->mask & IN_IGNORED)
+						wd = -1;
+					p += sizeof(*ev) + ev->len;
+				}
+			}
+			changed = true;
 		}
+		if (pfds[1].revents & POLLIN)
+			while (read_uevent(ev_fd, &changed));
+		if (!changed)
+			continue;
+
+		/* The file was removed or replaced, so watch the new one */
+		if (wd < 0 && in_fd >= 0)
+			wd = inotify_add_watch(in_fd, edid_path, EDID_INOTIFY_MASK);
+
+		/*
+		 * Reopen the file each time: it may have been replaced by
+		 * a new file, or it may have disappeared entirely.
+		 */
+		close(fd);
+		fd = open(edid_path, O_RDONLY);
+		pa = fd >= 0 ? read_phys_addr_from_edid_fd(fd) : CEC_PHYS_ADDR_INVALID;
+		if (pa == phys_addr)
+			continue;
+		phys_addr = pa;
+		doioctl(node, CEC_ADAP_S_PHYS_ADDR, &phys_addr);
+		if (is_paused)
+			printf("Physical Address: %x.%x.%x.%x\n",
+			       cec_phys_addr_exp(phys_addr));
 	}
 	return NULL;
 }
 
-using dev_vec = std::vector<std::string>;
 using dev_map = std::map<std::string, std::string>;
 
 static void list_devices()
@@ -1864,6 +3049,7 @@ static void list_devices()
 int main(int argc, char **argv)
 {
 	std::string device;
+	dev_vec monitor_devices;
 	const char *driver = NULL;
 	const char *adapter = NULL;
 	const struct cec_msg_args *opt;
@@ -1883,6 +3069,10 @@ int main(int argc, char **argv)
 	double stress_test_pwr_cycle_sleep_before_off = 0;
 	unsigned int test_pwr_cycle_polls = 15;
 	unsigned int test_pwr_cycle_sleep = 10;
+	unsigned int bench_to = CEC_LOG_ADDR_TV;
+	unsigned int bench_cnt = 100;
+	unsigned int bench_burst = 1;
+	unsigned int bench_msg = BENCH_MSG_POWER_STATUS;
 	bool warn_if_unconfigured = false;
 	__u16 phys_addr;
 	__u8 from = 0, to = 0, first_to = 0xff;
@@ -1891,6 +3081,7 @@ int main(int argc, char **argv)
 	__u8 rc_src = 0;
 	const char *osd_name = "";
 	const char *store_pin = NULL;
+	const char *topology_cache = NULL;
 	const char *analyze_pin = NULL;
 	bool reply = true;
 	int idx = 0;
@@ -1957,6 +3148,12 @@ int main(int argc, char **argv)
 		case OptMonitorTime:
 			monitor_time = strtoul(optarg, NULL, 0);
 			break;
+		case OptMonitorDevice:
+			if (isdigit(optarg[0]) && strlen(optarg) <= 3)
+				monitor_devices.push_back(std::string("/dev/cec") + optarg);
+			else
+				monitor_devices.push_back(optarg);
+			break;
 		case OptIgnore: {
 			bool all_la = !strncmp(optarg, "all", 3);
 			bool all_opcodes = true;
@@ -2000,7 +3197,16 @@ int main(int argc, char **argv)
 		case OptStorePin:
 			store_pin = optarg;
 			break;
+		case OptStorePinBinary:
+			store_pin = optarg;
+			store_pin_binary = true;
+			options[OptStorePin] = 1;
+			break;
+		case OptTopologyCache:
+			topology_cache = optarg;
+			break;
 		case OptAnalyzePin:
+		case OptAnalyzePinSummary:
 			analyze_pin = optarg;
 			break;
 		case OptToggleNoReply:
@@ -2285,6 +3491,49 @@ int main(int argc, char **argv)
 			break;
 		}
 
+		case OptBench: {
+			static const char *arg_names[] = {
+				"to",
+				"cnt",
+				"burst",
+				"msg",
+				NULL
+			};
+			char *value, *subs = optarg;
+
+			while (*subs != '\0') {
+				switch (cec_parse_subopt(&subs, arg_names, &value)) {
+				case 0:
+					bench_to = strtoul(value, 0L, 0) & 0xf;
+					break;
+				case 1:
+					bench_cnt = strtoul(value, 0L, 0);
+					break;
+				case 2:
+					bench_burst = strtoul(value, 0L, 0);
+					break;
+				case 3:
+					if (!strcmp(value, "power-status")) {
+						bench_msg = BENCH_MSG_POWER_STATUS;
+					} else if (!strcmp(value, "cec-version")) {
+						bench_msg = BENCH_MSG_CEC_VERSION;
+					} else if (!strcmp(value, "poll")) {
+						bench_msg = BENCH_MSG_POLL;
+					} else {
+						fprintf(stderr, "unknown bench message '%s'\n", value);
+						std::exit(EXIT_FAILURE);
+					}
+					break;
+				default:
+					std::exit(EXIT_FAILURE);
+				}
+			}
+			if (!bench_burst)
+				bench_burst = 1;
+			warn_if_unconfigured = true;
+			break;
+		}
+
 		case OptStressTestPowerCycle: {
 			static const char *arg_names[] = {
 				"cnt",
@@ -2373,6 +3622,22 @@ int main(int argc, char **argv)
 		return 1;
 	}
 
+	if (!monitor_devices.empty() &&
+	    (options[OptMonitorPin] || options[OptStorePin] || analyze_pin)) {
+		fprintf(stderr, "--monitor-device cannot be combined with the pin options.\n\n");
+		usage();
+		return 1;
+	}
+
+	if (!monitor_devices.empty() && !options[OptMonitorAll])
+		options[OptMonitor] = 1;
+
+	if (options[OptCacheTopology] && !topology_cache) {
+		fprintf(stderr, "--cache-topology requires the --topology-cache option.\n\n");
+		usage();
+		return 1;
+	}
+
 	if (analyze_pin && options[OptSetDevice]) {
 		fprintf(stderr, "--device and --analyze-pin options cannot be combined.\n\n");
 		usage();
@@ -2380,7 +3645,10 @@ int main(int argc, char **argv)
 	}
 
 	if (analyze_pin) {
-		analyze(analyze_pin);
+		if (options[OptAnalyzePinSummary])
+			analyze_summary(analyze_pin);
+		else
+			analyze(analyze_pin);
 		return 0;
 	}
 
@@ -2625,7 +3893,8 @@ int main(int argc, char **argv)
 
 	if (node.num_log_addrs == 0) {
 		if (options[OptMonitor] || options[OptMonitorAll] ||
-		    options[OptMonitorPin] || options[OptStorePin])
+		    options[OptMonitorPin] || options[OptStorePin] ||
+		    options[OptCacheTopology])
 			goto skip_la;
 		if (warn_if_unconfigured)
 			fprintf(stderr, "\nAdapter is unconfigured, please configure it first.\n");
@@ -2638,7 +3907,7 @@ int main(int argc, char **argv)
 		from = laddrs.log_addr[0] & 0xf;
 
 	if (options[OptShowTopology])
-		showTopology(&node);
+		showTopology(&node, topology_cache);
 
 	if (options[OptLogicalAddress])
 		printf("%d\n", laddrs.log_addr[0] & 0xf);
@@ -2712,13 +3981,20 @@ int main(int argc, char **argv)
 					stress_test_pwr_cycle_repeats,
 					stress_test_pwr_cycle_sleep_before_on,
 					stress_test_pwr_cycle_sleep_before_off);
+	if (options[OptBench])
+		bench(&node, from, bench_to, bench_cnt, bench_burst, bench_msg);
 
 skip_la:
 	if (options[OptMonitor] || options[OptMonitorAll] ||
 	    options[OptMonitorPin] || options[OptStorePin]) {
-		monitor(node, monitor_time, store_pin);
+		if (monitor_devices.empty())
+			monitor(node, monitor_time, store_pin);
+		else
+			monitor_multi(node, monitor_devices, monitor_time);
 	} else if (options[OptWaitForMsgs]) {
 		wait_for_msgs(node, monitor_time);
+	} else if (options[OptCacheTopology]) {
+		cache_topology(node, monitor_time, topology_cache);
 	} else if (options[OptPhysAddrFromEDIDPoll]) {
 		printf("Press Ctrl-C to stop EDID polling.\n");
 		is_paused = true;
@@ -14,8 +14,42 @@ std::string ts2s(__u64 ts);
 std::string ts2s(double ts);
 
 // cec-pin.cpp
-extern __u64 eob_ts;
-extern __u64 eob_ts_max;
+#define CEC_PIN_HIST_BIN_USECS	50
+#define CEC_PIN_HIST_BINS	121	// the last bin counts all longer times
+
+enum cec_pin_error {
+	CEC_PIN_ERR_START_BIT_LOW,
+	CEC_PIN_ERR_START_BIT_PERIOD,
+	CEC_PIN_ERR_DATA_BIT_LOW,
+	CEC_PIN_ERR_DATA_BIT_PERIOD,
+	CEC_PIN_ERR_LOW_DRIVE,
+	CEC_PIN_ERR_UNEXPECTED_START_BIT,
+	CEC_PIN_ERR_MISSING_EOM,
+	CEC_PIN_ERR_SPURIOUS_BYTE,
+	CEC_PIN_NUM_ERRS
+};
+
+// Statistics gathered by log_event_pin(), see cec_pin_stats_set()
+struct cec_pin_stats {
+	__u64 events;
+	__u64 msgs;
+	__u64 opcode_msgs[257];		// index 256 counts the polls
+	__u64 init_msgs[16];
+	__u64 init_nacks[16];
+	__u64 init_errors[17];		// index 16 counts errors outside messages
+	__u64 errors[CEC_PIN_NUM_ERRS];
+	__u64 start_bit_low[CEC_PIN_HIST_BINS];
+	__u64 start_bit_period[CEC_PIN_HIST_BINS];
+	__u64 data_bit_low[CEC_PIN_HIST_BINS];
+	__u64 data_bit_period[CEC_PIN_HIST_BINS];
+};
+
+// The pin state is per thread, so separate captures can be analyzed in parallel
+extern thread_local __u64 eob_ts;
+extern thread_local __u64 eob_ts_max;
 void log_event_pin(bool is_high, __u64 ts, bool show);
+void cec_pin_stats_set(struct cec_pin_stats *stats);
+void cec_pin_stats_add(struct cec_pin_stats &to, const struct cec_pin_stats &from);
+void cec_pin_stats_show(const struct cec_pin_stats &stats);
 
 #endif
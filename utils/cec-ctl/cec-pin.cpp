@@ -3,6 +3,7 @@
  * Copyright 2017 Cisco Systems, Inc. and/or its affiliates. All rights reserved.
  */
 
+#include <algorithm>
 #include <string>
 
 #include <linux/cec.h>
@@ -85,26 +86,53 @@ enum cec_state {
 #define CEC_TIM_START_BIT_TOTAL_LONG	(5000 + CEC_TIM_MARGIN)
 #define CEC_TIM_DATA_BIT_TOTAL_LONG	(2900 + CEC_TIM_MARGIN)
 
-__u64 eob_ts;
-__u64 eob_ts_max;
+thread_local __u64 eob_ts;
+thread_local __u64 eob_ts_max;
 
 // Global CEC state
-static enum cec_state state;
-static double ts;
-static __u64 low_usecs;
-static unsigned int rx_bit;
-static __u8 byte;
-static bool eom;
-static bool eom_reached;
-static __u8 byte_cnt;
-static bool bcast;
-static bool cdc;
-static struct cec_msg msg;
+static thread_local enum cec_state state;
+static thread_local double ts;
+static thread_local __u64 low_usecs;
+static thread_local unsigned int rx_bit;
+static thread_local __u8 byte;
+static thread_local bool eom;
+static thread_local bool eom_reached;
+static thread_local __u8 byte_cnt;
+static thread_local bool bcast;
+static thread_local bool cdc;
+static thread_local bool nacked;
+static thread_local struct cec_msg msg;
+static thread_local struct cec_pin_stats *stats;
+
+void cec_pin_stats_set(struct cec_pin_stats *s)
+{
+	stats = s;
+}
+
+static void pin_error(enum cec_pin_error err)
+{
+	if (!stats)
+		return;
+	stats->errors[err]++;
+	if (state == CEC_ST_RECEIVING_DATA && msg.len)
+		stats->init_errors[cec_msg_initiator(&msg)]++;
+	else
+		stats->init_errors[16]++;
+}
+
+static void pin_hist(__u64 *hist, __u64 usecs)
+{
+	hist[std::min<__u64>(usecs / CEC_PIN_HIST_BIN_USECS,
+			     CEC_PIN_HIST_BINS - 1)]++;
+}
 
 static void cec_pin_rx_start_bit_was_high(bool is_high, __u64 usecs, __u64 usecs_min, bool show)
 {
 	bool period_too_long = low_usecs + usecs > CEC_TIM_START_BIT_TOTAL_LONG;
 
+	if (is_high || low_usecs + usecs > CEC_TIM_START_BIT_TOTAL_MAX ||
+	    low_usecs + usecs < CEC_TIM_START_BIT_TOTAL_MIN - CEC_TIM_MARGIN)
+		pin_error(CEC_PIN_ERR_START_BIT_PERIOD);
 	if (is_high && show)
 		printf("%s: warn: start bit: total period too long\n", ts2s(ts).c_str());
 	else if (low_usecs + usecs > CEC_TIM_START_BIT_TOTAL_MAX && show)
@@ -129,11 +157,14 @@ static void cec_pin_rx_start_bit_was_high(bool is_high, __u64 usecs, __u64 usecs
 	byte_cnt = 0;
 	bcast = false;
 	cdc = false;
+	nacked = false;
 	msg.len = 0;
 }
 
 static void cec_pin_rx_start_bit_was_low(__u64 ev_ts, __u64 usecs, __u64 usecs_min, bool show)
 {
+	if (usecs_min > CEC_TIM_START_BIT_LOW_MAX)
+		pin_error(CEC_PIN_ERR_START_BIT_LOW);
 	if (usecs_min > CEC_TIM_START_BIT_LOW_MAX && show)
 		printf("%s: warn: start bit: low time too long (%.2f > %.2f ms)\n",
 			ts2s(ts).c_str(), usecs / 1000.0,
@@ -148,6 +179,8 @@ static void cec_pin_rx_start_bit_was_low(__u64 ev_ts, __u64 usecs, __u64 usecs_m
 		state = CEC_ST_IDLE;
 		return;
 	}
+	if (stats)
+		pin_hist(stats->start_bit_low, usecs);
 	low_usecs = usecs;
 	eob_ts = ev_ts + 1000 * (CEC_TIM_START_BIT_TOTAL - low_usecs);
 	eob_ts_max = ev_ts + 1000 * (CEC_TIM_START_BIT_TOTAL_LONG - low_usecs);
@@ -159,6 +192,10 @@ static void cec_pin_rx_data_bit_was_high(bool is_high, __u64 ev_ts,
 	bool period_too_long = low_usecs + usecs > CEC_TIM_DATA_BIT_TOTAL_LONG;
 	bool bit;
 
+	if ((rx_bit < 9 && (is_high ||
+			    low_usecs + usecs > CEC_TIM_DATA_BIT_TOTAL_MAX + CEC_TIM_MARGIN)) ||
+	    low_usecs + usecs < CEC_TIM_DATA_BIT_TOTAL_MIN - CEC_TIM_MARGIN)
+		pin_error(CEC_PIN_ERR_DATA_BIT_PERIOD);
 	if (is_high && rx_bit < 9 && show)
 		printf("%s: warn: data bit %d: total period too long\n", ts2s(ts).c_str(), rx_bit);
 	else if (rx_bit < 9 && show &&
@@ -191,6 +228,21 @@ static void cec_pin_rx_data_bit_was_high(bool is_high, __u64 ev_ts,
 
 		if (msg.len < CEC_MAX_MSG_SIZE)
 			msg.msg[msg.len++] = byte;
+		if (!ack)
+			nacked = true;
+		if (eom_reached)
+			pin_error(CEC_PIN_ERR_SPURIOUS_BYTE);
+		else if (is_high && !eom && ack)
+			pin_error(CEC_PIN_ERR_MISSING_EOM);
+		if (stats && eom && !eom_reached) {
+			__u8 init = cec_msg_initiator(&msg);
+
+			stats->msgs++;
+			stats->opcode_msgs[msg.len > 1 ? msg.msg[1] : 256]++;
+			stats->init_msgs[init]++;
+			if (nacked && !bcast)
+				stats->init_nacks[init]++;
+		}
 		if (show)
 			printf("%s: rx 0x%02x%s%s%s%s%s\n", ts2s(ts).c_str(), byte,
 			       eom ? " EOM" : "", ack ? " ACK" : " NACK",
@@ -250,6 +302,7 @@ static void cec_pin_rx_data_bit_was_low(__u64 ev_ts, __u64 usecs, __u64 usecs_mi
 
 	low_usecs = usecs;
 	if (usecs >= CEC_TIM_LOW_DRIVE_ERROR_MIN - CEC_TIM_MARGIN) {
+		pin_error(CEC_PIN_ERR_LOW_DRIVE);
 		if (usecs >= max_low_drive && show)
 			printf("%s: warn: low drive too long (%.2f > %.2f ms)\n\n",
 			       ts2s(ts).c_str(), usecs / 1000.0,
@@ -262,6 +315,7 @@ static void cec_pin_rx_data_bit_was_low(__u64 ev_ts, __u64 usecs, __u64 usecs_mi
 
 	if (rx_bit == 0 && byte_cnt &&
 	    usecs >= CEC_TIM_START_BIT_LOW_MIN - CEC_TIM_MARGIN) {
+		pin_error(CEC_PIN_ERR_UNEXPECTED_START_BIT);
 		if (show)
 			printf("%s: warn: unexpected start bit\n", ts2s(ts).c_str());
 		cec_pin_rx_start_bit_was_low(ev_ts, usecs, usecs_min, show);
@@ -270,6 +324,7 @@ static void cec_pin_rx_data_bit_was_low(__u64 ev_ts, __u64 usecs, __u64 usecs_mi
 	}
 
 	if (usecs_min > CEC_TIM_DATA_BIT_0_LOW_MAX) {
+		pin_error(CEC_PIN_ERR_DATA_BIT_LOW);
 		if (show)
 			printf("%s: warn: data bit %d: low time too long (%.2f ms)\n",
 				ts2s(ts).c_str(), rx_bit, usecs / 1000.0);
@@ -280,6 +335,10 @@ static void cec_pin_rx_data_bit_was_low(__u64 ev_ts, __u64 usecs, __u64 usecs_mi
 		}
 		return;
 	}
+	if ((usecs_min > CEC_TIM_DATA_BIT_1_LOW_MAX &&
+	     usecs < CEC_TIM_DATA_BIT_0_LOW_MIN - CEC_TIM_MARGIN) ||
+	    usecs < CEC_TIM_DATA_BIT_1_LOW_MIN - CEC_TIM_MARGIN)
+		pin_error(CEC_PIN_ERR_DATA_BIT_LOW);
 	if (usecs_min > CEC_TIM_DATA_BIT_1_LOW_MAX &&
 	    usecs < CEC_TIM_DATA_BIT_0_LOW_MIN - CEC_TIM_MARGIN && show) {
 		printf("%s: warn: data bit %d: invalid 0->1 transition (%.2f ms)\n",
@@ -301,6 +360,8 @@ static void cec_pin_debug(__u64 ev_ts, __u64 usecs, bool was_high, bool is_high,
 	switch (state) {
 	case CEC_ST_RECEIVE_START_BIT:
 		eom_reached = false;
+		if (stats && was_high && !is_high)
+			pin_hist(stats->start_bit_period, low_usecs + usecs);
 		if (was_high)
 			cec_pin_rx_start_bit_was_high(is_high, usecs, usecs_min, show);
 		else
@@ -308,6 +369,14 @@ static void cec_pin_debug(__u64 ev_ts, __u64 usecs, bool was_high, bool is_high,
 		break;
 
 	case CEC_ST_RECEIVING_DATA:
+		/*
+		 * A high to high event is the end-of-bit timeout, not a
+		 * real period.
+		 */
+		if (stats && was_high && !is_high)
+			pin_hist(stats->data_bit_period, low_usecs + usecs);
+		else if (stats && !was_high)
+			pin_hist(stats->data_bit_low, usecs);
 		if (was_high)
 			cec_pin_rx_data_bit_was_high(is_high, ev_ts, usecs, usecs_min, show);
 		else
@@ -324,13 +393,15 @@ static void cec_pin_debug(__u64 ev_ts, __u64 usecs, bool was_high, bool is_high,
 
 void log_event_pin(bool is_high, __u64 ev_ts, bool show)
 {
-	static __u64 last_ts;
-	static __u64 last_change_ts;
-	static __u64 last_1_to_0_ts;
-	static bool was_high = true;
+	static thread_local __u64 last_ts;
+	static thread_local __u64 last_change_ts;
+	static thread_local __u64 last_1_to_0_ts;
+	static thread_local bool was_high = true;
 	double bit_periods = ((ev_ts - last_ts) / 1000.0) / CEC_TIM_DATA_BIT_TOTAL;
 
 	eob_ts = eob_ts_max = 0;
+	if (stats)
+		stats->events++;
 
 	ts = ev_ts / 1000000000.0;
 	if (last_change_ts == 0) {
@@ -389,3 +460,83 @@ void log_event_pin(bool is_high, __u64 ev_ts, bool show)
 	last_ts = ev_ts;
 	was_high = is_high;
 }
+
+void cec_pin_stats_add(struct cec_pin_stats &to, const struct cec_pin_stats &from)
+{
+	const __u64 *f = reinterpret_cast<const __u64 *>(&from);
+	__u64 *t = reinterpret_cast<__u64 *>(&to);
+
+	// All members are counters
+	for (unsigned i = 0; i < sizeof(to) / sizeof(*t); i++)
+		t[i] += f[i];
+}
+
+static void show_pin_hist(const char *name, const __u64 *hist)
+{
+	printf("%s:\n", name);
+	for (unsigned i = 0; i < CEC_PIN_HIST_BINS; i++) {
+		if (!hist[i])
+			continue;
+		if (i == CEC_PIN_HIST_BINS - 1)
+			printf("\t   >= %5.2f ms: %llu\n",
+			       i * CEC_PIN_HIST_BIN_USECS / 1000.0, hist[i]);
+		else
+			printf("\t%5.2f-%5.2f ms: %llu\n",
+			       i * CEC_PIN_HIST_BIN_USECS / 1000.0,
+			       (i + 1) * CEC_PIN_HIST_BIN_USECS / 1000.0, hist[i]);
+	}
+}
+
+void cec_pin_stats_show(const struct cec_pin_stats &stats)
+{
+	static const char *error_names[CEC_PIN_NUM_ERRS] = {
+		"Start bit low time",
+		"Start bit period",
+		"Data bit low time",
+		"Data bit period",
+		"Low drive",
+		"Unexpected start bit",
+		"Missing EOM",
+		"Spurious byte",
+	};
+
+	printf("Pin Events: %llu\n", stats.events);
+	printf("Messages:   %llu\n\n", stats.msgs);
+
+	printf("Messages per opcode:\n");
+	for (unsigned i = 0; i < ARRAY_SIZE(stats.opcode_msgs); i++) {
+		const char *name = i == 256 ? "Poll" : cec_opcode2s(i);
+
+		if (!stats.opcode_msgs[i])
+			continue;
+		if (name)
+			printf("\t%-32s: %llu\n", name, stats.opcode_msgs[i]);
+		else
+			printf("\t0x%02x%-28s: %llu\n", i, "", stats.opcode_msgs[i]);
+	}
+
+	printf("\nMessages, NACKs and errors per initiator:\n");
+	for (unsigned i = 0; i < ARRAY_SIZE(stats.init_errors); i++) {
+		if (i < 16 && !stats.init_msgs[i] && !stats.init_errors[i])
+			continue;
+		if (i == 16) {
+			if (stats.init_errors[i])
+				printf("\t%-20s:                         %llu errors\n",
+				       "No message", stats.init_errors[i]);
+			continue;
+		}
+		printf("\t%-20s: %8llu msgs, %8llu NACKs, %llu errors\n",
+		       cec_la2s(i), stats.init_msgs[i], stats.init_nacks[i],
+		       stats.init_errors[i]);
+	}
+
+	printf("\nErrors:\n");
+	for (unsigned i = 0; i < CEC_PIN_NUM_ERRS; i++)
+		printf("\t%-20s: %llu\n", error_names[i], stats.errors[i]);
+
+	printf("\n");
+	show_pin_hist("Start bit low time", stats.start_bit_low);
+	show_pin_hist("Start bit period", stats.start_bit_period);
+	show_pin_hist("Data bit low time", stats.data_bit_low);
+	show_pin_hist("Data bit period", stats.data_bit_period);
+}
@@ -3,12 +3,16 @@
  * Copyright 2016 Cisco Systems, Inc. and/or its affiliates. All rights reserved.
  */
 
+#include <algorithm>
 #include <cerrno>
 #include <ctime>
 #include <string>
 
+#include <sys/epoll.h>
 #include <sys/ioctl.h>
 #include <sys/time.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
 
 #include "cec-follower.h"
 #include "compiler.h"
@@ -854,21 +858,98 @@ static void poll_remote_devs(struct node *node, unsigned me)
 	}
 }
 
+/*
+ * Timers for the time-driven behavior. Each timer is armed with the
+ * absolute time of its next deadline, or disarmed if nothing is pending,
+ * so the main loop only wakes up when there is something to do.
+ */
+enum {
+	TIMER_RC,		/* User Control Pressed safety timeout */
+	TIMER_POLL,		/* next remote device poll */
+	TIMER_PWR_STATE,	/* power state transition step */
+	TIMER_PWR_TOGGLE,	/* --toggle-power-status */
+	NUM_TIMERS
+};
+
+static const clockid_t timer_clock[NUM_TIMERS] = {
+	CLOCK_MONOTONIC,
+	CLOCK_MONOTONIC,
+	/* These follow power_status_changed_time, i.e. time() */
+	CLOCK_REALTIME,
+	CLOCK_REALTIME,
+};
+
+/* Arm the timer for the absolute time ts in ns, or disarm it if ts is 0 */
+static void set_timer(int tfd, __u64 ts)
+{
+	struct itimerspec its = {};
+
+	its.it_value.tv_sec = ts / 1000000000ULL;
+	its.it_value.tv_nsec = ts % 1000000000ULL;
+	timerfd_settime(tfd, TFD_TIMER_ABSTIME, &its, NULL);
+}
+
+/*
+ * Remote devices are polled in the second that matches their logical
+ * address, once they have been silent for more than POLL_PERIOD ms.
+ * Find the earliest time that will happen.
+ */
+static __u64 next_poll_ts(__u64 ts_now, unsigned me, __u64 last_poll_s)
+{
+	__u64 s = ts_now / 1000000000ULL;
+
+	/* Every logical address slot comes by twice in 32 seconds */
+	for (unsigned i = 0; i < 32; i++, s++) {
+		unsigned la = s % 16;
+		__u64 ts;
+
+		if (la == me || la >= 15 || !la_info[la].ts || s == last_poll_s)
+			continue;
+		ts = la_info[la].ts + (POLL_PERIOD + 1) * 1000000ULL;
+		ts = std::max(ts, s * 1000000000ULL);
+		if (ts < (s + 1) * 1000000000ULL)
+			return std::max(ts, ts_now);
+	}
+	return 0;
+}
+
 void testProcessing(struct node *node, bool wallclock)
 {
 	struct cec_log_addrs laddrs;
-	fd_set rd_fds;
-	fd_set ex_fds;
+	struct epoll_event ev_fd = {};
 	int fd = node->fd;
+	int epfd;
+	int tfds[NUM_TIMERS];
 	__u32 mode = CEC_MODE_INITIATOR | CEC_MODE_FOLLOWER;
 	unsigned me;
-	unsigned last_poll_la = 15;
+	__u64 last_poll_s = 0;
 	__u8 last_pwr_state = current_power_state(node);
 	time_t last_pwr_status_toggle = time(NULL);
 
 	clock_gettime(CLOCK_MONOTONIC, &start_monotonic);
 	gettimeofday(&start_timeofday, NULL);
 
+	epfd = epoll_create1(EPOLL_CLOEXEC);
+	if (epfd < 0) {
+		fprintf(stderr, "Failed to create an epoll instance: %s\n", strerror(errno));
+		return;
+	}
+	ev_fd.events = EPOLLIN | EPOLLPRI;
+	ev_fd.data.fd = fd;
+	epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev_fd);
+	for (unsigned i = 0; i < NUM_TIMERS; i++) {
+		struct epoll_event ev_timer = {};
+
+		tfds[i] = timerfd_create(timer_clock[i], TFD_NONBLOCK | TFD_CLOEXEC);
+		if (tfds[i] < 0) {
+			fprintf(stderr, "Failed to create a timer: %s\n", strerror(errno));
+			return;
+		}
+		ev_timer.events = EPOLLIN;
+		ev_timer.data.fd = tfds[i];
+		epoll_ctl(epfd, EPOLL_CTL_ADD, tfds[i], &ev_timer);
+	}
+
 	doioctl(node, CEC_S_MODE, &mode);
 	doioctl(node, CEC_ADAP_G_LOG_ADDRS, &laddrs);
 	me = laddrs.log_addr[0];
@@ -876,19 +957,28 @@ void testProcessing(struct node *node, bool wallclock)
 	poll_remote_devs(node, me);
 
 	while (true) {
+		struct epoll_event evs[1 + NUM_TIMERS];
+		bool has_msg = false;
+		bool has_event = false;
 		int res;
-		struct timeval timeval = {};
 
 		fflush(stdout);
-		timeval.tv_sec = 1;
-		FD_ZERO(&rd_fds);
-		FD_ZERO(&ex_fds);
-		FD_SET(fd, &rd_fds);
-		FD_SET(fd, &ex_fds);
-		res = select(fd + 1, &rd_fds, NULL, &ex_fds, &timeval);
+		res = epoll_wait(epfd, evs, ARRAY_SIZE(evs), -1);
+		if (res < 0 && errno == EINTR)
+			continue;
 		if (res < 0)
 			break;
-		if (FD_ISSET(fd, &ex_fds)) {
+		/*
+		 * All timers are re-armed at the end of the loop, which
+		 * also clears the expiration count of those that fired.
+		 */
+		for (int i = 0; i < res; i++) {
+			if (evs[i].data.fd == fd) {
+				has_msg = evs[i].events & EPOLLIN;
+				has_event = evs[i].events & EPOLLPRI;
+			}
+		}
+		if (has_event) {
 			struct cec_event ev;
 
 			res = doioctl(node, CEC_DQEVENT, &ev);
@@ -897,7 +987,7 @@ void testProcessing(struct node *node, bool wallclock)
 				break;
 			}
 			if (res)
-				continue;
+				goto timers;
 			log_event(ev, wallclock);
 			if (ev.event == CEC_EVENT_STATE_CHANGE) {
 				dev_info("CEC adapter state change.\n");
@@ -913,7 +1003,7 @@ void testProcessing(struct node *node, bool wallclock)
 				memset(la_info, 0, sizeof(la_info));
 			}
 		}
-		if (FD_ISSET(fd, &rd_fds)) {
+		if (has_msg) {
 			struct cec_msg msg = { };
 
 			res = doioctl(node, CEC_RECEIVE, &msg);
@@ -922,16 +1012,16 @@ void testProcessing(struct node *node, bool wallclock)
 				break;
 			}
 			if (res)
-				continue;
+				goto timers;
 
 			__u8 from = cec_msg_initiator(&msg);
 			__u8 to = cec_msg_destination(&msg);
 			__u8 opcode = cec_msg_opcode(&msg);
 
 			if (node->ignore_la[from])
-				continue;
+				goto timers;
 			if (node->ignore_opcode[msg.msg[1]] & (1 << from))
-				continue;
+				goto timers;
 
 			if (from != CEC_LOG_ADDR_UNREGISTERED &&
 			    la_info[from].feature_aborted[opcode].ts &&
@@ -954,6 +1044,7 @@ void testProcessing(struct node *node, bool wallclock)
 				processMsg(node, msg, me);
 		}
 
+timers:
 		__u8 pwr_state = current_power_state(node);
 		if (node->cec_version >= CEC_OP_CEC_VERSION_2_0 &&
 		    last_pwr_state != pwr_state &&
@@ -976,10 +1067,11 @@ void testProcessing(struct node *node, bool wallclock)
 		}
 
 		__u64 ts_now = get_ts();
-		unsigned poll_la = ts_to_s(ts_now) % 16;
+		__u64 poll_s = ts_now / 1000000000ULL;
+		unsigned poll_la = poll_s % 16;
 
 		if (poll_la != me &&
-		    poll_la != last_poll_la && poll_la < 15 && la_info[poll_la].ts &&
+		    poll_s != last_poll_s && poll_la < 15 && la_info[poll_la].ts &&
 		    ts_to_ms(ts_now - la_info[poll_la].ts) > POLL_PERIOD) {
 			struct cec_msg msg = {};
 
@@ -992,7 +1084,7 @@ void testProcessing(struct node *node, bool wallclock)
 				node->remote_phys_addr[poll_la] = CEC_PHYS_ADDR_INVALID;
 			}
 		}
-		last_poll_la = poll_la;
+		last_poll_s = poll_s;
 
 		unsigned ms_since_press = ts_to_ms(ts_now - node->state.rc_press_rx_ts);
 
@@ -1004,7 +1096,28 @@ void testProcessing(struct node *node, bool wallclock)
 				node->state.rc_state = NOPRESS;
 			}
 		}
+
+		if (node->state.rc_state == PRESS || node->state.rc_state == PRESS_HOLD)
+			set_timer(tfds[TIMER_RC], node->state.rc_press_rx_ts +
+				  (FOLLOWER_SAFETY_TIMEOUT + 1) * 1000000ULL);
+		else
+			set_timer(tfds[TIMER_RC], 0);
+		set_timer(tfds[TIMER_POLL], next_poll_ts(get_ts(), me, last_poll_s));
+		/* The reported power state steps once per second while in transition */
+		if (current_power_state(node) != node->state.power_status)
+			set_timer(tfds[TIMER_PWR_STATE], (time(NULL) + 1) * 1000000000ULL);
+		else
+			set_timer(tfds[TIMER_PWR_STATE], 0);
+		if (node->state.toggle_power_status && cec_has_tv(1 << me))
+			set_timer(tfds[TIMER_PWR_TOGGLE],
+				  (last_pwr_status_toggle + node->state.toggle_power_status + 1) *
+				  1000000000ULL);
+		else
+			set_timer(tfds[TIMER_PWR_TOGGLE], 0);
 	}
+	for (int tfd : tfds)
+		close(tfd);
+	close(epfd);
 	mode = CEC_MODE_INITIATOR;
 	doioctl(node, CEC_S_MODE, &mode);
 }
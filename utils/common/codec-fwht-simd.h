@@ -0,0 +1,443 @@
+/* SPDX-License-Identifier: LGPL-2.1+ */
+/*
+ * SSE2 and NEON versions of the 8x8 transform and quantization kernels
+ * of codec-fwht.c. This file is not part of the kernel sources, it is
+ * hooked into codec-fwht.c by codec-fwht.patch.
+ *
+ * The kernels are selected at run time with cpu_select_kernels(), so
+ * V4L_SIMD=c falls back to the scalar code.
+ *
+ * All kernels give bit-exact results compared to the scalar code: the
+ * scalar code stores the result of each transform pass in an s16, and
+ * since only additions and subtractions are done in between, doing all
+ * the arithmetic in wrapping 16 bit lanes gives the same result.
+ */
+
+#ifndef CODEC_FWHT_SIMD_H
+#define CODEC_FWHT_SIMD_H
+
+#include <config.h>
+#include <cpu-features.h>
+
+#if defined(CPU_BUILD_SSE)
+#include <emmintrin.h>
+#define FWHT_HAVE_SIMD
+#define FWHT_SIMD_TARGET __attribute__((target("sse2")))
+#elif defined(CPU_BUILD_NEON) && defined(__aarch64__)
+#include <arm_neon.h>
+#define FWHT_HAVE_SIMD
+#define FWHT_SIMD_TARGET
+#endif
+
+#ifdef FWHT_HAVE_SIMD
+
+/* These must match quant_table[] and quant_table_p[] in codec-fwht.c */
+#define FWHT_SIMD_QUANT_INTRA(Q) \
+	Q(2), Q(2), Q(2), Q(2), Q(2), Q(2), Q(2), Q(2), \
+	Q(2), Q(2), Q(2), Q(2), Q(2), Q(2), Q(2), Q(2), \
+	Q(2), Q(2), Q(2), Q(2), Q(2), Q(2), Q(2), Q(3), \
+	Q(2), Q(2), Q(2), Q(2), Q(2), Q(2), Q(3), Q(6), \
+	Q(2), Q(2), Q(2), Q(2), Q(2), Q(3), Q(6), Q(6), \
+	Q(2), Q(2), Q(2), Q(2), Q(3), Q(6), Q(6), Q(6), \
+	Q(2), Q(2), Q(2), Q(3), Q(6), Q(6), Q(6), Q(6), \
+	Q(2), Q(2), Q(3), Q(6), Q(6), Q(6), Q(6), Q(8)
+
+#define FWHT_SIMD_QUANT_INTER(Q) \
+	Q(3), Q(3), Q(3), Q(3), Q(3), Q(3), Q(3), Q(3), \
+	Q(3), Q(3), Q(3), Q(3), Q(3), Q(3), Q(3), Q(3), \
+	Q(3), Q(3), Q(3), Q(3), Q(3), Q(3), Q(3), Q(3), \
+	Q(3), Q(3), Q(3), Q(3), Q(3), Q(3), Q(3), Q(6), \
+	Q(3), Q(3), Q(3), Q(3), Q(3), Q(3), Q(6), Q(6), \
+	Q(3), Q(3), Q(3), Q(3), Q(3), Q(6), Q(6), Q(9), \
+	Q(3), Q(3), Q(3), Q(3), Q(6), Q(6), Q(9), Q(9), \
+	Q(3), Q(3), Q(3), Q(6), Q(6), Q(9), Q(9), Q(10)
+
+#if defined(CPU_BUILD_SSE)
+
+typedef __m128i fwht_simd_vec;
+
+#define fwht_simd_add(a, b)	_mm_add_epi16(a, b)
+#define fwht_simd_sub(a, b)	_mm_sub_epi16(a, b)
+#define fwht_simd_load(p)	_mm_loadu_si128((const __m128i *)(p))
+#define fwht_simd_store(p, v)	_mm_storeu_si128((__m128i *)(p), v)
+#define fwht_simd_dup(x)	_mm_set1_epi16(x)
+
+FWHT_SIMD_TARGET
+static inline void fwht_simd_transpose(fwht_simd_vec v[8])
+{
+	__m128i t0 = _mm_unpacklo_epi16(v[0], v[1]);
+	__m128i t1 = _mm_unpackhi_epi16(v[0], v[1]);
+	__m128i t2 = _mm_unpacklo_epi16(v[2], v[3]);
+	__m128i t3 = _mm_unpackhi_epi16(v[2], v[3]);
+	__m128i t4 = _mm_unpacklo_epi16(v[4], v[5]);
+	__m128i t5 = _mm_unpackhi_epi16(v[4], v[5]);
+	__m128i t6 = _mm_unpacklo_epi16(v[6], v[7]);
+	__m128i t7 = _mm_unpackhi_epi16(v[6], v[7]);
+	__m128i u0 = _mm_unpacklo_epi32(t0, t2);
+	__m128i u1 = _mm_unpackhi_epi32(t0, t2);
+	__m128i u2 = _mm_unpacklo_epi32(t1, t3);
+	__m128i u3 = _mm_unpackhi_epi32(t1, t3);
+	__m128i u4 = _mm_unpacklo_epi32(t4, t6);
+	__m128i u5 = _mm_unpackhi_epi32(t4, t6);
+	__m128i u6 = _mm_unpacklo_epi32(t5, t7);
+	__m128i u7 = _mm_unpackhi_epi32(t5, t7);
+
+	v[0] = _mm_unpacklo_epi64(u0, u4);
+	v[1] = _mm_unpackhi_epi64(u0, u4);
+	v[2] = _mm_unpacklo_epi64(u1, u5);
+	v[3] = _mm_unpackhi_epi64(u1, u5);
+	v[4] = _mm_unpacklo_epi64(u2, u6);
+	v[5] = _mm_unpackhi_epi64(u2, u6);
+	v[6] = _mm_unpacklo_epi64(u3, u7);
+	v[7] = _mm_unpackhi_epi64(u3, u7);
+}
+
+/* Load 8 consecutive pixels and widen them to 16 bits */
+FWHT_SIMD_TARGET
+static inline fwht_simd_vec fwht_simd_load_u8(const u8 *p)
+{
+	return _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *)p),
+				 _mm_setzero_si128());
+}
+
+/* Arithmetic right and left shift by the quantization table */
+#define Q_SHR(q)	(1 << (16 - (q)))
+#define Q_SHL(q)	(1 << (q))
+static const s16 fwht_simd_quant_shr[2][64] __attribute__((aligned(16))) = {
+	{ FWHT_SIMD_QUANT_INTER(Q_SHR) }, { FWHT_SIMD_QUANT_INTRA(Q_SHR) }
+};
+static const s16 fwht_simd_quant_shl[2][64] __attribute__((aligned(16))) = {
+	{ FWHT_SIMD_QUANT_INTER(Q_SHL) }, { FWHT_SIMD_QUANT_INTRA(Q_SHL) }
+};
+#undef Q_SHR
+#undef Q_SHL
+
+/*
+ * The shifts are done as multiplications: x * 2^(16 - q) >> 16 is the
+ * same as x >> q for q >= 2, which is the smallest shift in the tables.
+ */
+#define fwht_simd_shr(v, intra, i) \
+	_mm_mulhi_epi16(v, fwht_simd_load(fwht_simd_quant_shr[intra] + (i)))
+#define fwht_simd_shl(v, intra, i) \
+	_mm_mullo_epi16(v, fwht_simd_load(fwht_simd_quant_shl[intra] + (i)))
+
+FWHT_SIMD_TARGET
+static inline fwht_simd_vec fwht_simd_outside(fwht_simd_vec v,
+					      fwht_simd_vec qp,
+					      fwht_simd_vec nqp)
+{
+	return _mm_or_si128(_mm_cmpgt_epi16(v, qp), _mm_cmplt_epi16(v, nqp));
+}
+
+#define fwht_simd_and(a, mask)	_mm_and_si128(a, mask)
+#define fwht_simd_srai6(v)	_mm_srai_epi16(v, 6)
+
+#else /* CPU_BUILD_NEON */
+
+typedef int16x8_t fwht_simd_vec;
+
+#define fwht_simd_add(a, b)	vaddq_s16(a, b)
+#define fwht_simd_sub(a, b)	vsubq_s16(a, b)
+#define fwht_simd_load(p)	vld1q_s16(p)
+#define fwht_simd_store(p, v)	vst1q_s16(p, v)
+#define fwht_simd_dup(x)	vdupq_n_s16(x)
+
+FWHT_SIMD_TARGET
+static inline void fwht_simd_transpose(fwht_simd_vec v[8])
+{
+	int16x8x2_t t0 = vtrnq_s16(v[0], v[1]);
+	int16x8x2_t t1 = vtrnq_s16(v[2], v[3]);
+	int16x8x2_t t2 = vtrnq_s16(v[4], v[5]);
+	int16x8x2_t t3 = vtrnq_s16(v[6], v[7]);
+	int32x4x2_t u0 = vtrnq_s32(vreinterpretq_s32_s16(t0.val[0]),
+				   vreinterpretq_s32_s16(t1.val[0]));
+	int32x4x2_t u1 = vtrnq_s32(vreinterpretq_s32_s16(t0.val[1]),
+				   vreinterpretq_s32_s16(t1.val[1]));
+	int32x4x2_t u2 = vtrnq_s32(vreinterpretq_s32_s16(t2.val[0]),
+				   vreinterpretq_s32_s16(t3.val[0]));
+	int32x4x2_t u3 = vtrnq_s32(vreinterpretq_s32_s16(t2.val[1]),
+				   vreinterpretq_s32_s16(t3.val[1]));
+
+#define FWHT_SIMD_COMBINE(half, a, b) \
+	vreinterpretq_s16_s32(vcombine_s32(vget_##half##_s32(a), \
+					   vget_##half##_s32(b)))
+	v[0] = FWHT_SIMD_COMBINE(low, u0.val[0], u2.val[0]);
+	v[1] = FWHT_SIMD_COMBINE(low, u1.val[0], u3.val[0]);
+	v[2] = FWHT_SIMD_COMBINE(low, u0.val[1], u2.val[1]);
+	v[3] = FWHT_SIMD_COMBINE(low, u1.val[1], u3.val[1]);
+	v[4] = FWHT_SIMD_COMBINE(high, u0.val[0], u2.val[0]);
+	v[5] = FWHT_SIMD_COMBINE(high, u1.val[0], u3.val[0]);
+	v[6] = FWHT_SIMD_COMBINE(high, u0.val[1], u2.val[1]);
+	v[7] = FWHT_SIMD_COMBINE(high, u1.val[1], u3.val[1]);
+#undef FWHT_SIMD_COMBINE
+}
+
+FWHT_SIMD_TARGET
+static inline fwht_simd_vec fwht_simd_load_u8(const u8 *p)
+{
+	return vreinterpretq_s16_u16(vmovl_u8(vld1_u8(p)));
+}
+
+#define Q_SHR(q)	(-(q))
+#define Q_SHL(q)	(q)
+static const s16 fwht_simd_quant_shr[2][64] = {
+	{ FWHT_SIMD_QUANT_INTER(Q_SHR) }, { FWHT_SIMD_QUANT_INTRA(Q_SHR) }
+};
+static const s16 fwht_simd_quant_shl[2][64] = {
+	{ FWHT_SIMD_QUANT_INTER(Q_SHL) }, { FWHT_SIMD_QUANT_INTRA(Q_SHL) }
+};
+#undef Q_SHR
+#undef Q_SHL
+
+#define fwht_simd_shr(v, intra, i) \
+	vshlq_s16(v, vld1q_s16(fwht_simd_quant_shr[intra] + (i)))
+#define fwht_simd_shl(v, intra, i) \
+	vshlq_s16(v, vld1q_s16(fwht_simd_quant_shl[intra] + (i)))
+
+FWHT_SIMD_TARGET
+static inline fwht_simd_vec fwht_simd_outside(fwht_simd_vec v,
+					      fwht_simd_vec qp,
+					      fwht_simd_vec nqp)
+{
+	return vreinterpretq_s16_u16(vorrq_u16(vcgtq_s16(v, qp),
+					       vcltq_s16(v, nqp)));
+}
+
+#define fwht_simd_and(a, mask)	vandq_s16(a, mask)
+#define fwht_simd_srai6(v)	vshrq_n_s16(v, 6)
+
+#endif
+
+/* One 8 point transform over the eight vectors, in sequency order */
+FWHT_SIMD_TARGET
+static inline void fwht_simd_butterfly(fwht_simd_vec v[8])
+{
+	fwht_simd_vec a0 = fwht_simd_add(v[0], v[1]);
+	fwht_simd_vec a1 = fwht_simd_sub(v[0], v[1]);
+	fwht_simd_vec a2 = fwht_simd_add(v[2], v[3]);
+	fwht_simd_vec a3 = fwht_simd_sub(v[2], v[3]);
+	fwht_simd_vec a4 = fwht_simd_add(v[4], v[5]);
+	fwht_simd_vec a5 = fwht_simd_sub(v[4], v[5]);
+	fwht_simd_vec a6 = fwht_simd_add(v[6], v[7]);
+	fwht_simd_vec a7 = fwht_simd_sub(v[6], v[7]);
+	fwht_simd_vec b0 = fwht_simd_add(a0, a2);
+	fwht_simd_vec b1 = fwht_simd_sub(a0, a2);
+	fwht_simd_vec b2 = fwht_simd_sub(a1, a3);
+	fwht_simd_vec b3 = fwht_simd_add(a1, a3);
+	fwht_simd_vec b4 = fwht_simd_add(a4, a6);
+	fwht_simd_vec b5 = fwht_simd_sub(a4, a6);
+	fwht_simd_vec b6 = fwht_simd_sub(a5, a7);
+	fwht_simd_vec b7 = fwht_simd_add(a5, a7);
+
+	v[0] = fwht_simd_add(b0, b4);
+	v[1] = fwht_simd_sub(b0, b4);
+	v[2] = fwht_simd_sub(b1, b5);
+	v[3] = fwht_simd_add(b1, b5);
+	v[4] = fwht_simd_add(b2, b6);
+	v[5] = fwht_simd_sub(b2, b6);
+	v[6] = fwht_simd_sub(b3, b7);
+	v[7] = fwht_simd_add(b3, b7);
+}
+
+/* Rows first, then the columns, just like the scalar code */
+FWHT_SIMD_TARGET
+static inline void fwht_simd_transform(fwht_simd_vec v[8])
+{
+	fwht_simd_transpose(v);
+	fwht_simd_butterfly(v);
+	fwht_simd_transpose(v);
+	fwht_simd_butterfly(v);
+}
+
+/*
+ * The intra offset of 256 that the scalar code subtracts from each
+ * even first stage value is the same as subtracting 128 from each pixel.
+ */
+FWHT_SIMD_TARGET
+static void fwht_simd_fwht(const u8 *block, s16 *output_block,
+			   unsigned int stride, unsigned int input_step,
+			   bool intra)
+{
+	fwht_simd_vec v[8];
+	fwht_simd_vec add = fwht_simd_dup(intra ? 128 : 0);
+	s16 row[8];
+	unsigned int i, j;
+
+	for (i = 0; i < 8; i++, block += stride) {
+		if (input_step == 1) {
+			v[i] = fwht_simd_load_u8(block);
+		} else {
+			/* Only read the bytes the scalar code reads */
+			for (j = 0; j < 8; j++)
+				row[j] = block[j * input_step];
+			v[i] = fwht_simd_load(row);
+		}
+		v[i] = fwht_simd_sub(v[i], add);
+	}
+	fwht_simd_transform(v);
+	for (i = 0; i < 8; i++)
+		fwht_simd_store(output_block + 8 * i, v[i]);
+}
+
+FWHT_SIMD_TARGET
+static void fwht_simd_fwht16(const s16 *block, s16 *output_block,
+			     int stride)
+{
+	fwht_simd_vec v[8];
+	unsigned int i;
+
+	for (i = 0; i < 8; i++, block += stride)
+		v[i] = fwht_simd_load(block);
+	fwht_simd_transform(v);
+	for (i = 0; i < 8; i++)
+		fwht_simd_store(output_block + 8 * i, v[i]);
+}
+
+FWHT_SIMD_TARGET
+static void fwht_simd_ifwht(const s16 *block, s16 *output_block,
+			    int intra)
+{
+	fwht_simd_vec v[8];
+	fwht_simd_vec add = fwht_simd_dup(intra ? 128 : 0);
+	unsigned int i;
+
+	for (i = 0; i < 8; i++)
+		v[i] = fwht_simd_load(block + 8 * i);
+	fwht_simd_transform(v);
+	for (i = 0; i < 8; i++)
+		fwht_simd_store(output_block + 8 * i,
+				fwht_simd_add(fwht_simd_srai6(v[i]), add));
+}
+
+FWHT_SIMD_TARGET
+static void fwht_simd_quantize(s16 *coeff, s16 *de_coeff, u16 qp,
+			       bool intra)
+{
+	/*
+	 * After the shift all coefficients are within +/- 2^13, so
+	 * clamping qp to the s16 range doesn't change the result.
+	 */
+	fwht_simd_vec vqp = fwht_simd_dup(qp > 0x7fff ? 0x7fff : qp);
+	fwht_simd_vec nqp = fwht_simd_sub(fwht_simd_dup(0), vqp);
+	unsigned int i;
+
+	for (i = 0; i < 64; i += 8) {
+		fwht_simd_vec v = fwht_simd_shr(fwht_simd_load(coeff + i),
+						intra, i);
+		fwht_simd_vec keep = fwht_simd_outside(v, vqp, nqp);
+
+		v = fwht_simd_and(v, keep);
+		fwht_simd_store(coeff + i, v);
+		fwht_simd_store(de_coeff + i, fwht_simd_shl(v, intra, i));
+	}
+}
+
+FWHT_SIMD_TARGET
+static void fwht_simd_dequantize(s16 *coeff, bool intra)
+{
+	unsigned int i;
+
+	for (i = 0; i < 64; i += 8)
+		fwht_simd_store(coeff + i,
+				fwht_simd_shl(fwht_simd_load(coeff + i),
+					      intra, i));
+}
+
+struct fwht_simd_kernels {
+	void (*fwht)(const u8 *block, s16 *output_block, unsigned int stride,
+		     unsigned int input_step, bool intra);
+	void (*fwht16)(const s16 *block, s16 *output_block, int stride);
+	void (*ifwht)(const s16 *block, s16 *output_block, int intra);
+	void (*quantize)(s16 *coeff, s16 *de_coeff, u16 qp, bool intra);
+	void (*dequantize)(s16 *coeff, bool intra);
+};
+
+static const struct fwht_simd_kernels fwht_simd_vec_kernels = {
+	.fwht = fwht_simd_fwht,
+	.fwht16 = fwht_simd_fwht16,
+	.ifwht = fwht_simd_ifwht,
+	.quantize = fwht_simd_quantize,
+	.dequantize = fwht_simd_dequantize,
+};
+
+/* No kernels: the scalar code in codec-fwht.c is used */
+static const struct fwht_simd_kernels fwht_simd_c_kernels;
+
+static const struct cpu_kernel_variant fwht_simd_variants[] = {
+#if defined(CPU_BUILD_SSE)
+	{ "sse2", CPU_FEATURE_SSE2, &fwht_simd_vec_kernels },
+#else
+	{ "neon", CPU_FEATURE_NEON, &fwht_simd_vec_kernels },
+#endif
+	{ "c", 0, &fwht_simd_c_kernels },
+};
+
+static inline const struct fwht_simd_kernels *fwht_simd_get_kernels(void)
+{
+	static const void *kernels;
+
+	return cpu_select_kernels_cached(&kernels, fwht_simd_variants);
+}
+
+/*
+ * The hooks in codec-fwht.c: these return false if the scalar code has
+ * to do the work.
+ */
+static inline bool fwht_simd(const u8 *block, s16 *output_block,
+			     unsigned int stride, unsigned int input_step,
+			     bool intra)
+{
+	const struct fwht_simd_kernels *k = fwht_simd_get_kernels();
+
+	if (!k->fwht)
+		return false;
+	k->fwht(block, output_block, stride, input_step, intra);
+	return true;
+}
+
+static inline bool fwht16_simd(const s16 *block, s16 *output_block,
+			       int stride)
+{
+	const struct fwht_simd_kernels *k = fwht_simd_get_kernels();
+
+	if (!k->fwht16)
+		return false;
+	k->fwht16(block, output_block, stride);
+	return true;
+}
+
+static inline bool ifwht_simd(const s16 *block, s16 *output_block,
+			      int intra)
+{
+	const struct fwht_simd_kernels *k = fwht_simd_get_kernels();
+
+	if (!k->ifwht)
+		return false;
+	k->ifwht(block, output_block, intra);
+	return true;
+}
+
+static inline bool quantize_simd(s16 *coeff, s16 *de_coeff, u16 qp,
+				 bool intra)
+{
+	const struct fwht_simd_kernels *k = fwht_simd_get_kernels();
+
+	if (!k->quantize)
+		return false;
+	k->quantize(coeff, de_coeff, qp, intra);
+	return true;
+}
+
+static inline bool dequantize_simd(s16 *coeff, bool intra)
+{
+	const struct fwht_simd_kernels *k = fwht_simd_get_kernels();
+
+	if (!k->dequantize)
+		return false;
+	k->dequantize(coeff, intra);
+	return true;
+}
+
+#endif /* FWHT_HAVE_SIMD */
+
+#endif
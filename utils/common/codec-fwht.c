@@ -12,6 +12,7 @@
 #include <linux/string.h>
 #include <linux/kernel.h>
 #include "codec-fwht.h"
+#include "codec-fwht-simd.h"
 
 #define OVERFLOW_BIT BIT(14)
 
@@ -25,6 +26,8 @@
 
 #define PBLOCK 0
 #define IBLOCK 1
+/* A P-block of which all coefficients are quantized to zero */
+#define SKIPBLOCK 2
 
 #define ALL_ZEROS 15
 
@@ -197,6 +200,11 @@ static void quantize_intra(s16 *coeff, s16 *de_coeff, u16 qp)
 	const int *quant = quant_table;
 	int i, j;
 
+#ifdef FWHT_HAVE_SIMD
+	if (quantize_simd(coeff, de_coeff, qp, true))
+		return;
+#endif
+
 	for (j = 0; j < 8; j++) {
 		for (i = 0; i < 8; i++, quant++, coeff++, de_coeff++) {
 			*coeff >>= *quant;
@@ -213,6 +221,11 @@ static void dequantize_intra(s16 *coeff)
 	const int *quant = quant_table;
 	int i, j;
 
+#ifdef FWHT_HAVE_SIMD
+	if (dequantize_simd(coeff, true))
+		return;
+#endif
+
 	for (j = 0; j < 8; j++)
 		for (i = 0; i < 8; i++, quant++, coeff++)
 			*coeff <<= *quant;
@@ -223,6 +236,11 @@ static void quantize_inter(s16 *coeff, s16 *de_coeff, u16 qp)
 	const int *quant = quant_table_p;
 	int i, j;
 
+#ifdef FWHT_HAVE_SIMD
+	if (quantize_simd(coeff, de_coeff, qp, false))
+		return;
+#endif
+
 	for (j = 0; j < 8; j++) {
 		for (i = 0; i < 8; i++, quant++, coeff++, de_coeff++) {
 			*coeff >>= *quant;
@@ -239,6 +257,11 @@ static void dequantize_inter(s16 *coeff)
 	const int *quant = quant_table_p;
 	int i, j;
 
+#ifdef FWHT_HAVE_SIMD
+	if (dequantize_simd(coeff, false))
+		return;
+#endif
+
 	for (j = 0; j < 8; j++)
 		for (i = 0; i < 8; i++, quant++, coeff++)
 			*coeff <<= *quant;
@@ -255,6 +278,11 @@ static void noinline_for_stack fwht(const u8 *block, s16 *output_block,
 	int add = intra ? 256 : 0;
 	unsigned int i;
 
+#ifdef FWHT_HAVE_SIMD
+	if (fwht_simd(block, output_block, stride, input_step, intra))
+		return;
+#endif
+
 	/* stage 1 */
 	for (i = 0; i < 8; i++, tmp += stride, out += 8) {
 		switch (input_step) {
@@ -387,6 +415,11 @@ fwht16(const s16 *block, s16 *output_block, int stride, int intra)
 	s16 *out = output_block;
 	int i;
 
+#ifdef FWHT_HAVE_SIMD
+	if (fwht16_simd(block, output_block, stride))
+		return;
+#endif
+
 	for (i = 0; i < 8; i++, tmp += stride, out += 8) {
 		/* stage 1 */
 		workspace1[0]  = tmp[0] + tmp[1];
@@ -475,6 +508,11 @@ ifwht(const s16 *block, s16 *output_block, int intra)
 	s16 *out = output_block;
 	int i;
 
+#ifdef FWHT_HAVE_SIMD
+	if (ifwht_simd(block, output_block, intra))
+		return;
+#endif
+
 	for (i = 0; i < 8; i++, tmp += 8, out += 8) {
 		/* stage 1 */
 		workspace1[0]  = tmp[0] + tmp[1];
@@ -611,9 +649,17 @@ static int var_inter(const s16 *old, const s16 *new)
 	return ret;
 }
 
+/*
+ * No coefficient of a P-block can be larger than the sum of the absolute
+ * deltas, and quant_table_p shifts them right by at least 3. So if that sum
+ * is at most 8 * qp all coefficients are quantized to zero, and the block
+ * can be skipped without changing the result. FWHT_SPEED_FASTEST skips
+ * blocks up to twice that sum.
+ */
 static noinline_for_stack int
 decide_blocktype(const u8 *cur, const u8 *reference, s16 *deltablock,
-		 unsigned int stride, unsigned int input_step)
+		 unsigned int stride, unsigned int input_step,
+		 u16 qp, unsigned int speed)
 {
 	s16 tmp[64];
 	s16 old[64];
@@ -621,10 +667,19 @@ decide_blocktype(const u8 *cur, const u8 *reference, s16 *deltablock,
 	unsigned int k, l;
 	int vari;
 	int vard;
+	bool skip;
 
 	fill_encoder_block(cur, tmp, stride, input_step);
 	fill_encoder_block(reference, old, 8, 1);
+	vard = var_inter(old, tmp);
+	skip = vard <= (speed >= FWHT_SPEED_FASTEST ? 16 : 8) * qp;
+	if (skip && speed >= FWHT_SPEED_FAST)
+		return SKIPBLOCK;
 	vari = var_intra(tmp);
+	if (vari <= vard)
+		return IBLOCK;
+	if (skip)
+		return SKIPBLOCK;
 
 	for (k = 0; k < 8; k++) {
 		for (l = 0; l < 8; l++) {
@@ -634,9 +689,7 @@ decide_blocktype(const u8 *cur, const u8 *reference, s16 *deltablock,
 			reference++;
 		}
 	}
-	deltablock -= 64;
-	vard = var_inter(old, tmp);
-	return vari <= vard ? IBLOCK : PBLOCK;
+	return PBLOCK;
 }
 
 static void fill_decoder_block(u8 *dst, const s16 *input, int stride,
@@ -705,8 +758,17 @@ static u32 encode_plane(u8 *input, u8 *refp, __be16 **rlco, __be16 *rlco_max,
 
 			if (!is_intra)
 				blocktype = decide_blocktype(input, refp,
-					deltablock, stride, input_step);
-			if (blocktype == IBLOCK) {
+					deltablock, stride, input_step,
+					cf->p_frame_qp, cf->speed);
+			if (blocktype == SKIPBLOCK) {
+				/*
+				 * Transforming and quantizing the zero deltas
+				 * gives zero coefficients, and decoding them
+				 * leaves the reference block as it is.
+				 */
+				encoding |= FWHT_FRAME_PCODED;
+				memset(cf->coeffs, 0, sizeof(cf->coeffs));
+			} else if (blocktype == IBLOCK) {
 				fwht(input, cf->coeffs, stride, input_step, 1);
 				quantize_intra(cf->coeffs, cf->de_coeffs,
 					       cf->i_frame_qp);
@@ -717,7 +779,7 @@ static u32 encode_plane(u8 *input, u8 *refp, __be16 **rlco, __be16 *rlco_max,
 				quantize_inter(cf->coeffs, cf->de_coeffs,
 					       cf->p_frame_qp);
 			}
-			if (!next_is_intra) {
+			if (!next_is_intra && blocktype != SKIPBLOCK) {
 				ifwht(cf->de_coeffs, cf->de_fwht, blocktype);
 
 				if (blocktype == PBLOCK)
@@ -728,6 +790,8 @@ static u32 encode_plane(u8 *input, u8 *refp, __be16 **rlco, __be16 *rlco_max,
 			input += 8 * input_step;
 			refp += 8 * 8;
 
+			if (blocktype == SKIPBLOCK)
+				blocktype = PBLOCK;
 			size = rlc(cf->coeffs, *rlco, blocktype);
 			if (last_size == size &&
 			    !memcmp(*rlco + 1, *rlco - size + 1, 2 * size - 2)) {
@@ -852,7 +916,14 @@ static bool decode_plane(struct fwht_cframe *cf, const __be16 **rlco,
 		if (end_of_rlco_buf + 1 < *rlco + width * height / 2)
 			return false;
 		for (i = 0; i < height; i++) {
-			memcpy(dst, *rlco, width);
+			const u8 *src = (const u8 *)*rlco;
+
+			/* Don't overwrite the other components of packed formats */
+			if (dst_step == 1)
+				memcpy(dst, src, width);
+			else
+				for (j = 0; j < width; j++)
+					dst[j * dst_step] = src[j];
 			dst += dst_stride;
 			*rlco += width / 2;
 		}
@@ -906,6 +977,170 @@ static bool decode_plane(struct fwht_cframe *cf, const __be16 **rlco,
 	return true;
 }
 
+/*
+ * With FWHT_FL_SLICES each slice is decoded by its own decode_plane() call
+ * over its block rows, starting at its offset in the slice table.
+ */
+static const __be32 *slice_table(const struct fwht_cframe *cf,
+				 u32 *rows, u32 *num_slices)
+{
+	const __be32 *table = (const __be32 *)cf->rlc_data;
+
+	if (cf->size < 2 * sizeof(*table))
+		return NULL;
+	*rows = ntohl(table[0]);
+	*num_slices = ntohl(table[1]);
+	if (!*rows || !*num_slices ||
+	    *num_slices > cf->size / sizeof(*table) - 2)
+		return NULL;
+	return table + 2;
+}
+
+static unsigned int slice_plane_rows(unsigned int plane, u32 hdr_flags,
+				     unsigned int height)
+{
+	if ((plane == 1 || plane == 2) &&
+	    !(hdr_flags & FWHT_FL_CHROMA_FULL_HEIGHT))
+		height /= 2;
+	return round_up(height, 8) / 8;
+}
+
+/*
+ * Returns the number of slices of a frame with FWHT_FL_SLICES set, or 0
+ * if the slice table doesn't match the frame.
+ */
+unsigned int fwht_decode_num_slices(const struct fwht_cframe *cf, u32 hdr_flags,
+				    unsigned int components_num,
+				    unsigned int height)
+{
+	unsigned int planes = components_num >= 3 ? components_num : 1;
+	unsigned int num = 0;
+	u32 rows, num_slices;
+	unsigned int i;
+
+	if (!slice_table(cf, &rows, &num_slices))
+		return 0;
+	for (i = 0; i < planes; i++)
+		num += (slice_plane_rows(i, hdr_flags, height) + rows - 1) / rows;
+	return num == num_slices ? num : 0;
+}
+
+static const u32 plane_uncompressed[4] = {
+	FWHT_FL_LUMA_IS_UNCOMPRESSED,
+	FWHT_FL_CB_IS_UNCOMPRESSED,
+	FWHT_FL_CR_IS_UNCOMPRESSED,
+	FWHT_FL_ALPHA_IS_UNCOMPRESSED,
+};
+
+/*
+ * Find slice idx of a frame with FWHT_FL_SLICES set: the plane it is part
+ * of, the block rows of the plane it covers and its data.
+ */
+static bool find_slice(const struct fwht_cframe *cf, unsigned int idx,
+		       u32 hdr_flags, unsigned int components_num,
+		       unsigned int height, unsigned int *plane,
+		       unsigned int *first_row, unsigned int *num_rows,
+		       const __be16 **rlco, const __be16 **end_of_rlco)
+{
+	unsigned int planes = components_num >= 3 ? components_num : 1;
+	unsigned int slice = idx;
+	unsigned int block_rows = 0;
+	const __be32 *table;
+	const __be16 *data;
+	u32 rows, num_slices, data_size, start, end;
+
+	table = slice_table(cf, &rows, &num_slices);
+	if (!table || idx >= num_slices)
+		return false;
+	data = (const __be16 *)(table + num_slices);
+	data_size = cf->size - ((const u8 *)data - (const u8 *)cf->rlc_data);
+	start = ntohl(table[idx]);
+	end = idx + 1 < num_slices ? ntohl(table[idx + 1]) : data_size;
+	if ((start & 1) || start > end || end > data_size)
+		return false;
+
+	for (*plane = 0; *plane < planes; (*plane)++) {
+		unsigned int n;
+
+		block_rows = slice_plane_rows(*plane, hdr_flags, height);
+		n = (block_rows + rows - 1) / rows;
+		if (slice < n)
+			break;
+		slice -= n;
+	}
+	if (*plane == planes)
+		return false;
+
+	*first_row = slice * rows;
+	*num_rows = block_rows - *first_row < rows ?
+		    block_rows - *first_row : rows;
+	*rlco = data + start / 2;
+	*end_of_rlco = data + end / 2 - 1;
+	return true;
+}
+
+/*
+ * Decode slice idx of a frame with FWHT_FL_SLICES set. The slices of a
+ * frame can be decoded concurrently as long as each call gets its own
+ * copy of cf, since its coefficient buffers are used as scratch space.
+ */
+bool fwht_decode_slice(struct fwht_cframe *cf, unsigned int idx, u32 hdr_flags,
+		       unsigned int components_num, unsigned int width,
+		       unsigned int height, const struct fwht_raw_frame *ref,
+		       unsigned int ref_stride, unsigned int ref_chroma_stride,
+		       struct fwht_raw_frame *dst, unsigned int dst_stride,
+		       unsigned int dst_chroma_stride)
+{
+	unsigned int plane, first_row, num_rows;
+	unsigned int r_stride, r_step, d_stride, d_step;
+	const u8 *refp;
+	u8 *dstp;
+	const __be16 *rlco, *end;
+
+	if (!find_slice(cf, idx, hdr_flags, components_num, height, &plane,
+			&first_row, &num_rows, &rlco, &end))
+		return false;
+
+	switch (plane) {
+	case 0:
+		refp = ref->luma;
+		dstp = dst->luma;
+		break;
+	case 1:
+		refp = ref->cb;
+		dstp = dst->cb;
+		break;
+	case 2:
+		refp = ref->cr;
+		dstp = dst->cr;
+		break;
+	default:
+		refp = ref->alpha;
+		dstp = dst->alpha;
+		break;
+	}
+	if (plane == 1 || plane == 2) {
+		if (!(hdr_flags & FWHT_FL_CHROMA_FULL_WIDTH))
+			width /= 2;
+		r_stride = ref_chroma_stride;
+		r_step = ref->chroma_step;
+		d_stride = dst_chroma_stride;
+		d_step = dst->chroma_step;
+	} else {
+		r_stride = ref_stride;
+		r_step = ref->luma_alpha_step;
+		d_stride = dst_stride;
+		d_step = dst->luma_alpha_step;
+	}
+
+	if (refp)
+		refp += first_row * 8 * r_stride;
+	dstp += first_row * 8 * d_stride;
+	return decode_plane(cf, &rlco, num_rows * 8, width, refp, r_stride,
+			    r_step, dstp, d_stride, d_step,
+			    hdr_flags & plane_uncompressed[plane], end);
+}
+
 bool fwht_decode_frame(struct fwht_cframe *cf, u32 hdr_flags,
 		       unsigned int components_num, unsigned int width,
 		       unsigned int height, const struct fwht_raw_frame *ref,
@@ -917,6 +1152,22 @@ bool fwht_decode_frame(struct fwht_cframe *cf, u32 hdr_flags,
 	const __be16 *end_of_rlco_buf = cf->rlc_data +
 			(cf->size / sizeof(*rlco)) - 1;
 
+	if (hdr_flags & FWHT_FL_SLICES) {
+		unsigned int i, num;
+
+		num = fwht_decode_num_slices(cf, hdr_flags, components_num,
+					     height);
+		if (!num)
+			return false;
+		for (i = 0; i < num; i++)
+			if (!fwht_decode_slice(cf, i, hdr_flags, components_num,
+					       width, height, ref, ref_stride,
+					       ref_chroma_stride, dst, dst_stride,
+					       dst_chroma_stride))
+				return false;
+		return true;
+	}
+
 	if (!decode_plane(cf, &rlco, height, width, ref->luma, ref_stride,
 			  ref->luma_alpha_step, dst->luma, dst_stride,
 			  dst->luma_alpha_step,
@@ -956,3 +1207,142 @@ bool fwht_decode_frame(struct fwht_cframe *cf, u32 hdr_flags,
 			return false;
 	return true;
 }
+
+/*
+ * Like decode_plane(), but store the dequantized coefficients of the
+ * blocks of rows first_row to first_row + height / 8 instead of
+ * transforming them.
+ */
+static bool decode_plane_coeffs(struct fwht_cframe *cf, const __be16 **rlco,
+				u32 first_row, u32 height, u32 width,
+				struct fwht_coeff_plane *plane,
+				bool uncompressed, const __be16 *end_of_rlco_buf)
+{
+	unsigned int copies = 0;
+	s16 copy[8 * 8];
+	u8 copy_type = FWHT_BLOCK_INTRA;
+	u16 stat;
+	unsigned int i, j, k;
+	s16 *coeffs = plane->coeffs + first_row * 8 * plane->stride;
+	u8 *blocks = plane->blocks + first_row * (plane->stride / 8);
+
+	width = round_up(width, 8);
+	height = round_up(height, 8);
+
+	if (uncompressed) {
+		if (end_of_rlco_buf + 1 < *rlco + width * height / 2)
+			return false;
+		for (j = 0; j < height; j++) {
+			const u8 *src = (const u8 *)*rlco;
+
+			for (i = 0; i < width; i++)
+				coeffs[i] = src[i];
+			coeffs += plane->stride;
+			*rlco += width / 2;
+		}
+		for (j = 0; j < height / 8; j++)
+			memset(blocks + j * (plane->stride / 8), FWHT_BLOCK_RAW,
+			       width / 8);
+		return true;
+	}
+
+	for (j = 0; j < height / 8; j++) {
+		for (i = 0; i < width / 8; i++) {
+			s16 *c = coeffs + j * 8 * plane->stride + i * 8;
+			const s16 *block = copy;
+			u8 type;
+
+			if (copies) {
+				type = copy_type;
+				copies--;
+			} else {
+				stat = derlc(rlco, cf->coeffs, end_of_rlco_buf);
+				if (stat & OVERFLOW_BIT)
+					return false;
+				if (stat & PFRAME_BIT) {
+					dequantize_inter(cf->coeffs);
+					type = FWHT_BLOCK_INTER;
+				} else {
+					dequantize_intra(cf->coeffs);
+					type = FWHT_BLOCK_INTRA;
+				}
+				copies = (stat & DUPS_MASK) >> 1;
+				if (copies) {
+					memcpy(copy, cf->coeffs, sizeof(copy));
+					copy_type = type;
+				}
+				block = cf->coeffs;
+			}
+			for (k = 0; k < 8; k++)
+				memcpy(c + k * plane->stride, block + k * 8,
+				       8 * sizeof(*c));
+			blocks[j * (plane->stride / 8) + i] = type;
+		}
+	}
+	return true;
+}
+
+/*
+ * Entropy decode a frame into the coefficient planes, so the inverse
+ * transform can be done elsewhere. On top of what fwht_decode_frame()
+ * does, the caller does for each block of type FWHT_BLOCK_INTRA or
+ * FWHT_BLOCK_INTER: ifwht() with intra set for FWHT_BLOCK_INTRA, which
+ * truncates the row and the column sums to s16 and shifts the latter right
+ * by 6, then adds 128 or the reference pixel and clamps to 0-255.
+ */
+bool fwht_decode_frame_coeffs(struct fwht_cframe *cf, u32 hdr_flags,
+			      unsigned int components_num, unsigned int width,
+			      unsigned int height,
+			      struct fwht_coeff_plane *planes)
+{
+	unsigned int num = components_num >= 3 ? components_num : 1;
+	const __be16 *rlco = cf->rlc_data;
+	const __be16 *end_of_rlco_buf = cf->rlc_data +
+			(cf->size / sizeof(*rlco)) - 1;
+	unsigned int plane, first_row, num_rows;
+	const __be16 *end;
+	unsigned int i;
+
+	if (hdr_flags & FWHT_FL_SLICES) {
+		unsigned int slices;
+
+		slices = fwht_decode_num_slices(cf, hdr_flags, components_num,
+						height);
+		if (!slices)
+			return false;
+		for (i = 0; i < slices; i++) {
+			unsigned int w = width;
+
+			if (!find_slice(cf, i, hdr_flags, components_num,
+					height, &plane, &first_row, &num_rows,
+					&rlco, &end))
+				return false;
+			if ((plane == 1 || plane == 2) &&
+			    !(hdr_flags & FWHT_FL_CHROMA_FULL_WIDTH))
+				w /= 2;
+			if (!decode_plane_coeffs(cf, &rlco, first_row,
+						 num_rows * 8, w, &planes[plane],
+						 hdr_flags & plane_uncompressed[plane],
+						 end))
+				return false;
+		}
+		return true;
+	}
+
+	for (plane = 0; plane < num; plane++) {
+		u32 h = height;
+		u32 w = width;
+
+		if (plane == 1 || plane == 2) {
+			if (!(hdr_flags & FWHT_FL_CHROMA_FULL_HEIGHT))
+				h /= 2;
+			if (!(hdr_flags & FWHT_FL_CHROMA_FULL_WIDTH))
+				w /= 2;
+		}
+		if (!decode_plane_coeffs(cf, &rlco, 0, h, w, &planes[plane],
+					 hdr_flags & plane_uncompressed[plane],
+					 end_of_rlco_buf))
+			return false;
+	}
+	return true;
+}
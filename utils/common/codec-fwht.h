@@ -97,6 +97,19 @@ typedef __u8 u8;
 #define FWHT_FL_CHROMA_FULL_WIDTH	BIT(8)
 #define FWHT_FL_ALPHA_IS_UNCOMPRESSED	BIT(9)
 #define FWHT_FL_I_FRAME			BIT(10)
+/*
+ * Set if the planes are split in slices of block rows that can be decoded
+ * independently. The compressed data then starts with a slice table:
+ *
+ * __be32 rows;		// block rows per slice, the same for all planes
+ * __be32 num_slices;	// total number of slices of all planes
+ * __be32 offset[num_slices];
+ *
+ * Only the last slice of each plane can have less block rows. The slices
+ * follow the plane order, and offset is the start of the slice data relative
+ * to the end of the table. Uncompressed planes are split in slices as well.
+ */
+#define FWHT_FL_SLICES			BIT(11)
 
 /* A 4-values flag - the number of components - 1 */
 #define FWHT_FL_COMPONENTS_NUM_MSK	GENMASK(18, 16)
@@ -128,9 +141,21 @@ struct fwht_cframe_hdr {
 	__be32 size;
 };
 
+/*
+ * Encoder speed presets. FWHT_SPEED_DEFAULT gives the same compressed data
+ * as always, it just avoids the transforms for the P-blocks that would be
+ * quantized to zero. FWHT_SPEED_FAST always skips those blocks without
+ * checking if intra coding them is better, and FWHT_SPEED_FASTEST also
+ * skips blocks that differ a bit more from the reference frame.
+ */
+#define FWHT_SPEED_DEFAULT	0
+#define FWHT_SPEED_FAST		1
+#define FWHT_SPEED_FASTEST	2
+
 struct fwht_cframe {
 	u16 i_frame_qp;
 	u16 p_frame_qp;
+	u16 speed;
 	__be16 *rlc_data;
 	s16 coeffs[8 * 8];
 	s16 de_coeffs[8 * 8];
@@ -148,6 +173,29 @@ struct fwht_raw_frame {
 	u8 *luma, *cb, *cr, *alpha;
 };
 
+/*
+ * The dequantized coefficients of a plane, see fwht_decode_frame_coeffs().
+ * Coefficient (i, j) of the block at block column x and block row y is at
+ * coeffs[(y * 8 + i) * stride + x * 8 + j], so the coefficients are laid
+ * out like the pixels of the plane. blocks has the FWHT_BLOCK_* type of
+ * each block, stride / 8 per block row. The stride and the number of rows
+ * are the width and the height of the plane rounded up to 8.
+ */
+struct fwht_coeff_plane {
+	s16 *coeffs;
+	u8 *blocks;
+	unsigned int stride;
+	unsigned int width;
+	unsigned int height;
+};
+
+/* The inverse transform plus 128 */
+#define FWHT_BLOCK_INTRA	0
+/* The inverse transform plus the reference frame */
+#define FWHT_BLOCK_INTER	1
+/* The coefficients are the pixel values, for uncompressed planes */
+#define FWHT_BLOCK_RAW		2
+
 #define FWHT_FRAME_PCODED	BIT(0)
 #define FWHT_FRAME_UNENCODED	BIT(1)
 #define FWHT_LUMA_UNENCODED	BIT(2)
@@ -167,4 +215,17 @@ bool fwht_decode_frame(struct fwht_cframe *cf, u32 hdr_flags,
 		unsigned int ref_stride, unsigned int ref_chroma_stride,
 		struct fwht_raw_frame *dst, unsigned int dst_stride,
 		unsigned int dst_chroma_stride);
+unsigned int fwht_decode_num_slices(const struct fwht_cframe *cf, u32 hdr_flags,
+				    unsigned int components_num,
+				    unsigned int height);
+bool fwht_decode_slice(struct fwht_cframe *cf, unsigned int idx, u32 hdr_flags,
+		       unsigned int components_num, unsigned int width,
+		       unsigned int height, const struct fwht_raw_frame *ref,
+		       unsigned int ref_stride, unsigned int ref_chroma_stride,
+		       struct fwht_raw_frame *dst, unsigned int dst_stride,
+		       unsigned int dst_chroma_stride);
+bool fwht_decode_frame_coeffs(struct fwht_cframe *cf, u32 hdr_flags,
+			      unsigned int components_num, unsigned int width,
+			      unsigned int height,
+			      struct fwht_coeff_plane *planes);
 #endif
@@ -91,7 +91,7 @@ const struct v4l2_fwht_pixfmt_info *v4l2_fwht_get_pixfmt(u32 idx)
 	return v4l2_fwht_pixfmts + idx;
 }
 
-static int prepare_raw_frame(struct fwht_raw_frame *rf,
+int prepare_raw_frame(struct fwht_raw_frame *rf,
 			 const struct v4l2_fwht_pixfmt_info *info, u8 *buf,
 			 unsigned int size)
 {
@@ -235,6 +235,7 @@ int v4l2_fwht_encode(struct v4l2_fwht_state *state, u8 *p_in, u8 *p_out)
 
 	cf.i_frame_qp = state->i_frame_qp;
 	cf.p_frame_qp = state->p_frame_qp;
+	cf.speed = state->speed;
 	cf.rlc_data = (__be16 *)(p_out + sizeof(*p_hdr));
 
 	encoding = fwht_encode_frame(&rf, &state->ref_frame, &cf,
@@ -279,19 +280,19 @@ int v4l2_fwht_encode(struct v4l2_fwht_state *state, u8 *p_in, u8 *p_out)
 	return cf.size + sizeof(*p_hdr);
 }
 
-int v4l2_fwht_decode(struct v4l2_fwht_state *state, u8 *p_in, u8 *p_out)
+/*
+ * Check the header of the frame to decode against the state, on success
+ * cf is set up for decoding the frame at p_in
+ */
+static int v4l2_fwht_check_header(struct v4l2_fwht_state *state, u8 *p_in,
+				  struct fwht_cframe *cf, u32 *hdr_flags,
+				  unsigned int *hdr_components_num)
 {
 	u32 flags;
-	struct fwht_cframe cf;
 	unsigned int components_num = 3;
 	unsigned int version;
 	const struct v4l2_fwht_pixfmt_info *info;
 	unsigned int hdr_width_div, hdr_height_div;
-	struct fwht_raw_frame dst_rf;
-	unsigned int dst_chroma_stride = state->stride;
-	unsigned int ref_chroma_stride = state->ref_stride;
-	unsigned int dst_size = state->stride * state->coded_height;
-	unsigned int ref_size;
 
 	if (!state->info)
 		return -EINVAL;
@@ -330,14 +331,35 @@ int v4l2_fwht_decode(struct v4l2_fwht_state *state, u8 *p_in, u8 *p_out)
 	state->xfer_func = ntohl(state->header.xfer_func);
 	state->ycbcr_enc = ntohl(state->header.ycbcr_enc);
 	state->quantization = ntohl(state->header.quantization);
-	cf.rlc_data = (__be16 *)p_in;
-	cf.size = ntohl(state->header.size);
+	cf->rlc_data = (__be16 *)p_in;
+	cf->size = ntohl(state->header.size);
 
 	hdr_width_div = (flags & FWHT_FL_CHROMA_FULL_WIDTH) ? 1 : 2;
 	hdr_height_div = (flags & FWHT_FL_CHROMA_FULL_HEIGHT) ? 1 : 2;
 	if (hdr_width_div != info->width_div ||
 	    hdr_height_div != info->height_div)
 		return -EINVAL;
+	*hdr_flags = flags;
+	*hdr_components_num = components_num;
+	return 0;
+}
+
+int v4l2_fwht_decode(struct v4l2_fwht_state *state, u8 *p_in, u8 *p_out)
+{
+	u32 flags;
+	struct fwht_cframe cf;
+	unsigned int components_num;
+	const struct v4l2_fwht_pixfmt_info *info = state->info;
+	struct fwht_raw_frame dst_rf;
+	unsigned int dst_chroma_stride = state->stride;
+	unsigned int ref_chroma_stride = state->ref_stride;
+	unsigned int dst_size = state->stride * state->coded_height;
+	unsigned int ref_size;
+	int ret;
+
+	ret = v4l2_fwht_check_header(state, p_in, &cf, &flags, &components_num);
+	if (ret)
+		return ret;
 
 	if (prepare_raw_frame(&dst_rf, info, p_out, dst_size))
 		return -EINVAL;
@@ -365,3 +387,25 @@ int v4l2_fwht_decode(struct v4l2_fwht_state *state, u8 *p_in, u8 *p_out)
 		return -EINVAL;
 	return 0;
 }
+
+/*
+ * Decode the coefficients of the frame at p_in into planes, leaving the
+ * inverse transform to the caller, see fwht_decode_frame_coeffs()
+ */
+int v4l2_fwht_decode_coeffs(struct v4l2_fwht_state *state, u8 *p_in,
+			    struct fwht_coeff_plane *planes)
+{
+	u32 flags;
+	struct fwht_cframe cf;
+	unsigned int components_num;
+	int ret;
+
+	ret = v4l2_fwht_check_header(state, p_in, &cf, &flags, &components_num);
+	if (ret)
+		return ret;
+	if (!fwht_decode_frame_coeffs(&cf, flags, components_num,
+				      state->visible_width,
+				      state->visible_height, planes))
+		return -EINVAL;
+	return 0;
+}
@@ -35,6 +35,7 @@ struct v4l2_fwht_state {
 	unsigned int gop_cnt;
 	u16 i_frame_qp;
 	u16 p_frame_qp;
+	u16 speed;
 
 	enum v4l2_colorspace colorspace;
 	enum v4l2_ycbcr_encoding ycbcr_enc;
@@ -57,8 +58,13 @@ const struct v4l2_fwht_pixfmt_info *v4l2_fwht_find_nth_fmt(u32 width_div,
 							  u32 components_num,
 							  u32 pixenc,
 							  unsigned int start_idx);
+int prepare_raw_frame(struct fwht_raw_frame *rf,
+		      const struct v4l2_fwht_pixfmt_info *info, u8 *buf,
+		      unsigned int size);
 
 int v4l2_fwht_encode(struct v4l2_fwht_state *state, u8 *p_in, u8 *p_out);
 int v4l2_fwht_decode(struct v4l2_fwht_state *state, u8 *p_in, u8 *p_out);
+int v4l2_fwht_decode_coeffs(struct v4l2_fwht_state *state, u8 *p_in,
+			    struct fwht_coeff_plane *planes);
 
 #endif
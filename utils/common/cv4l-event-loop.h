@@ -0,0 +1,136 @@
+/* SPDX-License-Identifier: (GPL-2.0-only OR BSD-3-Clause) */
+/*
+ * V4L2 C++ helper header providing an epoll based event loop to wait for
+ * the buffers (EPOLLIN/EPOLLOUT) and events (EPOLLPRI) of one or more
+ * file descriptors.
+ *
+ * The file descriptors are registered once instead of rebuilding an fd_set
+ * for every select() call. Each is registered with an id that is used to
+ * look up its ready events after wait(). With busy polling enabled wait()
+ * spins on epoll_wait() with a zero timeout instead of sleeping, which
+ * avoids the wakeup latency at the cost of a CPU core.
+ */
+
+#ifndef _CV4L_EVENT_LOOP_H_
+#define _CV4L_EVENT_LOOP_H_
+
+#include <linux/types.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+
+#define CV4L_EVENT_LOOP_MAX_EVENTS 16
+
+class cv4l_event_loop {
+public:
+	cv4l_event_loop() :
+		epfd(epoll_create1(EPOLL_CLOEXEC)),
+		busy_poll(false),
+		num_ready(0)
+	{
+	}
+	~cv4l_event_loop()
+	{
+		if (epfd >= 0)
+			close(epfd);
+	}
+
+	int g_fd() const { return epfd; }
+	bool g_busy_poll() const { return busy_poll; }
+	void s_busy_poll(bool busy) { busy_poll = busy; }
+
+	/* These return 0 on success or an errno value */
+	int add(int fd, __u32 events, __u32 id) { return ctl(EPOLL_CTL_ADD, fd, events, id); }
+	int modify(int fd, __u32 events, __u32 id) { return ctl(EPOLL_CTL_MOD, fd, events, id); }
+	int del(int fd) { return ctl(EPOLL_CTL_DEL, fd, 0, 0); }
+
+	/*
+	 * Wait up to timeout_ms milliseconds (forever if < 0) for events.
+	 * Returns the number of ready file descriptors, 0 on timeout and -1
+	 * (with errno set) on error. Interrupted waits are restarted.
+	 */
+	int wait(int timeout_ms)
+	{
+		struct timespec start;
+		int n;
+
+		num_ready = 0;
+		if (epfd < 0) {
+			errno = EBADF;
+			return -1;
+		}
+		if (!busy_poll || timeout_ms == 0) {
+			do {
+				n = epoll_wait(epfd, ready, CV4L_EVENT_LOOP_MAX_EVENTS, timeout_ms);
+			} while (n < 0 && errno == EINTR);
+			num_ready = n > 0 ? n : 0;
+			return n;
+		}
+
+		clock_gettime(CLOCK_MONOTONIC, &start);
+		for (;;) {
+			n = epoll_wait(epfd, ready, CV4L_EVENT_LOOP_MAX_EVENTS, 0);
+			if (n > 0 || (n < 0 && errno != EINTR))
+				break;
+			if (timeout_ms > 0 && elapsed_ms(start) >= timeout_ms)
+				return 0;
+		}
+		num_ready = n > 0 ? n : 0;
+		return n;
+	}
+
+	/*
+	 * The events of the last wait() for the file descriptor with this id.
+	 * Like select() does, EPOLLERR also reports EPOLLIN and EPOLLOUT and
+	 * EPOLLHUP also reports EPOLLIN, so the caller tries to dequeue and
+	 * gets the actual error.
+	 */
+	__u32 g_events(__u32 id) const
+	{
+		__u32 events = 0;
+
+		for (unsigned i = 0; i < num_ready; i++)
+			if (ready[i].data.u32 == id)
+				events |= ready[i].events;
+		if (events & EPOLLERR)
+			events |= EPOLLIN | EPOLLOUT;
+		if (events & EPOLLHUP)
+			events |= EPOLLIN;
+		return events;
+	}
+	unsigned g_num_ready() const { return num_ready; }
+	__u32 g_ready_id(unsigned i) const { return ready[i].data.u32; }
+	__u32 g_ready_events(unsigned i) const { return ready[i].events; }
+
+private:
+	cv4l_event_loop(const cv4l_event_loop &);
+	cv4l_event_loop &operator= (const cv4l_event_loop &);
+
+	int ctl(int op, int fd, __u32 events, __u32 id)
+	{
+		struct epoll_event ev = { };
+
+		ev.events = events;
+		ev.data.u32 = id;
+		if (epfd < 0)
+			return EBADF;
+		return epoll_ctl(epfd, op, fd, &ev) ? errno : 0;
+	}
+
+	static long elapsed_ms(const struct timespec &start)
+	{
+		struct timespec now;
+
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		return (now.tv_sec - start.tv_sec) * 1000 +
+		       (now.tv_nsec - start.tv_nsec) / 1000000;
+	}
+
+	int epfd;
+	bool busy_poll;
+	unsigned num_ready;
+	struct epoll_event ready[CV4L_EVENT_LOOP_MAX_EVENTS];
+};
+
+#endif
@@ -0,0 +1,389 @@
+/* SPDX-License-Identifier: (GPL-2.0-only OR BSD-3-Clause) */
+/*
+ * V4L2 C++ helper header providing a streaming engine on top of the
+ * cv4l_fd and cv4l_queue helpers.
+ *
+ * The engine keeps the metadata of every buffer of the queue in a fixed
+ * array, so nothing is allocated once streaming has started. A dequeued
+ * buffer is handed out as a cv4l_stream_buffer: a move-only handle that
+ * queues the buffer back to the driver when it is destroyed or released,
+ * so a buffer can't be lost on an early return.
+ *
+ * Every dequeued buffer is passed through the registered stages in order.
+ * A stage may keep a buffer for later by moving it out of the handle it
+ * was given, the stages after it are then skipped for that buffer.
+ *
+ * The engine waits with a cv4l_event_loop, so other file descriptors can
+ * be added to the same loop and V4L2 events (EPOLLPRI) are dequeued and
+ * passed on to the stages as well.
+ */
+
+#ifndef _CV4L_STREAM_ENGINE_H_
+#define _CV4L_STREAM_ENGINE_H_
+
+#include <errno.h>
+#include <fcntl.h>
+#include <cv4l-helpers.h>
+#include <cv4l-event-loop.h>
+
+#define CV4L_STREAM_ENGINE_MAX_STAGES 8
+
+/* The event loop id of the streaming file descriptor */
+#define CV4L_STREAM_ENGINE_ID 0
+
+class cv4l_stream_engine;
+
+class cv4l_stream_buffer {
+	friend class cv4l_stream_engine;
+public:
+	cv4l_stream_buffer() : engine(NULL), buf(NULL) {}
+	cv4l_stream_buffer(cv4l_stream_buffer &&h) : engine(h.engine), buf(h.buf)
+	{
+		h.engine = NULL;
+		h.buf = NULL;
+	}
+	cv4l_stream_buffer &operator= (cv4l_stream_buffer &&h)
+	{
+		if (this != &h) {
+			release();
+			engine = h.engine;
+			buf = h.buf;
+			h.engine = NULL;
+			h.buf = NULL;
+		}
+		return *this;
+	}
+	~cv4l_stream_buffer() { release(); }
+
+	bool valid() const { return buf != NULL; }
+	cv4l_buffer &operator*() const { return *buf; }
+	cv4l_buffer *operator->() const { return buf; }
+	inline void *g_dataptr(unsigned plane = 0) const;
+
+	/*
+	 * Give the buffer back to the driver now. Returns 0 on success or an
+	 * errno value, the handle is empty afterwards in either case.
+	 */
+	inline int release();
+
+private:
+	cv4l_stream_buffer(const cv4l_stream_buffer &);
+	cv4l_stream_buffer &operator= (const cv4l_stream_buffer &);
+
+	cv4l_stream_engine *engine;
+	cv4l_buffer *buf;
+};
+
+class cv4l_stream_stage {
+public:
+	virtual ~cv4l_stream_stage() {}
+
+	/*
+	 * Handle a dequeued buffer. Return 0 to pass it on to the next stage,
+	 * > 0 to skip the remaining stages for this buffer and < 0 to stop
+	 * the engine: run_once() then returns this value.
+	 */
+	virtual int process(cv4l_stream_engine &engine, cv4l_stream_buffer &buf) = 0;
+
+	/* Handle a dequeued V4L2 event, same return values as process() */
+	virtual int event(cv4l_stream_engine &engine, const v4l2_event &ev) { return 0; }
+};
+
+class cv4l_stream_engine {
+	friend class cv4l_stream_buffer;
+public:
+	cv4l_stream_engine(cv4l_fd &fd, cv4l_queue &q) :
+		fd(fd),
+		q(q),
+		num_stages(0),
+		streaming(false),
+		non_blocking(false),
+		watch_events(false),
+		frames(0),
+		outstanding(0)
+	{
+		for (unsigned i = 0; i < VIDEO_MAX_FRAME; i++)
+			queued[i] = held[i] = false;
+	}
+	~cv4l_stream_engine()
+	{
+		stop();
+	}
+
+	cv4l_fd &g_fd() const { return fd; }
+	cv4l_queue &g_queue() const { return q; }
+	cv4l_event_loop &g_event_loop() { return loop; }
+	bool g_streaming() const { return streaming; }
+	/* The number of buffers dequeued since start() */
+	__u64 g_frames() const { return frames; }
+	/* The number of buffers held by handles */
+	unsigned g_outstanding() const { return outstanding; }
+	/* Also wait for and dequeue V4L2 events, set before start() */
+	void s_watch_events(bool watch) { watch_events = watch; }
+
+	/* Returns 0 on success or ENOSPC if all stage slots are in use */
+	int add_stage(cv4l_stream_stage *stage)
+	{
+		if (num_stages == CV4L_STREAM_ENGINE_MAX_STAGES)
+			return ENOSPC;
+		stages[num_stages++] = stage;
+		return 0;
+	}
+
+	/*
+	 * Start streaming the buffers already obtained for the queue. The
+	 * buffers of a capture queue are all queued first, those of an output
+	 * queue are handed out by get_unqueued() to be filled. Returns 0 on success
+	 * or an errno value.
+	 */
+	int start()
+	{
+		unsigned type = q.g_type();
+		__u32 events;
+		int ret;
+
+		if (streaming || outstanding)
+			return EBUSY;
+		if (!q.g_buffers() || q.g_buffers() > VIDEO_MAX_FRAME)
+			return EINVAL;
+		non_blocking = fcntl(fd.g_fd(), F_GETFL) & O_NONBLOCK;
+		frames = 0;
+		for (unsigned i = 0; i < q.g_buffers(); i++) {
+			bufs[i].init(q, i);
+			queued[i] = false;
+			if (v4l_type_is_output(type))
+				continue;
+			ret = fd.qbuf(bufs[i]);
+			if (ret)
+				return ret;
+			queued[i] = true;
+		}
+		ret = fd.streamon(type);
+		if (ret)
+			return ret;
+		events = v4l_type_is_output(type) ? EPOLLOUT : EPOLLIN;
+		if (watch_events)
+			events |= EPOLLPRI;
+		ret = loop.add(fd.g_fd(), events, CV4L_STREAM_ENGINE_ID);
+		if (ret) {
+			fd.streamoff(type);
+			return ret;
+		}
+		streaming = true;
+		return 0;
+	}
+
+	/*
+	 * Stop streaming. The driver takes back all queued buffers, releasing
+	 * the handles that are still held no longer queues them.
+	 */
+	int stop()
+	{
+		if (!streaming)
+			return 0;
+		streaming = false;
+		loop.del(fd.g_fd());
+		for (unsigned i = 0; i < VIDEO_MAX_FRAME; i++)
+			queued[i] = false;
+		return fd.streamoff(q.g_type());
+	}
+
+	/*
+	 * Hand out the buffers of an output queue that were never queued,
+	 * for filling them before the first wait. Returns EAGAIN when all
+	 * buffers are queued or held.
+	 */
+	int get_unqueued(cv4l_stream_buffer &h)
+	{
+		h.release();
+		for (unsigned i = 0; i < q.g_buffers(); i++) {
+			if (queued[i] || held[i])
+				continue;
+			attach(h, i);
+			return 0;
+		}
+		return EAGAIN;
+	}
+
+	/*
+	 * Dequeue a buffer into h, releasing what h held before. Returns 0 on
+	 * success or an errno value: EAGAIN if nothing can be dequeued without
+	 * blocking on a non-blocking file descriptor.
+	 */
+	int dequeue(cv4l_stream_buffer &h)
+	{
+		unsigned index;
+		int ret;
+
+		h.release();
+		if (!streaming)
+			return EINVAL;
+		scratch.init(q);
+		ret = fd.dqbuf(scratch);
+		if (ret)
+			return ret;
+		index = scratch.g_index();
+		if (index >= q.g_buffers())
+			return EINVAL;
+		bufs[index].init(scratch);
+		queued[index] = false;
+		frames++;
+		attach(h, index);
+		return 0;
+	}
+
+	/*
+	 * Wait up to timeout_ms milliseconds (forever if < 0) and run the
+	 * stages for everything that is ready, all of it for a non-blocking
+	 * file descriptor and one buffer otherwise. Returns the number of
+	 * buffers processed, a negative stage return value, or -1 with errno
+	 * set on error.
+	 */
+	int run_once(int timeout_ms)
+	{
+		cv4l_stream_buffer h;
+		__u32 events;
+		int processed = 0;
+		int ret;
+
+		if (!streaming) {
+			errno = EINVAL;
+			return -1;
+		}
+		ret = loop.wait(timeout_ms);
+		if (ret <= 0)
+			return ret;
+		events = loop.g_events(CV4L_STREAM_ENGINE_ID);
+
+		if (watch_events && (events & EPOLLPRI)) {
+			v4l2_event ev;
+
+			/* Only dequeue what is pending, DQEVENT may block */
+			do {
+				if (fd.dqevent(ev))
+					break;
+				ret = run_event(ev);
+				if (ret < 0)
+					return ret;
+			} while (ev.pending);
+		}
+		if (!(events & (EPOLLIN | EPOLLOUT)))
+			return 0;
+		do {
+			ret = dequeue(h);
+			if (ret == EAGAIN)
+				break;
+			if (ret) {
+				errno = ret;
+				return -1;
+			}
+			ret = run_stages(h);
+			if (ret < 0)
+				return ret;
+			processed++;
+			h.release();
+		} while (non_blocking);
+		return processed;
+	}
+
+	/* Call run_once() until a stage or an error stops it */
+	int run(int timeout_ms)
+	{
+		int ret;
+
+		do {
+			ret = run_once(timeout_ms);
+		} while (ret >= 0);
+		return ret;
+	}
+
+	/* Pass a buffer through the stages */
+	int run_stages(cv4l_stream_buffer &h)
+	{
+		for (unsigned i = 0; i < num_stages && h.valid(); i++) {
+			int ret = stages[i]->process(*this, h);
+
+			if (ret)
+				return ret < 0 ? ret : 0;
+		}
+		return 0;
+	}
+
+private:
+	cv4l_stream_engine(const cv4l_stream_engine &);
+	cv4l_stream_engine &operator= (const cv4l_stream_engine &);
+
+	int run_event(const v4l2_event &ev)
+	{
+		for (unsigned i = 0; i < num_stages; i++) {
+			int ret = stages[i]->event(*this, ev);
+
+			if (ret)
+				return ret < 0 ? ret : 0;
+		}
+		return 0;
+	}
+
+	void attach(cv4l_stream_buffer &h, unsigned index)
+	{
+		held[index] = true;
+		outstanding++;
+		h.engine = this;
+		h.buf = &bufs[index];
+	}
+
+	int requeue(cv4l_buffer *buf)
+	{
+		unsigned index = buf->g_index();
+		int ret;
+
+		held[index] = false;
+		outstanding--;
+		if (!streaming)
+			return 0;
+		if (v4l_type_is_output(q.g_type())) {
+			/* Keep the bytesused and timestamps of the filled buffer */
+			q.buffer_update(*buf, index);
+		} else {
+			buf->init(q, index);
+		}
+		ret = fd.qbuf(*buf);
+		if (!ret)
+			queued[index] = true;
+		return ret;
+	}
+
+	cv4l_fd &fd;
+	cv4l_queue &q;
+	cv4l_event_loop loop;
+	cv4l_stream_stage *stages[CV4L_STREAM_ENGINE_MAX_STAGES];
+	unsigned num_stages;
+	bool streaming;
+	bool non_blocking;
+	bool watch_events;
+	__u64 frames;
+	unsigned outstanding;
+	cv4l_buffer scratch;
+	cv4l_buffer bufs[VIDEO_MAX_FRAME];
+	bool queued[VIDEO_MAX_FRAME];
+	bool held[VIDEO_MAX_FRAME];
+};
+
+inline void *cv4l_stream_buffer::g_dataptr(unsigned plane) const
+{
+	return engine->q.g_dataptr(buf->g_index(), plane);
+}
+
+inline int cv4l_stream_buffer::release()
+{
+	cv4l_buffer *b = buf;
+	cv4l_stream_engine *e = engine;
+
+	if (!b)
+		return 0;
+	engine = NULL;
+	buf = NULL;
+	return e->requeue(b);
+}
+
+#endif
@@ -0,0 +1,486 @@
+/* SPDX-License-Identifier: GPL-2.0 */
+/*
+ * ir-decode.c - decodes raw IR into scancodes
+ *
+ * The decoders are state machines driven by the timing tables below,
+ * which are built from the same units as the encoders in ir-encode.c.
+ * There are two kinds: pulse distance/length protocols, where each bit
+ * is a pulse and a space, and manchester (bi-phase) protocols, where each
+ * bit is two half bits of opposite level.
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <assert.h>
+
+#include <linux/lirc.h>
+
+#include "ir-encode.h"
+#include "ir-decode.h"
+
+enum pd_state {
+	PD_HEADER_PULSE,
+	PD_HEADER_SPACE,
+	PD_BIT_PULSE,
+	PD_BIT_SPACE,
+	PD_TRAILER_SPACE,
+};
+
+enum mc_state {
+	MC_IDLE,
+	MC_HEADER_SPACE,
+	MC_BITS,
+};
+
+static bool eq_margin(unsigned d, unsigned t, unsigned margin)
+{
+	return d + margin >= t && d <= t + margin;
+}
+
+static bool nec_scancode(uint64_t bits, unsigned count,
+			 enum rc_proto *proto, unsigned *scancode)
+{
+	unsigned a0 = bits & 0xff, a1 = (bits >> 8) & 0xff;
+	unsigned c0 = (bits >> 16) & 0xff, c1 = (bits >> 24) & 0xff;
+
+	// the reverse of nec_encode() and protocol_scancode_valid()
+	if ((c0 ^ c1) != 0xff) {
+		*proto = RC_PROTO_NEC32;
+		*scancode = a1 << 24 | a0 << 16 | c1 << 8 | c0;
+	} else if ((a0 ^ a1) != 0xff) {
+		*proto = RC_PROTO_NECX;
+		*scancode = a0 << 16 | a1 << 8 | c0;
+	} else {
+		*proto = RC_PROTO_NEC;
+		*scancode = a0 << 8 | c0;
+	}
+
+	return true;
+}
+
+static bool jvc_scancode(uint64_t bits, unsigned count,
+			 enum rc_proto *proto, unsigned *scancode)
+{
+	// the address comes first
+	*proto = RC_PROTO_JVC;
+	*scancode = ((bits << 8) & 0xff00) | ((bits >> 8) & 0x00ff);
+	return true;
+}
+
+static bool sanyo_scancode(uint64_t bits, unsigned count,
+			   enum rc_proto *proto, unsigned *scancode)
+{
+	unsigned address = bits & 0x1fff;
+	unsigned command = (bits >> 26) & 0xff;
+	unsigned not_command = (bits >> 34) & 0xff;
+
+	// like the kernel decoder, the inverted address is not checked
+	if ((command ^ not_command) != 0xff)
+		return false;
+
+	*proto = RC_PROTO_SANYO;
+	*scancode = address << 8 | command;
+	return true;
+}
+
+static bool sony_scancode(uint64_t bits, unsigned count,
+			  enum rc_proto *proto, unsigned *scancode)
+{
+	unsigned command = bits & 0x7f;
+
+	switch (count) {
+	case 12:
+		*proto = RC_PROTO_SONY12;
+		*scancode = ((bits >> 7) & 0x1f) << 16 | command;
+		return true;
+	case 15:
+		*proto = RC_PROTO_SONY15;
+		*scancode = ((bits >> 7) & 0xff) << 16 | command;
+		return true;
+	case 20:
+		*proto = RC_PROTO_SONY20;
+		*scancode = ((bits >> 7) & 0x1f) << 16 |
+			    ((bits >> 12) & 0xff) << 8 | command;
+		return true;
+	default:
+		return false;
+	}
+}
+
+static bool xbox_dvd_scancode(uint64_t bits, unsigned count,
+			      enum rc_proto *proto, unsigned *scancode)
+{
+	if ((((bits >> 12) ^ bits) & 0xfff) != 0xfff)
+		return false;
+
+	*proto = RC_PROTO_XBOX_DVD;
+	*scancode = bits & 0xfff;
+	return true;
+}
+
+static bool rc5_scancode(uint64_t bits, unsigned count,
+			 enum rc_proto *proto, unsigned *scancode)
+{
+	// start bit, field bit, toggle bit and the data bits
+	switch (count) {
+	case 14:
+		if (!(bits & 0x2000))
+			return false;
+		*proto = RC_PROTO_RC5;
+		*scancode = ((bits >> 6) & 0x1f) << 8 | (bits & 0x3f) |
+			    (bits & 0x1000 ? 0 : 0x40);
+		return true;
+	case 15:
+		if (!(bits & 0x4000))
+			return false;
+		*proto = RC_PROTO_RC5_SZ;
+		*scancode = (bits & 0x2000) | (bits & 0xfff);
+		return true;
+	default:
+		return false;
+	}
+}
+
+static bool rc6_scancode(uint64_t bits, unsigned count,
+			 enum rc_proto *proto, unsigned *scancode)
+{
+	// start bit, three mode bits, toggle bit and the data bits
+	unsigned n, mode, data;
+
+	if (count < 5 || !((bits >> (count - 1)) & 1))
+		return false;
+
+	n = count - 5;
+	mode = (bits >> (count - 4)) & 7;
+	data = bits & ((1ull << n) - 1);
+
+	if (mode == 0 && n == 16) {
+		*proto = RC_PROTO_RC6_0;
+	} else if (mode == 6 && n == 20) {
+		*proto = RC_PROTO_RC6_6A_20;
+	} else if (mode == 6 && n == 24) {
+		*proto = RC_PROTO_RC6_6A_24;
+	} else if (mode == 6 && n == 32) {
+		// the mce toggle bit is not part of the scancode
+		if ((data & 0xffff0000) == 0x800f0000) {
+			*proto = RC_PROTO_RC6_MCE;
+			data &= ~0x8000;
+		} else {
+			*proto = RC_PROTO_RC6_6A_32;
+		}
+	} else {
+		return false;
+	}
+
+	*scancode = data;
+	return true;
+}
+
+#define UNIT(u, n)	NS_TO_US((u) * (n))
+
+/*
+ * For pulse distance protocols, the bit value is in the length of the
+ * space and the message ends with a trailing pulse. For pulse length
+ * protocols (sony), the bit value is in the length of the pulse and the
+ * message ends with a long space.
+ */
+static const struct pd_protocol {
+	unsigned header_pulse, header_space;
+	unsigned pulse[2], space[2];
+	unsigned header_margin, margin;
+	unsigned trailer_space;
+	uint8_t max_bits;
+	bool msb_first;
+	bool trailer;
+	bool (*scancode)(uint64_t bits, unsigned count,
+			 enum rc_proto *proto, unsigned *scancode);
+} pd_protocols[] = {
+	{
+		UNIT(NEC_UNIT, 16), UNIT(NEC_UNIT, 8),
+		{ UNIT(NEC_UNIT, 1), UNIT(NEC_UNIT, 1) },
+		{ UNIT(NEC_UNIT, 1), UNIT(NEC_UNIT, 3) },
+		UNIT(NEC_UNIT, 2), UNIT(NEC_UNIT, 1) / 2,
+		UNIT(NEC_UNIT, 10), 32, false, true, nec_scancode
+	}, {
+		UNIT(JVC_UNIT, 16), UNIT(JVC_UNIT, 8),
+		{ UNIT(JVC_UNIT, 1), UNIT(JVC_UNIT, 1) },
+		{ UNIT(JVC_UNIT, 1), UNIT(JVC_UNIT, 3) },
+		UNIT(JVC_UNIT, 1) / 2, UNIT(JVC_UNIT, 1) / 2,
+		UNIT(JVC_UNIT, 10), 16, false, true, jvc_scancode
+	}, {
+		UNIT(SANYO_UNIT, 16), UNIT(SANYO_UNIT, 8),
+		{ UNIT(SANYO_UNIT, 1), UNIT(SANYO_UNIT, 1) },
+		{ UNIT(SANYO_UNIT, 1), UNIT(SANYO_UNIT, 3) },
+		UNIT(SANYO_UNIT, 1) / 2, UNIT(SANYO_UNIT, 1) / 2,
+		UNIT(SANYO_UNIT, 10), 42, false, true, sanyo_scancode
+	}, {
+		UNIT(SONY_UNIT, 4), UNIT(SONY_UNIT, 1),
+		{ UNIT(SONY_UNIT, 1), UNIT(SONY_UNIT, 2) },
+		{ UNIT(SONY_UNIT, 1), UNIT(SONY_UNIT, 1) },
+		// tighter than the kernel, which would take a 2666us rc6
+		// header pulse for a sony one
+		UNIT(SONY_UNIT, 1) / 3, UNIT(SONY_UNIT, 1) / 2,
+		UNIT(SONY_UNIT, 10), 20, false, false, sony_scancode
+	}, {
+		XBOX_DVD_HEADER_PULSE, XBOX_DVD_HEADER_SPACE,
+		{ XBOX_DVD_PULSE, XBOX_DVD_PULSE },
+		{ XBOX_DVD_SPACE_0, XBOX_DVD_SPACE_1 },
+		XBOX_DVD_SPACE_1 - XBOX_DVD_SPACE_0,
+		(XBOX_DVD_SPACE_1 - XBOX_DVD_SPACE_0) * 2 / 5,
+		XBOX_DVD_HEADER_SPACE, 24, true, true,
+		xbox_dvd_scancode
+	},
+};
+
+/*
+ * For manchester protocols, the samples are split into units of half a
+ * bit, each of which must be within margin of a whole number of units.
+ * The rc6 toggle bit is twice as wide as the other bits. A space longer
+ * than max_run units cannot be part of a message, so it ends it.
+ */
+static const struct mc_protocol {
+	unsigned unit, margin;
+	unsigned header_pulse, header_space;
+	bool one_first;		// level of the first half of a 1 bit
+	uint8_t wide_bit;
+	uint8_t max_run;
+	uint8_t max_bits;
+	bool (*scancode)(uint64_t bits, unsigned count,
+			 enum rc_proto *proto, unsigned *scancode);
+} mc_protocols[] = {
+	// the first half of the rc5 start bit is the space while idle
+	{
+		UNIT(RC5_UNIT, 1), UNIT(RC5_UNIT, 3) / 10, 0, 0,
+		false, 0xff, 2, 15, rc5_scancode
+	}, {
+		UNIT(RC6_UNIT, 1), UNIT(RC6_UNIT, 1) / 2,
+		UNIT(RC6_UNIT, 6), UNIT(RC6_UNIT, 2),
+		true, 4, 3, 37, rc6_scancode
+	},
+};
+
+static bool pd_decode(const struct pd_protocol *p, struct ir_decoder_state *s,
+		      bool pulse, unsigned d,
+		      enum rc_proto *proto, unsigned *scancode)
+{
+	unsigned bit;
+
+again:
+	switch (s->state) {
+	case PD_HEADER_PULSE:
+		if (pulse && eq_margin(d, p->header_pulse, p->header_margin))
+			s->state = PD_HEADER_SPACE;
+		return false;
+
+	case PD_HEADER_SPACE:
+		if (pulse || !eq_margin(d, p->header_space, p->header_margin))
+			break;
+		s->state = PD_BIT_PULSE;
+		s->count = 0;
+		s->bits = 0;
+		return false;
+
+	case PD_BIT_PULSE:
+		if (!pulse)
+			break;
+		if (p->trailer) {
+			if (!eq_margin(d, p->pulse[0], p->margin))
+				break;
+			s->state = s->count == p->max_bits ?
+				PD_TRAILER_SPACE : PD_BIT_SPACE;
+			return false;
+		}
+
+		if (s->count == p->max_bits)
+			break;
+		if (eq_margin(d, p->pulse[1], p->margin))
+			bit = 1;
+		else if (eq_margin(d, p->pulse[0], p->margin))
+			bit = 0;
+		else
+			break;
+		goto add_bit;
+
+	case PD_BIT_SPACE:
+		if (pulse)
+			break;
+		if (!p->trailer) {
+			if (eq_margin(d, p->space[0], p->margin)) {
+				s->state = PD_BIT_PULSE;
+				return false;
+			}
+			if (d < p->trailer_space)
+				break;
+			// the long space after the last bit
+			s->state = PD_HEADER_PULSE;
+			return p->scancode(s->bits, s->count, proto, scancode);
+		}
+
+		if (eq_margin(d, p->space[1], p->margin))
+			bit = 1;
+		else if (eq_margin(d, p->space[0], p->margin))
+			bit = 0;
+		else
+			break;
+		goto add_bit;
+
+	case PD_TRAILER_SPACE:
+		// nec and sanyo share the header, so the message only
+		// ends once the space after the trailer is seen
+		if (pulse || d < p->trailer_space)
+			break;
+		s->state = PD_HEADER_PULSE;
+		return p->scancode(s->bits, s->count, proto, scancode);
+	}
+
+	// not this protocol; the sample might start a new message
+	s->state = PD_HEADER_PULSE;
+	if (pulse)
+		goto again;
+	return false;
+
+add_bit:
+	if (p->msb_first)
+		s->bits = s->bits << 1 | bit;
+	else
+		s->bits |= (uint64_t)bit << s->count;
+	s->count++;
+	s->state = p->trailer ? PD_BIT_PULSE : PD_BIT_SPACE;
+	return false;
+}
+
+// Add n half bit units of the level to the bits, false if invalid
+static bool mc_add_units(const struct mc_protocol *p,
+			 struct ir_decoder_state *s, bool level, unsigned n)
+{
+	while (n--) {
+		unsigned w = s->count == p->wide_bit ? 2 : 1;
+
+		if (s->pos == 0)
+			s->first = level;
+		else if ((s->pos < w) != (level == s->first))
+			return false;
+
+		if (++s->pos < 2 * w)
+			continue;
+
+		if (s->count == p->max_bits)
+			return false;
+		s->bits = s->bits << 1 | (s->first == p->one_first);
+		s->count++;
+		s->pos = 0;
+	}
+
+	return true;
+}
+
+static bool mc_decode(const struct mc_protocol *p, struct ir_decoder_state *s,
+		      bool pulse, unsigned d,
+		      enum rc_proto *proto, unsigned *scancode)
+{
+	unsigned n = (d + p->unit / 2) / p->unit;
+	bool retry = true;
+
+	if (!eq_margin(d, n * p->unit, p->margin))
+		n = 0;
+
+again:
+	switch (s->state) {
+	case MC_IDLE:
+		if (!pulse)
+			return false;
+		if (p->header_pulse) {
+			if (eq_margin(d, p->header_pulse, p->unit))
+				s->state = MC_HEADER_SPACE;
+			return false;
+		}
+		s->state = MC_BITS;
+		s->count = 0;
+		s->bits = 0;
+		s->pos = 0;
+		if (!mc_add_units(p, s, false, 1))
+			break;
+		goto bits;
+
+	case MC_HEADER_SPACE:
+		if (pulse || !eq_margin(d, p->header_space, p->unit / 2))
+			break;
+		s->state = MC_BITS;
+		s->count = 0;
+		s->bits = 0;
+		s->pos = 0;
+		return false;
+
+	case MC_BITS:
+	bits:
+		if (!pulse && d > p->max_run * p->unit + p->margin) {
+			// the end of the message, which completes the
+			// last bit if it ends with a space
+			s->state = MC_IDLE;
+			if (s->pos) {
+				unsigned w = s->count == p->wide_bit ? 2 : 1;
+
+				if (!mc_add_units(p, s, false, 2 * w - s->pos))
+					return false;
+			}
+			return p->scancode(s->bits, s->count, proto, scancode);
+		}
+		if (n == 0 || n > p->max_run || !mc_add_units(p, s, pulse, n))
+			break;
+		return false;
+	}
+
+	// not this protocol; the sample might start a new message
+	s->state = MC_IDLE;
+	if (pulse && retry) {
+		retry = false;
+		goto again;
+	}
+	return false;
+}
+
+void ir_decoder_init(struct ir_decoder *d)
+{
+	assert(ARRAY_SIZE(pd_protocols) + ARRAY_SIZE(mc_protocols) == IR_DECODERS);
+
+	memset(d, 0, sizeof(*d));
+}
+
+/*
+ * Feed one pulse or space to all decoders. A lirc timeout should be
+ * passed as a space, since it ends the message. Returns true if a
+ * scancode was decoded.
+ */
+bool ir_decode(struct ir_decoder *d, bool pulse, unsigned duration,
+	       enum rc_proto *proto, unsigned *scancode)
+{
+	struct ir_decoder_state *s = d->s;
+	bool decoded = false;
+	enum rc_proto p;
+	unsigned sc;
+	unsigned i;
+
+	// Every decoder sees every sample, even after one has decoded. The
+	// manchester decoders check more of the message, so they go first:
+	// an rc6 message can also look like a valid sony one.
+	for (i = 0; i < ARRAY_SIZE(mc_protocols); i++, s++) {
+		if (mc_decode(&mc_protocols[i], s, pulse, duration, &p, &sc) &&
+		    !decoded) {
+			*proto = p;
+			*scancode = sc;
+			decoded = true;
+		}
+	}
+
+	for (i = 0; i < ARRAY_SIZE(pd_protocols); i++, s++) {
+		if (pd_decode(&pd_protocols[i], s, pulse, duration, &p, &sc) &&
+		    !decoded) {
+			*proto = p;
+			*scancode = sc;
+			decoded = true;
+		}
+	}
+
+	return decoded;
+}
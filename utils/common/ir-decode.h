@@ -0,0 +1,34 @@
+
+#ifndef __IR_DECODE_H__
+#define __IR_DECODE_H__
+
+#include <stdint.h>
+
+/*
+ * Userspace decoders for the protocols which ir-encode.c can encode,
+ * except sharp and rc5x_20. Every decoder runs on every sample, like the
+ * kernel decoders do, so no protocol needs to be selected.
+ *
+ * The state is kept in struct ir_decoder, one per stream of samples,
+ * so that several devices or captures can be decoded at the same time.
+ * Decoding does not allocate memory.
+ */
+#define IR_DECODERS 7
+
+struct ir_decoder_state {
+	uint8_t state;
+	uint8_t count;
+	uint8_t pos;
+	uint8_t first;
+	uint64_t bits;
+};
+
+struct ir_decoder {
+	struct ir_decoder_state s[IR_DECODERS];
+};
+
+void ir_decoder_init(struct ir_decoder *d);
+bool ir_decode(struct ir_decoder *d, bool pulse, unsigned duration,
+	       enum rc_proto *proto, unsigned *scancode);
+
+#endif
@@ -27,9 +27,7 @@
 
 #include "ir-encode.h"
 
-#define NS_TO_US(x) (((x)+500)/1000)
-
-static const int nec_unit = 562500;
+static const int nec_unit = NEC_UNIT;
 
 static void nec_add_byte(unsigned *buf, int *n, unsigned bits)
 {
@@ -80,7 +78,7 @@ static int nec_encode(enum rc_proto proto, unsigned scancode, unsigned *buf)
 
 static int jvc_encode(enum rc_proto proto, unsigned scancode, unsigned *buf)
 {
-	const int jvc_unit = 525000;
+	const int jvc_unit = JVC_UNIT;
 	int i;
 
 	/* swap bytes so address comes first */
@@ -105,7 +103,7 @@ static int jvc_encode(enum rc_proto proto, unsigned scancode, unsigned *buf)
 	return 35;
 }
 
-static const int sanyo_unit = 562500;
+static const int sanyo_unit = SANYO_UNIT;
 
 static void sanyo_add_bits(unsigned **buf, int bits, int count)
 {
@@ -135,7 +133,7 @@ static int sanyo_encode(enum rc_proto proto, unsigned scancode, unsigned *buf)
 	return 87;
 }
 
-static const int sharp_unit = 40000;
+static const int sharp_unit = SHARP_UNIT;
 
 static void sharp_add_bits(unsigned **buf, int bits, int count)
 {
@@ -167,7 +165,7 @@ static int sharp_encode(enum rc_proto proto, unsigned scancode, unsigned *buf)
 	return (13 + 2) * 4 + 3;
 }
 
-static const int sony_unit = 600000;
+static const int sony_unit = SONY_UNIT;
 
 static void sony_add_bits(unsigned *buf, int *n, int bits, int count)
 {
@@ -211,7 +209,7 @@ static int sony_encode(enum rc_proto proto, unsigned scancode, unsigned *buf)
 	return n - 1;
 }
 
-static const unsigned int rc5_unit = 888888;
+static const unsigned int rc5_unit = RC5_UNIT;
 
 static void rc5_advance_space(unsigned *buf, unsigned *n, unsigned length)
 {
@@ -277,7 +275,7 @@ static int rc5_encode(enum rc_proto proto, unsigned scancode, unsigned *buf)
 	return (n % 2) ? n : n + 1;
 }
 
-static const unsigned int rc6_unit = 444444;
+static const unsigned int rc6_unit = RC6_UNIT;
 
 static void rc6_advance_space(unsigned *buf, unsigned *n, unsigned length)
 {
@@ -350,22 +348,22 @@ static int xbox_dvd_encode(enum rc_proto proto, unsigned scancode, unsigned *buf
 {
 	int len = 0;
 
-	buf[len++] = 4000;
-	buf[len++] = 3900;
+	buf[len++] = XBOX_DVD_HEADER_PULSE;
+	buf[len++] = XBOX_DVD_HEADER_SPACE;
 
 	scancode &= 0xfff;
 	scancode |= (~scancode << 12) & 0xfff000;
 
 	for (int i=23; i >=0; i--) {
-		buf[len++] = 550;
+		buf[len++] = XBOX_DVD_PULSE;
 
 		if (scancode & (1 << i))
-			buf[len++] = 1900;
+			buf[len++] = XBOX_DVD_SPACE_1;
 		else
-			buf[len++] = 900;
+			buf[len++] = XBOX_DVD_SPACE_0;
 	}
 
-	buf[len++]= 550;
+	buf[len++]= XBOX_DVD_PULSE;
 
 	return len;
 }
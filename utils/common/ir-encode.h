@@ -4,6 +4,24 @@
 
 #define ARRAY_SIZE(x)     (sizeof(x)/sizeof((x)[0]))
 
+/* Protocol timings in nanoseconds, shared by the encoder and decoder */
+#define NEC_UNIT	562500
+#define JVC_UNIT	525000
+#define SANYO_UNIT	562500
+#define SHARP_UNIT	40000
+#define SONY_UNIT	600000
+#define RC5_UNIT	888888
+#define RC6_UNIT	444444
+
+/* The xbox-dvd timings have no common unit, these are in microseconds */
+#define XBOX_DVD_HEADER_PULSE	4000
+#define XBOX_DVD_HEADER_SPACE	3900
+#define XBOX_DVD_PULSE		550
+#define XBOX_DVD_SPACE_0	900
+#define XBOX_DVD_SPACE_1	1900
+
+#define NS_TO_US(x) (((x)+500)/1000)
+
 bool protocol_match(const char *name, enum rc_proto *proto);
 unsigned protocol_carrier(enum rc_proto proto);
 unsigned protocol_max_size(enum rc_proto proto);
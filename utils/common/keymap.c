@@ -456,6 +456,399 @@ static error_t parse_toml_protocol(const char *fname, struct toml_table_t *proot
 	return 0;
 }
 
+/*
+ * Fast path for toml keymaps, which fills struct keymap directly from the
+ * file contents rather than building the toml tree first. It only knows
+ * the subset of toml which keymaps use: the [[protocols]],
+ * [protocols.scancodes] and [[protocols.raw]] tables, bare keys, and
+ * string and integer values on a single line. The values are converted
+ * with toml_rtos() and toml_rtoi(), as the full parser does.
+ *
+ * Anything else, including anything the full parser would reject, makes
+ * it return KEYMAP_FALLBACK so that the file is parsed by the full
+ * parser, which also reports the error.
+ */
+#define KEYMAP_FALLBACK -1
+#define KEYMAP_MAX_KEYS 32
+
+struct fast_keymap {
+	struct keymap *map, *cur;
+	struct scancode_entry **next_se;
+	// keys of the current protocol or raw table, to find duplicates
+	const char *keys[KEYMAP_MAX_KEYS];
+	int nkeys;
+	bool have_scancodes;
+	// the current raw table
+	const char *raw_keycode, *raw_str;
+	bool in_raw;
+	// the keys of the current scancodes table
+	const char **scancodes;
+	int nscancodes, scancodes_size;
+};
+
+static char *skip_space(char *p)
+{
+	while (*p == ' ' || *p == '\t')
+		p++;
+	return p;
+}
+
+static bool fast_end_of_line(char *p)
+{
+	p = skip_space(p);
+	return *p == 0 || *p == '#';
+}
+
+// Returns false if the key was already seen in this table
+static bool fast_add_key(struct fast_keymap *fk, const char *key)
+{
+	int i;
+
+	if (fk->nkeys == KEYMAP_MAX_KEYS)
+		return false;
+
+	for (i = 0; i < fk->nkeys; i++)
+		if (!strcmp(fk->keys[i], key))
+			return false;
+
+	fk->keys[fk->nkeys++] = key;
+	return true;
+}
+
+static int cmp_key(const void *a, const void *b)
+{
+	return strcmp(*(const char **)a, *(const char **)b);
+}
+
+static error_t fast_end_scancodes(struct fast_keymap *fk)
+{
+	int i;
+
+	qsort(fk->scancodes, fk->nscancodes, sizeof(*fk->scancodes), cmp_key);
+	for (i = 1; i < fk->nscancodes; i++)
+		if (!strcmp(fk->scancodes[i - 1], fk->scancodes[i]))
+			return KEYMAP_FALLBACK;
+
+	fk->nscancodes = 0;
+	return 0;
+}
+
+static error_t fast_end_raw(const char *fname, struct fast_keymap *fk)
+{
+	struct raw_entry *re;
+	char *keycode, *raw_str;
+	error_t err;
+
+	if (!fk->in_raw)
+		return 0;
+	fk->in_raw = false;
+
+	if (!fk->raw_keycode || !fk->raw_str ||
+	    toml_rtos(fk->raw_keycode, &keycode))
+		return KEYMAP_FALLBACK;
+
+	if (toml_rtos(fk->raw_str, &raw_str)) {
+		free(keycode);
+		return KEYMAP_FALLBACK;
+	}
+
+	err = parse_rawir_string(fname, raw_str, &re);
+	free(raw_str);
+	if (err) {
+		free(keycode);
+		return err;
+	}
+
+	re->keycode = keycode;
+	re->next = fk->cur->raw;
+	fk->cur->raw = re;
+	return 0;
+}
+
+static error_t fast_end_protocol(const char *fname, struct fast_keymap *fk)
+{
+	struct keymap *cur = fk->cur;
+	error_t err;
+
+	if (!cur)
+		return 0;
+
+	err = fast_end_raw(fname, fk);
+	if (!err && fk->have_scancodes)
+		err = fast_end_scancodes(fk);
+	if (err)
+		return err;
+
+	// the checks of parse_toml_protocol()
+	if (!cur->protocol)
+		return KEYMAP_FALLBACK;
+	if (!strcmp(cur->protocol, "raw") != !!cur->raw)
+		return KEYMAP_FALLBACK;
+
+	// the same order as parse_toml_keymap() gives
+	fk->cur = NULL;
+	if (!fk->map) {
+		fk->map = cur;
+	} else {
+		cur->next = fk->map->next;
+		fk->map->next = cur;
+	}
+	return 0;
+}
+
+static error_t fast_keyval(struct fast_keymap *fk, char *key, char *value)
+{
+	struct keymap *cur = fk->cur;
+	struct scancode_entry *se;
+	struct protocol_param *param;
+	char **field = NULL;
+	int64_t ival;
+
+	if (!cur)
+		return KEYMAP_FALLBACK;
+
+	if (fk->in_raw) {
+		if (!fast_add_key(fk, key))
+			return KEYMAP_FALLBACK;
+		if (!strcmp(key, "keycode"))
+			fk->raw_keycode = value;
+		else if (!strcmp(key, "raw"))
+			fk->raw_str = value;
+		return 0;
+	}
+
+	if (fk->next_se) {
+		if (fk->nscancodes == fk->scancodes_size) {
+			const char **p;
+
+			fk->scancodes_size = fk->scancodes_size * 2 + 64;
+			p = realloc(fk->scancodes,
+				    fk->scancodes_size * sizeof(*p));
+			if (!p)
+				return ENOMEM;
+			fk->scancodes = p;
+		}
+		fk->scancodes[fk->nscancodes++] = key;
+
+		se = calloc(1, sizeof(*se));
+		if (!se)
+			return ENOMEM;
+		if (toml_rtos(value, &se->keycode)) {
+			free(se);
+			return KEYMAP_FALLBACK;
+		}
+		se->scancode = strtoull(key, NULL, 0);
+		*fk->next_se = se;
+		fk->next_se = &se->next;
+		return 0;
+	}
+
+	if (!fast_add_key(fk, key) ||
+	    !strcmp(key, "raw") || !strcmp(key, "scancodes"))
+		return KEYMAP_FALLBACK;
+
+	if (!strcmp(key, "protocol"))
+		field = &cur->protocol;
+	else if (!strcmp(key, "variant"))
+		field = &cur->variant;
+	else if (!strcmp(key, "name"))
+		field = &cur->name;
+
+	if (field)
+		return toml_rtos(value, field) ? KEYMAP_FALLBACK : 0;
+
+	if (toml_rtoi(value, &ival)) {
+		// other strings and booleans are ignored, like the full
+		// parser does
+		if (*value == '"' || *value == '\'' ||
+		    !strcmp(value, "true") || !strcmp(value, "false"))
+			return 0;
+		return KEYMAP_FALLBACK;
+	}
+
+	param = malloc(sizeof(*param));
+	if (!param)
+		return ENOMEM;
+	param->name = strdup(key);
+	param->value = ival;
+	param->next = cur->param;
+	cur->param = param;
+	return 0;
+}
+
+static error_t fast_line(const char *fname, struct fast_keymap *fk, char *p)
+{
+	char *key, *value, *q;
+	error_t err;
+
+	p = skip_space(p);
+	if (fast_end_of_line(p))
+		return 0;
+
+	if (*p == '[') {
+		q = p + strcspn(p, " \t#");
+		if (!fast_end_of_line(q))
+			return KEYMAP_FALLBACK;
+		*q = 0;
+
+		if (!strcmp(p, "[[protocols]]")) {
+			err = fast_end_protocol(fname, fk);
+			if (err)
+				return err;
+			fk->cur = calloc(1, sizeof(*fk->cur));
+			if (!fk->cur)
+				return ENOMEM;
+			fk->nkeys = 0;
+			fk->have_scancodes = false;
+			fk->next_se = NULL;
+			return 0;
+		}
+
+		if (!fk->cur)
+			return KEYMAP_FALLBACK;
+
+		err = fast_end_raw(fname, fk);
+		if (err)
+			return err;
+
+		if (!strcmp(p, "[protocols.scancodes]")) {
+			if (fk->have_scancodes)
+				return KEYMAP_FALLBACK;
+			fk->have_scancodes = true;
+			fk->next_se = &fk->cur->scancode;
+			return 0;
+		}
+
+		if (!strcmp(p, "[[protocols.raw]]")) {
+			if (fk->next_se) {
+				err = fast_end_scancodes(fk);
+				if (err)
+					return err;
+				fk->next_se = NULL;
+			}
+			fk->in_raw = true;
+			fk->raw_keycode = NULL;
+			fk->raw_str = NULL;
+			fk->nkeys = 0;
+			return 0;
+		}
+
+		return KEYMAP_FALLBACK;
+	}
+
+	// bare key
+	key = p;
+	while ((*p >= 'a' && *p <= 'z') || (*p >= 'A' && *p <= 'Z') ||
+	       (*p >= '0' && *p <= '9') || *p == '_' || *p == '-')
+		p++;
+	if (p == key)
+		return KEYMAP_FALLBACK;
+	q = p;
+	p = skip_space(p);
+	if (*p != '=')
+		return KEYMAP_FALLBACK;
+	*q = 0;
+	p = skip_space(p + 1);
+
+	// single line value
+	value = p;
+	if (*p == '"') {
+		if (p[1] == '"' && p[2] == '"')
+			return KEYMAP_FALLBACK;
+		for (p++; *p != '"'; p++) {
+			if (*p == 0)
+				return KEYMAP_FALLBACK;
+			if (*p == '\\' && *++p == 0)
+				return KEYMAP_FALLBACK;
+		}
+		p++;
+	} else if (*p == '\'') {
+		if (p[1] == '\'' && p[2] == '\'')
+			return KEYMAP_FALLBACK;
+		p = strchr(p + 1, '\'');
+		if (!p)
+			return KEYMAP_FALLBACK;
+		p++;
+	} else {
+		p += strcspn(p, " \t#");
+		if (p == value || *value == '[' || *value == '{')
+			return KEYMAP_FALLBACK;
+	}
+
+	if (!fast_end_of_line(p))
+		return KEYMAP_FALLBACK;
+	*p = 0;
+
+	return fast_keyval(fk, key, value);
+}
+
+static error_t parse_toml_keymap_fast(const char *fname, char *buf, struct keymap **keymap)
+{
+	struct fast_keymap fk = {};
+	error_t err = 0;
+	char *p, *e;
+
+	for (p = buf; *p && !err; p = e) {
+		e = strchr(p, '\n');
+		if (e)
+			*e++ = 0;
+		else
+			e = p + strlen(p);
+		if (e - p >= 2 && e[-2] == '\r')
+			e[-2] = 0;
+		err = fast_line(fname, &fk, p);
+	}
+
+	if (!err)
+		err = fast_end_protocol(fname, &fk);
+	if (!err && !fk.map)
+		err = KEYMAP_FALLBACK;
+
+	free(fk.scancodes);
+	if (err) {
+		free_keymap(fk.cur);
+		free_keymap(fk.map);
+		return err;
+	}
+
+	*keymap = fk.map;
+	return 0;
+}
+
+static char *read_keymap_file(FILE *fin)
+{
+	size_t size = 0, len = 0, n;
+	char *buf = NULL, *p;
+
+	do {
+		if (len + 1 >= size) {
+			size = size * 2 + 4096;
+			p = realloc(buf, size);
+			if (!p) {
+				free(buf);
+				return NULL;
+			}
+			buf = p;
+		}
+		n = fread(buf + len, 1, size - len - 1, fin);
+		len += n;
+	} while (n);
+
+	if (ferror(fin)) {
+		free(buf);
+		return NULL;
+	}
+	buf[len] = 0;
+
+	// the full parser would stop at a NUL byte
+	if (strlen(buf) != len) {
+		free(buf);
+		return NULL;
+	}
+
+	return buf;
+}
+
 static error_t parse_toml_keymap(char *fname, struct keymap **keymap, bool verbose)
 {
 	struct toml_table_t *root, *proot;
@@ -473,6 +866,21 @@ static error_t parse_toml_keymap(char *fname, struct keymap **keymap, bool verbo
 		return EINVAL;
 	}
 
+	// The verbose messages are only given by the full parser
+	if (!verbose) {
+		char *contents = read_keymap_file(fin);
+
+		if (contents) {
+			ret = parse_toml_keymap_fast(fname, contents, keymap);
+			free(contents);
+			if (ret != KEYMAP_FALLBACK) {
+				fclose(fin);
+				return ret;
+			}
+		}
+		rewind(fin);
+	}
+
 	root = toml_parse_file(fin, buf, sizeof(buf));
 	fclose(fin);
 	if (!root) {
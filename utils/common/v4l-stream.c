@@ -8,6 +8,14 @@
 #include <stdlib.h>
 #include <string.h>
 #include <netinet/in.h>
+#include <config.h>
+#include <cpu-features.h>
+#ifdef CPU_BUILD_SSE
+#include <emmintrin.h>
+#endif
+#if defined(CPU_BUILD_NEON) && defined(__aarch64__)
+#include <arm_neon.h>
+#endif
 
 #include "v4l-stream.h"
 #include "codec-fwht.h"
@@ -108,74 +116,264 @@ void rle_decompress(__u8 *b, unsigned size, unsigned rle_size, unsigned bpl)
 	}
 }
 
-unsigned rle_compress(__u8 *b, unsigned size, unsigned bpl)
+/* Returns the number of words, at most max, starting at p that equal *p */
+static inline unsigned c_rle_run_length(const __u32 *p, unsigned max)
+{
+	unsigned n = 1;
+
+	while (n < max && p[n] == *p)
+		n++;
+	return n;
+}
+
+/*
+ * Copies p[0-3] to dst if none of them is a magic word or starts a run,
+ * which is the case if no word equals the next one. p[4] must be readable.
+ */
+static inline bool c_rle_copy_literals(const __u32 *p, __u32 *dst,
+				       __u32 magic_x, __u32 magic_y)
+{
+	return false;
+}
+
+#ifdef CPU_BUILD_SSE
+
+__attribute__((target("sse2")))
+static inline unsigned sse2_rle_run_length(const __u32 *p, unsigned max)
+{
+	__m128i v = _mm_set1_epi32(*p);
+	unsigned n = 1;
+
+	for (; n + 4 <= max; n += 4) {
+		__m128i w = _mm_loadu_si128((const __m128i *)(p + n));
+		unsigned mask = _mm_movemask_epi8(_mm_cmpeq_epi32(v, w));
+
+		if (mask != 0xffff)
+			return n + __builtin_ctz(~mask) / 4;
+	}
+	while (n < max && p[n] == *p)
+		n++;
+	return n;
+}
+
+__attribute__((target("sse2")))
+static inline bool sse2_rle_copy_literals(const __u32 *p, __u32 *dst,
+					  __u32 magic_x, __u32 magic_y)
+{
+	__m128i w = _mm_loadu_si128((const __m128i *)p);
+	__m128i next = _mm_loadu_si128((const __m128i *)(p + 1));
+	__m128i eq = _mm_or_si128(_mm_cmpeq_epi32(w, next),
+				  _mm_or_si128(_mm_cmpeq_epi32(w, _mm_set1_epi32(magic_x)),
+					       _mm_cmpeq_epi32(w, _mm_set1_epi32(magic_y))));
+
+	if (_mm_movemask_epi8(eq))
+		return false;
+	_mm_storeu_si128((__m128i *)dst, w);
+	return true;
+}
+
+#endif
+
+#if defined(CPU_BUILD_NEON) && defined(__aarch64__)
+
+static inline unsigned neon_rle_run_length(const __u32 *p, unsigned max)
+{
+	uint32x4_t v = vdupq_n_u32(*p);
+	unsigned n = 1;
+
+	for (; n + 4 <= max; n += 4) {
+		uint32x4_t eq = vceqq_u32(v, vld1q_u32(p + n));
+
+		if (vminvq_u32(eq) == 0)
+			break;
+	}
+	while (n < max && p[n] == *p)
+		n++;
+	return n;
+}
+
+static inline bool neon_rle_copy_literals(const __u32 *p, __u32 *dst,
+					  __u32 magic_x, __u32 magic_y)
+{
+	uint32x4_t w = vld1q_u32(p);
+	uint32x4_t eq = vorrq_u32(vceqq_u32(w, vld1q_u32(p + 1)),
+				  vorrq_u32(vceqq_u32(w, vdupq_n_u32(magic_x)),
+					    vceqq_u32(w, vdupq_n_u32(magic_y))));
+
+	if (vmaxvq_u32(eq))
+		return false;
+	vst1q_u32(dst, w);
+	return true;
+}
+
+#endif
+
+/*
+ * The band loop, inlined into each variant with its helpers so these are
+ * inlined as well.
+ */
+__attribute__((always_inline))
+static inline unsigned rle_compress_band_tmpl(const __u8 *src, __u8 *dst,
+		unsigned size, unsigned bpl,
+		unsigned (*rle_run_length)(const __u32 *p, unsigned max),
+		bool (*rle_copy_literals)(const __u32 *p, __u32 *dst,
+					  __u32 magic_x, __u32 magic_y))
 {
 	__u32 magic_x = ntohl(V4L_STREAM_PACKET_FRAME_VIDEO_X_RLE);
 	__u32 magic_y = ntohl(V4L_STREAM_PACKET_FRAME_VIDEO_Y_RLE);
 	__u32 magic_r = ntohl(V4L_STREAM_PACKET_FRAME_VIDEO_RPLC);
-	__u32 *p = (__u32 *)b;
-	__u32 *dst = p;
-	unsigned i;
-
-	/*
-	 * Only attempt runlength encoding if b is aligned
-	 * to a multiple of 4 bytes and if size is a multiple of 4.
-	 */
-	if (((unsigned long)b & 3) || (size & 3))
-		return size;
+	const __u32 *p = (const __u32 *)src;
+	__u32 *d = (__u32 *)dst;
+	unsigned max = 0;
+	unsigned i = 0;
 
 	if (bpl & 3)
 		bpl = 0;
-	if (bpl == 0)
+	if (bpl == 0) {
 		magic_y = magic_x;
+		max = size;
+	}
 
-	for (i = 0; i < size; i += 4, p++) {
-		unsigned n, max;
+	while (i < size) {
+		unsigned n;
 
-		if (bpl && i % bpl == 0) {
+		/* max is the end of the current line */
+		if (bpl && i == max) {
 			unsigned l = 0;
 
 			while (i + (l + 2) * bpl <= size &&
 			       !memcmp(p, p + (l + 1) * (bpl / 4), bpl))
 				l++;
-			if (l) {
-				*dst++ = magic_y;
-				*dst++ = htonl(l);
-				i += l * bpl - 4;
-				p += (l * bpl / 4) - 1;
+			if (l && l * bpl >= 8) {
+				*d++ = magic_y;
+				*d++ = htonl(l);
+				i += l * bpl;
+				p += l * bpl / 4;
+				max = i;
 				continue;
 			}
+			max = i + bpl < size ? i + bpl : size;
 		}
-		if (*p == magic_x || *p == magic_y) {
-			*dst++ = magic_r;
-			continue;
-		}
-		max = bpl ? bpl * (i / bpl + 1) : size;
-		if (i >= max - 16) {
-			*dst++ = *p;
+		if (i + 20 <= max && rle_copy_literals(p, d, magic_x, magic_y)) {
+			d += 4;
+			p += 4;
+			i += 16;
 			continue;
 		}
-		if (*p != p[1] || *p != p[2] || *p != p[3]) {
-			*dst++ = *p;
-			continue;
+		if (*p == magic_x || *p == magic_y) {
+			*d++ = magic_r;
+		} else if (i + 16 >= max ||
+			   (n = rle_run_length(p, (max - i) / 4)) < 4) {
+			*d++ = *p;
+		} else {
+			*d++ = magic_x;
+			*d++ = *p;
+			*d++ = htonl(n);
+			p += n - 1;
+			i += n * 4 - 4;
 		}
-		n = 4;
-
-		while (i + n * 4 < max && *p == p[n])
-			n++;
-		*dst++ = magic_x;
-		*dst++ = p[1];
-		*dst++ = htonl(n);
-		p += n - 1;
-		i += n * 4 - 4;
+		i += 4;
+		p++;
 	}
-	return (__u8 *)dst - b;
+	return (__u8 *)d - dst;
+}
+
+struct rle_kernels {
+	unsigned (*compress_band)(const __u8 *src, __u8 *dst,
+				  unsigned size, unsigned bpl);
+};
+
+static unsigned c_rle_compress_band(const __u8 *src, __u8 *dst,
+				    unsigned size, unsigned bpl)
+{
+	return rle_compress_band_tmpl(src, dst, size, bpl, c_rle_run_length,
+				      c_rle_copy_literals);
+}
+
+static const struct rle_kernels c_rle_kernels = {
+	.compress_band = c_rle_compress_band,
+};
+
+#ifdef CPU_BUILD_SSE
+__attribute__((target("sse2")))
+static unsigned sse2_rle_compress_band(const __u8 *src, __u8 *dst,
+				       unsigned size, unsigned bpl)
+{
+	return rle_compress_band_tmpl(src, dst, size, bpl, sse2_rle_run_length,
+				      sse2_rle_copy_literals);
+}
+
+static const struct rle_kernels sse2_rle_kernels = {
+	.compress_band = sse2_rle_compress_band,
+};
+#endif
+
+#if defined(CPU_BUILD_NEON) && defined(__aarch64__)
+static unsigned neon_rle_compress_band(const __u8 *src, __u8 *dst,
+				       unsigned size, unsigned bpl)
+{
+	return rle_compress_band_tmpl(src, dst, size, bpl, neon_rle_run_length,
+				      neon_rle_copy_literals);
+}
+
+static const struct rle_kernels neon_rle_kernels = {
+	.compress_band = neon_rle_compress_band,
+};
+#endif
+
+static const struct cpu_kernel_variant rle_variants[] = {
+#ifdef CPU_BUILD_SSE
+	{ "sse2", CPU_FEATURE_SSE2, &sse2_rle_kernels },
+#endif
+#if defined(CPU_BUILD_NEON) && defined(__aarch64__)
+	{ "neon", CPU_FEATURE_NEON, &neon_rle_kernels },
+#endif
+	{ "c", 0, &c_rle_kernels },
+};
+
+/*
+ * Encode size bytes from src into dst, which must have room for size bytes
+ * as well: a line repeat is only used if it is not longer than the lines it
+ * replaces, so the result is never larger than the input. Both buffers must
+ * be aligned to 4 bytes, size must be a multiple of 4.
+ *
+ * Since nothing is carried over from one line to the next, a frame can be
+ * split in bands that start at a line boundary and these bands compressed
+ * independently. Concatenated the results are identical to compressing the
+ * frame as a whole, except for line repeats crossing the band boundaries.
+ */
+unsigned rle_compress_band(const __u8 *src, __u8 *dst, unsigned size, unsigned bpl)
+{
+	static const void *kernels;
+	const struct rle_kernels *k =
+		cpu_select_kernels_cached(&kernels, rle_variants);
+
+	return k->compress_band(src, dst, size, bpl);
+}
+
+/*
+ * Returns the size of the compressed data in dst, or size if the data could
+ * not be compressed, in which case src should be sent as is.
+ */
+unsigned rle_compress(const __u8 *src, __u8 *dst, unsigned size, unsigned bpl)
+{
+	unsigned comp_size;
+
+	/*
+	 * Only attempt runlength encoding if the buffers are aligned
+	 * to a multiple of 4 bytes and if size is a multiple of 4.
+	 */
+	if (((unsigned long)src & 3) || ((unsigned long)dst & 3) || (size & 3))
+		return size;
+
+	comp_size = rle_compress_band(src, dst, size, bpl);
+	return comp_size < size ? comp_size : size;
 }
 
 struct codec_ctx *fwht_alloc(unsigned pixfmt, unsigned visible_width, unsigned visible_height,
 			     unsigned coded_width, unsigned coded_height,
 			     unsigned field, unsigned colorspace, unsigned xfer_func,
-			     unsigned ycbcr_enc, unsigned quantization)
+			     unsigned ycbcr_enc, unsigned quantization, unsigned max_slices)
 {
 	struct codec_ctx *ctx;
 	const struct v4l2_fwht_pixfmt_info *info = v4l2_fwht_find_pixfmt(pixfmt);
@@ -209,13 +407,23 @@ struct codec_ctx *fwht_alloc(unsigned pixfmt, unsigned visible_width, unsigned v
 		ctx->size = 2 * size + 2 * (size / chroma_div);
 	else if (info->components_num == 3)
 		ctx->size = size + 2 * (size / chroma_div);
-	ctx->state.ref_frame.buf = malloc(ctx->size);
-	ctx->state.ref_frame.luma = ctx->state.ref_frame.buf;
-	ctx->comp_max_size = ctx->size + sizeof(struct fwht_cframe_hdr);
+	ctx->ref_buf = malloc(ctx->size);
+	ctx->state.ref_frame.buf = ctx->ref_buf;
+	ctx->state.ref_frame.luma = ctx->ref_buf;
+	/* Room for the largest slice table a sender may use */
+	ctx->comp_max_size = ctx->size + sizeof(struct fwht_cframe_hdr) +
+		V4L_STREAM_FWHT_SLICE_TABLE_SIZE(4 * V4L_STREAM_FWHT_MAX_SLICES);
 	ctx->state.compressed_frame = malloc(ctx->comp_max_size);
-	if (!ctx->state.ref_frame.luma || !ctx->state.compressed_frame) {
-		free(ctx->state.ref_frame.luma);
+	if (max_slices > V4L_STREAM_FWHT_MAX_SLICES)
+		max_slices = V4L_STREAM_FWHT_MAX_SLICES;
+	ctx->max_slices = max_slices > 1 ? max_slices : 0;
+	ctx->slices = ctx->max_slices ?
+		malloc(4 * ctx->max_slices * sizeof(*ctx->slices)) : NULL;
+	if (!ctx->ref_buf || !ctx->state.compressed_frame ||
+	    (ctx->max_slices && !ctx->slices)) {
+		free(ctx->ref_buf);
 		free(ctx->state.compressed_frame);
+		free(ctx->slices);
 		free(ctx);
 		return NULL;
 	}
@@ -233,14 +441,22 @@ struct codec_ctx *fwht_alloc(unsigned pixfmt, unsigned visible_width, unsigned v
 	else
 		ctx->state.ref_frame.alpha = NULL;
 	ctx->state.gop_size = 10;
+	ctx->state.speed = FWHT_SPEED_DEFAULT;
 	ctx->state.gop_cnt = 0;
+	ctx->num_planes = 0;
+	ctx->num_slices = 0;
+	ctx->slice_rows = 0;
+	ctx->slice_buf = NULL;
+	ctx->slice_buf_size = 0;
 	return ctx;
 }
 
 void fwht_free(struct codec_ctx *ctx)
 {
-	free(ctx->state.ref_frame.luma);
+	free(ctx->ref_buf);
 	free(ctx->state.compressed_frame);
+	free(ctx->slices);
+	free(ctx->slice_buf);
 	free(ctx);
 }
 
@@ -251,11 +467,268 @@ __u8 *fwht_compress(struct codec_ctx *ctx, __u8 *buf, unsigned uncomp_size, unsi
 	return ctx->state.compressed_frame;
 }
 
-static void copy_cap_to_ref(const u8 *cap, const struct v4l2_fwht_pixfmt_info *info,
+/*
+ * Compressing a frame in slices, so the slices can be compressed in
+ * parallel: fwht_compress_slices() splits the planes of the frame in
+ * slices of whole block rows and returns the number of slices, or 0 if
+ * the context wasn't allocated for more than one slice. Each of them is
+ * then compressed by a call to fwht_compress_slice(), these calls may run
+ * concurrently. Finally fwht_compress_finish() puts the compressed frame
+ * together in out, which must be at least comp_max_size bytes large, and
+ * returns its size.
+ *
+ * The frame has FWHT_FL_SLICES set and starts with the slice table, so the
+ * receiver can decode the slices independently as well. The reference
+ * frame is updated by each slice for its own block rows. If a slice can't
+ * be compressed, the whole plane is sent uncompressed.
+ */
+
+/* Don't split planes in slices smaller than this many pixels */
+#define FWHT_MIN_SLICE_SIZE	16384
+
+static void fwht_add_plane(struct codec_ctx *ctx, u8 *input, u8 *ref,
+			   unsigned width, unsigned height,
+			   unsigned stride, unsigned step)
+{
+	struct fwht_slice_plane *plane = &ctx->planes[ctx->num_planes++];
+	unsigned block_width = (width + 7) / 8 * 8;
+	unsigned block_rows = (height + 7) / 8;
+	unsigned rows = ctx->slice_rows;
+	unsigned i;
+
+	plane->input = input;
+	plane->width = width;
+	plane->height = height;
+	plane->stride = stride;
+	plane->step = step;
+	plane->first_slice = ctx->num_slices;
+	plane->num_slices = 0;
+
+	for (i = 0; i < block_rows; i += rows) {
+		struct fwht_slice *slice = &ctx->slices[ctx->num_slices++];
+
+		memset(slice, 0, sizeof(*slice));
+		slice->frame.components_num = 1;
+		slice->frame.luma_alpha_step = step;
+		slice->frame.luma = input + i * 8 * stride;
+		slice->ref.luma = ref + i * 8 * block_width;
+		slice->width = width;
+		slice->height = (i + rows < block_rows ? rows : block_rows - i) * 8;
+		slice->stride = stride;
+		/* Room for the data if the slice turns out to be uncompressible */
+		slice->size = block_width * slice->height + 512;
+		plane->num_slices++;
+	}
+}
+
+unsigned fwht_compress_slices(struct codec_ctx *ctx, __u8 *buf, unsigned size)
+{
+	struct v4l2_fwht_state *state = &ctx->state;
+	const struct v4l2_fwht_pixfmt_info *info = state->info;
+	struct fwht_raw_frame *rf = &ctx->raw;
+	unsigned chroma_stride = state->stride;
+	unsigned block_rows = (state->visible_height + 7) / 8;
+	unsigned buf_size = 0;
+	unsigned slices;
+	unsigned i;
+
+	if (!ctx->max_slices)
+		return 0;
+	if (prepare_raw_frame(rf, info, buf, state->stride * state->coded_height))
+		return 0;
+	if (info->planes_num == 3)
+		chroma_stride /= 2;
+	if (info->id == V4L2_PIX_FMT_NV24 ||
+	    info->id == V4L2_PIX_FMT_NV42)
+		chroma_stride *= 2;
+
+	/* The luma plane decides the number of block rows in all slices */
+	slices = block_rows * 8 * ((state->visible_width + 7) / 8 * 8) /
+		 FWHT_MIN_SLICE_SIZE;
+	if (slices > ctx->max_slices)
+		slices = ctx->max_slices;
+	if (slices < 1)
+		slices = 1;
+	ctx->slice_rows = (block_rows + slices - 1) / slices;
+
+	ctx->num_planes = 0;
+	ctx->num_slices = 0;
+	fwht_add_plane(ctx, rf->luma, state->ref_frame.luma,
+		       state->visible_width, state->visible_height,
+		       state->stride, rf->luma_alpha_step);
+	if (rf->components_num >= 3) {
+		unsigned chroma_w = state->visible_width / rf->width_div;
+		unsigned chroma_h = state->visible_height / rf->height_div;
+
+		fwht_add_plane(ctx, rf->cb, state->ref_frame.cb, chroma_w, chroma_h,
+			       chroma_stride, rf->chroma_step);
+		fwht_add_plane(ctx, rf->cr, state->ref_frame.cr, chroma_w, chroma_h,
+			       chroma_stride, rf->chroma_step);
+	}
+	if (rf->components_num == 4)
+		fwht_add_plane(ctx, rf->alpha, state->ref_frame.alpha,
+			       state->visible_width, state->visible_height,
+			       state->stride, rf->luma_alpha_step);
+
+	for (i = 0; i < ctx->num_slices; i++)
+		buf_size += ctx->slices[i].size;
+	if (buf_size > ctx->slice_buf_size) {
+		free(ctx->slice_buf);
+		ctx->slice_buf_size = 0;
+		ctx->slice_buf = malloc(buf_size);
+		if (!ctx->slice_buf)
+			return 0;
+		ctx->slice_buf_size = buf_size;
+	}
+	buf_size = 0;
+	for (i = 0; i < ctx->num_slices; i++) {
+		ctx->slices[i].buf = ctx->slice_buf + buf_size;
+		buf_size += ctx->slices[i].size;
+	}
+
+	state->i_frame_qp = state->p_frame_qp = 20;
+	ctx->is_intra = !state->gop_cnt;
+	ctx->next_is_intra = state->gop_cnt == state->gop_size - 1;
+	return ctx->num_slices;
+}
+
+void fwht_compress_slice(struct codec_ctx *ctx, unsigned idx)
+{
+	struct fwht_slice *slice = &ctx->slices[idx];
+	struct fwht_cframe cf;
+
+	cf.i_frame_qp = ctx->state.i_frame_qp;
+	cf.p_frame_qp = ctx->state.p_frame_qp;
+	cf.speed = ctx->state.speed;
+	cf.rlc_data = (__be16 *)slice->buf;
+	slice->encoding = fwht_encode_frame(&slice->frame, &slice->ref, &cf,
+					    ctx->is_intra, ctx->next_is_intra,
+					    slice->width, slice->height,
+					    slice->stride, slice->stride);
+	slice->size = cf.size;
+}
+
+/*
+ * Returns the size of the compressed plane at out, or 0 if it has to be
+ * sent uncompressed. *encoding is updated with FWHT_FRAME_PCODED and the
+ * slice offsets, starting at offset, are filled in.
+ */
+static unsigned fwht_finish_plane(struct codec_ctx *ctx,
+				  const struct fwht_slice_plane *plane,
+				  u8 *out, unsigned offset, __be32 *offsets,
+				  u32 *encoding)
+{
+	/* The limit used by fwht_encode_frame() for the plane as a whole */
+	long max_size = 2 * ((long)(plane->width * plane->height / 2) - 256);
+	u32 plane_encoding = 0;
+	unsigned size = 0;
+	unsigned i;
+
+	for (i = plane->first_slice; i < plane->first_slice + plane->num_slices; i++) {
+		const struct fwht_slice *slice = &ctx->slices[i];
+
+		if ((slice->encoding & FWHT_LUMA_UNENCODED) ||
+		    (long)(size + slice->size) >= max_size)
+			return 0;
+		offsets[i] = htonl(offset + size);
+		memcpy(out + size, slice->buf, slice->size);
+		size += slice->size;
+		plane_encoding |= slice->encoding;
+	}
+	*encoding |= plane_encoding & FWHT_FRAME_PCODED;
+	return size;
+}
+
+/* As done by encode_plane() */
+static unsigned fwht_copy_plane(const struct fwht_slice_plane *plane, u8 *out)
+{
+	unsigned width = (plane->width + 7) / 8 * 8;
+	unsigned height = (plane->height + 7) / 8 * 8;
+	const u8 *input = plane->input;
+	unsigned i, j;
+
+	for (j = 0; j < height; j++) {
+		const u8 *p = input;
+
+		for (i = 0; i < width; i++, p += plane->step)
+			*out++ = (*p == 0xff) ? 0xfe : *p;
+		input += plane->stride;
+	}
+	return width * height;
+}
+
+unsigned fwht_compress_finish(struct codec_ctx *ctx, __u8 *out)
+{
+	static const u32 unencoded[4] = {
+		FWHT_FL_LUMA_IS_UNCOMPRESSED,
+		FWHT_FL_CB_IS_UNCOMPRESSED,
+		FWHT_FL_CR_IS_UNCOMPRESSED,
+		FWHT_FL_ALPHA_IS_UNCOMPRESSED,
+	};
+	struct v4l2_fwht_state *state = &ctx->state;
+	const struct v4l2_fwht_pixfmt_info *info = state->info;
+	struct fwht_cframe_hdr *p_hdr = (struct fwht_cframe_hdr *)out;
+	__be32 *table = (__be32 *)(out + sizeof(*p_hdr));
+	__be32 *offsets = table + 2;
+	u8 *data = (u8 *)(offsets + ctx->num_slices);
+	u8 *p = data;
+	u32 encoding = 0;
+	u32 flags = FWHT_FL_SLICES;
+	unsigned i, j;
+
+	table[0] = htonl(ctx->slice_rows);
+	table[1] = htonl(ctx->num_slices);
+	for (i = 0; i < ctx->num_planes; i++) {
+		const struct fwht_slice_plane *plane = &ctx->planes[i];
+		unsigned size = fwht_finish_plane(ctx, plane, p, p - data,
+						  offsets, &encoding);
+
+		if (!size) {
+			/* The uncompressed slices are just the plane rows */
+			unsigned slice_size = ctx->slice_rows * 8 *
+					      ((plane->width + 7) / 8 * 8);
+
+			size = fwht_copy_plane(plane, p);
+			flags |= unencoded[i];
+			for (j = 0; j < plane->num_slices; j++)
+				offsets[plane->first_slice + j] =
+					htonl(p - data + j * slice_size);
+		}
+		p += size;
+	}
+
+	if (!(encoding & FWHT_FRAME_PCODED))
+		state->gop_cnt = 0;
+	if (++state->gop_cnt >= state->gop_size)
+		state->gop_cnt = 0;
+
+	p_hdr->magic1 = FWHT_MAGIC1;
+	p_hdr->magic2 = FWHT_MAGIC2;
+	p_hdr->version = htonl(FWHT_VERSION);
+	p_hdr->width = htonl(state->visible_width);
+	p_hdr->height = htonl(state->visible_height);
+	flags |= (info->components_num - 1) << FWHT_FL_COMPONENTS_NUM_OFFSET;
+	flags |= info->pixenc;
+	if (!(encoding & FWHT_FRAME_PCODED))
+		flags |= FWHT_FL_I_FRAME;
+	if (ctx->raw.height_div == 1)
+		flags |= FWHT_FL_CHROMA_FULL_HEIGHT;
+	if (ctx->raw.width_div == 1)
+		flags |= FWHT_FL_CHROMA_FULL_WIDTH;
+	p_hdr->flags = htonl(flags);
+	p_hdr->colorspace = htonl(state->colorspace);
+	p_hdr->xfer_func = htonl(state->xfer_func);
+	p_hdr->ycbcr_enc = htonl(state->ycbcr_enc);
+	p_hdr->quantization = htonl(state->quantization);
+	p_hdr->size = htonl(p - out - sizeof(*p_hdr));
+	return p - out;
+}
+
+static void copy_cap_to_ref(const u8 *cap, u8 *p_ref,
+			    const struct v4l2_fwht_pixfmt_info *info,
 			    struct v4l2_fwht_state *state)
 {
 	int plane_idx;
-	u8 *p_ref = state->ref_frame.buf;
 	unsigned int cap_stride = state->stride;
 	unsigned int ref_stride = state->ref_stride;
 
@@ -295,6 +768,160 @@ bool fwht_decompress(struct codec_ctx *ctx, __u8 *p_in, unsigned comp_size,
 	p_in += sizeof(ctx->state.header);
 	if (v4l2_fwht_decode(&ctx->state, p_in, p_out))
 		return false;
-	copy_cap_to_ref(p_out, ctx->state.info, &ctx->state);
+	copy_cap_to_ref(p_out, ctx->ref_buf, ctx->state.info, &ctx->state);
+	ctx->state.ref_frame.buf = ctx->ref_buf;
 	return true;
 }
+
+/*
+ * Like fwht_decompress(), but instead of copying the decoded frame into
+ * the reference frame buffer, p_out itself becomes the reference frame of
+ * the next frame. So p_out must not be changed until the next frame has
+ * been decoded, typically by decoding into a ring of at least two buffers,
+ * or always into the same buffer since a frame can be decoded in place.
+ * The reference frame and the output frame have the same layout since
+ * bytesperline_mult and luma_alpha_step are the same for all formats.
+ *
+ * Call fwht_release_ref() before freeing or reusing the last p_out for
+ * something else.
+ */
+bool fwht_decompress_ref(struct codec_ctx *ctx, __u8 *p_in, unsigned comp_size,
+			 __u8 *p_out, unsigned uncomp_size)
+{
+	memcpy(&ctx->state.header, p_in, sizeof(ctx->state.header));
+	p_in += sizeof(ctx->state.header);
+	if (v4l2_fwht_decode(&ctx->state, p_in, p_out))
+		return false;
+	ctx->state.ref_frame.buf = p_out;
+	return true;
+}
+
+/*
+ * Set up planes for the coefficients of a frame in buf, as decoded by
+ * fwht_decompress_coeffs(). Returns the number of planes. If buf is NULL
+ * only the sizes are set, *size is set to the size of the buffer needed.
+ */
+unsigned fwht_coeff_planes(const struct codec_ctx *ctx, __u8 *buf,
+			   struct fwht_coeff_plane planes[4], unsigned *size)
+{
+	const struct v4l2_fwht_pixfmt_info *info = ctx->state.info;
+	unsigned num = info->components_num >= 3 ? info->components_num : 1;
+	unsigned coeffs = 0, blocks = 0;
+	__u8 *block_buf;
+	unsigned p;
+
+	for (p = 0; p < num; p++) {
+		struct fwht_coeff_plane *plane = &planes[p];
+		bool chroma = p == 1 || p == 2;
+
+		plane->width = ctx->state.visible_width /
+			       (chroma ? info->width_div : 1);
+		plane->height = ctx->state.visible_height /
+				(chroma ? info->height_div : 1);
+		plane->stride = (plane->width + 7) / 8 * 8;
+		coeffs += plane->stride * ((plane->height + 7) / 8 * 8);
+	}
+	/* All coefficients first, so they stay aligned */
+	block_buf = buf ? buf + coeffs * sizeof(s16) : NULL;
+	for (p = 0; p < num; p++) {
+		struct fwht_coeff_plane *plane = &planes[p];
+		unsigned rows = (plane->height + 7) / 8 * 8;
+
+		plane->coeffs = (s16 *)buf;
+		plane->blocks = block_buf;
+		if (buf) {
+			buf += plane->stride * rows * sizeof(s16);
+			block_buf += plane->stride / 8 * (rows / 8);
+		}
+		blocks += plane->stride / 8 * (rows / 8);
+	}
+	*size = coeffs * sizeof(s16) + blocks;
+	return num;
+}
+
+/*
+ * Like fwht_decompress(), but only do the entropy decoding: p_out gets the
+ * coefficients of the frame as set up by fwht_coeff_planes(), the inverse
+ * transform is left to the caller. The reference frame is not updated,
+ * the caller has to keep it.
+ */
+bool fwht_decompress_coeffs(struct codec_ctx *ctx, __u8 *p_in, unsigned comp_size,
+			    __u8 *p_out, unsigned size)
+{
+	struct fwht_coeff_plane planes[4];
+	unsigned needed;
+
+	fwht_coeff_planes(ctx, p_out, planes, &needed);
+	if (size < needed)
+		return false;
+	memcpy(&ctx->state.header, p_in, sizeof(ctx->state.header));
+	p_in += sizeof(ctx->state.header);
+	return !v4l2_fwht_decode_coeffs(&ctx->state, p_in, planes);
+}
+
+/* Copy the reference frame back into the buffer owned by the context */
+void fwht_release_ref(struct codec_ctx *ctx)
+{
+	if (ctx->state.ref_frame.buf == ctx->ref_buf)
+		return;
+	copy_cap_to_ref(ctx->state.ref_frame.buf, ctx->ref_buf,
+			ctx->state.info, &ctx->state);
+	ctx->state.ref_frame.buf = ctx->ref_buf;
+}
+
+/*
+ * Add a datagram of a UDP stream. Returns 1 when it completes a packet,
+ * which is then in rx->buf with size rx->size, 0 if it doesn't and -1 if
+ * it isn't a valid datagram. Datagrams are expected in order, a packet of
+ * which a datagram is missing or out of order is dropped and rx->lost set.
+ */
+int udp_rx_datagram(struct udp_rx *rx, const __u8 *dgram, unsigned len)
+{
+	const __u32 *hdr = (const __u32 *)dgram;
+	__u32 seq, size, offset;
+
+	if (len < V4L_STREAM_UDP_HDR_SIZE || ntohl(hdr[0]) != V4L_STREAM_UDP_ID)
+		return -1;
+	seq = ntohl(hdr[1]);
+	size = ntohl(hdr[2]);
+	offset = ntohl(hdr[3]);
+	dgram += V4L_STREAM_UDP_HDR_SIZE;
+	len -= V4L_STREAM_UDP_HDR_SIZE;
+	if (size > V4L_STREAM_UDP_MAX_PACKET || offset > size || len > size - offset)
+		return -1;
+
+	if (!offset) {
+		if (rx->receiving || (rx->have_seq && seq != rx->seq + 1))
+			rx->lost = true;
+		if (size > rx->alloc) {
+			__u8 *buf = realloc(rx->buf, size);
+
+			if (!buf)
+				return -1;
+			rx->buf = buf;
+			rx->alloc = size;
+		}
+		rx->seq = seq;
+		rx->size = size;
+		rx->received = 0;
+		rx->receiving = true;
+		rx->have_seq = true;
+	} else if (!rx->receiving || seq != rx->seq || offset != rx->received) {
+		if (rx->receiving)
+			rx->lost = true;
+		rx->receiving = false;
+		return 0;
+	}
+	memcpy(rx->buf + offset, dgram, len);
+	rx->received += len;
+	if (rx->received < rx->size)
+		return 0;
+	rx->receiving = false;
+	return 1;
+}
+
+void udp_rx_free(struct udp_rx *rx)
+{
+	free(rx->buf);
+	memset(rx, 0, sizeof(*rx));
+}
@@ -124,11 +124,17 @@ extern "C" {
  * FWHT-compression desciption:
  *
  * The compressed encoding is simple but good enough for debugging.
- * The size value is always <= bytesused + sizeof(struct fwht_cframe_hdr).
+ * The size value is always <= bytesused + sizeof(struct fwht_cframe_hdr),
+ * plus the size of the slice table if FWHT_FL_SLICES is set. Frames are
+ * split in at most V4L_STREAM_FWHT_MAX_SLICES slices per plane.
  *
  * See codec-fwht.h for more information about the compression
  * details.
  */
+#define V4L_STREAM_FWHT_MAX_SLICES	16
+
+/* The size of the slice table of FWHT_FL_SLICES frames */
+#define V4L_STREAM_FWHT_SLICE_TABLE_SIZE(slices)	(4 * (2 + (slices)))
 
 /*
  * This packet ends the stream and, after reading this, the socket can be closed
@@ -136,25 +142,118 @@ extern "C" {
  */
 #define V4L_STREAM_PACKET_END				v4l2_fourcc('e', 'n', 'd', ' ')
 
+/*
+ * Instead of over a TCP connection the stream can be sent in UDP datagrams,
+ * e.g. to a multicast group. There is no stream ID and version, the packets
+ * are those of V4L_STREAM_VERSION. The FMT_VIDEO packet is repeated before
+ * every I-frame, so receivers can join at any time.
+ *
+ * Each packet (packet ID, size and content) is split in datagrams of at
+ * most V4L_STREAM_UDP_MAX_SIZE bytes, sent in order. Each datagram starts
+ * with this header:
+ *
+ * uint32_t id;		// V4L_STREAM_UDP_ID
+ * uint32_t seq;	// sequence number of the packet, incremented per packet
+ * uint32_t size;	// size in bytes of the whole packet
+ * uint32_t offset;	// offset in bytes of the data of this datagram in the packet
+ *
+ * A receiver drops a packet if one of its datagrams got lost. After losing
+ * an FWHT frame it has to skip the frames up to the next I-frame.
+ */
+#define V4L_STREAM_UDP_ID				v4l2_fourcc('V', '4', 'L', 'u')
+#define V4L_STREAM_UDP_HDR_SIZE				(4 * 4)
+/* Fits an ethernet MTU of 1500 bytes without IP fragmentation */
+#define V4L_STREAM_UDP_MAX_SIZE				1472
+#define V4L_STREAM_UDP_MAX_PACKET			(256 * 1024 * 1024)
+
+/* One plane of a frame that is compressed in slices */
+struct fwht_slice_plane {
+	u8			*input;
+	unsigned int		width;
+	unsigned int		height;
+	unsigned int		stride;
+	unsigned int		step;
+	unsigned int		first_slice;
+	unsigned int		num_slices;
+};
+
+/* A number of consecutive block rows of a plane */
+struct fwht_slice {
+	struct fwht_raw_frame	frame;
+	struct fwht_raw_frame	ref;
+	unsigned int		width;
+	unsigned int		height;
+	unsigned int		stride;
+	u8			*buf;
+	u32			size;
+	u32			encoding;
+};
+
 struct codec_ctx {
 	struct v4l2_fwht_state	state;
 	unsigned int		flags;
 	unsigned int		size;
 	u32			field;
 	u32			comp_max_size;
+	/*
+	 * The reference frame buffer owned by the context. After
+	 * fwht_decompress_ref() state.ref_frame.buf points to the caller's
+	 * output buffer instead.
+	 */
+	u8			*ref_buf;
+
+	/* Used by fwht_compress_slices() and friends */
+	struct fwht_raw_frame	raw;
+	struct fwht_slice_plane	planes[4];
+	unsigned int		num_planes;
+	struct fwht_slice	*slices;
+	unsigned int		num_slices;
+	unsigned int		max_slices;
+	unsigned int		slice_rows;
+	u8			*slice_buf;
+	unsigned int		slice_buf_size;
+	bool			is_intra;
+	bool			next_is_intra;
+};
+
+/* Reassembles the packets of a UDP stream */
+struct udp_rx {
+	__u8			*buf;
+	unsigned int		alloc;
+	/* The packet being received */
+	__u32			seq;
+	unsigned int		size;
+	unsigned int		received;
+	bool			receiving;
+	bool			have_seq;
+	/* Set when packets got lost, cleared by the caller */
+	bool			lost;
 };
 
-unsigned rle_compress(__u8 *buf, unsigned size, unsigned bytesperline);
+unsigned rle_compress(const __u8 *src, __u8 *dst, unsigned size, unsigned bytesperline);
+unsigned rle_compress_band(const __u8 *src, __u8 *dst, unsigned size, unsigned bytesperline);
 void rle_decompress(__u8 *buf, unsigned size, unsigned rle_size, unsigned bytesperline);
 struct codec_ctx *fwht_alloc(unsigned pixfmt, unsigned visible_width, unsigned visible_height,
 			     unsigned coded_width, unsigned coded_height, unsigned field,
 			     unsigned colorspace, unsigned xfer_func, unsigned ycbcr_enc,
-			     unsigned quantization);
+			     unsigned quantization, unsigned max_slices);
 void fwht_free(struct codec_ctx *ctx);
 __u8 *fwht_compress(struct codec_ctx *ctx, __u8 *buf, unsigned size, unsigned *comp_size);
+unsigned fwht_compress_slices(struct codec_ctx *ctx, __u8 *buf, unsigned size);
+void fwht_compress_slice(struct codec_ctx *ctx, unsigned slice);
+unsigned fwht_compress_finish(struct codec_ctx *ctx, __u8 *out);
 bool fwht_decompress(struct codec_ctx *ctx, __u8 *read_buf, unsigned comp_size,
 		     __u8 *buf, unsigned size);
+bool fwht_decompress_ref(struct codec_ctx *ctx, __u8 *read_buf, unsigned comp_size,
+			 __u8 *buf, unsigned size);
+void fwht_release_ref(struct codec_ctx *ctx);
+unsigned fwht_coeff_planes(const struct codec_ctx *ctx, __u8 *buf,
+			   struct fwht_coeff_plane planes[4], unsigned *size);
+bool fwht_decompress_coeffs(struct codec_ctx *ctx, __u8 *read_buf, unsigned comp_size,
+			    __u8 *buf, unsigned size);
 unsigned rle_calc_bpl(unsigned bpl, __u32 pixelformat);
+int udp_rx_datagram(struct udp_rx *rx, const __u8 *dgram, unsigned len);
+void udp_rx_free(struct udp_rx *rx);
 
 #ifdef __cplusplus
 }
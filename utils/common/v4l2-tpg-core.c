@@ -1078,10 +1078,53 @@ static void precalculate_color(struct tpg_data *tpg, int k)
 
 static void tpg_precalculate_colors(struct tpg_data *tpg)
 {
+	struct tpg_color_cache *cache;
+	struct tpg_color_key key;
+	unsigned i;
 	int k;
 
+	/* Noise gets new random colors every time */
+	if (tpg->pattern == TPG_PAT_NOISE) {
+		for (k = 0; k < TPG_COLOR_MAX; k++)
+			precalculate_color(tpg, k);
+		return;
+	}
+
+	memset(&key, 0, sizeof(key));
+	key.fourcc = tpg->fourcc;
+	key.colorspace = tpg->colorspace;
+	key.real_xfer_func = tpg->real_xfer_func;
+	key.real_ycbcr_enc = tpg->real_ycbcr_enc;
+	key.real_hsv_enc = tpg->real_hsv_enc;
+	key.real_quantization = tpg->real_quantization;
+	key.rgb_range = tpg->rgb_range;
+	key.real_rgb_range = tpg->real_rgb_range;
+	key.pattern = tpg->pattern;
+	key.qual = tpg->qual;
+	key.color_enc = tpg->color_enc;
+	key.hue = tpg->hue;
+	key.brightness = tpg->brightness;
+	key.contrast = tpg->contrast;
+	key.saturation = tpg->saturation;
+
+	for (i = 0; i < TPG_COLOR_CACHE_SIZE; i++) {
+		cache = &tpg->color_cache[i];
+		if (cache->valid && !memcmp(&cache->key, &key, sizeof(key))) {
+			memcpy(tpg->colors, cache->colors, sizeof(tpg->colors));
+			/* The random color is drawn anew each time it is used */
+			precalculate_color(tpg, TPG_COLOR_RANDOM);
+			return;
+		}
+	}
+
 	for (k = 0; k < TPG_COLOR_MAX; k++)
 		precalculate_color(tpg, k);
+
+	cache = &tpg->color_cache[tpg->color_cache_next];
+	tpg->color_cache_next = (tpg->color_cache_next + 1) % TPG_COLOR_CACHE_SIZE;
+	cache->valid = true;
+	cache->key = key;
+	memcpy(cache->colors, tpg->colors, sizeof(tpg->colors));
 }
 
 /* 'odd' is true for pixels 1, 3, 5, etc. and false for pixels 0, 2, 4, etc. */
@@ -1739,14 +1782,61 @@ static void tpg_calculate_square_border(struct tpg_data *tpg)
 	}
 }
 
+/* Fill size bytes of buf by repeating the first len bytes of pix */
+static void tpg_fill_repeat(u8 *buf, const u8 *pix, unsigned len, unsigned size)
+{
+	unsigned done = min(len, size);
+
+	memcpy(buf, pix, done);
+	while (done < size) {
+		unsigned n = min(done, size - done);
+
+		memcpy(buf + done, buf, n);
+		done += n;
+	}
+}
+
+/*
+ * gen_twopix() is called for every two pixels of the pattern lines, but
+ * most patterns only use a few colors. So cache the last few generated
+ * pixel pairs. Only complete pairs can be cached, since for some formats
+ * the second pixel is combined with the first one.
+ */
+#define TPG_TWOPIX_CACHE 8
+
+struct tpg_twopix {
+	int color1, color2;
+	u8 pix[TPG_MAX_PLANES][8];
+};
+
+static const struct tpg_twopix *tpg_gen_twopix_pair(struct tpg_data *tpg,
+						     struct tpg_twopix *cache,
+						     int color1, int color2)
+{
+	struct tpg_twopix *e = &cache[(color1 * 3 + color2) % TPG_TWOPIX_CACHE];
+
+	if (e->color1 != color1 || e->color2 != color2 ||
+	    color1 == TPG_COLOR_RANDOM || color2 == TPG_COLOR_RANDOM) {
+		gen_twopix(tpg, e->pix, color1, 0);
+		gen_twopix(tpg, e->pix, color2, 1);
+		e->color1 = color1;
+		e->color2 = color2;
+	}
+	return e;
+}
+
 static void tpg_precalculate_line(struct tpg_data *tpg)
 {
+	struct tpg_twopix cache[TPG_TWOPIX_CACHE];
 	enum tpg_color contrast;
 	u8 pix[TPG_MAX_PLANES][8];
 	unsigned pat;
 	unsigned p;
 	unsigned x;
 
+	for (x = 0; x < TPG_TWOPIX_CACHE; x++)
+		cache[x].color1 = cache[x].color2 = -1;
+
 	switch (tpg->pattern) {
 	case TPG_PAT_GREEN:
 		contrast = TPG_COLOR_100_RED;
@@ -1768,6 +1858,7 @@ static void tpg_precalculate_line(struct tpg_data *tpg)
 
 		for (x = 0; x < tpg->scaled_width * 2; x += 2) {
 			unsigned real_x = src_x;
+			const struct tpg_twopix *twopix;
 			enum tpg_color color1, color2;
 
 			real_x = tpg->hflip ? tpg->src_width * 2 - real_x - 2 : real_x;
@@ -1791,14 +1882,15 @@ static void tpg_precalculate_line(struct tpg_data *tpg)
 				src_x++;
 			}
 
-			gen_twopix(tpg, pix, tpg->hflip ? color2 : color1, 0);
-			gen_twopix(tpg, pix, tpg->hflip ? color1 : color2, 1);
+			twopix = tpg_gen_twopix_pair(tpg, cache,
+						     tpg->hflip ? color2 : color1,
+						     tpg->hflip ? color1 : color2);
 			for (p = 0; p < tpg->planes; p++) {
 				unsigned twopixsize = tpg->twopixelsize[p];
 				unsigned hdiv = tpg->hdownsampling[p];
 				u8 *pos = tpg->lines[pat][p] + tpg_hdiv(tpg, p, x);
 
-				memcpy(pos, pix[p], twopixsize / hdiv);
+				memcpy(pos, twopix->pix[p], twopixsize / hdiv);
 			}
 		}
 	}
@@ -1825,20 +1917,18 @@ static void tpg_precalculate_line(struct tpg_data *tpg)
 	gen_twopix(tpg, pix, contrast, 1);
 	for (p = 0; p < tpg->planes; p++) {
 		unsigned twopixsize = tpg->twopixelsize[p];
-		u8 *pos = tpg->contrast_line[p];
 
-		for (x = 0; x < tpg->scaled_width; x += 2, pos += twopixsize)
-			memcpy(pos, pix[p], twopixsize);
+		tpg_fill_repeat(tpg->contrast_line[p], pix[p], twopixsize,
+				DIV_ROUND_UP(tpg->scaled_width, 2) * twopixsize);
 	}
 
 	gen_twopix(tpg, pix, TPG_COLOR_100_BLACK, 0);
 	gen_twopix(tpg, pix, TPG_COLOR_100_BLACK, 1);
 	for (p = 0; p < tpg->planes; p++) {
 		unsigned twopixsize = tpg->twopixelsize[p];
-		u8 *pos = tpg->black_line[p];
 
-		for (x = 0; x < tpg->scaled_width; x += 2, pos += twopixsize)
-			memcpy(pos, pix[p], twopixsize);
+		tpg_fill_repeat(tpg->black_line[p], pix[p], twopixsize,
+				DIV_ROUND_UP(tpg->scaled_width, 2) * twopixsize);
 	}
 
 	for (x = 0; x < tpg->scaled_width * 2; x += 2) {
@@ -2532,34 +2622,28 @@ static void tpg_fill_plane_pattern(const struct tpg_data *tpg,
 	}
 }
 
-void tpg_fill_plane_buffer(struct tpg_data *tpg, v4l2_std_id std,
-			   unsigned p, u8 *vbuf)
+/*
+ * Fill lines first up to last of the compose rectangle. The source line and
+ * the Bresenham error of line h follow directly from h, so each range of
+ * lines can be filled independently of the others.
+ */
+static void tpg_fill_plane_lines(const struct tpg_data *tpg,
+				 const struct tpg_draw_params *common,
+				 unsigned p, u8 *vbuf,
+				 unsigned first, unsigned last)
 {
-	struct tpg_draw_params params;
+	struct tpg_draw_params params = *common;
 	unsigned factor = V4L2_FIELD_HAS_T_OR_B(tpg->field) ? 2 : 1;
 
 	/* Coarse scaling with Bresenham */
 	unsigned int_part = (tpg->crop.height / factor) / tpg->compose.height;
 	unsigned fract_part = (tpg->crop.height / factor) % tpg->compose.height;
-	unsigned src_y = 0;
-	unsigned error = 0;
+	unsigned src_y = first * int_part +
+			 (first * fract_part) / tpg->compose.height;
+	unsigned error = (first * fract_part) % tpg->compose.height;
 	unsigned h;
 
-	tpg_recalc(tpg);
-
-	params.is_tv = std;
-	params.is_60hz = std & V4L2_STD_525_60;
-	params.twopixsize = tpg->twopixelsize[p];
-	params.img_width = tpg_hdiv(tpg, p, tpg->compose.width);
-	params.stride = tpg->bytesperline[p];
-	params.hmax = (tpg->compose.height * tpg->perc_fill) / 100;
-
-	tpg_fill_params_pattern(tpg, p, &params);
-	tpg_fill_params_extras(tpg, p, &params);
-
-	vbuf += tpg_hdiv(tpg, p, tpg->compose.left);
-
-	for (h = 0; h < tpg->compose.height; h++) {
+	for (h = first; h < last; h++) {
 		unsigned buf_line;
 
 		params.frame_line = tpg_calc_frameline(tpg, src_y, tpg->field);
@@ -2615,6 +2699,62 @@ void tpg_fill_plane_buffer(struct tpg_data *tpg, v4l2_std_id std,
 	}
 }
 
+struct tpg_band {
+	const struct tpg_data *tpg;
+	const struct tpg_draw_params *params;
+	unsigned p;
+	u8 *vbuf;
+	unsigned lines;
+};
+
+static void tpg_fill_band(void *arg, unsigned band)
+{
+	const struct tpg_band *b = arg;
+	unsigned first = band * b->lines;
+
+	tpg_fill_plane_lines(b->tpg, b->params, b->p, b->vbuf, first,
+			     min(first + b->lines, b->tpg->compose.height));
+}
+
+void tpg_fill_plane_buffer(struct tpg_data *tpg, v4l2_std_id std,
+			   unsigned p, u8 *vbuf)
+{
+	struct tpg_draw_params params;
+	unsigned bands;
+
+	tpg_recalc(tpg);
+
+	params.is_tv = std;
+	params.is_60hz = std & V4L2_STD_525_60;
+	params.twopixsize = tpg->twopixelsize[p];
+	params.img_width = tpg_hdiv(tpg, p, tpg->compose.width);
+	params.stride = tpg->bytesperline[p];
+	params.hmax = (tpg->compose.height * tpg->perc_fill) / 100;
+
+	tpg_fill_params_pattern(tpg, p, &params);
+	tpg_fill_params_extras(tpg, p, &params);
+
+	vbuf += tpg_hdiv(tpg, p, tpg->compose.left);
+
+	bands = min(tpg->max_bands, tpg->compose.height / TPG_MIN_BAND_LINES);
+	if (tpg->run_bands && bands > 1) {
+		struct tpg_band band = {
+			.tpg = tpg,
+			.params = &params,
+			.p = p,
+			.vbuf = vbuf,
+		};
+
+		/* Keep lines that are downsampled together in one band */
+		band.lines = DIV_ROUND_UP(tpg->compose.height, bands);
+		band.lines = (band.lines + 3) & ~3;
+		bands = DIV_ROUND_UP(tpg->compose.height, band.lines);
+		tpg->run_bands(tpg->run_bands_priv, bands, tpg_fill_band, &band);
+		return;
+	}
+	tpg_fill_plane_lines(tpg, &params, p, vbuf, 0, tpg->compose.height);
+}
+
 void tpg_fillbuffer(struct tpg_data *tpg, v4l2_std_id std, unsigned p, u8 *vbuf)
 {
 	unsigned offset = 0;
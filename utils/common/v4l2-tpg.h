@@ -35,6 +35,9 @@ typedef __s8 s8;
 #define min3(x, y, z) min((typeof(x))min(x, y), z)
 #define max3(x, y, z) max((typeof(x))max(x, y), z)
 #define array_size(a, b) ((a) * (b))
+#ifndef DIV_ROUND_UP
+#define DIV_ROUND_UP(n, d) (((n) + (d) - 1) / (d))
+#endif
 #define array3_size(a, b, c) ((a) * (b) * (c))
 
 static inline void vfree(void *p)
@@ -177,6 +180,34 @@ extern const char * const tpg_aspect_strings[];
 
 #define TPG_MAX_PLANES 3
 #define TPG_MAX_PAT_LINES 8
+/* Don't split a plane in bands of fewer lines than this */
+#define TPG_MIN_BAND_LINES 16
+#define TPG_COLOR_CACHE_SIZE 8
+
+/* Everything the precalculated colors depend on */
+struct tpg_color_key {
+	u32				fourcc;
+	u32				colorspace;
+	u32				real_xfer_func;
+	u32				real_ycbcr_enc;
+	u32				real_hsv_enc;
+	u32				real_quantization;
+	unsigned			rgb_range;
+	unsigned			real_rgb_range;
+	u32				pattern;
+	u32				qual;
+	u32				color_enc;
+	s16				hue;
+	u8				brightness;
+	u8				contrast;
+	u8				saturation;
+};
+
+struct tpg_color_cache {
+	bool				valid;
+	struct tpg_color_key		key;
+	u8				colors[TPG_COLOR_MAX][3];
+};
 
 struct tpg_data {
 	/* Source frame size */
@@ -243,6 +274,9 @@ struct tpg_data {
 	unsigned			hmask[TPG_MAX_PLANES];
 	/* Used to store the colors in native format, either RGB or YUV */
 	u8				colors[TPG_COLOR_MAX][3];
+	/* Recently precalculated colors, reused when switching back to them */
+	struct tpg_color_cache		color_cache[TPG_COLOR_CACHE_SIZE];
+	unsigned			color_cache_next;
 	u8				textfg[TPG_MAX_PLANES][8], textbg[TPG_MAX_PLANES][8];
 	/* size in bytes for two pixels in each plane */
 	unsigned			twopixelsize[TPG_MAX_PLANES];
@@ -278,6 +312,17 @@ struct tpg_data {
 	u8				*random_line[TPG_MAX_PLANES];
 	u8				*contrast_line[TPG_MAX_PLANES];
 	u8				*black_line[TPG_MAX_PLANES];
+
+	/*
+	 * Optionally fill the planes in up to max_bands bands of lines:
+	 * run_bands must call func(arg, band) for bands 0 to bands - 1,
+	 * which may run in parallel, and return when they are all done.
+	 */
+	unsigned			max_bands;
+	void				(*run_bands)(void *priv, unsigned bands,
+						     void (*func)(void *arg, unsigned band),
+						     void *arg);
+	void				*run_bands_priv;
 };
 
 void tpg_init(struct tpg_data *tpg, unsigned w, unsigned h);
@@ -594,6 +639,17 @@ static inline void tpg_s_perc_fill_blank(struct tpg_data *tpg,
 	tpg->perc_fill_blank = perc_fill_blank;
 }
 
+static inline void tpg_s_band_runner(struct tpg_data *tpg, unsigned max_bands,
+				     void (*run_bands)(void *priv, unsigned bands,
+						       void (*func)(void *arg, unsigned band),
+						       void *arg),
+				     void *priv)
+{
+	tpg->max_bands = max_bands;
+	tpg->run_bands = run_bands;
+	tpg->run_bands_priv = priv;
+}
+
 static inline void tpg_s_video_aspect(struct tpg_data *tpg,
 					enum tpg_video_aspect vid_aspect)
 {
@@ -666,6 +722,33 @@ static inline void tpg_update_mv_count(struct tpg_data *tpg, bool frame_is_field
 	tpg->mv_vert_count += tpg->mv_vert_step * (frame_is_field ? 1 : 2);
 }
 
+static inline unsigned tpg_gcd(unsigned a, unsigned b)
+{
+	while (b) {
+		unsigned r = a % b;
+
+		a = b;
+		b = r;
+	}
+	return a;
+}
+
+/*
+ * Return the number of frames after which the pattern movement repeats
+ * itself, if tpg_update_mv_count() is called once for each frame.
+ */
+static inline unsigned tpg_g_mv_period(const struct tpg_data *tpg,
+				       bool frame_is_field)
+{
+	unsigned mul = frame_is_field ? 1 : 2;
+	unsigned hor_step = (tpg->mv_hor_step * mul) % tpg->src_width;
+	unsigned vert_step = (tpg->mv_vert_step * mul) % tpg->src_height;
+	unsigned hor = tpg->src_width / tpg_gcd(tpg->src_width, hor_step);
+	unsigned vert = tpg->src_height / tpg_gcd(tpg->src_height, vert_step);
+
+	return hor / tpg_gcd(hor, vert) * vert;
+}
+
 static inline void tpg_s_hflip(struct tpg_data *tpg, bool hflip)
 {
 	if (tpg->hflip == hflip)
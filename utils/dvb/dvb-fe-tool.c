@@ -383,8 +383,12 @@ int main(int argc, char *argv[])
 		dvb_fe_prt_parms(parms);
 	}
 
-	if (femon)
+	if (femon) {
+		/* Let the daemon push the stats, instead of polling it */
+		if (server && port)
+			dvb_dev_remote_stats_subscribe(dvb, 500);
 		get_show_stats(parms);
+	}
 
 ret:
 	dvb_dev_free(dvb);
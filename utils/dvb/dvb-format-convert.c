@@ -25,7 +25,9 @@
 #include <ctype.h>
 #include <errno.h>
 #include <signal.h>
+#include <pthread.h>
 #include <sys/types.h>
+#include <sys/stat.h>
 #include <sys/time.h>
 #include <argp.h>
 
@@ -50,15 +52,25 @@
 #define PROGRAM_NAME	"dvb-format-convert"
 
 struct arguments {
-	char *input_file, *output_file;
+	char *input_file, *output_file, *output_dir;
 	enum dvb_file_formats input_format, output_format;
-	int delsys;
+	int delsys, jobs;
+};
+
+/* Input files still to be converted into args->output_dir */
+struct convert_queue {
+	struct arguments *args;
+	char **files;
+	int n_files, next, errors;
+	pthread_mutex_t lock;
 };
 
 static const struct argp_option options[] = {
-	{"input-format",	'I',	N_("format"),	0, N_("Valid input formats: ZAP, CHANNEL, DVBV5"), 0},
-	{"output-format",	'O',	N_("format"),	0, N_("Valid output formats: VDR, ZAP, CHANNEL, DVBV5"), 0},
+	{"input-format",	'I',	N_("format"),	0, N_("Valid input formats: ZAP, CHANNEL, DVBV5, DVBV5DB"), 0},
+	{"output-format",	'O',	N_("format"),	0, N_("Valid output formats: VDR, ZAP, CHANNEL, DVBV5, DVBV5DB"), 0},
 	{"delsys",		's',	N_("system"),	0, N_("Delivery system type. Needed if input or output format is ZAP"), 0},
+	{"output-dir",		'd',	N_("dir"),	0, N_("Convert all input files, writing them with the same name at dir"), 0},
+	{"jobs",		'j',	N_("jobs"),	0, N_("Number of files converted in parallel with --output-dir. Default: one per CPU"), 0},
 	{"help",        '?',	0,		0,	N_("Give this help list"), -1},
 	{"usage",	-3,	0,		0,	N_("Give a short usage message")},
 	{"version",	'V',	0,		0,	N_("Print program version"), -1},
@@ -81,6 +93,14 @@ static error_t parse_opt(int k, char *optarg, struct argp_state *state)
 	case 's':
 		args->delsys = dvb_parse_delsys(optarg);
 		break;
+	case 'd':
+		args->output_dir = optarg;
+		break;
+	case 'j':
+		args->jobs = atoi(optarg);
+		if (args->jobs <= 0)
+			argp_error(state, _("invalid number of jobs: %s"), optarg);
+		break;
 	case '?':
 		argp_state_help(state, state->out_stream,
 				ARGP_HELP_SHORT_USAGE | ARGP_HELP_LONG
@@ -99,28 +119,196 @@ static error_t parse_opt(int k, char *optarg, struct argp_state *state)
 	return 0;
 }
 
-static int convert_file(struct arguments *args)
+static int same_file(const char *a, const char *b)
+{
+	struct stat st_a, st_b;
+
+	if (stat(a, &st_a) < 0 || stat(b, &st_b) < 0)
+		return 0;
+	return st_a.st_dev == st_b.st_dev && st_a.st_ino == st_b.st_ino;
+}
+
+/*
+ * Converts one entry at a time, so memory doesn't grow with the size of
+ * the file.
+ */
+static int convert_stream(struct arguments *args, const char *input,
+			  const char *output)
+{
+	struct dvb_file_stream *in, *out;
+	struct dvb_entry *entry;
+	int ret, rc;
+
+	in = dvb_file_stream_open(input, args->delsys, args->input_format, "r");
+	if (!in) {
+		fprintf(stderr, _("Error reading file %s\n"), input);
+		return -1;
+	}
+	out = dvb_file_stream_open(output, args->delsys, args->output_format,
+				   "w");
+	if (!out) {
+		dvb_file_stream_close(in);
+		return -1;
+	}
+
+	while ((ret = dvb_file_stream_read(in, &entry)) > 0) {
+		rc = dvb_file_stream_write(out, entry);
+		dvb_file_free_entry(entry);
+		if (rc < 0)
+			break;
+	}
+	if (ret < 0)
+		fprintf(stderr, _("Error reading file %s\n"), input);
+	if (ret)
+		ret = -1;
+
+	dvb_file_stream_close(in);
+	if (dvb_file_stream_close(out) < 0)
+		ret = -1;
+
+	/* Don't leave a half converted file behind */
+	if (ret < 0 && strcmp(output, "-"))
+		unlink(output);
+
+	return ret;
+}
+
+static int convert_file(struct arguments *args, const char *input,
+			const char *output)
 {
 	struct dvb_file *dvb_file = NULL;
+	FILE *msg = strcmp(output, "-") ? stdout : stderr;
 	int ret;
 
-	printf(_("Reading file %s\n"), args->input_file);
+	fprintf(msg, _("Reading file %s\n"), input);
+	fprintf(msg, _("Writing file %s\n"), output);
+
+	/*
+	 * The database is written with its index, and converting a file
+	 * onto itself needs all of it read before writing.
+	 */
+	if (args->input_format != FILE_DVBV5_DB &&
+	    args->output_format != FILE_DVBV5_DB &&
+	    !same_file(input, output))
+		return convert_stream(args, input, output);
 
-	dvb_file = dvb_read_file_format(args->input_file, args->delsys,
+	dvb_file = dvb_read_file_format(input, args->delsys,
 				    args->input_format);
 	if (!dvb_file) {
-		fprintf(stderr, _("Error reading file %s\n"), args->input_file);
+		fprintf(stderr, _("Error reading file %s\n"), input);
 		return -1;
 	}
 
-	printf(_("Writing file %s\n"), args->output_file);
-	ret = dvb_write_file_format(args->output_file, dvb_file,
+	ret = dvb_write_file_format(output, dvb_file,
 				    args->delsys, args->output_format);
 	dvb_file_free(dvb_file);
 
 	return ret;
 }
 
+static const char *file_basename(const char *fname)
+{
+	const char *p = strrchr(fname, '/');
+
+	return p ? p + 1 : fname;
+}
+
+static int cmp_basename(const void *a, const void *b)
+{
+	return strcmp(file_basename(*(char * const *)a),
+		      file_basename(*(char * const *)b));
+}
+
+static void *convert_thread(void *privdata)
+{
+	struct convert_queue *queue = privdata;
+	struct arguments *args = queue->args;
+	char *output;
+	int i, ret;
+
+	while (1) {
+		pthread_mutex_lock(&queue->lock);
+		i = queue->next++;
+		pthread_mutex_unlock(&queue->lock);
+		if (i >= queue->n_files)
+			break;
+
+		if (asprintf(&output, "%s/%s", args->output_dir,
+			     file_basename(queue->files[i])) < 0) {
+			perror(_("Allocating memory for file name"));
+			ret = -1;
+		} else {
+			ret = convert_file(args, queue->files[i], output);
+			free(output);
+		}
+		if (ret < 0) {
+			pthread_mutex_lock(&queue->lock);
+			queue->errors++;
+			pthread_mutex_unlock(&queue->lock);
+		}
+	}
+	return NULL;
+}
+
+static int convert_files(struct arguments *args, char **files, int n_files)
+{
+	struct convert_queue queue = {
+		.args = args,
+		.files = files,
+		.n_files = n_files,
+		.lock = PTHREAD_MUTEX_INITIALIZER,
+	};
+	pthread_t *threads;
+	char **sorted;
+	int i, jobs = args->jobs, started = 0;
+
+	/* Two inputs with the same name would be written to the same file */
+	sorted = malloc(n_files * sizeof(*sorted));
+	if (!sorted) {
+		perror(_("Allocating memory for file names"));
+		return -1;
+	}
+	memcpy(sorted, files, n_files * sizeof(*sorted));
+	qsort(sorted, n_files, sizeof(*sorted), cmp_basename);
+	for (i = 1; i < n_files; i++) {
+		if (!cmp_basename(&sorted[i - 1], &sorted[i])) {
+			fprintf(stderr,
+				_("ERROR: %s and %s would both be written as %s/%s\n"),
+				sorted[i - 1], sorted[i], args->output_dir,
+				file_basename(sorted[i]));
+			free(sorted);
+			return -1;
+		}
+	}
+	free(sorted);
+
+	if (!jobs)
+		jobs = sysconf(_SC_NPROCESSORS_ONLN);
+	if (jobs > n_files)
+		jobs = n_files;
+
+	threads = calloc(jobs, sizeof(*threads));
+	if (threads) {
+		for (started = 0; started < jobs - 1; started++)
+			if (pthread_create(&threads[started], NULL,
+					   convert_thread, &queue))
+				break;
+	}
+
+	/* The main thread does its share of the work too */
+	convert_thread(&queue);
+
+	for (i = 0; i < started; i++)
+		pthread_join(threads[i], NULL);
+	free(threads);
+
+	if (queue.errors)
+		fprintf(stderr, _("ERROR: %d of %d files failed to convert\n"),
+			queue.errors, n_files);
+
+	return queue.errors ? -1 : 0;
+}
+
 int main(int argc, char **argv)
 {
 	struct arguments args = {};
@@ -129,7 +317,7 @@ int main(int argc, char **argv)
 		.options = options,
 		.parser = parse_opt,
 		.doc = N_("scan DVB services using the channel file"),
-		.args_doc = N_("<input file> <output file>"),
+		.args_doc = N_("<input file> <output file>\n-d <output dir> <input file>..."),
 	};
 
 #ifdef ENABLE_NLS
@@ -141,7 +329,11 @@ int main(int argc, char **argv)
 	memset(&args, 0, sizeof(args));
 	argp_parse(&argp, argc, argv, ARGP_NO_HELP | ARGP_NO_EXIT, &idx, &args);
 
-	if (idx + 1 < argc) {
+	if (args.output_dir) {
+		if (idx >= 0 && idx < argc)
+			args.input_file = argv[idx];
+		args.output_file = args.output_dir;
+	} else if (idx + 1 < argc) {
 		args.input_file = argv[idx];
 		args.output_file = argv[idx + 1];
 	}
@@ -158,6 +350,9 @@ int main(int argc, char **argv)
 	} else if (!args.output_file) {
 		fprintf(stderr, _("ERROR: Please specify a valid output file\n"));
 		missing = 1;
+	} else if (!args.output_dir && idx + 2 < argc) {
+		fprintf(stderr, _("ERROR: Please use --output-dir to convert more than one file\n"));
+		missing = 1;
 	} else if (((args.input_format == FILE_ZAP) ||
 		   (args.output_format == FILE_ZAP)) &&
 		   (args.delsys <= 0 || args.delsys == SYS_ISDBS)) {
@@ -169,5 +364,8 @@ int main(int argc, char **argv)
 		return -1;
 	}
 
-	return convert_file(&args);
+	if (args.output_dir)
+		return convert_files(&args, &argv[idx], argc - idx);
+
+	return convert_file(&args, args.input_file, args.output_file);
 }
@@ -43,12 +43,19 @@
 #include <stdio.h>
 #include <signal.h>
 #include <syslog.h>
+#include <sys/eventfd.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+#include <time.h>
 #include <unistd.h>
 
 #include <netdb.h>
 #include <netinet/in.h>
 #include <netinet/tcp.h>
+#include <linux/sockios.h>
 
 #include "../../lib/libdvbv5/dvb-fe-priv.h"
 #include "../../lib/libdvbv5/dvb-dev-priv.h"
@@ -85,6 +92,8 @@ static const char doc[] = N_(
 static const struct argp_option options[] = {
 	{"verbose",	'v',	0,		0,	N_("enables debug messages"), 0},
 	{"port",	'p',	"5555",		0,	N_("port to listen"), 0},
+	{"unix",	'u',	N_("path"),	0,	N_("Unix socket to listen, for local clients"), 0},
+	{"metrics",	'm',	N_("port"),	0,	N_("port to serve the metrics, in the Prometheus text format"), 0},
 	{"help",        '?',	0,		0,	N_("Give this help list"), -1},
 	{"usage",	-3,	0,		0,	N_("Give a short usage message")},
 	{"version",	'V',	0,		0,	N_("Print program version"), -1},
@@ -92,6 +101,8 @@ static const struct argp_option options[] = {
 };
 
 static int port = 0;
+static int metrics_port = 0;
+static char *unix_path = NULL;
 static int verbose = 0;
 
 static error_t parse_opt(int k, char *arg, struct argp_state *state)
@@ -100,6 +111,12 @@ static error_t parse_opt(int k, char *arg, struct argp_state *state)
 	case 'p':
 		port = atoi(arg);
 		break;
+	case 'u':
+		unix_path = arg;
+		break;
+	case 'm':
+		metrics_port = atoi(arg);
+		break;
 	case 'v':
 		verbose	++;
 		break;
@@ -195,21 +212,70 @@ void local_log(int level, const char *fmt, ...)
  * Static data used by the code
  */
 
-static pthread_mutex_t msg_mutex;
-static pthread_mutex_t dvb_read_mutex;
-static pthread_t read_id = 0;
-
 struct dvb_descriptors {
 	int uid;
 	struct dvb_open_descriptor *open_dev;
+	int xfer_size;		/* max amount of data per data_read message */
+
+	/* Shared memory ring, used instead of data_read for local clients */
+	struct dvb_shm_ring *shm;
+	size_t shm_len;
+	int shm_efd;
+
+	/* Metrics, updated with dvb_read_mutex held */
+	uint64_t reads, read_bytes, read_errors, overflows;
 };
 
-static struct dvb_device *dvb = NULL;
-static void *desc_root = NULL;
-static int dvb_fd = -1;
+/*
+ * Each client connection has its own DVB device struct, open descriptors
+ * and read thread, so that several clients can use different adapters
+ * at the same time. The descriptors opened by a client can only be used
+ * by it, and their data is sent only to its socket.
+ */
+struct dvb_client {
+	unsigned int id;	/* for the metrics */
+	int fd;			/* client socket */
+	int proto;		/* protocol version used by the client */
+	int session;		/* the client called daemon_get_version */
+	int is_local;		/* connected via the Unix socket */
+	struct dvb_device *dvb;
+
+	/*
+	 * Data channel: a second connection of the same client, used just
+	 * to send the data_read messages. The client attaches it by sending
+	 * the token it got from data_channel_open.
+	 */
+	int data_fd;
+	char token[33];
+	pthread_mutex_t data_mutex;
+
+	pthread_mutex_t msg_mutex;
+	pthread_mutex_t dvb_read_mutex;	/* protects fds and desc_root */
+	pthread_t read_id;
+	int read_running, stop_read;
+
+	/* Held while running a method, as they share the frontend */
+	pthread_mutex_t fe_mutex;
+
+	/* Frontend stats subscription, see REMOTE_OP_FE_STATS_SUBSCRIBE */
+	pthread_mutex_t stats_mutex;
+	pthread_cond_t stats_cond;
+	pthread_t stats_id;
+	int stats_running;
+	unsigned int stats_interval;	/* ms, 0 stops the thread */
+	struct remote_bin_stats stats_last;
+
+	void *desc_root;
+	struct pollfd fds[NUM_FOPEN];
+	nfds_t numfds;
+
+	struct dvb_client *next;
+};
 
-static struct pollfd fds[NUM_FOPEN];
-static nfds_t numfds = 0;
+/* Connected clients, for data_channel_attach to find its owner */
+static struct dvb_client *clients;
+static pthread_mutex_t clients_mutex = PTHREAD_MUTEX_INITIALIZER;
+static unsigned int num_clients;
 
 static char output_charset[256] = "utf-8";
 static char default_charset[256] = "iso-8859-1";
@@ -246,32 +312,58 @@ static int dvb_desc_compare(const void *__a, const void *__b)
 	return (b->uid - a->uid);
 }
 
-static struct dvb_open_descriptor *get_open_dev(int uid)
+static struct dvb_descriptors *get_desc(struct dvb_client *client, int uid)
 {
 	struct dvb_descriptors desc, **p;
 
-	if (!desc_root)
+	if (!client->desc_root)
 		return NULL;
 
 	desc.uid = uid;
-	p = tfind(&desc, &desc_root, dvb_desc_compare);
+	p = tfind(&desc, &client->desc_root, dvb_desc_compare);
 
 	if (!p) {
 		err("open element not retrieved!");
 		return NULL;
 	}
 
-	return (*p)->open_dev;
+	return *p;
 }
 
-static void destroy_open_dev(int uid)
+static struct dvb_open_descriptor *get_open_dev(struct dvb_client *client,
+						int uid)
 {
-	struct dvb_descriptors desc, **p;
+	struct dvb_descriptors *desc = get_desc(client, uid);
+
+	if (!desc)
+		return NULL;
+
+	return desc->open_dev;
+}
+
+static void free_desc_shm(struct dvb_descriptors *desc)
+{
+	if (!desc->shm)
+		return;
+	munmap(desc->shm, desc->shm_len);
+	close(desc->shm_efd);
+	desc->shm = NULL;
+}
+
+static void destroy_open_dev(struct dvb_client *client, int uid)
+{
+	struct dvb_descriptors desc, *old, **p;
 
 	desc.uid = uid;
-	p = tdelete(&desc, &desc_root, dvb_desc_compare);
-	if (!p)
+	p = tfind(&desc, &client->desc_root, dvb_desc_compare);
+	if (!p) {
 		err("can't destroy opened element");
+		return;
+	}
+	old = *p;
+	tdelete(&desc, &client->desc_root, dvb_desc_compare);
+	free_desc_shm(old);
+	free(old);
 }
 
 static void free_opendevs(void *node)
@@ -282,16 +374,18 @@ static void free_opendevs(void *node)
 		dbg("closing dev %p", desc, desc->open_dev);
 
 	dvb_dev_close(desc->open_dev);
+	free_desc_shm(desc);
 	free (desc);
 }
 
-static void close_all_devs(void)
+static void close_all_devs(struct dvb_client *client)
 {
-	dvb_fd = -1;
-	numfds = 0;
-	tdestroy(desc_root, free_opendevs);
+	pthread_mutex_lock(&client->dvb_read_mutex);
+	client->numfds = 0;
+	tdestroy(client->desc_root, free_opendevs);
 
-	desc_root = NULL;
+	client->desc_root = NULL;
+	pthread_mutex_unlock(&client->dvb_read_mutex);
 }
 
 /*
@@ -303,9 +397,6 @@ static void sigterm_handler(int const sig_class)
 	info(PROGRAM_NAME" interrupted.");
 
 	pthread_exit(NULL);
-
-	close_all_devs();
-	dvb_dev_free(dvb);
 }
 
 static void start_signal_handler(void)
@@ -316,6 +407,10 @@ static void start_signal_handler(void)
 	action.sa_flags = 0;
 	action.sa_handler = sigterm_handler;
 	sigaction(SIGTERM, &action, NULL);
+
+	/* A client going away shouldn't stop the daemon serving the others */
+	action.sa_handler = SIG_IGN;
+	sigaction(SIGPIPE, &action, NULL);
 }
 
 static void stop_signal_handler(void)
@@ -430,35 +525,181 @@ static ssize_t prepare_data(char *buf, const size_t size,
 	return ret;
 }
 
-static int send_buf(int fd, const char *buf, size_t size)
+static int __send_buf(struct dvb_client *client, const char *buf, size_t size,
+		      uint32_t flags)
 {
+	int fd = client->fd;
 	int ret;
 	int32_t i32;
 
 	if (fd < 0)
 		return ECONNRESET;
 
-	pthread_mutex_lock(&msg_mutex);
-	i32 = htobe32(size);
+	pthread_mutex_lock(&client->msg_mutex);
+	i32 = htobe32(size | flags);
 	ret = send(fd, (void *)&i32, 4, MSG_MORE);
 	if (ret >= 0)
 		ret = send(fd, buf, size, 0);
-	pthread_mutex_unlock(&msg_mutex);
+	pthread_mutex_unlock(&client->msg_mutex);
 	if (ret < 0) {
 		local_perror("write");
-		if (ret == ECONNRESET)
-			close_all_devs();
-
 		return errno;
 	}
 
 	return ret;
 }
 
-static ssize_t send_data(int fd, const char *fmt, ...)
+static int send_buf(struct dvb_client *client, const char *buf, size_t size)
+{
+	return __send_buf(client, buf, size, 0);
+}
+
+/* Sends the response to a binary message */
+static int send_bin(struct dvb_client *client, const struct remote_bin_hdr *req,
+		    int retval, const void *payload, size_t size)
+{
+	char buf[REMOTE_BUF_SIZE];
+	struct remote_bin_hdr *hdr = (void *)buf;
+
+	if (sizeof(*hdr) + size > sizeof(buf))
+		return -EINVAL;
+
+	hdr->seq = req->seq;
+	hdr->opcode = req->opcode;
+	hdr->reserved = 0;
+	hdr->retval = htobe32(retval);
+	if (size)
+		memcpy(buf + sizeof(*hdr), payload, size);
+
+	return __send_buf(client, buf, sizeof(*hdr) + size, REMOTE_BIN_MSG);
+}
+
+/*
+ * Sends a message together with some file descriptors, for local clients.
+ * Returns the message size, or -errno on errors.
+ */
+static ssize_t send_buf_fds(struct dvb_client *client, const char *buf,
+			    size_t size, const int *fds, int nfds)
+{
+	char cbuf[CMSG_SPACE(2 * sizeof(int))] = { 0 };
+	struct msghdr mh = { 0 };
+	struct cmsghdr *cmsg;
+	struct iovec iov[2];
+	int32_t i32;
+	ssize_t ret;
+
+	if (client->fd < 0)
+		return -ECONNRESET;
+	if (nfds > 2)
+		return -EINVAL;
+
+	i32 = htobe32(size);
+	iov[0].iov_base = &i32;
+	iov[0].iov_len = 4;
+	iov[1].iov_base = (void *)buf;
+	iov[1].iov_len = size;
+	mh.msg_iov = iov;
+	mh.msg_iovlen = 2;
+
+	/* The descriptors go with the first byte of the message */
+	mh.msg_control = cbuf;
+	mh.msg_controllen = CMSG_SPACE(nfds * sizeof(int));
+	cmsg = CMSG_FIRSTHDR(&mh);
+	cmsg->cmsg_level = SOL_SOCKET;
+	cmsg->cmsg_type = SCM_RIGHTS;
+	cmsg->cmsg_len = CMSG_LEN(nfds * sizeof(int));
+	memcpy(CMSG_DATA(cmsg), fds, nfds * sizeof(int));
+
+	pthread_mutex_lock(&client->msg_mutex);
+	do {
+		ret = sendmsg(client->fd, &mh, 0);
+	} while (ret < 0 && errno == EINTR);
+	pthread_mutex_unlock(&client->msg_mutex);
+
+	if (ret < 0) {
+		ret = -errno;
+		local_perror("sendmsg");
+		return ret;
+	}
+
+	/* Unix sockets don't do partial writes on blocking sockets */
+	return size;
+}
+
+/*
+ * Sends a message whose contents are scattered over several buffers,
+ * without first copying them together, via the data channel if there's
+ * one. Returns the message size, or -errno on errors.
+ */
+#define MAX_SEND_IOV	4
+
+static ssize_t send_bufv(struct dvb_client *client, const struct iovec *iov,
+			 int iovcnt)
+{
+	struct iovec vec[MAX_SEND_IOV + 1], *v = vec;
+	pthread_mutex_t *mutex = &client->msg_mutex;
+	int fd = client->fd;
+	size_t size = 0;
+	ssize_t ret = 0;
+	int32_t i32;
+	int i, n = iovcnt + 1;
+
+	if (fd < 0)
+		return -ECONNRESET;
+	if (iovcnt > MAX_SEND_IOV)
+		return -EINVAL;
+
+	for (i = 0; i < iovcnt; i++) {
+		vec[i + 1] = iov[i];
+		size += iov[i].iov_len;
+	}
+	i32 = htobe32(size);
+	vec[0].iov_base = &i32;
+	vec[0].iov_len = 4;
+
+	/* Use the data channel, if the client attached one */
+	pthread_mutex_lock(&client->data_mutex);
+	if (client->data_fd >= 0) {
+		fd = client->data_fd;
+		mutex = &client->data_mutex;
+	} else {
+		pthread_mutex_unlock(&client->data_mutex);
+		pthread_mutex_lock(mutex);
+	}
+
+	while (n) {
+		ret = writev(fd, v, n);
+		if (ret < 0) {
+			if (errno == EINTR)
+				continue;
+			break;
+		}
+
+		/* Handle partial writes */
+		while (n && (size_t)ret >= v->iov_len) {
+			ret -= v->iov_len;
+			v++;
+			n--;
+		}
+		if (n) {
+			v->iov_base = (char *)v->iov_base + ret;
+			v->iov_len -= ret;
+		}
+	}
+	pthread_mutex_unlock(mutex);
+	if (ret < 0) {
+		ret = -errno;
+		local_perror("writev");
+		return ret;
+	}
+
+	return size;
+}
+
+static ssize_t send_data(struct dvb_client *client, const char *fmt, ...)
 	__attribute__ (( format( printf, 2, 3 )));
 
-static ssize_t send_data(int fd, const char *fmt, ...)
+static ssize_t send_data(struct dvb_client *client, const char *fmt, ...)
 {
 	char buf[REMOTE_BUF_SIZE];
 	va_list ap;
@@ -473,7 +714,7 @@ static ssize_t send_data(int fd, const char *fmt, ...)
 	if (ret < 0)
 		return ret;
 
-	return send_buf(fd, buf, ret);
+	return send_buf(client, buf, ret);
 }
 
 static ssize_t scan_data(char *buf, int buf_size, const char *fmt, ...)
@@ -559,7 +800,7 @@ void dvb_remote_log(void *priv, int level, const char *fmt, ...)
 	char *buf;
 
 	va_list ap;
-	int fd = *(int*)priv;
+	struct dvb_client *client = priv;
 
 	va_start(ap, fmt);
 	ret = vasprintf(&buf, fmt, ap);
@@ -570,8 +811,8 @@ void dvb_remote_log(void *priv, int level, const char *fmt, ...)
 
 	va_end(ap);
 
-	if (fd >= 0)
-		send_data(fd, "%i%s%i%s", 0, "log", level, buf);
+	if (client && client->fd >= 0)
+		send_data(client, "%i%s%i%s", 0, "log", level, buf);
 	else
 		local_log(level, buf);
 
@@ -581,7 +822,9 @@ void dvb_remote_log(void *priv, int level, const char *fmt, ...)
 static int dev_change_monitor(char *sysname,
 			      enum dvb_dev_change_type type, void *user_priv)
 {
-	send_data(dvb_fd, "%i%s%i%s", 0, "dev_change", type, sysname);
+	struct dvb_client *client = user_priv;
+
+	send_data(client, "%i%s%i%s", 0, "dev_change", type, sysname);
 
 	return 0;
 }
@@ -590,15 +833,24 @@ static int dev_change_monitor(char *sysname,
 /*
  * command handler methods
  */
-static int daemon_get_version(uint32_t seq, char *cmd, int fd,
+static int daemon_get_version(uint32_t seq, char *cmd, struct dvb_client *client,
 			      char *buf, ssize_t size)
 {
-	int ret = 0;
+	int ret = 0, proto;
 
-	return send_data(fd, "%i%s%i%s", seq, cmd, ret, argp_program_version);
+	/* Protocol version 1 clients don't send their version */
+	if (scan_data(buf, size, "%i", &proto) > 0 && proto > 1)
+		client->proto = proto < REMOTE_PROTO_VERSION ?
+				proto : REMOTE_PROTO_VERSION;
+	else
+		client->proto = 1;
+
+	return send_data(client, "%i%s%i%s%i", seq, cmd, ret, argp_program_version,
+			 REMOTE_PROTO_VERSION);
 }
 
-static int dev_find(uint32_t seq, char *cmd, int fd, char *buf, ssize_t size)
+static int dev_find(uint32_t seq, char *cmd, struct dvb_client *client,
+		    char *buf, ssize_t size)
 {
 	int enable_monitor = 0, ret;
 	dvb_dev_change_t handler = NULL;
@@ -610,21 +862,21 @@ static int dev_find(uint32_t seq, char *cmd, int fd, char *buf, ssize_t size)
 	if (enable_monitor)
 		handler = &dev_change_monitor;
 
-	ret = dvb_dev_find(dvb, handler, NULL);
+	ret = dvb_dev_find(client->dvb, handler, client);
 
 error:
-	return send_data(fd, "%i%s%i", seq, cmd, ret);
+	return send_data(client, "%i%s%i", seq, cmd, ret);
 }
 
-static int dev_stop_monitor(uint32_t seq, char *cmd, int fd,
+static int dev_stop_monitor(uint32_t seq, char *cmd, struct dvb_client *client,
 			    char *buf, ssize_t size)
 {
-	dvb_dev_stop_monitor(dvb);
+	dvb_dev_stop_monitor(client->dvb);
 
-	return send_data(fd, "%i%s%i", seq, cmd, 0);
+	return send_data(client, "%i%s%i", seq, cmd, 0);
 }
 
-static int dev_seek_by_adapter(uint32_t seq, char *cmd, int fd,
+static int dev_seek_by_adapter(uint32_t seq, char *cmd, struct dvb_client *client,
 			       char *buf, ssize_t size)
 {
 	struct dvb_dev_list *dev;
@@ -634,19 +886,19 @@ static int dev_seek_by_adapter(uint32_t seq, char *cmd, int fd,
 	if (ret < 0)
 		goto error;
 
-	dev = dvb_dev_seek_by_adapter(dvb, adapter, num, type);
+	dev = dvb_dev_seek_by_adapter(client->dvb, adapter, num, type);
 	if (!dev)
 		goto error;
 
-	return send_data(fd, "%i%s%i%s%s%s%i%s%s%s%s%s", seq, cmd, ret,
+	return send_data(client, "%i%s%i%s%s%s%i%s%s%s%s%s", seq, cmd, ret,
 			 dev->syspath, dev->path, dev->sysname, dev->dvb_type,
 			 dev->bus_addr, dev->bus_id, dev->manufacturer,
 			 dev->product, dev->serial);
 error:
-	return send_data(fd, "%i%s%i", seq, cmd, ret);
+	return send_data(client, "%i%s%i", seq, cmd, ret);
 }
 
-static int dev_get_dev_info(uint32_t seq, char *cmd, int fd,
+static int dev_get_dev_info(uint32_t seq, char *cmd, struct dvb_client *client,
 			       char *buf, ssize_t size)
 {
 	struct dvb_dev_list *dev;
@@ -657,40 +909,112 @@ static int dev_get_dev_info(uint32_t seq, char *cmd, int fd,
 	if (ret < 0)
 		goto error;
 
-	dev = dvb_get_dev_info(dvb, sysname);
+	dev = dvb_get_dev_info(client->dvb, sysname);
 	if (!dev)
 		goto error;
 
-	return send_data(fd, "%i%s%i%s%s%s%i%s%s%s%s%s", seq, cmd, ret,
+	return send_data(client, "%i%s%i%s%s%s%i%s%s%s%s%s", seq, cmd, ret,
 			 dev->syspath, dev->path, dev->sysname, dev->dvb_type,
 			 dev->bus_addr, dev->bus_id, dev->manufacturer,
 			 dev->product, dev->serial);
 error:
-	return send_data(fd, "%i%s%i", seq, cmd, ret);
+	return send_data(client, "%i%s%i", seq, cmd, ret);
+}
+
+static void desc_count_read(struct dvb_descriptors *desc, int read_ret)
+{
+	if (read_ret == -EAGAIN)
+		return;
+	desc->reads++;
+	if (read_ret > 0)
+		desc->read_bytes += read_ret;
+	else if (read_ret == -EOVERFLOW)
+		desc->overflows++;
+	else if (read_ret < 0)
+		desc->read_errors++;
+}
+
+static uint64_t shm_ring_free(struct dvb_shm_ring *shm)
+{
+	return shm->size - (shm->write -
+			    __atomic_load_n(&shm->read, __ATOMIC_ACQUIRE));
+}
+
+/*
+ * Reads from the device straight into the free space of the shared memory
+ * ring, waking up the client if it is waiting for data.
+ */
+static void read_shm_ring(struct dvb_descriptors *desc)
+{
+	struct dvb_shm_ring *shm = desc->shm;
+	char *data = (char *)shm + shm->data_offset;
+	uint64_t pos, count, one = 1;
+	int read_ret;
+
+	count = shm_ring_free(shm);
+	if (!count)
+		return;
+	pos = shm->write % shm->size;
+	if (count > shm->size - pos)
+		count = shm->size - pos;
+
+	read_ret = dvb_dev_read(desc->open_dev, data + pos, count);
+	if (verbose > 1)
+		dbg("#%d: read %d bytes into the ring", desc->uid, read_ret);
+	desc_count_read(desc, read_ret);
+
+	/* Pairs with the store to waiting at the client */
+	if (read_ret > 0)
+		__atomic_store_n(&shm->write, shm->write + read_ret,
+				 __ATOMIC_SEQ_CST);
+	else if (read_ret < 0 && read_ret != -EAGAIN)
+		__atomic_store_n(&shm->rc, read_ret, __ATOMIC_RELEASE);
+	else
+		return;
+
+	if (__atomic_exchange_n(&shm->waiting, 0, __ATOMIC_SEQ_CST)) {
+		if (write(desc->shm_efd, &one, sizeof(one)) < 0)
+			local_perror("eventfd write");
+	}
 }
 
 static void *read_data(void *privdata)
 {
+	struct dvb_client *client = privdata;
+	struct dvb_descriptors *desc;
 	struct dvb_open_descriptor *open_dev;
 	int timeout;
 	int ret, read_ret = -1, fd, i;
-	char databuf[REMOTE_BUF_SIZE];
-	char buf[REMOTE_BUF_SIZE + 32], *p;
-	size_t size;
+	char *databuf;
+	char hdr[32];
+	struct iovec iov[2];
 	size_t count;
 	struct pollfd __fds[NUM_FOPEN];
 	nfds_t __numfds;
 
+	databuf = malloc(REMOTE_MAX_BUF_SIZE);
+	if (!databuf) {
+		local_perror("malloc");
+		return NULL;
+	}
+
 	timeout = 10; /* ms */
 	while (1) {
-		pthread_mutex_lock(&dvb_read_mutex);
-		if (!numfds) {
-			pthread_mutex_unlock(&dvb_read_mutex);
+		pthread_mutex_lock(&client->dvb_read_mutex);
+		if (client->stop_read) {
+			pthread_mutex_unlock(&client->dvb_read_mutex);
 			break;
 		}
-		__numfds = numfds;
-		memcpy(__fds, fds, sizeof(fds));
-		pthread_mutex_unlock(&dvb_read_mutex);
+		__numfds = client->numfds;
+		memcpy(__fds, client->fds, sizeof(*__fds) * __numfds);
+
+		/* Don't wake up for the shared memory rings that are full */
+		for (i = 0; i < __numfds; i++) {
+			desc = get_desc(client, __fds[i].fd);
+			if (desc && desc->shm && !shm_ring_free(desc->shm))
+				__fds[i].events = 0;
+		}
+		pthread_mutex_unlock(&client->dvb_read_mutex);
 
 		ret = poll(__fds, __numfds, timeout);
 		if (!ret)
@@ -700,81 +1024,82 @@ static void *read_data(void *privdata)
 			continue;
 		}
 
+		/*
+		 * Service all ready descriptors at every poll round, in
+		 * order to not starve the ones at the end of the table.
+		 */
 		for (i = 0; i < __numfds; i++) {
+			/*
+			 * An error condition happened.
+			 * Likely the file was closed.
+			 */
 			if (__fds[i].revents & (POLLERR | POLLHUP | POLLNVAL))
 				continue;
-			if (__fds[i].revents)
-				break;
-		}
-
-		/*
-		 * it means that one error condition happened.
-		 * Likely the file was closed.
-		 */
-		if (i == __numfds)
-			continue;
-
-		fd = __fds[i].fd;
-
-		if (!desc_root)
-			break;
-
-		open_dev = get_open_dev(fd);
-		if (!open_dev) {
-			err("Couldn't find opened file %d", fd);
-			continue;
-		}
+			if (!__fds[i].revents)
+				continue;
 
-		count = REMOTE_BUF_SIZE;
-		read_ret = dvb_dev_read(open_dev, databuf, count);
-		if (verbose) {
-			if (read_ret < 0)
-				dbg("#%d: read error: %d on %p", fd, read_ret, open_dev);
-			else
-				dbg("#%d: read %d bytes (count %d)", fd, read_ret, count);
-		}
+			fd = __fds[i].fd;
 
-		/* Initialize to the start of the buffer */
-		p = buf;
-		size = sizeof(buf);
+			/*
+			 * Hold the lock while reading, as the client thread
+			 * may be closing the descriptor meanwhile.
+			 */
+			pthread_mutex_lock(&client->dvb_read_mutex);
+			desc = get_desc(client, fd);
+			if (!desc) {
+				pthread_mutex_unlock(&client->dvb_read_mutex);
+				continue;
+			}
+			open_dev = desc->open_dev;
 
-		ret = prepare_data(p, size, "%i%s%i%i", 0, "data_read",
-				   read_ret, fd);
-		if (ret < 0) {
-			err("Failed to prepare answer to dvb_read()");
-			break;
-		}
+			if (desc->shm) {
+				read_shm_ring(desc);
+				pthread_mutex_unlock(&client->dvb_read_mutex);
+				continue;
+			}
 
-		p += ret;
-		size -= ret;
+			count = desc->xfer_size;
+			read_ret = dvb_dev_read(open_dev, databuf, count);
+			desc_count_read(desc, read_ret);
+			pthread_mutex_unlock(&client->dvb_read_mutex);
+			if (verbose) {
+				if (read_ret < 0)
+					dbg("#%d: read error: %d on %p", fd, read_ret, open_dev);
+				else
+					dbg("#%d: read %d bytes (count %d)", fd, read_ret, count);
+			}
 
-		if (read_ret > 0) {
-			if (read_ret > size) {
-				dbg("buffer to short to store read data!");
-				read_ret = -EOVERFLOW;
-			} else {
-				memcpy(p, databuf, read_ret);
-				p += read_ret;
+			ret = prepare_data(hdr, sizeof(hdr), "%i%s%i%i", 0,
+					   "data_read", read_ret, fd);
+			if (ret < 0) {
+				err("Failed to prepare answer to dvb_read()");
+				goto finish;
 			}
-		}
 
-		ret = send_buf(dvb_fd, buf, p - buf);
-		if (ret < 0) {
-			err("Error %d sending buffer\n", ret);
-			if (ret == ECONNRESET) {
-				close_all_devs();
-				break;
+			/* Send the header and the data as a single message */
+			iov[0].iov_base = hdr;
+			iov[0].iov_len = ret;
+			iov[1].iov_base = databuf;
+			iov[1].iov_len = read_ret > 0 ? read_ret : 0;
+
+			ret = send_bufv(client, iov, 2);
+			if (ret < 0) {
+				err("Error %d sending buffer\n", ret);
+				/* The client thread will clean up */
+				if (ret == -ECONNRESET || ret == -EPIPE)
+					goto finish;
 			}
-			continue;
 		}
 	}
 
+finish:
+	free(databuf);
 	dbg("Finishing kthread");
-	read_id = 0;
 	return NULL;
 }
 
-static int dev_open(uint32_t seq, char *cmd, int fd, char *buf, ssize_t size)
+static int dev_open(uint32_t seq, char *cmd, struct dvb_client *client,
+		    char *buf, ssize_t size)
 {
 	struct dvb_open_descriptor *open_dev;
 	struct dvb_dev_list *dev;
@@ -801,7 +1126,7 @@ static int dev_open(uint32_t seq, char *cmd, int fd, char *buf, ssize_t size)
 	 */
 	flags &= ~O_NONBLOCK;
 
-	open_dev = dvb_dev_open(dvb, sysname, flags);
+	open_dev = dvb_dev_open(client->dvb, sysname, flags);
 	if (!open_dev) {
 		ret = -errno;
 		free(desc);
@@ -812,50 +1137,53 @@ static int dev_open(uint32_t seq, char *cmd, int fd, char *buf, ssize_t size)
 	if (verbose)
 		dbg("open dev handler for %s: %p with uid#%d", sysname, open_dev, open_dev->fd);
 
-	dev = open_dev->dev;
-	if (dev->dvb_type == DVB_DEVICE_DEMUX ||
-	    dev->dvb_type == DVB_DEVICE_DVR) {
-		pthread_mutex_lock(&dvb_read_mutex);
-		fds[numfds].fd = open_dev->fd;
-		fds[numfds].events = POLLIN | POLLPRI;
-		numfds++;
-		pthread_mutex_unlock(&dvb_read_mutex);
-	}
-
-	if (!read_id) {
-		ret = pthread_create(&read_id, NULL, read_data, NULL);
-		if (ret < 0) {
-			local_perror("pthread_create");
-			pthread_mutex_unlock(&msg_mutex);
-			free(desc);
-			return -1;
-		}
-	}
-
-	pthread_mutex_unlock(&msg_mutex);
 	uid = open_dev->fd;
 
 	desc->uid = uid;
 	desc->open_dev = open_dev;
+	desc->xfer_size = REMOTE_BUF_SIZE;
+
+	pthread_mutex_lock(&client->dvb_read_mutex);
 
 	/* Add element to the desc_root tree */
-	p = tsearch(desc, &desc_root, dvb_desc_compare);
+	p = tsearch(desc, &client->desc_root, dvb_desc_compare);
 	if (!p) {
 		local_perror("tsearch");
-		uid = 0;
+		pthread_mutex_unlock(&client->dvb_read_mutex);
+		dvb_dev_close(open_dev);
+		free(desc);
+		ret = -ENOMEM;
+		goto error;
 	}
-	if (*p != desc) {
-		err("uid %d was already opened!");
+	if (*p != desc)
+		err("uid %d was already opened!", uid);
+
+	dev = open_dev->dev;
+	if (dev->dvb_type == DVB_DEVICE_DEMUX ||
+	    dev->dvb_type == DVB_DEVICE_DVR) {
+		client->fds[client->numfds].fd = open_dev->fd;
+		client->fds[client->numfds].events = POLLIN | POLLPRI;
+		client->numfds++;
 	}
+	pthread_mutex_unlock(&client->dvb_read_mutex);
 
-	pthread_mutex_unlock(&msg_mutex);
+	if (!client->read_running) {
+		ret = pthread_create(&client->read_id, NULL, read_data, client);
+		if (ret) {
+			errno = ret;
+			local_perror("pthread_create");
+			return -1;
+		}
+		client->read_running = 1;
+	}
 
 	ret = uid;
 error:
-	return send_data(fd, "%i%s%i", seq, cmd, ret);
+	return send_data(client, "%i%s%i", seq, cmd, ret);
 }
 
-static int dev_close(uint32_t seq, char *cmd, int fd, char *buf, ssize_t size)
+static int dev_close(uint32_t seq, char *cmd, struct dvb_client *client,
+		     char *buf, ssize_t size)
 {
 	struct dvb_open_descriptor *open_dev;
 	int uid, ret, i;
@@ -864,7 +1192,7 @@ static int dev_close(uint32_t seq, char *cmd, int fd, char *buf, ssize_t size)
 	if (ret < 0)
 		goto error;
 
-	open_dev = get_open_dev(uid);
+	open_dev = get_open_dev(client, uid);
 	if (!open_dev) {
 		err("Can't find uid to close");
 		ret = -1;
@@ -872,30 +1200,26 @@ static int dev_close(uint32_t seq, char *cmd, int fd, char *buf, ssize_t size)
 	}
 
 	/* Delete fd from the opened array */
-	pthread_mutex_lock(&dvb_read_mutex);
-	for (i = 0; i < numfds; i++) {
-		if (fds[i].fd != open_dev->fd)
+	pthread_mutex_lock(&client->dvb_read_mutex);
+	for (i = 0; i < client->numfds; i++) {
+		if (client->fds[i].fd != open_dev->fd)
 		    continue;
-		if (i < numfds - 1)
-			memmove(&fds[i], &fds[i + 1],
-				sizeof(*fds)*(numfds - i - 1));
-		numfds--;
+		if (i < client->numfds - 1)
+			memmove(&client->fds[i], &client->fds[i + 1],
+				sizeof(*client->fds)*(client->numfds - i - 1));
+		client->numfds--;
 		break;
 	}
-	pthread_mutex_unlock(&dvb_read_mutex);
-	if (read_id && !numfds) {
-		pthread_cancel(read_id);
-		read_id = 0;
-	}
 
 	dvb_dev_close(open_dev);
-	destroy_open_dev(uid);
+	destroy_open_dev(client, uid);
+	pthread_mutex_unlock(&client->dvb_read_mutex);
 
 error:
-	return send_data(fd, "%i%s%i", seq, cmd, ret);
+	return send_data(client, "%i%s%i", seq, cmd, ret);
 }
 
-static int dev_dmx_stop(uint32_t seq, char *cmd, int fd,
+static int dev_dmx_stop(uint32_t seq, char *cmd, struct dvb_client *client,
 			char *buf, ssize_t size)
 {
 	struct dvb_open_descriptor *open_dev;
@@ -905,7 +1229,7 @@ static int dev_dmx_stop(uint32_t seq, char *cmd, int fd,
 	if (ret < 0)
 		goto error;
 
-	open_dev = get_open_dev(uid);
+	open_dev = get_open_dev(client, uid);
 	if (!open_dev) {
 		ret = -1;
 		err("Can't find uid to stop");
@@ -915,33 +1239,72 @@ static int dev_dmx_stop(uint32_t seq, char *cmd, int fd,
 	dvb_dev_dmx_stop(open_dev);
 
 error:
-	return send_data(fd, "%i%s%i", seq, cmd, ret);
+	return send_data(client, "%i%s%i", seq, cmd, ret);
+}
+
+/*
+ * Transfer unit used for a given demux/dvr buffer size: a quarter of it,
+ * in order to keep the kernel buffer from filling up while a chunk is
+ * in transit, rounded down to whole TS packets.
+ */
+static int get_xfer_size(int bufsize)
+{
+	int xfer_size = bufsize / 4;
+
+	if (xfer_size > REMOTE_MAX_BUF_SIZE)
+		xfer_size = REMOTE_MAX_BUF_SIZE;
+	xfer_size -= xfer_size % 188;
+	if (xfer_size < REMOTE_BUF_SIZE)
+		xfer_size = REMOTE_BUF_SIZE;
+
+	return xfer_size;
 }
 
-static int dev_set_bufsize(uint32_t seq, char *cmd, int fd,
+static int dev_set_bufsize(uint32_t seq, char *cmd, struct dvb_client *client,
 			   char *buf, ssize_t size)
 {
-	struct dvb_open_descriptor *open_dev;
-	int uid, ret, bufsize;
+	struct dvb_descriptors *desc;
+	int uid, ret, bufsize, sndbuf;
 
 	ret = scan_data(buf, size, "%i%i",  &uid, &bufsize);
 	if (ret < 0)
 		goto error;
 
-	open_dev = get_open_dev(uid);
-	if (!open_dev) {
+	desc = get_desc(client, uid);
+	if (!desc) {
 		ret = -1;
 		err("Can't find uid to stop");
 		goto error;
 	}
 
-	dvb_dev_set_bufsize(open_dev, bufsize);
+	dvb_dev_set_bufsize(desc->open_dev, bufsize);
+
+	/* Older clients can't receive anything bigger */
+	if (client->proto < 2)
+		goto error;
+
+	desc->xfer_size = get_xfer_size(bufsize);
+
+	/*
+	 * Make room for a couple of messages at the socket. The data
+	 * channel already has a large buffer.
+	 */
+	if (client->data_fd < 0) {
+		sndbuf = desc->xfer_size * 2;
+		setsockopt(client->fd, SOL_SOCKET, SO_SNDBUF,
+			   (void *)&sndbuf, (int)sizeof(sndbuf));
+	}
+
+	if (verbose)
+		dbg("#%d: using %d bytes data transfers", uid, desc->xfer_size);
+
+	return send_data(client, "%i%s%i%i", seq, cmd, ret, desc->xfer_size);
 
 error:
-	return send_data(fd, "%i%s%i", seq, cmd, ret);
+	return send_data(client, "%i%s%i", seq, cmd, ret);
 }
 
-static int dev_dmx_set_pesfilter(uint32_t seq, char *cmd, int fd,
+static int dev_dmx_set_pesfilter(uint32_t seq, char *cmd, struct dvb_client *client,
 				 char *buf, ssize_t size)
 {
 	struct dvb_open_descriptor *open_dev;
@@ -952,7 +1315,7 @@ static int dev_dmx_set_pesfilter(uint32_t seq, char *cmd, int fd,
 	if (ret < 0)
 		goto error;
 
-	open_dev = get_open_dev(uid);
+	open_dev = get_open_dev(client, uid);
 	if (!open_dev) {
 		ret = -1;
 		err("Can't find uid to set pesfilter");
@@ -962,10 +1325,10 @@ static int dev_dmx_set_pesfilter(uint32_t seq, char *cmd, int fd,
 	ret = dvb_dev_dmx_set_pesfilter(open_dev, pid, type, output, bufsize);
 
 error:
-	return send_data(fd, "%i%s%i", seq, cmd, ret);
+	return send_data(client, "%i%s%i", seq, cmd, ret);
 }
 
-static int dev_dmx_set_section_filter(uint32_t seq, char *cmd, int fd,
+static int dev_dmx_set_section_filter(uint32_t seq, char *cmd, struct dvb_client *client,
 				      char *buf, ssize_t size)
 {
 	struct dvb_open_descriptor *open_dev;
@@ -977,7 +1340,7 @@ static int dev_dmx_set_section_filter(uint32_t seq, char *cmd, int fd,
 	if (ret < 0)
 		goto error;
 
-	open_dev = get_open_dev(uid);
+	open_dev = get_open_dev(client, uid);
 	if (!open_dev) {
 		ret = -1;
 		err("Can't find uid to set section filter");
@@ -988,10 +1351,10 @@ static int dev_dmx_set_section_filter(uint32_t seq, char *cmd, int fd,
 					     mask, mode, flags);
 
 error:
-	return send_data(fd, "%i%s%i", seq, cmd, ret);
+	return send_data(client, "%i%s%i", seq, cmd, ret);
 }
 
-static int dev_dmx_get_pmt_pid(uint32_t seq, char *cmd, int fd,
+static int dev_dmx_get_pmt_pid(uint32_t seq, char *cmd, struct dvb_client *client,
 			       char *buf, ssize_t size)
 {
 	struct dvb_open_descriptor *open_dev;
@@ -1001,7 +1364,7 @@ static int dev_dmx_get_pmt_pid(uint32_t seq, char *cmd, int fd,
 	if (ret < 0)
 		goto error;
 
-	open_dev = get_open_dev(uid);
+	open_dev = get_open_dev(client, uid);
 	if (!open_dev) {
 		ret = -1;
 		err("Can't find uid to get PMT PID");
@@ -1011,10 +1374,11 @@ static int dev_dmx_get_pmt_pid(uint32_t seq, char *cmd, int fd,
 	ret = dvb_dev_dmx_get_pmt_pid(open_dev, sid);
 
 error:
-	return send_data(fd, "%i%s%i", seq, cmd, ret);
+	return send_data(client, "%i%s%i", seq, cmd, ret);
 }
 
-static int dev_scan(uint32_t seq, char *cmd, int fd, char *buf, ssize_t size)
+static int dev_scan(uint32_t seq, char *cmd, struct dvb_client *client,
+		    char *buf, ssize_t size)
 {
 	int ret = -1;
 
@@ -1031,7 +1395,7 @@ static int dev_scan(uint32_t seq, char *cmd, int fd, char *buf, ssize_t size)
 	if (ret < 0)
 		goto error;
 
-	open_dev = get_open_dev(uid);
+	open_dev = get_open_dev(client, uid);
 	if (!open_dev) {
 		ret = -1;
 		err("Can't find uid to scan");
@@ -1041,16 +1405,16 @@ static int dev_scan(uint32_t seq, char *cmd, int fd, char *buf, ssize_t size)
 	ret = dvb_scan(foo);
 
 error:
-	return send_data(fd, "%i%s%i", seq, cmd, ret);
+	return send_data(client, "%i%s%i", seq, cmd, ret);
 #else
-	return send_data(fd, "%i%s%i", seq, cmd, ret);
+	return send_data(client, "%i%s%i", seq, cmd, ret);
 #endif
 }
 
-static int dev_set_sys(uint32_t seq, char *cmd, int fd,
+static int dev_set_sys(uint32_t seq, char *cmd, struct dvb_client *client,
 		       char *buf, ssize_t size)
 {
-	struct dvb_v5_fe_parms_priv *parms = (void *)dvb->fe_parms;
+	struct dvb_v5_fe_parms_priv *parms = (void *)client->dvb->fe_parms;
 	struct dvb_v5_fe_parms *p = (void *)parms;
 	int sys = 0, ret;
 
@@ -1060,13 +1424,13 @@ static int dev_set_sys(uint32_t seq, char *cmd, int fd,
 
 	ret = __dvb_set_sys(p, sys);
 error:
-	return send_data(fd, "%i%s%i", seq, cmd, ret);
+	return send_data(client, "%i%s%i", seq, cmd, ret);
 }
 
-static int dev_get_parms(uint32_t seq, char *cmd, int fd,
+static int dev_get_parms(uint32_t seq, char *cmd, struct dvb_client *client,
 			 char *inbuf, ssize_t insize)
 {
-	struct dvb_v5_fe_parms_priv *parms = (void *)dvb->fe_parms;
+	struct dvb_v5_fe_parms_priv *parms = (void *)client->dvb->fe_parms;
 	struct dvb_v5_fe_parms *par = (void *)parms;
 	struct dvb_frontend_info *info = &par->info;
 	int ret, i;
@@ -1145,15 +1509,15 @@ static int dev_get_parms(uint32_t seq, char *cmd, int fd,
 	strcpy(output_charset, par->output_charset);
 	strcpy(default_charset, par->default_charset);
 
-	return send_buf(fd, buf, p - buf);
+	return send_buf(client, buf, p - buf);
 error:
-	return send_data(fd, "%i%s%i", seq, cmd, ret);
+	return send_data(client, "%i%s%i", seq, cmd, ret);
 }
 
-static int dev_set_parms(uint32_t seq, char *cmd, int fd,
+static int dev_set_parms(uint32_t seq, char *cmd, struct dvb_client *client,
 			 char *buf, ssize_t size)
 {
-	struct dvb_v5_fe_parms_priv *parms = (void *)dvb->fe_parms;
+	struct dvb_v5_fe_parms_priv *parms = (void *)client->dvb->fe_parms;
 	struct dvb_v5_fe_parms *par = (void *)parms;
 	int ret, i;
 	char *p = buf;
@@ -1221,13 +1585,13 @@ static int dev_set_parms(uint32_t seq, char *cmd, int fd,
 	ret = __dvb_fe_set_parms(par);
 
 error:
-	return send_data(fd, "%i%s%i", seq, cmd, ret);
+	return send_data(client, "%i%s%i", seq, cmd, ret);
 }
 
-static int dev_get_stats(uint32_t seq, char *cmd, int fd,
+static int dev_get_stats(uint32_t seq, char *cmd, struct dvb_client *client,
 			 char *inbuf, ssize_t insize)
 {
-	struct dvb_v5_fe_parms_priv *parms = (void *)dvb->fe_parms;
+	struct dvb_v5_fe_parms_priv *parms = (void *)client->dvb->fe_parms;
 	struct dvb_v5_stats *st = &parms->stats;
 	struct dvb_v5_fe_parms *par = (void *)parms;
 	int ret, i;
@@ -1295,84 +1659,841 @@ static int dev_get_stats(uint32_t seq, char *cmd, int fd,
 		size -= ret;
 	}
 
-	return send_buf(fd, buf, p - buf);
+	return send_buf(client, buf, p - buf);
 error:
-	return send_data(fd, "%i%s%i", seq, cmd, ret);
+	return send_data(client, "%i%s%i", seq, cmd, ret);
 }
 
 /*
- * Structure with all methods with RPC calls
+ * Creates a shared memory ring for a DVR device of a local client, and
+ * passes its memfd and its eventfd within the answer. From then on, the
+ * data is written to the ring instead of sent via data_read messages.
  */
+#define MAX_SHM_RING_SIZE	(64 * 1024 * 1024)
 
-typedef int (*method_handler) (uint32_t seq, char *cmd, int fd,
-			       char *buf, ssize_t size);
+static int dev_shm_ring(uint32_t seq, char *cmd, struct dvb_client *client,
+			char *buf, ssize_t size)
+{
+	struct dvb_descriptors *desc;
+	int uid, ret, ring_size, fds[2];
+	uint32_t data_offset = 4096;
+	struct dvb_shm_ring *shm;
+	char answer[REMOTE_BUF_SIZE];
+	size_t len;
+
+	ret = scan_data(buf, size, "%i%i", &uid, &ring_size);
+	if (ret < 0)
+		goto error;
 
-struct method_types {
-	char *name;
-	method_handler handler;
-	int locks_dvb;
-};
+	if (!client->is_local || client->proto < 4) {
+		ret = -EPERM;
+		goto error;
+	}
+#ifndef HAVE_MEMFD_CREATE
+	ret = -ENOTSUP;
+	goto error;
+#else
+	desc = get_desc(client, uid);
+	if (!desc) {
+		ret = -EINVAL;
+		err("Can't find uid for the ring");
+		goto error;
+	}
+	if (desc->shm || desc->open_dev->dev->dvb_type != DVB_DEVICE_DVR) {
+		ret = -EINVAL;
+		goto error;
+	}
+	if (ring_size > MAX_SHM_RING_SIZE)
+		ring_size = MAX_SHM_RING_SIZE;
+	if (ring_size < REMOTE_MAX_BUF_SIZE)
+		ring_size = REMOTE_MAX_BUF_SIZE;
+	ring_size -= ring_size % 188;
+	len = data_offset + ring_size;
+
+	fds[0] = memfd_create("dvbv5-ring", MFD_CLOEXEC);
+	if (fds[0] < 0) {
+		ret = -errno;
+		local_perror("memfd_create");
+		goto error;
+	}
+	if (ftruncate(fds[0], len) < 0) {
+		ret = -errno;
+		local_perror("ftruncate");
+		close(fds[0]);
+		goto error;
+	}
+	shm = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_SHARED, fds[0], 0);
+	if (shm == MAP_FAILED) {
+		ret = -errno;
+		local_perror("mmap");
+		close(fds[0]);
+		goto error;
+	}
+	fds[1] = eventfd(0, EFD_CLOEXEC);
+	if (fds[1] < 0) {
+		ret = -errno;
+		local_perror("eventfd");
+		munmap(shm, len);
+		close(fds[0]);
+		goto error;
+	}
 
-static const struct method_types methods[] = {
-	{"daemon_get_version", &daemon_get_version, 1},
-	{"dev_find", &dev_find, 0},
-	{"dev_stop_monitor", &dev_stop_monitor, 0},
-	{"dev_seek_by_adapter", &dev_seek_by_adapter, 0},
-	{"dev_get_dev_info", &dev_get_dev_info, 0},
-	{"dev_open", &dev_open, 0},
-	{"dev_close", &dev_close, 0},
-	{"dev_dmx_stop", &dev_dmx_stop, 0},
-	{"dev_set_bufsize", &dev_set_bufsize, 0},
-	{"dev_dmx_set_pesfilter", &dev_dmx_set_pesfilter, 0},
-	{"dev_dmx_set_section_filter", &dev_dmx_set_section_filter, 0},
-	{"dev_dmx_get_pmt_pid", &dev_dmx_get_pmt_pid, 0},
+	shm->magic = DVB_SHM_RING_MAGIC;
+	shm->data_offset = data_offset;
+	shm->size = ring_size;
 
-	{"dev_scan", &dev_scan, 0},
+	/*
+	 * Switch to the ring before answering, as the client may already
+	 * be waiting on it when it gets the answer.
+	 */
+	pthread_mutex_lock(&client->dvb_read_mutex);
+	desc->shm = shm;
+	desc->shm_len = len;
+	desc->shm_efd = fds[1];
+	pthread_mutex_unlock(&client->dvb_read_mutex);
+
+	ret = prepare_data(answer, sizeof(answer), "%i%s%i%i", seq, cmd, 0,
+			   ring_size);
+	if (ret >= 0)
+		ret = send_buf_fds(client, answer, ret, fds, 2);
+	close(fds[0]);
+	if (ret < 0) {
+		pthread_mutex_lock(&client->dvb_read_mutex);
+		free_desc_shm(desc);
+		pthread_mutex_unlock(&client->dvb_read_mutex);
+		return ret;
+	}
 
-	{"dev_set_sys", &dev_set_sys, 0},
-	{"fe_get_parms", &dev_get_parms, 0},
-	{"fe_set_parms", &dev_set_parms, 0},
-	{"fe_get_stats", &dev_get_stats, 0},
+	if (verbose)
+		dbg("#%d: using a %d bytes shared memory ring", uid, ring_size);
+	return 0;
+#endif
 
-	{}
-};
+error:
+	return send_data(client, "%i%s%i", seq, cmd, ret);
+}
 
-static void *start_server(void *fd_pointer)
+static int data_channel_open(uint32_t seq, char *cmd, struct dvb_client *client,
+			     char *buf, ssize_t size)
 {
-	const struct method_types *method;
-	int fd = *(int *)fd_pointer, ret, flag = 1;
-	char buf[REMOTE_BUF_SIZE + 8], cmd[80], *p;
-	ssize_t size;
-	uint32_t seq;
-	int bufsize;
+	unsigned char rnd[16];
+	int i, fd, ret = 0;
 
-	if (verbose)
-		dbg("Opening socket %d", fd);
+	fd = open("/dev/urandom", O_RDONLY | O_CLOEXEC);
+	if (fd < 0 || read(fd, rnd, sizeof(rnd)) != sizeof(rnd)) {
+		local_perror("/dev/urandom");
+		ret = -EIO;
+	}
+	if (fd >= 0)
+		close(fd);
+	if (ret < 0)
+		return send_data(client, "%i%s%i", seq, cmd, ret);
 
-	/* Set a large buffer for read() to work better */
+	pthread_mutex_lock(&clients_mutex);
+	for (i = 0; i < sizeof(rnd); i++)
+		sprintf(&client->token[2 * i], "%02x", rnd[i]);
+	pthread_mutex_unlock(&clients_mutex);
+
+	return send_data(client, "%i%s%i%s", seq, cmd, ret, client->token);
+}
+
+/*
+ * Called on the new connection. On success, the socket is handed over to
+ * the client that owns the token, and this connection thread finishes.
+ */
+static int data_channel_attach(uint32_t seq, char *cmd, struct dvb_client *client,
+			       char *buf, ssize_t size)
+{
+	char token[REMOTE_BUF_SIZE];
+	struct dvb_client *owner;
+	int ret, bufsize;
+
+	ret = scan_data(buf, size, "%s", token);
+	if (ret < 0)
+		return send_data(client, "%i%s%i", seq, cmd, ret);
+
+	pthread_mutex_lock(&clients_mutex);
+	for (owner = clients; owner; owner = owner->next)
+		if (owner != client && owner->token[0] &&
+		    !strcmp(owner->token, token))
+			break;
+	if (!owner || owner->data_fd >= 0) {
+		pthread_mutex_unlock(&clients_mutex);
+		err("no client waiting for a data channel with this token");
+		return send_data(client, "%i%s%i", seq, cmd, -EINVAL);
+	}
+
+	/*
+	 * Tune the socket for throughput: a large buffer and Nagle on, as
+	 * each data_read message is already sent with a single writev().
+	 */
+	bufsize = 4 * REMOTE_MAX_BUF_SIZE;
+	setsockopt(client->fd, SOL_SOCKET, SO_SNDBUF,
+		   (void *)&bufsize, (int)sizeof(bufsize));
+	ret = 0;
+	setsockopt(client->fd, IPPROTO_TCP, TCP_NODELAY, &ret, sizeof(ret));
+
+	ret = send_data(client, "%i%s%i", seq, cmd, 0);
+	if (ret < 0) {
+		pthread_mutex_unlock(&clients_mutex);
+		return ret;
+	}
+
+	pthread_mutex_lock(&owner->data_mutex);
+	owner->data_fd = client->fd;
+	owner->token[0] = '\0';
+	pthread_mutex_unlock(&owner->data_mutex);
+	pthread_mutex_unlock(&clients_mutex);
+
+	if (verbose)
+		dbg("socket %d is the data channel of socket %d",
+		    client->fd, owner->fd);
+
+	client->fd = -1;
+	return 0;
+}
+
+/*
+ * Structure with all methods with RPC calls
+ */
+
+typedef int (*method_handler) (uint32_t seq, char *cmd, struct dvb_client *client,
+			       char *buf, ssize_t size);
+
+struct method_types {
+	char *name;
+	method_handler handler;
+	int starts_session;
+};
+
+/* Per method metrics, updated atomically, as each client has its thread */
+struct method_stats {
+	uint64_t calls;
+	uint64_t ns;		/* time spent running the method */
+};
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void count_method(struct method_stats *st, uint64_t start)
+{
+	__atomic_fetch_add(&st->calls, 1, __ATOMIC_RELAXED);
+	__atomic_fetch_add(&st->ns, now_ns() - start, __ATOMIC_RELAXED);
+}
+
+static const struct method_types methods[] = {
+	{"daemon_get_version", &daemon_get_version, 1},
+	{"data_channel_open", &data_channel_open, 0},
+	{"data_channel_attach", &data_channel_attach, 1},
+	{"dev_find", &dev_find, 0},
+	{"dev_stop_monitor", &dev_stop_monitor, 0},
+	{"dev_seek_by_adapter", &dev_seek_by_adapter, 0},
+	{"dev_get_dev_info", &dev_get_dev_info, 0},
+	{"dev_open", &dev_open, 0},
+	{"dev_close", &dev_close, 0},
+	{"dev_dmx_stop", &dev_dmx_stop, 0},
+	{"dev_set_bufsize", &dev_set_bufsize, 0},
+	{"dev_shm_ring", &dev_shm_ring, 0},
+	{"dev_dmx_set_pesfilter", &dev_dmx_set_pesfilter, 0},
+	{"dev_dmx_set_section_filter", &dev_dmx_set_section_filter, 0},
+	{"dev_dmx_get_pmt_pid", &dev_dmx_get_pmt_pid, 0},
+
+	{"dev_scan", &dev_scan, 0},
+
+	{"dev_set_sys", &dev_set_sys, 0},
+	{"fe_get_parms", &dev_get_parms, 0},
+	{"fe_set_parms", &dev_set_parms, 0},
+	{"fe_get_stats", &dev_get_stats, 0},
+
+	{}
+};
+
+#define NUM_METHODS	(sizeof(methods) / sizeof(*methods) - 1)
+
+static struct method_stats method_stats[NUM_METHODS];
+
+/*
+ * Binary methods, dispatched by their opcode
+ */
+
+static void bin_counters(struct remote_bin_counters *out,
+			 const struct dvb_v5_counters *c)
+{
+	out->pre_bit_count = htobe64(c->pre_bit_count);
+	out->pre_bit_error = htobe64(c->pre_bit_error);
+	out->post_bit_count = htobe64(c->post_bit_count);
+	out->post_bit_error = htobe64(c->post_bit_error);
+	out->block_count = htobe64(c->block_count);
+	out->block_error = htobe64(c->block_error);
+}
+
+/* Reads the frontend stats, with fe_mutex held */
+static int get_bin_stats(struct dvb_client *client, struct remote_bin_stats *out)
+{
+	struct dvb_v5_fe_parms_priv *parms = (void *)client->dvb->fe_parms;
+	struct dvb_v5_stats *st = &parms->stats;
+	int ret, i, j;
+
+	ret = __dvb_fe_get_stats(&parms->p);
+	if (ret < 0)
+		return ret;
+
+	memset(out, 0, sizeof(*out));
+	out->prev_status = htobe32(st->prev_status);
+	for (i = 0; i < DTV_NUM_STATS_PROPS; i++) {
+		out->prop[i].cmd = htobe32(st->prop[i].cmd);
+		out->prop[i].len = htobe32(st->prop[i].u.st.len);
+		for (j = 0; j < MAX_DTV_STATS; j++) {
+			out->prop[i].stat[j].scale = st->prop[i].u.st.stat[j].scale;
+			out->prop[i].stat[j].value = htobe64(st->prop[i].u.st.stat[j].uvalue);
+		}
+	}
+	for (i = 0; i < MAX_DTV_STATS; i++) {
+		out->layer[i].has_post_ber = htobe32(st->has_post_ber[i]);
+		out->layer[i].has_pre_ber = htobe32(st->has_pre_ber[i]);
+		out->layer[i].has_per = htobe32(st->has_per[i]);
+		bin_counters(&out->layer[i].prev, &st->prev[i]);
+		bin_counters(&out->layer[i].cur, &st->cur[i]);
+	}
+
+	return ret;
+}
+
+static int bin_fe_get_stats(struct dvb_client *client,
+			    const struct remote_bin_hdr *hdr,
+			    char *buf, ssize_t size)
+{
+	struct remote_bin_stats out;
+	int ret;
+
+	ret = get_bin_stats(client, &out);
+	if (ret < 0)
+		return send_bin(client, hdr, ret, NULL, 0);
+
+	return send_bin(client, hdr, ret, &out, sizeof(out));
+}
+
+/*
+ * Pushes the props and layers that changed since the last sample. Returns
+ * the message size, or zero if nothing changed.
+ */
+static int push_stats_delta(struct dvb_client *client,
+			    const struct remote_bin_stats *cur)
+{
+	struct remote_bin_stats *last = &client->stats_last;
+	struct remote_bin_hdr hdr = { 0 };
+	struct remote_bin_stats_delta *delta;
+	char buf[sizeof(*delta) + sizeof(*cur)], *p;
+	uint32_t prop_mask = 0, layer_mask = 0;
+	int i;
+
+	delta = (void *)buf;
+	p = buf + sizeof(*delta);
+	for (i = 0; i < DTV_NUM_STATS_PROPS; i++) {
+		if (!memcmp(&cur->prop[i], &last->prop[i], sizeof(cur->prop[i])))
+			continue;
+		prop_mask |= 1 << i;
+		memcpy(p, &cur->prop[i], sizeof(cur->prop[i]));
+		p += sizeof(cur->prop[i]);
+	}
+	for (i = 0; i < MAX_DTV_STATS; i++) {
+		if (!memcmp(&cur->layer[i], &last->layer[i], sizeof(cur->layer[i])))
+			continue;
+		layer_mask |= 1 << i;
+		memcpy(p, &cur->layer[i], sizeof(cur->layer[i]));
+		p += sizeof(cur->layer[i]);
+	}
+	if (cur->prev_status == last->prev_status && !prop_mask && !layer_mask)
+		return 0;
+
+	*last = *cur;
+
+	delta->prev_status = cur->prev_status;
+	delta->prop_mask = htobe32(prop_mask);
+	delta->layer_mask = htobe32(layer_mask);
+
+	hdr.opcode = htobe16(REMOTE_OP_FE_STATS_EVENT);
+	return send_bin(client, &hdr, 0, buf, p - buf);
+}
+
+static void *stats_thread(void *privdata)
+{
+	struct dvb_client *client = privdata;
+	struct remote_bin_stats cur;
+	struct timespec ts;
+	unsigned int interval;
+	int ret;
+
+	pthread_mutex_lock(&client->stats_mutex);
+	while (client->stats_interval) {
+		interval = client->stats_interval;
+		clock_gettime(CLOCK_REALTIME, &ts);
+		ts.tv_sec += interval / 1000;
+		ts.tv_nsec += (interval % 1000) * 1000000L;
+		if (ts.tv_nsec >= 1000000000L) {
+			ts.tv_sec++;
+			ts.tv_nsec -= 1000000000L;
+		}
+		ret = pthread_cond_timedwait(&client->stats_cond,
+					     &client->stats_mutex, &ts);
+		if (ret != ETIMEDOUT)
+			continue;
+
+		/*
+		 * Don't wait for a method that owns the frontend, like a
+		 * scan: just skip this sample.
+		 */
+		if (pthread_mutex_trylock(&client->fe_mutex))
+			continue;
+		ret = get_bin_stats(client, &cur);
+		pthread_mutex_unlock(&client->fe_mutex);
+
+		if (ret >= 0 && push_stats_delta(client, &cur) < 0)
+			break;
+	}
+	client->stats_running = 0;
+	pthread_mutex_unlock(&client->stats_mutex);
+
+	dbg("Finishing stats thread");
+	return NULL;
+}
+
+static void stop_stats_thread(struct dvb_client *client)
+{
+	pthread_mutex_lock(&client->stats_mutex);
+	client->stats_interval = 0;
+	pthread_cond_signal(&client->stats_cond);
+	pthread_mutex_unlock(&client->stats_mutex);
+
+	if (client->stats_id) {
+		pthread_join(client->stats_id, NULL);
+		client->stats_id = 0;
+	}
+}
+
+#define MIN_STATS_INTERVAL	50	/* ms */
+
+static int bin_fe_stats_subscribe(struct dvb_client *client,
+				  const struct remote_bin_hdr *hdr,
+				  char *buf, ssize_t size)
+{
+	struct remote_bin_subscribe req;
+	struct remote_bin_stats out;
+	unsigned int interval;
+	int ret;
+
+	if (size < sizeof(req))
+		return send_bin(client, hdr, -EINVAL, NULL, 0);
+	memcpy(&req, buf, sizeof(req));
+	interval = be32toh(req.interval_ms);
+
+	if (!interval) {
+		stop_stats_thread(client);
+		if (verbose)
+			dbg("stats subscription cancelled");
+		return send_bin(client, hdr, 0, NULL, 0);
+	}
+	if (interval < MIN_STATS_INTERVAL)
+		interval = MIN_STATS_INTERVAL;
+
+	ret = get_bin_stats(client, &out);
+	if (ret < 0)
+		return send_bin(client, hdr, ret, NULL, 0);
+
+	pthread_mutex_lock(&client->stats_mutex);
+	client->stats_last = out;
+	client->stats_interval = interval;
+	pthread_cond_signal(&client->stats_cond);
+	if (!client->stats_running) {
+		/* Reap a thread that finished due to a send error */
+		if (client->stats_id) {
+			pthread_mutex_unlock(&client->stats_mutex);
+			pthread_join(client->stats_id, NULL);
+			pthread_mutex_lock(&client->stats_mutex);
+		}
+		ret = pthread_create(&client->stats_id, NULL, stats_thread,
+				     client);
+		if (ret) {
+			client->stats_id = 0;
+			client->stats_interval = 0;
+			pthread_mutex_unlock(&client->stats_mutex);
+			errno = ret;
+			local_perror("pthread_create");
+			return send_bin(client, hdr, -ret, NULL, 0);
+		}
+		client->stats_running = 1;
+	}
+	pthread_mutex_unlock(&client->stats_mutex);
+
+	if (verbose)
+		dbg("stats subscription every %u ms", interval);
+
+	return send_bin(client, hdr, 0, &out, sizeof(out));
+}
+
+typedef int (*bin_method_handler) (struct dvb_client *client,
+				   const struct remote_bin_hdr *hdr,
+				   char *buf, ssize_t size);
+
+static const struct bin_method_types {
+	char *name;
+	bin_method_handler handler;
+} bin_methods[REMOTE_OP_MAX] = {
+	[REMOTE_OP_FE_GET_STATS] = { "fe_get_stats", &bin_fe_get_stats },
+	[REMOTE_OP_FE_STATS_SUBSCRIBE] = { "fe_stats_subscribe", &bin_fe_stats_subscribe },
+};
+
+static struct method_stats bin_method_stats[REMOTE_OP_MAX];
+
+static int handle_bin_msg(struct dvb_client *client, char *buf, ssize_t size)
+{
+	const struct bin_method_types *method = NULL;
+	struct remote_bin_hdr hdr;
+	unsigned int opcode;
+	uint64_t start;
+	int ret;
+
+	if (size < sizeof(hdr)) {
+		if (verbose)
+			dbg("binary message too short: %d", size);
+		return send_data(client, "%i%s%i%s", 0, "log", LOG_ERR,
+				 "msg too short");
+	}
+	memcpy(&hdr, buf, sizeof(hdr));
+	opcode = be16toh(hdr.opcode);
+
+	if (opcode < REMOTE_OP_MAX)
+		method = &bin_methods[opcode];
+	if (!method || !method->handler) {
+		if (verbose)
+			dbg("invalid opcode: %u", opcode);
+		return send_bin(client, &hdr, -ENOSYS, NULL, 0);
+	}
+
+	if (verbose)
+		dbg("received binary command: %u '%s'", be32toh(hdr.seq),
+		    method->name);
+
+	if (!client->session || client->proto < 5)
+		return send_bin(client, &hdr, -EPROTO, NULL, 0);
+
+	start = now_ns();
+	ret = method->handler(client, &hdr, buf + sizeof(hdr),
+			      size - sizeof(hdr));
+	count_method(&bin_method_stats[opcode], start);
+
+	return ret;
+}
+
+/*
+ * Metrics, sent in the Prometheus text format to whoever connects to the
+ * metrics port, like an HTTP scraper, and then disconnected.
+ *
+ * They're collected without stopping the clients. So, the frontend stats
+ * are the last ones a client read, and are skipped if the client is
+ * running a method.
+ */
+enum metric {
+	METRIC_READS,
+	METRIC_READ_BYTES,
+	METRIC_READ_ERRORS,
+	METRIC_OVERFLOWS,
+	METRIC_RING_BACKLOG,
+	METRIC_SEND_BACKLOG,
+	METRIC_FE_STATUS,
+	METRIC_FE_SIGNAL_DBM,
+	METRIC_FE_SIGNAL_RELATIVE,
+	METRIC_FE_CNR_DB,
+	METRIC_FE_CNR_RELATIVE,
+	METRIC_FE_POST_BER,
+	NUM_METRIC,
+};
+
+static const struct metric_family {
+	const char *name, *type, *help;
+} metric_families[NUM_METRIC] = {
+	[METRIC_READS] = { "dvbv5_daemon_reads_total", "counter",
+		"Reads from a demux or dvr descriptor" },
+	[METRIC_READ_BYTES] = { "dvbv5_daemon_read_bytes_total", "counter",
+		"Bytes read from a demux or dvr descriptor" },
+	[METRIC_READ_ERRORS] = { "dvbv5_daemon_read_errors_total", "counter",
+		"Failed reads from a demux or dvr descriptor, but overflows" },
+	[METRIC_OVERFLOWS] = { "dvbv5_daemon_overflows_total", "counter",
+		"Kernel buffer overflows of a demux or dvr descriptor" },
+	[METRIC_RING_BACKLOG] = { "dvbv5_daemon_shm_ring_backlog_bytes", "gauge",
+		"Bytes at a shared memory ring not read by the client yet" },
+	[METRIC_SEND_BACKLOG] = { "dvbv5_daemon_send_backlog_bytes", "gauge",
+		"Bytes queued at a client socket not sent yet" },
+	[METRIC_FE_STATUS] = { "dvbv5_daemon_frontend_status", "gauge",
+		"Frontend status bits, as fe_status_t" },
+	[METRIC_FE_SIGNAL_DBM] = { "dvbv5_daemon_frontend_signal_dbm", "gauge",
+		"Frontend signal strength, in dBm" },
+	[METRIC_FE_SIGNAL_RELATIVE] = { "dvbv5_daemon_frontend_signal_relative", "gauge",
+		"Frontend signal strength, from 0 to 1" },
+	[METRIC_FE_CNR_DB] = { "dvbv5_daemon_frontend_cnr_db", "gauge",
+		"Frontend carrier to noise ratio, in dB" },
+	[METRIC_FE_CNR_RELATIVE] = { "dvbv5_daemon_frontend_cnr_relative", "gauge",
+		"Frontend carrier to noise ratio, from 0 to 1" },
+	[METRIC_FE_POST_BER] = { "dvbv5_daemon_frontend_post_ber", "gauge",
+		"Frontend bit error rate after the inner code" },
+};
+
+struct metrics {
+	FILE *f[NUM_METRIC];
+	char *buf[NUM_METRIC];
+	size_t len[NUM_METRIC];
+};
+
+static void metric_stat(struct metrics *m, unsigned int id, const char *device,
+			struct dtv_stats *st, enum metric db, enum metric relative)
+{
+	if (!st)
+		return;
+	if (st->scale == FE_SCALE_DECIBEL)
+		fprintf(m->f[db], "%s{client=\"%u\",device=\"%s\"} %.3f\n",
+			metric_families[db].name, id, device,
+			st->svalue / 1000.);
+	else if (st->scale == FE_SCALE_RELATIVE)
+		fprintf(m->f[relative], "%s{client=\"%u\",device=\"%s\"} %.5f\n",
+			metric_families[relative].name, id, device,
+			st->uvalue / 65535.);
+}
+
+static void metrics_frontend(struct metrics *m, struct dvb_client *client)
+{
+	struct dvb_v5_fe_parms_priv *parms = (void *)client->dvb->fe_parms;
+	struct dvb_v5_fe_parms *p = &parms->p;
+	enum fecap_scale_params scale;
+	float ber;
+
+	if (parms->fd < 0 || !parms->fname)
+		return;
+
+	fprintf(m->f[METRIC_FE_STATUS], "%s{client=\"%u\",device=\"%s\"} %u\n",
+		metric_families[METRIC_FE_STATUS].name, client->id,
+		parms->fname, parms->stats.prev_status);
+	metric_stat(m, client->id, parms->fname,
+		    dvb_fe_retrieve_stats_layer(p, DTV_STAT_SIGNAL_STRENGTH, 0),
+		    METRIC_FE_SIGNAL_DBM, METRIC_FE_SIGNAL_RELATIVE);
+	metric_stat(m, client->id, parms->fname,
+		    dvb_fe_retrieve_stats_layer(p, DTV_STAT_CNR, 0),
+		    METRIC_FE_CNR_DB, METRIC_FE_CNR_RELATIVE);
+
+	ber = dvb_fe_retrieve_ber(p, 0, &scale);
+	if (scale != FE_SCALE_NOT_AVAILABLE)
+		fprintf(m->f[METRIC_FE_POST_BER], "%s{client=\"%u\",device=\"%s\"} %g\n",
+			metric_families[METRIC_FE_POST_BER].name, client->id,
+			parms->fname, ber);
+}
+
+static void metrics_send_backlog(struct metrics *m, struct dvb_client *client,
+				 int fd, const char *channel)
+{
+	int queued;
+
+	if (fd < 0 || ioctl(fd, SIOCOUTQ, &queued) < 0)
+		return;
+	fprintf(m->f[METRIC_SEND_BACKLOG], "%s{client=\"%u\",channel=\"%s\"} %d\n",
+		metric_families[METRIC_SEND_BACKLOG].name, client->id, channel,
+		queued);
+}
+
+static void metrics_client(struct metrics *m, struct dvb_client *client)
+{
+	static const enum metric counters[] = {
+		METRIC_READS, METRIC_READ_BYTES, METRIC_READ_ERRORS,
+		METRIC_OVERFLOWS,
+	};
+	struct dvb_descriptors *desc;
+	uint64_t values[4];
+	const char *device;
+	nfds_t i;
+	int j;
+
+	metrics_send_backlog(m, client, client->fd, "control");
+	metrics_send_backlog(m, client, client->data_fd, "data");
+
+	pthread_mutex_lock(&client->dvb_read_mutex);
+	for (i = 0; i < client->numfds; i++) {
+		desc = get_desc(client, client->fds[i].fd);
+		if (!desc)
+			continue;
+		device = desc->open_dev->dev->sysname;
+		values[0] = desc->reads;
+		values[1] = desc->read_bytes;
+		values[2] = desc->read_errors;
+		values[3] = desc->overflows;
+		for (j = 0; j < 4; j++)
+			fprintf(m->f[counters[j]], "%s{client=\"%u\",uid=\"%d\",device=\"%s\"} %llu\n",
+				metric_families[counters[j]].name, client->id,
+				desc->uid, device, (unsigned long long)values[j]);
+		if (desc->shm)
+			fprintf(m->f[METRIC_RING_BACKLOG], "%s{client=\"%u\",uid=\"%d\",device=\"%s\"} %llu\n",
+				metric_families[METRIC_RING_BACKLOG].name,
+				client->id, desc->uid, device,
+				(unsigned long long)(desc->shm->write -
+				__atomic_load_n(&desc->shm->read, __ATOMIC_ACQUIRE)));
+	}
+	pthread_mutex_unlock(&client->dvb_read_mutex);
+
+	/* Don't wait for a method, like a scan, to finish */
+	if (!pthread_mutex_trylock(&client->fe_mutex)) {
+		metrics_frontend(m, client);
+		pthread_mutex_unlock(&client->fe_mutex);
+	}
+}
+
+static void metrics_methods(FILE *f, const char *name,
+			    struct method_stats *st)
+{
+	uint64_t calls = __atomic_load_n(&st->calls, __ATOMIC_RELAXED);
+	uint64_t ns = __atomic_load_n(&st->ns, __ATOMIC_RELAXED);
+
+	fprintf(f, "dvbv5_daemon_method_seconds_count{method=\"%s\"} %llu\n",
+		name, (unsigned long long)calls);
+	fprintf(f, "dvbv5_daemon_method_seconds_sum{method=\"%s\"} %.6f\n",
+		name, ns / 1e9);
+}
+
+static void *serve_metrics(void *privdata)
+{
+	int fd = (intptr_t)privdata;
+	struct dvb_client *client;
+	struct timeval tv = { 1, 0 };
+	struct metrics m;
+	char req[1024], *body = NULL;
+	size_t body_len;
+	FILE *f;
+	int i, ok = 1;
+
+	memset(&m, 0, sizeof(m));
+
+	/* Consume the request, if any: any path gets the metrics */
+	setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+	setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+	if (recv(fd, req, sizeof(req), 0) < 0 && errno != EAGAIN)
+		goto close;
+
+	for (i = 0; i < NUM_METRIC; i++) {
+		m.f[i] = open_memstream(&m.buf[i], &m.len[i]);
+		if (!m.f[i])
+			ok = 0;
+	}
+	f = open_memstream(&body, &body_len);
+	if (!f || !ok) {
+		local_perror("open_memstream");
+		if (f)
+			fclose(f);
+		free(body);
+		goto free;
+	}
+
+	fprintf(f, "# HELP dvbv5_daemon_clients Connected clients\n"
+		   "# TYPE dvbv5_daemon_clients gauge\n"
+		   "dvbv5_daemon_clients %u\n",
+		__atomic_load_n(&num_clients, __ATOMIC_RELAXED));
+
+	fprintf(f, "# HELP dvbv5_daemon_method_seconds Time spent running the methods\n"
+		   "# TYPE dvbv5_daemon_method_seconds summary\n");
+	for (i = 0; i < NUM_METHODS; i++)
+		metrics_methods(f, methods[i].name, &method_stats[i]);
+	for (i = 0; i < REMOTE_OP_MAX; i++)
+		if (bin_methods[i].name)
+			metrics_methods(f, bin_methods[i].name,
+					&bin_method_stats[i]);
+
+	pthread_mutex_lock(&clients_mutex);
+	for (client = clients; client; client = client->next)
+		if (client->dvb)
+			metrics_client(&m, client);
+	pthread_mutex_unlock(&clients_mutex);
+
+	for (i = 0; i < NUM_METRIC; i++) {
+		fclose(m.f[i]);
+		m.f[i] = NULL;
+		if (!m.len[i])
+			continue;
+		fprintf(f, "# HELP %s %s\n# TYPE %s %s\n",
+			metric_families[i].name, metric_families[i].help,
+			metric_families[i].name, metric_families[i].type);
+		fwrite(m.buf[i], 1, m.len[i], f);
+	}
+	fclose(f);
+
+	i = snprintf(req, sizeof(req),
+		     "HTTP/1.0 200 OK\r\n"
+		     "Content-Type: text/plain; version=0.0.4\r\n"
+		     "Content-Length: %zu\r\n\r\n", body_len);
+	if (send(fd, req, i, MSG_MORE | MSG_NOSIGNAL) == i)
+		send(fd, body, body_len, MSG_NOSIGNAL);
+	free(body);
+
+free:
+	for (i = 0; i < NUM_METRIC; i++) {
+		if (m.f[i])
+			fclose(m.f[i]);
+		free(m.buf[i]);
+	}
+close:
+	close(fd);
+	return NULL;
+}
+
+static void *start_server(void *privdata)
+{
+	struct dvb_client *client = privdata, **next;
+	const struct method_types *method;
+	int fd = client->fd, ret, flag = 1;
+	char buf[REMOTE_BUF_SIZE + 8], cmd[80], *p;
+	ssize_t size;
+	uint32_t seq, len;
+	int bufsize;
+
+	if (verbose)
+		dbg("Opening socket %d", fd);
+
+	/* Set a large buffer for read() to work better */
 	bufsize = REMOTE_BUF_SIZE;
 	setsockopt(fd, SOL_SOCKET, SO_SNDBUF,
 		   (void *)&bufsize, (int)sizeof(bufsize));
 
 	/* Disable Naggle algorithm, as we want errors to be sent ASAP */
-	setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, (char *) &flag, sizeof(int));
+	if (!client->is_local)
+		setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, (char *) &flag,
+			   sizeof(int));
 
 	/* Command dispatcher */
 	do {
-		size = recv(fd, buf, 4, MSG_WAITALL);
+		size = recv(fd, &len, 4, MSG_WAITALL);
 		if (size <= 0)
 			break;
-		size = (uint32_t)buf[0] << 24 | (uint32_t)buf[1] << 16 |
-		       (uint32_t)buf[2] << 8 | (uint32_t)buf[3];
+		len = be32toh(len);
+		size = len & ~REMOTE_BIN_MSG;
+		if (size > sizeof(buf)) {
+			err("message too big: %d bytes", size);
+			break;
+		}
 		size = recv(fd, buf, size, MSG_WAITALL);
 		if (size <= 0)
 			break;
 
+		if (len & REMOTE_BIN_MSG) {
+			pthread_mutex_lock(&client->fe_mutex);
+			handle_bin_msg(client, buf, size);
+			pthread_mutex_unlock(&client->fe_mutex);
+			continue;
+		}
+
 		ret = scan_data(buf, size, "%i%s",  &seq, cmd);
 		if (ret < 0) {
 			if (verbose)
 				dbg("message too short: %d", size);
-			send_data(fd, "%i%s%i%s", 0, "log", LOG_ERR,
+			send_data(client, "%i%s%i%s", 0, "log", LOG_ERR,
 				  "msg too short");
 			continue;
 		}
@@ -1386,7 +2507,7 @@ static void *start_server(void *fd_pointer)
 		if (size > buf + sizeof(buf) - p) {
 			if (verbose)
 				dbg("data length too big: %d", size);
-			send_data(fd, "%i%s%i%s", 0, "log", LOG_ERR,
+			send_data(client, "%i%s%i%s", 0, "log", LOG_ERR,
 				  "data length too big");
 			continue;
 		}
@@ -1394,17 +2515,24 @@ static void *start_server(void *fd_pointer)
 		method = methods;
 		while (method->name) {
 			if (!strcmp(cmd, method->name)) {
-				if (dvb_fd > 0 || method->locks_dvb) {
+				if (client->session || method->starts_session) {
+					uint64_t start;
+
+					pthread_mutex_lock(&client->fe_mutex);
+					start = now_ns();
 					ret = method->handler(seq, cmd,
-							      fd, p, size);
-					if (ret < 0)
+							      client, p, size);
+					count_method(&method_stats[method - methods],
+						     start);
+					pthread_mutex_unlock(&client->fe_mutex);
+					if (ret < 0 || client->fd < 0)
 						break;
-					if (method->locks_dvb)
-						dvb_fd = fd;
+					if (method->starts_session)
+						client->session = 1;
 					break;
 				}
-				send_data(fd, "%i%s%i%s", 0, "log", LOG_ERR,
-					  "daemon busy");
+				send_data(client, "%i%s%i%s", 0, "log", LOG_ERR,
+					  "daemon_get_version should be called first");
 				break;
 			}
 			method++;
@@ -1412,66 +2540,106 @@ static void *start_server(void *fd_pointer)
 		if (!method->name) {
 			if (verbose)
 				dbg("invalid command: %s", cmd);
-			send_data(fd, "%i%s%i%s", 0, "log", LOG_ERR,
+			send_data(client, "%i%s%i%s", 0, "log", LOG_ERR,
 				  "invalid command");
 		}
+
+		/* The connection became the data channel of another client */
+		if (client->fd < 0)
+			break;
 	} while (1);
 
-	if (verbose)
+	if (verbose && client->fd >= 0)
 		dbg("Closing socket %d", fd);
 
-	close(fd);
-	if (read_id) {
-		pthread_cancel(read_id);
-		read_id = 0;
+	pthread_mutex_lock(&clients_mutex);
+	for (next = &clients; *next; next = &(*next)->next) {
+		if (*next == client) {
+			*next = client->next;
+			num_clients--;
+			break;
+		}
+	}
+	pthread_mutex_unlock(&clients_mutex);
+
+	stop_stats_thread(client);
+	if (client->read_running) {
+		pthread_mutex_lock(&client->dvb_read_mutex);
+		client->stop_read = 1;
+		pthread_mutex_unlock(&client->dvb_read_mutex);
+		pthread_join(client->read_id, NULL);
 	}
-	if (dvb_fd > 0)
-		close_all_devs();
+	close_all_devs(client);
+	dvb_dev_free(client->dvb);
+	if (client->data_fd >= 0)
+		close(client->data_fd);
+	if (client->fd >= 0)
+		close(client->fd);
+
+	pthread_mutex_destroy(&client->data_mutex);
+	pthread_mutex_destroy(&client->msg_mutex);
+	pthread_mutex_destroy(&client->dvb_read_mutex);
+	pthread_mutex_destroy(&client->fe_mutex);
+	pthread_mutex_destroy(&client->stats_mutex);
+	pthread_cond_destroy(&client->stats_cond);
+	free(client);
 
 	return NULL;
 }
 
-/*
- * main program
- */
-
-int main(int argc, char *argv[])
+static struct dvb_client *alloc_client(int fd, int is_local)
 {
-	int ret;
-	int sockfd;
-	socklen_t addrlen;
-	struct sockaddr_in serv_addr, cli_addr;
-
-#ifdef ENABLE_NLS
-	setlocale (LC_ALL, "");
-	bindtextdomain (PACKAGE, LOCALEDIR);
-	textdomain (PACKAGE);
-#endif
+	static unsigned int next_id;
+	struct dvb_client *client;
 
-	if (argp_parse(&argp, argc, argv, ARGP_NO_HELP | ARGP_NO_EXIT, 0, 0)) {
-		argp_help(&argp, stderr, ARGP_HELP_SHORT_USAGE, PROGRAM_NAME);
-		return -1;
-	}
-
-	if (!port) {
-		argp_help(&argp, stderr, ARGP_HELP_SHORT_USAGE, PROGRAM_NAME);
-		return -1;
+	client = calloc(1, sizeof(*client));
+	if (!client) {
+		local_perror("calloc");
+		return NULL;
 	}
 
-	/* Allocate DVB structure and start seek for devices */
-	dvb = dvb_dev_alloc();
-	if (!dvb) {
+	client->dvb = dvb_dev_alloc();
+	if (!client->dvb) {
 		err("Can't allocate DVB data\n");
-		return -1;
+		free(client);
+		return NULL;
 	}
+	dvb_dev_find(client->dvb, 0, NULL);
 
-	dvb_dev_find(dvb, 0, NULL);
+	/* FIXME: should allow the caller to set the verbosity */
+	dvb_dev_set_logpriv(client->dvb, 1, dvb_remote_log, client);
+
+	client->fd = fd;
+	client->is_local = is_local;
+	client->proto = 1;
+	client->data_fd = -1;
+	pthread_mutex_init(&client->data_mutex, NULL);
+	pthread_mutex_init(&client->msg_mutex, NULL);
+	pthread_mutex_init(&client->dvb_read_mutex, NULL);
+	pthread_mutex_init(&client->fe_mutex, NULL);
+	pthread_mutex_init(&client->stats_mutex, NULL);
+	pthread_cond_init(&client->stats_cond, NULL);
+
+	pthread_mutex_lock(&clients_mutex);
+	client->id = next_id++;
+	client->next = clients;
+	clients = client;
+	num_clients++;
+	pthread_mutex_unlock(&clients_mutex);
+
+	return client;
+}
+
+static int listen_tcp(int port)
+{
+	struct sockaddr_in serv_addr;
+	int sockfd, ret;
 
 	/* Create a socket */
-	sockfd = socket(AF_INET, SOCK_STREAM, 0);
+	sockfd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
 	if (sockfd < 0) {
 		local_perror("socket");
-		goto error;
+		return -1;
 	}
 
 	/* Initialize listen address struct */
@@ -1484,19 +2652,102 @@ int main(int argc, char *argv[])
 	ret = bind(sockfd, (struct sockaddr *) &serv_addr, sizeof(serv_addr));
 	if (ret < 0) {
 		local_perror("bind");
-		goto error;
+		close(sockfd);
+		return -1;
 	}
 
-	/* FIXME: should allow the caller to set the verbosity */
-	dvb_dev_set_logpriv(dvb, 1, dvb_remote_log, &dvb_fd);
-
 	/* Listen up to 5 connections */
 	listen(sockfd, 5);
-	addrlen = sizeof(cli_addr);
+
+	return sockfd;
+}
+
+/*
+ * Local clients can connect via a Unix socket, which also allows passing
+ * a shared memory ring for the DVR data.
+ */
+static int listen_unix(void)
+{
+	struct sockaddr_un serv_addr;
+	int sockfd, ret;
+
+	if (strlen(unix_path) >= sizeof(serv_addr.sun_path)) {
+		err("Unix socket path too long: %s", unix_path);
+		return -1;
+	}
+
+	sockfd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (sockfd < 0) {
+		local_perror("socket");
+		return -1;
+	}
+
+	memset((char *) &serv_addr, 0, sizeof(serv_addr));
+	serv_addr.sun_family = AF_UNIX;
+	strcpy(serv_addr.sun_path, unix_path);
+
+	/* Remove a stale socket from a previous run */
+	unlink(unix_path);
+	ret = bind(sockfd, (struct sockaddr *) &serv_addr, sizeof(serv_addr));
+	if (ret < 0) {
+		local_perror("bind");
+		close(sockfd);
+		return -1;
+	}
+
+	listen(sockfd, 5);
+
+	return sockfd;
+}
+
+/*
+ * main program
+ */
+
+int main(int argc, char *argv[])
+{
+	int ret, i;
+	struct pollfd lfds[3];
+	nfds_t numlfds = 0, metrics_lfd = 3, unix_lfd = 3;
+
+#ifdef ENABLE_NLS
+	setlocale (LC_ALL, "");
+	bindtextdomain (PACKAGE, LOCALEDIR);
+	textdomain (PACKAGE);
+#endif
+
+	if (argp_parse(&argp, argc, argv, ARGP_NO_HELP | ARGP_NO_EXIT, 0, 0)) {
+		argp_help(&argp, stderr, ARGP_HELP_SHORT_USAGE, PROGRAM_NAME);
+		return -1;
+	}
+
+	if (!port && !unix_path) {
+		argp_help(&argp, stderr, ARGP_HELP_SHORT_USAGE, PROGRAM_NAME);
+		return -1;
+	}
+
+	if (port) {
+		lfds[numlfds].fd = listen_tcp(port);
+		if (lfds[numlfds].fd < 0)
+			goto error;
+		lfds[numlfds++].events = POLLIN;
+	}
+	if (unix_path) {
+		lfds[numlfds].fd = listen_unix();
+		if (lfds[numlfds].fd < 0)
+			goto error;
+		unix_lfd = numlfds;
+		lfds[numlfds++].events = POLLIN;
+	}
+	if (metrics_port) {
+		lfds[numlfds].fd = listen_tcp(metrics_port);
+		if (lfds[numlfds].fd < 0)
+			goto error;
+		metrics_lfd = numlfds;
+		lfds[numlfds++].events = POLLIN;
+	}
 
 	start_signal_handler();
-	pthread_mutex_init(&msg_mutex, NULL);
-	pthread_mutex_init(&dvb_read_mutex, NULL);
 
 	/* Accept actual connection from the client */
 
@@ -1511,36 +2762,69 @@ int main(int argc, char *argv[])
 	info(PROGRAM_NAME" started.");
 
 	while (1) {
-		int fd;
+		struct dvb_client *client;
+		int fd, is_local;
 		pthread_t id;
 
 		if (verbose)
 			dbg("waiting for connections");
-		fd = accept(sockfd, (struct sockaddr *)&cli_addr, &addrlen);
-		if (fd < 0) {
-			local_perror("accept");
+		ret = poll(lfds, numlfds, -1);
+		if (ret < 0) {
+			if (errno == EINTR)
+				continue;
+			local_perror("poll");
 			break;
 		}
 
-		if (verbose)
-			dbg("accepted connection %d", fd);
-		ret = pthread_create(&id, NULL, start_server, (void *)&fd);
-		if (ret < 0) {
-			local_perror("pthread_create");
-			break;
+		for (i = 0; i < numlfds; i++) {
+			if (!lfds[i].revents)
+				continue;
+
+			fd = accept4(lfds[i].fd, NULL, NULL, SOCK_CLOEXEC);
+			if (fd < 0) {
+				local_perror("accept");
+				continue;
+			}
+			if (i == metrics_lfd) {
+				ret = pthread_create(&id, NULL, serve_metrics,
+						     (void *)(intptr_t)fd);
+				if (ret) {
+					close(fd);
+					continue;
+				}
+				pthread_detach(id);
+				continue;
+			}
+			is_local = i == unix_lfd;
+
+			if (verbose)
+				dbg("accepted %s connection %d",
+				    is_local ? "local" : "TCP", fd);
+			client = alloc_client(fd, is_local);
+			if (!client) {
+				close(fd);
+				continue;
+			}
+			ret = pthread_create(&id, NULL, start_server, client);
+			if (ret) {
+				errno = ret;
+				local_perror("pthread_create");
+				goto stop;
+			}
+			pthread_detach(id);
 		}
 	}
 
+stop:
 	/* Just in case we add some way for the remote part to stop the daemon */
 	stop_signal_handler();
 
 error:
+	if (unix_path)
+		unlink(unix_path);
 	info(PROGRAM_NAME" stopped.");
 
 	pthread_exit(NULL);
 
-	if (dvb)
-		dvb_dev_free(dvb);
-
 	return -1;
 }
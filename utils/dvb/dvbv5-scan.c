@@ -32,6 +32,10 @@
 
 #include <config.h>
 
+#ifdef HAVE_PTHREAD
+# include <pthread.h>
+#endif
+
 #ifdef ENABLE_NLS
 # define _(string) gettext(string)
 # include "gettext.h"
@@ -59,11 +63,11 @@ const char *argp_program_version = PROGRAM_NAME " version " V4L_UTILS_VERSION;
 const char *argp_program_bug_address = "Mauro Carvalho Chehab <mchehab@kernel.org>";
 
 struct arguments {
-	char *confname, *lnb_name, *output, *demux_dev;
+	char *confname, *lnb_name, *output, *demux_dev, *frontend_dev, *replay;
 	unsigned adapter, n_adapter, adapter_fe, adapter_dmx, frontend, demux, get_detected, get_nit;
 	int lna, lnb, sat_number, freq_bpf;
 	unsigned diseqc_wait, dont_add_new_freqs, timeout_multiply;
-	unsigned other_nit;
+	unsigned other_nit, parallel;
 	enum dvb_file_formats input_format, output_format;
 	const char *cc;
 
@@ -87,8 +91,10 @@ static const struct argp_option options[] = {
 	{"file-freqs-only", 'F', NULL,			0, N_("don't use the other frequencies discovered during scan"), 0},
 	{"timeout-multiply", 'T', N_("factor"),		0, N_("Multiply scan timeouts by this factor"), 0},
 	{"parse-other-nit", 'p', NULL,			0, N_("Parse the other NIT/SDT tables"), 0},
+	{"parallel",	'P',	NULL,			0, N_("scan in parallel with all frontends that support the delivery system"), 0},
 	{"input-format", 'I',	N_("format"),		0, N_("Input format: CHANNEL, DVBV5 (default: DVBV5)"), 0},
 	{"output-format", 'O',	N_("format"),		0, N_("Output format: VDR, CHANNEL, ZAP, DVBV5 (default: DVBV5)"), 0},
+	{"replay",	'R',	N_("directory"),	0, N_("scan the MPEG-TS recordings at directory, named after their frequencies, instead of a device"), 0},
 	{"cc",		'C',	N_("country_code"),	0, N_("Set the default country to be used (in ISO 3166-1 two letter code)"), 0},
 	{"help",        '?',	0,		0,	N_("Give this help list"), -1},
 	{"usage",	-3,	0,		0,	N_("Give a short usage message")},
@@ -182,85 +188,142 @@ static int print_frontend_stats(struct arguments *args,
 	return 0;
 }
 
+static int show_lock_stats(struct dvb_v5_fe_parms *parms, void *__args)
+{
+	struct arguments *args = __args;
+
+	/* The status lines of several frontends would overwrite each other */
+	if (!args->parallel)
+		print_frontend_stats(args, parms);
+	return 0;
+}
+
 static int check_frontend(void *__args,
 			  struct dvb_v5_fe_parms *parms)
 {
 	struct arguments *args = __args;
-	int rc, i;
-	fe_status_t status;
+	int rc;
 
+	/*
+	 * The lock is detected by the frontend events; the stats are only
+	 * refreshed every 100 ms, to show them.
+	 */
 	args->n_status_lines = 0;
-	for (i = 0; i < args->timeout_multiply * 40; i++) {
-		if (parms->abort)
-			return 0;
-		rc = dvb_fe_get_stats(parms);
-		if (rc)
-			PERROR(_("dvb_fe_get_stats failed"));
-
-		rc = dvb_fe_retrieve_stats(parms, DTV_STATUS, &status);
-		if (rc)
-			status = 0;
-		print_frontend_stats(args, parms);
-		if (status & FE_HAS_LOCK)
-			break;
-		usleep(100000);
-	};
+	rc = dvb_fe_wait_lock(parms, args->timeout_multiply * 4000, 100,
+			      show_lock_stats, args);
+	if (parms->abort)
+		return 0;
+	if (rc < 0 && rc != -ETIMEDOUT)
+		PERROR(_("dvb_fe_wait_lock failed"));
 
 	if (isatty(STDERR_FILENO)) {
 		fprintf(stderr, "\x1b[37m");
 	}
 
-	return (status & FE_HAS_LOCK) ? 0 : -1;
+	return rc ? -1 : 0;
 }
 
-static int run_scan(struct arguments *args, struct dvb_device *dvb)
+/*
+ * Parallel scanning: each frontend that supports the delivery system
+ * is handled by a worker. The workers share the transponder list, taking
+ * the next transponder to scan from it, and the list of services found.
+ */
+#define SCAN_MAX_FRONTENDS	32
+
+struct scan_sched {
+	struct arguments *args;
+	struct dvb_file *dvb_file, *dvb_file_new;
+
+	/* Points to the next transponder to be scanned */
+	struct dvb_entry **next;
+	int count;
+	unsigned busy;
+
+	/* Used to look for duplicated transponders at dvb_file */
+	struct dvb_freq_index *freq_index;
+
+#ifdef HAVE_PTHREAD
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+#endif
+};
+
+struct scan_worker {
+	struct scan_sched *sched;
+	struct dvb_device *dvb;
+	struct dvb_open_descriptor *dmx_fd;
+	const char *name;
+
+	/* Per worker copy, used by check_frontend() */
+	struct arguments args;
+
+#ifdef HAVE_PTHREAD
+	pthread_t thread;
+#endif
+};
+
+static int *timeout_flag[SCAN_MAX_FRONTENDS];
+static unsigned num_timeout_flags;
+
+static void scan_lock(struct scan_sched *s)
 {
-	struct dvb_v5_fe_parms *parms = dvb->fe_parms;
-	struct dvb_file *dvb_file = NULL, *dvb_file_new = NULL;
+#ifdef HAVE_PTHREAD
+	pthread_mutex_lock(&s->lock);
+#endif
+}
+
+static void scan_unlock(struct scan_sched *s)
+{
+#ifdef HAVE_PTHREAD
+	pthread_mutex_unlock(&s->lock);
+#endif
+}
+
+static void scan_wait(struct scan_sched *s)
+{
+#ifdef HAVE_PTHREAD
+	pthread_cond_wait(&s->cond, &s->lock);
+#endif
+}
+
+static void scan_wakeup(struct scan_sched *s)
+{
+#ifdef HAVE_PTHREAD
+	pthread_cond_broadcast(&s->cond);
+#endif
+}
+
+static void *scan_worker_run(void *__w)
+{
+	struct scan_worker *w = __w;
+	struct scan_sched *s = w->sched;
+	struct arguments *args = &w->args;
+	struct dvb_v5_fe_parms *parms = w->dvb->fe_parms;
 	struct dvb_entry *entry;
-	struct dvb_open_descriptor *dmx_fd;
-	int count = 0, shift;
-	uint32_t freq, sys;
+	int count, shift;
+	uint32_t freq;
 	enum dvb_sat_polarization pol;
 
-	/* This is used only when reading old formats */
-	switch (parms->current_sys) {
-	case SYS_DVBT:
-	case SYS_DVBS:
-	case SYS_DVBC_ANNEX_A:
-	case SYS_ATSC:
-		sys = parms->current_sys;
-		break;
-	case SYS_DVBC_ANNEX_C:
-		sys = SYS_DVBC_ANNEX_A;
-		break;
-	case SYS_DVBC_ANNEX_B:
-		sys = SYS_ATSC;
-		break;
-	case SYS_ISDBT:
-	case SYS_DTMB:
-		sys = SYS_DVBT;
-		break;
-	default:
-		sys = SYS_UNDEFINED;
-		break;
-	}
-	dvb_file = dvb_read_file_format(args->confname, sys,
-				    args->input_format);
-	if (!dvb_file)
-		return -2;
-
-	/* FIXME: should be replaced by dvb_dev_open() */
-	dmx_fd = dvb_dev_open(dvb, args->demux_dev, O_RDWR);
-	if (!dmx_fd) {
-		perror(_("opening demux failed"));
-		return -3;
-	}
+	dvb_scan_set_freq_index(parms, s->freq_index);
 
-	for (entry = dvb_file->first_entry; entry != NULL; entry = entry->next) {
+	scan_lock(s);
+	while (!parms->abort) {
 		struct dvb_v5_descriptors *dvb_scan_handler = NULL;
 		uint32_t stream_id;
 
+		/*
+		 * When all transponders were taken, wait for the ones
+		 * still being scanned, as their NIT may add new ones.
+		 */
+		entry = *s->next;
+		if (!entry) {
+			if (!s->busy)
+				break;
+			scan_wait(s);
+			continue;
+		}
+		s->next = &entry->next;
+
 		/*
 		 * If the channel file has duplicated frequencies, or some
 		 * entries without any frequency at all, discard.
@@ -275,12 +338,20 @@ static int run_scan(struct arguments *args, struct dvb_device *dvb)
 		if (dvb_retrieve_entry_prop(entry, DTV_STREAM_ID, &stream_id))
 			stream_id = NO_STREAM_ID_FILTER;
 
-		if (!dvb_new_entry_is_needed(dvb_file->first_entry, entry,
-						  freq, shift, pol, stream_id))
+		if (!dvb_freq_index_entry_is_needed(s->freq_index,
+						    s->dvb_file->first_entry,
+						    entry, freq, shift, pol,
+						    stream_id))
 			continue;
 
-		count++;
-		dvb_log(_("Scanning frequency #%d %d"), count, freq);
+		count = ++s->count;
+		s->busy++;
+		scan_unlock(s);
+
+		if (args->parallel)
+			dvb_log(_("Scanning frequency #%d %d on %s"), count, freq, w->name);
+		else
+			dvb_log(_("Scanning frequency #%d %d"), count, freq);
 
 		/*
 		 * update params->lnb only if it differs from entry->lnb
@@ -295,11 +366,15 @@ static int run_scan(struct arguments *args, struct dvb_device *dvb)
 		 * Run the scanning logic
 		 */
 
-		dvb_scan_handler = dvb_dev_scan(dmx_fd, entry,
+		dvb_scan_handler = dvb_dev_scan(w->dmx_fd, entry,
 						&check_frontend, args,
 						args->other_nit,
 						args->timeout_multiply);
 
+		scan_lock(s);
+		s->busy--;
+		scan_wakeup(s);
+
 		if (parms->abort) {
 			dvb_scan_free_handler_table(dvb_scan_handler);
 			break;
@@ -310,7 +385,7 @@ static int run_scan(struct arguments *args, struct dvb_device *dvb)
 		/*
 		 * Store the service entry
 		 */
-		dvb_store_channel(&dvb_file_new, parms, dvb_scan_handler,
+		dvb_store_channel(&s->dvb_file_new, parms, dvb_scan_handler,
 				  args->get_detected, args->get_nit);
 
 		/*
@@ -318,7 +393,7 @@ static int run_scan(struct arguments *args, struct dvb_device *dvb)
 		 */
 		if (!args->dont_add_new_freqs)
 			dvb_add_scaned_transponders(parms, dvb_scan_handler,
-						    dvb_file->first_entry, entry);
+						    s->dvb_file->first_entry, entry);
 
 		/*
 		 * Free the scan handler associated with the transponder
@@ -326,16 +401,198 @@ static int run_scan(struct arguments *args, struct dvb_device *dvb)
 
 		dvb_scan_free_handler_table(dvb_scan_handler);
 	}
+	scan_unlock(s);
+
+	return NULL;
+}
+
+/*
+ * Opens another frontend, together with the demux of the same number,
+ * if it supports the delivery system that is being scanned.
+ */
+static int open_scan_worker(struct arguments *args,
+			    struct dvb_v5_fe_parms *main_parms,
+			    struct dvb_dev_list *dev,
+			    struct scan_worker *w)
+{
+	struct dvb_v5_fe_parms *parms;
+	struct dvb_dev_list *dmx_dev;
+	unsigned adapter, num;
+	int i;
+
+	if (sscanf(dev->sysname, "dvb%u.frontend%u", &adapter, &num) != 2)
+		return -1;
+
+	w->dvb = dvb_dev_alloc();
+	if (!w->dvb)
+		return -1;
+	dvb_dev_set_log(w->dvb, verbose, NULL);
+	if (args->replay && dvb_dev_file_init(w->dvb, args->replay) < 0)
+		goto err;
+	dvb_dev_find(w->dvb, NULL, NULL);
+
+	dmx_dev = dvb_dev_seek_by_adapter(w->dvb, adapter, num, DVB_DEVICE_DEMUX);
+	if (!dmx_dev) {
+		if (verbose)
+			fprintf(stderr, _("%s: no demux %u, not used\n"),
+				dev->sysname, num);
+		goto err;
+	}
+	if (!dvb_dev_open(w->dvb, dev->sysname, O_RDWR)) {
+		if (verbose)
+			fprintf(stderr, _("%s: can't be opened, not used\n"),
+				dev->sysname);
+		goto err;
+	}
+	parms = w->dvb->fe_parms;
+	for (i = 0; i < parms->num_systems; i++)
+		if (parms->systems[i] == main_parms->current_sys)
+			break;
+	if (i == parms->num_systems) {
+		if (verbose)
+			fprintf(stderr, _("%s: doesn't support %s, not used\n"),
+				dev->sysname,
+				delivery_system_name[main_parms->current_sys]);
+		goto err;
+	}
+
+	w->dmx_fd = dvb_dev_open(w->dvb, dmx_dev->sysname, O_RDWR);
+	if (!w->dmx_fd) {
+		PERROR(_("opening demux %s failed"), dmx_dev->sysname);
+		goto err;
+	}
+
+	parms->lnb = main_parms->lnb;
+	parms->sat_number = main_parms->sat_number;
+	parms->diseqc_wait = main_parms->diseqc_wait;
+	parms->freq_bpf = main_parms->freq_bpf;
+	parms->lna = main_parms->lna;
+	if (dvb_fe_set_default_country(parms, args->cc) < 0)
+		fprintf(stderr, _("Failed to set the country code:%s\n"), args->cc);
+
+	w->name = dev->sysname;
+	return 0;
+
+err:
+	dvb_dev_free(w->dvb);
+	w->dvb = NULL;
+	return -1;
+}
+
+static int run_scan(struct arguments *args, struct dvb_device *dvb)
+{
+	struct dvb_v5_fe_parms *parms = dvb->fe_parms;
+	struct scan_worker workers[SCAN_MAX_FRONTENDS];
+	struct scan_sched sched;
+	unsigned num_workers = 1, i;
+	uint32_t sys;
+
+	/* This is used only when reading old formats */
+	switch (parms->current_sys) {
+	case SYS_DVBT:
+	case SYS_DVBS:
+	case SYS_DVBC_ANNEX_A:
+	case SYS_ATSC:
+		sys = parms->current_sys;
+		break;
+	case SYS_DVBC_ANNEX_C:
+		sys = SYS_DVBC_ANNEX_A;
+		break;
+	case SYS_DVBC_ANNEX_B:
+		sys = SYS_ATSC;
+		break;
+	case SYS_ISDBT:
+	case SYS_DTMB:
+		sys = SYS_DVBT;
+		break;
+	default:
+		sys = SYS_UNDEFINED;
+		break;
+	}
+	memset(&sched, 0, sizeof(sched));
+	sched.args = args;
+	sched.dvb_file = dvb_read_file_format(args->confname, sys,
+				    args->input_format);
+	if (!sched.dvb_file)
+		return -2;
+	sched.next = &sched.dvb_file->first_entry;
+	sched.freq_index = dvb_freq_index_alloc();
+
+	memset(workers, 0, sizeof(workers));
+	workers[0].sched = &sched;
+	workers[0].dvb = dvb;
+	workers[0].name = args->frontend_dev;
+	workers[0].args = *args;
+
+	/* FIXME: should be replaced by dvb_dev_open() */
+	workers[0].dmx_fd = dvb_dev_open(dvb, args->demux_dev, O_RDWR);
+	if (!workers[0].dmx_fd) {
+		perror(_("opening demux failed"));
+		dvb_freq_index_free(sched.freq_index);
+		dvb_file_free(sched.dvb_file);
+		return -3;
+	}
+
+	if (args->parallel) {
+		for (i = 0; i < dvb->num_devices; i++) {
+			struct dvb_dev_list *dev = &dvb->devices[i];
+			struct scan_worker *w = &workers[num_workers];
+
+			if (num_workers == SCAN_MAX_FRONTENDS)
+				break;
+			if (dev->dvb_type != DVB_DEVICE_FRONTEND ||
+			    !strcmp(dev->sysname, args->frontend_dev))
+				continue;
+			if (open_scan_worker(args, parms, dev, w))
+				continue;
+			w->sched = &sched;
+			w->args = *args;
+			timeout_flag[num_timeout_flags++] = &w->dvb->fe_parms->abort;
+			num_workers++;
+		}
+		if (verbose || num_workers == 1)
+			fprintf(stderr, _("scanning with %u frontend(s)\n"),
+				num_workers);
+	}
+
+#ifdef HAVE_PTHREAD
+	pthread_mutex_init(&sched.lock, NULL);
+	pthread_cond_init(&sched.cond, NULL);
 
-	if (dvb_file_new)
-		dvb_write_file_format(args->output, dvb_file_new,
+	for (i = 1; i < num_workers; i++) {
+		if (pthread_create(&workers[i].thread, NULL,
+				   scan_worker_run, &workers[i])) {
+			PERROR(_("can't start a thread for %s"), workers[i].name);
+			workers[i].name = NULL;
+		}
+	}
+#endif
+	scan_worker_run(&workers[0]);
+
+	for (i = 1; i < num_workers; i++) {
+#ifdef HAVE_PTHREAD
+		if (workers[i].name)
+			pthread_join(workers[i].thread, NULL);
+#endif
+		dvb_dev_close(workers[i].dmx_fd);
+		dvb_dev_free(workers[i].dvb);
+	}
+#ifdef HAVE_PTHREAD
+	pthread_cond_destroy(&sched.cond);
+	pthread_mutex_destroy(&sched.lock);
+#endif
+
+	if (sched.dvb_file_new)
+		dvb_write_file_format(args->output, sched.dvb_file_new,
 				      parms->current_sys, args->output_format);
 
-	dvb_file_free(dvb_file);
-	if (dvb_file_new)
-		dvb_file_free(dvb_file_new);
+	dvb_scan_set_freq_index(parms, NULL);
+	dvb_freq_index_free(sched.freq_index);
+	dvb_file_free(sched.dvb_file);
+	if (sched.dvb_file_new)
+		dvb_file_free(sched.dvb_file_new);
 
-	dvb_dev_close(dmx_fd);
+	dvb_dev_close(workers[0].dmx_fd);
 	return 0;
 }
 
@@ -396,6 +653,9 @@ static error_t parse_opt(int k, char *optarg, struct argp_state *state)
 	case 'p':
 		args->other_nit++;
 		break;
+	case 'P':
+		args->parallel++;
+		break;
 	case 'v':
 		verbose++;
 		break;
@@ -414,6 +674,9 @@ static error_t parse_opt(int k, char *optarg, struct argp_state *state)
 	case 'C':
 		args->cc = strndup(optarg, 2);
 		break;
+	case 'R':
+		args->replay = optarg;
+		break;
 	case '?':
 		argp_state_help(state, state->out_stream,
 				ARGP_HELP_SHORT_USAGE | ARGP_HELP_LONG
@@ -432,13 +695,14 @@ static error_t parse_opt(int k, char *optarg, struct argp_state *state)
 	return 0;
 }
 
-static int *timeout_flag;
-
 static void do_timeout(int x)
 {
+	unsigned i;
+
 	(void)x;
-	if (*timeout_flag == 0) {
-		*timeout_flag = 1;
+	if (*timeout_flag[0] == 0) {
+		for (i = 0; i < num_timeout_flags; i++)
+			*timeout_flag[i] = 1;
 		alarm(5);
 		signal(SIGALRM, do_timeout);
 	} else {
@@ -521,6 +785,10 @@ int main(int argc, char **argv)
 	if (!dvb)
 		return -1;
 	dvb_dev_set_log(dvb, verbose, NULL);
+	if (args.replay && dvb_dev_file_init(dvb, args.replay) < 0) {
+		dvb_dev_free(dvb);
+		return -1;
+	}
 	dvb_dev_find(dvb, NULL, NULL);
 	parms = dvb->fe_parms;
 
@@ -540,6 +808,8 @@ int main(int argc, char **argv)
 	if (!dvb_dev)
 		return -1;
 
+	args.frontend_dev = dvb_dev->sysname;
+
 	if (!dvb_dev_open(dvb, dvb_dev->sysname, O_RDWR)) {
 		free(args.demux_dev);
 		return -1;
@@ -555,7 +825,8 @@ int main(int argc, char **argv)
 	if (err < 0)
 		fprintf(stderr, _("Failed to set the country code:%s\n"), args.cc);
 
-	timeout_flag = &parms->abort;
+	timeout_flag[0] = &parms->abort;
+	num_timeout_flags = 1;
 	signal(SIGTERM, do_timeout);
 	signal(SIGINT, do_timeout);
 
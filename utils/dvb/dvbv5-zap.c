@@ -47,6 +47,9 @@
 #include <signal.h>
 #include <argp.h>
 #include <sys/time.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netdb.h>
 #include <time.h>
 
 #include <config.h>
@@ -69,6 +72,13 @@
 #include "libdvbv5/dvb-dev.h"
 #include "libdvbv5/dvb-scan.h"
 #include "libdvbv5/header.h"
+#include "libdvbv5/mpeg_ts.h"
+#include "libdvbv5/pat.h"
+#include "libdvbv5/pmt.h"
+#include "libdvbv5/sdt.h"
+#include "libdvbv5/mpeg_pes.h"
+#include "libdvbv5/mpeg_es.h"
+#include "libdvbv5/crc32.h"
 #include "libdvbv5/countries.h"
 
 #define CHANNEL_FILE	"channels.conf"
@@ -94,8 +104,10 @@ struct arguments {
 	unsigned timeout, dvr, rec_psi, exit_after_tuning;
 	unsigned n_apid, n_vpid, all_pids;
 	enum dvb_file_formats input_format, output_format;
-	unsigned traffic_monitor, low_traffic, non_human, port;
-	char *search, *server;
+	unsigned traffic_monitor, low_traffic, non_human, port, rate_window;
+	unsigned use_splice, multi_service;
+	char *search, *server, *index_fname, *stream_url;
+	int stream_ttl;
 	const char *cc;
 
 	/* Used by status print */
@@ -108,7 +120,7 @@ static const struct argp_option options[] = {
 	{"channels",	'c', N_("file"),		0, N_("read channels list from 'file'"), 0},
 	{"demux",	'd', N_("demux#"),		0, N_("use given demux (default 0)"), 0},
 	{"frontend",	'f', N_("frontend#"),		0, N_("use given frontend (default 0)"), 0},
-	{"input-format", 'I',	N_("format"),		0, N_("Input format: ZAP, CHANNEL, DVBV5 (default: DVBV5)"), 0},
+	{"input-format", 'I',	N_("format"),		0, N_("Input format: ZAP, CHANNEL, DVBV5, DVBV5DB (default: DVBV5)"), 0},
 	{"lna",		'w', N_("LNA (0, 1, -1)"),	0, N_("enable/disable/auto LNA power"), 0},
 	{"lnbf",	'l', N_("LNBf_type"),		0, N_("type of LNBf to use. 'help' lists the available ones"), 0},
 	{"search",	'L', N_("string"),		0, N_("search/look for a string inside the traffic"), 0},
@@ -131,6 +143,12 @@ static const struct argp_option options[] = {
 	{"server",	'H', N_("SERVER"),		0, N_("dvbv5-daemon host IP address"), 0},
 	{"tcp-port",	'T', N_("PORT"),		0, N_("dvbv5-daemon host tcp port"), 0},
 	{"dvr-pipe",	'D', N_("PIPE"),		0, N_("Named pipe for DVR output, when using remote access (by default: /tmp/dvr-pipe)"), 0},
+	{"splice",	-5,  NULL,			0, N_("record using splice(), without copying data to userspace, if supported"), 0},
+	{"services",	-6,  NULL,			0, N_("record several services of the same multiplex at once, each channel argument (as channel or channel=file) to its own file (implies -r)"), 0},
+	{"index",	-7,  N_("file"),		0, N_("while recording, write a PCR and I-frame seek index of the recording to 'file'"), 0},
+	{"rate-window",	-8,  N_("seconds"),		0, N_("with --monitor, show the rates of the last 'seconds' of traffic (default 10)"), 0},
+	{"stream",	-9,  N_("url"),			0, N_("stream the TS to rtp://host:port or udp://host:port, at the pace of its PCR (implies -r)"), 0},
+	{"ttl",		-10, N_("hops"),		0, N_("with --stream, time to live of the multicast packets (default 1)"), 0},
 	{"help",        '?', 0,				0, N_("Give this help list"), -1},
 	{"usage",	-3,  0,				0, N_("Give a short usage message")},
 	{"version",	-4,  0,				0, N_("Print program version"), -1},
@@ -164,13 +182,38 @@ static int timeout_flag = 0;
 		fprintf(stderr, msg, __diff, ##args);				\
 	} while (0)
 
+/*
+ * On a channel database, use its indexes for an exact match, as loading
+ * the whole file is what takes time there. Returns NULL if the channel
+ * is not found this way, and the caller falls back to loading the file.
+ */
+static struct dvb_file *read_channel_db(const char *fname, const char *channel)
+{
+	struct dvb_file *dvb_file = NULL;
+	struct dvb_file_db *db;
+	int idx, vidx;
+
+	db = dvb_file_db_open(fname);
+	if (!db)
+		return NULL;
+
+	idx = dvb_file_db_find_channel(db, channel, -1);
+	vidx = dvb_file_db_find_vchannel(db, channel, -1);
+	if (idx < 0 || (vidx >= 0 && vidx < idx))
+		idx = vidx;
+	if (idx >= 0)
+		dvb_file = dvb_file_db_get(db, idx);
+
+	dvb_file_db_close(db);
+	return dvb_file;
+}
 
 static int parse(struct arguments *args,
 		 struct dvb_v5_fe_parms *parms,
 		 char *channel,
 		 int *vpid, int *apid, int *sid)
 {
-	struct dvb_file *dvb_file;
+	struct dvb_file *dvb_file = NULL;
 	struct dvb_entry *entry;
 	int i;
 	uint32_t sys;
@@ -197,8 +240,11 @@ static int parse(struct arguments *args,
 		sys = SYS_UNDEFINED;
 		break;
 	}
-	dvb_file = dvb_read_file_format(args->confname, sys,
-				    args->input_format);
+	if (args->input_format == FILE_DVBV5_DB)
+		dvb_file = read_channel_db(args->confname, channel);
+	if (!dvb_file)
+		dvb_file = dvb_read_file_format(args->confname, sys,
+					    args->input_format);
 	if (!dvb_file)
 		return -2;
 
@@ -339,9 +385,14 @@ static int parse(struct arguments *args,
 	return 0;
 }
 
+/* How long setup_frontend() waits for a lock, before check_frontend() */
+#define LOCK_WAIT_MS	2000
+
 static int setup_frontend(struct arguments *args,
 			  struct dvb_v5_fe_parms *parms)
 {
+	struct dvb_fe_tune *tune;
+	unsigned int lock_ms;
 	int rc;
 	uint32_t freq;
 
@@ -354,11 +405,23 @@ static int setup_frontend(struct arguments *args,
 		fprintf(stderr, _("tuning to %i Hz\n"), freq);
 	}
 
-	rc = dvb_fe_set_parms(parms);
-	if (rc < 0) {
-		ERROR("dvb_fe_set_parms failed");
+	/*
+	 * Wait for the lock events, instead of polling the status. If it
+	 * doesn't lock in time, check_frontend() keeps on waiting.
+	 */
+	tune = dvb_fe_prepare_tune(parms);
+	if (!tune) {
+		ERROR("dvb_fe_prepare_tune failed");
+		return -1;
+	}
+	rc = dvb_fe_tune(parms, tune, LOCK_WAIT_MS, &lock_ms);
+	dvb_fe_tune_free(tune);
+	if (rc < 0 && rc != -ETIMEDOUT && rc != -EINTR) {
+		ERROR("dvb_fe_tune failed");
 		return -1;
 	}
+	if (!rc && args->silent < 2)
+		fprintf(stderr, _("Lock after %u ms\n"), lock_ms);
 
 	return 0;
 }
@@ -486,27 +549,34 @@ static int print_frontend_stats(FILE *fd,
 	return 0;
 }
 
+static int show_lock_stats(struct dvb_v5_fe_parms *parms, void *__args)
+{
+	struct arguments *args = __args;
+
+	if (!args->silent)
+		print_frontend_stats(stderr, args, parms);
+	return timeout_flag;
+}
+
 static int check_frontend(struct arguments *args,
 			  struct dvb_v5_fe_parms *parms)
 {
-	int rc;
 	fe_status_t status = 0;
+	int rc;
+
+	/*
+	 * Wait for the lock event, showing the stats every second. The
+	 * alarm interrupts the wait, to check for the timeout.
+	 */
 	do {
-		rc = dvb_fe_get_stats(parms);
-		if (rc) {
-			ERROR("dvb_fe_get_stats failed");
+		rc = dvb_fe_wait_lock(parms, 0, 1000, show_lock_stats, args);
+		if (rc < 0 && rc != -EINTR && rc != -ECANCELED) {
+			ERROR("dvb_fe_wait_lock failed");
 			usleep(1000000);
-			continue;
 		}
+	} while (rc < 0 && !timeout_flag);
 
-		status = 0;
-		rc = dvb_fe_retrieve_stats(parms, DTV_STATUS, &status);
-		if (!args->silent)
-			print_frontend_stats(stderr, args, parms);
-		if (status & FE_HAS_LOCK)
-			break;
-		usleep(1000000);
-	} while (!timeout_flag);
+	dvb_fe_retrieve_stats(parms, DTV_STATUS, &status);
 	if (args->silent < 2)
 		print_frontend_stats(stderr, args, parms);
 
@@ -549,17 +619,1080 @@ static struct timespec *elapsed_time(struct timespec *start)
 	return &elapsed;
 }
 
-static void copy_to_file(struct dvb_open_descriptor *in_fd, int out_fd,
-			 int timeout, int silent)
+#define MMAP_BUFS	8
+
+static void print_received(long long int rc, int timeout, int silent)
+{
+	if (silent < 2) {
+		if (timeout)
+			fprintf(stderr, _("received %lld bytes (%lld Kbytes/sec)\n"), rc,
+				rc / (1024 * timeout));
+		else
+			fprintf(stderr, _("received %lld bytes\n"), rc);
+	}
+}
+
+/*
+ * Moves size bytes from the pipe to out_fd. If out_fd can't be spliced
+ * to, (like a tty, or a file opened with O_APPEND), copy via buf instead.
+ */
+static int drain_pipe(int pipe_fd, int out_fd, size_t size, int *can_splice)
 {
 	char buf[BUFLEN];
-	int r, first = 1;
+	ssize_t r;
+
+	while (size > 0) {
+		if (*can_splice) {
+			r = splice(pipe_fd, NULL, out_fd, NULL, size,
+				   SPLICE_F_MOVE | SPLICE_F_MORE);
+			if (r < 0 && errno == EINVAL) {
+				*can_splice = 0;
+				continue;
+			}
+		} else {
+			r = read(pipe_fd, buf, size < sizeof(buf) ? size : sizeof(buf));
+			if (r > 0)
+				r = write(out_fd, buf, r);
+		}
+		if (r < 0) {
+			if (errno == EINTR)
+				continue;
+			return -1;
+		}
+		size -= r;
+	}
+	return 0;
+}
+
+/*
+ * Returns -1 if the DVR doesn't support splice(), before reading any data,
+ * as the caller should then fallback to copy_to_file().
+ */
+static int splice_to_file(struct dvb_open_descriptor *in_fd, int out_fd,
+			  int timeout, int silent)
+{
+	int dvr_fd, pipe_fds[2], can_splice = 1, first = 1;
+	long long int rc = 0LL;
+	struct timespec start, *elapsed;
+	ssize_t r;
+
+	/* Only local devices have a file descriptor */
+	dvr_fd = dvb_dev_get_fd(in_fd);
+	if (dvr_fd < 0)
+		return -1;
+
+	if (pipe(pipe_fds) < 0) {
+		PERROR(_("pipe failed"));
+		return -1;
+	}
+	/* Not fatal: the pipe would just be drained more often */
+	fcntl(pipe_fds[1], F_SETPIPE_SZ, BUFLEN);
+
+	while (timeout_flag == 0) {
+		r = splice(dvr_fd, NULL, pipe_fds[1], NULL, BUFLEN,
+			   SPLICE_F_MOVE | SPLICE_F_MORE);
+		if (r < 0) {
+			if (errno == EINTR || errno == EAGAIN)
+				continue;
+			if (errno == EOVERFLOW) {
+				elapsed = elapsed_time(&start);
+				if (!elapsed)
+					fprintf(stderr, _("buffer overrun at %lld\n"), rc);
+				else
+					fprintf(stderr, _("buffer overrun after %lld.%02ld seconds\n"),
+						(long long)elapsed->tv_sec,
+						elapsed->tv_nsec / 10000000);
+				continue;
+			}
+			if (first && (errno == EINVAL || errno == ENOSYS)) {
+				if (silent < 2)
+					fprintf(stderr, _("splice() not supported by the DVR. Copying data instead\n"));
+				close(pipe_fds[0]);
+				close(pipe_fds[1]);
+				return -1;
+			}
+			PERROR(_("splice failed"));
+			break;
+		}
+		if (!r)
+			continue;
+
+		/* See copy_to_file() about restarting the alarm */
+		if (first) {
+			if (timeout > 0)
+				alarm(timeout);
+
+			clock_gettime(CLOCK_MONOTONIC, &start);
+			first = 0;
+		}
+
+		if (drain_pipe(pipe_fds[0], out_fd, r, &can_splice) < 0) {
+			PERROR(_("Write failed"));
+			break;
+		}
+
+		rc += r;
+	}
+	close(pipe_fds[0]);
+	close(pipe_fds[1]);
+
+	print_received(rc, timeout, silent);
+	return 0;
+}
+
+/*
+ * Multi-service recording: the whole TS is read once from the DVR and each
+ * packet is sent to the files of the services that use its PID. Every file
+ * gets a PAT listing only its service and only the PMT sections of its
+ * service, so it plays as a single program TS.
+ */
+
+#define TS_PACKET_SIZE	188
+#define TS_NUM_PIDS	8192
+
+/* Splits the data read from the DVR into whole TS packets */
+struct ts_packets {
+	uint64_t offset;	/* of the next byte fed */
+	unsigned int carry_len;
+	uint8_t carry[TS_PACKET_SIZE];
+};
+
+typedef void (*ts_packet_cb)(void *priv, const uint8_t *pkt,
+			     uint64_t offset);
+
+static void ts_packets_feed(struct ts_packets *tp, const uint8_t *buf,
+			    size_t len, ts_packet_cb cb, void *priv)
+{
+	uint64_t offset = tp->offset;
+	size_t n;
+
+	tp->offset += len;
+
+	/* A packet split between two reads */
+	if (tp->carry_len) {
+		n = TS_PACKET_SIZE - tp->carry_len;
+		if (n > len)
+			n = len;
+		memcpy(tp->carry + tp->carry_len, buf, n);
+		tp->carry_len += n;
+		buf += n;
+		len -= n;
+		offset += n;
+		if (tp->carry_len < TS_PACKET_SIZE)
+			return;
+		cb(priv, tp->carry, offset - TS_PACKET_SIZE);
+		tp->carry_len = 0;
+	}
+
+	while (len >= TS_PACKET_SIZE) {
+		if (buf[0] != DVB_MPEG_TS) {
+			buf++;
+			len--;
+			offset++;
+			continue;
+		}
+		cb(priv, buf, offset);
+		buf += TS_PACKET_SIZE;
+		len -= TS_PACKET_SIZE;
+		offset += TS_PACKET_SIZE;
+	}
+	if (len && buf[0] == DVB_MPEG_TS) {
+		memcpy(tp->carry, buf, len);
+		tp->carry_len = len;
+	}
+}
+
+/* PAT and PMT sections can't be longer than 1024 bytes */
+struct split_section {
+	uint8_t buf[1024];
+	unsigned int len, size;
+	int active, cc;
+};
+
+struct split_service {
+	char *name, *fname;
+	int fd;
+	uint16_t sid;
+	int pmt_pid, pmt_seen;
+	uint8_t pat_cc, pmt_cc;
+	struct split_section pmt;
+	uint8_t pids[TS_NUM_PIDS / 8];
+	long long bytes;
+	unsigned int len;
+	uint8_t buf[BUFLEN];
+};
+
+struct ts_split {
+	struct dvb_v5_fe_parms *parms;
+	struct split_section pat;
+	unsigned int n_services;
+	struct split_service **service;
+	struct ts_packets packets;
+	unsigned silent;
+};
+
+typedef void (*split_section_cb)(struct ts_split *split, void *priv,
+				 uint8_t *sec, unsigned int len);
+
+static void split_flush(struct split_service *svc)
+{
+	uint8_t *p = svc->buf;
+	ssize_t r;
+
+	while (svc->fd >= 0 && svc->len) {
+		r = write(svc->fd, p, svc->len);
+		if (r < 0) {
+			if (errno == EINTR)
+				continue;
+			PERROR(_("Write to '%s' failed"), svc->fname);
+			close(svc->fd);
+			svc->fd = -1;
+			break;
+		}
+		p += r;
+		svc->len -= r;
+		svc->bytes += r;
+	}
+	svc->len = 0;
+}
+
+static void split_write(struct split_service *svc, const uint8_t *pkt)
+{
+	if (svc->fd < 0)
+		return;
+	if (svc->len + TS_PACKET_SIZE > sizeof(svc->buf))
+		split_flush(svc);
+	memcpy(svc->buf + svc->len, pkt, TS_PACKET_SIZE);
+	svc->len += TS_PACKET_SIZE;
+}
+
+/* Packs a PSI section into as many TS packets as needed, with stuffing */
+static void split_write_section(struct split_service *svc, int pid,
+				uint8_t *cc, const uint8_t *sec,
+				unsigned int len)
+{
+	uint8_t pkt[TS_PACKET_SIZE];
+	unsigned int n, start = 1;
+
+	while (len) {
+		pkt[0] = DVB_MPEG_TS;
+		pkt[1] = (start ? 0x40 : 0) | (pid >> 8);
+		pkt[2] = pid & 0xff;
+		pkt[3] = 0x10 | *cc;
+		*cc = (*cc + 1) & 0x0f;
+
+		n = 4;
+		if (start)
+			pkt[n++] = 0;	/* pointer field */
+		if (len < TS_PACKET_SIZE - n) {
+			memcpy(pkt + n, sec, len);
+			memset(pkt + n + len, 0xff, TS_PACKET_SIZE - n - len);
+			len = 0;
+		} else {
+			memcpy(pkt + n, sec, TS_PACKET_SIZE - n);
+			sec += TS_PACKET_SIZE - n;
+			len -= TS_PACKET_SIZE - n;
+		}
+		split_write(svc, pkt);
+		start = 0;
+	}
+}
+
+static void split_section_start(struct split_section *s, int active)
+{
+	s->active = active;
+	s->len = 0;
+	s->size = 0;
+}
+
+static void split_section_copy(struct ts_split *split, struct split_section *s,
+			       const uint8_t *p, const uint8_t *end,
+			       split_section_cb done, void *priv)
+{
+	unsigned int n;
+
+	while (s->active && p < end) {
+		n = s->size ? s->size - s->len : 3 - s->len;
+		if (n > end - p)
+			n = end - p;
+		memcpy(s->buf + s->len, p, n);
+		s->len += n;
+		p += n;
+
+		if (!s->size && s->len == 3) {
+			s->size = 3 + (((s->buf[1] & 0x0f) << 8) | s->buf[2]);
+			if (s->size > sizeof(s->buf) || s->size < 3 + 5 + 4) {
+				s->active = 0;
+				break;
+			}
+		}
+		if (s->size && s->len == s->size) {
+			done(split, priv, s->buf, s->len);
+
+			/* Another section may follow, up to the stuffing */
+			split_section_start(s, p < end && *p != 0xff);
+		}
+	}
+}
+
+/* Reassembles the PSI sections carried by the packets of a PID */
+static void split_section_feed(struct ts_split *split, struct split_section *s,
+			       const uint8_t *pkt, split_section_cb done,
+			       void *priv)
+{
+	const uint8_t *p = pkt + 4, *end = pkt + TS_PACKET_SIZE;
+	int cc = pkt[3] & 0x0f;
+	unsigned int ptr;
+
+	/* Transport error, or no payload */
+	if ((pkt[1] & 0x80) || !(pkt[3] & 0x10))
+		return;
+	if (pkt[3] & 0x20)
+		p += 1 + pkt[4];
+	if (p >= end)
+		return;
+
+	if (s->active && cc != ((s->cc + 1) & 0x0f))
+		s->active = 0;
+	s->cc = cc;
+
+	if (pkt[1] & 0x40) {
+		ptr = *p++;
+		if (ptr >= end - p) {
+			s->active = 0;
+			return;
+		}
+		split_section_copy(split, s, p, p + ptr, done, priv);
+		p += ptr;
+		split_section_start(s, *p != 0xff);
+	}
+	split_section_copy(split, s, p, end, done, priv);
+}
+
+static void split_pat_done(struct ts_split *split, void *priv,
+			   uint8_t *sec, unsigned int len)
+{
+	struct dvb_table_pat *pat = NULL;
+	struct split_service *svc;
+	uint8_t out[16];
+	uint32_t crc;
+	unsigned int i;
+
+	if (sec[0] != DVB_TABLE_PAT || dvb_crc32(sec, len, 0xFFFFFFFF))
+		return;
+	if (dvb_table_pat_init(split->parms, sec, len, &pat) < 0 ||
+	    !pat->header.current_next)
+		goto free;
+
+	for (i = 0; i < split->n_services; i++) {
+		svc = split->service[i];
+
+		dvb_pat_program_foreach(prog, pat) {
+			if (prog->service_id == svc->sid &&
+			    prog->pid != svc->pmt_pid) {
+				svc->pmt_pid = prog->pid;
+				split_section_start(&svc->pmt, 0);
+			}
+		}
+		if (svc->pmt_pid < 0)
+			continue;
+
+		/* A PAT with just this service */
+		out[0] = DVB_TABLE_PAT;
+		out[1] = 0xb0;
+		out[2] = 13;
+		out[3] = pat->header.id >> 8;
+		out[4] = pat->header.id & 0xff;
+		out[5] = 0xc1 | (pat->header.version << 1);
+		out[6] = 0;
+		out[7] = 0;
+		out[8] = svc->sid >> 8;
+		out[9] = svc->sid & 0xff;
+		out[10] = 0xe0 | (svc->pmt_pid >> 8);
+		out[11] = svc->pmt_pid & 0xff;
+		crc = dvb_crc32(out, 12, 0xFFFFFFFF);
+		out[12] = crc >> 24;
+		out[13] = crc >> 16;
+		out[14] = crc >> 8;
+		out[15] = crc;
+		split_write_section(svc, DVB_TABLE_PAT_PID, &svc->pat_cc,
+				    out, sizeof(out));
+	}
+free:
+	if (pat)
+		dvb_table_pat_free(pat);
+}
+
+static void split_pmt_done(struct ts_split *split, void *priv,
+			   uint8_t *sec, unsigned int len)
+{
+	struct split_service *svc = priv;
+	struct dvb_table_pmt *pmt = NULL;
+	unsigned int n = 0;
+
+	/* A PMT PID may carry the PMTs of other services as well */
+	if (sec[0] != DVB_TABLE_PMT || ((sec[3] << 8) | sec[4]) != svc->sid ||
+	    !(sec[5] & 1) || dvb_crc32(sec, len, 0xFFFFFFFF))
+		return;
+	if (dvb_table_pmt_init(split->parms, sec, len, &pmt) < 0)
+		goto free;
+
+	memset(svc->pids, 0, sizeof(svc->pids));
+	svc->pids[DVB_TABLE_SDT_PID >> 3] |= 1 << (DVB_TABLE_SDT_PID & 7);
+	if (pmt->pcr_pid != DVB_MPEG_TS_NULL_PID)
+		svc->pids[pmt->pcr_pid >> 3] |= 1 << (pmt->pcr_pid & 7);
+	dvb_pmt_stream_foreach(stream, pmt) {
+		svc->pids[stream->elementary_pid >> 3] |=
+			1 << (stream->elementary_pid & 7);
+		n++;
+	}
+	if (!svc->pmt_seen && split->silent < 2)
+		fprintf(stderr, _("%s: PMT pid %d, %d streams\n"),
+			svc->name, svc->pmt_pid, n);
+	svc->pmt_seen = 1;
+
+	split_write_section(svc, svc->pmt_pid, &svc->pmt_cc, sec, len);
+free:
+	if (pmt)
+		dvb_table_pmt_free(pmt);
+}
+
+static void split_packet(void *priv, const uint8_t *pkt, uint64_t offset)
+{
+	struct ts_split *split = priv;
+	int pid = ((pkt[1] & 0x1f) << 8) | pkt[2];
+	struct split_service *svc;
+	unsigned int i;
+
+	if (pid == DVB_TABLE_PAT_PID) {
+		split_section_feed(split, &split->pat, pkt, split_pat_done,
+				   NULL);
+		return;
+	}
+	for (i = 0; i < split->n_services; i++) {
+		svc = split->service[i];
+		if (pid == svc->pmt_pid)
+			split_section_feed(split, &svc->pmt, pkt,
+					   split_pmt_done, svc);
+		else if (svc->pids[pid >> 3] & (1 << (pid & 7)))
+			split_write(svc, pkt);
+	}
+}
+
+static void split_feed(struct ts_split *split, const uint8_t *buf, size_t len)
+{
+	ts_packets_feed(&split->packets, buf, len, split_packet, split);
+}
+
+static void split_free(struct ts_split *split)
+{
+	struct split_service *svc;
+	unsigned int i;
+
+	for (i = 0; i < split->n_services; i++) {
+		svc = split->service[i];
+		split_flush(svc);
+		if (svc->fd >= 0) {
+			close(svc->fd);
+			if (split->silent < 2)
+				fprintf(stderr, _("%s: wrote %lld bytes to '%s'\n"),
+					svc->name, svc->bytes, svc->fname);
+		}
+		free(svc->name);
+		free(svc->fname);
+		free(svc);
+	}
+	free(split->service);
+	free(split);
+}
+
+/* Arguments are "channel" or "channel=file", the default file is channel.ts */
+static struct ts_split *split_setup(struct arguments *args,
+				    struct dvb_v5_fe_parms *parms,
+				    int argc, char **argv)
+{
+	struct ts_split *split;
+	struct split_service *svc;
+	uint32_t freq = 0, f;
+	int i, vpid, apid, sid;
+	char *fname;
+
+	split = calloc(1, sizeof(*split));
+	if (!split)
+		return NULL;
+	split->service = calloc(argc, sizeof(*split->service));
+	if (!split->service) {
+		free(split);
+		return NULL;
+	}
+	split->parms = parms;
+	split->silent = args->silent;
+
+	for (i = 0; i < argc; i++) {
+		svc = calloc(1, sizeof(*svc));
+		if (!svc)
+			goto err;
+		split->service[split->n_services++] = svc;
+		svc->fd = -1;
+		svc->pmt_pid = -1;
+
+		svc->name = strdup(argv[i]);
+		if (!svc->name)
+			goto err;
+		fname = strrchr(svc->name, '=');
+		if (fname) {
+			*fname++ = '\0';
+			svc->fname = strdup(fname);
+		} else if (asprintf(&svc->fname, "%s.ts", svc->name) < 0) {
+			svc->fname = NULL;
+		}
+		if (!svc->fname)
+			goto err;
+
+		sid = -1;
+		if (parse(args, parms, svc->name, &vpid, &apid, &sid))
+			goto err;
+		if (sid <= 0) {
+			ERROR("service id of '%s' was not specified at the file",
+			      svc->name);
+			goto err;
+		}
+		svc->sid = sid;
+
+		dvb_fe_retrieve_parm(parms, DTV_FREQUENCY, &f);
+		if (!i) {
+			freq = f;
+		} else if (f != freq) {
+			ERROR("'%s' is not on the same multiplex as '%s'",
+			      svc->name, split->service[0]->name);
+			goto err;
+		}
+
+		svc->fd = open(svc->fname,
+			       O_LARGEFILE | O_WRONLY | O_CREAT | O_TRUNC,
+			       0644);
+		if (svc->fd < 0) {
+			PERROR(_("open of '%s' failed"), svc->fname);
+			goto err;
+		}
+		if (args->silent < 2)
+			fprintf(stderr, _("service '%s' (sid 0x%04x) will be recorded to '%s'\n"),
+				svc->name, svc->sid, svc->fname);
+	}
+	return split;
+
+err:
+	split->silent = 2;
+	split_free(split);
+	return NULL;
+}
+
+/*
+ * Seek index written along with a recording. After a 16 bytes header
+ * ("DVBTSIDX", then the version and the size of an entry, as 32 bits big
+ * endian numbers), each 24 bytes entry has three 64 bits big endian fields:
+ *
+ *	- the offset of a TS packet in the recording;
+ *	- the time of that packet, in 27 MHz units since the first PCR of the
+ *	  recording, as given by the PCRs before it. It goes on across PCR
+ *	  wraps and discontinuities, so it never goes back;
+ *	- flags (TS_INDEX_RAP, TS_INDEX_PTS) and, with TS_INDEX_PTS, the PTS
+ *	  of the PES starting at that packet.
+ *
+ * There's an entry at each random access point of the video, and one at
+ * least every TS_INDEX_PCR_INTERVAL, so both the offsets and the times are
+ * sorted, and a binary search finds the offset of a given time.
+ */
+#define TS_INDEX_VERSION	1
+#define TS_INDEX_ENTRY_SIZE	24
+#define TS_INDEX_RAP		(1ULL << 63)	/* I-frame or random access */
+#define TS_INDEX_PTS		(1ULL << 62)
+
+#define PCR_HZ			27000000ULL
+#define PCR_WRAP		((1ULL << 33) * 300)
+#define TS_INDEX_PCR_INTERVAL	(PCR_HZ / 10)
+
+struct ts_index {
+	struct dvb_v5_fe_parms *parms;
+	char *fname;
+	FILE *fp;
+	struct ts_packets packets;
+	int pcr_pid;
+	uint64_t last_pcr, time, entry_time;
+	unsigned long entries;
+};
+
+static void put_be32(uint8_t *p, uint32_t v)
+{
+	p[0] = v >> 24;
+	p[1] = v >> 16;
+	p[2] = v >> 8;
+	p[3] = v;
+}
+
+static void put_be64(uint8_t *p, uint64_t v)
+{
+	put_be32(p, v >> 32);
+	put_be32(p + 4, v);
+}
+
+static void ts_index_close(struct ts_index *idx, unsigned silent)
+{
+	if (idx->fp) {
+		if (fclose(idx->fp))
+			PERROR(_("Write to '%s' failed"), idx->fname);
+		else if (silent < 2)
+			fprintf(stderr, _("wrote %lu index entries to '%s'\n"),
+				idx->entries, idx->fname);
+	}
+	free(idx);
+}
+
+static struct ts_index *ts_index_open(struct dvb_v5_fe_parms *parms,
+				      char *fname)
+{
+	struct ts_index *idx;
+	uint8_t hdr[16];
+
+	idx = calloc(1, sizeof(*idx));
+	if (!idx)
+		return NULL;
+	idx->parms = parms;
+	idx->fname = fname;
+	idx->pcr_pid = -1;
+
+	idx->fp = fopen(fname, "wb");
+	if (!idx->fp) {
+		PERROR(_("open of '%s' failed"), fname);
+		free(idx);
+		return NULL;
+	}
+
+	memcpy(hdr, "DVBTSIDX", 8);
+	put_be32(hdr + 8, TS_INDEX_VERSION);
+	put_be32(hdr + 12, TS_INDEX_ENTRY_SIZE);
+	if (fwrite(hdr, sizeof(hdr), 1, idx->fp) != 1) {
+		PERROR(_("Write to '%s' failed"), fname);
+		ts_index_close(idx, 2);
+		return NULL;
+	}
+	return idx;
+}
+
+static void ts_index_add(struct ts_index *idx, uint64_t offset,
+			 uint64_t flags)
+{
+	uint8_t e[TS_INDEX_ENTRY_SIZE];
+
+	put_be64(e, offset);
+	put_be64(e + 8, idx->time);
+	put_be64(e + 16, flags);
+	if (fwrite(e, sizeof(e), 1, idx->fp) != 1) {
+		PERROR(_("Write to '%s' failed"), idx->fname);
+		return;
+	}
+	idx->entries++;
+	idx->entry_time = idx->time;
+}
+
+/* Returns 1 if the first picture starting in the ES data is an MPEG-2 I-frame */
+static int ts_index_iframe(const uint8_t *p, const uint8_t *end)
+{
+	struct dvb_mpeg_es_pic_start pic;
+
+	for (; p + sizeof(pic) <= end; p++) {
+		if (p[0] || p[1] || p[2] != 1 || p[3] != DVB_MPEG_ES_PIC_START)
+			continue;
+		if (dvb_mpeg_es_pic_start_init(p, end - p, &pic) < 0)
+			return 0;
+		return pic.coding_type == DVB_MPEG_ES_FRAME_I;
+	}
+	return 0;
+}
+
+static void ts_index_packet(void *priv, const uint8_t *pkt, uint64_t offset)
+{
+	struct ts_index *idx = priv;
+	const uint8_t *p = pkt + 4, *end = pkt + TS_PACKET_SIZE;
+	uint8_t pes_buf[sizeof(struct dvb_mpeg_pes) +
+			sizeof(struct dvb_mpeg_pes_optional)];
+	struct dvb_mpeg_pes *pes = (struct dvb_mpeg_pes *)pes_buf;
+	int pid = ((pkt[1] & 0x1f) << 8) | pkt[2];
+	int rai = 0, rap = 0, has_pcr = 0;
+	uint64_t pcr, delta, flags = 0;
+
+	if (pkt[1] & 0x80)
+		return;
+
+	if ((pkt[3] & 0x20) && pkt[4]) {
+		rai = pkt[5] & 0x40;
+		if ((pkt[5] & 0x10) && pkt[4] >= 7) {
+			pcr = ((uint64_t)pkt[6] << 25 | pkt[7] << 17 |
+			       pkt[8] << 9 | pkt[9] << 1 | pkt[10] >> 7) * 300 +
+			      ((pkt[10] & 1) << 8 | pkt[11]);
+			if (idx->pcr_pid < 0) {
+				idx->pcr_pid = pid;
+				idx->last_pcr = pcr;
+			}
+			if (pid == idx->pcr_pid) {
+				/*
+				 * PCRs are at most 100 ms apart, anything else
+				 * is a discontinuity, and the time just goes on
+				 */
+				delta = (pcr + PCR_WRAP - idx->last_pcr) % PCR_WRAP;
+				if (delta > PCR_HZ)
+					delta = 0;
+				idx->time += delta;
+				idx->last_pcr = pcr;
+				has_pcr = 1;
+			}
+		}
+		p += 1 + pkt[4];
+	}
+
+	/* The start of a clear video PES */
+	if ((pkt[1] & 0x40) && (pkt[3] & 0x10) && !(pkt[3] & 0xc0) &&
+	    p + sizeof(pes_buf) - sizeof(pes->optional->pts) <= end &&
+	    !p[0] && !p[1] && p[2] == 1 && (p[3] & 0xf0) == 0xe0 &&
+	    dvb_mpeg_pes_init(idx->parms, p, end - p, pes_buf) > 0) {
+		if (pes->optional->PTS_DTS & 2)
+			flags = TS_INDEX_PTS | pes->optional->pts;
+		rap = rai;
+		if (!rap && !pes->optional->PES_scrambling_control)
+			rap = ts_index_iframe(p + 9 + pes->optional->length,
+					      end);
+	}
+
+	if (rap)
+		ts_index_add(idx, offset, flags | TS_INDEX_RAP);
+	else if (has_pcr && (!idx->entries ||
+		 idx->time - idx->entry_time >= TS_INDEX_PCR_INTERVAL))
+		ts_index_add(idx, offset, flags);
+}
+
+static void ts_index_feed(struct ts_index *idx, const uint8_t *buf, size_t len)
+{
+	ts_packets_feed(&idx->packets, buf, len, ts_index_packet, idx);
+
+	/* Keep the index usable while the recording goes on */
+	fflush(idx->fp);
+}
+
+/*
+ * Network output: the TS is sent in datagrams of 7 packets, as RTP (payload
+ * type 33, RFC 2250) or plain UDP. The DVR hands the data over in bursts,
+ * so each datagram is sent when the stream's clock says it is due: the PCRs
+ * of the first PID carrying them give the time of their packets, and the
+ * packets in between get a time interpolated from the bitrate between the
+ * last two PCRs. The datagrams due within STREAM_SLICE of each other are
+ * sent with a single sendmmsg().
+ */
+
+#define STREAM_TS_PACKETS	7
+#define STREAM_RTP_HDR_SIZE	12
+#define STREAM_BATCH		32
+#define STREAM_SLICE		(PCR_HZ / 500)	/* 2 ms */
+#define STREAM_MAX_LATE		PCR_HZ		/* give up catching up */
+
+struct ts_stream {
+	int fd, rtp;
+	uint16_t seq;
+	uint32_t ssrc;
+	struct ts_packets packets;
+
+	/* Datagrams ready to be sent, and the one being filled after them */
+	uint8_t dgram[STREAM_BATCH + 1][STREAM_RTP_HDR_SIZE +
+				       STREAM_TS_PACKETS * TS_PACKET_SIZE];
+	unsigned int n_dgrams, n_packets;
+	uint64_t due[STREAM_BATCH];
+	struct iovec iov[STREAM_BATCH];
+	struct mmsghdr msgs[STREAM_BATCH];
+
+	/* Stream time in 27 MHz units since the first PCR */
+	int pcr_pid;
+	uint64_t last_pcr, last_pcr_offset, last_pcr_time;
+	double ticks_per_byte;
+	struct timespec start;
+
+	unsigned long long datagrams;
+	unsigned errors;
+};
+
+/* Parses rtp://host:port or udp://host:port, host may be an [IPv6] address */
+static struct ts_stream *ts_stream_open(const char *url, int ttl)
+{
+	struct addrinfo hints = { .ai_socktype = SOCK_DGRAM }, *res, *ai;
+	struct ts_stream *stream;
+	char *host, *port, *end;
+	int rtp, ret;
+
+	if (!strncmp(url, "rtp://", 6)) {
+		rtp = 1;
+	} else if (!strncmp(url, "udp://", 6)) {
+		rtp = 0;
+	} else {
+		ERROR("stream url must be rtp://host:port or udp://host:port");
+		return NULL;
+	}
+	host = strdup(url + 6);
+	if (!host)
+		return NULL;
+	if (host[0] == '[' && (end = strchr(host, ']')) && end[1] == ':') {
+		*end = '\0';
+		port = end + 2;
+		memmove(host, host + 1, end - host);
+	} else if ((port = strrchr(host, ':'))) {
+		*port++ = '\0';
+	}
+	if (!port || !*port || !*host) {
+		ERROR("no host or port in stream url '%s'", url);
+		free(host);
+		return NULL;
+	}
+
+	ret = getaddrinfo(host, port, &hints, &res);
+	if (ret) {
+		ERROR("can't resolve '%s': %s", url, gai_strerror(ret));
+		free(host);
+		return NULL;
+	}
+	free(host);
+
+	stream = calloc(1, sizeof(*stream));
+	if (!stream) {
+		freeaddrinfo(res);
+		return NULL;
+	}
+	stream->fd = -1;
+	for (ai = res; ai; ai = ai->ai_next) {
+		stream->fd = socket(ai->ai_family, ai->ai_socktype | SOCK_CLOEXEC,
+				    ai->ai_protocol);
+		if (stream->fd < 0)
+			continue;
+		/* Only used for multicast destinations */
+		if (ai->ai_family == AF_INET6)
+			setsockopt(stream->fd, IPPROTO_IPV6, IPV6_MULTICAST_HOPS,
+				   &ttl, sizeof(ttl));
+		else
+			setsockopt(stream->fd, IPPROTO_IP, IP_MULTICAST_TTL,
+				   &ttl, sizeof(ttl));
+		if (!connect(stream->fd, ai->ai_addr, ai->ai_addrlen))
+			break;
+		close(stream->fd);
+		stream->fd = -1;
+	}
+	freeaddrinfo(res);
+	if (stream->fd < 0) {
+		PERROR(_("can't connect to '%s'"), url);
+		free(stream);
+		return NULL;
+	}
+
+	stream->rtp = rtp;
+	stream->pcr_pid = -1;
+	srandom(getpid() ^ time(NULL));
+	stream->seq = random();
+	stream->ssrc = random();
+	return stream;
+}
+
+static uint64_t ts_stream_now(struct ts_stream *stream)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return ((now.tv_sec - stream->start.tv_sec) * 1000000000ULL +
+		now.tv_nsec - stream->start.tv_nsec) * 27 / 1000;
+}
+
+/* Waits for the first datagram to be due, then sends all of them */
+static void ts_stream_flush(struct ts_stream *stream)
+{
+	struct timespec due;
+	uint64_t now, ns;
+	unsigned int sent = 0;
+	int r;
+
+	if (!stream->n_dgrams)
+		return;
+
+	if (stream->start.tv_sec || stream->start.tv_nsec) {
+		now = ts_stream_now(stream);
+		if (now >= stream->due[0] + STREAM_MAX_LATE) {
+			/* Way behind, a stall or a discontinuity: start over */
+			ns = (now - stream->due[0]) * 1000 / 27;
+			stream->start.tv_sec += ns / NANO_SECONDS_IN_SEC;
+			stream->start.tv_nsec += ns % NANO_SECONDS_IN_SEC;
+			if (stream->start.tv_nsec >= NANO_SECONDS_IN_SEC) {
+				stream->start.tv_sec++;
+				stream->start.tv_nsec -= NANO_SECONDS_IN_SEC;
+			}
+		} else if (now < stream->due[0]) {
+			ns = stream->due[0] * 1000 / 27;
+			due.tv_sec = stream->start.tv_sec + ns / NANO_SECONDS_IN_SEC;
+			due.tv_nsec = stream->start.tv_nsec + ns % NANO_SECONDS_IN_SEC;
+			if (due.tv_nsec >= NANO_SECONDS_IN_SEC) {
+				due.tv_sec++;
+				due.tv_nsec -= NANO_SECONDS_IN_SEC;
+			}
+			/* Stopped by the timeout alarm, the rest is sent anyway */
+			clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &due, NULL);
+		}
+	}
+
+	while (sent < stream->n_dgrams) {
+		r = sendmmsg(stream->fd, stream->msgs + sent,
+			     stream->n_dgrams - sent, 0);
+		if (r < 0) {
+			if (errno == EINTR)
+				continue;
+			/* Like ECONNREFUSED from a receiver not there yet */
+			if (!stream->errors++)
+				PERROR(_("send failed"));
+			break;
+		}
+		sent += r;
+	}
+	stream->datagrams += sent;
+
+	/* The datagram being filled goes to the front */
+	memcpy(stream->dgram[0], stream->dgram[stream->n_dgrams],
+	       STREAM_RTP_HDR_SIZE + stream->n_packets * TS_PACKET_SIZE);
+	stream->n_dgrams = 0;
+}
+
+/* The datagram being filled is complete, queue it */
+static void ts_stream_queue(struct ts_stream *stream, uint64_t time)
+{
+	unsigned int n = stream->n_dgrams;
+	uint8_t *d = stream->dgram[n];
+	size_t len = stream->n_packets * TS_PACKET_SIZE;
+	uint32_t ts = time / 300;	/* 90 kHz */
+
+	if (n && (n == STREAM_BATCH || time >= stream->due[0] + STREAM_SLICE)) {
+		ts_stream_flush(stream);
+		n = 0;
+		d = stream->dgram[0];
+	}
+
+	if (stream->rtp) {
+		d[0] = 0x80;		/* version 2 */
+		d[1] = 33;		/* MP2T */
+		d[2] = stream->seq >> 8;
+		d[3] = stream->seq;
+		put_be32(d + 4, ts);
+		put_be32(d + 8, stream->ssrc);
+		stream->seq++;
+		stream->iov[n].iov_base = d;
+		stream->iov[n].iov_len = STREAM_RTP_HDR_SIZE + len;
+	} else {
+		stream->iov[n].iov_base = d + STREAM_RTP_HDR_SIZE;
+		stream->iov[n].iov_len = len;
+	}
+	memset(&stream->msgs[n], 0, sizeof(stream->msgs[n]));
+	stream->msgs[n].msg_hdr.msg_iov = &stream->iov[n];
+	stream->msgs[n].msg_hdr.msg_iovlen = 1;
+	stream->due[n] = time;
+	stream->n_dgrams = n + 1;
+	stream->n_packets = 0;
+}
+
+static void ts_stream_packet(void *priv, const uint8_t *pkt, uint64_t offset)
+{
+	struct ts_stream *stream = priv;
+	int pid = ((pkt[1] & 0x1f) << 8) | pkt[2];
+	uint64_t pcr, delta, time;
+
+	/* The time of this packet, from the bitrate up to the last PCR */
+	time = stream->last_pcr_time + (offset - stream->last_pcr_offset) *
+	       stream->ticks_per_byte;
+
+	if (!(pkt[1] & 0x80) && (pkt[3] & 0x20) && pkt[4] >= 7 &&
+	    (pkt[5] & 0x10)) {
+		pcr = ((uint64_t)pkt[6] << 25 | pkt[7] << 17 |
+		       pkt[8] << 9 | pkt[9] << 1 | pkt[10] >> 7) * 300 +
+		      ((pkt[10] & 1) << 8 | pkt[11]);
+		if (stream->pcr_pid < 0) {
+			/* The stream clock starts now */
+			stream->pcr_pid = pid;
+			clock_gettime(CLOCK_MONOTONIC, &stream->start);
+			stream->last_pcr = pcr;
+			stream->last_pcr_offset = offset;
+			stream->last_pcr_time = time = 0;
+		} else if (pid == stream->pcr_pid) {
+			delta = (pcr + PCR_WRAP - stream->last_pcr) % PCR_WRAP;
+			/* Across a discontinuity the interpolated time goes on */
+			if (delta && delta <= PCR_HZ) {
+				stream->ticks_per_byte = (double)delta /
+					(offset - stream->last_pcr_offset);
+				time = stream->last_pcr_time + delta;
+			}
+			stream->last_pcr = pcr;
+			stream->last_pcr_offset = offset;
+			stream->last_pcr_time = time;
+		}
+	}
+
+	memcpy(stream->dgram[stream->n_dgrams] + STREAM_RTP_HDR_SIZE +
+	       stream->n_packets * TS_PACKET_SIZE, pkt, TS_PACKET_SIZE);
+	if (++stream->n_packets == STREAM_TS_PACKETS)
+		ts_stream_queue(stream, time);
+}
+
+static void ts_stream_feed(struct ts_stream *stream, const uint8_t *buf,
+			   size_t len)
+{
+	ts_packets_feed(&stream->packets, buf, len, ts_stream_packet, stream);
+}
+
+static void ts_stream_close(struct ts_stream *stream, unsigned silent)
+{
+	/* Send what is left, without waiting for it to be due */
+	if (stream->n_packets)
+		ts_stream_queue(stream, stream->last_pcr_time);
+	stream->start.tv_sec = stream->start.tv_nsec = 0;
+	ts_stream_flush(stream);
+
+	if (silent < 2)
+		fprintf(stderr, _("sent %llu datagrams\n"), stream->datagrams);
+	close(stream->fd);
+	free(stream);
+}
+
+/*
+ * With split, the data goes to its services instead of to out_fd. With
+ * stream, it goes to the network. With idx, it gets indexed as well.
+ */
+static void copy_to_file(struct dvb_open_descriptor *in_fd, int out_fd,
+			 struct ts_split *split, struct ts_stream *stream,
+			 struct ts_index *idx, int timeout, int silent)
+{
+	char buf[BUFLEN], *p = buf;
+	int r, first = 1, index = -1, use_mmap;
 	long long int rc = 0LL;
 	struct timespec start, *elapsed;
 
+	/*
+	 * If the demux supports it, write the data straight from its
+	 * buffers, instead of copying it through buf.
+	 */
+	use_mmap = dvb_dev_mmap_setup(in_fd, MMAP_BUFS, BUFLEN) > 0;
+	if (use_mmap && silent < 2)
+		fprintf(stderr, _("using memory mapped DVR buffers\n"));
+
 	while (timeout_flag == 0) {
-		r = dvb_dev_read(in_fd, buf, sizeof(buf));
+		if (index >= 0) {
+			dvb_dev_mmap_queue(in_fd, index);
+			index = -1;
+		}
+		if (use_mmap)
+			r = dvb_dev_mmap_dequeue(in_fd, (void **)&p, &index, NULL);
+		else
+			r = dvb_dev_read(in_fd, buf, sizeof(buf));
 		if (r < 0) {
+			/* DMX_DQBUF gives up after a while without data */
+			if (r == -EAGAIN)
+				continue;
 			if (r == -EOVERFLOW) {
 				elapsed = elapsed_time(&start);
 				if (!elapsed)
@@ -589,20 +1722,22 @@ static void copy_to_file(struct dvb_open_descriptor *in_fd, int out_fd,
 			first = 0;
 		}
 
-		if (write(out_fd, buf, r) < 0) {
+		if (split) {
+			split_feed(split, (uint8_t *)p, r);
+		} else if (stream) {
+			ts_stream_feed(stream, (uint8_t *)p, r);
+		} else if (write(out_fd, p, r) < 0) {
 			PERROR(_("Write failed"));
 			break;
+		} else if (idx) {
+			ts_index_feed(idx, (uint8_t *)p, r);
 		}
 
 		rc += r;
 	}
-	if (silent < 2) {
-		if (timeout)
-			fprintf(stderr, _("received %lld bytes (%lld Kbytes/sec)\n"), rc,
-				rc / (1024 * timeout));
-		else
-			fprintf(stderr, _("received %lld bytes\n"), rc);
-	}
+	if (use_mmap)
+		dvb_dev_mmap_free(in_fd);
+	print_received(rc, timeout, silent);
 }
 
 static error_t parse_opt(int k, char *optarg, struct argp_state *state)
@@ -714,6 +1849,30 @@ static error_t parse_opt(int k, char *optarg, struct argp_state *state)
 				| ARGP_HELP_DOC);
 		fprintf(state->out_stream, _("\nReport bugs to %s.\n"), argp_program_bug_address);
 		exit(0);
+	case -5:
+		args->use_splice = 1;
+		break;
+	case -6:
+		args->multi_service = 1;
+		args->dvr = 1;
+		break;
+	case -7:
+		args->index_fname = strdup(optarg);
+		break;
+	case -8:
+		args->rate_window = strtoul(optarg, NULL, 0);
+		if (!args->rate_window)
+			argp_error(state, _("invalid rate window: %s"), optarg);
+		break;
+	case -9:
+		args->stream_url = strdup(optarg);
+		args->dvr = 1;
+		break;
+	case -10:
+		args->stream_ttl = strtoul(optarg, NULL, 0);
+		if (args->stream_ttl < 1 || args->stream_ttl > 255)
+			argp_error(state, _("invalid ttl: %s"), optarg);
+		break;
 	case -4:
 		fprintf (state->out_stream, "%s\n", argp_program_version);
 		exit(0);
@@ -752,27 +1911,285 @@ static char *print_bytes(float val)
 	return buf;
 }
 
+static void monitor_cc_error(void *priv, uint16_t pid,
+			     unsigned expected, unsigned received)
+{
+	monitor_log(_("%.2fs: pid %d, expecting %d received %d\n"),
+		    pid, expected, received);
+}
+
+/* Counts the packets containing args->search */
+static void monitor_search(struct arguments *args, unsigned char *buffer,
+			   ssize_t r, uint64_t *search_pidt,
+			   uint64_t *search_total)
+{
+	int i, j, pid, sl = strlen(args->search);
+
+	for (i = 0; i + 188 <= r; i += 188) {
+		unsigned char *h = &buffer[i];
+
+		if (h[0] != DVB_MPEG_TS)
+			continue;
+		pid = ((h[1] & 0x1f) << 8) | h[2];
+		if (pid == DVB_MPEG_TS_NULL_PID)
+			continue;
+		for (j = 0; j < (188 - sl); ++j) {
+			if (!memcmp(h + j, args->search, sl)) {
+				search_pidt[pid]++;
+				(*search_total)++;
+				break;
+			}
+		}
+	}
+}
+
+/*
+ * Packet counters of the last args->rate_window seconds, one snapshot per
+ * report, so the rates shown follow the traffic instead of being averages
+ * since the start of the capture.
+ */
+struct monitor_window {
+	unsigned size, head, used;
+	uint64_t *packets;	/* size snapshots of DVB_MPEG_TS_NUM_PIDS counters */
+	uint64_t *total;
+	unsigned long long *ms;
+};
+
+static int monitor_window_init(struct monitor_window *w, unsigned seconds)
+{
+	w->size = seconds + 1;
+	w->head = 0;
+	w->used = 1;
+	w->packets = calloc(w->size, DVB_MPEG_TS_NUM_PIDS * sizeof(*w->packets));
+	w->total = calloc(w->size, sizeof(*w->total));
+	w->ms = calloc(w->size, sizeof(*w->ms));
+	if (!w->packets || !w->total || !w->ms)
+		return -ENOMEM;
+	return 0;
+}
+
+static void monitor_window_free(struct monitor_window *w)
+{
+	free(w->packets);
+	free(w->total);
+	free(w->ms);
+}
+
+/* Stores the counters at ms, returning the oldest snapshot still kept */
+static unsigned monitor_window_add(struct monitor_window *w,
+				   const uint64_t *pidt, uint64_t total,
+				   unsigned long long ms)
+{
+	w->head = (w->head + 1) % w->size;
+	memcpy(&w->packets[w->head * DVB_MPEG_TS_NUM_PIDS], pidt,
+	       DVB_MPEG_TS_NUM_PIDS * sizeof(*pidt));
+	w->total[w->head] = total;
+	w->ms[w->head] = ms;
+	if (w->used < w->size)
+		w->used++;
+
+	return (w->head + w->size - w->used + 1) % w->size;
+}
+
+/* Jitter range in ns, max interval in ms and drift in ppm of a PCR PID */
+static void pcr_values(const struct dvb_mpeg_ts_pcr *pcr, double *jitter_min,
+		       double *jitter_max, double *interval, double *drift,
+		       int *has_drift)
+{
+	uint64_t clock = pcr->last_clock - pcr->first_clock;
+
+	*jitter_min = pcr->win_jitter_min * 1000. / 27;
+	*jitter_max = pcr->win_jitter_max * 1000. / 27;
+	*interval = pcr->win_max_interval * 1000. / DVB_MPEG_TS_PCR_HZ;
+
+	/* Drift is meaningless before a few seconds */
+	*has_drift = clock >= 5ULL * NANO_SECONDS_IN_SEC;
+	if (*has_drift)
+		*drift = (pcr->elapsed * 1e9 / DVB_MPEG_TS_PCR_HZ - clock) *
+			 1e6 / clock;
+}
+
+static void monitor_print_table(struct arguments *args,
+				struct dvb_mpeg_ts_stats *stats,
+				const uint64_t *pidt, uint64_t total,
+				const uint64_t *old_pidt, uint64_t old_total,
+				unsigned long long ms)
+{
+	unsigned long long other_pidt = 0, other_total = 0, other_err_cnt = 0;
+	unsigned long long cnt, err_cnt;
+	double jitter_min, jitter_max, interval, drift;
+	int pid, has_drift, has_pcr = 0;
+
+	printf(_(" PID           FREQ         SPEED       TOTAL\n"));
+	for (pid = 0; pid < DVB_MPEG_TS_NUM_PIDS; pid++) {
+		cnt = pidt[pid];
+		err_cnt = stats->cc_errors[pid];
+		if (cnt) {
+			double rate = (cnt - old_pidt[pid]) * 1000. / ms;
+
+			if (args->low_traffic && rate < args->low_traffic) {
+				other_pidt += cnt - old_pidt[pid];
+				other_total += cnt;
+				other_err_cnt += err_cnt;
+				continue;
+			}
+			printf("%5d %9.2f p/s %sbps ",
+				pid,
+				rate,
+				print_bytes(rate * 8 * 188));
+			if (cnt * 188 / 1024)
+				printf("%8llu KB", (cnt * 188 + 512) / 1024);
+			else
+				printf(" %8llu B", cnt * 188);
+			if (err_cnt > 0)
+				printf(" %8llu continuity errors",
+				       err_cnt);
+
+			printf("\n");
+		}
+	}
+	if (other_total) {
+		printf(_("OTHER"));
+		printf(" %9.2f p/s %sbps ",
+			other_pidt * 1000. / ms,
+			print_bytes(other_pidt * 1000. * 8 * 188/ ms));
+		if (other_total * 188 / 1024)
+			printf("%8llu KB", (other_total * 188 + 512) / 1024);
+		else
+			printf(" %8llu B", other_total * 188);
+		if (other_err_cnt > 0)
+			printf(" %8llu continuity errors",
+			       other_err_cnt);
+		printf("\n");
+	}
+
+	cnt = total - old_total;
+	printf("TOT %11.2f p/s %sbps %8llu KB\n",
+		cnt * 1000. / ms,
+		print_bytes(cnt * 1000. * 8 * 188/ ms),
+		((unsigned long long)total * 188 + 512) / 1024);
+
+	for (pid = 0; stats->pcr && pid < DVB_MPEG_TS_NUM_PIDS; pid++) {
+		const struct dvb_mpeg_ts_pcr *pcr = &stats->pcr->pid[pid];
+
+		if (!pcr->count)
+			continue;
+		if (!has_pcr++)
+			printf(_("\n PCR     INTERVAL      JITTER (ns)       DRIFT  REPET  DISC   ACC\n"));
+
+		pcr_values(pcr, &jitter_min, &jitter_max, &interval, &drift,
+			   &has_drift);
+		printf("%5d %9.2f ms ", pid, interval);
+		if (pcr->win_jitters)
+			printf("%+8.0f %+8.0f ", jitter_min, jitter_max);
+		else
+			printf("%8s %8s ", "-", "-");
+		if (has_drift)
+			printf("%+7.2f ppm ", drift);
+		else
+			printf("%11s ", "-");
+		printf("%5llu %5llu %5llu\n",
+		       (unsigned long long)pcr->repetition_errors,
+		       (unsigned long long)pcr->discontinuities,
+		       (unsigned long long)pcr->accuracy_errors);
+	}
+	printf("\n");
+}
+
+/*
+ * One JSON object per line and per report, for monitoring tools. Rates are
+ * over the rate window, counters are since the start of the capture.
+ */
+static void monitor_print_json(struct dvb_mpeg_ts_stats *stats,
+			       const uint64_t *pidt, uint64_t total,
+			       const uint64_t *old_pidt, uint64_t old_total,
+			       unsigned long long ms, unsigned long long now)
+{
+	double jitter_min, jitter_max, interval, drift;
+	int pid, has_drift, n = 0;
+
+	printf("{\"time\":%.3f,\"packets\":%llu,\"bps\":%.0f,"
+	       "\"sync_errors\":%llu,\"cc_errors\":%llu,\"pids\":[",
+	       now / 1000., (unsigned long long)total,
+	       (total - old_total) * 1000. * 8 * 188 / ms,
+	       (unsigned long long)stats->sync_errors,
+	       (unsigned long long)stats->total_cc_errors);
+	for (pid = 0; pid < DVB_MPEG_TS_NUM_PIDS; pid++) {
+		if (!pidt[pid])
+			continue;
+		printf("%s{\"pid\":%d,\"packets\":%llu,\"bps\":%.0f,\"cc_errors\":%llu}",
+		       n++ ? "," : "", pid, (unsigned long long)pidt[pid],
+		       (pidt[pid] - old_pidt[pid]) * 1000. * 8 * 188 / ms,
+		       (unsigned long long)stats->cc_errors[pid]);
+	}
+	printf("],\"pcr\":[");
+	for (pid = 0, n = 0; stats->pcr && pid < DVB_MPEG_TS_NUM_PIDS; pid++) {
+		const struct dvb_mpeg_ts_pcr *pcr = &stats->pcr->pid[pid];
+
+		if (!pcr->count)
+			continue;
+		pcr_values(pcr, &jitter_min, &jitter_max, &interval, &drift,
+			   &has_drift);
+		printf("%s{\"pid\":%d,\"count\":%llu,\"max_interval_ms\":%.3f",
+		       n++ ? "," : "", pid, (unsigned long long)pcr->count,
+		       interval);
+		if (pcr->win_jitters)
+			printf(",\"jitter_min_ns\":%.0f,\"jitter_max_ns\":%.0f",
+			       jitter_min, jitter_max);
+		if (has_drift)
+			printf(",\"drift_ppm\":%.3f", drift);
+		printf(",\"repetition_errors\":%llu,\"discontinuities\":%llu,"
+		       "\"accuracy_errors\":%llu}",
+		       (unsigned long long)pcr->repetition_errors,
+		       (unsigned long long)pcr->discontinuities,
+		       (unsigned long long)pcr->accuracy_errors);
+	}
+	printf("]}\n");
+	fflush(stdout);
+}
+
 int do_traffic_monitor(struct arguments *args, struct dvb_device *dvb,
 		       int out_fd, int timeout)
 {
 	struct dvb_open_descriptor *fd, *dvr_fd;
 	struct timespec startt;
 	struct dvb_v5_fe_parms *parms = dvb->fe_parms;
-	unsigned long long pidt[0x2001], wait, cont_err = 0;
-	unsigned long long err_cnt[0x2000];
-	signed char pid_cont[0x2000];
-	int i, first = 1;
-
-	memset(pidt, 0, sizeof(pidt));
-	memset(err_cnt, 0, sizeof(err_cnt));
-	memset(pid_cont, 0, sizeof(pid_cont));
+	struct dvb_mpeg_ts_stats *stats;
+	struct monitor_window window = {};
+	uint64_t *search_pidt = NULL, search_total = 0, *pidt, *total;
+	unsigned long long wait, sync_errors;
+	int first = 1, ret = -1;
+
+	stats = calloc(1, sizeof(*stats));
+	if (!stats)
+		return -1;
+	stats->pcr = calloc(1, sizeof(*stats->pcr));
+	if (!stats->pcr)
+		goto free_stats;
+	dvb_mpeg_ts_stats_init(stats);
+	dvb_mpeg_ts_pcr_stats_init(stats->pcr);
+	stats->cc_error = monitor_cc_error;
+	pidt = stats->packets;
+	total = &stats->total;
+
+	if (monitor_window_init(&window, args->rate_window ? : 10) < 0)
+		goto free_stats;
+
+	/* On search mode, only the packets that match are accounted */
+	if (args->search) {
+		search_pidt = calloc(DVB_MPEG_TS_NUM_PIDS, sizeof(*search_pidt));
+		if (!search_pidt)
+			goto free_stats;
+		pidt = search_pidt;
+		total = &search_total;
+	}
 
 	args->exit_after_tuning = 1;
 	check_frontend(args, parms);
 
 	dvr_fd = dvb_dev_open(dvb, args->dvr_dev, O_RDONLY);
 	if (!dvr_fd)
-		return -1;
+		goto free_stats;
 
 	fprintf(stderr, _("dvb_dev_set_bufsize: buffer set to %d\n"), DVB_BUF_SIZE);
 	dvb_dev_set_bufsize(dvr_fd, DVB_BUF_SIZE);
@@ -780,30 +2197,28 @@ int do_traffic_monitor(struct arguments *args, struct dvb_device *dvb,
 	fd = dvb_dev_open(dvb, args->demux_dev, O_RDWR);
 	if (!fd) {
 		dvb_dev_close(dvr_fd);
-		return -1;
+		goto free_stats;
 	}
 
 	if (args->silent < 2)
 		fprintf(stderr, _("  dvb_set_pesfilter to 0x2000\n"));
 	if (dvb_dev_dmx_set_pesfilter(fd, 0x2000, DMX_PES_OTHER,
-				      DMX_OUT_TS_TAP, 0) < 0) {
-		dvb_dev_close(dvr_fd);
-		dvb_dev_close(fd);
-		return -1;
-	}
+				      DMX_OUT_TS_TAP, 0) < 0)
+		goto close_devs;
 
 	if (clock_gettime(CLOCK_MONOTONIC, &startt)) {
 		fprintf(stderr, _("Can't get timespec\n"));
-                return -1;
+		goto close_devs;
 	}
 
 	wait = 1000;
+	ret = 0;
 
 	monitor_log(_("%.2fs: Starting capture\n"));
 	while (1) {
 		struct timespec *elapsed;
 		unsigned char buffer[BUFLEN];
-		int pid, ok, diff;
+		int diff;
 		ssize_t r;
 
 		if (timeout_flag)
@@ -841,170 +2256,83 @@ int do_traffic_monitor(struct arguments *args, struct dvb_device *dvb,
 			break;
 		}
 
-		for (i = 0; i < BUFLEN; i += 188) {
-			struct dvb_ts_packet_header *h = (void *)&buffer[i];
-			if (h->sync_byte != 0x47) {
-				monitor_log(_("%.2fs: invalid sync byte. Discarding %zd bytes\n"), r);
-				continue;
-			}
-
-			bswap16(h->bitfield);
-
-#if 0
-			/*
-			 * ITU-T Rec. H.222.0 decoders shall discard Transport
-			 * Stream packets with the adaptation_field_control
-			 * field set to a value of '00' (invalid). Packets with
-			 * a value of '01' are NULL packets. Yet, as those are
-			 * actually part of the stream, we won't be discarding,
-			 * as we want to take them into account for traffic
-			 * estimation purposes.
-			 */
-			if (h->adaptation_field_control == 0)
-				continue;
-#endif
-			ok = 1;
-			pid = h->pid;
-
-			if (pid > 0x1fff) {
-				monitor_log(_("%.2fs: invalid pid: 0x%04x\n"),
-					    pid);
-				pid = 0x1fff;
-			}
-
-			/*
-			 * After 1 second of processing, check if are there
-			 * any issues with regards to frame continuity for
-			 * non-NULL packets.
-			 *
-			 * According to ITU-T H.222.0 | ISO/IEC 13818-1, the
-			 * continuity counter isn't incremented if the packet
-			 * is 00 or 10. It is only incremented on odd values.
-			 *
-			 * Also, don't check continuity errors on the first
-			 * second, as the frontend is still starting streaming
-			 */
-			if (pid < 0x1fff && h->adaptation_field_control & 1) {
-				int discontinued = 0;
-
-				if (err_cnt[pid] < 0)
-					err_cnt[pid] = 0;
-
-				if (h->adaptation_field_control & 2) {
-					if (h->adaptation_field_length >= 1) {
-						discontinued = h->discontinued;
-					} else {
-						monitor_log(_("%.2fs: pid %d has adaption layer, but size is too small!\n"),
-							    pid);
-					}
-				}
-
-				if (wait < 2000)
-					discontinued = 1;
-
-				if (!discontinued && pid_cont[pid] >= 0) {
-					unsigned int next = (pid_cont[pid] + 1) % 16;
-					if (next != h->continuity_counter) {
-						monitor_log(_("%.2fs: pid %d, expecting %d received %d\n"),
-							    pid, next,
-							    h->continuity_counter);
-						discontinued = 1;
-						cont_err++;
-						err_cnt[pid]++;
-					}
-				}
-				if (discontinued)
-					pid_cont[pid] = -1;
-				else
-					pid_cont[pid] = h->continuity_counter;
-			}
-
-			if (args->search) {
-				int i, sl = strlen(args->search);
-				ok = 0;
-				if (pid != 0x1fff) {
-					for (i = 0; i < (188 - sl); ++i) {
-						if (!memcmp((char *)h + i, args->search, sl))
-							ok = 1;
-					}
-				}
-			}
-
-			if (ok) {
-				pidt[pid]++;
-				pidt[0x2000]++;
-			}
-		}
-
 		elapsed = elapsed_time(&startt);
 		if (!elapsed)
 			diff = wait;
 		else
 			diff = (unsigned long long)elapsed->tv_sec * 1000
 				+ elapsed->tv_nsec * 1000 / NANO_SECONDS_IN_SEC;
+		stats->pcr->clock = elapsed ?
+			(uint64_t)elapsed->tv_sec * NANO_SECONDS_IN_SEC +
+			elapsed->tv_nsec : (uint64_t)diff * 1000000;
+
+		/*
+		 * ITU-T Rec. H.222.0 decoders shall discard Transport
+		 * Stream packets with the adaptation_field_control
+		 * field set to a value of '00' (invalid). Packets with
+		 * a value of '01' are NULL packets. Yet, as those are
+		 * actually part of the stream, we won't be discarding,
+		 * as we want to take them into account for traffic
+		 * estimation purposes.
+		 *
+		 * Also, don't check continuity errors on the first
+		 * second, as the frontend is still starting streaming
+		 */
+		sync_errors = stats->sync_errors;
+		dvb_mpeg_ts_stats_update(stats, buffer, r, wait >= 2000);
+		if (stats->sync_errors != sync_errors)
+			monitor_log(_("%.2fs: invalid sync byte. Discarded %llu packets\n"),
+				    (unsigned long long)stats->sync_errors - sync_errors);
+
+		if (args->search)
+			monitor_search(args, buffer, r, search_pidt, &search_total);
 
 		if (diff > wait) {
-			unsigned long long other_pidt = 0, other_err_cnt = 0;
+			const uint64_t *old_pidt;
+			unsigned long long ms;
+			unsigned old;
+
+			old = monitor_window_add(&window, pidt, *total, diff);
+			old_pidt = &window.packets[old * DVB_MPEG_TS_NUM_PIDS];
+			ms = diff - window.ms[old];
+			if (!ms)
+				ms = 1;
+
+			if (args->non_human) {
+				monitor_print_json(stats, pidt, *total,
+						   old_pidt, window.total[old],
+						   ms, diff);
+				get_show_stats(stderr, args, parms, 0);
+				dvb_mpeg_ts_pcr_stats_reset_window(stats->pcr);
+				wait += 1000;
+				continue;
+			}
 
 			if (isatty(STDOUT_FILENO))
 				printf("\x1b[1H\x1b[2J");
 
 			args->n_status_lines = 0;
-			printf(_(" PID           FREQ         SPEED       TOTAL\n"));
-			int _pid = 0;
-			for (_pid = 0; _pid < 0x2000; _pid++) {
-				if (pidt[_pid]) {
-					if (args->low_traffic && (pidt[_pid] * 1000. / diff) < args->low_traffic) {
-						other_pidt += pidt[_pid];
-						other_err_cnt += err_cnt[_pid];
-						continue;
-					}
-					printf("%5d %9.2f p/s %sbps ",
-						_pid,
-						pidt[_pid] * 1000. / diff,
-						print_bytes(pidt[_pid] * 1000. * 8 * 188/ diff));
-					if (pidt[_pid] * 188 / 1024)
-						printf("%8llu KB", (pidt[_pid] * 188 + 512) / 1024);
-					else
-						printf(" %8llu B", pidt[_pid] * 188);
-					if (err_cnt[_pid] > 0)
-						printf(" %8llu continuity errors",
-						       err_cnt[_pid]);
-
-					printf("\n");
-				}
-			}
-			if (other_pidt) {
-				printf(_("OTHER"));
-				printf(" %9.2f p/s %sbps ",
-					other_pidt * 1000. / diff,
-					print_bytes(other_pidt * 1000. * 8 * 188/ diff));
-				if (other_pidt * 188 / 1024)
-					printf("%8llu KB", (other_pidt * 188 + 512) / 1024);
-				else
-					printf(" %8llu B", other_pidt * 188);
-				if (other_err_cnt > 0)
-					printf(" %8llu continuity errors",
-					       other_err_cnt);
-				printf("\n");
-			}
-
-			/* 0x2000 is the total traffic */
-			printf("TOT %11.2f p/s %sbps %8llu KB\n",
-				pidt[_pid] * 1000. / diff,
-				print_bytes(pidt[_pid] * 1000. * 8 * 188/ diff),
-				(pidt[_pid] * 188 + 512) / 1024);
-			printf("\n");
+			monitor_print_table(args, stats, pidt, *total,
+					    old_pidt, window.total[old], ms);
+			dvb_mpeg_ts_pcr_stats_reset_window(stats->pcr);
 			get_show_stats(stdout, args, parms, 0);
 			wait += 1000;
-			if (cont_err)
-				printf("CONTINUITY errors: %llu\n", cont_err);
+			if (stats->total_cc_errors)
+				printf("CONTINUITY errors: %llu\n",
+				       (unsigned long long)stats->total_cc_errors);
 		}
 	}
 	monitor_log(_("%.2fs: Stopping capture\n"));
+
+close_devs:
 	dvb_dev_close(dvr_fd);
 	dvb_dev_close(fd);
-	return 0;
+free_stats:
+	monitor_window_free(&window);
+	free(search_pidt);
+	free(stats->pcr);
+	free(stats);
+	return ret;
 }
 
 static void set_signals(struct arguments *args)
@@ -1031,6 +2359,9 @@ int main(int argc, char **argv)
 	struct dvb_open_descriptor *sdt_fd = NULL;
 	struct dvb_open_descriptor *sid_fd = NULL, *dvr_fd = NULL;
 	struct dvb_open_descriptor *audio_fd = NULL, *video_fd = NULL;
+	struct ts_split *split = NULL;
+	struct ts_index *ts_idx = NULL;
+	struct ts_stream *stream = NULL;
 	int file_fd = -1;
 	int err = -1;
 	int r, ret;
@@ -1041,7 +2372,8 @@ int main(int argc, char **argv)
 		.options = options,
 		.parser = parse_opt,
 		.doc = N_("DVB zap utility"),
-		.args_doc = N_("<channel name> [or <frequency> if in monitor mode]"),
+		.args_doc = N_("<channel name> [or <frequency> if in monitor mode]\n"
+			       "--services <channel name>[=<file>]..."),
 	};
 
 #ifdef ENABLE_NLS
@@ -1055,6 +2387,7 @@ int main(int argc, char **argv)
 	args.input_format = FILE_DVBV5;
 	args.dvr_pipe = default_dvr_pipe;
 	args.low_traffic = 1;
+	args.stream_ttl = 1;
 
 	if (argp_parse(&argp, argc, argv, ARGP_NO_HELP | ARGP_NO_EXIT, &idx, &args)) {
 		argp_help(&argp, stderr, ARGP_HELP_SHORT_USAGE, PROGRAM_NAME);
@@ -1081,6 +2414,28 @@ int main(int argc, char **argv)
 		return -1;
 	}
 
+	if (args.multi_service &&
+	    (args.filename || args.rec_psi || args.all_pids ||
+	     args.traffic_monitor || args.exit_after_tuning)) {
+		ERROR("--services can't be used with -o, -p, -P, -m or -x\n");
+		argp_help(&argp, stderr, ARGP_HELP_STD_HELP, PROGRAM_NAME);
+		return -1;
+	}
+
+	if (args.stream_url &&
+	    (args.filename || args.multi_service || args.traffic_monitor)) {
+		ERROR("--stream can't be used with -o, --services or -m\n");
+		argp_help(&argp, stderr, ARGP_HELP_STD_HELP, PROGRAM_NAME);
+		return -1;
+	}
+
+	if (args.index_fname &&
+	    (!args.filename || args.multi_service || args.traffic_monitor)) {
+		ERROR("--index can be used only when recording to a file with -o\n");
+		argp_help(&argp, stderr, ARGP_HELP_STD_HELP, PROGRAM_NAME);
+		return -1;
+	}
+
 	if (args.lnb_name) {
 		lnb = dvb_sat_search_lnb(args.lnb_name);
 		if (lnb < 0) {
@@ -1160,12 +2515,21 @@ int main(int argc, char **argv)
 	if (r < 0)
 		fprintf(stderr, _("Failed to set the country code:%s\n"), args.cc);
 
-	if (parse(&args, parms, channel, &vpid, &apid, &sid))
+	if (args.multi_service) {
+		split = split_setup(&args, parms, argc - idx, argv + idx);
+		if (!split)
+			goto err;
+	} else if (parse(&args, parms, channel, &vpid, &apid, &sid)) {
 		goto err;
+	}
 
 	if (setup_frontend(&args, parms) < 0)
 		goto err;
 
+	/* Let the daemon push the stats, instead of polling it */
+	if (args.server && args.port)
+		dvb_dev_remote_stats_subscribe(dvb, 250);
+
 	if (args.exit_after_tuning) {
 		set_signals(&args);
 		err = 0;
@@ -1244,7 +2608,8 @@ int main(int argc, char **argv)
 			goto err;
 	}
 
-	if (args.all_pids++) {
+	/* On multi-service mode, the services are demultiplexed here */
+	if (args.all_pids++ || split) {
 		vpid = 0x2000;
 		apid = 0;
 	}
@@ -1329,7 +2694,38 @@ int main(int argc, char **argv)
 		if (args.silent < 2)
 			get_show_stats(stderr, &args, parms, 0);
 
-		if (file_fd >= 0) {
+		if (args.index_fname) {
+			ts_idx = ts_index_open(parms, args.index_fname);
+			if (!ts_idx)
+				goto err;
+		}
+
+		if (args.stream_url) {
+			stream = ts_stream_open(args.stream_url, args.stream_ttl);
+			if (!stream)
+				goto err;
+		}
+
+		if (split) {
+			dvr_fd = dvb_dev_open(dvb, args.dvr_dev, O_RDONLY);
+			if (!dvr_fd) {
+				ERROR("failed opening '%s'", args.dvr_dev);
+				goto err;
+			}
+			if (!timeout_flag)
+				fprintf(stderr, _("Record of %d services started\n"),
+					split->n_services);
+			copy_to_file(dvr_fd, -1, split, NULL, NULL, args.timeout, args.silent);
+		} else if (stream) {
+			dvr_fd = dvb_dev_open(dvb, args.dvr_dev, O_RDONLY);
+			if (!dvr_fd) {
+				ERROR("failed opening '%s'", args.dvr_dev);
+				goto err;
+			}
+			if (!timeout_flag)
+				fprintf(stderr, _("Streaming to '%s' started\n"), args.stream_url);
+			copy_to_file(dvr_fd, -1, NULL, stream, NULL, args.timeout, args.silent);
+		} else if (file_fd >= 0) {
 			dvr_fd = dvb_dev_open(dvb, args.dvr_dev, O_RDONLY);
 			if (!dvr_fd) {
 				ERROR("failed opening '%s'", args.dvr_dev);
@@ -1337,7 +2733,10 @@ int main(int argc, char **argv)
 			}
 			if (!timeout_flag)
 				fprintf(stderr, _("Record to file '%s' started\n"), args.filename);
-			copy_to_file(dvr_fd, file_fd, args.timeout, args.silent);
+			/* The index needs to see the data */
+			if (ts_idx || !args.use_splice ||
+			    splice_to_file(dvr_fd, file_fd, args.timeout, args.silent) < 0)
+				copy_to_file(dvr_fd, file_fd, NULL, NULL, ts_idx, args.timeout, args.silent);
 		} else if (args.server && args.port) {
 			struct stat st;
 			if (stat(args.dvr_pipe, &st) == -1) {
@@ -1376,7 +2775,7 @@ int main(int argc, char **argv)
 				err = -1;
 				goto err;
 			}
-			copy_to_file(dvr_fd, file_fd, args.timeout, args.silent);
+			copy_to_file(dvr_fd, file_fd, NULL, NULL, ts_idx, args.timeout, args.silent);
 		} else {
 			if (!timeout_flag)
 				fprintf(stderr, _("DVR interface '%s' can now be opened\n"), args.dvr_fname);
@@ -1396,6 +2795,12 @@ int main(int argc, char **argv)
 
 err:
 	dvb_dev_free(dvb);
+	if (split)
+		split_free(split);
+	if (ts_idx)
+		ts_index_close(ts_idx, args.silent);
+	if (stream)
+		ts_stream_close(stream, args.silent);
 
 	/*
 	 * Just to make Valgrind happier. It should be noticed
@@ -1410,6 +2815,10 @@ err:
 		free(args.lnb_name);
 	if (args.search)
 		free(args.search);
+	if (args.index_fname)
+		free(args.index_fname);
+	if (args.stream_url)
+		free(args.stream_url);
 	if (args.server)
 		free(args.search);
 	if (args.dvr_pipe != default_dvr_pipe)
@@ -25,12 +25,16 @@
 #include <fcntl.h>
 #include <argp.h>
 #include <sysexits.h>
+#include <signal.h>
+#include <time.h>
+#include <byteswap.h>
 
 #include <config.h>
 
 #include <linux/lirc.h>
 
 #include "ir-encode.h"
+#include "ir-decode.h"
 #include "keymap.h"
 #include "bpf_encoder.h"
 
@@ -58,9 +62,31 @@
 
 /* See drivers/media/rc/lirc_dev.c line 22 */
 #define LIRCBUF_SIZE 1024
+/* lirc_dev.c rejects sending more than 0.5 seconds of IR in one write */
+#define LIRC_MAX_SEND_DURATION 500000
 #define IR_DEFAULT_TIMEOUT 125000
 #define UNSET UINT32_MAX
 
+/*
+ * Binary capture format written by --receive --binary: this header,
+ * followed by the raw LIRC mode2 words as read from the device, in host
+ * byte order. byte_order holds CAPTURE_BYTE_ORDER, so that a capture
+ * made on a machine of the other endianness can still be converted.
+ */
+#define CAPTURE_MAGIC "IRCTLCAP"
+#define CAPTURE_VERSION 1
+#define CAPTURE_BYTE_ORDER 0x01020304
+#define CAPTURE_BUF_SIZE (16 * LIRCBUF_SIZE)
+
+struct capture_header {
+	char magic[8];
+	uint32_t version;
+	uint32_t byte_order;
+	int64_t start_sec;	// CLOCK_REALTIME when receiving started
+	uint32_t start_nsec;
+	uint32_t reserved;
+};
+
 const char *argp_program_version = "IR ctl version " V4L_UTILS_VERSION;
 const char *argp_program_bug_address = "Sean Young <sean@mess.org>";
 
@@ -92,6 +118,9 @@ struct arguments {
 	bool receive;
 	bool verbose;
 	bool mode2;
+	bool binary;
+	bool decode;
+	char *convert;
 	struct keymap *keymap;
 	struct send *send;
 	bool oneshot;
@@ -118,6 +147,9 @@ static const struct argp_option options[] = {
 		{ .doc = N_("Receiving options:") },
 	{ "one-shot",	'1',	0,		0,	N_("end receiving after first message") },
 	{ "mode2",	2,	0,		0,	N_("output in mode2 format") },
+	{ "binary",	3,	0,		0,	N_("save received IR in binary capture format") },
+	{ "convert",	4,	N_("FILE"),	0,	N_("convert binary capture file to text") },
+	{ "decode",	5,	0,		0,	N_("decode received IR to scancodes") },
 	{ "wideband",	'w',	0,		0,	N_("use wideband receiver aka learning mode") },
 	{ "narrowband",	'n',	0,		0,	N_("use narrowband receiver, disable learning mode") },
 	{ "carrier-range", 'R', N_("RANGE"),	0,	N_("set receiver carrier range") },
@@ -139,6 +171,7 @@ static const char args_doc[] = N_(
 	"--send [file to send]\n"
 	"--scancode [scancode to send]\n"
 	"--keycode [keycode to send]\n"
+	"--convert [binary capture file]\n"
 	"[to set lirc option]");
 
 static const char doc[] = N_(
@@ -586,6 +619,17 @@ static error_t parse_opt(int k, char *arg, struct argp_state *state)
 	case 2:
 		arguments->mode2 = true;
 		break;
+	case 3:
+		arguments->binary = true;
+		break;
+	case 4:
+		if (arguments->convert)
+			argp_error(state, _("convert filename already set"));
+		arguments->convert = arg;
+		break;
+	case 5:
+		arguments->decode = true;
+		break;
 	case 'v':
 		arguments->verbose = true;
 		break;
@@ -725,12 +769,23 @@ static error_t parse_opt(int k, char *arg, struct argp_state *state)
 		if (!arguments->work_to_do)
 			argp_usage(state);
 
+		if (arguments->convert &&
+		    (arguments->receive || arguments->send || arguments->features))
+			argp_error(state, _("convert can not be combined with receive, send or features option"));
+		if (arguments->binary && !arguments->receive)
+			argp_error(state, _("binary can only be used with receive option"));
+		if (arguments->binary && arguments->mode2)
+			argp_error(state, _("binary can not be combined with mode2 option"));
+		if (arguments->decode && !arguments->receive && !arguments->convert)
+			argp_error(state, _("decode can only be used with receive or convert option"));
+		if (arguments->decode && (arguments->binary || arguments->mode2))
+			argp_error(state, _("decode can not be combined with binary or mode2 option"));
 		break;
 	default:
 		return ARGP_ERR_UNKNOWN;
 	}
 
-	if (k != '1' && k != 'd' && k != 'v' && k != 'k' && k != 2)
+	if (k != '1' && k != 'd' && k != 'v' && k != 'k' && k != 2 && k != 3 && k != 5)
 		arguments->work_to_do = true;
 
 	return 0;
@@ -1036,6 +1091,55 @@ static void lirc_features(struct arguments *args, int fd, unsigned features)
 	}
 }
 
+static int lirc_transmit(struct arguments *args, int fd, const unsigned *buf, unsigned len)
+{
+	const char *dev = args->device;
+	size_t size = len * sizeof(unsigned);
+	ssize_t ret;
+
+	if (args->verbose) {
+		int i;
+		printf("Sending:");
+		for (i=0; i<len; i++)
+			printf("%s%u", i & 1 ? " -" : " +", buf[i]);
+		putchar('\n');
+	}
+	ret = TEMP_FAILURE_RETRY(write(fd, buf, size));
+	if (ret < 0) {
+		fprintf(stderr, _("%s: failed to send: %m\n"), dev);
+		return EX_IOERR;
+	}
+
+	if (size < ret) {
+		fprintf(stderr, _("warning: %s: sent %zd out %zd edges\n"),
+				dev,
+				ret / sizeof(unsigned),
+				size / sizeof(unsigned));
+		return EX_IOERR;
+	}
+	if (args->verbose)
+		printf("Successfully sent\n");
+
+	return 0;
+}
+
+// Encode a scancode to pulse and space in userspace
+static int encode_send(struct arguments *args, struct send *f)
+{
+	enum rc_proto proto = f->protocol;
+
+	if (!protocol_encoder_available(proto)) {
+		fprintf(stderr, _("%s: no encoder available for `%s'\n"),
+			args->device, protocol_name(proto));
+		return EX_UNAVAILABLE;
+	}
+	f->len = protocol_encode(f->protocol, f->scancode, f->buf);
+	f->carrier = protocol_carrier(proto);
+	f->is_scancode = false;
+
+	return 0;
+}
+
 static int lirc_send(struct arguments *args, int fd, unsigned features, struct send *f)
 {
 	const char *dev = args->device;
@@ -1074,15 +1178,9 @@ static int lirc_send(struct arguments *args, int fd, unsigned features, struct s
 	}
 
 	if (f->is_scancode) {
-		// encode scancode
-		enum rc_proto proto = f->protocol;
-		if (!protocol_encoder_available(proto)) {
-			fprintf(stderr, _("%s: no encoder available for `%s'\n"),
-				dev, protocol_name(proto));
-			return EX_UNAVAILABLE;
-		}
-		f->len = protocol_encode(f->protocol, f->scancode, f->buf);
-		f->carrier = protocol_carrier(proto);
+		rc = encode_send(args, f);
+		if (rc)
+			return rc;
 	}
 
 	if (args->carrier != UNSET) {
@@ -1092,33 +1190,351 @@ static int lirc_send(struct arguments *args, int fd, unsigned features, struct s
 	} else if (f->carrier != UNSET)
 		lirc_set_send_carrier(fd, dev, features, f->carrier);
 
-	size_t size = f->len * sizeof(unsigned);
-	if (args->verbose) {
-		int i;
-		printf("Sending:");
-		for (i=0; i<f->len; i++)
-			printf("%s%u", i & 1 ? " -" : " +", f->buf[i]);
-		putchar('\n');
+	return lirc_transmit(args, fd, f->buf, f->len);
+}
+
+/*
+ * Send everything on the command line. A single file, scancode or key is
+ * sent as before, so the kernel encoder is used for a scancode if there
+ * is one. Otherwise the whole sequence is encoded in userspace up front
+ * and joined into as few writes as lirc allows, with the gaps sent as
+ * spaces; this keeps the timing between messages exact. A new write is
+ * started when the buffer or the maximum duration of a write is reached,
+ * or when the carrier changes, with --gap of sleep in between.
+ */
+static int lirc_send_all(struct arguments *args, int fd, unsigned features)
+{
+	static unsigned buf[LIRCBUF_SIZE];
+	const char *dev = args->device;
+	unsigned len = 0, duration = 0, carrier = UNSET;
+	struct send *s, *next, **p;
+	int i, rc, mode;
+
+	// convert all keycodes first, so nothing is sent if one is missing
+	for (p = &args->send; *p; p = &(*p)->next) {
+		struct send *k;
+
+		if (!(*p)->is_keycode)
+			continue;
+
+		if (!args->keymap) {
+			fprintf(stderr, _("error: no keymap specified\n"));
+			return EX_DATAERR;
+		}
+
+		k = convert_keycode(args->keymap, (*p)->keycode);
+		if (!k)
+			return EX_DATAERR;
+
+		k->next = (*p)->next;
+		free(*p);
+		*p = k;
 	}
-	ret = TEMP_FAILURE_RETRY(write(fd, f->buf, size));
-	if (ret < 0) {
-		fprintf(stderr, _("%s: failed to send: %m\n"), dev);
-		return EX_IOERR;
+
+	if (!args->send->next)
+		return lirc_send(args, fd, features, args->send);
+
+	if (!(features & LIRC_CAN_SEND_PULSE)) {
+		fprintf(stderr, _("%s: device cannot send\n"), dev);
+		return EX_UNAVAILABLE;
 	}
 
-	if (size < ret) {
-		fprintf(stderr, _("warning: %s: sent %zd out %zd edges\n"),
-				dev,
-				ret / sizeof(unsigned),
-				size / sizeof(unsigned));
-		return EX_IOERR;
+	mode = LIRC_MODE_PULSE;
+	if (ioctl(fd, LIRC_SET_SEND_MODE, &mode)) {
+		fprintf(stderr, _("%s: cannot set send mode\n"), dev);
+		return EX_UNAVAILABLE;
+	}
+
+	for (s = args->send; s; s = s->next) {
+		unsigned c, d = 0;
+
+		if (s->is_scancode) {
+			rc = encode_send(args, s);
+			if (rc)
+				return rc;
+		}
+
+		if (args->carrier != UNSET) {
+			if (s->carrier != UNSET)
+				fprintf(stderr, _("warning: carrier specified but overwritten on command line\n"));
+			c = args->carrier;
+		} else {
+			c = s->carrier;
+		}
+
+		for (i = 0; i < s->len; i++)
+			d += s->buf[i];
+
+		if (len && (c != carrier || len + 1 + s->len > LIRCBUF_SIZE ||
+			    duration + args->gap + d > LIRC_MAX_SEND_DURATION)) {
+			rc = lirc_transmit(args, fd, buf, len);
+			if (rc)
+				return rc;
+			usleep(args->gap);
+			len = 0;
+			duration = 0;
+		}
+
+		if (!len && c != carrier) {
+			if (c != UNSET)
+				lirc_set_send_carrier(fd, dev, features, c);
+			carrier = c;
+		}
+
+		if (len) {
+			// the gap is a space, after the trailing pulse
+			if (len % 2)
+				buf[len++] = args->gap;
+			else
+				buf[len - 1] += args->gap;
+			duration += args->gap;
+		}
+
+		memcpy(buf + len, s->buf, s->len * sizeof(unsigned));
+		len += s->len;
+		duration += d;
+	}
+
+	rc = lirc_transmit(args, fd, buf, len);
+
+	for (s = args->send; s; s = next) {
+		next = s->next;
+		free(s);
+	}
+	args->send = NULL;
+
+	return rc;
+}
+
+struct receive_state {
+	bool leading_space;
+	unsigned carrier;
+	struct ir_decoder decoder;
+};
+
+static bool oneshot_done(struct arguments *args, unsigned sample)
+{
+	unsigned val = sample & LIRC_VALUE_MASK;
+	unsigned msg = sample & LIRC_MODE2_MASK;
+
+	return args->oneshot &&
+		(msg == LIRC_MODE2_TIMEOUT ||
+		(msg == LIRC_MODE2_SPACE && val > 19000));
+}
+
+/*
+ * Print one mode2 sample as text. Returns false once the message is
+ * complete in oneshot mode, and the sample should not be printed.
+ */
+static bool print_sample(struct arguments *args, FILE *out,
+			 struct receive_state *st, unsigned sample)
+{
+	unsigned val = sample & LIRC_VALUE_MASK;
+	unsigned msg = sample & LIRC_MODE2_MASK;
+
+	// FIXME: the kernel often send us a space after
+	// the IR receiver comes out of idle mode. This
+	// is meaningless, maybe fix the kernel?
+	if (st->leading_space && msg == LIRC_MODE2_SPACE)
+		return true;
+
+	st->leading_space = false;
+
+	// the decoders need the space which ends the message, so feed it
+	// before checking for the end of a oneshot
+	if (args->decode && msg != LIRC_MODE2_FREQUENCY) {
+		enum rc_proto proto;
+		unsigned scancode;
+
+		if (ir_decode(&st->decoder, msg == LIRC_MODE2_PULSE, val,
+			      &proto, &scancode))
+			fprintf(out, "%s:0x%x\n", protocol_name(proto), scancode);
+		if (msg == LIRC_MODE2_TIMEOUT)
+			st->leading_space = true;
+	}
+
+	if (oneshot_done(args, sample))
+		return false;
+
+	if (args->decode)
+		return true;
+
+	if (args->mode2) {
+		switch (msg) {
+		case LIRC_MODE2_TIMEOUT:
+			fprintf(out, "timeout %u\n", val);
+			st->leading_space = true;
+			break;
+		case LIRC_MODE2_PULSE:
+			fprintf(out, "pulse %u\n", val);
+			break;
+		case LIRC_MODE2_SPACE:
+			fprintf(out, "space %u\n", val);
+			break;
+		case LIRC_MODE2_FREQUENCY:
+			fprintf(out, "carrier %u\n", val);
+			break;
+		}
+	} else {
+		switch (msg) {
+		case LIRC_MODE2_TIMEOUT:
+			if (st->carrier)
+				fprintf(out, "# carrier %uHz, timeout %u\n", st->carrier, val);
+			else
+				fprintf(out, "# timeout %u\n", val);
+			st->leading_space = true;
+			st->carrier = 0;
+			break;
+		case LIRC_MODE2_PULSE:
+			fprintf(out, "+%u ", val);
+			break;
+		case LIRC_MODE2_SPACE:
+			fprintf(out, "-%u ", val);
+			break;
+		case LIRC_MODE2_FREQUENCY:
+			st->carrier = val;
+			break;
+		}
+	}
+
+	return true;
+}
+
+static volatile sig_atomic_t stop_receiving;
+
+static void stop_handler(int signal)
+{
+	stop_receiving = 1;
+}
+
+static int write_all(int fd, const void *buf, size_t size)
+{
+	const char *p = buf;
+
+	while (size) {
+		ssize_t ret = write(fd, p, size);
+
+		if (ret < 0) {
+			if (errno == EINTR)
+				continue;
+			return -1;
+		}
+		p += ret;
+		size -= ret;
 	}
-	if (args->verbose)
-		printf("Successfully sent\n");
 
 	return 0;
 }
 
+/*
+ * Save the raw mode2 words without any formatting, so that nothing is
+ * lost because of slow output. The words are collected in a large buffer
+ * which is written out when it is full, at the end of each message and
+ * when receiving is stopped by a signal.
+ */
+static int lirc_receive_binary(struct arguments *args, int fd)
+{
+	static unsigned buf[CAPTURE_BUF_SIZE];
+	struct capture_header hdr = {};
+	struct sigaction sa = {};
+	char *dev = args->device;
+	char *outname = args->savetofile ? args->savetofile : _("standard output");
+	bool keep_reading = true;
+	bool leading_space = true;
+	struct timespec ts;
+	unsigned used = 0;
+	int out = STDOUT_FILENO;
+	int rc = EX_IOERR;
+
+	if (args->savetofile) {
+		out = open(args->savetofile, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+		if (out < 0) {
+			fprintf(stderr, _("%s: failed to open for writing: %m\n"), args->savetofile);
+			return EX_CANTCREAT;
+		}
+	}
+
+	// no SA_RESTART, so that a blocking read is interrupted
+	sa.sa_handler = stop_handler;
+	sigaction(SIGINT, &sa, NULL);
+	sigaction(SIGTERM, &sa, NULL);
+
+	clock_gettime(CLOCK_REALTIME, &ts);
+	memcpy(hdr.magic, CAPTURE_MAGIC, sizeof(hdr.magic));
+	hdr.version = CAPTURE_VERSION;
+	hdr.byte_order = CAPTURE_BYTE_ORDER;
+	hdr.start_sec = ts.tv_sec;
+	hdr.start_nsec = ts.tv_nsec;
+
+	if (write_all(out, &hdr, sizeof(hdr))) {
+		fprintf(stderr, _("%s: failed to write: %m\n"), outname);
+		goto err;
+	}
+
+	while (keep_reading && !stop_receiving) {
+		bool flush = false;
+		unsigned i, n;
+		ssize_t ret;
+
+		ret = read(fd, buf + used, LIRCBUF_SIZE * sizeof(unsigned));
+		if (ret < 0) {
+			if (errno == EINTR)
+				continue;
+			fprintf(stderr, _("%s: failed read: %m\n"), dev);
+			goto err;
+		}
+
+		if (ret == 0 || ret % sizeof(unsigned)) {
+			fprintf(stderr, _("%s: read returned %zd bytes\n"),
+								dev, ret);
+			goto err;
+		}
+
+		n = ret / sizeof(unsigned);
+		for (i = 0; i < n; i++) {
+			unsigned sample = buf[used + i];
+			unsigned msg = sample & LIRC_MODE2_MASK;
+
+			// leading spaces are saved, but do not end a
+			// message; see print_sample()
+			if (leading_space && msg == LIRC_MODE2_SPACE)
+				continue;
+
+			leading_space = false;
+			if (oneshot_done(args, sample)) {
+				keep_reading = false;
+				break;
+			}
+			if (msg == LIRC_MODE2_TIMEOUT) {
+				leading_space = true;
+				flush = true;
+			}
+		}
+		used += i;
+
+		if (flush || !keep_reading ||
+		    used > CAPTURE_BUF_SIZE - LIRCBUF_SIZE) {
+			if (write_all(out, buf, used * sizeof(unsigned))) {
+				fprintf(stderr, _("%s: failed to write: %m\n"), outname);
+				goto err;
+			}
+			used = 0;
+		}
+	}
+
+	if (write_all(out, buf, used * sizeof(unsigned))) {
+		fprintf(stderr, _("%s: failed to write: %m\n"), outname);
+		goto err;
+	}
+
+	rc = 0;
+err:
+	if (args->savetofile)
+		close(out);
+
+	return rc;
+}
+
 int lirc_receive(struct arguments *args, int fd, unsigned features)
 {
 	char *dev = args->device;
@@ -1137,6 +1553,9 @@ int lirc_receive(struct arguments *args, int fd, unsigned features)
 		return EX_IOERR;
 	}
 
+	if (args->binary)
+		return lirc_receive_binary(args, fd);
+
 	if (args->savetofile) {
 		out = fopen(args->savetofile, "w");
 		if (!out) {
@@ -1147,8 +1566,9 @@ int lirc_receive(struct arguments *args, int fd, unsigned features)
 	unsigned buf[LIRCBUF_SIZE];
 
 	bool keep_reading = true;
-	bool leading_space = true;
-	unsigned carrier = 0;
+	struct receive_state st = { .leading_space = true };
+
+	ir_decoder_init(&st.decoder);
 
 	while (keep_reading) {
 		ssize_t ret = TEMP_FAILURE_RETRY(read(fd, buf, sizeof(buf)));
@@ -1164,61 +1584,11 @@ int lirc_receive(struct arguments *args, int fd, unsigned features)
 		}
 
 		for (int i=0; i<ret / sizeof(unsigned); i++) {
-			unsigned val = buf[i] & LIRC_VALUE_MASK;
-			unsigned msg = buf[i] & LIRC_MODE2_MASK;
-
-			// FIXME: the kernel often send us a space after
-			// the IR receiver comes out of idle mode. This
-			// is meaningless, maybe fix the kernel?
-			if (leading_space && msg == LIRC_MODE2_SPACE)
-				continue;
-
-			leading_space = false;
-			if (args->oneshot &&
-				(msg == LIRC_MODE2_TIMEOUT ||
-				(msg == LIRC_MODE2_SPACE && val > 19000))) {
+			if (!print_sample(args, out, &st, buf[i])) {
 				keep_reading = false;
 				break;
 			}
 
-			if (args->mode2) {
-				switch (msg) {
-				case LIRC_MODE2_TIMEOUT:
-					fprintf(out, "timeout %u\n", val);
-					leading_space = true;
-					break;
-				case LIRC_MODE2_PULSE:
-					fprintf(out, "pulse %u\n", val);
-					break;
-				case LIRC_MODE2_SPACE:
-					fprintf(out, "space %u\n", val);
-					break;
-				case LIRC_MODE2_FREQUENCY:
-					fprintf(out, "carrier %u\n", val);
-					break;
-				}
-			} else {
-				switch (msg) {
-				case LIRC_MODE2_TIMEOUT:
-					if (carrier)
-						fprintf(out, "# carrier %uHz, timeout %u\n", carrier, val);
-					else
-						fprintf(out, "# timeout %u\n", val);
-					leading_space = true;
-					carrier = 0;
-					break;
-				case LIRC_MODE2_PULSE:
-					fprintf(out, "+%u ", val);
-					break;
-				case LIRC_MODE2_SPACE:
-					fprintf(out, "-%u ", val);
-					break;
-				case LIRC_MODE2_FREQUENCY:
-					carrier = val;
-					break;
-				}
-			}
-
 			fflush(out);
 		}
 	}
@@ -1231,6 +1601,80 @@ err:
 	return rc;
 }
 
+// Print a capture made with --receive --binary in the text format
+static int convert_capture(struct arguments *args)
+{
+	static unsigned buf[CAPTURE_BUF_SIZE];
+	struct receive_state st = { .leading_space = true };
+	struct capture_header hdr;
+	char date[64];
+	struct tm tm;
+	time_t t;
+	bool swap;
+	size_t i, n;
+	FILE *in;
+	int rc = EX_DATAERR;
+
+	ir_decoder_init(&st.decoder);
+
+	in = fopen(args->convert, "r");
+	if (!in) {
+		fprintf(stderr, _("%s: failed to open: %m\n"), args->convert);
+		return EX_NOINPUT;
+	}
+
+	if (fread(&hdr, sizeof(hdr), 1, in) != 1 ||
+	    memcmp(hdr.magic, CAPTURE_MAGIC, sizeof(hdr.magic))) {
+		fprintf(stderr, _("%s: not a binary capture file\n"), args->convert);
+		goto out;
+	}
+
+	swap = hdr.byte_order == bswap_32(CAPTURE_BYTE_ORDER);
+	if (swap) {
+		hdr.version = bswap_32(hdr.version);
+		hdr.start_sec = bswap_64(hdr.start_sec);
+		hdr.start_nsec = bswap_32(hdr.start_nsec);
+	} else if (hdr.byte_order != CAPTURE_BYTE_ORDER) {
+		fprintf(stderr, _("%s: not a binary capture file\n"), args->convert);
+		goto out;
+	}
+
+	if (hdr.version != CAPTURE_VERSION) {
+		fprintf(stderr, _("%s: unsupported capture version %u\n"),
+			args->convert, hdr.version);
+		goto out;
+	}
+
+	t = hdr.start_sec;
+	localtime_r(&t, &tm);
+	strftime(date, sizeof(date), "%F %T", &tm);
+	printf("# capture started %s.%06u\n", date, hdr.start_nsec / 1000);
+
+	while ((n = fread(buf, sizeof(unsigned), CAPTURE_BUF_SIZE, in)) > 0) {
+		for (i = 0; i < n; i++) {
+			unsigned sample = swap ? bswap_32(buf[i]) : buf[i];
+
+			if (!print_sample(args, stdout, &st, sample))
+				goto done;
+		}
+	}
+
+	if (ferror(in)) {
+		fprintf(stderr, _("%s: failed read: %m\n"), args->convert);
+		rc = EX_IOERR;
+		goto out;
+	}
+
+done:
+	// terminate a message which did not end with a timeout
+	if (!args->mode2 && !st.leading_space)
+		printf("\n");
+	rc = 0;
+out:
+	fclose(in);
+	return rc;
+}
+
 int main(int argc, char *argv[])
 {
 	struct arguments args = {
@@ -1247,6 +1691,9 @@ int main(int argc, char *argv[])
 
 	argp_parse(&argp, argc, argv, 0, 0, &args);
 
+	if (args.convert)
+		return convert_capture(&args);
+
 	if (args.device == NULL)
 		args.device = "/dev/lirc0";
 
@@ -1261,36 +1708,12 @@ int main(int argc, char *argv[])
 	if (rc)
 		exit(EX_IOERR);
 
-	struct send *s = args.send;
-	while (s) {
-		struct send *next = s->next;
-		if (s != args.send)
-			usleep(args.gap);
-
-		if (s->is_keycode) {
-			struct send *k;
-
-			if (!args.keymap) {
-				fprintf(stderr, _("error: no keymap specified\n"));
-				exit(EX_DATAERR);
-			}
-
-			k = convert_keycode(args.keymap, s->keycode);
-			if (!k)
-				exit(EX_DATAERR);
-
-			free(s);
-			s = k;
-		}
-
-		rc = lirc_send(&args, fd, features, s);
+	if (args.send) {
+		rc = lirc_send_all(&args, fd, features);
 		if (rc) {
 			close(fd);
 			exit(rc);
 		}
-
-		free(s);
-		s = next;
 	}
 
 	if (args.receive) {
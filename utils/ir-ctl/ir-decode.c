@@ -0,0 +1 @@
+../common/ir-decode.c
\ No newline at end of file
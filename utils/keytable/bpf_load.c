@@ -11,9 +11,11 @@
 #include <stdbool.h>
 #include <limits.h>
 #include <stdlib.h>
+#include <stdint.h>
 #include <linux/bpf.h>
 #include <assert.h>
 #include <argp.h>
+#include <libgen.h>
 #include "keymap.h"
 #include "bpf.h"
 #include "bpf_load.h"
@@ -42,11 +44,10 @@ int trail_space;
 char bpf_log_buf[BPF_LOG_BUF_SIZE];
 extern int debug;
 
+// ELF parsing state, only used while parsing
 struct bpf_file {
 	Elf *elf;
-	char license[128];
 	bool processed_sec[128];
-	int map_fd[MAX_MAPS];
 	struct bpf_map_data map_data[MAX_MAPS];
 	int nr_maps;
 	int maps_shidx;
@@ -55,16 +56,39 @@ struct bpf_file {
 	Elf_Data *data;
 	int strtabidx;
 	Elf_Data *symbols;
-	struct protocol_param *param;
 };
 
-static int load_and_attach(int lirc_fd, struct bpf_file *bpf_file, const char *name, struct bpf_insn *prog, int size)
+// A relocation of a BPF_LD_IMM64 insn against a map or a variable
+struct bpf_reloc {
+	unsigned int insn_idx;
+	int map_idx;		// -1 if this is a .data or .bss variable
+	char *sym_name;
+	bool in_data;		// variable in .data, default_value is valid
+	int default_value;
+};
+
+// The result of parsing an ELF file, which can be loaded many times
+struct bpf_object {
+	struct bpf_object *next;
+	char *path;
+	char license[128];
+	char *prog_name;
+	struct bpf_insn *insns;
+	size_t insns_cnt;
+	struct bpf_map_data map_data[MAX_MAPS];
+	int nr_maps;
+	struct bpf_reloc *relocs;
+	int nr_relocs;
+};
+
+static struct bpf_object *bpf_objects;
+
+static int load_and_attach(int lirc_fd, struct bpf_object *obj, struct bpf_insn *prog)
 {
-        size_t insns_cnt = size / sizeof(struct bpf_insn);
 	int fd, err;
 
-	fd = bpf_load_program(BPF_PROG_TYPE_LIRC_MODE2, prog, insns_cnt,
-			      name, bpf_file->license, 0,
+	fd = bpf_load_program(BPF_PROG_TYPE_LIRC_MODE2, prog, obj->insns_cnt,
+			      obj->prog_name, obj->license, 0,
 			      bpf_log_buf, BPF_LOG_BUF_SIZE);
 	if (fd < 0) {
 		printf("bpf_load_program() err=%m\n%s", bpf_log_buf);
@@ -72,6 +96,7 @@ static int load_and_attach(int lirc_fd, struct bpf_file *bpf_file, const char *n
 	}
 
 	err = bpf_prog_attach(fd, lirc_fd, BPF_LIRC_MODE2, 0);
+	close(fd);
 	if (err) {
 		printf("bpf_prog_attach: err=%m\n");
 		return -1;
@@ -84,6 +109,9 @@ static int build_raw_map(struct bpf_map_data *map, struct raw_entry *raw, int nu
 	int no_patterns, value_size, fd, key, i;
 	struct raw_entry *e;
 	struct raw_pattern *p;
+	unsigned char *values;
+	int *keys;
+	__u32 count;
 
 	no_patterns = 0;
 
@@ -113,15 +141,19 @@ static int build_raw_map(struct bpf_map_data *map, struct raw_entry *raw, int nu
 		return -1;
 	}
 
-	p = malloc(value_size);
-	if (!p) {
+	keys = calloc(no_patterns + 1, sizeof(*keys));
+	values = calloc(no_patterns + 1, value_size);
+	if (!keys || !values) {
 		printf(_("Failed to allocate memory"));
+		free(keys);
+		free(values);
 		return -1;
 	}
 
 	key = 0;
 
 	for (e = raw; e; e = e->next) {
+		p = (struct raw_pattern *)(values + key * value_size);
 		p->scancode = e->scancode;
 		for (i = 0; i < e->raw_length; i++) {
 			p->raw[i] = e->raw[i];
@@ -129,20 +161,34 @@ static int build_raw_map(struct bpf_map_data *map, struct raw_entry *raw, int nu
 				trail_space = e->raw[i];
 		}
 
-		// Add trailing space and clear rest of the struct
-		while (i < max_length)
-			p->raw[i++] = 0;
+		// The rest of the pattern is already zeroed by calloc,
+		// which adds the trailing 0
+		keys[key] = key;
+		key++;
+	}
 
-		if (bpf_map_update_elem(fd, &key, p, BPF_ANY)) {
-			printf(_("failed to update raw map: %d %s\n"),
-			       errno, strerror(errno));
-			free(p);
-			return -1;
+	// Fill the whole map with a single syscall where possible. Kernels
+	// before 5.6 do not know BPF_MAP_UPDATE_BATCH, so fall back to
+	// updating one element at a time. The batch may have been applied
+	// partially, so start over from the first element; BPF_ANY makes
+	// this harmless.
+	count = no_patterns;
+	if (no_patterns &&
+	    bpf_map_update_batch(fd, keys, values, &count, BPF_ANY, 0)) {
+		for (key = 0; key < no_patterns; key++) {
+			if (bpf_map_update_elem(fd, &key,
+						values + key * value_size,
+						BPF_ANY)) {
+				printf(_("failed to update raw map: %d %s\n"),
+				       errno, strerror(errno));
+				free(keys);
+				free(values);
+				return -1;
+			}
 		}
-
-		key++;
 	}
-	free(p);
+	free(keys);
+	free(values);
 
 	// 1ms extra for trailing space. This also ensure that the
 	// trail_space is larger than largest space + margin in the
@@ -152,20 +198,20 @@ static int build_raw_map(struct bpf_map_data *map, struct raw_entry *raw, int nu
 	return fd;
 }
 
-static int load_maps(struct bpf_file *bpf_file, struct raw_entry *raw)
+static int load_maps(struct bpf_object *obj, int *map_fd, struct raw_entry *raw)
 {
-	struct bpf_map_data *maps = bpf_file->map_data;
+	struct bpf_map_data *maps = obj->map_data;
 	int i, numa_node;
 
-	for (i = 0; i < bpf_file->nr_maps; i++) {
+	for (i = 0; i < obj->nr_maps; i++) {
 		numa_node = maps[i].def.map_flags & BPF_F_NUMA_NODE ?
 			maps[i].def.numa_node : -1;
 
 		if (maps[i].def.type == BPF_MAP_TYPE_ARRAY_OF_MAPS ||
 		    maps[i].def.type == BPF_MAP_TYPE_HASH_OF_MAPS) {
-			int inner_map_fd = bpf_file->map_fd[maps[i].def.inner_map_idx];
+			int inner_map_fd = map_fd[maps[i].def.inner_map_idx];
 
-			bpf_file->map_fd[i] = bpf_create_map_in_map_node(
+			map_fd[i] = bpf_create_map_in_map_node(
 							maps[i].def.type,
 							maps[i].name,
 							maps[i].def.key_size,
@@ -174,9 +220,9 @@ static int load_maps(struct bpf_file *bpf_file, struct raw_entry *raw)
 							maps[i].def.map_flags,
 							numa_node);
 		} else if (!strcmp(maps[i].name, "raw_map")) {
-			bpf_file->map_fd[i] = build_raw_map(&maps[i], raw, numa_node);
+			map_fd[i] = build_raw_map(&maps[i], raw, numa_node);
 		} else {
-			bpf_file->map_fd[i] = bpf_create_map_node(
+			map_fd[i] = bpf_create_map_node(
 							maps[i].def.type,
 							maps[i].name,
 							maps[i].def.key_size,
@@ -186,12 +232,11 @@ static int load_maps(struct bpf_file *bpf_file, struct raw_entry *raw)
 							numa_node);
 		}
 
-		if (bpf_file->map_fd[i] < 0) {
+		if (map_fd[i] < 0) {
 			printf(_("failed to create a map: %d %s\n"),
 			       errno, strerror(errno));
 			return 1;
 		}
-		maps[i].fd = bpf_file->map_fd[i];
 	}
 	return 0;
 }
@@ -219,14 +264,20 @@ static int get_sec(Elf *elf, int i, GElf_Ehdr *ehdr, char **shname,
 	return 0;
 }
 
-static int parse_relo_and_apply(struct bpf_file *bpf_file, GElf_Shdr *shdr,
-				struct bpf_insn *insn, Elf_Data *data)
+static int parse_relo(struct bpf_file *bpf_file, struct bpf_object *obj,
+		      GElf_Shdr *shdr, struct bpf_insn *insn, Elf_Data *data)
 {
 	int i, nrels;
+	struct bpf_reloc *relocs;
 
 	nrels = shdr->sh_size / shdr->sh_entsize;
+	relocs = realloc(obj->relocs, (obj->nr_relocs + nrels) * sizeof(*relocs));
+	if (!relocs)
+		return 1;
+	obj->relocs = relocs;
 
 	for (i = 0; i < nrels; i++) {
+		struct bpf_reloc *r = &obj->relocs[obj->nr_relocs];
 		GElf_Sym sym;
 		GElf_Rel rel;
 		unsigned int insn_idx;
@@ -248,6 +299,10 @@ static int parse_relo_and_apply(struct bpf_file *bpf_file, GElf_Shdr *shdr,
 			return 1;
 		}
 
+		memset(r, 0, sizeof(*r));
+		r->insn_idx = insn_idx;
+		r->map_idx = -1;
+
 		if (sym.st_shndx == bpf_file->maps_shidx) {
 			/* Match FD relocation against recorded map_data[] offset */
 			for (map_idx = 0; map_idx < bpf_file->nr_maps; map_idx++) {
@@ -258,8 +313,8 @@ static int parse_relo_and_apply(struct bpf_file *bpf_file, GElf_Shdr *shdr,
 			}
 
 			if (match) {
-		                insn[insn_idx].src_reg = BPF_PSEUDO_MAP_FD;
-				insn[insn_idx].imm = bpf_file->map_data[map_idx].fd;
+				r->map_idx = map_idx;
+				obj->nr_relocs++;
 				continue;
 			}
 
@@ -268,33 +323,14 @@ static int parse_relo_and_apply(struct bpf_file *bpf_file, GElf_Shdr *shdr,
 			return 1;
 		}
 		if (sym.st_shndx == bpf_file->dataidx || sym.st_shndx == bpf_file->bssidx) {
-			const char *raw = NULL;
-			int value = 0;
-
-			if (!bpf_param(bpf_file->param, sym_name, &value)) {
-				if (value < INT_MIN && value > UINT_MAX) {
-					printf(_("variable %s out of range: %s\n"), sym_name, raw);
-					return 1;
-				}
-			} else if (sym.st_shndx == bpf_file->dataidx) {
-				// Value is not overridden on command line
-				// or toml file. For the raw decoder, the
-				// max_length and trail_space needs to be
-				// patched in. Otherwise use value set in
-				// bpf object file from data section.
-				if (!strcmp(sym_name, "max_length") && max_length)
-					value = max_length;
-				else if (!strcmp(sym_name, "trail_space") && trail_space)
-					value = trail_space;
-				else
-					value = *(int*)((unsigned char*)bpf_file->data->d_buf + sym.st_value);
+			r->sym_name = strdup(sym_name);
+			if (!r->sym_name)
+				return 1;
+			if (sym.st_shndx == bpf_file->dataidx) {
+				r->in_data = true;
+				r->default_value = *(int*)((unsigned char*)bpf_file->data->d_buf + sym.st_value);
 			}
-
-			if (debug)
-				printf(_("patching insn[%d] with immediate %d for symbol %s\n"), insn_idx, value, sym_name);
-
-			// patch ld to mov immediate
-			insn[insn_idx].imm = value;
+			obj->nr_relocs++;
 		} else {
 			printf(_("symbol %s has unknown section %d\n"), sym_name, sym.st_shndx);
 			return 1;
@@ -304,6 +340,45 @@ static int parse_relo_and_apply(struct bpf_file *bpf_file, GElf_Shdr *shdr,
 	return 0;
 }
 
+static void apply_relo(struct bpf_object *obj, struct bpf_insn *insn,
+		       const int *map_fd, struct protocol_param *param)
+{
+	int i;
+
+	for (i = 0; i < obj->nr_relocs; i++) {
+		const struct bpf_reloc *r = &obj->relocs[i];
+		int value = 0;
+
+		if (r->map_idx >= 0) {
+			insn[r->insn_idx].src_reg = BPF_PSEUDO_MAP_FD;
+			insn[r->insn_idx].imm = map_fd[r->map_idx];
+			continue;
+		}
+
+		if (!bpf_param(param, r->sym_name, &value)) {
+			// Overridden on command line or toml file
+		} else if (r->in_data) {
+			// Value is not overridden on command line
+			// or toml file. For the raw decoder, the
+			// max_length and trail_space needs to be
+			// patched in. Otherwise use value set in
+			// bpf object file from data section.
+			if (!strcmp(r->sym_name, "max_length") && max_length)
+				value = max_length;
+			else if (!strcmp(r->sym_name, "trail_space") && trail_space)
+				value = trail_space;
+			else
+				value = r->default_value;
+		}
+
+		if (debug)
+			printf(_("patching insn[%d] with immediate %d for symbol %s\n"), r->insn_idx, value, r->sym_name);
+
+		// patch ld to mov immediate
+		insn[r->insn_idx].imm = value;
+	}
+}
+
 static int cmp_symbols(const void *l, const void *r)
 {
 	const GElf_Sym *lsym = (const GElf_Sym *)l;
@@ -424,32 +499,52 @@ static int load_elf_maps_section(struct bpf_file *bpf_file)
 	return nr_maps;
 }
 
-int load_bpf_file(const char *path, int lirc_fd, struct protocol_param *param,
-	          struct raw_entry *raw)
+static void free_bpf_object(struct bpf_object *obj)
 {
-	struct bpf_file bpf_file = { .param = param };
-	int fd, i, ret;
+	int i;
+
+	for (i = 0; i < obj->nr_relocs; i++)
+		free(obj->relocs[i].sym_name);
+	for (i = 0; i < obj->nr_maps; i++)
+		free(obj->map_data[i].name);
+	free(obj->relocs);
+	free(obj->insns);
+	free(obj->prog_name);
+	free(obj->path);
+	free(obj);
+}
+
+static struct bpf_object *parse_bpf_file(const char *path)
+{
+	struct bpf_file bpf_file = {};
+	struct bpf_object *obj;
+	int fd, i, prog_idx = 0;
 	Elf *elf;
 	GElf_Ehdr ehdr;
 	GElf_Shdr shdr, shdr_prog;
-	Elf_Data *data, *data_prog, *data_map = NULL;
-	char *shname, *shname_prog;
-	int nr_maps = 0;
+	Elf_Data *data, *data_prog = NULL, *data_map = NULL;
+	char *shname, *shname_prog = NULL;
 
 	if (elf_version(EV_CURRENT) == EV_NONE)
-		return 1;
+		return NULL;
 
 	fd = open(path, O_RDONLY, 0);
 	if (fd < 0)
-		return 1;
+		return NULL;
 
 	elf = elf_begin(fd, ELF_C_READ, NULL);
 
-	if (!elf)
-		return 1;
+	if (!elf) {
+		close(fd);
+		return NULL;
+	}
+
+	obj = calloc(1, sizeof(*obj));
+	if (!obj)
+		goto err;
 
 	if (gelf_getehdr(elf, &ehdr) != &ehdr)
-		return 1;
+		goto err;
 
 	bpf_file.elf = elf;
 
@@ -466,14 +561,10 @@ int load_bpf_file(const char *path, int lirc_fd, struct protocol_param *param,
 
 		if (strcmp(shname, "license") == 0) {
 			bpf_file.processed_sec[i] = true;
-			memcpy(bpf_file.license, data->d_buf, data->d_size);
+			memcpy(obj->license, data->d_buf, data->d_size);
 		} else if (strcmp(shname, "maps") == 0) {
-			int j;
-
 			bpf_file.maps_shidx = i;
 			data_map = data;
-			for (j = 0; j < MAX_MAPS; j++)
-				bpf_file.map_data[j].fd = -1;
 		} else if (strcmp(shname, ".data") == 0) {
 			bpf_file.dataidx = i;
 			bpf_file.data = data;
@@ -485,58 +576,41 @@ int load_bpf_file(const char *path, int lirc_fd, struct protocol_param *param,
 		}
 	}
 
-	ret = 1;
-
 	if (!bpf_file.symbols) {
 		printf(_("missing SHT_SYMTAB section\n"));
-		goto done;
+		goto err;
 	}
 
-	max_length = 0;
-	trail_space = 0;
-
 	if (data_map) {
 		bpf_file.nr_maps = load_elf_maps_section(&bpf_file);
 		if (bpf_file.nr_maps < 0) {
 			printf(_("Error: Failed loading ELF maps (errno:%d):%s\n"),
-			       nr_maps, strerror(-nr_maps));
-			goto done;
+			       bpf_file.nr_maps, strerror(-bpf_file.nr_maps));
+			goto err;
 		}
-		if (load_maps(&bpf_file, raw))
-			goto done;
 
 		bpf_file.processed_sec[bpf_file.maps_shidx] = true;
 	}
 
-	/* process all relo sections, and rewrite bpf insns for maps */
+	/* the first program is the one that is loaded */
 	for (i = 1; i < ehdr.e_shnum; i++) {
 		if (bpf_file.processed_sec[i])
 			continue;
 
-		if (get_sec(elf, i, &ehdr, &shname, &shdr, &data))
+		if (get_sec(elf, i, &ehdr, &shname_prog, &shdr_prog, &data_prog))
 			continue;
 
-		if (shdr.sh_type == SHT_REL) {
-			struct bpf_insn *insns;
-
-			/* locate prog sec that need map fixup (relocations) */
-			if (get_sec(elf, shdr.sh_info, &ehdr, &shname_prog,
-				    &shdr_prog, &data_prog))
-				continue;
-
-			if (shdr_prog.sh_type != SHT_PROGBITS ||
-			    !(shdr_prog.sh_flags & SHF_EXECINSTR))
-				continue;
-
-			insns = (struct bpf_insn *) data_prog->d_buf;
-			bpf_file.processed_sec[i] = true; /* relo section */
-
-			if (parse_relo_and_apply(&bpf_file, &shdr, insns, data))
-				continue;
+		if (shdr_prog.sh_type == SHT_PROGBITS &&
+		    (shdr_prog.sh_flags & SHF_EXECINSTR)) {
+			prog_idx = i;
+			break;
 		}
 	}
 
-	/* load programs */
+	if (!prog_idx)
+		goto err;
+
+	/* process the relo sections of the program, to patch in maps and variables */
 	for (i = 1; i < ehdr.e_shnum; i++) {
 		if (bpf_file.processed_sec[i])
 			continue;
@@ -544,16 +618,376 @@ int load_bpf_file(const char *path, int lirc_fd, struct protocol_param *param,
 		if (get_sec(elf, i, &ehdr, &shname, &shdr, &data))
 			continue;
 
-		if (shdr.sh_type != SHT_PROGBITS ||
-		    !(shdr.sh_flags & SHF_EXECINSTR))
-			continue;
+		if (shdr.sh_type == SHT_REL && (int)shdr.sh_info == prog_idx)
+			parse_relo(&bpf_file, obj, &shdr,
+				   (struct bpf_insn *)data_prog->d_buf, data);
+	}
 
-		ret = load_and_attach(lirc_fd, &bpf_file, shname, data->d_buf,
-				      data->d_size);
-		break;
+	obj->path = strdup(path);
+	obj->prog_name = strdup(shname_prog);
+	obj->insns_cnt = data_prog->d_size / sizeof(struct bpf_insn);
+	obj->insns = malloc(obj->insns_cnt * sizeof(struct bpf_insn));
+	if (!obj->path || !obj->prog_name || !obj->insns)
+		goto err;
+	memcpy(obj->insns, data_prog->d_buf, obj->insns_cnt * sizeof(struct bpf_insn));
+	obj->nr_maps = bpf_file.nr_maps;
+	memcpy(obj->map_data, bpf_file.map_data, sizeof(obj->map_data));
+
+	elf_end(elf);
+	close(fd);
+	return obj;
+
+err:
+	if (obj) {
+		// The map names are not owned by obj yet
+		for (i = 0; i < bpf_file.nr_maps; i++)
+			free(bpf_file.map_data[i].name);
+		free_bpf_object(obj);
 	}
+	elf_end(elf);
+	close(fd);
+	return NULL;
+}
 
-done:
+/*
+ * The parsed object is cached on disk, so that loading a decoder at boot
+ * does not have to go through libelf every time. A cache file holds one
+ * object and is only valid for a source file of the same path, size and
+ * mtime. Integers are in host byte order; the cache is not meant to be
+ * shared between machines.
+ */
+#define BPF_CACHE_MAGIC "IRBPFOBJ"
+#define BPF_CACHE_VERSION 1
+
+struct bpf_cache_header {
+	char magic[8];
+	uint32_t version;
+	uint32_t insns_cnt;
+	uint64_t src_size;
+	uint64_t src_mtime_ns;
+	uint32_t nr_maps;
+	uint32_t nr_relocs;
+	uint32_t path_len;
+	uint32_t prog_name_len;
+	char license[128];
+};
+
+struct bpf_cache_map {
+	struct bpf_load_map_def def;
+	uint32_t name_len;
+	uint64_t elf_offset;
+};
+
+struct bpf_cache_reloc {
+	uint32_t insn_idx;
+	int32_t map_idx;
+	int32_t default_value;
+	uint32_t in_data;
+	uint32_t sym_name_len;
+};
+
+static char *bpf_cache_name(const char *path)
+{
+	char *cpath, *name;
+	uint32_t hash = 2166136261u;
+	const char *p;
+
+	// The basename keeps the cache readable, the hash of the full path
+	// keeps decoders of the same name from different directories apart
+	for (p = path; *p; p++)
+		hash = (hash ^ (unsigned char)*p) * 16777619u;
+
+	cpath = strdup(path);
+	if (!cpath)
+		return NULL;
+	if (asprintf(&name, "%s/%s-%08x.cache", IR_KEYTABLE_CACHE_DIR,
+		     basename(cpath), hash) < 0)
+		name = NULL;
+	free(cpath);
+	return name;
+}
+
+// Bounds checked reader over the cache file contents
+struct bpf_cache_buf {
+	const char *p;
+	size_t left;
+};
+
+static const void *cache_get(struct bpf_cache_buf *b, size_t size)
+{
+	const void *p = b->p;
+
+	if (size > b->left)
+		return NULL;
+	b->p += size;
+	b->left -= size;
+	return p;
+}
+
+static char *cache_get_str(struct bpf_cache_buf *b, uint32_t len)
+{
+	const char *s = cache_get(b, len);
+
+	if (!s)
+		return NULL;
+	return strndup(s, len);
+}
+
+static struct bpf_object *read_bpf_cache(const char *path, const struct stat *st)
+{
+	const struct bpf_cache_header *hdr;
+	struct bpf_object *obj = NULL;
+	struct bpf_cache_buf b;
+	struct stat cst;
+	char *name, *buf = NULL;
+	const void *insns;
+	int fd, i;
+
+	name = bpf_cache_name(path);
+	if (!name)
+		return NULL;
+	fd = open(name, O_RDONLY | O_CLOEXEC);
+	free(name);
+	if (fd < 0)
+		return NULL;
+
+	if (fstat(fd, &cst) || cst.st_size < (off_t)sizeof(*hdr))
+		goto out;
+	buf = malloc(cst.st_size);
+	if (!buf || read(fd, buf, cst.st_size) != cst.st_size)
+		goto out;
+
+	b.p = buf;
+	b.left = cst.st_size;
+	hdr = cache_get(&b, sizeof(*hdr));
+	if (memcmp(hdr->magic, BPF_CACHE_MAGIC, sizeof(hdr->magic)) ||
+	    hdr->version != BPF_CACHE_VERSION ||
+	    hdr->src_size != (uint64_t)st->st_size ||
+	    hdr->src_mtime_ns != (uint64_t)st->st_mtim.tv_sec * 1000000000 + st->st_mtim.tv_nsec ||
+	    hdr->nr_maps > MAX_MAPS)
+		goto out;
+
+	obj = calloc(1, sizeof(*obj));
+	if (!obj)
+		goto out;
+
+	obj->path = cache_get_str(&b, hdr->path_len);
+	if (!obj->path || strcmp(obj->path, path))
+		goto err;
+	obj->prog_name = cache_get_str(&b, hdr->prog_name_len);
+	if (!obj->prog_name)
+		goto err;
+	memcpy(obj->license, hdr->license, sizeof(obj->license));
+	obj->license[sizeof(obj->license) - 1] = 0;
+
+	obj->insns_cnt = hdr->insns_cnt;
+	insns = cache_get(&b, obj->insns_cnt * sizeof(struct bpf_insn));
+	obj->insns = malloc(obj->insns_cnt * sizeof(struct bpf_insn));
+	if (!insns || !obj->insns)
+		goto err;
+	memcpy(obj->insns, insns, obj->insns_cnt * sizeof(struct bpf_insn));
+
+	for (i = 0; i < (int)hdr->nr_maps; i++) {
+		const struct bpf_cache_map *m = cache_get(&b, sizeof(*m));
+
+		if (!m)
+			goto err;
+		obj->map_data[i].def = m->def;
+		obj->map_data[i].elf_offset = m->elf_offset;
+		obj->map_data[i].name = cache_get_str(&b, m->name_len);
+		if (!obj->map_data[i].name)
+			goto err;
+		obj->nr_maps++;
+	}
+
+	if (hdr->nr_relocs) {
+		obj->relocs = calloc(hdr->nr_relocs, sizeof(*obj->relocs));
+		if (!obj->relocs)
+			goto err;
+	}
+	for (i = 0; i < (int)hdr->nr_relocs; i++) {
+		const struct bpf_cache_reloc *r = cache_get(&b, sizeof(*r));
+		struct bpf_reloc *reloc = &obj->relocs[i];
+
+		if (!r || r->insn_idx >= obj->insns_cnt ||
+		    r->map_idx >= obj->nr_maps)
+			goto err;
+		reloc->insn_idx = r->insn_idx;
+		reloc->map_idx = r->map_idx;
+		reloc->default_value = r->default_value;
+		reloc->in_data = r->in_data;
+		reloc->sym_name = cache_get_str(&b, r->sym_name_len);
+		if (!reloc->sym_name)
+			goto err;
+		obj->nr_relocs++;
+	}
+
+	if (b.left)
+		goto err;
+
+	if (debug)
+		printf(_("using cached BPF object for %s\n"), path);
+	goto out;
+
+err:
+	free_bpf_object(obj);
+	obj = NULL;
+out:
+	free(buf);
 	close(fd);
+	return obj;
+}
+
+static int cache_put(FILE *f, const void *p, size_t size)
+{
+	return size && fwrite(p, size, 1, f) != 1 ? -1 : 0;
+}
+
+static void write_bpf_cache(struct bpf_object *obj, const struct stat *st)
+{
+	struct bpf_cache_header hdr = {};
+	char *name, *tmp = NULL;
+	int i, ret = 0;
+	FILE *f;
+
+	name = bpf_cache_name(obj->path);
+	if (!name)
+		return;
+	if (asprintf(&tmp, "%s.XXXXXX", name) < 0) {
+		tmp = NULL;
+		goto out;
+	}
+
+	// Only the cache directory itself is created, not its parents
+	mkdir(IR_KEYTABLE_CACHE_DIR, 0755);
+	i = mkstemp(tmp);
+	if (i < 0)
+		goto out;
+	f = fdopen(i, "w");
+	if (!f) {
+		close(i);
+		unlink(tmp);
+		goto out;
+	}
+
+	memcpy(hdr.magic, BPF_CACHE_MAGIC, sizeof(hdr.magic));
+	hdr.version = BPF_CACHE_VERSION;
+	hdr.insns_cnt = obj->insns_cnt;
+	hdr.src_size = st->st_size;
+	hdr.src_mtime_ns = (uint64_t)st->st_mtim.tv_sec * 1000000000 + st->st_mtim.tv_nsec;
+	hdr.nr_maps = obj->nr_maps;
+	hdr.nr_relocs = obj->nr_relocs;
+	hdr.path_len = strlen(obj->path);
+	hdr.prog_name_len = strlen(obj->prog_name);
+	memcpy(hdr.license, obj->license, sizeof(hdr.license));
+
+	ret |= cache_put(f, &hdr, sizeof(hdr));
+	ret |= cache_put(f, obj->path, hdr.path_len);
+	ret |= cache_put(f, obj->prog_name, hdr.prog_name_len);
+	ret |= cache_put(f, obj->insns, obj->insns_cnt * sizeof(struct bpf_insn));
+
+	for (i = 0; i < obj->nr_maps; i++) {
+		struct bpf_cache_map m = {};
+
+		m.def = obj->map_data[i].def;
+		m.elf_offset = obj->map_data[i].elf_offset;
+		m.name_len = strlen(obj->map_data[i].name);
+		ret |= cache_put(f, &m, sizeof(m));
+		ret |= cache_put(f, obj->map_data[i].name, m.name_len);
+	}
+
+	for (i = 0; i < obj->nr_relocs; i++) {
+		const struct bpf_reloc *reloc = &obj->relocs[i];
+		struct bpf_cache_reloc r = {};
+
+		r.insn_idx = reloc->insn_idx;
+		r.map_idx = reloc->map_idx;
+		r.default_value = reloc->default_value;
+		r.in_data = reloc->in_data;
+		r.sym_name_len = strlen(reloc->sym_name);
+		ret |= cache_put(f, &r, sizeof(r));
+		ret |= cache_put(f, reloc->sym_name, r.sym_name_len);
+	}
+
+	if (fclose(f) || ret || rename(tmp, name)) {
+		unlink(tmp);
+		goto out;
+	}
+
+	if (debug)
+		printf(_("stored BPF object for %s in %s\n"), obj->path, name);
+out:
+	free(tmp);
+	free(name);
+}
+
+struct bpf_object *bpf_object_get(const char *path)
+{
+	struct bpf_object *obj;
+	struct stat st;
+
+	for (obj = bpf_objects; obj; obj = obj->next)
+		if (!strcmp(obj->path, path))
+			return obj;
+
+	if (stat(path, &st))
+		return NULL;
+
+	obj = read_bpf_cache(path, &st);
+	if (!obj) {
+		obj = parse_bpf_file(path);
+		if (!obj)
+			return NULL;
+		// Failing to write the cache, e.g. on a read-only
+		// filesystem, only means the file is parsed again next time
+		write_bpf_cache(obj, &st);
+	}
+	obj->next = bpf_objects;
+	bpf_objects = obj;
+	return obj;
+}
+
+int bpf_object_load(struct bpf_object *obj, int lirc_fd,
+		    struct protocol_param *param, struct raw_entry *raw)
+{
+	int map_fd[MAX_MAPS];
+	struct bpf_insn *insns;
+	int i, ret = 1;
+
+	for (i = 0; i < MAX_MAPS; i++)
+		map_fd[i] = -1;
+
+	// Patched per load, the parsed program is kept as it is
+	insns = malloc(obj->insns_cnt * sizeof(*insns));
+	if (!insns)
+		return 1;
+	memcpy(insns, obj->insns, obj->insns_cnt * sizeof(*insns));
+
+	max_length = 0;
+	trail_space = 0;
+
+	if (obj->nr_maps && load_maps(obj, map_fd, raw))
+		goto done;
+
+	apply_relo(obj, insns, map_fd, param);
+
+	ret = load_and_attach(lirc_fd, obj, insns);
+
+done:
+	// The loaded program holds its own references to the maps
+	for (i = 0; i < obj->nr_maps; i++)
+		if (map_fd[i] >= 0)
+			close(map_fd[i]);
+	free(insns);
 	return ret;
 }
+
+int load_bpf_file(const char *path, int lirc_fd, struct protocol_param *param,
+	          struct raw_entry *raw)
+{
+	struct bpf_object *obj = bpf_object_get(path);
+
+	if (!obj)
+		return 1;
+	return bpf_object_load(obj, lirc_fd, param, raw);
+}
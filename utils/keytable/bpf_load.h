@@ -38,6 +38,18 @@ struct bpf_map_data {
  */
 int load_bpf_file(const char *path, int lirc_fd, struct protocol_param *param, struct raw_entry *raw);
 
+/* The ELF parsing done by load_bpf_file() is split out, so that a file
+ * is parsed only once however many devices its program is loaded for.
+ *
+ * bpf_object_get() returns the parsed file, parsing it on the first call
+ * for a path. bpf_object_load() then creates the maps, patches the maps
+ * and parameters into a copy of the program, and loads and attaches it.
+ */
+struct bpf_object;
+
+struct bpf_object *bpf_object_get(const char *path);
+int bpf_object_load(struct bpf_object *obj, int lirc_fd, struct protocol_param *param, struct raw_entry *raw);
+
 int bpf_param(struct protocol_param *param, const char *name, int *val);
 
 #endif
@@ -0,0 +1,784 @@
+/* SPDX-License-Identifier: GPL-2.0 */
+
+// Binary cache of parsed keymaps and of the rc_maps.cfg match table.
+//
+// Parsing rc_maps.cfg and a toml keymap for every rc device that udev
+// adds is slow on systems with many receivers. ir-keytable --compile
+// writes everything that --auto-load needs into one file which can be
+// mmap()ed and walked without any parsing. Every source file is recorded
+// with its size and modification time, so a stale entry is simply
+// ignored and the source file is parsed as before.
+
+#include <config.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <argp.h>
+
+#include "keymap-cache.h"
+
+#ifdef ENABLE_NLS
+# define _(string) gettext(string)
+# include "gettext.h"
+# include <locale.h>
+# include <langinfo.h>
+# include <iconv.h>
+#else
+# define _(string) string
+#endif
+
+#define KC_MAGIC	"IRKCACHE"
+#define KC_VERSION	1
+#define KC_ALIGN	8
+
+// All offsets are from the start of the file, except for strings which
+// are offsets into the string table. String offset 0 is a NULL string.
+
+struct kc_stat {
+	uint64_t size;
+	uint64_t mtime_ns;
+};
+
+struct kc_header {
+	char magic[8];
+	uint32_t version;
+	uint32_t header_size;
+	uint64_t file_size;
+	struct kc_stat cfg;
+	uint32_t cfg_off, n_cfg;
+	uint32_t files_off, n_files;
+	uint32_t strtab_off, strtab_size;
+};
+
+struct kc_cfg {
+	uint32_t driver;
+	uint32_t table;
+	uint32_t fname;
+	uint32_t pad;
+};
+
+// Sorted by path
+struct kc_file {
+	struct kc_stat st;
+	uint32_t path;
+	uint32_t maps_off, n_maps;
+	uint32_t pad;
+};
+
+struct kc_map {
+	uint32_t name, protocol, variant;
+	uint32_t params_off, n_params;
+	uint32_t scancodes_off, n_scancodes;
+	uint32_t raws_off, n_raws;
+	uint32_t pad;
+};
+
+struct kc_param {
+	int64_t value;
+	uint32_t name;
+	uint32_t pad;
+};
+
+struct kc_scancode {
+	uint64_t scancode;
+	uint32_t keycode;
+	uint32_t pad;
+};
+
+struct kc_raw {
+	uint64_t scancode;
+	uint32_t keycode;
+	uint32_t raw_length;
+	uint32_t raw_off;
+	uint32_t pad;
+};
+
+static bool kc_stat_file(const char *fname, struct kc_stat *kst)
+{
+	struct stat st;
+
+	if (stat(fname, &st))
+		return false;
+	kst->size = st.st_size;
+	kst->mtime_ns = st.st_mtim.tv_sec * 1000000000ULL + st.st_mtim.tv_nsec;
+	return true;
+}
+
+/*
+ * Reading the cache
+ */
+
+struct keymap_cache {
+	const uint8_t *base;
+	size_t size;
+	const struct kc_header *hdr;
+	const char *strtab;
+};
+
+static const void *kc_array(struct keymap_cache *c, uint32_t off,
+			    uint32_t n, size_t elem_size)
+{
+	if (off % KC_ALIGN || off < sizeof(struct kc_header) ||
+	    off + (uint64_t)n * elem_size > c->size)
+		return NULL;
+	return c->base + off;
+}
+
+static const char *kc_str(struct keymap_cache *c, uint32_t off)
+{
+	if (!off || off >= c->hdr->strtab_size)
+		return NULL;
+	return c->strtab + off;
+}
+
+static char *kc_strdup(struct keymap_cache *c, uint32_t off)
+{
+	const char *s = kc_str(c, off);
+
+	return s ? strdup(s) : NULL;
+}
+
+struct keymap_cache *keymap_cache_open(const char *cfgname, bool verbose)
+{
+	const struct kc_header *hdr;
+	struct keymap_cache *c;
+	struct kc_stat cfg_st;
+	struct stat st;
+	char *cachename;
+	void *base;
+	int fd;
+
+	if (asprintf(&cachename, "%s" KEYMAP_CACHE_SUFFIX, cfgname) < 0)
+		return NULL;
+
+	fd = open(cachename, O_RDONLY | O_CLOEXEC);
+	if (fd < 0) {
+		free(cachename);
+		return NULL;
+	}
+	if (fstat(fd, &st) || st.st_size < (off_t)sizeof(*hdr)) {
+		close(fd);
+		free(cachename);
+		return NULL;
+	}
+	base = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (base == MAP_FAILED) {
+		free(cachename);
+		return NULL;
+	}
+
+	hdr = base;
+	if (memcmp(hdr->magic, KC_MAGIC, sizeof(hdr->magic)) ||
+	    hdr->version != KC_VERSION ||
+	    hdr->header_size != sizeof(*hdr) ||
+	    hdr->file_size != (uint64_t)st.st_size ||
+	    !hdr->strtab_size ||
+	    hdr->strtab_off + (uint64_t)hdr->strtab_size != hdr->file_size ||
+	    ((const char *)base)[st.st_size - 1]) {
+		fprintf(stderr, _("%s: invalid keymap cache, ignoring\n"), cachename);
+		goto err;
+	}
+
+	if (!kc_stat_file(cfgname, &cfg_st) ||
+	    cfg_st.size != hdr->cfg.size || cfg_st.mtime_ns != hdr->cfg.mtime_ns) {
+		if (verbose)
+			fprintf(stderr, _("%s is older than %s, ignoring\n"),
+				cachename, cfgname);
+		goto err;
+	}
+
+	c = calloc(1, sizeof(*c));
+	if (!c)
+		goto err;
+	c->base = base;
+	c->size = st.st_size;
+	c->hdr = hdr;
+	c->strtab = (const char *)base + hdr->strtab_off;
+
+	if (!kc_array(c, hdr->cfg_off, hdr->n_cfg, sizeof(struct kc_cfg)) ||
+	    !kc_array(c, hdr->files_off, hdr->n_files, sizeof(struct kc_file))) {
+		fprintf(stderr, _("%s: invalid keymap cache, ignoring\n"), cachename);
+		free(c);
+		goto err;
+	}
+
+	if (verbose)
+		fprintf(stderr, _("Using keymap cache %s\n"), cachename);
+	free(cachename);
+	return c;
+
+err:
+	munmap(base, st.st_size);
+	free(cachename);
+	return NULL;
+}
+
+void keymap_cache_close(struct keymap_cache *c)
+{
+	if (!c)
+		return;
+	munmap((void *)c->base, c->size);
+	free(c);
+}
+
+unsigned keymap_cache_cfg_count(struct keymap_cache *c)
+{
+	return c->hdr->n_cfg;
+}
+
+void keymap_cache_cfg_entry(struct keymap_cache *c, unsigned idx,
+			    const char **driver, const char **table,
+			    const char **fname)
+{
+	const struct kc_cfg *cfg = kc_array(c, c->hdr->cfg_off, c->hdr->n_cfg,
+					    sizeof(*cfg));
+
+	*driver = kc_str(c, cfg[idx].driver);
+	*table = kc_str(c, cfg[idx].table);
+	*fname = kc_str(c, cfg[idx].fname);
+}
+
+static const struct kc_file *kc_find_file(struct keymap_cache *c,
+					  const char *fname)
+{
+	const struct kc_file *files = kc_array(c, c->hdr->files_off,
+					       c->hdr->n_files, sizeof(*files));
+	unsigned lo = 0, hi = c->hdr->n_files;
+
+	while (lo < hi) {
+		unsigned mid = lo + (hi - lo) / 2;
+		const char *path = kc_str(c, files[mid].path);
+		int cmp = path ? strcmp(fname, path) : 1;
+
+		if (!cmp)
+			return &files[mid];
+		if (cmp < 0)
+			hi = mid;
+		else
+			lo = mid + 1;
+	}
+	return NULL;
+}
+
+static struct keymap *kc_load_map(struct keymap_cache *c,
+				  const struct kc_map *km)
+{
+	const struct kc_param *params;
+	const struct kc_scancode *scancodes;
+	const struct kc_raw *raws;
+	struct protocol_param **next_param;
+	struct scancode_entry **next_se;
+	struct raw_entry **next_re;
+	struct keymap *map;
+	uint32_t i;
+
+	params = kc_array(c, km->params_off, km->n_params, sizeof(*params));
+	scancodes = kc_array(c, km->scancodes_off, km->n_scancodes, sizeof(*scancodes));
+	raws = kc_array(c, km->raws_off, km->n_raws, sizeof(*raws));
+	if ((km->n_params && !params) || (km->n_scancodes && !scancodes) ||
+	    (km->n_raws && !raws))
+		return NULL;
+
+	map = calloc(1, sizeof(*map));
+	if (!map)
+		return NULL;
+	map->name = kc_strdup(c, km->name);
+	map->protocol = kc_strdup(c, km->protocol);
+	map->variant = kc_strdup(c, km->variant);
+
+	next_param = &map->param;
+	for (i = 0; i < km->n_params; i++) {
+		struct protocol_param *param = calloc(1, sizeof(*param));
+
+		if (!param)
+			goto err;
+		*next_param = param;
+		next_param = &param->next;
+		param->name = kc_strdup(c, params[i].name);
+		param->value = params[i].value;
+		if (!param->name)
+			goto err;
+	}
+
+	next_se = &map->scancode;
+	for (i = 0; i < km->n_scancodes; i++) {
+		struct scancode_entry *se = calloc(1, sizeof(*se));
+
+		if (!se)
+			goto err;
+		*next_se = se;
+		next_se = &se->next;
+		se->scancode = scancodes[i].scancode;
+		se->keycode = kc_strdup(c, scancodes[i].keycode);
+		if (!se->keycode)
+			goto err;
+	}
+
+	next_re = &map->raw;
+	for (i = 0; i < km->n_raws; i++) {
+		const uint32_t *raw = kc_array(c, raws[i].raw_off,
+					       raws[i].raw_length, sizeof(*raw));
+		struct raw_entry *re;
+
+		if (!raw && raws[i].raw_length)
+			goto err;
+		re = calloc(1, sizeof(*re) + sizeof(re->raw[0]) * raws[i].raw_length);
+		if (!re)
+			goto err;
+		*next_re = re;
+		next_re = &re->next;
+		re->scancode = raws[i].scancode;
+		re->raw_length = raws[i].raw_length;
+		if (raw)
+			memcpy(re->raw, raw, sizeof(re->raw[0]) * re->raw_length);
+		re->keycode = kc_strdup(c, raws[i].keycode);
+		if (!re->keycode)
+			goto err;
+	}
+	return map;
+
+err:
+	free_keymap(map);
+	return NULL;
+}
+
+/*
+ * Returns the keymap list exactly as parse_keymap() would for fname, or
+ * ENOENT if fname is not in the cache or has changed since it was compiled.
+ */
+error_t keymap_cache_lookup(struct keymap_cache *c, const char *fname,
+			    struct keymap **keymap)
+{
+	const struct kc_file *file = kc_find_file(c, fname);
+	const struct kc_map *maps;
+	struct keymap *head = NULL, **next = &head;
+	struct kc_stat st;
+	uint32_t i;
+
+	if (!file || !kc_stat_file(fname, &st) ||
+	    st.size != file->st.size || st.mtime_ns != file->st.mtime_ns)
+		return ENOENT;
+
+	maps = kc_array(c, file->maps_off, file->n_maps, sizeof(*maps));
+	if (!maps || !file->n_maps)
+		return ENOENT;
+
+	for (i = 0; i < file->n_maps; i++) {
+		*next = kc_load_map(c, &maps[i]);
+		if (!*next) {
+			free_keymap(head);
+			return ENOENT;
+		}
+		next = &(*next)->next;
+	}
+	*keymap = head;
+	return 0;
+}
+
+/*
+ * Writing the cache
+ */
+
+struct kc_buf {
+	uint8_t *data;
+	size_t len, alloc;
+};
+
+struct kc_pending_file {
+	char *path;
+	struct kc_file file;
+};
+
+struct keymap_cache_writer {
+	char *cfgname;
+	struct kc_stat cfg_st;
+	bool failed;
+
+	struct kc_buf data;	// follows the header in the file
+	struct kc_buf strtab;
+	uint32_t *str_hash;	// open addressing hash of strtab offsets
+	unsigned hash_size, hash_used;
+
+	struct kc_cfg *cfg;
+	unsigned n_cfg, alloc_cfg;
+	struct kc_pending_file *files;
+	unsigned n_files, alloc_files;
+};
+
+static bool kc_grow(struct keymap_cache_writer *w, void **p, unsigned *alloc,
+		    unsigned n, size_t elem_size)
+{
+	unsigned new_alloc;
+	void *q;
+
+	if (n < *alloc)
+		return true;
+	new_alloc = *alloc ? *alloc * 2 : 64;
+	q = realloc(*p, new_alloc * elem_size);
+	if (!q) {
+		w->failed = true;
+		return false;
+	}
+	*p = q;
+	*alloc = new_alloc;
+	return true;
+}
+
+static size_t kc_buf_add(struct keymap_cache_writer *w, struct kc_buf *b,
+			 const void *p, size_t len, size_t align)
+{
+	size_t off = (b->len + align - 1) & ~(align - 1);
+
+	if (off + len > b->alloc) {
+		size_t new_alloc = b->alloc ? b->alloc : 4096;
+		uint8_t *q;
+
+		while (off + len > new_alloc)
+			new_alloc *= 2;
+		q = realloc(b->data, new_alloc);
+		if (!q) {
+			w->failed = true;
+			return 0;
+		}
+		b->data = q;
+		b->alloc = new_alloc;
+	}
+	memset(b->data + b->len, 0, off - b->len);
+	memcpy(b->data + off, p, len);
+	b->len = off + len;
+	return off;
+}
+
+// Returns the file offset of a copy of p in the data section
+static uint32_t kc_add_data(struct keymap_cache_writer *w, const void *p, size_t len)
+{
+	if (!len)
+		return 0;
+	return sizeof(struct kc_header) + kc_buf_add(w, &w->data, p, len, KC_ALIGN);
+}
+
+static uint32_t kc_hash(const char *s)
+{
+	uint32_t h = 2166136261U;
+
+	while (*s)
+		h = (h ^ (uint8_t)*s++) * 16777619U;
+	return h;
+}
+
+// Strings are deduplicated, keymaps mostly repeat the same KEY_ names
+static uint32_t kc_add_str(struct keymap_cache_writer *w, const char *s)
+{
+	unsigned i, mask;
+	uint32_t off;
+
+	if (!s)
+		return 0;
+
+	if (w->hash_used * 2 >= w->hash_size) {
+		unsigned new_size = w->hash_size ? w->hash_size * 2 : 1024;
+		uint32_t *h = calloc(new_size, sizeof(*h));
+
+		if (!h) {
+			w->failed = true;
+			return 0;
+		}
+		for (i = 0; i < w->hash_size; i++) {
+			unsigned j;
+
+			if (!w->str_hash[i])
+				continue;
+			j = kc_hash((char *)w->strtab.data + w->str_hash[i]) & (new_size - 1);
+			while (h[j])
+				j = (j + 1) & (new_size - 1);
+			h[j] = w->str_hash[i];
+		}
+		free(w->str_hash);
+		w->str_hash = h;
+		w->hash_size = new_size;
+	}
+
+	mask = w->hash_size - 1;
+	for (i = kc_hash(s) & mask; w->str_hash[i]; i = (i + 1) & mask)
+		if (!strcmp((char *)w->strtab.data + w->str_hash[i], s))
+			return w->str_hash[i];
+
+	off = kc_buf_add(w, &w->strtab, s, strlen(s) + 1, 1);
+	if (w->failed)
+		return 0;
+	w->str_hash[i] = off;
+	w->hash_used++;
+	return off;
+}
+
+struct keymap_cache_writer *keymap_cache_writer_new(const char *cfgname)
+{
+	struct keymap_cache_writer *w = calloc(1, sizeof(*w));
+
+	if (!w)
+		return NULL;
+	if (!kc_stat_file(cfgname, &w->cfg_st)) {
+		fprintf(stderr, _("%s: error: cannot stat: %m\n"), cfgname);
+		free(w);
+		return NULL;
+	}
+	w->cfgname = strdup(cfgname);
+	// Offset 0 of the string table is the NULL string
+	kc_buf_add(w, &w->strtab, "", 1, 1);
+	return w;
+}
+
+void keymap_cache_writer_free(struct keymap_cache_writer *w)
+{
+	unsigned i;
+
+	if (!w)
+		return;
+	for (i = 0; i < w->n_files; i++)
+		free(w->files[i].path);
+	free(w->files);
+	free(w->cfg);
+	free(w->str_hash);
+	free(w->strtab.data);
+	free(w->data.data);
+	free(w->cfgname);
+	free(w);
+}
+
+void keymap_cache_add_cfg(struct keymap_cache_writer *w, const char *driver,
+			  const char *table, const char *fname)
+{
+	struct kc_cfg *cfg;
+
+	if (!kc_grow(w, (void **)&w->cfg, &w->alloc_cfg, w->n_cfg, sizeof(*w->cfg)))
+		return;
+	cfg = &w->cfg[w->n_cfg++];
+	cfg->driver = kc_add_str(w, driver);
+	cfg->table = kc_add_str(w, table);
+	cfg->fname = kc_add_str(w, fname);
+	cfg->pad = 0;
+}
+
+bool keymap_cache_has_keymap(struct keymap_cache_writer *w, const char *fname)
+{
+	unsigned i;
+
+	for (i = 0; i < w->n_files; i++)
+		if (!strcmp(w->files[i].path, fname))
+			return true;
+	return false;
+}
+
+static void kc_add_map(struct keymap_cache_writer *w, struct keymap *map,
+		       struct kc_map *km)
+{
+	struct protocol_param *param;
+	struct scancode_entry *se;
+	struct raw_entry *re;
+	struct kc_param *params;
+	struct kc_scancode *scancodes;
+	struct kc_raw *raws;
+	uint32_t i;
+
+	memset(km, 0, sizeof(*km));
+	km->name = kc_add_str(w, map->name);
+	km->protocol = kc_add_str(w, map->protocol);
+	km->variant = kc_add_str(w, map->variant);
+	for (param = map->param; param; param = param->next)
+		km->n_params++;
+	for (se = map->scancode; se; se = se->next)
+		km->n_scancodes++;
+	for (re = map->raw; re; re = re->next)
+		km->n_raws++;
+
+	params = calloc(km->n_params + 1, sizeof(*params));
+	scancodes = calloc(km->n_scancodes + 1, sizeof(*scancodes));
+	raws = calloc(km->n_raws + 1, sizeof(*raws));
+	if (!params || !scancodes || !raws) {
+		w->failed = true;
+		goto out;
+	}
+
+	for (i = 0, param = map->param; param; param = param->next, i++) {
+		params[i].name = kc_add_str(w, param->name);
+		params[i].value = param->value;
+	}
+	for (i = 0, se = map->scancode; se; se = se->next, i++) {
+		scancodes[i].scancode = se->scancode;
+		scancodes[i].keycode = kc_add_str(w, se->keycode);
+	}
+	for (i = 0, re = map->raw; re; re = re->next, i++) {
+		raws[i].scancode = re->scancode;
+		raws[i].keycode = kc_add_str(w, re->keycode);
+		raws[i].raw_length = re->raw_length;
+		raws[i].raw_off = kc_add_data(w, re->raw,
+					      sizeof(re->raw[0]) * re->raw_length);
+	}
+
+	km->params_off = kc_add_data(w, params, sizeof(*params) * km->n_params);
+	km->scancodes_off = kc_add_data(w, scancodes, sizeof(*scancodes) * km->n_scancodes);
+	km->raws_off = kc_add_data(w, raws, sizeof(*raws) * km->n_raws);
+
+out:
+	free(params);
+	free(scancodes);
+	free(raws);
+}
+
+error_t keymap_cache_add_keymap(struct keymap_cache_writer *w,
+				const char *fname, struct keymap *map)
+{
+	struct kc_pending_file *f;
+	struct kc_map *maps;
+	struct keymap *cur;
+	uint32_t i, n_maps;
+
+	if (!kc_grow(w, (void **)&w->files, &w->alloc_files, w->n_files,
+		     sizeof(*w->files)))
+		return ENOMEM;
+	f = &w->files[w->n_files];
+	memset(f, 0, sizeof(*f));
+	if (!kc_stat_file(fname, &f->file.st)) {
+		error_t err = errno;
+
+		fprintf(stderr, _("%s: error: cannot stat: %m\n"), fname);
+		return err;
+	}
+
+	for (n_maps = 0, cur = map; cur; cur = cur->next)
+		n_maps++;
+	maps = calloc(n_maps + 1, sizeof(*maps));
+	if (!maps) {
+		w->failed = true;
+		return ENOMEM;
+	}
+	for (i = 0, cur = map; cur; cur = cur->next, i++)
+		kc_add_map(w, cur, &maps[i]);
+
+	f->path = strdup(fname);
+	f->file.path = kc_add_str(w, fname);
+	f->file.n_maps = n_maps;
+	f->file.maps_off = kc_add_data(w, maps, sizeof(*maps) * n_maps);
+	free(maps);
+	if (!f->path || w->failed) {
+		free(f->path);
+		w->failed = true;
+		return ENOMEM;
+	}
+	w->n_files++;
+	return 0;
+}
+
+static int kc_cmp_files(const void *a, const void *b)
+{
+	const struct kc_pending_file *fa = a, *fb = b;
+
+	return strcmp(fa->path, fb->path);
+}
+
+static bool kc_write_all(int fd, const void *p, size_t len)
+{
+	const uint8_t *q = p;
+
+	while (len) {
+		ssize_t ret = write(fd, q, len);
+
+		if (ret < 0 && errno == EINTR)
+			continue;
+		if (ret <= 0)
+			return false;
+		q += ret;
+		len -= ret;
+	}
+	return true;
+}
+
+error_t keymap_cache_write(struct keymap_cache_writer *w)
+{
+	struct kc_header hdr = {};
+	struct kc_file *files;
+	char *cachename, *tmpname;
+	error_t ret = 0;
+	unsigned i;
+	int fd;
+
+	qsort(w->files, w->n_files, sizeof(*w->files), kc_cmp_files);
+	files = calloc(w->n_files + 1, sizeof(*files));
+	if (!files)
+		return ENOMEM;
+	for (i = 0; i < w->n_files; i++)
+		files[i] = w->files[i].file;
+
+	memcpy(hdr.magic, KC_MAGIC, sizeof(hdr.magic));
+	hdr.version = KC_VERSION;
+	hdr.header_size = sizeof(hdr);
+	hdr.cfg = w->cfg_st;
+	hdr.n_cfg = w->n_cfg;
+	hdr.cfg_off = kc_add_data(w, w->cfg, sizeof(*w->cfg) * w->n_cfg);
+	hdr.n_files = w->n_files;
+	hdr.files_off = kc_add_data(w, files, sizeof(*files) * w->n_files);
+	free(files);
+	// An empty array still needs a valid offset
+	if (!hdr.cfg_off || !hdr.files_off) {
+		uint64_t zero = 0;
+		uint32_t off = kc_add_data(w, &zero, sizeof(zero));
+
+		if (!hdr.cfg_off)
+			hdr.cfg_off = off;
+		if (!hdr.files_off)
+			hdr.files_off = off;
+	}
+	hdr.strtab_off = sizeof(hdr) + w->data.len;
+	hdr.strtab_size = w->strtab.len;
+	hdr.file_size = hdr.strtab_off + (uint64_t)hdr.strtab_size;
+
+	if (w->failed) {
+		fprintf(stderr, _("Out of memory while compiling the keymap cache\n"));
+		return ENOMEM;
+	}
+
+	if (asprintf(&cachename, "%s" KEYMAP_CACHE_SUFFIX, w->cfgname) < 0)
+		return ENOMEM;
+	if (asprintf(&tmpname, "%s.tmp", cachename) < 0) {
+		free(cachename);
+		return ENOMEM;
+	}
+
+	// Write to a temporary file first, so readers never see a partial cache
+	fd = open(tmpname, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+	if (fd < 0) {
+		ret = errno;
+		fprintf(stderr, _("%s: error: cannot create: %m\n"), tmpname);
+		goto out;
+	}
+	if (!kc_write_all(fd, &hdr, sizeof(hdr)) ||
+	    !kc_write_all(fd, w->data.data, w->data.len) ||
+	    !kc_write_all(fd, w->strtab.data, w->strtab.len)) {
+		ret = errno ? errno : EIO;
+		fprintf(stderr, _("%s: error: write failed: %m\n"), tmpname);
+		close(fd);
+		unlink(tmpname);
+		goto out;
+	}
+	close(fd);
+	if (rename(tmpname, cachename)) {
+		ret = errno;
+		fprintf(stderr, _("%s: error: cannot rename to %s: %m\n"),
+			tmpname, cachename);
+		unlink(tmpname);
+	}
+
+out:
+	free(tmpname);
+	free(cachename);
+	return ret;
+}
@@ -0,0 +1,34 @@
+/* SPDX-License-Identifier: GPL-2.0 */
+#ifndef __KEYMAP_CACHE_H
+#define __KEYMAP_CACHE_H
+
+#include <stdbool.h>
+#include <argp.h>
+
+#include "keymap.h"
+
+// The cache for CFGFILE is stored alongside it, as CFGFILE.cache
+#define KEYMAP_CACHE_SUFFIX ".cache"
+
+struct keymap_cache;
+struct keymap_cache_writer;
+
+struct keymap_cache *keymap_cache_open(const char *cfgname, bool verbose);
+void keymap_cache_close(struct keymap_cache *cache);
+unsigned keymap_cache_cfg_count(struct keymap_cache *cache);
+void keymap_cache_cfg_entry(struct keymap_cache *cache, unsigned idx,
+			    const char **driver, const char **table,
+			    const char **fname);
+error_t keymap_cache_lookup(struct keymap_cache *cache, const char *fname,
+			    struct keymap **keymap);
+
+struct keymap_cache_writer *keymap_cache_writer_new(const char *cfgname);
+void keymap_cache_writer_free(struct keymap_cache_writer *w);
+void keymap_cache_add_cfg(struct keymap_cache_writer *w, const char *driver,
+			  const char *table, const char *fname);
+bool keymap_cache_has_keymap(struct keymap_cache_writer *w, const char *fname);
+error_t keymap_cache_add_keymap(struct keymap_cache_writer *w,
+				const char *fname, struct keymap *map);
+error_t keymap_cache_write(struct keymap_cache_writer *w);
+
+#endif
@@ -27,6 +27,7 @@
 #include <sys/types.h>
 #include <sys/resource.h>
 #include <sys/stat.h>
+#include <sys/wait.h>
 #include <dirent.h>
 #include <argp.h>
 #include <time.h>
@@ -35,6 +36,7 @@
 #include "ir-encode.h"
 #include "parse.h"
 #include "keymap.h"
+#include "keymap-cache.h"
 
 #ifdef HAVE_BPF
 #include "bpf.h"
@@ -258,7 +260,8 @@ static const char doc[] = N_(
 	"  PERIOD    - Period to repeat a keystroke\n"
 	"  PARAMETER - a set of name1=number1[,name2=number2]... for the BPF prototcol\n"
 	"  CFGFILE   - configuration file that associates a driver/table name with\n"
-	"              a keymap file\n"
+	"              a keymap file. If CFGFILE" KEYMAP_CACHE_SUFFIX " was created with\n"
+	"              --compile, then it is used instead of parsing the keymaps\n"
 	"\nOptions can be combined together.");
 
 static const struct argp_option options[] = {
@@ -275,6 +278,8 @@ static const struct argp_option options[] = {
 	{"period",	'P',	N_("PERIOD"),	0,	N_("Sets the period to repeat a keystroke"), 0},
 	{"auto-load",	'a',	N_("CFGFILE"),	0,	N_("Auto-load keymaps, based on a configuration file. Only works with --sysdev."), 0},
 	{"test-keymap",	1,	N_("KEYMAP"),	0,	N_("Test if keymap is valid"), 0},
+	{"all",		3,	0,		0,	N_("With --auto-load, load the keymaps of all rc devices in parallel"), 0},
+	{"compile",	2,	N_("CFGFILE"),	0,	N_("Compile the config file and all keymaps into a cache for --auto-load"), 0},
 	{"help",        '?',	0,		0,	N_("Give this help list"), -1},
 	{"usage",	-3,	0,		0,	N_("Give a short usage message")},
 	{"version",	'V',	0,		0,	N_("Print program version"), -1},
@@ -292,6 +297,9 @@ static int test = 0;
 static int delay = -1;
 static int period = -1;
 static int test_keymap = 0;
+static char *compile_cfg = NULL;
+static int all_devices = 0;
+static struct keymap_cache *keymap_cache = NULL;
 static enum sysfs_protocols ch_proto = 0;
 
 struct bpf_protocol {
@@ -455,6 +463,55 @@ static int add_keymap(struct keymap *map, const char *fname)
 	return 0;
 }
 
+static error_t add_cfg_entry(struct cfgfile **nextcfg, const char *driver,
+			     const char *table, const char *filename)
+{
+	struct cfgfile *cur = *nextcfg;
+
+	cur->driver = strdup(driver);
+	cur->table = strdup(table);
+	cur->fname = strdup(filename);
+
+	cur->next = calloc(1, sizeof(*cur));
+	if (!cur->driver || !cur->table || !cur->fname || !cur->next) {
+		perror("parse_cfgfile");
+		return ENOMEM;
+	}
+	*nextcfg = cur->next;
+	return 0;
+}
+
+/*
+ * Fill in the config file entries from the keymap cache, if there is one
+ * and it is up to date with fname.
+ */
+static bool cfg_from_cache(char *fname)
+{
+	struct cfgfile *nextcfg = &cfg;
+	unsigned i;
+
+	keymap_cache = keymap_cache_open(fname, debug);
+	if (!keymap_cache)
+		return false;
+
+	for (i = 0; i < keymap_cache_cfg_count(keymap_cache); i++) {
+		const char *driver, *table, *filename;
+
+		keymap_cache_cfg_entry(keymap_cache, i, &driver, &table, &filename);
+		if (!driver || !table || !filename ||
+		    add_cfg_entry(&nextcfg, driver, table, filename)) {
+			keymap_cache_close(keymap_cache);
+			keymap_cache = NULL;
+			cfg.next = NULL;
+			return false;
+		}
+		if (debug)
+			fprintf(stderr, _("Driver %s, Table %s => file %s\n"),
+				driver, table, filename);
+	}
+	return true;
+}
+
 static error_t parse_cfgfile(char *fname)
 {
 	FILE *fin;
@@ -498,21 +555,10 @@ static error_t parse_cfgfile(char *fname)
 			fprintf(stderr, _("Driver %s, Table %s => file %s\n"),
 				driver, table, filename);
 
-		nextcfg->driver = malloc(strlen(driver) + 1);
-		strcpy(nextcfg->driver, driver);
-
-		nextcfg->table = malloc(strlen(table) + 1);
-		strcpy(nextcfg->table, table);
-
-		nextcfg->fname = malloc(strlen(filename) + 1);
-		strcpy(nextcfg->fname, filename);
-
-		nextcfg->next = calloc(1, sizeof(*nextcfg));
-		if (!nextcfg->next) {
-			perror("parse_cfgfile");
+		if (add_cfg_entry(&nextcfg, driver, table, filename)) {
+			fclose(fin);
 			return ENOMEM;
 		}
-		nextcfg = nextcfg->next;
 	}
 	fclose(fin);
 
@@ -573,6 +619,8 @@ static error_t parse_opt(int k, char *arg, struct argp_state *state)
 		break;
 	}
 	case 'a': {
+		if (cfg_from_cache(arg))
+			break;
 		rc = parse_cfgfile(arg);
 		if (rc)
 			argp_error(state, _("Failed to read config file %s"), arg);
@@ -691,6 +739,15 @@ static error_t parse_opt(int k, char *arg, struct argp_state *state)
 			p = strtok(NULL, ":=");
 		} while (p);
 		break;
+	case 3:
+		all_devices++;
+		break;
+	case 2:
+		rc = parse_cfgfile(arg);
+		if (rc)
+			argp_error(state, _("Failed to read config file %s"), arg);
+		compile_cfg = arg;
+		break;
 	case 1:
 		test_keymap++;
 		struct keymap *map ;
@@ -1373,6 +1430,71 @@ static int get_input_protocol_version(int fd)
 	return 0;
 }
 
+struct scan_key {
+	unsigned long long scancode;
+	uint32_t keycode;
+	uint32_t order;
+};
+
+static int cmp_scan_key(const void *a, const void *b)
+{
+	const struct scan_key *ka = a, *kb = b;
+
+	if (ka->scancode != kb->scancode)
+		return ka->scancode < kb->scancode ? -1 : 1;
+	return ka->order < kb->order ? -1 : ka->order > kb->order;
+}
+
+/*
+ * Returns the scancode to keycode table that add_keys() would leave
+ * behind, sorted by scancode. add_keys() writes the list from the head,
+ * so the entry closest to the tail wins if a scancode is listed twice.
+ */
+static struct scan_key *target_table(unsigned *num)
+{
+	struct keytable_entry *ke;
+	struct scan_key *keys;
+	unsigned i, n = 0;
+
+	for (ke = keytable; ke; ke = ke->next)
+		n++;
+	keys = calloc(n + 1, sizeof(*keys));
+	if (!keys)
+		return NULL;
+	for (i = 0, ke = keytable; ke; ke = ke->next, i++) {
+		keys[i].scancode = ke->scancode;
+		keys[i].keycode = ke->keycode;
+		keys[i].order = i;
+	}
+	qsort(keys, n, sizeof(*keys), cmp_scan_key);
+
+	for (i = 0, *num = 0; i < n; i++) {
+		if (i + 1 < n && keys[i + 1].scancode == keys[i].scancode)
+			continue;
+		if (keys[i].keycode != KEY_RESERVED)
+			keys[(*num)++] = keys[i];
+	}
+	return keys;
+}
+
+static bool in_table(const struct scan_key *keys, unsigned num,
+		     unsigned long long scancode)
+{
+	unsigned lo = 0, hi = num;
+
+	while (lo < hi) {
+		unsigned mid = lo + (hi - lo) / 2;
+
+		if (keys[mid].scancode == scancode)
+			return true;
+		if (keys[mid].scancode < scancode)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return false;
+}
+
 static void clear_table(int fd)
 {
 	int i, j;
@@ -1381,13 +1503,24 @@ static void clear_table(int fd)
 
 	/* Clears old table */
 	if (input_protocol_version < 0x10001) {
+		struct scan_key *keys;
+		unsigned num = 0;
+
+		/*
+		 * There is no way to enumerate the table, but the scancodes
+		 * that are about to be written need not be cleared first.
+		 */
+		keys = target_table(&num);
 		for (j = 0; j < 256; j++) {
 			for (i = 0; i < 256; i++) {
 				codes[0] = (j << 8) | i;
 				codes[1] = KEY_RESERVED;
+				if (keys && in_table(keys, num, codes[0]))
+					continue;
 				ioctl(fd, EVIOCSKEYCODE, codes);
 			}
 		}
+		free(keys);
 	} else {
 		memset(&entry, '\0', sizeof(entry));
 		i = 0;
@@ -1403,11 +1536,42 @@ static void clear_table(int fd)
 	}
 }
 
+static int set_keycode(int fd, unsigned long long scancode, uint32_t keycode)
+{
+	unsigned codes[2];
+
+	codes[0] = scancode;
+	codes[1] = keycode;
+
+	if (codes[0] != scancode) {
+		// 64 bit scancode
+		struct input_keymap_entry_v2 entry = {
+			.keycode = keycode,
+			.len = sizeof(scancode)
+		};
+
+		memcpy(entry.scancode, &scancode, sizeof(scancode));
+
+		return ioctl(fd, EVIOCSKEYCODE_V2, &entry);
+	}
+	return ioctl(fd, EVIOCSKEYCODE, codes);
+}
+
+static void free_keytable(void)
+{
+	struct keytable_entry *ke;
+
+	while (keytable) {
+		ke = keytable;
+		keytable = ke->next;
+		free(ke);
+	}
+}
+
 static int add_keys(int fd)
 {
 	int write_cnt = 0;
 	struct keytable_entry *ke;
-	unsigned codes[2];
 
 	for (ke = keytable; ke; ke = ke->next) {
 		write_cnt++;
@@ -1415,41 +1579,138 @@ static int add_keys(int fd)
 			fprintf(stderr, "\t%04llx=%04x\n",
 				ke->scancode, ke->keycode);
 
-		codes[0] = ke->scancode;
-		codes[1] = ke->keycode;
+		if (set_keycode(fd, ke->scancode, ke->keycode)) {
+			fprintf(stderr,
+				_("Setting scancode 0x%04llx with 0x%04x via "),
+				ke->scancode, ke->keycode);
+			perror("EVIOCSKEYCODE");
+		}
+	}
 
-		if (codes[0] != ke->scancode) {
-			// 64 bit scancode
-			struct input_keymap_entry_v2 entry = {
-				.keycode = ke->keycode,
-				.len = sizeof(ke->scancode)
-			};
+	free_keytable();
 
-			memcpy(entry.scancode, &ke->scancode, sizeof(ke->scancode));
+	return write_cnt;
+}
 
-			if (ioctl(fd, EVIOCSKEYCODE_V2, &entry)) {
-				fprintf(stderr,
-					_("Setting scancode 0x%04llx with 0x%04x via "),
-					ke->scancode, ke->keycode);
-				perror("EVIOCSKEYCODE");
+/*
+ * Reads the current table by index, which takes one ioctl per mapped
+ * scancode rather than one per possible scancode.
+ */
+static struct scan_key *read_table_v2(int fd, unsigned *num)
+{
+	struct input_keymap_entry_v2 entry = {};
+	struct scan_key *keys = NULL;
+	unsigned alloc = 0;
+
+	for (*num = 0; ; (*num)++) {
+		entry.flags = KEYMAP_BY_INDEX;
+		entry.index = *num;
+		entry.len = sizeof(uint64_t);
+
+		if (ioctl(fd, EVIOCGKEYCODE_V2, &entry) == -1)
+			break;
+
+		if (*num == alloc) {
+			struct scan_key *p;
+
+			alloc = alloc ? alloc * 2 : 128;
+			p = realloc(keys, alloc * sizeof(*keys));
+			if (!p) {
+				free(keys);
+				return NULL;
 			}
+			keys = p;
+		}
+
+		if (entry.len == sizeof(uint32_t)) {
+			uint32_t temp;
+
+			memcpy(&temp, entry.scancode, sizeof(temp));
+			keys[*num].scancode = temp;
+		} else if (entry.len == sizeof(uint64_t)) {
+			uint64_t temp;
+
+			memcpy(&temp, entry.scancode, sizeof(temp));
+			keys[*num].scancode = temp;
 		} else {
-			if (ioctl(fd, EVIOCSKEYCODE, codes)) {
-				fprintf(stderr,
-					_("Setting scancode 0x%04llx with 0x%04x via "),
-					ke->scancode, ke->keycode);
-				perror("EVIOCSKEYCODE");
-			}
+			free(keys);
+			return NULL;
 		}
+		keys[*num].keycode = entry.keycode;
+		keys[*num].order = *num;
 	}
+	if (!keys)
+		keys = calloc(1, sizeof(*keys));
+	else
+		qsort(keys, *num, sizeof(*keys), cmp_scan_key);
+	return keys;
+}
 
-	while (keytable) {
-		ke = keytable;
-		keytable = ke->next;
-		free(ke);
+/*
+ * Replace the current table with the new keytable, touching only the
+ * scancodes that differ. Returns the number of keycodes written, or -1 if
+ * the caller should fall back to clear_table() and add_keys().
+ */
+static int replace_table_v2(int fd)
+{
+	struct scan_key *cur, *new;
+	unsigned n_cur, n_new, i = 0, j = 0;
+	unsigned removed = 0, written = 0;
+	int ret = 0;
+
+	cur = read_table_v2(fd, &n_cur);
+	new = target_table(&n_new);
+	if (!cur || !new) {
+		free(cur);
+		free(new);
+		return -1;
 	}
 
-	return write_cnt;
+	while (i < n_cur || j < n_new) {
+		if (j == n_new ||
+		    (i < n_cur && cur[i].scancode < new[j].scancode)) {
+			if (debug)
+				fprintf(stderr, _("Deleting scancode 0x%04llx\n"),
+					cur[i].scancode);
+			if (set_keycode(fd, cur[i].scancode, KEY_RESERVED)) {
+				ret = -1;
+				break;
+			}
+			removed++;
+			i++;
+			continue;
+		}
+		if (i < n_cur && cur[i].scancode == new[j].scancode &&
+		    cur[i].keycode == new[j].keycode) {
+			i++;
+			j++;
+			continue;
+		}
+		if (debug)
+			fprintf(stderr, "\t%04llx=%04x\n",
+				new[j].scancode, new[j].keycode);
+		if (set_keycode(fd, new[j].scancode, new[j].keycode)) {
+			fprintf(stderr,
+				_("Setting scancode 0x%04llx with 0x%04x via "),
+				new[j].scancode, new[j].keycode);
+			perror("EVIOCSKEYCODE");
+		}
+		written++;
+		if (i < n_cur && cur[i].scancode == new[j].scancode)
+			i++;
+		j++;
+	}
+	free(cur);
+	free(new);
+	if (ret)
+		return ret;
+
+	if (!removed && !written)
+		fprintf(stderr, _("Keytable already up to date\n"));
+	else if (removed)
+		fprintf(stderr, _("Old keytable cleared\n"));
+	free_keytable();
+	return written;
 }
 
 static void display_proto(struct rc_device *rc_dev)
@@ -2028,52 +2289,95 @@ char* keymap_to_filename(const char *fname)
 	return NULL;
 }
 
-int main(int argc, char *argv[])
+static void compile_keymap(struct keymap_cache_writer *w, const char *fname)
 {
-	int dev_from_class = 0, write_cnt;
-	int fd;
-	static struct sysfs_names *names;
-	struct rc_device	  rc_dev;
+	struct keymap *map;
+	char *name = strdup(fname);
 
-#ifdef ENABLE_NLS
-	setlocale (LC_ALL, "");
-	bindtextdomain (PACKAGE, LOCALEDIR);
-	textdomain (PACKAGE);
-#endif
+	if (!name || keymap_cache_has_keymap(w, fname)) {
+		free(name);
+		return;
+	}
+	if (parse_keymap(name, &map, debug)) {
+		fprintf(stderr, _("Skipping %s, it cannot be parsed\n"), fname);
+		free(name);
+		return;
+	}
+	keymap_cache_add_keymap(w, fname, map);
+	free_keymap(map);
+	free(name);
+}
 
-	argp_parse(&argp, argc, argv, ARGP_NO_HELP, 0, 0);
+static void compile_keymap_dir(struct keymap_cache_writer *w, const char *dirname)
+{
+	struct dirent *entry;
+	DIR *dir;
 
-	if (test_keymap)
-		return 0;
+	dir = opendir(dirname);
+	if (!dir)
+		return;
 
-	/* Just list all devices */
-	if (!clear && !readtable && !keytable && !ch_proto && !cfg.next && !test && delay < 0 && period < 0 && !bpf_protocol) {
-		if (show_sysfs_attribs(&rc_dev, devclass))
-			return -1;
+	while ((entry = readdir(dir))) {
+		struct stat st;
+		char *fname;
 
-		return 0;
+		if (entry->d_name[0] == '.')
+			continue;
+		if (asprintf(&fname, "%s/%s", dirname, entry->d_name) < 0)
+			break;
+		if (!stat(fname, &st) && S_ISREG(st.st_mode))
+			compile_keymap(w, fname);
+		free(fname);
 	}
+	closedir(dir);
+}
 
-	if (!devclass)
-		devclass = "rc0";
+/*
+ * Compile the config file and every keymap it or the keymap directories
+ * refer to into CFGFILE.cache, so --auto-load can skip all the parsing.
+ */
+static int compile_keymap_cache(const char *cfgname)
+{
+	struct keymap_cache_writer *w;
+	struct cfgfile *cur;
+	int rc;
 
-	if (cfg.next && (clear || keytable || ch_proto)) {
-		fprintf (stderr, _("Auto-mode can be used only with --read, --verbose and --sysdev options\n"));
+	w = keymap_cache_writer_new(cfgname);
+	if (!w)
 		return -1;
-	}
 
-	names = find_device(devclass);
-	if (!names)
-		return -1;
-	rc_dev.sysfs_name = names->name;
-	if (get_attribs(&rc_dev, names->name)) {
-		free_names(names);
-		return -1;
+	for (cur = &cfg; cur->next; cur = cur->next)
+		keymap_cache_add_cfg(w, cur->driver, cur->table, cur->fname);
+
+	compile_keymap_dir(w, IR_KEYTABLE_USER_DIR);
+	compile_keymap_dir(w, IR_KEYTABLE_SYSTEM_DIR);
+
+	// Keymaps which are given by a path in the config file
+	for (cur = &cfg; cur->next; cur = cur->next) {
+		char *fname = keymap_to_filename(cur->fname);
+
+		if (fname)
+			compile_keymap(w, fname);
+		free(fname);
 	}
-	names->name = NULL;
-	free_names(names);
 
-	dev_from_class++;
+	rc = keymap_cache_write(w);
+	if (!rc)
+		fprintf(stderr, _("Wrote keymap cache %s" KEYMAP_CACHE_SUFFIX "\n"),
+			cfgname);
+	keymap_cache_writer_free(w);
+	return rc ? -1 : 0;
+}
+
+/*
+ * Read the device attributes and, in auto-load mode, the keymaps that
+ * match the device. Returns 1 if there is nothing to do for the device.
+ */
+static int prepare_device(struct rc_device *rc_dev, char *sysfs_name)
+{
+	rc_dev->sysfs_name = sysfs_name;
+	if (get_attribs(rc_dev, sysfs_name))
+		return -1;
 
 	if (cfg.next) {
 		struct cfgfile *cur;
@@ -2083,21 +2387,28 @@ int main(int argc, char *argv[])
 		int matches = 0;
 
 		for (cur = &cfg; cur->next; cur = cur->next) {
-			if ((!rc_dev.drv_name || strcasecmp(cur->driver, rc_dev.drv_name)) && strcasecmp(cur->driver, "*"))
+			if ((!rc_dev->drv_name || strcasecmp(cur->driver, rc_dev->drv_name)) && strcasecmp(cur->driver, "*"))
 				continue;
-			if ((!rc_dev.keytable_name || strcasecmp(cur->table, rc_dev.keytable_name)) && strcasecmp(cur->table, "*"))
+			if ((!rc_dev->keytable_name || strcasecmp(cur->table, rc_dev->keytable_name)) && strcasecmp(cur->table, "*"))
 				continue;
 
 			if (debug)
 				fprintf(stderr, _("Keymap for %s, %s is on %s file.\n"),
-					rc_dev.drv_name, rc_dev.keytable_name,
+					rc_dev->drv_name, rc_dev->keytable_name,
 					cur->fname);
 
 			fname = keymap_to_filename(cur->fname);
 			if (!fname)
 				return -1;
 
-			rc = parse_keymap(fname, &map, debug);
+			rc = ENOENT;
+			if (keymap_cache) {
+				rc = keymap_cache_lookup(keymap_cache, fname, &map);
+				if (!rc && debug)
+					fprintf(stderr, _("Using cached %s keymap\n"), fname);
+			}
+			if (rc)
+				rc = parse_keymap(fname, &map, debug);
 			if (rc < 0) {
 				fprintf(stderr, _("Can't load %s keymap\n"), fname);
 				free(fname);
@@ -2118,27 +2429,40 @@ int main(int argc, char *argv[])
 		if (!matches) {
 			if (debug)
 				fprintf(stderr, _("Keymap for %s, %s not found. Keep as-is\n"),
-				       rc_dev.drv_name, rc_dev.keytable_name);
-			return 0;
+				       rc_dev->drv_name, rc_dev->keytable_name);
+			return 1;
 		}
 	}
 
+	return 0;
+}
+
+/*
+ * Write the keytable, protocols and BPF decoders to the device
+ */
+static int apply_device(struct rc_device *rc_dev)
+{
+	int write_cnt;
+	int fd;
+
 	if (debug)
-		fprintf(stderr, _("Opening %s\n"), rc_dev.input_name);
-	fd = open(rc_dev.input_name, O_RDONLY | O_NONBLOCK);
+		fprintf(stderr, _("Opening %s\n"), rc_dev->input_name);
+	fd = open(rc_dev->input_name, O_RDONLY | O_NONBLOCK);
 	if (fd < 0) {
-		perror(rc_dev.input_name);
+		perror(rc_dev->input_name);
 		return -1;
 	}
-	if (dev_from_class)
-		free(rc_dev.input_name);
+	free(rc_dev->input_name);
 	if (get_input_protocol_version(fd))
 		return -1;
 
 	/*
 	 * First step: clear, if --clear is specified
 	 */
-	if (clear) {
+	write_cnt = -1;
+	if (clear && keytable && input_protocol_version >= 0x10001)
+		write_cnt = replace_table_v2(fd);
+	if (clear && write_cnt < 0) {
 		clear_table(fd);
 		fprintf(stderr, _("Old keytable cleared\n"));
 	}
@@ -2146,7 +2470,8 @@ int main(int argc, char *argv[])
 	/*
 	 * Second step: stores key tables from file or from commandline
 	 */
-	write_cnt = add_keys(fd);
+	if (write_cnt < 0)
+		write_cnt = add_keys(fd);
 	if (write_cnt)
 		fprintf(stderr, _("Wrote %d keycode(s) to driver\n"), write_cnt);
 
@@ -2154,14 +2479,14 @@ int main(int argc, char *argv[])
 	 * Third step: change protocol
 	 */
 	if (ch_proto || bpf_protocol) {
-		if (rc_dev.lirc_name)
-			clear_bpf(rc_dev.lirc_name);
+		if (rc_dev->lirc_name)
+			clear_bpf(rc_dev->lirc_name);
 
-		rc_dev.current = load_bpf_for_unsupported(ch_proto, rc_dev.supported);
+		rc_dev->current = load_bpf_for_unsupported(ch_proto, rc_dev->supported);
 
-		if (!set_proto(&rc_dev)) {
+		if (!set_proto(rc_dev)) {
 			fprintf(stderr, _("Protocols changed to "));
-			write_sysfs_protocols(rc_dev.current, stderr, "%s ");
+			write_sysfs_protocols(rc_dev->current, stderr, "%s ");
 			fprintf(stderr, "\n");
 		}
 	}
@@ -2169,15 +2494,15 @@ int main(int argc, char *argv[])
 	if (bpf_protocol) {
 		struct bpf_protocol *b;
 
-		if (!rc_dev.lirc_name) {
+		if (!rc_dev->lirc_name) {
 			fprintf(stderr, _("Error: unable to attach bpf program, lirc device name was not found\n"));
 		}
 
-		for (b = bpf_protocol; b && rc_dev.lirc_name; b = b->next) {
+		for (b = bpf_protocol; b && rc_dev->lirc_name; b = b->next) {
 			char *fname = find_bpf_file(b->name);
 
 			if (fname) {
-				if (attach_bpf(rc_dev.lirc_name, fname, b->param))
+				if (attach_bpf(rc_dev->lirc_name, fname, b->param))
 					fprintf(stderr, _("Loaded BPF protocol %s\n"), b->name);
 				free(fname);
 			}
@@ -2188,7 +2513,7 @@ int main(int argc, char *argv[])
 	 * Fourth step: display current keytable
 	 */
 	if (readtable)
-		display_table(&rc_dev, fd);
+		display_table(rc_dev, fd);
 
 	/*
 	 * Fiveth step: change repeat rate/delay
@@ -2204,7 +2529,149 @@ int main(int argc, char *argv[])
 	}
 
 	if (test)
-		test_event(&rc_dev, fd);
+		test_event(rc_dev, fd);
 
 	return 0;
 }
+
+#ifdef HAVE_BPF
+/*
+ * Parse the BPF decoders of the device before forking, so that every
+ * child that uses the same decoder gets the parsed ELF file for free.
+ */
+static void preload_bpf(void)
+{
+	struct bpf_protocol *b;
+
+	for (b = bpf_protocol; b; b = b->next) {
+		char *fname = find_bpf_file(b->name);
+
+		if (fname) {
+			bpf_object_get(fname);
+			free(fname);
+		}
+	}
+}
+#else
+static void preload_bpf(void) {}
+#endif
+
+/*
+ * Auto-load all rc devices at once. The matching keymaps are read here,
+ * and then one child per device writes them to the device, so that the
+ * slow parts (sysfs protocol writes, keycode ioctls and BPF verification)
+ * run concurrently.
+ */
+static int load_all_devices(void)
+{
+	struct bpf_protocol *initial_bpf = bpf_protocol;
+	enum sysfs_protocols initial_proto = ch_proto;
+	struct sysfs_names *names, *cur;
+	int children = 0, ret = 0;
+	int status;
+	pid_t pid;
+
+	names = find_device(NULL);
+	if (!names)
+		return -1;
+
+	for (cur = names; cur->next; cur = cur->next) {
+		struct rc_device rc_dev = {};
+		int rc;
+
+		// Start each device from the state given on the command line
+		free_keytable();
+		rawtable = NULL;
+		raw_scancode = 0;
+		bpf_protocol = initial_bpf;
+		ch_proto = initial_proto;
+
+		rc = prepare_device(&rc_dev, cur->name);
+		if (rc < 0)
+			ret = -1;
+		if (rc)
+			continue;
+
+		preload_bpf();
+		fflush(stdout);
+		fflush(stderr);
+		pid = fork();
+		if (pid < 0) {
+			perror("fork");
+			if (apply_device(&rc_dev))
+				ret = -1;
+			continue;
+		}
+		if (!pid)
+			exit(apply_device(&rc_dev) ? EXIT_FAILURE : EXIT_SUCCESS);
+		children++;
+	}
+
+	while (children && wait(&status) > 0) {
+		children--;
+		if (!WIFEXITED(status) || WEXITSTATUS(status))
+			ret = -1;
+	}
+	free_names(names);
+	return ret;
+}
+
+int main(int argc, char *argv[])
+{
+	static struct sysfs_names *names;
+	struct rc_device	  rc_dev;
+	int rc;
+
+#ifdef ENABLE_NLS
+	setlocale (LC_ALL, "");
+	bindtextdomain (PACKAGE, LOCALEDIR);
+	textdomain (PACKAGE);
+#endif
+
+	argp_parse(&argp, argc, argv, ARGP_NO_HELP, 0, 0);
+
+	if (test_keymap)
+		return 0;
+
+	if (compile_cfg)
+		return compile_keymap_cache(compile_cfg);
+
+	if (all_devices && (!cfg.next || devclass || readtable || test)) {
+		fprintf(stderr, _("--all can only be used with --auto-load, and not with --sysdev, --read or --test\n"));
+		return -1;
+	}
+
+	/* Just list all devices */
+	if (!clear && !readtable && !keytable && !ch_proto && !cfg.next && !test && delay < 0 && period < 0 && !bpf_protocol) {
+		if (show_sysfs_attribs(&rc_dev, devclass))
+			return -1;
+
+		return 0;
+	}
+
+	if (!devclass)
+		devclass = "rc0";
+
+	if (cfg.next && (clear || keytable || ch_proto)) {
+		fprintf (stderr, _("Auto-mode can be used only with --read, --verbose and --sysdev options\n"));
+		return -1;
+	}
+
+	if (all_devices)
+		return load_all_devices();
+
+	names = find_device(devclass);
+	if (!names)
+		return -1;
+	rc = prepare_device(&rc_dev, names->name);
+	if (rc < 0) {
+		free_names(names);
+		return -1;
+	}
+	names->name = NULL;
+	free_names(names);
+	if (rc)
+		return 0;
+
+	return apply_device(&rc_dev);
+}
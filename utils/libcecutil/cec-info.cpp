@@ -18,28 +18,47 @@
 
 #include "cec-msgs-gen.h"
 
+/*
+ * Opcodes are a single byte, so the generated tables are turned into
+ * direct-indexed 256 entry lookup tables the first time they are used.
+ * This keeps the name lookups O(1) when logging a busy bus.
+ */
+struct opcode_names {
+	const char *names[256];
+
+	template <size_t N>
+	explicit opcode_names(const struct msgtable (&table)[N]) : names()
+	{
+		// Walk backwards so the first entry wins, as the linear scan did
+		for (size_t i = N; i--; )
+			names[table[i].opcode] = table[i].name;
+	}
+
+	const char *lookup(unsigned opcode) const
+	{
+		return opcode < 256 ? names[opcode] : NULL;
+	}
+};
+
 const char *cec_opcode2s(unsigned opcode)
 {
-	for (auto i : msgtable)
-		if (i.opcode == opcode)
-			return i.name;
-	return NULL;
+	static const opcode_names map(msgtable);
+
+	return map.lookup(opcode);
 }
 
 const char *cec_cdc_opcode2s(unsigned cdc_opcode)
 {
-	for (auto i : cdcmsgtable)
-		if (i.opcode == cdc_opcode)
-			return i.name;
-	return NULL;
+	static const opcode_names map(cdcmsgtable);
+
+	return map.lookup(cdc_opcode);
 }
 
 const char *cec_htng_opcode2s(unsigned htng_opcode)
 {
-	for (auto i : htngmsgtable)
-		if (i.opcode == htng_opcode)
-			return i.name;
-	return NULL;
+	static const opcode_names map(htngmsgtable);
+
+	return map.lookup(htng_opcode);
 }
 
 static std::string caps2s(unsigned caps)
@@ -316,78 +335,90 @@ std::string cec_dev_feat2s(unsigned feat, const std::string &prefix)
 	return s;
 }
 
-static std::string tx_status2s(const struct cec_msg &msg)
+static unsigned status_add(char *buf, unsigned size, unsigned pos,
+			   const char *str, unsigned cnt = 0)
+{
+	int n;
+
+	if (pos >= size)
+		return pos;
+	if (cnt)
+		n = snprintf(buf + pos, size - pos, "%s%s (%u)",
+			     pos ? ", " : "", str, cnt);
+	else
+		n = snprintf(buf + pos, size - pos, "%s%s",
+			     pos ? ", " : "", str);
+	return n < 0 ? pos : pos + n;
+}
+
+static unsigned tx_status2s(const struct cec_msg &msg, char *buf,
+			    unsigned size, unsigned pos)
 {
-	std::string s;
-	char num[4];
 	unsigned stat = msg.tx_status;
 
 	if (stat)
-		s += "Tx";
+		pos = status_add(buf, size, pos, "Tx");
 	if (stat & CEC_TX_STATUS_OK)
-		s += ", OK";
-	if (stat & CEC_TX_STATUS_ARB_LOST) {
-		sprintf(num, "%u", msg.tx_arb_lost_cnt);
-		s += ", Arbitration Lost";
-		if (msg.tx_arb_lost_cnt)
-			s += " (" + std::string(num) + ")";
-	}
-	if (stat & CEC_TX_STATUS_NACK) {
-		sprintf(num, "%u", msg.tx_nack_cnt);
-		s += ", Not Acknowledged";
-		if (msg.tx_nack_cnt)
-			s += " (" + std::string(num) + ")";
-	}
-	if (stat & CEC_TX_STATUS_LOW_DRIVE) {
-		sprintf(num, "%u", msg.tx_low_drive_cnt);
-		s += ", Low Drive";
-		if (msg.tx_low_drive_cnt)
-			s += " (" + std::string(num) + ")";
-	}
-	if (stat & CEC_TX_STATUS_ERROR) {
-		sprintf(num, "%u", msg.tx_error_cnt);
-		s += ", Error";
-		if (msg.tx_error_cnt)
-			s += " (" + std::string(num) + ")";
-	}
+		pos = status_add(buf, size, pos, "OK");
+	if (stat & CEC_TX_STATUS_ARB_LOST)
+		pos = status_add(buf, size, pos, "Arbitration Lost",
+				 msg.tx_arb_lost_cnt);
+	if (stat & CEC_TX_STATUS_NACK)
+		pos = status_add(buf, size, pos, "Not Acknowledged",
+				 msg.tx_nack_cnt);
+	if (stat & CEC_TX_STATUS_LOW_DRIVE)
+		pos = status_add(buf, size, pos, "Low Drive",
+				 msg.tx_low_drive_cnt);
+	if (stat & CEC_TX_STATUS_ERROR)
+		pos = status_add(buf, size, pos, "Error", msg.tx_error_cnt);
 	if (stat & CEC_TX_STATUS_ABORTED)
-		s += ", Aborted";
+		pos = status_add(buf, size, pos, "Aborted");
 	if (stat & CEC_TX_STATUS_TIMEOUT)
-		s += ", Timeout";
+		pos = status_add(buf, size, pos, "Timeout");
 	if (stat & CEC_TX_STATUS_MAX_RETRIES)
-		s += ", Max Retries";
-	return s;
+		pos = status_add(buf, size, pos, "Max Retries");
+	return pos;
 }
 
-static std::string rx_status2s(unsigned stat)
+static unsigned rx_status2s(unsigned stat, char *buf,
+			    unsigned size, unsigned pos)
 {
-	std::string s;
-
 	if (stat)
-		s += "Rx";
+		pos = status_add(buf, size, pos, "Rx");
 	if (stat & CEC_RX_STATUS_OK)
-		s += ", OK";
+		pos = status_add(buf, size, pos, "OK");
 	if (stat & CEC_RX_STATUS_TIMEOUT)
-		s += ", Timeout";
+		pos = status_add(buf, size, pos, "Timeout");
 	if (stat & CEC_RX_STATUS_FEATURE_ABORT)
-		s += ", Feature Abort";
+		pos = status_add(buf, size, pos, "Feature Abort");
 	if (stat & CEC_RX_STATUS_ABORTED)
-		s += ", Aborted";
-	return s;
+		pos = status_add(buf, size, pos, "Aborted");
+	return pos;
 }
 
-std::string cec_status2s(const struct cec_msg &msg)
+/*
+ * Format the tx/rx status of msg into the caller supplied buffer without
+ * any heap allocations. The result is truncated if it does not fit.
+ */
+const char *cec_status2s(const struct cec_msg &msg, char *buf, unsigned size)
 {
-	std::string s;
+	unsigned pos = 0;
 
+	if (!size)
+		return buf;
+	buf[0] = 0;
 	if (msg.tx_status)
-		s = tx_status2s(msg);
-	if (msg.rx_status) {
-		if (!s.empty())
-			s += ", ";
-		s += rx_status2s(msg.rx_status);
-	}
-	return s;
+		pos = tx_status2s(msg, buf, size, pos);
+	if (msg.rx_status)
+		rx_status2s(msg.rx_status, buf, size, pos);
+	return buf;
+}
+
+std::string cec_status2s(const struct cec_msg &msg)
+{
+	char buf[CEC_STATUS_STR_SIZE];
+
+	return cec_status2s(msg, buf, sizeof(buf));
 }
 
 void cec_driver_info(const struct cec_caps &caps,
@@ -26,6 +26,10 @@ std::string cec_rc_src_prof2s(unsigned prof, const std::string &prefix);
 std::string cec_dev_feat2s(unsigned feat, const std::string &prefix);
 std::string cec_status2s(const struct cec_msg &msg);
 
+/* Large enough for every tx and rx status flag and counter */
+#define CEC_STATUS_STR_SIZE 192
+const char *cec_status2s(const struct cec_msg &msg, char *buf, unsigned size);
+
 void cec_driver_info(const struct cec_caps &caps,
 		     const struct cec_log_addrs &laddrs, __u16 phys_addr,
 		     const struct cec_connector_info &conn_info);
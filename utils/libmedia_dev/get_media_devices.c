@@ -17,6 +17,8 @@
    02110-1335 USA.
  */
 
+#include <config.h>
+
 #include <stdio.h>
 #include <unistd.h>
 #include <sys/types.h>
@@ -28,6 +30,10 @@
 #include <limits.h>
 #include "get_media_devices.h"
 
+#ifdef HAVE_LIBUDEV
+#include <libudev.h>
+#endif
+
 #define ARRAY_SIZE(arr) (sizeof(arr) / sizeof((arr)[0]))
 
 /**
@@ -37,11 +43,15 @@
  *			PCI devices are like: pci0000:00/0000:00:1b.0
  *			USB devices are like: pci0000:00/0000:00:1d.7/usb1/1-8
  * @node:		Device node, in sysfs or alsa hw identifier
+ * @sysname:		Name of the node in /sys/class/<class>
+ * @class:		sysfs class of the node
  * @device_type:	Type of the device (V4L_*, DVB_*, SND_*)
  */
 struct media_device_entry {
 	char *device;
 	char *node;
+	char *sysname;
+	const char *class;
 	enum device_type type;
 	enum bus_type bus;
 	unsigned major, minor;		/* Device major/minor */
@@ -55,14 +65,35 @@ struct media_device_entry {
  *			USB devices are like: pci0000:00/0000:00:1d.7/usb1/1-8
  * @node:		Device node, in sysfs or alsa hw identifier
  * @device_type:	Type of the device (V4L_*, DVB_*, SND_*)
+ * @udev:		udev context, for a cache created by
+ *			media_devices_cache_new()
+ * @mon:		udev monitor reporting the hotplug events
  */
 struct media_devices {
 	struct media_device_entry *md_entry;
 	unsigned int md_size;
+#ifdef HAVE_LIBUDEV
+	struct udev *udev;
+	struct udev_monitor *mon;
+#endif
 };
 
 typedef int (*fill_data_t)(struct media_device_entry *md);
 
+static int add_v4l_class(struct media_device_entry *md);
+static int add_snd_class(struct media_device_entry *md);
+static int add_dvb_class(struct media_device_entry *md);
+
+/* The sysfs classes are also the udev subsystems */
+static const struct {
+	const char *class;
+	fill_data_t fill;
+} media_classes[] = {
+	{ "video4linux", add_v4l_class },
+	{ "sound", add_snd_class },
+	{ "dvb", add_dvb_class },
+};
+
 #define DEVICE_STR "devices"
 
 static void get_uevent_info(struct media_device_entry *md_ptr, char *dname)
@@ -117,24 +148,114 @@ static enum bus_type get_bus(char *device)
 	return MEDIA_BUS_UNKNOWN;
 }
 
-static int get_class(char *class,
-		     struct media_device_entry **md,
-		     unsigned int *md_size,
-		     fill_data_t fill)
+static int sort_media_device_entry(const void *a, const void *b);
+
+/*
+ * Adds the /sys/class/<class>/<name> node to the list. Returns 0 if the
+ * node was added or isn't a media device node, and -2 on errors.
+ */
+static int add_class_node(struct media_devices *md, unsigned int class_idx,
+			  const char *name)
 {
-	DIR		*dir;
-	struct dirent	*entry;
+	const char	*class = media_classes[class_idx].class;
 	char		dname[PATH_MAX];
-	char		fname[PATH_MAX + sizeof(entry->d_name)];
+	char		fname[PATH_MAX + NAME_MAX + 1];
 	char		link[PATH_MAX];
 	char		virt_dev[60];
-	int		err = -2;
-	struct		media_device_entry *md_ptr = NULL;
+	struct		media_device_entry *md_entry, *md_ptr;
 	char		*p, *device;
 	enum bus_type	bus;
 	static int	virtual = 0;
 
 	snprintf(dname, PATH_MAX, "/sys/class/%s", class);
+
+	/* Canonicalize the device name */
+	snprintf(fname, sizeof(fname), "%s/%s", dname, name);
+	if (!realpath(fname, link))
+		return 0;
+
+	device = link;
+
+	/* Remove the subsystem/class_name from the string */
+	p = strstr(device, class);
+	if (!p)
+		return 0;
+	*(p - 1) = '\0';
+
+	bus = get_bus(device);
+
+	/* remove the /sys/devices/ from the name */
+	device += 13;
+
+	switch (bus) {
+	case MEDIA_BUS_PCI:
+		/* Remove the device function nr */
+		p = strrchr(device, '.');
+		if (!p)
+			return 0;
+		*p = '\0';
+		break;
+	case MEDIA_BUS_USB:
+		/* Remove USB interface from the path */
+		p = strrchr(device, '/');
+		if (!p)
+			return 0;
+		/* In case we have a device where the driver
+		   attaches directly to the usb device rather
+		   then to an interface */
+		if (!strchr(p, ':'))
+			break;
+		*p = '\0';
+		break;
+	case MEDIA_BUS_VIRTUAL:
+		/* Don't group virtual devices */
+		sprintf(virt_dev, "virtual%d", virtual++);
+		device = virt_dev;
+		break;
+	case MEDIA_BUS_UNKNOWN:
+		break;
+	}
+
+	/* Add one more element to the devices struct */
+	md_entry = realloc(md->md_entry, (md->md_size + 1) * sizeof(*md_ptr));
+	if (!md_entry)
+		return -2;
+	md->md_entry = md_entry;
+	md_ptr = md_entry + md->md_size;
+
+	/* Cleans previous data and fills it with device/node */
+	memset(md_ptr, 0, sizeof(*md_ptr));
+	md_ptr->type = UNKNOWN;
+	md_ptr->class = class;
+	md_ptr->device = strdup(device);
+	md_ptr->node = strdup(name);
+	md_ptr->sysname = strdup(name);
+	if (!md_ptr->device || !md_ptr->node || !md_ptr->sysname) {
+		free(md_ptr->device);
+		free(md_ptr->node);
+		free(md_ptr->sysname);
+		return -2;
+	}
+	md->md_size++;
+
+	/* Retrieve major and minor information */
+	get_uevent_info(md_ptr, dname);
+
+	/* Used to identify the type of node */
+	media_classes[class_idx].fill(md_ptr);
+
+	return 0;
+}
+
+static int get_class(struct media_devices *md, unsigned int class_idx)
+{
+	DIR		*dir;
+	struct dirent	*entry;
+	char		dname[PATH_MAX];
+	int		err = 0;
+
+	snprintf(dname, PATH_MAX, "/sys/class/%s",
+		 media_classes[class_idx].class);
 	dir = opendir(dname);
 	if (!dir) {
 		return 0;
@@ -143,75 +264,44 @@ static int get_class(char *class,
 		/* Skip . and .. */
 		if (entry->d_name[0] == '.')
 			continue;
-		/* Canonicalize the device name */
-		snprintf(fname, sizeof(fname), "%s/%s", dname, entry->d_name);
-		if (realpath(fname, link)) {
-			device = link;
-
-			/* Remove the subsystem/class_name from the string */
-			p = strstr(device, class);
-			if (!p)
-				continue;
-			*(p - 1) = '\0';
-
-			bus = get_bus(device);
+		err = add_class_node(md, class_idx, entry->d_name);
+		if (err)
+			break;
+	}
+	closedir(dir);
+	return err;
+}
 
-			/* remove the /sys/devices/ from the name */
-			device += 13;
+static int scan_media_devices(struct media_devices *md)
+{
+	unsigned int i;
 
-			switch (bus) {
-			case MEDIA_BUS_PCI:
-				/* Remove the device function nr */
-				p = strrchr(device, '.');
-				if (!p)
-					continue;
-				*p = '\0';
-				break;
-			case MEDIA_BUS_USB:
-				/* Remove USB interface from the path */
-				p = strrchr(device, '/');
-				if (!p)
-					continue;
-				/* In case we have a device where the driver
-				   attaches directly to the usb device rather
-				   then to an interface */
-				if (!strchr(p, ':'))
-					break;
-				*p = '\0';
-				break;
-			case MEDIA_BUS_VIRTUAL:
-				/* Don't group virtual devices */
-				sprintf(virt_dev, "virtual%d", virtual++);
-				device = virt_dev;
-				break;
-			case MEDIA_BUS_UNKNOWN:
-				break;
-			}
+	for (i = 0; i < ARRAY_SIZE(media_classes); i++) {
+		if (get_class(md, i))
+			return -2;
+	}
 
-			/* Add one more element to the devices struct */
-			*md = realloc(*md, (*md_size + 1) * sizeof(*md_ptr));
-			if (!*md)
-				goto error;
-			md_ptr = (*md) + *md_size;
-			(*md_size)++;
+	if (md->md_entry)
+		qsort(md->md_entry, md->md_size, sizeof(*md->md_entry),
+		      sort_media_device_entry);
 
-			/* Cleans previous data and fills it with device/node */
-			memset(md_ptr, 0, sizeof(*md_ptr));
-			md_ptr->type = UNKNOWN;
-			md_ptr->device = strdup(device);
-			md_ptr->node = strdup(entry->d_name);
+	return 0;
+}
 
-			/* Retrieve major and minor information */
-			get_uevent_info(md_ptr, dname);
+static void free_media_device_entries(struct media_devices *md)
+{
+	struct media_device_entry *md_ptr = md->md_entry;
+	int i;
 
-			/* Used to identify the type of node */
-			fill(md_ptr);
-		}
+	for (i = 0; i < md->md_size; i++) {
+		free(md_ptr->node);
+		free(md_ptr->device);
+		free(md_ptr->sysname);
+		md_ptr++;
 	}
-	err = 0;
-error:
-	closedir(dir);
-	return err;
+	free(md->md_entry);
+	md->md_entry = NULL;
+	md->md_size = 0;
 }
 
 static int add_v4l_class(struct media_device_entry *md)
@@ -317,47 +407,154 @@ static int sort_media_device_entry(const void *a, const void *b)
 }
 
 
-/* Public functions */
+#ifdef HAVE_LIBUDEV
 
-void free_media_devices(void *opaque)
+static void remove_class_node(struct media_devices *md, const char *class,
+			      const char *name)
 {
-	struct media_devices *md = opaque;
 	struct media_device_entry *md_ptr = md->md_entry;
-	int i;
-	for (i = 0; i < md->md_size; i++) {
+	unsigned int i;
+
+	for (i = 0; i < md->md_size; i++, md_ptr++) {
+		if (strcmp(md_ptr->class, class) ||
+		    strcmp(md_ptr->sysname, name))
+			continue;
+
 		free(md_ptr->node);
 		free(md_ptr->device);
-		md_ptr++;
+		free(md_ptr->sysname);
+		memmove(md_ptr, md_ptr + 1,
+			(md->md_size - i - 1) * sizeof(*md_ptr));
+		md->md_size--;
+		return;
 	}
-	free(md->md_entry);
+}
+
+/* Moves the last entry, just added by add_class_node(), to its sorted place */
+static void sort_last_node(struct media_devices *md)
+{
+	struct media_device_entry new_entry = md->md_entry[md->md_size - 1];
+	unsigned int lo = 0, hi = md->md_size - 1, mid;
+
+	while (lo < hi) {
+		mid = (lo + hi) / 2;
+		if (sort_media_device_entry(&md->md_entry[mid], &new_entry) <= 0)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	memmove(&md->md_entry[lo + 1], &md->md_entry[lo],
+		(md->md_size - 1 - lo) * sizeof(new_entry));
+	md->md_entry[lo] = new_entry;
+}
+
+static int handle_udev_event(struct media_devices *md, struct udev_device *dev)
+{
+	const char *action = udev_device_get_action(dev);
+	const char *subsystem = udev_device_get_subsystem(dev);
+	const char *name = udev_device_get_sysname(dev);
+	unsigned int size = md->md_size;
+	unsigned int i;
+
+	if (!action || !subsystem || !name)
+		return 0;
+
+	for (i = 0; i < ARRAY_SIZE(media_classes); i++) {
+		if (!strcmp(subsystem, media_classes[i].class))
+			break;
+	}
+	if (i == ARRAY_SIZE(media_classes))
+		return 0;
+
+	if (!strcmp(action, "add")) {
+		/*
+		 * The node may already be known, if it was added between the
+		 * monitor creation and the sysfs scan.
+		 */
+		remove_class_node(md, media_classes[i].class, name);
+		if (add_class_node(md, i, name))
+			return -2;
+		if (md->md_size > size)
+			sort_last_node(md);
+		return 1;
+	}
+
+	if (!strcmp(action, "remove")) {
+		remove_class_node(md, media_classes[i].class, name);
+		return md->md_size != size;
+	}
+
+	return 0;
+}
+
+static void close_udev_monitor(struct media_devices *md)
+{
+	if (md->mon)
+		udev_monitor_unref(md->mon);
+	if (md->udev)
+		udev_unref(md->udev);
+	md->mon = NULL;
+	md->udev = NULL;
+}
+
+static void open_udev_monitor(struct media_devices *md)
+{
+	unsigned int i;
+
+	md->udev = udev_new();
+	if (!md->udev)
+		return;
+
+	md->mon = udev_monitor_new_from_netlink(md->udev, "udev");
+	if (!md->mon)
+		goto error;
+
+	for (i = 0; i < ARRAY_SIZE(media_classes); i++) {
+		if (udev_monitor_filter_add_match_subsystem_devtype(md->mon,
+						media_classes[i].class, NULL) < 0)
+			goto error;
+	}
+
+	if (udev_monitor_enable_receiving(md->mon) < 0)
+		goto error;
+
+	return;
+
+error:
+	close_udev_monitor(md);
+}
+
+#endif
+
+/* Public functions */
+
+void free_media_devices(void *opaque)
+{
+	struct media_devices *md = opaque;
+
+	free_media_device_entries(md);
+#ifdef HAVE_LIBUDEV
+	close_udev_monitor(md);
+#endif
 	free(md);
 }
 
 void *discover_media_devices(void)
 {
 	struct media_devices *md = NULL;
-	struct media_device_entry *md_entry = NULL;
 
 	md = calloc(1, sizeof(*md));
 	if (!md)
 		return NULL;
 
-	md->md_size = 0;
-	if (get_class("video4linux", &md_entry, &md->md_size, add_v4l_class))
-		goto error;
-	if (get_class("sound", &md_entry, &md->md_size, add_snd_class))
-		goto error;
-	if (get_class("dvb", &md_entry, &md->md_size, add_dvb_class))
+	if (scan_media_devices(md))
 		goto error;
 
 	/* There's no media device */
-	if (!md_entry)
+	if (!md->md_entry)
 		goto error;
 
-	qsort(md_entry, md->md_size, sizeof(*md_entry), sort_media_device_entry);
-
-	md->md_entry = md_entry;
-
 	return md;
 
 error:
@@ -365,6 +562,72 @@ error:
 	return NULL;
 }
 
+void *media_devices_cache_new(void)
+{
+	struct media_devices *md;
+
+	md = calloc(1, sizeof(*md));
+	if (!md)
+		return NULL;
+
+#ifdef HAVE_LIBUDEV
+	/*
+	 * Start listening before scanning sysfs, so that no node added or
+	 * removed in between gets lost.
+	 */
+	open_udev_monitor(md);
+#endif
+
+	if (scan_media_devices(md)) {
+		free_media_devices(md);
+		return NULL;
+	}
+
+	return md;
+}
+
+int media_devices_cache_get_fd(void *opaque)
+{
+#ifdef HAVE_LIBUDEV
+	struct media_devices *md = opaque;
+
+	if (md->mon)
+		return udev_monitor_get_fd(md->mon);
+#endif
+	return -1;
+}
+
+int media_devices_cache_update(void *opaque)
+{
+	struct media_devices *md = opaque;
+	int changed = 0;
+
+#ifdef HAVE_LIBUDEV
+	if (md->mon) {
+		struct udev_device *dev;
+		int ret;
+
+		/* The monitor socket is non-blocking */
+		while ((dev = udev_monitor_receive_device(md->mon))) {
+			ret = handle_udev_event(md, dev);
+			udev_device_unref(dev);
+			if (ret < 0)
+				return ret;
+			if (ret > 0)
+				changed = 1;
+		}
+		return changed;
+	}
+#endif
+
+	/* No hotplug notification, rescan everything */
+	free_media_device_entries(md);
+	if (scan_media_devices(md))
+		return -2;
+
+	return 1;
+}
+
 const char *media_device_type(enum device_type type)
 {
 	switch(type) {
@@ -20,7 +20,7 @@
 /*
  * Version of the API
  */
-#define GET_MEDIA_DEVICES_VERSION	0x0105
+#define GET_MEDIA_DEVICES_VERSION	0x0106
 
 /**
  * enum device_type - Enumerates the type for each device
@@ -82,6 +82,40 @@ enum bus_type {
  */
 void *discover_media_devices(void);
 
+/**
+ * media_devices_cache_new() - Returns a list of media devices kept up to date
+ *
+ * This function works like discover_media_devices(), but also listens to
+ * the udev hotplug events, if libmedia_dev was built with udev support. The
+ * list can then be updated with media_devices_cache_update() instead of
+ * being discovered again. Unlike discover_media_devices(), it also returns a
+ * descriptor when there's no media device yet. It should be freed with
+ * free_media_devices().
+ */
+void *media_devices_cache_new(void);
+
+/**
+ * media_devices_cache_get_fd() - Returns a file descriptor for hotplug events
+ * @opaque:	media devices opaque descriptor, from media_devices_cache_new()
+ *
+ * The file descriptor becomes readable when devices were added or removed,
+ * and can be polled to know when to call media_devices_cache_update().
+ * Returns -1 if hotplug events aren't available.
+ */
+int media_devices_cache_get_fd(void *opaque);
+
+/**
+ * media_devices_cache_update() - Updates the list of media devices
+ * @opaque:	media devices opaque descriptor, from media_devices_cache_new()
+ *
+ * Applies the pending hotplug events to the list, without blocking. If
+ * hotplug events aren't available, sysfs is scanned again. Returns 1 if the
+ * list may have changed, 0 if not, and a negative value on errors.
+ * Node names returned by the lookup functions before the update may no
+ * longer be valid afterwards.
+ */
+int media_devices_cache_update(void *opaque);
+
 /**
  * free_media_devices() - Frees the media devices array
  *
@@ -30,6 +30,7 @@
 #include <errno.h>
 #include <fcntl.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -66,21 +67,135 @@ struct media_pad *media_entity_remote_source(struct media_pad *pad)
 	return NULL;
 }
 
-struct media_entity *media_get_entity_by_name(struct media_device *media,
-					      const char *name)
+/* -----------------------------------------------------------------------------
+ * Entity lookup
+ */
+
+static void media_index_free(struct media_device *media)
+{
+	free(media->index.by_id);
+	free(media->index.by_name);
+	memset(&media->index, 0, sizeof(media->index));
+}
+
+static unsigned int media_index_hash(const char *name, size_t len)
 {
+	unsigned int hash = 2166136261u;
+
+	while (len-- && *name)
+		hash = (hash ^ (unsigned char)*name++) * 16777619u;
+
+	return hash;
+}
+
+/*
+ * Build the lookup tables. On allocation failure the index is left invalid
+ * and lookups fall back to linear searches.
+ */
+static void media_index_build(struct media_device *media)
+{
+	unsigned int max_id = 0;
+	unsigned int size;
 	unsigned int i;
 
+	media_index_free(media);
+
+	for (i = 0; i < media->entities_count; ++i) {
+		if (media->entities[i].info.id > max_id)
+			max_id = media->entities[i].info.id;
+	}
+
+	/* Don't waste memory on a direct table if IDs are sparse. */
+	if (max_id < 4 * media->entities_count + 64) {
+		media->index.by_id = calloc(max_id + 1,
+					    sizeof(*media->index.by_id));
+		if (media->index.by_id == NULL)
+			return;
+		media->index.max_id = max_id;
+
+		for (i = 0; i < media->entities_count; ++i) {
+			struct media_entity *entity = &media->entities[i];
+
+			if (media->index.by_id[entity->info.id] == NULL)
+				media->index.by_id[entity->info.id] = entity;
+		}
+	}
+
+	/* Keep the hash table at most half full. */
+	for (size = 16; size < 2 * media->entities_count; size <<= 1);
+
+	media->index.by_name = calloc(size, sizeof(*media->index.by_name));
+	if (media->index.by_name == NULL) {
+		media_index_free(media);
+		return;
+	}
+	media->index.by_name_mask = size - 1;
+
 	for (i = 0; i < media->entities_count; ++i) {
 		struct media_entity *entity = &media->entities[i];
+		const char *name = entity->info.name;
+		unsigned int slot;
+
+		slot = media_index_hash(name, sizeof(entity->info.name));
 
-		if (strcmp(entity->info.name, name) == 0)
+		/* Names should be unique, keep the first entity otherwise. */
+		for (slot &= size - 1; media->index.by_name[slot];
+		     slot = (slot + 1) & (size - 1)) {
+			if (strncmp(media->index.by_name[slot]->info.name, name,
+				    sizeof(entity->info.name)) == 0)
+				break;
+		}
+
+		if (media->index.by_name[slot] == NULL)
+			media->index.by_name[slot] = entity;
+	}
+
+	media->index.valid = true;
+}
+
+static struct media_entity *
+media_get_entity_by_name_len(struct media_device *media, const char *name,
+			     size_t len)
+{
+	unsigned int i;
+
+	if (!media->index.valid)
+		media_index_build(media);
+
+	if (media->index.valid) {
+		unsigned int mask = media->index.by_name_mask;
+		unsigned int slot = media_index_hash(name, len) & mask;
+		struct media_entity *entity;
+
+		for (; (entity = media->index.by_name[slot]) != NULL;
+		     slot = (slot + 1) & mask) {
+			if (strncmp(entity->info.name, name, len) == 0 &&
+			    (len >= sizeof(entity->info.name) ||
+			     entity->info.name[len] == '\0'))
+				return entity;
+		}
+
+		return NULL;
+	}
+
+	for (i = 0; i < media->entities_count; ++i) {
+		struct media_entity *entity = &media->entities[i];
+
+		if (strncmp(entity->info.name, name, len) == 0 &&
+		    (len >= sizeof(entity->info.name) ||
+		     entity->info.name[len] == '\0'))
 			return entity;
 	}
 
 	return NULL;
 }
 
+struct media_entity *media_get_entity_by_name(struct media_device *media,
+					      const char *name)
+{
+	return media_get_entity_by_name_len(media, name, strlen(name));
+}
+
 struct media_entity *media_get_entity_by_id(struct media_device *media,
 					    __u32 id)
 {
@@ -89,6 +204,22 @@ struct media_entity *media_get_entity_by_id(struct media_device *media,
 
 	id &= ~MEDIA_ENT_ID_FLAG_NEXT;
 
+	if (!media->index.valid)
+		media_index_build(media);
+
+	if (media->index.valid && media->index.by_id) {
+		if (!next)
+			return id <= media->index.max_id
+			     ? media->index.by_id[id] : NULL;
+
+		for (i = id + 1; i <= media->index.max_id; ++i) {
+			if (media->index.by_id[i])
+				return media->index.by_id[i];
+		}
+
+		return NULL;
+	}
+
 	for (i = 0; i < media->entities_count; ++i) {
 		struct media_entity *entity = &media->entities[i];
 
@@ -134,8 +265,15 @@ const struct media_link *media_entity_get_link(struct media_entity *entity, unsi
 	return &entity->links[index];
 }
 
+static void media_entity_lookup_devname(struct media_entity *entity);
+
 const char *media_entity_get_devname(struct media_entity *entity)
 {
+	if (!entity->devname_looked_up) {
+		entity->devname_looked_up = true;
+		media_entity_lookup_devname(entity);
+	}
+
 	return entity->devname[0] ? entity->devname : NULL;
 }
 
@@ -501,18 +639,335 @@ static int media_get_devname_sysfs(struct media_entity *entity)
 	return 0;
 }
 
+/* Find the device name of an entity, called on first use of the name as
+ * this takes a udev or sysfs lookup per entity.
+ */
+static void media_entity_lookup_devname(struct media_entity *entity)
+{
+	struct udev *udev;
+
+	if (media_entity_type(entity) != MEDIA_ENT_T_DEVNODE &&
+	    media_entity_type(entity) != MEDIA_ENT_T_V4L2_SUBDEV)
+		return;
+
+	/* Don't try to parse empty major,minor */
+	if (!entity->info.dev.major && !entity->info.dev.minor)
+		return;
+
+	if (media_udev_open(&udev) < 0)
+		media_dbg(entity->media, "Can't get udev context\n");
+
+	/* Try to get the device name via udev, fall back to sysfs */
+	if (media_get_devname_udev(udev, entity))
+		media_get_devname_sysfs(entity);
+
+	media_udev_close(udev);
+}
+
+static void media_entity_set_default(struct media_device *media,
+				     struct media_entity *entity)
+{
+	if (!(entity->info.flags & MEDIA_ENT_FL_DEFAULT))
+		return;
+
+	switch (entity->info.type) {
+	case MEDIA_ENT_T_DEVNODE_V4L:
+		media->def.v4l = entity;
+		break;
+	case MEDIA_ENT_T_DEVNODE_FB:
+		media->def.fb = entity;
+		break;
+	case MEDIA_ENT_T_DEVNODE_ALSA:
+		media->def.alsa = entity;
+		break;
+	case MEDIA_ENT_T_DEVNODE_DVB:
+		media->def.dvb = entity;
+		break;
+	}
+}
+
+static void media_free_entities(struct media_device *media)
+{
+	unsigned int i;
+
+	for (i = 0; i < media->entities_count; ++i) {
+		struct media_entity *entity = &media->entities[i];
+
+		free(entity->pads);
+		free(entity->links);
+		free(entity->pad_state);
+		if (entity->fd != -1)
+			close(entity->fd);
+	}
+
+	free(media->entities);
+	media->entities = NULL;
+	media->entities_count = 0;
+	memset(&media->def, 0, sizeof(media->def));
+	media_index_free(media);
+}
+
+static int media_topology_entity_cmp(const void *a, const void *b)
+{
+	const struct media_entity *ea = a, *eb = b;
+
+	return ea->info.id < eb->info.id ? -1 : ea->info.id > eb->info.id;
+}
+
+static const struct media_v2_pad *
+media_topology_find_pad(const struct media_v2_topology *topo, __u32 id)
+{
+	const struct media_v2_pad *pads =
+		(const struct media_v2_pad *)(uintptr_t)topo->ptr_pads;
+	unsigned int i;
+
+	for (i = 0; i < topo->num_pads; ++i)
+		if (pads[i].id == id)
+			return &pads[i];
+
+	return NULL;
+}
+
+static const struct media_v2_interface *
+media_topology_find_interface(const struct media_v2_topology *topo, __u32 id)
+{
+	const struct media_v2_interface *intfs =
+		(const struct media_v2_interface *)(uintptr_t)topo->ptr_interfaces;
+	unsigned int i;
+
+	for (i = 0; i < topo->num_interfaces; ++i)
+		if (intfs[i].id == id)
+			return &intfs[i];
+
+	return NULL;
+}
+
+/* Fetch the whole graph with MEDIA_IOC_G_TOPOLOGY, once to get the number of
+ * objects and once to get the objects themselves, and build the entities,
+ * pads and links from that.
+ */
+static int media_get_topology(struct media_device *media,
+			      struct media_v2_topology *topo, void **buf)
+{
+	unsigned int retries;
+
+	for (retries = 0; retries < 5; retries++) {
+		size_t size;
+		char *p;
+
+		memset(topo, 0, sizeof(*topo));
+		if (ioctl(media->fd, MEDIA_IOC_G_TOPOLOGY, topo) < 0)
+			return -errno;
+
+		size = topo->num_entities * sizeof(struct media_v2_entity) +
+		       topo->num_interfaces * sizeof(struct media_v2_interface) +
+		       topo->num_pads * sizeof(struct media_v2_pad) +
+		       topo->num_links * sizeof(struct media_v2_link);
+		p = *buf = malloc(size ? size : 1);
+		if (p == NULL)
+			return -ENOMEM;
+
+		topo->ptr_entities = (uintptr_t)p;
+		p += topo->num_entities * sizeof(struct media_v2_entity);
+		topo->ptr_interfaces = (uintptr_t)p;
+		p += topo->num_interfaces * sizeof(struct media_v2_interface);
+		topo->ptr_pads = (uintptr_t)p;
+		p += topo->num_pads * sizeof(struct media_v2_pad);
+		topo->ptr_links = (uintptr_t)p;
+
+		if (ioctl(media->fd, MEDIA_IOC_G_TOPOLOGY, topo) == 0)
+			return 0;
+
+		free(*buf);
+		*buf = NULL;
+		/* The graph grew in between, try again */
+		if (errno != ENOSPC)
+			return -errno;
+	}
+
+	return -EAGAIN;
+}
+
+static int media_enum_topology(struct media_device *media)
+{
+	const struct media_v2_entity *ents;
+	const struct media_v2_pad *pads;
+	const struct media_v2_link *links;
+	struct media_v2_topology topo;
+	unsigned int i;
+	void *buf;
+	int ret;
+
+	ret = media_get_topology(media, &topo, &buf);
+	if (ret < 0)
+		return ret;
+
+	ents = (const struct media_v2_entity *)(uintptr_t)topo.ptr_entities;
+	pads = (const struct media_v2_pad *)(uintptr_t)topo.ptr_pads;
+	links = (const struct media_v2_link *)(uintptr_t)topo.ptr_links;
+
+	media->entities = calloc(topo.num_entities ? topo.num_entities : 1,
+				 sizeof(*media->entities));
+	if (media->entities == NULL) {
+		ret = -ENOMEM;
+		goto done;
+	}
+
+	for (i = 0; i < topo.num_entities; ++i) {
+		struct media_entity *entity = &media->entities[i];
+
+		entity->fd = -1;
+		entity->media = media;
+		entity->info.id = ents[i].id;
+		entity->info.type = ents[i].function;
+		entity->info.flags = ents[i].flags;
+		strncpy(entity->info.name, ents[i].name,
+			sizeof(entity->info.name) - 1);
+	}
+	media->entities_count = topo.num_entities;
+
+	/* Lookups by id (and MEDIA_ENT_ID_FLAG_NEXT) rely on the order */
+	qsort(media->entities, media->entities_count,
+	      sizeof(*media->entities), media_topology_entity_cmp);
+
+	for (i = 0; i < topo.num_pads; ++i) {
+		struct media_entity *entity =
+			media_get_entity_by_id(media, pads[i].entity_id);
+
+		if (entity)
+			entity->info.pads++;
+	}
+
+	/* Count the data links, and get the device node numbers and whether
+	 * an entity is a subdev from the interface links.
+	 */
+	for (i = 0; i < topo.num_links; ++i) {
+		const struct media_v2_pad *source, *sink;
+		const struct media_v2_interface *intf;
+		struct media_entity *entity;
+
+		switch (links[i].flags & MEDIA_LNK_FL_LINK_TYPE) {
+		case MEDIA_LNK_FL_DATA_LINK:
+			source = media_topology_find_pad(&topo, links[i].source_id);
+			sink = media_topology_find_pad(&topo, links[i].sink_id);
+			if (source == NULL || sink == NULL)
+				break;
+
+			entity = media_get_entity_by_id(media, source->entity_id);
+			if (entity) {
+				entity->info.links++;
+				entity->max_links++;
+			}
+			entity = media_get_entity_by_id(media, sink->entity_id);
+			if (entity)
+				entity->max_links++;
+			break;
+
+		case MEDIA_LNK_FL_INTERFACE_LINK:
+			intf = media_topology_find_interface(&topo,
+							     links[i].source_id);
+			entity = media_get_entity_by_id(media, links[i].sink_id);
+			if (intf == NULL || entity == NULL)
+				break;
+
+			entity->info.dev.major = intf->devnode.major;
+			entity->info.dev.minor = intf->devnode.minor;
+
+			/* Legacy types, as reported by ENUM_ENTITIES */
+			if (entity->info.type >= MEDIA_ENT_F_OLD_BASE &&
+			    entity->info.type <= MEDIA_ENT_F_TUNER)
+				break;
+			if (intf->intf_type == MEDIA_INTF_T_V4L_SUBDEV)
+				entity->info.type = MEDIA_ENT_F_V4L2_SUBDEV_UNKNOWN;
+			break;
+		}
+	}
+
+	for (i = 0; i < media->entities_count; ++i) {
+		struct media_entity *entity = &media->entities[i];
+
+		if (entity->info.type < MEDIA_ENT_F_OLD_BASE ||
+		    entity->info.type > MEDIA_ENT_F_TUNER)
+			entity->info.type = MEDIA_ENT_T_DEVNODE_UNKNOWN;
+
+		entity->pads = calloc(entity->info.pads ? entity->info.pads : 1,
+				      sizeof(*entity->pads));
+		entity->links = malloc((entity->max_links ? entity->max_links : 1) *
+				       sizeof(*entity->links));
+		if (entity->pads == NULL || entity->links == NULL) {
+			ret = -ENOMEM;
+			goto done;
+		}
+
+		media_entity_set_default(media, entity);
+	}
+
+	for (i = 0; i < topo.num_pads; ++i) {
+		struct media_entity *entity =
+			media_get_entity_by_id(media, pads[i].entity_id);
+
+		if (entity == NULL || pads[i].index >= entity->info.pads)
+			continue;
+
+		entity->pads[pads[i].index].entity = entity;
+		entity->pads[pads[i].index].index = pads[i].index;
+		entity->pads[pads[i].index].flags = pads[i].flags;
+	}
+
+	for (i = 0; i < topo.num_links; ++i) {
+		const struct media_v2_pad *source_pad, *sink_pad;
+		struct media_entity *source, *sink;
+		struct media_link *fwdlink;
+		struct media_link *backlink;
+
+		if ((links[i].flags & MEDIA_LNK_FL_LINK_TYPE) !=
+		    MEDIA_LNK_FL_DATA_LINK)
+			continue;
+
+		source_pad = media_topology_find_pad(&topo, links[i].source_id);
+		sink_pad = media_topology_find_pad(&topo, links[i].sink_id);
+		source = source_pad ?
+			media_get_entity_by_id(media, source_pad->entity_id) : NULL;
+		sink = sink_pad ?
+			media_get_entity_by_id(media, sink_pad->entity_id) : NULL;
+
+		if (source == NULL || sink == NULL ||
+		    source_pad->index >= source->info.pads ||
+		    sink_pad->index >= sink->info.pads) {
+			media_dbg(media,
+				  "WARNING link %u from pad %u to pad %u is invalid!\n",
+				  links[i].id, links[i].source_id,
+				  links[i].sink_id);
+			ret = -EINVAL;
+			continue;
+		}
+
+		fwdlink = media_entity_add_link(source);
+		fwdlink->source = &source->pads[source_pad->index];
+		fwdlink->sink = &sink->pads[sink_pad->index];
+		fwdlink->flags = links[i].flags & ~MEDIA_LNK_FL_LINK_TYPE;
+
+		backlink = media_entity_add_link(sink);
+		backlink->source = &source->pads[source_pad->index];
+		backlink->sink = &sink->pads[sink_pad->index];
+		backlink->flags = links[i].flags & ~MEDIA_LNK_FL_LINK_TYPE;
+
+		fwdlink->twin = backlink;
+		backlink->twin = fwdlink;
+	}
+
+done:
+	free(buf);
+	return ret;
+}
+
 static int media_enum_entities(struct media_device *media)
 {
 	struct media_entity *entity;
-	struct udev *udev;
 	unsigned int size;
 	__u32 id;
 	int ret;
 
-	ret = media_udev_open(&udev);
-	if (ret < 0)
-		media_dbg(media, "Can't get udev context\n");
-
 	for (id = 0, ret = 0; ; id = entity->info.id) {
 		size = (media->entities_count + 1) * sizeof(*media->entities);
 		media->entities = realloc(media->entities, size);
@@ -543,42 +998,9 @@ static int media_enum_entities(struct media_device *media)
 		}
 
 		media->entities_count++;
-
-		if (entity->info.flags & MEDIA_ENT_FL_DEFAULT) {
-			switch (entity->info.type) {
-			case MEDIA_ENT_T_DEVNODE_V4L:
-				media->def.v4l = entity;
-				break;
-			case MEDIA_ENT_T_DEVNODE_FB:
-				media->def.fb = entity;
-				break;
-			case MEDIA_ENT_T_DEVNODE_ALSA:
-				media->def.alsa = entity;
-				break;
-			case MEDIA_ENT_T_DEVNODE_DVB:
-				media->def.dvb = entity;
-				break;
-			}
-		}
-
-		/* Find the corresponding device name. */
-		if (media_entity_type(entity) != MEDIA_ENT_T_DEVNODE &&
-		    media_entity_type(entity) != MEDIA_ENT_T_V4L2_SUBDEV)
-			continue;
-
-		/* Don't try to parse empty major,minor */
-		if (!entity->info.dev.major && !entity->info.dev.minor)
-			continue;
-
-		/* Try to get the device name via udev */
-		if (!media_get_devname_udev(udev, entity))
-			continue;
-
-		/* Fall back to get the device name via sysfs */
-		media_get_devname_sysfs(entity);
+		media_entity_set_default(media, entity);
 	}
 
-	media_udev_close(udev);
 	return ret;
 }
 
@@ -604,6 +1026,25 @@ int media_device_enumerate(struct media_device *media)
 		goto done;
 	}
 
+	/* Entity flags and pad indices are only reported by G_TOPOLOGY since
+	 * 4.19, use the per entity ioctls for older kernels.
+	 */
+	if (MEDIA_V2_ENTITY_HAS_FLAGS(media->info.media_version) &&
+	    MEDIA_V2_PAD_HAS_INDEX(media->info.media_version)) {
+		media_dbg(media, "Enumerating topology\n");
+
+		ret = media_enum_topology(media);
+		if (ret == 0) {
+			media_dbg(media, "Found %u entities\n",
+				  media->entities_count);
+			goto done;
+		}
+
+		media_dbg(media, "%s: Unable to get the topology (%s)\n",
+			  __func__, strerror(-ret));
+		media_free_entities(media);
+	}
+
 	media_dbg(media, "Enumerating entities\n");
 
 	ret = media_enum_entities(media);
@@ -707,22 +1148,11 @@ struct media_device *media_device_ref(struct media_device *media)
 
 void media_device_unref(struct media_device *media)
 {
-	unsigned int i;
-
 	media->refcount--;
 	if (media->refcount > 0)
 		return;
 
-	for (i = 0; i < media->entities_count; ++i) {
-		struct media_entity *entity = &media->entities[i];
-
-		free(entity->pads);
-		free(entity->links);
-		if (entity->fd != -1)
-			close(entity->fd);
-	}
-
-	free(media->entities);
+	media_free_entities(media);
 	free(media->devnode);
 	free(media);
 }
@@ -742,6 +1172,7 @@ int media_device_add_entity(struct media_device *media,
 
 	media->entities = entity;
 	media->entities_count++;
+	media_index_free(media);
 
 	entity = &media->entities[media->entities_count - 1];
 	memset(entity, 0, sizeof *entity);
@@ -750,6 +1181,7 @@ int media_device_add_entity(struct media_device *media,
 	entity->media = media;
 	strncpy(entity->devname, devnode, sizeof entity->devname);
 	entity->devname[sizeof entity->devname - 1] = '\0';
+	entity->devname_looked_up = true;
 
 	entity->info.id = 0;
 	entity->info.type = desc->type;
@@ -800,8 +1232,6 @@ struct media_entity *media_parse_entity(struct media_device *media,
 	for (; isspace(*p); ++p);
 
 	if (*p == '"' || *p == '\'') {
-		char *name;
-
 		for (end = (char *)p + 1; *end && *end != '"' && *end != '\''; ++end);
 		if (*end != '"' && *end != '\'') {
 			media_dbg(media, "missing matching '\"'\n");
@@ -809,11 +1239,7 @@ struct media_entity *media_parse_entity(struct media_device *media,
 			return NULL;
 		}
 
-		name = strndup(p + 1, end - p - 1);
-		if (!name)
-			return NULL;
-		entity = media_get_entity_by_name(media, name);
-		free(name);
+		entity = media_get_entity_by_name_len(media, p + 1, end - p - 1);
 		if (entity == NULL) {
 			media_dbg(media, "no such entity \"%.*s\"\n", end - p - 1, p + 1);
 			*endp = (char *)p + 1;
@@ -920,8 +1346,9 @@ struct media_link *media_parse_link(struct media_device *media,
 	return NULL;
 }
 
-int media_parse_setup_link(struct media_device *media,
-			   const char *p, char **endp)
+int media_parse_link_config(struct media_device *media, const char *p,
+			    struct media_link **linkp, __u32 *flagsp,
+			    char **endp)
 {
 	struct media_link *link;
 	__u32 flags;
@@ -953,6 +1380,22 @@ int media_parse_setup_link(struct media_device *media,
 	for (; isspace(*p); p++);
 	*endp = (char *)p;
 
+	*linkp = link;
+	*flagsp = flags;
+	return 0;
+}
+
+int media_parse_setup_link(struct media_device *media,
+			   const char *p, char **endp)
+{
+	struct media_link *link;
+	__u32 flags;
+	int ret;
+
+	ret = media_parse_link_config(media, p, &link, &flags, endp);
+	if (ret < 0)
+		return ret;
+
 	media_dbg(media,
 		  "Setting up link %u:%u -> %u:%u [%u]\n",
 		  link->source->entity->info.id, link->source->index,
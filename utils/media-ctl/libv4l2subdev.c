@@ -41,15 +41,25 @@
 
 int v4l2_subdev_open(struct media_entity *entity)
 {
+	const char *devname;
+
 	if (entity->fd != -1)
 		return 0;
 
-	entity->fd = open(entity->devname, O_RDWR);
+	devname = media_entity_get_devname(entity);
+	if (devname == NULL) {
+		media_dbg(entity->media,
+			  "%s: No device node for entity %s\n", __func__,
+			  entity->info.name);
+		return -ENODEV;
+	}
+
+	entity->fd = open(devname, O_RDWR);
 	if (entity->fd == -1) {
 		int ret = -errno;
 		media_dbg(entity->media,
 			  "%s: Failed to open subdev device node %s\n", __func__,
-			  entity->devname);
+			  devname);
 		return ret;
 	}
 
@@ -62,6 +72,98 @@ void v4l2_subdev_close(struct media_entity *entity)
 	entity->fd = -1;
 }
 
+/* -----------------------------------------------------------------------------
+ * Active configuration tracking
+ */
+
+/* Configuration stages, in the order the V4L2 subdev API propagates them
+ * inside an entity. Changing a stage may reset all the later ones, except
+ * for frame intervals which only depend on the settings of their own pad.
+ */
+static unsigned int v4l2_subdev_state_stage(struct media_entity *entity,
+					    unsigned int pad, unsigned int what)
+{
+	bool sink = entity->pads[pad].flags & MEDIA_PAD_FL_SINK;
+
+	switch (what) {
+	case V4L2_SUBDEV_STATE_FORMAT:
+		return sink ? 0 : 5;
+	case V4L2_SUBDEV_STATE_CROP:
+		return sink ? 1 : 3;
+	case V4L2_SUBDEV_STATE_COMPOSE:
+		return sink ? 2 : 4;
+	default:
+		return 6;
+	}
+}
+
+static struct v4l2_subdev_pad_state *
+v4l2_subdev_get_state(struct media_entity *entity, unsigned int pad)
+{
+	if (pad >= entity->info.pads)
+		return NULL;
+
+	if (entity->pad_state == NULL) {
+		entity->pad_state = calloc(entity->info.pads,
+					   sizeof(*entity->pad_state));
+		if (entity->pad_state == NULL)
+			return NULL;
+	}
+
+	return &entity->pad_state[pad];
+}
+
+/* Forget @what on @pad and all the later stages on the entity pads, or the
+ * whole entity state when @what is 0.
+ */
+static void v4l2_subdev_state_invalidate(struct media_entity *entity,
+					 unsigned int pad, unsigned int what)
+{
+	unsigned int stage, bit, i;
+
+	if (entity->pad_state == NULL)
+		return;
+
+	if (what == 0 || pad >= entity->info.pads) {
+		for (i = 0; i < entity->info.pads; ++i)
+			entity->pad_state[i].valid = 0;
+		return;
+	}
+
+	stage = v4l2_subdev_state_stage(entity, pad, what);
+	entity->pad_state[pad].valid &= ~what;
+
+	for (i = 0; i < entity->info.pads; ++i) {
+		for (bit = V4L2_SUBDEV_STATE_FORMAT;
+		     bit <= V4L2_SUBDEV_STATE_INTERVAL; bit <<= 1) {
+			if (bit == V4L2_SUBDEV_STATE_INTERVAL && i != pad)
+				continue;
+			if (v4l2_subdev_state_stage(entity, i, bit) > stage)
+				entity->pad_state[i].valid &= ~bit;
+		}
+	}
+}
+
+static unsigned int v4l2_subdev_selection_state(unsigned int target)
+{
+	switch (target) {
+	case V4L2_SEL_TGT_CROP:
+		return V4L2_SUBDEV_STATE_CROP;
+	case V4L2_SEL_TGT_COMPOSE:
+		return V4L2_SUBDEV_STATE_COMPOSE;
+	default:
+		return 0;
+	}
+}
+
+void v4l2_subdev_forget_state(struct media_device *media)
+{
+	unsigned int i;
+
+	for (i = 0; i < media_get_entities_count(media); ++i)
+		v4l2_subdev_state_invalidate(media_get_entity(media, i), 0, 0);
+}
+
 int v4l2_subdev_get_format(struct media_entity *entity,
 	struct v4l2_mbus_framefmt *format, unsigned int pad,
 	enum v4l2_subdev_format_whence which)
@@ -101,10 +203,24 @@ int v4l2_subdev_set_format(struct media_entity *entity,
 	fmt.which = which;
 	fmt.format = *format;
 
+	if (which == V4L2_SUBDEV_FORMAT_ACTIVE)
+		v4l2_subdev_state_invalidate(entity, pad,
+					     V4L2_SUBDEV_STATE_FORMAT);
+
 	ret = ioctl(entity->fd, VIDIOC_SUBDEV_S_FMT, &fmt);
 	if (ret < 0)
 		return -errno;
 
+	if (which == V4L2_SUBDEV_FORMAT_ACTIVE) {
+		struct v4l2_subdev_pad_state *state =
+			v4l2_subdev_get_state(entity, pad);
+
+		if (state) {
+			state->format = *format;
+			state->valid |= V4L2_SUBDEV_STATE_FORMAT;
+		}
+	}
+
 	*format = fmt.format;
 	return 0;
 }
@@ -156,12 +272,17 @@ int v4l2_subdev_set_selection(struct media_entity *entity,
 		struct v4l2_subdev_selection sel;
 		struct v4l2_subdev_crop crop;
 	} u;
+	unsigned int what = v4l2_subdev_selection_state(target);
+	struct v4l2_rect requested = *rect;
 	int ret;
 
 	ret = v4l2_subdev_open(entity);
 	if (ret < 0)
 		return ret;
 
+	if (which == V4L2_SUBDEV_FORMAT_ACTIVE)
+		v4l2_subdev_state_invalidate(entity, pad, what);
+
 	memset(&u.sel, 0, sizeof(u.sel));
 	u.sel.pad = pad;
 	u.sel.target = target;
@@ -171,7 +292,7 @@ int v4l2_subdev_set_selection(struct media_entity *entity,
 	ret = ioctl(entity->fd, VIDIOC_SUBDEV_S_SELECTION, &u.sel);
 	if (ret >= 0) {
 		*rect = u.sel.r;
-		return 0;
+		goto done;
 	}
 	if (errno != ENOTTY || target != V4L2_SEL_TGT_CROP)
 		return -errno;
@@ -186,6 +307,21 @@ int v4l2_subdev_set_selection(struct media_entity *entity,
 		return -errno;
 
 	*rect = u.crop.rect;
+
+done:
+	if (which == V4L2_SUBDEV_FORMAT_ACTIVE && what) {
+		struct v4l2_subdev_pad_state *state =
+			v4l2_subdev_get_state(entity, pad);
+
+		if (state) {
+			if (what == V4L2_SUBDEV_STATE_CROP)
+				state->crop = requested;
+			else
+				state->compose = requested;
+			state->valid |= what;
+		}
+	}
+
 	return 0;
 }
 
@@ -288,6 +424,7 @@ int v4l2_subdev_set_frame_interval(struct media_entity *entity,
 				   unsigned int pad)
 {
 	struct v4l2_subdev_frame_interval ival;
+	struct v4l2_subdev_pad_state *state;
 	int ret;
 
 	ret = v4l2_subdev_open(entity);
@@ -298,10 +435,18 @@ int v4l2_subdev_set_frame_interval(struct media_entity *entity,
 	ival.pad = pad;
 	ival.interval = *interval;
 
+	v4l2_subdev_state_invalidate(entity, pad, V4L2_SUBDEV_STATE_INTERVAL);
+
 	ret = ioctl(entity->fd, VIDIOC_SUBDEV_S_FRAME_INTERVAL, &ival);
 	if (ret < 0)
 		return -errno;
 
+	state = v4l2_subdev_get_state(entity, pad);
+	if (state) {
+		state->interval = *interval;
+		state->valid |= V4L2_SUBDEV_STATE_INTERVAL;
+	}
+
 	*interval = ival.interval;
 	return 0;
 }
@@ -850,6 +995,429 @@ int v4l2_subdev_parse_setup_formats(struct media_device *media, const char *p)
 	return *end ? -EINVAL : 0;
 }
 
+/* -----------------------------------------------------------------------------
+ * Pipeline configurations
+ */
+
+enum v4l2_subdev_config_type {
+	V4L2_SUBDEV_CONFIG_LINK,
+	V4L2_SUBDEV_CONFIG_FORMAT,
+	V4L2_SUBDEV_CONFIG_CROP,
+	V4L2_SUBDEV_CONFIG_COMPOSE,
+	V4L2_SUBDEV_CONFIG_INTERVAL,
+	/* Format and interval of a source pad, to be set on the remote pads */
+	V4L2_SUBDEV_CONFIG_PROPAGATE,
+};
+
+struct v4l2_subdev_config_step {
+	enum v4l2_subdev_config_type type;
+	struct media_link *link;
+	struct media_pad *pad;
+	__u32 flags;
+	struct v4l2_mbus_framefmt format;
+	struct v4l2_rect rect;
+	struct v4l2_fract interval;
+};
+
+struct v4l2_subdev_config_steps {
+	struct v4l2_subdev_config_step *steps;
+	unsigned int num_steps;
+	unsigned int max_steps;
+};
+
+struct v4l2_subdev_config {
+	struct media_device *media;
+	struct v4l2_subdev_config_steps steps;
+};
+
+static struct v4l2_subdev_config_step *
+v4l2_subdev_config_add(struct v4l2_subdev_config_steps *steps,
+		       enum v4l2_subdev_config_type type, struct media_pad *pad)
+{
+	struct v4l2_subdev_config_step *step;
+
+	if (steps->num_steps == steps->max_steps) {
+		unsigned int max_steps = steps->max_steps ? steps->max_steps * 2 : 16;
+
+		step = realloc(steps->steps, max_steps * sizeof(*step));
+		if (step == NULL)
+			return NULL;
+
+		steps->steps = step;
+		steps->max_steps = max_steps;
+	}
+
+	step = &steps->steps[steps->num_steps++];
+	memset(step, 0, sizeof(*step));
+	step->type = type;
+	step->pad = pad;
+	return step;
+}
+
+void v4l2_subdev_config_free(struct v4l2_subdev_config *config)
+{
+	if (config == NULL)
+		return;
+
+	free(config->steps.steps);
+	free(config);
+}
+
+static int v4l2_subdev_config_parse_links(struct v4l2_subdev_config *config,
+					  const char *p)
+{
+	struct media_device *media = config->media;
+	struct v4l2_subdev_config_step *step;
+	struct media_link *link;
+	__u32 flags;
+	char *end;
+	int ret;
+
+	do {
+		ret = media_parse_link_config(media, p, &link, &flags, &end);
+		if (ret < 0) {
+			media_print_streampos(media, p, end);
+			return ret;
+		}
+
+		step = v4l2_subdev_config_add(&config->steps,
+					      V4L2_SUBDEV_CONFIG_LINK, NULL);
+		if (step == NULL)
+			return -ENOMEM;
+
+		step->link = link;
+		step->flags = flags;
+
+		p = end + 1;
+	} while (*end == ',');
+
+	return *end ? -EINVAL : 0;
+}
+
+static int v4l2_subdev_config_parse_format(struct v4l2_subdev_config *config,
+					   const char *p, char **endp)
+{
+	struct media_device *media = config->media;
+	struct v4l2_subdev_config_steps *steps = &config->steps;
+	struct v4l2_mbus_framefmt format = { 0, 0, 0 };
+	struct v4l2_subdev_config_step *step;
+	struct media_pad *pad;
+	struct v4l2_rect crop = { -1, -1, -1, -1 };
+	struct v4l2_rect compose = crop;
+	struct v4l2_fract interval = { 0, 0 };
+	bool has_format;
+	char *end;
+
+	pad = v4l2_subdev_parse_pad_format(media, &format, &crop, &compose,
+					   &interval, p, &end);
+	if (pad == NULL) {
+		media_print_streampos(media, p, end);
+		media_dbg(media, "Unable to parse format\n");
+		return -EINVAL;
+	}
+
+	*endp = end;
+
+	/* Same order as v4l2_subdev_parse_setup_format() */
+	has_format = format.width != 0 && format.height != 0;
+	if (has_format && (pad->flags & MEDIA_PAD_FL_SINK)) {
+		step = v4l2_subdev_config_add(steps, V4L2_SUBDEV_CONFIG_FORMAT,
+					      pad);
+		if (step == NULL)
+			return -ENOMEM;
+		step->format = format;
+	}
+
+	if (crop.left != -1 && crop.top != -1) {
+		step = v4l2_subdev_config_add(steps, V4L2_SUBDEV_CONFIG_CROP,
+					      pad);
+		if (step == NULL)
+			return -ENOMEM;
+		step->rect = crop;
+	}
+
+	if (compose.left != -1 && compose.top != -1) {
+		step = v4l2_subdev_config_add(steps, V4L2_SUBDEV_CONFIG_COMPOSE,
+					      pad);
+		if (step == NULL)
+			return -ENOMEM;
+		step->rect = compose;
+	}
+
+	if (has_format && (pad->flags & MEDIA_PAD_FL_SOURCE)) {
+		step = v4l2_subdev_config_add(steps, V4L2_SUBDEV_CONFIG_FORMAT,
+					      pad);
+		if (step == NULL)
+			return -ENOMEM;
+		step->format = format;
+	}
+
+	if (interval.numerator != 0) {
+		step = v4l2_subdev_config_add(steps, V4L2_SUBDEV_CONFIG_INTERVAL,
+					      pad);
+		if (step == NULL)
+			return -ENOMEM;
+		step->interval = interval;
+	}
+
+	if ((has_format || interval.numerator != 0) &&
+	    (pad->flags & MEDIA_PAD_FL_SOURCE)) {
+		step = v4l2_subdev_config_add(steps,
+					      V4L2_SUBDEV_CONFIG_PROPAGATE, pad);
+		if (step == NULL)
+			return -ENOMEM;
+		step->format = format;
+		step->interval = interval;
+	}
+
+	return 0;
+}
+
+struct v4l2_subdev_config *v4l2_subdev_config_parse(struct media_device *media,
+						    const char *links,
+						    const char *formats)
+{
+	struct v4l2_subdev_config *config;
+	const char *p;
+	char *end;
+	int ret;
+
+	config = calloc(1, sizeof(*config));
+	if (config == NULL)
+		return NULL;
+
+	config->media = media;
+
+	if (links && *links) {
+		ret = v4l2_subdev_config_parse_links(config, links);
+		if (ret < 0)
+			goto error;
+	}
+
+	if (formats && *formats) {
+		p = formats;
+		do {
+			ret = v4l2_subdev_config_parse_format(config, p, &end);
+			if (ret < 0)
+				goto error;
+
+			for (; isspace(*end); end++);
+			p = end + 1;
+		} while (*end == ',');
+
+		if (*end)
+			goto error;
+	}
+
+	return config;
+
+error:
+	v4l2_subdev_config_free(config);
+	return NULL;
+}
+
+/* Apply a format, selection or frame interval step unless the pad is known
+ * to be configured that way already. The previous value, when known, is
+ * recorded in @undo if not NULL.
+ */
+static int v4l2_subdev_config_set(struct v4l2_subdev_config_steps *undo,
+				  const struct v4l2_subdev_config_step *step,
+				  struct media_pad *pad)
+{
+	struct v4l2_subdev_pad_state *state;
+	struct v4l2_subdev_config_step *old;
+	struct v4l2_mbus_framefmt format;
+	struct v4l2_fract interval;
+	struct v4l2_rect rect;
+	unsigned int what;
+	const void *cur, *new;
+	size_t size;
+
+	switch (step->type) {
+	case V4L2_SUBDEV_CONFIG_CROP:
+		what = V4L2_SUBDEV_STATE_CROP;
+		break;
+	case V4L2_SUBDEV_CONFIG_COMPOSE:
+		what = V4L2_SUBDEV_STATE_COMPOSE;
+		break;
+	case V4L2_SUBDEV_CONFIG_INTERVAL:
+		what = V4L2_SUBDEV_STATE_INTERVAL;
+		break;
+	default:
+		what = V4L2_SUBDEV_STATE_FORMAT;
+		break;
+	}
+
+	state = v4l2_subdev_get_state(pad->entity, pad->index);
+	if (state && (state->valid & what)) {
+		switch (what) {
+		case V4L2_SUBDEV_STATE_CROP:
+			cur = &state->crop;
+			new = &step->rect;
+			size = sizeof(step->rect);
+			break;
+		case V4L2_SUBDEV_STATE_COMPOSE:
+			cur = &state->compose;
+			new = &step->rect;
+			size = sizeof(step->rect);
+			break;
+		case V4L2_SUBDEV_STATE_INTERVAL:
+			cur = &state->interval;
+			new = &step->interval;
+			size = sizeof(step->interval);
+			break;
+		default:
+			cur = &state->format;
+			new = &step->format;
+			size = sizeof(step->format);
+			break;
+		}
+
+		if (!memcmp(cur, new, size))
+			return 0;
+
+		if (undo) {
+			old = v4l2_subdev_config_add(undo, step->type, pad);
+			if (old == NULL)
+				return -ENOMEM;
+			old->format = state->format;
+			old->rect = what == V4L2_SUBDEV_STATE_CROP ?
+				    state->crop : state->compose;
+			old->interval = state->interval;
+		}
+	}
+
+	switch (what) {
+	case V4L2_SUBDEV_STATE_CROP:
+		rect = step->rect;
+		return set_selection(pad, V4L2_SEL_TGT_CROP, &rect);
+	case V4L2_SUBDEV_STATE_COMPOSE:
+		rect = step->rect;
+		return set_selection(pad, V4L2_SEL_TGT_COMPOSE, &rect);
+	case V4L2_SUBDEV_STATE_INTERVAL:
+		interval = step->interval;
+		return set_frame_interval(pad, &interval);
+	default:
+		format = step->format;
+		return set_format(pad, &format);
+	}
+}
+
+static int v4l2_subdev_config_propagate(struct v4l2_subdev_config_steps *undo,
+					const struct v4l2_subdev_config_step *step)
+{
+	struct media_pad *pad = step->pad;
+	struct v4l2_subdev_config_step remote = *step;
+	unsigned int i;
+	int ret;
+
+	for (i = 0; i < pad->entity->num_links; ++i) {
+		struct media_link *link = &pad->entity->links[i];
+
+		if (!(link->flags & MEDIA_LNK_FL_ENABLED))
+			continue;
+
+		if (link->source != pad ||
+		    link->sink->entity->info.type != MEDIA_ENT_T_V4L2_SUBDEV)
+			continue;
+
+		if (step->format.width != 0 && step->format.height != 0) {
+			remote.type = V4L2_SUBDEV_CONFIG_FORMAT;
+			v4l2_subdev_config_set(undo, &remote, link->sink);
+		}
+
+		if (step->interval.numerator != 0) {
+			remote.type = V4L2_SUBDEV_CONFIG_INTERVAL;
+			ret = v4l2_subdev_config_set(undo, &remote, link->sink);
+			if (ret < 0 && ret != -EINVAL && ret != -ENOTTY)
+				return ret;
+		}
+	}
+
+	return 0;
+}
+
+static void v4l2_subdev_config_rollback(struct v4l2_subdev_config *config,
+					struct v4l2_subdev_config_steps *undo)
+{
+	struct v4l2_subdev_config_step *old;
+	unsigned int i;
+
+	media_dbg(config->media, "Restoring the previous configuration\n");
+
+	/* Links in reverse order, so that exclusive links can be restored */
+	for (i = undo->num_steps; i > 0; --i) {
+		old = &undo->steps[i - 1];
+		if (old->type == V4L2_SUBDEV_CONFIG_LINK)
+			media_setup_link(config->media, old->link->source,
+					 old->link->sink, old->flags);
+	}
+
+	/* Formats and selections in the order they propagate */
+	for (i = 0; i < undo->num_steps; ++i) {
+		old = &undo->steps[i];
+		if (old->type != V4L2_SUBDEV_CONFIG_LINK)
+			v4l2_subdev_config_set(NULL, old, old->pad);
+	}
+}
+
+int v4l2_subdev_config_apply(struct v4l2_subdev_config *config)
+{
+	struct v4l2_subdev_config_steps undo = { NULL, 0, 0 };
+	struct v4l2_subdev_config_step *old;
+	unsigned int i;
+	int ret = 0;
+
+	for (i = 0; i < config->steps.num_steps; ++i) {
+		struct v4l2_subdev_config_step *step = &config->steps.steps[i];
+		struct media_link *link = step->link;
+
+		switch (step->type) {
+		case V4L2_SUBDEV_CONFIG_LINK:
+			if ((link->flags & MEDIA_LNK_FL_ENABLED) ==
+			    (step->flags & MEDIA_LNK_FL_ENABLED))
+				continue;
+
+			old = v4l2_subdev_config_add(&undo, step->type, NULL);
+			if (old == NULL) {
+				ret = -ENOMEM;
+				break;
+			}
+			old->link = link;
+			old->flags = link->flags & ~MEDIA_LNK_FL_IMMUTABLE;
+
+			media_dbg(config->media,
+				  "Setting up link %u:%u -> %u:%u [%u]\n",
+				  link->source->entity->info.id,
+				  link->source->index,
+				  link->sink->entity->info.id,
+				  link->sink->index, step->flags);
+
+			ret = media_setup_link(config->media, link->source,
+					       link->sink, step->flags);
+			if (ret < 0)
+				undo.num_steps--;
+			break;
+
+		case V4L2_SUBDEV_CONFIG_PROPAGATE:
+			ret = v4l2_subdev_config_propagate(&undo, step);
+			break;
+
+		default:
+			ret = v4l2_subdev_config_set(&undo, step, step->pad);
+			break;
+		}
+
+		if (ret < 0) {
+			v4l2_subdev_config_rollback(config, &undo);
+			break;
+		}
+	}
+
+	free(undo.steps);
+	return ret;
+}
+
 static const struct {
 	const char *name;
 	enum v4l2_mbus_pixelcode code;
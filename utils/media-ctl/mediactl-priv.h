@@ -23,9 +23,27 @@
 #define __MEDIA_PRIV_H__
 
 #include <linux/media.h>
+#include <linux/v4l2-subdev.h>
+#include <stdbool.h>
 
 #include "mediactl.h"
 
+/* Active configuration of a subdev pad as last set through libv4l2subdev,
+ * the valid bits tell which members are known.
+ */
+#define V4L2_SUBDEV_STATE_FORMAT	(1 << 0)
+#define V4L2_SUBDEV_STATE_CROP		(1 << 1)
+#define V4L2_SUBDEV_STATE_COMPOSE	(1 << 2)
+#define V4L2_SUBDEV_STATE_INTERVAL	(1 << 3)
+
+struct v4l2_subdev_pad_state {
+	unsigned int valid;
+	struct v4l2_mbus_framefmt format;
+	struct v4l2_rect crop;
+	struct v4l2_rect compose;
+	struct v4l2_fract interval;
+};
+
 struct media_entity {
 	struct media_device *media;
 	struct media_entity_desc info;
@@ -35,7 +53,11 @@ struct media_entity {
 	unsigned int num_links;
 
 	char devname[32];
+	bool devname_looked_up; /* The device node is looked up on first use */
 	int fd;
+
+	/* One per pad, allocated on the first configuration change */
+	struct v4l2_subdev_pad_state *pad_state;
 };
 
 struct media_device {
@@ -47,6 +69,18 @@ struct media_device {
 	struct media_entity *entities;
 	unsigned int entities_count;
 
+	/* Lookup tables, built on the first lookup after enumeration. by_id is
+	 * indexed directly by entity ID and left NULL for sparse IDs, by_name
+	 * is an open addressing hash table of by_name_mask + 1 entries.
+	 */
+	struct {
+		bool valid;
+		struct media_entity **by_id;
+		unsigned int max_id;
+		struct media_entity **by_name;
+		unsigned int by_name_mask;
+	} index;
+
 	void (*debug_handler)(void *, ...);
 	void *debug_priv;
 
@@ -408,6 +408,23 @@ struct media_pad *media_parse_pad(struct media_device *media,
 struct media_link *media_parse_link(struct media_device *media,
 				    const char *p, char **endp);
 
+/**
+ * @brief Parse string to a link on the media device and its configuration.
+ * @param media - media device.
+ * @param p - input string
+ * @param link - pointer to the parsed link (return)
+ * @param flags - pointer to the parsed link flags (return)
+ * @param endp - pointer to p where parsing ended
+ *
+ * Parse NULL terminated string p describing a link and its configuration,
+ * without configuring the link.
+ *
+ * @return 0 on success, or a negative error code on failure.
+ */
+int media_parse_link_config(struct media_device *media, const char *p,
+			    struct media_link **link, __u32 *flags,
+			    char **endp);
+
 /**
  * @brief Parse string to a link on the media device and set it up.
  * @param media - media device.
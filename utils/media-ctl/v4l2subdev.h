@@ -26,6 +26,7 @@
 
 struct media_device;
 struct media_entity;
+struct v4l2_subdev_config;
 
 /**
  * @brief Open a sub-device.
@@ -235,6 +236,56 @@ int v4l2_subdev_set_frame_interval(struct media_entity *entity,
  */
 int v4l2_subdev_parse_setup_formats(struct media_device *media, const char *p);
 
+/**
+ * @brief Parse a pipeline configuration.
+ * @param media - media device.
+ * @param links - links string, as for media_parse_setup_links(), or NULL.
+ * @param formats - formats string, as for v4l2_subdev_parse_setup_formats(),
+ * or NULL.
+ *
+ * Parse the @a links and @a formats strings once into a configuration that
+ * can be applied any number of times with v4l2_subdev_config_apply(), for
+ * instance at every mode switch.
+ *
+ * @return A pointer to the configuration, or NULL on failure.
+ */
+struct v4l2_subdev_config *v4l2_subdev_config_parse(struct media_device *media,
+						    const char *links,
+						    const char *formats);
+
+/**
+ * @brief Apply a pipeline configuration.
+ * @param config - configuration returned by v4l2_subdev_config_parse().
+ *
+ * Set up the links, and then the formats, selections and frame intervals in
+ * the same order as v4l2_subdev_parse_setup_formats() does, including the
+ * propagation of source pad formats to the connected subdev sink pads.
+ *
+ * Only the settings that differ from the active configuration as last set
+ * through this library are applied, the others are skipped without any
+ * ioctl. When a setting fails, the settings changed by this call are
+ * restored to their previous value, when known.
+ *
+ * @return 0 on success, or a negative error code on failure.
+ */
+int v4l2_subdev_config_apply(struct v4l2_subdev_config *config);
+
+/**
+ * @brief Free a pipeline configuration.
+ * @param config - configuration returned by v4l2_subdev_config_parse().
+ */
+void v4l2_subdev_config_free(struct v4l2_subdev_config *config);
+
+/**
+ * @brief Forget the known active configuration of all sub-devices.
+ * @param media - media device.
+ *
+ * Make the next v4l2_subdev_config_apply() calls apply all their settings,
+ * for instance when the configuration may have been changed by another
+ * process.
+ */
+void v4l2_subdev_forget_state(struct media_device *media);
+
 /**
  * @brief Convert media bus pixel code to string.
  * @param code - input string
@@ -40,13 +40,27 @@
 #include <pthread.h>
 #include <alsa/asoundlib.h>
 #include <sys/time.h>
+#include <stdint.h>
+#include <unistd.h>
 #include <math.h>
 
 #define ARRAY_SIZE(a) (sizeof(a)/sizeof(*(a)))
 
-/* Private vars to control alsa thread status */
+/*
+ * Maximum deviation of the playback rate from the capture rate used to
+ * hold the target latency. 0.5% is not audible as a change of pitch.
+ */
+#define MAX_RESAMPLE 0.005
+
+/*
+ * Private vars to control alsa thread status. They are shared between
+ * the GUI, capture and playback threads, so they are only accessed with
+ * atomics.
+ */
 static int stop_alsa = 0;
-static snd_htimestamp_t timestamp;
+static uint64_t timestamp_ns;
+static unsigned target_latency;	/* usecs, 0 means the negotiated latency */
+static unsigned audio_latency;	/* usecs, as last measured */
 
 /* Error handlers */
 snd_output_t *output = NULL;
@@ -58,6 +72,7 @@ struct final_params {
     int rate;
     int latency;
     int channels;
+    int period;
 };
 
 static int setparams_stream(snd_pcm_t *handle,
@@ -210,6 +225,16 @@ static int setparams_set(snd_pcm_t *handle,
 		id, snd_strerror(err));
     }
 
+#if SND_LIB_VERSION >= 0x01001d
+    /* Use the same clock as the V4L2 buffer timestamps */
+    err = snd_pcm_sw_params_set_tstamp_type(handle, swparams,
+					    SND_PCM_TSTAMP_TYPE_MONOTONIC);
+    if (err < 0 && verbose) {
+	fprintf(error_fp, "alsa: Unable to use monotonic timestamps for %s: %s\n",
+		id, snd_strerror(err));
+    }
+#endif
+
     err = snd_pcm_sw_params(handle, swparams);
     if (err < 0) {
 	fprintf(error_fp, "alsa: Unable to set sw params for %s: %s\n",
@@ -423,6 +448,100 @@ static int setparams(snd_pcm_t *phandle, snd_pcm_t *chandle,
     negotiated->rate = ratep;
     negotiated->channels = channels;
     negotiated->latency = latency;
+    negotiated->period = p_psize;
+    return 0;
+}
+
+static int alsa_stopped(void)
+{
+    return __atomic_load_n(&stop_alsa, __ATOMIC_ACQUIRE);
+}
+
+/*
+ * Single producer, single consumer ring of frames between the capture
+ * and the playback threads. head is only changed by the capture thread
+ * and tail by the playback thread, so no locks are needed.
+ */
+struct audio_ring {
+    int16_t *data;
+    unsigned size;	/* in frames, a power of two */
+    unsigned channels;
+    unsigned head;	/* frames written */
+    unsigned tail;	/* frames read */
+};
+
+/* Called by the playback thread */
+static unsigned ring_fill(struct audio_ring *ring)
+{
+    return __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE) -
+	   __atomic_load_n(&ring->tail, __ATOMIC_RELAXED);
+}
+
+/* Called by the capture thread. Returns the number of frames stored */
+static unsigned ring_write(struct audio_ring *ring, const int16_t *buf,
+			   unsigned frames)
+{
+    unsigned head = __atomic_load_n(&ring->head, __ATOMIC_RELAXED);
+    unsigned tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+    unsigned space = ring->size - (head - tail);
+    unsigned i, n, pos;
+
+    if (frames > space)
+	frames = space;
+
+    for (i = 0; i < frames; i += n) {
+	pos = (head + i) & (ring->size - 1);
+	n = frames - i;
+	if (n > ring->size - pos)
+	    n = ring->size - pos;
+	memcpy(ring->data + pos * ring->channels, buf + i * ring->channels,
+	       n * ring->channels * sizeof(*buf));
+    }
+
+    __atomic_store_n(&ring->head, head + frames, __ATOMIC_RELEASE);
+    return frames;
+}
+
+/* Called by the playback thread */
+static void ring_skip(struct audio_ring *ring, unsigned frames)
+{
+    unsigned tail = __atomic_load_n(&ring->tail, __ATOMIC_RELAXED);
+
+    __atomic_store_n(&ring->tail, tail + frames, __ATOMIC_RELEASE);
+}
+
+/*
+ * Called by the playback thread. Fills frames output frames from the ring,
+ * consuming ratio input frames per output frame, with linear
+ * interpolation. *pos is the fractional input position, carried over
+ * between calls. Returns -1 if the ring does not hold enough frames.
+ */
+static int ring_resample(struct audio_ring *ring, int16_t *out,
+			 unsigned frames, double *pos, double ratio)
+{
+    unsigned tail = __atomic_load_n(&ring->tail, __ATOMIC_RELAXED);
+    unsigned fill = ring_fill(ring);
+    unsigned mask = ring->size - 1, ch = ring->channels;
+    const int16_t *s0, *s1;
+    unsigned i, c, idx;
+    double p = *pos, frac;
+
+    /* The last output frame is interpolated from two input frames */
+    if (p + (frames - 1) * ratio + 2 > fill)
+	return -1;
+
+    for (i = 0; i < frames; i++, p += ratio) {
+	idx = (unsigned)p;
+	frac = p - idx;
+	s0 = ring->data + ((tail + idx) & mask) * ch;
+	s1 = ring->data + ((tail + idx + 1) & mask) * ch;
+	for (c = 0; c < ch; c++)
+	    *out++ = lrint(s0[c] + (s1[c] - s0[c]) * frac);
+    }
+
+    idx = (unsigned)p;
+    *pos = p - idx;
+    __atomic_store_n(&ring->tail, tail + idx, __ATOMIC_RELEASE);
     return 0;
 }
 
@@ -431,7 +550,12 @@ static snd_pcm_sframes_t readbuf(snd_pcm_t *handle, char *buf, long len)
 {
     snd_pcm_sframes_t r;
     snd_pcm_uframes_t frames;
+    snd_htimestamp_t timestamp;
+
     snd_pcm_htimestamp(handle, &frames, &timestamp);
+    __atomic_store_n(&timestamp_ns,
+		     timestamp.tv_sec * 1000000000ULL + timestamp.tv_nsec,
+		     __ATOMIC_RELAXED);
     r = snd_pcm_readi(handle, buf, len);
     if (r < 0 && !(r == -EAGAIN || r == -ENODEV)) {
 	r = snd_pcm_recover(handle, r, 0);
@@ -442,11 +566,12 @@ static snd_pcm_sframes_t readbuf(snd_pcm_t *handle, char *buf, long len)
 }
 
 /* Write len frames (note not up to len, but all of len!) */
-static snd_pcm_sframes_t writebuf(snd_pcm_t *handle, char *buf, long len)
+static snd_pcm_sframes_t writebuf(snd_pcm_t *handle, char *buf, long len,
+				  size_t frame_size)
 {
     snd_pcm_sframes_t r;
 
-    while (!stop_alsa) {
+    while (!alsa_stopped()) {
 	r = snd_pcm_writei(handle, buf, len);
 	if (r == len)
 	    return 0;
@@ -458,19 +583,115 @@ static snd_pcm_sframes_t writebuf(snd_pcm_t *handle, char *buf, long len)
 		return r;
 	    }
 	}
-	buf += r * 4;
+	buf += r * frame_size;
 	len -= r;
 	snd_pcm_wait(handle, 100);
     }
     return -1;
 }
 
+struct playback_params {
+    snd_pcm_t *handle;
+    struct audio_ring *ring;
+    unsigned rate;
+    snd_pcm_uframes_t period;
+    unsigned min_latency;	/* frames */
+};
+
+static unsigned target_frames(struct playback_params *pb)
+{
+    unsigned usecs = __atomic_load_n(&target_latency, __ATOMIC_RELAXED);
+    unsigned frames = (uint64_t)usecs * pb->rate / 1000000;
+
+    if (frames < pb->min_latency)
+	frames = pb->min_latency;
+    if (frames > pb->ring->size / 2)
+	frames = pb->ring->size / 2;
+    return frames;
+}
+
+/*
+ * The playback thread. It holds the latency from capture to playback,
+ * i.e. the frames in the ring plus the playback delay, at the target by
+ * playing slightly faster or slower than the capture rate.
+ */
+static void *alsa_playback_entry(void *whatever)
+{
+    struct playback_params *pb = (struct playback_params *) whatever;
+    struct audio_ring *ring = pb->ring;
+    size_t frame_size = ring->channels * sizeof(int16_t);
+    snd_pcm_sframes_t delay;
+    double pos = 0, ratio, error = 0;
+    unsigned fill, target;
+    int prefill = 1;
+    int16_t *buffer;
+    long total;
+
+    buffer = malloc(pb->period * frame_size);
+    if (buffer == NULL) {
+	fprintf(error_fp, "alsa: Failed allocating buffer for playback\n");
+	return NULL;
+    }
+
+    while (!alsa_stopped()) {
+	fill = ring_fill(ring);
+	target = target_frames(pb);
+
+	if (prefill) {
+	    if (fill < target) {
+		usleep(1000);
+		continue;
+	    }
+	    prefill = 0;
+	}
+
+	if (snd_pcm_delay(pb->handle, &delay) < 0 || delay < 0)
+	    delay = 0;
+	total = fill + delay;
+	__atomic_store_n(&audio_latency,
+			 (unsigned)(total * 1000000ULL / pb->rate),
+			 __ATOMIC_RELAXED);
+
+	/* Far behind, e.g. after a stall: drop the excess at once */
+	if (total > (long)(target + pb->rate / 4)) {
+	    ring_skip(ring, total - target < fill ? total - target : fill);
+	    error = 0;
+	    continue;
+	}
+
+	/* Correct the averaged error in about two seconds */
+	error += (total - (long)target - error) / 16;
+	ratio = 1 + error / (2.0 * pb->rate);
+	if (ratio < 1 - MAX_RESAMPLE)
+	    ratio = 1 - MAX_RESAMPLE;
+	if (ratio > 1 + MAX_RESAMPLE)
+	    ratio = 1 + MAX_RESAMPLE;
+
+	if (ring_resample(ring, buffer, pb->period, &pos, ratio)) {
+	    /* Capture fell behind: wait until the ring is refilled */
+	    if (verbose)
+		fprintf(error_fp, "alsa: playback ring underrun\n");
+	    prefill = 1;
+	    continue;
+	}
+
+	if (writebuf(pb->handle, (char *)buffer, pb->period, frame_size) < 0)
+	    break;
+    }
+
+    free(buffer);
+    return NULL;
+}
+
 static int alsa_stream(const char *pdevice, const char *cdevice, int latency)
 {
     snd_pcm_t *phandle, *chandle;
     char *buffer;
     int err;
     ssize_t r;
+    struct audio_ring ring = {};
+    struct playback_params pb;
+    pthread_t playback_thread;
     struct final_params negotiated;
     snd_pcm_format_t format = SND_PCM_FORMAT_S16_LE;
     char pdevice_new[32];
@@ -534,24 +755,56 @@ static int alsa_stream(const char *pdevice, const char *cdevice, int latency)
 	return 0;
     }
 
+    /* Room for at least a second, so that the target latency can grow */
+    ring.channels = negotiated.channels;
+    ring.size = 1;
+    while (ring.size < 2 * negotiated.rate || ring.size < 4 * negotiated.bufsize)
+	ring.size <<= 1;
+    ring.data = malloc(ring.size * ring.channels * sizeof(*ring.data));
+    if (ring.data == NULL) {
+	fprintf(error_fp, "alsa: Failed allocating ring for audio\n");
+	free(buffer);
+	snd_pcm_close(phandle);
+	snd_pcm_close(chandle);
+	return 0;
+    }
+
+    pb.handle = phandle;
+    pb.ring = &ring;
+    pb.rate = negotiated.rate;
+    pb.period = negotiated.period;
+    pb.min_latency = negotiated.latency;
+    if (pthread_create(&playback_thread, NULL, &alsa_playback_entry, &pb)) {
+	fprintf(error_fp, "alsa: Failed creating playback thread\n");
+	free(ring.data);
+	free(buffer);
+	snd_pcm_close(phandle);
+	snd_pcm_close(chandle);
+	return 0;
+    }
+
     if (verbose)
         fprintf(error_fp,
 	    "alsa: stream started from %s to %s (%i Hz, buffer delay = %.2f ms)\n",
 	    cdevice, pdevice, negotiated.rate,
 	    negotiated.latency * 1000.0 / negotiated.rate);
 
-    while (!stop_alsa) {
+    while (!alsa_stopped()) {
 	/* We start with a read and not a wait to auto(re)start the capture */
 	r = readbuf(chandle, buffer, negotiated.bufsize);
 	if (r == 0)   /* Succesfully recovered from an overrun? */
 	    continue; /* Force restart of capture stream */
-	if (r > 0)
-	    writebuf(phandle, buffer, r);
+	if (r > 0 && ring_write(&ring, (int16_t *)buffer, r) < r && verbose)
+	    fprintf(error_fp, "alsa: playback ring overrun\n");
 	/* use poll to wait for next event */
-	while (!stop_alsa && !snd_pcm_wait(chandle, 50))
+	while (!alsa_stopped() && !snd_pcm_wait(chandle, 50))
 	    ;
     }
 
+    pthread_join(playback_thread, NULL);
+    free(ring.data);
+    free(buffer);
+
     snd_pcm_drop(chandle);
     snd_pcm_drop(phandle);
 
@@ -628,7 +881,10 @@ int alsa_thread_startup(const char *pdevice, const char *cdevice, int latency,
     inputs->cdevice = strdup(cdevice);
     inputs->latency = latency;
 
-    stop_alsa = 0;
+    __atomic_store_n(&stop_alsa, 0, __ATOMIC_RELEASE);
+    __atomic_store_n(&timestamp_ns, 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&target_latency, 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&audio_latency, 0, __ATOMIC_RELAXED);
     ret = pthread_create(&alsa_thread, NULL,
 			 &alsa_thread_entry, (void *) inputs);
     if (ret == 0)
@@ -642,7 +898,7 @@ void alsa_thread_stop(void)
     if (!alsa_is_running)
         return;
 
-    stop_alsa = 1;
+    __atomic_store_n(&stop_alsa, 1, __ATOMIC_RELEASE);
     pthread_join(alsa_thread, NULL);
     alsa_is_running = 0;
 }
@@ -655,11 +911,25 @@ int alsa_thread_is_running(void)
 void alsa_thread_timestamp(struct timeval *tv)
 {
 	if (alsa_thread_is_running()) {
-		tv->tv_sec = timestamp.tv_sec;
-		tv->tv_usec = timestamp.tv_nsec / 1000;
+		uint64_t ns = __atomic_load_n(&timestamp_ns, __ATOMIC_RELAXED);
+
+		tv->tv_sec = ns / 1000000000;
+		tv->tv_usec = (ns % 1000000000) / 1000;
 	} else {
 		tv->tv_sec = 0;
 		tv->tv_usec = 0;
 	}
 }
+
+void alsa_thread_set_latency(unsigned usecs)
+{
+	__atomic_store_n(&target_latency, usecs, __ATOMIC_RELAXED);
+}
+
+unsigned alsa_thread_latency(void)
+{
+	if (!alsa_thread_is_running())
+		return 0;
+	return __atomic_load_n(&audio_latency, __ATOMIC_RELAXED);
+}
 #endif
@@ -9,4 +9,6 @@ int alsa_thread_startup(const char *pdevice, const char *cdevice,
 void alsa_thread_stop(void);
 int alsa_thread_is_running(void);
 void alsa_thread_timestamp(struct timeval *tv);
+void alsa_thread_set_latency(unsigned usecs);
+unsigned alsa_thread_latency(void);
 #endif
@@ -23,6 +23,7 @@
 #include "capture-win-gl.h"
 
 #include <stdio.h>
+#include <string.h>
 
 CaptureWinGL::CaptureWinGL(ApplicationWindow *aw) :
 	CaptureWin(aw)
@@ -148,7 +149,11 @@ CaptureWinGLEngine::CaptureWinGLEngine() :
 	m_frameData(NULL),
 	m_blending(false),
 	m_mag_filter(GL_NEAREST),
-	m_min_filter(GL_NEAREST)
+	m_min_filter(GL_NEAREST),
+	m_pbo(false),
+	m_pboIdx(0),
+	m_titleFrames(0),
+	m_titlePaintNs(0)
 {
 	makeCurrent();
 	m_glfunction.initializeGLFunctions(context());
@@ -157,6 +162,8 @@ CaptureWinGLEngine::CaptureWinGLEngine() :
 CaptureWinGLEngine::~CaptureWinGLEngine()
 {
 	clearShader();
+	if (m_pbo)
+		glDeleteBuffers(PBO_RING_SIZE, m_pbos);
 }
 
 void CaptureWinGLEngine::setColorspace(unsigned colorspace, unsigned xfer_func,
@@ -301,6 +308,14 @@ void CaptureWinGLEngine::initializeGL()
 	m_glRed16 = m_hasGLRed ? GL_R16 : GL_LUMINANCE;
 	m_glRedGreen = m_hasGLRed ? GL_RG : GL_LUMINANCE_ALPHA;
 
+	// glMapBufferRange() needs OpenGL 3.0 as well
+	m_pbo = m_hasGLRed;
+	if (m_pbo) {
+		glGenBuffers(PBO_RING_SIZE, m_pbos);
+		memset(m_pboSize, 0, sizeof(m_pboSize));
+		m_pboIdx = 0;
+	}
+
 	glClearColor(1.0f, 1.0f, 1.0f, 0.0f);
 	glBlendFunc(GL_ONE, GL_ZERO);
 	checkError("InitializeGL");
@@ -344,6 +359,111 @@ void CaptureWinGLEngine::checkError(const char *msg)
 	if (err) fprintf(stderr, "OpenGL Error 0x%x: %s.\n", err, msg);
 }
 
+/*
+ * Same as glTexSubImage2D(), but the data is copied into the next pixel
+ * buffer object of the ring first. The GPU then transfers it to the texture
+ * while the frame renders, instead of the upload waiting for the GPU to
+ * finish with the texture.
+ */
+void CaptureWinGLEngine::uploadTexture(GLenum target, GLint level, GLint xoffset, GLint yoffset,
+				       GLsizei width, GLsizei height, GLenum format, GLenum type,
+				       const void *pixels)
+{
+	GLint rowLength, alignment;
+	unsigned bpp, stride, size;
+	GLuint pbo;
+	void *p;
+
+	if (!m_pbo || !pixels || width <= 0 || height <= 0) {
+		glTexSubImage2D(target, level, xoffset, yoffset, width, height,
+				format, type, pixels);
+		return;
+	}
+
+	switch (type) {
+	case GL_UNSIGNED_BYTE_3_3_2:
+		bpp = 1;
+		break;
+	case GL_UNSIGNED_SHORT_5_6_5:
+	case GL_UNSIGNED_SHORT_4_4_4_4:
+	case GL_UNSIGNED_SHORT_4_4_4_4_REV:
+	case GL_UNSIGNED_SHORT_5_5_5_1:
+	case GL_UNSIGNED_SHORT_1_5_5_5_REV:
+		bpp = 2;
+		break;
+	case GL_UNSIGNED_INT_8_8_8_8:
+	case GL_UNSIGNED_INT_8_8_8_8_REV:
+		bpp = 4;
+		break;
+	default:
+		bpp = type == GL_UNSIGNED_SHORT ? 2 : 1;
+		switch (format) {
+		case GL_RG:
+		case GL_LUMINANCE_ALPHA:
+			bpp *= 2;
+			break;
+		case GL_RGB:
+		case GL_BGR:
+			bpp *= 3;
+			break;
+		case GL_RGBA:
+		case GL_BGRA:
+			bpp *= 4;
+			break;
+		}
+		break;
+	}
+
+	glGetIntegerv(GL_UNPACK_ROW_LENGTH, &rowLength);
+	glGetIntegerv(GL_UNPACK_ALIGNMENT, &alignment);
+	stride = (rowLength ? rowLength : width) * bpp;
+	stride = (stride + alignment - 1) / alignment * alignment;
+	size = stride * (height - 1) + width * bpp;
+
+	pbo = m_pboIdx;
+	m_pboIdx = (m_pboIdx + 1) % PBO_RING_SIZE;
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, m_pbos[pbo]);
+	if (m_pboSize[pbo] != size) {
+		glBufferData(GL_PIXEL_UNPACK_BUFFER, size, NULL, GL_STREAM_DRAW);
+		m_pboSize[pbo] = size;
+	}
+	p = glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, size,
+			     GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+	if (p) {
+		memcpy(p, pixels, size);
+		if (glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER)) {
+			glTexSubImage2D(target, level, xoffset, yoffset, width, height,
+					format, type, NULL);
+			glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+			return;
+		}
+	}
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+	glTexSubImage2D(target, level, xoffset, yoffset, width, height,
+			format, type, pixels);
+}
+
+void CaptureWinGLEngine::updateTitle(qint64 paintNs)
+{
+	if (!m_titleTimer.isValid()) {
+		m_titleTimer.start();
+		return;
+	}
+	m_titleFrames++;
+	m_titlePaintNs += paintNs;
+
+	qint64 elapsed = m_titleTimer.nsecsElapsed();
+
+	if (elapsed < 1000000000LL)
+		return;
+	window()->setWindowTitle(QString("V4L2 Capture (OpenGL) - %1 fps, %2 ms per frame")
+		.arg(m_titleFrames * 1e9 / elapsed, 0, 'f', 2)
+		.arg(m_titlePaintNs / 1e6 / m_titleFrames, 0, 'f', 2));
+	m_titleFrames = 0;
+	m_titlePaintNs = 0;
+	m_titleTimer.restart();
+}
+
 bool CaptureWinGLEngine::hasNativeFormat(__u32 format)
 {
 	static const __u32 supported_fmts[] = {
@@ -353,6 +473,10 @@ bool CaptureWinGLEngine::hasNativeFormat(__u32 format)
 		V4L2_PIX_FMT_BGR32,
 		V4L2_PIX_FMT_XBGR32,
 		V4L2_PIX_FMT_ABGR32,
+		V4L2_PIX_FMT_RGBX32,
+		V4L2_PIX_FMT_RGBA32,
+		V4L2_PIX_FMT_BGRX32,
+		V4L2_PIX_FMT_BGRA32,
 		V4L2_PIX_FMT_RGB24,
 		V4L2_PIX_FMT_BGR24,
 		V4L2_PIX_FMT_RGB565,
@@ -360,9 +484,21 @@ bool CaptureWinGLEngine::hasNativeFormat(__u32 format)
 		V4L2_PIX_FMT_RGB444,
 		V4L2_PIX_FMT_XRGB444,
 		V4L2_PIX_FMT_ARGB444,
+		V4L2_PIX_FMT_XBGR444,
+		V4L2_PIX_FMT_ABGR444,
+		V4L2_PIX_FMT_RGBX444,
+		V4L2_PIX_FMT_RGBA444,
+		V4L2_PIX_FMT_BGRX444,
+		V4L2_PIX_FMT_BGRA444,
 		V4L2_PIX_FMT_RGB555,
 		V4L2_PIX_FMT_XRGB555,
 		V4L2_PIX_FMT_ARGB555,
+		V4L2_PIX_FMT_XBGR555,
+		V4L2_PIX_FMT_ABGR555,
+		V4L2_PIX_FMT_RGBX555,
+		V4L2_PIX_FMT_RGBA555,
+		V4L2_PIX_FMT_BGRX555,
+		V4L2_PIX_FMT_BGRA555,
 		V4L2_PIX_FMT_RGB555X,
 		V4L2_PIX_FMT_XRGB555X,
 		V4L2_PIX_FMT_ARGB555X,
@@ -538,6 +674,22 @@ void CaptureWinGLEngine::changeShader()
 	case V4L2_PIX_FMT_XBGR32:
 	case V4L2_PIX_FMT_ARGB32:
 	case V4L2_PIX_FMT_ABGR32:
+	case V4L2_PIX_FMT_RGBX32:
+	case V4L2_PIX_FMT_RGBA32:
+	case V4L2_PIX_FMT_BGRX32:
+	case V4L2_PIX_FMT_BGRA32:
+	case V4L2_PIX_FMT_XBGR444:
+	case V4L2_PIX_FMT_ABGR444:
+	case V4L2_PIX_FMT_RGBX444:
+	case V4L2_PIX_FMT_RGBA444:
+	case V4L2_PIX_FMT_BGRX444:
+	case V4L2_PIX_FMT_BGRA444:
+	case V4L2_PIX_FMT_XBGR555:
+	case V4L2_PIX_FMT_ABGR555:
+	case V4L2_PIX_FMT_RGBX555:
+	case V4L2_PIX_FMT_RGBA555:
+	case V4L2_PIX_FMT_BGRX555:
+	case V4L2_PIX_FMT_BGRA555:
 	case V4L2_PIX_FMT_GREY:
 	case V4L2_PIX_FMT_Z16:
 	case V4L2_PIX_FMT_INZI:
@@ -604,6 +756,9 @@ void CaptureWinGLEngine::paintGL()
 		glBlendFunc(GL_ONE_MINUS_SRC_ALPHA, GL_SRC_ALPHA);
 	}
 
+	QElapsedTimer paintTimer;
+
+	paintTimer.start();
 	switch (m_frameFormat) {
 	case V4L2_PIX_FMT_YUYV:
 	case V4L2_PIX_FMT_YVYU:
@@ -701,6 +856,22 @@ void CaptureWinGLEngine::paintGL()
 	case V4L2_PIX_FMT_XBGR32:
 	case V4L2_PIX_FMT_ARGB32:
 	case V4L2_PIX_FMT_ABGR32:
+	case V4L2_PIX_FMT_RGBX32:
+	case V4L2_PIX_FMT_RGBA32:
+	case V4L2_PIX_FMT_BGRX32:
+	case V4L2_PIX_FMT_BGRA32:
+	case V4L2_PIX_FMT_XBGR444:
+	case V4L2_PIX_FMT_ABGR444:
+	case V4L2_PIX_FMT_RGBX444:
+	case V4L2_PIX_FMT_RGBA444:
+	case V4L2_PIX_FMT_BGRX444:
+	case V4L2_PIX_FMT_BGRA444:
+	case V4L2_PIX_FMT_XBGR555:
+	case V4L2_PIX_FMT_ABGR555:
+	case V4L2_PIX_FMT_RGBX555:
+	case V4L2_PIX_FMT_RGBA555:
+	case V4L2_PIX_FMT_BGRX555:
+	case V4L2_PIX_FMT_BGRA555:
 	case V4L2_PIX_FMT_HSV24:
 	case V4L2_PIX_FMT_HSV32:
 	default:
@@ -708,6 +879,7 @@ void CaptureWinGLEngine::paintGL()
 		break;
 	}
 	paintFrame();
+	updateTitle(paintTimer.nsecsElapsed());
 
 	if (m_blending)
 		glBlendFunc(GL_ONE, GL_ZERO);
@@ -1047,7 +1219,7 @@ void CaptureWinGLEngine::render_YUV(__u32 format)
 	glBindTexture(GL_TEXTURE_2D, m_screenTexture[0]);
 	GLint Y = m_glfunction.glGetUniformLocation(m_shaderProgram.programId(), "ytex");
 	glUniform1i(Y, 0);
-	glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, m_frameWidth, m_frameHeight,
+	uploadTexture(GL_TEXTURE_2D, 0, 0, 0, m_frameWidth, m_frameHeight,
 			m_glRed, GL_UNSIGNED_BYTE, m_frameData);
 	checkError("YUV paint ytex");
 
@@ -1059,19 +1231,19 @@ void CaptureWinGLEngine::render_YUV(__u32 format)
 	case V4L2_PIX_FMT_YUV422P:
 	case V4L2_PIX_FMT_YUV420:
 	case V4L2_PIX_FMT_YVU420:
-		glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, m_frameWidth / hdiv, m_frameHeight / vdiv,
+		uploadTexture(GL_TEXTURE_2D, 0, 0, 0, m_frameWidth / hdiv, m_frameHeight / vdiv,
 			m_glRed, GL_UNSIGNED_BYTE, m_frameData == NULL ? NULL : &m_frameData[idxU]);
 		break;
 	case V4L2_PIX_FMT_YUV420M:
 	case V4L2_PIX_FMT_YUV422M:
 	case V4L2_PIX_FMT_YUV444M:
-		glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, m_frameWidth / hdiv, m_frameHeight / vdiv,
+		uploadTexture(GL_TEXTURE_2D, 0, 0, 0, m_frameWidth / hdiv, m_frameHeight / vdiv,
 			m_glRed, GL_UNSIGNED_BYTE, m_frameData2);
 		break;
 	case V4L2_PIX_FMT_YVU420M:
 	case V4L2_PIX_FMT_YVU422M:
 	case V4L2_PIX_FMT_YVU444M:
-		glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, m_frameWidth / hdiv, m_frameHeight / vdiv,
+		uploadTexture(GL_TEXTURE_2D, 0, 0, 0, m_frameWidth / hdiv, m_frameHeight / vdiv,
 			m_glRed, GL_UNSIGNED_BYTE, m_frameData3);
 		break;
 	}
@@ -1085,19 +1257,19 @@ void CaptureWinGLEngine::render_YUV(__u32 format)
 	case V4L2_PIX_FMT_YUV422P:
 	case V4L2_PIX_FMT_YUV420:
 	case V4L2_PIX_FMT_YVU420:
-		glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, m_frameWidth / hdiv, m_frameHeight / vdiv,
+		uploadTexture(GL_TEXTURE_2D, 0, 0, 0, m_frameWidth / hdiv, m_frameHeight / vdiv,
 			m_glRed, GL_UNSIGNED_BYTE, m_frameData == NULL ? NULL : &m_frameData[idxV]);
 		break;
 	case V4L2_PIX_FMT_YUV420M:
 	case V4L2_PIX_FMT_YUV422M:
 	case V4L2_PIX_FMT_YUV444M:
-		glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, m_frameWidth / hdiv, m_frameHeight / vdiv,
+		uploadTexture(GL_TEXTURE_2D, 0, 0, 0, m_frameWidth / hdiv, m_frameHeight / vdiv,
 			m_glRed, GL_UNSIGNED_BYTE, m_frameData3);
 		break;
 	case V4L2_PIX_FMT_YVU420M:
 	case V4L2_PIX_FMT_YVU422M:
 	case V4L2_PIX_FMT_YVU444M:
-		glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, m_frameWidth / hdiv, m_frameHeight / vdiv,
+		uploadTexture(GL_TEXTURE_2D, 0, 0, 0, m_frameWidth / hdiv, m_frameHeight / vdiv,
 			m_glRed, GL_UNSIGNED_BYTE, m_frameData2);
 		break;
 	}
@@ -1205,7 +1377,7 @@ void CaptureWinGLEngine::render_NV12(__u32 format)
 	glBindTexture(GL_TEXTURE_2D, m_screenTexture[0]);
 	GLint Y = m_glfunction.glGetUniformLocation(m_shaderProgram.programId(), "ytex");
 	glUniform1i(Y, 0);
-	glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, m_frameWidth, m_frameHeight,
+	uploadTexture(GL_TEXTURE_2D, 0, 0, 0, m_frameWidth, m_frameHeight,
 			m_glRed, GL_UNSIGNED_BYTE, m_frameData);
 	checkError("NV12 paint ytex");
 
@@ -1216,13 +1388,13 @@ void CaptureWinGLEngine::render_NV12(__u32 format)
 	switch (format) {
 	case V4L2_PIX_FMT_NV12:
 	case V4L2_PIX_FMT_NV21:
-		glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, m_frameWidth, m_frameHeight / 2,
+		uploadTexture(GL_TEXTURE_2D, 0, 0, 0, m_frameWidth, m_frameHeight / 2,
 				m_glRed, GL_UNSIGNED_BYTE,
 				m_frameData ? m_frameData + m_frameWidth * m_frameHeight : NULL);
 		break;
 	case V4L2_PIX_FMT_NV12M:
 	case V4L2_PIX_FMT_NV21M:
-		glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, m_frameWidth, m_frameHeight / 2,
+		uploadTexture(GL_TEXTURE_2D, 0, 0, 0, m_frameWidth, m_frameHeight / 2,
 				m_glRed, GL_UNSIGNED_BYTE, m_frameData2);
 		break;
 	}
@@ -1321,7 +1493,7 @@ void CaptureWinGLEngine::render_NV24(__u32 format)
 	glBindTexture(GL_TEXTURE_2D, m_screenTexture[0]);
 	GLint Y = m_glfunction.glGetUniformLocation(m_shaderProgram.programId(), "ytex");
 	glUniform1i(Y, 0);
-	glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, m_frameWidth, m_frameHeight,
+	uploadTexture(GL_TEXTURE_2D, 0, 0, 0, m_frameWidth, m_frameHeight,
 			m_glRed, GL_UNSIGNED_BYTE, m_frameData);
 	checkError("NV24 paint ytex");
 
@@ -1329,7 +1501,7 @@ void CaptureWinGLEngine::render_NV24(__u32 format)
 	glBindTexture(GL_TEXTURE_2D, m_screenTexture[1]);
 	GLint U = m_glfunction.glGetUniformLocation(m_shaderProgram.programId(), "uvtex");
 	glUniform1i(U, 1);
-	glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, m_frameWidth, m_frameHeight,
+	uploadTexture(GL_TEXTURE_2D, 0, 0, 0, m_frameWidth, m_frameHeight,
 			m_glRedGreen, GL_UNSIGNED_BYTE,
 			m_frameData ? m_frameData + m_frameWidth * m_frameHeight : NULL);
 	checkError("NV24 paint uvtex");
@@ -1434,7 +1606,7 @@ void CaptureWinGLEngine::render_NV16(__u32 format)
 	glBindTexture(GL_TEXTURE_2D, m_screenTexture[0]);
 	GLint Y = m_glfunction.glGetUniformLocation(m_shaderProgram.programId(), "ytex");
 	glUniform1i(Y, 0);
-	glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, m_frameWidth, m_frameHeight,
+	uploadTexture(GL_TEXTURE_2D, 0, 0, 0, m_frameWidth, m_frameHeight,
 			m_glRed, GL_UNSIGNED_BYTE, m_frameData);
 	checkError("NV16 paint ytex");
 
@@ -1445,13 +1617,13 @@ void CaptureWinGLEngine::render_NV16(__u32 format)
 	switch (format) {
 	case V4L2_PIX_FMT_NV16:
 	case V4L2_PIX_FMT_NV61:
-		glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, m_frameWidth, m_frameHeight,
+		uploadTexture(GL_TEXTURE_2D, 0, 0, 0, m_frameWidth, m_frameHeight,
 				m_glRed, GL_UNSIGNED_BYTE,
 				m_frameData ? m_frameData + m_frameWidth * m_frameHeight : NULL);
 		break;
 	case V4L2_PIX_FMT_NV16M:
 	case V4L2_PIX_FMT_NV61M:
-		glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, m_frameWidth, m_frameHeight,
+		uploadTexture(GL_TEXTURE_2D, 0, 0, 0, m_frameWidth, m_frameHeight,
 				m_glRed, GL_UNSIGNED_BYTE, m_frameData2);
 		break;
 	}
@@ -1574,7 +1746,7 @@ void CaptureWinGLEngine::render_YUY2(__u32 format)
 	glBindTexture(GL_TEXTURE_2D, m_screenTexture[0]);
 	GLint Y = m_glfunction.glGetUniformLocation(m_shaderProgram.programId(), "tex");
 	glUniform1i(Y, 0);
-	glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, m_frameWidth / 2, m_frameHeight,
+	uploadTexture(GL_TEXTURE_2D, 0, 0, 0, m_frameWidth / 2, m_frameHeight,
 			GL_RGBA, GL_UNSIGNED_BYTE, m_frameData);
 	checkError("YUY2 paint");
 }
@@ -1622,6 +1794,54 @@ void CaptureWinGLEngine::shader_RGB(__u32 format)
 			     GL_BGRA, GL_UNSIGNED_SHORT_4_4_4_4_REV, NULL);
 		break;
 
+	case V4L2_PIX_FMT_ABGR444:
+		hasAlpha = true;
+		/* fall-through */
+	case V4L2_PIX_FMT_XBGR444:
+		glTexImage2D(GL_TEXTURE_2D, 0, internalFmt, m_frameWidth, m_frameHeight, 0,
+			     GL_RGBA, GL_UNSIGNED_SHORT_4_4_4_4_REV, NULL);
+		break;
+
+	case V4L2_PIX_FMT_RGBA444:
+		hasAlpha = true;
+		/* fall-through */
+	case V4L2_PIX_FMT_RGBX444:
+		glTexImage2D(GL_TEXTURE_2D, 0, internalFmt, m_frameWidth, m_frameHeight, 0,
+			     GL_RGBA, GL_UNSIGNED_SHORT_4_4_4_4, NULL);
+		break;
+
+	case V4L2_PIX_FMT_BGRA444:
+		hasAlpha = true;
+		/* fall-through */
+	case V4L2_PIX_FMT_BGRX444:
+		glTexImage2D(GL_TEXTURE_2D, 0, internalFmt, m_frameWidth, m_frameHeight, 0,
+			     GL_BGRA, GL_UNSIGNED_SHORT_4_4_4_4, NULL);
+		break;
+
+	case V4L2_PIX_FMT_ABGR555:
+		hasAlpha = true;
+		/* fall-through */
+	case V4L2_PIX_FMT_XBGR555:
+		glTexImage2D(GL_TEXTURE_2D, 0, internalFmt, m_frameWidth, m_frameHeight, 0,
+			     GL_RGBA, GL_UNSIGNED_SHORT_1_5_5_5_REV, NULL);
+		break;
+
+	case V4L2_PIX_FMT_RGBA555:
+		hasAlpha = true;
+		/* fall-through */
+	case V4L2_PIX_FMT_RGBX555:
+		glTexImage2D(GL_TEXTURE_2D, 0, internalFmt, m_frameWidth, m_frameHeight, 0,
+			     GL_RGBA, GL_UNSIGNED_SHORT_5_5_5_1, NULL);
+		break;
+
+	case V4L2_PIX_FMT_BGRA555:
+		hasAlpha = true;
+		/* fall-through */
+	case V4L2_PIX_FMT_BGRX555:
+		glTexImage2D(GL_TEXTURE_2D, 0, internalFmt, m_frameWidth, m_frameHeight, 0,
+			     GL_BGRA, GL_UNSIGNED_SHORT_5_5_5_1, NULL);
+		break;
+
 	case V4L2_PIX_FMT_ARGB555X:
 		hasAlpha = true;
 		/* fall-through */
@@ -1663,6 +1883,15 @@ void CaptureWinGLEngine::shader_RGB(__u32 format)
 		glTexImage2D(GL_TEXTURE_2D, 0, internalFmt, m_frameWidth, m_frameHeight, 0,
 				GL_RGBA, GL_UNSIGNED_INT_8_8_8_8, NULL);
 		break;
+	case V4L2_PIX_FMT_RGBA32:
+	case V4L2_PIX_FMT_BGRA32:
+		hasAlpha = true;
+		/* fall-through */
+	case V4L2_PIX_FMT_RGBX32:
+	case V4L2_PIX_FMT_BGRX32:
+		glTexImage2D(GL_TEXTURE_2D, 0, internalFmt, m_frameWidth, m_frameHeight, 0,
+				GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+		break;
 	case V4L2_PIX_FMT_GREY:
 		glTexImage2D(GL_TEXTURE_2D, 0, m_glRed, m_frameWidth, m_frameHeight, 0,
 			     m_glRed, GL_UNSIGNED_BYTE, NULL);
@@ -1797,25 +2026,61 @@ void CaptureWinGLEngine::render_RGB(__u32 format)
 
 	switch (format) {
 	case V4L2_PIX_FMT_RGB332:
-		glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, m_frameWidth, m_frameHeight,
+		uploadTexture(GL_TEXTURE_2D, 0, 0, 0, m_frameWidth, m_frameHeight,
 				GL_RGB, GL_UNSIGNED_BYTE_3_3_2, m_frameData);
 		break;
 	case V4L2_PIX_FMT_RGB555:
 	case V4L2_PIX_FMT_XRGB555:
 	case V4L2_PIX_FMT_ARGB555:
-		glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, m_frameWidth, m_frameHeight,
+		uploadTexture(GL_TEXTURE_2D, 0, 0, 0, m_frameWidth, m_frameHeight,
 				GL_BGRA, GL_UNSIGNED_SHORT_1_5_5_5_REV, m_frameData);
 		break;
 
 	case V4L2_PIX_FMT_RGB444:
 	case V4L2_PIX_FMT_XRGB444:
 	case V4L2_PIX_FMT_ARGB444:
-		glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, m_frameWidth, m_frameHeight,
+		uploadTexture(GL_TEXTURE_2D, 0, 0, 0, m_frameWidth, m_frameHeight,
 				GL_BGRA, GL_UNSIGNED_SHORT_4_4_4_4_REV, m_frameData);
 		break;
 
+	case V4L2_PIX_FMT_XBGR444:
+	case V4L2_PIX_FMT_ABGR444:
+		uploadTexture(GL_TEXTURE_2D, 0, 0, 0, m_frameWidth, m_frameHeight,
+				GL_RGBA, GL_UNSIGNED_SHORT_4_4_4_4_REV, m_frameData);
+		break;
+
+	case V4L2_PIX_FMT_RGBX444:
+	case V4L2_PIX_FMT_RGBA444:
+		uploadTexture(GL_TEXTURE_2D, 0, 0, 0, m_frameWidth, m_frameHeight,
+				GL_RGBA, GL_UNSIGNED_SHORT_4_4_4_4, m_frameData);
+		break;
+
+	case V4L2_PIX_FMT_BGRX444:
+	case V4L2_PIX_FMT_BGRA444:
+		uploadTexture(GL_TEXTURE_2D, 0, 0, 0, m_frameWidth, m_frameHeight,
+				GL_BGRA, GL_UNSIGNED_SHORT_4_4_4_4, m_frameData);
+		break;
+
+	case V4L2_PIX_FMT_XBGR555:
+	case V4L2_PIX_FMT_ABGR555:
+		uploadTexture(GL_TEXTURE_2D, 0, 0, 0, m_frameWidth, m_frameHeight,
+				GL_RGBA, GL_UNSIGNED_SHORT_1_5_5_5_REV, m_frameData);
+		break;
+
+	case V4L2_PIX_FMT_RGBX555:
+	case V4L2_PIX_FMT_RGBA555:
+		uploadTexture(GL_TEXTURE_2D, 0, 0, 0, m_frameWidth, m_frameHeight,
+				GL_RGBA, GL_UNSIGNED_SHORT_5_5_5_1, m_frameData);
+		break;
+
+	case V4L2_PIX_FMT_BGRX555:
+	case V4L2_PIX_FMT_BGRA555:
+		uploadTexture(GL_TEXTURE_2D, 0, 0, 0, m_frameWidth, m_frameHeight,
+				GL_BGRA, GL_UNSIGNED_SHORT_5_5_5_1, m_frameData);
+		break;
+
 	case V4L2_PIX_FMT_GREY:
-		glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, m_frameWidth, m_frameHeight,
+		uploadTexture(GL_TEXTURE_2D, 0, 0, 0, m_frameWidth, m_frameHeight,
 				m_glRed, GL_UNSIGNED_BYTE, m_frameData);
 		break;
 
@@ -1824,12 +2089,12 @@ void CaptureWinGLEngine::render_RGB(__u32 format)
 	case V4L2_PIX_FMT_Y16:
 	case V4L2_PIX_FMT_Z16:
 	case V4L2_PIX_FMT_INZI:
-		glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, m_frameWidth, m_frameHeight,
+		uploadTexture(GL_TEXTURE_2D, 0, 0, 0, m_frameWidth, m_frameHeight,
 				m_glRed, GL_UNSIGNED_SHORT, m_frameData);
 		break;
 	case V4L2_PIX_FMT_Y16_BE:
 		glPixelStorei(GL_UNPACK_SWAP_BYTES, GL_TRUE);
-		glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, m_frameWidth, m_frameHeight,
+		uploadTexture(GL_TEXTURE_2D, 0, 0, 0, m_frameWidth, m_frameHeight,
 				m_glRed, GL_UNSIGNED_SHORT, m_frameData);
 		glPixelStorei(GL_UNPACK_SWAP_BYTES, GL_FALSE);
 		break;
@@ -1841,13 +2106,13 @@ void CaptureWinGLEngine::render_RGB(__u32 format)
 		// for the RGB555 format, and false for this format. This would have
 		// to be tested first, though.
 		glPixelStorei(GL_UNPACK_SWAP_BYTES, GL_TRUE);
-		glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, m_frameWidth, m_frameHeight,
+		uploadTexture(GL_TEXTURE_2D, 0, 0, 0, m_frameWidth, m_frameHeight,
 				GL_BGRA, GL_UNSIGNED_SHORT_1_5_5_5_REV, m_frameData);
 		glPixelStorei(GL_UNPACK_SWAP_BYTES, GL_FALSE);
 		break;
 
 	case V4L2_PIX_FMT_RGB565:
-		glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, m_frameWidth, m_frameHeight,
+		uploadTexture(GL_TEXTURE_2D, 0, 0, 0, m_frameWidth, m_frameHeight,
 				GL_RGB, GL_UNSIGNED_SHORT_5_6_5, m_frameData);
 		break;
 
@@ -1856,7 +2121,7 @@ void CaptureWinGLEngine::render_RGB(__u32 format)
 		// for the RGB565 format, and false for this format. This would have
 		// to be tested first, though.
 		glPixelStorei(GL_UNPACK_SWAP_BYTES, GL_TRUE);
-		glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, m_frameWidth, m_frameHeight,
+		uploadTexture(GL_TEXTURE_2D, 0, 0, 0, m_frameWidth, m_frameHeight,
 				GL_RGB, GL_UNSIGNED_SHORT_5_6_5, m_frameData);
 		glPixelStorei(GL_UNPACK_SWAP_BYTES, GL_FALSE);
 		break;
@@ -1865,21 +2130,31 @@ void CaptureWinGLEngine::render_RGB(__u32 format)
 	case V4L2_PIX_FMT_XRGB32:
 	case V4L2_PIX_FMT_ARGB32:
 	case V4L2_PIX_FMT_HSV32:
-		glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, m_frameWidth, m_frameHeight,
+		uploadTexture(GL_TEXTURE_2D, 0, 0, 0, m_frameWidth, m_frameHeight,
 				GL_BGRA, GL_UNSIGNED_INT_8_8_8_8, m_frameData);
 		break;
 	case V4L2_PIX_FMT_BGR666:
 	case V4L2_PIX_FMT_BGR32:
 	case V4L2_PIX_FMT_XBGR32:
 	case V4L2_PIX_FMT_ABGR32:
-		glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, m_frameWidth, m_frameHeight,
+		uploadTexture(GL_TEXTURE_2D, 0, 0, 0, m_frameWidth, m_frameHeight,
 				GL_BGRA, GL_UNSIGNED_INT_8_8_8_8_REV, m_frameData);
 		break;
+	case V4L2_PIX_FMT_RGBX32:
+	case V4L2_PIX_FMT_RGBA32:
+		uploadTexture(GL_TEXTURE_2D, 0, 0, 0, m_frameWidth, m_frameHeight,
+				GL_RGBA, GL_UNSIGNED_BYTE, m_frameData);
+		break;
+	case V4L2_PIX_FMT_BGRX32:
+	case V4L2_PIX_FMT_BGRA32:
+		uploadTexture(GL_TEXTURE_2D, 0, 0, 0, m_frameWidth, m_frameHeight,
+				GL_RGBA, GL_UNSIGNED_INT_8_8_8_8, m_frameData);
+		break;
 	case V4L2_PIX_FMT_RGB24:
 	case V4L2_PIX_FMT_BGR24:
 	case V4L2_PIX_FMT_HSV24:
 	default:
-		glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, m_frameWidth, m_frameHeight,
+		uploadTexture(GL_TEXTURE_2D, 0, 0, 0, m_frameWidth, m_frameHeight,
 				GL_RGB, GL_UNSIGNED_BYTE, m_frameData);
 		break;
 	}
@@ -2037,7 +2312,7 @@ void CaptureWinGLEngine::render_Bayer(__u32 format)
 	case V4L2_PIX_FMT_SGBRG8:
 	case V4L2_PIX_FMT_SGRBG8:
 	case V4L2_PIX_FMT_SRGGB8:
-		glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, m_frameWidth, m_frameHeight,
+		uploadTexture(GL_TEXTURE_2D, 0, 0, 0, m_frameWidth, m_frameHeight,
 				m_glRed, GL_UNSIGNED_BYTE, m_frameData);
 		break;
 	case V4L2_PIX_FMT_SBGGR10:
@@ -2052,7 +2327,7 @@ void CaptureWinGLEngine::render_Bayer(__u32 format)
 	case V4L2_PIX_FMT_SGBRG16:
 	case V4L2_PIX_FMT_SGRBG16:
 	case V4L2_PIX_FMT_SRGGB16:
-		glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, m_frameWidth, m_frameHeight,
+		uploadTexture(GL_TEXTURE_2D, 0, 0, 0, m_frameWidth, m_frameHeight,
 				m_glRed, GL_UNSIGNED_SHORT, m_frameData);
 		break;
 	}
@@ -2151,29 +2426,29 @@ void CaptureWinGLEngine::render_YUV_packed(__u32 format)
 
 	switch (format) {
 	case V4L2_PIX_FMT_YUV555:
-		glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, m_frameWidth, m_frameHeight,
+		uploadTexture(GL_TEXTURE_2D, 0, 0, 0, m_frameWidth, m_frameHeight,
 				GL_BGRA, GL_UNSIGNED_SHORT_1_5_5_5_REV, m_frameData);
 		break;
 
 	case V4L2_PIX_FMT_YUV444:
-		glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, m_frameWidth, m_frameHeight,
+		uploadTexture(GL_TEXTURE_2D, 0, 0, 0, m_frameWidth, m_frameHeight,
 				GL_BGRA, GL_UNSIGNED_SHORT_4_4_4_4_REV, m_frameData);
 		break;
 
 	case V4L2_PIX_FMT_YUV565:
-		glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, m_frameWidth, m_frameHeight,
+		uploadTexture(GL_TEXTURE_2D, 0, 0, 0, m_frameWidth, m_frameHeight,
 				GL_RGB, GL_UNSIGNED_SHORT_5_6_5, m_frameData);
 		break;
 
 	case V4L2_PIX_FMT_YUV32:
 	case V4L2_PIX_FMT_AYUV32:
 	case V4L2_PIX_FMT_XYUV32:
-		glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, m_frameWidth, m_frameHeight,
+		uploadTexture(GL_TEXTURE_2D, 0, 0, 0, m_frameWidth, m_frameHeight,
 				GL_BGRA, GL_UNSIGNED_INT_8_8_8_8, m_frameData);
 		break;
 	case V4L2_PIX_FMT_VUYA32:
 	case V4L2_PIX_FMT_VUYX32:
-		glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, m_frameWidth, m_frameHeight,
+		uploadTexture(GL_TEXTURE_2D, 0, 0, 0, m_frameWidth, m_frameHeight,
 				GL_BGRA, GL_UNSIGNED_INT_8_8_8_8_REV, m_frameData);
 		break;
 	}
@@ -16,6 +16,7 @@
 #include <QGLShader>
 #include <QGLShaderProgram>
 #include <QGLFunctions>
+#include <QElapsedTimer>
 #endif
 
 #include "qv4l2.h"
@@ -28,6 +29,10 @@
 // This must be equal to the max number of textures that any shader uses
 #define MAX_TEXTURES_NEEDED 3
 
+// The textures of this many frames can be uploaded at the same time
+#define PBO_FRAMES 3
+#define PBO_RING_SIZE (PBO_FRAMES * MAX_TEXTURES_NEEDED)
+
 class CaptureWinGLEngine : public QGLWidget
 {
 public:
@@ -88,6 +93,10 @@ private:
 	void paintSquare();
 	void configureTexture(size_t idx);
 	void checkError(const char *msg);
+	void uploadTexture(GLenum target, GLint level, GLint xoffset, GLint yoffset,
+			   GLsizei width, GLsizei height, GLenum format, GLenum type,
+			   const void *pixels);
+	void updateTitle(qint64 paintNs);
 
 	int m_frameWidth;
 	int m_frameHeight;
@@ -117,6 +126,15 @@ private:
 	bool m_blending;
 	GLint m_mag_filter;
 	GLint m_min_filter;
+	// Upload the textures through a ring of pixel buffer objects
+	bool m_pbo;
+	GLuint m_pbos[PBO_RING_SIZE];
+	unsigned m_pboSize[PBO_RING_SIZE];
+	unsigned m_pboIdx;
+	// Frame statistics shown in the window title
+	QElapsedTimer m_titleTimer;
+	unsigned m_titleFrames;
+	qint64 m_titlePaintNs;
 };
 
 #endif
@@ -76,6 +76,10 @@ GeneralTab::GeneralTab(const QString &device, cv4l_fd *fd, int n, QWidget *paren
 	m_isPlanar(false),
 	m_haveBuffers(false),
 	m_discreteSizes(false),
+	m_field(V4L2_FIELD_ANY),
+	m_queryGen(0),
+	m_queryStop(false),
+	m_fmtPending(false),
 	m_videoInput(NULL),
 	m_videoOutput(NULL),
 	m_audioInput(NULL),
@@ -125,6 +129,15 @@ GeneralTab::GeneralTab(const QString &device, cv4l_fd *fd, int n, QWidget *paren
 	m_device.append(device);
 	setSizeConstraint(QLayout::SetMinimumSize);
 
+	memset(&m_fmtKey, 0, sizeof(m_fmtKey));
+	connect(this, SIGNAL(fmtInfoReady()), SLOT(applyFmtInfo()), Qt::QueuedConnection);
+	/*
+	 * libv4lconvert does not serialize its enum and try_fmt emulation,
+	 * so only query a wrapped device from the GUI thread.
+	 */
+	if (m_fd->g_direct())
+		m_queryThread = std::thread(&GeneralTab::queryThread, this);
+
 	for (int i = 0; i < n; i++) {
 		m_maxw[i] = 0;
 	}
@@ -298,6 +311,24 @@ done:
 	fixWidth();
 }
 
+GeneralTab::~GeneralTab()
+{
+	stopQueries();
+}
+
+void GeneralTab::stopQueries()
+{
+	{
+		std::lock_guard<std::mutex> lock(m_queryLock);
+
+		m_queryStop = true;
+		m_queries.clear();
+	}
+	m_queryCond.notify_one();
+	if (m_queryThread.joinable())
+		m_queryThread.join();
+}
+
 void GeneralTab::sourceChangeSubscribe()
 {
 	v4l2_input vin;
@@ -712,6 +743,7 @@ void GeneralTab::formatSection(v4l2_fmtdesc fmt)
 			do {
 				m_vidOutFormats->addItem(pixfmt2s(fmt.pixelformat) +
 					" (" + (const char *)fmt.description + ")");
+				m_pixelformats.push_back(fmt.pixelformat);
 			} while (!enum_fmt(fmt));
 		}
 		addWidget(m_vidOutFormats);
@@ -728,6 +760,7 @@ void GeneralTab::formatSection(v4l2_fmtdesc fmt)
 					m_vidCapFormats->addItem(s + "Emulated)");
 				else
 					m_vidCapFormats->addItem(s + (const char *)fmt.description + ")");
+				m_pixelformats.push_back(fmt.pixelformat);
 			} while (!enum_fmt(fmt));
 		}
 		addWidget(m_vidCapFormats);
@@ -1240,6 +1273,7 @@ void GeneralTab::updateGUIOutput(__u32 output)
 void GeneralTab::inputChanged(int input)
 {
 	s_input((__u32)input);
+	invalidateFmtInfo();
 
 	if (m_audioInput)
 		updateAudioInput();
@@ -1252,6 +1286,7 @@ void GeneralTab::inputChanged(int input)
 void GeneralTab::outputChanged(int output)
 {
 	s_output((__u32)output);
+	invalidateFmtInfo();
 
 	if (m_audioOutput)
 		updateAudioOutput();
@@ -1547,8 +1582,18 @@ void GeneralTab::frameHeightChanged()
 void GeneralTab::frameSizeChanged(int idx)
 {
 	v4l2_frmsizeenum frmsize = { 0 };
+	bool ok;
+
+	{
+		std::lock_guard<std::mutex> lock(m_queryLock);
+		auto it = m_fmtInfo.find(m_fmtKey);
 
-	if (!enum_framesizes(frmsize, m_pixelformat, idx)) {
+		ok = it != m_fmtInfo.end() && idx >= 0 &&
+		     (unsigned)idx < it->second.sizes.size();
+		if (ok)
+			frmsize = it->second.sizes[idx];
+	}
+	if (ok && frmsize.type == V4L2_FRMSIZE_TYPE_DISCRETE) {
 		cv4l_fmt fmt;
 
 		g_fmt(fmt);
@@ -1564,9 +1609,18 @@ void GeneralTab::frameSizeChanged(int idx)
 void GeneralTab::frameIntervalChanged(int idx)
 {
 	v4l2_frmivalenum frmival = { 0 };
+	bool ok;
 
-	if (!enum_frameintervals(frmival, m_pixelformat, m_width, m_height, idx)
-	    && frmival.type == V4L2_FRMIVAL_TYPE_DISCRETE) {
+	{
+		std::lock_guard<std::mutex> lock(m_queryLock);
+		auto it = m_fmtInfo.find(m_fmtKey);
+
+		ok = it != m_fmtInfo.end() && idx >= 0 &&
+		     (unsigned)idx < it->second.intervals.size();
+		if (ok)
+			frmival = it->second.intervals[idx];
+	}
+	if (ok && frmival.type == V4L2_FRMIVAL_TYPE_DISCRETE) {
 		if (!set_interval(frmival.discrete))
 			m_interval = frmival.discrete;
 	}
@@ -1819,6 +1873,7 @@ void GeneralTab::updateStandard()
 		vs.framelines);
 	m_tvStandard->setStatusTip(what);
 	m_tvStandard->setWhatsThis(what);
+	invalidateFmtInfo();
 	updateVidFormat();
 	if (!isVbi() && !m_isOutput)
 		changePixelAspectRatio();
@@ -1892,6 +1947,7 @@ void GeneralTab::updateTimings()
 	m_isSDTV = p.timings.bt.width <= 720 && p.timings.bt.height <= 576;
 	m_videoTimings->setStatusTip(what);
 	m_videoTimings->setWhatsThis(what);
+	invalidateFmtInfo();
 	updateVidFormat();
 	g_mw->updateLimRGBRange();
 }
@@ -1987,8 +2043,8 @@ void GeneralTab::updateColorspace()
 
 void GeneralTab::updateVidCapFormat()
 {
-	v4l2_fmtdesc desc;
 	cv4l_fmt fmt;
+	unsigned idx;
 
 	if (isVbi())
 		return;
@@ -1996,27 +2052,23 @@ void GeneralTab::updateVidCapFormat()
 	m_pixelformat = fmt.g_pixelformat();
 	m_width = fmt.g_width();
 	m_height = fmt.g_height();
+	m_field = fmt.g_field();
 	updateColorspace();
-	updateFrameSize();
-	updateFrameInterval();
-	if (!enum_fmt(desc, true)) {
-		do {
-			if (desc.pixelformat == m_pixelformat)
-				break;
-		} while (!enum_fmt(desc));
-	}
-	if (desc.pixelformat != m_pixelformat)
+	updateFmtInfo(fmt);
+	for (idx = 0; idx < m_pixelformats.size(); idx++)
+		if (m_pixelformats[idx] == m_pixelformat)
+			break;
+	if (idx == m_pixelformats.size())
 		return;
-	m_vidCapFormats->setCurrentIndex(desc.index);
-	updateVidFields();
+	m_vidCapFormats->setCurrentIndex(idx);
 	updateCrop();
 	updateCompose();
 }
 
 void GeneralTab::updateVidOutFormat()
 {
-	v4l2_fmtdesc desc;
 	cv4l_fmt fmt;
+	unsigned idx;
 
 	if (isVbi())
 		return;
@@ -2024,42 +2076,163 @@ void GeneralTab::updateVidOutFormat()
 	m_pixelformat = fmt.g_pixelformat();
 	m_width = fmt.g_width();
 	m_height = fmt.g_height();
+	m_field = fmt.g_field();
 	updateColorspace();
-	updateFrameSize();
-	if (!enum_fmt(desc, true)) {
-		do {
-			if (desc.pixelformat == m_pixelformat)
-				break;
-		} while (!enum_fmt(desc));
-	}
-	if (desc.pixelformat != m_pixelformat)
+	updateFmtInfo(fmt);
+	for (idx = 0; idx < m_pixelformats.size(); idx++)
+		if (m_pixelformats[idx] == m_pixelformat)
+			break;
+	if (idx == m_pixelformats.size())
 		return;
-	m_vidOutFormats->setCurrentIndex(desc.index);
-	updateVidFields();
+	m_vidOutFormats->setCurrentIndex(idx);
 	updateCrop();
 	updateCompose();
 }
 
-void GeneralTab::updateVidFields()
+void GeneralTab::updateFmtInfo(const cv4l_fmt &fmt)
 {
-	cv4l_fmt fmt;
+	FmtQuery query;
+	FmtInfo info;
+
+	query.key.pixelformat = m_pixelformat;
+	query.key.width = m_width;
+	query.key.height = m_height;
+	query.fmt = fmt;
+	m_fmtKey = query.key;
+
+	if (!m_queryThread.joinable()) {
+		// Wrapped device: query synchronously, but still cache it
+		std::unique_lock<std::mutex> lock(m_queryLock);
+		auto it = m_fmtInfo.find(m_fmtKey);
+
+		if (it == m_fmtInfo.end()) {
+			lock.unlock();
+			queryFmtInfo(query, info);
+			lock.lock();
+			m_fmtInfo[m_fmtKey] = info;
+		} else {
+			info = it->second;
+		}
+	} else {
+		std::lock_guard<std::mutex> lock(m_queryLock);
+		auto it = m_fmtInfo.find(m_fmtKey);
+
+		if (it == m_fmtInfo.end()) {
+			query.gen = m_queryGen;
+			m_queries.push_back(query);
+			m_queryCond.notify_one();
+			m_fmtPending = true;
+			return;
+		}
+		info = it->second;
+	}
+	m_fmtPending = false;
+	updateFrameSize(info);
+	updateVidFields(info);
+}
+
+void GeneralTab::applyFmtInfo()
+{
+	FmtInfo info;
+
+	if (!m_fmtPending)
+		return;
+	{
+		std::lock_guard<std::mutex> lock(m_queryLock);
+		auto it = m_fmtInfo.find(m_fmtKey);
+
+		if (it == m_fmtInfo.end())
+			return;
+		info = it->second;
+	}
+	m_fmtPending = false;
+	updateFrameSize(info);
+	updateVidFields(info);
+}
+
+void GeneralTab::invalidateFmtInfo()
+{
+	std::lock_guard<std::mutex> lock(m_queryLock);
+
+	m_fmtInfo.clear();
+	m_queries.clear();
+	m_queryGen++;
+}
+
+void GeneralTab::queryThread()
+{
+	std::unique_lock<std::mutex> lock(m_queryLock);
+
+	for (;;) {
+		m_queryCond.wait(lock, [this] {
+			return m_queryStop || !m_queries.empty();
+		});
+		if (m_queryStop)
+			break;
+
+		FmtQuery query = m_queries.front();
+		FmtInfo info;
+
+		m_queries.pop_front();
+		if (query.gen != m_queryGen || m_fmtInfo.count(query.key))
+			continue;
+
+		lock.unlock();
+		queryFmtInfo(query, info);
+		lock.lock();
+
+		// Drop the result if the input, standard or timings changed meanwhile
+		if (query.gen != m_queryGen || m_queryStop)
+			continue;
+		m_fmtInfo[query.key] = info;
+		lock.unlock();
+		emit fmtInfoReady();
+		lock.lock();
+	}
+}
+
+void GeneralTab::queryFmtInfo(const FmtQuery &query, FmtInfo &info)
+{
+	v4l2_frmsizeenum frmsize;
+	v4l2_frmivalenum frmival = { 0 };
 	cv4l_fmt tmp;
-	bool first = true;
 
-	g_fmt(fmt);
+	info.sizesOk = !m_fd->enum_framesizes(frmsize, query.key.pixelformat);
+	if (info.sizesOk) {
+		info.sizes.push_back(frmsize);
+		if (frmsize.type == V4L2_FRMSIZE_TYPE_DISCRETE)
+			while (!m_fd->enum_framesizes(frmsize))
+				info.sizes.push_back(frmsize);
+	}
+
+	info.intervalsOk = !m_fd->enum_frameintervals(frmival, query.key.pixelformat,
+						      query.key.width, query.key.height);
+	if (info.intervalsOk) {
+		info.intervals.push_back(frmival);
+		if (frmival.type == V4L2_FRMIVAL_TYPE_DISCRETE)
+			while (!m_fd->enum_frameintervals(frmival))
+				info.intervals.push_back(frmival);
+	}
 
 	for (__u32 f = V4L2_FIELD_NONE; f <= V4L2_FIELD_INTERLACED_BT; f++) {
-		tmp = fmt;
+		tmp = query.fmt;
 		tmp.s_field(f);
-		if (try_fmt(tmp) || tmp.g_field() != f)
+		if (m_fd->try_fmt(tmp) || tmp.g_field() != f)
 			continue;
-		if (first) {
-			m_vidFields->clear();
-			first = false;
-		}
-		m_vidFields->addItem(field2s(f));
-		if (fmt.g_field() == f)
-			m_vidFields->setCurrentIndex(m_vidFields->count() - 1);
+		info.fields.push_back(f);
+	}
+}
+
+void GeneralTab::updateVidFields(const FmtInfo &info)
+{
+	if (info.fields.empty())
+		return;
+
+	m_vidFields->clear();
+	for (unsigned i = 0; i < info.fields.size(); i++) {
+		m_vidFields->addItem(field2s(info.fields[i]));
+		if (info.fields[i] == m_field)
+			m_vidFields->setCurrentIndex(i);
 	}
 }
 
@@ -2152,23 +2325,26 @@ void GeneralTab::updateCompose()
 	emit clearBuffers();
 }
 
-void GeneralTab::updateFrameSize()
+void GeneralTab::updateFrameSize(const FmtInfo &info)
 {
-	v4l2_frmsizeenum frmsize;
-	bool ok = false;
+	v4l2_frmsizeenum frmsize = { 0 };
+	bool ok = info.sizesOk;
 
 	if (m_frameSize)
 		m_frameSize->clear();
 
-	ok = !enum_framesizes(frmsize, m_pixelformat);
+	if (ok)
+		frmsize = info.sizes[0];
 	if (ok && frmsize.type == V4L2_FRMSIZE_TYPE_DISCRETE) {
-		do {
+		for (unsigned i = 0; i < info.sizes.size(); i++) {
+			const v4l2_frmsizeenum &size = info.sizes[i];
+
 			m_frameSize->addItem(QString("%1x%2")
-				.arg(frmsize.discrete.width).arg(frmsize.discrete.height));
-			if (frmsize.discrete.width == m_width &&
-			    frmsize.discrete.height == m_height)
-				m_frameSize->setCurrentIndex(frmsize.index);
-		} while (!enum_framesizes(frmsize));
+				.arg(size.discrete.width).arg(size.discrete.height));
+			if (size.discrete.width == m_width &&
+			    size.discrete.height == m_height)
+				m_frameSize->setCurrentIndex(i);
+		}
 
 		m_discreteSizes = true;
 		m_frameWidth->setEnabled(false);
@@ -2185,7 +2361,7 @@ void GeneralTab::updateFrameSize()
 		m_frameHeight->setValue(m_height);
 		m_frameHeight->blockSignals(false);
 		m_frameSize->setEnabled(!m_haveBuffers);
-		updateFrameInterval();
+		updateFrameInterval(info);
 		return;
 	}
 	if (!ok) {
@@ -2200,7 +2376,7 @@ void GeneralTab::updateFrameSize()
 	if (m_frameSize)
 		m_frameSize->setEnabled(false);
 	if (!m_frameWidth) {
-		updateFrameInterval();
+		updateFrameInterval(info);
 		return;
 	}
 
@@ -2219,7 +2395,7 @@ void GeneralTab::updateFrameSize()
 	m_frameHeight->setSingleStep(frmsize.stepwise.step_height);
 	m_frameHeight->setValue(m_height);
 	m_frameHeight->blockSignals(false);
-	updateFrameInterval();
+	updateFrameInterval(info);
 }
 
 CropMethod GeneralTab::getCropMethod()
@@ -2318,33 +2494,34 @@ double GeneralTab::getPixelAspectRatio()
 	       (((double)ratio.numerator * h) / cur_height);
 }
 
-void GeneralTab::updateFrameInterval()
+void GeneralTab::updateFrameInterval(const FmtInfo &info)
 {
-	v4l2_frmivalenum frmival = { 0 };
 	v4l2_fract curr = { 1, 1 };
-	bool curr_ok, ok;
+	bool curr_ok;
 
 	if (m_frameInterval == NULL)
 		return;
 
 	m_frameInterval->clear();
 
-	ok = !enum_frameintervals(frmival, m_pixelformat, m_width, m_height);
-	m_has_interval = ok && frmival.type == V4L2_FRMIVAL_TYPE_DISCRETE;
+	m_has_interval = info.intervalsOk &&
+			 info.intervals[0].type == V4L2_FRMIVAL_TYPE_DISCRETE;
 	m_frameInterval->setEnabled(m_has_interval);
 	if (m_has_interval) {
-	        m_interval = frmival.discrete;
-        	curr_ok = !m_fd->get_interval(curr);
-		do {
+		m_interval = info.intervals[0].discrete;
+		curr_ok = !m_fd->get_interval(curr);
+		for (unsigned i = 0; i < info.intervals.size(); i++) {
+			const v4l2_fract &ival = info.intervals[i].discrete;
+
 			m_frameInterval->addItem(QString("%1 fps")
-				.arg((double)frmival.discrete.denominator / frmival.discrete.numerator));
+				.arg((double)ival.denominator / ival.numerator));
 			if (curr_ok &&
-			    frmival.discrete.numerator == curr.numerator &&
-			    frmival.discrete.denominator == curr.denominator) {
-				m_frameInterval->setCurrentIndex(frmival.index);
-				m_interval = frmival.discrete;
-                        }
-		} while (!enum_frameintervals(frmival));
+			    ival.numerator == curr.numerator &&
+			    ival.denominator == curr.denominator) {
+				m_frameInterval->setCurrentIndex(i);
+				m_interval = ival;
+			}
+		}
 	}
 }
 
@@ -2401,10 +2578,16 @@ int GeneralTab::matchAudioDevice()
 {
 	QStringList devPath = m_device.split("/");
 	QString curDev = devPath.value(devPath.count() - 1);
-	void *media;
+	static void *media;
 	int match;
 
-	media = discover_media_devices();
+	/* Keep the list across calls, only applying the hotplug changes */
+	if (media)
+		media_devices_cache_update(media);
+	else
+		media = media_devices_cache_new();
+	if (!media)
+		return -1;
 
 	if ((match = checkMatchAudioDevice(media, curDev.toLatin1(), MEDIA_SND_CAP)) != -1)
 		return match;
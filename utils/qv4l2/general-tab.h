@@ -29,7 +29,12 @@
 #include <QStackedWidget>
 #include <sys/time.h>
 #include <linux/videodev2.h>
+#include <condition_variable>
+#include <deque>
 #include <map>
+#include <mutex>
+#include <thread>
+#include <vector>
 
 #include "qv4l2.h"
 #include "capture-win.h"
@@ -48,13 +53,48 @@ class QSpinBox;
 class QToolButton;
 class QSlider;
 
+/* Frame size and frame interval enumeration key */
+struct FmtKey {
+	__u32 pixelformat;
+	__u32 width, height;
+
+	bool operator<(const FmtKey &k) const
+	{
+		if (pixelformat != k.pixelformat)
+			return pixelformat < k.pixelformat;
+		if (width != k.width)
+			return width < k.width;
+		return height < k.height;
+	}
+	bool operator==(const FmtKey &k) const
+	{
+		return pixelformat == k.pixelformat &&
+		       width == k.width && height == k.height;
+	}
+};
+
+/* What the device supports for a format, as found by the query thread */
+struct FmtInfo {
+	bool sizesOk;
+	std::vector<v4l2_frmsizeenum> sizes;
+	bool intervalsOk;
+	std::vector<v4l2_frmivalenum> intervals;
+	std::vector<__u32> fields;
+};
+
+struct FmtQuery {
+	FmtKey key;
+	cv4l_fmt fmt;
+	unsigned gen;
+};
+
 class GeneralTab: public QGridLayout
 {
 	Q_OBJECT
 
 public:
 	GeneralTab(const QString &device, cv4l_fd *fd, int n, QWidget *parent = 0);
-	virtual ~GeneralTab() {}
+	virtual ~GeneralTab();
 
 	CapMethod capMethod();
 	QString getAudioInDevice();
@@ -85,6 +125,7 @@ public:
 	}
 	void sourceChange(const v4l2_event &ev);
 	void sourceChangeSubscribe();
+	void stopQueries();
 	int getWidth();
 	unsigned getNumBuffers() const;
 	QComboBox *m_tpgComboColorspace;
@@ -97,8 +138,10 @@ signals:
 	void pixelAspectRatioChanged();
 	void croppingChanged();
 	void clearBuffers();
+	void fmtInfoReady();
 
 private slots:
+	void applyFmtInfo();
 	void inputChanged(int);
 	void outputChanged(int);
 	void inputAudioChanged(int);
@@ -155,9 +198,13 @@ private:
 	void updateColorspace();
 	void clearColorspace(cv4l_fmt &fmt);
 	void updateVidCapFormat();
-	void updateVidFields();
-	void updateFrameSize();
-	void updateFrameInterval();
+	void updateFmtInfo(const cv4l_fmt &fmt);
+	void updateVidFields(const FmtInfo &info);
+	void updateFrameSize(const FmtInfo &info);
+	void updateFrameInterval(const FmtInfo &info);
+	void invalidateFmtInfo();
+	void queryThread();
+	void queryFmtInfo(const FmtQuery &query, FmtInfo &info);
 	void updateVidOutFormat();
 	void updateCrop();
 	void updateCompose();
@@ -317,6 +364,23 @@ private:
 	struct v4l2_capability m_querycap;
 	__u32 m_pixelformat;
 	__u32 m_width, m_height;
+	__u32 m_field;
+	std::vector<__u32> m_pixelformats;
+
+	/*
+	 * Enumerating the frame sizes, intervals and fields can take seconds
+	 * on slow USB devices, so that is done by a thread, which caches the
+	 * results per format until the input, standard or timings change.
+	 */
+	std::thread m_queryThread;
+	std::mutex m_queryLock;
+	std::condition_variable m_queryCond;
+	std::deque<FmtQuery> m_queries;
+	std::map<FmtKey, FmtInfo> m_fmtInfo;
+	unsigned m_queryGen;
+	bool m_queryStop;
+	bool m_fmtPending;
+	FmtKey m_fmtKey;
 	struct v4l2_fract m_interval;
 	bool m_has_interval;
 	int m_audioDeviceBufferSize;
@@ -1133,6 +1133,25 @@ void ApplicationWindow::capFrame()
 		}
 		status.append(QString(" Average A-V: %1 ms")
 			      .arg((m_totalAudioLatency.tv_sec * 1000 + m_totalAudioLatency.tv_usec / 1000) / m_frame));
+
+		/*
+		 * Have the audio follow the delay between capturing and
+		 * showing a frame, so that audio and video stay in sync.
+		 */
+		if (buf.g_timestamp_type() == V4L2_BUF_FLAG_TIMESTAMP_MONOTONIC) {
+			struct timespec now;
+			long long delay;
+
+			clock_gettime(CLOCK_MONOTONIC, &now);
+			delay = (now.tv_sec - buf.g_timestamp().tv_sec) * 1000000LL +
+				now.tv_nsec / 1000 - buf.g_timestamp().tv_usec;
+			if (delay > 0 && delay < 1000000) {
+				m_videoLatency = m_videoLatency ?
+					(m_videoLatency * 15 + delay) / 16 : delay;
+				alsa_thread_set_latency(m_videoLatency);
+			}
+		}
+		status.append(QString(" Audio latency: %1 ms").arg(alsa_thread_latency() / 1000));
 	}
 #endif
 	if (plane[0] == NULL && showFrames())
@@ -1260,6 +1279,7 @@ void ApplicationWindow::startAudio()
 #ifdef HAVE_ALSA
 	m_totalAudioLatency.tv_sec = 0;
 	m_totalAudioLatency.tv_usec = 0;
+	m_videoLatency = 0;
 
 	QString audIn = m_genTab->getAudioInDevice();
 	QString audOut = m_genTab->getAudioOutDevice();
@@ -1564,6 +1584,8 @@ void ApplicationWindow::capStart(bool start)
 	case V4L2_PIX_FMT_BGR32:
 	case V4L2_PIX_FMT_XRGB32:
 	case V4L2_PIX_FMT_XBGR32:
+	case V4L2_PIX_FMT_RGBX32:
+	case V4L2_PIX_FMT_BGRX32:
 	case V4L2_PIX_FMT_YUV32:
 	case V4L2_PIX_FMT_XYUV32:
 	case V4L2_PIX_FMT_VUYX32:
@@ -1571,6 +1593,8 @@ void ApplicationWindow::capStart(bool start)
 		break;
 	case V4L2_PIX_FMT_ARGB32:
 	case V4L2_PIX_FMT_ABGR32:
+	case V4L2_PIX_FMT_RGBA32:
+	case V4L2_PIX_FMT_BGRA32:
 	case V4L2_PIX_FMT_AYUV32:
 	case V4L2_PIX_FMT_VUYA32:
 		dstFmt = QImage::Format_ARGB32;
@@ -1634,6 +1658,8 @@ void ApplicationWindow::closeDevice()
 		}
 		delete [] m_frameData;
 		m_frameData = NULL;
+		if (m_genTab)
+			m_genTab->stopQueries();
 		v4lconvert_destroy(m_convertData);
 		cv4l_fd::close();
 		delete m_capture;
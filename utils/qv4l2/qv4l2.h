@@ -293,6 +293,7 @@ private:
 	double m_fps;
 	struct timespec m_startTimestamp;
 	struct timeval m_totalAudioLatency;
+	unsigned m_videoLatency;
 	QFile m_saveRaw;
 };
 
@@ -0,0 +1 @@
+../common/raw2sliced.h
\ No newline at end of file
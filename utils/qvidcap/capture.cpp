@@ -22,7 +22,9 @@
 #include <QTimer>
 #include <QApplication>
 
+#include <sys/socket.h>
 #include <netinet/in.h>
+#include <time.h>
 #include "v4l2-info.h"
 
 const __u32 formats[] = {
@@ -211,6 +213,13 @@ CaptureWin::CaptureWin(QScrollArea *sa, QWidget *parent) :
 	QOpenGLWidget(parent),
 	m_fd(0),
 	m_sock(0),
+	m_udp(false),
+	m_udpFmtValid(false),
+	m_udpSynced(false),
+	m_decodeRunning(false),
+	m_decodeStop(false),
+	m_fwhtGpu(false),
+	m_decodeCoeffs(false),
 	m_v4l_queue(0),
 	m_frame(0),
 	m_ctx(0),
@@ -223,8 +232,32 @@ CaptureWin::CaptureWin(QScrollArea *sa, QWidget *parent) :
 	m_program(0),
 	m_curIndex(-1),
 	m_nextIndex(-1),
+	m_dmabuf(false),
+	m_pbo(false),
+	m_pboIdx(0),
+	m_fwhtTexValid(false),
+	m_fwhtCur(0),
+	m_fwhtFrame(false),
+	m_fwhtVao(0),
+	m_fwhtFbo(0),
+	m_titleFrames(0),
+	m_titlePaintNs(0),
+	m_timingPending(false),
+	m_latencyCsv(NULL),
+	m_latencyStart(0),
+	m_latencyFrames(0),
+	m_latencyCaptured(0),
+	m_latencyMax(0),
 	m_scrollArea(sa)
 {
+	memset(&m_nextTiming, 0, sizeof(m_nextTiming));
+	memset(&m_curTiming, 0, sizeof(m_curTiming));
+	memset(m_latencySum, 0, sizeof(m_latencySum));
+	memset(m_dmabufImages, 0, sizeof(m_dmabufImages));
+	memset(m_decodeSlots, 0, sizeof(m_decodeSlots));
+	m_fwhtProgram[0] = m_fwhtProgram[1] = NULL;
+	pthread_mutex_init(&m_decodeLock, NULL);
+	pthread_cond_init(&m_decodeCond, NULL);
 	m_curSize[0] = 0;
 	m_curData[0] = 0;
 	m_canOverrideResolution = false;
@@ -314,11 +347,30 @@ CaptureWin::CaptureWin(QScrollArea *sa, QWidget *parent) :
 	m_exitFullScreen = new QAction("Exit fullscreen (F or Esc)", this);
 	connect(m_exitFullScreen, SIGNAL(triggered(bool)),
 		this, SLOT(toggleFullScreen(bool)));
+
+	m_latencyOverlay = new QAction("Show frame latency (L)", this);
+	m_latencyOverlay->setCheckable(true);
+	connect(m_latencyOverlay, SIGNAL(triggered(bool)),
+		this, SLOT(latencyOverlayChanged(bool)));
+
+	m_latencyLabel = new QLabel(this);
+	m_latencyLabel->setStyleSheet("QLabel { background-color: rgba(0, 0, 0, 160); "
+				      "color: white; font-family: monospace; padding: 4px; }");
+	m_latencyLabel->setAttribute(Qt::WA_TransparentForMouseEvents);
+	m_latencyLabel->move(8, 8);
+	m_latencyLabel->hide();
+	connect(this, SIGNAL(frameSwapped()), this, SLOT(frameSwappedEvent()));
 }
 
 CaptureWin::~CaptureWin()
 {
+	stopDecoder();
+	pthread_cond_destroy(&m_decodeCond);
+	pthread_mutex_destroy(&m_decodeLock);
 	makeCurrent();
+	freeDmabufImages();
+	if (m_pbo)
+		glDeleteBuffers(PBO_RING_SIZE, m_pbos);
 	delete m_program;
 }
 
@@ -517,6 +569,7 @@ void CaptureWin::contextMenuEvent(QContextMenuEvent *event)
 		menu.addAction(m_exitFullScreen);
 	else
 		menu.addAction(m_enterFullScreen);
+	menu.addAction(m_latencyOverlay);
 
 	if (m_canOverrideResolution) {
 		menu.addAction(m_resolutionOverride);
@@ -582,8 +635,10 @@ void CaptureWin::keyPressEvent(QKeyEvent *event)
 	case Qt::Key_Space:
 		if (m_mode == AppModeTest)
 			m_cnt = 1;
-		else if (m_singleStep && m_frame > m_singleStepStart)
+		else if (m_singleStep && m_frame > m_singleStepStart) {
 			m_singleStepNext = true;
+			stepDecoder();
+		}
 		return;
 	case Qt::Key_Escape:
 		if (!m_scrollArea->isFullScreen())
@@ -634,6 +689,9 @@ void CaptureWin::keyPressEvent(QKeyEvent *event)
 		checkSubMenuItem(m_hsvEncMenu, m_overrideHSVEnc);
 		updateShader();
 		return;
+	case Qt::Key_L:
+		setLatencyOverlay(!m_latencyOverlay->isChecked());
+		return;
 	case Qt::Key_I:
 		cycleMenu(m_overrideField, m_origField,
 			  fields, hasShift, hasCtrl);
@@ -799,11 +857,16 @@ void CaptureWin::setModeSocket(int socket, int port)
 	m_sock = socket;
 	m_port = port;
 	if (m_ctx)
-		free(m_ctx);
+		fwht_free(m_ctx);
 	m_ctx = fwht_alloc(m_v4l_fmt.g_pixelformat(), m_v4l_fmt.g_width(), m_v4l_fmt.g_height(),
 			   m_v4l_fmt.g_width(), m_v4l_fmt.g_height(),
 			   m_v4l_fmt.g_field(), m_v4l_fmt.g_colorspace(), m_v4l_fmt.g_xfer_func(),
-			   m_v4l_fmt.g_ycbcr_enc(), m_v4l_fmt.g_quantization());
+			   m_v4l_fmt.g_ycbcr_enc(), m_v4l_fmt.g_quantization(), 1);
+
+	if (!m_udp) {
+		startDecoder();
+		return;
+	}
 
 	QSocketNotifier *readSock = new QSocketNotifier(m_sock,
 		QSocketNotifier::Read, this);
@@ -811,6 +874,16 @@ void CaptureWin::setModeSocket(int socket, int port)
 	connect(readSock, SIGNAL(activated(int)), this, SLOT(sockReadEvent()));
 }
 
+void CaptureWin::setModeUdp(int socket, int port)
+{
+	m_udp = true;
+	/* initUdpSocket() left the FMT_VIDEO packet in udp_stream */
+	m_udpFmt = QByteArray((const char *)udp_stream.buf, udp_stream.size);
+	m_udpFmtValid = true;
+	m_udpSynced = false;
+	setModeSocket(socket, port);
+}
+
 void CaptureWin::setModeFile(const QString &filename)
 {
 	m_mode = AppModeFile;
@@ -1122,6 +1195,12 @@ void CaptureWin::v4l2ReadEvent()
 	if (m_fd->dqbuf(buf))
 		return;
 
+	m_nextTiming.sequence = buf.g_sequence();
+	m_nextTiming.dequeued = monotonicNs();
+	m_nextTiming.captured = 0;
+	if (buf.g_timestamp_type() == V4L2_BUF_FLAG_TIMESTAMP_MONOTONIC &&
+	    buf.g_timestamp_ns() <= m_nextTiming.dequeued)
+		m_nextTiming.captured = buf.g_timestamp_ns();
 	for (unsigned i = 0; i < m_v4l_queue->g_num_planes(); i++) {
 		m_nextData[i] = (__u8 *)m_v4l_queue->g_dataptr(buf.g_index(), i);
 		m_nextSize[i] = buf.g_bytesused(i);
@@ -1140,6 +1219,124 @@ void CaptureWin::v4l2ReadEvent()
 		std::exit(EXIT_SUCCESS);
 }
 
+__u64 CaptureWin::monotonicNs()
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+void CaptureWin::setLatencyCsv(FILE *csv)
+{
+	m_latencyCsv = csv;
+	fprintf(csv, "sequence,timestamp_us,dqbuf_us,paint_us,upload_us,swap_us,total_us\n");
+}
+
+void CaptureWin::setLatencyOverlay(bool show)
+{
+	m_latencyOverlay->setChecked(show);
+	latencyOverlayChanged(show);
+}
+
+void CaptureWin::latencyOverlayChanged(bool show)
+{
+	m_latencyStart = 0;
+	m_latencyLabel->setVisible(show);
+	if (!show)
+		return;
+	if (m_mode == AppModeV4L2)
+		m_latencyLabel->setText("Waiting for frames");
+	else
+		m_latencyLabel->setText("Only available when capturing from a video device");
+	m_latencyLabel->adjustSize();
+}
+
+/*
+ * Called once a painted frame is on its way to the screen. Split the
+ * latency of the frame in the time spent in the driver (capture to DQBUF),
+ * waiting for paintGL(), uploading the textures and waiting for the swap.
+ */
+void CaptureWin::frameSwappedEvent()
+{
+	if (!m_timingPending)
+		return;
+	m_timingPending = false;
+
+	const FrameTiming &t = m_curTiming;
+	__u64 swapped = monotonicNs();
+	__u64 stages[4] = {
+		t.captured ? t.dequeued - t.captured : 0,
+		t.painted - t.dequeued,
+		t.uploaded - t.painted,
+		swapped - t.uploaded,
+	};
+	__u64 total = swapped - (t.captured ? t.captured : t.dequeued);
+
+	if (m_latencyCsv) {
+		if (t.captured)
+			fprintf(m_latencyCsv, "%u,%llu,%llu,", t.sequence,
+				(unsigned long long)t.captured / 1000,
+				(unsigned long long)stages[0] / 1000);
+		else
+			fprintf(m_latencyCsv, "%u,,,", t.sequence);
+		fprintf(m_latencyCsv, "%llu,%llu,%llu,",
+			(unsigned long long)stages[1] / 1000,
+			(unsigned long long)stages[2] / 1000,
+			(unsigned long long)stages[3] / 1000);
+		if (t.captured)
+			fprintf(m_latencyCsv, "%llu\n", (unsigned long long)total / 1000);
+		else
+			fprintf(m_latencyCsv, "\n");
+	}
+
+	if (!m_latencyOverlay->isChecked())
+		return;
+
+	if (!m_latencyStart) {
+		m_latencyStart = swapped;
+		m_latencyFrames = 0;
+		m_latencyCaptured = 0;
+		m_latencyMax = 0;
+		memset(m_latencySum, 0, sizeof(m_latencySum));
+	}
+	m_latencyFrames++;
+	if (t.captured)
+		m_latencyCaptured++;
+	for (unsigned i = 0; i < 4; i++)
+		m_latencySum[i] += stages[i];
+	if (total > m_latencyMax)
+		m_latencyMax = total;
+
+	if (swapped - m_latencyStart < LATENCY_OVERLAY_PERIOD_NS)
+		return;
+
+	double ave[4];
+	double ave_total = 0;
+
+	for (unsigned i = 0; i < 4; i++) {
+		unsigned frames = i ? m_latencyFrames : m_latencyCaptured;
+
+		ave[i] = frames ? m_latencySum[i] / 1e6 / frames : 0;
+		ave_total += ave[i];
+	}
+
+	QString text = QString("Frame         %1\n").arg(t.sequence);
+
+	if (m_latencyCaptured)
+		text += QString("Capture-DQBUF %1 ms\n").arg(ave[0], 6, 'f', 2);
+	else
+		text += "Capture-DQBUF n/a\n";
+	text += QString("DQBUF-paint   %1 ms\n").arg(ave[1], 6, 'f', 2);
+	text += QString("Upload        %1 ms\n").arg(ave[2], 6, 'f', 2);
+	text += QString("Upload-swap   %1 ms\n").arg(ave[3], 6, 'f', 2);
+	text += QString("Total         %1 ms (max %2 ms)")
+		.arg(ave_total, 6, 'f', 2).arg(m_latencyMax / 1e6, 0, 'f', 2);
+	m_latencyLabel->setText(text);
+	m_latencyLabel->adjustSize();
+	m_latencyStart = 0;
+}
+
 void CaptureWin::v4l2ExceptionEvent()
 {
 	v4l2_event ev;
@@ -1167,6 +1364,7 @@ void CaptureWin::listenForNewConnection()
 	cv4l_fmt fmt;
 	v4l2_fract pixelaspect = { 1, 1 };
 
+	stopDecoder();
 	::close(m_sock);
 
 	for (unsigned p = 0; p < m_v4l_fmt.g_num_planes(); p++) {
@@ -1187,11 +1385,11 @@ void CaptureWin::listenForNewConnection()
 		::close(sock_fd);
 	}
 	if (m_ctx)
-		free(m_ctx);
+		fwht_free(m_ctx);
 	m_ctx = fwht_alloc(fmt.g_pixelformat(), fmt.g_width(), fmt.g_height(),
 			   fmt.g_width(), fmt.g_height(),
 			   fmt.g_field(), fmt.g_colorspace(), fmt.g_xfer_func(),
-			   fmt.g_ycbcr_enc(), fmt.g_quantization());
+			   fmt.g_ycbcr_enc(), fmt.g_quantization(), 1);
 	setPixelAspect(pixelaspect);
 	updateOrigValues();
 	setModeSocket(sock_fd, m_port);
@@ -1205,7 +1403,8 @@ int CaptureWin::read_u32(__u32 &v)
 	v = 0;
 	n = read(m_sock, &v, sizeof(v));
 	if (n != sizeof(v)) {
-		fprintf(stderr, "could not read __u32\n");
+		if (!__atomic_load_n(&m_decodeStop, __ATOMIC_RELAXED))
+			fprintf(stderr, "could not read __u32\n");
 		return -1;
 	}
 	v = ntohl(v);
@@ -1214,8 +1413,6 @@ int CaptureWin::read_u32(__u32 &v)
 
 void CaptureWin::sockReadEvent()
 {
-	int n;
-
 	if (m_singleStep && m_frame > m_singleStepStart && !m_singleStepNext)
 		return;
 	m_singleStepNext = false;
@@ -1230,19 +1427,30 @@ void CaptureWin::sockReadEvent()
 		}
 	}
 
+	udpReadEvent();
+}
+
+/*
+ * Read a FRAME_VIDEO packet from the TCP stream and decode it into slot.
+ * Returns 1 if a frame was decoded, 0 if another packet was skipped and
+ * -1 if the connection has to be closed.
+ */
+int CaptureWin::decodeFrame(DecodeSlot &slot)
+{
 	unsigned packet, sz;
 	bool is_fwht;
+	int n;
 
 	if (read_u32(packet))
-		goto new_conn;
+		return -1;
 
 	if (packet == V4L_STREAM_PACKET_END) {
 		fprintf(stderr, "END packet read\n");
-		goto new_conn;
+		return -1;
 	}
 
 	if (read_u32(sz))
-		goto new_conn;
+		return -1;
 
 	if (packet != V4L_STREAM_PACKET_FRAME_VIDEO_RLE &&
 	    packet != V4L_STREAM_PACKET_FRAME_VIDEO_FWHT) {
@@ -1253,78 +1461,391 @@ void CaptureWin::sockReadEvent()
 			unsigned rdsize = sz > sizeof(buf) ? sizeof(buf) : sz;
 
 			n = read(m_sock, buf, rdsize);
-			if (n < 0) {
+			if (n <= 0) {
 				fprintf(stderr, "error reading %d bytes\n", sz);
-				goto new_conn;
+				return -1;
 			}
 			sz -= n;
 		}
-		return;
+		return 0;
 	}
 
 	is_fwht = m_ctx && packet == V4L_STREAM_PACKET_FRAME_VIDEO_FWHT;
+	slot.coeffs = is_fwht && m_decodeCoeffs;
 
 	if (read_u32(sz))
-		goto new_conn;
+		return -1;
 
 	if (sz != V4L_STREAM_PACKET_FRAME_VIDEO_SIZE_HDR) {
 		fprintf(stderr, "unsupported FRAME_VIDEO size\n");
-		goto new_conn;
+		return -1;
 	}
 	if (read_u32(sz) ||  // ignore field
 	    read_u32(sz))    // ignore flags
-		goto new_conn;
+		return -1;
 
-	for (unsigned p = 0; p < m_v4l_fmt.g_num_planes(); p++) {
-		__u32 max_size = is_fwht ? m_ctx->comp_max_size : m_curSize[p];
-		__u8 *dst = is_fwht ? m_ctx->state.compressed_frame : m_curData[p];
+	for (unsigned p = 0; p < m_decodeFmt.g_num_planes(); p++) {
+		__u32 max_size = is_fwht ? m_ctx->comp_max_size : m_decodeSize[p];
+		__u8 *dst = is_fwht ? m_ctx->state.compressed_frame : slot.data[p];
 		__u32 data_size;
 		__u32 offset;
 		__u32 size;
 
 		if (read_u32(sz))
-			goto new_conn;
+			return -1;
 		if (sz != V4L_STREAM_PACKET_FRAME_VIDEO_SIZE_PLANE_HDR) {
 			fprintf(stderr, "unsupported FRAME_VIDEO plane size\n");
-			goto new_conn;
+			return -1;
 		}
 		if (read_u32(size) || read_u32(data_size))
-			goto new_conn;
+			return -1;
+		if (!is_fwht && (size > m_decodeSize[p] || data_size > size)) {
+			fprintf(stderr, "invalid FRAME_VIDEO plane size\n");
+			return -1;
+		}
 		offset = is_fwht ? 0 : size - data_size;
 		sz = data_size;
 
 		if (data_size > max_size) {
 			fprintf(stderr, "data size is too large (%u > %u)\n",
 				data_size, max_size);
-			goto new_conn;
+			return -1;
 		}
 		while (sz) {
 			n = read(m_sock, dst + offset, sz);
-			if (n < 0) {
+			if (n <= 0) {
 				fprintf(stderr, "error reading %d bytes\n", sz);
-				goto new_conn;
+				return -1;
 			}
-			if ((__u32)n == sz)
-				break;
 			offset += n;
 			sz -= n;
 		}
-		if (is_fwht)
-			fwht_decompress(m_ctx, dst, data_size, m_curData[p], m_curSize[p]);
-		else
+		if (slot.coeffs) {
+			if (!fwht_decompress_coeffs(m_ctx, dst, data_size, slot.data[p], m_decodeSize[p]))
+				return 0;
+		} else if (is_fwht) {
+			fwht_decompress_ref(m_ctx, dst, data_size, slot.data[p], m_decodeSize[p]);
+		} else {
 			rle_decompress(dst, size, data_size,
-				       rle_calc_bpl(m_v4l_fmt.g_bytesperline(p), m_v4l_fmt.g_pixelformat()));
+				       rle_calc_bpl(m_decodeFmt.g_bytesperline(p), m_decodeFmt.g_pixelformat()));
+		}
 	}
+	return 1;
+}
+
+void *CaptureWin::decodeThread(void *arg)
+{
+	CaptureWin *win = static_cast<CaptureWin *>(arg);
+	int ret;
+
+	for (;;) {
+		pthread_mutex_lock(&win->m_decodeLock);
+		while (win->m_singleStep && win->m_decodeFrame > win->m_singleStepStart &&
+		       !win->m_decodeSteps && !win->m_decodeStop)
+			pthread_cond_wait(&win->m_decodeCond, &win->m_decodeLock);
+		win->m_decodeSteps = 0;
+		pthread_mutex_unlock(&win->m_decodeLock);
+		if (__atomic_load_n(&win->m_decodeStop, __ATOMIC_RELAXED))
+			break;
+
+		ret = win->decodeFrame(win->m_decodeSlots[win->m_decodeWrite]);
+		if (ret < 0) {
+			__atomic_store_n(&win->m_decodeFailed, true, __ATOMIC_RELEASE);
+		} else if (ret) {
+			// Every frame is needed as reference, so wait until it's taken
+			pthread_mutex_lock(&win->m_decodeLock);
+			while (win->m_decodeCoeffs && !win->m_decodeStop &&
+			       (__atomic_load_n(&win->m_decodeReady, __ATOMIC_ACQUIRE) & DECODE_SLOT_NEW))
+				pthread_cond_wait(&win->m_decodeCond, &win->m_decodeLock);
+			pthread_mutex_unlock(&win->m_decodeLock);
+			// Publish the frame, getting back the one it replaces
+			win->m_decodeWrite = __atomic_exchange_n(&win->m_decodeReady,
+								 win->m_decodeWrite | DECODE_SLOT_NEW,
+								 __ATOMIC_ACQ_REL) & ~DECODE_SLOT_NEW;
+			win->m_decodeFrame++;
+			__atomic_add_fetch(&win->m_decodedFrames, 1, __ATOMIC_RELEASE);
+		} else {
+			continue;
+		}
+		if (!__atomic_exchange_n(&win->m_decodeNotified, true, __ATOMIC_ACQ_REL))
+			QMetaObject::invokeMethod(win, "decodedFrame", Qt::QueuedConnection);
+		if (ret < 0)
+			break;
+	}
+	return NULL;
+}
+
+void CaptureWin::startDecoder()
+{
+	if (m_origPixelFormat == 0)
+		updateOrigValues();
+
+	m_decodeFmt = m_v4l_fmt;
+	m_decodeCoeffs = false;
+	m_fwhtTexValid = false;
+	m_fwhtFrame = false;
+	switch (m_decodeFmt.g_pixelformat()) {
+	case V4L2_PIX_FMT_YUV420:
+	case V4L2_PIX_FMT_YVU420:
+	case V4L2_PIX_FMT_YUV422P:
+		m_decodeCoeffs = m_fwhtGpu && m_ctx;
+		break;
+	}
+	for (unsigned p = 0; p < m_decodeFmt.g_num_planes(); p++) {
+		m_decodeSize[p] = m_decodeFmt.g_sizeimage(p);
+		if (m_decodeCoeffs) {
+			struct fwht_coeff_plane planes[4];
+			unsigned size;
+
+			fwht_coeff_planes(m_ctx, NULL, planes, &size);
+			if (size > m_decodeSize[p])
+				m_decodeSize[p] = size;
+		}
+		for (unsigned s = 0; s < DECODE_SLOTS; s++)
+			m_decodeSlots[s].data[p] = new __u8[m_decodeSize[p]];
+		m_curSize[p] = m_decodeSize[p];
+		m_curData[p] = NULL;
+	}
+	m_decodeWrite = 0;
+	m_decodeRead = 1;
+	m_decodeReady = 2;
+	m_decodeFrame = m_frame;
+	m_decodedFrames = 0;
+	m_decodeSteps = 0;
+	m_decodeStop = false;
+	m_decodeFailed = false;
+	m_decodeNotified = false;
+	if (pthread_create(&m_decodeThread, NULL, decodeThread, this)) {
+		fprintf(stderr, "could not start the decode thread\n");
+		std::exit(EXIT_FAILURE);
+	}
+	m_decodeRunning = true;
+}
+
+void CaptureWin::stopDecoder()
+{
+	if (!m_decodeRunning)
+		return;
+
+	pthread_mutex_lock(&m_decodeLock);
+	__atomic_store_n(&m_decodeStop, true, __ATOMIC_RELAXED);
+	pthread_cond_signal(&m_decodeCond);
+	pthread_mutex_unlock(&m_decodeLock);
+	// Wake up a blocking read()
+	shutdown(m_sock, SHUT_RDWR);
+	pthread_join(m_decodeThread, NULL);
+	m_decodeRunning = false;
+	// The reference frame may be in one of the slots
+	if (m_ctx)
+		fwht_release_ref(m_ctx);
+
+	for (unsigned p = 0; p < m_decodeFmt.g_num_planes(); p++) {
+		for (unsigned s = 0; s < DECODE_SLOTS; s++) {
+			delete [] m_decodeSlots[s].data[p];
+			m_decodeSlots[s].data[p] = NULL;
+		}
+		m_curSize[p] = 0;
+		m_curData[p] = NULL;
+	}
+}
+
+void CaptureWin::stepDecoder()
+{
+	if (!m_decodeRunning)
+		return;
+
+	pthread_mutex_lock(&m_decodeLock);
+	m_decodeSteps = 1;
+	pthread_cond_signal(&m_decodeCond);
+	pthread_mutex_unlock(&m_decodeLock);
+}
+
+/* Called from paintGL() to show the last frame of the decode thread */
+void CaptureWin::takeDecodedFrame()
+{
+	if (!(__atomic_load_n(&m_decodeReady, __ATOMIC_ACQUIRE) & DECODE_SLOT_NEW))
+		return;
+
+	m_decodeRead = __atomic_exchange_n(&m_decodeReady, m_decodeRead,
+					   __ATOMIC_ACQ_REL) & ~DECODE_SLOT_NEW;
+	for (unsigned p = 0; p < m_decodeFmt.g_num_planes(); p++)
+		m_curData[p] = m_decodeSlots[m_decodeRead].data[p];
+}
+
+/*
+ * Called from decodedFrame() instead if the GPU does the inverse transform,
+ * so no frame is skipped.
+ */
+void CaptureWin::takeDecodedCoeffs()
+{
+	if (!(__atomic_load_n(&m_decodeReady, __ATOMIC_ACQUIRE) & DECODE_SLOT_NEW))
+		return;
+
+	takeDecodedFrame();
+	m_fwhtFrame = m_decodeSlots[m_decodeRead].coeffs;
+	if (m_fwhtFrame && isValid()) {
+		makeCurrent();
+		fwhtGpuDecode(m_curData[0]);
+		doneCurrent();
+	}
+	// Let the decode thread publish the next frame
+	pthread_mutex_lock(&m_decodeLock);
+	pthread_cond_signal(&m_decodeCond);
+	pthread_mutex_unlock(&m_decodeLock);
+}
+
+void CaptureWin::decodedFrame()
+{
+	__atomic_store_n(&m_decodeNotified, false, __ATOMIC_RELEASE);
+
+	if (m_decodeCoeffs)
+		takeDecodedCoeffs();
+
+	unsigned frames = __atomic_exchange_n(&m_decodedFrames, 0, __ATOMIC_ACQ_REL);
+
+	if (frames) {
+		m_frame += frames;
+		update();
+		if (m_cnt) {
+			if (frames >= m_cnt)
+				std::exit(EXIT_SUCCESS);
+			m_cnt -= frames;
+		}
+	}
+	if (m_decodeRunning && __atomic_load_n(&m_decodeFailed, __ATOMIC_ACQUIRE))
+		listenForNewConnection();
+}
+
+void CaptureWin::udpReadEvent()
+{
+	__u8 dgram[V4L_STREAM_UDP_MAX_SIZE];
+	int n;
+
+	/* Decode everything that is pending, only the last frame is shown */
+	while ((n = recv(m_sock, dgram, sizeof(dgram), MSG_DONTWAIT)) > 0)
+		if (udp_rx_datagram(&udp_stream, dgram, n) == 1)
+			udpPacket(udp_stream.buf, udp_stream.size);
+}
+
+void CaptureWin::udpFormatChanged(cv4l_fmt &fmt, const v4l2_fract &pixelaspect)
+{
+	if (m_ctx)
+		fwht_release_ref(m_ctx);
+	for (unsigned p = 0; p < m_v4l_fmt.g_num_planes(); p++) {
+		m_curSize[p] = 0;
+		delete [] m_curData[p];
+		m_curData[p] = NULL;
+	}
+	m_udpSynced = false;
+	m_udpFmtValid = setV4LFormat(fmt);
+	if (!m_udpFmtValid) {
+		fprintf(stderr, "Unsupported format: '%s' %s\n",
+			fcc2s(fmt.g_pixelformat()).c_str(),
+			pixfmt2s(fmt.g_pixelformat()).c_str());
+		return;
+	}
+	if (m_ctx)
+		fwht_free(m_ctx);
+	m_ctx = fwht_alloc(fmt.g_pixelformat(), fmt.g_width(), fmt.g_height(),
+			   fmt.g_width(), fmt.g_height(),
+			   fmt.g_field(), fmt.g_colorspace(), fmt.g_xfer_func(),
+			   fmt.g_ycbcr_enc(), fmt.g_quantization(), 1);
+	setPixelAspect(pixelaspect);
+	updateOrigValues();
+	restoreSize();
+	for (unsigned p = 0; p < m_v4l_fmt.g_num_planes(); p++) {
+		m_curSize[p] = m_v4l_fmt.g_sizeimage(p);
+		m_curData[p] = new __u8[m_curSize[p]];
+	}
+}
+
+/* Handle a packet received over UDP, see v4l-stream.h */
+void CaptureWin::udpPacket(__u8 *p, unsigned size)
+{
+	const __u32 *w = (const __u32 *)p;
+	__u32 packet;
+	bool is_fwht;
+
+	if (size < 8 || ntohl(w[1]) != size - 8)
+		return;
+	packet = ntohl(w[0]);
+	p += 8;
+	size -= 8;
+
+	if (packet == V4L_STREAM_PACKET_FMT_VIDEO) {
+		QByteArray fmtPacket((const char *)p - 8, size + 8);
+		v4l2_fract pixelaspect = { 1, 1 };
+		cv4l_fmt fmt;
+
+		if (fmtPacket == m_udpFmt)
+			return;
+		m_udpFmt = fmtPacket;
+		if (parseFmtPacket(p, size, fmt, pixelaspect))
+			udpFormatChanged(fmt, pixelaspect);
+		else
+			m_udpFmtValid = false;
+		return;
+	}
+	if (packet == V4L_STREAM_PACKET_END) {
+		fprintf(stderr, "END packet read\n");
+		return;
+	}
+	if ((packet != V4L_STREAM_PACKET_FRAME_VIDEO_RLE &&
+	     packet != V4L_STREAM_PACKET_FRAME_VIDEO_FWHT) || !m_udpFmtValid)
+		return;
+
+	is_fwht = m_ctx && packet == V4L_STREAM_PACKET_FRAME_VIDEO_FWHT;
+	/* FWHT P-frames can't be decoded after a lost frame */
+	if (udp_stream.lost) {
+		udp_stream.lost = false;
+		m_udpSynced = false;
+	}
+
+	w = (const __u32 *)p;
+	if (size < 12 || ntohl(w[0]) != V4L_STREAM_PACKET_FRAME_VIDEO_SIZE_HDR)
+		return;
+	// ignore field and flags
+	p += 12;
+	size -= 12;
+
+	for (unsigned plane = 0; plane < m_v4l_fmt.g_num_planes(); plane++) {
+		__u32 data_size, bytesused;
+
+		w = (const __u32 *)p;
+		if (size < 12 || ntohl(w[0]) != V4L_STREAM_PACKET_FRAME_VIDEO_SIZE_PLANE_HDR)
+			return;
+		bytesused = ntohl(w[1]);
+		data_size = ntohl(w[2]);
+		p += 12;
+		size -= 12;
+		if (data_size > size || bytesused > m_curSize[plane] ||
+		    (!is_fwht && data_size > bytesused)) {
+			fprintf(stderr, "invalid FRAME_VIDEO plane size\n");
+			return;
+		}
+		if (is_fwht) {
+			if (data_size < sizeof(struct fwht_cframe_hdr))
+				return;
+			if (!m_udpSynced &&
+			    !(ntohl(((struct fwht_cframe_hdr *)p)->flags) & FWHT_FL_I_FRAME))
+				return;
+			fwht_decompress_ref(m_ctx, p, data_size, m_curData[plane], m_curSize[plane]);
+		} else {
+			/* Decoded in place, from the end of the buffer */
+			memcpy(m_curData[plane] + bytesused - data_size, p, data_size);
+			rle_decompress(m_curData[plane], bytesused, data_size,
+				       rle_calc_bpl(m_v4l_fmt.g_bytesperline(plane), m_v4l_fmt.g_pixelformat()));
+		}
+		p += data_size;
+		size -= data_size;
+	}
+	m_udpSynced = true;
 	m_frame++;
 	update();
 	if (m_cnt == 0)
 		return;
 	if (--m_cnt == 0)
 		std::exit(EXIT_SUCCESS);
-	return;
-
-new_conn:
-	listenForNewConnection();
 }
 
 void CaptureWin::resizeGL(int w, int h)
@@ -16,8 +16,12 @@
 #include <QAction>
 #include <QActionGroup>
 #include <QScrollArea>
+#include <QElapsedTimer>
+#include <QLabel>
 #include <QtGui/QOpenGLShaderProgram>
 
+#include <pthread.h>
+
 #include "qvidcap.h"
 
 extern "C" {
@@ -64,6 +68,45 @@ struct TestState {
 // This must be equal to the max number of textures that any shader uses
 #define MAX_TEXTURES_NEEDED 3
 
+// The textures of this many frames can be uploaded at the same time
+#define PBO_FRAMES 3
+#define PBO_RING_SIZE (PBO_FRAMES * MAX_TEXTURES_NEEDED)
+
+// A V4L2 buffer plane imported as an EGLImage
+struct DmabufImage {
+	void *image;
+	int fd;
+	unsigned offset;
+	unsigned width;
+	unsigned height;
+	unsigned pitch;
+	__u32 drm_fourcc;
+};
+
+// The number of frames the socket decode thread rotates, see decodeThread()
+#define DECODE_SLOTS 3
+// Set in m_decodeReady if the slot holds a frame that wasn't shown yet
+#define DECODE_SLOT_NEW 0x100
+
+struct DecodeSlot {
+	__u8 *data[MAX_TEXTURES_NEEDED];
+	/* data[0] holds the FWHT coefficients, see fwht_coeff_planes() */
+	bool coeffs;
+};
+
+// When a V4L2 frame passed each stage, in ns of CLOCK_MONOTONIC
+struct FrameTiming {
+	__u32 sequence;
+	// The buffer timestamp, 0 if the driver doesn't use CLOCK_MONOTONIC
+	__u64 captured;
+	__u64 dequeued;
+	__u64 painted;
+	__u64 uploaded;
+};
+
+// The latency overlay shows the averages over this period
+#define LATENCY_OVERLAY_PERIOD_NS 500000000ULL
+
 class CaptureWin : public QOpenGLWidget, protected QOpenGLFunctions
 {
 	Q_OBJECT
@@ -73,6 +116,7 @@ public:
 
 	void setModeV4L2(cv4l_fd *fd);
 	void setModeSocket(int sock, int port);
+	void setModeUdp(int sock, int port);
 	void setModeFile(const QString &filename);
 	void setModeTPG();
 	void setModeTest(unsigned cnt);
@@ -85,6 +129,10 @@ public:
 	void setOverrideHorPadding(__u32 p);
 	void setCount(unsigned cnt) { m_cnt = cnt; }
 	void setReportTimings(bool report) { m_reportTimings = report; }
+	void setDmabuf(bool dmabuf) { m_dmabuf = dmabuf; }
+	void setFwhtGpu(bool gpu) { m_fwhtGpu = gpu; }
+	void setLatencyCsv(FILE *csv);
+	void setLatencyOverlay(bool show);
 	void setVerbose(bool verbose) { m_verbose = verbose; }
 	void setOverridePixelFormat(__u32 fmt) { m_overridePixelFormat = fmt; }
 	void setOverrideField(__u32 field) { m_overrideField = field; }
@@ -104,6 +152,7 @@ private slots:
 	void v4l2ReadEvent();
 	void v4l2ExceptionEvent();
 	void sockReadEvent();
+	void decodedFrame();
 	void tpgUpdateFrame();
 
 	void restoreAll(bool checked);
@@ -118,6 +167,8 @@ private slots:
 	void windowScalingChanged(QAction *a);
 	void resolutionOverrideChanged(bool);
 	void toggleFullScreen(bool b = false);
+	void latencyOverlayChanged(bool show);
+	void frameSwappedEvent();
 
 private:
 	void resizeEvent(QResizeEvent *event);
@@ -129,6 +180,16 @@ private:
 	void mouseDoubleClickEvent(QMouseEvent * e);
 	void listenForNewConnection();
 	int read_u32(__u32 &v);
+	static void *decodeThread(void *arg);
+	int decodeFrame(DecodeSlot &slot);
+	void startDecoder();
+	void stopDecoder();
+	void stepDecoder();
+	void takeDecodedFrame();
+	void takeDecodedCoeffs();
+	void udpReadEvent();
+	void udpPacket(__u8 *p, unsigned size);
+	void udpFormatChanged(cv4l_fmt &fmt, const v4l2_fract &pixelaspect);
 	void showCurrentOverrides();
 	void cycleMenu(__u32 &overrideVal, __u32 origVal,
 		       const __u32 values[], bool hasShift, bool hasCtrl);
@@ -140,6 +201,19 @@ private:
 	void updateOrigValues();
 	void updateShader();
 	void changeShader();
+	void initDmabuf();
+	void freeDmabufImages();
+	bool bindDmabuf(unsigned tex, unsigned plane, unsigned offset,
+			unsigned width, unsigned height, unsigned pitch,
+			__u32 drm_fourcc);
+	void initPBOs();
+	void initFwhtGpu();
+	void fwhtGpuDecode(__u8 *coeffs);
+	void uploadTexture(GLenum target, GLint level, GLint xoffset, GLint yoffset,
+			   GLsizei width, GLsizei height, GLenum format, GLenum type,
+			   const void *pixels);
+	void updateTitle(qint64 paintNs);
+	static __u64 monotonicNs();
 
 	// Colorspace conversion shaders
 	void shader_YUV();
@@ -165,6 +239,41 @@ private:
 	cv4l_fd *m_fd;
 	int m_sock;
 	int m_port;
+	bool m_udp;
+	/* The last FMT_VIDEO packet received over UDP */
+	QByteArray m_udpFmt;
+	bool m_udpFmtValid;
+	/* Set once an I-frame was decoded after losing packets */
+	bool m_udpSynced;
+	/*
+	 * TCP streams are read and decoded by m_decodeThread. The decoded
+	 * frames are handed to paintGL() by exchanging the index of the
+	 * DecodeSlot in m_decodeReady, so frames that could not be shown in
+	 * time are overwritten.
+	 */
+	pthread_t m_decodeThread;
+	bool m_decodeRunning;
+	bool m_decodeStop;
+	bool m_decodeFailed;
+	bool m_decodeNotified;
+	pthread_mutex_t m_decodeLock;
+	pthread_cond_t m_decodeCond;
+	unsigned m_decodeSteps;
+	unsigned m_decodedFrames;
+	unsigned m_decodeFrame;
+	cv4l_fmt m_decodeFmt;
+	DecodeSlot m_decodeSlots[DECODE_SLOTS];
+	unsigned m_decodeSize[MAX_TEXTURES_NEEDED];
+	unsigned m_decodeReady;
+	unsigned m_decodeWrite;
+	unsigned m_decodeRead;
+	/*
+	 * Let the GPU do the inverse transform of FWHT frames: the decode
+	 * thread only does the entropy decoding and hands every frame to
+	 * takeDecodedCoeffs(), since each frame is the reference of the next.
+	 */
+	bool m_fwhtGpu;
+	bool m_decodeCoeffs;
 	QFile m_file;
 	bool m_v4l2;
 	cv4l_fmt m_v4l_fmt;
@@ -224,9 +333,49 @@ private:
 	unsigned m_nextSize[MAX_TEXTURES_NEEDED];
 	int m_curIndex;
 	int m_nextIndex;
+	/* Bind the exported V4L2 buffers to the textures instead of uploading */
+	bool m_dmabuf;
+	DmabufImage m_dmabufImages[VIDEO_MAX_FRAME][MAX_TEXTURES_NEEDED];
+	/* Upload the textures through a ring of pixel buffer objects */
+	bool m_pbo;
+	GLuint m_pbos[PBO_RING_SIZE];
+	unsigned m_pboSize[PBO_RING_SIZE];
+	unsigned m_pboIdx;
+	/* The textures and the programs of fwht-decode.glsl */
+	QOpenGLShaderProgram *m_fwhtProgram[2];
+	bool m_fwhtTexValid;
+	GLuint m_fwhtCoeffTex[3];
+	GLuint m_fwhtBlockTex[3];
+	GLuint m_fwhtRowTex[3];
+	/* The planes of the last two frames, m_fwhtCur is the last one decoded */
+	GLuint m_fwhtTex[2][3];
+	unsigned m_fwhtCur;
+	/* Set if the current frame is in m_fwhtTex instead of m_curData */
+	bool m_fwhtFrame;
+	GLuint m_fwhtVao;
+	GLuint m_fwhtFbo;
+	/* Frame statistics shown in the window title with --timings */
+	QElapsedTimer m_titleTimer;
+	unsigned m_titleFrames;
+	qint64 m_titlePaintNs;
+	/*
+	 * The latency of the V4L2 frames from capture to swap, dumped to
+	 * m_latencyCsv and shown in m_latencyLabel
+	 */
+	FrameTiming m_nextTiming;
+	FrameTiming m_curTiming;
+	bool m_timingPending;
+	FILE *m_latencyCsv;
+	QLabel *m_latencyLabel;
+	__u64 m_latencyStart;
+	unsigned m_latencyFrames;
+	unsigned m_latencyCaptured;
+	__u64 m_latencySum[4];
+	__u64 m_latencyMax;
 	struct tpg_data m_tpg;
 
 	QScrollArea *m_scrollArea;
+	QAction *m_latencyOverlay;
 	QAction *m_resolutionOverride;
 	QAction *m_exitFullScreen;
 	QAction *m_enterFullScreen;
@@ -0,0 +1,75 @@
+// The inverse transform of the FWHT codec, see ifwht() in codec-fwht.c.
+//
+// The CPU does the entropy decoding and dequantization, see
+// fwht_decode_frame_coeffs(), and this shader turns the coefficients
+// of a plane into pixels. The 2-D transform is split into two passes,
+// each fetching 8 texels per pixel: PASS 1 transforms the rows of each
+// 8x8 block, PASS 2 the columns, adding the reference frame for the
+// inter coded blocks.
+
+uniform highp isampler2D coeffs;	// PASS 1: the coefficients, PASS 2: the output of PASS 1
+uniform highp usampler2D blocks;	// The FWHT_BLOCK_* type of each 8x8 block
+#if PASS == 2
+uniform sampler2D ref;			// The previous frame
+#endif
+
+#if PASS == 1
+out highp ivec4 fs_Coeff;
+#else
+out vec4 fs_Pixel;
+#endif
+
+#define FWHT_BLOCK_INTRA 0u
+#define FWHT_BLOCK_INTER 1u
+#define FWHT_BLOCK_RAW 2u
+
+// Output k of the 1-D transform is the sum of the inputs c, negated if
+// bit c of negate[k] is set
+const uint negate[8] = uint[8](0x00u, 0xf0u, 0x3cu, 0xccu, 0x66u, 0x96u, 0x5au, 0xaau);
+
+// The transform is done in 16 bits, like the s16 math of ifwht()
+int wrap16(int v)
+{
+	return (v << 16) >> 16;
+}
+
+void main()
+{
+	ivec2 pos = ivec2(gl_FragCoord.xy);
+	uint type = texelFetch(blocks, pos / 8, 0).r;
+#if PASS == 1
+	int k = pos.x & 7;
+	ivec2 first = ivec2(pos.x & ~7, pos.y);
+#else
+	int k = pos.y & 7;
+	ivec2 first = ivec2(pos.x, pos.y & ~7);
+#endif
+	int sum = 0;
+
+	if (type == FWHT_BLOCK_RAW) {
+		// Uncompressed, the coefficients are the pixels
+		sum = texelFetch(coeffs, pos, 0).r;
+	} else {
+		for (int c = 0; c < 8; c++) {
+#if PASS == 1
+			int v = texelFetch(coeffs, first + ivec2(c, 0), 0).r;
+#else
+			int v = texelFetch(coeffs, first + ivec2(0, c), 0).r;
+#endif
+			sum += ((negate[k] >> uint(c)) & 1u) != 0u ? -v : v;
+		}
+		sum = wrap16(sum);
+	}
+#if PASS == 1
+	fs_Coeff = ivec4(sum, 0, 0, 0);
+#else
+	if (type != FWHT_BLOCK_RAW) {
+		sum >>= 6;
+		if (type == FWHT_BLOCK_INTER)
+			sum += int(texelFetch(ref, pos, 0).r * 255.0 + 0.5);
+		else
+			sum += 128;
+	}
+	fs_Pixel = vec4(float(clamp(sum, 0, 255)) / 255.0, 0.0, 0.0, 1.0);
+#endif
+}
@@ -22,8 +22,418 @@
 #include <QTimer>
 #include <QApplication>
 
+#include <dlfcn.h>
+
 #include "v4l2-info.h"
 
+/*
+ * With EGL_EXT_image_dma_buf_import the exported V4L2 buffers are bound
+ * to the textures directly, so the frames don't have to be copied with
+ * glTexSubImage2D. EGL is only used if Qt already uses it, so qvidcap
+ * neither builds nor links against it; the few definitions needed are
+ * here.
+ */
+#define QVIDCAP_EGL_EXTENSIONS			0x3055
+#define QVIDCAP_EGL_HEIGHT			0x3056
+#define QVIDCAP_EGL_WIDTH			0x3057
+#define QVIDCAP_EGL_NONE			0x3038
+#define QVIDCAP_EGL_LINUX_DMA_BUF_EXT		0x3270
+#define QVIDCAP_EGL_LINUX_DRM_FOURCC_EXT	0x3271
+#define QVIDCAP_EGL_DMA_BUF_PLANE0_FD_EXT	0x3272
+#define QVIDCAP_EGL_DMA_BUF_PLANE0_OFFSET_EXT	0x3273
+#define QVIDCAP_EGL_DMA_BUF_PLANE0_PITCH_EXT	0x3274
+
+/* The DRM fourccs use the same encoding as the V4L2 ones */
+#define QVIDCAP_DRM_FORMAT_R8			v4l2_fourcc('R', '8', ' ', ' ')
+#define QVIDCAP_DRM_FORMAT_GR88			v4l2_fourcc('G', 'R', '8', '8')
+#define QVIDCAP_DRM_FORMAT_ABGR8888		v4l2_fourcc('A', 'B', '2', '4')
+
+typedef void *(*egl_get_current_fn)(void);
+typedef void *(*egl_get_proc_address_fn)(const char *name);
+typedef const char *(*egl_query_string_fn)(void *dpy, int name);
+typedef void *(*egl_create_image_fn)(void *dpy, void *ctx, unsigned target,
+				     void *buffer, const int *attribs);
+typedef unsigned (*egl_destroy_image_fn)(void *dpy, void *image);
+typedef void (*gl_egl_image_target_texture_2d_fn)(GLenum target, void *image);
+
+static void *egl_display;
+static egl_create_image_fn egl_create_image;
+static egl_destroy_image_fn egl_destroy_image;
+static gl_egl_image_target_texture_2d_fn gl_egl_image_target_texture_2d;
+
+void CaptureWin::initDmabuf()
+{
+	egl_get_current_fn get_display =
+		(egl_get_current_fn)dlsym(RTLD_DEFAULT, "eglGetCurrentDisplay");
+	egl_get_current_fn get_context =
+		(egl_get_current_fn)dlsym(RTLD_DEFAULT, "eglGetCurrentContext");
+	egl_get_proc_address_fn get_proc_address =
+		(egl_get_proc_address_fn)dlsym(RTLD_DEFAULT, "eglGetProcAddress");
+	egl_query_string_fn query_string =
+		(egl_query_string_fn)dlsym(RTLD_DEFAULT, "eglQueryString");
+	const char *exts = NULL;
+
+	if (!m_dmabuf)
+		return;
+	m_dmabuf = false;
+
+	// Only if the OpenGL context is an EGL context
+	if (!get_display || !get_context || !get_proc_address || !query_string ||
+	    !get_context() || !(egl_display = get_display()))
+		goto unsupported;
+	exts = query_string(egl_display, QVIDCAP_EGL_EXTENSIONS);
+	if (!exts || !strstr(exts, "EGL_EXT_image_dma_buf_import") ||
+	    !context()->hasExtension("GL_OES_EGL_image"))
+		goto unsupported;
+	egl_create_image = (egl_create_image_fn)get_proc_address("eglCreateImageKHR");
+	egl_destroy_image = (egl_destroy_image_fn)get_proc_address("eglDestroyImageKHR");
+	gl_egl_image_target_texture_2d = (gl_egl_image_target_texture_2d_fn)
+		get_proc_address("glEGLImageTargetTexture2DOES");
+	if (!egl_create_image || !egl_destroy_image || !gl_egl_image_target_texture_2d)
+		goto unsupported;
+	m_dmabuf = true;
+	if (m_verbose)
+		printf("Using EGL_EXT_image_dma_buf_import to display the buffers\n");
+	return;
+
+unsupported:
+	if (m_verbose)
+		printf("EGL_EXT_image_dma_buf_import is not available, uploading the buffers\n");
+}
+
+void CaptureWin::freeDmabufImages()
+{
+	for (unsigned i = 0; i < VIDEO_MAX_FRAME; i++) {
+		for (unsigned t = 0; t < MAX_TEXTURES_NEEDED; t++) {
+			DmabufImage &img = m_dmabufImages[i][t];
+
+			if (img.image)
+				egl_destroy_image(egl_display, img.image);
+			img.image = NULL;
+		}
+	}
+}
+
+/*
+ * Bind the plane of the current buffer to the texture that is bound to
+ * GL_TEXTURE_2D. If this returns false, the caller uploads the data instead.
+ */
+bool CaptureWin::bindDmabuf(unsigned tex, unsigned plane, unsigned offset,
+			    unsigned width, unsigned height, unsigned pitch,
+			    __u32 drm_fourcc)
+{
+	if (!m_dmabuf || m_mode != AppModeV4L2 || m_curIndex < 0 ||
+	    plane >= m_v4l_queue->g_num_planes() ||
+	    (unsigned long)offset + (unsigned long)pitch * height >
+	    m_v4l_queue->g_length(plane))
+		return false;
+
+	DmabufImage &img = m_dmabufImages[m_curIndex][tex];
+	int fd = m_v4l_queue->g_fd(m_curIndex, plane);
+
+	if (fd < 0)
+		return false;
+	if (img.image && (img.fd != fd || img.offset != offset ||
+			  img.width != width || img.height != height ||
+			  img.pitch != pitch || img.drm_fourcc != drm_fourcc)) {
+		egl_destroy_image(egl_display, img.image);
+		img.image = NULL;
+	}
+	if (!img.image) {
+		const int attribs[] = {
+			QVIDCAP_EGL_WIDTH, (int)width,
+			QVIDCAP_EGL_HEIGHT, (int)height,
+			QVIDCAP_EGL_LINUX_DRM_FOURCC_EXT, (int)drm_fourcc,
+			QVIDCAP_EGL_DMA_BUF_PLANE0_FD_EXT, fd,
+			QVIDCAP_EGL_DMA_BUF_PLANE0_OFFSET_EXT, (int)offset,
+			QVIDCAP_EGL_DMA_BUF_PLANE0_PITCH_EXT, (int)pitch,
+			QVIDCAP_EGL_NONE
+		};
+
+		img.image = egl_create_image(egl_display, NULL,
+					     QVIDCAP_EGL_LINUX_DMA_BUF_EXT,
+					     NULL, attribs);
+		if (!img.image) {
+			fprintf(stderr, "Could not import buffer %d as an EGLImage, uploading the buffers instead\n",
+				m_curIndex);
+			freeDmabufImages();
+			m_dmabuf = false;
+			// Recreate the textures, some may use an EGLImage
+			m_updateShader = true;
+			return false;
+		}
+		img.fd = fd;
+		img.offset = offset;
+		img.width = width;
+		img.height = height;
+		img.pitch = pitch;
+		img.drm_fourcc = drm_fourcc;
+	}
+	gl_egl_image_target_texture_2d(GL_TEXTURE_2D, img.image);
+	return true;
+}
+
+void CaptureWin::initPBOs()
+{
+	// glMapBufferRange() needs OpenGL (ES) 3.0
+	m_pbo = context()->format().majorVersion() >= 3;
+	if (!m_pbo)
+		return;
+	glGenBuffers(PBO_RING_SIZE, m_pbos);
+	memset(m_pboSize, 0, sizeof(m_pboSize));
+	m_pboIdx = 0;
+	if (m_verbose)
+		printf("Using pixel buffer objects to upload the textures\n");
+}
+
+/*
+ * Same as glTexSubImage2D(), but the data is copied into the next pixel
+ * buffer object of the ring first. The GPU then transfers it to the texture
+ * while the frame renders, instead of the upload waiting for the GPU to
+ * finish with the texture.
+ */
+void CaptureWin::uploadTexture(GLenum target, GLint level, GLint xoffset, GLint yoffset,
+			       GLsizei width, GLsizei height, GLenum format, GLenum type,
+			       const void *pixels)
+{
+	GLint rowLength, alignment;
+	unsigned bpp, stride, size;
+	GLuint pbo;
+	void *p;
+
+	if (!m_pbo || !pixels || width <= 0 || height <= 0) {
+		glTexSubImage2D(target, level, xoffset, yoffset, width, height,
+				format, type, pixels);
+		return;
+	}
+
+	switch (type) {
+	case GL_UNSIGNED_BYTE_3_3_2:
+		bpp = 1;
+		break;
+	case GL_UNSIGNED_SHORT_5_6_5:
+	case GL_UNSIGNED_SHORT_4_4_4_4:
+	case GL_UNSIGNED_SHORT_4_4_4_4_REV:
+	case GL_UNSIGNED_SHORT_5_5_5_1:
+	case GL_UNSIGNED_SHORT_1_5_5_5_REV:
+		bpp = 2;
+		break;
+	case GL_UNSIGNED_INT_8_8_8_8:
+	case GL_UNSIGNED_INT_8_8_8_8_REV:
+		bpp = 4;
+		break;
+	default:
+		bpp = type == GL_UNSIGNED_SHORT ? 2 : 1;
+		switch (format) {
+		case GL_RG:
+			bpp *= 2;
+			break;
+		case GL_RGB:
+			bpp *= 3;
+			break;
+		case GL_RGBA:
+		case GL_BGRA:
+			bpp *= 4;
+			break;
+		}
+		break;
+	}
+
+	glGetIntegerv(GL_UNPACK_ROW_LENGTH, &rowLength);
+	glGetIntegerv(GL_UNPACK_ALIGNMENT, &alignment);
+	stride = (rowLength ? rowLength : width) * bpp;
+	stride = (stride + alignment - 1) / alignment * alignment;
+	size = stride * (height - 1) + width * bpp;
+
+	pbo = m_pboIdx;
+	m_pboIdx = (m_pboIdx + 1) % PBO_RING_SIZE;
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, m_pbos[pbo]);
+	if (m_pboSize[pbo] != size) {
+		glBufferData(GL_PIXEL_UNPACK_BUFFER, size, NULL, GL_STREAM_DRAW);
+		m_pboSize[pbo] = size;
+	}
+	p = glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, size,
+			     GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+	if (p) {
+		memcpy(p, pixels, size);
+		if (glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER)) {
+			glTexSubImage2D(target, level, xoffset, yoffset, width, height,
+					format, type, NULL);
+			glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+			return;
+		}
+	}
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+	glTexSubImage2D(target, level, xoffset, yoffset, width, height,
+			format, type, pixels);
+}
+
+static const char *fwht_prog =
+#include "fwht-decode.h"
+;
+
+static void fwhtTexture(GLuint tex, GLint ifmt, GLenum fmt, GLenum type,
+			unsigned width, unsigned height)
+{
+	glBindTexture(GL_TEXTURE_2D, tex);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	glTexImage2D(GL_TEXTURE_2D, 0, ifmt, width, height, 0, fmt, type, NULL);
+}
+
+/*
+ * Set up the programs of fwht-decode.glsl and the textures for the size
+ * of the planes of the decode thread, see startDecoder().
+ */
+void CaptureWin::initFwhtGpu()
+{
+	struct fwht_coeff_plane planes[4];
+	unsigned num, size;
+
+	if (!m_fwhtProgram[0]) {
+		for (unsigned pass = 0; pass < 2; pass++) {
+			QString code;
+
+			if (context()->isOpenGLES())
+				code = "#version 300 es\n"
+					"precision mediump float;\n"
+					"precision highp int;\n";
+			else
+				code = "#version 330\n";
+			QString vertexShaderSrc = code +
+				"void main() {\n"
+				"       // A triangle covering the viewport\n"
+				"       gl_Position = vec4(vec2(gl_VertexID & 1, gl_VertexID >> 1) * 4.0 - 1.0, 0.0, 1.0);\n"
+				"}\n";
+			code += QString("#define PASS %1\n#line 1\n").arg(pass + 1);
+			code += fwht_prog;
+
+			m_fwhtProgram[pass] = new QOpenGLShaderProgram(this);
+			if (!m_fwhtProgram[pass]->addShaderFromSourceCode(QOpenGLShader::Fragment, code) ||
+			    !m_fwhtProgram[pass]->addShaderFromSourceCode(QOpenGLShader::Vertex, vertexShaderSrc) ||
+			    !m_fwhtProgram[pass]->bind()) {
+				fprintf(stderr, "OpenGL Error: FWHT decode shader compilation failed.\n");
+				std::exit(EXIT_FAILURE);
+			}
+			m_fwhtProgram[pass]->setUniformValue("coeffs", 0);
+			m_fwhtProgram[pass]->setUniformValue("blocks", 1);
+			if (pass)
+				m_fwhtProgram[pass]->setUniformValue("ref", 2);
+		}
+		glGenVertexArrays(1, &m_fwhtVao);
+		glGenFramebuffers(1, &m_fwhtFbo);
+	} else {
+		glDeleteTextures(3, m_fwhtCoeffTex);
+		glDeleteTextures(3, m_fwhtBlockTex);
+		glDeleteTextures(3, m_fwhtRowTex);
+		glDeleteTextures(6, m_fwhtTex[0]);
+	}
+
+	glGenTextures(3, m_fwhtCoeffTex);
+	glGenTextures(3, m_fwhtBlockTex);
+	glGenTextures(3, m_fwhtRowTex);
+	glGenTextures(6, m_fwhtTex[0]);
+	num = fwht_coeff_planes(m_ctx, NULL, planes, &size);
+	for (unsigned p = 0; p < num; p++) {
+		unsigned rows = (planes[p].height + 7) / 8 * 8;
+
+		fwhtTexture(m_fwhtCoeffTex[p], GL_R16I, GL_RED_INTEGER, GL_SHORT,
+			    planes[p].stride, rows);
+		fwhtTexture(m_fwhtRowTex[p], GL_R16I, GL_RED_INTEGER, GL_SHORT,
+			    planes[p].stride, rows);
+		fwhtTexture(m_fwhtBlockTex[p], GL_R8UI, GL_RED_INTEGER, GL_UNSIGNED_BYTE,
+			    planes[p].stride / 8, rows / 8);
+		for (unsigned i = 0; i < 2; i++)
+			fwhtTexture(m_fwhtTex[i][p], GL_R8, GL_RED, GL_UNSIGNED_BYTE,
+				    planes[p].width, planes[p].height);
+	}
+	m_fwhtCur = 0;
+	m_fwhtTexValid = true;
+	checkError("FWHT decode init");
+}
+
+/*
+ * Turn the coefficients of fwht_decompress_coeffs() into the next frame
+ * in m_fwhtTex, using the current one as reference.
+ */
+void CaptureWin::fwhtGpuDecode(__u8 *coeffs)
+{
+	struct fwht_coeff_plane planes[4];
+	unsigned num, size;
+	unsigned next;
+
+	if (!m_fwhtTexValid)
+		initFwhtGpu();
+
+	next = !m_fwhtCur;
+	num = fwht_coeff_planes(m_ctx, coeffs, planes, &size);
+	glBindVertexArray(m_fwhtVao);
+	glBindFramebuffer(GL_FRAMEBUFFER, m_fwhtFbo);
+	glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+	for (unsigned p = 0; p < num; p++) {
+		unsigned rows = (planes[p].height + 7) / 8 * 8;
+
+		glActiveTexture(GL_TEXTURE0);
+		glBindTexture(GL_TEXTURE_2D, m_fwhtCoeffTex[p]);
+		glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, planes[p].stride, rows,
+				GL_RED_INTEGER, GL_SHORT, planes[p].coeffs);
+		glActiveTexture(GL_TEXTURE1);
+		glBindTexture(GL_TEXTURE_2D, m_fwhtBlockTex[p]);
+		glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+		glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, planes[p].stride / 8, rows / 8,
+				GL_RED_INTEGER, GL_UNSIGNED_BYTE, planes[p].blocks);
+		glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+
+		// Transform the rows of the blocks
+		m_fwhtProgram[0]->bind();
+		glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D,
+				       m_fwhtRowTex[p], 0);
+		glViewport(0, 0, planes[p].stride, rows);
+		glDrawArrays(GL_TRIANGLES, 0, 3);
+
+		// Transform the columns and add the reference frame
+		m_fwhtProgram[1]->bind();
+		glActiveTexture(GL_TEXTURE0);
+		glBindTexture(GL_TEXTURE_2D, m_fwhtRowTex[p]);
+		glActiveTexture(GL_TEXTURE2);
+		glBindTexture(GL_TEXTURE_2D, m_fwhtTex[m_fwhtCur][p]);
+		glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D,
+				       m_fwhtTex[next][p], 0);
+		glViewport(0, 0, planes[p].width, planes[p].height);
+		glDrawArrays(GL_TRIANGLES, 0, 3);
+	}
+	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, 0, 0);
+	glBindFramebuffer(GL_FRAMEBUFFER, defaultFramebufferObject());
+	glBindVertexArray(0);
+	if (m_program->isLinked())
+		m_program->bind();
+	m_fwhtCur = next;
+	checkError("FWHT decode");
+}
+
+void CaptureWin::updateTitle(qint64 paintNs)
+{
+	if (!m_titleTimer.isValid()) {
+		m_titleTimer.start();
+		return;
+	}
+	m_titleFrames++;
+	m_titlePaintNs += paintNs;
+
+	qint64 elapsed = m_titleTimer.nsecsElapsed();
+
+	if (elapsed < 1000000000LL)
+		return;
+	m_scrollArea->window()->setWindowTitle(QString("%1 fps, %2 ms per frame")
+		.arg(m_titleFrames * 1e9 / elapsed, 0, 'f', 2)
+		.arg(m_titlePaintNs / 1e6 / m_titleFrames, 0, 'f', 2));
+	m_titleFrames = 0;
+	m_titlePaintNs = 0;
+	m_titleTimer.restart();
+}
+
 void CaptureWin::initializeGL()
 {
 	initializeOpenGLFunctions();
@@ -60,6 +470,8 @@ void CaptureWin::initializeGL()
 	checkError("InitializeGL Part 2");
 	m_program = new QOpenGLShaderProgram(this);
 	m_updateShader = true;
+	initDmabuf();
+	initPBOs();
 }
 
 
@@ -83,6 +495,10 @@ void CaptureWin::paintGL()
 			m_nextData[i] = 0;
 			m_nextSize[i] = 0;
 		}
+		m_curTiming = m_nextTiming;
+		m_curTiming.painted = monotonicNs();
+	} else if (m_mode == AppModeSocket && m_decodeRunning && !m_decodeCoeffs) {
+		takeDecodedFrame();
 	}
 
 
@@ -112,6 +528,9 @@ void CaptureWin::paintGL()
 	if (!supportedFmt(m_v4l_fmt.g_pixelformat()))
 		return;
 
+	QElapsedTimer paintTimer;
+
+	paintTimer.start();
 	switch (m_v4l_fmt.g_pixelformat()) {
 	case V4L2_PIX_FMT_YUYV:
 	case V4L2_PIX_FMT_YVYU:
@@ -231,6 +650,11 @@ void CaptureWin::paintGL()
 		break;
 	}
 
+	if (m_mode == AppModeV4L2) {
+		m_curTiming.uploaded = monotonicNs();
+		m_timingPending = true;
+	}
+
 	static unsigned long long tot_t;
 	static unsigned cnt;
 	GLuint query;
@@ -299,6 +723,7 @@ void CaptureWin::paintGL()
 	checkError("paintGL");
 
 	if (m_reportTimings) {
+		updateTitle(paintTimer.nsecsElapsed());
 		glEndQuery(GL_TIME_ELAPSED);
 		GLuint t;
 		glGetQueryObjectuiv(query, GL_QUERY_RESULT, &t);
@@ -470,6 +895,8 @@ void CaptureWin::changeShader()
 {
 	if (m_screenTextureCount)
 		glDeleteTextures(m_screenTextureCount, m_screenTexture);
+	if (m_dmabuf)
+		freeDmabufImages();
 	m_program->removeAllShaders();
 	checkError("Render settings.\n");
 
@@ -983,10 +1410,27 @@ void CaptureWin::render_YUV(__u32 format)
 		break;
 	}
 
+	if (m_fwhtFrame) {
+		// Decoded by fwhtGpuDecode(), in the order of the planes in memory
+		for (unsigned i = 0; i < 3; i++) {
+			glActiveTexture(GL_TEXTURE0 + i);
+			glBindTexture(GL_TEXTURE_2D, m_fwhtTex[m_fwhtCur][idxV < idxU ? (3 - i) % 3 : i]);
+		}
+		checkError("YUV paint FWHT planes");
+		return;
+	}
+
+	unsigned bpl = m_v4l_fmt.g_bytesperline();
+	unsigned cbpl = m_v4l_fmt.g_num_planes() > 1 ? m_v4l_fmt.g_bytesperline(1) : bpl / hdiv;
+	unsigned cw = m_v4l_fmt.g_width() / hdiv;
+	unsigned ch = m_v4l_fmt.g_height() / vdiv;
+
 	glActiveTexture(GL_TEXTURE0);
 	glBindTexture(GL_TEXTURE_2D, m_screenTexture[0]);
-	glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, m_v4l_fmt.g_width(), m_v4l_fmt.g_height(),
-			GL_RED, GL_UNSIGNED_BYTE, m_curData[0]);
+	if (!bindDmabuf(0, 0, 0, m_v4l_fmt.g_width(), m_v4l_fmt.g_height(), bpl,
+			QVIDCAP_DRM_FORMAT_R8))
+		uploadTexture(GL_TEXTURE_2D, 0, 0, 0, m_v4l_fmt.g_width(), m_v4l_fmt.g_height(),
+				GL_RED, GL_UNSIGNED_BYTE, m_curData[0]);
 	checkError("YUV paint ytex");
 
 	glActiveTexture(GL_TEXTURE1);
@@ -995,20 +1439,24 @@ void CaptureWin::render_YUV(__u32 format)
 	case V4L2_PIX_FMT_YUV422P:
 	case V4L2_PIX_FMT_YUV420:
 	case V4L2_PIX_FMT_YVU420:
-		glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, m_v4l_fmt.g_width() / hdiv, m_v4l_fmt.g_height() / vdiv,
-			GL_RED, GL_UNSIGNED_BYTE, m_curData[0] == NULL ? NULL : &m_curData[0][idxU]);
+		if (!bindDmabuf(1, 0, idxU * bpl / m_v4l_fmt.g_width(), cw, ch, cbpl,
+				QVIDCAP_DRM_FORMAT_R8))
+			uploadTexture(GL_TEXTURE_2D, 0, 0, 0, m_v4l_fmt.g_width() / hdiv, m_v4l_fmt.g_height() / vdiv,
+				GL_RED, GL_UNSIGNED_BYTE, m_curData[0] == NULL ? NULL : &m_curData[0][idxU]);
 		break;
 	case V4L2_PIX_FMT_YUV420M:
 	case V4L2_PIX_FMT_YUV422M:
 	case V4L2_PIX_FMT_YUV444M:
-		glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, m_v4l_fmt.g_width() / hdiv, m_v4l_fmt.g_height() / vdiv,
-			GL_RED, GL_UNSIGNED_BYTE, m_curData[1]);
+		if (!bindDmabuf(1, 1, 0, cw, ch, cbpl, QVIDCAP_DRM_FORMAT_R8))
+			uploadTexture(GL_TEXTURE_2D, 0, 0, 0, m_v4l_fmt.g_width() / hdiv, m_v4l_fmt.g_height() / vdiv,
+				GL_RED, GL_UNSIGNED_BYTE, m_curData[1]);
 		break;
 	case V4L2_PIX_FMT_YVU420M:
 	case V4L2_PIX_FMT_YVU422M:
 	case V4L2_PIX_FMT_YVU444M:
-		glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, m_v4l_fmt.g_width() / hdiv, m_v4l_fmt.g_height() / vdiv,
-			GL_RED, GL_UNSIGNED_BYTE, m_curData[2]);
+		if (!bindDmabuf(1, 2, 0, cw, ch, cbpl, QVIDCAP_DRM_FORMAT_R8))
+			uploadTexture(GL_TEXTURE_2D, 0, 0, 0, m_v4l_fmt.g_width() / hdiv, m_v4l_fmt.g_height() / vdiv,
+				GL_RED, GL_UNSIGNED_BYTE, m_curData[2]);
 		break;
 	}
 	checkError("YUV paint utex");
@@ -1019,20 +1467,24 @@ void CaptureWin::render_YUV(__u32 format)
 	case V4L2_PIX_FMT_YUV422P:
 	case V4L2_PIX_FMT_YUV420:
 	case V4L2_PIX_FMT_YVU420:
-		glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, m_v4l_fmt.g_width() / hdiv, m_v4l_fmt.g_height() / vdiv,
-			GL_RED, GL_UNSIGNED_BYTE, m_curData[0] == NULL ? NULL : &m_curData[0][idxV]);
+		if (!bindDmabuf(2, 0, idxV * bpl / m_v4l_fmt.g_width(), cw, ch, cbpl,
+				QVIDCAP_DRM_FORMAT_R8))
+			uploadTexture(GL_TEXTURE_2D, 0, 0, 0, m_v4l_fmt.g_width() / hdiv, m_v4l_fmt.g_height() / vdiv,
+				GL_RED, GL_UNSIGNED_BYTE, m_curData[0] == NULL ? NULL : &m_curData[0][idxV]);
 		break;
 	case V4L2_PIX_FMT_YUV420M:
 	case V4L2_PIX_FMT_YUV422M:
 	case V4L2_PIX_FMT_YUV444M:
-		glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, m_v4l_fmt.g_width() / hdiv, m_v4l_fmt.g_height() / vdiv,
-			GL_RED, GL_UNSIGNED_BYTE, m_curData[2]);
+		if (!bindDmabuf(2, 2, 0, cw, ch, cbpl, QVIDCAP_DRM_FORMAT_R8))
+			uploadTexture(GL_TEXTURE_2D, 0, 0, 0, m_v4l_fmt.g_width() / hdiv, m_v4l_fmt.g_height() / vdiv,
+				GL_RED, GL_UNSIGNED_BYTE, m_curData[2]);
 		break;
 	case V4L2_PIX_FMT_YVU420M:
 	case V4L2_PIX_FMT_YVU422M:
 	case V4L2_PIX_FMT_YVU444M:
-		glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, m_v4l_fmt.g_width() / hdiv, m_v4l_fmt.g_height() / vdiv,
-			GL_RED, GL_UNSIGNED_BYTE, m_curData[1]);
+		if (!bindDmabuf(2, 1, 0, cw, ch, cbpl, QVIDCAP_DRM_FORMAT_R8))
+			uploadTexture(GL_TEXTURE_2D, 0, 0, 0, m_v4l_fmt.g_width() / hdiv, m_v4l_fmt.g_height() / vdiv,
+				GL_RED, GL_UNSIGNED_BYTE, m_curData[1]);
 		break;
 	}
 	checkError("YUV paint vtex");
@@ -1040,10 +1492,14 @@ void CaptureWin::render_YUV(__u32 format)
 
 void CaptureWin::render_NV12(__u32 format)
 {
+	unsigned bpl = m_v4l_fmt.g_bytesperline();
+
 	glActiveTexture(GL_TEXTURE0);
 	glBindTexture(GL_TEXTURE_2D, m_screenTexture[0]);
-	glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, m_v4l_fmt.g_width(), m_v4l_fmt.g_height(),
-			GL_RED, GL_UNSIGNED_BYTE, m_curData[0]);
+	if (!bindDmabuf(0, 0, 0, m_v4l_fmt.g_width(), m_v4l_fmt.g_height(), bpl,
+			QVIDCAP_DRM_FORMAT_R8))
+		uploadTexture(GL_TEXTURE_2D, 0, 0, 0, m_v4l_fmt.g_width(), m_v4l_fmt.g_height(),
+				GL_RED, GL_UNSIGNED_BYTE, m_curData[0]);
 	checkError("NV12 paint ytex");
 
 	glActiveTexture(GL_TEXTURE1);
@@ -1051,14 +1507,18 @@ void CaptureWin::render_NV12(__u32 format)
 	switch (format) {
 	case V4L2_PIX_FMT_NV12:
 	case V4L2_PIX_FMT_NV21:
-		glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, m_v4l_fmt.g_width(), m_v4l_fmt.g_height() / 2,
-				GL_RED, GL_UNSIGNED_BYTE,
-				m_curData[0] ? m_curData[0] + m_v4l_fmt.g_width() * m_v4l_fmt.g_height() : NULL);
+		if (!bindDmabuf(1, 0, bpl * m_v4l_fmt.g_height(), m_v4l_fmt.g_width(),
+				m_v4l_fmt.g_height() / 2, bpl, QVIDCAP_DRM_FORMAT_R8))
+			uploadTexture(GL_TEXTURE_2D, 0, 0, 0, m_v4l_fmt.g_width(), m_v4l_fmt.g_height() / 2,
+					GL_RED, GL_UNSIGNED_BYTE,
+					m_curData[0] ? m_curData[0] + m_v4l_fmt.g_width() * m_v4l_fmt.g_height() : NULL);
 		break;
 	case V4L2_PIX_FMT_NV12M:
 	case V4L2_PIX_FMT_NV21M:
-		glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, m_v4l_fmt.g_width(), m_v4l_fmt.g_height() / 2,
-				GL_RED, GL_UNSIGNED_BYTE, m_curData[1]);
+		if (!bindDmabuf(1, 1, 0, m_v4l_fmt.g_width(), m_v4l_fmt.g_height() / 2,
+				m_v4l_fmt.g_bytesperline(1), QVIDCAP_DRM_FORMAT_R8))
+			uploadTexture(GL_TEXTURE_2D, 0, 0, 0, m_v4l_fmt.g_width(), m_v4l_fmt.g_height() / 2,
+					GL_RED, GL_UNSIGNED_BYTE, m_curData[1]);
 		break;
 	}
 	checkError("NV12 paint uvtex");
@@ -1069,16 +1529,21 @@ void CaptureWin::render_NV24(__u32 format)
 	glActiveTexture(GL_TEXTURE0);
 	glBindTexture(GL_TEXTURE_2D, m_screenTexture[0]);
 	glPixelStorei(GL_UNPACK_ROW_LENGTH, m_v4l_fmt.g_bytesperline());
-	glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, m_v4l_fmt.g_width(), m_v4l_fmt.g_height(),
-			GL_RED, GL_UNSIGNED_BYTE, m_curData[0]);
+	if (!bindDmabuf(0, 0, 0, m_v4l_fmt.g_width(), m_v4l_fmt.g_height(),
+			m_v4l_fmt.g_bytesperline(), QVIDCAP_DRM_FORMAT_R8))
+		uploadTexture(GL_TEXTURE_2D, 0, 0, 0, m_v4l_fmt.g_width(), m_v4l_fmt.g_height(),
+				GL_RED, GL_UNSIGNED_BYTE, m_curData[0]);
 	checkError("NV24 paint ytex");
 
 	glActiveTexture(GL_TEXTURE1);
 	glBindTexture(GL_TEXTURE_2D, m_screenTexture[1]);
 	glPixelStorei(GL_UNPACK_ROW_LENGTH, m_v4l_fmt.g_bytesperline());
-	glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, m_v4l_fmt.g_width(), m_v4l_fmt.g_height(),
-			GL_RG, GL_UNSIGNED_BYTE,
-			m_curData[0] ? m_curData[0] + m_v4l_fmt.g_sizeimage() / 3 : NULL);
+	if (!bindDmabuf(1, 0, m_v4l_fmt.g_sizeimage() / 3, m_v4l_fmt.g_width(),
+			m_v4l_fmt.g_height(), m_v4l_fmt.g_bytesperline() * 2,
+			QVIDCAP_DRM_FORMAT_GR88))
+		uploadTexture(GL_TEXTURE_2D, 0, 0, 0, m_v4l_fmt.g_width(), m_v4l_fmt.g_height(),
+				GL_RG, GL_UNSIGNED_BYTE,
+				m_curData[0] ? m_curData[0] + m_v4l_fmt.g_sizeimage() / 3 : NULL);
 	checkError("NV24 paint uvtex");
 }
 
@@ -1087,8 +1552,10 @@ void CaptureWin::render_NV16(__u32 format)
 	glActiveTexture(GL_TEXTURE0);
 	glBindTexture(GL_TEXTURE_2D, m_screenTexture[0]);
 	glPixelStorei(GL_UNPACK_ROW_LENGTH, m_v4l_fmt.g_bytesperline());
-	glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, m_v4l_fmt.g_width(), m_v4l_fmt.g_height(),
-			GL_RED, GL_UNSIGNED_BYTE, m_curData[0]);
+	if (!bindDmabuf(0, 0, 0, m_v4l_fmt.g_width(), m_v4l_fmt.g_height(),
+			m_v4l_fmt.g_bytesperline(), QVIDCAP_DRM_FORMAT_R8))
+		uploadTexture(GL_TEXTURE_2D, 0, 0, 0, m_v4l_fmt.g_width(), m_v4l_fmt.g_height(),
+				GL_RED, GL_UNSIGNED_BYTE, m_curData[0]);
 	checkError("NV16 paint ytex");
 
 	glActiveTexture(GL_TEXTURE1);
@@ -1096,14 +1563,19 @@ void CaptureWin::render_NV16(__u32 format)
 	switch (format) {
 	case V4L2_PIX_FMT_NV16:
 	case V4L2_PIX_FMT_NV61:
-		glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, m_v4l_fmt.g_width(), m_v4l_fmt.g_height(),
-				GL_RED, GL_UNSIGNED_BYTE,
-				m_curData[0] ? m_curData[0] + m_v4l_fmt.g_sizeimage() / 2 : NULL);
+		if (!bindDmabuf(1, 0, m_v4l_fmt.g_sizeimage() / 2, m_v4l_fmt.g_width(),
+				m_v4l_fmt.g_height(), m_v4l_fmt.g_bytesperline(),
+				QVIDCAP_DRM_FORMAT_R8))
+			uploadTexture(GL_TEXTURE_2D, 0, 0, 0, m_v4l_fmt.g_width(), m_v4l_fmt.g_height(),
+					GL_RED, GL_UNSIGNED_BYTE,
+					m_curData[0] ? m_curData[0] + m_v4l_fmt.g_sizeimage() / 2 : NULL);
 		break;
 	case V4L2_PIX_FMT_NV16M:
 	case V4L2_PIX_FMT_NV61M:
-		glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, m_v4l_fmt.g_width(), m_v4l_fmt.g_height(),
-				GL_RED, GL_UNSIGNED_BYTE, m_curData[1]);
+		if (!bindDmabuf(1, 1, 0, m_v4l_fmt.g_width(), m_v4l_fmt.g_height(),
+				m_v4l_fmt.g_bytesperline(1), QVIDCAP_DRM_FORMAT_R8))
+			uploadTexture(GL_TEXTURE_2D, 0, 0, 0, m_v4l_fmt.g_width(), m_v4l_fmt.g_height(),
+					GL_RED, GL_UNSIGNED_BYTE, m_curData[1]);
 		break;
 	}
 	glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
@@ -1115,8 +1587,10 @@ void CaptureWin::render_YUY2(__u32 format)
 	glActiveTexture(GL_TEXTURE0);
 	glBindTexture(GL_TEXTURE_2D, m_screenTexture[0]);
 	glPixelStorei(GL_UNPACK_ROW_LENGTH, m_v4l_fmt.g_bytesperline() / 4);
-	glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, m_v4l_fmt.g_width() / 2, m_v4l_fmt.g_height(),
-			GL_RGBA, GL_UNSIGNED_BYTE, m_curData[0]);
+	if (!bindDmabuf(0, 0, 0, m_v4l_fmt.g_width() / 2, m_v4l_fmt.g_height(),
+			m_v4l_fmt.g_bytesperline(), QVIDCAP_DRM_FORMAT_ABGR8888))
+		uploadTexture(GL_TEXTURE_2D, 0, 0, 0, m_v4l_fmt.g_width() / 2, m_v4l_fmt.g_height(),
+				GL_RGBA, GL_UNSIGNED_BYTE, m_curData[0]);
 	glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
 	checkError("YUY2 paint");
 }
@@ -1129,7 +1603,7 @@ void CaptureWin::render_RGB(__u32 format)
 	switch (format) {
 	case V4L2_PIX_FMT_RGB332:
 		glPixelStorei(GL_UNPACK_ROW_LENGTH, m_v4l_fmt.g_bytesperline());
-		glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, m_v4l_fmt.g_width(), m_v4l_fmt.g_height(),
+		uploadTexture(GL_TEXTURE_2D, 0, 0, 0, m_v4l_fmt.g_width(), m_v4l_fmt.g_height(),
 				GL_RGB, GL_UNSIGNED_BYTE_3_3_2, m_curData[0]);
 		break;
 
@@ -1143,13 +1617,13 @@ void CaptureWin::render_RGB(__u32 format)
 	case V4L2_PIX_FMT_BGRX444:
 	case V4L2_PIX_FMT_BGRA444:
 		glPixelStorei(GL_UNPACK_ROW_LENGTH, m_v4l_fmt.g_bytesperline() / 2);
-		glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, m_v4l_fmt.g_width(), m_v4l_fmt.g_height(),
+		uploadTexture(GL_TEXTURE_2D, 0, 0, 0, m_v4l_fmt.g_width(), m_v4l_fmt.g_height(),
 				GL_RGBA, GL_UNSIGNED_SHORT_4_4_4_4, m_curData[0]);
 		break;
 
 	case V4L2_PIX_FMT_GREY:
 		glPixelStorei(GL_UNPACK_ROW_LENGTH, m_v4l_fmt.g_bytesperline());
-		glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, m_v4l_fmt.g_width(), m_v4l_fmt.g_height(),
+		uploadTexture(GL_TEXTURE_2D, 0, 0, 0, m_v4l_fmt.g_width(), m_v4l_fmt.g_height(),
 				GL_RED_INTEGER, GL_UNSIGNED_BYTE, m_curData[0]);
 		break;
 
@@ -1158,12 +1632,12 @@ void CaptureWin::render_RGB(__u32 format)
 	case V4L2_PIX_FMT_Y16:
 	case V4L2_PIX_FMT_Z16:
 		glPixelStorei(GL_UNPACK_ROW_LENGTH, m_v4l_fmt.g_bytesperline() / 2);
-		glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, m_v4l_fmt.g_width(), m_v4l_fmt.g_height(),
+		uploadTexture(GL_TEXTURE_2D, 0, 0, 0, m_v4l_fmt.g_width(), m_v4l_fmt.g_height(),
 				GL_RED_INTEGER, GL_UNSIGNED_SHORT, m_curData[0]);
 		break;
 	case V4L2_PIX_FMT_Y16_BE:
 		glPixelStorei(GL_UNPACK_ROW_LENGTH, m_v4l_fmt.g_bytesperline() / 2);
-		glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, m_v4l_fmt.g_width(), m_v4l_fmt.g_height(),
+		uploadTexture(GL_TEXTURE_2D, 0, 0, 0, m_v4l_fmt.g_width(), m_v4l_fmt.g_height(),
 				GL_RED_INTEGER, GL_UNSIGNED_SHORT, m_curData[0]);
 		break;
 
@@ -1173,7 +1647,7 @@ void CaptureWin::render_RGB(__u32 format)
 	case V4L2_PIX_FMT_XBGR555:
 	case V4L2_PIX_FMT_ABGR555:
 		glPixelStorei(GL_UNPACK_ROW_LENGTH, m_v4l_fmt.g_bytesperline() / 2);
-		glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, m_v4l_fmt.g_width(), m_v4l_fmt.g_height(),
+		uploadTexture(GL_TEXTURE_2D, 0, 0, 0, m_v4l_fmt.g_width(), m_v4l_fmt.g_height(),
 				GL_BGRA, GL_UNSIGNED_SHORT_1_5_5_5_REV, m_curData[0]);
 		break;
 
@@ -1185,7 +1659,7 @@ void CaptureWin::render_RGB(__u32 format)
 		// for the RGB555 format, and false for this format. This would have
 		// to be tested first, though.
 		glPixelStorei(GL_UNPACK_SWAP_BYTES, GL_TRUE);
-		glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, m_v4l_fmt.g_width(), m_v4l_fmt.g_height(),
+		uploadTexture(GL_TEXTURE_2D, 0, 0, 0, m_v4l_fmt.g_width(), m_v4l_fmt.g_height(),
 				GL_BGRA, GL_UNSIGNED_SHORT_1_5_5_5_REV, m_curData[0]);
 		glPixelStorei(GL_UNPACK_SWAP_BYTES, GL_FALSE);
 		break;
@@ -1195,13 +1669,13 @@ void CaptureWin::render_RGB(__u32 format)
 	case V4L2_PIX_FMT_BGRX555:
 	case V4L2_PIX_FMT_BGRA555:
 		glPixelStorei(GL_UNPACK_ROW_LENGTH, m_v4l_fmt.g_bytesperline() / 2);
-		glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, m_v4l_fmt.g_width(), m_v4l_fmt.g_height(),
+		uploadTexture(GL_TEXTURE_2D, 0, 0, 0, m_v4l_fmt.g_width(), m_v4l_fmt.g_height(),
 				GL_BGRA, GL_UNSIGNED_SHORT_5_5_5_1, m_curData[0]);
 		break;
 
 	case V4L2_PIX_FMT_RGB565:
 		glPixelStorei(GL_UNPACK_ROW_LENGTH, m_v4l_fmt.g_bytesperline() / 2);
-		glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, m_v4l_fmt.g_width(), m_v4l_fmt.g_height(),
+		uploadTexture(GL_TEXTURE_2D, 0, 0, 0, m_v4l_fmt.g_width(), m_v4l_fmt.g_height(),
 				GL_RGB, GL_UNSIGNED_SHORT_5_6_5, m_curData[0]);
 		break;
 
@@ -1211,7 +1685,7 @@ void CaptureWin::render_RGB(__u32 format)
 		// for the RGB565 format, and false for this format. This would have
 		// to be tested first, though.
 		glPixelStorei(GL_UNPACK_SWAP_BYTES, GL_TRUE);
-		glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, m_v4l_fmt.g_width(), m_v4l_fmt.g_height(),
+		uploadTexture(GL_TEXTURE_2D, 0, 0, 0, m_v4l_fmt.g_width(), m_v4l_fmt.g_height(),
 				GL_RGB, GL_UNSIGNED_SHORT_5_6_5, m_curData[0]);
 		glPixelStorei(GL_UNPACK_SWAP_BYTES, GL_FALSE);
 		break;
@@ -1228,12 +1702,12 @@ void CaptureWin::render_RGB(__u32 format)
 	case V4L2_PIX_FMT_BGRX32:
 	case V4L2_PIX_FMT_BGRA32:
 		glPixelStorei(GL_UNPACK_ROW_LENGTH, m_v4l_fmt.g_bytesperline() / 4);
-		glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, m_v4l_fmt.g_width(), m_v4l_fmt.g_height(),
+		uploadTexture(GL_TEXTURE_2D, 0, 0, 0, m_v4l_fmt.g_width(), m_v4l_fmt.g_height(),
 				GL_RGBA, GL_UNSIGNED_BYTE, m_curData[0]);
 		break;
 	case V4L2_PIX_FMT_BGR666:
 		glPixelStorei(GL_UNPACK_ROW_LENGTH, m_v4l_fmt.g_bytesperline() / 4);
-		glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, m_v4l_fmt.g_width(), m_v4l_fmt.g_height(),
+		uploadTexture(GL_TEXTURE_2D, 0, 0, 0, m_v4l_fmt.g_width(), m_v4l_fmt.g_height(),
 				GL_BGRA, GL_UNSIGNED_INT_8_8_8_8_REV, m_curData[0]);
 		break;
 
@@ -1242,7 +1716,7 @@ void CaptureWin::render_RGB(__u32 format)
 	case V4L2_PIX_FMT_HSV24:
 	default:
 		glPixelStorei(GL_UNPACK_ROW_LENGTH, m_v4l_fmt.g_bytesperline() / 3);
-		glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, m_v4l_fmt.g_width(), m_v4l_fmt.g_height(),
+		uploadTexture(GL_TEXTURE_2D, 0, 0, 0, m_v4l_fmt.g_width(), m_v4l_fmt.g_height(),
 				GL_RGB, GL_UNSIGNED_BYTE, m_curData[0]);
 		break;
 	}
@@ -1261,7 +1735,7 @@ void CaptureWin::render_Bayer(__u32 format)
 	case V4L2_PIX_FMT_SGRBG8:
 	case V4L2_PIX_FMT_SRGGB8:
 		glPixelStorei(GL_UNPACK_ROW_LENGTH, m_v4l_fmt.g_bytesperline());
-		glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, m_v4l_fmt.g_width(), m_v4l_fmt.g_height(),
+		uploadTexture(GL_TEXTURE_2D, 0, 0, 0, m_v4l_fmt.g_width(), m_v4l_fmt.g_height(),
 				GL_RED_INTEGER, GL_UNSIGNED_BYTE, m_curData[0]);
 		break;
 	case V4L2_PIX_FMT_SBGGR10:
@@ -1277,7 +1751,7 @@ void CaptureWin::render_Bayer(__u32 format)
 	case V4L2_PIX_FMT_SGRBG16:
 	case V4L2_PIX_FMT_SRGGB16:
 		glPixelStorei(GL_UNPACK_ROW_LENGTH, m_v4l_fmt.g_bytesperline() / 2);
-		glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, m_v4l_fmt.g_width(), m_v4l_fmt.g_height(),
+		uploadTexture(GL_TEXTURE_2D, 0, 0, 0, m_v4l_fmt.g_width(), m_v4l_fmt.g_height(),
 				GL_RED_INTEGER, GL_UNSIGNED_SHORT, m_curData[0]);
 		break;
 	}
@@ -1291,17 +1765,17 @@ void CaptureWin::render_YUV_packed(__u32 format)
 
 	switch (format) {
 	case V4L2_PIX_FMT_YUV555:
-		glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, m_v4l_fmt.g_width(), m_v4l_fmt.g_height(),
+		uploadTexture(GL_TEXTURE_2D, 0, 0, 0, m_v4l_fmt.g_width(), m_v4l_fmt.g_height(),
 				GL_BGRA, GL_UNSIGNED_SHORT_1_5_5_5_REV, m_curData[0]);
 		break;
 
 	case V4L2_PIX_FMT_YUV444:
-		glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, m_v4l_fmt.g_width(), m_v4l_fmt.g_height(),
+		uploadTexture(GL_TEXTURE_2D, 0, 0, 0, m_v4l_fmt.g_width(), m_v4l_fmt.g_height(),
 				GL_RGBA, GL_UNSIGNED_SHORT_4_4_4_4, m_curData[0]);
 		break;
 
 	case V4L2_PIX_FMT_YUV565:
-		glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, m_v4l_fmt.g_width(), m_v4l_fmt.g_height(),
+		uploadTexture(GL_TEXTURE_2D, 0, 0, 0, m_v4l_fmt.g_width(), m_v4l_fmt.g_height(),
 				GL_RGB, GL_UNSIGNED_SHORT_5_6_5, m_curData[0]);
 		break;
 
@@ -1310,7 +1784,7 @@ void CaptureWin::render_YUV_packed(__u32 format)
 	case V4L2_PIX_FMT_XYUV32:
 	case V4L2_PIX_FMT_VUYA32:
 	case V4L2_PIX_FMT_VUYX32:
-		glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, m_v4l_fmt.g_width(), m_v4l_fmt.g_height(),
+		uploadTexture(GL_TEXTURE_2D, 0, 0, 0, m_v4l_fmt.g_width(), m_v4l_fmt.g_height(),
 				GL_RGBA, GL_UNSIGNED_BYTE, m_curData[0]);
 		break;
 	}
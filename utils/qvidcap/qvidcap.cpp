@@ -8,6 +8,7 @@
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <netinet/in.h>
+#include <arpa/inet.h>
 
 #include <QApplication>
 #include <QScrollArea>
@@ -29,6 +30,11 @@ static void usage()
 	       "  -f, --file=<file>        read from the file <file> for the raw frame data\n"
 	       "  -p, --port[=<port>]      listen for a network connection on the given port\n"
 	       "                           The default port is %d\n"
+	       "  -u, --udp                receive the stream in UDP datagrams on the --port\n"
+	       "                           instead of over a TCP connection, as sent by\n"
+	       "                           v4l2-ctl --stream-to-host-udp. Implies -p\n"
+	       "  --multicast=<group>      receive the UDP stream sent to this multicast group.\n"
+	       "                           Implies -u\n"
 	       "  -T, --tpg                use the test pattern generator\n"
 	       "\n"
 	       "  If neither -d, -f, -p nor -T is specified then use /dev/video0.\n"
@@ -61,12 +67,20 @@ static void usage()
 	       "\n"
 	       "  -l, --list-formats       display all supported formats\n"
 	       "  -h, --help               display this help message\n"
-	       "  -t, --timings            report frame render timings\n"
+	       "  -t, --timings            report frame render timings, also shown in the\n"
+	       "                           window title\n"
 	       "  -v, --verbose            be more verbose\n"
 	       "  -R, --raw                open device in raw mode\n"
 	       "\n"
 	       "  --opengl                 force openGL to display the video\n"
 	       "  --opengles               force openGL ES to display the video\n"
+	       "  --no-dmabuf              upload the captured buffers to the GPU instead of\n"
+	       "                           importing them as DMABUFs\n"
+	       "  --fwht-gpu               do the inverse transform of FWHT streams received over\n"
+	       "                           TCP on the GPU, the CPU only does the entropy decoding\n"
+	       "  --latency-overlay        show the latency of the captured frames in the window,\n"
+	       "                           press L to toggle\n"
+	       "  --latency-csv=<file>     write the latency of every captured frame to <file>\n"
 	       "\n"
 	       "  The following options are ignored when capturing from a video device:\n"
 	       "\n"
@@ -424,6 +438,112 @@ int initSocket(int port, cv4l_fmt &fmt, v4l2_fract &pixelaspect)
 	return sock_fd;
 }
 
+struct udp_rx udp_stream;
+
+/* Parse the content of an FMT_VIDEO packet */
+bool parseFmtPacket(const __u8 *p, unsigned size, cv4l_fmt &fmt, v4l2_fract &pixelaspect)
+{
+	const __u32 *w = (const __u32 *)p;
+	unsigned num_planes;
+
+	if (size < V4L_STREAM_PACKET_FMT_VIDEO_SIZE(0) ||
+	    ntohl(w[0]) != V4L_STREAM_PACKET_FMT_VIDEO_SIZE_FMT)
+		return false;
+	num_planes = ntohl(w[1]);
+	if (!num_planes || num_planes > VIDEO_MAX_PLANES ||
+	    size < V4L_STREAM_PACKET_FMT_VIDEO_SIZE(num_planes))
+		return false;
+	fmt.s_type(V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE);
+	fmt.s_num_planes(num_planes);
+	fmt.s_pixelformat(ntohl(w[2]));
+	fmt.s_width(ntohl(w[3]));
+	fmt.s_height(ntohl(w[4]));
+	fmt.s_field(ntohl(w[5]));
+	fmt.s_colorspace(ntohl(w[6]));
+	fmt.s_ycbcr_enc(ntohl(w[7]));
+	fmt.s_quantization(ntohl(w[8]));
+	fmt.s_xfer_func(ntohl(w[9]));
+	fmt.s_flags(ntohl(w[10]));
+	pixelaspect.numerator = ntohl(w[11]);
+	pixelaspect.denominator = ntohl(w[12]);
+	w += 13;
+
+	for (unsigned i = 0; i < num_planes; i++, w += 3) {
+		if (ntohl(w[0]) != V4L_STREAM_PACKET_FMT_VIDEO_SIZE_FMT_PLANE)
+			return false;
+		fmt.s_sizeimage(ntohl(w[1]), i);
+		fmt.s_bytesperline(ntohl(w[2]), i);
+	}
+	return true;
+}
+
+/*
+ * Open the UDP socket, the first time this is called, and wait for an
+ * FMT_VIDEO packet. That is sent before every I-frame, so decoding can
+ * start with the next frame.
+ */
+int initUdpSocket(int port, const char *group, cv4l_fmt &fmt, v4l2_fract &pixelaspect)
+{
+	static int sock_fd = -1;
+	__u8 dgram[V4L_STREAM_UDP_MAX_SIZE];
+
+	if (sock_fd < 0) {
+		struct sockaddr_in serv_addr = {};
+		int val = 1;
+
+		sock_fd = socket(AF_INET, SOCK_DGRAM, 0);
+		if (sock_fd < 0) {
+			fprintf(stderr, "could not opening socket\n");
+			std::exit(EXIT_FAILURE);
+		}
+		/* So several viewers on this host can join the same group */
+		setsockopt(sock_fd, SOL_SOCKET, SO_REUSEADDR, &val, sizeof(int));
+		/* A frame arrives as a burst of datagrams */
+		val = 8 * 1024 * 1024;
+		setsockopt(sock_fd, SOL_SOCKET, SO_RCVBUF, &val, sizeof(int));
+
+		serv_addr.sin_family = AF_INET;
+		serv_addr.sin_addr.s_addr = INADDR_ANY;
+		serv_addr.sin_port = htons(port);
+		if (bind(sock_fd, (struct sockaddr *)&serv_addr, sizeof(serv_addr)) < 0) {
+			fprintf(stderr, "could not bind: %s\n", strerror(errno));
+			std::exit(EXIT_FAILURE);
+		}
+		if (group) {
+			struct ip_mreq mreq = {};
+
+			if (!inet_aton(group, &mreq.imr_multiaddr)) {
+				fprintf(stderr, "invalid multicast group %s\n", group);
+				std::exit(EXIT_FAILURE);
+			}
+			mreq.imr_interface.s_addr = INADDR_ANY;
+			if (setsockopt(sock_fd, IPPROTO_IP, IP_ADD_MEMBERSHIP,
+				       &mreq, sizeof(mreq)) < 0) {
+				fprintf(stderr, "could not join %s: %s\n", group, strerror(errno));
+				std::exit(EXIT_FAILURE);
+			}
+		}
+	}
+	for (;;) {
+		int n = recv(sock_fd, dgram, sizeof(dgram), 0);
+
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n < 0) {
+			fprintf(stderr, "could not receive: %s\n", strerror(errno));
+			std::exit(EXIT_FAILURE);
+		}
+		if (udp_rx_datagram(&udp_stream, dgram, n) != 1 || udp_stream.size < 8 ||
+		    ntohl(*(__u32 *)udp_stream.buf) != V4L_STREAM_PACKET_FMT_VIDEO)
+			continue;
+		if (parseFmtPacket(udp_stream.buf + 8, udp_stream.size - 8, fmt, pixelaspect))
+			break;
+	}
+	/* Whatever got lost before doesn't matter anymore */
+	udp_stream.lost = false;
+	return sock_fd;
+}
+
 int main(int argc, char **argv)
 {
 	QApplication disp(argc, argv);
@@ -441,6 +561,8 @@ int main(int argc, char **argv)
 	bool single_step = false;
 	unsigned single_step_start = 1;
 	int port = 0;
+	bool udp = false;
+	QString multicast;
 	bool info_option = false;
 	bool report_timings = false;
 	bool verbose = false;
@@ -472,6 +594,10 @@ int main(int argc, char **argv)
 	tpg_move_mode vert_mode = TPG_MOVE_NONE;
 	bool force_opengl = false;
 	bool force_opengles = false;
+	bool no_dmabuf = false;
+	bool fwht_gpu = false;
+	bool latency_overlay = false;
+	QString latency_csv;
 
 	disp.setWindowIcon(QIcon(":/qvidcap.png"));
 	disp.setApplicationDisplayName("V4L2 Viewer");
@@ -494,6 +620,18 @@ int main(int argc, char **argv)
 			if (!processOption(args, i, port))
 				return 0;
 			mode = AppModeSocket;
+		} else if (isOption(args[i], "--udp", "-u")) {
+			udp = true;
+			mode = AppModeSocket;
+			if (!port)
+				port = V4L_STREAM_PORT;
+		} else if (isOptArg(args[i], "--multicast")) {
+			if (!processOption(args, i, multicast))
+				return 0;
+			udp = true;
+			mode = AppModeSocket;
+			if (!port)
+				port = V4L_STREAM_PORT;
 		} else if (isOption(args[i], "--tpg", "-T")) {
 			mode = AppModeTPG;
 		} else if (isOptArg(args[i], "--test-mask")) {
@@ -645,6 +783,15 @@ int main(int argc, char **argv)
 			force_opengles = true;
 		} else if (isOptArg(args[i], "--opengl")) {
 			force_opengl = true;
+		} else if (isOption(args[i], "--no-dmabuf")) {
+			no_dmabuf = true;
+		} else if (isOption(args[i], "--fwht-gpu")) {
+			fwht_gpu = true;
+		} else if (isOption(args[i], "--latency-overlay")) {
+			latency_overlay = true;
+		} else if (isOptArg(args[i], "--latency-csv")) {
+			if (!processOption(args, i, latency_csv))
+				return 0;
 		} else if (isOption(args[i], "--verbose", "-v")) {
 			verbose = true;
 		} else if (isOption(args[i], "--raw", "-R")) {
@@ -713,6 +860,10 @@ int main(int argc, char **argv)
 		unsigned tmp_w, tmp_h;
 
 		pixelaspect = fd.g_pixel_aspect(tmp_w, tmp_h);
+	} else if (mode == AppModeSocket && udp) {
+		fps = 0;
+		sock_fd = initUdpSocket(port, multicast.isEmpty() ? NULL : multicast.toUtf8().data(),
+					fmt, pixelaspect);
 	} else if (mode == AppModeSocket) {
 		fps = 0;
 		sock_fd = initSocket(port, fmt, pixelaspect);
@@ -758,6 +909,17 @@ int main(int argc, char **argv)
 	win.setFps(fps);
 	win.setFormat(format);
 	win.setReportTimings(report_timings);
+	win.setLatencyOverlay(latency_overlay);
+	if (!latency_csv.isEmpty()) {
+		FILE *csv = fopen(latency_csv.toUtf8().data(), "w");
+
+		if (!csv) {
+			fprintf(stderr, "could not open %s for writing\n",
+				latency_csv.toUtf8().data());
+			std::exit(EXIT_FAILURE);
+		}
+		win.setLatencyCsv(csv);
+	}
 	win.setCount(test ? test : cnt);
 	if (mode == AppModeTest) {
 		win.setModeTest(test);
@@ -788,7 +950,10 @@ int main(int argc, char **argv)
 			pixfmt2s(fmt.g_pixelformat()).c_str());
 		if (mode != AppModeSocket)
 			std::exit(EXIT_FAILURE);
-		sock_fd = initSocket(port, fmt, pixelaspect);
+		if (udp)
+			sock_fd = initUdpSocket(port, NULL, fmt, pixelaspect);
+		else
+			sock_fd = initSocket(port, fmt, pixelaspect);
 	}
 	win.setPixelAspect(pixelaspect);
 	win.setMinimumSize(16, 16);
@@ -804,12 +969,19 @@ int main(int argc, char **argv)
 	sa->resize(win.correctAspect(QSize(fmt.g_width(), fmt.g_frame_height())));
 	sa->setWidgetResizable(true);
 
-	if (mode == AppModeSocket)
+	win.setFwhtGpu(fwht_gpu);
+	if (mode == AppModeSocket && udp)
+		win.setModeUdp(sock_fd, port);
+	else if (mode == AppModeSocket)
 		win.setModeSocket(sock_fd, port);
 	else if (mode == AppModeV4L2) {
 		cv4l_queue q(fd.g_type(), V4L2_MEMORY_MMAP);
 		q.reqbufs(&fd, v4l2_bufs);
 		q.obtain_bufs(&fd);
+		if (!no_dmabuf && !q.export_bufs(&fd, fd.g_type()))
+			win.setDmabuf(true);
+		else
+			q.close_exported_fds();
 		q.queue_all(&fd);
 		win.setQueue(&q);
 		if (fd.streamon())
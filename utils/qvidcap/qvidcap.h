@@ -19,4 +19,9 @@
 __u32 read_u32(int fd);
 int initSocket(int port, cv4l_fmt &fmt, v4l2_fract &pixelaspect);
 
+/* Reassembles the packets received by initUdpSocket() and CaptureWin */
+extern struct udp_rx udp_stream;
+bool parseFmtPacket(const __u8 *p, unsigned size, cv4l_fmt &fmt, v4l2_fract &pixelaspect);
+int initUdpSocket(int port, const char *group, cv4l_fmt &fmt, v4l2_fract &pixelaspect);
+
 #endif
@@ -21,6 +21,8 @@
 #include <dirent.h>
 #include <fcntl.h>
 #include <getopt.h>
+#include <poll.h>
+#include <sys/epoll.h>
 #include <sys/ioctl.h>
 #include <unistd.h>
 
@@ -49,9 +51,11 @@ enum Option {
 	OptReadRds = 'R',
 	OptGetTuner = 'T',
 	OptAll = 128,
+	OptBandScan,
 	OptFreqSeek,
 	OptListDevices,
 	OptListFreqBands,
+	OptMonitor,
 	OptOpenFile,
 	OptPrintBlock,
 	OptSilent,
@@ -79,6 +83,7 @@ static int app_result;
 static struct option long_options[] = {
 	{"all", no_argument, 0, OptAll},
 	{"rbds", no_argument, 0, OptRBDS},
+	{"band-scan", no_argument, 0, OptBandScan},
 	{"device", required_argument, 0, OptSetDevice},
 	{"file", required_argument, 0, OptOpenFile},
 	{"freq-seek", required_argument, 0, OptFreqSeek},
@@ -88,6 +93,7 @@ static struct option long_options[] = {
 	{"info", no_argument, 0, OptGetDriverInfo},
 	{"list-devices", no_argument, 0, OptListDevices},
 	{"list-freq-bands", no_argument, 0, OptListFreqBands},
+	{"monitor", no_argument, 0, OptMonitor},
 	{"print-block", no_argument, 0, OptPrintBlock},
 	{"read-rds", no_argument, 0, OptReadRds},
 	{"set-freq", required_argument, 0, OptSetFreq},
@@ -133,6 +139,10 @@ static void usage_tuner()
 	       "                     spacing sets the seek resolution (use 0 for default)\n"
 	       "  --list-freq-bands  display all frequency bands for the tuner/modulator\n"
 	       "                     [VIDIOC_ENUM_FREQ_BANDS]\n"
+	       "  --band-scan        seek through the whole range of the tuner and list the\n"
+	       "                     stations found with their PI code and PS name. Each\n"
+	       "                     station is listened to until both are decoded, but\n"
+	       "                     at most for the wait limit [VIDIOC_S_HW_FREQ_SEEK]\n"
 	       );
 }
 
@@ -146,6 +156,11 @@ static void usage_rds()
 	       "  --wait-limit <ms>  defines the maximum wait duration for avaibility of new\n"
 	       "                     RDS data\n"
 	       "                     <default>: 5000 ms\n"
+	       "  --monitor          decode the RDS data of all RDS-capable radio devices at\n"
+	       "                     once and print one line for each group that changed a\n"
+	       "                     field: '<time> <dev> <field>=<value> ...'. A device that\n"
+	       "                     has no RDS data for the wait limit is reported as\n"
+	       "                     '<time> <dev> NODATA'\n"
 	       "  --print-block      prints all valid RDS fields, whenever a value is updated\n"
 	       "                     instead of printing only updated values\n"
 	       "  --tmc              print information about TMC (Traffic Message Channel) messages\n"
@@ -668,38 +683,61 @@ static void print_rds_data(const struct v4l2_rds *handle, uint32_t updated_field
 		print_rds_tmc(handle, updated_fields);
 }
 
+/* number of RDS blocks read at once, 64 blocks take ~1.4s to transmit */
+#define RDS_READ_BLOCKS 64
+
 static void read_rds(struct v4l2_rds *handle, const int fd, const int wait_limit)
 {
 	int byte_cnt = 0;
 	int error_cnt = 0;
 	uint32_t updated_fields = 0x00;
-	struct v4l2_rds_data rds_data; /* read buffer for rds blocks */
+	struct v4l2_rds_data rds_data[RDS_READ_BLOCKS]; /* read buffer for rds blocks */
+	struct pollfd pfd = { fd, POLLIN, 0 };
+	unsigned int bytes = 0;	/* bytes in rds_data, a file may end with a partial block */
 
 	while (!params.terminate_decoding) {
-		memset(&rds_data, 0, sizeof(rds_data));
-		if ((byte_cnt=read(fd, &rds_data, 3)) != 3) {
-			if (byte_cnt == 0) {
-				printf("\nEnd of input file reached \n");
-				break;
-			}
-			if (++error_cnt > 2) {
+		/* wait for new data to arrive: transmission of 1
+		 * group takes ~88.7ms */
+		byte_cnt = poll(&pfd, 1, wait_limit);
+		if (byte_cnt > 0)
+			byte_cnt = read(fd, (char *)rds_data + bytes,
+					sizeof(rds_data) - bytes);
+		else if (byte_cnt == 0)
+			byte_cnt = -1;
+		if (byte_cnt == 0) {
+			printf("\nEnd of input file reached \n");
+			break;
+		}
+		if (byte_cnt < 0) {
+			if (errno == EINTR)
+				continue;
+			if (++error_cnt > 1) {
 				fprintf(stderr, "\nError reading from "
 					"device (no RDS data available)\n");
 				break;
 			}
-			/* wait for new data to arrive: transmission of 1
-			 * group takes ~88.7ms */
-			usleep(wait_limit * 1000);
+			continue;
 		}
-		else if (byte_cnt == 3) {
-			error_cnt = 0;
+		error_cnt = 0;
+		bytes += byte_cnt;
+
+		unsigned int blocks = bytes / sizeof(rds_data[0]);
+		unsigned int i = 0;
+
+		while (i < blocks) {
+			unsigned int count = blocks - i;
+
 			/* true if a new group was decoded */
-			if ((updated_fields = v4l2_rds_add(handle, &rds_data))) {
+			updated_fields = v4l2_rds_add_blocks(handle, rds_data + i, &count);
+			i += count;
+			if (updated_fields) {
 				print_rds_data(handle, updated_fields);
 				if (params.options[OptVerbose])
 					 print_rds_group(v4l2_rds_get_group(handle));
 			}
 		}
+		bytes -= blocks * sizeof(rds_data[0]);
+		memmove(rds_data, rds_data + blocks, bytes);
 	}
 	/* print a summary of all valid RDS-fields before exiting */
 	printf("\nSummary of valid RDS-fields:");
@@ -725,6 +763,278 @@ static void read_rds_from_fd(const int fd)
 	v4l2_rds_destroy(rds_handle);
 }
 
+/* state of one radio device in monitor mode */
+struct rds_monitor {
+	std::string name;
+	int fd;
+	struct v4l2_rds *handle;
+	int64_t last_data;	/* CLOCK_MONOTONIC timestamp in ms of the last data */
+	bool silent;		/* NODATA was reported since the last data */
+	struct v4l2_rds prev;	/* the fields as they were last printed */
+	unsigned int bytes;	/* bytes in rds_data */
+	struct v4l2_rds_data rds_data[RDS_READ_BLOCKS];
+};
+
+static int64_t monotonic_ms()
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000LL + ts.tv_nsec / 1000000;
+}
+
+static void print_record_start(const struct rds_monitor &mon)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_REALTIME, &ts);
+	printf("%lld.%03ld %s", static_cast<long long>(ts.tv_sec),
+	       ts.tv_nsec / 1000000, mon.name.c_str());
+}
+
+static void print_quoted(const char *key, const unsigned char *s)
+{
+	printf(" %s=\"", key);
+	for (; *s; s++) {
+		if (*s == '"' || *s == '\\')
+			putchar('\\');
+		putchar(*s);
+	}
+	putchar('"');
+}
+
+/* the fields that are printed in monitor mode */
+#define RDS_RECORD_FIELDS (V4L2_RDS_PI | V4L2_RDS_PTY | V4L2_RDS_TP | \
+			   V4L2_RDS_PS | V4L2_RDS_TA | V4L2_RDS_DI | \
+			   V4L2_RDS_MS | V4L2_RDS_PTYN | V4L2_RDS_RT | \
+			   V4L2_RDS_TIME | V4L2_RDS_AF | V4L2_RDS_ECC | \
+			   V4L2_RDS_LC)
+
+template <typename T>
+static uint32_t changed_field(uint32_t flag, uint32_t updated_fields,
+			      uint32_t &prev_valid, T &prev, const T &cur)
+{
+	if (!(updated_fields & flag))
+		return 0;
+	if ((prev_valid & flag) && !memcmp(&prev, &cur, sizeof(T)))
+		return 0;
+	memcpy(&prev, &cur, sizeof(T));
+	prev_valid |= flag;
+	return flag;
+}
+
+/*
+ * Drop the fields from updated_fields that did not change since they
+ * were last printed: the library also reports a field as updated when
+ * the same value is received again (e.g. V4L2_RDS_PTY shares its bit
+ * with V4L2_RDS_ODA).
+ */
+static uint32_t rds_changed_fields(struct rds_monitor &mon, uint32_t updated_fields)
+{
+	const struct v4l2_rds *handle = mon.handle;
+	struct v4l2_rds &prev = mon.prev;
+	uint32_t &valid = prev.valid_fields;
+	uint32_t changed = 0;
+
+	updated_fields &= handle->valid_fields & RDS_RECORD_FIELDS;
+	if (!updated_fields)
+		return 0;
+	changed |= changed_field(V4L2_RDS_PI, updated_fields, valid, prev.pi, handle->pi);
+	changed |= changed_field(V4L2_RDS_PS, updated_fields, valid, prev.ps, handle->ps);
+	changed |= changed_field(V4L2_RDS_PTY, updated_fields, valid, prev.pty, handle->pty);
+	changed |= changed_field(V4L2_RDS_PTYN, updated_fields, valid, prev.ptyn, handle->ptyn);
+	changed |= changed_field(V4L2_RDS_RT, updated_fields, valid, prev.rt, handle->rt);
+	changed |= changed_field(V4L2_RDS_TP, updated_fields, valid, prev.tp, handle->tp);
+	changed |= changed_field(V4L2_RDS_TA, updated_fields, valid, prev.ta, handle->ta);
+	changed |= changed_field(V4L2_RDS_MS, updated_fields, valid, prev.ms, handle->ms);
+	changed |= changed_field(V4L2_RDS_ECC, updated_fields, valid, prev.ecc, handle->ecc);
+	changed |= changed_field(V4L2_RDS_LC, updated_fields, valid, prev.lc, handle->lc);
+	changed |= changed_field(V4L2_RDS_DI, updated_fields, valid, prev.di, handle->di);
+	changed |= changed_field(V4L2_RDS_TIME, updated_fields, valid, prev.time, handle->time);
+	changed |= changed_field(V4L2_RDS_AF, updated_fields, valid, prev.rds_af, handle->rds_af);
+	return changed;
+}
+
+/* print the fields in updated_fields as one line of key=value pairs */
+static void print_rds_record(struct rds_monitor &mon, uint32_t updated_fields)
+{
+	const struct v4l2_rds *handle = mon.handle;
+
+	updated_fields = rds_changed_fields(mon, updated_fields);
+	if (!updated_fields)
+		return;
+
+	print_record_start(mon);
+	if (updated_fields & V4L2_RDS_PI)
+		printf(" PI=%04x", handle->pi);
+	if (updated_fields & V4L2_RDS_PS)
+		print_quoted("PS", handle->ps);
+	if (updated_fields & V4L2_RDS_PTY)
+		printf(" PTY=%u", handle->pty);
+	if (updated_fields & V4L2_RDS_PTYN)
+		print_quoted("PTYN", handle->ptyn);
+	if (updated_fields & V4L2_RDS_RT)
+		print_quoted("RT", handle->rt);
+	if (updated_fields & V4L2_RDS_TP)
+		printf(" TP=%u", handle->tp);
+	if (updated_fields & V4L2_RDS_TA)
+		printf(" TA=%u", handle->ta);
+	if (updated_fields & V4L2_RDS_MS)
+		printf(" MS=%u", handle->ms);
+	if (updated_fields & V4L2_RDS_ECC)
+		printf(" ECC=%02x", handle->ecc);
+	if (updated_fields & V4L2_RDS_LC)
+		printf(" LC=%u", handle->lc);
+	if (updated_fields & V4L2_RDS_DI)
+		printf(" DI=%x", handle->di);
+	if (updated_fields & V4L2_RDS_TIME)
+		printf(" TIME=%lld", static_cast<long long>(handle->time));
+	if (updated_fields & V4L2_RDS_AF) {
+		const struct v4l2_rds_af_set *af_set = &handle->rds_af;
+
+		printf(" AF=");
+		for (int i = 0; i < af_set->size && i < af_set->announced_af; i++)
+			printf("%s%u", i ? "," : "", af_set->af[i]);
+	}
+	printf("\n");
+}
+
+/* read all data that is available from a device, returns false on EOF/error */
+static bool monitor_read(struct rds_monitor &mon)
+{
+	int byte_cnt = read(mon.fd, (char *)mon.rds_data + mon.bytes,
+			    sizeof(mon.rds_data) - mon.bytes);
+
+	if (byte_cnt < 0)
+		return errno == EAGAIN || errno == EINTR;
+	if (byte_cnt == 0)
+		return false;
+
+	mon.last_data = monotonic_ms();
+	mon.silent = false;
+	mon.bytes += byte_cnt;
+
+	unsigned int blocks = mon.bytes / sizeof(mon.rds_data[0]);
+	unsigned int i = 0;
+
+	while (i < blocks) {
+		unsigned int count = blocks - i;
+		uint32_t updated_fields;
+
+		updated_fields = v4l2_rds_add_blocks(mon.handle, mon.rds_data + i, &count);
+		i += count;
+		if (updated_fields)
+			print_rds_record(mon, updated_fields);
+	}
+	mon.bytes -= blocks * sizeof(mon.rds_data[0]);
+	memmove(mon.rds_data, mon.rds_data + blocks, mon.bytes);
+	return true;
+}
+
+/*
+ * Monitor mode: decode the RDS data of all radio devices from a single
+ * epoll loop, one RDS handle per device. Only the updated fields of each
+ * group are printed, so the amount of work and output follows the number
+ * of changes.
+ */
+static void monitor_devices(const dev_vec &devices)
+{
+	std::vector<struct rds_monitor> monitors(devices.size());
+	struct epoll_event events[16];
+	int64_t now = monotonic_ms();
+	unsigned active = 0;
+	int epfd;
+
+	epfd = epoll_create1(EPOLL_CLOEXEC);
+	if (epfd < 0) {
+		perror("epoll_create1");
+		std::exit(EXIT_FAILURE);
+	}
+	for (unsigned i = 0; i < devices.size(); i++) {
+		struct rds_monitor &mon = monitors[i];
+		struct epoll_event ev = {};
+
+		mon.name = devices[i];
+		mon.fd = open(mon.name.c_str(), O_RDONLY | O_NONBLOCK);
+		if (mon.fd < 0) {
+			fprintf(stderr, "Failed to open %s: %s\n", mon.name.c_str(),
+				strerror(errno));
+			continue;
+		}
+		mon.handle = v4l2_rds_create(params.options[OptRBDS]);
+		if (!mon.handle) {
+			fprintf(stderr, "Failed to init RDS lib: %s\n", strerror(errno));
+			std::exit(EXIT_FAILURE);
+		}
+		mon.last_data = now;
+		ev.events = EPOLLIN;
+		ev.data.ptr = &mon;
+		if (epoll_ctl(epfd, EPOLL_CTL_ADD, mon.fd, &ev)) {
+			fprintf(stderr, "Failed to monitor %s: %s\n", mon.name.c_str(),
+				strerror(errno));
+			v4l2_rds_destroy(mon.handle);
+			mon.handle = nullptr;
+			close(mon.fd);
+			mon.fd = -1;
+			continue;
+		}
+		active++;
+	}
+
+	while (active && !params.terminate_decoding) {
+		int timeout = -1;
+
+		/* wake up when the next device exceeds the wait limit */
+		for (const auto &mon : monitors) {
+			if (mon.fd < 0 || mon.silent)
+				continue;
+
+			int64_t left = mon.last_data + params.wait_limit - now;
+
+			if (left < 0)
+				left = 0;
+			if (timeout < 0 || left < timeout)
+				timeout = left;
+		}
+
+		int n = epoll_wait(epfd, events, ARRAY_SIZE(events), timeout);
+
+		if (n < 0 && errno != EINTR) {
+			perror("epoll_wait");
+			break;
+		}
+		for (int i = 0; i < n; i++) {
+			struct rds_monitor &mon = *static_cast<struct rds_monitor *>(events[i].data.ptr);
+
+			if (monitor_read(mon))
+				continue;
+			fprintf(stderr, "%s: no more RDS data\n", mon.name.c_str());
+			epoll_ctl(epfd, EPOLL_CTL_DEL, mon.fd, nullptr);
+			close(mon.fd);
+			mon.fd = -1;
+			active--;
+		}
+		now = monotonic_ms();
+		for (auto &mon : monitors) {
+			if (mon.fd < 0 || mon.silent ||
+			    now - mon.last_data < params.wait_limit)
+				continue;
+			print_record_start(mon);
+			printf(" NODATA\n");
+			mon.silent = true;
+		}
+		fflush(stdout);
+	}
+
+	for (auto &mon : monitors) {
+		if (mon.fd >= 0)
+			close(mon.fd);
+		if (mon.handle)
+			v4l2_rds_destroy(mon.handle);
+	}
+	close(epfd);
+}
+
 static int parse_cl(int argc, char **argv)
 {
 	int i = 0;
@@ -939,6 +1249,136 @@ static void get_options(const int fd, const int capabilities, struct v4l2_freque
 	}
 }
 
+/* listen to the current station until its PI code and PS name are known */
+static void scan_station(const int fd, struct v4l2_rds *handle, const int wait_limit)
+{
+	const uint32_t wanted = V4L2_RDS_PI | V4L2_RDS_PS;
+	struct v4l2_rds_data rds_data[RDS_READ_BLOCKS];
+	struct pollfd pfd = { fd, POLLIN, 0 };
+	int64_t end;
+
+	/* drop the RDS data of the previous station */
+	while (read(fd, rds_data, sizeof(rds_data)) > 0)
+		;
+	v4l2_rds_reset(handle, true);
+
+	end = monotonic_ms() + wait_limit;
+	while (!params.terminate_decoding) {
+		int64_t left = end - monotonic_ms();
+		int byte_cnt;
+
+		if (left <= 0)
+			break;
+		byte_cnt = poll(&pfd, 1, left);
+		if (byte_cnt > 0)
+			byte_cnt = read(fd, rds_data, sizeof(rds_data));
+		if (byte_cnt < 0 && (errno == EINTR || errno == EAGAIN))
+			continue;
+		if (byte_cnt <= 0)
+			break;
+
+		unsigned int blocks = byte_cnt / sizeof(rds_data[0]);
+		unsigned int i = 0;
+
+		while (i < blocks) {
+			unsigned int count = blocks - i;
+
+			v4l2_rds_add_blocks(handle, rds_data + i, &count);
+			i += count;
+		}
+		if ((handle->valid_fields & wanted) == wanted)
+			break;
+	}
+}
+
+/*
+ * Chain hardware seeks from the lower end of the tuner range upwards and
+ * print a table of all stations found. The RDS data of each station is
+ * decoded only until the PI code and PS name are known, so the scan does
+ * not have to wait a fixed time per station.
+ */
+static void band_scan(const int fd)
+{
+	struct v4l2_tuner vt;
+	struct v4l2_frequency vf;
+	struct v4l2_hw_freq_seek seek;
+	struct v4l2_rds *handle;
+	unsigned stations = 0;
+	int64_t start = monotonic_ms();
+	__u32 orig_freq;
+	__u32 last;
+	double fac;
+
+	memset(&vt, 0, sizeof(vt));
+	vt.index = params.tuner_index;
+	if (doioctl(fd, VIDIOC_G_TUNER, &vt))
+		return;
+	if (!(vt.capability & (V4L2_TUNER_CAP_HWSEEK_BOUNDED | V4L2_TUNER_CAP_HWSEEK_WRAP))) {
+		fprintf(stderr, "Tuner %d does not support hardware seek\n", vt.index);
+		return;
+	}
+	fac = (vt.capability & V4L2_TUNER_CAP_LOW) ? 16000 : 16;
+
+	memset(&vf, 0, sizeof(vf));
+	vf.tuner = vt.index;
+	vf.type = vt.type;
+	if (doioctl(fd, VIDIOC_G_FREQUENCY, &vf))
+		return;
+	orig_freq = vf.frequency;
+	vf.frequency = vt.rangelow;
+	if (doioctl(fd, VIDIOC_S_FREQUENCY, &vf))
+		return;
+	last = vt.rangelow;
+
+	if (!(handle = v4l2_rds_create(params.options[OptRBDS]))) {
+		fprintf(stderr, "Failed to init RDS lib: %s\n", strerror(errno));
+		std::exit(EXIT_FAILURE);
+	}
+
+	memset(&seek, 0, sizeof(seek));
+	seek.tuner = vt.index;
+	seek.type = vt.type;
+	seek.seek_upward = 1;
+	/* without bounded seek, detect the wrap around from the frequency */
+	seek.wrap_around = !(vt.capability & V4L2_TUNER_CAP_HWSEEK_BOUNDED);
+
+	printf("Frequency      Signal  PI    PS\n");
+	while (!params.terminate_decoding) {
+		if (ioctl(fd, VIDIOC_S_HW_FREQ_SEEK, &seek)) {
+			/* ENODATA: no more stations until the end of the range */
+			if (errno != ENODATA && errno != EINTR)
+				fprintf(stderr, "VIDIOC_S_HW_FREQ_SEEK: failed: %s\n",
+					strerror(errno));
+			break;
+		}
+		if (doioctl(fd, VIDIOC_G_FREQUENCY, &vf) || vf.frequency <= last)
+			break;
+		last = vf.frequency;
+		stations++;
+
+		scan_station(fd, handle, params.wait_limit);
+		vt.index = params.tuner_index;
+		if (ioctl(fd, VIDIOC_G_TUNER, &vt))
+			vt.signal = 0;
+		printf("%8.3f MHz   %3ld%%   ", vf.frequency / fac, lround(vt.signal / 655.25));
+		if (handle->valid_fields & V4L2_RDS_PI)
+			printf("%04x  ", handle->pi);
+		else
+			printf("-     ");
+		if (handle->valid_fields & V4L2_RDS_PS)
+			printf("%s\n", handle->ps);
+		else
+			printf("-\n");
+		fflush(stdout);
+	}
+	printf("%u stations found in %.1f s\n", stations,
+	       (monotonic_ms() - start) / 1000.0);
+
+	vf.frequency = orig_freq;
+	doioctl(fd, VIDIOC_S_FREQUENCY, &vf);
+	v4l2_rds_destroy(handle);
+}
+
 int main(int argc, char **argv)
 {
 	int fd = -1;
@@ -979,6 +1419,18 @@ int main(int argc, char **argv)
 		std::exit(EXIT_SUCCESS);
 	}
 
+	/* Monitor Mode: decode the RDS data of all radio devices */
+	if (params.options[OptMonitor]) {
+		dev_vec devices = list_devices();
+
+		if (devices.empty()) {
+			fprintf(stderr, "No RDS-capable device found\n");
+			std::exit(EXIT_FAILURE);
+		}
+		monitor_devices(devices);
+		std::exit(EXIT_SUCCESS);
+	}
+
 	/* Device Mode: open the radio device as read-only and non-blocking */
 	if (!params.options[OptSetDevice]) {
 		/* check the system for RDS capable devices */
@@ -1005,6 +1457,9 @@ int main(int argc, char **argv)
 	set_options(fd, vcap.capabilities, &vf, &tuner);
 	/* Get options */
 	get_options(fd, vcap.capabilities, &vf, &tuner);
+	/* Band scan */
+	if (params.options[OptBandScan])
+		band_scan(fd);
 	/* RDS decoding */
 	if (params.options[OptReadRds])
 		read_rds_from_fd(fd);
@@ -66,6 +66,8 @@ enum Option {
 	OptMediaBusInfo = 'z',
 	OptStreamFrom = 128,
 	OptStreamFromHdr,
+	OptStreamPerf,
+	OptParallel,
 	OptVersion,
 	OptLast = 256
 };
@@ -86,10 +88,12 @@ bool exit_on_warn;
 bool is_vivid;
 int media_fd = -1;
 unsigned warnings;
+bool parallel_nodes;
 
 static unsigned color_component;
 static unsigned color_skip;
 static unsigned color_perc = 90;
+static unsigned stream_perf_secs = 5;
 
 struct dev_state {
 	struct node *node;
@@ -141,6 +145,8 @@ static struct option long_options[] = {
 	{"stream-all-formats", optional_argument, 0, OptStreamAllFormats},
 	{"stream-all-io", no_argument, 0, OptStreamAllIO},
 	{"stream-all-color", required_argument, 0, OptStreamAllColorTest},
+	{"stream-perf", optional_argument, 0, OptStreamPerf},
+	{"parallel", no_argument, 0, OptParallel},
 	{"version", no_argument, 0, OptVersion},
 	{0, 0, 0, 0}
 };
@@ -209,6 +215,10 @@ static void usage()
 	printf("                     If <dev> starts with a digit, then /dev/media<dev> is used.\n");
 	printf("                     If <dev> doesn't exist, then attempt to find a media device with a\n");
 	printf("                     bus info string equal to <dev>.\n");
+	printf("  --parallel         With -m test all the interfaces of the media device at the same\n");
+	printf("                     time, each in its own process. The results are shown per\n");
+	printf("                     interface, in the usual order. Only use this if the streaming\n");
+	printf("                     tests of the interfaces don't depend on each other.\n");
 	printf("  -s, --streaming <count>\n");
 	printf("                     Enable the streaming tests. Set <count> to the number of\n");
 	printf("                     frames to stream (default 60). Requires a valid input/output\n");
@@ -240,6 +250,12 @@ static void usage()
 	printf("                     signal is present on the input(s). If <skip> is not specified,\n");
 	printf("                     then just capture the first frame. If <perc> is not specified,\n");
 	printf("                     then this defaults to 90%%.\n");
+	printf("  --stream-perf [<secs>]\n");
+	printf("                     Measure the streaming performance for all available formats.\n");
+	printf("                     For all formats, sizes and intervals stream using MMAP mode\n");
+	printf("                     for <secs> seconds (default 5) and report the achieved fps\n");
+	printf("                     against the frame interval, the DQBUF latency and the CPU\n");
+	printf("                     usage. Warn if the frame rate of the interval isn't reached.\n");
 	printf("  -E, --exit-on-fail Exit on the first fail.\n");
 	printf("  -h, --help         Display this help message.\n");
 	printf("  -C, --color <when> Highlight OK/warn/fail/FAIL strings with colors\n");
@@ -939,6 +955,23 @@ err:
 	return result;
 }
 
+void getTestTotals(test_totals &t)
+{
+	t.total = grand_total;
+	t.ok = grand_ok;
+	t.warnings = grand_warnings;
+	t.result = app_result;
+}
+
+void addTestTotals(const test_totals &t)
+{
+	grand_total += t.total;
+	grand_ok += t.ok;
+	grand_warnings += t.warnings;
+	if (t.result)
+		app_result = t.result;
+}
+
 void testNode(struct node &node, struct node &node_m2m_cap, struct node &expbuf_node, media_type type,
 	      unsigned frame_count, unsigned all_fmt_frame_count)
 {
@@ -1351,6 +1384,7 @@ void testNode(struct node &node, struct node &node_m2m_cap, struct node &expbuf_
 			break;
 
 		if (options[OptStreaming] || (node.is_video && options[OptStreamAllFormats]) ||
+		    (node.is_video && options[OptStreamPerf]) ||
 		    (node.is_video && node.can_capture && options[OptStreamAllColorTest]))
 			printf("Test %s %d:\n\n",
 				node.can_capture ? "input" : "output", io);
@@ -1423,6 +1457,17 @@ void testNode(struct node &node, struct node &node_m2m_cap, struct node &expbuf_
 			}
 		}
 
+		if (node.is_video && options[OptStreamPerf]) {
+			printf("Stream performance using all formats:\n");
+
+			if (node.is_m2m) {
+				printf("\tNot supported for M2M devices\n");
+			} else {
+				streamingSetup(&node);
+				streamAllFormatsPerf(&node, stream_perf_secs);
+			}
+		}
+
 		if (node.is_video && node.can_capture && options[OptStreamAllColorTest]) {
 			printf("Stream using all formats and do a color check:\n");
 
@@ -1592,6 +1637,15 @@ int main(int argc, char **argv)
 			if (optarg)
 				all_fmt_frame_count = strtoul(optarg, NULL, 0);
 			break;
+		case OptParallel:
+			parallel_nodes = true;
+			break;
+		case OptStreamPerf:
+			if (optarg)
+				stream_perf_secs = strtoul(optarg, NULL, 0);
+			if (!stream_perf_secs)
+				stream_perf_secs = 1;
+			break;
 		case OptStreamAllColorTest:
 			subs = optarg;
 			while (*subs != '\0') {
@@ -53,6 +53,7 @@ extern bool is_vivid; // We're testing the vivid driver
 extern int kernel_version;
 extern int media_fd;
 extern unsigned warnings;
+extern bool parallel_nodes;
 
 enum poll_mode {
 	POLL_MODE_NONE,
@@ -271,6 +272,17 @@ int testMediaSetupLink(struct node *node);
 void walkTopology(struct node &node, struct node &expbuf_node,
 		  unsigned frame_count, unsigned all_fmt_frame_count);
 
+// The grand totals, passed from the processes testing nodes in parallel
+struct test_totals {
+	int total;
+	int ok;
+	int warnings;
+	int result;
+};
+
+void getTestTotals(test_totals &t);
+void addTestTotals(const test_totals &t);
+
 // Debug ioctl tests
 int testRegister(struct node *node);
 int testLogStatus(struct node *node);
@@ -352,6 +364,7 @@ int testDmaBuf(struct node *expbuf_node, struct node *node,
 	       enum poll_mode pollmode);
 int testRequests(struct node *node, bool test_streaming);
 void streamAllFormats(struct node *node, unsigned frame_count);
+void streamAllFormatsPerf(struct node *node, unsigned secs);
 void streamM2MAllFormats(struct node *node, unsigned frame_count);
 
 // Color tests
@@ -29,6 +29,7 @@
 #include <poll.h>
 #include <pthread.h>
 #include <sys/epoll.h>
+#include <sys/resource.h>
 
 #include "v4l2-compliance.h"
 
@@ -2667,6 +2668,140 @@ static bool haveSelTest(const selTest &test)
 		{ return &selfTest != &test; });
 }
 
+/*
+ * Set by streamAllFormatsPerf(): stream each format for this many seconds
+ * instead of running the streaming tests of streamFmt().
+ */
+static unsigned perf_secs;
+
+static __u64 perf_now()
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static __u64 perf_cpu_ns()
+{
+	struct rusage ru;
+
+	getrusage(RUSAGE_SELF, &ru);
+	return (ru.ru_utime.tv_sec + ru.ru_stime.tv_sec) * 1000000000ULL +
+	       (ru.ru_utime.tv_usec + ru.ru_stime.tv_usec) * 1000ULL;
+}
+
+/*
+ * Stream MMAP buffers for perf_secs seconds and measure the achieved frame
+ * rate, the DQBUF latency (the time from the buffer timestamp to the
+ * return of VIDIOC_DQBUF, for capture devices with monotonic timestamps)
+ * and the CPU time used by this process. If the frame rate is more than
+ * 5% below that of the frame interval, then that is a warning.
+ */
+static int testStreamingPerf(struct node *node, const v4l2_fract *f,
+			     char *res, unsigned res_size)
+{
+	int type = node->g_type();
+	bool is_output = v4l_type_is_output(type);
+	cv4l_queue q(type, V4L2_MEMORY_MMAP);
+	cv4l_buffer buf(q);
+	v4l2_fract interval;
+	double expected = 0;
+	__u64 start, first = 0, last = 0, cpu;
+	__u64 lat_sum = 0, lat_max = 0;
+	unsigned lat_cnt = 0;
+	unsigned frames = 0;
+	double fps = 0;
+	int len;
+
+	if (!(node->valid_buftypes & (1 << type)) ||
+	    !(node->g_caps() & V4L2_CAP_STREAMING))
+		return ENOTTY;
+
+	if (f && !check_fract(f))
+		expected = 1.0 / fract2f(f);
+	else if (!node->get_interval(interval) && !check_fract(&interval))
+		expected = 1.0 / fract2f(&interval);
+
+	buffer_info.clear();
+	cur_fmt.s_type(type);
+	node->g_fmt(cur_fmt);
+
+	bool alternate = cur_fmt.g_field() == V4L2_FIELD_ALTERNATE;
+	v4l2_std_id std = 0;
+
+	node->g_std(std);
+
+	unsigned field = cur_fmt.g_first_field(std);
+
+	if (is_output)
+		stream_for_fmt(cur_fmt.g_pixelformat());
+
+	fail_on_test(q.reqbufs(node, 4));
+	fail_on_test(q.obtain_bufs(node));
+	for (unsigned i = 0; i < q.g_buffers(); i++) {
+		buf.init(q, i);
+		buf.s_field(field);
+		if (alternate)
+			field ^= 1;
+		if (is_output && !fill_output_buffer(q, buf))
+			return 0;
+		fail_on_test(node->qbuf(buf));
+	}
+	cpu = perf_cpu_ns();
+	start = perf_now();
+	fail_on_test(node->streamon());
+
+	while (node->dqbuf(buf) == 0) {
+		__u64 now = perf_now();
+		__u64 ts = buf.g_timestamp_ns();
+
+		if (!frames++)
+			first = now;
+		last = now;
+		if (!is_output && ts && ts <= now &&
+		    buf.g_timestamp_type() == V4L2_BUF_FLAG_TIMESTAMP_MONOTONIC) {
+			lat_sum += now - ts;
+			lat_max = std::max(lat_max, now - ts);
+			lat_cnt++;
+		}
+		if (!no_progress)
+			printf("\r\t\t%s: Frame #%03d Field %s   ",
+			       buftype2s(q.g_type()).c_str(),
+			       buf.g_sequence(), field2s(buf.g_field()).c_str());
+		fflush(stdout);
+		buf.s_field(field);
+		if (alternate)
+			field ^= 1;
+		if (is_output && !fill_output_buffer(q, buf))
+			break;
+		fail_on_test(node->qbuf(buf));
+		if (now - start >= perf_secs * 1000000000ULL)
+			break;
+	}
+	cpu = perf_cpu_ns() - cpu;
+	fail_on_test(node->streamoff());
+	q.free(node);
+	if (!no_progress)
+		printf("\r\t\t                                                            ");
+
+	fail_on_test(frames < 2);
+	fps = (frames - 1) * 1000000000.0 / (last - first);
+	len = snprintf(res, res_size, "%u frames, %.2f fps", frames, fps);
+	if (expected)
+		len += snprintf(res + len, res_size - len, " (interval %.2f fps)", expected);
+	if (lat_cnt)
+		len += snprintf(res + len, res_size - len,
+				", DQBUF latency %.3f ms (max %.3f ms)",
+				lat_sum / 1000000.0 / lat_cnt, lat_max / 1000000.0);
+	snprintf(res + len, res_size - len, ", CPU %.1f%%",
+		 cpu * 100.0 / (perf_now() - start));
+	if (expected && fps < expected * 0.95)
+		warn("%.2f fps is too low for a frame interval of %.2f fps\n",
+		     fps, expected);
+	return 0;
+}
+
 static void streamFmtRun(struct node *node, cv4l_fmt &fmt, unsigned frame_count,
 		bool testSelection = false)
 {
@@ -2745,6 +2880,16 @@ static void streamFmt(struct node *node, __u32 pixelformat, __u32 w, __u32 h,
 				fcc2s(pixelformat).c_str(),
 				fmt.g_width(), fmt.g_frame_height(), hz);
 
+	if (perf_secs) {
+		char res[256] = "";
+		int ret = testStreamingPerf(node, f, res, sizeof(res));
+
+		printf("\r\t\t%sField %s: %s   \n", res[0] ? strcat(res, ", ") : "",
+		       field2s(fmt.g_field()).c_str(), ok(ret));
+		node->reopen();
+		return;
+	}
+
 	if (has_crop)
 		node->g_frame_selection(crop, fmt.g_field());
 	if (has_compose)
@@ -3029,6 +3174,13 @@ void streamAllFormats(struct node *node, unsigned frame_count)
 	} while (!node->enum_fmt(fmtdesc));
 }
 
+void streamAllFormatsPerf(struct node *node, unsigned secs)
+{
+	perf_secs = secs;
+	streamAllFormats(node, 0);
+	perf_secs = 0;
+}
+
 static void streamM2MRun(struct node *node, unsigned frame_count)
 {
 	cv4l_fmt cap_fmt, out_fmt;
@@ -16,7 +16,10 @@
 
 #include <cstdio>
 #include <map>
+#include <memory>
 #include <set>
+#include <thread>
+#include <vector>
 
 #include <sys/types.h>
 
@@ -88,8 +91,12 @@ static void ycbcr2rgb(const double m[3][3], double y, double cb, double cr,
 	c.b = m[2][0] * y + m[2][1] * cb + m[2][2] * cr;
 }
 
-static void getColor(const cv4l_fmt &fmt, __u8 * const planes[3],
-		unsigned y, unsigned x, color &c)
+/*
+ * Read the raw value of the pixel: depending on the format either the
+ * 8, 16 or 32 bits value pixelColor() decodes.
+ */
+static __u32 getPixel(const cv4l_fmt &fmt, __u8 * const planes[3],
+		      unsigned y, unsigned x)
 {
 	unsigned bpl = fmt.g_bytesperline();
 	unsigned yeven = y & ~1;
@@ -302,6 +309,14 @@ static void getColor(const cv4l_fmt &fmt, __u8 * const planes[3],
 		      planes[1][bpl * 2 * y + 2 * x];
 		break;
 	}
+	return v8 | v16 | v32;
+}
+
+static void pixelColor(const cv4l_fmt &fmt, __u32 v, color &c)
+{
+	__u8 v8 = v;
+	__u16 v16 = v;
+	__u32 v32 = v;
 
 	switch (fmt.g_pixelformat()) {
 	case V4L2_PIX_FMT_RGB332:
@@ -471,15 +486,33 @@ static const char * const colors[] = {
 	"blue"
 };
 
-static int testColorsFmt(struct node *node, unsigned component,
-		unsigned skip, unsigned perc)
+/*
+ * Don't evaluate more than about this many pixels horizontally and
+ * vertically: the steps are odd so the samples alternate between even
+ * and odd pixels, which matters for the subsampled and Bayer formats.
+ */
+#define COLOR_SAMPLES_X 320
+#define COLOR_SAMPLES_Y 240
+
+/* A captured frame, counted by a worker while the next one is captured */
+struct colors_job {
+	cv4l_fmt fmt;
+	std::vector<__u8> data[3];
+	__u8 *planes[3];
+	bool is_50hz;
+	unsigned color_cnt[3];
+	unsigned total;
+};
+
+static int captureColorsFmt(struct node *node, unsigned skip, colors_job &job)
 {
+	cv4l_fmt &fmt = job.fmt;
 	cv4l_queue q;
-	cv4l_fmt fmt;
-	__u8 *planes[3] = { 0, 0, 0 };
+	v4l2_std_id std;
 	skip++;
 
 	node->g_fmt(fmt);
+	memset(job.planes, 0, sizeof(job.planes));
 
 	if (node->g_caps() & V4L2_CAP_STREAMING) {
 		cv4l_buffer buf;
@@ -496,26 +529,33 @@ static int testColorsFmt(struct node *node, unsigned component,
 				break;
 			fail_on_test(node->qbuf(buf));
 		}
+		if (skip)
+			q.free(node);
 		fail_on_test(skip);
-		for (unsigned i = 0; i < fmt.g_num_planes(); i++)
-			planes[i] = static_cast<__u8 *>(q.g_dataptr(buf.g_index(), i));
+		/* Keep a copy, so the buffers can be freed for the next format */
+		for (unsigned i = 0; i < fmt.g_num_planes(); i++) {
+			const __u8 *p = static_cast<__u8 *>(q.g_dataptr(buf.g_index(), i));
 
+			job.data[i].assign(p, p + fmt.g_sizeimage(i));
+			job.planes[i] = job.data[i].data();
+		}
+		q.free(node);
 	} else {
 		fail_on_test(!(node->g_caps() & V4L2_CAP_READWRITE));
 
 		int size = fmt.g_sizeimage();
-		void *tmp = malloc(size);
 
+		job.data[0].resize(size);
 		for (unsigned i = 0; i < skip; i++) {
 			int ret;
 
-			ret = node->read(tmp, size);
+			ret = node->read(job.data[0].data(), size);
 			fail_on_test(ret != size);
 		}
-		planes[0] = static_cast<__u8 *>(tmp);
+		job.planes[0] = job.data[0].data();
 	}
 
-	setupPlanes(fmt, planes);
+	setupPlanes(fmt, job.planes);
 
 	if (fmt.g_ycbcr_enc() == V4L2_YCBCR_ENC_DEFAULT) {
 		switch (fmt.g_colorspace()) {
@@ -534,41 +574,57 @@ static int testColorsFmt(struct node *node, unsigned component,
 		}
 	}
 
+	job.is_50hz = (node->cur_io_caps & V4L2_IN_CAP_STD) &&
+		      !node->g_std(std) && (std & V4L2_STD_625_50);
+	return 0;
+}
+
+static void countColors(colors_job *job)
+{
+	const cv4l_fmt &fmt = job->fmt;
 	unsigned h = fmt.g_height();
 	unsigned w = fmt.g_width();
-	unsigned color_cnt[3] = { 0, 0, 0 };
-	v4l2_std_id std;
-	bool is_50hz = false;
-	unsigned total;
-
-	if ((node->cur_io_caps & V4L2_IN_CAP_STD) &&
-	    !node->g_std(std) && (std & V4L2_STD_625_50))
-		is_50hz = true;
+	unsigned xstep = (w / COLOR_SAMPLES_X) | 1;
+	unsigned ystep = (h / COLOR_SAMPLES_Y) | 1;
+	/* The test patterns are made of few colors, so cache the last one */
+	__u32 last = 0;
+	unsigned last_cnt = 3;
 
-	total = w * h - (is_50hz ? w / 2 : 0);
+	memset(job->color_cnt, 0, sizeof(job->color_cnt));
+	job->total = 0;
 
-	for (unsigned y = 0; y < h; y++) {
+	for (unsigned y = 0; y < h; y += ystep) {
 		/*
 		 * 50 Hz (PAL/SECAM) formats have a garbage first half-line,
 		 * so skip that.
 		 */
-		for (unsigned x = (y == 0 && is_50hz) ? w / 2 : 0; x < w; x++) {
-			color c = { 0, 0, 0, 0 };
-
-			getColor(fmt, planes, y, x, c);
-			if (c.r > c.b && c.r > c.g)
-				color_cnt[0]++;
-			else if (c.g > c.r && c.g > c.b)
-				color_cnt[1]++;
-			else
-				color_cnt[2]++;
+		for (unsigned x = (y == 0 && job->is_50hz) ? w / 2 : 0; x < w; x += xstep) {
+			__u32 v = getPixel(fmt, job->planes, y, x);
+
+			if (v != last || last_cnt == 3) {
+				color c = { 0, 0, 0, 0 };
+
+				pixelColor(fmt, v, c);
+				if (c.r > c.b && c.r > c.g)
+					last_cnt = 0;
+				else if (c.g > c.r && c.g > c.b)
+					last_cnt = 1;
+				else
+					last_cnt = 2;
+				last = v;
+			}
+			job->color_cnt[last_cnt]++;
+			job->total++;
 		}
 	}
-	if (node->g_caps() & V4L2_CAP_STREAMING)
-		q.free(node);
-	else
-		free(planes[0]);
+}
+
+static int checkColors(const colors_job &job, unsigned component, unsigned perc)
+{
+	const unsigned *color_cnt = job.color_cnt;
+	unsigned total = job.total;
 
+	fail_on_test(!total);
 	if (color_cnt[component] < total * perc / 100) {
 		return fail("red: %u%% green: %u%% blue: %u%% expected: %s >= %u%%\n",
 			color_cnt[0] * 100 / total,
@@ -582,8 +638,21 @@ static int testColorsFmt(struct node *node, unsigned component,
 int testColorsAllFormats(struct node *node, unsigned component,
 			 unsigned skip, unsigned perc)
 {
+	std::unique_ptr<colors_job> pending;
+	std::thread worker;
 	v4l2_fmtdesc fmtdesc;
 
+	auto finish = [&]() {
+		if (!pending)
+			return;
+		worker.join();
+		printf("\ttest %u%% %s for format %s: %s\n",
+				perc, colors[component],
+				fcc2s(pending->fmt.g_pixelformat()).c_str(),
+				ok(checkColors(*pending, component, perc)));
+		pending.reset();
+	};
+
 	if (node->enum_fmt(fmtdesc, true))
 		return 0;
 	do {
@@ -609,11 +678,22 @@ int testColorsAllFormats(struct node *node, unsigned component,
 		node->g_fmt(fmt);
 		fmt.s_pixelformat(fmtdesc.pixelformat);
 		node->s_fmt(fmt);
-		printf("\ttest %u%% %s for format %s: %s\n",
-				perc, colors[component],
-				fcc2s(fmt.g_pixelformat()).c_str(),
-				ok(testColorsFmt(node, component, skip, perc)));
+
+		/* Capture this format while the previous one is counted */
+		std::unique_ptr<colors_job> job(new colors_job);
+		int ret = captureColorsFmt(node, skip, *job);
+
+		finish();
+		if (ret) {
+			printf("\ttest %u%% %s for format %s: %s\n",
+					perc, colors[component],
+					fcc2s(fmt.g_pixelformat()).c_str(), ok(ret));
+			continue;
+		}
+		pending = std::move(job);
+		worker = std::thread(countColors, pending.get());
 	} while (!node->enum_fmt(fmtdesc));
+	finish();
 	printf("\n");
 	return 0;
 }
@@ -20,10 +20,12 @@
 
 #include <map>
 #include <set>
+#include <vector>
 
 #include <dirent.h>
 #include <sys/sysmacros.h>
 #include <sys/types.h>
+#include <sys/wait.h>
 
 #include "v4l2-compliance.h"
 
@@ -519,9 +521,94 @@ int testMediaSetupLink(struct node *node)
 	return 0;
 }
 
+/* A child process of walkTopology() testing one interface */
+struct parallel_test {
+	pid_t pid;
+	FILE *out;
+	int totals_fd;
+};
+
+/*
+ * Test the node in a child process. Its output goes to a temporary file
+ * and its totals to a pipe, so they can be shown in order afterwards.
+ */
+static bool testNodeParallel(struct node &test_node, struct node &expbuf_node,
+			     media_type type, unsigned frame_count,
+			     unsigned all_fmt_frame_count, parallel_test &pt)
+{
+	int fds[2];
+
+	pt.out = tmpfile();
+	if (!pt.out || pipe(fds)) {
+		if (pt.out)
+			fclose(pt.out);
+		return false;
+	}
+	fflush(stdout);
+	pt.pid = fork();
+	if (pt.pid < 0) {
+		fclose(pt.out);
+		close(fds[0]);
+		close(fds[1]);
+		return false;
+	}
+	if (pt.pid) {
+		close(fds[1]);
+		pt.totals_fd = fds[0];
+		return true;
+	}
+
+	test_totals before, after;
+
+	close(fds[0]);
+	dup2(fileno(pt.out), STDOUT_FILENO);
+	getTestTotals(before);
+	printf("--------------------------------------------------------------------------------\n");
+	testNode(test_node, test_node, expbuf_node, type,
+		 frame_count, all_fmt_frame_count);
+	test_node.close();
+	getTestTotals(after);
+	after.total -= before.total;
+	after.ok -= before.ok;
+	after.warnings -= before.warnings;
+	fflush(stdout);
+	if (write(fds[1], &after, sizeof(after)) != sizeof(after))
+		_exit(EXIT_FAILURE);
+	_exit(EXIT_SUCCESS);
+}
+
+static void waitNodeParallel(parallel_test &pt)
+{
+	test_totals totals;
+	char buf[4096];
+	size_t n;
+	int status;
+
+	while (waitpid(pt.pid, &status, 0) < 0 && errno == EINTR);
+	rewind(pt.out);
+	while ((n = fread(buf, 1, sizeof(buf), pt.out)) > 0)
+		fwrite(buf, 1, n, stdout);
+	fclose(pt.out);
+	if (read(pt.totals_fd, &totals, sizeof(totals)) == sizeof(totals)) {
+		addTestTotals(totals);
+	} else {
+		/* The child exited early, e.g. due to --exit-on-fail */
+		memset(&totals, 0, sizeof(totals));
+		totals.result = -1;
+		addTestTotals(totals);
+	}
+	close(pt.totals_fd);
+	if (!WIFEXITED(status) || WEXITSTATUS(status)) {
+		fflush(stdout);
+		if (exit_on_fail || exit_on_warn)
+			std::exit(EXIT_FAILURE);
+	}
+}
+
 void walkTopology(struct node &node, struct node &expbuf_node,
 		  unsigned frame_count, unsigned all_fmt_frame_count)
 {
+	std::vector<parallel_test> children;
 	media_v2_topology topology;
 
 	memset(&topology, 0, sizeof(topology));
@@ -541,7 +628,8 @@ void walkTopology(struct node &node, struct node &expbuf_node,
 		if (dev.empty())
 			continue;
 
-		printf("--------------------------------------------------------------------------------\n");
+		if (!parallel_nodes)
+			printf("--------------------------------------------------------------------------------\n");
 
 		media_type type = mi_media_detect_type(dev.c_str());
 		if (type == MEDIA_TYPE_CANT_STAT) {
@@ -595,8 +683,23 @@ void walkTopology(struct node &node, struct node &expbuf_node,
 			continue;
 		}
 
+		if (parallel_nodes) {
+			parallel_test pt;
+
+			if (testNodeParallel(test_node, expbuf_node, type, frame_count,
+					     all_fmt_frame_count, pt)) {
+				children.push_back(pt);
+				test_node.close();
+				continue;
+			}
+			fprintf(stderr, "\nCannot test device %s in parallel: %s\n\n",
+				dev.c_str(), strerror(errno));
+			printf("--------------------------------------------------------------------------------\n");
+		}
 		testNode(test_node, test_node, expbuf_node, type,
 			 frame_count, all_fmt_frame_count);
 		test_node.close();
 	}
+	for (auto &pt : children)
+		waitNodeParallel(pt);
 }
@@ -10,6 +10,7 @@ LOCAL_CFLAGS += -Wno-missing-field-initializers
 LOCAL_C_INCLUDES := \
     $(LOCAL_PATH)/../.. \
     $(LOCAL_PATH)/../../include \
+    $(LOCAL_PATH)/../../lib/include \
     $(LOCAL_PATH)/../common \
     bionic \
     external/stlport/stlport
@@ -22,5 +23,5 @@ LOCAL_SRC_FILES := \
     v4l2-ctl-overlay.cpp v4l2-ctl-vbi.cpp v4l2-ctl-selection.cpp v4l2-ctl-misc.cpp \
     v4l2-ctl-streaming.cpp v4l2-ctl-sdr.cpp v4l2-ctl-edid.cpp v4l2-ctl-modes.cpp \
     v4l2-ctl-meta.cpp v4l2-ctl-subdev.cpp v4l2-info.cpp media-info.cpp \
-    v4l2-tpg-colors.c v4l2-tpg-core.c v4l-stream.c codec-fwht.c
+    v4l2-tpg-colors.c v4l2-tpg-core.c v4l-stream.c codec-fwht.c raw2sliced.cpp
 include $(BUILD_EXECUTABLE)
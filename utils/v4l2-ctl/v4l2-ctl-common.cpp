@@ -6,12 +6,14 @@
 #include <vector>
 
 #include <dirent.h>
+#include <poll.h>
 #include <sys/stat.h>
 #include <sys/sysmacros.h>
 
 #include <linux/media.h>
 
 #include "v4l2-ctl.h"
+#include <media-info.h>
 
 #ifdef HAVE_SYS_KLOG_H
 #include <sys/klog.h>
@@ -45,6 +47,8 @@ static enum v4l2_priority prio = V4L2_PRIORITY_UNSET;
 
 static bool have_query_ext_ctrl;
 
+static const char *ctrl_cache_file;
+
 void common_usage()
 {
 	printf("\nGeneral/Common options:\n"
@@ -53,6 +57,16 @@ void common_usage()
 	       "                     get the value of the controls [VIDIOC_G_EXT_CTRLS]\n"
 	       "  -c, --set-ctrl <ctrl>=<val>[,<ctrl>=<val>...]\n"
 	       "                     set the value of the controls [VIDIOC_S_EXT_CTRLS]\n"
+	       "  --set-ctrl-file <file>\n"
+	       "                     set the controls listed in <file>, one <ctrl>=<val> per line.\n"
+	       "                     All controls, including those of --set-ctrl, are set with a\n"
+	       "                     single VIDIOC_S_EXT_CTRLS call.\n"
+	       "  --set-ctrl-request set the --set-ctrl and --set-ctrl-file controls in a media\n"
+	       "                     request and queue it [MEDIA_IOC_REQUEST_ALLOC]\n"
+	       "  --ctrl-cache <file>\n"
+	       "                     cache the names and types of the controls in <file>. If <file>\n"
+	       "                     was written for the same device, then the controls are not\n"
+	       "                     enumerated again.\n"
 	       "  -D, --info         show driver info [VIDIOC_QUERYCAP]\n"
 	       "  -d, --device <dev> use device <dev> instead of /dev/video0\n"
 	       "                     if <dev> starts with a digit, then /dev/video<dev> is used\n"
@@ -108,6 +122,12 @@ void common_usage()
 	       "  --set-priority <prio>\n"
 	       "                     set the new access priority [VIDIOC_S_PRIORITY]\n"
 	       "                     <prio> is 1 (background), 2 (interactive) or 3 (record)\n"
+	       "  --server [<socket>]\n"
+	       "                     open the device once and then execute the v4l2-ctl commands\n"
+	       "                     read from stdin, or from the connections to unix socket\n"
+	       "                     <socket>, one per line. The output of command <n> is\n"
+	       "                     preceded by a 'begin <n>' line and followed by a line\n"
+	       "                     'end <n> <exit code> <duration in us>'. 'quit' stops.\n"
 	       "  --silent           only set the result code, do not print any messages\n"
 	       "  --sleep <secs>     sleep <secs>, call QUERYCAP and close the file handle\n"
 	       "  --verbose          turn on verbose ioctl status reporting\n"
@@ -663,6 +683,87 @@ static void find_controls(cv4l_fd &_fd)
 	}
 }
 
+/*
+ * The --ctrl-cache file starts with a line identifying the device, followed
+ * by one line per control with the query_ext_ctrl fields needed to get and
+ * set it, and its name at the end of the line.
+ */
+static std::string ctrl_cache_key(cv4l_fd &fd)
+{
+	struct v4l2_capability vcap;
+	struct stat sb = {};
+	char buf[64];
+
+	fd.querycap(vcap);
+	fstat(fd.g_fd(), &sb);
+	sprintf(buf, "%u:%u %08x %08x", major(sb.st_rdev), minor(sb.st_rdev),
+		vcap.version, vcap.device_caps);
+	return std::string(buf) + " " + safename(vcap.driver) + " " +
+	       safename(vcap.card) + " " + safename(vcap.bus_info);
+}
+
+static bool load_ctrl_cache(cv4l_fd &fd)
+{
+	FILE *f = fopen(ctrl_cache_file, "r");
+	std::string key = ctrl_cache_key(fd) + "\n";
+	char line[256];
+	bool ok = false;
+
+	if (!f)
+		return false;
+	if (!fgets(line, sizeof(line), f) || key != line) {
+		fclose(f);
+		return false;
+	}
+	while (fgets(line, sizeof(line), f)) {
+		struct v4l2_query_ext_ctrl qctrl;
+		int n = 0;
+
+		memset(&qctrl, 0, sizeof(qctrl));
+		if (sscanf(line, "%x %u %x %u %u %u %u %u %u %u %lld %lld %llu %lld %n",
+			   &qctrl.id, &qctrl.type, &qctrl.flags,
+			   &qctrl.elem_size, &qctrl.elems, &qctrl.nr_of_dims,
+			   &qctrl.dims[0], &qctrl.dims[1], &qctrl.dims[2], &qctrl.dims[3],
+			   &qctrl.minimum, &qctrl.maximum,
+			   &qctrl.step, &qctrl.default_value, &n) != 14 || !n) {
+			ctrl_str2q.clear();
+			ctrl_id2str.clear();
+			fclose(f);
+			return false;
+		}
+		line[strcspn(line, "\n")] = 0;
+		strncpy(qctrl.name, line + n, sizeof(qctrl.name) - 1);
+		ctrl_str2q[name2var(qctrl.name)] = qctrl;
+		ctrl_id2str[qctrl.id] = name2var(qctrl.name);
+		ok = true;
+	}
+	fclose(f);
+	return ok;
+}
+
+static void save_ctrl_cache(cv4l_fd &fd)
+{
+	FILE *f = fopen(ctrl_cache_file, "w");
+
+	if (!f) {
+		fprintf(stderr, "Failed to create %s: %s\n", ctrl_cache_file,
+			strerror(errno));
+		return;
+	}
+	fprintf(f, "%s\n", ctrl_cache_key(fd).c_str());
+	for (const auto &q : ctrl_str2q) {
+		const struct v4l2_query_ext_ctrl &qctrl = q.second;
+
+		fprintf(f, "%x %u %x %u %u %u %u %u %u %u %lld %lld %llu %lld %s\n",
+			qctrl.id, qctrl.type, qctrl.flags,
+			qctrl.elem_size, qctrl.elems, qctrl.nr_of_dims,
+			qctrl.dims[0], qctrl.dims[1], qctrl.dims[2], qctrl.dims[3],
+			qctrl.minimum, qctrl.maximum,
+			qctrl.step, qctrl.default_value, qctrl.name);
+	}
+	fclose(f);
+}
+
 int common_find_ctrl_id(const char *name)
 {
 	if (ctrl_str2q.find(name) == ctrl_str2q.end())
@@ -680,7 +781,11 @@ void common_process_controls(cv4l_fd &fd)
 	rc = test_ioctl(fd.g_fd(), VIDIOC_QUERY_EXT_CTRL, &qc);
 	have_query_ext_ctrl = rc == 0;
 
-	find_controls(fd);
+	if (!ctrl_cache_file || !load_ctrl_cache(fd)) {
+		find_controls(fd);
+		if (ctrl_cache_file)
+			save_ctrl_cache(fd);
+	}
 	for (const auto &get_ctrl : get_ctrls) {
 	    if (ctrl_str2q.find(get_ctrl) == ctrl_str2q.end()) {
 		fprintf(stderr, "unknown control '%s'\n", get_ctrl.c_str());
@@ -785,6 +890,39 @@ static bool parse_next_subopt(char **subs, char **value)
 	return true;
 }
 
+static bool parse_ctrl_file(const char *fname)
+{
+	FILE *f = fopen(fname, "r");
+	unsigned line = 0;
+	char buf[1024];
+
+	if (!f) {
+		fprintf(stderr, "Failed to open %s: %s\n", fname, strerror(errno));
+		return true;
+	}
+	while (fgets(buf, sizeof(buf), f)) {
+		char *s = buf + strspn(buf, " \t");
+		char *equal;
+
+		line++;
+		s[strcspn(s, "\r\n")] = 0;
+		if (!*s || *s == '#')
+			continue;
+		equal = std::strchr(s, '=');
+		if (!equal) {
+			fprintf(stderr, "%s:%u: control '%s' without '='\n", fname, line, s);
+			fclose(f);
+			return true;
+		}
+		std::string name(s, equal - s);
+
+		name.erase(name.find_last_not_of(" \t") + 1);
+		set_ctrls[name] = equal + 1 + strspn(equal + 1, " \t");
+	}
+	fclose(f);
+	return false;
+}
+
 void common_cmd(const std::string &media_bus_info, int ch, char *optarg)
 {
 	char *value, *subs;
@@ -822,6 +960,13 @@ void common_cmd(const std::string &media_bus_info, int ch, char *optarg)
 			}
 		}
 		break;
+	case OptSetCtrlFile:
+		if (parse_ctrl_file(optarg))
+			std::exit(EXIT_FAILURE);
+		break;
+	case OptCtrlCache:
+		ctrl_cache_file = optarg;
+		break;
 	case OptSubset:
 		if (parse_subset(optarg)) {
 			common_usage();
@@ -886,6 +1031,62 @@ static bool idx_in_subset(const struct v4l2_query_ext_ctrl &qc, const ctrl_subse
 	return true;
 }
 
+/*
+ * Set all controls with one VIDIOC_S_EXT_CTRLS call, regardless of their
+ * control class, either directly or through a media request.
+ */
+static void set_all_ctrls(int fd, class2ctrls_map &class2ctrls)
+{
+	std::vector<struct v4l2_ext_control> all;
+	struct v4l2_ext_controls ctrls;
+	int media_fd = -1;
+	int req_fd = -1;
+
+	for (const auto &class2ctrl : class2ctrls)
+		all.insert(all.end(), class2ctrl.second.begin(), class2ctrl.second.end());
+
+	memset(&ctrls, 0, sizeof(ctrls));
+	ctrls.which = V4L2_CTRL_WHICH_CUR_VAL;
+	ctrls.count = all.size();
+	ctrls.controls = &all[0];
+	if (options[OptSetCtrlRequest]) {
+		media_fd = mi_get_media_fd(fd);
+		if (media_fd < 0) {
+			fprintf(stderr, "No media device found for the request\n");
+			return;
+		}
+		if (ioctl(media_fd, MEDIA_IOC_REQUEST_ALLOC, &req_fd)) {
+			fprintf(stderr, "Unable to allocate media request: %s\n",
+				strerror(errno));
+			close(media_fd);
+			return;
+		}
+		ctrls.which = V4L2_CTRL_WHICH_REQUEST_VAL;
+		ctrls.request_fd = req_fd;
+	}
+	if (doioctl(fd, VIDIOC_S_EXT_CTRLS, &ctrls)) {
+		if (ctrls.error_idx >= ctrls.count)
+			fprintf(stderr, "Error setting controls: %s\n",
+				strerror(errno));
+		else
+			fprintf(stderr, "%s: %s\n",
+				ctrl_id2str[all[ctrls.error_idx].id].c_str(),
+				strerror(errno));
+	} else if (req_fd >= 0) {
+		struct pollfd pfd = { req_fd, POLLPRI, 0 };
+
+		if (doioctl(req_fd, MEDIA_REQUEST_IOC_QUEUE, NULL))
+			fprintf(stderr, "Unable to queue the media request: %s\n",
+				strerror(errno));
+		else if (poll(&pfd, 1, 1000) <= 0)
+			fprintf(stderr, "The media request did not complete\n");
+	}
+	if (req_fd >= 0)
+		close(req_fd);
+	if (media_fd >= 0)
+		close(media_fd);
+}
+
 void common_set(cv4l_fd &_fd)
 {
 	int fd = _fd.g_fd();
@@ -896,7 +1097,7 @@ void common_set(cv4l_fd &_fd)
 		}
 	}
 
-	if (options[OptSetCtrl] && !set_ctrls.empty()) {
+	if ((options[OptSetCtrl] || options[OptSetCtrlFile]) && !set_ctrls.empty()) {
 		struct v4l2_ext_controls ctrls;
 		class2ctrls_map class2ctrls;
 		bool use_ext_ctrls = false;
@@ -980,6 +1181,10 @@ void common_set(cv4l_fd &_fd)
 			}
 			class2ctrls[V4L2_CTRL_ID2WHICH(ctrl.id)].push_back(ctrl);
 		}
+		if (options[OptSetCtrlFile] || options[OptSetCtrlRequest]) {
+			set_all_ctrls(fd, class2ctrls);
+			return;
+		}
 		for (auto &class2ctrl : class2ctrls) {
 			if (!use_ext_ctrls &&
 			    (class2ctrl.first == V4L2_CTRL_CLASS_USER ||
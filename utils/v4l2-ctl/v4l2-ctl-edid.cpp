@@ -1,5 +1,6 @@
 #include <cctype>
 #include <cstring>
+#include <vector>
 
 #include <linux/v4l2-subdev.h>
 
@@ -39,15 +40,13 @@ static char *file_out;
 static enum format gformat;
 static enum format sformat;
 static unsigned clear_pad;
-static long phys_addr = -1;
+static char *batch_file;
 
-static __u8 toggle_cta861_hdr_flags;
 #define CTA861_HDR_UNDERSCAN	(1 << 6)
 #define CTA861_HDR_AUDIO	(1 << 6)
 #define CTA861_HDR_YCBCR444	(1 << 5)
 #define CTA861_HDR_YCBCR422	(1 << 4)
 
-static __u8 toggle_speaker1_flags;
 #define SPEAKER1_FL_FR		(1 << 0)
 #define SPEAKER1_LFE		(1 << 1)
 #define SPEAKER1_FC		(1 << 2)
@@ -57,7 +56,6 @@ static __u8 toggle_speaker1_flags;
 #define SPEAKER1_RLC_RRC	(1 << 6)
 #define SPEAKER1_FLW_FRW	(1 << 7)
 
-static __u8 toggle_speaker2_flags;
 #define SPEAKER2_TPFL_TPFR	(1 << 0)
 #define SPEAKER2_TPC		(1 << 1)
 #define SPEAKER2_TPFC		(1 << 2)
@@ -67,18 +65,15 @@ static __u8 toggle_speaker2_flags;
 #define SPEAKER2_SIL_SIR	(1 << 6)
 #define SPEAKER2_TPSIL_TPSIR	(1 << 7)
 
-static __u8 toggle_speaker3_flags;
 #define SPEAKER3_TPBL_TPBR	(1 << 0)
 #define SPEAKER3_BTFC		(1 << 1)
 #define SPEAKER3_BTFL_BTFR	(1 << 2)
 #define SPEAKER3_TPLS_TPRS	(1 << 3)
 
-static __u8 toggle_hdmi_vsdb_dc_flags;
 #define HDMI_VSDB_Y444_BIT	(1 << 3)
 #define HDMI_VSDB_30_BIT	(1 << 4)
 #define HDMI_VSDB_36_BIT	(1 << 5)
 #define HDMI_VSDB_48_BIT	(1 << 6)
-static __u8 toggle_hdmi_vsdb_cnc_flags;
 #define HDMI_VSDB_GRAPHICS	(1 << 0)
 #define HDMI_VSDB_PHOTO		(1 << 1)
 #define HDMI_VSDB_CINEMA	(1 << 2)
@@ -86,17 +81,11 @@ static __u8 toggle_hdmi_vsdb_cnc_flags;
 #define HDMI_VSDB_I_LATENCY	(1 << 6)
 #define HDMI_VSDB_LATENCY	(1 << 7)
 
-static __u8 toggle_hf_vsdb_flags;
 #define HF_VSDB_SCSD_PRESENT	(1 << 7)
 
-static int mod_s_pt = -1;
-static int mod_s_it = -1;
-static int mod_s_ce = -1;
-static __u8 toggle_vid_cap_flags;
 #define VID_CAP_QS		(1 << 6)
 #define VID_CAP_QY		(1 << 7)
 
-static __u8 toggle_colorimetry_flags1;
 #define COLORIMETRY_XVYCC601		(1 << 0)
 #define COLORIMETRY_XVYCC709		(1 << 1)
 #define COLORIMETRY_SYCC		(1 << 2)
@@ -106,15 +95,55 @@ static __u8 toggle_colorimetry_flags1;
 #define COLORIMETRY_BT2020YCC		(1 << 6)
 #define COLORIMETRY_BT2020RGB		(1 << 7)
 
-static __u8 toggle_colorimetry_flags2;
 #define COLORIMETRY_DCIP3		(1 << 0)
 
-static __u8 toggle_hdr_md_flags;
 #define HDR_MD_SDR		(1 << 0)
 #define HDR_MD_HDR		(1 << 1)
 #define HDR_MD_SMPTE_2084	(1 << 2)
 #define HDR_MD_HLG		(1 << 3)
 
+/*
+ * The modifiers of --set-edid or of one line of a --set-edid-batch
+ * script: the toggle fields are XORed into the corresponding bytes.
+ */
+struct edid_mods {
+	long phys_addr;
+	int s_pt;
+	int s_it;
+	int s_ce;
+	__u8 cta861_hdr;
+	__u8 speaker1;
+	__u8 speaker2;
+	__u8 speaker3;
+	__u8 hdmi_vsdb_dc;
+	__u8 hdmi_vsdb_cnc;
+	__u8 hf_vsdb;
+	__u8 vid_cap;
+	__u8 colorimetry1;
+	__u8 colorimetry2;
+	__u8 hdr_md;
+};
+
+#define EDID_MODS_INIT { -1, -1, -1, -1 }
+
+static struct edid_mods mods = EDID_MODS_INIT;
+
+/*
+ * The locations of the modifiable CTA-861 fields, or -1 if the EDID
+ * doesn't have them. None of the modifiers change the length of a data
+ * block, so the index stays valid for all variants of an EDID.
+ */
+struct edid_index {
+	int cta861_hdr;
+	int spa;
+	int speaker;
+	int hdmi_vsdb;
+	int hf_vsdb;
+	int vid_cap;
+	int colorimetry;
+	int hdr_md;
+};
+
 void edid_usage()
 {
 	printf("\nEDID options:\n"
@@ -200,6 +229,12 @@ void edid_usage()
 	       "                     hdr: toggle the Traditional gamma HDR bit.\n"
 	       "                     smpte2084: toggle the SMPTE ST 2084 bit.\n"
 	       "                     hlg: toggle the Hybrid Log-Gamma bit.\n"
+	       "  --set-edid-batch <file>\n"
+	       "                     set a variant of the --set-edid EDID for every line in <file>.\n"
+	       "                     Each line is a comma-separated list of the --set-edid modifiers\n"
+	       "                     which are applied to the --set-edid EDID, e.g. 'pa=1.0.0.0,hdr'.\n"
+	       "                     Empty lines and lines starting with '#' are skipped. Every\n"
+	       "                     variant is read back with VIDIOC_G_EDID and compared.\n"
 	       "  --clear-edid <pad> clear the EDID for the input or output index <pad>.\n"
 	       "  --info-edid <pad>  print the current EDID's modifiers\n"
 	       "                     <pad> is the input or output index for which to get the EDID.\n"
@@ -508,21 +543,107 @@ static int get_edid_hdr_md_location(const unsigned char *edid, unsigned size)
 	return (edid[loc] & 0x1f) >= 3 ? loc + 2 : -1;
 }
 
-static void set_edid_phys_addr(unsigned char *edid, unsigned size, unsigned short phys_addr)
+static void get_edid_index(const unsigned char *edid, unsigned size,
+			   struct edid_index &idx)
 {
-	int loc = get_edid_spa_location(edid, size);
-	unsigned char sum = 0;
-	int i;
+	idx.cta861_hdr = get_edid_cta861_hdr_location(edid, size);
+	idx.spa = get_edid_spa_location(edid, size);
+	idx.speaker = get_edid_speaker_location(edid, size);
+	idx.hdmi_vsdb = get_edid_hdmi_vsdb_location(edid, size);
+	idx.hf_vsdb = get_edid_hf_vsdb_location(edid, size);
+	idx.vid_cap = get_edid_vid_cap_location(edid, size);
+	idx.colorimetry = get_edid_colorimetry_location(edid, size);
+	idx.hdr_md = get_edid_hdr_md_location(edid, size);
+}
 
-	if (loc < 0)
-		return;
-	edid[loc] = phys_addr >> 8;
-	edid[loc + 1] = phys_addr & 0xff;
-	loc &= ~0x7f;
-
-	for (i = loc; i < loc + 127; i++)
-		sum += edid[i];
-	edid[i] = 256 - sum;
+/* Set a byte and update the checksum of its block accordingly */
+static void set_edid_byte(unsigned char *edid, int loc, __u8 v)
+{
+	edid[loc | 0x7f] += edid[loc] - v;
+	edid[loc] = v;
+}
+
+/* Returns true if any of the modifiers applied to the EDID */
+static bool apply_edid_mods(unsigned char *edid, const struct edid_index &idx,
+			    const struct edid_mods &m)
+{
+	bool changed = false;
+	int loc;
+
+	if (m.cta861_hdr || m.phys_addr >= 0) {
+		loc = idx.cta861_hdr;
+		if (loc >= 0) {
+			set_edid_byte(edid, loc, edid[loc] ^ m.cta861_hdr);
+			if (m.phys_addr >= 0 && idx.spa >= 0) {
+				set_edid_byte(edid, idx.spa, m.phys_addr >> 8);
+				set_edid_byte(edid, idx.spa + 1, m.phys_addr & 0xff);
+			}
+			changed = true;
+		}
+	}
+	if (m.speaker1 || m.speaker2 || m.speaker3) {
+		loc = idx.speaker;
+		if (loc >= 0) {
+			set_edid_byte(edid, loc, edid[loc] ^ m.speaker1);
+			set_edid_byte(edid, loc + 1, edid[loc + 1] ^ m.speaker2);
+			set_edid_byte(edid, loc + 2, edid[loc + 2] ^ m.speaker3);
+			changed = true;
+		}
+	}
+	if (m.hdmi_vsdb_dc || m.hdmi_vsdb_cnc) {
+		loc = idx.hdmi_vsdb;
+
+		if (loc >= 0) {
+			__u8 len = edid[loc] & 0x1f;
+
+			if (len >= 6) {
+				set_edid_byte(edid, loc + 6, edid[loc + 6] ^ m.hdmi_vsdb_dc);
+				changed = true;
+			}
+			if (len >= 8) {
+				set_edid_byte(edid, loc + 8, edid[loc + 8] ^ m.hdmi_vsdb_cnc);
+				changed = true;
+			}
+		}
+	}
+	if (m.hf_vsdb) {
+		loc = idx.hf_vsdb;
+		if (loc >= 0) {
+			set_edid_byte(edid, loc + 1, edid[loc + 1] ^ m.hf_vsdb);
+			changed = true;
+		}
+	}
+	if (m.vid_cap || m.s_pt >= 0 || m.s_ce >= 0 || m.s_it >= 0) {
+		loc = idx.vid_cap;
+		if (loc >= 0) {
+			__u8 v = edid[loc] ^ m.vid_cap;
+
+			if (m.s_ce >= 0)
+				v = (v & 0xfc) | (m.s_ce << 0);
+			if (m.s_it >= 0)
+				v = (v & 0xf3) | (m.s_it << 2);
+			if (m.s_pt >= 0)
+				v = (v & 0xcf) | (m.s_pt << 4);
+			set_edid_byte(edid, loc, v);
+			changed = true;
+		}
+	}
+	if (m.colorimetry1 || m.colorimetry2) {
+		loc = idx.colorimetry;
+		if (loc >= 0) {
+			set_edid_byte(edid, loc, edid[loc] ^ m.colorimetry1);
+			set_edid_byte(edid, loc + 1, edid[loc + 1] ^ m.colorimetry2);
+			changed = true;
+		}
+	}
+	if (m.hdr_md) {
+		loc = idx.hdr_md;
+		if (loc >= 0) {
+			set_edid_byte(edid, loc, edid[loc] ^ m.hdr_md);
+			changed = true;
+		}
+	}
+	return changed;
 }
 
 static unsigned short get_edid_phys_addr(const unsigned char *edid, unsigned size)
@@ -901,6 +1022,145 @@ static uint8_t hdmi_edid_4k_600[256] = {
 
 /******************************************************/
 
+static const char *const edid_subopts[] = {
+	"pad",
+	"type",
+	"edid",
+	"file",
+	"format",
+	"pa",
+	"s-pt",
+	"s-it",
+	"s-ce",
+	"y444",
+	"30-bit",
+	"36-bit",
+	"48-bit",
+	"graphics",
+	"photo",
+	"cinema",
+	"game",
+	"scdc",
+	"underscan",
+	"audio",
+	"ycbcr444",
+	"ycbcr422",
+	"qy",
+	"qs",
+	"xvycc-601",
+	"xvycc-709",
+	"sycc",
+	"opycc",
+	"oprgb",
+	"bt2020-rgb",
+	"bt2020-ycc",
+	"bt2020-cycc",
+	"dci-p3",
+	"sdr",
+	"hdr",
+	"smpte2084",
+	"hlg",
+	"fl-fr",
+	"lfe",
+	"fc",
+	"bl-br",
+	"bc",
+	"flc-frc",
+	"rlc-rrc",
+	"flw-frw",
+	"tpfl-tpfr",
+	"tpc",
+	"tpfc",
+	"ls-rs",
+	"lfe2",
+	"tpbc",
+	"sil-sir",
+	"tpsil-tpsir",
+	"tpbl-tpbr",
+	"btfc",
+	"btfl-btbr",
+	"tpls-tprs",
+	NULL
+};
+
+/* Parse the modifier suboptions (5 and up) of --set-edid */
+static bool parse_edid_mod(int opt, char *value, struct edid_mods &m)
+{
+	if (opt < 5)
+		return false;
+	if (value == NULL && opt <= 8) {
+		fprintf(stderr, "No value given to suboption <%s>\n",
+			edid_subopts[opt]);
+		return false;
+	}
+	switch (opt) {
+	case 5:
+		if (value)
+			m.phys_addr = parse_phys_addr(value);
+		break;
+	case 6:
+		m.s_pt = strtoul(value, 0, 0) & 3;
+		break;
+	case 7:
+		m.s_it = strtoul(value, 0, 0) & 3;
+		break;
+	case 8:
+		m.s_ce = strtoul(value, 0, 0) & 3;
+		break;
+	case 9: m.hdmi_vsdb_dc |= HDMI_VSDB_Y444_BIT; break;
+	case 10: m.hdmi_vsdb_dc |= HDMI_VSDB_30_BIT; break;
+	case 11: m.hdmi_vsdb_dc |= HDMI_VSDB_36_BIT; break;
+	case 12: m.hdmi_vsdb_dc |= HDMI_VSDB_48_BIT; break;
+	case 13: m.hdmi_vsdb_cnc |= HDMI_VSDB_GRAPHICS; break;
+	case 14: m.hdmi_vsdb_cnc |= HDMI_VSDB_PHOTO; break;
+	case 15: m.hdmi_vsdb_cnc |= HDMI_VSDB_CINEMA; break;
+	case 16: m.hdmi_vsdb_cnc |= HDMI_VSDB_GAME; break;
+	case 17: m.hf_vsdb |= HF_VSDB_SCSD_PRESENT; break;
+	case 18: m.cta861_hdr |= CTA861_HDR_UNDERSCAN; break;
+	case 19: m.cta861_hdr |= CTA861_HDR_AUDIO; break;
+	case 20: m.cta861_hdr |= CTA861_HDR_YCBCR444; break;
+	case 21: m.cta861_hdr |= CTA861_HDR_YCBCR422; break;
+	case 22: m.vid_cap |= VID_CAP_QY; break;
+	case 23: m.vid_cap |= VID_CAP_QS; break;
+	case 24: m.colorimetry1 |= COLORIMETRY_XVYCC601; break;
+	case 25: m.colorimetry1 |= COLORIMETRY_XVYCC709; break;
+	case 26: m.colorimetry1 |= COLORIMETRY_SYCC; break;
+	case 27: m.colorimetry1 |= COLORIMETRY_OPYCC; break;
+	case 28: m.colorimetry1 |= COLORIMETRY_OPRGB; break;
+	case 29: m.colorimetry1 |= COLORIMETRY_BT2020RGB; break;
+	case 30: m.colorimetry1 |= COLORIMETRY_BT2020YCC; break;
+	case 31: m.colorimetry1 |= COLORIMETRY_BT2020CYCC; break;
+	case 32: m.colorimetry2 |= COLORIMETRY_DCIP3; break;
+	case 33: m.hdr_md |= HDR_MD_SDR; break;
+	case 34: m.hdr_md |= HDR_MD_HDR; break;
+	case 35: m.hdr_md |= HDR_MD_SMPTE_2084; break;
+	case 36: m.hdr_md |= HDR_MD_HLG; break;
+	case 37: m.speaker1 |= SPEAKER1_FL_FR; break;
+	case 38: m.speaker1 |= SPEAKER1_LFE; break;
+	case 39: m.speaker1 |= SPEAKER1_FC; break;
+	case 40: m.speaker1 |= SPEAKER1_BL_BR; break;
+	case 41: m.speaker1 |= SPEAKER1_BC; break;
+	case 42: m.speaker1 |= SPEAKER1_FLC_FRC; break;
+	case 43: m.speaker1 |= SPEAKER1_RLC_RRC; break;
+	case 44: m.speaker1 |= SPEAKER1_FLW_FRW; break;
+	case 45: m.speaker2 |= SPEAKER2_TPFL_TPFR; break;
+	case 46: m.speaker2 |= SPEAKER2_TPC; break;
+	case 47: m.speaker2 |= SPEAKER2_TPFC; break;
+	case 48: m.speaker2 |= SPEAKER2_LS_RS; break;
+	case 49: m.speaker2 |= SPEAKER2_LFE2; break;
+	case 50: m.speaker2 |= SPEAKER2_TPBC; break;
+	case 51: m.speaker2 |= SPEAKER2_SIL_SIR; break;
+	case 52: m.speaker2 |= SPEAKER2_TPSIL_TPSIR; break;
+	case 53: m.speaker3 |= SPEAKER3_TPBL_TPBR; break;
+	case 54: m.speaker3 |= SPEAKER3_BTFC; break;
+	case 55: m.speaker3 |= SPEAKER3_BTFL_BTFR; break;
+	case 56: m.speaker3 |= SPEAKER3_TPLS_TPRS; break;
+	default:
+		return false;
+	}
+	return true;
+}
+
 void edid_cmd(int ch, char *optarg)
 {
 	char *value, *subs;
@@ -913,77 +1173,16 @@ void edid_cmd(int ch, char *optarg)
 			break;
 		subs = optarg;
 		while (*subs != '\0') {
-			static const char *const subopts[] = {
-				"pad",
-				"type",
-				"edid",
-				"file",
-				"format",
-				"pa",
-				"s-pt",
-				"s-it",
-				"s-ce",
-				"y444",
-				"30-bit",
-				"36-bit",
-				"48-bit",
-				"graphics",
-				"photo",
-				"cinema",
-				"game",
-				"scdc",
-				"underscan",
-				"audio",
-				"ycbcr444",
-				"ycbcr422",
-				"qy",
-				"qs",
-				"xvycc-601",
-				"xvycc-709",
-				"sycc",
-				"opycc",
-				"oprgb",
-				"bt2020-rgb",
-				"bt2020-ycc",
-				"bt2020-cycc",
-				"dci-p3",
-				"sdr",
-				"hdr",
-				"smpte2084",
-				"hlg",
-				"fl-fr",
-				"lfe",
-				"fc",
-				"bl-br",
-				"bc",
-				"flc-frc",
-				"rlc-rrc",
-				"flw-frw",
-				"tpfl-tpfr",
-				"tpc",
-				"tpfc",
-				"ls-rs",
-				"lfe2",
-				"tpbc",
-				"sil-sir",
-				"tpsil-tpsir",
-				"tpbl-tpbr",
-				"btfc",
-				"btfl-btbr",
-				"tpls-tprs",
-				NULL
-			};
-
-			int opt = getsubopt(&subs, (char* const*)subopts, &value);
+			int opt = getsubopt(&subs, (char* const*)edid_subopts, &value);
 
 			if (opt == -1) {
 				fprintf(stderr, "Invalid suboptions specified\n");
 				edid_usage();
 				std::exit(EXIT_FAILURE);
 			}
-			if (value == NULL && opt <= 8) {
+			if (value == NULL && opt <= 4) {
 				fprintf(stderr, "No value given to suboption <%s>\n",
-					subopts[opt]);
+					edid_subopts[opt]);
 				edid_usage();
 				std::exit(EXIT_FAILURE);
 			}
@@ -1039,74 +1238,20 @@ void edid_cmd(int ch, char *optarg)
 					std::exit(EXIT_FAILURE);
 				}
 				break;
-			case 5:
-				if (value)
-					phys_addr = parse_phys_addr(value);
-				break;
-			case 6:
-				mod_s_pt = strtoul(value, 0, 0) & 3;
-				break;
-			case 7:
-				mod_s_it = strtoul(value, 0, 0) & 3;
-				break;
-			case 8:
-				mod_s_ce = strtoul(value, 0, 0) & 3;
-				break;
-			case 9: toggle_hdmi_vsdb_dc_flags |= HDMI_VSDB_Y444_BIT; break;
-			case 10: toggle_hdmi_vsdb_dc_flags |= HDMI_VSDB_30_BIT; break;
-			case 11: toggle_hdmi_vsdb_dc_flags |= HDMI_VSDB_36_BIT; break;
-			case 12: toggle_hdmi_vsdb_dc_flags |= HDMI_VSDB_48_BIT; break;
-			case 13: toggle_hdmi_vsdb_cnc_flags |= HDMI_VSDB_GRAPHICS; break;
-			case 14: toggle_hdmi_vsdb_cnc_flags |= HDMI_VSDB_PHOTO; break;
-			case 15: toggle_hdmi_vsdb_cnc_flags |= HDMI_VSDB_CINEMA; break;
-			case 16: toggle_hdmi_vsdb_cnc_flags |= HDMI_VSDB_GAME; break;
-			case 17: toggle_hf_vsdb_flags |= HF_VSDB_SCSD_PRESENT; break;
-			case 18: toggle_cta861_hdr_flags |= CTA861_HDR_UNDERSCAN; break;
-			case 19: toggle_cta861_hdr_flags |= CTA861_HDR_AUDIO; break;
-			case 20: toggle_cta861_hdr_flags |= CTA861_HDR_YCBCR444; break;
-			case 21: toggle_cta861_hdr_flags |= CTA861_HDR_YCBCR422; break;
-			case 22: toggle_vid_cap_flags |= VID_CAP_QY; break;
-			case 23: toggle_vid_cap_flags |= VID_CAP_QS; break;
-			case 24: toggle_colorimetry_flags1 |= COLORIMETRY_XVYCC601; break;
-			case 25: toggle_colorimetry_flags1 |= COLORIMETRY_XVYCC709; break;
-			case 26: toggle_colorimetry_flags1 |= COLORIMETRY_SYCC; break;
-			case 27: toggle_colorimetry_flags1 |= COLORIMETRY_OPYCC; break;
-			case 28: toggle_colorimetry_flags1 |= COLORIMETRY_OPRGB; break;
-			case 29: toggle_colorimetry_flags1 |= COLORIMETRY_BT2020RGB; break;
-			case 30: toggle_colorimetry_flags1 |= COLORIMETRY_BT2020YCC; break;
-			case 31: toggle_colorimetry_flags1 |= COLORIMETRY_BT2020CYCC; break;
-			case 32: toggle_colorimetry_flags2 |= COLORIMETRY_DCIP3; break;
-			case 33: toggle_hdr_md_flags |= HDR_MD_SDR; break;
-			case 34: toggle_hdr_md_flags |= HDR_MD_HDR; break;
-			case 35: toggle_hdr_md_flags |= HDR_MD_SMPTE_2084; break;
-			case 36: toggle_hdr_md_flags |= HDR_MD_HLG; break;
-			case 37: toggle_speaker1_flags |= SPEAKER1_FL_FR; break;
-			case 38: toggle_speaker1_flags |= SPEAKER1_LFE; break;
-			case 39: toggle_speaker1_flags |= SPEAKER1_FC; break;
-			case 40: toggle_speaker1_flags |= SPEAKER1_BL_BR; break;
-			case 41: toggle_speaker1_flags |= SPEAKER1_BC; break;
-			case 42: toggle_speaker1_flags |= SPEAKER1_FLC_FRC; break;
-			case 43: toggle_speaker1_flags |= SPEAKER1_RLC_RRC; break;
-			case 44: toggle_speaker1_flags |= SPEAKER1_FLW_FRW; break;
-			case 45: toggle_speaker2_flags |= SPEAKER2_TPFL_TPFR; break;
-			case 46: toggle_speaker2_flags |= SPEAKER2_TPC; break;
-			case 47: toggle_speaker2_flags |= SPEAKER2_TPFC; break;
-			case 48: toggle_speaker2_flags |= SPEAKER2_LS_RS; break;
-			case 49: toggle_speaker2_flags |= SPEAKER2_LFE2; break;
-			case 50: toggle_speaker2_flags |= SPEAKER2_TPBC; break;
-			case 51: toggle_speaker2_flags |= SPEAKER2_SIL_SIR; break;
-			case 52: toggle_speaker2_flags |= SPEAKER2_TPSIL_TPSIR; break;
-			case 53: toggle_speaker3_flags |= SPEAKER3_TPBL_TPBR; break;
-			case 54: toggle_speaker3_flags |= SPEAKER3_BTFC; break;
-			case 55: toggle_speaker3_flags |= SPEAKER3_BTFL_BTFR; break;
-			case 56: toggle_speaker3_flags |= SPEAKER3_TPLS_TPRS; break;
 			default:
-				edid_usage();
-				std::exit(EXIT_FAILURE);
+				if (!parse_edid_mod(opt, value, mods)) {
+					edid_usage();
+					std::exit(EXIT_FAILURE);
+				}
+				break;
 			}
 		}
 		break;
 
+	case OptSetEdidBatch:
+		batch_file = optarg;
+		break;
+
 	case OptClearEdid:
 		if (optarg)
 			clear_pad = strtoul(optarg, 0, 0);
@@ -1177,10 +1322,92 @@ void edid_cmd(int ch, char *optarg)
 	}
 }
 
+/*
+ * Set a variant of sedid for every line of the --set-edid-batch script.
+ * All lines are parsed and the locations of the fields are found once,
+ * so every variant is just a copy of sedid with the modified bytes and
+ * the checksums adjusted for them.
+ */
+static void edid_set_batch(int fd, const struct edid_index &idx)
+{
+	std::vector<std::pair<unsigned, struct edid_mods>> variants;
+	unsigned size = sedid.blocks * 128;
+	struct v4l2_edid e = sedid;
+	struct v4l2_edid r = sedid;
+	unsigned failed = 0, mismatch = 0;
+	unsigned line = 0;
+	struct timespec start, end;
+	char buf[1024];
+	double secs;
+	FILE *f;
+
+	f = fopen(batch_file, "r");
+	if (!f) {
+		fprintf(stderr, "Failed to open %s: %s\n", batch_file,
+			strerror(errno));
+		std::exit(EXIT_FAILURE);
+	}
+	while (fgets(buf, sizeof(buf), f)) {
+		struct edid_mods m = EDID_MODS_INIT;
+		char *subs = buf + strspn(buf, " \t");
+		char *value;
+		bool ok = true;
+
+		line++;
+		subs[strcspn(subs, "\r\n")] = 0;
+		if (!*subs || *subs == '#')
+			continue;
+		while (ok && *subs) {
+			int opt = getsubopt(&subs, (char* const*)edid_subopts, &value);
+
+			ok = opt >= 0 && parse_edid_mod(opt, value, m);
+		}
+		if (ok)
+			variants.push_back(std::make_pair(line, m));
+		else
+			fprintf(stderr, "%s:%u: invalid modifiers, skipped\n",
+				batch_file, line);
+	}
+	fclose(f);
+
+	e.edid = static_cast<unsigned char *>(malloc(size));
+	r.edid = static_cast<unsigned char *>(malloc(size));
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (const auto &v : variants) {
+		memcpy(e.edid, sedid.edid, size);
+		if (!apply_edid_mods(e.edid, idx, v.second) && verbose)
+			printf("%s:%u: no modifier applies to this EDID\n",
+			       batch_file, v.first);
+		e.blocks = sedid.blocks;
+		if (doioctl(fd, VIDIOC_S_EDID, &e)) {
+			fprintf(stderr, "%s:%u: failed to set the EDID\n",
+				batch_file, v.first);
+			failed++;
+			continue;
+		}
+		r.start_block = 0;
+		r.blocks = sedid.blocks;
+		if (doioctl(fd, VIDIOC_G_EDID, &r) ||
+		    r.blocks != sedid.blocks || memcmp(r.edid, e.edid, size)) {
+			fprintf(stderr, "%s:%u: the EDID read back differs\n",
+				batch_file, v.first);
+			mismatch++;
+		}
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	secs = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1000000000.0;
+
+	printf("%zu EDIDs in %.3f s (%.1f/s), %u failed, %u read back differently\n",
+	       variants.size(), secs, secs > 0 ? variants.size() / secs : 0.0,
+	       failed, mismatch);
+	free(e.edid);
+	free(r.edid);
+}
+
 void edid_set(cv4l_fd &_fd)
 {
 	int fd = _fd.g_fd();
-	int loc;
+	struct edid_index idx;
 
 	if (options[OptClearEdid]) {
 		struct v4l2_edid edid;
@@ -1190,6 +1417,9 @@ void edid_set(cv4l_fd &_fd)
 		doioctl(fd, VIDIOC_S_EDID, &edid);
 	}
 
+	if (batch_file && !options[OptSetEdid])
+		fprintf(stderr, "--set-edid-batch requires --set-edid\n");
+
 	if (options[OptSetEdid]) {
 		FILE *fin = NULL;
 		bool must_fix_edid = options[OptFixEdidChecksums];
@@ -1213,89 +1443,18 @@ void edid_set(cv4l_fd &_fd)
 				std::exit(EXIT_FAILURE);
 			}
 		}
-		if (toggle_cta861_hdr_flags || phys_addr >= 0) {
-			loc = get_edid_cta861_hdr_location(sedid.edid, sedid.blocks * 128);
-			if (loc >= 0) {
-				sedid.edid[loc] ^= toggle_cta861_hdr_flags;
-				if (phys_addr >= 0)
-					set_edid_phys_addr(sedid.edid, sedid.blocks * 128, phys_addr);
-				must_fix_edid = true;
-			}
-		}
-		if (toggle_speaker1_flags || toggle_speaker2_flags || toggle_speaker3_flags) {
-			loc = get_edid_speaker_location(sedid.edid, sedid.blocks * 128);
-			if (loc >= 0) {
-				sedid.edid[loc] ^= toggle_speaker1_flags;
-				sedid.edid[loc + 1] ^= toggle_speaker2_flags;
-				sedid.edid[loc + 2] ^= toggle_speaker3_flags;
-				must_fix_edid = true;
-			}
-		}
-		if (toggle_hdmi_vsdb_dc_flags || toggle_hdmi_vsdb_cnc_flags) {
-			loc = get_edid_hdmi_vsdb_location(sedid.edid, sedid.blocks * 128);
-
-			if (loc >= 0) {
-				__u8 len = sedid.edid[loc] & 0x1f;
-
-				if (len >= 6) {
-					sedid.edid[loc + 6] ^= toggle_hdmi_vsdb_dc_flags;
-					must_fix_edid = true;
-				}
-				if (len >= 8) {
-					sedid.edid[loc + 8] ^= toggle_hdmi_vsdb_cnc_flags;
-					must_fix_edid = true;
-				}
-			}
-		}
-		if (toggle_hf_vsdb_flags) {
-			loc = get_edid_hf_vsdb_location(sedid.edid, sedid.blocks * 128);
-			if (loc >= 0) {
-				sedid.edid[loc + 1] ^= toggle_hf_vsdb_flags;
-				must_fix_edid = true;
-			}
-		}
-		if (toggle_vid_cap_flags || mod_s_pt >= 0 ||
-		    mod_s_ce >= 0 || mod_s_it >= 0) {
-			loc = get_edid_vid_cap_location(sedid.edid, sedid.blocks * 128);
-			if (loc >= 0) {
-				sedid.edid[loc] ^= toggle_vid_cap_flags;
-				if (mod_s_ce >= 0) {
-					sedid.edid[loc] &= 0xfc;
-					sedid.edid[loc] |= mod_s_ce << 0;
-				}
-				if (mod_s_it >= 0) {
-					sedid.edid[loc] &= 0xf3;
-					sedid.edid[loc] |= mod_s_it << 2;
-				}
-				if (mod_s_pt >= 0) {
-					sedid.edid[loc] &= 0xcf;
-					sedid.edid[loc] |= mod_s_pt << 4;
-				}
-				must_fix_edid = true;
-			}
-		}
-		if (toggle_colorimetry_flags1 || toggle_colorimetry_flags2) {
-			loc = get_edid_colorimetry_location(sedid.edid, sedid.blocks * 128);
-			if (loc >= 0) {
-				sedid.edid[loc] ^= toggle_colorimetry_flags1;
-				sedid.edid[loc + 1] ^= toggle_colorimetry_flags2;
-				must_fix_edid = true;
-			}
-		}
-		if (toggle_hdr_md_flags) {
-			loc = get_edid_hdr_md_location(sedid.edid, sedid.blocks * 128);
-			if (loc >= 0) {
-				sedid.edid[loc] ^= toggle_hdr_md_flags;
-				must_fix_edid = true;
-			}
-		}
+		get_edid_index(sedid.edid, sedid.blocks * 128, idx);
+		if (apply_edid_mods(sedid.edid, idx, mods))
+			must_fix_edid = true;
 		if (must_fix_edid)
 			fix_edid(&sedid);
 		print_edid_mods(&sedid);
-		if (verify_edid(&sedid))
-			doioctl(fd, VIDIOC_S_EDID, &sedid);
-		else
+		if (!verify_edid(&sedid))
 			fprintf(stderr, "EDID not set due to checksum errors\n");
+		else if (batch_file)
+			edid_set_batch(fd, idx);
+		else
+			doioctl(fd, VIDIOC_S_EDID, &sedid);
 		if (fin) {
 			if (sedid.edid) {
 				free(sedid.edid);
@@ -1,3 +1,5 @@
+#include <cstddef>
+
 #include <endian.h>
 
 #include "v4l2-ctl.h"
@@ -148,43 +150,98 @@ struct vivid_meta_out_buf {
         __s16	hue;
 };
 
-void print_meta_buffer(FILE *f, cv4l_buffer &buf, cv4l_fmt &fmt, cv4l_queue &q)
+/* the UVC payload header fields in front of uvc_meta_buf.buf */
+#define UVC_META_HDR_SIZE	offsetof(struct uvc_meta_buf, buf)
+
+/*
+ * Decode the metadata buffer at p in place, e.g. straight from the mmap()ed
+ * buffer. A UVC buffer holds one block per payload: a uvc_meta_buf with
+ * length bytes of payload header, starting with length and flags.
+ */
+bool decode_meta_buffer(const void *p, unsigned size, __u32 dataformat, meta_fields &m)
 {
-	struct uvc_meta_buf *vbuf;
-	int buf_off = 0;
-	struct vivid_meta_out_buf *vbuf_out;
+	const __u8 *data = static_cast<const __u8 *>(p);
 
-	switch (fmt.g_pixelformat()) {
-	case V4L2_META_FMT_UVC:
-		fprintf(f, "UVC: ");
-		vbuf = static_cast<uvc_meta_buf *>(q.g_dataptr(buf.g_index(), 0));
+	memset(&m, 0, sizeof(m));
+	m.dataformat = dataformat;
 
-		fprintf(f, "%.6fs sof: %4d len: %u flags: 0x%02x",
-			static_cast<double>(vbuf->ns) / 1000000000.0,
-			vbuf->sof,
-			vbuf->length,
-			vbuf->flags);
-		if (vbuf->flags & UVC_STREAM_PTS) {
-			fprintf(f, " PTS: %u", le32toh(*(__u32*)(vbuf->buf)));
+	switch (dataformat) {
+	case V4L2_META_FMT_UVC: {
+		const struct uvc_meta_buf *vbuf = static_cast<const uvc_meta_buf *>(p);
+		unsigned buf_off = 0;
+
+		if (size < UVC_META_HDR_SIZE)
+			return false;
+		m.ns = m.last_ns = vbuf->ns;
+		m.sof = vbuf->sof;
+		m.length = vbuf->length;
+		m.flags = vbuf->flags;
+		if (m.flags & UVC_STREAM_PTS) {
+			memcpy(&m.pts, vbuf->buf, sizeof(m.pts));
+			m.pts = le32toh(m.pts);
 			buf_off = 4;
 		}
-		if (vbuf->flags & UVC_STREAM_SCR)
-			fprintf(f, " STC: %u SOF counter: %u",
-				le32toh(*(__u32*)(vbuf->buf + buf_off)),
-				le16toh(*(__u16*)(vbuf->buf + buf_off + 4)));
+		if (m.flags & UVC_STREAM_SCR) {
+			memcpy(&m.stc, vbuf->buf + buf_off, sizeof(m.stc));
+			memcpy(&m.sof_counter, vbuf->buf + buf_off + 4, sizeof(m.sof_counter));
+			m.stc = le32toh(m.stc);
+			m.sof_counter = le16toh(m.sof_counter);
+		}
+		for (unsigned off = 0; off + UVC_META_HDR_SIZE <= size; m.blocks++) {
+			__u8 length = data[off + offsetof(struct uvc_meta_buf, length)];
+
+			memcpy(&m.last_ns, data + off, sizeof(m.last_ns));
+			/* length covers the length and flags fields as well */
+			off += offsetof(struct uvc_meta_buf, length) + (length < 2 ? 2 : length);
+		}
+		return true;
+	}
+	case V4L2_META_FMT_VIVID: {
+		const struct vivid_meta_out_buf *vbuf_out = static_cast<const vivid_meta_out_buf *>(p);
+
+		if (size < sizeof(*vbuf_out))
+			return false;
+		m.brightness = vbuf_out->brightness;
+		m.contrast = vbuf_out->contrast;
+		m.saturation = vbuf_out->saturation;
+		m.hue = vbuf_out->hue;
+		return true;
+	}
+	}
+	return false;
+}
+
+void print_meta_fields(FILE *f, const meta_fields &m)
+{
+	switch (m.dataformat) {
+	case V4L2_META_FMT_UVC:
+		fprintf(f, "UVC: ");
+		fprintf(f, "%.6fs sof: %4d len: %u flags: 0x%02x",
+			static_cast<double>(m.ns) / 1000000000.0,
+			m.sof, m.length, m.flags);
+		if (m.flags & UVC_STREAM_PTS)
+			fprintf(f, " PTS: %u", m.pts);
+		if (m.flags & UVC_STREAM_SCR)
+			fprintf(f, " STC: %u SOF counter: %u", m.stc, m.sof_counter);
 		fprintf(f, "\n");
 		break;
 	case V4L2_META_FMT_VIVID:
 		fprintf(f, "VIVID:");
-		vbuf_out = static_cast<vivid_meta_out_buf *>(q.g_dataptr(buf.g_index(), 0));
-
 		fprintf(f, " brightness: %u contrast: %u saturation: %u  hue: %d\n",
-			vbuf_out->brightness, vbuf_out->contrast,
-			vbuf_out->saturation, vbuf_out->hue);
+			m.brightness, m.contrast, m.saturation, m.hue);
 		break;
 	}
 }
 
+void print_meta_buffer(FILE *f, cv4l_buffer &buf, cv4l_fmt &fmt, cv4l_queue &q)
+{
+	meta_fields m;
+
+	if (decode_meta_buffer(q.g_dataptr(buf.g_index(), 0), buf.g_bytesused(0),
+			       fmt.g_pixelformat(), m))
+		print_meta_fields(f, m);
+}
+
 void meta_fillbuffer(cv4l_buffer &buf, cv4l_fmt &fmt, cv4l_queue &q)
 {
 	struct vivid_meta_out_buf *vbuf;
@@ -1,7 +1,36 @@
+#include <cmath>
+#include <vector>
+
+#include <pthread.h>
+
 #include "v4l2-ctl.h"
 
+#include <cpu-features.h>
+#ifdef CPU_BUILD_SSE
+#include <emmintrin.h>
+#endif
+#if defined(CPU_BUILD_NEON) && defined(__aarch64__)
+#include <arm_neon.h>
+#define SDR_BUILD_NEON
+#endif
+
 static struct v4l2_format vfmt;	/* set_format/get_format */
 
+/* Conversion of captured SDR samples to float for --stream-sdr-float */
+static struct {
+	unsigned bits;		/* significant bits per sample */
+	unsigned flip;		/* xor mask that turns unsigned samples into signed ones */
+	float bias;		/* added to the signed samples before scaling */
+	float scale;		/* scales the samples to [-1, 1) */
+	unsigned channels;	/* 2 for I/Q samples, 1 for real samples */
+	unsigned decim;
+	unsigned taps;
+	std::vector<float> coeffs;	/* reversed, repeated per channel, 0 padded */
+	std::vector<float> hist;	/* (taps - 1) frames of history, then new frames */
+	unsigned phase;		/* first frame of the next output in hist */
+	std::vector<float> out;
+} conv;
+
 void sdr_usage()
 {
 	printf("\nSDR Formats options:\n"
@@ -47,6 +76,680 @@ void sdr_cmd(int ch, char *optarg)
 	}
 }
 
+/*
+ * The SSE2 and NEON kernels below do the bulk of the work and leave the
+ * remainder to the tails of the C versions, the variant is selected at
+ * run time by sdr_get_kernels().
+ */
+
+/* convert samples i...n - 1 with conv.bits <= 8 in bytes */
+static void sdr_s8_to_float_tail(const __u8 *raw, float *f, unsigned i, unsigned n)
+{
+	const __u8 flip = conv.flip;
+
+	for (; i < n; i++)
+		f[i] = (static_cast<__s8>(raw[i] ^ flip) + conv.bias) * conv.scale;
+}
+
+/* convert little endian 16 bit samples i...n - 1 with conv.bits significant bits */
+static void sdr_s16_to_float_tail(const __u8 *raw, float *f, unsigned i, unsigned n)
+{
+	const unsigned shift = 16 - conv.bits;
+
+	for (; i < n; i++) {
+		__u16 v = (raw[i * 2] | (raw[i * 2 + 1] << 8)) ^ conv.flip;
+		__s16 s = static_cast<__s16>(v << shift) >> shift;
+
+		f[i] = (s + conv.bias) * conv.scale;
+	}
+}
+
+/* the FIR output from the 4 lanes of the dot product */
+static void sdr_fir_sum(const float sum[4], float *out)
+{
+	/* the lanes hold I, Q, I, Q for complex and 4 partial sums for real samples */
+	if (conv.channels == 2) {
+		out[0] = sum[0] + sum[2];
+		out[1] = sum[1] + sum[3];
+	} else {
+		out[0] = sum[0] + sum[1] + sum[2] + sum[3];
+	}
+}
+
+/* butterflies k...half - 1 of a group: t = b * w, b = a - t, a = a + t */
+static void sdr_butterflies_tail(float *a, float *b, const float *tw,
+				 unsigned k, unsigned half)
+{
+	for (; k < half; k++) {
+		float wr = tw[4 * k];
+		float wi = tw[4 * k + 3];
+		float tr = b[2 * k] * wr - b[2 * k + 1] * wi;
+		float ti = b[2 * k] * wi + b[2 * k + 1] * wr;
+
+		b[2 * k] = a[2 * k] - tr;
+		b[2 * k + 1] = a[2 * k + 1] - ti;
+		a[2 * k] += tr;
+		a[2 * k + 1] += ti;
+	}
+}
+
+static void c_sdr_s8_to_float(const __u8 *raw, float *f, unsigned n)
+{
+	sdr_s8_to_float_tail(raw, f, 0, n);
+}
+
+static void c_sdr_s16_to_float(const __u8 *raw, float *f, unsigned n)
+{
+	sdr_s16_to_float_tail(raw, f, 0, n);
+}
+
+static void c_sdr_fir(const float *hist, float *out)
+{
+	const float *c = conv.coeffs.data();
+	unsigned len = conv.coeffs.size();
+	float sum[4] = { 0 };
+
+	for (unsigned i = 0; i < len; i += 4)
+		for (unsigned j = 0; j < 4; j++)
+			sum[j] += hist[i + j] * c[i + j];
+	sdr_fir_sum(sum, out);
+}
+
+static void c_sdr_butterflies(float *a, float *b, const float *tw, unsigned half)
+{
+	sdr_butterflies_tail(a, b, tw, 0, half);
+}
+
+#ifdef CPU_BUILD_SSE
+
+__attribute__((target("sse2")))
+static void sse2_sdr_s8_to_float(const __u8 *raw, float *f, unsigned n)
+{
+	const __m128i vflip = _mm_set1_epi8(conv.flip);
+	const __m128 vbias = _mm_set1_ps(conv.bias);
+	const __m128 vscale = _mm_set1_ps(conv.scale);
+	unsigned i = 0;
+
+	for (; i + 16 <= n; i += 16) {
+		__m128i x = _mm_xor_si128(_mm_loadu_si128((const __m128i *)(raw + i)), vflip);
+		__m128i w[2] = {
+			_mm_srai_epi16(_mm_unpacklo_epi8(x, x), 8),
+			_mm_srai_epi16(_mm_unpackhi_epi8(x, x), 8),
+		};
+
+		for (unsigned j = 0; j < 2; j++) {
+			__m128i lo = _mm_srai_epi32(_mm_unpacklo_epi16(w[j], w[j]), 16);
+			__m128i hi = _mm_srai_epi32(_mm_unpackhi_epi16(w[j], w[j]), 16);
+
+			_mm_storeu_ps(f + i + j * 8,
+				      _mm_mul_ps(_mm_add_ps(_mm_cvtepi32_ps(lo), vbias), vscale));
+			_mm_storeu_ps(f + i + j * 8 + 4,
+				      _mm_mul_ps(_mm_add_ps(_mm_cvtepi32_ps(hi), vbias), vscale));
+		}
+	}
+	sdr_s8_to_float_tail(raw, f, i, n);
+}
+
+__attribute__((target("sse2")))
+static void sse2_sdr_s16_to_float(const __u8 *raw, float *f, unsigned n)
+{
+	const unsigned shift = 16 - conv.bits;
+	const __m128i vflip = _mm_set1_epi16(conv.flip);
+	const __m128 vbias = _mm_set1_ps(conv.bias);
+	const __m128 vscale = _mm_set1_ps(conv.scale);
+	const __m128i vshift = _mm_cvtsi32_si128(shift);
+	unsigned i = 0;
+
+	for (; i + 8 <= n; i += 8) {
+		__m128i x = _mm_xor_si128(_mm_loadu_si128((const __m128i *)(raw + i * 2)), vflip);
+
+		/* sign extend from conv.bits, which also drops the unused bits */
+		x = _mm_sra_epi16(_mm_sll_epi16(x, vshift), vshift);
+
+		__m128i lo = _mm_srai_epi32(_mm_unpacklo_epi16(x, x), 16);
+		__m128i hi = _mm_srai_epi32(_mm_unpackhi_epi16(x, x), 16);
+
+		_mm_storeu_ps(f + i, _mm_mul_ps(_mm_add_ps(_mm_cvtepi32_ps(lo), vbias), vscale));
+		_mm_storeu_ps(f + i + 4, _mm_mul_ps(_mm_add_ps(_mm_cvtepi32_ps(hi), vbias), vscale));
+	}
+	sdr_s16_to_float_tail(raw, f, i, n);
+}
+
+__attribute__((target("sse2")))
+static void sse2_sdr_fir(const float *hist, float *out)
+{
+	const float *c = conv.coeffs.data();
+	unsigned len = conv.coeffs.size();
+	__m128 acc = _mm_setzero_ps();
+	float sum[4];
+
+	for (unsigned i = 0; i < len; i += 4)
+		acc = _mm_add_ps(acc, _mm_mul_ps(_mm_loadu_ps(hist + i), _mm_loadu_ps(c + i)));
+	_mm_storeu_ps(sum, acc);
+	sdr_fir_sum(sum, out);
+}
+
+/* two butterflies at a time */
+__attribute__((target("sse2")))
+static void sse2_sdr_butterflies(float *a, float *b, const float *tw, unsigned half)
+{
+	unsigned k = 0;
+
+	for (; k + 2 <= half; k += 2) {
+		__m128 w0 = _mm_loadu_ps(tw + 4 * k);
+		__m128 w1 = _mm_loadu_ps(tw + 4 * k + 4);
+		__m128 wr = _mm_shuffle_ps(w0, w1, _MM_SHUFFLE(1, 0, 1, 0));
+		__m128 wi = _mm_shuffle_ps(w0, w1, _MM_SHUFFLE(3, 2, 3, 2));
+		__m128 vb = _mm_loadu_ps(b + 2 * k);
+		__m128 va = _mm_loadu_ps(a + 2 * k);
+		__m128 swapped = _mm_shuffle_ps(vb, vb, _MM_SHUFFLE(2, 3, 0, 1));
+		__m128 t = _mm_add_ps(_mm_mul_ps(vb, wr), _mm_mul_ps(swapped, wi));
+
+		_mm_storeu_ps(b + 2 * k, _mm_sub_ps(va, t));
+		_mm_storeu_ps(a + 2 * k, _mm_add_ps(va, t));
+	}
+	sdr_butterflies_tail(a, b, tw, k, half);
+}
+
+#endif
+
+#ifdef SDR_BUILD_NEON
+
+static void neon_sdr_s8_to_float(const __u8 *raw, float *f, unsigned n)
+{
+	const uint8x16_t vflip = vdupq_n_u8(conv.flip);
+	const float32x4_t vbias = vdupq_n_f32(conv.bias);
+	const float32x4_t vscale = vdupq_n_f32(conv.scale);
+	unsigned i = 0;
+
+	for (; i + 16 <= n; i += 16) {
+		int8x16_t x = vreinterpretq_s8_u8(veorq_u8(vld1q_u8(raw + i), vflip));
+		int16x8_t w[2] = { vmovl_s8(vget_low_s8(x)), vmovl_high_s8(x) };
+
+		for (unsigned j = 0; j < 2; j++) {
+			int32x4_t lo = vmovl_s16(vget_low_s16(w[j]));
+			int32x4_t hi = vmovl_high_s16(w[j]);
+
+			vst1q_f32(f + i + j * 8,
+				  vmulq_f32(vaddq_f32(vcvtq_f32_s32(lo), vbias), vscale));
+			vst1q_f32(f + i + j * 8 + 4,
+				  vmulq_f32(vaddq_f32(vcvtq_f32_s32(hi), vbias), vscale));
+		}
+	}
+	sdr_s8_to_float_tail(raw, f, i, n);
+}
+
+static void neon_sdr_s16_to_float(const __u8 *raw, float *f, unsigned n)
+{
+	const unsigned shift = 16 - conv.bits;
+	const uint16x8_t vflip = vdupq_n_u16(conv.flip);
+	const float32x4_t vbias = vdupq_n_f32(conv.bias);
+	const float32x4_t vscale = vdupq_n_f32(conv.scale);
+	const int16x8_t vshl = vdupq_n_s16(shift);
+	const int16x8_t vshr = vdupq_n_s16(-static_cast<int>(shift));
+	unsigned i = 0;
+
+	for (; i + 8 <= n; i += 8) {
+		uint16x8_t u = veorq_u16(vreinterpretq_u16_u8(vld1q_u8(raw + i * 2)), vflip);
+		int16x8_t x = vshlq_s16(vshlq_s16(vreinterpretq_s16_u16(u), vshl), vshr);
+		int32x4_t lo = vmovl_s16(vget_low_s16(x));
+		int32x4_t hi = vmovl_high_s16(x);
+
+		vst1q_f32(f + i, vmulq_f32(vaddq_f32(vcvtq_f32_s32(lo), vbias), vscale));
+		vst1q_f32(f + i + 4, vmulq_f32(vaddq_f32(vcvtq_f32_s32(hi), vbias), vscale));
+	}
+	sdr_s16_to_float_tail(raw, f, i, n);
+}
+
+static void neon_sdr_fir(const float *hist, float *out)
+{
+	const float *c = conv.coeffs.data();
+	unsigned len = conv.coeffs.size();
+	float32x4_t acc = vdupq_n_f32(0);
+	float sum[4];
+
+	for (unsigned i = 0; i < len; i += 4)
+		acc = vmlaq_f32(acc, vld1q_f32(hist + i), vld1q_f32(c + i));
+	vst1q_f32(sum, acc);
+	sdr_fir_sum(sum, out);
+}
+
+static void neon_sdr_butterflies(float *a, float *b, const float *tw, unsigned half)
+{
+	unsigned k = 0;
+
+	for (; k + 2 <= half; k += 2) {
+		float32x4_t w0 = vld1q_f32(tw + 4 * k);
+		float32x4_t w1 = vld1q_f32(tw + 4 * k + 4);
+		float32x4_t wr = vcombine_f32(vget_low_f32(w0), vget_low_f32(w1));
+		float32x4_t wi = vcombine_f32(vget_high_f32(w0), vget_high_f32(w1));
+		float32x4_t vb = vld1q_f32(b + 2 * k);
+		float32x4_t va = vld1q_f32(a + 2 * k);
+		float32x4_t t = vmlaq_f32(vmulq_f32(vb, wr), vrev64q_f32(vb), wi);
+
+		vst1q_f32(b + 2 * k, vsubq_f32(va, t));
+		vst1q_f32(a + 2 * k, vaddq_f32(va, t));
+	}
+	sdr_butterflies_tail(a, b, tw, k, half);
+}
+
+#endif
+
+struct sdr_kernels {
+	void (*s8_to_float)(const __u8 *raw, float *f, unsigned n);
+	void (*s16_to_float)(const __u8 *raw, float *f, unsigned n);
+	/* the dot product of the coefficients with the frames at hist */
+	void (*fir)(const float *hist, float *out);
+	/* the butterflies of one group of an FFT stage */
+	void (*butterflies)(float *a, float *b, const float *tw, unsigned half);
+};
+
+static const struct sdr_kernels c_sdr_kernels = {
+	c_sdr_s8_to_float, c_sdr_s16_to_float, c_sdr_fir, c_sdr_butterflies
+};
+#ifdef CPU_BUILD_SSE
+static const struct sdr_kernels sse2_sdr_kernels = {
+	sse2_sdr_s8_to_float, sse2_sdr_s16_to_float, sse2_sdr_fir, sse2_sdr_butterflies
+};
+#endif
+#ifdef SDR_BUILD_NEON
+static const struct sdr_kernels neon_sdr_kernels = {
+	neon_sdr_s8_to_float, neon_sdr_s16_to_float, neon_sdr_fir, neon_sdr_butterflies
+};
+#endif
+
+static const struct cpu_kernel_variant sdr_variants[] = {
+#ifdef CPU_BUILD_SSE
+	{ "sse2", CPU_FEATURE_SSE2, &sse2_sdr_kernels },
+#endif
+#ifdef SDR_BUILD_NEON
+	{ "neon", CPU_FEATURE_NEON, &neon_sdr_kernels },
+#endif
+	{ "c", 0, &c_sdr_kernels },
+};
+
+static const struct sdr_kernels *sdr_get_kernels()
+{
+	static const void *kernels;
+
+	return static_cast<const struct sdr_kernels *>(
+		cpu_select_kernels_cached(&kernels, sdr_variants));
+}
+
+/*
+ * Design the decimation filter: a Blackman windowed sinc low-pass with its
+ * cutoff a bit below the Nyquist frequency of the decimated output.
+ */
+static void sdr_design_fir()
+{
+	unsigned ch = conv.channels;
+	unsigned len = (conv.taps * ch + 3) & ~3;
+	double fc = 0.45 / conv.decim;
+	double mid = (conv.taps - 1) / 2.0;
+	std::vector<double> h(conv.taps);
+	double sum = 0;
+
+	for (unsigned k = 0; k < conv.taps; k++) {
+		double t = k - mid;
+		double sinc = t == 0 ? 2 * fc : sin(2 * M_PI * fc * t) / (M_PI * t);
+		double w = conv.taps == 1 ? 1 :
+			0.42 - 0.5 * cos(2 * M_PI * k / (conv.taps - 1)) +
+			0.08 * cos(4 * M_PI * k / (conv.taps - 1));
+
+		h[k] = sinc * w;
+		sum += h[k];
+	}
+	conv.coeffs.assign(len, 0);
+	for (unsigned k = 0; k < conv.taps; k++)
+		for (unsigned j = 0; j < ch; j++)
+			conv.coeffs[(conv.taps - 1 - k) * ch + j] = h[k] / sum;
+}
+
+/* set up the sample conversion for the current SDR capture format */
+static bool sdr_float_format(cv4l_fd &fd)
+{
+	v4l2_format fmt;
+
+	if (fd.g_fmt(fmt, V4L2_BUF_TYPE_SDR_CAPTURE)) {
+		fprintf(stderr, "cannot get the SDR capture format\n");
+		return false;
+	}
+	conv.channels = 2;
+	switch (fmt.fmt.sdr.pixelformat) {
+	case V4L2_SDR_FMT_CU8:
+		conv.bits = 8;
+		conv.flip = 0x80;
+		break;
+	case V4L2_SDR_FMT_CS8:
+		conv.bits = 8;
+		conv.flip = 0;
+		break;
+	case V4L2_SDR_FMT_CU16LE:
+		conv.bits = 16;
+		conv.flip = 0x8000;
+		break;
+	case V4L2_SDR_FMT_CS14LE:
+		conv.bits = 14;
+		conv.flip = 0;
+		break;
+	case V4L2_SDR_FMT_RU12LE:
+		conv.bits = 12;
+		conv.flip = 0x800;
+		conv.channels = 1;
+		break;
+	default:
+		fprintf(stderr, "cannot convert SDR format '%s' to float\n",
+			fcc2s(fmt.fmt.sdr.pixelformat).c_str());
+		return false;
+	}
+	/* unsigned samples are centered between two integer values */
+	conv.bias = conv.flip ? 0.5f : 0.0f;
+	conv.scale = 1.0f / (1 << (conv.bits - 1));
+	return true;
+}
+
+/* convert n samples to float */
+static void sdr_to_float(const __u8 *raw, float *f, unsigned n)
+{
+	if (conv.bits > 8)
+		sdr_get_kernels()->s16_to_float(raw, f, n);
+	else
+		sdr_get_kernels()->s8_to_float(raw, f, n);
+}
+
+bool sdr_convert_prepare(cv4l_fd &fd, unsigned decim, unsigned taps)
+{
+	if (!sdr_float_format(fd))
+		return false;
+	conv.decim = decim ? decim : 1;
+	conv.taps = taps ? taps : 24 * conv.decim + 1;
+	conv.phase = 0;
+	if (conv.decim > 1) {
+		sdr_design_fir();
+		conv.hist.assign((conv.taps - 1) * conv.channels, 0);
+	}
+	return true;
+}
+
+unsigned sdr_convert(const void *raw, unsigned size, const void **out)
+{
+	const __u8 *p = static_cast<const __u8 *>(raw);
+	unsigned ch = conv.channels;
+	unsigned n = size / (conv.bits > 8 ? 2 : 1);
+	unsigned keep = conv.hist.size();
+	unsigned frames, i;
+	float *f;
+
+	n -= n % ch;
+	if (!n)
+		return 0;
+	if (conv.decim == 1) {
+		conv.out.resize(n);
+		f = conv.out.data();
+	} else {
+		/* the FIR kernels may read up to 3 floats past the last tap */
+		conv.hist.resize(keep + n + 3);
+		f = conv.hist.data() + keep;
+	}
+	sdr_to_float(p, f, n);
+	if (conv.decim == 1) {
+		*out = conv.out.data();
+		return n * sizeof(float);
+	}
+
+	/* every decim'th output of the FIR filter over the frames in hist */
+	frames = (keep + n) / ch;
+	conv.out.resize(((frames - conv.taps + 1) / conv.decim + 1) * ch);
+	f = conv.out.data();
+	for (i = conv.phase; i + conv.taps <= frames; i += conv.decim, f += ch)
+		sdr_get_kernels()->fir(conv.hist.data() + i * ch, f);
+	conv.phase = i - (frames - conv.taps + 1);
+	memmove(conv.hist.data(), conv.hist.data() + (frames - conv.taps + 1) * ch,
+		keep * sizeof(float));
+	conv.hist.resize(keep);
+	*out = conv.out.data();
+	return (f - conv.out.data()) * sizeof(float);
+}
+
+/*
+ * Power spectra for --stream-sdr-spectrum. The capture thread only copies
+ * the samples to one of SPECTRUM_QUEUE buffers, a worker thread converts
+ * them and computes the FFTs. If the worker falls behind, buffers are
+ * dropped instead of stalling the capture.
+ */
+#define SPECTRUM_QUEUE 4
+
+static struct {
+	pthread_t thread;
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	bool running;
+	bool stop;
+	std::vector<__u8> queue[SPECTRUM_QUEUE];
+	unsigned head, tail;
+	unsigned dropped;
+
+	unsigned size;		/* FFT size */
+	unsigned log2size;
+	unsigned avg;		/* number of buffers per spectrum */
+	/* the FFT plan */
+	std::vector<unsigned> bitrev;
+	std::vector<float> twiddle;	/* cos, cos, -sin, sin of the twiddle factors */
+	std::vector<float> window;
+	float norm;		/* scales a full scale tone to 0 dB */
+
+	std::vector<float> samples;	/* converted samples not yet transformed */
+	std::vector<float> fft;		/* re/im pairs */
+	std::vector<double> power;
+	unsigned ffts;		/* FFTs accumulated in power */
+	unsigned buffers;	/* buffers accumulated in power */
+	unsigned seq;
+} spec;
+
+static void spectrum_plan()
+{
+	unsigned n = spec.size;
+	double sum = 0;
+
+	spec.log2size = 0;
+	while ((1U << spec.log2size) < n)
+		spec.log2size++;
+	spec.bitrev.resize(n);
+	for (unsigned i = 0; i < n; i++) {
+		unsigned r = 0;
+
+		for (unsigned b = 0; b < spec.log2size; b++)
+			if (i & (1 << b))
+				r |= 1 << (spec.log2size - 1 - b);
+		spec.bitrev[i] = r;
+	}
+	/* stored per stage, so the butterflies read them sequentially */
+	spec.twiddle.clear();
+	for (unsigned len = 2; len <= n; len <<= 1) {
+		for (unsigned k = 0; k < len / 2; k++) {
+			float c = cos(2 * M_PI * k / len);
+			float s = -sin(2 * M_PI * k / len);
+
+			spec.twiddle.insert(spec.twiddle.end(), { c, c, -s, s });
+		}
+	}
+	/* Hann window */
+	spec.window.resize(n);
+	for (unsigned i = 0; i < n; i++) {
+		spec.window[i] = 0.5 - 0.5 * cos(2 * M_PI * i / n);
+		sum += spec.window[i];
+	}
+	spec.norm = 1.0 / (sum * sum);
+	spec.fft.resize(2 * n);
+	spec.power.assign(n, 0);
+}
+
+/* in place radix-2 FFT of the spec.size re/im pairs in spec.fft */
+static void spectrum_fft()
+{
+	float *x = spec.fft.data();
+	const float *tw = spec.twiddle.data();
+	unsigned n = spec.size;
+	const struct sdr_kernels *k = sdr_get_kernels();
+
+	for (unsigned len = 2; len <= n; tw += 2 * len, len <<= 1) {
+		unsigned half = len / 2;
+
+		for (unsigned i = 0; i < n; i += len) {
+			float *a = x + 2 * i;
+			float *b = a + 2 * half;
+
+			k->butterflies(a, b, tw, half);
+		}
+	}
+}
+
+/* transform one block of spec.size frames and accumulate its power */
+static void spectrum_block(const float *s)
+{
+	float *x = spec.fft.data();
+	unsigned ch = conv.channels;
+
+	/* window and bit reverse */
+	for (unsigned i = 0; i < spec.size; i++) {
+		unsigned r = spec.bitrev[i];
+
+		x[2 * r] = s[i * ch] * spec.window[i];
+		x[2 * r + 1] = ch == 2 ? s[i * ch + 1] * spec.window[i] : 0;
+	}
+	spectrum_fft();
+	for (unsigned i = 0; i < spec.size; i++)
+		spec.power[i] += x[2 * i] * x[2 * i] + x[2 * i + 1] * x[2 * i + 1];
+	spec.ffts++;
+}
+
+/* print the averaged spectrum in dB, from the lowest to the highest frequency */
+static void spectrum_print()
+{
+	unsigned n = spec.size;
+	/* complex spectra are centered around the tuner frequency */
+	unsigned first = conv.channels == 2 ? n / 2 : 0;
+	unsigned bins = conv.channels == 2 ? n : n / 2 + 1;
+	double scale = spec.norm / spec.ffts;
+
+	printf("spectrum %u:", spec.seq++);
+	for (unsigned i = 0; i < bins; i++) {
+		double p = spec.power[(first + i) % n] * scale;
+
+		printf(" %.1f", p > 1e-20 ? 10 * log10(p) : -200.0);
+	}
+	printf("\n");
+	fflush(stdout);
+	spec.power.assign(n, 0);
+	spec.ffts = 0;
+}
+
+static void spectrum_process(const std::vector<__u8> &raw)
+{
+	unsigned ch = conv.channels;
+	unsigned n = raw.size() / (conv.bits > 8 ? 2 : 1);
+	unsigned have = spec.samples.size();
+	unsigned block = spec.size * ch;
+	unsigned pos = 0;
+
+	n -= n % ch;
+	spec.samples.resize(have + n);
+	sdr_to_float(raw.data(), spec.samples.data() + have, n);
+	for (; pos + block <= have + n; pos += block)
+		spectrum_block(spec.samples.data() + pos);
+	spec.samples.erase(spec.samples.begin(), spec.samples.begin() + pos);
+
+	if (++spec.buffers >= spec.avg && spec.ffts) {
+		spectrum_print();
+		spec.buffers = 0;
+	}
+}
+
+static void *spectrum_thread(void *arg)
+{
+	pthread_mutex_lock(&spec.lock);
+	for (;;) {
+		while (spec.head == spec.tail && !spec.stop)
+			pthread_cond_wait(&spec.cond, &spec.lock);
+		if (spec.head == spec.tail)
+			break;
+		pthread_mutex_unlock(&spec.lock);
+		spectrum_process(spec.queue[spec.head % SPECTRUM_QUEUE]);
+		pthread_mutex_lock(&spec.lock);
+		spec.head++;
+	}
+	pthread_mutex_unlock(&spec.lock);
+	return NULL;
+}
+
+bool sdr_spectrum_start(cv4l_fd &fd, unsigned size, unsigned avg)
+{
+	if (size < 16 || size > 65536 || (size & (size - 1))) {
+		fprintf(stderr, "the FFT size must be a power of two from 16 to 65536\n");
+		return false;
+	}
+	if (!sdr_float_format(fd))
+		return false;
+	spec.size = size;
+	spec.avg = avg ? avg : 1;
+	spec.head = spec.tail = 0;
+	spec.dropped = 0;
+	spec.stop = false;
+	spec.samples.clear();
+	spec.ffts = spec.buffers = spec.seq = 0;
+	spectrum_plan();
+
+	pthread_mutex_init(&spec.lock, NULL);
+	pthread_cond_init(&spec.cond, NULL);
+	if (pthread_create(&spec.thread, NULL, spectrum_thread, NULL)) {
+		fprintf(stderr, "could not start the spectrum thread\n");
+		pthread_cond_destroy(&spec.cond);
+		pthread_mutex_destroy(&spec.lock);
+		return false;
+	}
+	spec.running = true;
+	return true;
+}
+
+void sdr_spectrum_add(const void *raw, unsigned size)
+{
+	const __u8 *p = static_cast<const __u8 *>(raw);
+	bool full;
+
+	pthread_mutex_lock(&spec.lock);
+	full = spec.tail - spec.head >= SPECTRUM_QUEUE;
+	pthread_mutex_unlock(&spec.lock);
+	if (full) {
+		spec.dropped++;
+		return;
+	}
+
+	/* only the capture thread touches the buffer at the tail */
+	spec.queue[spec.tail % SPECTRUM_QUEUE].assign(p, p + size);
+
+	pthread_mutex_lock(&spec.lock);
+	spec.tail++;
+	pthread_cond_signal(&spec.cond);
+	pthread_mutex_unlock(&spec.lock);
+}
+
+/* wait until the queued buffers are processed and stop the worker */
+void sdr_spectrum_stop()
+{
+	if (!spec.running)
+		return;
+	pthread_mutex_lock(&spec.lock);
+	spec.stop = true;
+	pthread_cond_signal(&spec.cond);
+	pthread_mutex_unlock(&spec.lock);
+	pthread_join(spec.thread, NULL);
+	pthread_cond_destroy(&spec.cond);
+	pthread_mutex_destroy(&spec.lock);
+	spec.running = false;
+	if (spec.dropped)
+		fprintf(stderr, "spectrum: %u buffers dropped\n", spec.dropped);
+}
+
 void sdr_set(cv4l_fd &_fd)
 {
 	int fd = _fd.g_fd();
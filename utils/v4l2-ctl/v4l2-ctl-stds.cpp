@@ -1,4 +1,5 @@
 #include <cctype>
+#include <string>
 
 #include "v4l2-ctl.h"
 
@@ -204,8 +205,8 @@ static int parse_timing_subopt(char **subopt_str, int *value)
 	return opt;
 }
 
-static void get_cvt_gtf_timings(char *subopt, int standard,
-				struct v4l2_bt_timings *bt)
+static bool calc_cvt_gtf_timings(char *subopt, int standard,
+				 struct v4l2_bt_timings *bt)
 {
 	int width = 0;
 	int height = 0;
@@ -252,13 +253,111 @@ static void get_cvt_gtf_timings(char *subopt, int standard,
 	else
 		timings_valid = calc_gtf_modeline(width, height, fps, r_blank,
 						  interlaced, bt);
+	return timings_valid;
+}
 
-	if (!timings_valid) {
+static void get_cvt_gtf_timings(char *subopt, int standard,
+				struct v4l2_bt_timings *bt)
+{
+	if (!calc_cvt_gtf_timings(subopt, standard, bt)) {
 		stds_usage();
 		std::exit(EXIT_FAILURE);
 	}
 }
 
+/* expand the a:b:c value lists in the suboptions of a sweep line */
+static void dv_sweep_expand(const std::vector<std::string> &subopts, unsigned idx,
+			    const std::string &prefix, std::vector<std::string> &lines)
+{
+	if (idx == subopts.size()) {
+		lines.push_back(prefix);
+		return;
+	}
+
+	const std::string &s = subopts[idx];
+	size_t eq = s.find('=');
+	const char *sep = prefix.empty() ? "" : ",";
+
+	if (eq == std::string::npos || s.find(':', eq) == std::string::npos) {
+		dv_sweep_expand(subopts, idx + 1, prefix + sep + s, lines);
+		return;
+	}
+	for (size_t start = eq + 1; start <= s.size();) {
+		size_t end = s.find(':', start);
+
+		if (end == std::string::npos)
+			end = s.size();
+		dv_sweep_expand(subopts, idx + 1,
+				prefix + sep + s.substr(0, eq + 1) + s.substr(start, end - start),
+				lines);
+		start = end + 1;
+	}
+}
+
+/*
+ * Read the timings for --stream-dv-sweep: every line of the file has the
+ * cvt/gtf syntax of --set-dv-bt-timings, where each value can be a list
+ * like fps=50:60. A line stands for all combinations of its values. All
+ * timings are calculated up front.
+ */
+bool dv_sweep_load(const char *fname, std::vector<v4l2_dv_timings> &table)
+{
+	FILE *f = fopen(fname, "r");
+	char line[1024];
+	unsigned invalid = 0;
+	unsigned lineno = 0;
+
+	if (!f) {
+		fprintf(stderr, "cannot open %s: %s\n", fname, strerror(errno));
+		return false;
+	}
+	while (fgets(line, sizeof(line), f)) {
+		std::vector<std::string> subopts;
+		std::vector<std::string> lines;
+		char *p = strchr(line, '#');
+		int standard;
+
+		lineno++;
+		if (p)
+			*p = 0;
+		for (char *tok = strtok(line, ", \t\r\n"); tok; tok = strtok(NULL, ", \t\r\n"))
+			subopts.push_back(tok);
+		if (subopts.empty())
+			continue;
+		if (subopts[0] == "cvt") {
+			standard = V4L2_DV_BT_STD_CVT;
+		} else if (subopts[0] == "gtf") {
+			standard = V4L2_DV_BT_STD_GTF;
+		} else {
+			fprintf(stderr, "%s:%u: lines must start with cvt or gtf\n", fname, lineno);
+			fclose(f);
+			return false;
+		}
+		subopts.erase(subopts.begin());
+		dv_sweep_expand(subopts, 0, "", lines);
+
+		for (auto &l : lines) {
+			std::vector<char> subopt(l.begin(), l.end());
+			v4l2_dv_timings t = {};
+
+			subopt.push_back(0);
+			t.type = V4L2_DV_BT_656_1120;
+			if (calc_cvt_gtf_timings(subopt.data(), standard, &t.bt))
+				table.push_back(t);
+			else
+				invalid++;
+		}
+	}
+	fclose(f);
+	if (invalid)
+		fprintf(stderr, "%s: skipped %u invalid timings\n", fname, invalid);
+	if (table.empty()) {
+		fprintf(stderr, "%s: no timings to sweep\n", fname);
+		return false;
+	}
+	return true;
+}
+
 static void parse_dv_bt_timings(char *optarg, struct v4l2_dv_timings *dv_timings)
 {
 	char *subs = optarg;
@@ -1,13 +1,28 @@
+#include <algorithm>
+#include <cmath>
+#include <csignal>
 #include <cstring>
+#include <vector>
 
 #include <netdb.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sys/mman.h>
 #include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <netinet/tcp.h>
 
 #include <linux/media.h>
+#ifdef HAVE_LINUX_DMA_BUF_H
+#include <linux/dma-buf.h>
+#endif
 
 #include "compiler.h"
 #include "v4l2-ctl.h"
 #include "v4l-stream.h"
+#include "cv4l-event-loop.h"
 #include <media-info.h>
 #include <fwht-ctrls.h>
 
@@ -20,9 +35,21 @@ static unsigned stream_skip;
 static __u32 memory = V4L2_MEMORY_MMAP;
 static __u32 out_memory = V4L2_MEMORY_MMAP;
 static int stream_sleep = -1;
+static int stream_poll_timeout = 2000;
+static FILE *stream_stats_file;
+static const char *stream_stats_name;
+static volatile sig_atomic_t stream_stats_dump_gen;
+
+/* The statistics are dumped by the next add_ts() of each fps_timestamps */
+static void stream_stats_sigusr1(int)
+{
+	stream_stats_dump_gen = stream_stats_dump_gen + 1;
+}
+static bool stream_busy_poll;
 static bool stream_no_query;
 static unsigned stream_pat;
 static bool stream_loop;
+static unsigned stream_from_preload;
 static bool stream_out_square;
 static bool stream_out_border;
 static bool stream_out_sav;
@@ -33,6 +60,10 @@ static u8 stream_out_alpha;
 static bool stream_out_alpha_red_only;
 static bool stream_out_rgb_lim_range;
 static unsigned stream_out_perc_fill = 100;
+static unsigned stream_out_threads = 1;
+#define STREAM_OUT_CACHE_MAX_FRAMES	64
+static unsigned stream_out_cache_frames = 16;
+static bool stream_out_prerender_frames;
 static v4l2_std_id stream_out_std;
 static bool stream_out_refresh;
 static tpg_move_mode stream_out_hor_mode = TPG_MOVE_NONE;
@@ -41,13 +72,35 @@ static unsigned reqbufs_count_cap = 4;
 static unsigned reqbufs_count_out = 4;
 static char *file_to;
 static bool to_with_hdr;
+static bool stream_slice_vbi;
+static unsigned stream_sdr_decim;
+static unsigned stream_sdr_taps;
+static unsigned stream_sdr_fft;
+static unsigned stream_sdr_fft_avg = 16;
+static unsigned stream_to_queue;
+static bool stream_direct;
 static char *host_to;
 #ifndef NO_STREAM_TO
+#define HOST_MAX_HOSTS 8
 static unsigned host_port_to = V4L_STREAM_PORT;
 static unsigned bpl_cap[VIDEO_MAX_PLANES];
+/* All --stream-to-host sockets, host_fd_to is the first one */
+static int host_fds_to[HOST_MAX_HOSTS];
+static unsigned host_num_fds_to;
+/* With --stream-to-host-udp: the packet sequence numbers and the FMT_VIDEO packet */
+static __u32 host_seq_to[HOST_MAX_HOSTS];
+static __u32 host_fmt_pkt[2 + V4L_STREAM_PACKET_FMT_VIDEO_SIZE(VIDEO_MAX_PLANES) / 4];
+static unsigned host_fmt_pkt_size;
 #endif
 static bool host_lossless;
+static unsigned host_threads_to = 1;
+static unsigned host_speed_to = FWHT_SPEED_DEFAULT;
+static bool host_udp_to;
 static int host_fd_to = -1;
+static char *stream_devices;
+static char *stream_meta;
+static char *stream_dv_sweep;
+static char *stream_chain;
 static unsigned comp_perc;
 static unsigned comp_perc_count;
 static char *file_from;
@@ -83,6 +136,7 @@ static request_fwht fwht_reqs[VIDEO_MAX_FRAME];
 
 #define TS_WINDOW 241
 #define FILE_HDR_ID			v4l2_fourcc('V', 'h', 'd', 'r')
+#define STREAM_MAX_THREADS		16
 
 enum codec_type {
 	NOT_CODEC,
@@ -93,6 +147,39 @@ enum codec_type {
 #define QUEUE_ERROR -1
 #define QUEUE_STOPPED -2
 
+/*
+ * The inter-frame intervals are kept in microseconds in a log-linear
+ * histogram: values below 16 have their own bucket, above that each power
+ * of two is split in 16 buckets, so the error is at most 1/32. Intervals
+ * are clamped to 2^32 us, so the memory used is fixed.
+ */
+#define STATS_SUB_BUCKETS	16
+#define STATS_BUCKETS		((32 - 4 + 1) * STATS_SUB_BUCKETS)
+/* Dropped-frame bursts of 1, 2-3, 4-7, ... frames */
+#define STATS_BURSTS		16
+
+enum {
+	STATS_FRAME,
+	STATS_TOP,
+	STATS_BOTTOM,
+	STATS_NUM_FIELDS
+};
+
+/* Long-run statistics of --stream-stats, never reset while streaming */
+struct fps_stats {
+	__u64 frames;
+	double first_ts;
+	double last_ts;
+	__u64 min_us;
+	__u64 max_us;
+	__u64 hist[STATS_BUCKETS];
+	__u64 gaps[STATS_NUM_FIELDS];
+	__u64 lost[STATS_NUM_FIELDS];
+	__u64 bursts[STATS_BURSTS];
+	unsigned max_burst;
+	sig_atomic_t dump_gen;
+};
+
 class fps_timestamps {
 private:
 	unsigned idx;
@@ -105,12 +192,24 @@ private:
 	bool alternate_fields;
 	unsigned field_cnt;
 	unsigned last_field;
+	unsigned type;
+	fps_stats stats;
+
+	void stats_add_interval(double interval);
+	void stats_add_gap(unsigned field, unsigned lost);
 
 public:
 	fps_timestamps()
 	{
+		memset(&stats, 0, sizeof(stats));
+		type = 0;
 		reset();
 	}
+	~fps_timestamps()
+	{
+		if (stream_stats_file)
+			dump_stats(stream_stats_file);
+	}
 
 	void reset() {
 		idx = 0;
@@ -127,6 +226,9 @@ public:
 	bool has_fps(bool continuous);
 	double fps();
 	unsigned dropped();
+	double last_ts() const;
+	double period() const;
+	void dump_stats(FILE *f);
 };
 
 void fps_timestamps::determine_field(int fd, unsigned type)
@@ -137,6 +239,140 @@ void fps_timestamps::determine_field(int fd, unsigned type)
 	ioctl(fd, VIDIOC_G_FMT, &fmt);
 	cv4l_fmt cfmt(fmt);
 	alternate_fields = cfmt.g_field() == V4L2_FIELD_ALTERNATE;
+	this->type = type;
+}
+
+static unsigned stats_bucket(__u64 us)
+{
+	unsigned msb;
+
+	if (us < STATS_SUB_BUCKETS)
+		return us;
+	if (us >= (1ULL << 32))
+		us = (1ULL << 32) - 1;
+	msb = 63 - __builtin_clzll(us);
+	return (msb - 3) * STATS_SUB_BUCKETS + ((us >> (msb - 4)) & (STATS_SUB_BUCKETS - 1));
+}
+
+/* The middle of the values that end up in the bucket */
+static double stats_bucket_value(unsigned bucket)
+{
+	unsigned shift;
+
+	if (bucket < STATS_SUB_BUCKETS)
+		return bucket;
+	shift = bucket / STATS_SUB_BUCKETS - 1;
+	return ((STATS_SUB_BUCKETS + bucket % STATS_SUB_BUCKETS) << shift) +
+	       ((1U << shift) - 1) / 2.0;
+}
+
+void fps_timestamps::stats_add_interval(double interval)
+{
+	__u64 us = interval > 0 ? llround(interval * 1000000.0) : 0;
+
+	if (!stats.min_us || us < stats.min_us)
+		stats.min_us = us;
+	if (us > stats.max_us)
+		stats.max_us = us;
+	stats.hist[stats_bucket(us)]++;
+}
+
+void fps_timestamps::stats_add_gap(unsigned field, unsigned lost)
+{
+	unsigned burst = 0;
+
+	while (burst < STATS_BURSTS - 1 && (lost >> (burst + 1)))
+		burst++;
+	stats.gaps[field]++;
+	stats.lost[field] += lost;
+	stats.bursts[burst]++;
+	if (lost > stats.max_burst)
+		stats.max_burst = lost;
+}
+
+/* The value below which the given fraction of the counted values lies */
+static double stats_percentile(const double *values, const __u64 *counts,
+			       unsigned n, __u64 total, double fraction)
+{
+	__u64 target = ceil(total * fraction);
+	__u64 cnt = 0;
+
+	for (unsigned i = 0; i < n; i++) {
+		cnt += counts[i];
+		if (cnt && cnt >= target)
+			return values[i];
+	}
+	return n ? values[n - 1] : 0;
+}
+
+/*
+ * Write the statistics as a single line JSON object. The jitter is the
+ * deviation of the intervals from the median interval.
+ */
+void fps_timestamps::dump_stats(FILE *f)
+{
+	static const char *field_names[STATS_NUM_FIELDS] = { "frame", "top", "bottom" };
+	static const double fractions[] = { 0.01, 0.5, 0.99, 0.999 };
+	static const char *fraction_names[] = { "p1", "p50", "p99", "p99.9" };
+	double values[STATS_BUCKETS];
+	double dev[STATS_BUCKETS];
+	__u64 dev_counts[STATS_BUCKETS];
+	unsigned order[STATS_BUCKETS];
+	__u64 intervals = 0;
+	double median;
+
+	stats.dump_gen = stream_stats_dump_gen;
+	if (!stats.frames)
+		return;
+
+	for (unsigned i = 0; i < STATS_BUCKETS; i++) {
+		values[i] = stats_bucket_value(i);
+		intervals += stats.hist[i];
+		order[i] = i;
+	}
+	median = stats_percentile(values, stats.hist, STATS_BUCKETS, intervals, 0.5);
+	std::sort(order, order + STATS_BUCKETS, [&](unsigned a, unsigned b) {
+		return fabs(values[a] - median) < fabs(values[b] - median);
+	});
+	for (unsigned i = 0; i < STATS_BUCKETS; i++) {
+		dev[i] = fabs(values[order[i]] - median);
+		dev_counts[i] = stats.hist[order[i]];
+	}
+
+	fprintf(f, "{\"type\": \"%s\", \"frames\": %llu, \"duration_s\": %.6f",
+		type ? buftype2s(type).c_str() : "", (unsigned long long)stats.frames,
+		stats.last_ts - stats.first_ts);
+	fprintf(f, ", \"interval_us\": {\"count\": %llu", (unsigned long long)intervals);
+	if (intervals) {
+		fprintf(f, ", \"min\": %llu", (unsigned long long)stats.min_us);
+		for (unsigned i = 0; i < ARRAY_SIZE(fractions); i++)
+			fprintf(f, ", \"%s\": %.1f", fraction_names[i],
+				stats_percentile(values, stats.hist, STATS_BUCKETS,
+						 intervals, fractions[i]));
+		fprintf(f, ", \"max\": %llu", (unsigned long long)stats.max_us);
+	}
+	fprintf(f, "}, \"jitter_us\": {");
+	for (unsigned i = 0; intervals && i < ARRAY_SIZE(fractions); i++)
+		fprintf(f, "%s\"%s\": %.1f", i ? ", " : "", fraction_names[i],
+			stats_percentile(dev, dev_counts, STATS_BUCKETS,
+					 intervals, fractions[i]));
+	fprintf(f, "}, \"gaps\": {");
+	for (unsigned i = 0; i < STATS_NUM_FIELDS; i++)
+		fprintf(f, "%s\"%s\": {\"gaps\": %llu, \"lost\": %llu}", i ? ", " : "",
+			field_names[i], (unsigned long long)stats.gaps[i],
+			(unsigned long long)stats.lost[i]);
+	fprintf(f, "}, \"bursts\": {\"max\": %u", stats.max_burst);
+	for (unsigned i = 0; i < STATS_BURSTS; i++)
+		if (stats.bursts[i])
+			fprintf(f, ", \"%u-%u\": %llu", 1U << i, (2U << i) - 1,
+				(unsigned long long)stats.bursts[i]);
+	fprintf(f, "}, \"histogram_us\": [");
+	for (unsigned i = 0, cnt = 0; i < STATS_BUCKETS; i++)
+		if (stats.hist[i])
+			fprintf(f, "%s[%.1f, %llu]", cnt++ ? ", " : "", values[i],
+				(unsigned long long)stats.hist[i]);
+	fprintf(f, "]}\n");
+	fflush(f);
 }
 
 bool fps_timestamps::add_ts(double ts_secs, unsigned sequence, unsigned field)
@@ -152,6 +388,15 @@ bool fps_timestamps::add_ts(double ts_secs, unsigned sequence, unsigned field)
 	    field != V4L2_FIELD_TOP && field != V4L2_FIELD_BOTTOM)
 		return false;
 
+	if (stream_stats_file) {
+		if (stats.dump_gen != stream_stats_dump_gen)
+			dump_stats(stream_stats_file);
+		if (!stats.frames)
+			stats.first_ts = ts_secs;
+		stats.last_ts = ts_secs;
+		stats.frames++;
+	}
+
 	if (!full && idx == 0) {
 		ts[idx] = ts_secs;
 		seq[TS_WINDOW - 1] = sequence;
@@ -164,6 +409,7 @@ bool fps_timestamps::add_ts(double ts_secs, unsigned sequence, unsigned field)
 
 	unsigned prev_idx = (idx + TS_WINDOW - 1) % TS_WINDOW;
 	unsigned next_idx = (idx + 1) % TS_WINDOW;
+	unsigned prev_dropped = dropped_buffers;
 
 	if (seq[prev_idx] == sequence) {
 		if (alternate_fields) {
@@ -180,23 +426,35 @@ bool fps_timestamps::add_ts(double ts_secs, unsigned sequence, unsigned field)
 				dropped_buffers++;
 				last_field = last_field == V4L2_FIELD_TOP ?
 					V4L2_FIELD_BOTTOM : V4L2_FIELD_TOP;
+				if (stream_stats_file)
+					stats_add_gap(last_field == V4L2_FIELD_TOP ?
+						      STATS_TOP : STATS_BOTTOM, 1);
 			}
 			field_cnt = 1;
 			if (field == last_field) {
 				dropped_buffers++;
 				field_cnt++;
+				if (stream_stats_file)
+					stats_add_gap(field == V4L2_FIELD_TOP ?
+						      STATS_BOTTOM : STATS_TOP, 1);
 			}
 			last_field = field;
 		}
 		if (seq[prev_idx] - sequence > 1) {
 			unsigned dropped = sequence - seq[prev_idx] - 1;
 
+			if (stream_stats_file)
+				stats_add_gap(STATS_FRAME, dropped);
 			if (alternate_fields)
 				dropped *= 2;
 			dropped_buffers += dropped;
 		}
 	}
 
+	/* Intervals spanning dropped buffers would distort the jitter */
+	if (stream_stats_file && dropped_buffers == prev_dropped)
+		stats_add_interval(ts_secs - ts[prev_idx]);
+
 	if (!full) {
 		sum += ts_secs - ts[idx - 1];
 		ts[idx] = ts_secs;
@@ -244,6 +502,26 @@ double fps_timestamps::fps()
 	return fps;
 };
 
+/* The timestamp of the last buffer, 0 if there was none */
+double fps_timestamps::last_ts() const
+{
+	if (!full && idx == 0)
+		return 0;
+	return ts[(idx + TS_WINDOW - 1) % TS_WINDOW];
+}
+
+/* The average time between two sequence numbers, 0 if not known yet */
+double fps_timestamps::period() const
+{
+	unsigned prev_idx = (idx + TS_WINDOW - 1) % TS_WINDOW;
+	unsigned cnt;
+
+	if (!full && idx < 2)
+		return 0;
+	cnt = seq[prev_idx] - seq[full ? idx : 0];
+	return cnt ? sum / cnt : 0;
+}
+
 void streaming_usage()
 {
 	printf("\nVideo Streaming options:\n"
@@ -263,11 +541,108 @@ void streaming_usage()
 	       "                     and the --silent option is turned on automatically.\n"
 	       "  --stream-to-hdr <file> stream to this file. Same as --stream-to, but each\n"
 	       "                     frame is prefixed by a header. Use for compressed data.\n"
-	       "  --stream-to-host <hostname[:port]>\n"
+	       "  --stream-to-host <hostname[:port]>[,<hostname[:port]>...]\n"
                "                     stream to this host. The default port is %d.\n"
+	       "                     With several hosts each frame is compressed once and sent\n"
+	       "                     to all of them. A host that can't keep up skips frames\n"
+	       "                     (up to the next I-frame with lossy compression) instead\n"
+	       "                     of slowing down the capture.\n"
+	       "  --stream-to-queue <depth>\n"
+	       "                     write the buffers to the --stream-to(-hdr) file from a\n"
+	       "                     separate thread, with up to <depth> buffers waiting to be\n"
+	       "                     written. Buffers are requeued once they are written.\n"
+	       "                     With --stream-to-host the buffers are compressed by that\n"
+	       "                     thread and sent by another one.\n"
+	       "  --stream-direct    open the --stream-to(-hdr) file with O_DIRECT, bypassing\n"
+	       "                     the page cache.\n"
+	       "  --stream-slice-vbi slice the captured raw VBI and write the teletext, VPS,\n"
+	       "                     WSS and closed caption data to the --stream-to(-hdr) file\n"
+	       "                     as sliced VBI, i.e. as an array of v4l2_sliced_vbi_data\n"
+	       "                     structs per buffer, one for each captured line.\n"
+	       "  --stream-sdr-float <decim>[,<taps>]\n"
+	       "                     convert the captured SDR samples to float in [-1, 1)\n"
+	       "                     (interleaved I/Q for complex formats) and decimate them\n"
+	       "                     by <decim> before writing them to the --stream-to(-hdr)\n"
+	       "                     file. The decimation filter has <taps> taps, by default\n"
+	       "                     24 * <decim> + 1. A <decim> of 1 only converts.\n"
+	       "  --stream-sdr-spectrum <size>[,<avg>]\n"
+	       "                     compute <size> point FFTs of the captured SDR samples and\n"
+	       "                     print their average power in dB over every <avg> (default\n"
+	       "                     16) buffers as 'spectrum <n>: <bin> ...' to stdout, from\n"
+	       "                     the lowest to the highest frequency. This is done by a\n"
+	       "                     separate thread, which skips buffers if it can't keep up.\n"
+	       "  --stream-to-host-threads <threads>\n"
+	       "                     use <threads> threads to compress the frames streamed with\n"
+	       "                     --stream-to-host. The default is 1, 0 means one thread per\n"
+	       "                     online cpu. With more than one thread, lossy frames are\n"
+	       "                     sent in slices, which older receivers can't decode.\n"
+	       "  --stream-to-host-speed <speed>\n"
+	       "                     trade quality for speed when compressing the frames streamed\n"
+	       "                     with --stream-to-host: 0 (the default) compresses as usual,\n"
+	       "                     1 doesn't try intra coding for (nearly) unchanged blocks and\n"
+	       "                     2 also drops small changes.\n"
+	       "  --stream-to-host-udp\n"
+	       "                     send the --stream-to-host stream in UDP datagrams instead of\n"
+	       "                     over TCP. The hosts can be multicast groups. Receivers skip\n"
+	       "                     lost frames (up to the next I-frame with lossy compression)\n"
+	       "                     instead of stalling, and can join at any time.\n"
 	       "  --stream-lossless  always use lossless video compression.\n"
 #endif
-	       "  --stream-poll      use non-blocking mode and select() to stream.\n"
+	       "  --stream-poll      use non-blocking mode and epoll() to stream.\n"
+	       "  --stream-poll-timeout <ms>\n"
+	       "                     give up if no buffer or event arrives within <ms>\n"
+	       "                     milliseconds when polling. The default is 2000, -1 waits\n"
+	       "                     forever.\n"
+	       "  --stream-bench     for m2m devices: measure the time from queueing an OUTPUT\n"
+	       "                     buffer to dequeueing the CAPTURE buffer with the same\n"
+	       "                     (copied) timestamp. Every second the fps, latency and\n"
+	       "                     number of queued OUTPUT buffers are reported, at the end\n"
+	       "                     the p50/p99/max latency and the steady-state throughput.\n"
+	       "                     Combine with --stream-busy-poll for the lowest latency.\n"
+	       "  --stream-stats <file>\n"
+	       "                     keep long-run statistics of the buffer timestamps: a\n"
+	       "                     histogram of the frame intervals, the jitter percentiles,\n"
+	       "                     the sequence gaps per field and the dropped-frame bursts.\n"
+	       "                     They are written as one JSON object per line to\n"
+	       "                     <file> when streaming stops and on SIGUSR1.\n"
+	       "                     If <file> is '-', then the statistics go to stderr.\n"
+	       "  --stream-busy-poll busy-wait for buffers and events instead of sleeping in\n"
+	       "                     epoll_wait(). This uses a CPU core, but avoids the wakeup\n"
+	       "                     latency, e.g. when measuring the latency of m2m codecs.\n"
+	       "  --stream-devices <device>[,<device>...]\n"
+	       "                     capture from these devices as well, all serviced by the\n"
+	       "                     same epoll() loop. Every second the fps and dropped buffers\n"
+	       "                     of each device are reported, together with the skew of its\n"
+	       "                     buffer timestamps against those of the -d device.\n"
+	       "                     The captured data is discarded. If <device> starts with a\n"
+	       "                     digit, then /dev/video<device> is used.\n"
+	       "  --stream-meta <device>\n"
+	       "                     capture from the metadata node <device> together with the\n"
+	       "                     -d video node and match their buffers by sequence number.\n"
+	       "                     The metadata is decoded in place in the mmap()ed buffers.\n"
+	       "                     Every second the fps and dropped buffers are reported with\n"
+	       "                     the number of (un)matched buffers and, for UVC, the delay\n"
+	       "                     from the first payload to the video buffer timestamp. With\n"
+	       "                     --verbose the metadata of each matched frame is printed.\n"
+	       "                     If <device> starts with a digit, then /dev/video<device>\n"
+	       "                     is used.\n"
+	       "  --stream-dv-sweep <file>\n"
+	       "                     for all timings in <file>: set the timings, start streaming,\n"
+	       "                     capture --stream-count (default 30) frames and stop\n"
+	       "                     streaming, and report the lock time and fps of each timing.\n"
+	       "                     Each line of <file> uses the cvt/gtf syntax of\n"
+	       "                     --set-dv-bt-timings, where values can be lists that are\n"
+	       "                     all combined, e.g. cvt,width=1280:1920,height=720:1080,fps=50:60\n"
+	       "  --stream-chain <stage>[,<stage>...]\n"
+	       "                     pass the buffers captured with --stream-mmap through these\n"
+	       "                     m2m devices, in order. Each <stage> is\n"
+	       "                     <device>[:<width>x<height>[:<fourcc>]], the optional\n"
+	       "                     size and pixelformat set the CAPTURE format of the stage.\n"
+	       "                     The CAPTURE buffers of a stage are exported as DMABUFs and\n"
+	       "                     imported by the OUTPUT queue of the next stage, without\n"
+	       "                     any copying. Every second the fps of each stage and the\n"
+	       "                     latency of the frames through it are reported. The output\n"
+	       "                     of the last stage is discarded.\n"
 	       "  --stream-buf-caps  show capture buffer capabilities\n"
 	       "  --stream-mmap <count>\n"
 	       "                     capture video using mmap() [VIDIOC_(D)QBUF]\n"
@@ -280,6 +655,12 @@ void streaming_usage()
 	       "  --stream-from <file>\n"
 	       "                     stream from this file. The default is to generate a pattern.\n"
 	       "                     If <file> is '-', then the data is read from stdin.\n"
+	       "                     A regular file is mapped in memory. With --stream-out-user\n"
+	       "                     the frames are queued directly from that mapping.\n"
+	       "  --stream-from-preload <frames>\n"
+	       "                     read the first <frames> frames of the --stream-from file\n"
+	       "                     into memory (using huge pages if available) and keep\n"
+	       "                     looping over them without reading the file again.\n"
 	       "  --stream-from-hdr <file> stream from this file. Same as --stream-from, but each\n"
 	       "                     frame is prefixed by a header. Use for compressed data.\n"
 	       "  --stream-from-host <hostname[:port]>\n"
@@ -316,6 +697,16 @@ void streaming_usage()
 	       "                     and the range is [-3...3].\n"
 	       "  --stream-out-perc-fill <percentage>\n"
 	       "                     percentage of the frame to actually fill. The default is 100%%.\n"
+	       "  --stream-out-threads <threads>\n"
+	       "                     use <threads> threads to fill the test pattern of the output\n"
+	       "                     frames. The default is 1, 0 means one thread per online cpu.\n"
+	       "  --stream-out-cache <frames>\n"
+	       "                     keep up to <frames> generated test pattern frames around and\n"
+	       "                     copy those instead of generating them again. The default is 16,\n"
+	       "                     the maximum is 64 and 0 disables the cache.\n"
+	       "  --stream-out-prerender\n"
+	       "                     generate all frames of one period of the test pattern movement\n"
+	       "                     before streaming, so each frame takes the same time to produce.\n"
 	       "  --stream-out-buf-caps\n"
 	       "                     show output buffer capabilities\n"
 	       "  --stream-out-mmap <count>\n"
@@ -431,11 +822,268 @@ static int get_out_crop_rect(cv4l_fd &fd)
 	return 0;
 }
 
+/*
+ * --stream-bench: the time from the OUTPUT QBUF of a buffer to the CAPTURE
+ * DQBUF of the buffer that got its timestamp copied, for m2m devices.
+ */
+#define BENCH_MAX_INFLIGHT	64
+#define BENCH_REPORT_NS		1000000000ULL
+
+struct bench_frame {
+	__u64 ts;
+	__u64 queued;
+};
+
+static struct {
+	bool active;
+	/* The queued OUTPUT buffers whose timestamp wasn't seen on CAPTURE yet */
+	bench_frame inflight[BENCH_MAX_INFLIGHT];
+	unsigned num_inflight;
+	unsigned unmatched;
+	__u64 last_ts;
+	/* The number of OUTPUT buffers queued and dequeued */
+	unsigned out_queued;
+	unsigned out_dequeued;
+	std::vector<__u64> latencies;
+	__u64 first_dq;
+	__u64 last_dq;
+	__u64 occupancy_sum;
+	unsigned occupancy_max;
+	/* Since the last report */
+	__u64 period_start;
+	unsigned period_frames;
+	__u64 period_latency;
+	__u64 period_latency_max;
+	__u64 period_occupancy;
+	unsigned period_occupancy_max;
+} bench;
+
+static __u64 bench_now()
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/* Buffers queued within the same microsecond would get the same timestamp */
+static void bench_unique_ts(cv4l_buffer &buf)
+{
+	__u64 ts = buf.g_timestamp_ns();
+
+	if (ts <= bench.last_ts) {
+		struct timeval tv;
+
+		ts = bench.last_ts + 1000;
+		tv.tv_sec = ts / 1000000000ULL;
+		tv.tv_usec = (ts % 1000000000ULL) / 1000;
+		buf.s_timestamp(tv);
+	}
+	bench.last_ts = ts;
+}
+
+static void bench_out_queued(cv4l_buffer &buf)
+{
+	if (!bench.active)
+		return;
+
+	bench.out_queued++;
+	if (bench.num_inflight == BENCH_MAX_INFLIGHT) {
+		/* Never showed up on the CAPTURE queue, forget the oldest */
+		memmove(bench.inflight, bench.inflight + 1,
+			(BENCH_MAX_INFLIGHT - 1) * sizeof(bench.inflight[0]));
+		bench.num_inflight--;
+		bench.unmatched++;
+	}
+	bench.inflight[bench.num_inflight].ts = buf.g_timestamp_ns();
+	bench.inflight[bench.num_inflight++].queued = bench_now();
+}
+
+static void bench_out_dequeued()
+{
+	if (bench.active)
+		bench.out_dequeued++;
+}
+
+static void bench_cap_dequeued(cv4l_buffer &buf)
+{
+	__u64 ts = buf.g_timestamp_ns();
+	unsigned occupancy;
+	__u64 latency;
+	__u64 now;
+	unsigned i;
+
+	if (!bench.active)
+		return;
+
+	for (i = 0; i < bench.num_inflight; i++)
+		if (bench.inflight[i].ts == ts)
+			break;
+	if (i == bench.num_inflight)
+		return;
+
+	now = bench_now();
+	latency = now - bench.inflight[i].queued;
+	memmove(bench.inflight + i, bench.inflight + i + 1,
+		(bench.num_inflight - i - 1) * sizeof(bench.inflight[0]));
+	bench.num_inflight--;
+
+	occupancy = bench.out_queued - bench.out_dequeued;
+	bench.latencies.push_back(latency);
+	if (bench.latencies.size() == 1)
+		bench.first_dq = now;
+	bench.last_dq = now;
+	bench.occupancy_sum += occupancy;
+	if (occupancy > bench.occupancy_max)
+		bench.occupancy_max = occupancy;
+
+	if (!bench.period_frames)
+		bench.period_start = now;
+	bench.period_frames++;
+	bench.period_latency += latency;
+	if (latency > bench.period_latency_max)
+		bench.period_latency_max = latency;
+	bench.period_occupancy += occupancy;
+	if (occupancy > bench.period_occupancy_max)
+		bench.period_occupancy_max = occupancy;
+	if (now - bench.period_start < BENCH_REPORT_NS)
+		return;
+
+	fprintf(stderr, "\nbench: %.02f fps, latency avg %.3f ms max %.3f ms, "
+		"queued OUTPUT buffers avg %.1f max %u\n",
+		(bench.period_frames - 1) * 1e9 / (now - bench.period_start),
+		bench.period_latency / 1e6 / bench.period_frames,
+		bench.period_latency_max / 1e6,
+		static_cast<double>(bench.period_occupancy) / bench.period_frames,
+		bench.period_occupancy_max);
+	bench.period_frames = 0;
+	bench.period_latency = bench.period_latency_max = 0;
+	bench.period_occupancy = 0;
+	bench.period_occupancy_max = 0;
+}
+
+static void bench_report()
+{
+	std::vector<__u64> &lat = bench.latencies;
+	size_t n = lat.size();
+
+	if (!n) {
+		fprintf(stderr, "bench: no OUTPUT timestamp was copied to a CAPTURE buffer\n");
+		return;
+	}
+	std::sort(lat.begin(), lat.end());
+	fprintf(stderr, "bench: %zu frames, latency p50 %.3f ms p99 %.3f ms max %.3f ms\n",
+		n, lat[(n - 1) * 50 / 100] / 1e6, lat[(n - 1) * 99 / 100] / 1e6,
+		lat[n - 1] / 1e6);
+	fprintf(stderr, "bench: queued OUTPUT buffers avg %.1f max %u\n",
+		static_cast<double>(bench.occupancy_sum) / n, bench.occupancy_max);
+	if (n > 1 && bench.last_dq > bench.first_dq)
+		fprintf(stderr, "bench: steady-state throughput %.02f fps\n",
+			(n - 1) * 1e9 / (bench.last_dq - bench.first_dq));
+	if (bench.unmatched + bench.num_inflight)
+		fprintf(stderr, "bench: %u OUTPUT buffers without a matching CAPTURE buffer\n",
+			bench.unmatched + bench.num_inflight);
+}
+
 static void set_time_stamp(cv4l_buffer &buf)
 {
 	if ((buf.g_flags() & V4L2_BUF_FLAG_TIMESTAMP_MASK) != V4L2_BUF_FLAG_TIMESTAMP_COPY)
 		return;
 	buf.s_timestamp_clock();
+	if (bench.active)
+		bench_unique_ts(buf);
+}
+
+/*
+ * A regular --stream-from file is mapped in memory, so the frames are
+ * copied from (or, for USERPTR buffers, queued straight out of) the page
+ * cache instead of being read with stdio. The from_*() functions use the
+ * mapping if there is one and fall back to stdio otherwise.
+ *
+ * With --stream-from-preload the bytes of the first frames are recorded
+ * in an anonymous (huge page) arena, which then replaces the file as the
+ * mapping, see preload_frames().
+ */
+static struct {
+	const __u8 *data;
+	size_t size;
+	size_t pos;
+	size_t map_size;
+	/* The arena being filled by preload_frames() */
+	__u8 *record;
+	size_t record_size;
+	size_t record_alloc;
+	bool preloaded;
+} from_map;
+
+static void from_map_open(FILE *f)
+{
+	struct stat st;
+	void *p;
+
+	if (fstat(fileno(f), &st) || !S_ISREG(st.st_mode) || !st.st_size)
+		return;
+	p = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fileno(f), 0);
+	if (p == MAP_FAILED)
+		return;
+	madvise(p, st.st_size, MADV_SEQUENTIAL | MADV_WILLNEED);
+	from_map.data = static_cast<const __u8 *>(p);
+	from_map.size = from_map.map_size = st.st_size;
+	from_map.pos = 0;
+}
+
+static void from_map_close()
+{
+	if (from_map.data)
+		munmap(const_cast<__u8 *>(from_map.data), from_map.map_size);
+	if (from_map.record)
+		munmap(from_map.record, from_map.record_alloc);
+	memset(&from_map, 0, sizeof(from_map));
+}
+
+static void from_record(const void *ptr, size_t len)
+{
+	if (!from_map.record)
+		return;
+	if (len > from_map.record_alloc - from_map.record_size)
+		len = from_map.record_alloc - from_map.record_size;
+	memcpy(from_map.record + from_map.record_size, ptr, len);
+	from_map.record_size += len;
+}
+
+/* Returns a pointer to the next len bytes, or NULL if fewer are left */
+static const __u8 *from_map_ptr(size_t len)
+{
+	const __u8 *p;
+
+	if (!from_map.data || len > from_map.size - from_map.pos)
+		return NULL;
+	p = from_map.data + from_map.pos;
+	from_map.pos += len;
+	from_record(p, len);
+	return p;
+}
+
+static size_t from_read(void *ptr, size_t len, FILE *f)
+{
+	if (!from_map.data) {
+		len = fread(ptr, 1, len, f);
+	} else {
+		if (len > from_map.size - from_map.pos)
+			len = from_map.size - from_map.pos;
+		memcpy(ptr, from_map.data + from_map.pos, len);
+		from_map.pos += len;
+	}
+	from_record(ptr, len);
+	return len;
+}
+
+static void from_rewind(FILE *f)
+{
+	if (from_map.data)
+		from_map.pos = 0;
+	else
+		fseek(f, 0, SEEK_SET);
 }
 
 static __u32 read_u32(FILE *f)
@@ -447,10 +1095,13 @@ static __u32 read_u32(FILE *f)
 	return ntohl(v);
 }
 
-static void write_u32(FILE *f, __u32 v)
+static __u32 from_read_u32(FILE *f)
 {
-	v = htonl(v);
-	fwrite(&v, 1, sizeof(v), f);
+	__u32 v;
+
+	if (from_read(&v, sizeof(v), f) != sizeof(v))
+		return 0;
+	return ntohl(v);
 }
 
 static std::string timestamp_type2s(__u32 flags)
@@ -648,9 +1299,35 @@ void streaming_cmd(int ch, char *optarg)
 	case OptStreamNoQuery:
 		stream_no_query = true;
 		break;
+	case OptStreamDevices:
+		stream_devices = optarg;
+		break;
+	case OptStreamMeta:
+		stream_meta = optarg;
+		break;
+	case OptStreamDvSweep:
+		stream_dv_sweep = optarg;
+		break;
+	case OptStreamChain:
+		stream_chain = optarg;
+		break;
+	case OptStreamPollTimeout:
+		stream_poll_timeout = strtol(optarg, 0L, 0);
+		if (stream_poll_timeout < 0)
+			stream_poll_timeout = -1;
+		break;
+	case OptStreamBusyPoll:
+		stream_busy_poll = true;
+		break;
+	case OptStreamStats:
+		stream_stats_name = optarg;
+		break;
 	case OptStreamLoop:
 		stream_loop = true;
 		break;
+	case OptStreamFromPreload:
+		stream_from_preload = strtoul(optarg, 0L, 0);
+		break;
 	case OptStreamOutPattern:
 		stream_pat = strtoul(optarg, 0L, 0);
 		for (i = 0; tpg_pattern_strings[i]; i++) ;
@@ -734,6 +1411,65 @@ void streaming_cmd(int ch, char *optarg)
 	case OptStreamToHost:
 		host_to = optarg;
 		break;
+	case OptStreamToQueue:
+		stream_to_queue = strtoul(optarg, 0L, 0);
+		if (stream_to_queue > VIDEO_MAX_FRAME)
+			stream_to_queue = VIDEO_MAX_FRAME;
+		break;
+	case OptStreamDirect:
+		stream_direct = true;
+		break;
+	case OptStreamSliceVbi:
+		stream_slice_vbi = true;
+		break;
+	case OptStreamSdrFloat: {
+		char *end;
+
+		stream_sdr_decim = strtoul(optarg, &end, 0);
+		if (*end == ',')
+			stream_sdr_taps = strtoul(end + 1, 0L, 0);
+		if (!stream_sdr_decim)
+			stream_sdr_decim = 1;
+		break;
+	}
+	case OptStreamSdrSpectrum: {
+		char *end;
+
+		stream_sdr_fft = strtoul(optarg, &end, 0);
+		if (*end == ',')
+			stream_sdr_fft_avg = strtoul(end + 1, 0L, 0);
+		break;
+	}
+	case OptStreamOutCache:
+		stream_out_cache_frames = strtoul(optarg, 0L, 0);
+		if (stream_out_cache_frames > STREAM_OUT_CACHE_MAX_FRAMES)
+			stream_out_cache_frames = STREAM_OUT_CACHE_MAX_FRAMES;
+		break;
+	case OptStreamOutPrerender:
+		stream_out_prerender_frames = true;
+		break;
+	case OptStreamOutThreads:
+		stream_out_threads = strtoul(optarg, 0L, 0);
+		if (stream_out_threads == 0)
+			stream_out_threads = sysconf(_SC_NPROCESSORS_ONLN);
+		if (stream_out_threads > STREAM_MAX_THREADS)
+			stream_out_threads = STREAM_MAX_THREADS;
+		break;
+	case OptStreamToHostThreads:
+		host_threads_to = strtoul(optarg, 0L, 0);
+		if (host_threads_to == 0)
+			host_threads_to = sysconf(_SC_NPROCESSORS_ONLN);
+		if (host_threads_to > STREAM_MAX_THREADS)
+			host_threads_to = STREAM_MAX_THREADS;
+		break;
+	case OptStreamToHostSpeed:
+		host_speed_to = strtoul(optarg, 0L, 0);
+		if (host_speed_to > FWHT_SPEED_FASTEST)
+			host_speed_to = FWHT_SPEED_FASTEST;
+		break;
+	case OptStreamToHostUdp:
+		host_udp_to = true;
+		break;
 	case OptStreamLossless:
 		host_lossless = true;
 		break;
@@ -788,14 +1524,14 @@ static bool read_fwht_frame(cv4l_fmt &fmt, unsigned char *buf,
 	expected_len = sizeof(struct fwht_cframe_hdr);
 	if (expected_len > buf_len)
 		return false;
-	sz = fread(&last_fwht_hdr, 1, sizeof(struct fwht_cframe_hdr), fpointer);
+	sz = from_read(&last_fwht_hdr, sizeof(struct fwht_cframe_hdr), fpointer);
 	if (sz < sizeof(struct fwht_cframe_hdr))
 		return true;
 
 	expected_len = ntohl(last_fwht_hdr.size);
 	if (expected_len > buf_len)
 		return false;
-	sz = fread(buf, 1, ntohl(last_fwht_hdr.size), fpointer);
+	sz = from_read(buf, ntohl(last_fwht_hdr.size), fpointer);
 	return true;
 }
 
@@ -941,7 +1677,7 @@ static bool read_write_padded_frame(cv4l_fmt &fmt, unsigned char *buf,
 			unsigned int wsz = 0;
 
 			if (is_read)
-				wsz = fread(row_p, 1, consume_sz, fpointer);
+				wsz = from_read(row_p, consume_sz, fpointer);
 			else
 				wsz = fwrite(row_p, 1, consume_sz, fpointer);
 			if (wsz == 0 && i == 0 && plane_idx == 0)
@@ -1058,13 +1794,13 @@ restart:
 	if (from_with_hdr) {
 		__u32 v;
 
-		if (!fread(&v, sizeof(v), 1, fin)) {
+		if (from_read(&v, sizeof(v), fin) != sizeof(v)) {
 			if (first) {
 				fprintf(stderr, "Insufficient data\n");
 				return false;
 			}
 			if (stream_loop) {
-				fseek(fin, 0, SEEK_SET);
+				from_rewind(fin);
 				first = true;
 				goto restart;
 			}
@@ -1085,8 +1821,10 @@ restart:
 		bool res = true;
 
 		fd.g_fmt(fmt, q.g_type());
+		if (q.g_memory() == V4L2_MEMORY_USERPTR && from_map.data)
+			b.s_userptr(buf, j);
 		if (from_with_hdr) {
-			expected_len = read_u32(fin);
+			expected_len = from_read_u32(fin);
 			if (expected_len > q.g_length(j)) {
 				fprintf(stderr, "plane size is too large (%u > %u)\n",
 					expected_len, q.g_length(j));
@@ -1100,8 +1838,18 @@ restart:
 		else if (support_out_crop && v4l2_fwht_find_pixfmt(fmt.g_pixelformat()))
 			res = read_write_padded_frame(fmt, static_cast<unsigned char *>(buf),
 						      fin, sz, expected_len, buf_len, true);
-		else
-			sz = fread(buf, 1, expected_len, fin);
+		else if (q.g_memory() == V4L2_MEMORY_USERPTR &&
+			 from_map.size - from_map.pos >= buf_len) {
+			/*
+			 * Queue the frame straight from the mapping, it is
+			 * read-only for the device. The buffer length must fit
+			 * in the file, otherwise the frame is copied.
+			 */
+			b.s_userptr(const_cast<__u8 *>(from_map_ptr(expected_len)), j);
+			sz = expected_len;
+		} else {
+			sz = from_read(buf, expected_len, fin);
+		}
 
 		if (!res) {
 			fprintf(stderr, "amount intended to be read/written is larger than the buffer size\n");
@@ -1113,7 +1861,7 @@ restart:
 			return false;
 		}
 		if (j == 0 && sz == 0 && stream_loop) {
-			fseek(fin, 0, SEEK_SET);
+			from_rewind(fin);
 			first = true;
 			goto restart;
 		}
@@ -1129,99 +1877,498 @@ restart:
 	return true;
 }
 
-static int do_setup_out_buffers(cv4l_fd &fd, cv4l_queue &q, FILE *fin, bool qbuf,
-				bool ignore_count_skip)
-{
-	tpg_pixel_aspect aspect = TPG_PIXEL_ASPECT_SQUARE;
-	cv4l_fmt fmt(q.g_type());
-	u32 field;
-	unsigned p;
-	bool can_fill = false;
-	bool is_video = q.g_type() == V4L2_BUF_TYPE_VIDEO_OUTPUT ||
-			q.g_type() == V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE;
-	bool is_meta = q.g_type() == V4L2_BUF_TYPE_META_OUTPUT;
+/*
+ * --stream-from-preload: read the first stream_from_preload frames into
+ * memory, huge pages if possible, and cycle through them from then on
+ * without touching the file again. The frames are read with the normal
+ * fill_buffer_from_file() into the first buffer while their bytes are
+ * recorded, so all input formats are supported.
+ */
+#define PRELOAD_HUGE_PAGE_SIZE	(2 * 1024 * 1024)
 
-	if (q.obtain_bufs(&fd))
-		return QUEUE_ERROR;
+static bool preload_frames(cv4l_fd &fd, cv4l_queue &q, cv4l_fmt &fmt, FILE *fin)
+{
+	size_t frame_size = sizeof(struct fwht_cframe_hdr) + 4;
+	cv4l_buffer buf(q, 0);
+	bool old_loop = stream_loop;
+	bool huge = true;
+	unsigned frames;
+	size_t size;
+	void *p = MAP_FAILED;
 
-	fd.g_fmt(fmt, q.g_type());
-	{
-		cv4l_disable_trace dt(fd);
-		if (fd.g_std(stream_out_std)) {
-			struct v4l2_dv_timings timings;
+	if (host_fd_from >= 0) {
+		fprintf(stderr, "--stream-from-preload is not supported with --stream-from-host, ignored\n");
+		from_map.preloaded = true;
+		return true;
+	}
 
-			stream_out_std = 0;
-			if (fd.g_dv_timings(timings))
-				memset(&timings, 0, sizeof(timings));
-			else if (timings.bt.width == 720 && timings.bt.height == 480)
-				aspect = TPG_PIXEL_ASPECT_NTSC;
-			else if (timings.bt.width == 720 && timings.bt.height == 576)
-				aspect = TPG_PIXEL_ASPECT_PAL;
-		} else if (stream_out_std & V4L2_STD_525_60) {
-			aspect = TPG_PIXEL_ASPECT_NTSC;
-		} else if (stream_out_std & V4L2_STD_625_50) {
-			aspect = TPG_PIXEL_ASPECT_PAL;
+	/* The worst case, including the --stream-from-hdr headers */
+	for (unsigned j = 0; j < q.g_num_planes(); j++)
+		frame_size += q.g_length(j) + 4;
+	size = frame_size * stream_from_preload;
+	size = (size + PRELOAD_HUGE_PAGE_SIZE - 1) & ~(size_t)(PRELOAD_HUGE_PAGE_SIZE - 1);
+#ifdef MAP_HUGETLB
+	p = mmap(NULL, size, PROT_READ | PROT_WRITE,
+		 MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+#endif
+	if (p == MAP_FAILED) {
+		huge = false;
+		p = mmap(NULL, size, PROT_READ | PROT_WRITE,
+			 MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (p == MAP_FAILED) {
+			fprintf(stderr, "cannot allocate %zu bytes to preload %u frames\n",
+				size, stream_from_preload);
+			return false;
 		}
+#ifdef MADV_HUGEPAGE
+		madvise(p, size, MADV_HUGEPAGE);
+#endif
 	}
+	from_map.record = static_cast<__u8 *>(p);
+	from_map.record_alloc = size;
+	from_map.record_size = 0;
 
-	field = fmt.g_field();
-
-	output_field = field;
-	output_field_alt = field == V4L2_FIELD_ALTERNATE;
-	if (V4L2_FIELD_HAS_T_OR_B(field))
-		output_field = (stream_out_std & V4L2_STD_525_60) ?
-			V4L2_FIELD_BOTTOM : V4L2_FIELD_TOP;
+	/* Stop at the end of the file instead of recording it twice */
+	stream_loop = false;
+	for (frames = 0; frames < stream_from_preload; frames++) {
+		size_t recorded = from_map.record_size;
 
-	if (is_video) {
-		tpg_init(&tpg, 640, 360);
-		tpg_alloc(&tpg, fmt.g_width());
-		can_fill = tpg_s_fourcc(&tpg, fmt.g_pixelformat());
-		tpg_reset_source(&tpg, fmt.g_width(), fmt.g_frame_height(), field);
-		tpg_s_colorspace(&tpg, fmt.g_colorspace());
-		tpg_s_xfer_func(&tpg, fmt.g_xfer_func());
-		tpg_s_ycbcr_enc(&tpg, fmt.g_ycbcr_enc());
-		tpg_s_quantization(&tpg, fmt.g_quantization());
-		for (p = 0; p < fmt.g_num_planes(); p++)
-			tpg_s_bytesperline(&tpg, p,
-					   fmt.g_bytesperline(p));
-		tpg_s_pattern(&tpg, static_cast<tpg_pattern>(stream_pat));
-		tpg_s_mv_hor_mode(&tpg, stream_out_hor_mode);
-		tpg_s_mv_vert_mode(&tpg, stream_out_vert_mode);
-		tpg_s_show_square(&tpg, stream_out_square);
-		tpg_s_show_border(&tpg, stream_out_border);
-		tpg_s_insert_sav(&tpg, stream_out_sav);
-		tpg_s_insert_eav(&tpg, stream_out_eav);
-		tpg_s_perc_fill(&tpg, stream_out_perc_fill);
-		if (stream_out_rgb_lim_range)
-			tpg_s_real_rgb_range(&tpg, V4L2_DV_RGB_RANGE_LIMITED);
-		tpg_s_alpha_component(&tpg, stream_out_alpha);
-		tpg_s_alpha_mode(&tpg, stream_out_alpha_red_only);
-		tpg_s_video_aspect(&tpg, stream_out_video_aspect);
-		switch (stream_out_pixel_aspect) {
-		case -1:
-			tpg_s_pixel_aspect(&tpg, aspect);
-			break;
-		default:
-			tpg_s_pixel_aspect(&tpg, static_cast<tpg_pixel_aspect>(stream_out_pixel_aspect));
+		if (!fill_buffer_from_file(fd, q, buf, fmt, fin)) {
+			from_map.record_size = recorded;
 			break;
 		}
-		field = output_field;
-		if (can_fill && ((V4L2_FIELD_HAS_T_OR_B(field) && (stream_count & 1)) ||
-				 !tpg_pattern_is_static(&tpg)))
-			stream_out_refresh = true;
+	}
+	stream_loop = old_loop;
+	if (!frames) {
+		fprintf(stderr, "no frames to preload\n");
+		return false;
 	}
 
-	for (unsigned i = 0; i < q.g_buffers(); i++) {
-		cv4l_buffer buf(q);
+	/* The arena replaces the file */
+	if (from_map.data)
+		munmap(const_cast<__u8 *>(from_map.data), from_map.map_size);
+	from_map.data = from_map.record;
+	from_map.size = from_map.record_size;
+	from_map.map_size = from_map.record_alloc;
+	from_map.pos = 0;
+	from_map.record = NULL;
+	from_map.record_size = from_map.record_alloc = 0;
+	from_map.preloaded = true;
+	stream_loop = true;
+	fprintf(stderr, "preloaded %u frames (%zu bytes%s)\n", frames,
+		from_map.size, huge ? " in huge pages" : "");
+	return true;
+}
 
-		if (fd.querybuf(buf, i))
-			return QUEUE_ERROR;
+/*
+ * A pool of threads that run a number of jobs, used with
+ * --stream-to-host-threads to compress the frames in bands and with
+ * --stream-out-threads to fill the test pattern in bands. The calling
+ * thread takes jobs as well.
+ */
+struct stream_pool {
+	unsigned nthreads;
+	pthread_t threads[STREAM_MAX_THREADS];
+	pthread_mutex_t lock;
+	pthread_cond_t work_cond;
+	pthread_cond_t done_cond;
+	unsigned generation;
+	bool stop;
+	/* Current jobs */
+	void (*func)(void *arg, unsigned job);
+	void *arg;
+	unsigned jobs;
+	unsigned next_job;
+	unsigned done;
+};
 
-		buf.update(q, i);
-		for (unsigned j = 0; j < q.g_num_planes(); j++)
-			buf.s_bytesused(buf.g_length(j), j);
-		if (is_video) {
-			buf.s_field(field);
+/* Called with the lock held, returns with the lock held */
+static void stream_pool_do_jobs(stream_pool *p)
+{
+	while (p->next_job < p->jobs) {
+		unsigned job = p->next_job++;
+
+		pthread_mutex_unlock(&p->lock);
+		p->func(p->arg, job);
+		pthread_mutex_lock(&p->lock);
+		if (++p->done == p->jobs)
+			pthread_cond_signal(&p->done_cond);
+	}
+}
+
+static void *stream_pool_thread(void *arg)
+{
+	stream_pool *p = static_cast<stream_pool *>(arg);
+	unsigned generation = 0;
+
+	pthread_mutex_lock(&p->lock);
+	for (;;) {
+		while (generation == p->generation && !p->stop)
+			pthread_cond_wait(&p->work_cond, &p->lock);
+		if (p->stop)
+			break;
+		generation = p->generation;
+		stream_pool_do_jobs(p);
+	}
+	pthread_mutex_unlock(&p->lock);
+	return NULL;
+}
+
+static void stream_pool_destroy(stream_pool *p)
+{
+	pthread_mutex_lock(&p->lock);
+	p->stop = true;
+	pthread_cond_broadcast(&p->work_cond);
+	pthread_mutex_unlock(&p->lock);
+
+	for (unsigned i = 0; i < p->nthreads; i++)
+		pthread_join(p->threads[i], NULL);
+	pthread_cond_destroy(&p->done_cond);
+	pthread_cond_destroy(&p->work_cond);
+	pthread_mutex_destroy(&p->lock);
+	delete p;
+}
+
+/* Returns NULL if no threads could be started */
+static stream_pool *stream_pool_create(unsigned nthreads)
+{
+	stream_pool *p = new stream_pool();
+
+	pthread_mutex_init(&p->lock, NULL);
+	pthread_cond_init(&p->work_cond, NULL);
+	pthread_cond_init(&p->done_cond, NULL);
+	/* The calling thread is one of the threads */
+	while (p->nthreads < nthreads - 1 &&
+	       !pthread_create(&p->threads[p->nthreads], NULL,
+			       stream_pool_thread, p))
+		p->nthreads++;
+	if (!p->nthreads) {
+		stream_pool_destroy(p);
+		return NULL;
+	}
+	return p;
+}
+
+/* Run func for jobs 0 to jobs - 1 and wait until they are all done */
+static void stream_pool_run(stream_pool *p, unsigned jobs,
+			    void (*func)(void *arg, unsigned job), void *arg)
+{
+	if (!p || jobs < 2) {
+		for (unsigned job = 0; job < jobs; job++)
+			func(arg, job);
+		return;
+	}
+
+	pthread_mutex_lock(&p->lock);
+	p->func = func;
+	p->arg = arg;
+	p->jobs = jobs;
+	p->next_job = 0;
+	p->done = 0;
+	p->generation++;
+	pthread_cond_broadcast(&p->work_cond);
+	stream_pool_do_jobs(p);
+	while (p->done < p->jobs)
+		pthread_cond_wait(&p->done_cond, &p->lock);
+	pthread_mutex_unlock(&p->lock);
+}
+
+static stream_pool *stream_out_pool;
+
+static void stream_out_run_bands(void *priv, unsigned bands,
+				 void (*func)(void *arg, unsigned band), void *arg)
+{
+	stream_pool_run(static_cast<stream_pool *>(priv), bands, func, arg);
+}
+
+/*
+ * The output buffers are filled through their mapping, for DMABUF that
+ * access has to be bracketed by DMA_BUF_IOCTL_SYNC so the exporter can
+ * keep the caches coherent.
+ */
+static void stream_out_sync(cv4l_queue &q, unsigned index, bool end)
+{
+#ifdef DMA_BUF_IOCTL_SYNC
+	struct dma_buf_sync sync = {};
+
+	if (q.g_memory() != V4L2_MEMORY_DMABUF)
+		return;
+	sync.flags = DMA_BUF_SYNC_WRITE |
+		     (end ? DMA_BUF_SYNC_END : DMA_BUF_SYNC_START);
+	for (unsigned j = 0; j < q.g_num_planes(); j++)
+		ioctl(q.g_fd(index, j), DMA_BUF_IOCTL_SYNC, &sync);
+#endif
+}
+
+/*
+ * After the test pattern generator is set up, the only state that changes
+ * from one output frame to the next is the field and the movement of the
+ * pattern. Frames are cached by those values, so static patterns are only
+ * generated once and moving patterns once per position in the cache.
+ *
+ * With --stream-out-prerender all frames of one period of the movement
+ * are generated up front, so each frame costs the same: a copy.
+ */
+#define STREAM_OUT_CACHE_MAX_SIZE	(256 * 1024 * 1024)
+
+struct stream_out_frame {
+	unsigned field;
+	unsigned hor_old, hor_new;
+	unsigned vert_old, vert_new;
+	u8 *data;
+};
+
+/* All cached frames, frame_size bytes each, are stored in one arena */
+static struct {
+	u8 *arena;
+	unsigned frame_size;
+	stream_out_frame *frames;
+	unsigned max_frames;
+	unsigned num_frames;
+	unsigned next;
+	bool setup;
+} stream_out_cache;
+
+static void stream_out_cache_free()
+{
+	free(stream_out_cache.arena);
+	delete [] stream_out_cache.frames;
+	memset(&stream_out_cache, 0, sizeof(stream_out_cache));
+}
+
+static bool stream_out_cache_alloc(cv4l_queue &q, unsigned frames)
+{
+	unsigned frame_size = 0;
+
+	for (unsigned j = 0; j < q.g_num_planes(); j++)
+		frame_size += q.g_length(j);
+	if (!frame_size || !frames || frames > STREAM_OUT_CACHE_MAX_SIZE / frame_size)
+		return false;
+	stream_out_cache.arena = static_cast<u8 *>(malloc(frames * frame_size));
+	if (!stream_out_cache.arena)
+		return false;
+	stream_out_cache.frames = new stream_out_frame[frames];
+	stream_out_cache.frame_size = frame_size;
+	stream_out_cache.max_frames = frames;
+	return true;
+}
+
+static void stream_out_key(stream_out_frame &key)
+{
+	key.field = tpg.field;
+	key.hor_old = tpg.mv_hor_count % tpg.src_width;
+	key.hor_new = (tpg.mv_hor_count + tpg.mv_hor_step) % tpg.src_width;
+	key.vert_old = tpg.mv_vert_count % tpg.src_height;
+	key.vert_new = (tpg.mv_vert_count + tpg.mv_vert_step) % tpg.src_height;
+}
+
+static void stream_out_load(cv4l_queue &q, unsigned index, const u8 *data)
+{
+	for (unsigned j = 0; j < q.g_num_planes(); j++) {
+		memcpy(q.g_dataptr(index, j), data, q.g_length(j));
+		data += q.g_length(j);
+	}
+}
+
+static void stream_out_save(cv4l_queue &q, unsigned index, u8 *data)
+{
+	for (unsigned j = 0; j < q.g_num_planes(); j++) {
+		memcpy(data, q.g_dataptr(index, j), q.g_length(j));
+		data += q.g_length(j);
+	}
+}
+
+/* Generate all frames of one period of the pattern movement */
+static void stream_out_prerender(cv4l_queue &q, unsigned index)
+{
+	bool is_field = V4L2_FIELD_HAS_T_OR_B(tpg.field);
+	unsigned period = tpg_g_mv_period(&tpg, is_field);
+	int hor_count = tpg.mv_hor_count;
+	int vert_count = tpg.mv_vert_count;
+	unsigned field = tpg.field;
+
+	if (output_field_alt && (period & 1))
+		period *= 2;
+	if (!stream_out_cache_alloc(q, period)) {
+		fprintf(stderr, "cannot prerender %u frames, falling back to the frame cache\n",
+			period);
+		return;
+	}
+
+	for (unsigned i = 0; i < period; i++) {
+		stream_out_frame *f = &stream_out_cache.frames[i];
+
+		stream_out_key(*f);
+		f->data = stream_out_cache.arena + i * stream_out_cache.frame_size;
+		for (unsigned j = 0; j < q.g_num_planes(); j++)
+			tpg_fillbuffer(&tpg, stream_out_std, j,
+				       static_cast<u8 *>(q.g_dataptr(index, j)));
+		stream_out_save(q, index, f->data);
+		tpg_update_mv_count(&tpg, is_field);
+		if (output_field_alt)
+			tpg_s_field(&tpg, tpg.field == V4L2_FIELD_TOP ?
+				    V4L2_FIELD_BOTTOM : V4L2_FIELD_TOP, true);
+	}
+	stream_out_cache.num_frames = period;
+
+	tpg.mv_hor_count = hor_count;
+	tpg.mv_vert_count = vert_count;
+	tpg_s_field(&tpg, field, output_field_alt);
+}
+
+static void stream_out_fill(cv4l_queue &q, unsigned index)
+{
+	stream_out_frame key;
+	unsigned i;
+
+	/* Noise is different for every frame */
+	bool cacheable = tpg.pattern != TPG_PAT_NOISE && tpg.qual != TPG_QUAL_NOISE;
+
+	if (cacheable && !stream_out_cache.setup) {
+		stream_out_cache.setup = true;
+		if (stream_out_prerender_frames)
+			stream_out_prerender(q, index);
+		if (!stream_out_cache.arena && stream_out_cache_frames) {
+			unsigned frames = stream_out_cache_frames;
+
+			/* Cache as many frames as fit */
+			while (frames && !stream_out_cache_alloc(q, frames))
+				frames /= 2;
+		}
+	}
+
+	stream_out_key(key);
+
+	/* Frames are usually requested in the order they were cached */
+	for (i = 0; i < stream_out_cache.num_frames; i++) {
+		unsigned idx = (stream_out_cache.next + i) % stream_out_cache.num_frames;
+		stream_out_frame *f = &stream_out_cache.frames[idx];
+
+		if (f->field != key.field ||
+		    f->hor_old != key.hor_old || f->hor_new != key.hor_new ||
+		    f->vert_old != key.vert_old || f->vert_new != key.vert_new)
+			continue;
+		stream_out_load(q, index, f->data);
+		stream_out_cache.next = idx + 1;
+		return;
+	}
+
+	for (unsigned j = 0; j < q.g_num_planes(); j++)
+		tpg_fillbuffer(&tpg, stream_out_std, j,
+			       static_cast<u8 *>(q.g_dataptr(index, j)));
+
+	if (!cacheable || stream_out_cache.num_frames >= stream_out_cache.max_frames)
+		return;
+	key.data = stream_out_cache.arena +
+		   stream_out_cache.num_frames * stream_out_cache.frame_size;
+	stream_out_save(q, index, key.data);
+	stream_out_cache.frames[stream_out_cache.num_frames++] = key;
+}
+
+static int do_setup_out_buffers(cv4l_fd &fd, cv4l_queue &q, FILE *fin, bool qbuf,
+				bool ignore_count_skip)
+{
+	tpg_pixel_aspect aspect = TPG_PIXEL_ASPECT_SQUARE;
+	cv4l_fmt fmt(q.g_type());
+	u32 field;
+	unsigned p;
+	bool can_fill = false;
+	bool is_video = q.g_type() == V4L2_BUF_TYPE_VIDEO_OUTPUT ||
+			q.g_type() == V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE;
+	bool is_meta = q.g_type() == V4L2_BUF_TYPE_META_OUTPUT;
+
+	if (q.obtain_bufs(&fd))
+		return QUEUE_ERROR;
+
+	fd.g_fmt(fmt, q.g_type());
+	{
+		cv4l_disable_trace dt(fd);
+		if (fd.g_std(stream_out_std)) {
+			struct v4l2_dv_timings timings;
+
+			stream_out_std = 0;
+			if (fd.g_dv_timings(timings))
+				memset(&timings, 0, sizeof(timings));
+			else if (timings.bt.width == 720 && timings.bt.height == 480)
+				aspect = TPG_PIXEL_ASPECT_NTSC;
+			else if (timings.bt.width == 720 && timings.bt.height == 576)
+				aspect = TPG_PIXEL_ASPECT_PAL;
+		} else if (stream_out_std & V4L2_STD_525_60) {
+			aspect = TPG_PIXEL_ASPECT_NTSC;
+		} else if (stream_out_std & V4L2_STD_625_50) {
+			aspect = TPG_PIXEL_ASPECT_PAL;
+		}
+	}
+
+	field = fmt.g_field();
+
+	output_field = field;
+	output_field_alt = field == V4L2_FIELD_ALTERNATE;
+	if (V4L2_FIELD_HAS_T_OR_B(field))
+		output_field = (stream_out_std & V4L2_STD_525_60) ?
+			V4L2_FIELD_BOTTOM : V4L2_FIELD_TOP;
+
+	if (fin && stream_from_preload && !from_map.preloaded &&
+	    !preload_frames(fd, q, fmt, fin))
+		return QUEUE_ERROR;
+
+	if (is_video) {
+		stream_out_cache_free();
+		tpg_init(&tpg, 640, 360);
+		tpg_alloc(&tpg, fmt.g_width());
+		if (stream_out_threads > 1 && !stream_out_pool)
+			stream_out_pool = stream_pool_create(stream_out_threads);
+		if (stream_out_pool)
+			tpg_s_band_runner(&tpg, stream_out_threads,
+					  stream_out_run_bands, stream_out_pool);
+		can_fill = tpg_s_fourcc(&tpg, fmt.g_pixelformat());
+		tpg_reset_source(&tpg, fmt.g_width(), fmt.g_frame_height(), field);
+		tpg_s_colorspace(&tpg, fmt.g_colorspace());
+		tpg_s_xfer_func(&tpg, fmt.g_xfer_func());
+		tpg_s_ycbcr_enc(&tpg, fmt.g_ycbcr_enc());
+		tpg_s_quantization(&tpg, fmt.g_quantization());
+		for (p = 0; p < fmt.g_num_planes(); p++)
+			tpg_s_bytesperline(&tpg, p,
+					   fmt.g_bytesperline(p));
+		tpg_s_pattern(&tpg, static_cast<tpg_pattern>(stream_pat));
+		tpg_s_mv_hor_mode(&tpg, stream_out_hor_mode);
+		tpg_s_mv_vert_mode(&tpg, stream_out_vert_mode);
+		tpg_s_show_square(&tpg, stream_out_square);
+		tpg_s_show_border(&tpg, stream_out_border);
+		tpg_s_insert_sav(&tpg, stream_out_sav);
+		tpg_s_insert_eav(&tpg, stream_out_eav);
+		tpg_s_perc_fill(&tpg, stream_out_perc_fill);
+		if (stream_out_rgb_lim_range)
+			tpg_s_real_rgb_range(&tpg, V4L2_DV_RGB_RANGE_LIMITED);
+		tpg_s_alpha_component(&tpg, stream_out_alpha);
+		tpg_s_alpha_mode(&tpg, stream_out_alpha_red_only);
+		tpg_s_video_aspect(&tpg, stream_out_video_aspect);
+		switch (stream_out_pixel_aspect) {
+		case -1:
+			tpg_s_pixel_aspect(&tpg, aspect);
+			break;
+		default:
+			tpg_s_pixel_aspect(&tpg, static_cast<tpg_pixel_aspect>(stream_out_pixel_aspect));
+			break;
+		}
+		field = output_field;
+		if (can_fill && ((V4L2_FIELD_HAS_T_OR_B(field) && (stream_count & 1)) ||
+				 !tpg_pattern_is_static(&tpg)))
+			stream_out_refresh = true;
+	}
+
+	for (unsigned i = 0; i < q.g_buffers(); i++) {
+		cv4l_buffer buf(q);
+
+		if (fd.querybuf(buf, i))
+			return QUEUE_ERROR;
+
+		buf.update(q, i);
+		for (unsigned j = 0; j < q.g_num_planes(); j++)
+			buf.s_bytesused(buf.g_length(j), j);
+		stream_out_sync(q, i, false);
+		if (is_video) {
+			buf.s_field(field);
 			tpg_s_field(&tpg, field, output_field_alt);
 			if (output_field_alt) {
 				if (field == V4L2_FIELD_TOP)
@@ -1230,15 +2377,16 @@ static int do_setup_out_buffers(cv4l_fd &fd, cv4l_queue &q, FILE *fin, bool qbuf
 					field = V4L2_FIELD_TOP;
 			}
 
-			if (can_fill) {
-				for (unsigned j = 0; j < q.g_num_planes(); j++)
-					tpg_fillbuffer(&tpg, stream_out_std, j, static_cast<u8 *>(q.g_dataptr(i, j)));
-			}
+			if (can_fill)
+				stream_out_fill(q, i);
 		}
 		if (is_meta)
 			meta_fillbuffer(buf, fmt, q);
 
-		if (fin && !fill_buffer_from_file(fd, q, buf, fmt, fin))
+		bool filled = !fin || fill_buffer_from_file(fd, q, buf, fmt, fin);
+
+		stream_out_sync(q, i, true);
+		if (!filled)
 			return QUEUE_STOPPED;
 
 		if (fmt.g_pixelformat() == V4L2_PIX_FMT_FWHT_STATELESS) {
@@ -1267,6 +2415,7 @@ static int do_setup_out_buffers(cv4l_fd &fd, cv4l_queue &q, FILE *fin, bool qbuf
 			set_time_stamp(buf);
 			if (fd.qbuf(buf))
 				return QUEUE_ERROR;
+			bench_out_queued(buf);
 			tpg_update_mv_count(&tpg, V4L2_FIELD_HAS_T_OR_B(field));
 			if (!verbose)
 				fprintf(stderr, ">");
@@ -1291,609 +2440,2701 @@ static int do_setup_out_buffers(cv4l_fd &fd, cv4l_queue &q, FILE *fin, bool qbuf
 	return 0;
 }
 
-static void write_buffer_to_file(cv4l_fd &fd, cv4l_queue &q, cv4l_buffer &buf,
-				 cv4l_fmt &fmt, FILE *fout)
-{
 #ifndef NO_STREAM_TO
-	unsigned comp_size[VIDEO_MAX_PLANES];
-	__u8 *comp_ptr[VIDEO_MAX_PLANES];
+/*
+ * With --stream-direct the --stream-to file is written with O_DIRECT. That
+ * requires the memory address, file offset and length of every write to be
+ * block aligned. Plane data is written straight from the capture buffer as
+ * long as that is the case, everything else (headers, plane data following
+ * an unaligned amount of data) goes through an aligned bounce buffer.
+ */
+#define DIRECT_ALIGN		4096
+#define DIRECT_BOUNCE_SIZE	(4 * 1024 * 1024)
 
-	if (host_fd_to >= 0) {
-		unsigned tot_comp_size = 0;
-		unsigned tot_used = 0;
+struct direct_output {
+	int fd;
+	unsigned char *bounce;
+	size_t used;		/* Bytes in the bounce buffer */
+	off_t size;		/* Size of the file */
+	bool error;
+};
 
-		for (unsigned j = 0; j < buf.g_num_planes(); j++) {
-			__u32 used = buf.g_bytesused(j);
-			unsigned offset = buf.g_data_offset(j);
-			u8 *p = static_cast<u8 *>(q.g_dataptr(buf.g_index(), j)) + offset;
+static direct_output *direct_out;
 
-			if (ctx) {
-				comp_ptr[j] = fwht_compress(ctx, p,
-							    used - offset, &comp_size[j]);
-			} else {
-				comp_ptr[j] = p;
-				comp_size[j] = rle_compress(p, used - offset,
-							    bpl_cap[j]);
-			}
-			tot_comp_size += comp_size[j];
-			tot_used += used - offset;
-		}
-		write_u32(fout, ctx ? V4L_STREAM_PACKET_FRAME_VIDEO_FWHT :
-				V4L_STREAM_PACKET_FRAME_VIDEO_RLE);
-		write_u32(fout, V4L_STREAM_PACKET_FRAME_VIDEO_SIZE(buf.g_num_planes()) + tot_comp_size);
-		write_u32(fout, V4L_STREAM_PACKET_FRAME_VIDEO_SIZE_HDR);
-		write_u32(fout, buf.g_field());
-		write_u32(fout, buf.g_flags());
-		comp_perc += (tot_comp_size * 100 / tot_used);
-		comp_perc_count++;
-	}
-	if (to_with_hdr)
-		write_u32(fout, FILE_HDR_ID);
-	for (unsigned j = 0; j < buf.g_num_planes(); j++) {
-		__u32 used = buf.g_bytesused(j);
-		unsigned offset = buf.g_data_offset(j);
-		unsigned sz;
+static void direct_output_write_all(direct_output *d, const unsigned char *p,
+				    size_t len)
+{
+	while (len && !d->error) {
+		ssize_t ret = write(d->fd, p, len);
 
-		if (offset > used) {
-			// Should never happen
-			fprintf(stderr, "offset %d > used %d!\n",
-				offset, used);
-			offset = 0;
-		}
-		used -= offset;
-		if (host_fd_to >= 0) {
-			write_u32(fout, V4L_STREAM_PACKET_FRAME_VIDEO_SIZE_PLANE_HDR);
-			write_u32(fout, used);
-			write_u32(fout, comp_size[j]);
-			used = comp_size[j];
-		} else if (to_with_hdr) {
-			write_u32(fout, used);
+		if (ret < 0 && errno == EINTR)
+			continue;
+		if (ret <= 0) {
+			fprintf(stderr, "O_DIRECT write error: %s\n", strerror(errno));
+			d->error = true;
+			return;
 		}
-		if (host_fd_to >= 0)
-			sz = fwrite(comp_ptr[j] + offset, 1, used, fout);
-		else if (support_cap_compose && v4l2_fwht_find_pixfmt(fmt.g_pixelformat()))
-			read_write_padded_frame(fmt, static_cast<u8 *>(q.g_dataptr(buf.g_index(), j)) + offset,
-						fout, sz, used, used, false);
-		else
-			sz = fwrite(static_cast<u8 *>(q.g_dataptr(buf.g_index(), j)) + offset, 1, used, fout);
-
-		if (sz != used)
-			fprintf(stderr, "%u != %u\n", sz, used);
+		p += ret;
+		len -= ret;
 	}
-	if (host_fd_to >= 0)
-		fflush(fout);
-#endif
 }
 
-static int do_handle_cap(cv4l_fd &fd, cv4l_queue &q, FILE *fout, int *index,
-			 unsigned &count, fps_timestamps &fps_ts, cv4l_fmt &fmt,
-			 bool ignore_count_skip)
+static void direct_output_write(direct_output *d, const void *data, size_t len)
 {
-	char ch = '<';
-	int ret;
-	cv4l_buffer buf(q);
+	const unsigned char *p = static_cast<const unsigned char *>(data);
 
-	for (;;) {
-		ret = fd.dqbuf(buf);
-		if (ret == EAGAIN)
-			return 0;
-		if (ret == EPIPE)
-			return QUEUE_STOPPED;
-		if (ret) {
-			fprintf(stderr, "%s: failed: %s\n", "VIDIOC_DQBUF", strerror(errno));
-			return QUEUE_ERROR;
-		}
-		if (buf.g_flags() & V4L2_BUF_FLAG_LAST) {
-			last_buffer = true;
-			break;
+	d->size += len;
+	while (len) {
+		size_t n;
+
+		if (!d->used && len >= DIRECT_ALIGN &&
+		    !(reinterpret_cast<uintptr_t>(p) % DIRECT_ALIGN)) {
+			n = len & ~static_cast<size_t>(DIRECT_ALIGN - 1);
+			direct_output_write_all(d, p, n);
+		} else {
+			n = DIRECT_BOUNCE_SIZE - d->used;
+			if (n > len)
+				n = len;
+			memcpy(d->bounce + d->used, p, n);
+			d->used += n;
+			if (d->used == DIRECT_BOUNCE_SIZE) {
+				direct_output_write_all(d, d->bounce, d->used);
+				d->used = 0;
+			}
 		}
-		if (!(buf.g_flags() & V4L2_BUF_FLAG_ERROR))
-			break;
-		if (verbose)
-			print_concise_buffer(stderr, buf, fmt, q, fps_ts, -1);
-		if (fd.qbuf(buf))
-			return QUEUE_ERROR;
+		p += n;
+		len -= n;
 	}
+}
 
-	bool is_empty_frame = !buf.g_bytesused(0);
-	bool is_error_frame = buf.g_flags() & V4L2_BUF_FLAG_ERROR;
-
-	double ts_secs = buf.g_timestamp().tv_sec + buf.g_timestamp().tv_usec / 1000000.0;
-	fps_ts.add_ts(ts_secs, buf.g_sequence(), buf.g_field());
+static void direct_output_write_u32(direct_output *d, __u32 v)
+{
+	v = htonl(v);
+	direct_output_write(d, &v, sizeof(v));
+}
 
-	if (fout && (!stream_skip || ignore_count_skip) &&
-	    !is_empty_frame && !is_error_frame)
-		write_buffer_to_file(fd, q, buf, fmt, fout);
+/* Returns NULL if the file system doesn't support O_DIRECT */
+static direct_output *direct_output_open(const char *name)
+{
+	direct_output *d;
+	void *bounce;
+	int fd;
 
-	if (buf.g_flags() & V4L2_BUF_FLAG_KEYFRAME)
-		ch = 'K';
-	else if (buf.g_flags() & V4L2_BUF_FLAG_PFRAME)
-		ch = 'P';
-	else if (buf.g_flags() & V4L2_BUF_FLAG_BFRAME)
-		ch = 'B';
-	if (verbose) {
-		print_concise_buffer(stderr, buf, fmt, q, fps_ts,
-				     host_fd_to >= 0 ? 100 - comp_perc / comp_perc_count : -1);
-		comp_perc_count = comp_perc = 0;
-	}
-	if (!last_buffer && index == NULL) {
-		/*
-		 * EINVAL in qbuf can happen if this is the last buffer before
-		 * a dynamic resolution change sequence. In this case the buffer
-		 * has the size that fits the old resolution and might not
-		 * fit to the new one.
-		 */
-		if (fd.qbuf(buf) && errno != EINVAL) {
-			fprintf(stderr, "%s: qbuf error\n", __func__);
-			return QUEUE_ERROR;
-		}
+	fd = open(name, O_WRONLY | O_CREAT | O_TRUNC | O_DIRECT, 0666);
+	if (fd < 0)
+		return NULL;
+	if (posix_memalign(&bounce, DIRECT_ALIGN, DIRECT_BOUNCE_SIZE)) {
+		close(fd);
+		return NULL;
 	}
-	if (index)
-		*index = buf.g_index();
-
-	if (!verbose) {
-		fprintf(stderr, "%c", ch);
-		fflush(stderr);
+	d = new direct_output();
+	d->fd = fd;
+	d->bounce = static_cast<unsigned char *>(bounce);
+	return d;
+}
 
-		if (fps_ts.has_fps()) {
-			unsigned dropped = fps_ts.dropped();
+/*
+ * The last block is written padded to DIRECT_ALIGN, and the file truncated
+ * to its real size. The fd itself is closed by the FILE it is attached to.
+ */
+static void direct_output_close(direct_output *d)
+{
+	if (d->used) {
+		size_t len = (d->used + DIRECT_ALIGN - 1) & ~static_cast<size_t>(DIRECT_ALIGN - 1);
 
-			fprintf(stderr, " %.02f fps", fps_ts.fps());
-			if (dropped)
-				fprintf(stderr, ", dropped buffers: %u", dropped);
-			if (host_fd_to >= 0)
-				fprintf(stderr, " %d%% compression", 100 - comp_perc / comp_perc_count);
-			comp_perc_count = comp_perc = 0;
-			fprintf(stderr, "\n");
-		}
+		memset(d->bounce + d->used, 0, len - d->used);
+		direct_output_write_all(d, d->bounce, len);
 	}
-	count++;
+	if (ftruncate(d->fd, d->size))
+		fprintf(stderr, "could not truncate the output file: %s\n", strerror(errno));
+	free(d->bounce);
+	delete d;
+}
+#endif
 
-	if (ignore_count_skip)
-		return 0;
+#ifndef NO_STREAM_TO
+static stream_pool *host_pool;
 
-	if (stream_sleep > 0 && count % stream_sleep == 0)
-		sleep(1);
+/*
+ * The RLE compression is done out of place, so the captured buffer isn't
+ * modified. Each plane is split in up to host_threads_to bands of whole
+ * lines, which are compressed independently and written one after the other.
+ */
 
-	if (is_empty_frame || is_error_frame)
-		return 0;
+/* Don't bother splitting a plane in bands smaller than this */
+#define RLE_MIN_BAND_SIZE	(64 * 1024)
 
-	if (stream_skip) {
-		stream_skip--;
-		return 0;
-	}
+struct rle_band {
+	const u8 *src;
+	u8 *dst;
+	unsigned size;
+	unsigned bpl;
+	unsigned comp_size;
+};
 
-	if (stream_count == 0)
-		return 0;
+static rle_band rle_bands[VIDEO_MAX_PLANES][STREAM_MAX_THREADS];
+static unsigned rle_num_bands[VIDEO_MAX_PLANES];
+/* The bands of all planes of the current frame */
+static rle_band *rle_jobs[VIDEO_MAX_PLANES * STREAM_MAX_THREADS];
+static unsigned rle_num_jobs;
+static u8 *rle_buf[VIDEO_MAX_PLANES];
+static unsigned rle_buf_size[VIDEO_MAX_PLANES];
 
-	if (--stream_count == 0)
-		return QUEUE_STOPPED;
+static void rle_band_job(void *arg, unsigned job)
+{
+	rle_band *band = rle_jobs[job];
 
-	return 0;
+	band->comp_size = rle_compress_band(band->src, band->dst,
+					    band->size, band->bpl);
 }
 
-static int do_handle_out(cv4l_fd &fd, cv4l_queue &q, FILE *fin, cv4l_buffer *cap,
-			 unsigned &count, fps_timestamps &fps_ts, cv4l_fmt fmt,
-			 bool stopped, bool ignore_count_skip)
+/* Adds the bands of the plane to rle_jobs, if it can be compressed at all */
+static void rle_setup_plane(unsigned plane, const u8 *p, unsigned size)
 {
-	cv4l_buffer buf(q);
-	bool is_meta = q.g_type() == V4L2_BUF_TYPE_META_OUTPUT;
-	int ret = 0;
-
-	if (cap) {
-		buf.s_index(cap->g_index());
-
-		for (unsigned j = 0; j < buf.g_num_planes(); j++) {
-			unsigned data_offset = cap->g_data_offset(j);
-
-			if (q.g_memory() == V4L2_MEMORY_USERPTR) {
-				buf.s_userptr(static_cast<u8 *>(cap->g_userptr(j)) + data_offset, j);
-				buf.s_bytesused(cap->g_bytesused(j) - data_offset, j);
-				buf.s_data_offset(0, j);
-			} else if (q.g_memory() == V4L2_MEMORY_DMABUF) {
-				buf.s_bytesused(cap->g_bytesused(j), j);
-				buf.s_data_offset(data_offset, j);
-			}
-		}
-	} else {
-		ret = fd.dqbuf(buf);
-		if (ret == EAGAIN)
-			return 0;
-
-		double ts_secs = buf.g_timestamp().tv_sec + buf.g_timestamp().tv_usec / 1000000.0;
-		fps_ts.add_ts(ts_secs, buf.g_sequence(), buf.g_field());
-		if (verbose)
-			print_concise_buffer(stderr, buf, fmt, q, fps_ts, -1);
+	unsigned bpl = bpl_cap[plane];
+	unsigned unit = (bpl && !(bpl & 3)) ? bpl : 4;
+	unsigned bands = size / RLE_MIN_BAND_SIZE;
+	unsigned band_size;
 
-		for (unsigned j = 0; j < buf.g_num_planes(); j++)
-			buf.s_bytesused(buf.g_length(j), j);
-	}
-	if (ret) {
-		fprintf(stderr, "%s: failed: %s\n", "VIDIOC_DQBUF", strerror(ret));
-		return QUEUE_ERROR;
+	rle_num_bands[plane] = 0;
+	if ((reinterpret_cast<unsigned long>(p) & 3) || (size & 3) || !size)
+		return;
+	if (rle_buf_size[plane] < size) {
+		free(rle_buf[plane]);
+		rle_buf_size[plane] = 0;
+		if (posix_memalign(reinterpret_cast<void **>(&rle_buf[plane]), 64, size))
+			return;
+		rle_buf_size[plane] = size;
 	}
-	if (fps_ts.has_fps()) {
-		unsigned dropped = fps_ts.dropped();
 
-		fprintf(stderr, " %.02f fps", fps_ts.fps());
-		if (dropped)
-			fprintf(stderr, ", dropped buffers: %u", dropped);
-		fprintf(stderr, "\n");
+	if (bands > host_threads_to)
+		bands = host_threads_to;
+	if (bands < 1)
+		bands = 1;
+	band_size = (size / unit + bands - 1) / bands * unit;
+	if (!band_size)
+		band_size = size;
+	for (unsigned offset = 0; offset < size; offset += band_size) {
+		rle_band *band = &rle_bands[plane][rle_num_bands[plane]++];
+
+		/* The last band also gets any partial line at the end */
+		if (rle_num_bands[plane] == bands || size - offset < band_size)
+			band_size = size - offset;
+		band->src = p + offset;
+		band->dst = rle_buf[plane] + offset;
+		band->size = band_size;
+		band->bpl = bpl;
+		rle_jobs[rle_num_jobs++] = band;
 	}
-	if (stopped)
-		return 0;
+}
 
-	buf.s_field(output_field);
-	tpg_s_field(&tpg, output_field, output_field_alt);
-	if (output_field_alt) {
-		if (output_field == V4L2_FIELD_TOP)
-			output_field = V4L2_FIELD_BOTTOM;
-		else if (output_field == V4L2_FIELD_BOTTOM)
-			output_field = V4L2_FIELD_TOP;
-	}
+static unsigned rle_plane_size(unsigned plane)
+{
+	unsigned comp_size = 0;
 
-	if (fin && !fill_buffer_from_file(fd, q, buf, fmt, fin))
-		return QUEUE_STOPPED;
+	for (unsigned i = 0; i < rle_num_bands[plane]; i++)
+		comp_size += rle_bands[plane][i].comp_size;
+	return comp_size;
+}
 
-	if (!fin && stream_out_refresh) {
-		for (unsigned j = 0; j < buf.g_num_planes(); j++)
-			tpg_fillbuffer(&tpg, stream_out_std, j,
-				       static_cast<u8 *>(q.g_dataptr(buf.g_index(), j)));
-	}
-	if (is_meta)
-		meta_fillbuffer(buf, fmt, q);
+#ifndef MSG_MORE
+#define MSG_MORE 0
+#endif
 
-	if (fmt.g_pixelformat() == V4L2_PIX_FMT_FWHT_STATELESS) {
-		if (ioctl(buf.g_request_fd(), MEDIA_REQUEST_IOC_REINIT, NULL)) {
-			fprintf(stderr, "Unable to reinit media request: %s\n",
-				strerror(errno));
-			return QUEUE_ERROR;
+/*
+ * Frames for --stream-to-host are sent with a single sendmsg() each. The
+ * packet and plane headers are collected in words[], the plane data is
+ * referenced where it was compressed, so nothing is copied. Sized for the
+ * FMT_VIDEO packet and for FRAME_VIDEO packets with each plane in
+ * STREAM_MAX_THREADS RLE bands.
+ */
+#define HOST_IOV_WORDS	(4 + V4L_STREAM_PACKET_FMT_VIDEO_SIZE(VIDEO_MAX_PLANES) / 4)
+#define HOST_IOV_MAX	(1 + VIDEO_MAX_PLANES * (1 + STREAM_MAX_THREADS))
+
+struct host_iov {
+	struct iovec iov[HOST_IOV_MAX];
+	unsigned cnt;
+	__u32 words[HOST_IOV_WORDS];
+	unsigned num_words;
+};
+
+/*
+ * Send everything in iov, which is modified in the process. With MSG_MORE
+ * in flags the data is held back until the next call, so small packets go
+ * out together with the next frame.
+ */
+static bool host_send(int fd, struct iovec *iov, unsigned cnt, int flags)
+{
+	while (cnt) {
+		struct msghdr msg = {};
+		ssize_t ret;
+
+		msg.msg_iov = iov;
+		msg.msg_iovlen = cnt;
+		ret = sendmsg(fd, &msg, flags);
+		if (ret < 0 && errno == EINTR)
+			continue;
+		if (ret <= 0)
+			return false;
+		while (cnt && static_cast<size_t>(ret) >= iov->iov_len) {
+			ret -= iov->iov_len;
+			iov++;
+			cnt--;
 		}
+		if (cnt) {
+			iov->iov_base = static_cast<u8 *>(iov->iov_base) + ret;
+			iov->iov_len -= ret;
+		}
+	}
+	return true;
+}
 
-		if (set_fwht_ext_ctrl(fd, &last_fwht_hdr, last_fwht_bf_ts,
-				      buf.g_request_fd())) {
-			fprintf(stderr, "%s: set_fwht_ext_ctrl failed: %s\n",
-				__func__, strerror(errno));
-			return QUEUE_ERROR;
+/*
+ * Send a packet with --stream-to-host-udp, split in datagrams that each
+ * start with the V4L_STREAM_UDP_ID header.
+ */
+static bool host_send_udp(int fd, __u32 *seq, const struct iovec *iov, unsigned cnt)
+{
+	struct iovec dgram[1 + HOST_IOV_MAX];
+	size_t size = 0, offset = 0, skip = 0;
+	__u32 hdr[V4L_STREAM_UDP_HDR_SIZE / 4];
+
+	for (unsigned i = 0; i < cnt; i++)
+		size += iov[i].iov_len;
+	hdr[0] = htonl(V4L_STREAM_UDP_ID);
+	hdr[1] = htonl((*seq)++);
+	hdr[2] = htonl(size);
+	dgram[0].iov_base = hdr;
+	dgram[0].iov_len = sizeof(hdr);
+
+	while (offset < size) {
+		size_t len = min(size - offset, V4L_STREAM_UDP_MAX_SIZE - sizeof(hdr));
+		struct msghdr msg = {};
+		unsigned n = 1;
+
+		/* Gather the next len bytes of iov, skip is the offset in iov[0] */
+		for (size_t left = len; left; n++) {
+			size_t l = min(iov->iov_len - skip, left);
+
+			dgram[n].iov_base = static_cast<u8 *>(iov->iov_base) + skip;
+			dgram[n].iov_len = l;
+			left -= l;
+			skip += l;
+			if (skip == iov->iov_len) {
+				iov++;
+				skip = 0;
+			}
 		}
+		hdr[3] = htonl(offset);
+		msg.msg_iov = dgram;
+		msg.msg_iovlen = n;
+		/* Nobody listening to a unicast host yet is not an error */
+		if (sendmsg(fd, &msg, 0) < 0 && errno != ECONNREFUSED &&
+		    errno != EINTR)
+			return false;
+		offset += len;
 	}
+	return true;
+}
 
-	set_time_stamp(buf);
+/* Send a packet to host idx. Over UDP an I-frame is preceded by the format. */
+static bool host_send_packet(unsigned idx, struct iovec *iov, unsigned cnt,
+			     int flags, bool intra)
+{
+	if (!host_udp_to)
+		return host_send(host_fds_to[idx], iov, cnt, flags);
+	if (intra && host_fmt_pkt_size) {
+		struct iovec fmt = { host_fmt_pkt, host_fmt_pkt_size };
 
-	if (fd.qbuf(buf)) {
-		fprintf(stderr, "%s: failed: %s\n", "VIDIOC_QBUF", strerror(errno));
-		return QUEUE_ERROR;
+		host_send_udp(host_fds_to[idx], &host_seq_to[idx], &fmt, 1);
 	}
-	if (fmt.g_pixelformat() == V4L2_PIX_FMT_FWHT_STATELESS) {
-		if (!set_fwht_req_by_fd(&last_fwht_hdr, buf.g_request_fd(), last_fwht_bf_ts,
-					buf.g_timestamp_ns())) {
-			fprintf(stderr, "%s: request for fd %d does not exist\n",
-				__func__, buf.g_request_fd());
-			return QUEUE_ERROR;
-		}
+	return host_send_udp(host_fds_to[idx], &host_seq_to[idx], iov, cnt);
+}
 
-		last_fwht_bf_ts = buf.g_timestamp_ns();
-		if (ioctl(buf.g_request_fd(), MEDIA_REQUEST_IOC_QUEUE) < 0) {
-			fprintf(stderr, "Unable to queue media request: %s\n",
-				strerror(errno));
-			return QUEUE_ERROR;
-		}
+/* Send hv to all hosts */
+static bool host_send_all(host_iov *hv, int flags, bool intra)
+{
+	bool ok = true;
+
+	for (unsigned i = 0; i < host_num_fds_to; i++) {
+		struct iovec iov[HOST_IOV_MAX];
+
+		memcpy(iov, hv->iov, hv->cnt * sizeof(iov[0]));
+		ok &= host_send_packet(i, iov, hv->cnt, flags, intra);
 	}
+	return ok;
+}
 
-	tpg_update_mv_count(&tpg, V4L2_FIELD_HAS_T_OR_B(output_field));
+/*
+ * With --stream-to-queue the frames for --stream-to-host are compressed by
+ * the writer thread (see struct stream_writer) and sent by a sender thread,
+ * so capturing, compressing and sending overlap. Each frame is copied in a
+ * packet, the packets are sent in the order they were queued.
+ *
+ * When streaming to several hosts there is a sender thread per host, even
+ * without --stream-to-queue. Each frame is still compressed and copied
+ * once, the packet is shared by all hosts. A host that has
+ * HOST_SENDER_PACKETS packets waiting skips the frame instead of stalling
+ * the capture. After skipping a lossy frame a host gets no frames until
+ * the next I-frame, and the next frame is compressed as an I-frame.
+ */
+#define HOST_SENDER_PACKETS	4
+
+struct host_packet {
+	u8 *data;
+	unsigned size;
+	unsigned alloc;
+	/* The number of hosts this packet is queued for */
+	unsigned refs;
+	/* Can be decoded without the previous frames */
+	bool intra;
+};
 
-	if (!verbose)
-		fprintf(stderr, ">");
-	fflush(stderr);
+struct host_sender;
 
-	count++;
+struct host_client {
+	host_sender *s;
+	pthread_t thread;
+	/* Index in host_fds_to */
+	unsigned idx;
+	host_packet *queue[HOST_SENDER_PACKETS];
+	/* Packets waiting to be sent, from head to tail */
+	unsigned head, tail;
+	/* Wait for an I-frame before queuing packets again */
+	bool resync;
+	bool failed;
+	unsigned dropped;
+};
 
-	if (ignore_count_skip)
-		return 0;
+struct host_sender {
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	host_client clients[HOST_MAX_HOSTS];
+	unsigned num_clients;
+	host_packet packets[HOST_MAX_HOSTS * HOST_SENDER_PACKETS + 1];
+	/* Skip frames for hosts that don't keep up instead of waiting */
+	bool drop;
+	bool want_intra;
+	bool stop;
+};
 
-	if (stream_sleep > 0 && count % stream_sleep == 0)
-		sleep(1);
+static host_sender *host_out_sender;
 
-	if (stream_skip) {
-		stream_skip--;
-		return 0;
-	}
+static void *host_sender_thread(void *arg)
+{
+	host_client *c = static_cast<host_client *>(arg);
+	host_sender *s = c->s;
 
-	if (stream_count == 0)
-		return 0;
-	if (--stream_count == 0)
-		return QUEUE_STOPPED;
+	pthread_mutex_lock(&s->lock);
+	for (;;) {
+		while (c->head == c->tail && !s->stop)
+			pthread_cond_wait(&s->cond, &s->lock);
+		if (c->head == c->tail)
+			break;
 
-	return 0;
+		host_packet *pkt = c->queue[c->head % HOST_SENDER_PACKETS];
+		struct iovec iov = { pkt->data, pkt->size };
+		bool ok;
+
+		pthread_mutex_unlock(&s->lock);
+		ok = host_send_packet(c->idx, &iov, 1, s->drop ? MSG_NOSIGNAL : 0,
+				      pkt->intra);
+		pthread_mutex_lock(&s->lock);
+		c->head++;
+		pkt->refs--;
+		pthread_cond_broadcast(&s->cond);
+		if (ok)
+			continue;
+		fprintf(stderr, "could not send a frame\n");
+		/* Carry on with the other hosts */
+		if (s->drop) {
+			c->failed = true;
+			for (; c->head != c->tail; c->head++)
+				c->queue[c->head % HOST_SENDER_PACKETS]->refs--;
+			break;
+		}
+	}
+	pthread_mutex_unlock(&s->lock);
+	return NULL;
 }
 
-static int do_handle_out_to_in(cv4l_fd &out_fd, cv4l_fd &fd, cv4l_queue &out, cv4l_queue &in)
+static host_sender *host_sender_start(unsigned num_fds)
 {
-	cv4l_buffer buf(out);
-	int ret;
+	host_sender *s = new host_sender();
 
-	do {
-		ret = out_fd.dqbuf(buf);
-	} while (ret == EAGAIN);
-	if (ret) {
-		fprintf(stderr, "%s: failed: %s\n", "VIDIOC_DQBUF", strerror(errno));
-		return QUEUE_ERROR;
+	pthread_mutex_init(&s->lock, NULL);
+	pthread_cond_init(&s->cond, NULL);
+	s->drop = num_fds > 1;
+	for (unsigned i = 0; i < num_fds; i++) {
+		host_client *c = &s->clients[s->num_clients];
+
+		c->s = s;
+		c->idx = i;
+		if (pthread_create(&c->thread, NULL, host_sender_thread, c))
+			break;
+		s->num_clients++;
 	}
-	buf.init(in, buf.g_index());
-	ret = fd.querybuf(buf);
-	if (ret == 0)
-		ret = fd.qbuf(buf);
-	if (ret) {
-		fprintf(stderr, "%s: failed: %s\n", "VIDIOC_QBUF", strerror(errno));
-		return QUEUE_ERROR;
+	if (s->num_clients < num_fds) {
+		fprintf(stderr, "could not start the sender threads, sending synchronously\n");
+		pthread_mutex_lock(&s->lock);
+		s->stop = true;
+		pthread_cond_broadcast(&s->cond);
+		pthread_mutex_unlock(&s->lock);
+		for (unsigned i = 0; i < s->num_clients; i++)
+			pthread_join(s->clients[i].thread, NULL);
+		pthread_cond_destroy(&s->cond);
+		pthread_mutex_destroy(&s->lock);
+		delete s;
+		return NULL;
 	}
-	return 0;
+	return s;
 }
 
-static FILE *open_output_file(cv4l_fd &fd)
+/* Wait until all queued packets are sent and stop the threads */
+static void host_sender_stop(host_sender *s)
 {
-	FILE *fout = NULL;
-
-#ifndef NO_STREAM_TO
-	if (file_to) {
-		if (!strcmp(file_to, "-"))
-			return stdout;
-		fout = fopen(file_to, "w+");
-		if (!fout)
-			fprintf(stderr, "could not open %s for writing\n", file_to);
-		return fout;
+	pthread_mutex_lock(&s->lock);
+	s->stop = true;
+	pthread_cond_broadcast(&s->cond);
+	pthread_mutex_unlock(&s->lock);
+	for (unsigned i = 0; i < s->num_clients; i++) {
+		pthread_join(s->clients[i].thread, NULL);
+		if (s->clients[i].dropped)
+			fprintf(stderr, "host %u skipped %u frames\n",
+				i, s->clients[i].dropped);
 	}
-	if (!host_to)
-		return NULL;
 
-	char *p = std::strchr(host_to, ':');
+	for (unsigned i = 0; i < ARRAY_SIZE(s->packets); i++)
+		free(s->packets[i].data);
+	pthread_cond_destroy(&s->cond);
+	pthread_mutex_destroy(&s->lock);
+	delete s;
+}
+
+/*
+ * Returns an empty packet. With a single host this waits while all packets
+ * are queued, otherwise there are enough packets for every host to have a
+ * full queue.
+ */
+static host_packet *host_sender_get(host_sender *s)
+{
+	host_client *c = &s->clients[0];
+	host_packet *pkt = NULL;
+
+	pthread_mutex_lock(&s->lock);
+	while (!s->drop && c->tail - c->head >= HOST_SENDER_PACKETS)
+		pthread_cond_wait(&s->cond, &s->lock);
+	for (unsigned i = 0; !pkt; i++)
+		if (!s->packets[i].refs)
+			pkt = &s->packets[i];
+	pthread_mutex_unlock(&s->lock);
+	pkt->size = 0;
+	return pkt;
+}
+
+static void host_sender_queue(host_sender *s, host_packet *pkt)
+{
+	pthread_mutex_lock(&s->lock);
+	for (unsigned i = 0; i < s->num_clients; i++) {
+		host_client *c = &s->clients[i];
+		bool full = c->tail - c->head >= HOST_SENDER_PACKETS;
+
+		if (c->failed)
+			continue;
+		if (pkt->intra)
+			c->resync = false;
+		if (!c->resync && !full) {
+			c->queue[c->tail++ % HOST_SENDER_PACKETS] = pkt;
+			pkt->refs++;
+			continue;
+		}
+		/* The next P-frames refer to the skipped frame */
+		c->dropped++;
+		c->resync = true;
+		if (!full)
+			s->want_intra = true;
+	}
+	pthread_cond_broadcast(&s->cond);
+	pthread_mutex_unlock(&s->lock);
+}
+
+/* Returns true once if a host waits for an I-frame */
+static bool host_sender_want_intra(host_sender *s)
+{
+	bool want_intra;
+
+	pthread_mutex_lock(&s->lock);
+	want_intra = s->want_intra;
+	s->want_intra = false;
+	pthread_mutex_unlock(&s->lock);
+	return want_intra;
+}
+
+/* Copy the data to pkt, or add it to the iovecs of hv if pkt is NULL */
+static unsigned host_write(host_iov *hv, host_packet *pkt, const void *data, unsigned size)
+{
+	if (!pkt) {
+		struct iovec *last = hv->cnt ? &hv->iov[hv->cnt - 1] : NULL;
+
+		if (last && static_cast<const u8 *>(last->iov_base) + last->iov_len == data) {
+			last->iov_len += size;
+		} else {
+			hv->iov[hv->cnt].iov_base = const_cast<void *>(data);
+			hv->iov[hv->cnt++].iov_len = size;
+		}
+		return size;
+	}
+	if (pkt->size + size > pkt->alloc) {
+		unsigned alloc = (pkt->size + size) * 2;
+		u8 *p = static_cast<u8 *>(realloc(pkt->data, alloc));
+
+		if (!p)
+			return 0;
+		pkt->data = p;
+		pkt->alloc = alloc;
+	}
+	memcpy(pkt->data + pkt->size, data, size);
+	pkt->size += size;
+	return size;
+}
+
+static void host_write_u32(host_iov *hv, host_packet *pkt, __u32 v)
+{
+	v = htonl(v);
+	if (pkt) {
+		host_write(hv, pkt, &v, sizeof(v));
+		return;
+	}
+	hv->words[hv->num_words] = v;
+	host_write(hv, pkt, &hv->words[hv->num_words++], sizeof(v));
+}
+
+static unsigned rle_write_plane(unsigned plane, host_iov *hv, host_packet *pkt)
+{
+	unsigned sz = 0;
+
+	for (unsigned i = 0; i < rle_num_bands[plane]; i++)
+		sz += host_write(hv, pkt, rle_bands[plane][i].dst,
+				 rle_bands[plane][i].comp_size);
+	return sz;
+}
+
+static void fwht_slice_job(void *arg, unsigned job)
+{
+	fwht_compress_slice(static_cast<codec_ctx *>(arg), job);
+}
+
+/* With more than one thread the frame is compressed in slices */
+static __u8 *fwht_compress_threaded(u8 *p, unsigned size, unsigned *comp_size)
+{
+	unsigned slices = 0;
+
+	if (host_pool)
+		slices = fwht_compress_slices(ctx, p, size);
+	if (!slices)
+		return fwht_compress(ctx, p, size, comp_size);
+	stream_pool_run(host_pool, slices, fwht_slice_job, ctx);
+	*comp_size = fwht_compress_finish(ctx, ctx->state.compressed_frame);
+	return ctx->state.compressed_frame;
+}
+
+static void write_buffer_to_host(cv4l_queue &q, cv4l_buffer &buf)
+{
+	host_packet *pkt = host_out_sender ? host_sender_get(host_out_sender) : NULL;
+	host_iov hv = {};
+	unsigned comp_size[VIDEO_MAX_PLANES];
+	__u8 *comp_ptr[VIDEO_MAX_PLANES];
+	unsigned tot_comp_size = 0;
+	unsigned tot_used = 0;
+	bool intra = true;
+
+	if (host_threads_to > 1 && !host_pool)
+		host_pool = stream_pool_create(host_threads_to);
+	if (ctx && host_out_sender && host_sender_want_intra(host_out_sender))
+		ctx->state.gop_cnt = 0;
+
+	for (unsigned j = 0; j < buf.g_num_planes(); j++) {
+		__u32 used = buf.g_bytesused(j);
+		unsigned offset = buf.g_data_offset(j);
+		u8 *p;
+
+		if (offset > used) {
+			// Should never happen
+			fprintf(stderr, "offset %d > used %d!\n",
+				offset, used);
+			offset = 0;
+		}
+		used -= offset;
+		p = static_cast<u8 *>(q.g_dataptr(buf.g_index(), j)) + offset;
+		if (ctx) {
+			comp_ptr[j] = fwht_compress_threaded(p, used, &comp_size[j]);
+			if (!(ntohl(reinterpret_cast<fwht_cframe_hdr *>(comp_ptr[j])->flags) &
+			      FWHT_FL_I_FRAME))
+				intra = false;
+		} else {
+			comp_ptr[j] = p;
+			comp_size[j] = used;
+			rle_setup_plane(j, p, used);
+		}
+		tot_used += used;
+	}
+	if (rle_num_jobs) {
+		stream_pool_run(host_pool, rle_num_jobs, rle_band_job, NULL);
+		rle_num_jobs = 0;
+	}
+	for (unsigned j = 0; !ctx && j < buf.g_num_planes(); j++) {
+		if (!rle_num_bands[j])
+			continue;
+		/* Send it uncompressed if nothing was gained */
+		if (rle_plane_size(j) < comp_size[j])
+			comp_size[j] = rle_plane_size(j);
+		else
+			rle_num_bands[j] = 0;
+	}
+	for (unsigned j = 0; j < buf.g_num_planes(); j++)
+		tot_comp_size += comp_size[j];
+
+	host_write_u32(&hv, pkt, ctx ? V4L_STREAM_PACKET_FRAME_VIDEO_FWHT :
+				   V4L_STREAM_PACKET_FRAME_VIDEO_RLE);
+	host_write_u32(&hv, pkt, V4L_STREAM_PACKET_FRAME_VIDEO_SIZE(buf.g_num_planes()) + tot_comp_size);
+	host_write_u32(&hv, pkt, V4L_STREAM_PACKET_FRAME_VIDEO_SIZE_HDR);
+	host_write_u32(&hv, pkt, buf.g_field());
+	host_write_u32(&hv, pkt, buf.g_flags());
+	comp_perc += (tot_comp_size * 100 / tot_used);
+	comp_perc_count++;
+
+	for (unsigned j = 0; j < buf.g_num_planes(); j++) {
+		__u32 used = buf.g_bytesused(j);
+		unsigned offset = buf.g_data_offset(j);
+		unsigned sz;
+
+		if (offset > used)
+			offset = 0;
+		host_write_u32(&hv, pkt, V4L_STREAM_PACKET_FRAME_VIDEO_SIZE_PLANE_HDR);
+		host_write_u32(&hv, pkt, used - offset);
+		host_write_u32(&hv, pkt, comp_size[j]);
+		if (!ctx && rle_num_bands[j])
+			sz = rle_write_plane(j, &hv, pkt);
+		else
+			sz = host_write(&hv, pkt, comp_ptr[j], comp_size[j]);
+		if (sz != comp_size[j])
+			fprintf(stderr, "%u != %u\n", sz, comp_size[j]);
+	}
+	if (pkt) {
+		pkt->intra = intra;
+		host_sender_queue(host_out_sender, pkt);
+	} else if (!host_send_all(&hv, 0, intra)) {
+		fprintf(stderr, "could not send a frame\n");
+	}
+}
+
+static void host_compress_free()
+{
+	if (host_pool) {
+		stream_pool_destroy(host_pool);
+		host_pool = NULL;
+	}
+	for (unsigned j = 0; j < VIDEO_MAX_PLANES; j++) {
+		free(rle_buf[j]);
+		rle_buf[j] = NULL;
+		rle_buf_size[j] = 0;
+	}
+}
+
+static void write_u32(FILE *f, __u32 v)
+{
+	v = htonl(v);
+	fwrite(&v, 1, sizeof(v), f);
+}
+
+/* write the sliced VBI or converted SDR data of a buffer as a single plane */
+static void write_processed_to_file(cv4l_queue &q, cv4l_buffer &buf, FILE *fout)
+{
+	unsigned offset = buf.g_data_offset(0);
+	__u32 used = buf.g_bytesused(0);
+	const u8 *raw;
+	const void *data;
+	unsigned sz;
+
+	if (offset > used)
+		offset = 0;
+	raw = static_cast<u8 *>(q.g_dataptr(buf.g_index(), 0)) + offset;
+	if (q.g_type() == V4L2_BUF_TYPE_SDR_CAPTURE)
+		used = sdr_convert(raw, used - offset, &data);
+	else
+		used = vbi_slice(raw, used - offset, &data);
+	if (!used)
+		return;
+	if (direct_out) {
+		if (to_with_hdr) {
+			direct_output_write_u32(direct_out, FILE_HDR_ID);
+			direct_output_write_u32(direct_out, used);
+		}
+		direct_output_write(direct_out, data, used);
+		return;
+	}
+	if (to_with_hdr) {
+		write_u32(fout, FILE_HDR_ID);
+		write_u32(fout, used);
+	}
+	sz = fwrite(data, 1, used, fout);
+	if (sz != used)
+		fprintf(stderr, "%u != %u\n", sz, used);
+}
+#endif
+
+static void write_buffer_to_file(cv4l_fd &fd, cv4l_queue &q, cv4l_buffer &buf,
+				 cv4l_fmt &fmt, FILE *fout)
+{
+#ifndef NO_STREAM_TO
+	if ((stream_slice_vbi && q.g_type() == V4L2_BUF_TYPE_VBI_CAPTURE) ||
+	    (stream_sdr_decim && q.g_type() == V4L2_BUF_TYPE_SDR_CAPTURE)) {
+		write_processed_to_file(q, buf, fout);
+		return;
+	}
+	if (host_fd_to >= 0) {
+		write_buffer_to_host(q, buf);
+		return;
+	}
+	if (direct_out) {
+		if (to_with_hdr)
+			direct_output_write_u32(direct_out, FILE_HDR_ID);
+		for (unsigned j = 0; j < buf.g_num_planes(); j++) {
+			__u32 used = buf.g_bytesused(j);
+			unsigned offset = buf.g_data_offset(j);
+
+			if (offset > used)
+				offset = 0;
+			used -= offset;
+			if (to_with_hdr)
+				direct_output_write_u32(direct_out, used);
+			direct_output_write(direct_out,
+					    static_cast<u8 *>(q.g_dataptr(buf.g_index(), j)) + offset,
+					    used);
+		}
+		return;
+	}
+	if (to_with_hdr)
+		write_u32(fout, FILE_HDR_ID);
+	for (unsigned j = 0; j < buf.g_num_planes(); j++) {
+		__u32 used = buf.g_bytesused(j);
+		unsigned offset = buf.g_data_offset(j);
+		unsigned sz;
+
+		if (offset > used) {
+			// Should never happen
+			fprintf(stderr, "offset %d > used %d!\n",
+				offset, used);
+			offset = 0;
+		}
+		used -= offset;
+		if (to_with_hdr)
+			write_u32(fout, used);
+		if (support_cap_compose && v4l2_fwht_find_pixfmt(fmt.g_pixelformat()))
+			read_write_padded_frame(fmt, static_cast<u8 *>(q.g_dataptr(buf.g_index(), j)) + offset,
+						fout, sz, used, used, false);
+		else
+			sz = fwrite(static_cast<u8 *>(q.g_dataptr(buf.g_index(), j)) + offset, 1, used, fout);
+
+		if (sz != used)
+			fprintf(stderr, "%u != %u\n", sz, used);
+	}
+#endif
+}
+
+/*
+ * With --stream-to-queue the captured buffers are written to the file by a
+ * separate thread, so a slow disk doesn't immediately starve the driver of
+ * buffers. The capture thread only requeues buffers once they are written.
+ */
+struct stream_writer {
+	pthread_t thread;
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	cv4l_fd *fd;
+	cv4l_queue *q;
+	cv4l_fmt *fmt;
+	FILE *fout;
+	/* Buffers waiting to be written, from head to tail */
+	cv4l_buffer *pending[VIDEO_MAX_FRAME];
+	unsigned head, tail;
+	/* Written buffers that still need to be requeued */
+	cv4l_buffer *done[VIDEO_MAX_FRAME];
+	unsigned done_cnt;
+	/* Largest number of pending buffers since the last report */
+	unsigned max_backlog;
+	bool stop;
+};
+
+static stream_writer *cap_writer;
+
+static void *stream_writer_thread(void *arg)
+{
+	stream_writer *w = static_cast<stream_writer *>(arg);
+
+	pthread_mutex_lock(&w->lock);
+	for (;;) {
+		while (w->head == w->tail && !w->stop)
+			pthread_cond_wait(&w->cond, &w->lock);
+		if (w->head == w->tail)
+			break;
+
+		cv4l_buffer *buf = w->pending[w->head % VIDEO_MAX_FRAME];
+
+		pthread_mutex_unlock(&w->lock);
+		write_buffer_to_file(*w->fd, *w->q, *buf, *w->fmt, w->fout);
+		pthread_mutex_lock(&w->lock);
+		w->head++;
+		w->done[w->done_cnt++] = buf;
+		pthread_cond_broadcast(&w->cond);
+	}
+	pthread_mutex_unlock(&w->lock);
+	return NULL;
+}
+
+static stream_writer *stream_writer_start(cv4l_fd &fd, cv4l_queue &q,
+					  cv4l_fmt &fmt, FILE *fout)
+{
+	stream_writer *w = new stream_writer();
+
+	w->fd = &fd;
+	w->q = &q;
+	w->fmt = &fmt;
+	w->fout = fout;
+	pthread_mutex_init(&w->lock, NULL);
+	pthread_cond_init(&w->cond, NULL);
+	if (pthread_create(&w->thread, NULL, stream_writer_thread, w)) {
+		fprintf(stderr, "could not start the writer thread, writing synchronously\n");
+		pthread_cond_destroy(&w->cond);
+		pthread_mutex_destroy(&w->lock);
+		delete w;
+		return NULL;
+	}
+	return w;
+}
+
+/* Wait until all pending buffers are written and stop the thread */
+static void stream_writer_stop(stream_writer *w)
+{
+	pthread_mutex_lock(&w->lock);
+	w->stop = true;
+	pthread_cond_broadcast(&w->cond);
+	pthread_mutex_unlock(&w->lock);
+	pthread_join(w->thread, NULL);
+
+	for (unsigned i = 0; i < w->done_cnt; i++)
+		delete w->done[i];
+	pthread_cond_destroy(&w->cond);
+	pthread_mutex_destroy(&w->lock);
+	delete w;
+}
+
+/* Hand a buffer to the writer, waits while the queue is full */
+static void stream_writer_submit(stream_writer *w, cv4l_buffer &buf)
+{
+	pthread_mutex_lock(&w->lock);
+	while (w->tail - w->head >= stream_to_queue)
+		pthread_cond_wait(&w->cond, &w->lock);
+	w->pending[w->tail++ % VIDEO_MAX_FRAME] = new cv4l_buffer(buf);
+	if (w->tail - w->head > w->max_backlog)
+		w->max_backlog = w->tail - w->head;
+	pthread_cond_broadcast(&w->cond);
+	pthread_mutex_unlock(&w->lock);
+}
+
+/*
+ * Requeue the buffers that have been written. If the writer holds all
+ * buffers, then wait for it to finish one, since otherwise VIDIOC_DQBUF
+ * would never return.
+ */
+static int stream_writer_requeue(stream_writer *w, cv4l_fd &fd)
+{
+	cv4l_buffer *done[VIDEO_MAX_FRAME];
+	unsigned done_cnt;
+	int ret = 0;
+
+	pthread_mutex_lock(&w->lock);
+	while (!w->done_cnt &&
+	       w->tail - w->head >= w->q->g_buffers())
+		pthread_cond_wait(&w->cond, &w->lock);
+	done_cnt = w->done_cnt;
+	memcpy(done, w->done, done_cnt * sizeof(done[0]));
+	w->done_cnt = 0;
+	pthread_mutex_unlock(&w->lock);
+
+	for (unsigned i = 0; i < done_cnt; i++) {
+		/* See the EINVAL comment in do_handle_cap() */
+		if (!last_buffer && fd.qbuf(*done[i]) && errno != EINVAL) {
+			fprintf(stderr, "%s: qbuf error\n", __func__);
+			ret = QUEUE_ERROR;
+		}
+		delete done[i];
+	}
+	return ret;
+}
+
+static unsigned stream_writer_backlog(stream_writer *w)
+{
+	unsigned backlog;
+
+	pthread_mutex_lock(&w->lock);
+	backlog = w->max_backlog;
+	w->max_backlog = w->tail - w->head;
+	pthread_mutex_unlock(&w->lock);
+	return backlog;
+}
+
+static int do_handle_cap(cv4l_fd &fd, cv4l_queue &q, FILE *fout, int *index,
+			 unsigned &count, fps_timestamps &fps_ts, cv4l_fmt &fmt,
+			 bool ignore_count_skip)
+{
+	char ch = '<';
+	int ret;
+	cv4l_buffer buf(q);
+	stream_writer *writer = index ? NULL : cap_writer;
+
+	if (writer) {
+		ret = stream_writer_requeue(writer, fd);
+		if (ret)
+			return ret;
+	}
+
+	for (;;) {
+		ret = fd.dqbuf(buf);
+		if (ret == EAGAIN)
+			return 0;
+		if (ret == EPIPE)
+			return QUEUE_STOPPED;
+		if (ret) {
+			fprintf(stderr, "%s: failed: %s\n", "VIDIOC_DQBUF", strerror(errno));
+			return QUEUE_ERROR;
+		}
+		if (buf.g_flags() & V4L2_BUF_FLAG_LAST) {
+			last_buffer = true;
+			break;
+		}
+		if (!(buf.g_flags() & V4L2_BUF_FLAG_ERROR))
+			break;
+		if (verbose)
+			print_concise_buffer(stderr, buf, fmt, q, fps_ts, -1);
+		if (fd.qbuf(buf))
+			return QUEUE_ERROR;
+	}
+
+	bool is_empty_frame = !buf.g_bytesused(0);
+	bool is_error_frame = buf.g_flags() & V4L2_BUF_FLAG_ERROR;
+
+	if (!is_empty_frame && !is_error_frame)
+		bench_cap_dequeued(buf);
+
+	double ts_secs = buf.g_timestamp().tv_sec + buf.g_timestamp().tv_usec / 1000000.0;
+	fps_ts.add_ts(ts_secs, buf.g_sequence(), buf.g_field());
+
+	bool to_writer = writer && (!stream_skip || ignore_count_skip) &&
+			 !is_empty_frame && !is_error_frame;
+
+	if (to_writer)
+		stream_writer_submit(writer, buf);
+	else if (fout && (!stream_skip || ignore_count_skip) &&
+		 !is_empty_frame && !is_error_frame)
+		write_buffer_to_file(fd, q, buf, fmt, fout);
+
+	if (stream_sdr_fft && q.g_type() == V4L2_BUF_TYPE_SDR_CAPTURE &&
+	    !is_empty_frame && !is_error_frame) {
+		unsigned offset = buf.g_data_offset(0);
+		__u32 used = buf.g_bytesused(0);
+
+		if (offset > used)
+			offset = 0;
+		sdr_spectrum_add(static_cast<u8 *>(q.g_dataptr(buf.g_index(), 0)) + offset,
+				 used - offset);
+	}
+
+	if (buf.g_flags() & V4L2_BUF_FLAG_KEYFRAME)
+		ch = 'K';
+	else if (buf.g_flags() & V4L2_BUF_FLAG_PFRAME)
+		ch = 'P';
+	else if (buf.g_flags() & V4L2_BUF_FLAG_BFRAME)
+		ch = 'B';
+	if (verbose) {
+		print_concise_buffer(stderr, buf, fmt, q, fps_ts,
+				     host_fd_to >= 0 && comp_perc_count ?
+				     100 - comp_perc / comp_perc_count : -1);
+		comp_perc_count = comp_perc = 0;
+	}
+	if (!last_buffer && index == NULL && !to_writer) {
+		/*
+		 * EINVAL in qbuf can happen if this is the last buffer before
+		 * a dynamic resolution change sequence. In this case the buffer
+		 * has the size that fits the old resolution and might not
+		 * fit to the new one.
+		 */
+		if (fd.qbuf(buf) && errno != EINVAL) {
+			fprintf(stderr, "%s: qbuf error\n", __func__);
+			return QUEUE_ERROR;
+		}
+	}
+	if (index)
+		*index = buf.g_index();
+
+	if (!verbose) {
+		fprintf(stderr, "%c", ch);
+		fflush(stderr);
+
+		if (fps_ts.has_fps()) {
+			unsigned dropped = fps_ts.dropped();
+
+			fprintf(stderr, " %.02f fps", fps_ts.fps());
+			if (dropped)
+				fprintf(stderr, ", dropped buffers: %u", dropped);
+			if (writer)
+				fprintf(stderr, ", write queue: %u/%u",
+					stream_writer_backlog(writer), stream_to_queue);
+			/* With a writer thread no frame may have been compressed yet */
+			if (host_fd_to >= 0 && comp_perc_count)
+				fprintf(stderr, " %d%% compression", 100 - comp_perc / comp_perc_count);
+			comp_perc_count = comp_perc = 0;
+			fprintf(stderr, "\n");
+		}
+	}
+	count++;
+
+	if (ignore_count_skip)
+		return 0;
+
+	if (stream_sleep > 0 && count % stream_sleep == 0)
+		sleep(1);
+
+	if (is_empty_frame || is_error_frame)
+		return 0;
+
+	if (stream_skip) {
+		stream_skip--;
+		return 0;
+	}
+
+	if (stream_count == 0)
+		return 0;
+
+	if (--stream_count == 0)
+		return QUEUE_STOPPED;
+
+	return 0;
+}
+
+static int do_handle_out(cv4l_fd &fd, cv4l_queue &q, FILE *fin, cv4l_buffer *cap,
+			 unsigned &count, fps_timestamps &fps_ts, cv4l_fmt fmt,
+			 bool stopped, bool ignore_count_skip)
+{
+	cv4l_buffer buf(q);
+	bool is_meta = q.g_type() == V4L2_BUF_TYPE_META_OUTPUT;
+	int ret = 0;
+
+	if (cap) {
+		buf.s_index(cap->g_index());
+
+		for (unsigned j = 0; j < buf.g_num_planes(); j++) {
+			unsigned data_offset = cap->g_data_offset(j);
+
+			if (q.g_memory() == V4L2_MEMORY_USERPTR) {
+				buf.s_userptr(static_cast<u8 *>(cap->g_userptr(j)) + data_offset, j);
+				buf.s_bytesused(cap->g_bytesused(j) - data_offset, j);
+				buf.s_data_offset(0, j);
+			} else if (q.g_memory() == V4L2_MEMORY_DMABUF) {
+				buf.s_bytesused(cap->g_bytesused(j), j);
+				buf.s_data_offset(data_offset, j);
+			}
+		}
+	} else {
+		ret = fd.dqbuf(buf);
+		if (ret == EAGAIN)
+			return 0;
+		if (!ret)
+			bench_out_dequeued();
+
+		double ts_secs = buf.g_timestamp().tv_sec + buf.g_timestamp().tv_usec / 1000000.0;
+		fps_ts.add_ts(ts_secs, buf.g_sequence(), buf.g_field());
+		if (verbose)
+			print_concise_buffer(stderr, buf, fmt, q, fps_ts, -1);
+
+		for (unsigned j = 0; j < buf.g_num_planes(); j++)
+			buf.s_bytesused(buf.g_length(j), j);
+	}
+	if (ret) {
+		fprintf(stderr, "%s: failed: %s\n", "VIDIOC_DQBUF", strerror(ret));
+		return QUEUE_ERROR;
+	}
+	if (fps_ts.has_fps()) {
+		unsigned dropped = fps_ts.dropped();
+
+		fprintf(stderr, " %.02f fps", fps_ts.fps());
+		if (dropped)
+			fprintf(stderr, ", dropped buffers: %u", dropped);
+		fprintf(stderr, "\n");
+	}
+	if (stopped)
+		return 0;
+
+	buf.s_field(output_field);
+	tpg_s_field(&tpg, output_field, output_field_alt);
+	if (output_field_alt) {
+		if (output_field == V4L2_FIELD_TOP)
+			output_field = V4L2_FIELD_BOTTOM;
+		else if (output_field == V4L2_FIELD_BOTTOM)
+			output_field = V4L2_FIELD_TOP;
+	}
+
+	stream_out_sync(q, buf.g_index(), false);
+	if (fin && !fill_buffer_from_file(fd, q, buf, fmt, fin)) {
+		stream_out_sync(q, buf.g_index(), true);
+		return QUEUE_STOPPED;
+	}
+
+	if (!fin && stream_out_refresh)
+		stream_out_fill(q, buf.g_index());
+	if (is_meta)
+		meta_fillbuffer(buf, fmt, q);
+	stream_out_sync(q, buf.g_index(), true);
+
+	if (fmt.g_pixelformat() == V4L2_PIX_FMT_FWHT_STATELESS) {
+		if (ioctl(buf.g_request_fd(), MEDIA_REQUEST_IOC_REINIT, NULL)) {
+			fprintf(stderr, "Unable to reinit media request: %s\n",
+				strerror(errno));
+			return QUEUE_ERROR;
+		}
+
+		if (set_fwht_ext_ctrl(fd, &last_fwht_hdr, last_fwht_bf_ts,
+				      buf.g_request_fd())) {
+			fprintf(stderr, "%s: set_fwht_ext_ctrl failed: %s\n",
+				__func__, strerror(errno));
+			return QUEUE_ERROR;
+		}
+	}
+
+	set_time_stamp(buf);
+
+	if (fd.qbuf(buf)) {
+		fprintf(stderr, "%s: failed: %s\n", "VIDIOC_QBUF", strerror(errno));
+		return QUEUE_ERROR;
+	}
+	bench_out_queued(buf);
+	if (fmt.g_pixelformat() == V4L2_PIX_FMT_FWHT_STATELESS) {
+		if (!set_fwht_req_by_fd(&last_fwht_hdr, buf.g_request_fd(), last_fwht_bf_ts,
+					buf.g_timestamp_ns())) {
+			fprintf(stderr, "%s: request for fd %d does not exist\n",
+				__func__, buf.g_request_fd());
+			return QUEUE_ERROR;
+		}
+
+		last_fwht_bf_ts = buf.g_timestamp_ns();
+		if (ioctl(buf.g_request_fd(), MEDIA_REQUEST_IOC_QUEUE) < 0) {
+			fprintf(stderr, "Unable to queue media request: %s\n",
+				strerror(errno));
+			return QUEUE_ERROR;
+		}
+	}
+
+	tpg_update_mv_count(&tpg, V4L2_FIELD_HAS_T_OR_B(output_field));
+
+	if (!verbose)
+		fprintf(stderr, ">");
+	fflush(stderr);
+
+	count++;
+
+	if (ignore_count_skip)
+		return 0;
+
+	if (stream_sleep > 0 && count % stream_sleep == 0)
+		sleep(1);
+
+	if (stream_skip) {
+		stream_skip--;
+		return 0;
+	}
+
+	if (stream_count == 0)
+		return 0;
+	if (--stream_count == 0)
+		return QUEUE_STOPPED;
+
+	return 0;
+}
+
+/*
+ * For capture to output streaming: how long the buffers stay queued on
+ * each of the two devices, and how many are in flight on each.
+ */
+struct cap2out_side {
+	__u64 queued[VIDEO_MAX_FRAME];
+	unsigned inflight;
+	unsigned inflight_max;
+	unsigned frames;
+	__u64 total;
+	__u64 min;
+	__u64 max;
+};
+
+static void cap2out_queued(cap2out_side &s, unsigned index)
+{
+	if (index >= VIDEO_MAX_FRAME)
+		return;
+	s.queued[index] = bench_now();
+	if (++s.inflight > s.inflight_max)
+		s.inflight_max = s.inflight;
+}
+
+static void cap2out_dequeued(cap2out_side &s, unsigned index)
+{
+	__u64 t;
+
+	if (index >= VIDEO_MAX_FRAME || !s.inflight)
+		return;
+	s.inflight--;
+	t = bench_now() - s.queued[index];
+	if (!s.frames || t < s.min)
+		s.min = t;
+	if (t > s.max)
+		s.max = t;
+	s.total += t;
+	s.frames++;
+}
+
+static void cap2out_report(const char *name, const cap2out_side &s)
+{
+	if (!s.frames)
+		return;
+	fprintf(stderr, "%s: %u buffers, queued avg %.3f ms min %.3f ms max %.3f ms, "
+		"max %u in flight\n", name, s.frames, s.total / 1e6 / s.frames,
+		s.min / 1e6, s.max / 1e6, s.inflight_max);
+}
+
+/*
+ * Give the buffers done by the output device back to the capture device.
+ * The file descriptors are non-blocking, so this returns once there are
+ * no more.
+ */
+static int do_handle_out_to_in(cv4l_fd &out_fd, cv4l_fd &fd, cv4l_queue &out, cv4l_queue &in,
+			       cap2out_side &cap_stats, cap2out_side &out_stats)
+{
+	cv4l_buffer buf(out);
+	int ret;
+
+	for (;;) {
+		buf.init(out);
+		ret = out_fd.dqbuf(buf);
+		if (ret == EAGAIN)
+			return 0;
+		if (ret) {
+			fprintf(stderr, "%s: failed: %s\n", "VIDIOC_DQBUF", strerror(ret));
+			return QUEUE_ERROR;
+		}
+		cap2out_dequeued(out_stats, buf.g_index());
+		buf.init(in, buf.g_index());
+		ret = fd.querybuf(buf);
+		if (ret == 0)
+			ret = fd.qbuf(buf);
+		if (ret) {
+			fprintf(stderr, "%s: failed: %s\n", "VIDIOC_QBUF", strerror(ret));
+			return QUEUE_ERROR;
+		}
+		cap2out_queued(cap_stats, buf.g_index());
+	}
+}
+
+#ifndef NO_STREAM_TO
+static int host_connect(char *host)
+{
+	char *p = std::strchr(host, ':');
+	unsigned port = host_port_to;
 	struct sockaddr_in serv_addr;
 	struct hostent *server;
+	int fd;
+
+	if (p) {
+		port = strtoul(p + 1, 0L, 0);
+		*p = '\0';
+	}
+	fd = socket(AF_INET, host_udp_to ? SOCK_DGRAM : SOCK_STREAM, 0);
+	if (fd < 0) {
+		fprintf(stderr, "cannot open socket");
+		std::exit(EXIT_SUCCESS);
+	}
+	server = gethostbyname(host);
+	if (server == NULL) {
+		fprintf(stderr, "no such host %s\n", host);
+		std::exit(EXIT_SUCCESS);
+	}
+	memset(reinterpret_cast<char *>(&serv_addr), 0, sizeof(serv_addr));
+	serv_addr.sin_family = AF_INET;
+	memcpy(reinterpret_cast<char *>(&serv_addr.sin_addr.s_addr),
+	       server->h_addr,
+	       server->h_length);
+	serv_addr.sin_port = htons(port);
+	if (connect(fd, reinterpret_cast<struct sockaddr *>(&serv_addr), sizeof(serv_addr)) < 0) {
+		fprintf(stderr, "could not connect\n");
+		std::exit(EXIT_SUCCESS);
+	}
+	if (host_udp_to)
+		return fd;
+	/*
+	 * Each frame is sent in one go, so don't let the tail of a frame
+	 * wait for the ACK of the previous one.
+	 */
+	int one = 1;
+	setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+	return fd;
+}
+#endif
+
+static FILE *open_output_file(cv4l_fd &fd)
+{
+	FILE *fout = NULL;
+
+#ifndef NO_STREAM_TO
+	if (file_to) {
+		if (!strcmp(file_to, "-"))
+			return stdout;
+		cv4l_fmt dfmt;
+
+		fd.g_fmt(dfmt);
+		if (stream_direct && support_cap_compose &&
+		    v4l2_fwht_find_pixfmt(dfmt.g_pixelformat())) {
+			fprintf(stderr, "--stream-direct is not supported for composed frames\n");
+		} else if (stream_direct) {
+			direct_out = direct_output_open(file_to);
+			if (direct_out)
+				return fdopen(direct_out->fd, "w");
+			fprintf(stderr, "cannot use O_DIRECT for %s, using buffered writes\n",
+				file_to);
+		}
+		fout = fopen(file_to, "w+");
+		if (!fout)
+			fprintf(stderr, "could not open %s for writing\n", file_to);
+		return fout;
+	}
+	if (!host_to)
+		return NULL;
+
 	struct v4l2_fract aspect;
 	unsigned width, height;
 	cv4l_fmt cfmt;
 
-	fd.g_fmt(cfmt);
+	fd.g_fmt(cfmt);
+
+	aspect = fd.g_pixel_aspect(width, height);
+	for (char *host = strtok(host_to, ","); host; host = strtok(NULL, ",")) {
+		if (host_num_fds_to == HOST_MAX_HOSTS) {
+			fprintf(stderr, "cannot stream to more than %u hosts\n", HOST_MAX_HOSTS);
+			std::exit(EXIT_SUCCESS);
+		}
+		host_fds_to[host_num_fds_to++] = host_connect(host);
+	}
+	host_fd_to = host_fds_to[0];
+	/* Only used to close the socket, all data is sent with host_send() */
+	fout = fdopen(host_fd_to, "a");
+
+	host_iov hv = {};
+	unsigned fmt_word;
+
+	/* Over UDP there is no stream ID and version */
+	if (!host_udp_to) {
+		host_write_u32(&hv, NULL, V4L_STREAM_ID);
+		host_write_u32(&hv, NULL, V4L_STREAM_VERSION);
+	}
+	fmt_word = hv.num_words;
+	host_write_u32(&hv, NULL, V4L_STREAM_PACKET_FMT_VIDEO);
+	host_write_u32(&hv, NULL, V4L_STREAM_PACKET_FMT_VIDEO_SIZE(cfmt.g_num_planes()));
+	host_write_u32(&hv, NULL, V4L_STREAM_PACKET_FMT_VIDEO_SIZE_FMT);
+	host_write_u32(&hv, NULL, cfmt.g_num_planes());
+	host_write_u32(&hv, NULL, cfmt.g_pixelformat());
+	host_write_u32(&hv, NULL, cfmt.g_width());
+	host_write_u32(&hv, NULL, cfmt.g_height());
+	host_write_u32(&hv, NULL, cfmt.g_field());
+	host_write_u32(&hv, NULL, cfmt.g_colorspace());
+	host_write_u32(&hv, NULL, cfmt.g_ycbcr_enc());
+	host_write_u32(&hv, NULL, cfmt.g_quantization());
+	host_write_u32(&hv, NULL, cfmt.g_xfer_func());
+	host_write_u32(&hv, NULL, cfmt.g_flags());
+	host_write_u32(&hv, NULL, aspect.numerator);
+	host_write_u32(&hv, NULL, aspect.denominator);
+	for (unsigned i = 0; i < cfmt.g_num_planes(); i++) {
+		host_write_u32(&hv, NULL, V4L_STREAM_PACKET_FMT_VIDEO_SIZE_FMT_PLANE);
+		host_write_u32(&hv, NULL, cfmt.g_sizeimage(i));
+		host_write_u32(&hv, NULL, cfmt.g_bytesperline(i));
+		bpl_cap[i] = rle_calc_bpl(cfmt.g_bytesperline(i), cfmt.g_pixelformat());
+	}
+	if (!host_lossless) {
+		unsigned visible_width = support_cap_compose ? composed_width : cfmt.g_width();
+		unsigned visible_height = support_cap_compose ? composed_height : cfmt.g_height();
+
+		ctx = fwht_alloc(cfmt.g_pixelformat(), visible_width, visible_height,
+				 cfmt.g_width(), cfmt.g_height(),
+				 cfmt.g_field(), cfmt.g_colorspace(), cfmt.g_xfer_func(),
+				 cfmt.g_ycbcr_enc(), cfmt.g_quantization(),
+				 host_threads_to);
+		if (ctx)
+			ctx->state.speed = host_speed_to;
+	}
+	/* Kept to repeat it before every I-frame over UDP */
+	host_fmt_pkt_size = (hv.num_words - fmt_word) * 4;
+	memcpy(host_fmt_pkt, hv.words + fmt_word, host_fmt_pkt_size);
+	/* Corked, so this goes out together with the first frame */
+	if (!host_send_all(&hv, MSG_MORE, false))
+		fprintf(stderr, "could not send the stream header\n");
+#endif
+	return fout;
+}
+
+static void streaming_set_cap(cv4l_fd &fd, cv4l_fd &exp_fd)
+{
+	int fd_flags = fcntl(fd.g_fd(), F_GETFL);
+	cv4l_queue q(fd.g_type(), memory);
+	cv4l_queue exp_q(exp_fd.g_type(), V4L2_MEMORY_MMAP);
+	fps_timestamps fps_ts;
+	bool use_poll = options[OptStreamPoll];
+	cv4l_event_loop loop;
+	unsigned count;
+	bool eos;
+	bool source_change;
+	FILE *fout = NULL;
+	cv4l_fmt fmt;
+
+	if (!(capabilities & (V4L2_CAP_VIDEO_CAPTURE | V4L2_CAP_VIDEO_CAPTURE_MPLANE |
+			      V4L2_CAP_VBI_CAPTURE | V4L2_CAP_SLICED_VBI_CAPTURE |
+			      V4L2_CAP_META_CAPTURE | V4L2_CAP_SDR_CAPTURE |
+			      V4L2_CAP_VIDEO_M2M | V4L2_CAP_VIDEO_M2M_MPLANE))) {
+		fprintf(stderr, "unsupported stream type\n");
+		return;
+	}
+	if (options[OptStreamDmaBuf] && exp_fd.g_fd() < 0) {
+		fprintf(stderr, "--stream-dmabuf can only work in combination with --export-device\n");
+		return;
+	}
+	switch (q.g_type()) {
+	case V4L2_BUF_TYPE_VIDEO_CAPTURE:
+	case V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE:
+		break;
+	default:
+		if (host_to) {
+			fprintf(stderr, "--stream-to-host is not supported for non-video streams\n");
+			return;
+		}
+		break;
+	}
+
+	subscribe_event(fd, V4L2_EVENT_EOS);
+	if (use_poll)
+		subscribe_event(fd, V4L2_EVENT_SOURCE_CHANGE);
+
+	/* Without --stream-poll only the events are polled, DQBUF blocks */
+	loop.s_busy_poll(stream_busy_poll);
+	if (loop.add(fd.g_fd(), EPOLLPRI | (use_poll ? EPOLLIN : 0), 0)) {
+		fprintf(stderr, "epoll error: %s\n", strerror(errno));
+		return;
+	}
+
+recover:
+	eos = false;
+	source_change = false;
+	count = 0;
+
+	if (!stream_no_query) {
+		cv4l_disable_trace dt(fd);
+		struct v4l2_dv_timings new_dv_timings = {};
+		v4l2_std_id new_std;
+		struct v4l2_input in = { };
+
+		if (!fd.g_input(in.index) && !fd.enum_input(in, true, in.index)) {
+			if (in.capabilities & V4L2_IN_CAP_DV_TIMINGS) {
+				while (fd.query_dv_timings(new_dv_timings))
+					sleep(1);
+				fd.s_dv_timings(new_dv_timings);
+				fprintf(stderr, "New timings found\n");
+			} else if (in.capabilities & V4L2_IN_CAP_STD) {
+				if (!fd.query_std(new_std))
+					fd.s_std(new_std);
+			}
+		}
+	}
+
+	fout = open_output_file(fd);
+
+	if (q.reqbufs(&fd, reqbufs_count_cap)) {
+		if (q.g_type() != V4L2_BUF_TYPE_VBI_CAPTURE ||
+		    !fd.has_raw_vbi_cap() || !fd.has_sliced_vbi_cap())
+			goto done;
+		fd.s_type(V4L2_BUF_TYPE_SLICED_VBI_CAPTURE);
+		q.init(fd.g_type(), memory);
+		if (q.reqbufs(&fd, reqbufs_count_cap))
+			goto done;
+	}
+
+	if (stream_slice_vbi) {
+		if (q.g_type() != V4L2_BUF_TYPE_VBI_CAPTURE) {
+			fprintf(stderr, "--stream-slice-vbi requires raw VBI capture\n");
+			goto done;
+		}
+		if (!vbi_slice_prepare(fd))
+			goto done;
+	}
+
+	if (stream_sdr_decim) {
+		if (q.g_type() != V4L2_BUF_TYPE_SDR_CAPTURE) {
+			fprintf(stderr, "--stream-sdr-float requires SDR capture\n");
+			goto done;
+		}
+		if (!sdr_convert_prepare(fd, stream_sdr_decim, stream_sdr_taps))
+			goto done;
+	}
+
+	if (stream_sdr_fft) {
+		if (q.g_type() != V4L2_BUF_TYPE_SDR_CAPTURE) {
+			fprintf(stderr, "--stream-sdr-spectrum requires SDR capture\n");
+			goto done;
+		}
+		if (!sdr_spectrum_start(fd, stream_sdr_fft, stream_sdr_fft_avg))
+			goto done;
+	}
+
+	if (options[OptStreamDmaBuf]) {
+		if (exp_q.reqbufs(&exp_fd, reqbufs_count_cap))
+			goto done;
+		if (q.export_bufs(&exp_fd, exp_fd.g_type()))
+			goto done;
+	}
+
+	if (q.obtain_bufs(&fd))
+		goto done;
+
+	if (q.queue_all(&fd))
+		goto done;
+
+	fps_ts.determine_field(fd.g_fd(), q.g_type());
+
+	if (fd.streamon())
+		goto done;
+
+	fd.s_trace(0);
+	exp_fd.s_trace(0);
+
+	fd.g_fmt(fmt);
+
+	while (stream_sleep == 0)
+		sleep(100);
+
+	if (use_poll)
+		fcntl(fd.g_fd(), F_SETFL, fd_flags | O_NONBLOCK);
+
+#ifndef NO_STREAM_TO
+	if (fout && host_fd_to >= 0 && (stream_to_queue || host_num_fds_to > 1))
+		host_out_sender = host_sender_start(host_num_fds_to);
+#endif
+	if (fout && stream_to_queue)
+		cap_writer = stream_writer_start(fd, q, fmt, fout);
+
+	while (!eos && !source_change) {
+		__u32 events;
+		int r;
+
+		/* Make sure the driver has buffers to fill */
+		if (cap_writer && stream_writer_requeue(cap_writer, fd))
+			break;
+
+		r = loop.wait(use_poll ? stream_poll_timeout : 0);
+		if (r == -1) {
+			fprintf(stderr, "epoll error: %s\n",
+					strerror(errno));
+			goto done;
+		}
+		if (use_poll && r == 0) {
+			fprintf(stderr, "epoll timeout\n");
+			goto done;
+		}
+		events = loop.g_events(0);
+
+		if (events & EPOLLPRI) {
+			struct v4l2_event ev;
+
+			while (!fd.dqevent(ev)) {
+				switch (ev.type) {
+				case V4L2_EVENT_SOURCE_CHANGE:
+					source_change = true;
+					if (!verbose)
+						fprintf(stderr, "\n");
+					fprintf(stderr, "SOURCE CHANGE EVENT\n");
+					break;
+				case V4L2_EVENT_EOS:
+					eos = true;
+					if (!verbose)
+						fprintf(stderr, "\n");
+					fprintf(stderr, "EOS EVENT\n");
+					fflush(stderr);
+					break;
+				}
+			}
+		}
+
+		if (!use_poll || (events & EPOLLIN)) {
+			r = do_handle_cap(fd, q, fout, NULL,
+					  count, fps_ts, fmt, false);
+			if (r < 0)
+				break;
+		}
+
+	}
+	if (cap_writer) {
+		stream_writer_stop(cap_writer);
+		cap_writer = NULL;
+	}
+	sdr_spectrum_stop();
+#ifndef NO_STREAM_TO
+	if (host_out_sender) {
+		host_sender_stop(host_out_sender);
+		host_out_sender = NULL;
+	}
+#endif
+	fd.streamoff();
+	fcntl(fd.g_fd(), F_SETFL, fd_flags);
+	fprintf(stderr, "\n");
+
+	q.free(&fd);
+	tpg_free(&tpg);
+	if (source_change && !stream_no_query)
+		goto recover;
+
+done:
+	sdr_spectrum_stop();
+	if (options[OptStreamDmaBuf])
+		exp_q.close_exported_fds();
+#ifndef NO_STREAM_TO
+	if (direct_out) {
+		direct_output_close(direct_out);
+		direct_out = NULL;
+	}
+	if (fout && host_fd_to >= 0) {
+		host_iov hv = {};
+
+		host_write_u32(&hv, NULL, V4L_STREAM_PACKET_END);
+		host_send_all(&hv, MSG_NOSIGNAL, false);
+		/* fclose() closes the first one */
+		for (unsigned i = 1; i < host_num_fds_to; i++)
+			close(host_fds_to[i]);
+	}
+#endif
+	if (fout && fout != stdout)
+		fclose(fout);
+}
+
+#define MULTI_MAX_DEVICES 16
+
+/* A device captured from by streaming_set_multi() */
+struct multi_dev {
+	cv4l_fd *fd;
+	cv4l_queue q;
+	cv4l_fmt fmt;
+	fps_timestamps fps_ts;
+	unsigned count;
+	bool streaming;
+	bool stopped;
+	bool monotonic;
+	/* The skew against the first device since the last report, in seconds */
+	double skew_sum;
+	double skew_max;
+	unsigned skew_cnt;
+};
+
+/*
+ * The distance of ts to the nearest frame of the reference device,
+ * or false if there is no (comparable) reference frame.
+ */
+static bool multi_skew(const multi_dev &ref, const multi_dev &d, double ts, double &skew)
+{
+	double ref_ts = ref.fps_ts.last_ts();
+	double period = ref.fps_ts.period();
+
+	if (ref.stopped || !ref.monotonic || !d.monotonic ||
+	    ref_ts <= 0 || period <= 0)
+		return false;
+	skew = ts - ref_ts;
+	skew -= period * floor(skew / period + 0.5);
+	return true;
+}
+
+static int multi_handle_cap(multi_dev *devs, unsigned idx)
+{
+	multi_dev &d = devs[idx];
+	cv4l_buffer buf(d.q);
+
+	for (;;) {
+		int ret = d.fd->dqbuf(buf);
+
+		if (ret == EAGAIN)
+			return 0;
+		if (ret == EPIPE)
+			return QUEUE_STOPPED;
+		if (ret) {
+			fprintf(stderr, "%s: %s: failed: %s\n", d.fd->g_v4l_fd()->devname,
+				"VIDIOC_DQBUF", strerror(errno));
+			return QUEUE_ERROR;
+		}
+
+		bool is_empty_frame = !buf.g_bytesused(0);
+		bool is_error_frame = buf.g_flags() & V4L2_BUF_FLAG_ERROR;
+		double ts_secs = buf.g_timestamp().tv_sec + buf.g_timestamp().tv_usec / 1000000.0;
+		double skew;
+
+		d.monotonic = buf.g_timestamp_type() == V4L2_BUF_FLAG_TIMESTAMP_MONOTONIC;
+		if (!is_error_frame)
+			d.fps_ts.add_ts(ts_secs, buf.g_sequence(), buf.g_field());
+		if (idx && !is_error_frame && multi_skew(devs[0], d, ts_secs, skew)) {
+			d.skew_sum += skew;
+			if (fabs(skew) > d.skew_max)
+				d.skew_max = fabs(skew);
+			d.skew_cnt++;
+		}
+		if (verbose) {
+			fprintf(stderr, "%s: ", d.fd->g_v4l_fd()->devname);
+			print_concise_buffer(stderr, buf, d.fmt, d.q, d.fps_ts, -1);
+		} else if (d.fps_ts.has_fps()) {
+			unsigned dropped = d.fps_ts.dropped();
+
+			fprintf(stderr, "%s: %.02f fps", d.fd->g_v4l_fd()->devname, d.fps_ts.fps());
+			if (dropped)
+				fprintf(stderr, ", dropped buffers: %u", dropped);
+			if (d.skew_cnt)
+				fprintf(stderr, ", skew: %+.3f ms (max %.3f ms)",
+					d.skew_sum * 1000 / d.skew_cnt, d.skew_max * 1000);
+			fprintf(stderr, "\n");
+			d.skew_sum = d.skew_max = 0;
+			d.skew_cnt = 0;
+		}
 
-	aspect = fd.g_pixel_aspect(width, height);
-	if (p) {
-		host_port_to = strtoul(p + 1, 0L, 0);
-		*p = '\0';
+		if (buf.g_flags() & V4L2_BUF_FLAG_LAST)
+			return QUEUE_STOPPED;
+		if (d.fd->qbuf(buf)) {
+			fprintf(stderr, "%s: %s: qbuf error\n", d.fd->g_v4l_fd()->devname, __func__);
+			return QUEUE_ERROR;
+		}
+		if (is_empty_frame || is_error_frame)
+			continue;
+		if (++d.count > stream_skip && stream_count &&
+		    d.count - stream_skip >= stream_count)
+			return QUEUE_STOPPED;
 	}
-	host_fd_to = socket(AF_INET, SOCK_STREAM, 0);
-	if (host_fd_to < 0) {
-		fprintf(stderr, "cannot open socket");
-		std::exit(EXIT_SUCCESS);
+}
+
+/*
+ * Capture from the -d device and the --stream-devices devices at the same
+ * time. All devices are non-blocking and serviced from a single epoll loop,
+ * so their buffer timestamps can be compared: the skew of a device is the
+ * distance of its buffer timestamps to the nearest frame of the -d device.
+ */
+static void streaming_set_multi(cv4l_fd &fd)
+{
+	cv4l_fd extra_fds[MULTI_MAX_DEVICES - 1];
+	multi_dev devs[MULTI_MAX_DEVICES];
+	unsigned num_devs = 1;
+	unsigned active = 0;
+	cv4l_event_loop loop;
+
+	if (file_to || host_to || options[OptStreamDmaBuf]) {
+		fprintf(stderr, "--stream-devices can't be combined with --stream-to(-host) or --stream-dmabuf\n");
+		return;
 	}
-	server = gethostbyname(host_to);
-	if (server == NULL) {
-		fprintf(stderr, "no such host %s\n", host_to);
-		std::exit(EXIT_SUCCESS);
+
+	devs[0].fd = &fd;
+	for (char *dev = strtok(stream_devices, ","); dev; dev = strtok(NULL, ",")) {
+		std::string name = isdigit(dev[0]) ? std::string("/dev/video") + dev : dev;
+		cv4l_fd &xfd = extra_fds[num_devs - 1];
+
+		if (num_devs == MULTI_MAX_DEVICES) {
+			fprintf(stderr, "at most %u devices are supported\n", MULTI_MAX_DEVICES);
+			goto close;
+		}
+		xfd.s_direct(fd.g_direct());
+		if (xfd.open(name.c_str()) < 0) {
+			fprintf(stderr, "Failed to open %s: %s\n", name.c_str(), strerror(errno));
+			goto close;
+		}
+		xfd.s_trace(fd.g_trace());
+		devs[num_devs++].fd = &xfd;
 	}
-	memset(reinterpret_cast<char *>(&serv_addr), 0, sizeof(serv_addr));
-	serv_addr.sin_family = AF_INET;
-	memcpy(reinterpret_cast<char *>(&serv_addr.sin_addr.s_addr),
-	       server->h_addr,
-	       server->h_length);
-	serv_addr.sin_port = htons(host_port_to);
-	if (connect(host_fd_to, reinterpret_cast<struct sockaddr *>(&serv_addr), sizeof(serv_addr)) < 0) {
-		fprintf(stderr, "could not connect\n");
-		std::exit(EXIT_SUCCESS);
+
+	for (unsigned i = 0; i < num_devs; i++) {
+		multi_dev &d = devs[i];
+
+		if (!v4l_type_is_capture(d.fd->g_type())) {
+			fprintf(stderr, "%s: not a capture device\n", d.fd->g_v4l_fd()->devname);
+			goto done;
+		}
+		d.q.init(d.fd->g_type(), memory);
+		d.count = 0;
+		d.streaming = d.stopped = d.monotonic = false;
+		d.skew_sum = d.skew_max = 0;
+		d.skew_cnt = 0;
+		subscribe_event(*d.fd, V4L2_EVENT_EOS);
+		if (d.q.reqbufs(d.fd, reqbufs_count_cap) ||
+		    d.q.obtain_bufs(d.fd) || d.q.queue_all(d.fd))
+			goto done;
+		d.fps_ts.determine_field(d.fd->g_fd(), d.q.g_type());
+		d.fd->g_fmt(d.fmt);
 	}
-	fout = fdopen(host_fd_to, "a");
-	write_u32(fout, V4L_STREAM_ID);
-	write_u32(fout, V4L_STREAM_VERSION);
-	write_u32(fout, V4L_STREAM_PACKET_FMT_VIDEO);
-	write_u32(fout, V4L_STREAM_PACKET_FMT_VIDEO_SIZE(cfmt.g_num_planes()));
-	write_u32(fout, V4L_STREAM_PACKET_FMT_VIDEO_SIZE_FMT);
-	write_u32(fout, cfmt.g_num_planes());
-	write_u32(fout, cfmt.g_pixelformat());
-	write_u32(fout, cfmt.g_width());
-	write_u32(fout, cfmt.g_height());
-	write_u32(fout, cfmt.g_field());
-	write_u32(fout, cfmt.g_colorspace());
-	write_u32(fout, cfmt.g_ycbcr_enc());
-	write_u32(fout, cfmt.g_quantization());
-	write_u32(fout, cfmt.g_xfer_func());
-	write_u32(fout, cfmt.g_flags());
-	write_u32(fout, aspect.numerator);
-	write_u32(fout, aspect.denominator);
-	for (unsigned i = 0; i < cfmt.g_num_planes(); i++) {
-		write_u32(fout, V4L_STREAM_PACKET_FMT_VIDEO_SIZE_FMT_PLANE);
-		write_u32(fout, cfmt.g_sizeimage(i));
-		write_u32(fout, cfmt.g_bytesperline(i));
-		bpl_cap[i] = rle_calc_bpl(cfmt.g_bytesperline(i), cfmt.g_pixelformat());
+
+	loop.s_busy_poll(stream_busy_poll);
+	for (unsigned i = 0; i < num_devs; i++) {
+		int err;
+
+		fcntl(devs[i].fd->g_fd(), F_SETFL,
+		      fcntl(devs[i].fd->g_fd(), F_GETFL) | O_NONBLOCK);
+		err = loop.add(devs[i].fd->g_fd(), EPOLLIN | EPOLLPRI, i);
+		if (err) {
+			fprintf(stderr, "epoll error: %s\n", strerror(err));
+			goto done;
+		}
 	}
-	if (!host_lossless) {
-		unsigned visible_width = support_cap_compose ? composed_width : cfmt.g_width();
-		unsigned visible_height = support_cap_compose ? composed_height : cfmt.g_height();
 
-		ctx = fwht_alloc(cfmt.g_pixelformat(), visible_width, visible_height,
-				 cfmt.g_width(), cfmt.g_height(),
-				 cfmt.g_field(), cfmt.g_colorspace(), cfmt.g_xfer_func(),
-				 cfmt.g_ycbcr_enc(), cfmt.g_quantization());
+	/* Start all devices back to back, after all buffers were set up */
+	for (unsigned i = 0; i < num_devs; i++) {
+		if (devs[i].fd->streamon())
+			goto done;
+		devs[i].streaming = true;
+		active++;
+	}
+	for (unsigned i = 0; i < num_devs; i++)
+		devs[i].fd->s_trace(0);
+
+	while (stream_sleep == 0)
+		sleep(100);
+
+	while (active) {
+		int n = loop.wait(stream_poll_timeout);
+
+		if (n == -1) {
+			fprintf(stderr, "epoll error: %s\n", strerror(errno));
+			break;
+		}
+		if (n == 0) {
+			fprintf(stderr, "epoll timeout\n");
+			break;
+		}
+
+		for (unsigned i = 0; i < num_devs; i++) {
+			__u32 events = loop.g_events(i);
+			multi_dev &d = devs[i];
+			bool stop = false;
+
+			if (d.stopped || !events)
+				continue;
+			if (events & EPOLLPRI) {
+				struct v4l2_event ev;
+
+				while (!d.fd->dqevent(ev)) {
+					if (ev.type != V4L2_EVENT_EOS)
+						continue;
+					fprintf(stderr, "%s: EOS EVENT\n", d.fd->g_v4l_fd()->devname);
+					stop = true;
+				}
+			}
+			if ((events & EPOLLIN) && multi_handle_cap(devs, i) < 0)
+				stop = true;
+			if (stop) {
+				loop.del(d.fd->g_fd());
+				d.stopped = true;
+				active--;
+			}
+		}
+	}
+
+done:
+	for (unsigned i = 0; i < num_devs; i++) {
+		multi_dev &d = devs[i];
+
+		if (d.streaming)
+			d.fd->streamoff();
+		fcntl(d.fd->g_fd(), F_SETFL,
+		      fcntl(d.fd->g_fd(), F_GETFL) & ~O_NONBLOCK);
+		d.q.free(d.fd);
+	}
+	fprintf(stderr, "\n");
+close:
+	for (unsigned i = 1; i < num_devs; i++)
+		devs[i].fd->close();
+}
+
+/* Frames that wait for the buffer of the other node, indexed by sequence */
+#define META_MATCH_WINDOW	32
+
+struct meta_match {
+	bool valid;
+	__u32 sequence;
+	double ts;		/* video: the buffer timestamp */
+	meta_fields fields;	/* meta: the decoded buffer */
+};
+
+struct meta_match_state {
+	meta_match video[META_MATCH_WINDOW];
+	meta_match meta[META_MATCH_WINDOW];
+	unsigned matched;
+	unsigned unmatched;
+	/* delay from the first UVC payload to the video timestamp, in seconds */
+	double delay_sum;
+	double delay_max;
+	unsigned delay_cnt;
+};
+
+/*
+ * Store a dequeued video (is_meta == false) or meta buffer and pair it with
+ * the buffer of the other node with the same sequence number. Unpaired
+ * entries are counted as unmatched when they are overwritten.
+ */
+static void meta_match_add(meta_match_state &s, bool is_meta, const meta_match &e)
+{
+	meta_match &slot = (is_meta ? s.meta : s.video)[e.sequence % META_MATCH_WINDOW];
+	meta_match &other = (is_meta ? s.video : s.meta)[e.sequence % META_MATCH_WINDOW];
+
+	if (slot.valid)
+		s.unmatched++;
+	slot = e;
+	if (!other.valid || other.sequence != e.sequence)
+		return;
+
+	const meta_match &video = is_meta ? other : slot;
+	const meta_fields &m = is_meta ? slot.fields : other.fields;
+
+	s.matched++;
+	if (m.dataformat == V4L2_META_FMT_UVC && m.ns) {
+		double delay = video.ts - m.ns / 1000000000.0;
+
+		s.delay_sum += delay;
+		if (delay > s.delay_max)
+			s.delay_max = delay;
+		s.delay_cnt++;
+	}
+	if (verbose) {
+		fprintf(stderr, "seq: %u ts: %.06f ", video.sequence, video.ts);
+		if (m.dataformat == V4L2_META_FMT_UVC)
+			fprintf(stderr, "blocks: %u ", m.blocks);
+		print_meta_fields(stderr, m);
+	}
+	slot.valid = other.valid = false;
+}
+
+static int meta_handle_cap(multi_dev *devs, unsigned idx, meta_match_state &s)
+{
+	multi_dev &d = devs[idx];
+	cv4l_buffer buf(d.q);
+
+	for (;;) {
+		int ret = d.fd->dqbuf(buf);
+
+		if (ret == EAGAIN)
+			return 0;
+		if (ret == EPIPE)
+			return QUEUE_STOPPED;
+		if (ret) {
+			fprintf(stderr, "%s: %s: failed: %s\n", d.fd->g_v4l_fd()->devname,
+				"VIDIOC_DQBUF", strerror(errno));
+			return QUEUE_ERROR;
+		}
+
+		bool is_empty_frame = !buf.g_bytesused(0);
+		bool is_error_frame = buf.g_flags() & V4L2_BUF_FLAG_ERROR;
+		double ts_secs = buf.g_timestamp().tv_sec + buf.g_timestamp().tv_usec / 1000000.0;
+		meta_match e = {};
+
+		e.valid = true;
+		e.sequence = buf.g_sequence();
+		e.ts = ts_secs;
+		if (is_empty_frame || is_error_frame)
+			e.valid = false;
+		else if (idx == 0)
+			d.fps_ts.add_ts(ts_secs, buf.g_sequence(), buf.g_field());
+		else if (!decode_meta_buffer(d.q.g_dataptr(buf.g_index(), 0),
+					     buf.g_bytesused(0), d.fmt.g_pixelformat(),
+					     e.fields))
+			e.valid = false;
+		if (e.valid)
+			meta_match_add(s, idx, e);
+
+		if (idx == 0 && !verbose && d.fps_ts.has_fps()) {
+			unsigned dropped = d.fps_ts.dropped();
+
+			fprintf(stderr, "%.02f fps", d.fps_ts.fps());
+			if (dropped)
+				fprintf(stderr, ", dropped buffers: %u", dropped);
+			fprintf(stderr, ", meta matched: %u unmatched: %u", s.matched, s.unmatched);
+			if (s.delay_cnt)
+				fprintf(stderr, ", delay: %.3f ms (max %.3f ms)",
+					s.delay_sum * 1000 / s.delay_cnt, s.delay_max * 1000);
+			fprintf(stderr, "\n");
+			s.matched = s.unmatched = 0;
+			s.delay_sum = s.delay_max = 0;
+			s.delay_cnt = 0;
+		}
+
+		if (buf.g_flags() & V4L2_BUF_FLAG_LAST)
+			return QUEUE_STOPPED;
+		/* The meta buffer has been decoded, so it can be requeued right away */
+		if (d.fd->qbuf(buf)) {
+			fprintf(stderr, "%s: %s: qbuf error\n", d.fd->g_v4l_fd()->devname, __func__);
+			return QUEUE_ERROR;
+		}
+		if (idx || is_empty_frame || is_error_frame)
+			continue;
+		if (++d.count > stream_skip && stream_count &&
+		    d.count - stream_skip >= stream_count)
+			return QUEUE_STOPPED;
+	}
+}
+
+/*
+ * Capture from the -d video node and the --stream-meta metadata node at
+ * the same time, serviced by a single epoll loop, and pair the buffers of
+ * both with the same sequence number. Capturing stops when the video node
+ * stops.
+ */
+static void streaming_set_meta(cv4l_fd &fd)
+{
+	cv4l_fd meta_fd;
+	multi_dev devs[2];
+	meta_match_state *s = new meta_match_state();
+	cv4l_event_loop loop;
+	bool stop = false;
+	std::string name;
+
+	if (file_to || host_to || options[OptStreamDmaBuf] || memory != V4L2_MEMORY_MMAP) {
+		fprintf(stderr, "--stream-meta requires --stream-mmap and can't be combined with --stream-to(-host) or --stream-dmabuf\n");
+		goto free;
+	}
+	name = isdigit(stream_meta[0]) ? std::string("/dev/video") + stream_meta : stream_meta;
+	meta_fd.s_direct(fd.g_direct());
+	if (meta_fd.open(name.c_str()) < 0) {
+		fprintf(stderr, "Failed to open %s: %s\n", name.c_str(), strerror(errno));
+		goto free;
+	}
+	meta_fd.s_trace(fd.g_trace());
+	if (!v4l_type_is_video(fd.g_type()) ||
+	    !(meta_fd.g_caps() & V4L2_CAP_META_CAPTURE)) {
+		fprintf(stderr, "--stream-meta needs a video capture -d device and a metadata capture device\n");
+		goto close;
+	}
+	meta_fd.s_type(V4L2_BUF_TYPE_META_CAPTURE);
+	devs[0].fd = &fd;
+	devs[1].fd = &meta_fd;
+
+	for (unsigned i = 0; i < 2; i++) {
+		multi_dev &d = devs[i];
+
+		d.q.init(d.fd->g_type(), memory);
+		d.count = 0;
+		d.streaming = d.stopped = false;
+		subscribe_event(*d.fd, V4L2_EVENT_EOS);
+		if (d.q.reqbufs(d.fd, reqbufs_count_cap) ||
+		    d.q.obtain_bufs(d.fd) || d.q.queue_all(d.fd))
+			goto done;
+		d.fps_ts.determine_field(d.fd->g_fd(), d.q.g_type());
+		d.fd->g_fmt(d.fmt);
+	}
+
+	loop.s_busy_poll(stream_busy_poll);
+	for (unsigned i = 0; i < 2; i++) {
+		int err;
+
+		fcntl(devs[i].fd->g_fd(), F_SETFL,
+		      fcntl(devs[i].fd->g_fd(), F_GETFL) | O_NONBLOCK);
+		err = loop.add(devs[i].fd->g_fd(), EPOLLIN | EPOLLPRI, i);
+		if (err) {
+			fprintf(stderr, "epoll error: %s\n", strerror(err));
+			goto done;
+		}
+	}
+
+	/* Start the metadata node first, so it has buffers for the first frame */
+	for (unsigned i = 2; i-- > 0;) {
+		if (devs[i].fd->streamon())
+			goto done;
+		devs[i].streaming = true;
+	}
+	for (unsigned i = 0; i < 2; i++)
+		devs[i].fd->s_trace(0);
+
+	while (stream_sleep == 0)
+		sleep(100);
+
+	while (!stop) {
+		int n = loop.wait(stream_poll_timeout);
+
+		if (n == -1) {
+			fprintf(stderr, "epoll error: %s\n", strerror(errno));
+			break;
+		}
+		if (n == 0) {
+			fprintf(stderr, "epoll timeout\n");
+			break;
+		}
+
+		for (unsigned i = 0; i < 2; i++) {
+			__u32 events = loop.g_events(i);
+			multi_dev &d = devs[i];
+
+			if (d.stopped || !events)
+				continue;
+			if (events & EPOLLPRI) {
+				struct v4l2_event ev;
+
+				while (!d.fd->dqevent(ev)) {
+					if (ev.type != V4L2_EVENT_EOS)
+						continue;
+					fprintf(stderr, "%s: EOS EVENT\n", d.fd->g_v4l_fd()->devname);
+					d.stopped = true;
+				}
+			}
+			if ((events & EPOLLIN) && meta_handle_cap(devs, i, *s) < 0)
+				d.stopped = true;
+			if (d.stopped) {
+				loop.del(d.fd->g_fd());
+				/* Without video there is nothing to match against */
+				if (i == 0)
+					stop = true;
+			}
+		}
+	}
+
+done:
+	for (unsigned i = 0; i < 2; i++) {
+		multi_dev &d = devs[i];
+
+		if (d.streaming)
+			d.fd->streamoff();
+		fcntl(d.fd->g_fd(), F_SETFL,
+		      fcntl(d.fd->g_fd(), F_GETFL) & ~O_NONBLOCK);
+		d.q.free(d.fd);
+	}
+	fprintf(stderr, "\n");
+close:
+	meta_fd.close();
+free:
+	delete s;
+}
+
+/*
+ * Wait until VIDIOC_QUERY_DV_TIMINGS reports the timings that were set.
+ * Returns the time this took in ms, 0 if the driver can't query timings
+ * and -1 on a timeout.
+ */
+static double dv_sweep_lock(cv4l_fd &fd, const v4l2_dv_timings &t, __u64 start)
+{
+	for (;;) {
+		v4l2_dv_timings q = {};
+		int ret = fd.query_dv_timings(q);
+		double ms = (bench_now() - start) / 1000000.0;
+
+		if (ret == ENOTTY)
+			return 0;
+		if (!ret && q.bt.width == t.bt.width && q.bt.height == t.bt.height &&
+		    q.bt.interlaced == t.bt.interlaced)
+			return ms;
+		if (stream_poll_timeout >= 0 && ms > stream_poll_timeout)
+			return -1;
+		usleep(1000);
+	}
+}
+
+/*
+ * Capture count frames with the current timings. Returns the time from
+ * start to the first frame in ms, or -1 on an error or timeout.
+ */
+static double dv_sweep_capture(cv4l_fd &fd, cv4l_queue &q, unsigned count,
+			       __u64 start, double &fps)
+{
+	struct pollfd pfd = { fd.g_fd(), POLLIN, 0 };
+	double first_frame = -1;
+	double first_ts = 0, last_ts = 0;
+	unsigned frames = 0;
+
+	fps = 0;
+	if (q.reqbufs(&fd, reqbufs_count_cap) || q.obtain_bufs(&fd) ||
+	    q.queue_all(&fd) || fd.streamon())
+		goto free;
+
+	while (frames < count) {
+		cv4l_buffer buf(q);
+
+		if (poll(&pfd, 1, stream_poll_timeout) <= 0)
+			break;
+		if (fd.dqbuf(buf)) {
+			if (errno == EAGAIN)
+				continue;
+			break;
+		}
+		if (!(buf.g_flags() & V4L2_BUF_FLAG_ERROR) && buf.g_bytesused(0)) {
+			double ts = buf.g_timestamp().tv_sec + buf.g_timestamp().tv_usec / 1000000.0;
+
+			if (!frames++) {
+				first_frame = (bench_now() - start) / 1000000.0;
+				first_ts = ts;
+			}
+			last_ts = ts;
+		}
+		if (fd.qbuf(buf))
+			break;
+	}
+	if (frames > 1 && last_ts > first_ts)
+		fps = (frames - 1) / (last_ts - first_ts);
+	fd.streamoff();
+free:
+	q.free(&fd);
+	return first_frame;
+}
+
+/*
+ * Cycle through the --stream-dv-sweep timings in one process: set each
+ * one, wait for the receiver to lock, capture a few frames and report how
+ * long it took until the first frame and the measured frame rate.
+ */
+static void streaming_set_dv_sweep(cv4l_fd &fd)
+{
+	std::vector<v4l2_dv_timings> table;
+	unsigned count = stream_count ? stream_count : 30;
+	unsigned failed = 0;
+	int fd_flags = fcntl(fd.g_fd(), F_GETFL);
+	__u64 sweep_start = bench_now();
+
+	if (file_to || host_to || options[OptStreamDmaBuf]) {
+		fprintf(stderr, "--stream-dv-sweep can't be combined with --stream-to(-host) or --stream-dmabuf\n");
+		return;
+	}
+	if (!dv_sweep_load(stream_dv_sweep, table))
+		return;
+
+	fcntl(fd.g_fd(), F_SETFL, fd_flags | O_NONBLOCK);
+	printf("Timings                   Lock (ms)  First frame (ms)  FPS (expected)\n");
+	for (auto &t : table) {
+		const v4l2_bt_timings &bt = t.bt;
+		double tot = static_cast<double>(V4L2_DV_BT_FRAME_WIDTH(&bt)) *
+			     V4L2_DV_BT_FRAME_HEIGHT(&bt);
+		double expected = tot ? bt.pixelclock / tot * (bt.interlaced ? 2 : 1) : 0;
+		cv4l_queue q(fd.g_type(), memory);
+		char name[32];
+		double lock = 0, first_frame = -1, fps = 0;
+		__u64 start = bench_now();
+		v4l2_dv_timings s = t;
+
+		snprintf(name, sizeof(name), "%ux%u%c%.2f", bt.width, bt.height,
+			 bt.interlaced ? 'i' : 'p', expected);
+		if (fd.s_dv_timings(s)) {
+			printf("%-25s failed to set the timings\n", name);
+			failed++;
+			continue;
+		}
+		lock = dv_sweep_lock(fd, t, start);
+		if (lock >= 0)
+			first_frame = dv_sweep_capture(fd, q, count, start, fps);
+		if (lock < 0)
+			printf("%-25s no lock\n", name);
+		else if (first_frame < 0)
+			printf("%-25s %9.1f  no frames\n", name, lock);
+		else
+			printf("%-25s %9.1f  %16.1f  %.2f (%.2f)\n", name, lock,
+			       first_frame, fps, expected);
+		if (lock < 0 || first_frame < 0)
+			failed++;
+		fflush(stdout);
+	}
+	fcntl(fd.g_fd(), F_SETFL, fd_flags);
+	printf("%zu timings, %u failed, %.1f s\n", table.size(), failed,
+	       (bench_now() - sweep_start) / 1000000000.0);
+}
+
+#define CHAIN_MAX_STAGES	8
+#define CHAIN_MAX_INFLIGHT	64
+
+/*
+ * A stage of streaming_set_chain(): stage 0 is the -d capture device, the
+ * others are the --stream-chain m2m devices. The CAPTURE buffers of a
+ * stage are exported and imported by the OUTPUT queue of the next stage,
+ * using the same buffer index.
+ */
+struct chain_stage {
+	cv4l_fd *fd;
+	cv4l_queue out;
+	cv4l_queue cap;
+	cv4l_fmt fmt;
+	fps_timestamps fps_ts;
+	unsigned count;
+	bool streaming;
+	/* The timestamp and QBUF time of the frames queued to OUTPUT */
+	__u64 inflight_ts[CHAIN_MAX_INFLIGHT];
+	__u64 inflight_ns[CHAIN_MAX_INFLIGHT];
+	unsigned inflight_idx;
+	/* OUTPUT QBUF to CAPTURE DQBUF, since the last report and overall */
+	__u64 lat_sum, lat_max, lat_cnt;
+	__u64 lat_total_sum, lat_total_max, lat_total_cnt;
+};
+
+/* Parse <device>[:<width>x<height>[:<fourcc>]] and set up the stage */
+static int chain_open_stage(chain_stage &s, cv4l_fd &xfd, cv4l_fd &fd,
+			    const chain_stage &prev, char *spec)
+{
+	char *dev = strtok_r(spec, ":", &spec);
+	char *size = strtok_r(NULL, ":", &spec);
+	char *fourcc = strtok_r(NULL, ":", &spec);
+	std::string name = isdigit(dev[0]) ? std::string("/dev/video") + dev : dev;
+	__u32 width = 0, height = 0;
+	cv4l_fmt fmt;
+
+	if ((size && sscanf(size, "%ux%u", &width, &height) != 2) ||
+	    (fourcc && strlen(fourcc) != 4)) {
+		fprintf(stderr, "invalid stage '%s'\n", dev);
+		return -1;
+	}
+	xfd.s_direct(fd.g_direct());
+	if (xfd.open(name.c_str()) < 0) {
+		fprintf(stderr, "Failed to open %s: %s\n", name.c_str(), strerror(errno));
+		return -1;
+	}
+	xfd.s_trace(fd.g_trace());
+	s.fd = &xfd;
+	if (!xfd.has_vid_m2m()) {
+		fprintf(stderr, "%s: not an m2m device\n", name.c_str());
+		return -1;
+	}
+
+	/* The OUTPUT format is that of the CAPTURE buffers of the previous stage */
+	s.out.init(v4l_type_invert(xfd.g_type()), V4L2_MEMORY_DMABUF);
+	s.cap.init(xfd.g_type(), V4L2_MEMORY_MMAP);
+	xfd.g_fmt(fmt, s.out.g_type());
+	fmt.s_pixelformat(prev.fmt.g_pixelformat());
+	fmt.s_width(prev.fmt.g_width());
+	fmt.s_height(prev.fmt.g_height());
+	fmt.s_field(prev.fmt.g_field());
+	fmt.s_colorspace(prev.fmt.g_colorspace());
+	fmt.s_xfer_func(prev.fmt.g_xfer_func());
+	fmt.s_ycbcr_enc(prev.fmt.g_ycbcr_enc());
+	fmt.s_quantization(prev.fmt.g_quantization());
+	if (xfd.s_fmt(fmt) || fmt.g_pixelformat() != prev.fmt.g_pixelformat() ||
+	    fmt.g_width() != prev.fmt.g_width() || fmt.g_height() != prev.fmt.g_height()) {
+		fprintf(stderr, "%s: cannot set the OUTPUT format to %s %ux%u\n", name.c_str(),
+			fcc2s(prev.fmt.g_pixelformat()).c_str(),
+			prev.fmt.g_width(), prev.fmt.g_height());
+		return -1;
+	}
+	xfd.g_fmt(s.fmt, s.cap.g_type());
+	if (width) {
+		s.fmt.s_width(width);
+		s.fmt.s_height(height);
+	}
+	if (fourcc)
+		s.fmt.s_pixelformat(v4l2_fourcc(fourcc[0], fourcc[1], fourcc[2], fourcc[3]));
+	if ((width || fourcc) && xfd.s_fmt(s.fmt)) {
+		fprintf(stderr, "%s: cannot set the CAPTURE format\n", name.c_str());
+		return -1;
+	}
+	xfd.g_fmt(s.fmt, s.cap.g_type());
+	return 0;
+}
+
+static void chain_report(chain_stage &s, unsigned i)
+{
+	unsigned dropped = s.fps_ts.dropped();
+
+	fprintf(stderr, "%u %s: %.02f fps", i, s.fd->g_v4l_fd()->devname, s.fps_ts.fps());
+	if (dropped)
+		fprintf(stderr, ", dropped buffers: %u", dropped);
+	if (s.lat_cnt)
+		fprintf(stderr, ", latency: %.3f ms (max %.3f ms)",
+			s.lat_sum / 1000000.0 / s.lat_cnt, s.lat_max / 1000000.0);
+	fprintf(stderr, "\n");
+	s.lat_sum = s.lat_max = s.lat_cnt = 0;
+}
+
+/* Pass a CAPTURE buffer of stage i to the OUTPUT queue of stage i + 1 */
+static int chain_pass(chain_stage *stages, unsigned i, cv4l_buffer &buf)
+{
+	chain_stage &s = stages[i];
+	chain_stage &next = stages[i + 1];
+	cv4l_buffer ob(next.out, buf.g_index());
+
+	for (unsigned p = 0; p < buf.g_num_planes(); p++) {
+		ob.s_fd(s.cap.g_fd(buf.g_index(), p), p);
+		ob.s_length(s.cap.g_length(p), p);
+		ob.s_bytesused(buf.g_bytesused(p), p);
+		ob.s_data_offset(buf.g_data_offset(p), p);
+	}
+	ob.s_field(buf.g_field());
+	ob.s_timestamp(buf.g_timestamp());
+	next.inflight_ts[next.inflight_idx] = ob.g_timestamp_ns();
+	next.inflight_ns[next.inflight_idx] = bench_now();
+	next.inflight_idx = (next.inflight_idx + 1) % CHAIN_MAX_INFLIGHT;
+	if (next.fd->qbuf(ob)) {
+		fprintf(stderr, "%s: %s: failed: %s\n", next.fd->g_v4l_fd()->devname,
+			"VIDIOC_QBUF", strerror(errno));
+		return QUEUE_ERROR;
+	}
+	return 0;
+}
+
+static int chain_handle_cap(chain_stage *stages, unsigned num_stages, unsigned i)
+{
+	chain_stage &s = stages[i];
+	cv4l_buffer buf(s.cap);
+
+	for (;;) {
+		int ret = s.fd->dqbuf(buf);
+
+		if (ret == EAGAIN)
+			return 0;
+		if (ret == EPIPE)
+			return QUEUE_STOPPED;
+		if (ret) {
+			fprintf(stderr, "%s: %s: failed: %s\n", s.fd->g_v4l_fd()->devname,
+				"VIDIOC_DQBUF", strerror(ret));
+			return QUEUE_ERROR;
+		}
+
+		bool is_error_frame = buf.g_flags() & V4L2_BUF_FLAG_ERROR;
+		double ts_secs = buf.g_timestamp().tv_sec + buf.g_timestamp().tv_usec / 1000000.0;
+		__u64 now = bench_now();
+
+		if (!is_error_frame)
+			s.fps_ts.add_ts(ts_secs, buf.g_sequence(), buf.g_field());
+		for (unsigned j = 0; i && j < CHAIN_MAX_INFLIGHT; j++) {
+			if (!s.inflight_ns[j] || s.inflight_ts[j] != buf.g_timestamp_ns())
+				continue;
+
+			__u64 lat = now - s.inflight_ns[j];
+
+			s.inflight_ns[j] = 0;
+			s.lat_sum += lat;
+			s.lat_total_sum += lat;
+			s.lat_cnt++;
+			s.lat_total_cnt++;
+			if (lat > s.lat_max)
+				s.lat_max = lat;
+			if (lat > s.lat_total_max)
+				s.lat_total_max = lat;
+			break;
+		}
+		if (verbose) {
+			fprintf(stderr, "%u %s: ", i, s.fd->g_v4l_fd()->devname);
+			print_concise_buffer(stderr, buf, s.fmt, s.cap, s.fps_ts, -1);
+		} else if (s.fps_ts.has_fps()) {
+			chain_report(s, i);
+		}
+
+		bool last = buf.g_flags() & V4L2_BUF_FLAG_LAST;
+
+		if (i + 1 < num_stages && !is_error_frame && buf.g_bytesused(0))
+			ret = chain_pass(stages, i, buf);
+		else
+			ret = s.fd->qbuf(buf) ? QUEUE_ERROR : 0;
+		if (ret)
+			return ret;
+		if (last)
+			return QUEUE_STOPPED;
+		if (i + 1 < num_stages || is_error_frame)
+			continue;
+		if (++s.count > stream_skip && stream_count &&
+		    s.count - stream_skip >= stream_count)
+			return QUEUE_STOPPED;
 	}
-	fflush(fout);
-#endif
-	return fout;
 }
 
-static void streaming_set_cap(cv4l_fd &fd, cv4l_fd &exp_fd)
+/* Give the dequeued OUTPUT buffers of stage i back to stage i - 1 */
+static int chain_handle_out(chain_stage *stages, unsigned i)
 {
-	int fd_flags = fcntl(fd.g_fd(), F_GETFL);
-	cv4l_queue q(fd.g_type(), memory);
-	cv4l_queue exp_q(exp_fd.g_type(), V4L2_MEMORY_MMAP);
-	fps_timestamps fps_ts;
-	bool use_poll = options[OptStreamPoll];
-	unsigned count;
-	bool eos;
-	bool source_change;
-	FILE *fout = NULL;
-	cv4l_fmt fmt;
+	chain_stage &s = stages[i];
+	chain_stage &prev = stages[i - 1];
+	cv4l_buffer buf(s.out);
 
-	if (!(capabilities & (V4L2_CAP_VIDEO_CAPTURE | V4L2_CAP_VIDEO_CAPTURE_MPLANE |
-			      V4L2_CAP_VBI_CAPTURE | V4L2_CAP_SLICED_VBI_CAPTURE |
-			      V4L2_CAP_META_CAPTURE | V4L2_CAP_SDR_CAPTURE |
-			      V4L2_CAP_VIDEO_M2M | V4L2_CAP_VIDEO_M2M_MPLANE))) {
-		fprintf(stderr, "unsupported stream type\n");
-		return;
+	for (;;) {
+		int ret = s.fd->dqbuf(buf);
+
+		if (ret == EAGAIN)
+			return 0;
+		if (ret) {
+			fprintf(stderr, "%s: %s: failed: %s\n", s.fd->g_v4l_fd()->devname,
+				"VIDIOC_DQBUF", strerror(ret));
+			return QUEUE_ERROR;
+		}
+
+		cv4l_buffer cbuf(prev.cap, buf.g_index());
+
+		if (prev.fd->qbuf(cbuf)) {
+			fprintf(stderr, "%s: %s: failed: %s\n", prev.fd->g_v4l_fd()->devname,
+				"VIDIOC_QBUF", strerror(errno));
+			return QUEUE_ERROR;
+		}
 	}
-	if (options[OptStreamDmaBuf] && exp_fd.g_fd() < 0) {
-		fprintf(stderr, "--stream-dmabuf can only work in combination with --export-device\n");
+}
+
+/*
+ * Capture from the -d device and pass the buffers through a linear chain
+ * of m2m devices (e.g. a scaler and an encoder) without copying: each
+ * stage exports its CAPTURE buffers as DMABUFs that are imported by the
+ * OUTPUT queue of the next stage. Everything is serviced from a single
+ * epoll loop and every second the fps of each stage and the latency from
+ * queueing a frame to a stage until it comes out of that stage are reported.
+ */
+static void streaming_set_chain(cv4l_fd &fd)
+{
+	cv4l_fd extra_fds[CHAIN_MAX_STAGES - 1];
+	chain_stage stages[CHAIN_MAX_STAGES];
+	unsigned num_stages = 1;
+	cv4l_event_loop loop;
+	bool stop = false;
+
+	if (file_to || host_to || !options[OptStreamMmap]) {
+		fprintf(stderr, "--stream-chain needs --stream-mmap and can't be combined with --stream-to(-host)\n");
 		return;
 	}
-	switch (q.g_type()) {
-	case V4L2_BUF_TYPE_VIDEO_CAPTURE:
-	case V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE:
-		break;
-	default:
-		if (host_to) {
-			fprintf(stderr, "--stream-to-host is not supported for non-video streams\n");
-			return;
-		}
-		break;
+	if (!v4l_type_is_capture(fd.g_type()) || fd.has_vid_m2m()) {
+		fprintf(stderr, "--stream-chain needs a capture device\n");
+		return;
 	}
 
-	subscribe_event(fd, V4L2_EVENT_EOS);
-	if (use_poll)
-		subscribe_event(fd, V4L2_EVENT_SOURCE_CHANGE);
+	for (unsigned i = 0; i < CHAIN_MAX_STAGES; i++) {
+		chain_stage &s = stages[i];
 
-recover:
-	eos = false;
-	source_change = false;
-	count = 0;
+		s.fd = NULL;
+		s.count = s.inflight_idx = 0;
+		s.streaming = false;
+		memset(s.inflight_ns, 0, sizeof(s.inflight_ns));
+		s.lat_sum = s.lat_max = s.lat_cnt = 0;
+		s.lat_total_sum = s.lat_total_max = s.lat_total_cnt = 0;
+	}
+	stages[0].fd = &fd;
+	stages[0].cap.init(fd.g_type(), V4L2_MEMORY_MMAP);
+	fd.g_fmt(stages[0].fmt, stages[0].cap.g_type());
+
+	for (char *spec = strtok(stream_chain, ","); spec; spec = strtok(NULL, ",")) {
+		if (num_stages == CHAIN_MAX_STAGES) {
+			fprintf(stderr, "at most %u stages are supported\n", CHAIN_MAX_STAGES);
+			goto close;
+		}
+		if (chain_open_stage(stages[num_stages], extra_fds[num_stages - 1], fd,
+				     stages[num_stages - 1], spec)) {
+			/* Close it as well if it was opened */
+			if (stages[num_stages].fd)
+				num_stages++;
+			goto close;
+		}
+		num_stages++;
+	}
 
-	if (!stream_no_query) {
-		cv4l_disable_trace dt(fd);
-		struct v4l2_dv_timings new_dv_timings = {};
-		v4l2_std_id new_std;
-		struct v4l2_input in = { };
+	for (unsigned i = 0; i < num_stages; i++) {
+		chain_stage &s = stages[i];
 
-		if (!fd.g_input(in.index) && !fd.enum_input(in, true, in.index)) {
-			if (in.capabilities & V4L2_IN_CAP_DV_TIMINGS) {
-				while (fd.query_dv_timings(new_dv_timings))
-					sleep(1);
-				fd.s_dv_timings(new_dv_timings);
-				fprintf(stderr, "New timings found\n");
-			} else if (in.capabilities & V4L2_IN_CAP_STD) {
-				if (!fd.query_std(new_std))
-					fd.s_std(new_std);
+		if (i) {
+			if (s.out.reqbufs(s.fd, stages[i - 1].cap.g_buffers()))
+				goto done;
+			if (s.out.g_buffers() != stages[i - 1].cap.g_buffers() ||
+			    s.out.g_num_planes() != stages[i - 1].cap.g_num_planes()) {
+				fprintf(stderr, "%s: cannot import the buffers of %s\n",
+					s.fd->g_v4l_fd()->devname,
+					stages[i - 1].fd->g_v4l_fd()->devname);
+				goto done;
 			}
 		}
+		if (s.cap.reqbufs(s.fd, reqbufs_count_cap) ||
+		    s.cap.obtain_bufs(s.fd))
+			goto done;
+		if (i + 1 < num_stages && s.cap.export_bufs(s.fd, s.cap.g_type())) {
+			fprintf(stderr, "%s: cannot export buffers\n", s.fd->g_v4l_fd()->devname);
+			goto done;
+		}
+		if (s.cap.queue_all(s.fd))
+			goto done;
+		s.fps_ts.determine_field(s.fd->g_fd(), s.cap.g_type());
 	}
 
-	fout = open_output_file(fd);
+	loop.s_busy_poll(stream_busy_poll);
+	for (unsigned i = 0; i < num_stages; i++) {
+		int err;
 
-	if (q.reqbufs(&fd, reqbufs_count_cap)) {
-		if (q.g_type() != V4L2_BUF_TYPE_VBI_CAPTURE ||
-		    !fd.has_raw_vbi_cap() || !fd.has_sliced_vbi_cap())
-			goto done;
-		fd.s_type(V4L2_BUF_TYPE_SLICED_VBI_CAPTURE);
-		q.init(fd.g_type(), memory);
-		if (q.reqbufs(&fd, reqbufs_count_cap))
+		fcntl(stages[i].fd->g_fd(), F_SETFL,
+		      fcntl(stages[i].fd->g_fd(), F_GETFL) | O_NONBLOCK);
+		err = loop.add(stages[i].fd->g_fd(), i ? EPOLLIN | EPOLLOUT : EPOLLIN, i);
+		if (err) {
+			fprintf(stderr, "epoll error: %s\n", strerror(err));
 			goto done;
+		}
 	}
 
-	if (options[OptStreamDmaBuf]) {
-		if (exp_q.reqbufs(&exp_fd, reqbufs_count_cap))
+	/* Start the last stage first, so no stage has to wait for its consumer */
+	for (unsigned i = num_stages; i-- > 0;) {
+		chain_stage &s = stages[i];
+
+		if (i && s.fd->streamon(s.out.g_type()))
 			goto done;
-		if (q.export_bufs(&exp_fd, exp_fd.g_type()))
+		if (s.fd->streamon(s.cap.g_type()))
 			goto done;
+		s.streaming = true;
 	}
-
-	if (q.obtain_bufs(&fd))
-		goto done;
-
-	if (q.queue_all(&fd))
-		goto done;
-
-	fps_ts.determine_field(fd.g_fd(), q.g_type());
-
-	if (fd.streamon())
-		goto done;
-
-	fd.s_trace(0);
-	exp_fd.s_trace(0);
-
-	fd.g_fmt(fmt);
+	for (unsigned i = 0; i < num_stages; i++)
+		stages[i].fd->s_trace(0);
 
 	while (stream_sleep == 0)
 		sleep(100);
 
-	if (use_poll)
-		fcntl(fd.g_fd(), F_SETFL, fd_flags | O_NONBLOCK);
-
-	while (!eos && !source_change) {
-		fd_set read_fds;
-		fd_set exception_fds;
-		struct timeval tv = { use_poll ? 2 : 0, 0 };
-		int r;
-
-		FD_ZERO(&exception_fds);
-		FD_SET(fd.g_fd(), &exception_fds);
-		FD_ZERO(&read_fds);
-		FD_SET(fd.g_fd(), &read_fds);
-		r = select(fd.g_fd() + 1, use_poll ? &read_fds : NULL, NULL, &exception_fds, &tv);
+	while (!stop) {
+		int n = loop.wait(stream_poll_timeout);
 
-		if (r == -1) {
-			if (EINTR == errno)
-				continue;
-			fprintf(stderr, "select error: %s\n",
-					strerror(errno));
-			goto done;
+		if (n == -1) {
+			fprintf(stderr, "epoll error: %s\n", strerror(errno));
+			break;
 		}
-		if (use_poll && r == 0) {
-			fprintf(stderr, "select timeout\n");
-			goto done;
+		if (n == 0) {
+			fprintf(stderr, "epoll timeout\n");
+			break;
 		}
 
-		if (FD_ISSET(fd.g_fd(), &exception_fds)) {
-			struct v4l2_event ev;
-
-			while (!fd.dqevent(ev)) {
-				switch (ev.type) {
-				case V4L2_EVENT_SOURCE_CHANGE:
-					source_change = true;
-					if (!verbose)
-						fprintf(stderr, "\n");
-					fprintf(stderr, "SOURCE CHANGE EVENT\n");
-					break;
-				case V4L2_EVENT_EOS:
-					eos = true;
-					if (!verbose)
-						fprintf(stderr, "\n");
-					fprintf(stderr, "EOS EVENT\n");
-					fflush(stderr);
-					break;
-				}
-			}
-		}
+		for (unsigned i = 0; i < num_stages && !stop; i++) {
+			__u32 events = loop.g_events(i);
 
-		if (FD_ISSET(fd.g_fd(), &read_fds)) {
-			r = do_handle_cap(fd, q, fout, NULL,
-					  count, fps_ts, fmt, false);
-			if (r < 0)
-				break;
+			if (i && (events & EPOLLOUT) && chain_handle_out(stages, i) < 0)
+				stop = true;
+			if ((events & EPOLLIN) && chain_handle_cap(stages, num_stages, i) < 0)
+				stop = true;
 		}
-
 	}
-	fd.streamoff();
-	fcntl(fd.g_fd(), F_SETFL, fd_flags);
-	fprintf(stderr, "\n");
 
-	q.free(&fd);
-	tpg_free(&tpg);
-	if (source_change && !stream_no_query)
-		goto recover;
+	fprintf(stderr, "\n");
+	for (unsigned i = 0; i < num_stages; i++) {
+		chain_stage &s = stages[i];
+
+		fprintf(stderr, "%u %s: %s %ux%u", i, s.fd->g_v4l_fd()->devname,
+			fcc2s(s.fmt.g_pixelformat()).c_str(), s.fmt.g_width(), s.fmt.g_height());
+		if (s.lat_total_cnt)
+			fprintf(stderr, ", latency: %.3f ms (max %.3f ms) over %llu frames",
+				s.lat_total_sum / 1000000.0 / s.lat_total_cnt,
+				s.lat_total_max / 1000000.0,
+				static_cast<unsigned long long>(s.lat_total_cnt));
+		fprintf(stderr, "\n");
+	}
 
 done:
-	if (options[OptStreamDmaBuf])
-		exp_q.close_exported_fds();
-	if (fout && fout != stdout) {
-		if (host_fd_to >= 0)
-			write_u32(fout, V4L_STREAM_PACKET_END);
-		fclose(fout);
+	for (unsigned i = 0; i < num_stages; i++) {
+		chain_stage &s = stages[i];
+
+		if (s.streaming) {
+			if (i)
+				s.fd->streamoff(s.out.g_type());
+			s.fd->streamoff(s.cap.g_type());
+		}
+		fcntl(s.fd->g_fd(), F_SETFL,
+		      fcntl(s.fd->g_fd(), F_GETFL) & ~O_NONBLOCK);
+		/* Free the importers before the exporters */
+		if (i)
+			s.out.free(s.fd);
 	}
+	for (unsigned i = 0; i < num_stages; i++)
+		stages[i].cap.free(stages[i].fd);
+	fprintf(stderr, "\n");
+close:
+	for (unsigned i = 1; i < num_stages; i++)
+		stages[i].fd->close();
 }
 
 static FILE *open_input_file(cv4l_fd &fd, __u32 type)
@@ -1906,6 +5147,8 @@ static FILE *open_input_file(cv4l_fd &fd, __u32 type)
 		fin = fopen(file_from, "r");
 		if (!fin)
 			fprintf(stderr, "could not open %s for reading\n", file_from);
+		else
+			from_map_open(fin);
 		return fin;
 	}
 	if (!host_from)
@@ -1999,7 +5242,7 @@ static FILE *open_input_file(cv4l_fd &fd, __u32 type)
 	ctx = fwht_alloc(cfmt.g_pixelformat(), visible_width, visible_height,
 			 cfmt.g_width(), cfmt.g_height(),
 			 cfmt.g_field(), cfmt.g_colorspace(), cfmt.g_xfer_func(),
-			 cfmt.g_ycbcr_enc(), cfmt.g_quantization());
+			 cfmt.g_ycbcr_enc(), cfmt.g_quantization(), 1);
 
 	read_u32(fin); // pixelaspect.numerator
 	read_u32(fin); // pixelaspect.denominator
@@ -2029,6 +5272,7 @@ static void streaming_set_out(cv4l_fd &fd, cv4l_fd &exp_fd)
 	cv4l_queue exp_q(exp_fd.g_type(), V4L2_MEMORY_MMAP);
 	int fd_flags = fcntl(fd.g_fd(), F_GETFL);
 	bool use_poll = options[OptStreamPoll];
+	cv4l_event_loop loop;
 	fps_timestamps fps_ts;
 	unsigned count = 0;
 	bool stopped = false;
@@ -2096,35 +5340,29 @@ static void streaming_set_out(cv4l_fd &fd, cv4l_fd &exp_fd)
 	while (stream_sleep == 0)
 		sleep(100);
 
-	if (use_poll)
+	if (use_poll) {
 		fcntl(fd.g_fd(), F_SETFL, fd_flags | O_NONBLOCK);
+		loop.s_busy_poll(stream_busy_poll);
+		if (loop.add(fd.g_fd(), EPOLLOUT, 0)) {
+			fprintf(stderr, "epoll error: %s\n", strerror(errno));
+			goto done;
+		}
+	}
 
 	for (;;) {
 		int r;
 
 		if (use_poll) {
-			fd_set fds;
-			struct timeval tv;
-
-			FD_ZERO(&fds);
-			FD_SET(fd.g_fd(), &fds);
-
-			/* Timeout. */
-			tv.tv_sec = 2;
-			tv.tv_usec = 0;
-
-			r = select(fd.g_fd() + 1, NULL, &fds, NULL, &tv);
+			r = loop.wait(stream_poll_timeout);
 
 			if (r == -1) {
-				if (EINTR == errno)
-					continue;
-				fprintf(stderr, "select error: %s\n",
+				fprintf(stderr, "epoll error: %s\n",
 					strerror(errno));
 				goto done;
 			}
 
 			if (r == 0) {
-				fprintf(stderr, "select timeout\n");
+				fprintf(stderr, "epoll timeout\n");
 				goto done;
 			}
 		}
@@ -2216,10 +5454,9 @@ static void stateful_m2m(cv4l_fd &fd, cv4l_queue &in, cv4l_queue &out,
 	int fd_flags = fcntl(fd.g_fd(), F_GETFL);
 	fps_timestamps fps_ts[2];
 	unsigned count[2] = { 0, 0 };
-	fd_set fds[3];
-	fd_set *rd_fds = &fds[0]; /* for capture */
-	fd_set *ex_fds = &fds[1]; /* for capture */
-	fd_set *wr_fds = &fds[2]; /* for output */
+	cv4l_event_loop loop;
+	__u32 events = EPOLLIN | EPOLLPRI | EPOLLOUT;
+	__u32 loop_events = 0;
 	bool cap_streaming = false;
 	static struct v4l2_encoder_cmd enc_stop = {
 		.cmd = V4L2_ENC_CMD_STOP,
@@ -2274,6 +5511,7 @@ static void stateful_m2m(cv4l_fd &fd, cv4l_queue &in, cv4l_queue &out,
 		sleep(100);
 
 	fcntl(fd.g_fd(), F_SETFL, fd_flags | O_NONBLOCK);
+	loop.s_busy_poll(stream_busy_poll);
 
 	if (have_eos && stopped) {
 		if (!verbose)
@@ -2285,59 +5523,56 @@ static void stateful_m2m(cv4l_fd &fd, cv4l_queue &in, cv4l_queue &out,
 			fd.decoder_cmd(dec_stop);
 	}
 
-	while (rd_fds || wr_fds || ex_fds) {
-		struct timeval tv = { 2, 0 };
-		struct timeval stopped_tv = { 0, 500000 };
+	while (events) {
+		/* Once stopped, give the codec half a second to drain */
+		int timeout = stream_poll_timeout;
+		__u32 ready;
 		int r = 0;
 
-		if (rd_fds) {
-			FD_ZERO(rd_fds);
-			FD_SET(fd.g_fd(), rd_fds);
-		}
-
-		if (ex_fds) {
-			FD_ZERO(ex_fds);
-			FD_SET(fd.g_fd(), ex_fds);
-		}
+		if (stopped && (timeout < 0 || timeout > 500))
+			timeout = 500;
 
-		if (wr_fds) {
-			FD_ZERO(wr_fds);
-			FD_SET(fd.g_fd(), wr_fds);
+		if (events != loop_events) {
+			r = loop_events ? loop.modify(fd.g_fd(), events, 0) :
+					  loop.add(fd.g_fd(), events, 0);
+			if (r) {
+				fprintf(stderr, "epoll error: %s\n", strerror(r));
+				return;
+			}
+			loop_events = events;
 		}
 
-		r = select(fd.g_fd() + 1, rd_fds, wr_fds, ex_fds,
-			   stopped ? &stopped_tv : &tv);
+		r = loop.wait(timeout);
 
 		if (r == -1) {
-			if (EINTR == errno)
-				continue;
-			fprintf(stderr, "select error: %s\n",
+			fprintf(stderr, "epoll error: %s\n",
 					strerror(errno));
 			return;
 		}
 		if (r == 0) {
 			if (!stopped)
-				fprintf(stderr, "select timeout");
+				fprintf(stderr, "epoll timeout");
 			fprintf(stderr, "\n");
 			return;
 		}
+		ready = loop.g_events(0) & events;
 
-		if (rd_fds && FD_ISSET(fd.g_fd(), rd_fds)) {
+		if (ready & EPOLLIN) {
 			r = do_handle_cap(fd, in, fin, NULL,
 					  count[CAP], fps_ts[CAP], fmt_in,
 					  ignore_count_skip);
 			if (r == QUEUE_STOPPED)
 				break;
 			if (r < 0) {
-				rd_fds = NULL;
+				events &= ~EPOLLIN;
 				if (!have_eos) {
-					ex_fds = NULL;
+					events &= ~EPOLLPRI;
 					break;
 				}
 			}
 		}
 
-		if (wr_fds && FD_ISSET(fd.g_fd(), wr_fds)) {
+		if (ready & EPOLLOUT) {
 			r = do_handle_out(fd, out, fout, NULL,
 					  count[OUT], fps_ts[OUT], fmt_out, stopped,
 					  !ignore_count_skip);
@@ -2357,12 +5592,12 @@ static void stateful_m2m(cv4l_fd &fd, cv4l_queue &in, cv4l_queue &out,
 			}
 		}
 
-		if (ex_fds && FD_ISSET(fd.g_fd(), ex_fds)) {
+		if (ready & EPOLLPRI) {
 			struct v4l2_event ev;
 
 			while (!fd.dqevent(ev)) {
 				if (ev.type == V4L2_EVENT_EOS) {
-					wr_fds = NULL;
+					events &= ~EPOLLOUT;
 					if (!verbose)
 						fprintf(stderr, "\n");
 					fprintf(stderr, "EOS EVENT\n");
@@ -2458,31 +5693,55 @@ static void stateless_m2m(cv4l_fd &fd, cv4l_queue &in, cv4l_queue &out,
 	int index = 0;
 	bool queue_lst_buf = false;
 	cv4l_buffer last_in_buf;
+	cv4l_event_loop loop;
+	bool req_done[VIDEO_MAX_FRAME] = {};
 
 	fcntl(fd.g_fd(), F_SETFL, fd_flags | O_NONBLOCK);
 
+	/*
+	 * All OUTPUT buffers are queued with their own request, so up to
+	 * out.g_buffers() requests are in flight. Their completion is
+	 * collected from a single epoll set, but they are handled in the
+	 * order they were queued in since each frame may refer to the
+	 * previous one. A request is only rearmed (EPOLLONESHOT) once it is
+	 * queued again, so a request that completed early doesn't keep
+	 * waking up the loop.
+	 */
+	loop.s_busy_poll(stream_busy_poll);
+	for (unsigned i = 0; i < out.g_buffers(); i++) {
+		int err = loop.add(fwht_reqs[i].fd, EPOLLPRI | EPOLLONESHOT, i);
+
+		if (err) {
+			fprintf(stderr, "%s: epoll error: %s\n", __func__, strerror(err));
+			return;
+		}
+	}
+
 	while (true) {
-		fd_set except_fds;
 		int req_fd = fwht_reqs[index].fd;
-		struct timeval tv = { 2, 0 };
 
 		if (req_fd < 0)
 			break;
 
-		FD_ZERO(&except_fds);
-		FD_SET(req_fd, &except_fds);
+		if (!req_done[index]) {
+			int rc = loop.wait(stream_poll_timeout);
 
-		int rc = select(req_fd + 1, NULL, NULL, &except_fds, &tv);
-
-		if (rc == 0) {
-			fprintf(stderr, "Timeout when waiting for media request\n");
-			return;
-		}
-		if (rc < 0) {
-			fprintf(stderr, "Unable to select media request: %s\n",
-				strerror(errno));
-			return;
+			if (rc == 0) {
+				fprintf(stderr, "Timeout when waiting for media request\n");
+				return;
+			}
+			if (rc < 0) {
+				fprintf(stderr, "Unable to wait for media request: %s\n",
+					strerror(errno));
+				return;
+			}
+			for (unsigned i = 0; i < loop.g_num_ready(); i++)
+				req_done[loop.g_ready_id(i)] = true;
+			if (!req_done[index])
+				continue;
 		}
+		req_done[index] = false;
+
 		/*
 		 * it is safe to queue back last cap buffer only after
 		 * the following request is done so that the buffer
@@ -2499,8 +5758,8 @@ static void stateless_m2m(cv4l_fd &fd, cv4l_queue &in, cv4l_queue &out,
 		 * fin is not sent to do_handle_cap since the capture buf is
 		 * written to the file in current function
 		 */
-		rc = do_handle_cap(fd, in, NULL, &buf_idx, count[CAP],
-				   fps_ts[CAP], fmt_in, false);
+		int rc = do_handle_cap(fd, in, NULL, &buf_idx, count[CAP],
+				       fps_ts[CAP], fmt_in, false);
 		if (rc && rc != QUEUE_STOPPED) {
 			fprintf(stderr, "%s: do_handle_cap err\n", __func__);
 			return;
@@ -2545,8 +5804,16 @@ static void stateless_m2m(cv4l_fd &fd, cv4l_queue &in, cv4l_queue &out,
 				stopped = true;
 				if (rc != QUEUE_STOPPED)
 					fprintf(stderr, "%s: output stream ended\n", __func__);
+				loop.del(req_fd);
 				close(req_fd);
 				fwht_reqs[index].fd = -1;
+			} else {
+				int err = loop.modify(req_fd, EPOLLPRI | EPOLLONESHOT, index);
+
+				if (err) {
+					fprintf(stderr, "%s: epoll error: %s\n", __func__, strerror(err));
+					return;
+				}
 			}
 		}
 		index = (index + 1) % out.g_buffers();
@@ -2602,10 +5869,14 @@ static void streaming_set_m2m(cv4l_fd &fd, cv4l_fd &exp_fd)
 		if (out.export_bufs(&exp_fd, exp_fd.g_type()))
 			goto done;
 	}
+	bench.active = options[OptStreamBench];
 	if (fmt[OUT].g_pixelformat() == V4L2_PIX_FMT_FWHT_STATELESS)
 		stateless_m2m(fd, in, out, file[CAP], file[OUT], fmt[CAP], fmt[OUT], exp_fd_p);
 	else
 		stateful_m2m(fd, in, out, file[CAP], file[OUT], fmt[CAP], fmt[OUT], exp_fd_p);
+	if (bench.active)
+		bench_report();
+	bench.active = false;
 
 done:
 	if (options[OptStreamDmaBuf] || options[OptStreamOutDmaBuf])
@@ -2621,6 +5892,7 @@ done:
 static void streaming_set_cap2out(cv4l_fd &fd, cv4l_fd &out_fd)
 {
 	int fd_flags = fcntl(fd.g_fd(), F_GETFL);
+	int out_fd_flags = fcntl(out_fd.g_fd(), F_GETFL);
 	bool use_poll = options[OptStreamPoll];
 	bool use_dmabuf = options[OptStreamDmaBuf] || options[OptStreamOutDmaBuf];
 	bool use_userptr = options[OptStreamUser] && options[OptStreamOutUser];
@@ -2630,8 +5902,8 @@ static void streaming_set_cap2out(cv4l_fd &fd, cv4l_fd &out_fd)
 	fps_timestamps fps_ts[2];
 	unsigned count[2] = { 0, 0 };
 	FILE *file[2] = {NULL, NULL};
-	fd_set fds;
-	unsigned cnt = 0;
+	cap2out_side stats[2] = {};
+	cv4l_event_loop loop;
 	cv4l_fmt fmt[2];
 
 	fd.g_fmt(fmt[OUT], out.g_type());
@@ -2713,6 +5985,8 @@ static void streaming_set_cap2out(cv4l_fd &fd, cv4l_fd &out_fd)
 	    in.queue_all(&fd) ||
 	    do_setup_out_buffers(out_fd, out, file[OUT], false, false) == QUEUE_ERROR)
 		goto done;
+	for (unsigned i = 0; i < in.g_buffers(); i++)
+		cap2out_queued(stats[CAP], i);
 
 	fps_ts[CAP].determine_field(fd.g_fd(), in.g_type());
 	fps_ts[OUT].determine_field(fd.g_fd(), out.g_type());
@@ -2726,64 +6000,79 @@ static void streaming_set_cap2out(cv4l_fd &fd, cv4l_fd &out_fd)
 	while (stream_sleep == 0)
 		sleep(100);
 
-	if (use_poll)
-		fcntl(fd.g_fd(), F_SETFL, fd_flags | O_NONBLOCK);
+	/*
+	 * Both devices are waited for: a filled capture buffer is queued to
+	 * the output device and a buffer the output device is done with goes
+	 * back to the capture device, so any number of buffers can be in
+	 * flight on either side.
+	 */
+	fcntl(fd.g_fd(), F_SETFL, fd_flags | O_NONBLOCK);
+	fcntl(out_fd.g_fd(), F_SETFL, out_fd_flags | O_NONBLOCK);
+	loop.s_busy_poll(stream_busy_poll);
+	if (loop.add(fd.g_fd(), EPOLLIN, CAP) ||
+	    loop.add(out_fd.g_fd(), EPOLLOUT, OUT)) {
+		fprintf(stderr, "epoll error: %s\n", strerror(errno));
+		goto done;
+	}
 
 	while (true) {
-		struct timeval tv = { use_poll ? 2 : 0, 0 };
-		int r = 0;
-
-		FD_ZERO(&fds);
-		FD_SET(fd.g_fd(), &fds);
-
-		if (use_poll)
-			r = select(fd.g_fd() + 1, &fds, NULL, NULL, &tv);
+		int r = loop.wait(use_poll ? stream_poll_timeout : -1);
 
 		if (r == -1) {
-			if (EINTR == errno)
-				continue;
-			fprintf(stderr, "select error: %s\n",
+			fprintf(stderr, "epoll error: %s\n",
 					strerror(errno));
 			goto done;
 		}
-		if (use_poll && r == 0) {
-			fprintf(stderr, "select timeout\n");
+		if (r == 0) {
+			fprintf(stderr, "epoll timeout\n");
 			goto done;
 		}
 
-		if (FD_ISSET(fd.g_fd(), &fds)) {
+		if (loop.g_events(OUT) & EPOLLOUT) {
+			r = do_handle_out_to_in(out_fd, fd, out, in,
+						stats[CAP], stats[OUT]);
+			if (r)
+				fprintf(stderr, "handle out2in %d\n", r);
+		}
+
+		while (!r && (loop.g_events(CAP) & EPOLLIN)) {
 			int index = -1;
 
 			r = do_handle_cap(fd, in, file[CAP], &index,
 					  count[CAP], fps_ts[CAP], fmt[CAP], true);
 			if (r)
 				fprintf(stderr, "handle cap %d\n", r);
-			if (!r) {
-				cv4l_buffer buf(in, index);
+			if (r || index < 0)
+				break;
+			cap2out_dequeued(stats[CAP], index);
 
-				if (fd.querybuf(buf))
-					break;
-				r = do_handle_out(out_fd, out, file[OUT], &buf,
-						  count[OUT], fps_ts[OUT], fmt[OUT],
-						  false, false);
+			cv4l_buffer buf(in, index);
+
+			if (fd.querybuf(buf)) {
+				r = QUEUE_ERROR;
+				break;
 			}
+			r = do_handle_out(out_fd, out, file[OUT], &buf,
+					  count[OUT], fps_ts[OUT], fmt[OUT],
+					  false, false);
 			if (r)
 				fprintf(stderr, "handle out %d\n", r);
-			if (!r && cnt++ > 1)
-				r = do_handle_out_to_in(out_fd, fd, out, in);
-			if (r)
-				fprintf(stderr, "handle out2in %d\n", r);
-			if (r < 0) {
-				fd.streamoff();
-				out_fd.streamoff();
-				break;
-			}
+			else
+				cap2out_queued(stats[OUT], index);
+		}
+		if (r < 0) {
+			fd.streamoff();
+			out_fd.streamoff();
+			break;
 		}
 	}
 
 done:
 	fcntl(fd.g_fd(), F_SETFL, fd_flags);
+	fcntl(out_fd.g_fd(), F_SETFL, out_fd_flags);
 	fprintf(stderr, "\n");
+	cap2out_report("capture", stats[CAP]);
+	cap2out_report("output", stats[OUT]);
 
 	if (options[OptStreamDmaBuf])
 		out.close_exported_fds();
@@ -2827,14 +6116,54 @@ void streaming_set(cv4l_fd &fd, cv4l_fd &out_fd, cv4l_fd &exp_fd)
 	get_cap_compose_rect(fd);
 	get_out_crop_rect(fd);
 
+	if (stream_stats_name) {
+		if (!strcmp(stream_stats_name, "-")) {
+			stream_stats_file = stderr;
+		} else {
+			stream_stats_file = fopen(stream_stats_name, "w");
+			if (!stream_stats_file) {
+				fprintf(stderr, "cannot open %s: %s\n",
+					stream_stats_name, strerror(errno));
+				return;
+			}
+		}
+		signal(SIGUSR1, stream_stats_sigusr1);
+	}
+
+	if (options[OptStreamBench] && !(do_cap && do_out && out_fd.g_fd() < 0))
+		fprintf(stderr, "--stream-bench is only supported for m2m devices, ignored\n");
+
 	if (do_cap && do_out && out_fd.g_fd() < 0)
 		streaming_set_m2m(fd, exp_fd);
 	else if (do_cap && do_out)
 		streaming_set_cap2out(fd, out_fd);
+	else if (do_cap && stream_chain)
+		streaming_set_chain(fd);
+	else if (do_cap && stream_devices)
+		streaming_set_multi(fd);
+	else if (do_cap && stream_meta)
+		streaming_set_meta(fd);
+	else if (do_cap && stream_dv_sweep)
+		streaming_set_dv_sweep(fd);
 	else if (do_cap)
 		streaming_set_cap(fd, exp_fd);
 	else if (do_out)
 		streaming_set_out(fd, exp_fd);
+#ifndef NO_STREAM_TO
+	host_compress_free();
+#endif
+	if (stream_out_pool) {
+		stream_pool_destroy(stream_out_pool);
+		stream_out_pool = NULL;
+	}
+	stream_out_cache_free();
+	from_map_close();
+	if (stream_stats_file) {
+		signal(SIGUSR1, SIG_DFL);
+		if (stream_stats_file != stderr)
+			fclose(stream_stats_file);
+		stream_stats_file = NULL;
+	}
 
 	fd.s_trace(old_trace_fd);
 	out_fd.s_trace(old_trace_out_fd);
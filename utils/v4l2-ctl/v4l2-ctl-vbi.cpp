@@ -2,12 +2,18 @@
 
 #include "compiler.h"
 #include "v4l2-ctl.h"
+#include "raw2sliced.h"
 
 static struct v4l2_format sliced_fmt;	  /* set_format/get_format for sliced VBI */
 static struct v4l2_format sliced_fmt_out; /* set_format/get_format for sliced VBI output */
 static struct v4l2_format raw_fmt;	  /* set_format/get_format for VBI */
 static struct v4l2_format raw_fmt_out;	  /* set_format/get_format for VBI output */
 
+/* Slicing of captured raw VBI for --stream-slice-vbi */
+static struct vbi_handle slice_handle;
+static struct v4l2_sliced_vbi_data *slice_data;
+static unsigned slice_raw_size;
+
 void vbi_usage()
 {
 	printf("\nVBI Formats options:\n"
@@ -286,3 +292,39 @@ void vbi_list(cv4l_fd &fd)
 		}
 	}
 }
+
+bool vbi_slice_prepare(cv4l_fd &fd)
+{
+	v4l2_format fmt;
+	v4l2_std_id std;
+	unsigned lines;
+
+	if (fd.g_fmt(fmt, V4L2_BUF_TYPE_VBI_CAPTURE) || fd.g_std(std)) {
+		fprintf(stderr, "cannot get the raw VBI format and standard\n");
+		return false;
+	}
+	if (fmt.fmt.vbi.sample_format != V4L2_PIX_FMT_GREY) {
+		fprintf(stderr, "only 8 bit raw VBI samples can be sliced\n");
+		return false;
+	}
+	if (!vbi_prepare(&slice_handle, &fmt.fmt.vbi, std)) {
+		fprintf(stderr, "no VBI services to slice for this format and standard\n");
+		return false;
+	}
+	lines = fmt.fmt.vbi.count[0] + fmt.fmt.vbi.count[1];
+	slice_raw_size = lines * fmt.fmt.vbi.samples_per_line;
+	free(slice_data);
+	slice_data = static_cast<v4l2_sliced_vbi_data *>(calloc(lines, sizeof(*slice_data)));
+	return slice_data;
+}
+
+unsigned vbi_slice(const void *raw, unsigned size, const void **sliced)
+{
+	struct v4l2_sliced_vbi_format vbi;
+
+	if (size < slice_raw_size)
+		return 0;
+	vbi_parse(&slice_handle, static_cast<const unsigned char *>(raw), &vbi, slice_data);
+	*sliced = slice_data;
+	return vbi.io_size;
+}
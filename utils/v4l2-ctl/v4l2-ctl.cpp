@@ -24,7 +24,11 @@
 
 #include <dirent.h>
 #include <getopt.h>
+#include <csignal>
 #include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
 
 #include <linux/media.h>
 
@@ -203,6 +207,10 @@ static struct option long_options[] = {
 	{"overlay", required_argument, 0, OptOverlay},
 	{"sleep", required_argument, 0, OptSleep},
 	{"list-devices", no_argument, 0, OptListDevices},
+	{"server", optional_argument, 0, OptServer},
+	{"set-ctrl-file", required_argument, 0, OptSetCtrlFile},
+	{"set-ctrl-request", no_argument, 0, OptSetCtrlRequest},
+	{"ctrl-cache", required_argument, 0, OptCtrlCache},
 	{"list-dv-timings", optional_argument, 0, OptListDvTimings},
 	{"query-dv-timings", no_argument, 0, OptQueryDvTimings},
 	{"get-dv-timings", no_argument, 0, OptGetDvTimings},
@@ -214,6 +222,7 @@ static struct option long_options[] = {
 	{"decoder-cmd", required_argument, 0, OptDecoderCmd},
 	{"try-decoder-cmd", required_argument, 0, OptTryDecoderCmd},
 	{"set-edid", required_argument, 0, OptSetEdid},
+	{"set-edid-batch", required_argument, 0, OptSetEdidBatch},
 	{"clear-edid", optional_argument, 0, OptClearEdid},
 	{"get-edid", optional_argument, 0, OptGetEdid},
 	{"info-edid", optional_argument, 0, OptInfoEdid},
@@ -234,12 +243,29 @@ static struct option long_options[] = {
 	{"stream-loop", no_argument, 0, OptStreamLoop},
 	{"stream-sleep", required_argument, 0, OptStreamSleep},
 	{"stream-poll", no_argument, 0, OptStreamPoll},
+	{"stream-devices", required_argument, 0, OptStreamDevices},
+	{"stream-meta", required_argument, 0, OptStreamMeta},
+	{"stream-dv-sweep", required_argument, 0, OptStreamDvSweep},
+	{"stream-poll-timeout", required_argument, 0, OptStreamPollTimeout},
+	{"stream-busy-poll", no_argument, 0, OptStreamBusyPoll},
+	{"stream-bench", no_argument, 0, OptStreamBench},
+	{"stream-stats", required_argument, 0, OptStreamStats},
+	{"stream-from-preload", required_argument, 0, OptStreamFromPreload},
+	{"stream-chain", required_argument, 0, OptStreamChain},
 	{"stream-no-query", no_argument, 0, OptStreamNoQuery},
 #ifndef NO_STREAM_TO
 	{"stream-to", required_argument, 0, OptStreamTo},
 	{"stream-to-hdr", required_argument, 0, OptStreamToHdr},
 	{"stream-lossless", no_argument, 0, OptStreamLossless},
 	{"stream-to-host", required_argument, 0, OptStreamToHost},
+	{"stream-to-queue", required_argument, 0, OptStreamToQueue},
+	{"stream-direct", no_argument, 0, OptStreamDirect},
+	{"stream-slice-vbi", no_argument, 0, OptStreamSliceVbi},
+	{"stream-sdr-float", required_argument, 0, OptStreamSdrFloat},
+	{"stream-sdr-spectrum", required_argument, 0, OptStreamSdrSpectrum},
+	{"stream-to-host-threads", required_argument, 0, OptStreamToHostThreads},
+	{"stream-to-host-speed", required_argument, 0, OptStreamToHostSpeed},
+	{"stream-to-host-udp", no_argument, 0, OptStreamToHostUdp},
 #endif
 	{"stream-buf-caps", no_argument, 0, OptStreamBufCaps},
 	{"stream-mmap", optional_argument, 0, OptStreamMmap},
@@ -261,6 +287,9 @@ static struct option long_options[] = {
 	{"stream-out-hor-speed", required_argument, 0, OptStreamOutHorSpeed},
 	{"stream-out-vert-speed", required_argument, 0, OptStreamOutVertSpeed},
 	{"stream-out-perc-fill", required_argument, 0, OptStreamOutPercFill},
+	{"stream-out-threads", required_argument, 0, OptStreamOutThreads},
+	{"stream-out-cache", required_argument, 0, OptStreamOutCache},
+	{"stream-out-prerender", no_argument, 0, OptStreamOutPrerender},
 	{"stream-out-buf-caps", no_argument, 0, OptStreamOutBufCaps},
 	{"stream-out-mmap", optional_argument, 0, OptStreamOutMmap},
 	{"stream-out-user", optional_argument, 0, OptStreamOutUser},
@@ -1102,56 +1131,33 @@ err:
 	return device;
 }
 
-int main(int argc, char **argv)
+/* command args */
+static std::string media_bus_info;
+static const char *device = "/dev/video0";	/* -d device */
+static const char *out_device;
+static const char *export_device;
+static __u32 wait_for_event;	/* wait for this event */
+static const char *wait_event_id;
+static __u32 poll_for_event;	/* poll for this event */
+static const char *poll_event_id;
+static __u32 epoll_for_event;	/* epoll for this event */
+static const char *epoll_event_id;
+static unsigned secs;
+static const char *server_socket;
+static char short_options[26 * 2 * 3 + 1];
+
+/*
+ * Parse the command line options. Returns -1 if the command should be
+ * executed, otherwise it returns the exit code.
+ */
+static int parse_options(int argc, char **argv)
 {
 	int i;
-	cv4l_fd c_fd;
-	cv4l_fd c_out_fd;
-	cv4l_fd c_exp_fd;
-	int fd = -1;
-	int out_fd = -1;
-	int exp_fd = -1;
-	int media_fd = -1;
-	bool is_subdev = false;
-	std::string media_bus_info;
-
-	/* command args */
 	int ch;
-	const char *device = "/dev/video0";	/* -d device */
-	const char *out_device = NULL;
-	const char *export_device = NULL;
-	struct v4l2_capability vcap;	/* list_cap */
-	__u32 wait_for_event = 0;	/* wait for this event */
-	const char *wait_event_id = NULL;
-	__u32 poll_for_event = 0;	/* poll for this event */
-	const char *poll_event_id = NULL;
-	__u32 epoll_for_event = 0;	/* epoll for this event */
-	const char *epoll_event_id = NULL;
-	unsigned secs = 0;
-	char short_options[26 * 2 * 3 + 1];
-	int idx = 0;
 
-	memset(&vcap, 0, sizeof(vcap));
-
-	if (argc == 1) {
-		common_usage();
-		return 0;
-	}
-	for (i = 0; long_options[i].name; i++) {
-		if (!isalpha(long_options[i].val))
-			continue;
-		short_options[idx++] = long_options[i].val;
-		if (long_options[i].has_arg == required_argument) {
-			short_options[idx++] = ':';
-		} else if (long_options[i].has_arg == optional_argument) {
-			short_options[idx++] = ':';
-			short_options[idx++] = ':';
-		}
-	}
 	while (true) {
 		int option_index = 0;
 
-		short_options[idx] = 0;
 		ch = getopt_long(argc, argv, short_options,
 				 long_options, &option_index);
 		if (ch == -1)
@@ -1249,6 +1255,9 @@ int main(int argc, char **argv)
 		case OptSleep:
 			secs = strtoul(optarg, 0L, 0);
 			break;
+		case OptServer:
+			server_socket = optarg;
+			break;
 		case OptVersion:
 			print_version();
 			return 0;
@@ -1289,6 +1298,193 @@ int main(int argc, char **argv)
 		common_usage();
 		return 1;
 	}
+	return -1;
+}
+
+/*
+ * Split a --server command line into arguments. Arguments can be quoted
+ * with single or double quotes to include spaces.
+ */
+static void split_args(char *line, std::vector<char *> &args)
+{
+	char *d = line;
+
+	args.push_back(const_cast<char *>("v4l2-ctl"));
+	while (true) {
+		char quote = 0;
+
+		while (isspace(*line))
+			line++;
+		if (!*line)
+			break;
+		args.push_back(d);
+		for (; *line && (quote || !isspace(*line)); line++) {
+			if (quote && *line == quote)
+				quote = 0;
+			else if (!quote && (*line == '"' || *line == '\''))
+				quote = *line;
+			else
+				*d++ = *line;
+		}
+		if (*line)
+			line++;
+		*d++ = 0;
+	}
+	args.push_back(NULL);
+}
+
+static __u64 server_now_us()
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000;
+}
+
+/*
+ * Run the commands read from fin, writing the results to fout. Every
+ * command is executed in a child process forked from the server, so it
+ * starts with the device opened and the controls enumerated, and none of
+ * the option state leaks into the next command.
+ *
+ * Every result is framed as:
+ *
+ *	begin <seq>
+ *	<the output of the command>
+ *	end <seq> <exit code> <duration in us>
+ *
+ * Returns true in a child process, with the options of its command parsed.
+ */
+static bool server_run(FILE *fin, int fout, unsigned &seq)
+{
+	char line[4096];
+
+	while (fgets(line, sizeof(line), fin)) {
+		std::vector<char *> args;
+		__u64 start = server_now_us();
+		int status = 0;
+		pid_t pid;
+
+		line[strcspn(line, "\r\n")] = 0;
+		split_args(line, args);
+		if (args.size() == 2)
+			continue;
+		if (!strcmp(args[1], "quit") && args.size() == 3)
+			return false;
+		dprintf(fout, "begin %u\n", ++seq);
+		fflush(stdout);
+		fflush(stderr);
+		pid = fork();
+		if (pid == 0) {
+			int ret;
+
+			dup2(fout, STDOUT_FILENO);
+			dup2(fout, STDERR_FILENO);
+			memset(options, 0, sizeof(options));
+			optind = 0;
+			ret = parse_options(args.size() - 1, &args[0]);
+			if (ret >= 0)
+				std::exit(ret);
+			if (options[OptSetDevice] || options[OptSetOutDevice] ||
+			    options[OptSetExportDevice] || options[OptServer]) {
+				fprintf(stderr, "The device can't be changed in server mode\n");
+				std::exit(EXIT_FAILURE);
+			}
+			return true;
+		}
+		if (pid < 0)
+			dprintf(fout, "fork failed: %s\n", strerror(errno));
+		else
+			waitpid(pid, &status, 0);
+		dprintf(fout, "end %u %d %llu\n", seq,
+			WIFEXITED(status) ? WEXITSTATUS(status) : -1,
+			server_now_us() - start);
+	}
+	return false;
+}
+
+/*
+ * Serve commands from stdin, or from the connections to the given unix
+ * socket, one connection at a time. Only returns in a child process.
+ */
+static void server_loop()
+{
+	struct sockaddr_un addr = {};
+	unsigned seq = 0;
+	int sock;
+
+	if (!server_socket) {
+		if (!server_run(stdin, STDOUT_FILENO, seq))
+			std::exit(EXIT_SUCCESS);
+		return;
+	}
+	sock = socket(AF_UNIX, SOCK_STREAM, 0);
+	addr.sun_family = AF_UNIX;
+	strncpy(addr.sun_path, server_socket, sizeof(addr.sun_path) - 1);
+	unlink(server_socket);
+	if (sock < 0 || bind(sock, reinterpret_cast<struct sockaddr *>(&addr), sizeof(addr)) ||
+	    listen(sock, 1)) {
+		fprintf(stderr, "Cannot listen on %s: %s\n", server_socket,
+			strerror(errno));
+		std::exit(EXIT_FAILURE);
+	}
+	signal(SIGPIPE, SIG_IGN);
+	while (true) {
+		int conn = accept(sock, NULL, NULL);
+		FILE *fin;
+
+		if (conn < 0) {
+			if (errno == EINTR)
+				continue;
+			break;
+		}
+		fin = fdopen(conn, "r");
+		if (server_run(fin, conn, seq)) {
+			close(sock);
+			return;
+		}
+		fclose(fin);
+	}
+	close(sock);
+	unlink(server_socket);
+	std::exit(EXIT_FAILURE);
+}
+
+int main(int argc, char **argv)
+{
+	int i;
+	cv4l_fd c_fd;
+	cv4l_fd c_out_fd;
+	cv4l_fd c_exp_fd;
+	int fd = -1;
+	int out_fd = -1;
+	int exp_fd = -1;
+	int media_fd = -1;
+	bool is_subdev = false;
+	struct v4l2_capability vcap;	/* list_cap */
+	int idx = 0;
+
+	memset(&vcap, 0, sizeof(vcap));
+
+	if (argc == 1) {
+		common_usage();
+		return 0;
+	}
+	for (i = 0; long_options[i].name; i++) {
+		if (!isalpha(long_options[i].val))
+			continue;
+		short_options[idx++] = long_options[i].val;
+		if (long_options[i].has_arg == required_argument) {
+			short_options[idx++] = ':';
+		} else if (long_options[i].has_arg == optional_argument) {
+			short_options[idx++] = ':';
+			short_options[idx++] = ':';
+		}
+	}
+	short_options[idx] = 0;
+	i = parse_options(argc, argv);
+	if (i >= 0)
+		return i;
 
 	media_type type = mi_media_detect_type(device);
 	if (type == MEDIA_TYPE_CANT_STAT) {
@@ -1392,6 +1588,12 @@ int main(int argc, char **argv)
 
 	common_process_controls(c_fd);
 
+	if (options[OptServer]) {
+		server_loop();
+		verbose = options[OptVerbose];
+		c_fd.s_trace(options[OptSilent] ? 0 : (verbose ? 2 : 1));
+	}
+
 	if (wait_for_event == V4L2_EVENT_CTRL && wait_event_id)
 		if (!common_find_ctrl_id(wait_event_id)) {
 			fprintf(stderr, "unknown control '%s'\n", wait_event_id);
@@ -7,6 +7,8 @@
 #include <config.h>
 #endif
 
+#include <vector>
+
 #include <linux/videodev2.h>
 #include <linux/v4l2-subdev.h>
 
@@ -177,6 +179,10 @@ enum Option {
 	OptSetModulator,
 	OptListFreqBands,
 	OptListDevices,
+	OptServer,
+	OptSetCtrlFile,
+	OptSetCtrlRequest,
+	OptCtrlCache,
 	OptGetOutputParm,
 	OptSetOutputParm,
 	OptQueryStandard,
@@ -191,6 +197,7 @@ enum Option {
 	OptSetDvBtTimings,
 	OptGetDvTimingsCap,
 	OptSetEdid,
+	OptSetEdidBatch,
 	OptClearEdid,
 	OptGetEdid,
 	OptInfoEdid,
@@ -216,10 +223,27 @@ enum Option {
 	OptStreamLoop,
 	OptStreamSleep,
 	OptStreamPoll,
+	OptStreamDevices,
+	OptStreamMeta,
+	OptStreamDvSweep,
+	OptStreamPollTimeout,
+	OptStreamBusyPoll,
+	OptStreamBench,
+	OptStreamStats,
+	OptStreamFromPreload,
+	OptStreamChain,
 	OptStreamNoQuery,
 	OptStreamTo,
 	OptStreamToHdr,
 	OptStreamToHost,
+	OptStreamToQueue,
+	OptStreamDirect,
+	OptStreamSliceVbi,
+	OptStreamSdrFloat,
+	OptStreamSdrSpectrum,
+	OptStreamToHostThreads,
+	OptStreamToHostSpeed,
+	OptStreamToHostUdp,
 	OptStreamLossless,
 	OptStreamBufCaps,
 	OptStreamMmap,
@@ -236,6 +260,9 @@ enum Option {
 	OptStreamOutHorSpeed,
 	OptStreamOutVertSpeed,
 	OptStreamOutPercFill,
+	OptStreamOutThreads,
+	OptStreamOutCache,
+	OptStreamOutPrerender,
 	OptStreamOutAlphaComponent,
 	OptStreamOutAlphaRedOnly,
 	OptStreamOutRGBLimitedRange,
@@ -365,6 +392,7 @@ void stds_cmd(int ch, char *optarg);
 void stds_set(cv4l_fd &fd);
 void stds_get(cv4l_fd &fd);
 void stds_list(cv4l_fd &fd);
+bool dv_sweep_load(const char *fname, std::vector<v4l2_dv_timings> &table);
 
 // v4l2-ctl-vidcap.cpp
 void vidcap_usage(void);
@@ -395,6 +423,8 @@ void vbi_cmd(int ch, char *optarg);
 void vbi_set(cv4l_fd &fd);
 void vbi_get(cv4l_fd &fd);
 void vbi_list(cv4l_fd &fd);
+bool vbi_slice_prepare(cv4l_fd &fd);
+unsigned vbi_slice(const void *raw, unsigned size, const void **sliced);
 
 // v4l2-ctl-sdr.cpp
 void sdr_usage(void);
@@ -402,6 +432,11 @@ void sdr_cmd(int ch, char *optarg);
 void sdr_set(cv4l_fd &fd);
 void sdr_get(cv4l_fd &fd);
 void sdr_list(cv4l_fd &fd);
+bool sdr_convert_prepare(cv4l_fd &fd, unsigned decim, unsigned taps);
+unsigned sdr_convert(const void *raw, unsigned size, const void **out);
+bool sdr_spectrum_start(cv4l_fd &fd, unsigned size, unsigned avg);
+void sdr_spectrum_add(const void *raw, unsigned size);
+void sdr_spectrum_stop();
 
 // v4l2-ctl-meta.cpp
 void meta_usage(void);
@@ -409,6 +444,29 @@ void meta_cmd(int ch, char *optarg);
 void meta_set(cv4l_fd &fd);
 void meta_get(cv4l_fd &fd);
 void meta_list(cv4l_fd &fd);
+
+/* The fields of a metadata buffer, as decoded by decode_meta_buffer() */
+struct meta_fields {
+	__u32 dataformat;
+	/* V4L2_META_FMT_UVC: the first of the payload headers in the buffer */
+	unsigned blocks;	/* number of payload headers */
+	__u64 ns;		/* system time when the first payload arrived */
+	__u64 last_ns;		/* and the last one */
+	__u16 sof;
+	__u8 length;
+	__u8 flags;
+	__u32 pts;
+	__u32 stc;
+	__u16 sof_counter;
+	/* V4L2_META_FMT_VIVID */
+	__u16 brightness;
+	__u16 contrast;
+	__u16 saturation;
+	__s16 hue;
+};
+
+bool decode_meta_buffer(const void *p, unsigned size, __u32 dataformat, meta_fields &m);
+void print_meta_fields(FILE *f, const meta_fields &m);
 void print_meta_buffer(FILE *f, cv4l_buffer &buf, cv4l_fmt &fmt, cv4l_queue &q);
 void meta_fillbuffer(cv4l_buffer &buf, cv4l_fmt &fmt, cv4l_queue &q);
 
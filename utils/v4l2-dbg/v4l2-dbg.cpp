@@ -16,10 +16,13 @@
     Foundation, Inc., 51 Franklin Street, Suite 500, Boston, MA  02110-1335  USA
  */
 
+#include <algorithm>
 #include <cctype>
 #include <cerrno>
 #include <cstring>
+#include <ctime>
 #include <string>
+#include <unordered_map>
 #include <vector>
 
 #include <fcntl.h>
@@ -130,6 +133,7 @@ enum Option {
 	OptLogStatus = 128,
 	OptVerbose,
 	OptListSymbols,
+	OptWatch,
 	OptLast = 256
 };
 
@@ -150,6 +154,7 @@ static struct option long_options[] = {
 	{"log-status", no_argument, 0, OptLogStatus},
 	{"list-symbols", no_argument, 0, OptListSymbols},
 	{"wide", required_argument, 0, OptSetStride},
+	{"watch", optional_argument, 0, OptWatch},
 	{0, 0, 0, 0}
 };
 
@@ -168,6 +173,9 @@ static void usage()
 	       "                         subdev<num>: sub-device number <num>\n"
 	       "  -l, --list-registers[=min=<addr>[,max=<addr>]]\n"
 	       "		     Dump registers from <min> to <max> [VIDIOC_DBG_G_REGISTER]\n"
+	       "  --watch[=<msecs>]  After --list-registers, read the listed registers again\n"
+	       "                     every <msecs> (default 1000) milliseconds and print the\n"
+	       "                     ones which changed\n"
 	       "  -g, --get-register <addr>\n"
 	       "		     Get the specified register [VIDIOC_DBG_G_REGISTER]\n"
 	       "  -s, --set-register <addr>\n"
@@ -239,10 +247,53 @@ static std::string cap2s(unsigned cap)
 	return s;
 }
 
-static void print_regs(int fd, struct v4l2_dbg_register *reg, unsigned long min, unsigned long max, int stride)
+/* The values of a set of registers, each read once. Consecutive snapshots
+   of the same registers are compared to find the ones which changed. */
+struct reg_snapshot {
+	std::vector<unsigned long long> regs;
+	std::vector<unsigned long long> vals;
+	std::vector<bool> valid;
+};
+
+static void snapshot_add(struct reg_snapshot &snap, unsigned long long reg,
+			 unsigned long long val, bool valid)
+{
+	snap.regs.push_back(reg);
+	snap.vals.push_back(val);
+	snap.valid.push_back(valid);
+}
+
+/* Read all registers of snap, stops at the first failure if stop_on_error is
+   set. Returns false if any register could not be read. */
+static bool snapshot_read(int fd, struct v4l2_dbg_register *reg,
+			  struct reg_snapshot &snap, bool stop_on_error)
+{
+	bool ok = true;
+
+	for (unsigned i = 0; i < snap.regs.size(); i++) {
+		reg->reg = snap.regs[i];
+		snap.valid[i] = ioctl(fd, VIDIOC_DBG_G_REGISTER, reg) == 0;
+		if (!snap.valid[i]) {
+			ok = false;
+			if (!stop_on_error)
+				continue;
+			while (++i < snap.regs.size())
+				snap.valid[i] = false;
+			break;
+		}
+		snap.vals[i] = reg->val;
+		usleep(1);
+	}
+	return ok;
+}
+
+static void print_regs(int fd, struct v4l2_dbg_register *reg, unsigned long min, unsigned long max, int stride,
+		       struct reg_snapshot &watch)
 {
+	struct reg_snapshot snap;
 	unsigned long mask;
 	unsigned long i;
+	unsigned n = 0;
 	int line = 0;
 
 	/* Query size of the first register */
@@ -255,6 +306,13 @@ static void print_regs(int fd, struct v4l2_dbg_register *reg, unsigned long min,
 
 	mask = stride > 2 ? 0x1f : 0x0f;
 
+	/* Read the whole range before printing anything */
+	for (i = min & ~mask; i <= max; i += stride)
+		if (i >= min)
+			snapshot_add(snap, i, 0, false);
+	if (!snapshot_read(fd, reg, snap, true))
+		perror("ioctl: VIDIOC_DBG_G_REGISTER failed\n");
+
 	for (i = min & ~mask; i <= max; i += stride) {
 		if ((i & mask) == 0 && line % 32 == 0) {
 			if (stride == 4)
@@ -273,13 +331,11 @@ static void print_regs(int fd, struct v4l2_dbg_register *reg, unsigned long min,
 			printf("%*s ", 2 * stride, "");
 			continue;
 		}
-		reg->reg = i;
-		if (ioctl(fd, VIDIOC_DBG_G_REGISTER, reg) < 0) {
-			perror("ioctl: VIDIOC_DBG_G_REGISTER failed\n");
+		if (!snap.valid[n])
 			break;
-		}
-		printf("%0*llx ", 2 * stride, reg->val);
-		usleep(1);
+		printf("%0*llx ", 2 * stride, snap.vals[n]);
+		snapshot_add(watch, i, snap.vals[n], true);
+		n++;
 	}
 	printf("\n");
 }
@@ -291,38 +347,88 @@ static void print_name(struct v4l2_dbg_chip_info *chip)
 		(chip->flags & V4L2_CHIP_FL_WRITABLE) ? 'w' : '-');
 }
 
-static unsigned long long parse_reg(const struct board_list *curr_bd, const std::string &reg)
+/* The register names of the current board, looked up by address and by
+   lower case name, with and without the prefix. Where names or addresses
+   appear more than once the first one wins, the regular table before the
+   alternative one. */
+static std::unordered_map<unsigned long long, const char *> reg_names;
+static std::unordered_map<std::string, unsigned long long> reg_addrs;
+
+static std::string lower(const char *s)
 {
-	if (curr_bd) {
-		for (int i = 0; i < curr_bd->regs_size; i++) {
-			if (!strcasecmp(reg.c_str(), curr_bd->regs[i].name) ||
-			    !strcasecmp(reg.c_str(), curr_bd->regs[i].name + curr_bd->prefix)) {
-				return curr_bd->regs[i].reg;
-			}
-		}
-		for (int i = 0; i < curr_bd->alt_regs_size; i++) {
-			if (!strcasecmp(reg.c_str(), curr_bd->alt_regs[i].name) ||
-			    !strcasecmp(reg.c_str(), curr_bd->alt_regs[i].name + curr_bd->prefix)) {
-				return curr_bd->alt_regs[i].reg;
-			}
-		}
+	std::string l(s);
+
+	for (auto &c : l)
+		c = tolower(c);
+	return l;
+}
+
+static void index_regs(const struct board_regs *regs, int size, int prefix)
+{
+	for (int i = 0; i < size; i++) {
+		reg_names.emplace(regs[i].reg, regs[i].name);
+		reg_addrs.emplace(lower(regs[i].name), regs[i].reg);
+		reg_addrs.emplace(lower(regs[i].name + prefix), regs[i].reg);
 	}
+}
+
+static unsigned long long parse_reg(const std::string &reg)
+{
+	auto it = reg_addrs.find(lower(reg.c_str()));
+
+	if (it != reg_addrs.end())
+		return it->second;
 	return strtoull(reg.c_str(), NULL, 0);
 }
 
-static const char *reg_name(const struct board_list *curr_bd, unsigned long long reg)
+static const char *reg_name(unsigned long long reg)
 {
-	if (curr_bd) {
-		for (int i = 0; i < curr_bd->regs_size; i++) {
-			if (reg == curr_bd->regs[i].reg)
-				return curr_bd->regs[i].name;
+	auto it = reg_names.find(reg);
+
+	return it == reg_names.end() ? NULL : it->second;
+}
+
+/* Read the registers of snap every interval milliseconds, printing those
+   whose value changed since the previous read. Only returns on errors. */
+static void watch_regs(int fd, struct v4l2_dbg_register *reg,
+		       struct reg_snapshot &snap, unsigned interval)
+{
+	struct reg_snapshot prev = snap;
+	struct timespec start, now;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	printf("\nWatching %zu registers every %u ms\n", snap.regs.size(), interval);
+	fflush(stdout);
+
+	while (true) {
+		usleep(interval * 1000);
+		/* Registers which can't be read are skipped, unless none can */
+		if (!snapshot_read(fd, reg, snap, false) &&
+		    std::find(snap.valid.begin(), snap.valid.end(), true) == snap.valid.end()) {
+			perror("ioctl: VIDIOC_DBG_G_REGISTER failed");
+			return;
 		}
-		for (int i = 0; i < curr_bd->alt_regs_size; i++) {
-			if (reg == curr_bd->regs[i].reg)
-				return curr_bd->regs[i].name;
+		clock_gettime(CLOCK_MONOTONIC, &now);
+
+		for (unsigned i = 0; i < snap.regs.size(); i++) {
+			if (!snap.valid[i] || !prev.valid[i] ||
+			    snap.vals[i] == prev.vals[i])
+				continue;
+
+			const char *name = reg_name(snap.regs[i]);
+
+			printf("%5ld.%03ld: Register ",
+			       (long)(now.tv_sec - start.tv_sec) - (now.tv_nsec < start.tv_nsec),
+			       ((now.tv_nsec - start.tv_nsec + 1000000000L) % 1000000000L) / 1000000);
+			if (name)
+				printf("%s (0x%08llx)", name, snap.regs[i]);
+			else
+				printf("0x%08llx", snap.regs[i]);
+			printf(" = %llxh (was %llxh)\n", snap.vals[i], prev.vals[i]);
 		}
+		fflush(stdout);
+		std::swap(prev, snap);
 	}
-	return NULL;
 }
 
 static const char *binary(unsigned long long val)
@@ -409,6 +515,8 @@ int main(int argc, char **argv)
 	std::string reg_set_arg;
 	unsigned long long reg_min = 0, reg_max = 0;
 	std::vector<std::string> get_regs;
+	struct reg_snapshot watch;
+	unsigned watch_interval = 1000;
 	struct v4l2_dbg_match match;
 	char *p;
 
@@ -524,6 +632,11 @@ int main(int argc, char **argv)
 		case OptListSymbols:
 			break;
 
+		case OptWatch:
+			if (optarg)
+				watch_interval = strtoul(optarg, NULL, 0);
+			break;
+
 		case ':':
 			fprintf(stderr, "Option `%s' requires a value\n",
 				argv[optind]);
@@ -579,6 +692,10 @@ int main(int argc, char **argv)
 				}
 			}
 		}
+		if (curr_bd) {
+			index_regs(curr_bd->regs, curr_bd->regs_size, curr_bd->prefix);
+			index_regs(curr_bd->alt_regs, curr_bd->alt_regs_size, curr_bd->prefix);
+		}
 	}
 
 	/* Set options */
@@ -589,7 +706,7 @@ int main(int argc, char **argv)
 			usage();
 			exit(1);
 		}
-		set_reg.reg = parse_reg(curr_bd, reg_set_arg);
+		set_reg.reg = parse_reg(reg_set_arg);
 		while (optind < argc) {
 			unsigned size = 0;
 
@@ -600,7 +717,7 @@ int main(int argc, char **argv)
 			set_reg.val = strtoull(argv[optind++], NULL, 0);
 			if (doioctl(fd, VIDIOC_DBG_S_REGISTER, &set_reg,
 						"VIDIOC_DBG_S_REGISTER") >= 0) {
-				const char *name = reg_name(curr_bd, set_reg.reg);
+				const char *name = reg_name(set_reg.reg);
 
 				printf("Register ");
 
@@ -641,12 +758,12 @@ int main(int argc, char **argv)
 		printf("ioctl: VIDIOC_DBG_G_REGISTER\n");
 
 		for (const auto &reg : get_regs) {
-			get_reg.reg = parse_reg(curr_bd, reg);
+			get_reg.reg = parse_reg(reg);
 			if (ioctl(fd, VIDIOC_DBG_G_REGISTER, &get_reg) < 0)
 				fprintf(stderr, "ioctl: VIDIOC_DBG_G_REGISTER "
 						"failed for 0x%llx\n", get_reg.reg);
 			else {
-				const char *name = reg_name(curr_bd, get_reg.reg);
+				const char *name = reg_name(get_reg.reg);
 
 				printf("Register ");
 
@@ -677,13 +794,13 @@ int main(int argc, char **argv)
 			if (reg_min_arg.empty())
 				reg_min = 0;
 			else
-				reg_min = parse_reg(curr_bd, reg_min_arg);
+				reg_min = parse_reg(reg_min_arg);
 
 
 			if (reg_max_arg.empty())
 				reg_max = (1ll << 32) - 1;
 			else
-				reg_max = parse_reg(curr_bd, reg_max_arg);
+				reg_max = parse_reg(reg_max_arg);
 
 			for (int i = 0; i < curr_bd->regs_size; i++) {
 				if (reg_min_arg.empty() || ((curr_bd->regs[i].reg >= reg_min) && curr_bd->regs[i].reg <= reg_max)) {
@@ -693,7 +810,7 @@ int main(int argc, char **argv)
 						fprintf(stderr, "ioctl: VIDIOC_DBG_G_REGISTER "
 								"failed for 0x%llx\n", get_reg.reg);
 					else {
-						const char *name = reg_name(curr_bd, get_reg.reg);
+						const char *name = reg_name(get_reg.reg);
 
 						printf("Register ");
 
@@ -704,6 +821,7 @@ int main(int argc, char **argv)
 
 						printf(" = %llxh (%lldd  %sb)\n",
 							get_reg.val, get_reg.val, binary(get_reg.val));
+						snapshot_add(watch, get_reg.reg, get_reg.val, true);
 					}
 				}
 			}
@@ -711,13 +829,13 @@ int main(int argc, char **argv)
 		}
 
 		if (!reg_min_arg.empty()) {
-			reg_min = parse_reg(curr_bd, reg_min_arg);
+			reg_min = parse_reg(reg_min_arg);
 			if (reg_max_arg.empty())
 				reg_max = reg_min + 0xff;
 			else
-				reg_max = parse_reg(curr_bd, reg_max_arg);
+				reg_max = parse_reg(reg_max_arg);
 			/* Explicit memory range: just do it */
-			print_regs(fd, &get_reg, reg_min, reg_max, stride);
+			print_regs(fd, &get_reg, reg_min, reg_max, stride, watch);
 			goto list_done;
 		}
 
@@ -727,38 +845,41 @@ int main(int argc, char **argv)
 		name = chip_info.name;
 
 		if (name == "saa7115") {
-			print_regs(fd, &get_reg, 0, 0xff, stride);
+			print_regs(fd, &get_reg, 0, 0xff, stride, watch);
 		} else if (name == "saa717x") {
 			// FIXME: use correct reg regions
-			print_regs(fd, &get_reg, 0, 0xff, stride);
+			print_regs(fd, &get_reg, 0, 0xff, stride, watch);
 		} else if (name == "saa7127") {
-			print_regs(fd, &get_reg, 0, 0x7f, stride);
+			print_regs(fd, &get_reg, 0, 0x7f, stride, watch);
 		} else if (name == "ov7670") {
-			print_regs(fd, &get_reg, 0, 0x89, stride);
+			print_regs(fd, &get_reg, 0, 0x89, stride, watch);
 		} else if (name == "cx25840") {
-			print_regs(fd, &get_reg, 0, 2, stride);
-			print_regs(fd, &get_reg, 0x100, 0x15f, stride);
-			print_regs(fd, &get_reg, 0x200, 0x23f, stride);
-			print_regs(fd, &get_reg, 0x400, 0x4bf, stride);
-			print_regs(fd, &get_reg, 0x800, 0x9af, stride);
+			print_regs(fd, &get_reg, 0, 2, stride, watch);
+			print_regs(fd, &get_reg, 0x100, 0x15f, stride, watch);
+			print_regs(fd, &get_reg, 0x200, 0x23f, stride, watch);
+			print_regs(fd, &get_reg, 0x400, 0x4bf, stride, watch);
+			print_regs(fd, &get_reg, 0x800, 0x9af, stride, watch);
 		} else if (name == "cs5345") {
-			print_regs(fd, &get_reg, 1, 0x10, stride);
+			print_regs(fd, &get_reg, 1, 0x10, stride, watch);
 		} else if (name == "cx23416") {
-			print_regs(fd, &get_reg, 0x02000000, 0x020000ff, stride);
+			print_regs(fd, &get_reg, 0x02000000, 0x020000ff, stride, watch);
 		} else if (name == "cx23418") {
-			print_regs(fd, &get_reg, 0x02c40000, 0x02c409c7, stride);
+			print_regs(fd, &get_reg, 0x02c40000, 0x02c409c7, stride, watch);
 		} else if (name == "cafe") {
-			print_regs(fd, &get_reg, 0, 0x43, stride);
-			print_regs(fd, &get_reg, 0x88, 0x8f, stride);
-			print_regs(fd, &get_reg, 0xb4, 0xbb, stride);
-			print_regs(fd, &get_reg, 0x3000, 0x300c, stride);
+			print_regs(fd, &get_reg, 0, 0x43, stride, watch);
+			print_regs(fd, &get_reg, 0x88, 0x8f, stride, watch);
+			print_regs(fd, &get_reg, 0xb4, 0xbb, stride, watch);
+			print_regs(fd, &get_reg, 0x3000, 0x300c, stride, watch);
 		} else {
 			/* unknown chip, dump 0-0xff by default */
-			print_regs(fd, &get_reg, 0, 0xff, stride);
+			print_regs(fd, &get_reg, 0, 0xff, stride, watch);
 		}
 	}
 list_done:
 
+	if (options[OptWatch] && !watch.regs.empty())
+		watch_regs(fd, &get_reg, watch, watch_interval);
+
 	if (options[OptLogStatus]) {
 		static char buf[40960];
 		int len = -1;